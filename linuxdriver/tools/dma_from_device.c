@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include "dma_utils.c"
+#include "uring_utils.c"
 
 #define DEVICE_NAME_DEFAULT "/dev/xdma0_c2h_0"
 #define SIZE_DEFAULT (32)
@@ -43,6 +44,9 @@ static struct option const long_opts[] = {
 	{"eop_flush", no_argument, NULL, 'e'},
 	{"help", no_argument, NULL, 'h'},
 	{"verbose", no_argument, NULL, 'v'},
+	{"queue_depth", required_argument, NULL, 'q'},
+	{"registered", no_argument, NULL, 'R'},
+	{"sweep", no_argument, NULL, 'S'},
 	{0, 0, 0, 0}
 };
 
@@ -95,6 +99,16 @@ static void usage(const char *name)
 	fprintf(stdout, "  -%c (--%s) verbose output\n",
 		long_opts[i].val, long_opts[i].name);
 	i++;
+	fprintf(stdout, "  -%c (--%s) io_uring mode: keep this many transfers in flight\n",
+		long_opts[i].val, long_opts[i].name);
+	fprintf(stdout, "\t\t* -d can then be a comma separated list of devices\n");
+	i++;
+	fprintf(stdout, "  -%c (--%s) io_uring mode: use registered buffers\n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) io_uring mode: run at depths 1, 2, 4 ... -q\n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
 
 	fprintf(stdout, "\nReturn code:\n");
 	fprintf(stdout, "  0: all bytes were dma'ed successfully\n");
@@ -112,8 +126,11 @@ int main(int argc, char *argv[])
 	uint64_t offset = 0;
 	uint64_t count = COUNT_DEFAULT;
 	char *ofname = NULL;
+	uint32_t queue_depth = 0;
+	int registered = 0;
+	int sweep = 0;
 
-	while ((cmd_opt = getopt_long(argc, argv, "vhec:f:d:a:k:s:o:", long_opts,
+	while ((cmd_opt = getopt_long(argc, argv, "vheRSc:f:d:a:k:s:o:q:", long_opts,
 			    NULL)) != -1) {
 		switch (cmd_opt) {
 		case 0:
@@ -153,6 +170,15 @@ int main(int argc, char *argv[])
 		case 'e':
 			eop_flush = 1;
 			break;
+		case 'q':
+			queue_depth = getopt_integer(optarg);
+			break;
+		case 'R':
+			registered = 1;
+			break;
+		case 'S':
+			sweep = 1;
+			break;
 		case 'h':
 		default:
 			usage(argv[0]);
@@ -166,6 +192,9 @@ int main(int argc, char *argv[])
 		"count %lu\n",
 		device, address, aperture, size, offset, count);
 
+	if (queue_depth)
+		return uring_test(device, 0, address, size, count, queue_depth,
+				  registered, sweep, NULL);
 	return test_dma(device, address, aperture, size, offset, count, ofname);
 }
 
@@ -28,6 +28,7 @@
 #include <unistd.h>
 
 #include "dma_utils.c"
+#include "uring_utils.c"
 
 static struct option const long_opts[] = {
 	{"device", required_argument, NULL, 'd'},
@@ -40,6 +41,9 @@ static struct option const long_opts[] = {
 	{"data outfile", required_argument, NULL, 'w'},
 	{"help", no_argument, NULL, 'h'},
 	{"verbose", no_argument, NULL, 'v'},
+	{"queue_depth", required_argument, NULL, 'q'},
+	{"registered", no_argument, NULL, 'R'},
+	{"sweep", no_argument, NULL, 'S'},
 	{0, 0, 0, 0}
 };
 
@@ -93,6 +97,17 @@ static void usage(const char *name)
 	fprintf(stdout, "  -%c (--%s) verbose output\n",
 		long_opts[i].val, long_opts[i].name);
 	i++;
+	fprintf(stdout, "  -%c (--%s) io_uring mode: keep this many transfers in flight\n",
+		long_opts[i].val, long_opts[i].name);
+	fprintf(stdout, "\t\t* -d can then be a comma separated list of devices\n");
+	fprintf(stdout, "\t\t* every transfer writes the first -s bytes of -f\n");
+	i++;
+	fprintf(stdout, "  -%c (--%s) io_uring mode: use registered buffers\n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
+	fprintf(stdout, "  -%c (--%s) io_uring mode: run at depths 1, 2, 4 ... -q\n",
+		long_opts[i].val, long_opts[i].name);
+	i++;
 
 	fprintf(stdout, "\nReturn code:\n");
 	fprintf(stdout, "  0: all bytes were dma'ed successfully\n");
@@ -110,9 +125,12 @@ int main(int argc, char *argv[])
 	uint64_t count = COUNT_DEFAULT;
 	char *infname = NULL;
 	char *ofname = NULL;
+	uint32_t queue_depth = 0;
+	int registered = 0;
+	int sweep = 0;
 
 	while ((cmd_opt =
-		getopt_long(argc, argv, "vhc:f:d:a:k:s:o:w:", long_opts,
+		getopt_long(argc, argv, "vhRSc:f:d:a:k:s:o:w:q:", long_opts,
 			    NULL)) != -1) {
 		switch (cmd_opt) {
 		case 0:
@@ -153,6 +171,15 @@ int main(int argc, char *argv[])
 		case 'v':
 			verbose = 1;
 			break;
+		case 'q':
+			queue_depth = getopt_integer(optarg);
+			break;
+		case 'R':
+			registered = 1;
+			break;
+		case 'S':
+			sweep = 1;
+			break;
 		case 'h':
 		default:
 			usage(argv[0]);
@@ -167,6 +194,9 @@ int main(int argc, char *argv[])
 	        "count %lu\n",
 		device, address, aperture, size, offset, count);
 
+	if (queue_depth)
+		return uring_test(device, 1, address, size, count, queue_depth,
+				  registered, sweep, infname);
 	return test_dma(device, address, aperture, size, offset, count,
 			infname, ofname);
 }
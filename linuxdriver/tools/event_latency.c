@@ -0,0 +1,198 @@
+/*
+ * event_latency: wake-up latency of the XDMA user interrupt event devices
+ * (/dev/xdma0_events_N, cdev_events.c)
+ *
+ * trigger mode (-t): write a user BAR register that the FPGA design routes to
+ * usr_irq_req, then time how long a blocking read of the events device takes
+ * to return. That is the whole path p2app would see with interrupt driven
+ * FIFO waits: the register write, the MSI, the driver's handler and the
+ * wake-up of the sleeping thread. -r writes a register after each event to
+ * drop a level sensitive request again.
+ *
+ * passive mode (no -t): wait for interrupts the design raises by itself and
+ * report the time between events.
+ *
+ * licensed as the Xilinx DMA IP Core driver tools for Linux
+ * (BSD-style license, in the LICENSE file in the root directory of this source tree)
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+
+#include "latency_utils.c"
+
+#define FATAL do { fprintf(stderr, "Error at line %d, file %s (%d) [%s]\n", __LINE__, __FILE__, errno, strerror(errno)); exit(1); } while(0)
+
+#define EVENT_TIMEOUT_MS 1000		/* an event not seen by then is counted as missed */
+
+struct reg_write {
+	int set;
+	off_t address;
+	uint32_t value;
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"\nUsage:\t%s [options] <events device>\n"
+		"\t-c count       : events to time (default 1000)\n"
+		"\t-u device      : user BAR device for -t and -r (default /dev/xdma0_user)\n"
+		"\t-t addr=value  : register write that raises the user interrupt\n"
+		"\t-r addr=value  : register write after each event, to clear the request\n"
+		"\t-i us          : wait between triggers (default 1000)\n"
+		"\twithout -t the events the design raises itself are timed\n\n",
+		name);
+	exit(1);
+}
+
+static int parse_reg_write(const char *arg, struct reg_write *reg)
+{
+	char *end;
+
+	reg->address = strtoul(arg, &end, 0);
+	if (*end != '=')
+		return -1;
+	reg->value = strtoul(end + 1, &end, 0);
+	reg->set = 1;
+	return (*end != 0) || (reg->address & 3);
+}
+
+static void write_register(int fd, struct reg_write *reg)
+{
+	if (pwrite(fd, &reg->value, sizeof(reg->value), reg->address) != sizeof(reg->value))
+		FATAL;
+}
+
+/*
+ * wait for an event: return 1 (the driver's event flag), or 0 if timed out
+ */
+static uint32_t wait_event(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint32_t events = 0;
+	int rc;
+
+	rc = poll(&pfd, 1, EVENT_TIMEOUT_MS);
+	if (rc < 0)
+		FATAL;
+	if (rc == 0)
+		return 0;
+	if (read(fd, &events, sizeof(events)) != sizeof(events))
+		FATAL;
+	return events;
+}
+
+/* read any event already pending, so it isn't taken for the next trigger's */
+static void drain_events(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint32_t events;
+
+	while ((poll(&pfd, 1, 0) > 0) && (read(fd, &events, sizeof(events)) == sizeof(events)))
+		;
+}
+
+int main(int argc, char **argv)
+{
+	struct latency_stats stats;
+	struct reg_write trigger = {0}, clear = {0};
+	char *user_device = "/dev/xdma0_user";
+	uint64_t count = 1000, interval_us = 1000;
+	uint64_t i, start, previous = 0, reads = 0, missed = 0;
+	uint32_t events;
+	int events_fd, user_fd = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:u:t:r:i:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = strtoull(optarg, 0, 0);
+			break;
+		case 'u':
+			user_device = optarg;
+			break;
+		case 't':
+			if (parse_reg_write(optarg, &trigger))
+				usage(argv[0]);
+			break;
+		case 'r':
+			if (parse_reg_write(optarg, &clear))
+				usage(argv[0]);
+			break;
+		case 'i':
+			interval_us = strtoull(optarg, 0, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ((optind >= argc) || (count == 0))
+		usage(argv[0]);
+
+	if ((events_fd = open(argv[optind], O_RDONLY)) == -1)
+		FATAL;
+	if ((trigger.set || clear.set) && ((user_fd = open(user_device, O_RDWR)) == -1))
+		FATAL;
+	if (latency_init(&stats, count) < 0)
+		FATAL;
+
+	if (trigger.set) {
+		printf("%s: %llu events triggered by writing 0x%08x to 0x%08x of %s\n",
+		       argv[optind], (unsigned long long)count, trigger.value,
+		       (unsigned int)trigger.address, user_device);
+		drain_events(events_fd);
+		for (i = 0; i < count; i++) {
+			start = latency_now();
+			write_register(user_fd, &trigger);
+			events = wait_event(events_fd);
+			if (events) {
+				latency_add(&stats, latency_now() - start);
+				reads++;
+			} else
+				missed++;
+			if (clear.set)
+				write_register(user_fd, &clear);
+			if (interval_us)
+				usleep(interval_us);
+			drain_events(events_fd);
+		}
+		latency_print("trigger to wake-up", &stats);
+	} else {
+		printf("%s: timing %llu events raised by the design\n",
+		       argv[optind], (unsigned long long)count);
+		while (reads < count) {
+			events = wait_event(events_fd);
+			if (!events) {
+				missed++;
+				if (missed >= 10 && reads == 0) {
+					printf("no events in %d ms\n", 10 * EVENT_TIMEOUT_MS);
+					break;
+				}
+				continue;
+			}
+			start = latency_now();
+			if (previous)
+				latency_add(&stats, start - previous);
+			previous = start;
+			if (clear.set)
+				write_register(user_fd, &clear);
+			reads++;
+		}
+		latency_print("time between wake-ups", &stats);
+	}
+	printf("%llu wake-ups, %llu timeouts of %d ms\n",
+	       (unsigned long long)reads, (unsigned long long)missed, EVENT_TIMEOUT_MS);
+
+	latency_free(&stats);
+	if (user_fd >= 0)
+		close(user_fd);
+	close(events_fd);
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * latency statistics for the benchmark modes of the tools:
+ * min, mean, percentiles and a log2 histogram of per-access times in ns
+ *
+ * licensed as the Xilinx DMA IP Core driver tools for Linux
+ * (BSD-style license, in the LICENSE file in the root directory of this source tree)
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LATENCY_BUCKETS	32		/* bucket n: 2^n to 2^(n+1)-1 ns */
+#define LATENCY_BAR	50		/* histogram bar width for the fullest bucket */
+
+struct latency_stats {
+	uint64_t *samples;
+	uint64_t count;
+	uint64_t size;
+};
+
+static inline uint64_t latency_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int latency_init(struct latency_stats *stats, uint64_t size)
+{
+	stats->samples = calloc(size ? size : 1, sizeof(uint64_t));
+	stats->count = 0;
+	stats->size = size;
+	return stats->samples ? 0 : -1;
+}
+
+static void latency_free(struct latency_stats *stats)
+{
+	free(stats->samples);
+	stats->samples = NULL;
+}
+
+static inline void latency_add(struct latency_stats *stats, uint64_t ns)
+{
+	if (stats->count < stats->size)
+		stats->samples[stats->count++] = ns;
+}
+
+static int latency_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t latency_percentile(struct latency_stats *stats, unsigned int per_mille)
+{
+	uint64_t index = (stats->count * per_mille) / 1000;
+
+	if (index >= stats->count)
+		index = stats->count - 1;
+	return stats->samples[index];
+}
+
+/* sorts the samples, so call it once all have been added */
+static void latency_print(const char *name, struct latency_stats *stats)
+{
+	uint64_t buckets[LATENCY_BUCKETS] = {0};
+	uint64_t sum = 0;
+	uint64_t peak = 0;
+	uint64_t i;
+	int bucket, first = -1, last = 0;
+
+	if (stats->count == 0) {
+		printf("%s: no samples\n", name);
+		return;
+	}
+	qsort(stats->samples, stats->count, sizeof(uint64_t), latency_compare);
+	for (i = 0; i < stats->count; i++) {
+		sum += stats->samples[i];
+		bucket = stats->samples[i] ? 63 - __builtin_clzll(stats->samples[i]) : 0;
+		if (bucket >= LATENCY_BUCKETS)
+			bucket = LATENCY_BUCKETS - 1;
+		buckets[bucket]++;
+	}
+	printf("%s: %llu samples, ns: min %llu mean %llu p50 %llu p99 %llu p99.9 %llu max %llu\n",
+	       name, (unsigned long long)stats->count,
+	       (unsigned long long)stats->samples[0],
+	       (unsigned long long)(sum / stats->count),
+	       (unsigned long long)latency_percentile(stats, 500),
+	       (unsigned long long)latency_percentile(stats, 990),
+	       (unsigned long long)latency_percentile(stats, 999),
+	       (unsigned long long)stats->samples[stats->count - 1]);
+
+	for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+		if (!buckets[bucket])
+			continue;
+		if (first < 0)
+			first = bucket;
+		last = bucket;
+		if (buckets[bucket] > peak)
+			peak = buckets[bucket];
+	}
+	for (bucket = first; bucket <= last; bucket++) {
+		char bar[LATENCY_BAR + 1];
+		int width = (int)((buckets[bucket] * LATENCY_BAR + peak - 1) / peak);
+
+		memset(bar, '#', width);
+		bar[width] = 0;
+		printf("  %10llu - %10llu ns %10llu %s\n",
+		       bucket ? (unsigned long long)1 << bucket : 0ULL,
+		       ((unsigned long long)2 << bucket) - 1,
+		       (unsigned long long)buckets[bucket], bar);
+	}
+}
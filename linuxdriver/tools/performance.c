@@ -12,12 +12,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <glob.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sys/ioctl.h>
@@ -29,6 +31,40 @@
 
 struct xdma_performance_ioctl perf;
 
+/*
+ * profile mode: sample the per engine performance counters in sysfs while
+ * another application (eg p2app) owns the traffic. The engine clock is the
+ * XDMA AXI clock, 125MHz for the Saturn PCIe configuration.
+ */
+#define PROFILE_INTERVAL_MS 1000
+#define PROFILE_CLOCK_MHZ 125
+#define PROFILE_MAX_ENGINES 8
+#define PROFILE_BOUND_UTIL 90	/* % running above which the engine limits */
+
+struct engine_sample {
+  uint64_t cycles;	/* engine clock cycles running */
+  uint64_t data_cycles;	/* cycles with data transferred */
+  uint64_t pending;	/* cycles with requests pending */
+  uint64_t xfers;
+  uint64_t descs;
+  uint64_t bytes;
+};
+
+struct engine_profile {
+  char path[PATH_MAX];
+  char name[64];
+  struct engine_sample last;
+  double util_sum;	/* sum of per interval utilisation, % */
+  double util_peak;
+  double data_sum;	/* sum of per interval data duty of running time, % */
+  uint64_t bytes;
+  uint64_t xfers;
+  int samples;
+};
+
+static struct engine_profile engines[PROFILE_MAX_ENGINES];
+static int engine_count;
+
 static struct option const long_opts[] =
 {
   {"device", required_argument, NULL, 'd'},
@@ -38,6 +74,9 @@ static struct option const long_opts[] =
   {"non-incremental", no_argument, NULL, 'n'},
   {"verbose", no_argument, NULL, 'v'},
   {"help", no_argument, NULL, 'h'},
+  {"profile", no_argument, NULL, 'p'},
+  {"interval", required_argument, NULL, 't'},
+  {"clock", required_argument, NULL, 'f'},
   {0, 0, 0, 0}
 };
 
@@ -49,10 +88,15 @@ static void usage(const char* name)
   printf("Performance test for XDMA SGDMA engine.\n\n");
 
   printf("  -%c (--%s) device\n", long_opts[i].val, long_opts[i].name); i++;
+  printf("  -%c (--%s) number of reports (samples with --profile)\n", long_opts[i].val, long_opts[i].name); i++;
+  printf("  -%c (--%s) transfer size in bytes\n", long_opts[i].val, long_opts[i].name); i++;
   printf("  -%c (--%s) incremental\n", long_opts[i].val, long_opts[i].name); i++;
   printf("  -%c (--%s) non-incremental\n", long_opts[i].val, long_opts[i].name); i++;
   printf("  -%c (--%s) be more verbose during test\n", long_opts[i].val, long_opts[i].name); i++;
   printf("  -%c (--%s) print usage help and exit\n", long_opts[i].val, long_opts[i].name); i++;
+  printf("  -%c (--%s) profile the live traffic of every engine, no test transfer\n", long_opts[i].val, long_opts[i].name); i++;
+  printf("  -%c (--%s) profile sample interval in ms (default %d)\n", long_opts[i].val, long_opts[i].name, PROFILE_INTERVAL_MS); i++;
+  printf("  -%c (--%s) engine clock in MHz (default %d)\n", long_opts[i].val, long_opts[i].name, PROFILE_CLOCK_MHZ); i++;
 }
 
 static uint32_t getopt_integer(char *optarg)
@@ -67,6 +111,7 @@ static uint32_t getopt_integer(char *optarg)
 }
 
 int test_dma(char *device_name, int size, int count);
+int profile_engines(uint32_t interval_ms, uint32_t clock_mhz, uint32_t count);
 
 static int verbosity = 0;
 
@@ -76,9 +121,12 @@ int main(int argc, char *argv[])
   char *device = "/dev/xdma/card0/h2c0";
   uint32_t size = 32768;
   uint32_t count = 1;
+  uint32_t interval_ms = PROFILE_INTERVAL_MS;
+  uint32_t clock_mhz = PROFILE_CLOCK_MHZ;
+  int profile = 0;
   char *filename = NULL;
 
-  while ((cmd_opt = getopt_long(argc, argv, "vhic:d:s:", long_opts, NULL)) != -1)
+  while ((cmd_opt = getopt_long(argc, argv, "vhipc:d:s:t:f:", long_opts, NULL)) != -1)
   {
     switch (cmd_opt)
     {
@@ -102,6 +150,18 @@ int main(int argc, char *argv[])
         count = getopt_integer(optarg);
 	printf(" count = %d\n", count);
         break;
+      /* profile live traffic */
+      case 'p':
+        profile = 1;
+        break;
+      /* profile interval in ms */
+      case 't':
+        interval_ms = getopt_integer(optarg);
+        break;
+      /* engine clock in MHz */
+      case 'f':
+        clock_mhz = getopt_integer(optarg);
+        break;
       /* print usage help and exit */
       case 'h':
       default:
@@ -110,6 +170,9 @@ int main(int argc, char *argv[])
         break;
     }
   }
+  if (profile)
+    return profile_engines(interval_ms ? interval_ms : PROFILE_INTERVAL_MS,
+                           clock_mhz ? clock_mhz : PROFILE_CLOCK_MHZ, count);
   printf("device = %s, size = 0x%08x, count = %u\n", device, size, count);
   test_dma(device, size, count);
 
@@ -173,3 +236,160 @@ int test_dma(char *device_name, int size, int count)
 
   close(fd);
 }
+
+static int read_engine_sample(struct engine_profile *engine, struct engine_sample *sample)
+{
+  FILE *file = fopen(engine->path, "r");
+  int rc;
+
+  if (!file)
+    return -1;
+  rc = fscanf(file, "%llu %llu %llu %llu %llu %llu",
+              (unsigned long long *)&sample->cycles, (unsigned long long *)&sample->data_cycles,
+              (unsigned long long *)&sample->pending, (unsigned long long *)&sample->xfers,
+              (unsigned long long *)&sample->descs, (unsigned long long *)&sample->bytes);
+  fclose(file);
+  return (rc == 6) ? 0 : -1;
+}
+
+/* start (1) or stop (0) the counters; the driver reports errors on close */
+static int run_engine_counters(struct engine_profile *engine, int run)
+{
+  FILE *file = fopen(engine->path, "w");
+  int rc;
+
+  if (!file)
+    return -1;
+  rc = fprintf(file, "%d\n", run);
+  if (fclose(file) != 0)
+    rc = -1;
+  return (rc < 0) ? -1 : 0;
+}
+
+static int find_engines(void)
+{
+  glob_t found;
+  size_t i;
+  char *name;
+
+  if (glob("/sys/class/xdma/xdma*_h2c_*/perf_counters", 0, NULL, &found) == GLOB_NOSPACE)
+    return 0;
+  glob("/sys/class/xdma/xdma*_c2h_*/perf_counters", GLOB_APPEND, NULL, &found);
+  for (i = 0; (i < found.gl_pathc) && (engine_count < PROFILE_MAX_ENGINES); i++) {
+    struct engine_profile *engine = &engines[engine_count];
+
+    snprintf(engine->path, sizeof(engine->path), "%s", found.gl_pathv[i]);
+    name = strstr(found.gl_pathv[i], "/xdma/") + strlen("/xdma/");
+    snprintf(engine->name, sizeof(engine->name), "%.*s",
+             (int)(strchr(name, '/') - name), name);
+    if (run_engine_counters(engine, 1) < 0) {
+      printf("%s: could not start counters: %s\n", engine->name, strerror(errno));
+      continue;
+    }
+    if (read_engine_sample(engine, &engine->last) < 0)
+      continue;
+    engine_count++;
+  }
+  globfree(&found);
+  return engine_count;
+}
+
+static double get_seconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1.0e-9;
+}
+
+/*
+ * profile the live engine traffic: every interval print, per engine, the
+ * share of time it was running, the share of its running time moving data,
+ * the data rate and the mean idle gap between transfers. A stream whose
+ * engine is running nearly all the time is limited by PCIe/DMA; one whose
+ * engine sits idle is limited by the software feeding it.
+ */
+int profile_engines(uint32_t interval_ms, uint32_t clock_mhz, uint32_t count)
+{
+  struct engine_sample sample;
+  double start, last, now, interval, wall_cycles;
+  double util, data, rate, gap_us;
+  uint32_t n;
+  int i;
+
+  if (find_engines() == 0) {
+    printf("FAILURE: no engine perf_counters found in /sys/class/xdma. Make sure the xdma driver is loaded and you have access rights (maybe use sudo?).\n");
+    return 1;
+  }
+  printf("profiling %d engines: %u samples of %u ms, engine clock %u MHz\n",
+         engine_count, count, interval_ms, clock_mhz);
+  printf("%8s %-14s %7s %7s %10s %9s %10s\n", "time", "engine", "busy%", "data%",
+         "MB/s", "xfers/s", "gap us");
+
+  start = last = get_seconds();
+  for (n = 0; n < count; n++) {
+    usleep(interval_ms * 1000);
+    now = get_seconds();
+    interval = now - last;
+    last = now;
+    wall_cycles = interval * clock_mhz * 1.0e6;
+
+    for (i = 0; i < engine_count; i++) {
+      struct engine_profile *engine = &engines[i];
+      uint64_t cycles, xfers, bytes;
+
+      if (read_engine_sample(engine, &sample) < 0)
+        continue;
+      cycles = sample.cycles - engine->last.cycles;
+      xfers = sample.xfers - engine->last.xfers;
+      bytes = sample.bytes - engine->last.bytes;
+      util = cycles * 100.0 / wall_cycles;
+      if (util > 100.0)
+        util = 100.0;
+      data = cycles ? (sample.data_cycles - engine->last.data_cycles) * 100.0 / cycles : 0.0;
+      rate = bytes / interval / 1.0e6;
+      /* mean idle time between transfers */
+      gap_us = xfers ? interval * (100.0 - util) / 100.0 / xfers * 1.0e6 : interval * 1.0e6;
+      printf("%8.2f %-14s %7.1f %7.1f %10.2f %9.0f %10.1f\n", now - start, engine->name,
+             util, data, rate, xfers / interval, gap_us);
+      if (verbosity)
+        printf("%8s %-14s pending cycles %llu, descriptors/xfer %.1f\n", "", "",
+               (unsigned long long)(sample.pending - engine->last.pending),
+               xfers ? (double)(sample.descs - engine->last.descs) / xfers : 0.0);
+
+      engine->util_sum += util;
+      if (util > engine->util_peak)
+        engine->util_peak = util;
+      engine->data_sum += data;
+      engine->bytes += bytes;
+      engine->xfers += xfers;
+      engine->samples++;
+      engine->last = sample;
+    }
+  }
+
+  printf("\nsummary over %.1f s:\n", last - start);
+  printf("%-14s %9s %9s %10s %10s  %s\n", "engine", "mean busy", "peak busy", "MB/s",
+         "xfers", "limit");
+  for (i = 0; i < engine_count; i++) {
+    struct engine_profile *engine = &engines[i];
+    const char *limit;
+
+    run_engine_counters(engine, 0);
+    if (!engine->samples)
+      continue;
+    util = engine->util_sum / engine->samples;
+    data = engine->data_sum / engine->samples;
+    if (engine->xfers == 0)
+      limit = "idle";
+    else if (util < PROFILE_BOUND_UTIL)
+      limit = "software: engine waits for transfers";
+    else if (data < 50.0)
+      limit = "PCIe: engine running, waiting for the link";
+    else
+      limit = "DMA: engine moving data nearly all the time";
+    printf("%-14s %8.1f%% %8.1f%% %10.2f %10llu  %s\n", engine->name, util, engine->util_peak,
+           engine->bytes / (last - start) / 1.0e6, (unsigned long long)engine->xfers, limit);
+  }
+  return 0;
+}
@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <termios.h>
+#include <getopt.h>
 
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -42,6 +43,62 @@
 #define MAP_SIZE (32*1024UL)
 #define MAP_MASK (MAP_SIZE - 1)
 
+#include "latency_utils.c"
+
+/*
+ * benchmark: count back-to-back 32 bit accesses of one register, first with
+ * pread/pwrite on the device, then with loads/stores to the mapped BAR,
+ * timing each one. A write benchmark writes writeval every time.
+ */
+static int benchmark(int fd, void *virt_addr, off_t target, int write,
+		     uint32_t writeval, uint64_t count)
+{
+	struct latency_stats stats;
+	volatile uint32_t *reg = (volatile uint32_t *)virt_addr;
+	uint32_t value = htoll(writeval);
+	uint64_t i, start, begin, elapsed;
+	ssize_t rc;
+
+	if (latency_init(&stats, count) < 0)
+		FATAL;
+	printf("benchmark: %llu 32 bit %ss of 0x%08x\n",
+	       (unsigned long long)count, write ? "write" : "read",
+	       (unsigned int)target);
+
+	begin = latency_now();
+	for (i = 0; i < count; i++) {
+		start = latency_now();
+		if (write)
+			rc = pwrite(fd, &value, sizeof(value), target);
+		else
+			rc = pread(fd, &value, sizeof(value), target);
+		latency_add(&stats, latency_now() - start);
+		if (rc != sizeof(value))
+			FATAL;
+	}
+	elapsed = latency_now() - begin;
+	latency_print(write ? "pwrite" : "pread", &stats);
+	printf("  %.0f accesses/s\n\n", (double)count * 1e9 / elapsed);
+
+	stats.count = 0;
+	begin = latency_now();
+	for (i = 0; i < count; i++) {
+		start = latency_now();
+		if (write)
+			*reg = value;
+		else
+			value = *reg;
+		latency_add(&stats, latency_now() - start);
+	}
+	elapsed = latency_now() - begin;
+	latency_print(write ? "mmap store" : "mmap load", &stats);
+	printf("  %.0f accesses/s\n", (double)count * 1e9 / elapsed);
+	if (!write)
+		printf("last value read: 0x%08x\n", (unsigned int)ltohl(value));
+	latency_free(&stats);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	int fd;
@@ -51,16 +108,32 @@ int main(int argc, char **argv)
 	/* access width */
 	int access_width = 'w';
 	char *device;
+	/* benchmark accesses, 0 for one access */
+	uint64_t bench_count = 0;
+	char *prog = argv[0];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		if (opt == 'n')
+			bench_count = strtoull(optarg, 0, 0);
+		else
+			argc = 0;
+	}
+	/* the positional arguments then start at argv[1] as before */
+	argv += optind - 1;
+	argc -= optind - 1;
 
 	/* not enough arguments given? */
 	if (argc < 3) {
 		fprintf(stderr,
-			"\nUsage:\t%s <device> <address> [[type] data]\n"
+			"\nUsage:\t%s [-n count] <device> <address> [[type] data]\n"
+			"\t-n count: benchmark count back-to-back accesses through pread/pwrite\n"
+			"\t          and through the mapped BAR, with a latency histogram (32 bit only)\n"
 			"\tdevice  : character device to access\n"
 			"\taddress : memory address to access\n"
 			"\ttype    : access operation type : [b]yte, [h]alfword, [w]ord\n"
 			"\tdata    : data to be written for a write\n\n",
-			argv[0]);
+			prog);
 		exit(1);
 	}
 
@@ -104,6 +177,18 @@ int main(int argc, char **argv)
 
 	/* calculate the virtual address to be accessed */
 	virt_addr = map_base + target;
+
+	if (bench_count) {
+		if ((access_width != 'w') || (target & 3) || (target >= MAP_SIZE)) {
+			fprintf(stderr, "benchmark: 32 bit aligned accesses below 0x%lx only\n", MAP_SIZE);
+			exit(2);
+		}
+		benchmark(fd, virt_addr, target, argc >= 5,
+			  argc >= 5 ? strtoul(argv[4], 0, 0) : 0, bench_count);
+		munmap(map_base, MAP_SIZE);
+		close(fd);
+		return 0;
+	}
 	/* read only */
 	if (argc <= 4) {
 		//printf("Read from address %p.\n", virt_addr); 
@@ -0,0 +1,336 @@
+/*
+ * io_uring mode of dma_to_device and dma_from_device: keep a queue of
+ * transfers in flight on one or more SGDMA devices, and report IOPS,
+ * throughput and the latency of each transfer
+ *
+ * the ring is set up by hand with the raw system calls (as OutDDCRecord.c
+ * in p2app does), so no liburing is needed. Transfers go through the
+ * driver's asynchronous read_iter/write_iter path; with registered buffers
+ * they are IORING_OP_READ_FIXED/WRITE_FIXED, so the kernel doesn't map the
+ * user pages for each one.
+ *
+ * licensed as the Xilinx DMA IP Core driver tools for Linux
+ * (BSD-style license, in the LICENSE file in the root directory of this source tree)
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "latency_utils.c"
+
+#define URING_MAX_DEVICES 8
+#define URING_MAX_DEPTH 256
+#define URING_KNEE_GAIN 5		/* % more throughput a doubled depth must give to be scaling */
+
+struct uring_queue {
+	int fd;
+	uint32_t *sq_head, *sq_tail, *sq_array;
+	uint32_t sq_mask;
+	struct io_uring_sqe *sqes;
+	uint32_t *cq_head, *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+struct uring_result {
+	uint32_t depth;
+	double iops;
+	double mbps;
+	uint64_t p50, p99;
+	uint64_t errors;
+};
+
+static int uring_open(struct uring_queue *q, uint32_t entries)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	q->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (q->fd < 0)
+		return -errno;
+	q->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	q->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (q->cq_ring_size > q->sq_ring_size)
+			q->sq_ring_size = q->cq_ring_size;
+		q->cq_ring_size = q->sq_ring_size;
+	}
+	q->sq_ring = mmap(NULL, q->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_SQ_RING);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		q->cq_ring = q->sq_ring;
+	else
+		q->cq_ring = mmap(NULL, q->cq_ring_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_CQ_RING);
+	q->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	q->sqes = mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_SQES);
+	if (q->sq_ring == MAP_FAILED || q->cq_ring == MAP_FAILED || q->sqes == MAP_FAILED) {
+		close(q->fd);
+		q->fd = -1;
+		return -ENOMEM;
+	}
+	sq = q->sq_ring;
+	cq = q->cq_ring;
+	q->sq_head = (uint32_t *)(sq + p.sq_off.head);
+	q->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	q->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	q->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	q->cq_head = (uint32_t *)(cq + p.cq_off.head);
+	q->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	q->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	q->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+static void uring_close(struct uring_queue *q)
+{
+	if (q->fd < 0)
+		return;
+	munmap(q->sqes, q->sqes_size);
+	if (q->cq_ring != q->sq_ring)
+		munmap(q->cq_ring, q->cq_ring_size);
+	munmap(q->sq_ring, q->sq_ring_size);
+	close(q->fd);
+	q->fd = -1;
+}
+
+/* queue one transfer: slot is its buffer and the completion's user_data */
+static void uring_queue_transfer(struct uring_queue *q, int fd, int write, int fixed,
+				 uint32_t slot, char *buffer, uint64_t size, uint64_t addr)
+{
+	uint32_t tail = *q->sq_tail;
+	uint32_t index = tail & q->sq_mask;
+	struct io_uring_sqe *sqe = q->sqes + index;
+
+	memset(sqe, 0, sizeof(*sqe));
+	if (fixed)
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+	else
+		sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buffer;
+	sqe->len = size;
+	sqe->off = addr;
+	if (fixed)
+		sqe->buf_index = slot;
+	sqe->user_data = slot;
+	q->sq_array[index] = index;
+	__atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * one run at a queue depth: count transfers of size bytes, cycling through the devices
+ */
+static int uring_run(struct uring_queue *q, int *fds, int ndev, int write, int fixed,
+		     char **buffers, uint64_t addr, uint64_t size, uint64_t count,
+		     uint32_t depth, struct uring_result *result)
+{
+	struct latency_stats stats;
+	uint64_t start_ns[URING_MAX_DEPTH];
+	uint32_t free_slots[URING_MAX_DEPTH], nfree;
+	uint64_t queued = 0, done = 0, bytes = 0, begin, elapsed;
+	uint32_t slot, head, tail, to_submit = 0;
+	int rc;
+
+	if (latency_init(&stats, count) < 0)
+		return -ENOMEM;
+	memset(result, 0, sizeof(*result));
+	result->depth = depth;
+	/* transfers needn't finish in order, so each takes a free buffer */
+	for (nfree = 0; nfree < depth; nfree++)
+		free_slots[nfree] = depth - 1 - nfree;
+
+	begin = latency_now();
+	while (done < count) {
+		/* top the queue up to depth */
+		while ((queued < count) && (queued - done < depth)) {
+			slot = free_slots[--nfree];
+			start_ns[slot] = latency_now();
+			uring_queue_transfer(q, fds[queued % ndev], write, fixed, slot,
+					     buffers[slot], size, addr);
+			queued++;
+			to_submit++;
+		}
+		rc = syscall(__NR_io_uring_enter, q->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rc < 0 && errno != EINTR) {
+			perror("io_uring_enter");
+			latency_free(&stats);
+			return -errno;
+		}
+		if (rc > 0)
+			to_submit -= rc;
+		/* reap */
+		head = *q->cq_head;
+		tail = __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			struct io_uring_cqe *cqe = q->cqes + (head & q->cq_mask);
+
+			slot = (uint32_t)cqe->user_data;
+			latency_add(&stats, latency_now() - start_ns[slot]);
+			if (cqe->res == (int)size)
+				bytes += size;
+			else {
+				if (!result->errors)
+					fprintf(stderr, "transfer %s\n",
+						cqe->res < 0 ? strerror(-cqe->res) : "short");
+				result->errors++;
+			}
+			free_slots[nfree++] = slot;
+			done++;
+			head++;
+		}
+		__atomic_store_n(q->cq_head, head, __ATOMIC_RELEASE);
+	}
+	elapsed = latency_now() - begin;
+
+	printf("queue depth %u: %llu transfers of %llu bytes on %d device%s%s\n",
+	       depth, (unsigned long long)count, (unsigned long long)size, ndev,
+	       ndev > 1 ? "s" : "", fixed ? ", registered buffers" : "");
+	latency_print("transfer latency", &stats);
+	result->iops = (double)count * 1e9 / elapsed;
+	result->mbps = (double)bytes * 1e3 / elapsed;
+	result->p50 = latency_percentile(&stats, 500);
+	result->p99 = latency_percentile(&stats, 990);
+	printf("  %.0f IOPS, %.2f MB/s, %llu errors\n\n", result->iops, result->mbps,
+	       (unsigned long long)result->errors);
+	latency_free(&stats);
+	return 0;
+}
+
+/*
+ * the io_uring test. devnames is a comma separated list of devices.
+ * with sweep, run at depths 1, 2, 4 ... depth and report where throughput stops scaling
+ */
+static int uring_test(char *devnames, int write, uint64_t addr, uint64_t size,
+		      uint64_t count, uint32_t depth, int fixed, int sweep, char *infname)
+{
+	struct uring_queue q = { .fd = -1 };
+	struct uring_result results[10];
+	struct iovec iov[URING_MAX_DEPTH];
+	char *buffers[URING_MAX_DEPTH] = {0};
+	int fds[URING_MAX_DEVICES];
+	int ndev = 0, nresults = 0, rc = 0, i, infile_fd;
+	uint32_t run_depth;
+	char *name, *names = strdup(devnames);
+
+	if (depth == 0 || depth > URING_MAX_DEPTH || size == 0 || count == 0) {
+		fprintf(stderr, "queue depth must be 1 to %d, size and count not 0\n", URING_MAX_DEPTH);
+		return -EINVAL;
+	}
+	for (name = strtok(names, ","); name; name = strtok(NULL, ",")) {
+		if (ndev == URING_MAX_DEVICES) {
+			fprintf(stderr, "no more than %d devices\n", URING_MAX_DEVICES);
+			rc = -EINVAL;
+			goto out;
+		}
+		fds[ndev] = open(name, O_RDWR);
+		if (fds[ndev] < 0) {
+			fprintf(stderr, "unable to open device %s.\n", name);
+			perror("open device");
+			rc = -EINVAL;
+			goto out;
+		}
+		ndev++;
+	}
+	if (ndev == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < (int)depth; i++) {
+		if (posix_memalign((void **)&buffers[i], 4096, size)) {
+			fprintf(stderr, "OOM %lu.\n", size);
+			rc = -ENOMEM;
+			goto out;
+		}
+		memset(buffers[i], i, size);
+		iov[i].iov_base = buffers[i];
+		iov[i].iov_len = size;
+	}
+	if (write && infname) {
+		infile_fd = open(infname, O_RDONLY);
+		if (infile_fd < 0) {
+			perror("open input file");
+			rc = -EINVAL;
+			goto out;
+		}
+		rc = read_to_buffer(infname, infile_fd, buffers[0], size, 0);
+		close(infile_fd);
+		if (rc < 0)
+			goto out;
+		for (i = 1; i < (int)depth; i++)
+			memcpy(buffers[i], buffers[0], size);
+		rc = 0;
+	}
+
+	rc = uring_open(&q, depth);
+	if (rc < 0) {
+		fprintf(stderr, "io_uring not available: %s\n", strerror(-rc));
+		goto out;
+	}
+	if (fixed && syscall(__NR_io_uring_register, q.fd, IORING_REGISTER_BUFFERS, iov, depth) < 0) {
+		perror("io_uring register buffers");
+		rc = -errno;
+		goto out;
+	}
+
+	for (run_depth = sweep ? 1 : depth; run_depth <= depth; run_depth *= 2) {
+		rc = uring_run(&q, fds, ndev, write, fixed, buffers, addr, size, count,
+			       run_depth, results + nresults);
+		if (rc < 0)
+			goto out;
+		nresults++;
+		if (run_depth * 2 > depth && run_depth != depth && sweep) {
+			/* end on the depth asked for, if not a power of two */
+			rc = uring_run(&q, fds, ndev, write, fixed, buffers, addr, size, count,
+				       depth, results + nresults);
+			if (rc < 0)
+				goto out;
+			nresults++;
+			break;
+		}
+	}
+
+	if (nresults > 1) {
+		int knee = -1;
+
+		printf("depth       IOPS       MB/s   p50 ns   p99 ns  errors\n");
+		for (i = 0; i < nresults; i++) {
+			printf("%5u %10.0f %10.2f %8llu %8llu %7llu\n", results[i].depth,
+			       results[i].iops, results[i].mbps,
+			       (unsigned long long)results[i].p50,
+			       (unsigned long long)results[i].p99,
+			       (unsigned long long)results[i].errors);
+			if (knee < 0 && i > 0 &&
+			    results[i].mbps * 100 < results[i - 1].mbps * (100 + URING_KNEE_GAIN))
+				knee = i - 1;
+		}
+		if (knee >= 0)
+			printf("throughput stops scaling beyond queue depth %u (%d%% or less gain)\n",
+			       results[knee].depth, URING_KNEE_GAIN);
+		else
+			printf("throughput still scaling at queue depth %u\n", results[nresults - 1].depth);
+	}
+
+out:
+	uring_close(&q);
+	for (i = 0; i < URING_MAX_DEPTH; i++)
+		free(buffers[i]);
+	while (ndev > 0)
+		close(fds[--ndev]);
+	free(names);
+	return rc;
+}
@@ -84,4 +84,11 @@ struct xdma_ioc_info {
 #define IOCTL_XDMA_ADDRMODE_GET	_IOR('q', 5, int)
 #define IOCTL_XDMA_ALIGN_GET	_IOR('q', 6, int)
 
+/*
+ * mmap() offset flag: a map of the user or bypass BAR at offset
+ * (XDMA_MMAP_WC_OFFSET | off) is of the same range as offset off, but
+ * write-combined. Only for BARs no larger than the flag.
+ */
+#define XDMA_MMAP_WC_OFFSET	0x40000000UL
+
 #endif /* _XDMA_IOCALLS_POSIX_H_ */
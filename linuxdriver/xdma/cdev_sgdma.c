@@ -353,6 +353,152 @@ err_out:
 	return rv;
 }
 
+/*
+ * persistent DMA buffer: user pages pinned and DMA mapped for as long as it
+ * is registered, with a few prepared descriptor chains. p2app uses a handful
+ * of fixed transfer sizes per device, so a few chains cover them; the least
+ * recently used one is rebuilt when a new size or address turns up.
+ * read() and write() of data inside a buffer registered through the same
+ * file use it too, so they skip pinning the user pages.
+ */
+#define XDMA_PINNED_BUF_CHAINS	4
+#define XDMA_PINNED_BUF_MAX_LEN	(4 * 1024 * 1024)
+
+struct xdma_pinned_buf {
+	struct file *owner;		/* file it was registered through */
+	struct xdma_io_cb cb;		/* pinned pages and mapped sg table */
+	struct xdma_desc_chain chains[XDMA_PINNED_BUF_CHAINS];
+};
+
+static void pinned_buf_release(struct xdma_cdev *xcdev,
+			       struct xdma_pinned_buf *pbuf)
+{
+	struct xdma_engine *engine = xcdev->engine;
+	int i;
+
+	for (i = 0; i < XDMA_PINNED_BUF_CHAINS; i++)
+		xdma_chain_free(engine, pbuf->chains + i);
+	dma_unmap_sg(&xcdev->xdev->pdev->dev, pbuf->cb.sgt.sgl,
+		     pbuf->cb.sgt.orig_nents, engine->dir);
+	char_sgdma_unmap_user_buf(&pbuf->cb, pbuf->cb.write);
+	kfree(pbuf);
+}
+
+/*
+ * cache maintenance for the part of a registered buffer being transferred:
+ * the mapping is kept, so it is synced around each transfer instead
+ */
+static void pinned_buf_sync(struct device *dev, struct xdma_pinned_buf *pbuf,
+			    u32 offset, u32 len, enum dma_data_direction dir,
+			    bool for_cpu)
+{
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(pbuf->cb.sgt.sgl, sg, pbuf->cb.sgt.nents, i) {
+		u32 seg_len = sg_dma_len(sg);
+		u32 n;
+
+		if (offset >= seg_len) {
+			offset -= seg_len;
+			continue;
+		}
+		n = min(seg_len - offset, len);
+		if (for_cpu)
+			dma_sync_single_range_for_cpu(dev, sg_dma_address(sg),
+						      offset, n, dir);
+		else
+			dma_sync_single_range_for_device(dev,
+					sg_dma_address(sg), offset, n, dir);
+		offset = 0;
+		len -= n;
+		if (!len)
+			break;
+	}
+}
+
+/* the registered buffer of this file holding len bytes at ubuf, or NULL */
+static struct xdma_pinned_buf *pinned_buf_find(struct xdma_cdev *xcdev,
+		struct file *file, const char __user *ubuf, size_t len)
+{
+	unsigned long addr = (unsigned long)ubuf;
+	int i;
+
+	for (i = 0; i < XDMA_PINNED_BUF_MAX; i++) {
+		struct xdma_pinned_buf *pbuf = xcdev->pinned[i];
+		unsigned long base;
+
+		if (!pbuf || pbuf->owner != file)
+			continue;
+		base = (unsigned long)pbuf->cb.buf;
+		if (addr >= base && len <= pbuf->cb.len &&
+		    addr - base <= pbuf->cb.len - len)
+			return pbuf;
+	}
+	return NULL;
+}
+
+/*
+ * transfer part of a registered buffer through its cached chains
+ * must hold pinned_lock. Returns the bytes transferred, or negative; -EINVAL
+ * if the transfer can't use a cached chain (eg too many descriptors)
+ */
+static ssize_t pinned_buf_xfer(struct xdma_cdev *xcdev,
+			       struct xdma_pinned_buf *pbuf, u32 offset,
+			       u32 len, u64 ep_addr)
+{
+	struct xdma_engine *engine = xcdev->engine;
+	struct device *dev = &xcdev->xdev->pdev->dev;
+	struct xdma_desc_chain *chain = NULL;
+	struct xdma_desc_chain *oldest;
+	int timeout_ms;
+	ssize_t rv;
+	int i;
+
+	if (!len || offset > pbuf->cb.len || len > pbuf->cb.len - offset)
+		return -EINVAL;
+	rv = check_transfer_align(engine,
+			(char __user *)pbuf->cb.buf + offset, len, ep_addr, 1);
+	if (rv)
+		return rv;
+
+	/* find the chain for this transfer, or rebuild the oldest */
+	oldest = pbuf->chains;
+	for (i = 0; i < XDMA_PINNED_BUF_CHAINS; i++) {
+		struct xdma_desc_chain *c = pbuf->chains + i;
+
+		if (c->desc_num && c->offset == offset && c->len == len &&
+		    c->ep_addr == ep_addr) {
+			chain = c;
+			break;
+		}
+		if (!c->desc_num ||
+		    (oldest->desc_num &&
+		     time_before(c->last_used, oldest->last_used)))
+			oldest = c;
+	}
+	if (!chain) {
+		chain = oldest;
+		rv = xdma_chain_build(engine, chain, &pbuf->cb.sgt, offset,
+				      len, ep_addr);
+		if (rv < 0)
+			return rv;
+	}
+
+	timeout_ms = (engine->dir == DMA_TO_DEVICE) ? h2c_timeout * 1000 :
+						      c2h_timeout * 1000;
+	/*
+	 * the buffer stays mapped between transfers: it is handed to the
+	 * device before every transfer, either direction, so no CPU cache line
+	 * of it can be written back over what the device writes
+	 */
+	pinned_buf_sync(dev, pbuf, offset, len, engine->dir, false);
+	rv = xdma_chain_submit(engine, chain, timeout_ms);
+	if (engine->dir == DMA_FROM_DEVICE)
+		pinned_buf_sync(dev, pbuf, offset, len, engine->dir, true);
+	return rv;
+}
+
 static ssize_t char_sgdma_read_write(struct file *file, const char __user *buf,
 		size_t count, loff_t *pos, bool write)
 {
@@ -362,6 +508,7 @@ static ssize_t char_sgdma_read_write(struct file *file, const char __user *buf,
 	struct xdma_dev *xdev;
 	struct xdma_engine *engine;
 	struct xdma_io_cb cb;
+	struct xdma_pinned_buf *pbuf;
 
 	rv = xcdev_check(__func__, xcdev, 1);
 	if (rv < 0)
@@ -380,12 +527,32 @@ static ssize_t char_sgdma_read_write(struct file *file, const char __user *buf,
 		return -EINVAL;
 	}
 
+	if (engine->stream_transfer) {
+		pr_info("%s is running a streaming ring\n", engine->name);
+		return -EBUSY;
+	}
+
 	rv = check_transfer_align(engine, buf, count, *pos, 1);
 	if (rv) {
 		pr_info("Invalid transfer alignment detected\n");
 		return rv;
 	}
 
+	/* a registered buffer is already pinned and mapped */
+	mutex_lock(&xcdev->pinned_lock);
+	pbuf = pinned_buf_find(xcdev, file, buf, count);
+	if (pbuf) {
+		res = pinned_buf_xfer(xcdev, pbuf,
+				      (unsigned long)buf -
+					(unsigned long)pbuf->cb.buf,
+				      count, *pos);
+		if (res != -EINVAL) {
+			mutex_unlock(&xcdev->pinned_lock);
+			return res;
+		}
+	}
+	mutex_unlock(&xcdev->pinned_lock);
+
 	memset(&cb, 0, sizeof(struct xdma_io_cb));
 	cb.buf = (char __user *)buf;
 	cb.len = count;
@@ -566,12 +733,12 @@ static ssize_t cdev_aio_read(struct kiocb *iocb, const struct iovec *io,
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
 static ssize_t cdev_write_iter(struct kiocb *iocb, struct iov_iter *io)
 {
-	return cdev_aio_write(iocb, io->iov, io->nr_segs, io->iov_offset);
+	return cdev_aio_write(iocb, io->iov, io->nr_segs, iocb->ki_pos);
 }
 
 static ssize_t cdev_read_iter(struct kiocb *iocb, struct iov_iter *io)
 {
-	return cdev_aio_read(iocb, io->iov, io->nr_segs, io->iov_offset);
+	return cdev_aio_read(iocb, io->iov, io->nr_segs, iocb->ki_pos);
 }
 #endif
 
@@ -735,6 +902,239 @@ static int ioctl_do_align_get(struct xdma_engine *engine, unsigned long arg)
 	return put_user(engine->addr_align, (int __user *)arg);
 }
 
+/*
+ * a streaming ring belongs to the file that started it: only that file can
+ * map or stop it, and closing it stops the ring. Its mappings are counted,
+ * so the ring is never freed while user space can still reach it.
+ */
+static int ioctl_do_stream_start(struct file *file, struct xdma_engine *engine,
+				 unsigned long arg)
+{
+	struct xdma_stream_ioctl stream;
+	int rv;
+
+	if (copy_from_user(&stream, (struct xdma_stream_ioctl __user *)arg,
+			   sizeof(stream)))
+		return -EFAULT;
+	mutex_lock(&engine->stream_lock);
+	rv = xdma_stream_start(engine->xdev, engine, stream.ring_size,
+			       stream.block_size, stream.ep_addr);
+	if (!rv)
+		engine->stream_owner = file;
+	mutex_unlock(&engine->stream_lock);
+	return rv;
+}
+
+static int ioctl_do_stream_stop(struct file *file, struct xdma_engine *engine)
+{
+	int rv;
+
+	mutex_lock(&engine->stream_lock);
+	if (!engine->stream_transfer)
+		rv = -EINVAL;
+	else if (engine->stream_owner != file)
+		rv = -EPERM;
+	else if (atomic_read(&engine->stream_maps))
+		rv = -EBUSY;		/* user space must unmap the ring first */
+	else {
+		rv = xdma_stream_stop(engine);
+		engine->stream_owner = NULL;
+	}
+	mutex_unlock(&engine->stream_lock);
+	return rv;
+}
+
+static void stream_vma_open(struct vm_area_struct *vma)
+{
+	struct xdma_engine *engine = vma->vm_private_data;
+
+	atomic_inc(&engine->stream_maps);
+}
+
+static void stream_vma_close(struct vm_area_struct *vma)
+{
+	struct xdma_engine *engine = vma->vm_private_data;
+
+	atomic_dec(&engine->stream_maps);
+}
+
+static const struct vm_operations_struct stream_vm_ops = {
+	.open = stream_vma_open,
+	.close = stream_vma_close,
+};
+
+static int ioctl_do_stream_sync(struct xdma_engine *engine, unsigned long arg)
+{
+	struct xdma_stream_status status;
+	int rv;
+
+	if (!engine->stream_transfer)
+		return -EINVAL;
+	if (copy_from_user(&status, (struct xdma_stream_status __user *)arg,
+			   sizeof(status)))
+		return -EFAULT;
+	if (engine->dir == DMA_TO_DEVICE) {
+		rv = xdma_stream_credit(engine, status.head, &status.tail,
+					h2c_timeout * 1000);
+		status.overruns = 0;
+		if (copy_to_user((void __user *)arg, &status, sizeof(status)))
+			return -EFAULT;
+		return rv;
+	}
+	engine->stream_tail = status.tail;
+	status.head = xdma_stream_head(engine);
+	if ((status.head - status.tail) > engine->stream_buf_size)
+		engine->stream_overruns++;
+	status.overruns = engine->stream_overruns;
+	if (copy_to_user((void __user *)arg, &status, sizeof(status)))
+		return -EFAULT;
+	return 0;
+}
+
+static int ioctl_do_buf_register(struct file *file, struct xdma_cdev *xcdev,
+				 unsigned long arg)
+{
+	struct xdma_engine *engine = xcdev->engine;
+	struct xdma_buf_ioctl reg;
+	struct xdma_pinned_buf *pbuf;
+	int nents;
+	int id;
+	int rv;
+
+	if (copy_from_user(&reg, (struct xdma_buf_ioctl __user *)arg,
+			   sizeof(reg)))
+		return -EFAULT;
+	if (!reg.len || reg.len > XDMA_PINNED_BUF_MAX_LEN)
+		return -EINVAL;
+
+	pbuf = kzalloc(sizeof(*pbuf), GFP_KERNEL);
+	if (!pbuf)
+		return -ENOMEM;
+	pbuf->owner = file;
+	pbuf->cb.buf = (void __user *)(unsigned long)reg.addr;
+	pbuf->cb.len = reg.len;
+	pbuf->cb.write = (engine->dir == DMA_TO_DEVICE);
+	rv = char_sgdma_map_user_buf_to_sgl(&pbuf->cb, pbuf->cb.write);
+	if (rv < 0) {
+		kfree(pbuf);
+		return rv;
+	}
+	nents = dma_map_sg(&xcdev->xdev->pdev->dev, pbuf->cb.sgt.sgl,
+			   pbuf->cb.sgt.orig_nents, engine->dir);
+	if (!nents) {
+		pr_info("%s map of registered buffer failed\n", engine->name);
+		char_sgdma_unmap_user_buf(&pbuf->cb, pbuf->cb.write);
+		kfree(pbuf);
+		return -EIO;
+	}
+	pbuf->cb.sgt.nents = nents;
+
+	mutex_lock(&xcdev->pinned_lock);
+	for (id = 0; id < XDMA_PINNED_BUF_MAX; id++)
+		if (!xcdev->pinned[id])
+			break;
+	if (id == XDMA_PINNED_BUF_MAX) {
+		mutex_unlock(&xcdev->pinned_lock);
+		pinned_buf_release(xcdev, pbuf);
+		return -ENOSPC;
+	}
+	xcdev->pinned[id] = pbuf;
+	mutex_unlock(&xcdev->pinned_lock);
+
+	reg.id = id;
+	if (copy_to_user((void __user *)arg, &reg, sizeof(reg)))
+		return -EFAULT;
+	dbg_tfr("%s registered buffer %d, %u bytes\n", engine->name, id,
+		reg.len);
+	return 0;
+}
+
+static int ioctl_do_buf_unregister(struct file *file, struct xdma_cdev *xcdev,
+				   unsigned long id)
+{
+	int rv = -EINVAL;
+
+	if (id >= XDMA_PINNED_BUF_MAX)
+		return -EINVAL;
+	mutex_lock(&xcdev->pinned_lock);
+	if (xcdev->pinned[id] && xcdev->pinned[id]->owner == file) {
+		pinned_buf_release(xcdev, xcdev->pinned[id]);
+		xcdev->pinned[id] = NULL;
+		rv = 0;
+	}
+	mutex_unlock(&xcdev->pinned_lock);
+	return rv;
+}
+
+static long ioctl_do_buf_xfer(struct file *file, struct xdma_cdev *xcdev,
+			      unsigned long arg)
+{
+	struct xdma_buf_xfer req;
+	struct xdma_pinned_buf *pbuf;
+	long rv = -EINVAL;
+
+	if (copy_from_user(&req, (struct xdma_buf_xfer __user *)arg,
+			   sizeof(req)))
+		return -EFAULT;
+	if (req.id >= XDMA_PINNED_BUF_MAX)
+		return -EINVAL;
+	if (xcdev->engine->stream_transfer)
+		return -EBUSY;
+
+	mutex_lock(&xcdev->pinned_lock);
+	pbuf = xcdev->pinned[req.id];
+	if (pbuf && pbuf->owner == file)
+		rv = pinned_buf_xfer(xcdev, pbuf, req.offset, req.len,
+				     req.ep_addr);
+	mutex_unlock(&xcdev->pinned_lock);
+	return rv;
+}
+
+/*
+ * short read: the FIFO depth is read from the user BAR just before the
+ * transfer, so a read never asks the FPGA for more than the FIFO holds
+ */
+static long ioctl_do_read_available(struct file *file, struct xdma_cdev *xcdev,
+				    unsigned long arg)
+{
+	struct xdma_read_available req;
+	struct xdma_dev *xdev = xcdev->xdev;
+	struct xdma_engine *engine = xcdev->engine;
+	loff_t pos;
+	u64 avail;
+	ssize_t res;
+
+	if (copy_from_user(&req, (struct xdma_read_available __user *)arg,
+			   sizeof(req)))
+		return -EFAULT;
+	if (engine->dir != DMA_FROM_DEVICE || !req.granule || !req.word_bytes)
+		return -EINVAL;
+	if (xdev->user_bar_idx < 0 || !xdev->bar[xdev->user_bar_idx] ||
+	    (req.status_reg & 3) ||
+	    (u64)req.status_reg + 4 >
+		pci_resource_len(xdev->pdev, xdev->user_bar_idx))
+		return -EINVAL;
+
+	req.status = ioread32(xdev->bar[xdev->user_bar_idx] + req.status_reg);
+	avail = (u64)(req.status & req.depth_mask) * req.word_bytes;
+	if (avail > req.max_len)
+		avail = req.max_len;
+	avail -= avail % req.granule;
+	req.len = 0;
+	if (avail && avail >= req.min_len) {
+		pos = req.ep_addr;
+		res = char_sgdma_read_write(file,
+				(const char __user *)(unsigned long)req.addr,
+				avail, &pos, 0);
+		if (res < 0)
+			return res;
+		req.len = res;
+	}
+	if (copy_to_user((void __user *)arg, &req, sizeof(req)))
+		return -EFAULT;
+	return 0;
+}
+
 static long char_sgdma_ioctl(struct file *file, unsigned int cmd,
 		unsigned long arg)
 {
@@ -770,6 +1170,27 @@ static long char_sgdma_ioctl(struct file *file, unsigned int cmd,
 	case IOCTL_XDMA_ALIGN_GET:
 		rv = ioctl_do_align_get(engine, arg);
 		break;
+	case IOCTL_XDMA_STREAM_START:
+		rv = ioctl_do_stream_start(file, engine, arg);
+		break;
+	case IOCTL_XDMA_STREAM_STOP:
+		rv = ioctl_do_stream_stop(file, engine);
+		break;
+	case IOCTL_XDMA_STREAM_SYNC:
+		rv = ioctl_do_stream_sync(engine, arg);
+		break;
+	case IOCTL_XDMA_BUF_REGISTER:
+		rv = ioctl_do_buf_register(file, xcdev, arg);
+		break;
+	case IOCTL_XDMA_BUF_UNREGISTER:
+		rv = ioctl_do_buf_unregister(file, xcdev, arg);
+		break;
+	case IOCTL_XDMA_BUF_XFER:
+		rv = ioctl_do_buf_xfer(file, xcdev, arg);
+		break;
+	case IOCTL_XDMA_READ_AVAILABLE:
+		rv = ioctl_do_read_available(file, xcdev, arg);
+		break;
 	default:
 		dbg_perf("Unsupported operation\n");
 		rv = -EINVAL;
@@ -779,6 +1200,43 @@ static long char_sgdma_ioctl(struct file *file, unsigned int cmd,
 	return rv;
 }
 
+/*
+ * map the streaming ring into user space, through the file that started it.
+ * The ring can be mapped more than once, eg twice at adjacent addresses so a
+ * read never has to wrap
+ */
+static int char_sgdma_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct xdma_cdev *xcdev = (struct xdma_cdev *)file->private_data;
+	struct xdma_engine *engine;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int rv;
+
+	rv = xcdev_check(__func__, xcdev, 1);
+	if (rv < 0)
+		return rv;
+	engine = xcdev->engine;
+
+	mutex_lock(&engine->stream_lock);
+	if (!engine->stream_transfer || engine->stream_owner != file) {
+		pr_info("%s mmap: streaming ring not started by this file\n",
+			engine->name);
+		rv = -EINVAL;
+	} else if (vma->vm_pgoff || size > engine->stream_buf_size)
+		rv = -EINVAL;
+	else
+		rv = dma_mmap_coherent(&xcdev->xdev->pdev->dev, vma,
+				       engine->stream_buf_virt,
+				       engine->stream_buf_bus, size);
+	if (!rv) {
+		vma->vm_ops = &stream_vm_ops;
+		vma->vm_private_data = engine;
+		atomic_inc(&engine->stream_maps);
+	}
+	mutex_unlock(&engine->stream_lock);
+	return rv;
+}
+
 static int char_sgdma_open(struct inode *inode, struct file *file)
 {
 	struct xdma_cdev *xcdev;
@@ -805,6 +1263,7 @@ static int char_sgdma_close(struct inode *inode, struct file *file)
 	struct xdma_cdev *xcdev = (struct xdma_cdev *)file->private_data;
 	struct xdma_engine *engine;
 	int rv;
+	int i;
 
 	rv = xcdev_check(__func__, xcdev, 1);
 	if (rv < 0)
@@ -815,6 +1274,27 @@ static int char_sgdma_close(struct inode *inode, struct file *file)
 	if (engine->streaming && engine->dir == DMA_FROM_DEVICE)
 		engine->device_open = 0;
 
+	/*
+	 * only the owner maps the ring, and its mappings hold the file open,
+	 * so the ring is no longer mapped here
+	 */
+	mutex_lock(&engine->stream_lock);
+	if (engine->stream_transfer && engine->stream_owner == file) {
+		xdma_stream_stop(engine);
+		engine->stream_owner = NULL;
+	}
+	mutex_unlock(&engine->stream_lock);
+
+	/* buffers registered through this file */
+	mutex_lock(&xcdev->pinned_lock);
+	for (i = 0; i < XDMA_PINNED_BUF_MAX; i++) {
+		if (xcdev->pinned[i] && xcdev->pinned[i]->owner == file) {
+			pinned_buf_release(xcdev, xcdev->pinned[i]);
+			xcdev->pinned[i] = NULL;
+		}
+	}
+	mutex_unlock(&xcdev->pinned_lock);
+
 	return 0;
 }
 static const struct file_operations sgdma_fops = {
@@ -828,6 +1308,7 @@ static const struct file_operations sgdma_fops = {
 	.aio_write = cdev_aio_write,
 #endif
 	.read = char_sgdma_read,
+	.mmap = char_sgdma_mmap,
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
 	.read_iter = cdev_read_iter,
 #else
@@ -840,4 +1321,5 @@ static const struct file_operations sgdma_fops = {
 void cdev_sgdma_init(struct xdma_cdev *xcdev)
 {
 	cdev_init(&xcdev->cdev, &sgdma_fops);
+	mutex_init(&xcdev->pinned_lock);
 }
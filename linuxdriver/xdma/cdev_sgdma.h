@@ -60,6 +60,66 @@ struct xdma_performance_ioctl {
 
 
 
+/* streaming ring mode: IOCTL_XDMA_STREAM_START */
+struct xdma_stream_ioctl {
+	uint32_t ring_size;	/* ring bytes: power of 2, multiple of page size */
+	uint32_t block_size;	/* bytes per descriptor; divides ring_size */
+	uint64_t ep_addr;	/* AXI address to read (C2H) or write (H2C) */
+};
+
+/*
+ * IOCTL_XDMA_STREAM_SYNC, C2H: report consumed data and get the write position
+ * H2C: credit written data to the engine and get the read position; head is
+ * then in and tail out
+ */
+struct xdma_stream_status {
+	uint32_t tail;		/* bytes consumed (free running): in, H2C out */
+	uint32_t head;		/* bytes written (free running): out, H2C in */
+	uint32_t overruns;	/* out: C2H times unread data was overwritten */
+	uint32_t reserved;
+};
+
+/*
+ * persistent DMA buffers: IOCTL_XDMA_BUF_REGISTER pins and maps a buffer
+ * once. IOCTL_XDMA_BUF_XFER then transfers part of it, and the descriptors
+ * for each offset/length/address used are kept, so a repeat is only queued.
+ */
+struct xdma_buf_ioctl {
+	uint64_t addr;		/* user address of the buffer */
+	uint32_t len;		/* bytes */
+	uint32_t id;		/* out: id for IOCTL_XDMA_BUF_XFER/UNREGISTER */
+};
+
+/* IOCTL_XDMA_BUF_XFER: the ioctl returns the bytes transferred */
+struct xdma_buf_xfer {
+	uint32_t id;		/* buffer id from IOCTL_XDMA_BUF_REGISTER */
+	uint32_t offset;	/* bytes from the start of the buffer */
+	uint32_t len;		/* bytes to transfer */
+	uint32_t reserved;
+	uint64_t ep_addr;	/* AXI address */
+};
+
+/*
+ * IOCTL_XDMA_READ_AVAILABLE, C2H: short read of a FIFO behind an AXI-MM
+ * reader, which would stall on a read of more than it holds. The driver
+ * reads the FIFO monitor register at user BAR offset status_reg, takes
+ * (status & depth_mask) * word_bytes as the bytes available, and reads that
+ * much to addr in the same call: at most max_len, rounded down to a multiple
+ * of granule, and nothing if that is less than min_len.
+ */
+struct xdma_read_available {
+	uint64_t addr;		/* user buffer */
+	uint64_t ep_addr;	/* AXI address to read */
+	uint32_t min_len;	/* bytes: read nothing if fewer are available */
+	uint32_t max_len;	/* bytes: room in the buffer */
+	uint32_t granule;	/* bytes: the length read is a multiple of this */
+	uint32_t status_reg;	/* user BAR offset of the FIFO monitor register */
+	uint32_t depth_mask;	/* FIFO depth field of the register */
+	uint32_t word_bytes;	/* bytes per unit of FIFO depth */
+	uint32_t len;		/* out: bytes read */
+	uint32_t status;	/* out: the register, read before the transfer */
+};
+
 /* IOCTL codes */
 
 #define IOCTL_XDMA_PERF_START   _IOW('q', 1, struct xdma_performance_ioctl *)
@@ -68,5 +128,19 @@ struct xdma_performance_ioctl {
 #define IOCTL_XDMA_ADDRMODE_SET _IOW('q', 4, int)
 #define IOCTL_XDMA_ADDRMODE_GET _IOR('q', 5, int)
 #define IOCTL_XDMA_ALIGN_GET    _IOR('q', 6, int)
+#define IOCTL_XDMA_STREAM_START _IOW('q', 7, struct xdma_stream_ioctl *)
+#define IOCTL_XDMA_STREAM_STOP  _IO('q', 8)
+#define IOCTL_XDMA_STREAM_SYNC  _IOWR('q', 9, struct xdma_stream_status *)
+#define IOCTL_XDMA_BUF_REGISTER _IOWR('q', 10, struct xdma_buf_ioctl *)
+#define IOCTL_XDMA_BUF_UNREGISTER _IO('q', 11)
+#define IOCTL_XDMA_BUF_XFER     _IOW('q', 12, struct xdma_buf_xfer *)
+#define IOCTL_XDMA_READ_AVAILABLE _IOWR('q', 13, struct xdma_read_available *)
+
+/*
+ * mmap() offset flag: a map of the user or bypass BAR at offset
+ * (XDMA_MMAP_WC_OFFSET | off) is of the same range as offset off, but
+ * write-combined. Only for BARs no larger than the flag.
+ */
+#define XDMA_MMAP_WC_OFFSET	0x40000000UL
 
 #endif /* _XDMA_IOCALLS_POSIX_H_ */
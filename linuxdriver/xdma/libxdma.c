@@ -27,6 +27,8 @@
 #include <linux/errno.h>
 #include <linux/sched.h>
 #include <linux/vmalloc.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
 
 #include "libxdma.h"
 #include "libxdma_api.h"
@@ -37,7 +39,54 @@
 /* Module Parameters */
 static unsigned int poll_mode;
 module_param(poll_mode, uint, 0644);
-MODULE_PARM_DESC(poll_mode, "Set 1 for hw polling, default is 0 (interrupts)");
+MODULE_PARM_DESC(poll_mode,
+	"Set 1 for hw polling, 2 for hybrid poll then interrupt, default is 0 (interrupts)");
+
+static unsigned int h2c_poll_mode[XDMA_CHANNEL_NUM_MAX];
+static int h2c_poll_mode_num;
+module_param_array(h2c_poll_mode, uint, &h2c_poll_mode_num, 0444);
+MODULE_PARM_DESC(h2c_poll_mode,
+	"per H2C channel poll_mode, eg 0,2 (default: poll_mode for all channels)");
+
+static unsigned int c2h_poll_mode[XDMA_CHANNEL_NUM_MAX];
+static int c2h_poll_mode_num;
+module_param_array(c2h_poll_mode, uint, &c2h_poll_mode_num, 0444);
+MODULE_PARM_DESC(c2h_poll_mode,
+	"per C2H channel poll_mode, eg 2,0 (default: poll_mode for all channels)");
+
+static unsigned int hybrid_poll_us = 20;
+module_param(hybrid_poll_us, uint, 0644);
+MODULE_PARM_DESC(hybrid_poll_us,
+	"initial hybrid mode busy poll time in us, default is 20");
+
+static int h2c_irq_cpu[XDMA_CHANNEL_NUM_MAX];
+static int h2c_irq_cpu_num;
+module_param_array(h2c_irq_cpu, int, &h2c_irq_cpu_num, 0444);
+MODULE_PARM_DESC(h2c_irq_cpu,
+	"per H2C channel MSI-X affinity cpu, -1 for none (default: none)");
+
+static int c2h_irq_cpu[XDMA_CHANNEL_NUM_MAX];
+static int c2h_irq_cpu_num;
+module_param_array(c2h_irq_cpu, int, &c2h_irq_cpu_num, 0444);
+MODULE_PARM_DESC(c2h_irq_cpu,
+	"per C2H channel MSI-X affinity cpu, -1 for none (default: none)");
+
+static unsigned int h2c_irq_coalesce_us[XDMA_CHANNEL_NUM_MAX];
+static int h2c_irq_coalesce_us_num;
+module_param_array(h2c_irq_coalesce_us, uint, &h2c_irq_coalesce_us_num, 0444);
+MODULE_PARM_DESC(h2c_irq_coalesce_us,
+	"per H2C channel interrupt moderation poll interval in us, 0 for none (default: none)");
+
+static unsigned int c2h_irq_coalesce_us[XDMA_CHANNEL_NUM_MAX];
+static int c2h_irq_coalesce_us_num;
+module_param_array(c2h_irq_coalesce_us, uint, &c2h_irq_coalesce_us_num, 0444);
+MODULE_PARM_DESC(c2h_irq_coalesce_us,
+	"per C2H channel interrupt moderation poll interval in us, 0 for none (default: none)");
+
+static unsigned int irq_coalesce_count = 2;
+module_param(irq_coalesce_count, uint, 0644);
+MODULE_PARM_DESC(irq_coalesce_count,
+	"initial empty polls before a moderated engine's interrupt is unmasked, default is 2");
 
 static unsigned int interrupt_mode;
 module_param(interrupt_mode, uint, 0644);
@@ -82,6 +131,70 @@ MODULE_PARM_DESC(desc_blen_max,
 #endif
 
 
+/* engine_poll_mode_param() - completion mode asked for an engine at load */
+static unsigned int engine_poll_mode_param(enum dma_data_direction dir,
+					   int channel)
+{
+	unsigned int mode = poll_mode;
+
+	if (dir == DMA_TO_DEVICE && channel < h2c_poll_mode_num)
+		mode = h2c_poll_mode[channel];
+	else if (dir == DMA_FROM_DEVICE && channel < c2h_poll_mode_num)
+		mode = c2h_poll_mode[channel];
+
+	if (mode > ENGINE_POLL_MODE_MAX) {
+		pr_warn("poll_mode %u invalid, using interrupts\n", mode);
+		mode = ENGINE_POLL_INTR;
+	}
+	return mode;
+}
+
+/* engine_irq_cpu_param() - MSI-X affinity cpu asked for an engine, or -1 */
+static int engine_irq_cpu_param(enum dma_data_direction dir, int channel)
+{
+	if (dir == DMA_TO_DEVICE && channel < h2c_irq_cpu_num)
+		return h2c_irq_cpu[channel];
+	if (dir == DMA_FROM_DEVICE && channel < c2h_irq_cpu_num)
+		return c2h_irq_cpu[channel];
+	return -1;
+}
+
+/* engine_irq_coalesce_param() - moderation poll interval asked for an engine */
+static unsigned int engine_irq_coalesce_param(enum dma_data_direction dir,
+					      int channel)
+{
+	if (dir == DMA_TO_DEVICE && channel < h2c_irq_coalesce_us_num)
+		return h2c_irq_coalesce_us[channel];
+	if (dir == DMA_FROM_DEVICE && channel < c2h_irq_coalesce_us_num)
+		return c2h_irq_coalesce_us[channel];
+	return 0;
+}
+
+/* set when the writeback polling threads were created with the first device */
+static bool wb_poll_threads;
+
+/* true if any engine can be in writeback mode and needs a polling thread */
+static bool wb_poll_threads_needed(void)
+{
+	int i;
+
+	if (poll_mode == ENGINE_POLL_WB)
+		return true;
+	for (i = 0; i < h2c_poll_mode_num; i++)
+		if (h2c_poll_mode[i] == ENGINE_POLL_WB)
+			return true;
+	for (i = 0; i < c2h_poll_mode_num; i++)
+		if (c2h_poll_mode[i] == ENGINE_POLL_WB)
+			return true;
+	return false;
+}
+
+/* true if at least one engine completes by interrupt */
+static inline bool channel_irqs_used(struct xdma_dev *xdev)
+{
+	return (xdev->mask_irq_h2c | xdev->mask_irq_c2h) & ~xdev->mask_irq_wb;
+}
+
 /*
  * xdma device management
  * maintains a list of the xdma devices
@@ -101,13 +214,14 @@ static inline int xdev_list_add(struct xdma_dev *xdev)
 	mutex_lock(&xdev_mutex);
 	if (list_empty(&xdev_list)) {
 		xdev->idx = 0;
-		if (poll_mode) {
+		if (wb_poll_threads_needed()) {
 			int rv = xdma_threads_create(xdev->h2c_channel_max +
 					xdev->c2h_channel_max);
 			if (rv < 0) {
 				mutex_unlock(&xdev_mutex);
 				return rv;
 			}
+			wb_poll_threads = true;
 		}
 	} else {
 		struct xdma_dev *last;
@@ -134,8 +248,10 @@ static inline void xdev_list_remove(struct xdma_dev *xdev)
 {
 	mutex_lock(&xdev_mutex);
 	list_del(&xdev->list_head);
-	if (poll_mode && list_empty(&xdev_list))
+	if (wb_poll_threads && list_empty(&xdev_list)) {
 		xdma_threads_destroy();
+		wb_poll_threads = false;
+	}
 	mutex_unlock(&xdev_mutex);
 
 	spin_lock(&xdev_rcu_lock);
@@ -344,18 +460,60 @@ void get_perf_stats(struct xdma_engine *engine)
 	lo = read_register(&engine->regs->completed_desc_count);
 	engine->xdma_perf->iterations = build_u64(hi, lo);
 
-	hi = read_register(&engine->regs->perf_cyc_hi);
-	lo = read_register(&engine->regs->perf_cyc_lo);
+	xdma_engine_perf_read(engine, &engine->xdma_perf->clock_cycle_count,
+			      &engine->xdma_perf->data_cycle_count,
+			      &engine->xdma_perf->pending_count);
+}
+
+/*
+ * start or stop the engine performance counters without a test transfer,
+ * to profile the traffic of a live application. They count in auto mode,
+ * ie only while the engine is running. Not while a perf test has them.
+ */
+int xdma_engine_perf_run(struct xdma_engine *engine, bool run)
+{
+	if (!engine) {
+		pr_err("dma engine NULL\n");
+		return -EINVAL;
+	}
 
-	engine->xdma_perf->clock_cycle_count = build_u64(hi, lo);
+	if (engine->xdma_perf)
+		return -EBUSY;
 
-	hi = read_register(&engine->regs->perf_dat_hi);
-	lo = read_register(&engine->regs->perf_dat_lo);
-	engine->xdma_perf->data_cycle_count = build_u64(hi, lo);
+	if (run) {
+		enable_perf(engine);
+	} else {
+		write_register(0, &engine->regs->perf_ctrl,
+			       (unsigned long)(&engine->regs->perf_ctrl) -
+				       (unsigned long)(&engine->regs));
+		read_register(&engine->regs->identifier);
+	}
+	return 0;
+}
 
-	hi = read_register(&engine->regs->perf_pnd_hi);
-	lo = read_register(&engine->regs->perf_pnd_lo);
-	engine->xdma_perf->pending_count = build_u64(hi, lo);
+/* read a 64 bit counter; re-read if the low word wrapped between reads */
+static u64 perf_counter_read(u32 *reg_hi, u32 *reg_lo)
+{
+	u32 hi;
+	u32 lo;
+
+	do {
+		hi = read_register(reg_hi);
+		lo = read_register(reg_lo);
+	} while (hi != read_register(reg_hi));
+
+	return build_u64(hi, lo);
+}
+
+void xdma_engine_perf_read(struct xdma_engine *engine, u64 *cycles,
+			   u64 *data_cycles, u64 *pending)
+{
+	*cycles = perf_counter_read(&engine->regs->perf_cyc_hi,
+				    &engine->regs->perf_cyc_lo);
+	*data_cycles = perf_counter_read(&engine->regs->perf_dat_hi,
+					 &engine->regs->perf_dat_lo);
+	*pending = perf_counter_read(&engine->regs->perf_pnd_hi,
+				     &engine->regs->perf_pnd_lo);
 }
 
 static int engine_reg_dump(struct xdma_engine *engine)
@@ -549,7 +707,7 @@ static int xdma_engine_stop(struct xdma_engine *engine)
 	w |= (u32)XDMA_CTRL_IE_READ_ERROR;
 	w |= (u32)XDMA_CTRL_IE_DESC_ERROR;
 
-	if (poll_mode) {
+	if (engine->poll_mode == ENGINE_POLL_WB) {
 		w |= (u32)XDMA_CTRL_POLL_MODE_WB;
 	} else {
 		w |= (u32)XDMA_CTRL_IE_DESC_STOPPED;
@@ -599,7 +757,7 @@ static int engine_start_mode_config(struct xdma_engine *engine)
 	w |= (u32)XDMA_CTRL_IE_DESC_ALIGN_MISMATCH;
 	w |= (u32)XDMA_CTRL_IE_MAGIC_STOPPED;
 
-	if (poll_mode) {
+	if (engine->poll_mode == ENGINE_POLL_WB) {
 		w |= (u32)XDMA_CTRL_POLL_MODE_WB;
 	} else {
 		w |= (u32)XDMA_CTRL_IE_DESC_STOPPED;
@@ -805,6 +963,22 @@ static struct xdma_transfer *engine_transfer_completion(
 		return NULL;
 	}
 
+	if (transfer->state == TRANSFER_STATE_COMPLETED) {
+		engine->stat_xfers++;
+		engine->stat_descs += transfer->desc_num;
+		engine->stat_bytes += transfer->len;
+		/* a cyclic transfer runs until stopped: no latency */
+		if (!transfer->cyclic && transfer->submit_ns) {
+			u64 latency = ktime_get_ns() - transfer->submit_ns;
+
+			engine->stat_latency_ns += latency;
+			if (latency > engine->stat_latency_max_ns)
+				engine->stat_latency_max_ns = latency;
+		}
+	} else if (transfer->state == TRANSFER_STATE_FAILED) {
+		engine->stat_errors++;
+	}
+
 	/* synchronous I/O? */
 	/* awake task on transfer's wait queue */
 	xlx_wake_up(&transfer->wq);
@@ -1195,11 +1369,130 @@ done:
 	return err_flag ? -1 : 0;
 }
 
+/*
+ * interrupt moderation, for engines with irq_coalesce_us set
+ *
+ * as NAPI: once a completion interrupt has been serviced, the engine's
+ * interrupt stays masked and the engine is polled instead, every
+ * irq_coalesce_us, by an hrtimer that schedules the same work. Each poll
+ * services every transfer completed since the last in one batch. A poll that
+ * finds the engine busy just waits for the next; after irq_coalesce_count
+ * polls in a row find it idle with nothing completed, the interrupt is
+ * unmasked again. So a busy engine takes one interrupt per run of transfers,
+ * not per transfer, and a completion waits at most irq_coalesce_us. Engines
+ * with irq_coalesce_us 0 (the default) interrupt for every completion.
+ */
+static enum hrtimer_restart engine_coalesce_timer(struct hrtimer *timer)
+{
+	struct xdma_engine *engine =
+		container_of(timer, struct xdma_engine, coalesce_timer);
+
+	schedule_work(&engine->work);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * engine_coalesce_continue() - after servicing: true to stay moderated and
+ * poll again, false to unmask the interrupt
+ *
+ * must be called with engine->lock already acquired
+ */
+static bool engine_coalesce_continue(struct xdma_engine *engine, u32 done,
+				     bool busy)
+{
+	u32 us = READ_ONCE(engine->irq_coalesce_us);
+
+	if (done > engine->coalesce_batch_max)
+		engine->coalesce_batch_max = done;
+	if (engine->coalescing) {
+		engine->coalesce_polls++;
+		engine->coalesce_xfers += done;
+	}
+	if (!us || engine->poll_mode == ENGINE_POLL_WB ||
+	    (engine->shutdown & ENGINE_SHUTDOWN_REQUEST))
+		goto unmask;
+	if (done || busy)
+		engine->coalesce_idle = 0;
+	else if (!engine->coalescing ||
+		 ++engine->coalesce_idle > READ_ONCE(engine->irq_coalesce_count))
+		goto unmask;
+	if (!engine->coalescing)
+		engine->coalesce_batches++;
+	engine->coalescing = true;
+	hrtimer_start(&engine->coalesce_timer, ns_to_ktime((u64)us * 1000),
+		      HRTIMER_MODE_REL);
+	return true;
+
+unmask:
+	engine->coalescing = false;
+	engine->coalesce_idle = 0;
+	return false;
+}
+
+/*
+ * engine_irq_unmask() - re-enable the completion interrupt of an engine
+ *
+ * must be called with engine->lock already acquired
+ */
+static void engine_irq_unmask(struct xdma_engine *engine)
+{
+	if (engine->xdev->msix_enabled) {
+		write_register(
+			engine->interrupt_enable_mask_value,
+			&engine->regs->interrupt_enable_mask_w1s,
+			(unsigned long)(&engine->regs
+						 ->interrupt_enable_mask_w1s) -
+				(unsigned long)(&engine->regs));
+	} else
+		channel_interrupts_enable(engine->xdev, engine->irq_bitmask);
+}
+
+/*
+ * engine_coalesce_stop() - end a moderated run, and unmask the interrupt
+ *
+ * must be called with engine->lock already acquired. A poll already
+ * scheduled finds the run ended and services the engine as an interrupt would.
+ */
+static void engine_coalesce_stop(struct xdma_engine *engine)
+{
+	hrtimer_cancel(&engine->coalesce_timer);
+	if (engine->coalescing) {
+		engine->coalescing = false;
+		engine->coalesce_idle = 0;
+		engine_irq_unmask(engine);
+	}
+}
+
+/*
+ * xdma_engine_irq_coalesce_set() - change an engine's interrupt moderation
+ *
+ * @us: poll interval while moderated, 0 to interrupt for every completion
+ * @count: empty polls before the interrupt is unmasked
+ * a moderated run in progress picks up the new values at its next poll
+ */
+int xdma_engine_irq_coalesce_set(struct xdma_engine *engine, unsigned int us,
+				 unsigned int count)
+{
+	/* the interrupt is masked for up to (count + 1) polls: keep it short */
+	if (us > 10000 || count > 100)
+		return -EINVAL;
+	if (us && engine->poll_mode == ENGINE_POLL_WB) {
+		pr_info("%s writeback poll mode takes no interrupts\n",
+			engine->name);
+		return -EINVAL;
+	}
+	WRITE_ONCE(engine->irq_coalesce_count, count);
+	WRITE_ONCE(engine->irq_coalesce_us, us);
+	return 0;
+}
+
 /* engine_service_work */
 static void engine_service_work(struct work_struct *work)
 {
 	struct xdma_engine *engine;
 	unsigned long flags;
+	u64 xfers;
+	bool busy = false;
 	int rv;
 
 	engine = container_of(work, struct xdma_engine, work);
@@ -1213,28 +1506,97 @@ static void engine_service_work(struct work_struct *work)
 	spin_lock_irqsave(&engine->lock, flags);
 
 	dbg_tfr("engine_service() for %s engine %p\n", engine->name, engine);
-	rv = engine_service(engine, 0);
-	if (rv < 0) {
-		pr_err("Failed to service engine\n");
-		goto unlock;
+	xfers = engine->stat_xfers;
+	/* a moderated poll leaves a transfer in progress to the next poll */
+	if (engine->coalescing && engine->running &&
+	    (read_register(&engine->regs->status) & XDMA_STAT_BUSY)) {
+		busy = true;
+	} else {
+		rv = engine_service(engine, 0);
+		if (rv < 0) {
+			pr_err("Failed to service engine\n");
+			engine->coalescing = false;
+			goto unlock;
+		}
 	}
+	if (engine_coalesce_continue(engine, engine->stat_xfers - xfers, busy))
+		goto unlock;
 
 	/* re-enable interrupts for this engine */
-	if (engine->xdev->msix_enabled) {
-		write_register(
-			engine->interrupt_enable_mask_value,
-			&engine->regs->interrupt_enable_mask_w1s,
-			(unsigned long)(&engine->regs
-						 ->interrupt_enable_mask_w1s) -
-				(unsigned long)(&engine->regs));
-	} else
-		channel_interrupts_enable(engine->xdev, engine->irq_bitmask);
+	engine_irq_unmask(engine);
 
 	/* unlock the engine */
 unlock:
 	spin_unlock_irqrestore(&engine->lock, flags);
 }
 
+/**
+ * engine_hybrid_poll() - busy poll for the completion of a just queued transfer
+ *
+ * the engine is set up for interrupts. The submitter spins on the (non
+ * clearing) status register for up to hybrid_poll_us, and if the engine goes
+ * idle first services it directly, as the interrupt work would. The interrupt
+ * still arrives; its work then finds the engine stopped and only clears the
+ * status. Transfers longer than the poll time complete by interrupt as usual.
+ *
+ * must be called without engine->lock
+ */
+static void engine_hybrid_poll(struct xdma_engine *engine,
+			       struct xdma_transfer *xfer)
+{
+	ktime_t start = ktime_get();
+	ktime_t end = ktime_add_us(start, READ_ONCE(engine->hybrid_poll_us));
+	unsigned long flags;
+	bool hit = false;
+
+	do {
+		if (READ_ONCE(xfer->state) != TRANSFER_STATE_SUBMITTED)
+			break;
+		if (!(read_register(&engine->regs->status) & XDMA_STAT_BUSY)) {
+			spin_lock_irqsave(&engine->lock, flags);
+			if (xfer->state == TRANSFER_STATE_SUBMITTED &&
+			    engine_service(engine, 0) < 0)
+				pr_err("%s failed to service engine\n",
+				       engine->name);
+			spin_unlock_irqrestore(&engine->lock, flags);
+			hit = true;
+			break;
+		}
+		cpu_relax();
+	} while (ktime_before(ktime_get(), end));
+
+	/* submissions are serialised by desc_lock, so no atomics needed */
+	if (hit)
+		engine->hybrid_hits++;
+	else
+		engine->hybrid_misses++;
+	engine->hybrid_poll_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/**
+ * xdma_engine_poll_mode_set() - change an engine's completion mode at run time
+ *
+ * switching between interrupt and hybrid mode is allowed at any time, as both
+ * use the completion interrupt. Writeback mode needs its writeback buffer and
+ * polling thread set up at load time, so it can't be entered or left here.
+ */
+int xdma_engine_poll_mode_set(struct xdma_engine *engine, unsigned int mode)
+{
+	if (mode > ENGINE_POLL_MODE_MAX)
+		return -EINVAL;
+	if (mode == engine->poll_mode)
+		return 0;
+	if (mode == ENGINE_POLL_WB || engine->poll_mode == ENGINE_POLL_WB) {
+		pr_info("%s writeback poll mode is set at module load\n",
+			engine->name);
+		return -EINVAL;
+	}
+	mutex_lock(&engine->desc_lock);
+	engine->poll_mode = mode;
+	mutex_unlock(&engine->desc_lock);
+	return 0;
+}
+
 static u32 engine_service_wb_monitor(struct xdma_engine *engine,
 				     u32 expected_wb)
 {
@@ -1423,6 +1785,7 @@ static irqreturn_t xdma_isr(int irq, void *dev_id)
 			if ((engine->irq_bitmask & mask) &&
 			    (engine->magic == MAGIC_ENGINE)) {
 				mask &= ~engine->irq_bitmask;
+				engine->stat_irqs++;
 				dbg_tfr("schedule_work, %s.\n", engine->name);
 				schedule_work(&engine->work);
 			}
@@ -1442,6 +1805,7 @@ static irqreturn_t xdma_isr(int irq, void *dev_id)
 			if ((engine->irq_bitmask & mask) &&
 			    (engine->magic == MAGIC_ENGINE)) {
 				mask &= ~engine->irq_bitmask;
+				engine->stat_irqs++;
 				dbg_tfr("schedule_work, %s.\n", engine->name);
 				schedule_work(&engine->work);
 			}
@@ -1501,6 +1865,7 @@ static irqreturn_t xdma_channel_irq(int irq, void *dev_id)
 	irq_regs = (struct interrupt_regs *)(xdev->bar[xdev->config_bar_idx] +
 					     XDMA_OFS_INT_CTRL);
 
+	engine->stat_irqs++;
 	/* Disable the interrupt for this engine */
 	write_register(
 		engine->interrupt_enable_mask_value,
@@ -1970,6 +2335,7 @@ static void irq_msix_channel_teardown(struct xdma_dev *xdev)
 			break;
 		dbg_sg("Release IRQ#%d for engine %p\n", engine->msix_irq_line,
 		       engine);
+		irq_set_affinity_hint(engine->msix_irq_line, NULL);
 		free_irq(engine->msix_irq_line, engine);
 	}
 
@@ -1979,10 +2345,62 @@ static void irq_msix_channel_teardown(struct xdma_dev *xdev)
 			break;
 		dbg_sg("Release IRQ#%d for engine %p\n", engine->msix_irq_line,
 		       engine);
+		irq_set_affinity_hint(engine->msix_irq_line, NULL);
 		free_irq(engine->msix_irq_line, engine);
 	}
 }
 
+/*
+ * engine_irq_affinity_set() - steer an engine's MSI-X vector to engine->irq_cpu
+ *
+ * sets the affinity and the hint (so irqbalance follows it). The bottom half
+ * is scheduled on the cpu taking the interrupt, so it runs there too.
+ */
+static int engine_irq_affinity_set(struct xdma_engine *engine)
+{
+	int cpu = engine->irq_cpu;
+	int rv;
+
+	if (!engine->msix_irq_line)
+		return 0;
+	if (cpu < 0)
+		return irq_set_affinity_hint(engine->msix_irq_line, NULL);
+	if (cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+		pr_warn("%s irq cpu %d not online\n", engine->name, cpu);
+		return -EINVAL;
+	}
+	rv = irq_set_affinity_hint(engine->msix_irq_line, cpumask_of(cpu));
+	if (rv < 0)
+		pr_warn("%s irq#%d affinity to cpu %d failed %d\n",
+			engine->name, engine->msix_irq_line, cpu, rv);
+	else
+		pr_info("engine %s, irq#%d on cpu %d.\n", engine->name,
+			engine->msix_irq_line, cpu);
+	return rv;
+}
+
+/**
+ * xdma_engine_irq_cpu_set() - change the cpu an engine's interrupt is steered to
+ *
+ * @cpu: cpu number, or -1 to drop the affinity hint
+ *
+ * only MSI-X gives each engine its own vector; otherwise the setting is kept
+ * but has no effect
+ */
+int xdma_engine_irq_cpu_set(struct xdma_engine *engine, int cpu)
+{
+	int prev = engine->irq_cpu;
+	int rv;
+
+	if (cpu < -1)
+		return -EINVAL;
+	engine->irq_cpu = cpu;
+	rv = engine_irq_affinity_set(engine);
+	if (rv < 0)
+		engine->irq_cpu = prev;
+	return rv;
+}
+
 static int irq_msix_channel_setup(struct xdma_dev *xdev)
 {
 	int i;
@@ -2016,6 +2434,7 @@ static int irq_msix_channel_setup(struct xdma_dev *xdev)
 		}
 		pr_info("engine %s, irq#%d.\n", engine->name, vector);
 		engine->msix_irq_line = vector;
+		engine_irq_affinity_set(engine);
 	}
 
 	engine = xdev->engine_c2h;
@@ -2034,6 +2453,7 @@ static int irq_msix_channel_setup(struct xdma_dev *xdev)
 		}
 		pr_info("engine %s, irq#%d.\n", engine->name, vector);
 		engine->msix_irq_line = vector;
+		engine_irq_affinity_set(engine);
 	}
 
 	return 0;
@@ -2495,6 +2915,7 @@ static int transfer_queue(struct xdma_engine *engine,
 
 	/* mark the transfer as submitted */
 	transfer->state = TRANSFER_STATE_SUBMITTED;
+	transfer->submit_ns = ktime_get_ns();
 	/* add transfer to the tail of the engine transfer queue */
 	list_add_tail(&transfer->entry, &engine->transfer_list);
 
@@ -2604,6 +3025,8 @@ static int engine_destroy(struct xdma_dev *xdev, struct xdma_engine *engine)
 	write_register(0x0, &engine->regs->interrupt_enable_mask,
 		       (unsigned long)(&engine->regs->interrupt_enable_mask) -
 			       (unsigned long)(&engine->regs));
+	hrtimer_cancel(&engine->coalesce_timer);
+	cancel_work_sync(&engine->work);
 
 	if (enable_credit_mp && engine->streaming &&
 	    engine->dir == DMA_FROM_DEVICE) {
@@ -2615,7 +3038,7 @@ static int engine_destroy(struct xdma_dev *xdev, struct xdma_engine *engine)
 		write_register(reg_value, &reg->credit_mode_enable_w1c, 0);
 	}
 
-	if (poll_mode)
+	if (engine->poll_mode == ENGINE_POLL_WB)
 		xdma_thread_remove_work(engine);
 
 	/* Release memory use for descriptor writebacks */
@@ -2746,7 +3169,7 @@ static int engine_init_regs(struct xdma_engine *engine)
 	reg_value |= XDMA_CTRL_IE_DESC_ERROR;
 
 	/* if using polled mode, configure writeback address */
-	if (poll_mode) {
+	if (engine->poll_mode == ENGINE_POLL_WB) {
 		rv = engine_writeback_setup(engine);
 		if (rv) {
 			dbg_init("%s descr writeback setup failed.\n",
@@ -2799,7 +3222,7 @@ static int engine_alloc_resource(struct xdma_engine *engine)
 		goto err_out;
 	}
 
-	if (poll_mode) {
+	if (engine->poll_mode == ENGINE_POLL_WB) {
 		engine->poll_mode_addr_virt =
 			dma_alloc_coherent(&xdev->pdev->dev,
 					   sizeof(struct xdma_poll_wb),
@@ -2870,11 +3293,30 @@ static int engine_init(struct xdma_engine *engine, struct xdma_dev *xdev,
 
 	/* initialize the deferred work for transfer completion */
 	INIT_WORK(&engine->work, engine_service_work);
+#if KERNEL_VERSION(6, 15, 0) <= LINUX_VERSION_CODE
+	hrtimer_setup(&engine->coalesce_timer, engine_coalesce_timer,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&engine->coalesce_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
+	engine->coalesce_timer.function = engine_coalesce_timer;
+#endif
+
+	engine->poll_mode = engine_poll_mode_param(dir, channel);
+	engine->hybrid_poll_us = hybrid_poll_us;
+	engine->irq_cpu = engine_irq_cpu_param(dir, channel);
+	engine->irq_coalesce_count = irq_coalesce_count;
+	if (engine->poll_mode != ENGINE_POLL_WB)
+		engine->irq_coalesce_us = engine_irq_coalesce_param(dir, channel);
+	dbg_init("%s poll mode %u, irq coalesce %uus\n", engine->name,
+		engine->poll_mode, engine->irq_coalesce_us);
 
 	if (dir == DMA_TO_DEVICE)
 		xdev->mask_irq_h2c |= engine->irq_bitmask;
 	else
 		xdev->mask_irq_c2h |= engine->irq_bitmask;
+	if (engine->poll_mode == ENGINE_POLL_WB)
+		xdev->mask_irq_wb |= engine->irq_bitmask;
 	xdev->engines_num++;
 
 	rv = engine_alloc_resource(engine);
@@ -2885,7 +3327,7 @@ static int engine_init(struct xdma_engine *engine, struct xdma_dev *xdev,
 	if (rv)
 		return rv;
 
-	if (poll_mode)
+	if (engine->poll_mode == ENGINE_POLL_WB)
 		xdma_thread_add_work(engine);
 
 	return 0;
@@ -3265,6 +3707,8 @@ ssize_t xdma_xfer_submit(void *dev_hndl, int channel, bool write, u64 ep_addr,
 
 		if (engine->cmplthp)
 			xdma_kthread_wakeup(engine->cmplthp);
+		else if (engine->poll_mode == ENGINE_POLL_HYBRID)
+			engine_hybrid_poll(engine, xfer);
 
 		if (timeout_ms > 0)
 			xlx_wait_event_interruptible_timeout(xfer->wq,
@@ -3315,6 +3759,7 @@ ssize_t xdma_xfer_submit(void *dev_hndl, int channel, bool write, u64 ep_addr,
 			/* transfer can still be in-flight */
 			pr_info("xfer 0x%p,%u, s 0x%x timed out, ep 0x%llx.\n",
 				xfer, xfer->len, xfer->state, req->ep_addr);
+			engine->stat_timeouts++;
 			rv = engine_status_read(engine, 0, 1);
 			if (rv < 0) {
 				pr_err("Failed to read engine status\n");
@@ -3452,6 +3897,7 @@ ssize_t xdma_xfer_completion(void *cb_hndl, void *dev_hndl, int channel,
 			/* transfer can still be in-flight */
 			pr_info("xfer 0x%p,%u, s 0x%x timed out, ep 0x%llx.\n",
 				xfer, xfer->len, xfer->state, req->ep_addr);
+			engine->stat_timeouts++;
 			engine_status_read(engine, 0, 1);
 			engine_status_dump(engine);
 			transfer_abort(engine, xfer);
@@ -3781,6 +4227,531 @@ err_engine_transfer:
 	return rv;
 }
 
+/**
+ * xdma_stream_start() - run an engine continuously through a coherent ring
+ *
+ * @ring_size: ring bytes; a power of 2 and a multiple of PAGE_SIZE
+ * @block_size: bytes per descriptor; ring_size must be a multiple of it
+ * @ep_addr: AXI address read (C2H) or written (H2C) by every descriptor
+ *
+ * the ring is allocated once and the descriptors are linked in a loop, as for
+ * the performance test, so no user pages are pinned or mapped per transfer.
+ * user space maps the ring with mmap().
+ * C2H: the engine starts now and user space tracks the write position with
+ * xdma_stream_head(). The engine does not wait for user space: if it gets
+ * more than ring_size ahead of the tail, data is overwritten and the overrun
+ * is counted.
+ * H2C: the engine only runs on data credited by xdma_stream_credit().
+ */
+int xdma_stream_start(struct xdma_dev *xdev, struct xdma_engine *engine,
+		      u32 ring_size, u32 block_size, u64 ep_addr)
+{
+	struct xdma_transfer *transfer;
+	int num_desc;
+	int i;
+	int rv = -ENOMEM;
+
+	if (engine->stream_transfer || engine->xdma_perf) {
+		pr_err("%s engine busy\n", engine->name);
+		return -EBUSY;
+	}
+	if (!block_size || !ring_size || (ring_size & (ring_size - 1)) ||
+	    (ring_size % PAGE_SIZE) || (ring_size % block_size)) {
+		pr_err("%s invalid stream ring %u / block %u\n",
+		       engine->name, ring_size, block_size);
+		return -EINVAL;
+	}
+	num_desc = ring_size / block_size;
+	if (num_desc > XDMA_TRANSFER_MAX_DESC) {
+		pr_err("%s stream ring needs %d desc, max %d\n",
+		       engine->name, num_desc, XDMA_TRANSFER_MAX_DESC);
+		return -EINVAL;
+	}
+
+	engine->stream_buf_virt = dma_alloc_coherent(&xdev->pdev->dev,
+						ring_size,
+						&engine->stream_buf_bus,
+						GFP_KERNEL);
+	if (!engine->stream_buf_virt) {
+		pr_err("dev %s, %s stream ring OOM.\n",
+		       dev_name(&xdev->pdev->dev), engine->name);
+		return rv;
+	}
+	engine->stream_buf_size = ring_size;
+	engine->stream_block_size = block_size;
+	engine->stream_tail = 0;
+	engine->stream_overruns = 0;
+	engine->stream_ep_addr = ep_addr;
+	engine->stream_queued = 0;
+
+	transfer = kzalloc(sizeof(struct xdma_transfer), GFP_KERNEL);
+	if (!transfer) {
+		pr_err("dev %s, %s transfer request OOM.\n",
+		       dev_name(&xdev->pdev->dev), engine->name);
+		goto err_stream_buf;
+	}
+	transfer->dir = engine->dir;
+	transfer->desc_num = num_desc;
+	/* engine descriptors are allocated at engine init */
+	if (!engine->desc) {
+		pr_err("%s no descriptor memory\n", engine->name);
+		goto err_stream_transfer;
+	}
+	transfer->desc_virt = engine->desc;
+	transfer->desc_bus = engine->desc_bus;
+
+	rv = transfer_desc_init(transfer, transfer->desc_num);
+	if (rv < 0) {
+		pr_err("Failed to initialize descriptors\n");
+		goto err_stream_transfer;
+	}
+
+	/* each descriptor fills the next block of the ring */
+	for (i = 0; i < transfer->desc_num; i++)
+		xdma_desc_set(transfer->desc_virt + i,
+			      engine->stream_buf_bus + (dma_addr_t)i * block_size,
+			      ep_addr, block_size, engine->dir);
+
+	rv = xdma_desc_control_set(transfer->desc_virt, 0);
+	if (rv < 0) {
+		pr_err("Failed to set desc control\n");
+		goto err_stream_transfer;
+	}
+	/* create a linked loop */
+	xdma_desc_link(transfer->desc_virt + transfer->desc_num - 1,
+		       transfer->desc_virt, transfer->desc_bus);
+
+#if HAS_SWAKE_UP
+	init_swait_queue_head(&transfer->wq);
+#else
+	init_waitqueue_head(&transfer->wq);
+#endif
+
+	engine->stream_transfer = transfer;
+	/* H2C: each credit is queued as a batch of these descriptors */
+	if (engine->dir == DMA_TO_DEVICE) {
+		dbg_perf("%s streaming from %u byte ring, %d x %u bytes to 0x%llx\n",
+			 engine->name, ring_size, num_desc, block_size, ep_addr);
+		return 0;
+	}
+	transfer->cyclic = 1;
+	dbg_perf("%s streaming into %u byte ring, %d x %u bytes from 0x%llx\n",
+		 engine->name, ring_size, num_desc, block_size, ep_addr);
+	rv = transfer_queue(engine, transfer);
+	if (rv < 0) {
+		pr_err("Failed to queue stream transfer\n");
+		engine->stream_transfer = NULL;
+		goto err_stream_transfer;
+	}
+	return 0;
+
+err_stream_transfer:
+	kfree(transfer);
+err_stream_buf:
+	dma_free_coherent(&xdev->pdev->dev, ring_size,
+			  engine->stream_buf_virt, engine->stream_buf_bus);
+	engine->stream_buf_virt = NULL;
+	engine->stream_buf_size = 0;
+	return rv;
+}
+
+/**
+ * xdma_stream_stop() - stop a streaming ring and free it
+ *
+ * the caller makes sure no user mapping of the ring is left: cdev_sgdma.c
+ * counts them, and only stops the ring for the file that started it
+ */
+int xdma_stream_stop(struct xdma_engine *engine)
+{
+	struct xdma_transfer *transfer;
+	unsigned long flags;
+	int i;
+
+	/* an H2C credit in progress holds desc_lock while it waits */
+	mutex_lock(&engine->desc_lock);
+	spin_lock_irqsave(&engine->lock, flags);
+	transfer = engine->stream_transfer;
+	if (!transfer) {
+		spin_unlock_irqrestore(&engine->lock, flags);
+		mutex_unlock(&engine->desc_lock);
+		return -EINVAL;
+	}
+	xdma_engine_stop(engine);
+	/* an H2C ring is only queued while a batch is in flight */
+	if (transfer->cyclic || transfer->state == TRANSFER_STATE_SUBMITTED)
+		list_del(&transfer->entry);
+	engine->stream_transfer = NULL;
+	spin_unlock_irqrestore(&engine->lock, flags);
+	mutex_unlock(&engine->desc_lock);
+
+	/* the descriptor in progress completes after the run bit is cleared */
+	for (i = 0; i < 100; i++) {
+		if (!(read_register(&engine->regs->status) & XDMA_STAT_BUSY))
+			break;
+		usleep_range(100, 200);
+	}
+	kfree(transfer);
+	if (i == 100) {
+		/* a stalled read could still complete into the ring: keep it */
+		pr_warn("%s engine still busy after stream stop; ring not freed\n",
+			engine->name);
+		engine->stream_buf_virt = NULL;
+		engine->stream_buf_size = 0;
+		return -EBUSY;
+	}
+	dma_free_coherent(&engine->xdev->pdev->dev, engine->stream_buf_size,
+			  engine->stream_buf_virt, engine->stream_buf_bus);
+	engine->stream_buf_virt = NULL;
+	engine->stream_buf_size = 0;
+	return 0;
+}
+
+/**
+ * xdma_stream_head() - bytes written into the ring since the start (free running)
+ *
+ * the engine's completed descriptor count is reset when it starts, and each
+ * descriptor is one block, so this is exact at descriptor granularity
+ */
+u32 xdma_stream_head(struct xdma_engine *engine)
+{
+	return read_register(&engine->regs->completed_desc_count) *
+	       engine->stream_block_size;
+}
+
+/*
+ * queue the ring bytes from stream_queued up to head as one transfer: a
+ * descriptor per block (or part of one), ending at the end of the ring.
+ * called with desc_lock held and no batch in flight; returns bytes queued.
+ */
+static int stream_queue_batch(struct xdma_engine *engine, u32 head)
+{
+	struct xdma_transfer *transfer = engine->stream_transfer;
+	u32 block = engine->stream_block_size;
+	u32 offset = engine->stream_queued & (engine->stream_buf_size - 1);
+	u32 len = min(head - engine->stream_queued,
+		      engine->stream_buf_size - offset);
+	int first = offset / block;
+	int num = (offset + len + block - 1) / block - first;
+	int i, rv;
+
+	for (i = 0; i < num; i++) {
+		struct xdma_desc *desc = engine->desc + first + i;
+		u32 start = max(offset, (u32)(first + i) * block);
+		u32 end = min(offset + len, (u32)(first + i + 1) * block);
+
+		/* every descriptor writes from ep_addr, as for C2H */
+		xdma_desc_set(desc, engine->stream_buf_bus + start,
+			      engine->stream_ep_addr, end - start,
+			      engine->dir);
+		desc->control = cpu_to_le32(DESC_MAGIC);
+		xdma_desc_adjacent(desc, xdma_get_next_adj(num - i - 1,
+				   le32_to_cpu(desc->next_lo)));
+	}
+	xdma_desc_control_set(engine->desc + first + num - 1,
+			      XDMA_DESC_STOPPED | XDMA_DESC_EOP |
+			      XDMA_DESC_COMPLETED);
+
+	memset(transfer, 0, sizeof(*transfer));
+#if HAS_SWAKE_UP
+	init_swait_queue_head(&transfer->wq);
+#else
+	init_waitqueue_head(&transfer->wq);
+#endif
+	transfer->dir = engine->dir;
+	transfer->desc_virt = engine->desc + first;
+	transfer->desc_bus = engine->desc_bus +
+			     (dma_addr_t)first * sizeof(struct xdma_desc);
+	transfer->desc_num = num;
+	transfer->desc_adjacent = num;
+	transfer->desc_cmpl_th = num;
+	transfer->len = len;
+	transfer->last_in_request = 1;
+
+	rv = transfer_queue(engine, transfer);
+	if (rv < 0)
+		return rv;
+	engine->stream_queued += len;
+	if (engine->cmplthp)
+		xdma_kthread_wakeup(engine->cmplthp);
+	else if (engine->poll_mode == ENGINE_POLL_HYBRID)
+		engine_hybrid_poll(engine, transfer);
+	return len;
+}
+
+/**
+ * xdma_stream_credit() - give an H2C ring's written data to the engine
+ *
+ * @head: bytes written into the ring by user space (free running)
+ * @tail: returns the bytes the engine has read (free running)
+ *
+ * this is the ring's flow control: the engine only reads what has been
+ * credited, and a batch only completes as the FPGA accepts its writes, so
+ * the tail follows the FIFO. One batch is in flight at a time: the previous
+ * batch is waited for first (normally long finished), then everything from
+ * the tail to head is queued, in two batches if it wraps the ring.
+ * returns 0, or negative on error; a failed batch stops the ring's engine
+ */
+int xdma_stream_credit(struct xdma_engine *engine, u32 head, u32 *tail,
+		       int timeout_ms)
+{
+	struct xdma_transfer *transfer;
+	unsigned long flags;
+	int rv = 0;
+
+	mutex_lock(&engine->desc_lock);
+	transfer = engine->stream_transfer;
+	if (!transfer || engine->dir != DMA_TO_DEVICE) {
+		rv = -EINVAL;
+		goto unlock;
+	}
+	if ((head - engine->stream_queued) > engine->stream_buf_size) {
+		pr_info("%s stream credit %u beyond the ring (queued %u)\n",
+			engine->name, head, engine->stream_queued);
+		rv = -EINVAL;
+		goto unlock;
+	}
+
+	for (;;) {
+		if (transfer->state == TRANSFER_STATE_SUBMITTED)
+			xlx_wait_event_interruptible_timeout(transfer->wq,
+				(transfer->state != TRANSFER_STATE_SUBMITTED),
+				msecs_to_jiffies(timeout_ms));
+
+		spin_lock_irqsave(&engine->lock, flags);
+		switch (transfer->state) {
+		case TRANSFER_STATE_SUBMITTED:
+			pr_info("%s stream batch %u timed out\n", engine->name,
+				transfer->len);
+			engine->stat_timeouts++;
+			if (engine_status_read(engine, 0, 1) == 0 &&
+			    transfer_abort(engine, transfer) == 0)
+				xdma_engine_stop(engine);
+			rv = -ETIMEDOUT;
+			break;
+		case TRANSFER_STATE_FAILED:
+		case TRANSFER_STATE_ABORTED:
+			rv = -EIO;
+			break;
+		default:
+			break;
+		}
+		spin_unlock_irqrestore(&engine->lock, flags);
+		if (rv < 0 || head == engine->stream_queued)
+			break;
+		rv = stream_queue_batch(engine, head);
+		/* a batch to the end of the ring: go round for the rest */
+		if (rv < 0 || head == engine->stream_queued)
+			break;
+		rv = 0;
+	}
+	if (rv > 0)
+		rv = 0;
+
+unlock:
+	if (transfer) {
+		spin_lock_irqsave(&engine->lock, flags);
+		*tail = engine->stream_queued -
+			((transfer->state == TRANSFER_STATE_SUBMITTED) ?
+			 transfer->len : 0);
+		spin_unlock_irqrestore(&engine->lock, flags);
+	}
+	mutex_unlock(&engine->desc_lock);
+	return rv;
+}
+
+/**
+ * xdma_chain_build() - prepare a descriptor chain for a repeated transfer
+ *
+ * @sgt: DMA mapped sg table of a persistent buffer
+ * @offset, @len: part of the buffer to transfer
+ * @ep_addr: AXI address
+ *
+ * the chain is built as transfer_init() would, but into the chain's own
+ * descriptors, which are allocated on first use and kept until
+ * xdma_chain_free(). C2H AXI-ST engines need per transfer result buffers,
+ * so only AXI-MM and H2C engines are supported.
+ */
+int xdma_chain_build(struct xdma_engine *engine, struct xdma_desc_chain *chain,
+		     struct sg_table *sgt, u32 offset, u32 len, u64 ep_addr)
+{
+	struct xdma_dev *xdev = engine->xdev;
+	struct xdma_transfer *xfer = &chain->xfer;
+	struct scatterlist *sg;
+	u64 ep = ep_addr;
+	u32 skip = offset;
+	u32 remaining = len;
+	u32 control;
+	int num = 0;
+	int i;
+
+	if (engine->streaming && engine->dir == DMA_FROM_DEVICE)
+		return -EINVAL;
+	if (!len)
+		return -EINVAL;
+
+	if (!chain->desc_virt) {
+		chain->desc_virt = dma_alloc_coherent(&xdev->pdev->dev,
+					XDMA_CHAIN_MAX_DESC *
+						sizeof(struct xdma_desc),
+					&chain->desc_bus, GFP_KERNEL);
+		if (!chain->desc_virt) {
+			pr_err("%s descriptor chain OOM.\n", engine->name);
+			return -ENOMEM;
+		}
+	}
+	chain->desc_num = 0;
+	xfer->desc_virt = chain->desc_virt;
+	xfer->desc_bus = chain->desc_bus;
+	transfer_desc_init(xfer, XDMA_CHAIN_MAX_DESC);
+
+	/* split the mapped segments in the range by desc_blen_max */
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		dma_addr_t addr = sg_dma_address(sg);
+		u32 seg_len = sg_dma_len(sg);
+
+		if (skip >= seg_len) {
+			skip -= seg_len;
+			continue;
+		}
+		addr += skip;
+		seg_len -= skip;
+		skip = 0;
+
+		while (seg_len && remaining) {
+			u32 desc_len = min3(seg_len, remaining, desc_blen_max);
+
+			if (num == XDMA_CHAIN_MAX_DESC)
+				return -EINVAL;
+			xdma_desc_set(chain->desc_virt + num, addr, ep,
+				      desc_len, engine->dir);
+			if (!engine->non_incr_addr)
+				ep += desc_len;
+			addr += desc_len;
+			seg_len -= desc_len;
+			remaining -= desc_len;
+			num++;
+		}
+		if (!remaining)
+			break;
+	}
+	if (remaining)
+		return -EINVAL;
+
+	/* terminate the chain: stop engine, EOP for AXI ST, IRQ on last */
+	xdma_desc_link(chain->desc_virt + num - 1, NULL, 0);
+	control = XDMA_DESC_STOPPED | XDMA_DESC_EOP | XDMA_DESC_COMPLETED;
+	xdma_desc_control_set(chain->desc_virt + num - 1, control);
+	for (i = 0; i < num; i++)
+		xdma_desc_adjacent(chain->desc_virt + i,
+			xdma_get_next_adj(num - i - 1,
+					  (chain->desc_virt + i)->next_lo));
+
+	chain->desc_num = num;
+	chain->offset = offset;
+	chain->len = len;
+	chain->ep_addr = ep_addr;
+	dbg_tfr("%s chain %u bytes @ 0x%llx, %d desc\n", engine->name, len,
+		ep_addr, num);
+	return 0;
+}
+
+/**
+ * xdma_chain_free() - free a chain's descriptors
+ */
+void xdma_chain_free(struct xdma_engine *engine, struct xdma_desc_chain *chain)
+{
+	if (chain->desc_virt)
+		dma_free_coherent(&engine->xdev->pdev->dev,
+				  XDMA_CHAIN_MAX_DESC * sizeof(struct xdma_desc),
+				  chain->desc_virt, chain->desc_bus);
+	memset(chain, 0, sizeof(*chain));
+}
+
+/**
+ * xdma_chain_submit() - run a prepared chain and wait for it
+ *
+ * the queued transfer points straight at the chain, so nothing is built or
+ * mapped here. Cache maintenance of the buffer is up to the caller.
+ * returns the bytes transferred, or negative on error
+ */
+ssize_t xdma_chain_submit(struct xdma_engine *engine,
+			  struct xdma_desc_chain *chain, int timeout_ms)
+{
+	struct xdma_transfer *xfer = &chain->xfer;
+	unsigned long flags;
+	ssize_t rv;
+
+	if (xdma_device_flag_check(engine->xdev, XDEV_FLAG_OFFLINE))
+		return -EBUSY;
+	if (!chain->desc_num)
+		return -EINVAL;
+
+	mutex_lock(&engine->desc_lock);
+	memset(xfer, 0, sizeof(*xfer));
+#if HAS_SWAKE_UP
+	init_swait_queue_head(&xfer->wq);
+#else
+	init_waitqueue_head(&xfer->wq);
+#endif
+	xfer->dir = engine->dir;
+	xfer->desc_virt = chain->desc_virt;
+	xfer->desc_bus = chain->desc_bus;
+	xfer->desc_num = chain->desc_num;
+	xfer->desc_adjacent = chain->desc_num;
+	xfer->desc_cmpl_th = chain->desc_num;
+	xfer->len = chain->len;
+	xfer->last_in_request = 1;
+	chain->last_used = jiffies;
+
+	rv = transfer_queue(engine, xfer);
+	if (rv < 0) {
+		mutex_unlock(&engine->desc_lock);
+		pr_info("unable to submit %s, %zd.\n", engine->name, rv);
+		return rv;
+	}
+
+	if (engine->cmplthp)
+		xdma_kthread_wakeup(engine->cmplthp);
+	else if (engine->poll_mode == ENGINE_POLL_HYBRID)
+		engine_hybrid_poll(engine, xfer);
+
+	if (timeout_ms > 0)
+		xlx_wait_event_interruptible_timeout(xfer->wq,
+			(xfer->state != TRANSFER_STATE_SUBMITTED),
+			msecs_to_jiffies(timeout_ms));
+	else
+		xlx_wait_event_interruptible(xfer->wq,
+			(xfer->state != TRANSFER_STATE_SUBMITTED));
+
+	spin_lock_irqsave(&engine->lock, flags);
+	switch (xfer->state) {
+	case TRANSFER_STATE_COMPLETED:
+		rv = xfer->len;
+		break;
+	case TRANSFER_STATE_FAILED:
+		pr_info("%s chain xfer %u @ 0x%llx failed\n", engine->name,
+			chain->len, chain->ep_addr);
+		rv = -EIO;
+		break;
+	default:
+		/* transfer can still be in-flight: stop it, as for submit */
+		pr_info("%s chain xfer %u @ 0x%llx timed out\n", engine->name,
+			chain->len, chain->ep_addr);
+		engine->stat_timeouts++;
+		rv = engine_status_read(engine, 0, 1);
+		if (rv == 0) {
+			rv = transfer_abort(engine, xfer);
+			if (rv == 0)
+				xdma_engine_stop(engine);
+		}
+		rv = -ERESTARTSYS;
+		break;
+	}
+	spin_unlock_irqrestore(&engine->lock, flags);
+	mutex_unlock(&engine->desc_lock);
+	return rv;
+}
+
 static struct xdma_dev *alloc_dev_instance(struct pci_dev *pdev)
 {
 	int i;
@@ -3823,6 +4794,7 @@ static struct xdma_dev *alloc_dev_instance(struct pci_dev *pdev)
 	for (i = 0; i < XDMA_CHANNEL_NUM_MAX; i++, engine++) {
 		spin_lock_init(&engine->lock);
 		mutex_init(&engine->desc_lock);
+		mutex_init(&engine->stream_lock);
 		INIT_LIST_HEAD(&engine->transfer_list);
 #if HAS_SWAKE_UP
 		init_swait_queue_head(&engine->shutdown_wq);
@@ -3837,6 +4809,7 @@ static struct xdma_dev *alloc_dev_instance(struct pci_dev *pdev)
 	for (i = 0; i < XDMA_CHANNEL_NUM_MAX; i++, engine++) {
 		spin_lock_init(&engine->lock);
 		mutex_init(&engine->desc_lock);
+		mutex_init(&engine->stream_lock);
 		INIT_LIST_HEAD(&engine->transfer_list);
 #if HAS_SWAKE_UP
 		init_swait_queue_head(&engine->shutdown_wq);
@@ -4157,8 +5130,8 @@ void *xdma_device_open(const char *mname, struct pci_dev *pdev, int *user_max,
 	if (rv < 0)
 		goto err_msix;
 
-	if (!poll_mode)
-		channel_interrupts_enable(xdev, ~0);
+	if (channel_irqs_used(xdev))
+		channel_interrupts_enable(xdev, ~xdev->mask_irq_wb);
 
 	/* Flush writes */
 	read_interrupts(xdev);
@@ -4258,6 +5231,7 @@ void xdma_device_offline(struct pci_dev *pdev, void *dev_hndl)
 		if (engine->magic == MAGIC_ENGINE) {
 			spin_lock_irqsave(&engine->lock, flags);
 			engine->shutdown |= ENGINE_SHUTDOWN_REQUEST;
+			engine_coalesce_stop(engine);
 
 			rv = xdma_engine_stop(engine);
 			if (rv < 0)
@@ -4273,6 +5247,7 @@ void xdma_device_offline(struct pci_dev *pdev, void *dev_hndl)
 		if (engine->magic == MAGIC_ENGINE) {
 			spin_lock_irqsave(&engine->lock, flags);
 			engine->shutdown |= ENGINE_SHUTDOWN_REQUEST;
+			engine_coalesce_stop(engine);
 
 			rv = xdma_engine_stop(engine);
 			if (rv < 0)
@@ -4326,10 +5301,10 @@ void xdma_device_online(struct pci_dev *pdev, void *dev_hndl)
 	}
 
 	/* re-write the interrupt table */
-	if (!poll_mode) {
+	if (channel_irqs_used(xdev)) {
 		irq_setup(xdev, pdev);
 
-		channel_interrupts_enable(xdev, ~0);
+		channel_interrupts_enable(xdev, ~xdev->mask_irq_wb);
 		user_interrupts_enable(xdev, xdev->mask_irq_user);
 		read_interrupts(xdev);
 	}
@@ -200,6 +200,8 @@ int bridge_mmap(struct file *file, struct vm_area_struct *vma)
 	uint64_t phys;				// LVB 21/2/2021: must be 64 bit
 	uint64_t vsize;				// LVB 21/2/2021: must be 64 bit
 	uint64_t psize;				// LVB 21/2/2021: must be 64 bit
+	uint64_t bar_len;
+	bool write_combine;
 	int rv;
 
 	rv = xcdev_check(__func__, xcdev, 0);
@@ -208,12 +210,22 @@ int bridge_mmap(struct file *file, struct vm_area_struct *vma)
 	xdev = xcdev->xdev;
 
 	off = vma->vm_pgoff << PAGE_SHIFT;
+	/*
+	 * XDMA_MMAP_WC_OFFSET in the offset asks for a write-combined map of
+	 * a RAM-like range; only for a BAR too small to have that offset.
+	 */
+	bar_len = pci_resource_len(xdev->pdev, xcdev->bar);
+	write_combine = (off & XDMA_MMAP_WC_OFFSET) &&
+		(bar_len <= XDMA_MMAP_WC_OFFSET);
+	if (write_combine)
+		off &= ~(uint64_t)XDMA_MMAP_WC_OFFSET;
+	if (off >= bar_len)
+		return -EINVAL;
 	/* BAR physical address */
 	phys = pci_resource_start(xdev->pdev, xcdev->bar) + off;
 	vsize = vma->vm_end - vma->vm_start;
 	/* complete resource */
-	psize = pci_resource_end(xdev->pdev, xcdev->bar) -
-		pci_resource_start(xdev->pdev, xcdev->bar) + 1 - off;
+	psize = bar_len - off;
 
 	dbg_sg("mmap(): xcdev = 0x%08lx\n", (unsigned long)xcdev);
 	dbg_sg("mmap(): cdev->bar = %d\n", xcdev->bar);
@@ -230,9 +242,15 @@ int bridge_mmap(struct file *file, struct vm_area_struct *vma)
 		return -EINVAL;
 	/*
 	 * pages must not be cached as this would result in cache line sized
-	 * accesses to the end point
+	 * accesses to the end point. A write-combined map is not cached
+	 * either, but sequential stores to it may be merged into one TLP
+	 * until the user's store barrier, so it is only for memory, never
+	 * for FIFO or control registers.
 	 */
-	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	if (write_combine)
+		vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+	else
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
 	/*
 	 * prevent touching the pages (byte access) for swap-in,
 	 * and prevent the pages from being swapped out
@@ -241,8 +259,8 @@ int bridge_mmap(struct file *file, struct vm_area_struct *vma)
 	/* make MMIO accessible to user space */
 	rv = io_remap_pfn_range(vma, vma->vm_start, phys >> PAGE_SHIFT,
 			vsize, vma->vm_page_prot);
-	dbg_sg("vma=0x%p, vma->vm_start=0x%lx, phys=0x%lx, size=%lu = %d\n",
-		vma, vma->vm_start, phys >> PAGE_SHIFT, vsize, rv);
+	dbg_sg("vma=0x%p, vma->vm_start=0x%lx, phys=0x%lx, size=%lu, wc=%d = %d\n",
+		vma, vma->vm_start, phys >> PAGE_SHIFT, vsize, write_combine, rv);
 
 	if (rv)
 		return -EAGAIN;
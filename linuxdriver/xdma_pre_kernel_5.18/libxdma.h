@@ -31,6 +31,7 @@
 #include <linux/kernel.h>
 #include <linux/pci.h>
 #include <linux/workqueue.h>
+#include <linux/hrtimer.h>
 
 /* Add compatibility checking for RHEL versions */
 #if defined(RHEL_RELEASE_CODE)
@@ -77,6 +78,18 @@
 #define NUM_POLLS_PER_SCHED 100
 
 #define XDMA_CHANNEL_NUM_MAX (4)
+
+/*
+ * per engine completion modes (the poll_mode module parameters)
+ * interrupt: wait for the engine completion interrupt
+ * writeback: a kernel thread polls the descriptor writeback
+ * hybrid: the engine interrupts, but the submitter busy polls the engine
+ * status for a short time first, so short transfers skip the interrupt latency
+ */
+#define ENGINE_POLL_INTR	0
+#define ENGINE_POLL_WB		1
+#define ENGINE_POLL_HYBRID	2
+#define ENGINE_POLL_MODE_MAX	ENGINE_POLL_HYBRID
 /*
  * interrupts per engine, rad2_vul.sv:237
  * .REG_IRQ_OUT	(reg_irq_from_ch[(channel*2) +: 2]),
@@ -459,6 +472,26 @@ struct xdma_transfer {
 	unsigned int len;
 	struct sg_table *sgt;
 	struct xdma_io_cb *cb;
+	u64 submit_ns;			/* ktime queued, for the latency stats */
+};
+
+/*
+ * a prepared descriptor chain for a transfer that is repeated with the same
+ * buffer, length and AXI address (see xdma_chain_build()). The descriptors are
+ * in their own coherent memory, not the engine ring, so they are kept between
+ * transfers and a repeat is queued without rebuilding them.
+ */
+#define XDMA_CHAIN_MAX_DESC	32
+
+struct xdma_desc_chain {
+	struct xdma_desc *desc_virt;	/* XDMA_CHAIN_MAX_DESC descriptors */
+	dma_addr_t desc_bus;
+	int desc_num;			/* descriptors in use; 0 = not built */
+	u32 offset;			/* chain key: offset into the buffer, */
+	u32 len;			/* length */
+	u64 ep_addr;			/* and AXI address */
+	unsigned long last_used;	/* jiffies, to pick a chain to reuse */
+	struct xdma_transfer xfer;
 };
 
 struct xdma_request_cb {
@@ -516,9 +549,47 @@ struct xdma_engine {
 	u8 *perf_buf_virt;
 	dma_addr_t perf_buf_bus; /* bus address */
 
+	/* Members for C2H streaming ring mode */
+	struct xdma_transfer *stream_transfer; /* cyclic transfer, or NULL */
+	u8 *stream_buf_virt;		/* coherent ring buffer */
+	dma_addr_t stream_buf_bus;	/* bus addr of ring */
+	u32 stream_buf_size;		/* ring bytes */
+	u32 stream_block_size;		/* bytes per descriptor */
+	u32 stream_tail;		/* bytes consumed by user (free running) */
+	u32 stream_overruns;		/* times head passed tail + ring size */
+	u64 stream_ep_addr;		/* AXI address of the stream */
+	u32 stream_queued;		/* H2C: bytes given to the engine */
+	struct mutex stream_lock;	/* start, stop and mmap of the ring */
+	struct file *stream_owner;	/* file that started the ring */
+	atomic_t stream_maps;		/* user mappings of the ring */
+
 	/* Members associated with polled mode support */
 	u8 *poll_mode_addr_virt;	/* virt addr for descriptor writeback */
 	dma_addr_t poll_mode_bus;	/* bus addr for descriptor writeback */
+	u8 poll_mode;			/* ENGINE_POLL_INTR/WB/HYBRID */
+	u32 hybrid_poll_us;		/* hybrid: busy poll time before irq */
+	u64 hybrid_hits;		/* hybrid: completions found by polling */
+	u64 hybrid_misses;		/* hybrid: completions left to the irq */
+	u64 hybrid_poll_ns;		/* hybrid: total time spent polling */
+	u64 stat_xfers;			/* transfers completed */
+	u64 stat_descs;			/* descriptors of completed transfers */
+	u64 stat_bytes;			/* bytes of completed transfers */
+	u64 stat_errors;		/* transfers failed by the engine */
+	u64 stat_timeouts;		/* transfers aborted after their timeout */
+	u64 stat_irqs;			/* engine interrupts taken */
+	u64 stat_latency_ns;		/* total queue to completion time */
+	u64 stat_latency_max_ns;	/* longest queue to completion time */
+
+	/* Members for interrupt moderation (irq_coalesce_us set) */
+	u32 irq_coalesce_us;		/* poll interval while moderated; 0 = off */
+	u32 irq_coalesce_count;		/* empty polls before the irq is unmasked */
+	u32 coalesce_idle;		/* empty polls so far */
+	bool coalescing;		/* irq masked; completions found by polls */
+	struct hrtimer coalesce_timer;	/* schedules the next poll */
+	u64 coalesce_batches;		/* irqs that started a moderated run */
+	u64 coalesce_polls;		/* timer polls while moderated */
+	u64 coalesce_xfers;		/* transfers completed by timer polls */
+	u32 coalesce_batch_max;		/* most transfers completed in one service */
 
 	/* Members associated with interrupt mode support */
 #if	HAS_SWAKE_UP
@@ -529,6 +600,7 @@ struct xdma_engine {
 	spinlock_t lock;		/* protects concurrent access */
 	int prev_cpu;			/* remember CPU# of (last) locker */
 	int msix_irq_line;		/* MSI-X vector for this engine */
+	int irq_cpu;			/* MSI-X affinity cpu, or -1 */
 	u32 irq_bitmask;		/* IRQ bit mask for this engine */
 	struct work_struct work;	/* Work queue for interrupt handling */
 
@@ -607,6 +679,7 @@ struct xdma_dev {
 	int engines_num;	/* Total engine count */
 	u32 mask_irq_h2c;
 	u32 mask_irq_c2h;
+	u32 mask_irq_wb;	/* engines in writeback mode: no completion irq */
 	struct xdma_engine engine_h2c[XDMA_CHANNEL_NUM_MAX];
 	struct xdma_engine engine_c2h[XDMA_CHANNEL_NUM_MAX];
 
@@ -674,6 +747,27 @@ int xdma_performance_submit(struct xdma_dev *xdev, struct xdma_engine *engine);
 struct xdma_transfer *engine_cyclic_stop(struct xdma_engine *engine);
 void enable_perf(struct xdma_engine *engine);
 void get_perf_stats(struct xdma_engine *engine);
+int xdma_engine_perf_run(struct xdma_engine *engine, bool run);
+void xdma_engine_perf_read(struct xdma_engine *engine, u64 *cycles,
+			   u64 *data_cycles, u64 *pending);
+
+int xdma_stream_start(struct xdma_dev *xdev, struct xdma_engine *engine,
+		      u32 ring_size, u32 block_size, u64 ep_addr);
+int xdma_stream_stop(struct xdma_engine *engine);
+u32 xdma_stream_head(struct xdma_engine *engine);
+int xdma_stream_credit(struct xdma_engine *engine, u32 head, u32 *tail,
+		       int timeout_ms);
+
+int xdma_chain_build(struct xdma_engine *engine, struct xdma_desc_chain *chain,
+		     struct sg_table *sgt, u32 offset, u32 len, u64 ep_addr);
+void xdma_chain_free(struct xdma_engine *engine, struct xdma_desc_chain *chain);
+ssize_t xdma_chain_submit(struct xdma_engine *engine,
+			  struct xdma_desc_chain *chain, int timeout_ms);
+
+int xdma_engine_poll_mode_set(struct xdma_engine *engine, unsigned int mode);
+int xdma_engine_irq_coalesce_set(struct xdma_engine *engine, unsigned int us,
+				 unsigned int count);
+int xdma_engine_irq_cpu_set(struct xdma_engine *engine, int cpu);
 
 int engine_addrmode_set(struct xdma_engine *engine, unsigned long arg);
 int engine_service_poll(struct xdma_engine *engine, u32 expected_desc_count);
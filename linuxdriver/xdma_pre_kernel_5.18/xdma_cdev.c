@@ -91,6 +91,318 @@ ssize_t xdma_dev_instance_show(struct device *dev,
 static DEVICE_ATTR_RO(xdma_dev_instance);
 #endif
 
+/*
+ * per engine completion mode attributes, on the SG DMA device
+ * (eg /sys/class/xdma/xdma0_c2h_0/poll_mode)
+ */
+static struct xdma_engine *sys_device_engine(struct device *dev)
+{
+	struct xdma_cdev *xcdev = (struct xdma_cdev *)dev_get_drvdata(dev);
+
+	return xcdev ? xcdev->engine : NULL;
+}
+
+static ssize_t poll_mode_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	return snprintf(buf, PAGE_SIZE, "%u\n", engine->poll_mode);
+}
+
+static ssize_t poll_mode_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+	unsigned int mode;
+	int rv;
+
+	if (!engine)
+		return -ENODEV;
+	rv = kstrtouint(buf, 0, &mode);
+	if (rv < 0)
+		return rv;
+	rv = xdma_engine_poll_mode_set(engine, mode);
+	return rv < 0 ? rv : count;
+}
+
+static DEVICE_ATTR_RW(poll_mode);
+
+static ssize_t hybrid_poll_us_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	return snprintf(buf, PAGE_SIZE, "%u\n", engine->hybrid_poll_us);
+}
+
+static ssize_t hybrid_poll_us_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+	unsigned int us;
+	int rv;
+
+	if (!engine)
+		return -ENODEV;
+	rv = kstrtouint(buf, 0, &us);
+	if (rv < 0)
+		return rv;
+	/* the submitter spins for this long: keep it well below a tick */
+	if (us > 1000)
+		return -EINVAL;
+	WRITE_ONCE(engine->hybrid_poll_us, us);
+	return count;
+}
+
+static DEVICE_ATTR_RW(hybrid_poll_us);
+
+/* hits misses poll_ns; writing anything resets the counts */
+static ssize_t hybrid_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	return snprintf(buf, PAGE_SIZE, "%llu %llu %llu\n",
+			engine->hybrid_hits, engine->hybrid_misses,
+			engine->hybrid_poll_ns);
+}
+
+static ssize_t hybrid_stats_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	mutex_lock(&engine->desc_lock);
+	engine->hybrid_hits = 0;
+	engine->hybrid_misses = 0;
+	engine->hybrid_poll_ns = 0;
+	mutex_unlock(&engine->desc_lock);
+	return count;
+}
+
+static DEVICE_ATTR_RW(hybrid_stats);
+
+/* cpu the engine's MSI-X interrupt is steered to, -1 for none */
+static ssize_t irq_cpu_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	return snprintf(buf, PAGE_SIZE, "%d\n", engine->irq_cpu);
+}
+
+static ssize_t irq_cpu_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+	int cpu;
+	int rv;
+
+	if (!engine)
+		return -ENODEV;
+	rv = kstrtoint(buf, 0, &cpu);
+	if (rv < 0)
+		return rv;
+	rv = xdma_engine_irq_cpu_set(engine, cpu);
+	return rv < 0 ? rv : count;
+}
+
+static DEVICE_ATTR_RW(irq_cpu);
+
+/*
+ * live profiling counters: engine clock cycles running, cycles with data,
+ * cycles with requests pending, then the transfers, descriptors and bytes
+ * completed. Write 1 to clear and start the cycle counters, 0 to stop them.
+ */
+static ssize_t perf_counters_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+	u64 cycles, data_cycles, pending;
+
+	if (!engine)
+		return -ENODEV;
+	xdma_engine_perf_read(engine, &cycles, &data_cycles, &pending);
+	return snprintf(buf, PAGE_SIZE, "%llu %llu %llu %llu %llu %llu\n",
+			cycles, data_cycles, pending, READ_ONCE(engine->stat_xfers),
+			READ_ONCE(engine->stat_descs),
+			READ_ONCE(engine->stat_bytes));
+}
+
+static ssize_t perf_counters_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+	bool run;
+	int rv;
+
+	if (!engine)
+		return -ENODEV;
+	rv = kstrtobool(buf, &run);
+	if (rv < 0)
+		return rv;
+	rv = xdma_engine_perf_run(engine, run);
+	return rv < 0 ? rv : count;
+}
+
+static DEVICE_ATTR_RW(perf_counters);
+
+/*
+ * always on engine statistics, since the module loaded: transfers, bytes and
+ * descriptors completed, transfers failed by the engine, transfers timed out,
+ * interrupts taken, then the total and longest time from queueing a transfer
+ * to its completion in ns. Each is a plain counter, so reading them costs the
+ * running stream nothing; the average latency is total / transfers.
+ */
+static ssize_t stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	return snprintf(buf, PAGE_SIZE,
+			"%llu %llu %llu %llu %llu %llu %llu %llu\n",
+			READ_ONCE(engine->stat_xfers),
+			READ_ONCE(engine->stat_bytes),
+			READ_ONCE(engine->stat_descs),
+			READ_ONCE(engine->stat_errors),
+			READ_ONCE(engine->stat_timeouts),
+			READ_ONCE(engine->stat_irqs),
+			READ_ONCE(engine->stat_latency_ns),
+			READ_ONCE(engine->stat_latency_max_ns));
+}
+
+static DEVICE_ATTR_RO(stats);
+
+/*
+ * interrupt moderation: the poll interval in us while the engine's interrupt
+ * is masked (0 = an interrupt for every completion), and the empty polls
+ * before it is unmasked again
+ */
+static ssize_t irq_coalesce_us_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	return snprintf(buf, PAGE_SIZE, "%u\n", engine->irq_coalesce_us);
+}
+
+static ssize_t irq_coalesce_us_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+	unsigned int us;
+	int rv;
+
+	if (!engine)
+		return -ENODEV;
+	rv = kstrtouint(buf, 0, &us);
+	if (rv < 0)
+		return rv;
+	rv = xdma_engine_irq_coalesce_set(engine, us,
+					  READ_ONCE(engine->irq_coalesce_count));
+	return rv < 0 ? rv : count;
+}
+
+static DEVICE_ATTR_RW(irq_coalesce_us);
+
+static ssize_t irq_coalesce_count_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	return snprintf(buf, PAGE_SIZE, "%u\n", engine->irq_coalesce_count);
+}
+
+static ssize_t irq_coalesce_count_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+	unsigned int polls;
+	int rv;
+
+	if (!engine)
+		return -ENODEV;
+	rv = kstrtouint(buf, 0, &polls);
+	if (rv < 0)
+		return rv;
+	rv = xdma_engine_irq_coalesce_set(engine,
+					  READ_ONCE(engine->irq_coalesce_us), polls);
+	return rv < 0 ? rv : count;
+}
+
+static DEVICE_ATTR_RW(irq_coalesce_count);
+
+/*
+ * moderated runs started by an interrupt, timer polls, transfers completed
+ * by those polls, and the most transfers completed by one service. With the
+ * stats interrupt count, the interrupts saved are polled transfers less polls
+ * that found none. Writing anything resets the counts.
+ */
+static ssize_t irq_coalesce_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+
+	if (!engine)
+		return -ENODEV;
+	return snprintf(buf, PAGE_SIZE, "%llu %llu %llu %u\n",
+			READ_ONCE(engine->coalesce_batches),
+			READ_ONCE(engine->coalesce_polls),
+			READ_ONCE(engine->coalesce_xfers),
+			READ_ONCE(engine->coalesce_batch_max));
+}
+
+static ssize_t irq_coalesce_stats_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct xdma_engine *engine = sys_device_engine(dev);
+	unsigned long flags;
+
+	if (!engine)
+		return -ENODEV;
+	spin_lock_irqsave(&engine->lock, flags);
+	engine->coalesce_batches = 0;
+	engine->coalesce_polls = 0;
+	engine->coalesce_xfers = 0;
+	engine->coalesce_batch_max = 0;
+	spin_unlock_irqrestore(&engine->lock, flags);
+	return count;
+}
+
+static DEVICE_ATTR_RW(irq_coalesce_stats);
+
+static struct attribute *engine_attrs[] = {
+	&dev_attr_poll_mode.attr,
+	&dev_attr_hybrid_poll_us.attr,
+	&dev_attr_hybrid_stats.attr,
+	&dev_attr_irq_cpu.attr,
+	&dev_attr_perf_counters.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_irq_coalesce_us.attr,
+	&dev_attr_irq_coalesce_count.attr,
+	&dev_attr_irq_coalesce_stats.attr,
+	NULL,
+};
+
+ATTRIBUTE_GROUPS(engine);
+
 static int config_kobject(struct xdma_cdev *xcdev, enum cdev_type type)
 {
 	int rv = -EINVAL;
@@ -231,9 +543,14 @@ static int create_sys_device(struct xdma_cdev *xcdev, enum cdev_type type)
 	else
 		last_param = engine ? engine->channel : 0;
 
-	xcdev->sys_device = device_create(g_xdma_class, &xdev->pdev->dev,
-		xcdev->cdevno, NULL, devnode_names[type], xdev->idx,
-		last_param);
+	if (type == CHAR_XDMA_H2C || type == CHAR_XDMA_C2H)
+		xcdev->sys_device = device_create_with_groups(g_xdma_class,
+			&xdev->pdev->dev, xcdev->cdevno, xcdev, engine_groups,
+			devnode_names[type], xdev->idx, last_param);
+	else
+		xcdev->sys_device = device_create(g_xdma_class,
+			&xdev->pdev->dev, xcdev->cdevno, NULL,
+			devnode_names[type], xdev->idx, last_param);
 
 	if (!xcdev->sys_device) {
 		pr_err("device_create(%s) failed\n", devnode_names[type]);
@@ -58,6 +58,10 @@ extern unsigned int desc_blen_max;
 extern unsigned int h2c_timeout;
 extern unsigned int c2h_timeout;
 
+/* persistent DMA buffers (IOCTL_XDMA_BUF_REGISTER) per SG DMA device */
+#define XDMA_PINNED_BUF_MAX	8
+struct xdma_pinned_buf;
+
 struct xdma_cdev {
 	unsigned long magic;		/* structure ID for sanity checks */
 	struct xdma_pci_dev *xpdev;
@@ -70,6 +74,8 @@ struct xdma_cdev {
 	struct xdma_user_irq *user_irq;	/* IRQ value, if needed */
 	struct device *sys_device;	/* sysfs device */
 	spinlock_t lock;
+	struct mutex pinned_lock;	/* protects pinned[] */
+	struct xdma_pinned_buf *pinned[XDMA_PINNED_BUF_MAX];
 };
 
 /* XDMA PCIe device specific book-keeping */
@@ -30,6 +30,7 @@
 #include <math.h>
 #include <pthread.h>
 #include <termios.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -40,11 +41,16 @@
 #include "../common/saturntypes.h"
 #include "../common/hwaccess.h"                     // access to PCIe read & write
 #include "../common/saturnregisters.h"              // register I/O for Saturn
+#include "../common/saturndrivers.h"                // FIFO monitor and DDC stream drivers
+#include "../common/ddcdemux.h"                     // DDC frame demultiplex
+#include "../common/p1interleave.h"                 // P1 USB frame sample interleave
+#include "../common/ringbuffer.h"                   // DMA and I/Q sample rings
 #include "../common/codecwrite.h"                   // codec register I/O for Saturn
 #include "../common/version.h"                      // version I/O for Saturn
+#include "../common/txsamples.h"                    // TX sample interpolation for the DUC
 
 
-int receivers = 1;                          // number of requested DDC (1-8)
+volatile int receivers = 1;                 // number of requested DDC (1-8)
 int rate = 0;                               // reqd sample rate (00=48KHz .. 11 = 384KHz)
 
 
@@ -61,6 +67,177 @@ void *SendOutgoingPacketData(void *arg);
 #define SDRBOARDID 1                    // Hermes
 #define SDRSWVERSION 1                  // version of this software
 #define VMETISFRAMESIZE 1032            // each Metis Frame
+#define VP1RECVBATCH 16                 // max incoming Metis frames received at once
+
+
+//
+// TX data path. Each EP2 frame holds 2 USB frames of 63 TX samples at 48KHz.
+// they are interpolated to the DUC's 192KHz 24 bit samples, and written by DMA
+// as in P2: frames are held until VDUCCOALESCEFRAMES are pending or the oldest has
+// waited VDUCCOALESCEDEADLINE us; each DMA is sized to the free FIFO space, and
+// frames that don't fit stay pending.
+//
+#define VEP2SAMPLESPERUSBFRAME 63                   // TX samples in each USB frame
+#define VDUCFRAMEBYTES (2 * VEP2SAMPLESPERUSBFRAME * VTXINTERPOLATION * 6)   // DUC bytes made from each EP2 frame
+#define VDUCFRAMEWORDS (VDUCFRAMEBYTES / 8)         // FIFO locations for each EP2 frame
+#define VMAXDUCPENDING 16                           // EP2 frames the DUC DMA buffer can hold
+#define VDUCCOALESCEFRAMES 2                        // pending frames written in one DMA
+#define VDUCCOALESCEDEADLINE 3000                   // us an EP2 frame's samples may be held
+#define VDUCFIFOWAIT 3000                           // us to wait for FIFO space before dropping
+
+struct P1DUC
+{
+  int fd;                                           // DMA write device
+  uint8_t* Buffer;                                  // DMA buffer, VMAXDUCPENDING frames
+  uint32_t PendingFrames;                           // frames in the buffer not yet written
+  struct timespec FirstFrameTime;                   // time 1st pending frame received
+  struct TXInterpolator Interpolator;
+  uint32_t FramesDropped;                           // statistics: frames lost because the FIFO was full
+} DUC = {-1, NULL, 0, {0, 0}, {{0}, {0}, 0}, 0};
+
+
+//
+// callback from saturn register code
+// P1 has no EER mode, so nothing to do
+//
+void HandlerSetEERMode(__attribute__((unused)) bool Unused)
+{
+
+}
+
+
+
+//
+// OpenP1DUC(void)
+// allocate the DUC DMA buffer, open the DMA device and set up the DUC FIFO.
+// return true if error
+//
+static bool OpenP1DUC(void)
+{
+  if(posix_memalign((void**)&DUC.Buffer, 4096, VMAXDUCPENDING * VDUCFRAMEBYTES) != 0)
+  {
+    printf("TX I/Q DMA buffer allocation failed\n");
+    return true;
+  }
+  DUC.fd = OpenDMADevice(VDUCDMADEVICE, O_RDWR);
+  if(DUC.fd < 0)
+  {
+    printf("XDMA write device open failed for TX I/Q data\n");
+    return true;
+  }
+  DMARegisterBuffer(DUC.fd, DUC.Buffer, VMAXDUCPENDING * VDUCFRAMEBYTES);
+  EnableDUCMux(false);                                  // disable temporarily
+  SetTXIQDeinterleaved(false);                          // P1 has no EER
+  ResetDUCMux();                                        // reset 64 to 48 mux
+  ResetDMAStreamFIFO(eTXDUCDMA);
+  SetupFIFOMonitorChannel(eTXDUCDMA, false);
+  EnableDUCMux(true);
+  return false;
+}
+
+
+//
+// StartP1DUC(void)
+// start the TX data path for a Metis START: TX samples from the EP2 frames go to the DUC
+//
+static void StartP1DUC(void)
+{
+  DUC.PendingFrames = 0;
+  DUC.FramesDropped = 0;
+  ResetTXInterpolator(&DUC.Interpolator);
+  SetTXEnable(true);
+}
+
+
+//
+// StopP1DUC(void)
+// stop the TX data path; any pending samples are dropped
+//
+static void StopP1DUC(void)
+{
+  SetTXEnable(false);
+  SetMOX(false);
+  if(DUC.FramesDropped)
+    printf("TX I/Q: %d frames dropped\n", DUC.FramesDropped);
+  DUC.PendingFrames = 0;
+}
+
+
+//
+// QueueP1TXSamples(uint8_t* Frame)
+// interpolate the TX samples of both USB frames of an EP2 frame into the DMA buffer.
+// if the buffer is full (the FIFO has not had space), the frame is dropped.
+//
+static void QueueP1TXSamples(uint8_t* Frame)
+{
+  uint8_t* Dest;
+
+  if(DUC.PendingFrames == VMAXDUCPENDING)
+  {
+    DUC.FramesDropped++;
+    return;
+  }
+  if(DUC.PendingFrames == 0)
+    clock_gettime(CLOCK_MONOTONIC, &DUC.FirstFrameTime);
+  Dest = DUC.Buffer + DUC.PendingFrames * VDUCFRAMEBYTES;
+  InterpolateP1TXSamples(&DUC.Interpolator, Dest, Frame + 16, VEP2SAMPLESPERUSBFRAME);
+  InterpolateP1TXSamples(&DUC.Interpolator, Dest + VDUCFRAMEBYTES / 2, Frame + 528, VEP2SAMPLESPERUSBFRAME);
+  DUC.PendingFrames++;
+}
+
+
+//
+// WriteP1TXSamples(void)
+// write the pending TX samples by DMA, if enough are pending or the oldest has waited
+// long enough. As many frames as the FIFO has space for are written; any others are
+// moved down and stay pending. The FIFO is only waited for briefly, so C&C is not held up.
+//
+static void WriteP1TXSamples(void)
+{
+  struct timespec Now;
+  uint32_t Elapsed;
+  uint32_t Depth;
+  uint32_t WriteFrames;
+  bool FIFOOverflow, FIFOOverThreshold, FIFOUnderflow;
+  unsigned int Current;
+  int Result;
+
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  Elapsed = (Now.tv_sec - DUC.FirstFrameTime.tv_sec) * 1000000 + (Now.tv_nsec - DUC.FirstFrameTime.tv_nsec) / 1000;
+  if((DUC.PendingFrames < VDUCCOALESCEFRAMES) && (Elapsed < VDUCCOALESCEDEADLINE))
+    return;
+
+  Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+  if(Depth < VDUCFRAMEWORDS)
+    Depth = WaitFIFOMonitorChannel(eTXDUCDMA, VDUCFRAMEWORDS, VDUCFIFOWAIT, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+  WriteFrames = Depth / VDUCFRAMEWORDS;
+  if(WriteFrames > DUC.PendingFrames)
+    WriteFrames = DUC.PendingFrames;
+  if(WriteFrames == 0)
+    return;                                         // try again after the next receive
+
+  Result = DMAWriteToFPGA(DUC.fd, DUC.Buffer, WriteFrames * VDUCFRAMEBYTES, VADDRDUCSTREAMWRITE);
+  if(Result != 0)
+  {
+    //
+    // the FIFO is reset by the recovery, so the pending frames are dropped too
+    //
+    EnableDUCMux(false);
+    ResetDUCMux();
+    if(RecoverDMAStream(eTXDUCDMA, &DUC.fd, VDUCDMADEVICE, Result))
+      printf("TX I/Q DMA device could not be opened again\n");
+    EnableDUCMux(true);
+    DUC.FramesDropped += DUC.PendingFrames;
+    DUC.PendingFrames = 0;
+    return;
+  }
+  DUC.PendingFrames -= WriteFrames;
+  if(DUC.PendingFrames != 0)
+  {
+    memmove(DUC.Buffer, DUC.Buffer + WriteFrames * VDUCFRAMEBYTES, DUC.PendingFrames * VDUCFRAMEBYTES);
+    DUC.FirstFrameTime = Now;                       // (its own receive time is not kept)
+  }
+}
 
 //
 // main program. Initialise, then handle incoming data
@@ -69,7 +246,7 @@ void *SendOutgoingPacketData(void *arg);
 //
 int main(void)
 {
-  int i, size;
+  int i, Msg, MsgCount;
   pthread_t thread;
 
 //
@@ -79,12 +256,13 @@ int main(void)
   uint8_t id[4] = {0xef, 0xfe, 1, 6};                                                   // don't think this is needed here
   uint32_t code;                                                        // command word from PC app
   struct ifreq hwaddr;                                                  // holds this device MAC address
-  struct sockaddr_in addr_ep2, addr_from[10];                           // holds MAC address of source of incoming messages
-  uint8_t UDPInBuffer[VMETISFRAMESIZE];                                   // 8 outgoing buffers
-  struct iovec iovecinst;                                             // iovcnt buffer - 1 for each outgoing buffer
-  struct msghdr datagram;                                           // multiple incoming message header
+  struct sockaddr_in addr_ep2, addr_from[VP1RECVBATCH];                 // holds MAC address of source of incoming messages
+  uint8_t UDPInBuffer[VP1RECVBATCH][VMETISFRAMESIZE];                   // incoming buffers
+  uint8_t* Frame;                                                       // one incoming message
+  struct iovec iovecinst[VP1RECVBATCH];                                 // iovcnt buffer - 1 for each incoming buffer
+  struct mmsghdr datagram[VP1RECVBATCH];                                // multiple incoming message headers
+  bool InTransaction;                                                   // true while C&C register writes are deferred
   struct timeval tv;
-  struct timespec ts;
   int yes = 1;
 
 
@@ -93,9 +271,10 @@ int main(void)
 //
   OpenXDMADriver();
   CodecInitialise();
-  InitialiseDACAttenROMs();
-  InitialiseCWKeyerRamp();
+  InitialiseCWKeyerRamp(false, 5000);                     // default 5 ms ramp, P1
   SetCWSidetoneEnabled(true);
+  if(OpenP1DUC())
+    printf("no TX I/Q data path\n");
   
 
 
@@ -141,92 +320,124 @@ int main(void)
 
 
   //
-  // now main processing loop. Process received Metis packets
+  // now main processing loop. Receive all queued Metis packets together (waiting for
+  // at least one, or the 1ms timeout), then process them in order.
+  // the C&C of all the EP2 frames in a batch is decoded in one register transaction,
+  // so each changed register is written once; it is committed before any other command.
   //
+  memset(iovecinst, 0, sizeof(iovecinst));
+  memset(datagram, 0, sizeof(datagram));
+  for(Msg = 0; Msg < VP1RECVBATCH; Msg++)
+  {
+    iovecinst[Msg].iov_base = UDPInBuffer[Msg];
+    iovecinst[Msg].iov_len = VMETISFRAMESIZE;
+    datagram[Msg].msg_hdr.msg_iov = &iovecinst[Msg];
+    datagram[Msg].msg_hdr.msg_iovlen = 1;
+    datagram[Msg].msg_hdr.msg_name = &addr_from[Msg];
+  }
   while(1)
   {
-    memset(&iovecinst, 0, sizeof(struct iovec));
-    memset(&datagram, 0, sizeof(datagram));
-
-    memcpy(UDPInBuffer, id, 4);                         // don't know why we do this for incoming messages
-    iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
-    iovecinst.iov_len = 1032;
-    datagram.msg_iov = &iovecinst;
-    datagram.msg_iovlen = 1;
-    datagram.msg_name = &addr_from[i];
-    datagram.msg_namelen = sizeof(addr_from[i]);
-
-    size = recvmsg(sock_ep2, &datagram, 0);         // get a batch of 8 messages
-    if(size < 0 && errno != EAGAIN)
+    for(Msg = 0; Msg < VP1RECVBATCH; Msg++)
+    {
+      memcpy(UDPInBuffer[Msg], id, 4);                  // don't know why we do this for incoming messages
+      datagram[Msg].msg_hdr.msg_namelen = sizeof(addr_from[Msg]);
+    }
+    MsgCount = recvmmsg(sock_ep2, datagram, VP1RECVBATCH, MSG_WAITFORONE, NULL);
+    if(MsgCount < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
     {
       perror("recvfrom");
       return EXIT_FAILURE;
     }
 
-    memcpy(&code, &UDPInBuffer, 4);                          // copy the Metis frame identifier
-    switch(code)
+    InTransaction = false;
+    for(Msg = 0; Msg < MsgCount; Msg++)
     {
-      // PC to Metis data frame, EP2 data. C&C, TX I/Q, spkr
-      // this is "normal SDR traffic"
-      case 0x0201feef:
-        printf("RX metis frame\n");
-
-
-        break;
-
-
-      // Metis "discover request" from PC
-      // send message back to MAC address and port of originating request message
-      case 0x0002feef:
-        printf("received metis discover request frame\n");
-        reply[2] = 2 + active_thread;                             // response 2 if not active, 3 if running
-        memset(&UDPInBuffer, 0, 60);
-        memcpy(&UDPInBuffer, reply, 11);
-        sendto(sock_ep2, &UDPInBuffer, 60, 0, (struct sockaddr *)&addr_from[i], sizeof(addr_from[i]));
-        break;
-
-
-      // Metis STOP command from PC
-      // terminate outgoing thread
-      case 0x0004feef:
-        enable_thread = 0;                                        // signal thread to terminate
-        while(active_thread) usleep(1000);                        // sleep until thread has terminated
-        break;
-
-
-      // Metis START commands to PC (01=IQ only; 02=wideband only; 03=both)
-      // initialise settings for outgoing data thread and start it
-      case 0x0104feef:
-      case 0x0204feef:
-      case 0x0304feef:
-        printf("received metis START command\n");
-        enable_thread = 0;                                // command outgoing thread to stop
-        while(active_thread) usleep(1000);                // wait until it has stopped
-
-        //
-        // get from MAC address and port; this is where the data goes back to
-        //
-        memset(&addr_ep6, 0, sizeof(addr_ep6));
-        addr_ep6.sin_family = AF_INET;
-        addr_ep6.sin_addr.s_addr = addr_from[i].sin_addr.s_addr;
-        addr_ep6.sin_port = addr_from[i].sin_port;
-        enable_thread = 1;                                // initialise thread to active
-        active_thread = 1;
-        //
-        // create outgoing packet thread
-        //
-        if(pthread_create(&thread, NULL, SendOutgoingPacketData, NULL) < 0)
-        {
-          perror("pthread_create");
-          return EXIT_FAILURE;
-        }
-        pthread_detach(thread);
-        break;
-    }// end switch (packet type)
+      Frame = UDPInBuffer[Msg];
+      memcpy(&code, Frame, 4);                                 // copy the Metis frame identifier
+      if(InTransaction && (code != 0x0201feef))
+      {
+        CommitRegisterTransaction();
+        InTransaction = false;
+      }
+      switch(code)
+      {
+        // PC to Metis data frame, EP2 data. C&C, TX I/Q, spkr
+        // this is "normal SDR traffic"
+        case 0x0201feef:
+          if(datagram[Msg].msg_len != VMETISFRAMESIZE)
+            break;
+          if(!InTransaction)
+          {
+            BeginRegisterTransaction();                     // write each changed register once, at the end
+            InTransaction = true;
+          }
+          process_incoming_CandC(Frame + 11);                 // C&C bytes of each USB frame
+          process_incoming_CandC(Frame + 523);
+          if(active_thread && (DUC.fd >= 0))
+            QueueP1TXSamples(Frame);
+          break;
+
+
+        // Metis "discover request" from PC
+        // send message back to MAC address and port of originating request message
+        case 0x0002feef:
+          printf("received metis discover request frame\n");
+          reply[2] = 2 + active_thread;                             // response 2 if not active, 3 if running
+          memset(Frame, 0, 60);
+          memcpy(Frame, reply, 11);
+          sendto(sock_ep2, Frame, 60, 0, (struct sockaddr *)&addr_from[Msg], sizeof(addr_from[Msg]));
+          break;
+
+
+        // Metis STOP command from PC
+        // terminate outgoing thread
+        case 0x0004feef:
+          enable_thread = 0;                                        // signal thread to terminate
+          while(active_thread) usleep(1000);                        // sleep until thread has terminated
+          StopP1DUC();
+          break;
+
+
+        // Metis START commands to PC (01=IQ only; 02=wideband only; 03=both)
+        // initialise settings for outgoing data thread and start it
+        case 0x0104feef:
+        case 0x0204feef:
+        case 0x0304feef:
+          printf("received metis START command\n");
+          enable_thread = 0;                                // command outgoing thread to stop
+          while(active_thread) usleep(1000);                // wait until it has stopped
+          StopP1DUC();
+
+          //
+          // get from MAC address and port; this is where the data goes back to
+          //
+          memset(&addr_ep6, 0, sizeof(addr_ep6));
+          addr_ep6.sin_family = AF_INET;
+          addr_ep6.sin_addr.s_addr = addr_from[Msg].sin_addr.s_addr;
+          addr_ep6.sin_port = addr_from[Msg].sin_port;
+          StartP1DUC();
+          enable_thread = 1;                                // initialise thread to active
+          active_thread = 1;
+          //
+          // create outgoing packet thread
+          //
+          if(pthread_create(&thread, NULL, SendOutgoingPacketData, NULL) < 0)
+          {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+          }
+          pthread_detach(thread);
+          break;
+      }// end switch (packet type)
+    }
+    if(InTransaction)
+      CommitRegisterTransaction();
 
 //
-// now do any "post packet" processing
+// now do any "post packet" processing: write the TX samples if it is time
 //
+    if(DUC.PendingFrames != 0)
+      WriteP1TXSamples();
   } //while(1)
   close(sock_ep2);                          // close incoming data socket
 
@@ -269,7 +480,9 @@ void process_incoming_CandC(uint8_t *frame)
     // DDC count; time stamp on / off
         case 0:
         case 1:
-            SetP1SampleRate((ESampleRate)((C1 & 3)+1), ((C4 >> 3) & 7)+1);
+            receivers = ((C4 >> 3) & 7) + 1;
+            SetP1SampleRate((ESampleRate)((C1 & 3)+1), receivers);
+            WriteP2DDCRateRegister();
             // skip Atlas bus controls (10MHz source, clock source, config, mic)
             SetClassEPA((bool)(C2 & 1));
             SetOpenCollectorOutputs(C2 >> 1);
@@ -279,7 +492,6 @@ void process_incoming_CandC(uint8_t *frame)
             SetAlexRXOut((bool)(C3 >> 7));
             SetAlexTXAnt(C4 & 3);
             SetDuplex((bool)((C4 >> 2) & 1));
-            SetNumP1DDC((C4 >> 3) & 7);
             EnablePPSStamp((bool)((C4 >> 6) & 1));
             // skip mercury frequency
             break;
@@ -289,7 +501,7 @@ void process_incoming_CandC(uint8_t *frame)
         // TX frequency (Hz)
         case 2:
         case 3:
-            SetDUCFrequency(0, data32, false);
+            SetDUCFrequency(data32, false);
             break;
 
 
@@ -354,7 +566,7 @@ void process_incoming_CandC(uint8_t *frame)
         // Alex RX1 filters; Alex disable T / R relay; Alex TX filters; set apollo bits
     case 18:
     case 19:
-        SetTXDriveLevel(0, C1);
+        SetTXDriveLevel(C1);
         SetMicBoost((bool)(C2 & 1));
         SetMicLineInput((bool)((C2 >> 1) & 1));
         SetApolloBits((bool)((C2 >> 2) & 1), (bool)((C2 >> 3) & 1), (bool)((C2 >> 4) & 1));
@@ -372,7 +584,7 @@ void process_incoming_CandC(uint8_t *frame)
         SetCodecLineInGain(C2 & 0b00011111);
         // Check P1 code: do I need C2 bits 7-5?
         // check P1 code: do I need C3 bits?
-        SetADCAttenuator(eADC1, C4&0b00011111, (bool)((C4 >> 5) & 1));
+        SetADCAttenuator(eADC1, ((C4 >> 5) & 1) ? (C4 & 0b00011111) : 0, true, false);
         break;
 
 
@@ -380,13 +592,12 @@ void process_incoming_CandC(uint8_t *frame)
     // ADC2 atten; ADC3 atten; CW keys reversed; keyer speed, keyer mode, keyer weight, keyer spacing
     case 22:
     case 23:
-        SetADCAttenuator(eADC2, C1 & 0b00011111, (bool)((C1 >> 5) & 1));
+        SetADCAttenuator(eADC2, ((C1 >> 5) & 1) ? (C1 & 0b00011111) : 0, true, false);
         // ignore ADC3 data
-        SetCWKeyerReversed((bool)((C2 >> 6) & 1));
-        SetCWKeyerSpeed(C3 & 0b00111111);
-        SetCWKeyerMode((C3 >> 6) & 3);
-        SetCWKeyerWeight(C4 & 0b01111111);              // what is keyer weight
-        SetCWKeyerSpacing((bool)((C4 >> 7) & 1));
+        // keyer mode 0=straight, 1=iambic mode A, 2=iambic mode B
+        SetCWIambicKeyer(C3 & 0b00111111, C4 & 0b01111111, (bool)((C2 >> 6) & 1), (((C3 >> 6) & 3) == 2),
+                         (bool)((C4 >> 7) & 1), (((C3 >> 6) & 3) != 0), false);
+        break;
     case 24:
     case 25:
     case 26:
@@ -405,7 +616,7 @@ void process_incoming_CandC(uint8_t *frame)
         SetDDCADC(5, C2 & 3);
         SetDDCADC(6, (C2 >> 2) & 3);
         SetDDCADC(7, (C2 >> 4) & 3);
-        SetADCAttenDuringTX(C3&0b00011111);
+        SetADCAttenuator(eADC1, C3 & 0b00011111, false, true);    // ADC atten during TX
       break;
 
 
@@ -413,7 +624,7 @@ void process_incoming_CandC(uint8_t *frame)
     // CW enable; CW sidetone volume; CW PTT delay
     case 30:
     case 31:
-        EnableCW((bool)(C1 & 1));
+        EnableCW((bool)(C1 & 1), false);
         SetCWSidetoneVol(C2);
         SetCWPTTDelay(C3);
         break;
@@ -464,15 +675,12 @@ void process_incoming_CandC(uint8_t *frame)
 // global holding the current step of C&C data. Each new USB frame updates this.
 //
 uint32_t OutgoingCandCStep;                         // 0-1-2-3-4 sequence for C&C data
-#define VDMABUFFERSIZE 32768									      // memory buffer to reserve
-#define VALIGNMENT 4096                             // buffer alignment
-#define VBASE 0x1000									              // DMA start at 4K into buffer
-#define VMETISFRAMESIZE 1032
-#define VBASE 0x1000                                // offset into I/Q buffer for DMA to start
+#define VDMABUFFERSIZE 131072                       // DMA ring size to reserve (4x largest DMA so OK)
+#define VIQRINGSIZE 65536                           // demultiplexed I/Q samples ring size per receiver
 #define VUSBSAMPLESIZE 504                          // useful data per USB Frame
-#define VDMATRANSFERSIZE 4096                       // read 4K at a time
-#define AXIBaseAddress 0x18000									    // address of StreamRead/Writer IP (Litefury only!)
-#define VIQBYTESPERMETISFRAME 228                   // 19 sets of (same) I/Q per USB, 2USB per metis
+#define VMINDDCDMASIZE 4096                         // smallest DMA transfer, and size granularity
+#define VMAXDDCDMASIZE 32768                        // largest DMA transfer
+#define VP1SENDBATCH 32                             // max Metis frames per sendmmsg() call
 
   //
   // 5 USB data headers with outgoing C&C data
@@ -487,35 +695,158 @@ uint32_t OutgoingCandCStep;                         // 0-1-2-3-4 sequence for C&
   };
 
 
+//
+// strategy:
+// the FPGA DDC stream is the same one protocol 2 uses: frames of 64 bit words, each
+// frame a DDC rate word then the samples of every enabled DDC. This thread:
+// 1. waits on the FIFO monitor until there is enough data, then DMAs all of it
+//    (rounded to VMINDDCDMASIZE) into the mirrored DMA ring
+// 2. demultiplexes each complete frame into a per receiver I/Q ring, using the
+//    common copy plan for the frame's rate word
+// 3. interleaves the receivers' samples into Metis frames, and sends them in batches.
+// a partial DDC frame left at the end of a DMA stays in the ring and is decoded
+// when the next DMA has been appended after it.
+//
+struct SPSCRingBuffer DMARing;                              // DMA data read from the DDC FIFO
+struct SPSCRingBuffer IQRing[VMAXP1RECEIVERS];              // demultiplexed I/Q samples per receiver
+uint8_t UDPBuffer[VP1SENDBATCH][VMETISFRAMESIZE];           // Metis frame buffers for one batch
+uint32_t P1SamplesDiscarded;                                // statistics: samples dropped because a ring was full
+uint32_t P1FIFOOverflows;                                   // statistics: FIFO over threshold events
+
+
 
 //
-// AddOutgoingC&CBytes(unsigned char* Ptr, uint32_t CandCSequence);
+// AddOutgoingC&CBytes(unsigned char* Ptr);
+//
+// add the 8 C&C bytes for one USB frame beginning at the address pointed,
+// and step the C&C sequence on.
+//
+static inline void AddOutgoingCandCBytes(uint8_t* Ptr)
+{
+  memcpy(Ptr, USBCandC + 8 * OutgoingCandCStep, 8);
+  if(++OutgoingCandCStep == 5)
+    OutgoingCandCStep = 0;
+}
+
+
+
 //
-// add the 8 C&C bytes for one USB frame beginning at the address pointed. 
-// the C&C sequence is given by the other parameter, which is updated by this
+// PrepareMetisFrames(void)
+// initialise the outgoing frame buffers when the number of receivers changes:
+// everything that does not change from frame to frame - the Metis header,
+// the (null) mic samples and the padding - is written once here.
 //
-void AddOutgoingCandCBytes(uint8_t* Ptr)
+static void PrepareMetisFrames(void)
 {
-  memcpy(Ptr, USBCandC+8*OutgoingCandCStep, 8);
-  switch(OutgoingCandCStep)
+  uint8_t metisid[4] = {0xef, 0xfe, 1, 6};                // Metis frame identifier
+  uint32_t Frame;
+
+  for(Frame = 0; Frame < VP1SENDBATCH; Frame++)
   {
-    case 0:
-      OutgoingCandCStep++;
-      break;
-    case 1:
-      OutgoingCandCStep++;
-      break;
-    case 2:
-      OutgoingCandCStep++;
-      break;
-    case 3:
-      OutgoingCandCStep++;
-      break;
-    case 4:
-    default:
-      OutgoingCandCStep = 0;
-      break;
+    memset(UDPBuffer[Frame], 0, VMETISFRAMESIZE);
+    memcpy(UDPBuffer[Frame], metisid, 4);
+  }
+}
+
+
+
+//
+// DemuxP1Frames(struct DDCFramePlan* Plan, bool* HeaderFound)
+// copy the receivers' samples from each complete frame in the DMA ring to their I/Q rings.
+// if the rate word marker is missing the data up to the next one is discarded.
+// any part frame is left in the DMA ring for next time.
+//
+static void DemuxP1Frames(struct DDCFramePlan* Plan, bool* HeaderFound)
+{
+  uint32_t DDCCounts[VNUMDDC];
+  uint32_t DecodeByteCount;
+  uint32_t RateWord;
+  uint32_t Cntr;
+  uint32_t Skip;
+  struct DDCFramePlanEntry* Entry;
+  uint8_t* DMAReadPtr;
+  uint8_t* DMAStartPtr;
+  uint8_t* DestBytePtr;
+
+  DecodeByteCount = RingBytesUsed(&DMARing);
+  DMAReadPtr = RingReadPtr(&DMARing);
+  DMAStartPtr = DMAReadPtr;
+  while (DecodeByteCount >= 16)
+  {
+    //
+    // find a rate word: the top byte of its 64 bit word is 0x80.
+    // on the 1st DMA the stream may not start at one; later, lost framing.
+    //
+    if(!*HeaderFound || (*(DMAReadPtr + 7) != 0x80))
+    {
+      Skip = 8 + FindDDCRateWord(DMAReadPtr + 8, DecodeByteCount - 8);
+      if(*HeaderFound)
+        P1SamplesDiscarded += Skip / 8;
+      *HeaderFound = (Skip < (DecodeByteCount & ~7U));
+      DMAReadPtr += Skip;
+      DecodeByteCount -= Skip;
+      continue;
+    }
+    RateWord = *(uint32_t*)DMAReadPtr;
+    if(RateWord != Plan->RateWord)
+    {
+      AnalyseDDCHeader(RateWord, DDCCounts);
+      BuildDDCFramePlan(Plan, RateWord, DDCCounts);
+    }
+    if(DecodeByteCount < Plan->FrameBytes)
+      break;                                                // part frame: wait for more data
+    for(Cntr = 0; Cntr < Plan->NumEntries; Cntr++)
+    {
+      Entry = Plan->Entries + Cntr;
+      if(Entry->DDC >= VMAXP1RECEIVERS)
+        continue;
+      if(RingBytesFree(&IQRing[Entry->DDC]) < 6 * Entry->WordCount)
+      {
+        P1SamplesDiscarded += Entry->WordCount;             // sender has fallen behind
+        continue;
+      }
+      DestBytePtr = RingWritePtr(&IQRing[Entry->DDC]);
+      Entry->Demux(DestBytePtr, DMAReadPtr + Entry->SrcOffset, Plan->FrameBytes, 1, Entry->WordCount);
+      RingCommitWrite(&IQRing[Entry->DDC], 6 * Entry->WordCount);
+    }
+    DMAReadPtr += Plan->FrameBytes;
+    DecodeByteCount -= Plan->FrameBytes;
+  }
+  RingConsume(&DMARing, DMAReadPtr - DMAStartPtr);
+}
+
+
+
+//
+// MakeMetisFrame(uint8_t* Frame, uint32_t SequenceCounter, uint32_t Receivers)
+// assemble one outgoing Metis frame: 2 USB frames, each of C&C bytes then
+// samples of interleaved I/Q for every receiver + 2 (null) mic bytes.
+// the frame must have been set up by PrepareMetisFrames() for this many receivers,
+// so only the sequence count, C&C bytes and I/Q samples are written.
+// the caller has checked each receiver's ring holds enough samples.
+//
+static void MakeMetisFrame(uint8_t* Frame, uint32_t SequenceCounter, uint32_t Receivers)
+{
+  uint32_t SamplesPerUSBFrame;
+  uint32_t USBFrame;
+  uint32_t RX;
+  uint8_t* USBFramePtr;
+  uint8_t* IQReadPtr[VMAXP1RECEIVERS];
+  P1Interleave Interleave;
+
+  SamplesPerUSBFrame = VUSBSAMPLESIZE / (6 * Receivers + 2);
+  Interleave = SelectP1Interleave(Receivers);
+  for(RX = 0; RX < Receivers; RX++)
+    IQReadPtr[RX] = RingReadPtr(&IQRing[RX]);
+  *(uint32_t *)(Frame + 4) = htonl(SequenceCounter);              // add sequence count
+  for(USBFrame=0; USBFrame < 2; USBFrame++)
+  {
+    USBFramePtr = Frame + 8 + 512*USBFrame;                       // point to start of USB frame
+    AddOutgoingCandCBytes(USBFramePtr);
+    Interleave(USBFramePtr + 8, IQReadPtr, SamplesPerUSBFrame);
   }
+  for(RX = 0; RX < Receivers; RX++)
+    RingConsume(&IQRing[RX], 12 * SamplesPerUSBFrame);
 }
 
 
@@ -526,186 +857,175 @@ void AddOutgoingCandCBytes(uint8_t* Ptr)
 // will be instructed to stop & exit by main loop setting enable_thread to 0
 // this code signals thread terminated by setting active_thread = 0
 //
-void *SendOutgoingPacketData(void *arg)
+void *SendOutgoingPacketData(__attribute__((unused)) void *arg)
 {
-//
-// memory buffers
-//
-  uint8_t* IQReadBuffer = NULL;											// data for DMA read from DDC
-	uint32_t IQBufferSize = VDMABUFFERSIZE;
-  uint8_t* MicBuffer = NULL;											    // data for DMA read from Mic
-	uint32_t MicBufferSize = VDMABUFFERSIZE;
   bool InitError = false;                         // becomes true if we get an initialisation error
-	unsigned char* IQReadPtr;								        // pointer for reading out an I or Q sample
-	unsigned char* IQHeadPtr;								        // ptr to 1st free location in I/Q memory
-	unsigned char* IQBasePtr;								        // ptr to DMA location in I/Q memory
-	uint32_t ResidueBytes;
-	uint32_t Depth = 0;
-	int DMAReadfile_fd = -1;											// DMA read file device
-	uint32_t RegisterValue;
-
+  bool HeaderFound = false;                       // true when the DDC stream is in sync
+  bool FIFOOverflow, FIFOOverThreshold, FIFOUnderflow;
+  unsigned int Current;                           // occupied FIFO locations
+  uint32_t Depth;
+  uint32_t DMATransferSize;
+  int DMAReadfile_fd = -1;											// DMA read file device
+  struct DDCFramePlan Plan;                       // copy plan for the current rate word
+  uint32_t Receivers;                             // receivers in the frames being made
+  uint32_t ActiveReceivers = 0;                   // receivers the I/Q rings were last reset for
+  uint32_t BytesPerMetisFrame;                    // I/Q bytes per receiver in one Metis frame
+  uint32_t RX;
+  uint32_t Frames;
+  uint32_t Frame;
+  uint32_t Available;                             // Metis frames' worth of data in every receiver's ring
 
 //
-// variables for outgoing UDP frame
+// variables for outgoing UDP frames
 //
-  struct iovec iovecinst;                                 // instance of iovec
-  struct msghdr datagram;
-  uint8_t UDPBuffer[VMETISFRAMESIZE];                     // Metis frame buffer
-  uint8_t metisid[4] = {0xef, 0xfe, 1, 6};                // Metis frame identifier
+  struct iovec iovecinst[VP1SENDBATCH];
+  struct mmsghdr datagrams[VP1SENDBATCH];
   uint32_t SequenceCounter = 0;                           // UDP sequence count
-  uint32_t USBFrame;
-  uint8_t *USBFramePtr;                                    // write address into o/p frame buffer
-  uint32_t IQCount;                                       // counter of words to read
+  int Sent;
+  int Result;
+
 //
 // initialise. Create memory buffers and open DMA file devices
 //
   OutgoingCandCStep = 0;                                  // initialise C&C output
+  P1SamplesDiscarded = 0;
+  P1FIFOOverflows = 0;
   printf("starting up outgoing thread\n");
-	posix_memalign((void **)&IQReadBuffer, VALIGNMENT, IQBufferSize);
-	if(!IQReadBuffer)
-	{
-		printf("I/Q read buffer allocation failed\n");
-		InitError = true;
-	}
-	IQReadPtr = IQReadBuffer + VBASE;							// offset 4096 bytes into buffer
-	IQHeadPtr = IQReadBuffer + VBASE;
-	IQBasePtr = IQReadBuffer + VBASE;
-  memset(IQReadBuffer, 0, IQBufferSize);
-
-
-	posix_memalign((void **)&MicBuffer, VALIGNMENT, MicBufferSize);
-	if(!MicBuffer)
-	{
-		printf("Mic sample buffer allocation failed\n");
-		InitError = true;
-	}
-  memset(MicBuffer, 0, MicBufferSize);
+  if(CreateRingBuffer(&DMARing, VDMABUFFERSIZE))
+  {
+    printf("I/Q read buffer allocation failed\n");
+    InitError = true;
+  }
+  for(RX = 0; RX < VMAXP1RECEIVERS; RX++)
+    if(CreateRingBuffer(&IQRing[RX], VIQRINGSIZE))
+    {
+      printf("receiver %d buffer allocation failed\n", RX);
+      InitError = true;
+    }
 
 //
 // open DMA device driver
 //
-	DMAReadfile_fd = open("/dev/xdma0_c2h_0", O_RDWR);
-	if(DMAReadfile_fd < 0)
-	{
-		printf("XDMA read device open failed\n");
-		InitError = true;
-	}
+  DMAReadfile_fd = OpenDMADevice(VDDCDMADEVICE, O_RDWR);
+  if(DMAReadfile_fd < 0)
+  {
+    printf("XDMA read device open failed\n");
+    InitError = true;
+  }
 
   //
-  // initialise outgoing metis frame
+  // initialise outgoing metis frames
   //
-  memset(&iovecinst, 0, sizeof(struct iovec));
-  memset(&datagram, 0, sizeof(datagram));
-  memcpy(UDPBuffer, metisid, 4);
-  iovecinst.iov_base = UDPBuffer;
-  iovecinst.iov_len = VMETISFRAMESIZE;
-  datagram.msg_iov = &iovecinst;
-  datagram.msg_iovlen = 1;
-  datagram.msg_name = &addr_ep6;                   // MAC addr & port to send to
-  datagram.msg_namelen = sizeof(addr_ep6);
-
-//
-// write 0 to GPIO to clear FIFO; then set 2 to GPIO for normal operation
-// then read depth
-//
-	RegisterWrite(0xA000, 0);				// write to the GPIO register
-	RegisterWrite(0xA000, 2);				// write to the GPIO register
-	printf("GPIO Register written with value=0 then 2 to reset FIFO\n");
-	RegisterValue = RegisterRead(0x9000);				// read the FIFO Depth register
-	printf("FIFO Depth register = %08x (should be 0)\n", RegisterValue);
-	Depth=0;
+  memset(iovecinst, 0, sizeof(iovecinst));
+  memset(datagrams, 0, sizeof(datagrams));
+  for(Frames = 0; Frames < VP1SENDBATCH; Frames++)
+  {
+    iovecinst[Frames].iov_base = UDPBuffer[Frames];
+    iovecinst[Frames].iov_len = VMETISFRAMESIZE;
+    datagrams[Frames].msg_hdr.msg_iov = &iovecinst[Frames];
+    datagrams[Frames].msg_hdr.msg_iovlen = 1;
+    datagrams[Frames].msg_hdr.msg_name = &addr_ep6;           // MAC addr & port to send to
+    datagrams[Frames].msg_hdr.msg_namelen = sizeof(addr_ep6);
+  }
 
 //
-// write 3 to GPIO to enable FIFO writes
+// stop the DDC data and clear the FIFO; then enable it again
 //
-	RegisterWrite(0xA000, 3);				// write to the GPIO register
-	printf("GPIO Register written with value=3, enabling writes\n");
+  SetRXDDCEnabled(false);
+  usleep(1000);                                           // give FIFO time to stop recording
+  SetupFIFOMonitorChannel(eRXDDCDMA, false);
+  ResetDMAStreamFIFO(eRXDDCDMA);
+  memset(&Plan, 0, sizeof(Plan));
+  Plan.RateWord = 0xFFFFFFFF;                             // illegal value to force a plan to be built
+  SetRXDDCEnabled(true);
 
 
 //
 // thread loop. runs continuously until commanded by main loop to exit
-// for now: add 1 RX data + mic data at 48KHz sample rate. Mic data is constant zero.
-// while there is enough I/Q data, make outgoing packets;
+// while there is enough I/Q data for every receiver, make outgoing packets;
 // when not enough data, read more.
 //
   while(!InitError)
   {
     if(!enable_thread) break;                                     // exit thread if commanded
-		
+
     //
-    // while there is enough I/Q data, make Metis frames
+    // if the number of receivers has changed, restart their rings together
+    // so the receivers' samples stay time aligned
     //
-    while((IQHeadPtr - IQReadPtr)>VIQBYTESPERMETISFRAME)
+    Receivers = receivers;
+    if((Receivers < 1) || (Receivers > VMAXP1RECEIVERS))
+      Receivers = 1;
+    if(Receivers != ActiveReceivers)
     {
-      *(uint32_t *)(UDPBuffer  + 4) = htonl(SequenceCounter++);     // add sequence count
-      for(USBFrame=0; USBFrame < 2; USBFrame++)
-      {
-        USBFramePtr = UDPBuffer + 8 + 512*USBFrame;                 // point to start of USB frame
-        AddOutgoingCandCBytes(USBFramePtr);
-        USBFramePtr += 8;
-        //
-        // now add I/Q and (null) microphone audio data.
-        // the board is pretending to be a Hermes, so need to offer back 4 receivers worth of data
-        //
-        for(IQCount = 0; IQCount < 19; IQCount++)
-        {
-          memcpy(USBFramePtr, IQReadPtr, 6);                        // copy one set of I/Q samples
-          USBFramePtr+= 6;
-          memcpy(USBFramePtr, IQReadPtr, 6);                        // copy same set of I/Q samples
-          USBFramePtr+= 6;
-          memcpy(USBFramePtr, IQReadPtr, 6);                        // copy same set of I/Q samples
-          USBFramePtr+= 6;
-          memcpy(USBFramePtr, IQReadPtr, 6);                        // copy same set of I/Q samples
-          USBFramePtr+= 6;
-          *USBFramePtr++ = 0;                                       // add 2 zero bytes for mic
-          *USBFramePtr++ = 0;
-          IQReadPtr += 6;
-        }
-        memset(USBFramePtr, 0, 10);                                 // add 10 padding bytes
-        USBFramePtr += 10;
-      }
+      for(RX = 0; RX < VMAXP1RECEIVERS; RX++)
+        ResetRingBuffer(&IQRing[RX]);
+      PrepareMetisFrames();
+      ActiveReceivers = Receivers;
+    }
+    BytesPerMetisFrame = 12 * (VUSBSAMPLESIZE / (6 * Receivers + 2));
+
+    //
+    // make Metis frames from all the complete frames' worth of I/Q data
+    // every receiver has, in batches of up to VP1SENDBATCH
+    //
+    Available = RingBytesUsed(&IQRing[0]);
+    for(RX = 1; RX < Receivers; RX++)
+      if(RingBytesUsed(&IQRing[RX]) < Available)
+        Available = RingBytesUsed(&IQRing[RX]);
+    Available /= BytesPerMetisFrame;
+    while(Available != 0)
+    {
+      Frames = (Available > VP1SENDBATCH) ? VP1SENDBATCH : Available;
+      for(Frame = 0; Frame < Frames; Frame++)
+        MakeMetisFrame(UDPBuffer[Frame], SequenceCounter++, Receivers);
+      Available -= Frames;
       //
-      // send outgoing packet
+      // send outgoing packets. sendmmsg() can send fewer than requested, so loop
       //
-      sendmsg(sock_ep2, &datagram, 0);
+      for(Sent = 0; Sent < (int)Frames; )
+      {
+        Result = sendmmsg(sock_ep2, datagrams + Sent, Frames - Sent, 0);
+        if(Result <= 0)
+          break;
+        Sent += Result;
+      }
     }
+
     //
-    // now bring in more data via DMA
-    // first copy any residue to the start of the buffer (before the DMA point)
-//
-		ResidueBytes = IQHeadPtr- IQReadPtr;
-		printf("Residue = %d bytes\n",ResidueBytes);
-		if(ResidueBytes != 0)					// if there is residue
-		{
-			memcpy(IQBasePtr-ResidueBytes, IQReadPtr, ResidueBytes);
-			IQReadPtr = IQBasePtr-ResidueBytes;
-		}
-		else
-			IQReadPtr = IQBasePtr;
-//
-// now wait until there is data, then DMA it
-//
-		Depth = RegisterRead(0x9000);				// read the user access register
-		printf("read: depth = %d\n", Depth);
-		while(Depth < 512)			// 512 locations = 4K bytes
-		{
-			usleep(1000);								// 1ms wait
-			Depth = RegisterRead(0x9000);				// read the user access register
-			printf("read: depth = %d\n", Depth);
-		}
-
-		printf("DMA read %d bytes from destination to base\n", VDMATRANSFERSIZE);
-		DMAReadFromFPGA(DMAReadfile_fd, IQBasePtr, VDMATRANSFERSIZE, AXIBaseAddress);
-		IQHeadPtr = IQBasePtr + VDMATRANSFERSIZE;
+    // now bring in more data via DMA: wait until the FIFO has at least
+    // a minimum transfer, then read all of it (up to the max)
+    //
+    Depth = WaitFIFOMonitorChannel(eRXDDCDMA, VMINDDCDMASIZE/8U, VFIFOWAITTIMEOUT,
+                                   &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+    if(FIFOOverThreshold)
+      P1FIFOOverflows++;
+    DMATransferSize = ((Depth * 8U) / VMINDDCDMASIZE) * VMINDDCDMASIZE;
+    if(DMATransferSize == 0)
+      continue;                                                   // timed out: check for stop
+    if(DMATransferSize > VMAXDDCDMASIZE)
+      DMATransferSize = VMAXDDCDMASIZE;
+    if(RingBytesFree(&DMARing) < DMATransferSize)
+    {
+      printf("DDC DMA ring full: resetting\n");
+      ResetRingBuffer(&DMARing);
+      HeaderFound = false;
+    }
+    DMAReadFromFPGA(DMAReadfile_fd, RingWritePtr(&DMARing), DMATransferSize, VADDRDDCSTREAMREAD);
+    RingCommitWrite(&DMARing, DMATransferSize);
+    DemuxP1Frames(&Plan, &HeaderFound);
   }     // end of while(!InitError) loop
 
 //
 // tidy shutdown of the thread
 //
+  SetRXDDCEnabled(false);
+  if(P1SamplesDiscarded || P1FIFOOverflows)
+    printf("outgoing thread: %d samples discarded, %d FIFO overflows\n", P1SamplesDiscarded, P1FIFOOverflows);
+  close(DMAReadfile_fd);
+  FreeRingBuffer(&DMARing);
+  for(RX = 0; RX < VMAXP1RECEIVERS; RX++)
+    FreeRingBuffer(&IQRing[RX]);
   active_thread = 0;        // signal that thread has closed
-	close(DMAReadfile_fd);
-  free(IQReadBuffer);
-  free(MicBuffer);
   return NULL;
 }
-
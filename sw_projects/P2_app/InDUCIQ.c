@@ -17,6 +17,14 @@
 #include <stdint.h>
 #include "../common/saturntypes.h"
 #include "InDUCIQ.h"
+#include "telemetry.h"
+#include "p2config.h"
+#include "rxtimestamp.h"
+#include "pcapcapture.h"
+#include "heartbeat.h"
+#include "stageprofile.h"
+#include "ducreorder.h"
+#include "streamengine.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -24,9 +32,15 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
 #include "../common/hwaccess.h"
+#include "../common/txsamples.h"
 
 
 
@@ -34,151 +48,601 @@
 #define VMEMWORDSPERFRAME 180                       // memory writes per UDP frame
 #define VBYTESPERSAMPLE 6							// 24 bit + 24 bit samples
 #define VDMABUFFERSIZE 32768						// memory buffer to reserve
-#define VALIGNMENT 4096                             // buffer alignment
-#define VBASE 0x1000								// DMA start at 4K into buffer
 #define VDMATRANSFERSIZE 1440                       // write 1 message at a time
-#define VSTARTUPDELAY 100                           // 100 messages (~100ms) before reporting under or overflows
+#define VMAXDUCBATCH 16                             // max UDP frames received at once
+#define VMAXDUCPENDING ((VDMABUFFERSIZE - VSTREAMBASE) / VDMATRANSFERSIZE)    // frames the DMA buffer can hold
+#define VPREARMBASE VDMABUFFERSIZE                  // zero frames for pre-arm follow the DMA area
+#define VDUCSTREAMRINGSIZE 65536                    // driver H2C streaming ring size
+#define VDUCSTREAMBLOCKSIZE 4096                    // bytes per streaming ring descriptor
+
+
+//
+// coalescing settings: hold up to DUCCoalesceFrames frames, but no frame longer than
+// DUCCoalesceDeadline microseconds, then write them in one DMA
+//
+uint32_t DUCCoalesceFrames = 1;                     // 1 = write each received batch at once
+uint32_t DUCCoalesceDeadline = 0;                   // us
+
+
+//
+// TX pre-arm settings: on MOX, top the TX FIFO up to DUCPrearmFrames frames of zero
+// samples before the first client frame, and optionally ramp that frame up from zero
+//
+uint32_t DUCPrearmFrames = 0;                       // 0 = no pre-arm
+bool DUCPrearmRamp = false;
+
+
+//
+// EER mode asked for by HandlerSetEERMode(); the DUC thread changes mode when
+// it has no frames pending. In EER mode each received sample is followed by its
+// envelope sample, so every received frame makes two DMA frames.
+//
+atomic_bool DUCEERRequested = false;
+
+
+//
+// TX I/Q playback: a mapped file of samples in the DUC I/Q message format,
+// played in place of the client's messages. NULL if not set.
+//
+static uint8_t* PlaybackBase = NULL;
+static size_t PlaybackSize;                         // bytes: whole samples only
+static size_t PlaybackOffset;                       // next sample to play
+
+
+//
+// sequence number reorder buffer, used if duc_reorder_frames is set
+//
+static struct DUCReorderBuffer DUCReorder;
+
+
+//
+// set the DUC coalescing parameters
+//
+void SetDUCCoalescing(uint32_t MaxFrames, uint32_t DeadlineUs)
+{
+    if (MaxFrames < 1)
+        MaxFrames = 1;
+    else if (MaxFrames > VMAXDUCPENDING)
+        MaxFrames = VMAXDUCPENDING;
+    DUCCoalesceFrames = MaxFrames;
+    DUCCoalesceDeadline = DeadlineUs;
+}
+
+
+//
+// set the TX pre-arm parameters
+//
+void SetDUCPrearm(uint32_t Frames, bool Ramp)
+{
+    if (Frames > VMAXDUCPREARM)
+        Frames = VMAXDUCPREARM;
+    DUCPrearmFrames = Frames;
+    DUCPrearmRamp = Ramp;
+}
+
+
+//
+// set TX I/Q playback from a file
+//
+bool SetDUCPlayback(char* Path)
+{
+    int fd;
+    struct stat Stat;
+    uint8_t* Base;
+
+    fd = open(Path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &Stat) != 0) || ((size_t)Stat.st_size < VBYTESPERSAMPLE))
+    {
+        printf("TX I/Q playback file %s could not be opened\n", Path);
+        if (fd >= 0)
+            close(fd);
+        return true;
+    }
+    Base = mmap(NULL, Stat.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);                                                  // mapping stays valid
+    if (Base == MAP_FAILED)
+    {
+        printf("TX I/Q playback file %s could not be mapped\n", Path);
+        return true;
+    }
+    madvise(Base, Stat.st_size, MADV_SEQUENTIAL);
+    PlaybackBase = Base;
+    PlaybackSize = (Stat.st_size / VBYTESPERSAMPLE) * VBYTESPERSAMPLE;
+    PlaybackOffset = 0;
+    printf("TX I/Q playback from %s: %zu samples, %.3fs at 192KHz, looped\n",
+           Path, PlaybackSize / VBYTESPERSAMPLE, (double)(PlaybackSize / VBYTESPERSAMPLE) / 192000.0);
+    return false;
+}
+
+
+//
+// copy the next frame of playback samples, as they would be in a received
+// message, going back to the start of the file when its end is reached
+//
+static void ReadPlaybackFrame(uint8_t* Dest)
+{
+    uint32_t Remaining = VIQSAMPLESPERFRAME * VBYTESPERSAMPLE;
+    uint32_t Bytes;
+
+    while (Remaining != 0)
+    {
+        Bytes = Remaining;
+        if (Bytes > PlaybackSize - PlaybackOffset)
+            Bytes = PlaybackSize - PlaybackOffset;
+        memcpy(Dest, PlaybackBase + PlaybackOffset, Bytes);
+        Dest += Bytes;
+        Remaining -= Bytes;
+        PlaybackOffset += Bytes;
+        if (PlaybackOffset == PlaybackSize)
+            PlaybackOffset = 0;
+    }
+}
+
+
+//
+// scale one frame of 24 bit big endian I/Q samples (as received) by a linear ramp from 0
+// to full amplitude, so TX starts from the zero pre-arm frames without a step
+//
+static void RampIQFrame(uint8_t* Samples)
+{
+    int32_t Value;
+    uint32_t Sample, Word;
+    uint8_t* Ptr;
+
+    for (Sample = 0; Sample < VIQSAMPLESPERFRAME; Sample++)
+    {
+        for (Word = 0; Word < 2; Word++)            // I then Q
+        {
+            Ptr = Samples + Sample * VBYTESPERSAMPLE + Word * 3;
+            Value = (int32_t)(((uint32_t)Ptr[0] << 24) | ((uint32_t)Ptr[1] << 16) | ((uint32_t)Ptr[2] << 8)) >> 8;
+            Value = (int32_t)(((int64_t)Value * Sample) / VIQSAMPLESPERFRAME);
+            Ptr[0] = (Value >> 16) & 0xFF;
+            Ptr[1] = (Value >> 8) & 0xFF;
+            Ptr[2] = Value & 0xFF;
+        }
+    }
+}
+
+
+//
+// microseconds since an earlier time
+//
+static uint32_t MicrosecondsSince(struct timespec* Start)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (Now.tv_sec - Start->tv_sec) * 1000000 + (Now.tv_nsec - Start->tv_nsec) / 1000;
+}
+
+
+//
+// recover the DUC DMA after a failed write. The mux is reset along with the FIFO,
+// so the stream starts again on a frame (and, in EER mode, on an I/Q and envelope pair).
+// return true if error
+//
+static bool RecoverDUCDMA(struct StreamEngine* Engine, int Result)
+{
+    bool Error;
+
+    EnableDUCMux(false);
+    ResetDUCMux();
+    Error = RecoverStreamDMA(Engine, Result);
+    EnableDUCMux(true);
+    return Error;
+}
 
 //
 // listener thread for incoming DUC I/Q packets
 // planned strategy: just DMA spkr data when available; don't copy and DMA a larger amount.
 // if sufficient FIFO data available: DMA that data and transfer it out. 
 // if it turns out to be too inefficient, we'll have to try larger DMA.
+// all queued messages are received together by recvmmsg(); their samples are put
+// one after another in the DMA buffer and written to the FPGA in one DMA.
+// frames can be coalesced: they are held until DUCCoalesceFrames are pending, or the
+// oldest has waited DUCCoalesceDeadline us. Each DMA is then sized to the free FIFO space;
+// any frames that don't fit are moved down and stay pending.
+// when MOX is asserted the FIFO can be pre-armed: zero frames are written first so
+// the DUC has samples as soon as it keys, rather than waiting for the first DMA.
+// in EER mode the thread makes the envelope samples, and the mux de-interleaves them.
+// with tx_stream_ring set, samples go through the driver's H2C streaming ring: the
+// engine is held off by the FPGA while the FIFO is full, so all pending frames are
+// written at once and the FIFO depth is not read before each write.
+// with duc_direct_receive set, recvmmsg() scatters each message: its sequence number
+// to one buffer, and its samples straight to their slot in the DMA buffer, where
+// they are swapped in place, saving a copy of the TX stream. not used in EER mode,
+// where each message makes two DMA frames, or with playback.
+// with duc_reorder_frames set, frames go through a reorder buffer (ducreorder.c):
+// frames that arrive out of order are put back in sequence, waiting up to
+// duc_reorder_us for a missing frame, which is then concealed. Direct receive is
+// not used then, as a frame's place in the DMA buffer isn't known until it is released.
+// with TX I/Q playback set, client messages are not read: the DMA buffer is kept
+// full of frames from the file, and waiting for FIFO space (or the streaming ring
+// being held off) paces them at the rate the DUC takes samples.
 //
 void *IncomingDUCIQ(void *arg)                          // listener thread
 {
     struct ThreadSocketData *ThreadData;                  // socket etc data for this thread
-    struct sockaddr_in addr_from;                         // holds MAC address of source of incoming messages
-    uint8_t UDPInBuffer[VDUCIQSIZE];                      // incoming buffer
-    struct iovec iovecinst;                               // iovcnt buffer - 1 for each outgoing buffer
-    struct msghdr datagram;                               // multiple incoming message header
-    int size;                                             // UDP datagram length
+    struct sockaddr_in addr_from[VMAXDUCBATCH];           // holds MAC address of source of incoming messages
+    uint8_t UDPInBuffer[VMAXDUCBATCH][VDUCIQSIZE];        // incoming buffers
+    struct iovec iovecinst[VMAXDUCBATCH][2];              // iovcnt buffer - 1 or 2 for each incoming buffer
+    uint32_t SequenceWords[VMAXDUCBATCH];                 // sequence numbers, for direct receive
+    struct mmsghdr datagram[VMAXDUCBATCH];                // multiple incoming message headers
+    uint8_t StampInfo[VMAXDUCBATCH][VRXSTAMPCMSGSIZE] __attribute__((aligned(8)));   // receive stamps of each message
+    uint64_t PendingStamps[VMAXDUCPENDING];               // kernel receive stamp of each pending frame; 0 if none
+    uint64_t PendingHardware[VMAXDUCPENDING];             // NIC receive stamp of each pending frame; 0 if none
+    uint32_t Frame;
+    int MsgCount;                                         // messages received by recvmmsg()
+    int Msg;
+    uint32_t RecvLimit;                                   // max messages to receive this time
+    uint32_t ReceiveBase;                                 // pending frames when the messages were received
+    bool Direct;                                          // true if samples are received into the DMA buffer
+    bool Reorder;                                         // true if frames go through the reorder buffer
+    uint8_t* Samples;                                     // samples of one received message
+    uint64_t Stamp, Hardware;                             // its receive stamps
+    struct DUCReadyFrame Ready[VMAXDUCPENDING];           // frames to add to the DMA buffer, in order
+    uint32_t ReadyCount, ReadyFrame;
+    uint32_t Room;                                        // frames the DMA buffer has space for
+    uint32_t ReorderWait;                                 // us until held frames are due to be released
+    uint32_t PendingFrames = 0;                           // frames in DMA buffer not yet written
+    uint32_t WriteFrames;                                 // frames to write in this DMA
+    uint32_t Elapsed;                                     // us since 1st pending frame received
+    struct timespec FirstFrameTime;                       // time 1st pending frame received
+    uint64_t FirstFrameStamp = 0;                         // the same, for telemetry
+    struct timespec PollTimeout;
+    struct pollfd PollSocket;
+    struct SequenceTracker Sequence = {0};                // inbound sequence checking
 
                                                           //
-// variables for DMA buffer 
+// DMA to the DUC FIFO
 //
-    uint8_t* IQWriteBuffer = NULL;							// data for DMA to write to DUC
-    uint32_t IQBufferSize = VDMABUFFERSIZE;
+    struct StreamEngine Engine;                             // DMA buffer, device and FIFO
+    uint8_t* IQWriteBuffer;							        // data for DMA to write to DUC
     bool InitError = false;                                 // becomes true if we get an initialisation error
-    unsigned char* IQReadPtr;								// pointer for reading out an I/Q sample
-    unsigned char* IQHeadPtr;								// ptr to 1st free location in I/Q memory
     unsigned char* IQBasePtr;								// ptr to DMA location in I/Q memory
     uint32_t Depth = 0;
-    int DMAWritefile_fd = -1;								// DMA read file device
-    bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;
-    uint32_t Cntr;                                          // sample counter
-    uint8_t* SrcPtr;                                        // pointer to data from Thetis
-    uint8_t* DestPtr;                                       // pointer to DMA buffer data
-    unsigned int Current;                                   // current occupied locations in FIFO
-    unsigned int StartupCount;                              // used to delay reporting of under & overflows
     bool PrevSDRActive;                                     // used to detect change of state
+    bool PrevMOX = false;                                   // used to detect MOX being asserted
+    bool RampNextFrame = false;                             // true if the next frame is ramped up
+    uint32_t PrearmWords;                                   // FIFO words to pre-arm with
+    bool EERActive = false;                                 // true if making envelope samples
+    uint32_t FramesPerMessage = 1;                          // DMA frames per received frame
+    int Result;                                             // DMA result
+    struct StageProfiler Profiler;                          // receive, swap and DMA CPU cost
+    bool Playback = (PlaybackBase != NULL);                 // true if playing a file, not client data
 
     ThreadData = (struct ThreadSocketData *)arg;
     ThreadData->Active = true;
     printf("spinning up DUC I/Q thread with port %d\n", ThreadData->Portid);
   
     //
-    // setup DMA buffer
+    // setup DMA buffer: the DMA area, then zero frames; and open DMA device driver,
+    // through the streaming ring if set
     //
-    posix_memalign((void**)&IQWriteBuffer, VALIGNMENT, IQBufferSize);
-    if (!IQWriteBuffer)
+    InitStreamEngine(&Engine, "TX DUC", eTXDUCDMA, VDUCDMADEVICE, VADDRDUCSTREAMWRITE, true,
+                     eTelDUC, eBeatDUC, 0b00000100);
+    Engine.ReportFull = !Playback;                          // playback keeps the FIFO full
+    InitError = OpenStreamEngine(&Engine, VDMABUFFERSIZE + VMAXDUCPREARM * VDMATRANSFERSIZE, 0,
+                                 VDUCSTREAMRINGSIZE, VDUCSTREAMBLOCKSIZE);
+    if (InitError && (Engine.Buffer == NULL))
     {
-        printf("I/Q TX write buffer allocation failed\n");
-        InitError = true;
+        ThreadData->Active = false;                         // no buffer to write from
+        return NULL;
     }
-    IQReadPtr = IQWriteBuffer + VBASE;							// offset 4096 bytes into buffer
-    IQHeadPtr = IQWriteBuffer + VBASE;
-    IQBasePtr = IQWriteBuffer + VBASE;
-    memset(IQWriteBuffer, 0, IQBufferSize);
+    IQWriteBuffer = Engine.Buffer;
+    IQBasePtr = Engine.BasePtr;
 
-    //
-    // open DMA device driver
-    //
-    DMAWritefile_fd = open(VDUCDMADEVICE, O_RDWR);
-    if (DMAWritefile_fd < 0)
-    {
-        printf("XDMA write device open failed for TX I/Q data\n");
-        InitError = true;
-    }
-        
 //
 // setup hardware
 //
     EnableDUCMux(false);                                  // disable temporarily
     SetTXIQDeinterleaved(false);                          // not interleaved (at least for now!)
     ResetDUCMux();                                        // reset 64 to 48 mux
-    ResetDMAStreamFIFO(eTXDUCDMA);
-    SetupFIFOMonitorChannel(eTXDUCDMA, false);
+    StartStreamFIFO(&Engine);
     EnableDUCMux(true);                                   // enable operation
+    if(UseDebug)
+        printf("DUC I/Q sample swap using %s code\n", GetTXSampleKernelName());
+    if(UseDebug && P2Config.DUCDirectReceive)
+        printf("DUC I/Q: samples received straight into the DMA buffer\n");
+    if(UseDebug)
+        printf("DUC I/Q: coalesce up to %d frames, %dus deadline\n", DUCCoalesceFrames, DUCCoalesceDeadline);
+    if(Playback)
+        printf("DUC I/Q: playing the TX I/Q file; client DUC I/Q messages ignored\n");
+    if(UseDebug && DUCPrearmFrames)
+        printf("DUC I/Q: pre-arm %d frames on MOX%s\n", DUCPrearmFrames, DUCPrearmRamp ? ", ramped" : "");
 
   //
   // main processing loop
   //
+    HeartbeatStart(eBeatDUC);
+    StageProfilerInit(&Profiler);
     while(1)
     {
+        Heartbeat(eBeatDUC, eBeatRunning);
         if(SDRActive & !PrevSDRActive)                      // detect SDRActive has been asserted
-            StartupCount = VSTARTUPDELAY;
+        {
+            RestartStreamStartup(&Engine);
+            TelemetryResetSequence(&Sequence);
+            ResetDUCReorder(&DUCReorder);
+            StageProfilerStart(&Profiler);
+        }
         PrevSDRActive = SDRActive;
-
-        memset(&iovecinst, 0, sizeof(struct iovec));
-        memset(&datagram, 0, sizeof(datagram));
-        iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
-        iovecinst.iov_len = VDUCIQSIZE;
-        datagram.msg_iov = &iovecinst;
-        datagram.msg_iovlen = 1;
-        datagram.msg_name = &addr_from;
-        datagram.msg_namelen = sizeof(addr_from);
-        size = recvmsg(ThreadData->Socketid, &datagram, 0);         // get one message. If it times out, ges size=-1
-        if(size < 0 && errno != EAGAIN)
+        //
+        // change EER mode: the FIFO must be empty and the mux reset, so only with nothing pending
+        //
+        if((DUCEERRequested != EERActive) && (PendingFrames == 0))
         {
-            perror("recvfrom fail, TX I/Q data");
-            return EXIT_FAILURE;
+            EERActive = DUCEERRequested;
+            DrainStreamDMA(&Engine);                            // let any streaming ring drain first
+            EnableDUCMux(false);
+            SetTXIQDeinterleaved(EERActive);
+            ResetDUCMux();
+            ResetDMAStreamFIFO(eTXDUCDMA);
+            EnableDUCMux(true);
+            FramesPerMessage = EERActive ? 2 : 1;
+            printf("DUC I/Q: EER envelope generation %s\n", EERActive ? "on" : "off");
         }
-        if(size == VDUCIQSIZE)
+        //
+        // TX pre-arm: when MOX is asserted, top the FIFO up with zero frames ahead of any pending
+        //
+        if(MOXAsserted && !PrevMOX && (DUCPrearmFrames != 0) && !InitError)
         {
-            if(StartupCount != 0)                                   // decrement startup message count
-                StartupCount--;
-            NewMessageReceived = true;
-            Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);           // read the FIFO free locations
-            if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
-                printf("TX DUC FIFO Overthreshold, depth now = %d\n", Current);
-
-            if((StartupCount == 0) && FIFOUnderflow)
+            Depth = ReadStreamFIFO(&Engine);
+            PrearmWords = DUCPrearmFrames * VMEMWORDSPERFRAME;
+            if(Engine.Current < PrearmWords)
             {
-                GlobalFIFOOverflows |= 0b00000100;
+                PrearmWords = ((PrearmWords - Engine.Current) / VMEMWORDSPERFRAME) * VMEMWORDSPERFRAME;
+                if(PrearmWords > Depth)
+                    PrearmWords = (Depth / VMEMWORDSPERFRAME) * VMEMWORDSPERFRAME;
+                if(PrearmWords != 0)
+                {
+                    Result = TransferStreamDMA(&Engine, IQWriteBuffer + VPREARMBASE,
+                                               (PrearmWords / VMEMWORDSPERFRAME) * VDMATRANSFERSIZE);
+                    if((Result != 0) && RecoverDUCDMA(&Engine, Result))
+                    {
+                        ThreadError = true;                     // device lost: flag it to the main program
+                        break;
+                    }
+                }
+                Trace(eTraceDUCDMA, PrearmWords / VMEMWORDSPERFRAME, Engine.Current);
                 if(UseDebug)
-                    printf("TX DUC FIFO Underflowed, depth now = %d\n", Current);
+                    printf("TX DUC pre-armed with %d frames, FIFO depth was %d\n", PrearmWords / VMEMWORDSPERFRAME, Engine.Current);
             }
+            RampNextFrame = DUCPrearmRamp;
+        }
+        PrevMOX = MOXAsserted;
 
-            while (Depth < VMEMWORDSPERFRAME)       // loop till space available
+        Reorder = !Playback && ((P2Config.DUCReorderFrames != 0) || (DUCReorder.Held != 0));
+        Direct = P2Config.DUCDirectReceive && !EERActive && !Playback && !Reorder;
+        RecvLimit = (VMAXDUCPENDING - PendingFrames) / FramesPerMessage;
+        if (Reorder)                                          // leave room for the held frames too
+            RecvLimit = (RecvLimit > DUCReorder.Held) ? RecvLimit - DUCReorder.Held : 0;
+        if (RecvLimit > VMAXDUCBATCH)
+            RecvLimit = VMAXDUCBATCH;
+        MsgCount = 0;
+        ReceiveBase = PendingFrames;
+        ReorderWait = Reorder ? DUCReorderWait(&DUCReorder) : UINT32_MAX;
+        if (Playback)
+        {
+            //
+            // playback: make the frames that would have been received
+            //
+            for (Msg = 0; Msg < (int)RecvLimit; Msg++)
+            {
+                ReadPlaybackFrame(UDPInBuffer[Msg] + 4);
+                datagram[Msg].msg_len = VDUCIQSIZE;
+            }
+            MsgCount = RecvLimit;
+        }
+        else if (RecvLimit != 0)
+        {
+            memset(iovecinst, 0, sizeof(iovecinst));
+            memset(datagram, 0, sizeof(datagram));
+            for (Msg = 0; Msg < (int)RecvLimit; Msg++)
+            {
+                if (Direct)
+                {
+                    iovecinst[Msg][0].iov_base = &SequenceWords[Msg];
+                    iovecinst[Msg][0].iov_len = sizeof(SequenceWords[Msg]);
+                    iovecinst[Msg][1].iov_base = IQBasePtr + (ReceiveBase + Msg) * VDMATRANSFERSIZE;
+                    iovecinst[Msg][1].iov_len = VDMATRANSFERSIZE;
+                    datagram[Msg].msg_hdr.msg_iovlen = 2;
+                }
+                else
+                {
+                    iovecinst[Msg][0].iov_base = UDPInBuffer[Msg];     // set buffer for incoming message number i
+                    iovecinst[Msg][0].iov_len = VDUCIQSIZE;
+                    datagram[Msg].msg_hdr.msg_iovlen = 1;
+                }
+                datagram[Msg].msg_hdr.msg_iov = iovecinst[Msg];
+                datagram[Msg].msg_hdr.msg_name = &addr_from[Msg];
+                datagram[Msg].msg_hdr.msg_namelen = sizeof(addr_from[Msg]);
+                datagram[Msg].msg_hdr.msg_control = StampInfo[Msg];
+                datagram[Msg].msg_hdr.msg_controllen = sizeof(StampInfo[Msg]);
+            }
+            //
+            // if nothing pending: wait for one message (or the socket timeout), then take all that are queued
+            // if frames are pending, just take what is queued now
+            // if the reorder buffer holds frames, wait no longer than until they are due
+            //
+            if (PendingFrames == 0)
+            {
+                Heartbeat(eBeatDUC, eBeatIdle);                 // waiting for the client
+                if (ReorderWait != UINT32_MAX)
+                {
+                    PollSocket.fd = ThreadData->Socketid;
+                    PollSocket.events = POLLIN;
+                    PollTimeout.tv_sec = ReorderWait / 1000000;
+                    PollTimeout.tv_nsec = (ReorderWait % 1000000) * 1000;
+                    ppoll(&PollSocket, 1, &PollTimeout, NULL);
+                }
+                else if (atomic_load(&SDRIdle))
+                {
+                    //
+                    // in idle, wait for a message rather than waking at the socket timeout
+                    //
+                    PollSocket.fd = ThreadData->Socketid;
+                    PollSocket.events = POLLIN;
+                    poll(&PollSocket, 1, VIDLEWAITTIMEOUT);
+                }
+            }
+            StageMark(&Profiler);
+            MsgCount = recvmmsg(ThreadData->Socketid, datagram, RecvLimit,
+                                ((PendingFrames == 0) && (ReorderWait == UINT32_MAX)) ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+            Heartbeat(eBeatDUC, eBeatRunning);
+            if(MsgCount < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
             {
-                usleep(500);								                    // 0.5ms wait
-                Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);       // read the FIFO free locations
-                if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
-                    printf("TX DUC FIFO Overthreshold, depth now = %d\n", Current);
-                if((StartupCount == 0) && FIFOUnderflow)
+                perror("recvfrom fail, TX I/Q data");
+                ThreadError = true;                             // flag it to the main program
+                break;
+            }
+            if(MsgCount > 0)
+            {
+                TelemetryCountPackets(eTelDUC, MsgCount, MsgCount * VDUCIQSIZE);
+                CaptureMessages(eCapDUC, false, datagram, MsgCount, NULL, ThreadData->Portid);
+                StageEnd(&Profiler, eStageDUCReceive, MsgCount * VDUCIQSIZE);
+            }
+        }
+        //
+        // copy the I/Q samples of each valid frame to the DMA buffer, after any pending
+        // need to swap I & Q samples on replay
+        // received directly, they are in their slot already, unless an invalid message
+        // before them was dropped: then they are moved down to close the gap
+        // with the reorder buffer, each message gives the frames it lets go, in sequence
+        // order, and a last pass takes any frames whose wait for a missing one is over
+        //
+        for (Msg = 0; Msg <= MsgCount; Msg++)
+        {
+            Room = (VMAXDUCPENDING - PendingFrames) / FramesPerMessage;
+            if(Msg == MsgCount)
+            {
+                if(!Reorder)
+                    break;
+                ReadyCount = ReleaseDUCReorderFrames(&DUCReorder, Room, Ready);
+            }
+            else
+            {
+                if(datagram[Msg].msg_len != VDUCIQSIZE)
+                    continue;
+                if(!Playback)
+                {
+                    TelemetrySequence(eTelDUC, &Sequence, ntohl(Direct ? SequenceWords[Msg] : *(uint32_t*)UDPInBuffer[Msg]));
+                    NoteMessageReceived(VPORTDUCIQ);
+                }
+                CountStreamStartup(&Engine, 1);                     // decrement startup message count
+                if(Direct)
+                {
+                    Samples = IQBasePtr + PendingFrames * VDMATRANSFERSIZE;
+                    if(ReceiveBase + Msg != PendingFrames)
+                        memmove(Samples, IQBasePtr + (ReceiveBase + Msg) * VDMATRANSFERSIZE, VDMATRANSFERSIZE);
+                }
+                else
+                    Samples = UDPInBuffer[Msg] + 4;
+                //
+                // a message's delay is counted once, when its first frame is written
+                //
+                Stamp = 0;
+                Hardware = 0;
+                if(!Playback)
+                    GetReceiveTimestamps(&datagram[Msg].msg_hdr, &Stamp, &Hardware);
+                if(Reorder)
+                    ReadyCount = AddDUCReorderFrame(&DUCReorder, ntohl(*(uint32_t*)UDPInBuffer[Msg]), Samples,
+                                                    Stamp, Hardware, Room, Ready);
+                else
                 {
-                    GlobalFIFOOverflows |= 0b00000100;
-                    if(UseDebug)
-                        printf("TX DUC FIFO Underflowed, depth now = %d\n", Current);
+                    Ready[0].Samples = Samples;
+                    Ready[0].Stamp = Stamp;
+                    Ready[0].Hardware = Hardware;
+                    ReadyCount = 1;
                 }
             }
-            // copy data from UDP Buffer & DMA write it
-//            memcpy(IQBasePtr, UDPInBuffer + 4, VDMATRANSFERSIZE);                // copy out I/Q samples
-            // need to swap I & Q samples on replay
-            SrcPtr = (uint16_t *) (UDPInBuffer + 4);
-            DestPtr = (uint16_t *) IQBasePtr;
-            for (Cntr=0; Cntr < VIQSAMPLESPERFRAME; Cntr++)                     // samplecounter
+            for (ReadyFrame = 0; ReadyFrame < ReadyCount; ReadyFrame++)
             {
-                *DestPtr++ = *(SrcPtr+3);                           // get I sample (3 bytes)
-                *DestPtr++ = *(SrcPtr+4);
-                *DestPtr++ = *(SrcPtr+5);
-                *DestPtr++ = *(SrcPtr+0);                           // get Q sample (3 bytes)
-                *DestPtr++ = *(SrcPtr+1);
-                *DestPtr++ = *(SrcPtr+2);
-                SrcPtr += 6;                                        // point at next source sample
+                Samples = Ready[ReadyFrame].Samples;
+                if(RampNextFrame)
+                {
+                    RampIQFrame(Samples);
+                    RampNextFrame = false;
+                }
+                if(Direct)
+                    SwapIQSamplesInPlace(Samples, VIQSAMPLESPERFRAME);
+                else if(EERActive)
+                    InterleaveEERSamples(IQBasePtr + PendingFrames * VDMATRANSFERSIZE, Samples, VIQSAMPLESPERFRAME);
+                else
+                    SwapIQSamples(IQBasePtr + PendingFrames * VDMATRANSFERSIZE, Samples, VIQSAMPLESPERFRAME);
+                if(PendingFrames == 0)
+                {
+                    clock_gettime(CLOCK_MONOTONIC, &FirstFrameTime);
+                    FirstFrameStamp = TelemetryTimestamp();
+                }
+                PendingStamps[PendingFrames] = Ready[ReadyFrame].Stamp;
+                PendingHardware[PendingFrames] = Ready[ReadyFrame].Hardware;
+                for (Frame = 1; Frame < FramesPerMessage; Frame++)
+                    PendingStamps[PendingFrames + Frame] = 0;
+                PendingFrames += FramesPerMessage;
+            }
+        }
+        if(MsgCount > 0)
+            StageEnd(&Profiler, eStageDUCSwap, MsgCount * VDUCIQSIZE);
+        if(PendingFrames == 0)
+            continue;
+        //
+        // decide whether to write now. If not, wait for more data until the deadline
+        //
+        Elapsed = MicrosecondsSince(&FirstFrameTime);
+        if(!Playback && (PendingFrames < DUCCoalesceFrames) && (PendingFrames < VMAXDUCPENDING) && (Elapsed < DUCCoalesceDeadline))
+        {
+            PollSocket.fd = ThreadData->Socketid;
+            PollSocket.events = POLLIN;
+            PollTimeout.tv_sec = (DUCCoalesceDeadline - Elapsed) / 1000000;
+            PollTimeout.tv_nsec = ((DUCCoalesceDeadline - Elapsed) % 1000000) * 1000;
+            ppoll(&PollSocket, 1, &PollTimeout, NULL);
+            continue;
+        }
+
+        //
+        // a streaming ring takes all the pending frames: the FPGA holds the engine off
+        //
+        if(StreamRingActive(&Engine))
+            WriteFrames = PendingFrames;
+        else
+        {
+            Depth = ReadStreamFIFO(&Engine);                    // read the FIFO free locations
+            while (Depth < VMEMWORDSPERFRAME)                   // loop till space available for at least one frame
+                Depth = WaitStreamFIFO(&Engine, VMEMWORDSPERFRAME, VFIFOWAITTIMEOUT);     // wait for FIFO free locations
+            //
+            // write as many frames as the FIFO has space for; move any others down to the DMA base
+            //
+            WriteFrames = Depth / VMEMWORDSPERFRAME;
+            if(WriteFrames > PendingFrames)
+                WriteFrames = PendingFrames;
+        }
+        StageMark(&Profiler);
+        Result = TransferStreamDMA(&Engine, IQBasePtr, WriteFrames * VDMATRANSFERSIZE);
+        if(Result != 0)
+        {
+            //
+            // the FIFO is reset, so all the pending frames are dropped: the stream restarts on a message
+            //
+            if(RecoverDUCDMA(&Engine, Result))
+            {
+                ThreadError = true;                             // device lost: flag it to the main program
+                break;
             }
-            DMAWriteToFPGA(DMAWritefile_fd, IQBasePtr, VDMATRANSFERSIZE, VADDRDUCSTREAMWRITE);
+            PendingFrames = 0;
+            continue;
+        }
+        StageEnd(&Profiler, eStageDUCDMA, WriteFrames * VDMATRANSFERSIZE);
+        Trace(eTraceDUCDMA, WriteFrames, Engine.Current);
+        TelemetryLoopTime(eTelDUC, FirstFrameStamp);
+        for (Frame = 0; Frame < WriteFrames; Frame++)
+            TelemetryReceiveDelay(eTelDUC, PendingStamps[Frame], PendingHardware[Frame]);
+        PendingFrames -= WriteFrames;
+        if(PendingFrames != 0)
+        {
+            memmove(IQBasePtr, IQBasePtr + WriteFrames * VDMATRANSFERSIZE, PendingFrames * VDMATRANSFERSIZE);
+            memmove(PendingStamps, PendingStamps + WriteFrames, PendingFrames * sizeof(PendingStamps[0]));
+            memmove(PendingHardware, PendingHardware + WriteFrames, PendingFrames * sizeof(PendingHardware[0]));
         }
     }
 //
@@ -186,6 +650,7 @@ void *IncomingDUCIQ(void *arg)                          // listener thread
 //
     close(ThreadData->Socketid);                  // close incoming data socket
     ThreadData->Socketid = 0;
+    HeartbeatStop(eBeatDUC);
     ThreadData->Active = false;                   // indicate it is closed
     return NULL;
 }
@@ -195,9 +660,10 @@ void *IncomingDUCIQ(void *arg)                          // listener thread
 // HandlerSetEERMode (bool EEREnabled)
 // enables amplitude restoration mode. Generates envelope output alongside I/Q samples.
 // NOTE hardware does not properly support this yet!
-// TX FIFO must be empty. Stop multiplexer; set bit; restart
+// TX FIFO must be empty. Stop multiplexer; set bit; restart:
+// the DUC I/Q thread does that when it next has no frames pending
 // 
 void HandlerSetEERMode(bool EEREnabled)
 {
-
-}
\ No newline at end of file
+    DUCEERRequested = EEREnabled;
+}
@@ -19,10 +19,12 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "../common/saturntypes.h"
 
 
 #define VDUCIQSIZE 1444                 // TX DUC I/Q data packet
+#define VMAXDUCPREARM 8                 // most zero frames written on MOX (10ms at 192KHz)
 
 
 //
@@ -30,6 +32,33 @@
 //
 void *IncomingDUCIQ(void *arg);                 // listener thread
 
+
+//
+// SetDUCCoalescing(uint32_t MaxFrames, uint32_t DeadlineUs)
+// hold up to MaxFrames received DUC frames and write them in one DMA, but write
+// when the oldest has been held DeadlineUs microseconds. MaxFrames=1 writes at once.
+//
+void SetDUCCoalescing(uint32_t MaxFrames, uint32_t DeadlineUs);
+
+
+//
+// SetDUCPrearm(uint32_t Frames, bool Ramp)
+// when MOX is asserted, fill the TX FIFO to Frames frames of zero samples before the
+// next client frame, so the DUC runs from key down without underflowing; 0 = off.
+// if Ramp, that client frame is ramped up from zero amplitude to avoid a step.
+//
+void SetDUCPrearm(uint32_t Frames, bool Ramp);
+
+
+//
+// SetDUCPlayback(char* Path)
+// play a TX I/Q file into the DUC in place of the client's DUC I/Q messages, looping
+// at its end. The file is 24 bit big endian I then Q samples at 192KHz, as in the
+// messages; it is mapped, not read. Takes effect when the DUC thread starts.
+// Return true if error.
+//
+bool SetDUCPlayback(char* Path);
+
 //
 // HandlerSetEERMode (bool EEREnabled)
 // enables amplitude restoration mode. Generates envelope output alongside I/Q samples.
@@ -27,185 +27,196 @@
 #include "../common/hwaccess.h"                   // low level access
 #include "../common/version.h"
 #include "cathandler.h"
+#include "telemetry.h"
+#include "eventtrace.h"
+#include "packetfields.h"
 
 
+struct SequenceTracker HighPrioritySequence;            // inbound sequence checking
+struct PacketFieldCache HighPriorityCache;              // last high priority packet
+
 
 //
-// listener thread for incoming high priority packets
+// setters for the high priority packet fields
 //
-void *IncomingHighPriority(void *arg)                   // listener thread
+static void HPRunBit(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
 {
-  struct ThreadSocketData *ThreadData;                  // socket etc data for this thread
-  struct sockaddr_in addr_from;                         // holds MAC address of source of incoming messages
-  uint8_t UDPInBuffer[VHIGHPRIOTIYTOSDRSIZE];           // incoming buffer
-  struct iovec iovecinst;                               // iovcnt buffer - 1 for each outgoing buffer
-  struct msghdr datagram;                               // multiple incoming message header
-  int size;                                             // UDP datagram length
-  bool RunBit;                                          // true if "run" bit set
-  uint32_t DDCPhaseIncrement;                           // delta phase for a DDC
-  uint8_t Byte, Byte2;                                  // received dat being decoded
-  uint32_t LongWord;
-  uint16_t Word;
-  int i;                                                // counter
-  ESoftwareID FPGASWID;                                 // preprod/release etc
-  unsigned int FPGAVersion;                             // firmware version
-  bool PAEnable;
-
-
-  ThreadData = (struct ThreadSocketData *)arg;
-  ThreadData->Active = true;
-  printf("spinning up high priority incoming thread with port %d\n", ThreadData->Portid);
-  FPGAVersion = GetFirmwareVersion(&FPGASWID);          // get version of FPGA code
-
-  //
-  // main processing loop
-  //
-  while(1)
+  if(Value & 1)
   {
-    memset(&iovecinst, 0, sizeof(struct iovec));
-    memset(&datagram, 0, sizeof(datagram));
-    iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
-    iovecinst.iov_len = VHIGHPRIOTIYTOSDRSIZE;
-    datagram.msg_iov = &iovecinst;
-    datagram.msg_iovlen = 1;
-    datagram.msg_name = &addr_from;
-    datagram.msg_namelen = sizeof(addr_from);
-    size = recvmsg(ThreadData->Socketid, &datagram, 0);         // get one message. If it times out, ges size=-1
-    if(size < 0 && errno != EAGAIN)
+    StartBitReceived = true;
+    if(ReplyAddressSet && StartBitReceived)
     {
-      perror("recvfrom, high priority");
-      printf("error number = %d\n", errno);
-      return EXIT_FAILURE;
+      SetSDRActive(true);                                     // only set active if we have replay address too
+      SetTXEnable(true);
     }
+  }
+  else
+  {
+    SetSDRActive(false);                                     // set state of whole app
+    SetTXEnable(false);
+    EnableCW(false, false);
+    printf("set to inactive by client app\n");
+    StartBitReceived = false;
+    InvalidatePacketFields();                                // CW etc need setting again when restarted
+  }
+}
 
-    //
-    // if correct packet, process it
-    //
-    if(size == VHIGHPRIOTIYTOSDRSIZE)
-    {
-      NewMessageReceived = true;
-      LongWord = ntohl(*(uint32_t *)(UDPInBuffer));
-      printf("high priority packet received\n");
-      Byte = (uint8_t)(UDPInBuffer[4]);
-      RunBit = (bool)(Byte&1);
-      if(RunBit)
-      {
-        StartBitReceived = true;
-        if(ReplyAddressSet && StartBitReceived)
-        {
-          SDRActive = true;                                       // only set active if we have replay address too
-          SetTXEnable(true);
-        }
-      }
-      else
-      {
-        SDRActive = false;                                       // set state of whole app
-        SetTXEnable(false);
-        EnableCW(false, false);
-        printf("set to inactive by client app\n");
-        StartBitReceived = false;
-      }
-      //
-      // set TX or not TX
-      //
-      IsTXMode = (bool)(Byte&2);
-      SetMOX(IsTXMode);
-
-//
-// now properly decode DDC frequencies
-//
-      for (i=0; i<VNUMDDC; i++)
-      {
-        LongWord = ntohl(*(uint32_t *)(UDPInBuffer+i*4+9));
-        SetDDCFrequency(i, LongWord, true);                   // temporarily set above
-      }
-      //
-      // DUC frequency & drive level
-      //
-      LongWord = ntohl(*(uint32_t *)(UDPInBuffer+329));
-      SetDUCFrequency(LongWord, true);
-      Byte = (uint8_t)(UDPInBuffer[345]);
-      SetTXDriveLevel(Byte);
-      //
-      // CAT port (if set)
-      //
-      Word = ntohs(*(uint16_t *)(UDPInBuffer+1398));
-      if(Word != 0)
-        SetupCATPort(Word);
-      //
-      // transverter, speaker mute, open collector, user outputs
-      //
-      Byte = (uint8_t)(UDPInBuffer[1400]);
-      SetXvtrEnable((bool)(Byte&1));
-      SetSpkrMute((bool)((Byte>>1)&1));
-      Byte = (uint8_t)(UDPInBuffer[1401]);
-      SetOpenCollectorOutputs(Byte);
-      Byte = (uint8_t)(UDPInBuffer[1402]);
-      SetUserOutputBits(Byte);
-      //
-      // Alex
-      // behaviour needs to be FPGA version specific: at V12, separate register added for Alex TX antennas
-      // if new FPGA version: we write the word with TX ANT (byte 1428) to a new register, and the "old" word to original register
-      // if we don't have a new TX ant bit set, just write "old" word data (byte 1432) to both registers
-      // this is to allow safe operation with legacy client apps
-      // 1st read bytes and see if a TX ant bit is set
-      Word = ntohs(*(uint16_t *)(UDPInBuffer+1428));
-      //printf("Alex 1 TX word = 0x%x\n", Word);
-      Word = (Word >> 8) & 0x0007;                          // new data TX ant bits. if not set, must be legacy client app
-      
-      if((FPGAVersion >= 12) && (Word != 0))                // if new firmware && client app supports it
-      {
-        //printf("new FPGA code, new client data\n");
-        Word = ntohs(*(uint16_t *)(UDPInBuffer+1428));      // copy word with TX ant settings to filt/TXant register
-        AlexManualTXFilters(Word, true);
-        Word = ntohs(*(uint16_t *)(UDPInBuffer+1432));      // copy word with RX ant settings to filt/RXant register
-        //printf("Alex 0 TX word = 0x%x\n", Word);
-        AlexManualTXFilters(Word, false);
-      }
-      else if(FPGAVersion >= 12)                            // new hardware but no client app support
-      {
-        //printf("new FPGA code, new client data\n");
-        Word = ntohs(*(uint16_t *)(UDPInBuffer+1432));      // copy word with TX/RX ant settings to both registers
-        AlexManualTXFilters(Word, true);
-        AlexManualTXFilters(Word, false);
-      }
-      else                                                  // old FPGA hardware
-      {
-        //printf("old FPGA code\n");
-        Word = ntohs(*(uint16_t *)(UDPInBuffer+1432));      // copy word with TX/RX ant settings to original register
-        AlexManualTXFilters(Word, false);
-      }
-
-      // RX filters
-      Word = ntohs(*(uint16_t *)(UDPInBuffer+1430));
-      AlexManualRXFilters(Word, 2);
-      //printf("Alex 1 RX word = 0x%x\n", Word);
-      Word = ntohs(*(uint16_t *)(UDPInBuffer+1434));
-      AlexManualRXFilters(Word, 0);
-      //printf("Alex 0 RX word = 0x%x\n", Word);
-      //
-      // RX atten during TX and RX
-      // this should be just on RX now, because TX settings are in the DUC specific packet bytes 58&59
-      //
-      Byte2 = (uint8_t)(UDPInBuffer[1442]);     // RX2 atten
-      Byte = (uint8_t)(UDPInBuffer[1443]);      // RX1 atten
-      SetADCAttenuator(eADC1, Byte, true, false);
-      SetADCAttenuator(eADC2, Byte2, true, false);
-      //
-      // CWX bits
-      //
-      Byte = (uint8_t)(UDPInBuffer[5]);      // CWX
-      SetCWXBits((bool)(Byte & 1), (bool)((Byte>>2) & 1), (bool)((Byte>>1) & 1));    // enabled, dash, dot
-    }
+
+static void HPMOX(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  IsTXMode = (bool)(Value&2);
+  SetMOX(IsTXMode);
+}
+
+
+static void HPDDCFrequency(uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetDDCFrequency(Index, Value, true);
+}
+
+
+static void HPDUCFrequency(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetDUCFrequency(Value, true);
+}
+
+
+static void HPDriveLevel(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetTXDriveLevel(Value);
+}
+
+
+static void HPCATPort(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  if(Value != 0)
+    SetupCATPort(Value);
+}
+
+
+//
+// transverter, speaker mute
+//
+static void HPXvtrSpeaker(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetXvtrEnable((bool)(Value&1));
+  SetSpkrMute((bool)((Value>>1)&1));
+}
+
+
+static void HPOpenCollector(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetOpenCollectorOutputs(Value);
+}
+
+
+static void HPUserOutputs(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetUserOutputBits(Value);
+}
+
+
+//
+// Alex: the 4 words at 1428-1435 are used together
+// behaviour needs to be FPGA version specific: at V12, separate register added for Alex TX antennas
+// if new FPGA version: we write the word with TX ANT (byte 1428) to a new register, and the "old" word to original register
+// if we don't have a new TX ant bit set, just write "old" word data (byte 1432) to both registers
+// this is to allow safe operation with legacy client apps
+//
+static void HPAlex(__attribute__((unused)) uint32_t Index, __attribute__((unused)) uint32_t Value, const uint8_t* Packet)
+{
+  uint16_t Word;
+  bool SeparateAlexAnt;                                 // true if FPGA has separate TX & RX antenna words
+
+  SeparateAlexAnt = HasCapability(VCAPSEPARATEALEXANT); // V12+ FPGA code
+  // 1st read bytes and see if a TX ant bit is set
+  Word = ntohs(*(uint16_t *)(Packet+1428));
+  Word = (Word >> 8) & 0x0007;                          // new data TX ant bits. if not set, must be legacy client app
+  
+  if(SeparateAlexAnt && (Word != 0))                    // if new firmware && client app supports it
+  {
+    Word = ntohs(*(uint16_t *)(Packet+1428));           // copy word with TX ant settings to filt/TXant register
+    AlexManualTXFilters(Word, true);
+    Word = ntohs(*(uint16_t *)(Packet+1432));           // copy word with RX ant settings to filt/RXant register
+    AlexManualTXFilters(Word, false);
   }
+  else if(SeparateAlexAnt)                              // new hardware but no client app support
+  {
+    Word = ntohs(*(uint16_t *)(Packet+1432));           // copy word with TX/RX ant settings to both registers
+    AlexManualTXFilters(Word, true);
+    AlexManualTXFilters(Word, false);
+  }
+  else                                                  // old FPGA hardware
+  {
+    Word = ntohs(*(uint16_t *)(Packet+1432));           // copy word with TX/RX ant settings to original register
+    AlexManualTXFilters(Word, false);
+  }
+
+  // RX filters
+  Word = ntohs(*(uint16_t *)(Packet+1430));
+  AlexManualRXFilters(Word, 2);
+  Word = ntohs(*(uint16_t *)(Packet+1434));
+  AlexManualRXFilters(Word, 0);
+}
+
+
 //
-// close down thread
+// RX atten during RX: TX settings are in the DUC specific packet bytes 58&59
 //
-  close(ThreadData->Socketid);                  // close incoming data socket
-  ThreadData->Socketid = 0;
-  ThreadData->Active = false;                   // indicate it is closed
-  return NULL;
+static void HPRXAtten(uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetADCAttenuator((EADCSelect)Index, Value, true, false);
+}
+
+
+static void HPCWX(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetCWXBits((bool)(Value & 1), (bool)((Value>>2) & 1), (bool)((Value>>1) & 1));    // enabled, dash, dot
 }
 
 
+//
+// the high priority packet, in the order the settings are made
+//
+#define HPDDCFREQ(DDC) {9 + 4*(DDC), 4, VFIELDBIGENDIAN, (DDC), HPDDCFrequency}
 
+static const struct PacketField HighPriorityFields[] =
+{
+  {4, 1, VFIELDALWAYS, 0, HPRunBit},                    // run bit: acted on every packet
+  {4, 1, 0, 0, HPMOX},
+  HPDDCFREQ(0), HPDDCFREQ(1), HPDDCFREQ(2), HPDDCFREQ(3), HPDDCFREQ(4),
+  HPDDCFREQ(5), HPDDCFREQ(6), HPDDCFREQ(7), HPDDCFREQ(8), HPDDCFREQ(9),
+  {329, 4, VFIELDBIGENDIAN, 0, HPDUCFrequency},
+  {345, 1, 0, 0, HPDriveLevel},
+  {1398, 2, VFIELDBIGENDIAN, 0, HPCATPort},
+  {1400, 1, 0, 0, HPXvtrSpeaker},
+  {1401, 1, 0, 0, HPOpenCollector},
+  {1402, 1, 0, 0, HPUserOutputs},
+  {1428, 8, 0, 0, HPAlex},                              // TX & RX antenna and filter words
+  {1443, 1, 0, eADC1, HPRXAtten},
+  {1442, 1, 0, eADC2, HPRXAtten},
+  {5, 1, 0, 0, HPCWX}
+};
+
+
+//
+// handler for an incoming high priority packet
+// called by the network event loop in p2app.c with a complete packet
+// only the fields that have changed since the last packet are set
+//
+void HandleHighPriorityPacket(uint8_t* UDPInBuffer)
+{
+  uint32_t LongWord;
+
+  NoteMessageReceived(VPORTHIGHPRIORITYTOSDR);
+  LongWord = ntohl(*(uint32_t *)(UDPInBuffer));
+  TelemetryCountPackets(eTelHighPriority, 1, VHIGHPRIOTIYTOSDRSIZE);
+  TelemetrySequence(eTelHighPriority, &HighPrioritySequence, LongWord);
+  Trace(eTraceHighPriority, LongWord, UDPInBuffer[4] & 1);
+  if(UseDebug)
+    printf("high priority packet received\n");
+  BeginRegisterTransaction();                           // write each changed register once, at the end
+  DecodePacketFields(HighPriorityFields, sizeof(HighPriorityFields) / sizeof(struct PacketField),
+                     UDPInBuffer, VHIGHPRIOTIYTOSDRSIZE, &HighPriorityCache);
+  CommitRegisterTransaction();
+}
@@ -27,8 +27,9 @@
 
 //
 // protocol 2 handler for incoming high priority Packet to SDR
+// called from the network event loop with a VHIGHPRIOTIYTOSDRSIZE byte packet
 //
-void *IncomingHighPriority(void *arg);          // listener thread
+void HandleHighPriorityPacket(uint8_t* UDPInBuffer);
 
 
 #endif
\ No newline at end of file
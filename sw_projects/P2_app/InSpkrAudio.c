@@ -17,6 +17,11 @@
 #include <stdint.h>
 #include "../common/saturntypes.h"
 #include "InSpkrAudio.h"
+#include "telemetry.h"
+#include "pcapcapture.h"
+#include "p2config.h"
+#include "heartbeat.h"
+#include "streamengine.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -24,6 +29,8 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
 #include "../common/hwaccess.h"
@@ -33,43 +40,66 @@
 #define VMEMWORDSPERFRAME 32                        // 8 byte writes per UDP msg
 #define VSPKSAMPLESPERMEMWORD 2                     // 2 samples (each 4 bytres) per 8 byte word
 #define VDMABUFFERSIZE 32768						// memory buffer to reserve
-#define VALIGNMENT 4096                             // buffer alignment
-#define VBASE 0x1000								// DMA start at 4K into buffer
-#define VDMATRANSFERSIZE 256                        // write 1 message at a time
-#define VSTARTUPDELAY 100                           // 100 messages (~100ms) before reporting under or overflows
+#define VDMATRANSFERSIZE 256                        // bytes of samples in 1 message
+#define VMAXSPKBATCH 16                             // max UDP frames received & DMA written at once
+#define VSPKJITTERFRAMES 32                         // jitter buffer size: 32 frames, ~43ms
+#define VSPKTARGETFRAMES 4                          // frames held before playing starts (~5ms)
+#define VSPKMINDMAFRAMES 2                          // frames per DMA write, unless the FIFO is running low
+#define VSPKLOWWATER (2 * VMEMWORDSPERFRAME)        // FIFO occupied locations below which any data is written
+#define VSPKSERVICEPERIOD 1                         // ms: longest time between FIFO checks
+#define VSPKSTREAMRINGSIZE 8192                     // driver H2C streaming ring: 32 frames, as the jitter buffer
+#define VSPKSTREAMBLOCKSIZE 4096                    // bytes per streaming ring descriptor
 
 
 //
 // listener thread for incoming DDC (speaker) audio packets
-// planned strategy: just DMA spkr data when available; don't copy and DMA a larger amount.
-// if sufficient FIFO data available: DMA that data and transfer it out. 
-// if it turns out to be too inefficient, we'll have to try larger DMA.
+// all queued messages are received together by recvmmsg() into a jitter buffer.
+// the FIFO is then topped up from the jitter buffer, several frames per DMA.
+// playing starts (and restarts, after the buffer and FIFO have both run dry) only
+// once VSPKTARGETFRAMES are held, so late packets from the PC are covered by
+// that much buffered audio instead of making the speaker FIFO underflow.
+// the thread waits on the socket, never on the FIFO: for the service period
+// while it has frames to play out, else for a message (up to StateWaitTimeout()).
+// with tx_stream_ring set, frames go through the driver's H2C streaming ring as soon
+// as they can be played: the FPGA holds the engine off while the FIFO is full, so the
+// FIFO depth is not read.
 //
 void *IncomingSpkrAudio(void *arg)                      // listener thread
 {
     struct ThreadSocketData *ThreadData;                  // socket etc data for this thread
-    struct sockaddr_in addr_from;                         // holds MAC address of source of incoming messages
-    uint8_t UDPInBuffer[VSPEAKERAUDIOSIZE];               // incoming buffer
-    struct iovec iovecinst;                               // iovcnt buffer - 1 for each outgoing buffer
-    struct msghdr datagram;                               // multiple incoming message header
-    int size;                                             // UDP datagram length
+    struct sockaddr_in addr_from[VMAXSPKBATCH];           // holds MAC address of source of incoming messages
+    uint8_t UDPInBuffer[VMAXSPKBATCH][VSPEAKERAUDIOSIZE]; // incoming buffers
+    struct iovec iovecinst[VMAXSPKBATCH];                 // iovcnt buffer - 1 for each incoming buffer
+    struct mmsghdr datagram[VMAXSPKBATCH];                // multiple incoming message headers
+    int MsgCount;                                         // messages received by recvmmsg()
+    int Msg;
+    uint32_t BatchLimit;                                  // max messages per DMA for this FIFO size
+    uint32_t FrameCount;                                  // valid frames in the batch
+    struct pollfd SocketPoll;
 
 //
-// variables for DMA buffer 
+// jitter buffer: frames of samples, written at Head and read at Tail (free running counts)
 //
-    uint8_t* SpkWriteBuffer = NULL;							// data for DMA to write to spkr
-    uint32_t SpkBufferSize = VDMABUFFERSIZE;
-    bool InitError = false;                                 // becomes true if we get an initialisation error
-    unsigned char* SpkReadPtr;								// pointer for reading out a spkr sample
-    unsigned char* SpkHeadPtr;								// ptr to 1st free location in spk memory
+    uint8_t JitterBuffer[VSPKJITTERFRAMES][VDMATRANSFERSIZE];
+    uint32_t JitterHead = 0;
+    uint32_t JitterTail = 0;
+    uint32_t Fill;                                        // frames held
+    struct SequenceTracker Sequence = {0};                // inbound sequence checking
+    bool Playing = false;                                 // true once primed
+    uint32_t Frames;                                      // frames to write to the FIFO
+    uint32_t Cntr;
+
+//
+// DMA to the speaker FIFO
+//
+    struct StreamEngine Engine;                             // DMA buffer, device and FIFO
     unsigned char* SpkBasePtr;								// ptr to DMA location in spk memory
     uint32_t Depth = 0;
-    int DMAWritefile_fd = -1;								// DMA read file device
-    bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;
-    uint32_t RegVal;
-    unsigned int Current;                                   // current occupied locations in FIFO
-    unsigned int StartupCount;                              // used to delay reporting of under & overflows
-    bool PrevSDRActive;                                     // used to detect change of state
+    uint64_t ReceiveTime = 0;                               // for telemetry
+    int Result;                                             // DMA result
+    bool PrevSDRActive = false;                             // used to detect change of state
+    bool Waiting;                                           // true if there is nothing to play out
+    bool Ready;                                             // true if messages are waiting
 
 
     ThreadData = (struct ThreadSocketData *)arg;
@@ -77,102 +107,165 @@ void *IncomingSpkrAudio(void *arg)                      // listener thread
     printf("spinning up speaker audio thread with port %d\n", ThreadData->Portid);
 
     //
-    // setup DMA buffer
+    // setup DMA buffer and open DMA device driver: through the bypass BAR if it covers
+    // a batch, else through the streaming ring if set
     //
-    posix_memalign((void**)&SpkWriteBuffer, VALIGNMENT, SpkBufferSize);
-    if (!SpkWriteBuffer)
+    BatchLimit = DMAFIFODepths[eSpkCodecDMA] / (2 * VMEMWORDSPERFRAME);
+    if (BatchLimit < 1)
+        BatchLimit = 1;
+    else if (BatchLimit > VMAXSPKBATCH)
+        BatchLimit = VMAXSPKBATCH;
+    InitStreamEngine(&Engine, "Codec speaker", eSpkCodecDMA, VSPKDMADEVICE, VADDRSPKRSTREAMWRITE, true,
+                     eTelSpeaker, eBeatSpeaker, 0b00001000);
+    if (OpenStreamEngine(&Engine, VDMABUFFERSIZE, BatchLimit * VDMATRANSFERSIZE, VSPKSTREAMRINGSIZE, VSPKSTREAMBLOCKSIZE)
+        && (Engine.Buffer == NULL))
     {
-        printf("spkr write buffer allocation failed\n");
-        InitError = true;
+        ThreadData->Active = false;                         // no buffer to play from
+        return NULL;
     }
-    SpkReadPtr = SpkWriteBuffer + VBASE;							// offset 4096 bytes into buffer
-    SpkHeadPtr = SpkWriteBuffer + VBASE;
-    SpkBasePtr = SpkWriteBuffer + VBASE;
-    memset(SpkWriteBuffer, 0, SpkBufferSize);
+    SpkBasePtr = Engine.BasePtr;
+    StartStreamFIFO(&Engine);
 
-    //
-    // open DMA device driver
-    //
-    DMAWritefile_fd = open(VSPKDMADEVICE, O_RDWR);
-    if (DMAWritefile_fd < 0)
+    memset(iovecinst, 0, sizeof(iovecinst));                // clear buffers
+    memset(datagram, 0, sizeof(datagram));
+    for (Msg = 0; Msg < VMAXSPKBATCH; Msg++)
     {
-        printf("XDMA write device open failed for spk data\n");
-        InitError = true;
+        iovecinst[Msg].iov_base = UDPInBuffer[Msg];         // set buffer for incoming message number i
+        iovecinst[Msg].iov_len = VSPEAKERAUDIOSIZE;
+        datagram[Msg].msg_hdr.msg_iov = &iovecinst[Msg];
+        datagram[Msg].msg_hdr.msg_iovlen = 1;
+        datagram[Msg].msg_hdr.msg_name = &addr_from[Msg];
     }
-	ResetDMAStreamFIFO(eSpkCodecDMA);
-    SetupFIFOMonitorChannel(eSpkCodecDMA, false);
 
   //
   // main processing loop
   // modified to have the same structure as outgoing threads; capable of being stopped and started.
   //
+    HeartbeatStart(eBeatSpeaker);
     while(1)
     {
         //
-        // now released to start processing. Setup buffers.
+        // wait for a message (or the service period) then take all queued.
+        // with nothing to play out (not primed, or a streaming ring and an empty jitter
+        // buffer) only a message can change anything, so just wait for one. the state
+        // is checked after the wait so that a run's first messages are kept
         //
+        Waiting = !Playing || (StreamRingActive(&Engine) && (JitterHead == JitterTail));
+        Heartbeat(eBeatSpeaker, Waiting ? eBeatIdle : eBeatRunning);
+        SocketPoll.fd = ThreadData->Socketid;
+        SocketPoll.events = POLLIN;
+        Ready = (poll(&SocketPoll, 1, Waiting ? StateWaitTimeout() : VSPKSERVICEPERIOD) > 0) && (SocketPoll.revents & POLLIN);
+        Heartbeat(eBeatSpeaker, eBeatRunning);
         if(SDRActive & !PrevSDRActive)                      // detect SDRActive has been asserted
-            StartupCount = VSTARTUPDELAY;
+        {
+            RestartStreamStartup(&Engine);
+            JitterHead = JitterTail = 0;                    // start with an empty buffer
+            TelemetryResetSequence(&Sequence);
+            Playing = false;
+        }
         PrevSDRActive = SDRActive;
 
-        memset(&iovecinst, 0, sizeof(struct iovec));            // clear buffers
-        memset(&datagram, 0, sizeof(datagram));
-        iovecinst.iov_base = &UDPInBuffer;                      // set buffer for incoming message number i
-        iovecinst.iov_len = VSPEAKERAUDIOSIZE;
-        datagram.msg_iov = &iovecinst;
-        datagram.msg_iovlen = 1;
-        datagram.msg_name = &addr_from;
-        datagram.msg_namelen = sizeof(addr_from);
+        if(Ready)
+        {
+            for (Msg = 0; Msg < VMAXSPKBATCH; Msg++)
+                datagram[Msg].msg_hdr.msg_namelen = sizeof(addr_from[Msg]);
+            MsgCount = recvmmsg(ThreadData->Socketid, datagram, VMAXSPKBATCH, MSG_DONTWAIT, NULL);
+            if(MsgCount < 0 && errno != EAGAIN)
+            {
+                perror("recvfrom fail, Speaker data");
+                ThreadError = true;
+                break;
+            }
+            if(MsgCount > 0)
+                CaptureMessages(eCapSpeaker, false, datagram, MsgCount, NULL, ThreadData->Portid);
+            FrameCount = 0;
+            for (Msg = 0; Msg < MsgCount; Msg++)                // copy spk samples of each valid frame
+                if(datagram[Msg].msg_len == VSPEAKERAUDIOSIZE)
+                {
+                    TelemetrySequence(eTelSpeaker, &Sequence, ntohl(*(uint32_t*)UDPInBuffer[Msg]));
+                    if((JitterHead - JitterTail) == VSPKJITTERFRAMES)   // full: drop the oldest
+                    {
+                        JitterTail++;
+                        TelemetryCountOverflow(eTelSpeaker);
+                    }
+                    memcpy(JitterBuffer[JitterHead % VSPKJITTERFRAMES], UDPInBuffer[Msg] + 4, VDMATRANSFERSIZE);
+                    JitterHead++;
+                    FrameCount++;
+                }
+            if(FrameCount != 0)                                 // we have received packets!
+            {
+                ReceiveTime = TelemetryTimestamp();
+                TelemetryCountPackets(eTelSpeaker, FrameCount, FrameCount * VSPEAKERAUDIOSIZE);
+                CountStreamStartup(&Engine, FrameCount);        // decrement startup message count
+                NoteMessageReceived(VPORTSPKRAUDIO);
+            }
+        }
+
+        Fill = JitterHead - JitterTail;
+        TelemetryBufferFill(eTelSpeaker, Fill);
+        if(!Playing && (Fill >= VSPKTARGETFRAMES))
+            Playing = true;
+        if(!Playing)
+            continue;
+
         //
-        // receive operation thread
+        // top up the FIFO from the jitter buffer. A streaming ring takes what there is:
+        // the FPGA holds the engine off while the FIFO is full
         //
-        size = recvmsg(ThreadData->Socketid, &datagram, 0);     // get one message. If it times out, sets size=-1
-        if(size < 0 && errno != EAGAIN)
+        if(StreamRingActive(&Engine))
         {
-            perror("recvfrom fail, Speaker data");
-            return EXIT_FAILURE;
+            Frames = (Fill > BatchLimit) ? BatchLimit : Fill;
+            if(Frames == 0)
+                continue;
         }
-        if(size == VSPEAKERAUDIOSIZE)                           // we have received a packet!
+        else
         {
-            if(StartupCount != 0)                                   // decrement startup message count
-                StartupCount--;
-            NewMessageReceived = true;
-            RegVal += 1;            //debug
-            Depth = ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);        // read the FIFO free locations
-            if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
-                printf("Codec speaker FIFO Overthreshold, depth now = %d\n", Current);
-            if((StartupCount == 0) && FIFOUnderflow)
+            Depth = ReadStreamFIFO(&Engine);                    // read the FIFO free locations
+            if(Fill == 0)
             {
-                GlobalFIFOOverflows |= 0b00001000;
-                if(UseDebug)
-                    printf("Codec speaker FIFO Underflowed, depth now = %d\n", Current);
+                if(Engine.Current < VSPKLOWWATER)               // buffer and FIFO both dry: prime again
+                    Playing = false;
+                continue;
             }
-    //            printf("speaker packet received; depth = %d\n", Depth);
-            while (Depth < VMEMWORDSPERFRAME)       // loop till space available
+            Frames = Depth / VMEMWORDSPERFRAME;
+            if(Frames > Fill)
+                Frames = Fill;
+            if(Frames > BatchLimit)
+                Frames = BatchLimit;
+            if((Frames == 0) || ((Frames < VSPKMINDMAFRAMES) && (Engine.Current >= VSPKLOWWATER)))
+                continue;                                       // wait to make a bigger write
+        }
+
+        for (Cntr = 0; Cntr < Frames; Cntr++)
+            memcpy(SpkBasePtr + Cntr * VDMATRANSFERSIZE, JitterBuffer[(JitterTail + Cntr) % VSPKJITTERFRAMES], VDMATRANSFERSIZE);
+        JitterTail += Frames;
+        Result = TransferStreamDMA(&Engine, SpkBasePtr, Frames * VDMATRANSFERSIZE);
+        if(Result != 0)
+        {
+            //
+            // these frames are lost and the FIFO is reset: prime it again from the jitter buffer
+            //
+            if(RecoverStreamDMA(&Engine, Result))
             {
-                usleep(1000);								                    // 1ms wait
-                Depth = ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);    // read the FIFO free locations
-                if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
-                    printf("Codec speaker FIFO Overthreshold, depth now = %d\n", Current);
-                if((StartupCount == 0) && FIFOUnderflow)
-                {
-                    GlobalFIFOOverflows |= 0b00001000;
-                    if(UseDebug)
-                        printf("Codec speaker FIFO Underflowed, depth now = %d\n", Current);
-                }
+                ThreadError = true;                             // device lost: flag it to the main program
+                break;
             }
-                // copy sata from UDP Buffer & DMA write it
-            memcpy(SpkBasePtr, UDPInBuffer + 4, VDMATRANSFERSIZE);              // copy out spk samples
-    //        if(RegVal == 100)
-    //            DumpMemoryBuffer(SpkBasePtr, VDMATRANSFERSIZE);
-            DMAWriteToFPGA(DMAWritefile_fd, SpkBasePtr, VDMATRANSFERSIZE, VADDRSPKRSTREAMWRITE);
+            Playing = false;
+            ReceiveTime = 0;
+            continue;
         }
+        TelemetryBufferFill(eTelSpeaker, JitterHead - JitterTail);
+        Trace(eTraceSpeakerDMA, Frames, JitterHead - JitterTail);
+        if(ReceiveTime != 0)
+            TelemetryLoopTime(eTelSpeaker, ReceiveTime);
+        ReceiveTime = 0;
     }
 //
 // close down thread
 //
     close(ThreadData->Socketid);                  // close incoming data socket
     ThreadData->Socketid = 0;
+    HeartbeatStop(eBeatSpeaker);
     ThreadData->Active = false;                   // indicate it is closed
     return NULL;
 }
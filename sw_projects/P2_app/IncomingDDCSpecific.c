@@ -26,173 +26,144 @@
 #include <string.h>
 #include "../common/saturnregisters.h"
 #include "OutDDCIQ.h"
+#include "eventtrace.h"
+#include "packetfields.h"
+#include "p2config.h"
 
 
 
 
+struct PacketFieldCache DDCSpecificCache;               // last DDC specific packet
+bool DDCRatesChanged;                                   // set when an enable, rate or synch field changes
+
+
 //
-// listener thread for incoming DDC specific packets
+// setters for the DDC specific packet fields
 //
-void *IncomingDDCSpecific(void *arg)                    // listener thread
+static void DDCADCCount(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetADCCount(Value);
+}
+
+
+//
+// ADC dither (byte 5) and random (byte 6) bits: bit 0 for ADC1, bit 1 for ADC2
+//
+static void DDCADCOptions(__attribute__((unused)) uint32_t Index, __attribute__((unused)) uint32_t Value, const uint8_t* Packet)
+{
+  uint8_t Dither = Packet[5];
+  uint8_t Random = Packet[6];
+
+  SetADCOptions(eADC1, false, (bool)(Dither&1), (bool)(Random&1));
+  SetADCOptions(eADC2, false, (bool)((Dither>>1)&1), (bool)((Random>>1)&1));
+}
+
+
+static void DDCSampleSize(uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetDDCSampleSize(Index, Value);
+}
+
+
+static void DDCADCSelect(uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  EADCSelect ADC = eADC1;                               // ADC to use for a DDC
+
+  if(Value == 1)
+    ADC = eADC2;
+  else if(Value == 2)
+    ADC = eTXSamples;
+  SetDDCADC(Index, ADC);
+}
+
+
+//
+// the enables, rates and synch bytes are used together: note a change,
+// and SetDDCRates() sets them all after the packet is decoded
+//
+static void DDCRateField(__attribute__((unused)) uint32_t Index, __attribute__((unused)) uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  DDCRatesChanged = true;
+}
+
+
+//
+// main settings for each DDC
+// be aware an interleaved "odd" DDC will usually be set to disabled, and we need to revert this!
+// DDC synchronisation: my implementation it seems isn't what the spec intended!
+// if DDC1 is programmed to sync with DDC0, DDC0 is interleaved and DDC1 enabled;
+// similarly DDC3 with DDC2, DDC5 with DDC4 and DDC7 with DDC6.
+// the 1st DDC of a pair has VBITINTERLEAVE set on its thread, for the P2 format with
+// both DDCs' samples in its packets; with ddc_split_pairs, it is left clear and
+// the demux splits the pair to each DDC's own stream
+//
+static void SetDDCRates(const uint8_t* Packet)
 {
-  struct ThreadSocketData *ThreadData;                  // socket etc data for this thread
-  struct sockaddr_in addr_from;                         // holds MAC address of source of incoming messages
-  uint8_t UDPInBuffer[VDDCSPECIFICSIZE];                // incoming buffer
-  struct iovec iovecinst;                               // iovcnt buffer - 1 for each outgoing buffer
-  struct msghdr datagram;                               // multiple incoming message header
-  int size;                                             // UDP datagram length
-  uint8_t Byte1, Byte2;                                 // received data
-  bool Dither, Random;                                  // ADC bits
-  bool Enabled, Interleaved;                            // DDC settings
   uint16_t Word, Word2;                                 // 16 bit read value
+  uint8_t Synch;
+  bool Enabled, Interleaved;                            // DDC settings
   int i;                                                // counter
-  EADCSelect ADC = eADC1;                               // ADC to use for a DDC
 
-  ThreadData = (struct ThreadSocketData *)arg;
-  ThreadData->Active = true;
-  printf("spinning up DDC specific thread with port %d\n", ThreadData->Portid);
-  //
-  // main processing loop
-  //
-  while(1)
+  Word = *(uint16_t*)(Packet + 7);                      // get DDC enables 15:0 (note it is already low byte 1st!)
+  for(i=0; i<VNUMDDC; i++)
   {
-    memset(&iovecinst, 0, sizeof(struct iovec));
-    memset(&datagram, 0, sizeof(datagram));
-    iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
-    iovecinst.iov_len = VDDCSPECIFICSIZE;
-    datagram.msg_iov = &iovecinst;
-    datagram.msg_iovlen = 1;
-    datagram.msg_name = &addr_from;
-    datagram.msg_namelen = sizeof(addr_from);
-    size = recvmsg(ThreadData->Socketid, &datagram, 0);         // get one message. If it times out, ges size=-1
-    if(size < 0 && errno != EAGAIN)
-    {
-      perror("recvfrom, DDC Specific");
-      return EXIT_FAILURE;
-    }
-    if(size == VDDCSPECIFICSIZE)
+    Enabled = (bool)(Word & 1);                         // get enable state
+    Word2 = ntohs(*(uint16_t*)(Packet+i*6+18));         // get sample rate for this DDC
+    Interleaved = false;                                // assume no synch
+    if(i < 8)
     {
-      NewMessageReceived = true;
-      printf("DDC specific packet received\n");
-      // get ADC details:
-      Byte1 = *(uint8_t*)(UDPInBuffer+4);                   // get ADC count
-      SetADCCount(Byte1);
-      Byte1 = *(uint8_t*)(UDPInBuffer+5);                   // get ADC Dither bits
-      Byte2 = *(uint8_t*)(UDPInBuffer+6);                   // get ADC Random bits
-      Dither  = (bool)(Byte1&1);
-      Random  = (bool)(Byte2&1);
-      SetADCOptions(eADC1, false, Dither, Random);          // ADC1 settings
-      Byte1 = Byte1 >> 1;                                   // move onto ADC bits
-      Byte2 = Byte2 >> 1;
-      Dither  = (bool)(Byte1&1);
-      Random  = (bool)(Byte2&1);
-      SetADCOptions(eADC2, false, Dither, Random);          // ADC2 settings
-      
-      //
-      // main settings for each DDC
-      // reuse "dither" for interleaved with next;
-      // reuse "random" for DDC enabled.
-      // be aware an interleaved "odd" DDC will usually be set to disabled, and we need to revert this!
-      //
-      Word = *(uint16_t*)(UDPInBuffer + 7);                 // get DDC enables 15:0 (note it is already low byte 1st!)
-      for(i=0; i<VNUMDDC; i++)
+      Synch = *(uint8_t*)(Packet + 1363 + (i & 6));     // synch byte of the even DDC of the pair
+      if(Synch == (0b00000010 << (i & 6)))              // if the odd DDC synchs to it
       {
-        Enabled = (bool)(Word & 1);                        // get enable state
-        Byte1 = *(uint8_t*)(UDPInBuffer+i*6+17);          // get ADC for this DDC
-        Word2 = *(uint16_t*)(UDPInBuffer+i*6+18);         // get sample rate for this DDC
-        Word2 = ntohs(Word2);                             // swap byte order
-        Byte2 = *(uint8_t*)(UDPInBuffer+i*6+22);          // get sample size for this DDC
-        SetDDCSampleSize(i, Byte2);
-        if(Byte1 == 0)
-          ADC = eADC1;
-        else if(Byte1 == 1)
-          ADC = eADC2;
-        else if(Byte1 == 2)
-          ADC = eTXSamples;
-        SetDDCADC(i, ADC);
-
-        Interleaved = false;                                 // assume no synch
-        // finally DDC synchronisation: my implementation it seems isn't what the spec intended!
-        // check: is DDC1 programmed to sync with DDC0;
-        // check: is DDC3 programmed to sync with DDC2;
-        // check: is DDC5 programmed to sync with DDC4;
-        // check: is DDC7 programmed to sync with DDC6;
-        // check: if DDC1 synch to DDC0, enable it;
-        // check: if DDC3 synch to DDC2, enable it;
-        // check: if DDC5 synch to DDC4, enable it;
-        // check: if DDC7 synch to DDC6, enable it;
-        // (reuse the Dither variable)
-        switch(i)
-        {
-            case 0:
-                Byte1 = *(uint8_t*)(UDPInBuffer + 1363);          // get DDC0 synch
-                if (Byte1 == 0b00000010)
-                    Interleaved = true;                                // set interleave
-                break;
-
-            case 1: 
-                Byte1 = *(uint8_t*)(UDPInBuffer + 1363);          // get DDC0 synch
-                if (Byte1 == 0b00000010)                          // if synch to DDC1
-                    Enabled = true;                                // enable DDC1
-                break;
-
-            case 2:
-                Byte1 = *(uint8_t*)(UDPInBuffer + 1365);          // get DDC2 synch
-                if (Byte1 == 0b00001000)
-                    Interleaved = true;                                // set interleave
-                break;
-
-            case 3:
-                Byte1 = *(uint8_t*)(UDPInBuffer + 1365);          // get DDC2 synch
-                if (Byte1 == 0b00001000)                          // if synch to DDC3
-                    Enabled = true;                                // enable DDC3
-                break;
-
-            case 4:
-                Byte1 = *(uint8_t*)(UDPInBuffer + 1367);          // get DDC4 synch
-                if (Byte1 == 0b00100000)
-                    Interleaved = true;                                // set interleave
-                break;
-        
-            case 5:
-                Byte1 = *(uint8_t*)(UDPInBuffer + 1367);          // get DDC4 synch
-                if (Byte1 == 0b00100000)                          // if synch to DDC5
-                    Enabled = true;                                // enable DDC5
-                break;
-
-            case 6:
-                Byte1 = *(uint8_t*)(UDPInBuffer + 1369);          // get DDC6 synch
-                if (Byte1 == 0b10000000)
-                    Interleaved = true;                                // set interleave
-                break;
-
-            case 7:
-                Byte1 = *(uint8_t*)(UDPInBuffer + 1369);          // get DDC6 synch
-                if (Byte1 == 0b10000000)                          // if synch to DDC7
-                    Enabled = true;                                // enable DDC7
-                break;
-
-        }
-        SetP2SampleRate(i, Enabled, Word2, Interleaved);
-        Word = Word >> 1;                                 // move onto next DDC enabled bit
+        if(i & 1)
+          Enabled = true;                               // enable the odd DDC
+        else
+          Interleaved = true;                           // set interleave
       }
-      // now set register, and see if any changes made; reuse Dither again
-      Dither = WriteP2DDCRateRegister();
-      if (Dither)
-        HandlerCheckDDCSettings();
     }
+    SetP2SampleRate(i, Enabled, Word2, Interleaved);
+    if(Interleaved && !P2Config.DDCSplitPairs)
+      SocketData[VPORTDDCIQ0 + i].Cmdid |= VBITINTERLEAVE;
+    else
+      SocketData[VPORTDDCIQ0 + i].Cmdid &= ~VBITINTERLEAVE;
+    Word = Word >> 1;                                   // move onto next DDC enabled bit
   }
-//
-// close down thread
-//
-  close(ThreadData->Socketid);                  // close incoming data socket
-  ThreadData->Socketid = 0;
-  ThreadData->Active = false;                   // indicate it is closed
-  return NULL;
+  // now set register, and see if any changes made
+  if (WriteP2DDCRateRegister())
+    HandlerCheckDDCSettings();
 }
 
 
+#define DDCFIELDS(DDC) \
+  {(DDC)*6 + 22, 1, 0, (DDC), DDCSampleSize}, \
+  {(DDC)*6 + 17, 1, 0, (DDC), DDCADCSelect}, \
+  {(DDC)*6 + 18, 2, VFIELDBIGENDIAN, (DDC), DDCRateField}
 
+static const struct PacketField DDCSpecificFields[] =
+{
+  {4, 1, 0, 0, DDCADCCount},
+  {5, 2, 0, 0, DDCADCOptions},                          // dither & random bits
+  {7, 2, 0, 0, DDCRateField},                           // DDC enables
+  DDCFIELDS(0), DDCFIELDS(1), DDCFIELDS(2), DDCFIELDS(3), DDCFIELDS(4),
+  DDCFIELDS(5), DDCFIELDS(6), DDCFIELDS(7), DDCFIELDS(8), DDCFIELDS(9),
+  {1363, 7, 0, 0, DDCRateField}                         // synch bytes for DDC0, 2, 4, 6
+};
 
 
-
+//
+// handler for an incoming DDC specific packet
+// called by the network event loop in p2app.c with a complete packet
+// only the fields that have changed since the last packet are set
+//
+void HandleDDCSpecificPacket(uint8_t* UDPInBuffer)
+{
+  NoteMessageReceived(VPORTDDCSPECIFIC);
+  Trace(eTraceDDCSpecific, ntohl(*(uint32_t*)UDPInBuffer), *(uint16_t*)(UDPInBuffer + 7));
+  if(UseDebug)
+    printf("DDC specific packet received\n");
+  DDCRatesChanged = false;
+  DecodePacketFields(DDCSpecificFields, sizeof(DDCSpecificFields) / sizeof(struct PacketField),
+                     UDPInBuffer, VDDCSPECIFICSIZE, &DDCSpecificCache);
+  if(DDCRatesChanged)
+    SetDDCRates(UDPInBuffer);
+}
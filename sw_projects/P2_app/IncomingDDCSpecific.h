@@ -27,8 +27,9 @@
 
 //
 // protocol 2 handler for incoming DDC specific Packet to SDR
+// called from the network event loop with a VDDCSPECIFICSIZE byte packet
 //
-void *IncomingDDCSpecific(void *arg);           // listener thread
+void HandleDDCSpecificPacket(uint8_t* UDPInBuffer);
 
 
 #endif
\ No newline at end of file
@@ -26,110 +26,115 @@
 #include <stdio.h>
 #include <string.h>
 #include "../common/saturnregisters.h"
+#include "eventtrace.h"
+#include "packetfields.h"
 
 
 
+struct PacketFieldCache DUCSpecificCache;               // last DUC specific packet
+
+
 //
-// listener thread for incoming DUC specific packets
+// setters for the DUC specific packet fields
+// iambic and general CW settings: bytes 5-10 are used together
 //
-void *IncomingDUCSpecific(void *arg)                    // listener thread
-{ 
-    struct ThreadSocketData *ThreadData;                  // socket etc data for this thread
-    struct sockaddr_in addr_from;                         // holds MAC address of source of incoming messages
-    uint8_t UDPInBuffer[VDUCSPECIFICSIZE];                // incoming buffer
-    struct iovec iovecinst;                               // iovcnt buffer - 1 for each outgoing buffer
-    struct msghdr datagram;                               // multiple incoming message header
-    int size;                                             // UDP datagram length
+static void DUCKeyer(__attribute__((unused)) uint32_t Index, __attribute__((unused)) uint32_t Value, const uint8_t* Packet)
+{
     uint8_t Byte;
     uint16_t SidetoneFreq;                                // freq for audio sidetone
     uint8_t IambicSpeed;                                  // WPM
     uint8_t IambicWeight;                                 //
     uint8_t SidetoneVolume;
+
+    IambicSpeed = *(uint8_t*)(Packet+9);                    // keyer speed
+    IambicWeight = *(uint8_t*)(Packet+10);                  // keyer weight
+    Byte = *(uint8_t*)(Packet+5);                           // keyer bool bits
+    SetCWIambicKeyer(IambicSpeed, IambicWeight, (bool)((Byte >> 2)&1), (bool)((Byte >> 5)&1), 
+                    (bool)((Byte >> 6)&1), (bool)((Byte >> 3)&1), (bool)((Byte >> 7)&1));
+    SetCWSidetoneEnabled((bool)((Byte >> 4)&1));
+    EnableCW((bool)((Byte >> 1)&1), (bool)((Byte >> 7)&1));   // CW enabled bit, breakin bit
+    SidetoneVolume = *(uint8_t*)(Packet+6);                 // sidetone volume
+    SidetoneFreq = *(uint16_t*)(Packet+7);                  // get frequency
+    SidetoneFreq = ntohs(SidetoneFreq);                     // convert from big endian
+    SetCWSidetoneVol(SidetoneVolume);
+    SetCWSidetoneFrequency(SidetoneFreq);
+}
+
+
+static void DUCCWDelays(__attribute__((unused)) uint32_t Index, __attribute__((unused)) uint32_t Value, const uint8_t* Packet)
+{
     uint8_t CWRFDelay;
     uint16_t CWHangDelay;
-    uint8_t CWRampTime;
-    uint32_t CWRampTime_us;
-
-    ThreadData = (struct ThreadSocketData *)arg;
-    ThreadData->Active = true;
-    printf("spinning up DUC specific thread with port %d\n", ThreadData->Portid);
-    //
-    // main processing loop
-    //
-    while(1)
-    {
-      memset(&iovecinst, 0, sizeof(struct iovec));
-      memset(&datagram, 0, sizeof(datagram));
-      iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
-      iovecinst.iov_len = VDUCSPECIFICSIZE;
-      datagram.msg_iov = &iovecinst;
-      datagram.msg_iovlen = 1;
-      datagram.msg_name = &addr_from;
-      datagram.msg_namelen = sizeof(addr_from);
-      size = recvmsg(ThreadData->Socketid, &datagram, 0);         // get one message. If it times out, ges size=-1
-      if(size < 0 && errno != EAGAIN)
-      {
-          perror("recvfrom, DUC specific");
-          return EXIT_FAILURE;
-      }
-      if(size == VDUCSPECIFICSIZE)
-      {
-          NewMessageReceived = true;
-          printf("DUC packet received\n");
-// iambic settings
-          IambicSpeed = *(uint8_t*)(UDPInBuffer+9);               // keyer speed
-          IambicWeight = *(uint8_t*)(UDPInBuffer+10);             // keyer weight
-          Byte = *(uint8_t*)(UDPInBuffer+5);                      // keyer bool bits
-          SetCWIambicKeyer(IambicSpeed, IambicWeight, (bool)((Byte >> 2)&1), (bool)((Byte >> 5)&1), 
-                          (bool)((Byte >> 6)&1), (bool)((Byte >> 3)&1), (bool)((Byte >> 7)&1));
-// general CW settings
-          SetCWSidetoneEnabled((bool)((Byte >> 4)&1));
-          EnableCW((bool)((Byte >> 1)&1), (bool)((Byte >> 7)&1));   // CW enabled bit, breakin bit
-          SidetoneVolume = *(uint8_t*)(UDPInBuffer+6);            // keyer speed
-          SidetoneFreq = *(uint16_t*)(UDPInBuffer+7);             // get frequency
-          SidetoneFreq = ntohs(SidetoneFreq);                     // convert from big endian
-          SetCWSidetoneVol(SidetoneVolume);
-          SetCWSidetoneFrequency(SidetoneFreq);
-          CWRFDelay = *(uint8_t*)(UDPInBuffer+13);                // delay before CW on
-          CWHangDelay = *(uint16_t*)(UDPInBuffer+11);             // delay before CW off
-          CWHangDelay = ntohs(CWHangDelay);                       // convert from big endian
-          SetCWPTTDelay(CWRFDelay);
-          SetCWHangTime(CWHangDelay);
-          CWRampTime = *(uint8_t*)(UDPInBuffer+17);               // ramp transition time
-          if(CWRampTime != 0)                                     // if ramp period supported by client app
-          {
-              CWRampTime_us = 1000 * CWRampTime;
-              InitialiseCWKeyerRamp(true, CWRampTime_us);         // create required ramp, P2
-          }
 
-// mic and line in options
-          Byte = *(uint8_t*)(UDPInBuffer+50);                     // mic/line options
-          SetMicBoost((bool)((Byte >> 1)&1));
-          SetMicLineInput((bool)(Byte&1));
-          SetOrionMicOptions((bool)((Byte >> 3)&1), (bool)((Byte >> 4)&1), (bool)((~Byte >> 2)&1));          
-          SetBalancedMicInput((bool)((Byte >> 5)&1));
-          Byte = *(uint8_t*)(UDPInBuffer+51);                     // line in gain
-          SetCodecLineInGain(Byte);
-          Byte = *(uint8_t*)(UDPInBuffer+58);                     // ADC1 att on TX
-          SetADCAttenuator(eADC2, Byte, false, true);
-          Byte = *(uint8_t*)(UDPInBuffer+59);                     // ADC1 att on TX
-          SetADCAttenuator(eADC1, Byte, false, true);
-      }
-    }
+    CWRFDelay = *(uint8_t*)(Packet+13);                     // delay before CW on
+    CWHangDelay = *(uint16_t*)(Packet+11);                  // delay before CW off
+    CWHangDelay = ntohs(CWHangDelay);                       // convert from big endian
+    SetCWPTTDelay(CWRFDelay);
+    SetCWHangTime(CWHangDelay);
+}
+
+
+static void DUCCWRamp(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+    if(Value != 0)                                          // if ramp period supported by client app
+        InitialiseCWKeyerRamp(true, 1000 * Value);          // create required ramp, P2
+}
+
+
 //
-// close down thread
+// mic and line in options
 //
-    close(ThreadData->Socketid);                  // close incoming data socket
-    ThreadData->Socketid = 0;
-    ThreadData->Active = false;                   // indicate it is closed
-    return NULL;
+static void DUCMicOptions(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+    uint8_t Byte = Value;
+
+    SetMicBoost((bool)((Byte >> 1)&1));
+    SetMicLineInput((bool)(Byte&1));
+    SetOrionMicOptions((bool)((Byte >> 3)&1), (bool)((Byte >> 4)&1), (bool)((~Byte >> 2)&1));          
+    SetBalancedMicInput((bool)((Byte >> 5)&1));
 }
 
 
+static void DUCLineInGain(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+    SetCodecLineInGain(Value);
+}
 
 
+//
+// ADC attenuation on TX
+//
+static void DUCTXAtten(uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+    SetADCAttenuator((EADCSelect)Index, Value, false, true);
+}
 
 
+static const struct PacketField DUCSpecificFields[] =
+{
+    {5, 6, 0, 0, DUCKeyer},                                 // keyer bits, sidetone, speed & weight
+    {11, 3, 0, 0, DUCCWDelays},                             // hang time, RF delay
+    {17, 1, 0, 0, DUCCWRamp},                               // ramp transition time, ms
+    {50, 1, 0, 0, DUCMicOptions},
+    {51, 1, 0, 0, DUCLineInGain},
+    {58, 1, 0, eADC2, DUCTXAtten},
+    {59, 1, 0, eADC1, DUCTXAtten}
+};
 
 
-
+//
+// handler for an incoming DUC specific packet
+// called by the network event loop in p2app.c with a complete packet
+// only the fields that have changed since the last packet are set
+//
+void HandleDUCSpecificPacket(uint8_t* UDPInBuffer)
+{ 
+    NoteMessageReceived(VPORTDUCSPECIFIC);
+    Trace(eTraceDUCSpecific, ntohl(*(uint32_t*)UDPInBuffer), 0);
+    if(UseDebug)
+        printf("DUC packet received\n");
+    BeginRegisterTransaction();                           // write each changed register and codec register once
+    DecodePacketFields(DUCSpecificFields, sizeof(DUCSpecificFields) / sizeof(struct PacketField),
+                       UDPInBuffer, VDUCSPECIFICSIZE, &DUCSpecificCache);
+    CommitRegisterTransaction();
+}
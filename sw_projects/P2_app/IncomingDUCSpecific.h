@@ -27,8 +27,9 @@
 
 //
 // protocol 2 handler for incoming DUC specific Packet to SDR
+// called from the network event loop with a VDUCSPECIFICSIZE byte packet
 //
-void *IncomingDUCSpecific(void *arg);           // listener thread
+void HandleDUCSpecificPacket(uint8_t* UDPInBuffer);
 
 
 #endif
\ No newline at end of file
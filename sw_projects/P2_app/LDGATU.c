@@ -2,7 +2,7 @@
 //
 // Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
 // PCI Express interface from linux on Raspberry pi
-// this application uses C code to emulate HPSDR protocol 2 
+// this application uses C code to emulate HPSDR protocol 2
 //
 // copyright Laurence Barker November 2021
 // licenced under GNU GPL3
@@ -11,6 +11,13 @@
 //
 // interface an LDG ATU, sending CAT command to request TUNE if required
 //
+// the ATU thread waits on three file descriptors: a periodic timerfd, on which
+// it reads the ATU input (IO6, active low) every atu_poll us; a one-shot timerfd
+// for the timeouts of the state it is in; and an eventfd written by the CAT
+// thread when the client sends ZZTU. Each edge of the input, client ZZTU and
+// timeout is an event for the state machine in ATUEvent(). A tune request is
+// sent within atu_poll us of the ATU asking for it.
+//
 //////////////////////////////////////////////////////////////
 
 #include "threaddata.h"
@@ -23,9 +30,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
@@ -35,37 +45,293 @@
 #include "../common/hwaccess.h"
 #include "../common/debugaids.h"
 #include "cathandler.h"
+#include "LDGATU.h"
+#include "p2config.h"
+#include "eventtrace.h"
+#include "threadplacement.h"
+
+
+//
+// tune states
+//
+typedef enum
+{
+    eATUIdle,                                   // no tune power requested
+    eATURequested,                              // ZZTU1 sent; waiting for the client to confirm
+    eATUTuning,                                 // client is sending tune power
+    eATUReleasing,                              // ZZTU0 sent; waiting for the client to confirm
+    eATUCancelled                               // client ended the tune, or it timed out; wait for the ATU to release
+} EATUState;
+
+
+//
+// events for the state machine
+//
+typedef enum
+{
+    eATUAsserted,                               // ATU asks for tune power
+    eATUReleased,                               // ATU no longer asks for it
+    eATUClientOn,                               // client sent ZZTU1
+    eATUClientOff,                              // client sent ZZTU0
+    eATUTimeout,                                // the state's timeout has expired
+    eATULost                                    // CAT connection closed, or the SDR stopped
+} EATUEvent;
 
 
 bool ATUControlled = false;
-bool TuneRequestedState = false;                // true if tune power requested
+static EATUState ATUState = eATUIdle;
+static bool ATUQueried;                         // "ZZTU;" sent after an unconfirmed request
+
+static atomic_int ATUClientTune = -1;           // last ZZTU from the client not yet taken; -1 if none
+static int ATUWakeFd = -1;                      // eventfd: the CAT thread has a ZZTU
+static int ATUPollFd = -1;                      // timerfd: read the ATU input
+static int ATUTimeoutFd = -1;                   // timerfd: state timeout
+static pthread_t ATUThread;
+
 
 //
-// function to initialise a connection to the  ATU; call if selected as a command line option
+// arm the state timeout for Ms milliseconds; 0 to disarm it
 //
-void InitialiseLDGHandler(void)
+static void SetATUTimeout(uint32_t Ms)
 {
-    ATUControlled = true;
+    struct itimerspec Timer;
+
+    memset(&Timer, 0, sizeof(Timer));
+    Timer.it_value.tv_sec = Ms / 1000;
+    Timer.it_value.tv_nsec = (long)(Ms % 1000) * 1000000;
+    timerfd_settime(ATUTimeoutFd, 0, &Timer, NULL);
 }
 
 
 //
-// function to request TUNE power
-// paramter true to request tune power provision
+// change state, and arm the timeout of the new state
 //
-void RequestATUTune(bool TuneRequested)
+static void SetATUState(EATUState NewState, EATUEvent Event)
 {
-    if(ATUControlled)                // only do anything if ATU control has been requested
+    ATUState = NewState;
+    Trace(eTraceATU, NewState, Event);
+    switch(NewState)
     {
-        if(CATPortAssigned)
+        case eATURequested:
+        case eATUReleasing:
+            SetATUTimeout(P2Config.ATUAckTimeout);
+            break;
+
+        case eATUTuning:
+            SetATUTimeout(P2Config.ATUMaxTune);
+            break;
+
+        default:
+            SetATUTimeout(0);
+            break;
+    }
+}
+
+
+//
+// the state machine: act on one event
+//
+static void ATUEvent(EATUEvent Event)
+{
+    if(Event == eATULost)
+    {
+        SetATUState(eATUIdle, Event);                           // nothing to send: the client has gone
+        return;
+    }
+    switch(ATUState)
+    {
+        case eATUIdle:
+            if(Event == eATUAsserted)
+            {
+                MakeCATMessageBool(eZZTU, true);
+                ATUQueried = false;
+                SetATUState(eATURequested, Event);
+            }
+            break;                                              // a client ZZTU when idle is the user's own tune
+
+        case eATURequested:
+            if(Event == eATUClientOn)
+                SetATUState(eATUTuning, Event);
+            else if(Event == eATUClientOff)
+                SetATUState(eATUCancelled, Event);              // the client refused
+            else if(Event == eATUReleased)
+            {
+                MakeCATMessageBool(eZZTU, false);
+                SetATUState(eATUReleasing, Event);
+            }
+            else if((Event == eATUTimeout) && !ATUQueried)
+            {
+                MakeCATMessageNoParam(eZZTU);                   // ask for the tune state
+                ATUQueried = true;
+                SetATUTimeout(P2Config.ATUAckTimeout);
+            }
+            else if(Event == eATUTimeout)
+                SetATUState(eATUTuning, Event);                 // no reply: assume the client is tuning
+            break;
+
+        case eATUTuning:
+            if(Event == eATUReleased)
+            {
+                MakeCATMessageBool(eZZTU, false);
+                SetATUState(eATUReleasing, Event);
+            }
+            else if(Event == eATUClientOff)
+                SetATUState(eATUCancelled, Event);
+            else if(Event == eATUTimeout)
+            {
+                printf("ATU: tune power requested for more than %ums; released\n", P2Config.ATUMaxTune);
+                MakeCATMessageBool(eZZTU, false);
+                SetATUState(eATUCancelled, Event);
+            }
+            break;
+
+        case eATUReleasing:
+            if(Event == eATUAsserted)
+            {
+                MakeCATMessageBool(eZZTU, true);
+                ATUQueried = false;
+                SetATUState(eATURequested, Event);
+            }
+            else if((Event == eATUClientOff) || (Event == eATUTimeout))
+                SetATUState(eATUIdle, Event);
+            break;
+
+        case eATUCancelled:
+            if(Event == eATUReleased)
+                SetATUState(eATUIdle, Event);
+            break;
+    }
+}
+
+
+//
+// read the ATU input: true if tune power requested (bit 2 is zero)
+//
+static bool ReadATUInput(void)
+{
+    ReadStatusRegister();
+    return (((GetUserIOBits() >> 2) & 1) == 0);
+}
+
+
+//
+// the ATU thread: while the SDR is running and CAT is connected, turn
+// edges of the ATU input, client ZZTU messages and timeouts into events
+//
+static void* ATUHandler(__attribute__((unused)) void* arg)
+{
+    struct pollfd Polls[3];
+    struct itimerspec Timer;
+    uint64_t Count;
+    uint32_t Generation;
+    bool Input, LastInput = false;
+    bool Watching = false;
+    int Tune;
+
+    Polls[0].fd = ATUPollFd;
+    Polls[1].fd = ATUTimeoutFd;
+    Polls[2].fd = ATUWakeFd;
+    Polls[0].events = Polls[1].events = Polls[2].events = POLLIN;
+
+    Generation = GetStateGeneration();
+    while(true)
+    {
+        if(!atomic_load(&SDRActive) || !CATPortAssigned)
         {
-            if(TuneRequested != TuneRequestedState)         // act on change only
+            if(Watching)
             {
-                TuneRequestedState = TuneRequested;
-                MakeCATMessageBool(eZZTU, TuneRequested);
+                memset(&Timer, 0, sizeof(Timer));
+                timerfd_settime(ATUPollFd, 0, &Timer, NULL);
+                ATUEvent(eATULost);
+                Watching = false;
             }
+            atomic_store(&ATUClientTune, -1);
+            Generation = WaitForStateChange(Generation, StateWaitTimeout());
+            continue;
+        }
+        if(!Watching)
+        {
+            // a request already asserted counts as an edge once CAT is up
+            memset(&Timer, 0, sizeof(Timer));
+            Timer.it_value.tv_nsec = (long)P2Config.ATUPollPeriod * 1000;
+            Timer.it_interval = Timer.it_value;
+            timerfd_settime(ATUPollFd, 0, &Timer, NULL);
+            LastInput = false;
+            Watching = true;
+        }
+        if(poll(Polls, 3, -1) < 0)
+        {
+            if(errno != EINTR)
+                perror("ATU poll");
+            continue;
+        }
+        if(Polls[2].revents & POLLIN)
+        {
+            if(read(ATUWakeFd, &Count, sizeof(Count)) != sizeof(Count))
+                Count = 0;
+            Tune = atomic_exchange(&ATUClientTune, -1);
+            if(Tune >= 0)
+                ATUEvent(Tune ? eATUClientOn : eATUClientOff);
+        }
+        if(Polls[1].revents & POLLIN)
+        {
+            if(read(ATUTimeoutFd, &Count, sizeof(Count)) == sizeof(Count))
+                ATUEvent(eATUTimeout);
         }
-        else
-            TuneRequestedState = false;                     // set not requested if connection lost
+        if(Polls[0].revents & POLLIN)
+        {
+            if(read(ATUPollFd, &Count, sizeof(Count)) != sizeof(Count))
+                Count = 0;
+            Input = ReadATUInput();
+            if(Input != LastInput)
+                ATUEvent(Input ? eATUAsserted : eATUReleased);
+            LastInput = Input;
+        }
+    }
+    return NULL;
+}
+
+
+//
+// client ZZTU: pass it to the ATU thread
+//
+void NoteATUTuneResponse(bool TuneOn)
+{
+    uint64_t Wake = 1;
+
+    if(ATUWakeFd < 0)
+        return;
+    atomic_store(&ATUClientTune, TuneOn ? 1 : 0);
+    if(write(ATUWakeFd, &Wake, sizeof(Wake)) != sizeof(Wake))
+        perror("ATU wake");
+}
+
+
+//
+// function to initialise a connection to the  ATU; call if selected as a command line option
+//
+bool InitialiseLDGHandler(void)
+{
+    ATUWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ATUPollFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    ATUTimeoutFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if((ATUWakeFd < 0) || (ATUPollFd < 0) || (ATUTimeoutFd < 0))
+        perror("ATU eventfd/timerfd");
+    else if(CreatePlacedThread(&ATUThread, eThreadControl, "LDG ATU", ATUHandler, NULL) != 0)
+        perror("pthread_create LDG ATU");
+    else
+    {
+        pthread_detach(ATUThread);
+        ATUControlled = true;
+        printf("LDG ATU: input polled every %uus\n", P2Config.ATUPollPeriod);
+        return false;
     }
+    if(ATUWakeFd >= 0)
+        close(ATUWakeFd);
+    if(ATUPollFd >= 0)
+        close(ATUPollFd);
+    if(ATUTimeoutFd >= 0)
+        close(ATUTimeoutFd);
+    ATUWakeFd = ATUPollFd = ATUTimeoutFd = -1;
+    return true;
 }
@@ -17,17 +17,22 @@
 #define __LDGATU_h
 
 
+#include <stdbool.h>
+
+
 //
 // function to initialise a connection to the  ATU; call if selected as a command line option
+// starts the ATU thread, which reads the ATU input and requests TUNE power by CAT
+// return true if error
 //
-void InitialiseLDGHandler(void);
+bool InitialiseLDGHandler(void);
 
 
 //
-// function to request TUNE power
-// paramter true to request tune power provision
+// NoteATUTuneResponse(bool TuneOn)
+// called by the CAT handler when the client sends ZZTU (its tune state)
 //
-void RequestATUTune(bool TuneRequested);
+void NoteATUTuneResponse(bool TuneOn);
 
 
 
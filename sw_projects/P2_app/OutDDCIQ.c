@@ -2,7 +2,7 @@
 //
 // Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
 // PCI Express interface from linux on Raspberry pi
-// this application uses C code to emulate HPSDR protocol 2 
+// this application uses C code to emulate HPSDR protocol 2
 //
 // copyright Laurence Barker November 2021
 // licenced under GNU GPL3
@@ -17,6 +17,23 @@
 #include <stdint.h>
 #include "../common/saturntypes.h"
 #include "OutMicAudio.h"
+#include "OutDDCIQ.h"
+#include "OutVirtualDDC.h"
+#include "OutDDCShm.h"
+#include "OutDDCRecord.h"
+#include "OutDDCSnapshot.h"
+#include "telemetry.h"
+#include "pcapcapture.h"
+#include "p2config.h"
+#include "xdptx.h"
+#include "threadplacement.h"
+#include "eventtrace.h"
+#include "heartbeat.h"
+#include "streamengine.h"
+#include "stageprofile.h"
+#include "pluginhost.h"
+#include "pscapture.h"
+#include "ppstime.h"
 #include <errno.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -24,10 +41,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include <time.h>
+#include <math.h>
+#include <endian.h>
+#include <arpa/inet.h>
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
 #include "../common/hwaccess.h"
 #include "../common/debugaids.h"
+#include "../common/ddcdemux.h"
+#include "../common/ddccompress.h"
+#include "../common/ddcfec.h"
+#include "../common/ringbuffer.h"
+#include "../common/ddccapture.h"
+#include "../common/decimator.h"
+#include "../common/diversity.h"
+#include "../common/vita49.h"
 
 
 
@@ -35,215 +72,2122 @@
 //
 // global holding the current step of C&C data. Each new USB frame updates this.
 //
-#define VDMABUFFERSIZE 131072						// memory buffer to reserve (4x DDC FIFO so OK)
-#define VALIGNMENT 4096                             // buffer alignment
-#define VBASE 0x1000									              // DMA start at 4K into buffer
-#define VBASE 0x1000                                // offset into I/Q buffer for DMA to start
-#define VDMATRANSFERSIZE 4096                       // read 4K at a time  initially
+#define VDDCPACKETSIZE 1444
+#define VDDCHEADERSIZE 16                           // P2 header bytes before the I/Q samples
+#define VMAXDDCHEADERSIZE VVITA49DATAHEADERSIZE     // header buffer per packet: P2 or VITA-49
+#define VIQSAMPLESPERFRAME 238                      // total I/Q samples in one DDC packet
+#define VIQBYTESPERFRAME 6*VIQSAMPLESPERFRAME       // total bytes in one outgoing frame
+#define VIQSAMPLESPERFRAME16 357                    // I/Q samples in one DDC packet of 16 bit samples
+#define VIQRINGBYTESPERFRAME16 (6*VIQSAMPLESPERFRAME16)  // ring bytes (24 bit samples) packed into one such packet
+#define VDDCGAPQUEUESIZE 16                         // sample gaps per DDC waiting to be timestamped
+#define VDDCANCHORQUEUESIZE 4                       // PPS anchors per DDC waiting for the sender
+#define VDDCBOUNDARYQUEUESIZE 8                     // rate changes per DDC waiting for the sender
+#define VDDCRINGGROWWAIT 50000                      // us the demux waits for a sender to drain a ring to grow
+#define VDDCDMAINFLIGHT 2                           // async DMA transfers queued at once
+#define VDDCSTREAMRINGSIZE 1048576                  // driver streaming ring size
+#define VDDCSTREAMBLOCKSIZE 4096                    // bytes per streaming ring descriptor
+#define VDDCFRAMERATE 48000                         // DMA frames per second (one rate word per frame)
+#define VMINDDCDMASIZE 512                          // smallest DMA transfer, and size granularity
+#define VMAXDDCDMASIZE 32768                        // largest DMA transfer
+#define VMINIQRINGSIZE 16384                        // smallest per DDC I/Q ring
+#define VFULLRATEWORDS 32                           // samples per DMA frame from a DDC at 1536KHz
+
+//
+// strategy:
+// the DDC path is a pipeline of threads connected by single producer, single consumer rings:
+// 1. DMA reader (this thread, OutgoingDDCIQ): polls the FIFO and DMAs data into the DMA ring
+// 2. demux thread: finds DDC frames in the DMA ring and copies each DDC's samples to its own ring
+// 3. sender thread(s): send P2 packets from the DDC rings. Each DDC is served by one sender;
+//    with N senders, sender n serves the DDCs where (DDC % N) == n.
+// so a slow sendmmsg() can't hold up the DMA and overflow the FIFO.
+// each stage can optionally be pinned to its own CPU core.
+//
+// the ring buffers are double mapped (see ringbuffer.c), so a DMA or P2 packet
+// can always be read or written linearly at the ring's read or write pointer:
+// there is no wrap in the middle, and no residue to move down after each cycle.
+// a partial DDC frame left at the end of a DMA is decoded when the next DMA
+// has been appended after it.
+//
+// the DMA reader uses asynchronous DMA if the kernel supports it: while one transfer
+// is in progress the next is queued to the space after it in the DMA ring, so the
+// XDMA engine goes straight from one to the next. Transfers are committed to the ring
+// in the order they were queued. If AIO can't be set up, blocking reads are used.
+//
+// optionally the xdma driver's streaming ring is used instead: the driver runs the C2H
+// engine continuously into a ring it allocated once, and DMARing is a mirrored mapping
+// of that memory. The DMA reader then only passes the ring tail to the driver and
+// collects the new write position, with no per transfer page pinning or SG setup.
+// this relies on the FPGA stream reader holding off AXI reads while its FIFO is empty.
+//
+// if a capture file is open (p2app -C), the DMA reader copies each transfer to it as
+// the transfer is committed to the DMA ring. The demux and senders are not involved.
+//
+
+
+//
+// code to allocate and free dynamic allocated memory
+// first the memory buffers:
+//
+struct SPSCRingBuffer DMARing;                              // data for DMA read from DDC
+struct SPSCRingBuffer IQRing[VNUMDDC];                      // demultiplexed I/Q samples per DDC; Size 0 until needed
+uint8_t* UDPBuffer[VNUMDDC];                                // DDC frame header buffers: VMAXDDCBATCH headers per DDC
+
+//
+// the I/Q rings are made when a DDC is first enabled, sized for its sample rate,
+// so with the usual 1 or 2 DDCs the rings the demux and senders touch stay small.
+// a ring only ever grows (the memory stays in the arena): once a DDC's rate needs a
+// bigger ring than it has, the demux makes it at the rate boundary, after the sender
+// has drained the old one (see GrowIQRing()); only if that fails is the pipeline
+// stopped and restarted to make it.
+// shared memory clients map the rings once, so with them all the rings are made at the
+// largest size at startup as before.
+//
+static _Atomic uint32_t IQRingBytes[VNUMDDC];               // size of each ring made, 0 if none
+static _Atomic bool IQRingsTooSmall;                        // set when a ring needs to be made or grown
+static bool IQRingsAtStartup;                               // true if all were made at startup
+
+//
+// batched send: each DDC has its own socket, so outgoing packets are batched per DDC
+// and sent with one sendmmsg() call
+// each packet is a 2 entry iovec: the header in UDPBuffer, then the samples read
+// directly from the DDC sample buffer, so the samples are not copied to assemble a packet.
+// The sample buffer data must not be moved until the batch has been sent.
+// with subscribers each packet has one message per destination, all sharing its iovec:
+// message (Packet * DDCNumDests + Dest) sends packet Packet to destination Dest.
+//
+#define VMAXDDCDESTS (VMAXDDCSUBSCRIBERS + 1)               // client + subscribers
+uint32_t DDCSendBatchSize = VDEFAULTDDCBATCH;               // packets per sendmmsg() call
+struct mmsghdr DDCBatchMsgs[VNUMDDC][VMAXDDCBATCH * VMAXDDCDESTS];  // message headers for each batch
+struct iovec DDCBatchIovecs[VNUMDDC][VMAXDDCBATCH][2];   // [0]=header; [1]=I/Q samples
+struct sockaddr_in DDCDestAddr[VNUMDDC][VMAXDDCDESTS];      // destination addresses for outgoing data
+uint32_t DDCNumDests[VNUMDDC];                              // destinations in use for each DDC
+bool DDCConnected[VNUMDDC];                                 // true if the DDC socket is connected to the client
+uint8_t* DDCPackBuffer[VNUMDDC];                            // 16 bit or compressed samples for each packet of a batch; made when first needed
+uint32_t DDCPackJumbo[VNUMDDC];                             // jumbo factor the pack buffer was made for
+
+//
+// P2 header templates: the header fields that are the same in every packet of a stream
+// (bits per sample, samples per packet, and a zero timestamp when timestamping is off)
+// are written into every batch slot of UDPBuffer once, when one of them or the compression
+// mode changes. Each packet then only has its sequence number, and timestamp if on, written;
+// with compression on, also its bits field, as compressed and incompressible packets differ.
+// VITA-49 headers are made in the same slots, so sending them clears the template.
+//
+struct DDCHeaderTemplate
+{
+    uint32_t Bits;                                          // bits per sample field
+    uint32_t Samples;                                       // samples per packet field
+    uint32_t Compress;                                      // compression mode the slots were written for
+    bool Stamped;                                           // true if each packet writes its timestamp
+    bool Valid;                                             // false until written, or after VITA-49 headers
+};
+struct DDCHeaderTemplate DDCHeaderTemplates[VNUMDDC];
+
+//
+// optional jumbo DDC packets (setting ddc_jumbo = N) for clients on a jumbo frame LAN:
+// each packet carries N times the samples of a standard one, with the same header, so a
+// client that reads the sample count from the header takes them unchanged; the packet
+// rate and per packet overhead drop N times. It is used for a DDC only if it has no
+// subscribers and the path MTU to the client (the interface MTU, for a connected socket)
+// takes the packet unfragmented; otherwise as many times as fit, or standard packets.
+// 0 (the default) keeps standard packets for standard clients. GSO segments and XDP
+// frames are sized for standard packets, so a jumbo DDC is sent by sendmmsg().
+//
+#define VDDCIPUDPHEADERS 28                                 // IPv4 and UDP header bytes
+uint32_t DDCJumbo[VNUMDDC];                                 // standard packets' samples in each DDC packet: 1 = standard
+
+//
+// optional UDP GSO send (setting ddc_gso): the iovecs of consecutive packets in the batch
+// are adjacent in DDCBatchIovecs, so one message with the iovecs of up to VMAXGSOPACKETS
+// packets is a "super packet" that the kernel (or NIC) splits into VDDCPACKETSIZE datagrams.
+// one message per destination. This needs UDP_SEGMENT (linux 4.18); if the socket option
+// is refused, or a GSO send fails, the DDC uses the sendmmsg() batches.
+//
+#define VMAXGSOPACKETS 45                                   // 45 * 1444 bytes fits one 64KB UDP datagram
+bool DDCUseGSO[VNUMDDC];                                    // true if the DDC is sent by GSO
+struct mmsghdr DDCGSOMsgs[VNUMDDC][VMAXDDCDESTS];           // one GSO message per destination
+
+//
+// optional AF_XDP send (setting ddc_xdp): packets to the client go straight to the
+// eth0 driver (or that of the -I interface) through xdptx.c, bypassing the UDP/IP
+// stack. It is used for a DDC only if it has no subscribers and the client is in
+// the neighbour table;
+// otherwise, or if an XDP send fails, the DDC uses the socket path.
+//
+bool DDCUseXDP[VNUMDDC];                                    // true if the DDC is sent by XDP
+struct XDPDest DDCXDPDest[VNUMDDC];                         // prebuilt headers to the client
+bool DDCXDPUnavailable = false;                             // true once the transmitter failed to open
+
+//
+// optional paced send (setting ddc_pace): each packet carries an SCM_TXTIME departure
+// time, so the fq (or etf) qdisc spreads each batch out over the time it took to
+// collect, instead of sending it as one burst. Times are spaced a little under the
+// DDC's packet interval so that the queue drains even if the FPGA clock is fast of
+// the Pi's; a DDC that has run dry starts again at now + ddc_pace_lead. GSO and XDP
+// would bypass or merge the times, so a paced DDC is sent by sendmmsg().
+// needs SO_TXTIME (linux 4.19) and a qdisc on the interface that honours it, eg.
+// "tc qdisc replace dev eth0 root fq"; with any other qdisc the packets go at once.
+//
+#define VDDCPACEMARGIN 64                                   // interval is 1/64 short of nominal
+#define VMAXDDCPACEAHEAD 50000000ULL                        // ns; further ahead is taken as stale
+union DDCTxTimeControl
+{
+    char Buffer[CMSG_SPACE(sizeof(uint64_t))];
+    struct cmsghdr Align;
+};
+union DDCTxTimeControl DDCTxTime[VNUMDDC][VMAXDDCBATCH];   // SCM_TXTIME for each packet of a batch
+bool DDCUsePacing[VNUMDDC];                                 // true if the DDC's packets are timed
+clockid_t DDCPaceClock = CLOCK_MONOTONIC;                   // clock the departure times are on
+uint64_t DDCNextTxTime[VNUMDDC];                            // sender: departure of the next packet, ns
+_Atomic uint32_t DDCRateKHz[VNUMDDC];                       // demux: sample rate in the DDC stream
+
+//
+// optional forward error correction (setting ddc_fec = N), for clients on a lossy link
+// through ddcproxy: as each batch is sent, its packets are XORed into the DDC's parity
+// group, and a parity packet (see ddcfec.h) follows every N packets, to each destination.
+// ddcproxy makes any one lost packet of a group again, and takes the parity packets
+// out. It is used for P2 packets of standard size: not VITA-49 or jumbo packets.
+//
+struct DDCFECGroup DDCFECGroups[VNUMDDC];                   // sender: parity of each DDC's current group
+
+//
+// DDC subscription table: extra destinations, set from the command line
+//
+struct DDCSubscriber
+{
+    struct sockaddr_in Addr;
+    uint32_t DDCMask;                                       // bit n set = send DDC n
+};
+struct DDCSubscriber DDCSubscribers[VMAXDDCSUBSCRIBERS];
+uint32_t DDCSubscriberCount = 0;
+_Atomic uint32_t DDCPacketsSent;                            // statistics: packets sent
+_Atomic uint32_t DDCSendCalls;                              // statistics: sendmmsg() calls made
+_Atomic uint32_t DDCSamplesDiscarded;                       // statistics: samples dropped because a DDC ring was full
+
+//
+// packet timestamps
+// the timestamp of a DDC packet is the sample number of its 1st sample, counted
+// from the start of the stream. Samples the demux has to drop must still be
+// counted, so each drop is queued with its position in the DDC ring (the ring
+// head byte count when it happened); the sender adds the dropped samples to its
+// count when its packets reach that position.
+// there is no free running FPGA sample counter to read, so the count is derived
+// from the DDC stream itself.
+//
+struct DDCSampleGap
+{
+    uint32_t Position;                                      // IQRing head byte count at the gap
+    uint32_t Samples;                                       // samples dropped there
+};
+
+struct DDCGapQueue
+{
+    struct DDCSampleGap Gaps[VDDCGAPQUEUESIZE];
+    _Atomic uint32_t Head;                                  // gaps queued (written by demux)
+    _Atomic uint32_t Tail;                                  // gaps applied (written by sender)
+    uint32_t Unqueued;                                      // dropped samples not yet queued (demux only)
+};
+
+struct DDCGapQueue DDCGaps[VNUMDDC];
+
+//
+// with a PPS device, the demux queues the ring position of each pulse's sample
+// (the same way as the gaps) for the sender to set the stream's epoch from
+//
+struct DDCPPSAnchor
+{
+    uint32_t Position;                                      // IQRing head byte count of the pulse's sample
+    uint32_t Second;                                        // its UTC second
+};
+
+struct DDCAnchorQueue
+{
+    struct DDCPPSAnchor Anchors[VDDCANCHORQUEUESIZE];
+    _Atomic uint32_t Head;                                  // anchors queued (written by demux)
+    _Atomic uint32_t Tail;                                  // anchors applied (written by sender)
+};
+
+struct DDCAnchorQueue DDCAnchors[VNUMDDC];
+
+//
+// rate changes: when a DDC's sample rate changes (a new rate word, or a change of
+// software decimation), the demux queues the ring position where the new rate's
+// samples start. The sender sends the old rate's samples before it as a last packet
+// padded with zero samples, so no packet mixes two rates, and the new rate starts
+// a packet. The other DDCs are not affected, and sequence numbers carry on.
+//
+struct DDCRateBoundary
+{
+    uint32_t Position;                                      // IQRing head byte count where the new rate starts
+    uint32_t RateKHz;                                       // the new rate; 0 if the DDC has stopped
+};
+
+struct DDCBoundaryQueue
+{
+    struct DDCRateBoundary Boundaries[VDDCBOUNDARYQUEUESIZE];
+    _Atomic uint32_t Head;                                  // boundaries queued (written by demux)
+    _Atomic uint32_t Tail;                                  // boundaries reached (written by sender)
+};
+
+struct DDCBoundaryQueue DDCBoundaries[VNUMDDC];
+uint8_t* DDCFlushBuffer[VNUMDDC];                           // sender: a padded last packet; made when first needed
+uint32_t DDCFlushJumbo[VNUMDDC];                            // jumbo factor the flush buffer was made for
+
+//
+// packet sequence numbers and sample counts, kept over a pipeline restart within a run
+// (sender only, once running)
+//
+uint32_t DDCSequence[VNUMDDC];                              // sequence number of the next packet
+uint64_t DDCSampleCount[VNUMDDC];                           // sample number of the next packet's 1st sample
+bool DDCSequenceResumed;                                    // the next run carries on from these, not 0
+
+//
+// pipeline control
+//
+uint32_t DDCSenderCount = 1;                                // number of sender threads
+int DDCStageCores[3] = {-1, -1, -1};                        // core for DMA reader, demux, senders; -1 = not pinned
+volatile bool DDCPipelineRun;                               // true while the demux & sender stages should run
+volatile bool DDCPipelineError;                             // set by a stage if it fails
+struct ThreadSocketData* DDCSocketData;                     // socket data for DDC0; others follow
+
+//
+// per-DDC senders (SetDDCSenderThreads(0)): a sender for each DDC, that sleeps on its
+// own eventfd while its ring has less than a packet. It sets its Waiting flag before
+// the final ring check, and the demux writes the eventfd only if the flag is set, so
+// a sender that isn't asleep costs the demux no system call.
+//
+#define VDDCSENDERWAIT 10                                   // ms; backstop for a missed wakeup
+bool DDCSenderPerDDC = false;                               // true for one sender per DDC
+int DDCWakeFd[VNUMDDC];                                     // eventfd for each sender; -1 if none
+_Atomic bool DDCSenderWaiting[VNUMDDC];                     // true while a sender is going to sleep
+
+//
+// warm restart. The packet and socket setup of a run is kept for the next one
+// while the client address and the DDC sockets are unchanged. The DDCs are
+// disabled at the end of each run, so at the next start the stale FIFO contents
+// are dropped with one FIFO reset, and the stream should begin on a frame.
+//
+bool DDCSetupValid = false;                                 // true if the packet setup can be reused
+struct sockaddr_in DDCSetupAddr;                            // client address it was made for
+uint32_t DDCSetupSockets[VNUMDDC];                          // SocketCount of each DDC socket then
+uint32_t DDCSetupGSO, DDCSetupXDP, DDCSetupPace;            // P2Config.DDCGSO, DDCXDP, DDCPace then
+uint32_t DDCSetupJumbo;                                     // P2Config.DDCJumbo then
+bool DDCSetupVITA;                                          // IsVITA49Wanted() then
+volatile bool DDCWarmStart;                                 // true if the DMA ring should start with a rate word
+uint64_t DDCRunStartTime;                                   // TelemetryTimestamp() at the start of the run
+_Atomic uint64_t DDCFirstPacketTime;                        // time of the run's first packet; 0 until sent
+
+//
+// async DMA reader state
+//
+struct DMAAsyncContext DDCDMAContext;
+bool DDCAsyncDMA;                                           // true if AIO context set up
+uint32_t DDCDMAOldest;                                      // slot of oldest transfer in flight
+uint32_t DDCDMAInFlight;                                    // number of transfers in flight
+uint32_t DDCDMAPendingBytes;                                // bytes queued but not yet committed to DMA ring
+uint32_t DDCDMASize[VDDCDMAINFLIGHT];                       // bytes requested by each slot
+bool DDCDMADone[VDDCDMAINFLIGHT];                           // true when slot has completed
+uint64_t DDCDMAStart[VDDCDMAINFLIGHT];                      // time each slot was queued, for telemetry
+bool DDCUseStreamRing = false;                              // true if streaming ring requested
+bool DDCStreamActive = false;                               // true if DMARing is the driver's streaming ring
+uint32_t DDCTargetLatency = VDEFAULTDDCLATENCY;             // us of data to collect before a DMA
+uint32_t DDCFIFODepthNow;                                   // FIFO locations occupied at last read, for capture
+
+struct DDCSenderArgs
+{
+    uint32_t SenderNum;                                     // this sender's number, 0...DDCSenderCount-1
+};
+
+
+//
+// size of the first DMA transfers, before a latency target applies:
+// the configured size in whole DMA size steps
+//
+static uint32_t DDCInitialDMASize(void)
+{
+    return (P2Config.DDCDMATransferSize / VMINDDCDMASIZE) * VMINDDCDMASIZE;
+}
+
+
+bool CreateDynamicMemory(void)                              // return true if error
+{
+    uint32_t DDC;
+    bool Result = false;
+//
+// first create the ring for DMA
+//
+    if (ArenaRingBuffer(&StreamArena, &DMARing, P2Config.DDCDMABufferSize))
+    {
+        printf("I/Q read buffer allocation failed\n");
+        Result = true;
+    }
+
+    //
+    // set up per-DDC data structures. The headers are small and set up with the sockets,
+    // so they are made now; the I/Q rings when needed, unless they are to be shared
+    //
+    IQRingsAtStartup = (P2Config.DDCShm != VDDCSHMOFF) || IsDDCRecordingSet();
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        UDPBuffer[DDC] = ArenaAlloc(&StreamArena, VMAXDDCHEADERSIZE * VMAXDDCBATCH, 0);
+        DDCHeaderTemplates[DDC].Valid = false;
+        if (UDPBuffer[DDC] == NULL)
+            Result = true;
+        else if (IQRingsAtStartup)
+        {
+            Result |= ArenaRingBuffer(&StreamArena, &IQRing[DDC], P2Config.DDCDMABufferSize);
+            atomic_store(&IQRingBytes[DDC], IQRing[DDC].Size);
+        }
+        else
+            memset(&IQRing[DDC], 0, sizeof(struct SPSCRingBuffer));
+        if (Result)
+        {
+            printf("DDC%d buffer allocation failed\n", DDC);
+            break;
+        }
+    }
+    return Result;
+}
+
+
+//
+// the I/Q ring a DDC needs for WordCount samples per frame (1 per 48KHz):
+// the configured ring size at 1536KHz and in proportion below that
+//
+static uint32_t IQRingSizeForRate(uint32_t WordCount)
+{
+    uint64_t Size;
+
+    Size = ((uint64_t)P2Config.DDCDMABufferSize * WordCount) / VFULLRATEWORDS;
+    if (Size < VMINIQRINGSIZE * (P2Config.DDCJumbo ? P2Config.DDCJumbo : 1))
+        Size = VMINIQRINGSIZE * (P2Config.DDCJumbo ? P2Config.DDCJumbo : 1);       // room for a few jumbo packets
+    else if (Size > P2Config.DDCDMABufferSize)
+        Size = P2Config.DDCDMABufferSize;
+    return (uint32_t)Size;
+}
+
+
+//
+// make or grow the I/Q rings the enabled DDCs need. Called with the pipeline stopped.
+// return true if error
+//
+static bool PrepareIQRings(void)
+{
+    uint32_t DDCCounts[VNUMDDC];
+    uint32_t DDC;
+    uint32_t Size;
+
+    atomic_store(&IQRingsTooSmall, false);                  // a change from here on is seen next time
+    AnalyseDDCHeader(GetP2DDCRateWord(), DDCCounts);
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        if (DDCCounts[DDC] == 0)
+            continue;
+        Size = IQRingSizeForRate(DDCCounts[DDC]);
+        if (IQRing[DDC].Size >= Size)
+            continue;
+        if (IQRing[DDC].Base != NULL)
+            FreeRingBuffer(&IQRing[DDC]);                   // the memory stays in the arena
+        if (ArenaRingBuffer(&StreamArena, &IQRing[DDC], Size))
+        {
+            printf("DDC%d I/Q ring allocation failed\n", DDC);
+            atomic_store(&IQRingBytes[DDC], 0);
+            return true;
+        }
+        atomic_store(&IQRingBytes[DDC], IQRing[DDC].Size);
+        if (UseDebug)
+            printf("DDC%d I/Q ring %dKB\n", DDC, IQRing[DDC].Size / 1024);
+    }
+    return false;
+}
+
+
+void FreeDynamicMemory(void)
+{
+    uint32_t DDC;
+
+    FreeRingBuffer(&DMARing);
+    //
+    // free the per-DDC buffers
+    //
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        FreeRingBuffer(&IQRing[DDC]);                       // the memory stays in the arena
+}
+
+
+//
+// count a send in the statistics; the first of a run records the time to first packet
+//
+static void CountDDCSend(uint32_t Packets)
+{
+    uint64_t NotSent = 0;
+
+    atomic_fetch_add(&DDCSendCalls, 1);
+    atomic_fetch_add(&DDCPacketsSent, Packets);
+    if (atomic_load_explicit(&DDCFirstPacketTime, memory_order_relaxed) == 0)
+        atomic_compare_exchange_strong(&DDCFirstPacketTime, &NotSent, TelemetryTimestamp());
+}
+
+
+//
+// SendDDCBatch(int Socketid, struct mmsghdr* Msgs, uint32_t Count)
+// send a batch of DDC packets for one DDC with sendmmsg().
+// sendmmsg() can return having sent fewer than requested, so loop until all are sent.
+// a connected socket reports an ICMP "port unreachable" from an earlier packet as
+// ECONNREFUSED on the next send, which sends nothing; that is retried once.
+// PacketsPerMsg is the packets each message holds, for the statistics.
+// return true if error
+//
+static bool SendDDCBatch(int Socketid, struct mmsghdr* Msgs, uint32_t Count, uint32_t PacketsPerMsg)
+{
+    int Sent;
+    bool Retried = false;
+
+    while (Count != 0)
+    {
+        Sent = sendmmsg(Socketid, Msgs, Count, 0);
+        if ((Sent == -1) && (errno == ECONNREFUSED) && !Retried)
+        {
+            Retried = true;
+            continue;
+        }
+        if (Sent == -1)
+            return true;
+        CountDDCSend(Sent * PacketsPerMsg);
+        Msgs += Sent;
+        Count -= Sent;
+    }
+    return false;
+}
+
+
+//
+// SendDDCGSOBatch(uint32_t DDC, uint32_t First, uint32_t Count)
+// send packets First to Count-1 of a DDC's batch as GSO super packets.
+// if the kernel refuses GSO for this socket (eg. the route's device can't checksum
+// it), the DDC goes back to sendmmsg() and the rest of the batch is sent that way.
+// return true if error
+//
+static bool SendDDCGSOBatch(uint32_t DDC, uint32_t First, uint32_t Count)
+{
+    int Socketid = (DDCSocketData + DDC)->Socketid;
+    uint32_t Start;
+    uint32_t Packets;
+    uint32_t Dest;
+
+    for (Start = First; Start < Count; Start += Packets)
+    {
+        Packets = Count - Start;
+        if (Packets > VMAXGSOPACKETS)
+            Packets = VMAXGSOPACKETS;
+        for (Dest = 0; Dest < DDCNumDests[DDC]; Dest++)
+        {
+            DDCGSOMsgs[DDC][Dest].msg_hdr.msg_iov = DDCBatchIovecs[DDC][Start];
+            DDCGSOMsgs[DDC][Dest].msg_hdr.msg_iovlen = 2 * Packets;
+        }
+        if (SendDDCBatch(Socketid, DDCGSOMsgs[DDC], DDCNumDests[DDC], Packets))
+        {
+            if ((errno != EIO) && (errno != EINVAL))
+                return true;
+            printf("DDC %d: UDP GSO send refused (errno=%d); using sendmmsg()\n", DDC, errno);
+            DDCUseGSO[DDC] = false;
+            return SendDDCBatch(Socketid, DDCBatchMsgs[DDC] + Start * DDCNumDests[DDC],
+                                (Count - Start) * DDCNumDests[DDC], 1);
+        }
+    }
+    return false;
+}
+
+
+//
+// SendDDCXDPBatch(uint32_t DDC, uint32_t Count)
+// send the first Count packets of a DDC's batch by XDP.
+// if that fails the DDC goes back to the socket path, and sends the rest of the batch that way.
+// return true if error
+//
+static bool SendDDCXDPBatch(uint32_t DDC, uint32_t Count)
+{
+    uint32_t Queued;
+
+    Queued = XDPSendPackets(&DDCXDPDest[DDC], DDCBatchIovecs[DDC][0], 2, Count);
+    if (Queued != 0)
+        CountDDCSend(Queued);
+    if (Queued == Count)
+        return false;
+    printf("DDC %d: XDP send failed after %d packets; using the socket\n", DDC, Queued);
+    DDCUseXDP[DDC] = false;
+    if (DDCUseGSO[DDC])
+        return SendDDCGSOBatch(DDC, Queued, Count);
+    return SendDDCBatch((DDCSocketData + DDC)->Socketid, DDCBatchMsgs[DDC] + Queued, Count - Queued, 1);
+}
+
+
+//
+// set up XDP send for a DDC, if enabled. The transmitter is opened the
+// first time it is needed; if it can't be, it isn't tried again.
+// return true if XDP is to be used
+//
+static bool SetupDDCXDP(uint32_t DDC)
+{
+    if (!P2Config.DDCXDP || DDCXDPUnavailable || (DDCNumDests[DDC] != 1))
+        return false;
+    if (!XDPTransmitterOpen() && OpenXDPTransmitter((DataInterface[0] != 0) ? DataInterface : "eth0"))
+    {
+        printf("AF_XDP not available; DDC packets sent by socket\n");
+        DDCXDPUnavailable = true;
+        return false;
+    }
+    if (XDPSetDestination(&DDCXDPDest[DDC], &DDCDestAddr[DDC][0], (DDCSocketData + DDC)->Portid))
+    {
+        if (UseDebug || (DDC == 0))
+            printf("DDC %d: client not in the interface's neighbour table; sent by socket\n", DDC);
+        return false;
+    }
+    return true;
+}
+
+
+//
+// set up paced send for a DDC socket, if enabled: each message of a packet
+// (one per destination) points to the packet's SCM_TXTIME.
+// return true if pacing is to be used
+//
+static bool SetupDDCPacing(uint32_t DDC)
+{
+    int Socketid = (DDCSocketData + DDC)->Socketid;
+    struct sock_txtime TxTime;
+    struct cmsghdr* Cmsg;
+    struct msghdr* Msg;
+    uint32_t Packet, Dest;
+    bool Pace = (P2Config.DDCPace != VDDCPACEOFF);
+
+    if (Pace)
+    {
+        DDCPaceClock = (P2Config.DDCPace == VDDCPACEETF) ? CLOCK_TAI : CLOCK_MONOTONIC;
+        TxTime.clockid = DDCPaceClock;
+        TxTime.flags = 0;
+        if (setsockopt(Socketid, SOL_SOCKET, SO_TXTIME, &TxTime, sizeof(TxTime)) < 0)
+        {
+            if (DDC == 0)
+                printf("SO_TXTIME not available (errno=%d); DDC packets not paced\n", errno);
+            Pace = false;
+        }
+    }
+    for (Packet = 0; Packet < VMAXDDCBATCH; Packet++)
+    {
+        Cmsg = &DDCTxTime[DDC][Packet].Align;
+        Cmsg->cmsg_level = SOL_SOCKET;
+        Cmsg->cmsg_type = SCM_TXTIME;
+        Cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        for (Dest = 0; Dest < DDCNumDests[DDC]; Dest++)
+        {
+            Msg = &DDCBatchMsgs[DDC][Packet * DDCNumDests[DDC] + Dest].msg_hdr;
+            Msg->msg_control = Pace ? DDCTxTime[DDC][Packet].Buffer : NULL;
+            Msg->msg_controllen = Pace ? sizeof(DDCTxTime[DDC][Packet].Buffer) : 0;
+        }
+    }
+    DDCNextTxTime[DDC] = 0;
+    return Pace;
+}
+
+
+//
+// set the departure times of the first Count packets of a DDC's batch
+// (Samples in each), following on from the last batch if it is still going out
+//
+static void StampDDCTxTimes(uint32_t DDC, uint32_t Count, uint32_t Samples)
+{
+    struct timespec Now;
+    uint64_t Time, Interval;
+    uint32_t RateKHz = atomic_load_explicit(&DDCRateKHz[DDC], memory_order_relaxed);
+    uint32_t Packet;
+
+    clock_gettime(DDCPaceClock, &Now);
+    Time = (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec + (uint64_t)P2Config.DDCPaceLead * 1000;
+    if ((DDCNextTxTime[DDC] > Time) && ((DDCNextTxTime[DDC] - Time) < VMAXDDCPACEAHEAD))
+        Time = DDCNextTxTime[DDC];
+    Interval = (RateKHz == 0) ? 0 : (uint64_t)Samples * 1000000ULL / RateKHz;
+    Interval -= Interval / VDDCPACEMARGIN;
+    for (Packet = 0; Packet < Count; Packet++)
+    {
+        memcpy(CMSG_DATA(&DDCTxTime[DDC][Packet].Align), &Time, sizeof(Time));
+        Time += Interval;
+    }
+    DDCNextTxTime[DDC] = Time;
+}
+
+
+//
+// true if the DDC packets are to be VITA-49: asked for by the client, or by setting
+//
+static inline bool IsVITA49Wanted(void)
+{
+    return GEnableVITA49 || P2Config.DDCVITA49;
+}
+
+
+//
+// set up GSO send for a DDC socket, if enabled. The socket option sets the segment
+// size for every send, but a single packet is never longer so is sent unchanged.
+// a jumbo or VITA-49 packet would be, so the segment size is cleared for those.
+// return true if GSO is to be used
+//
+static bool SetupDDCGSO(uint32_t DDC)
+{
+    int Socketid = (DDCSocketData + DDC)->Socketid;
+    bool UseGSO = P2Config.DDCGSO && (DDCJumbo[DDC] == 1) && !IsVITA49Wanted();
+    int SegmentSize = UseGSO ? VDDCPACKETSIZE : 0;
+    uint32_t Dest;
+
+    if (setsockopt(Socketid, SOL_UDP, UDP_SEGMENT, &SegmentSize, sizeof(SegmentSize)) < 0)
+    {
+        if (UseGSO && (DDC == 0))
+            printf("UDP GSO not available (errno=%d); DDC packets sent by sendmmsg()\n", errno);
+        return false;
+    }
+    if (!UseGSO)
+        return false;
+    memset(DDCGSOMsgs[DDC], 0, sizeof(DDCGSOMsgs[DDC]));
+    for (Dest = 0; Dest < DDCNumDests[DDC]; Dest++)
+        DDCGSOMsgs[DDC][Dest].msg_hdr = DDCBatchMsgs[DDC][Dest].msg_hdr;            // destination of packet 0
+    return true;
+}
+
+
+//
+// choose the jumbo factor for a DDC: as many standard packets' samples as ddc_jumbo
+// asks for and the path MTU to the client allows. The socket must be connected.
+// return 1 for standard packets
+//
+static uint32_t SetupDDCJumbo(uint32_t DDC)
+{
+    int MTU = 0;
+    socklen_t Length = sizeof(MTU);
+    uint32_t Jumbo = P2Config.DDCJumbo;
+
+    if (Jumbo < 2)
+        return 1;
+    if (!DDCConnected[DDC] || (DDCNumDests[DDC] != 1) ||
+        (getsockopt((DDCSocketData + DDC)->Socketid, IPPROTO_IP, IP_MTU, &MTU, &Length) < 0))
+    {
+        if (DDC == 0)
+            printf("DDC jumbo packets need a connected DDC socket and no subscribers; standard packets sent\n");
+        return 1;
+    }
+    while ((Jumbo > 1) && ((VDDCIPUDPHEADERS + VMAXDDCHEADERSIZE + Jumbo * VIQBYTESPERFRAME) > (uint32_t)MTU))
+        Jumbo--;
+    if ((DDC == 0) && (Jumbo != P2Config.DDCJumbo))
+        printf("DDC jumbo packets: path MTU %d bytes allows %d times standard\n", MTU, Jumbo);
+    else if ((DDC == 0) && UseDebug)
+        printf("DDC jumbo packets: %d samples, %d bytes\n", Jumbo * VIQSAMPLESPERFRAME,
+               VDDCHEADERSIZE + Jumbo * VIQBYTESPERFRAME);
+    return Jumbo;
+}
+
+
+//
+// true if the packet and socket setup made for the last run is still right:
+// same client address and port, no DDC socket made again for a port change,
+// and the same send settings
+//
+static bool DDCSetupCurrent(struct ThreadSocketData* ThreadData)
+{
+    uint32_t DDC;
+
+    if (!DDCSetupValid || (DDCSetupGSO != P2Config.DDCGSO) || (DDCSetupXDP != P2Config.DDCXDP)
+        || (DDCSetupPace != P2Config.DDCPace) || (DDCSetupJumbo != P2Config.DDCJumbo)
+        || (DDCSetupVITA != IsVITA49Wanted())
+        || (DDCSetupAddr.sin_addr.s_addr != reply_addr.sin_addr.s_addr)
+        || (DDCSetupAddr.sin_port != reply_addr.sin_port))
+        return false;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if (DDCSetupSockets[DDC] != (ThreadData + DDC)->SocketCount)
+            return false;
+    return true;
+}
+
+
+//
+// SetStageCore(int Core, char* StageName)
+// pin the calling thread to one CPU core, if Core is not -1
+//
+static void SetStageCore(int Core, char* StageName)
+{
+    cpu_set_t CPUSet;
+
+    if (Core < 0)
+        return;
+    CPU_ZERO(&CPUSet);
+    CPU_SET(Core, &CPUSet);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &CPUSet) != 0)
+        printf("DDC %s thread: could not set core %d\n", StageName, Core);
+    else if (UseDebug)
+        printf("DDC %s thread running on core %d\n", StageName, Core);
+}
+
+
+//
+// work out the DMA transfer size that holds DDCTargetLatency of data at the rates
+// in a DDC rate word: 48000 frames per second, each the rate word plus 1 word per sample.
+// rounded up to a multiple of VMINDDCDMASIZE
+//
+static uint32_t DDCByteRate(uint32_t RateWord)
+{
+    uint32_t DDCCounts[VNUMDDC];
+
+    return VDDCFRAMERATE * (AnalyseDDCHeader(RateWord, DDCCounts) + 1) * 8;
+}
+
+
+static uint32_t DDCTargetTransferSize(uint32_t RateWord)
+{
+    uint64_t Size;
+
+    Size = (uint64_t)DDCByteRate(RateWord) * DDCTargetLatency / 1000000;
+    Size = ((Size + VMINDDCDMASIZE - 1) / VMINDDCDMASIZE) * VMINDDCDMASIZE;
+    if (Size < VMINDDCDMASIZE)
+        Size = VMINDDCDMASIZE;
+    else if (Size > VMAXDDCDMASIZE)
+        Size = VMAXDDCDMASIZE;
+    return (uint32_t)Size;
+}
+
+
+//
+// set the latency target for DDC DMA transfers
+//
+void SetDDCTargetLatency(uint32_t Microseconds)
+{
+    DDCTargetLatency = Microseconds;
+}
+
+
+//
+// add a subscriber to the DDC subscription table
+//
+bool AddDDCSubscriber(char* Setting)
+{
+    char Address[INET_ADDRSTRLEN];
+    unsigned int Port;
+    unsigned int Mask = (1 << VNUMDDC) - 1;
+    struct DDCSubscriber* Sub;
+    int Fields;
+
+    if (DDCSubscriberCount >= VMAXDDCSUBSCRIBERS)
+    {
+        printf("too many DDC subscribers: max %d\n", VMAXDDCSUBSCRIBERS);
+        return true;
+    }
+    Sub = DDCSubscribers + DDCSubscriberCount;
+    memset(Sub, 0, sizeof(struct DDCSubscriber));
+    Fields = sscanf(Setting, "%15[0-9.]:%u:%i", Address, &Port, &Mask);
+    if ((Fields < 2) || (Port == 0) || (Port > 65535) || (inet_pton(AF_INET, Address, &Sub->Addr.sin_addr) != 1))
+    {
+        printf("error parsing DDC subscriber %s: must be address:port or address:port:mask\n", Setting);
+        return true;
+    }
+    Sub->Addr.sin_family = AF_INET;
+    Sub->Addr.sin_port = htons(Port);
+    Sub->DDCMask = Mask & ((1 << VNUMDDC) - 1);
+    DDCSubscriberCount++;
+    printf("DDC subscriber %s:%u, %s DDC mask 0x%03x\n", Address, Port,
+           IN_MULTICAST(ntohl(Sub->Addr.sin_addr.s_addr)) ? "multicast," : "", Sub->DDCMask);
+    return false;
+}
+
+
+//
+// set the max number of packets sent per sendmmsg() call
+//
+void SetDDCSendBatchSize(uint32_t Size)
+{
+    if (Size < 1)
+        Size = 1;
+    else if (Size > VMAXDDCBATCH)
+        Size = VMAXDDCBATCH;
+    DDCSendBatchSize = Size;
+}
+
+
+//
+// report send statistics
+//
+void GetDDCSendStatistics(uint32_t* Packets, uint32_t* Calls)
+{
+    *Packets = atomic_load(&DDCPacketsSent);
+    *Calls = atomic_load(&DDCSendCalls);
+}
+
+
+//
+// set number of sender threads
+//
+void SetDDCSenderThreads(uint32_t Count)
+{
+    DDCSenderPerDDC = (Count == 0);
+    if (Count < 1)
+        Count = VNUMDDC;
+    else if (Count > VNUMDDC)
+        Count = VNUMDDC;
+    DDCSenderCount = Count;
+}
+
+
+//
+// wake a per-DDC sender if it is waiting for data (demux thread)
+// the fence orders the ring write before the flag read, against the
+// sender's flag write before its ring read
+//
+static void WakeDDCSender(uint32_t DDC)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&DDCSenderWaiting[DDC], memory_order_relaxed) &&
+        atomic_exchange(&DDCSenderWaiting[DDC], false))
+        eventfd_write(DDCWakeFd[DDC], 1);
+}
+
+
+//
+// per-DDC sender: sleep until the DDC's ring has more than RingBytes, or the pipeline stops
+//
+static void WaitDDCData(uint32_t DDC, uint32_t RingBytes)
+{
+    struct pollfd PollFd;
+    eventfd_t Count;
+
+    atomic_store(&DDCSenderWaiting[DDC], true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (DDCPipelineRun && (RingBytesUsed(&IQRing[DDC]) <= RingBytes))
+    {
+        PollFd.fd = DDCWakeFd[DDC];
+        PollFd.events = POLLIN;
+        PollFd.revents = 0;
+        poll(&PollFd, 1, VDDCSENDERWAIT);
+    }
+    atomic_store(&DDCSenderWaiting[DDC], false);
+    eventfd_read(DDCWakeFd[DDC], &Count);                   // non blocking: clear any wakeup
+}
+
+
+//
+// select the driver streaming ring for DDC DMA
+//
+void SetDDCStreamRing(bool Enabled)
+{
+    DDCUseStreamRing = Enabled;
+}
+
+
+//
+// StartDDCStreamRing(int fd)
+// start the driver's streaming ring and map it as DMARing in place of the local ring
+// return true if not possible: then DMARing is unchanged
+//
+static bool StartDDCStreamRing(int fd)
+{
+    struct SPSCRingBuffer StreamRing;
+
+    if (DMAStreamStart(fd, VDDCSTREAMRINGSIZE, VDDCSTREAMBLOCKSIZE, VADDRDDCSTREAMREAD))
+        return true;
+    if (MapDeviceRingBuffer(&StreamRing, fd, VDDCSTREAMRINGSIZE))
+    {
+        DMAStreamStop(fd);
+        return true;
+    }
+    FreeRingBuffer(&DMARing);
+    memcpy(&DMARing, &StreamRing, sizeof(struct SPSCRingBuffer));
+    return false;
+}
+
+
+//
+// set cores for the pipeline stages
+//
+void SetDDCPipelineCores(int ReaderCore, int DemuxCore, int SenderCore)
+{
+    DDCStageCores[0] = ReaderCore;
+    DDCStageCores[1] = DemuxCore;
+    DDCStageCores[2] = SenderCore;
+}
+
+
+//
+// CommitDDCDMA(uint32_t Bytes)
+// make DMA data at the DMA ring write pointer visible to the demux,
+// recording it first if a capture is open, and in any snapshot ring
+//
+static void CommitDDCDMA(uint32_t Bytes)
+{
+    if (IsDDCCaptureOpen())
+        CaptureDDCData(RingWritePtr(&DMARing), Bytes, GetP2DDCRateWord(), DDCFIFODepthNow);
+    SnapshotDDCData(RingWritePtr(&DMARing), Bytes, GetP2DDCRateWord(), DDCFIFODepthNow);
+    RingCommitWrite(&DMARing, Bytes);
+}
+
+
+//
+// CollectDDCDMA(void)
+// wait for an async DMA to complete, then commit any completed transfers to the DMA ring,
+// oldest first so the data stays in FIFO order.
+// return 0, or a negative errno if the transfer failed (-ENODATA if it was short)
+//
+static int CollectDDCDMA(void)
+{
+    uint32_t Slot;
+    int Result;
+    int Error = 0;
+
+    Result = DMAAsyncWaitComplete(&DDCDMAContext, &Slot);
+    if (Result < 0)
+        return Result;
+    if (Slot >= VDDCDMAINFLIGHT)
+        return -EIO;
+    if ((uint32_t)Result != DDCDMASize[Slot])
+    {
+        printf("DDC async DMA: %d bytes transferred, %d requested\n", Result, DDCDMASize[Slot]);
+        Error = -ENODATA;
+    }
+    DDCDMADone[Slot] = true;
+    TelemetryLoopTime(eTelDDCDMA, DDCDMAStart[Slot]);
+    while ((DDCDMAInFlight != 0) && DDCDMADone[DDCDMAOldest])
+    {
+        DDCDMADone[DDCDMAOldest] = false;
+        CommitDDCDMA(DDCDMASize[DDCDMAOldest]);
+        DDCDMAPendingBytes -= DDCDMASize[DDCDMAOldest];
+        DDCDMAOldest = (DDCDMAOldest + 1) % VDDCDMAINFLIGHT;
+        DDCDMAInFlight--;
+    }
+    return Error;
+}
+
+
+//
+// overload protection
+// when the DDC engine can't keep up for VOVERLOADHOLD: the FIFO over threshold or 3/4 full,
+// the DMA ring 3/4 full because the demux is behind, or DDC sends failing for lack of
+// socket buffer, the DDCs set in ddc_low_priority are shed. The demux drops their
+// samples whole frames at a time, counted, and their timestamps skip the gap, so the
+// other DDCs keep their continuity. Shedding stops after VOVERLOADRECOVER with no sign
+// of overload. The state is kept by the DMA reader, which sees the FIFO.
+//
+#define VOVERLOADHOLD 200000                                // us of sustained overload before shedding
+#define VOVERLOADRECOVER 2000000                            // us without overload before shedding stops
+
+static atomic_bool DDCShedding;                               // true while the low priority DDCs are shed
+static uint64_t OverloadStart;                              // DMA reader: time this overload began, or 0
+static uint64_t LastOverload;                               // DMA reader: time overload was last seen
+static uint32_t OverloadSendAgains;                         // DMA reader: DDC send EAGAINs at the last check
+
+
+bool IsDDCShedding(void)
+{
+    return atomic_load(&DDCShedding);
+}
+
+
+static void ResetDDCOverload(void)
+{
+    atomic_store(&DDCShedding, false);
+    OverloadStart = 0;
+    LastOverload = 0;
+    OverloadSendAgains = 0;
+    for (uint32_t DDC = 0; DDC < VNUMDDC; DDC++)
+        OverloadSendAgains += atomic_load_explicit(&Telemetry[DDC].SendAgains, memory_order_relaxed);
+}
+
+
+//
+// called by the DMA reader each time it reads the FIFO depth
+//
+static void CheckDDCOverload(unsigned int Current, bool OverThreshold)
+{
+    uint64_t Now = TelemetryTimestamp();
+    uint32_t SendAgains = 0;
+    uint32_t DDC;
+    bool Overloaded;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        SendAgains += atomic_load_explicit(&Telemetry[DDC].SendAgains, memory_order_relaxed);
+    Overloaded = OverThreshold || (SendAgains != OverloadSendAgains)
+                 || (Current >= (DMAFIFODepths[eRXDDCDMA] / 4) * 3)
+                 || (RingBytesUsed(&DMARing) >= (DMARing.Size / 4) * 3);
+    OverloadSendAgains = SendAgains;
+    if (Overloaded)
+    {
+        if (OverloadStart == 0)
+            OverloadStart = Now;
+        LastOverload = Now;
+    }
+    else if ((Now - LastOverload) >= VOVERLOADHOLD)
+        OverloadStart = 0;                                  // that one wasn't sustained
+
+    if (!atomic_load(&DDCShedding))
+    {
+        if ((OverloadStart != 0) && ((Now - OverloadStart) >= VOVERLOADHOLD) && (P2Config.DDCLowPriority != 0))
+        {
+            atomic_store(&DDCShedding, true);
+            Trace(eTraceShed, 1, P2Config.DDCLowPriority);
+            printf("DDC overload: shedding low priority DDCs (mask 0x%03x)\n", P2Config.DDCLowPriority);
+        }
+    }
+    else if (((Now - LastOverload) >= VOVERLOADRECOVER) || (P2Config.DDCLowPriority == 0))
+    {
+        atomic_store(&DDCShedding, false);
+        OverloadStart = 0;
+        Trace(eTraceShed, 0, P2Config.DDCLowPriority);
+        printf("DDC overload over: low priority DDCs sent again\n");
+    }
+}
+
+
+//
+// DMA reader: the DDC's own part of acting on a FIFO monitor reading, after the
+// engine has reported it. An overflow also triggers a snapshot.
+// CountStartup for a reading made each pass: it counts down the startup count,
+// and once that has run down the overload detector sees the reading.
+//
+static void NoteDDCFIFOStatus(struct StreamEngine* Engine, bool CountStartup)
+{
+    DDCFIFODepthNow = Engine->Current;
+    if(StreamFIFOError(Engine))
+        TriggerDDCSnapshot(eSnapshotFIFOOverflow);
+    if(!CountStartup)
+        return;
+    if(Engine->StartupCount != 0)                           // decrement startup message count
+        CountStreamStartup(Engine, 1);
+    else
+        CheckDDCOverload(Engine->Current, Engine->FIFOOverThreshold);
+}
+
+
+//
+// DMA reader: with no DMA in flight, the DMA ring head plus the FIFO depth is the
+// DDC stream position at the time the depth was read, to latch a PPS pulse with
+//
+static void NoteDDCStreamPosition(unsigned int Current, uint64_t Time)
+{
+    if (IsPPSEnabled() && (DDCDMAInFlight == 0) && !DDCStreamActive)
+        NotePPSStreamPosition(atomic_load_explicit(&DMARing.Head, memory_order_relaxed) + Current * 8U, Time,
+                              DDCByteRate(GetP2DDCRateWord()));
+}
+
+
+//
+// record samples dropped by the demux for a DDC, at the current ring head.
+// if the queue is full the samples are held and queued with the next gap.
+//
+static void RecordDDCGap(uint32_t DDC, uint32_t Samples)
+{
+    struct DDCGapQueue* Queue = DDCGaps + DDC;
+    struct DDCSampleGap* Gap;
+    uint32_t Head;
+
+    DDCShmGap(DDC, &IQRing[DDC], Samples);
+    Queue->Unqueued += Samples;
+    Head = atomic_load_explicit(&Queue->Head, memory_order_relaxed);
+    if ((Head - atomic_load_explicit(&Queue->Tail, memory_order_acquire)) >= VDDCGAPQUEUESIZE)
+        return;
+    Gap = Queue->Gaps + (Head % VDDCGAPQUEUESIZE);
+    Gap->Position = atomic_load_explicit(&IQRing[DDC].Head, memory_order_relaxed);
+    Gap->Samples = Queue->Unqueued;
+    Queue->Unqueued = 0;
+    atomic_store_explicit(&Queue->Head, Head + 1, memory_order_release);
+}
+
+
+//
+// add the samples of any gaps at or before ring position Position to a DDC's sample count
+//
+static uint64_t ApplyDDCGaps(uint32_t DDC, uint32_t Position, uint64_t SampleCount)
+{
+    struct DDCGapQueue* Queue = DDCGaps + DDC;
+    struct DDCSampleGap* Gap;
+    uint32_t Tail;
+
+    Tail = atomic_load_explicit(&Queue->Tail, memory_order_relaxed);
+    while (Tail != atomic_load_explicit(&Queue->Head, memory_order_acquire))
+    {
+        Gap = Queue->Gaps + (Tail % VDDCGAPQUEUESIZE);
+        if ((int32_t)(Gap->Position - Position) > 0)
+            break;                                          // gap is in a later packet
+        SampleCount += Gap->Samples;
+        Tail++;
+        atomic_store_explicit(&Queue->Tail, Tail, memory_order_release);
+    }
+    return SampleCount;
+}
+
+
+//
+// queue a PPS anchor for a DDC: its pulse is at ring position Position.
+// if the queue is full the anchor is dropped; the next pulse sets the epoch instead.
+//
+static void RecordDDCAnchor(uint32_t DDC, uint32_t Position, uint32_t Second)
+{
+    struct DDCAnchorQueue* Queue = DDCAnchors + DDC;
+    struct DDCPPSAnchor* Anchor;
+    uint32_t Head;
+
+    Head = atomic_load_explicit(&Queue->Head, memory_order_relaxed);
+    if ((Head - atomic_load_explicit(&Queue->Tail, memory_order_acquire)) >= VDDCANCHORQUEUESIZE)
+        return;
+    Anchor = Queue->Anchors + (Head % VDDCANCHORQUEUESIZE);
+    Anchor->Position = Position;
+    Anchor->Second = Second;
+    atomic_store_explicit(&Queue->Head, Head + 1, memory_order_release);
+}
+
+
+//
+// set a DDC's epoch from any anchors at or before ring position Position, where the
+// sample number is SampleCount. Returns true if the epoch was set.
+//
+static bool ApplyDDCAnchors(uint32_t DDC, uint32_t Position, uint64_t SampleCount, struct PPSEpoch* Epoch)
+{
+    struct DDCAnchorQueue* Queue = DDCAnchors + DDC;
+    struct DDCPPSAnchor* Anchor;
+    uint32_t Tail;
+    bool Set = false;
+
+    Tail = atomic_load_explicit(&Queue->Tail, memory_order_relaxed);
+    while (Tail != atomic_load_explicit(&Queue->Head, memory_order_acquire))
+    {
+        Anchor = Queue->Anchors + (Tail % VDDCANCHORQUEUESIZE);
+        if ((int32_t)(Anchor->Position - Position) > 0)
+            break;                                          // pulse is in a later packet
+        Epoch->Sample = SampleCount - (Position - Anchor->Position) / 6;
+        Epoch->Second = Anchor->Second;
+        Epoch->Valid = true;
+        Set = true;
+        Tail++;
+        atomic_store_explicit(&Queue->Tail, Tail, memory_order_release);
+    }
+    return Set;
+}
+
+
+//
+// demux: a DDC's rate is changing to RateKHz (0 if it has stopped): queue the
+// current ring head as the boundary, before any samples at the new rate are written.
+// if the queue is full the boundary is dropped, and a packet may mix the two rates.
+//
+static void RecordDDCBoundary(uint32_t DDC, uint32_t RateKHz)
+{
+    struct DDCBoundaryQueue* Queue = DDCBoundaries + DDC;
+    struct DDCRateBoundary* Boundary;
+    uint32_t Head;
+
+    Head = atomic_load_explicit(&Queue->Head, memory_order_relaxed);
+    if ((Head - atomic_load_explicit(&Queue->Tail, memory_order_acquire)) >= VDDCBOUNDARYQUEUESIZE)
+        return;
+    Boundary = Queue->Boundaries + (Head % VDDCBOUNDARYQUEUESIZE);
+    Boundary->Position = atomic_load_explicit(&IQRing[DDC].Head, memory_order_relaxed);
+    Boundary->RateKHz = RateKHz;
+    atomic_store_explicit(&Queue->Head, Head + 1, memory_order_release);
+    Trace(eTraceDDCRate, DDC, RateKHz);
+    if (DDCSenderPerDDC)
+        WakeDDCSender(DDC);                                 // to flush the old rate's samples
+}
+
+
+//
+// sender: ring bytes for the packet at Offset bytes beyond the ring tail.
+// boundaries reached at that position are taken, setting *RateKHz;
+// returns RingBytes for a whole packet, fewer for the old rate's last samples
+// before a boundary, or 0 if there isn't a packet's worth yet.
+//
+static uint32_t NextDDCPacketBytes(uint32_t DDC, uint32_t Offset, uint32_t RingBytes, uint32_t* RateKHz)
+{
+    struct DDCBoundaryQueue* Queue = DDCBoundaries + DDC;
+    struct DDCRateBoundary* Boundary;
+    uint32_t Position, Available, Residue;
+    uint32_t Tail;
+
+    Position = atomic_load_explicit(&IQRing[DDC].Tail, memory_order_relaxed) + Offset;
+    Available = RingBytesUsed(&IQRing[DDC]) - Offset;
+    Tail = atomic_load_explicit(&Queue->Tail, memory_order_relaxed);
+    while (Tail != atomic_load_explicit(&Queue->Head, memory_order_acquire))
+    {
+        Boundary = Queue->Boundaries + (Tail % VDDCBOUNDARYQUEUESIZE);
+        Residue = Boundary->Position - Position;
+        if ((int32_t)Residue > 0)
+        {
+            if ((Residue <= RingBytes) && (Residue <= Available))
+                return Residue;
+            break;                                          // boundary is in a later packet
+        }
+        *RateKHz = Boundary->RateKHz;
+        Tail++;
+        atomic_store_explicit(&Queue->Tail, Tail, memory_order_release);
+    }
+    return (Available > RingBytes) ? RingBytes : 0;
+}
+
+
+//
+// demux: make or grow a DDC's I/Q ring to Size, at a rate boundary just queued.
+// the sender first drains the old ring up to the boundary; the new ring then
+// carries on at the same byte count, so queued gap and anchor positions still hold,
+// and the sender sees an empty ring throughout. The old ring's memory stays in the arena.
+// returns true if it could not be done, so the pipeline must restart to make it.
+//
+static bool GrowIQRing(uint32_t DDC, uint32_t Size)
+{
+    struct SPSCRingBuffer Ring;
+    struct SPSCRingBuffer OldRing;
+    uint32_t Waited = 0;
+
+    while (RingBytesUsed(&IQRing[DDC]) != 0)
+    {
+        if (!DDCPipelineRun || (Waited >= VDDCRINGGROWWAIT))
+            return true;
+        if (DDCSenderPerDDC)
+            WakeDDCSender(DDC);
+        usleep(P2Config.StageIdleWait);
+        Waited += P2Config.StageIdleWait;
+    }
+    if (ArenaRingBuffer(&StreamArena, &Ring, Size))
+        return true;
+    OldRing = IQRing[DDC];
+    IQRing[DDC].Base = Ring.Base;
+    IQRing[DDC].Size = Ring.Size;
+    IQRing[DDC].Mask = Ring.Mask;
+    IQRing[DDC].FileOffset = Ring.FileOffset;
+    atomic_thread_fence(memory_order_release);              // before any samples are committed to it
+    atomic_store(&IQRingBytes[DDC], Ring.Size);
+    if (OldRing.Base != NULL)
+        FreeRingBuffer(&OldRing);
+    if (UseDebug)
+        printf("DDC%d: I/Q ring grown to %u bytes\n", DDC, Ring.Size);
+    return false;
+}
+
+
+//
+// find where sample frames start again after the framing has been lost.
+// a candidate rate word is accepted if the frame it describes is followed by
+// another word with the marker, or if there isn't enough data yet to check.
+// returns the byte offset of the next frame, or Bytes rounded down to a whole
+// word if none was found (so those words can be discarded).
+//
+static uint32_t FindNextDDCFrame(uint8_t* Ptr, uint32_t Bytes)
+{
+    uint32_t DDCCounts[VNUMDDC];
+    uint32_t Offset = 0;
+    uint32_t FrameBytes;
+
+    Bytes &= ~7U;
+    while (Offset < Bytes)
+    {
+        Offset += FindDDCRateWord(Ptr + Offset, Bytes - Offset);
+        if (Offset >= Bytes)
+            break;
+        FrameBytes = (AnalyseDDCHeader(*(uint32_t*)(Ptr + Offset), DDCCounts) + 1) * 8;
+        if (((Offset + FrameBytes + 8) > Bytes) || (*(Ptr + Offset + FrameBytes + 7) == 0x80))
+            return Offset;
+        Offset += 8;                                                // a sample that looks like a marker
+    }
+    return Bytes;
+}
+
+
+//
+// DDC demux thread
+// takes complete frames from the DMA ring and copies each DDC's samples to its I/Q ring
+// according to the embedded DDC rate words.
+// the 1st word is pointed by the ring read pointer and it should point to a DDC rate word
+// search for it if not!
+// (it should always be left in that state).
+// the top half of the 1st 64 bit word should be 0x8000
+// and that is located in the 2nd 32 bit location.
+// if the marker is missing (eg. a corrupted DMA) the data up to the next
+// valid rate word is discarded, and streaming carries on from there.
+//
+//
+// decimation for a DDC: the FPGA runs 12 and 24KHz DDCs at 48KHz,
+// and they are decimated here before the I/Q ring.
+//
+static inline uint32_t GetDDCDecimation(uint32_t DDC, uint32_t WordCount)
+{
+    uint32_t Rate;
+
+    if (WordCount != 1)
+        return 1;
+    Rate = GetP2SampleRate(DDC);
+    return ((Rate == 12) || (Rate == 24)) ? 48 / Rate : 1;
+}
+
+
+//
+// diversity combining (diversity_mode): the secondary DDC's samples are demultiplexed
+// and decimated alongside the primary's, then combined into them after the primary's
+// decimator. Only the primary's stream is sent, so the client gets one stream at half
+// the bandwidth. The two DDCs must have the same rate.
+//
+#define VDIVERSITYSAMPLES 4096                                  // secondary samples per batch
+
+static uint8_t DiversitySamples[VDIVERSITYSAMPLES * 6];         // secondary samples for a batch
+static struct DiversityCombiner Combiner;
+static _Atomic uint32_t DiversityPair;                          // VDIVERSITYACTIVE | primary << 8 | secondary, or 0
+static _Atomic float DiversityGain;
+static _Atomic float DiversityPhase;                            // degrees
+static _Atomic uint64_t DiversityCombined;                      // samples combined
+
+#define VDIVERSITYACTIVE 0x10000
+
+
+void GetDiversityStatus(struct DiversityStatus* Status)
+{
+    uint32_t Pair = atomic_load_explicit(&DiversityPair, memory_order_relaxed);
+
+    Status->Active = (Pair & VDIVERSITYACTIVE) != 0;
+    Status->Primary = (Pair >> 8) & 0xFF;
+    Status->Secondary = Pair & 0xFF;
+    Status->Gain = atomic_load_explicit(&DiversityGain, memory_order_relaxed);
+    Status->Phase = atomic_load_explicit(&DiversityPhase, memory_order_relaxed);
+    Status->Samples = atomic_load_explicit(&DiversityCombined, memory_order_relaxed);
+}
+
+
+void GetDDCSequenceState(uint32_t* Sequence, uint64_t* SampleCount)
+{
+    memcpy(Sequence, DDCSequence, sizeof(DDCSequence));
+    memcpy(SampleCount, DDCSampleCount, sizeof(DDCSampleCount));
+}
+
+
+void ResumeDDCSequence(const uint32_t* Sequence, const uint64_t* SampleCount)
+{
+    memcpy(DDCSequence, Sequence, sizeof(DDCSequence));
+    memcpy(DDCSampleCount, SampleCount, sizeof(DDCSampleCount));
+    DDCSequenceResumed = true;
+}
+
+
+//
+// find the secondary DDC's plan entry, if this plan is to be combined; NULL if not.
+// The combiner starts again whenever combining starts or the pair changes.
+//
+static struct DDCFramePlanEntry* GetDiversitySecondary(struct DDCFramePlan* Plan, uint32_t* Primary)
+{
+    struct DDCFramePlanEntry* PrimaryEntry = NULL;
+    struct DDCFramePlanEntry* SecondaryEntry = NULL;
+    uint32_t Mode = P2Config.DiversityMode;
+    uint32_t First = P2Config.DiversityDDC;
+    uint32_t Second = P2Config.DiversitySecond;
+    uint32_t Pair = 0;
+    uint32_t Cntr;
+
+    if ((Mode != 0) && (First != Second))
+    {
+        for (Cntr = 0; Cntr < Plan->NumEntries; Cntr++)
+            if (Plan->Entries[Cntr].DDC == First)
+                PrimaryEntry = Plan->Entries + Cntr;
+            else if (Plan->Entries[Cntr].DDC == Second)
+                SecondaryEntry = Plan->Entries + Cntr;
+        if ((PrimaryEntry != NULL) && (SecondaryEntry != NULL)
+            && (PrimaryEntry->WordCount == SecondaryEntry->WordCount)
+            && (GetDDCDecimation(First, PrimaryEntry->WordCount) == GetDDCDecimation(Second, SecondaryEntry->WordCount)))
+            Pair = VDIVERSITYACTIVE | (First << 8) | Second;
+    }
+    if (Pair != atomic_load_explicit(&DiversityPair, memory_order_relaxed))
+    {
+        ResetDiversityCombiner(&Combiner, P2Config.DiversityGain / 1000.0f,
+                               P2Config.DiversityPhase * (float)M_PI / 1800.0f);
+        atomic_store(&DiversityPair, Pair);
+        if (Pair != 0)
+        {
+            Trace(eTraceDiversity, First, Second);
+            if (UseDebug)
+                printf("diversity: DDC%d combined into DDC%d (%s, %s)\n", Second, First,
+                       (Mode == 2) ? "adaptive" : "fixed", GetDiversityKernelName());
+        }
+        else if (UseDebug)
+            printf("diversity: off\n");
+    }
+    if (Pair == 0)
+        return NULL;
+    *Primary = First;
+    return SecondaryEntry;
+}
+
+
+//
+// demultiplex and decimate the secondary's samples for Frames frames, and combine
+// up to Count of them into the primary's decimated samples
+//
+static void CombineDiversity(struct DDCFramePlanEntry* Secondary, struct DDCDecimator* Decimator,
+                             uint8_t* DMAReadPtr, uint32_t FrameBytes, uint32_t Frames, uint32_t Factor,
+                             uint8_t* Primary, uint32_t Count, uint32_t RateKHz)
+{
+    uint32_t Outputs;
+    float Gain, Phase;
+
+    if (Factor != Decimator->Factor)
+        ResetDecimator(Decimator, Factor);
+    Secondary->Demux(DiversitySamples, DMAReadPtr + Secondary->SrcOffset, FrameBytes, Frames, Secondary->WordCount);
+    Outputs = RunDecimator(Decimator, DiversitySamples, DiversitySamples, Frames * Secondary->WordCount);
+    if (Outputs < Count)
+        Count = Outputs;
+    if (P2Config.DiversityMode == 2)
+        RunDiversityCombiner(&Combiner, Primary, DiversitySamples, Count, P2Config.DiversityTimeConstant * RateKHz);
+    else
+    {
+        SetDiversityWeight(&Combiner, P2Config.DiversityGain / 1000.0f, P2Config.DiversityPhase * (float)M_PI / 1800.0f);
+        RunDiversityCombiner(&Combiner, Primary, DiversitySamples, Count, 0);
+    }
+    GetDiversityWeight(&Combiner, &Gain, &Phase);
+    atomic_store_explicit(&DiversityGain, Gain, memory_order_relaxed);
+    atomic_store_explicit(&DiversityPhase, Phase * 180.0f / (float)M_PI, memory_order_relaxed);
+    atomic_fetch_add_explicit(&DiversityCombined, Count, memory_order_relaxed);
+}
+
+
+//
+// interleaved pairs in a rate word to be split to their 2 DDCs' streams as they are demuxed:
+// those whose 1st DDC's thread doesn't have VBITINTERLEAVE (the P2 combined format) set.
+// returns a mask of the pairs' 1st DDCs
+//
+static uint32_t GetDDCSplitMask(uint32_t RateWord)
+{
+    uint32_t SplitMask = 0;
+    uint32_t DDC;
+
+    if (DDCSocketData == NULL)
+        return 0;
+    for (DDC = 0; DDC < (VNUMDDC - 1); DDC++)
+        if ((((RateWord >> (3 * DDC)) & 7) == eInterleaveWithNext)
+            && !(atomic_load_explicit(&(DDCSocketData + DDC)->Cmdid, memory_order_relaxed) & VBITINTERLEAVE))
+        {
+            SplitMask |= 1U << DDC;
+            DDC++;                                                  // the 2nd of the pair
+        }
+    return SplitMask;
+}
+
+
+static void *DDCDemuxThread(__attribute__((unused)) void *arg)
+{
+    uint32_t DDCCounts[VNUMDDC];                                // number of samples per DDC in a frame
+    struct DDCFramePlan Plan;                                   // copy plan for the current rate word
+    struct DDCFramePlanEntry* Entry;
+    uint32_t RateWord;                                          // DDC rate word from buffer
+    uint32_t FrameCount;                                        // complete frames with the same rate word
+    uint32_t Frames;                                            // frames copied for one DDC
+    uint32_t Cntr;                                              // sample word counter
+    bool HeaderFound = false;
+    bool WarmStart = DDCWarmStart;                              // true if the ring should begin with a rate word
+    bool Resyncing = false;                                     // true while searching for lost framing
+    uint32_t Skip;                                              // bytes discarded to get back in sync
+    uint32_t DecodeByteCount;                                   // bytes to decode
+    unsigned char* SrcBytePtr;                                  // read pointer into DMA data for each DDC
+    unsigned char* DestBytePtr;                                 // write pointer into a DDC's I/Q ring
+    unsigned char* DMAReadPtr;                                  // pointer for 1st available location in DMA ring
+    unsigned char* DMAStartPtr;                                 // read pointer before decode
+    uint32_t DDC;
+    uint32_t ShedMask;                                          // DDCs being shed under overload
+    struct StageProfiler Profiler;                              // demux CPU cost
+    static struct DDCDecimator Decimators[VNUMDDC];             // software decimation below 48KHz
+    uint32_t Factor;                                            // decimation for the current DDC
+    uint32_t Outputs;                                           // samples after decimation
+    uint32_t Kept;                                              // samples after the plugins
+    uint32_t RateKHz;                                           // DDC rate after decimation
+    uint32_t OutRateKHz[VNUMDDC];                               // rate each DDC's ring has, 0 if stopped
+    uint32_t PlanMask;                                          // DDCs in the new plan
+    uint32_t SplitMask;                                         // interleaved pairs split to 2 streams
+    uint32_t PlanSplitMask = 0;                                 // the pairs split in the plan
+    struct DDCFramePlanEntry* Secondary;                        // diversity secondary DDC, or NULL
+    uint32_t Primary = 0;                                       // diversity primary DDC
+    struct PSCapturePair PSPair;                                // PureSignal pair, if it is captured
+    bool PSCapturing;
+    bool PPSPending = false;                                    // true if a latched pulse is not yet decoded
+    bool PPSHere;                                               // true if it is in the current frames
+    uint32_t PPSPosition = 0;                                   // DMA stream byte position of the pulse
+    uint32_t PPSSecond = 0;                                     // and its UTC second
+    uint32_t PPSFrame = 0;                                      // frame of the current frames it is in
+    uint32_t Offset;
+
+    SetStageCore(DDCStageCores[1], "demux");
+    HeartbeatStart(eBeatDDCDemux);
+    StageProfilerInit(&Profiler);
+    StageProfilerStart(&Profiler);
+    memset(&Plan, 0, sizeof(Plan));
+    Plan.RateWord = 0xFFFFFFFF;                                 // illegal value to force a plan to be built
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        ResetDecimator(&Decimators[DDC], 1);
+    memset(OutRateKHz, 0, sizeof(OutRateKHz));
+    ResetDDCPlugins();
+    ResetPSCapture();
+    while (DDCPipelineRun)
+    {
+        Heartbeat(eBeatDDCDemux, eBeatRunning);
+        DecodeByteCount = RingBytesUsed(&DMARing);
+        if ((DecodeByteCount < (WarmStart ? 16U : DDCInitialDMASize())) && !HeaderFound)   // need 1st DMA to search for header
+        {
+            usleep(P2Config.StageIdleWait);
+            continue;
+        }
+        DMAReadPtr = RingReadPtr(&DMARing);
+        DMAStartPtr = DMAReadPtr;
+        StageMark(&Profiler);
+        //
+        // on a warm restart the stream should begin with a rate word, so the first
+        // data can be used without waiting for a whole DMA to search. If it doesn't,
+        // wait for that and search as on a cold start.
+        //
+        if (WarmStart && !HeaderFound)
+        {
+            WarmStart = false;
+            if (*(DMAReadPtr + 7) == 0x80)
+                HeaderFound = true;
+            else
+            {
+                if (UseDebug)
+                    printf("DDC warm restart: stream not on a frame; searching\n");
+                continue;
+            }
+        }
+        //
+        // find header: may not be the 1st word
+        //
+        if(HeaderFound == false)                                                    // 1st time: look for header
+        {
+            Cntr = 16 + FindNextDDCFrame(DMAReadPtr + 16, DecodeByteCount - 16);    // search for rate word; ignoring 1st
+            if (Cntr < (DecodeByteCount & ~7U))
+            {
+//                printf("found header at offset=%x\n", Cntr);
+                HeaderFound = true;
+            }
+            else
+                printf("DDC rate word not found in 1st DMA; discarding it\n");
+            DMAReadPtr += Cntr;                                                     // point read buffer where header is
+            DecodeByteCount -= Cntr;
+        }
+
+        while (DecodeByteCount >= 16)                       // minimum size to try!
+        {
+            if(*(DMAReadPtr + 7) != 0x80)
+            {
+                //
+                // lost framing: skip to the next valid rate word. If none yet, discard
+                // what we have and keep looking when more data arrives.
+                //
+                if (!Resyncing)
+                {
+                    printf("DDC rate word not found at addr %p: resynchronising\n", DMAReadPtr);
+                    TelemetryCountResync(eTelDDCDMA);
+                    TriggerDDCSnapshot(eSnapshotResync);
+                    Resyncing = true;
+                }
+                Skip = 8 + FindNextDDCFrame(DMAReadPtr + 8, DecodeByteCount - 8);
+                atomic_fetch_add(&DDCSamplesDiscarded, Skip / 8);
+                for (Cntr = 0; Cntr < Plan.NumEntries; Cntr++)                      // estimate samples lost per DDC
+                    RecordDDCGap(Plan.Entries[Cntr].DDC,
+                                 (Skip / Plan.FrameBytes + 1) * Plan.Entries[Cntr].WordCount
+                                  / Decimators[Plan.Entries[Cntr].DDC].Factor);
+                DMAReadPtr += Skip;
+                DecodeByteCount -= Skip;
+                continue;
+            }
+            if (Resyncing && UseDebug)
+                printf("DDC stream back in sync\n");
+            Resyncing = false;
+            //
+            // build a new copy plan only when the rate word changes
+            //
+            RateWord = *(uint32_t*)DMAReadPtr;                                      // read rate word
+            SplitMask = GetDDCSplitMask(RateWord);
+            if ((RateWord != Plan.RateWord) || (SplitMask != PlanSplitMask))
+            {
+                AnalyseDDCHeader(RateWord, &DDCCounts[0]);                          // read new settings
+                BuildDDCFramePlanSplit(&Plan, RateWord, DDCCounts, SplitMask);
+                if ((SplitMask != PlanSplitMask) && UseDebug)
+                    printf("DDC interleaved pairs split to separate streams: mask 0x%03x\n", SplitMask);
+                PlanSplitMask = SplitMask;
+                PlanMask = 0;
+                for (Cntr = 0; Cntr < Plan.NumEntries; Cntr++)
+                    PlanMask |= 1U << Plan.Entries[Cntr].DDC;
+                for (DDC = 0; DDC < VNUMDDC; DDC++)                                 // DDCs that have stopped
+                    if ((OutRateKHz[DDC] != 0) && !(PlanMask & (1U << DDC)))
+                    {
+                        RecordDDCBoundary(DDC, 0);
+                        OutRateKHz[DDC] = 0;
+                    }
+            }
+            //
+            // count the complete frames that follow with the same rate word
+            //
+            FrameCount = 0;
+            SrcBytePtr = DMAReadPtr;
+            while ((DecodeByteCount >= (FrameCount + 1) * Plan.FrameBytes) &&
+                   (*(SrcBytePtr + 7) == 0x80) && (*(uint32_t*)SrcBytePtr == RateWord))
+            {
+                FrameCount++;
+                SrcBytePtr += Plan.FrameBytes;
+            }
+            if (FrameCount == 0)
+                break;                                                              // if not enough left, exit loop
+            Secondary = GetDiversitySecondary(&Plan, &Primary);
+            PSCapturing = GetPSCapturePair(&Plan, &PSPair);
+            if (PSCapturing)
+                RunPSCapture(&PSPair, DMAReadPtr, Plan.FrameBytes, FrameCount);
+            if ((Secondary != NULL) && (FrameCount * Secondary->WordCount > VDIVERSITYSAMPLES))
+                FrameCount = VDIVERSITYSAMPLES / Secondary->WordCount;
+            //
+            // find a latched PPS pulse in these frames; one in data already skipped is lost
+            //
+            PPSHere = false;
+            if (!PPSPending)
+                PPSPending = GetPPSLatch(&PPSPosition, &PPSSecond);
+            if (PPSPending)
+            {
+                Offset = PPSPosition - (atomic_load_explicit(&DMARing.Tail, memory_order_relaxed)
+                                        + (uint32_t)(DMAReadPtr - DMAStartPtr));
+                if ((int32_t)Offset < 0)
+                    PPSPending = false;
+                else if (Offset < FrameCount * Plan.FrameBytes)
+                {
+                    PPSFrame = Offset / Plan.FrameBytes;
+                    PPSHere = true;
+                    PPSPending = false;
+                }
+            }
+            //
+            // now run the plan: copy each DDC's samples from all the frames to its I/Q ring
+            // except for DDCs being shed, whose samples are dropped
+            //
+            ShedMask = atomic_load_explicit(&DDCShedding, memory_order_relaxed) ? P2Config.DDCLowPriority : 0;
+            for (Cntr = 0; Cntr < Plan.NumEntries; Cntr++)
+            {
+                Entry = Plan.Entries + Cntr;
+                DDC = Entry->DDC;
+                if (Entry == Secondary)
+                    continue;                                                       // combined into the primary
+                if (PSCapturing && ((Entry == PSPair.Even) || (Entry == PSPair.Odd)))
+                    continue;                                                       // sent by the PureSignal capture
+                Factor = GetDDCDecimation(DDC, Entry->WordCount);
+                if (Factor != Decimators[DDC].Factor)
+                {
+                    ResetDecimator(&Decimators[DDC], Factor);
+                    if (UseDebug)
+                        printf("DDC%d: %dKHz, decimating by %d (%s)\n", DDC, 48 / Factor, Factor, GetDecimatorName());
+                }
+                //
+                // a new rate: the old rate's samples go out first, and the ring is made
+                // or grown if the new rate needs it, without stopping the other DDCs
+                //
+                RateKHz = 48 * Entry->WordCount / Factor;
+                if (RateKHz != OutRateKHz[DDC])
+                {
+                    RecordDDCBoundary(DDC, RateKHz);
+                    OutRateKHz[DDC] = RateKHz;
+                    if (!IQRingsAtStartup && (atomic_load(&IQRingBytes[DDC]) < IQRingSizeForRate(Entry->WordCount))
+                        && GrowIQRing(DDC, IQRingSizeForRate(Entry->WordCount)))
+                    {
+                        printf("DDC%d: I/Q ring can't be grown while running\n", DDC);
+                        atomic_store(&IQRingsTooSmall, true);                       // the DDC thread restarts the pipeline to make it
+                    }
+                }
+                if (ShedMask & (1U << DDC))
+                {
+                    TelemetryCountShed(DDC, FrameCount * Entry->WordCount / Factor);
+                    RecordDDCGap(DDC, FrameCount * Entry->WordCount / Factor);
+                    continue;
+                }
+                Frames = RingBytesFree(&IQRing[DDC]) / (6 * Entry->WordCount);        // discard if sender has fallen behind
+                if (Frames > FrameCount)
+                    Frames = FrameCount;
+                SrcBytePtr = DMAReadPtr + Entry->SrcOffset;
+                DestBytePtr = RingWritePtr(&IQRing[DDC]);
+                if (PPSHere && (PPSFrame < Frames))
+                    RecordDDCAnchor(DDC, atomic_load_explicit(&IQRing[DDC].Head, memory_order_relaxed)
+                                    + PPSFrame * Entry->WordCount / Factor * 6, PPSSecond);
+                DDCShmWriteStart(DDC, &IQRing[DDC], Frames * 6 * Entry->WordCount);
+                Entry->Demux(DestBytePtr, SrcBytePtr, Plan.FrameBytes, Frames, Entry->WordCount);    // 6 bytes per sample
+                if ((int)DDC == ChannelizerDDC)                                     // and to the channelizer
+                    WriteVirtualDDCSamples(RingWritePtr(&IQRing[DDC]), Frames * 6 * Entry->WordCount, Entry->WordCount);
+                Outputs = RunDecimator(&Decimators[DDC], DestBytePtr, DestBytePtr, Frames * Entry->WordCount);
+                if ((Secondary != NULL) && (DDC == Primary))
+                    CombineDiversity(Secondary, &Decimators[Secondary->DDC], DMAReadPtr, Plan.FrameBytes,
+                                     Frames, Factor, DestBytePtr, Outputs, RateKHz);
+                Kept = RunDDCPlugins(DDC, DestBytePtr, Outputs, RateKHz);
+                RingCommitWrite(&IQRing[DDC], Kept * 6);
+                if (Kept != Outputs)                                                // plugins dropped samples
+                    RecordDDCGap(DDC, Outputs - Kept);
+                DDCShmWriteDone(DDC, &IQRing[DDC], RateKHz);
+                if (atomic_load_explicit(&DDCRateKHz[DDC], memory_order_relaxed) != RateKHz)
+                    atomic_store_explicit(&DDCRateKHz[DDC], RateKHz, memory_order_relaxed);
+                if (DDCSenderPerDDC && (RingBytesUsed(&IQRing[DDC]) > DDCJumbo[DDC] * VIQBYTESPERFRAME))  // at least a 24 bit packet
+                    WakeDDCSender(DDC);
+                if (Frames < FrameCount)
+                {
+                    atomic_fetch_add(&DDCSamplesDiscarded, (FrameCount - Frames) * Entry->WordCount);
+                    RecordDDCGap(DDC, (FrameCount - Frames) * Entry->WordCount / Factor);
+                }
+            }
+            DMAReadPtr += FrameCount * Plan.FrameBytes;                             // that's how many bytes we read out
+            DecodeByteCount -= FrameCount * Plan.FrameBytes;
+        }
+        //
+        // release the decoded frames; any part frame stays in the ring for next time
+        //
+        if (DMAReadPtr != DMAStartPtr)
+        {
+            RingConsume(&DMARing, DMAReadPtr - DMAStartPtr);
+            NotifyDDCShm();                                                         // wake any local clients
+            StageEnd(&Profiler, eStageDDCDemux, DMAReadPtr - DMAStartPtr);
+        }
+        else
+            usleep(P2Config.StageIdleWait);
+    }
+    StageProfilerStop(&Profiler);
+    HeartbeatStop(eBeatDDCDemux);
+    return NULL;
+}
 
-#define VDDCPACKETSIZE 1444
-#define VIQSAMPLESPERFRAME 238                      // total I/Q samples in one DDC packet
-#define VIQBYTESPERFRAME 6*VIQSAMPLESPERFRAME       // total bytes in one outgoing frame
-#define VSTARTUPDELAY 100                           // 100 messages (~100ms) before reporting under or overflows
 
 //
-// strategy:
-// 1. We have one DMA buffer, big enough for the largest DMA
-// 2. When a DMA occurs, trafer data to separate circular buffers for each DDC
-// 3. retain separate pointers into those buffers for each DDC
-// 4. copy ALL DMA'd data out to the separate buffers
-// 5. then loop through all DDC IQ buffers and send as many messages as possible
-//
-
-
-// use of IQ memory buffers as a "nearly circular" buffer:
-
-//
-// initially: data is added starting at Base pointer
-// 
-//               higher address
-//
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 | <- IQHeadPtr: 1st free location above occupied data
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX | <- IQBasePtr, IQReadPtr
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 | <- start of memory buffer
-//                 low address
-//
-// when there is enough data for a P2 packet, it is copied out from the bottom:
-
-
-//
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 | <- IQHeadPtr: 1st free location above occupied data
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX | <- IQReadPtr: 1st occupied location, ready to read
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |               offset +0x1000    | <- IQBasePtr: data initially transferred here
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 | <- start of memory buffer
-//                 low address
-//
-// then the "residue" is copied just BELOW the IQBasePtr, ready for a 
-// linear DMA to be able to read the next P2 packet without a "wrap" in the middle
-//
-//
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 | 
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 | 
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |<- IQBasePtr, IQHeadPtr: 1st free location above occupied data
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX | <- IQReadPtr: 1st occupied location, ready to read
-//       |                                 | <- start of memory buffer
-//                 low address
-
-
-//
-// then more data gets added at the headptr:
-// 
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 | 
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       |                                 |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |<- IQHeadPtr: 1st free location above occupied data
-//       | XXXXXXXXXX occupied XXXXXXXXXXX | 
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |<- IQBasePtr
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX |
-//       | XXXXXXXXXX occupied XXXXXXXXXXX | <- IQReadPtr: 1st occupied location, ready to read
-//       |                                 | <- start of memory buffer
-//                 low address
-// 
+// write a DDC's P2 header template into all its header slots, if it has changed
+//
+static void SetDDCHeaderTemplate(uint32_t DDC, uint32_t Bits, uint32_t Samples, uint32_t Compress, bool Stamped)
+{
+    struct DDCHeaderTemplate* Template = &DDCHeaderTemplates[DDC];
+    uint8_t Header[VDDCHEADERSIZE];
+    uint32_t Slot;
+
+    if (Template->Valid && (Template->Bits == Bits) && (Template->Samples == Samples)
+        && (Template->Compress == Compress) && (Template->Stamped == Stamped))
+        return;
+    memset(Header, 0, sizeof(Header));                              // sequence number and timestamp 0
+    *(uint16_t*)(Header + 12) = htons(Bits);                        // bits per sample
+    *(uint16_t*)(Header + 14) = htons(Samples);                     // I/Q samples per packet
+    for (Slot = 0; Slot < VMAXDDCBATCH; Slot++)
+        memcpy(UDPBuffer[DDC] + Slot * VMAXDDCHEADERSIZE, Header, VDDCHEADERSIZE);
+    Template->Bits = Bits;
+    Template->Samples = Samples;
+    Template->Compress = Compress;
+    Template->Stamped = Stamped;
+    Template->Valid = true;
+}
 
 
+bool SendDDCPacket(uint32_t DDC, struct iovec* Iovecs, uint32_t Count)
+{
+    struct msghdr Msg;
+    uint32_t Dest;
+    uint32_t Bytes = 0;
+    uint32_t Cntr;
+    bool Error = false;
 
+    for (Cntr = 0; Cntr < Count; Cntr++)
+        Bytes += Iovecs[Cntr].iov_len;
+    for (Dest = 0; Dest < DDCNumDests[DDC]; Dest++)
+    {
+        Msg = DDCBatchMsgs[DDC][Dest].msg_hdr;                      // destination of packet 0
+        Msg.msg_iov = Iovecs;
+        Msg.msg_iovlen = Count;
+        if (sendmsg((DDCSocketData + DDC)->Socketid, &Msg, 0) < 0)
+        {
+            TelemetryCountSendError(DDC);
+            Error = true;
+        }
+        else
+            TelemetryCountPackets(DDC, 1, Bytes);
+    }
+    return Error;
+}
 
 
 //
-// code to allocate and free dynamic allocated memory
-// first the memory buffers:
+// add the packets of a batch just sent to the DDC's FEC group, and send the parity
+// packet of each group they complete
 //
-uint8_t* DMAReadBuffer = NULL;								// data for DMA read from DDC
-uint32_t DMABufferSize = VDMABUFFERSIZE;
-unsigned char* DMAReadPtr;							        // pointer for 1st available location in DMA memory
-unsigned char* DMAHeadPtr;							        // ptr to 1st free location in DMA memory
-unsigned char* DMABasePtr;							        // ptr to target DMA location in DMA memory
+static void SendDDCFECParity(uint32_t DDC, uint32_t Count)
+{
+    struct iovec Iovec;
+    uint32_t Packet;
 
-uint8_t* UDPBuffer[VNUMDDC];                                // DDC frame buffer
-uint8_t* DDCSampleBuffer[VNUMDDC];                          // buffer per DDC
-unsigned char* IQReadPtr[VNUMDDC];							// pointer for reading out an I or Q sample
-unsigned char* IQHeadPtr[VNUMDDC];							// ptr to 1st free location in I/Q memory
-unsigned char* IQBasePtr[VNUMDDC];							// ptr to DMA location in I/Q memory
+    Iovec.iov_base = DDCFECGroups[DDC].Packet;
+    for (Packet = 0; Packet < Count; Packet++)
+        if ((Iovec.iov_len = AddDDCFECPacket(&DDCFECGroups[DDC], DDCBatchIovecs[DDC][Packet], 2)) != 0)
+            SendDDCPacket(DDC, &Iovec, 1);
+}
 
 
-bool CreateDynamicMemory(void)                              // return true if error
-{
-    uint32_t DDC;
-    bool Result = false;
 //
-// first create the buffer for DMA, and initialise its pointers
+// send a DDC's VITA-49 context packet to the client and any subscribers
 //
-    posix_memalign((void**)&DMAReadBuffer, VALIGNMENT, DMABufferSize);
-    DMAReadPtr = DMAReadBuffer + VBASE;		                    // offset 4096 bytes into buffer
-    DMAHeadPtr = DMAReadBuffer + VBASE;
-    DMABasePtr = DMAReadBuffer + VBASE;
-    if (!DMAReadBuffer)
-    {
-        printf("I/Q read buffer allocation failed\n");
-        Result = true;
-    }
-    memset(DMAReadBuffer, 0, DMABufferSize);
+static void SendVITA49Context(uint32_t DDC, struct VITA49Stream* Stream, uint64_t SampleNumber)
+{
+    uint8_t Packet[VVITA49CONTEXTSIZE];
+    struct iovec Iovec;
 
-    //
-    // set up per-DDC data structures
-    //
-    for (DDC = 0; DDC < VNUMDDC; DDC++)
-    {
-        UDPBuffer[DDC] = malloc(VDDCPACKETSIZE);
-        DDCSampleBuffer[DDC] = malloc(DMABufferSize);
-        IQReadPtr[DDC] = DDCSampleBuffer[DDC] + VBASE;		// offset 4096 bytes into buffer
-        IQHeadPtr[DDC] = DDCSampleBuffer[DDC] + VBASE;
-        IQBasePtr[DDC] = DDCSampleBuffer[DDC] + VBASE;
-    }
-    return Result;
+    Iovec.iov_base = Packet;
+    Iovec.iov_len = MakeVITA49ContextPacket(Stream, Packet, SampleNumber);
+    SendDDCPacket(DDC, &Iovec, 1);
 }
 
 
-void FreeDynamicMemory(void)
+//
+// DDC sender thread
+// while there is enough I/Q data for a DDC served by this thread, make DDC Packets
+// into a batch, sent by sendmmsg() when full and when the DDC runs out of data
+// the samples stay in the ring until their batch has been sent, then are released
+// with VITA-49 asked for (by the client, or setting ddc_vita49) the packets have
+// VITA-49 data headers instead, and uncompressed samples; a context packet is
+// sent first, when the rate or sample size changes, and every VVITA49CONTEXTINTERVAL
+// packets. They aren't sent by GSO: the segment size is that of a P2 packet.
+// at a rate boundary the old rate's last samples are sent padded to a whole packet,
+// and that packet ends its batch.
+//
+static void *DDCSenderThread(void *arg)
 {
+    struct DDCSenderArgs* Args = (struct DDCSenderArgs*)arg;
+    uint32_t BatchSize;                                         // packets per sendmmsg() call
+    uint32_t PacketCount;                                       // packets ready in the current batch
+    uint32_t PacketsMade;                                       // packets made in one pass through the DDCs
+    uint8_t* PacketPtr;                                         // packet being assembled
+    unsigned char* IQReadPtr;                                   // I/Q samples for next packet in the DDC's ring
+    uint32_t RingBytes = VIQBYTESPERFRAME;                      // ring bytes used by each packet
+    uint32_t Samples;                                           // I/Q samples in each packet
+    uint32_t Bits;                                              // bits per sample sent
+    uint32_t Jumbo;                                             // standard packets' samples in each packet
+    uint32_t MaxPayload;                                        // I/Q bytes in an uncompressed packet
+    uint32_t Compress;                                          // compression mode (setting ddc_compress)
+    uint32_t PayloadBytes;                                      // I/Q bytes in the packet
+    uint32_t BatchBytes;                                        // bytes in the packets of the batch
+    uint32_t BatchRingBytes;                                    // ring bytes used by the packets of the batch
+    uint32_t PacketBytes;                                       // ring bytes used by the packet; fewer if padded
+    uint32_t PacketRateKHz[VNUMDDC];                            // sample rate of the packets being made
+    bool Error;
     uint32_t DDC;
+    struct StageProfiler Profiler;                              // packet build and send CPU cost
+    bool UseVITA;                                               // true if sending VITA-49 packets
+    uint32_t HeaderBytes;                                       // P2 or VITA-49 header bytes
+    struct VITA49Stream VITAStream[VNUMDDC];                    // VITA-49 header state, stream ID = DDC
+    uint32_t NextContext[VNUMDDC];                              // VITA-49 data packet count when a context packet is due
+    struct PPSEpoch Epoch[VNUMDDC];                             // PPS time of each DDC stream, when known
+    uint32_t Position;                                          // ring position of the packet's 1st sample
+    uint32_t FECGroup;                                          // packets per FEC parity packet; 0 if none
+    bool Stamped;                                               // true if P2 packets carry a timestamp
 
-    free(DMAReadBuffer);
-    //
-    // free the per-DDC buffers
-    //
+    SetStageCore(DDCStageCores[2], "sender");
+    HeartbeatStart(eBeatDDCSender + Args->SenderNum);
+    StageProfilerInit(&Profiler);
+    StageProfilerStart(&Profiler);
+    BatchSize = DDCSendBatchSize;
+    memset(PacketRateKHz, 0, sizeof(PacketRateKHz));
+    memset(NextContext, 0, sizeof(NextContext));
+    memset(Epoch, 0, sizeof(Epoch));
     for (DDC = 0; DDC < VNUMDDC; DDC++)
+        InitVITA49Stream(&VITAStream[DDC], DDC);
+    while (DDCPipelineRun)
     {
-        free(UDPBuffer[DDC]);
-        free(DDCSampleBuffer[DDC]);
+        Heartbeat(eBeatDDCSender + Args->SenderNum, eBeatRunning);
+        PacketsMade = 0;
+        for (DDC = Args->SenderNum; DDC < VNUMDDC; DDC += DDCSenderCount)
+        {
+            //
+            // when local clients read the rings in shared memory instead, the samples
+            // are just released. The ring write pointer keeps them for a ring's length.
+            //
+            if (P2Config.DDCShm == VDDCSHMONLY)
+            {
+                RingConsume(&IQRing[DDC], RingBytesUsed(&IQRing[DDC]));
+                atomic_store(&DDCBoundaries[DDC].Tail, atomic_load(&DDCBoundaries[DDC].Head));
+                continue;
+            }
+            //
+            // the ring always holds 24 bit samples. For 16 bit samples, each packet's
+            // are packed into the pack buffer, and 1.5x as many fit in a packet.
+            // the size is read once per pass so a batch is all one size.
+            // compressed payloads (24 bit samples only) are coded into the pack buffer too;
+            // they vary in size, so they are always sent by sendmmsg().
+            // a jumbo packet is the same, with Jumbo times the samples.
+            //
+            Bits = GetDDCSampleSize(DDC);
+            UseVITA = IsVITA49Wanted();
+            if (UseVITA && DDCUseGSO[DDC])
+            {
+                DDCUseGSO[DDC] = SetupDDCGSO(DDC);                  // turned on during the run: clear the segment size
+                DDCSetupValid = false;
+            }
+            Compress = ((Bits == 16) || UseVITA) ? VDDCCOMPRESSNONE : P2Config.DDCCompress;
+            Jumbo = DDCJumbo[DDC];
+            MaxPayload = Jumbo * VIQBYTESPERFRAME;
+            if (((Bits == 16) || (Compress != VDDCCOMPRESSNONE)) && (DDCPackJumbo[DDC] < Jumbo))
+            {
+                DDCPackBuffer[DDC] = ArenaAlloc(&StreamArena, VMAXDDCBATCH * MaxPayload, 0);     // any old one stays in the arena
+                DDCPackJumbo[DDC] = (DDCPackBuffer[DDC] == NULL) ? 0 : Jumbo;
+            }
+            if (DDCPackJumbo[DDC] < Jumbo)
+            {
+                Bits = 24;
+                Compress = VDDCCOMPRESSNONE;
+            }
+            RingBytes = Jumbo * ((Bits == 16) ? VIQRINGBYTESPERFRAME16 : VIQBYTESPERFRAME);
+            Samples = Jumbo * ((Bits == 16) ? VIQSAMPLESPERFRAME16 : VIQSAMPLESPERFRAME);
+            HeaderBytes = UseVITA ? VVITA49DATAHEADERSIZE : VDDCHEADERSIZE;
+            Stamped = GEnableTimeStamping;                          // read once, to match the template
+            if (UseVITA)
+                DDCHeaderTemplates[DDC].Valid = false;
+            else
+                SetDDCHeaderTemplate(DDC, Bits, Samples, Compress, Stamped);
+            FECGroup = (UseVITA || (Jumbo != 1)) ? 0 : P2Config.DDCFEC;
+            if (FECGroup != DDCFECGroups[DDC].GroupSize)
+                InitDDCFECGroup(&DDCFECGroups[DDC], FECGroup);
+            if (DDCFlushJumbo[DDC] < Jumbo)
+            {
+                DDCFlushBuffer[DDC] = ArenaAlloc(&StreamArena, Jumbo * VIQRINGBYTESPERFRAME16, 0);   // room for either sample size
+                DDCFlushJumbo[DDC] = (DDCFlushBuffer[DDC] == NULL) ? 0 : Jumbo;
+            }
+            PacketBytes = NextDDCPacketBytes(DDC, 0, RingBytes, &PacketRateKHz[DDC]);   // takes a boundary at the tail
+            if (!UseVITA)
+                NextContext[DDC] = VITAStream[DDC].DataCount;      // so one is sent first if it is turned on
+            else if (PacketBytes != 0)
+            {
+                if (SetVITA49Format(&VITAStream[DDC], 1000 * PacketRateKHz[DDC], Bits)
+                    || ((int32_t)(VITAStream[DDC].DataCount - NextContext[DDC]) >= 0))
+                {
+                    SendVITA49Context(DDC, &VITAStream[DDC], DDCSampleCount[DDC]);
+                    NextContext[DDC] = VITAStream[DDC].DataCount + VVITA49CONTEXTINTERVAL;
+                }
+            }
+            PacketCount = 0;
+            BatchBytes = 0;
+            BatchRingBytes = 0;
+            IQReadPtr = RingReadPtr(&IQRing[DDC]);
+            while ((PacketBytes = NextDDCPacketBytes(DDC, BatchRingBytes, RingBytes, &PacketRateKHz[DDC])) != 0)
+            {
+                if (PacketCount == 0)
+                    StageMark(&Profiler);                                   // a batch is profiled, not each packet
+                PacketPtr = UDPBuffer[DDC] + PacketCount * VMAXDDCHEADERSIZE;
+                DDCBatchIovecs[DDC][PacketCount][0].iov_len = HeaderBytes;
+                Position = atomic_load_explicit(&IQRing[DDC].Tail, memory_order_relaxed) + BatchRingBytes;
+                if (PacketBytes < RingBytes)
+                {
+                    //
+                    // the old rate's last samples before a rate boundary: padded with zero samples
+                    // (or if there is no flush buffer, dropped) so the new rate starts a packet
+                    //
+                    if (DDCFlushBuffer[DDC] == NULL)
+                    {
+                        RingConsume(&IQRing[DDC], PacketBytes);             // always the 1st of a batch
+                        DDCSampleCount[DDC] += PacketBytes / 6;
+                        IQReadPtr = RingReadPtr(&IQRing[DDC]);
+                        continue;
+                    }
+                    memcpy(DDCFlushBuffer[DDC], IQReadPtr, PacketBytes);
+                    memset(DDCFlushBuffer[DDC] + PacketBytes, 0, RingBytes - PacketBytes);
+                    IQReadPtr = DDCFlushBuffer[DDC];
+                }
+                DDCSampleCount[DDC] = ApplyDDCGaps(DDC, Position, DDCSampleCount[DDC]);
+                if (ApplyDDCAnchors(DDC, Position, DDCSampleCount[DDC], &Epoch[DDC]))
+                    SetVITA49Epoch(&VITAStream[DDC], Epoch[DDC].Sample, Epoch[DDC].Second);
+                if (UseVITA)
+                {
+                    DDCSequence[DDC]++;
+                    MakeVITA49DataHeader(&VITAStream[DDC], PacketPtr, DDCSampleCount[DDC], Samples, Samples * Bits / 4);
+                }
+                else
+                {
+                    //
+                    // the rest of the header is the template
+                    //
+                    *(uint32_t*)PacketPtr = htonl(DDCSequence[DDC]++);          // add sequence count
+                    if (Stamped && P2Config.PPSTimestamp && Epoch[DDC].Valid)
+                        *(uint64_t*)(PacketPtr + 4) = htobe64(GetPPSStamp(&Epoch[DDC], DDCSampleCount[DDC],
+                            1000 * PacketRateKHz[DDC]));                            // UTC second, samples into it
+                    else if (Stamped)
+                        *(uint64_t*)(PacketPtr + 4) = htobe64(DDCSampleCount[DDC]); // timestamp = 1st sample number
+                }
+                DDCSampleCount[DDC] += Samples;
+                //
+                // now point to I/Q data; send if batch full or no more data
+                //
+                PayloadBytes = MaxPayload;
+                if (Bits == 16)
+                {
+                    DDCBatchIovecs[DDC][PacketCount][1].iov_base = DDCPackBuffer[DDC] + PacketCount * MaxPayload;
+                    PackDDCSamples16(DDCBatchIovecs[DDC][PacketCount][1].iov_base, IQReadPtr, Samples);
+                }
+                else if ((Compress != VDDCCOMPRESSNONE) &&
+                         ((PayloadBytes = CompressDDCSamples(DDCPackBuffer[DDC] + PacketCount * MaxPayload, MaxPayload,
+                                                             IQReadPtr, Samples, Compress, P2Config.DDCCompressBits)) != 0))
+                {
+                    DDCBatchIovecs[DDC][PacketCount][1].iov_base = DDCPackBuffer[DDC] + PacketCount * MaxPayload;
+                    *(uint16_t*)(PacketPtr + 12) = htons(VDDCCOMPRESSEDBITS(Compress));
+                }
+                else
+                {
+                    PayloadBytes = MaxPayload;                                  // incompressible: sent as it is
+                    DDCBatchIovecs[DDC][PacketCount][1].iov_base = IQReadPtr;
+                    if (Compress != VDDCCOMPRESSNONE)
+                        *(uint16_t*)(PacketPtr + 12) = htons(Bits);             // the slot may hold a compressed packet's bits field
+                }
+                DDCBatchIovecs[DDC][PacketCount][1].iov_len = PayloadBytes;
+                BatchBytes += HeaderBytes + PayloadBytes;
+                BatchRingBytes += PacketBytes;
+                IQReadPtr = RingReadPtr(&IQRing[DDC]) + BatchRingBytes;
+                PacketsMade++;
+                if ((++PacketCount == BatchSize) || (PacketBytes < RingBytes) ||       // a padded packet ends its batch
+                    (NextDDCPacketBytes(DDC, BatchRingBytes, RingBytes, &PacketRateKHz[DDC]) != RingBytes))
+                {
+                    StageEnd(&Profiler, eStageDDCBuild, BatchBytes);
+                    Heartbeat(eBeatDDCSender + Args->SenderNum, eBeatSend);
+                    if (DDCUsePacing[DDC])
+                        StampDDCTxTimes(DDC, PacketCount, Samples);
+                    if (Compress != VDDCCOMPRESSNONE)
+                        Error = SendDDCBatch((DDCSocketData+DDC)->Socketid, DDCBatchMsgs[DDC], PacketCount * DDCNumDests[DDC], 1);
+                    else if (DDCUseXDP[DDC])
+                        Error = SendDDCXDPBatch(DDC, PacketCount);
+                    else if (DDCUseGSO[DDC])
+                        Error = SendDDCGSOBatch(DDC, 0, PacketCount);
+                    else
+                        Error = SendDDCBatch((DDCSocketData+DDC)->Socketid, DDCBatchMsgs[DDC], PacketCount * DDCNumDests[DDC], 1);
+                    if (Error)
+                        TelemetryCountSendError(DDC);
+                    else
+                    {
+                        TelemetryCountPackets(DDC, PacketCount * DDCNumDests[DDC], BatchBytes * DDCNumDests[DDC]);
+                        Trace(eTraceDDCSend, DDC, PacketCount * DDCNumDests[DDC]);
+                        CaptureMessages(eCapDDC, true, DDCBatchMsgs[DDC], PacketCount * DDCNumDests[DDC],
+                                        &DDCDestAddr[DDC][0], (DDCSocketData+DDC)->Portid);
+                        if (FECGroup != 0)
+                            SendDDCFECParity(DDC, PacketCount);
+                    }
+                    StageEnd(&Profiler, eStageDDCSend, BatchBytes * DDCNumDests[DDC]);
+                    RingConsume(&IQRing[DDC], BatchRingBytes);
+                    PacketCount = 0;
+                    BatchBytes = 0;
+                    BatchRingBytes = 0;
+                    IQReadPtr = RingReadPtr(&IQRing[DDC]);
+                    //
+                    // a send interrupted by the stall detector drops the batch; the engine is restarting
+                    //
+                    if (Error)
+                    {
+                        HeartbeatError(eBeatDDCSender + Args->SenderNum, errno);
+                        printf("Send Error, DDC=%d, errno=%d, socket id = %d\n", DDC, errno, (DDCSocketData+DDC)->Socketid);
+                        if (!StallRestartRequested(eBeatDDCDMA))
+                            DDCPipelineError = true;
+                    }
+                }
+            }
+        }
+        if (PacketsMade != 0)
+            continue;
+        if (DDCSenderPerDDC)
+        {
+            Heartbeat(eBeatDDCSender + Args->SenderNum, eBeatIdle);
+            WaitDDCData(Args->SenderNum, RingBytes);        // this sender's only DDC
+        }
+        else
+            usleep(P2Config.StageIdleWait);
     }
+    StageProfilerStop(&Profiler);
+    HeartbeatStop(eBeatDDCSender + Args->SenderNum);
+    return NULL;
 }
 
 
@@ -253,6 +2197,8 @@ void FreeDynamicMemory(void)
 // thread initiated after a "Start" command
 // will be instructed to stop & exit by main loop setting enable_thread to 0
 // this code signals thread terminated by setting active_thread = 0
+// this thread is the DMA reader stage of the DDC pipeline. The demux and
+// sender stages are started each time the SDR becomes active.
 //
 void *OutgoingDDCIQ(void *arg)
 {
@@ -260,68 +2206,97 @@ void *OutgoingDDCIQ(void *arg)
 // memory buffers
 //
     uint32_t DMATransferSize;
+    uint32_t TargetTransferSize;                                // DMA size meeting the latency target
+    uint32_t TargetRateWord = 0;                                // rate word TargetTransferSize was set for
+    uint32_t TargetLatency = 0;                                 // latency TargetTransferSize was set for
     bool InitError = false;                                     // becomes true if we get an initialisation error
-    
-    uint32_t ResidueBytes;
+    uint32_t Run = 0;                                           // stream run number
+
     uint32_t Depth = 0;
-    
-    int IQReadfile_fd = -1;									    // DMA read file device
-    uint32_t RegisterValue;
-    bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;
+    uint32_t Available;                                         // FIFO words not already requested by a DMA
+    uint32_t Slot;
+    uint32_t StreamHead;                                        // streaming ring: bytes written by driver
+    uint32_t StreamOverruns, PrevStreamOverruns = 0;
+    uint64_t DMAStartTime;                                      // for DMA time telemetry
+
+    struct StreamEngine Engine;                                 // DMA device and FIFO; the DMA ring is made with the I/Q rings
     int DDC;                                                    // iterator
+    uint32_t PacketCount;
 
     struct ThreadSocketData *ThreadData;                        // socket etc data for each thread.
                                                                 // points to 1st one
 //
-// variables for outgoing UDP frame
+// pipeline stage threads
 //
-    struct sockaddr_in DestAddr[VNUMDDC];                       // destination address for outgoing data
-    struct iovec iovecinst[VNUMDDC];                            // instance of iovec
-    struct msghdr datagram[VNUMDDC];
-    uint32_t SequenceCounter[VNUMDDC];                          // UDP sequence count
-//
-// variables for analysing a DDC frame
-//
-    uint32_t FrameLength;                                       // number of words per frame
-    uint32_t DDCCounts[VNUMDDC];                                // number of samples per DDC in a frame
-    uint32_t RateWord;                                          // DDC rate word from buffer
-    uint32_t HdrWord;                                           // check word read form DMA's data
-    uint16_t* SrcWordPtr, * DestWordPtr;                        // 16 bit read & write pointers
-    uint32_t *LongWordPtr;
-    uint32_t PrevRateWord;                                      // last used rate word
-    uint32_t Cntr;                                              // sample word counter
-    bool HeaderFound;
-    uint32_t DecodeByteCount;                                   // bytes to decode
-    unsigned int Current;                                   // current occupied locations in FIFO
-    unsigned int StartupCount;                              // used to delay reporting of under & overflows
+    pthread_t DemuxThread;
+    pthread_t SenderThreads[VNUMDDC];
+    struct DDCSenderArgs SenderArgs[VNUMDDC];
+    uint32_t Sender;
+    char SenderName[16];                                    // "DDC sender n"
+    uint32_t SendersRunning;
+    uint32_t Dest;                                          // destination iterator
+    struct msghdr* Msg;
+
+    bool RestartPipeline = false;                           // true to start the pipeline again in the same run
+    bool StallRestart = false;                              // true if restarting after a stall
+    int DMAResult = 0;                                      // result of a failed DMA, or 0
+    int Result;
+    struct StageProfiler Profiler;                          // FIFO wait and DMA CPU cost
+    bool ShortRead = false;                                 // true if each read takes what the FIFO holds
+    uint32_t TargetByteRate = 0;                            // DDC data rate at TargetRateWord, bytes/s
+    uint32_t MaxRead;                                       // ring space for a short read
+    uint64_t Wait;                                          // us until a short read should find data
 
 //
 // initialise. Create memory buffers and open DMA file devices
 //
-    PrevRateWord = 0xFFFFFFFF;                                  // illegal value to forc re-calculation of rates
-    DMATransferSize = VDMATRANSFERSIZE;                         // initial size, but can be changed
+    DMATransferSize = DDCInitialDMASize();                      // initial size, but can be changed
+    TargetTransferSize = DMATransferSize;
     InitError = CreateDynamicMemory();
+    if (!InitError && OpenDDCShm(IQRing, IsDDCRecordingSet()))
+        printf("DDC shared memory not available; DDCs sent over UDP\n");
+    if (!InitError && StartDDCRecorder())
+        printf("DDC recording not started\n");
     //
     // open DMA device driver
     //
-    IQReadfile_fd = open(VDDCDMADEVICE, O_RDWR);
-    if (IQReadfile_fd < 0)
-    {
-        printf("XDMA read device open failed for DDC data\n");
+    InitStreamEngine(&Engine, "RX DDC", eRXDDCDMA, VDDCDMADEVICE, VADDRDDCSTREAMREAD, false,
+                     eTelDDCDMA, eBeatDDCDMA, 0b00000001);
+    if (OpenStreamEngine(&Engine, 0, 0, 0, 0))
         InitError = true;
-    }
 
     ThreadData = (struct ThreadSocketData*)arg;
+    DDCSocketData = ThreadData;
     printf("spinning up outgoing I/Q thread with port %d\n", ThreadData->Portid);
+    if(UseDebug)
+        printf("DDC demultiplex using %s code\n", GetDDCDemuxName());
+    SetStageCore(DDCStageCores[0], "DMA reader");
+    if ((DDCStageCores[0] >= 0) && SetDMAInterruptCPU(VDDCDMADEVICE, DDCStageCores[0]))
+        printf("DDC DMA interrupt could not be steered to core %d\n", DDCStageCores[0]);
+    if (!InitError)
+    {
+        DDCAsyncDMA = !DMAAsyncInit(&DDCDMAContext, Engine.fd, VDDCDMAINFLIGHT);
+        printf("DDC DMA reads: %s\n", DDCAsyncDMA ? "asynchronous, double buffered" : "blocking");
+    }
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        DDCWakeFd[DDC] = DDCSenderPerDDC ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+        if (DDCSenderPerDDC && (DDCWakeFd[DDC] < 0))
+        {
+            perror("DDC sender eventfd");
+            printf("DDC senders: one per DDC, polling\n");
+            DDCSenderPerDDC = false;                                // each sender still has one DDC
+        }
+    }
+    if (DDCSenderPerDDC)
+        printf("DDC senders: one per DDC, woken when the DDC has a packet\n");
 
     //
     // set up per-DDC data structures
     //
     for (DDC = 0; DDC < VNUMDDC; DDC++)
-    {
-        SequenceCounter[DDC] = 0;                           // clear UDP packet counter
         (ThreadData + DDC)->Active = true;                  // set outgoing socket active
-    }
+    RegisterStreamThread(true);
 
 
 
@@ -333,266 +2308,461 @@ void *OutgoingDDCIQ(void *arg)
 //
 //    RegisterWrite(0x1010, 0x0000002A);      // disable DDC data transfer; DDC2=test source
     SetRXDDCEnabled(false);
-    usleep(1000);                           // give FIFO time to stop recording 
-    SetupFIFOMonitorChannel(eRXDDCDMA, false);
-    ResetDMAStreamFIFO(eRXDDCDMA);
-    RegisterValue = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
-	if(UseDebug)
-        printf("DDC FIFO Depth register = %08x (should be ~0)\n", RegisterValue);
+    usleep(1000);                           // give FIFO time to stop recording
+    StartStreamFIFO(&Engine);
 	Depth=0;
+    if (!InitError && DDCUseStreamRing)
+    {
+        DDCStreamActive = !StartDDCStreamRing(Engine.fd);
+        printf("DDC streaming ring %s\n", DDCStreamActive ? "started" : "not available; using read()");
+    }
 
 
 //
 // thread loop. runs continuously until commanded by main loop to exit
-// for now: add 1 RX data + mic data at 48KHz sample rate. Mic data is constant zero.
-// while there is enough I/Q data, make outgoing packets;
-// when not enough data, read more.
+// while the SDR is active, DMA data into the DMA ring whenever the FIFO has enough;
+// the demux and sender threads make the outgoing packets.
 //
+    HeartbeatStart(eBeatDDCDMA);
+    StageProfilerInit(&Profiler);
     while(!InitError)
     {
-        while(!SDRActive)
+        if (RestartPipeline && StallRestart)
+            printf("restarting outgoing DDC data after a stall\n");
+        else if (RestartPipeline && (DMAResult != 0))
+            printf("restarting outgoing DDC data after a DMA error\n");
+        else if (RestartPipeline)
+            printf("restarting outgoing DDC data for larger I/Q rings\n");
+        else
+        {
+            Heartbeat(eBeatDDCDMA, eBeatIdle);
+            WaitForStreamStart(ThreadData, VNUMDDC, true, &Run);
+            printf("starting outgoing DDC data\n");
+            if (DDCSequenceResumed)
+                DDCSequenceResumed = false;                         // taken over from another p2app
+            else
+            {
+                memset(DDCSequence, 0, sizeof(DDCSequence));        // a restart within the run carries on
+                memset(DDCSampleCount, 0, sizeof(DDCSampleCount));
+            }
+        }
+        RestartStreamStartup(&Engine);
+        atomic_store(&DDCPacketsSent, 0);
+        atomic_store(&DDCSendCalls, 0);
+        atomic_store(&DDCSamplesDiscarded, 0);
+        ResetDDCOverload();
+        DDCRunStartTime = TelemetryTimestamp();
+        atomic_store(&DDCFirstPacketTime, 0);
+        if (DDCSetupCurrent(ThreadData))
+        {
+            if (UseDebug)
+                printf("DDC packet setup kept from the last run\n");
+        }
+        else
         {
-            for (DDC=0; DDC < VNUMDDC; DDC++)
-                if((ThreadData+DDC) -> Cmdid & VBITCHANGEPORT)
+            //
+            // initialise outgoing DDC packets - VMAXDDCBATCH per DDC
+            // destination 0 is the client; then any subscribers to this DDC
+            // the DDC sockets only send, so each is connected to the client and the client
+            // packets need no address (no route lookup per packet). Subscriber packets still
+            // carry theirs: an address given in sendmmsg() overrides the connected one.
+            //
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+            {
+                memcpy(&DDCDestAddr[DDC][0], &reply_addr, sizeof(struct sockaddr_in));     // local copy of PC destination address (reply_addr is global)
+                DDCConnected[DDC] = !ConnectSocket(ThreadData + DDC, &DDCDestAddr[DDC][0]);
+                DDCNumDests[DDC] = 1;
+                for (Dest = 0; Dest < DDCSubscriberCount; Dest++)
+                    if (DDCSubscribers[Dest].DDCMask & (1 << DDC))
+                        memcpy(&DDCDestAddr[DDC][DDCNumDests[DDC]++], &DDCSubscribers[Dest].Addr, sizeof(struct sockaddr_in));
+                memset(DDCBatchIovecs[DDC], 0, sizeof(DDCBatchIovecs[DDC]));
+                memset(DDCBatchMsgs[DDC], 0, sizeof(DDCBatchMsgs[DDC]));
+                for (PacketCount = 0; PacketCount < VMAXDDCBATCH; PacketCount++)
                 {
-                    close((ThreadData+DDC) -> Socketid);                      // close old socket, open new one
-                    MakeSocket((ThreadData + DDC), 0);                        // this binds to the new port.
-                    (ThreadData + DDC) -> Cmdid &= ~VBITCHANGEPORT;           // clear command bit
+                    DDCBatchIovecs[DDC][PacketCount][0].iov_base = UDPBuffer[DDC] + PacketCount * VMAXDDCHEADERSIZE;
+                    DDCBatchIovecs[DDC][PacketCount][0].iov_len = VDDCHEADERSIZE;      // length set as each packet is made
+                    DDCBatchIovecs[DDC][PacketCount][1].iov_len = VIQBYTESPERFRAME;      // base and length set as each packet is made
+                    for (Dest = 0; Dest < DDCNumDests[DDC]; Dest++)
+                    {
+                        Msg = &DDCBatchMsgs[DDC][PacketCount * DDCNumDests[DDC] + Dest].msg_hdr;
+                        Msg->msg_iov = DDCBatchIovecs[DDC][PacketCount];
+                        Msg->msg_iovlen = 2;
+                        if ((Dest == 0) && DDCConnected[DDC])
+                            continue;                                                   // connected to the client: no address
+                        Msg->msg_name = &DDCDestAddr[DDC][Dest];                        // MAC addr & port to send to
+                        Msg->msg_namelen = sizeof(struct sockaddr_in);
+                    }
                 }
-            usleep(100);
+                DDCJumbo[DDC] = SetupDDCJumbo(DDC);
+                DDCUsePacing[DDC] = SetupDDCPacing(DDC);
+                DDCUseGSO[DDC] = SetupDDCGSO(DDC) && !DDCUsePacing[DDC];
+                DDCUseXDP[DDC] = !DDCUsePacing[DDC] && (DDCJumbo[DDC] == 1) && SetupDDCXDP(DDC);
+            }
+            memcpy(&DDCSetupAddr, &reply_addr, sizeof(struct sockaddr_in));
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+                DDCSetupSockets[DDC] = (ThreadData + DDC)->SocketCount;
+            DDCSetupGSO = P2Config.DDCGSO;
+            DDCSetupXDP = P2Config.DDCXDP;
+            DDCSetupPace = P2Config.DDCPace;
+            DDCSetupJumbo = P2Config.DDCJumbo;
+            DDCSetupVITA = IsVITA49Wanted();
+            DDCSetupValid = true;
+        }
+        if (DDCStreamActive)
+        {
+            //
+            // the driver ring runs all the time: start at its current write position
+            //
+            if (DMAStreamSync(Engine.fd, atomic_load(&DMARing.Tail), &StreamHead, &PrevStreamOverruns))
+            {
+                printf("DDC streaming ring sync failed\n");
+                InitError = true;
+                StreamThreadStopped();
+                break;
+            }
+            atomic_store(&DMARing.Head, StreamHead);
+            atomic_store(&DMARing.Tail, StreamHead);
+        }
+        else
+        {
+            //
+            // the DDCs have been disabled since the last run (or since the thread started),
+            // so one FIFO reset drops the stale contents and the stream restarts on a frame
+            //
+            ResetDMAStreamFIFO(eRXDDCDMA);
+            ResetRingBuffer(&DMARing);                      // discard any part frames from last time
+        }
+        DDCWarmStart = !DDCStreamActive;
+        DDCDMAOldest = 0;
+        DDCDMAInFlight = 0;
+        DDCDMAPendingBytes = 0;
+        if (PrepareIQRings())
+        {
+            InitError = true;
+            StreamThreadStopped();
+            break;
         }
-        printf("starting outgoing DDC data\n");
-        StartupCount = VSTARTUPDELAY;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            ResetRingBuffer(&IQRing[DDC]);
+        memset(DDCGaps, 0, sizeof(DDCGaps));
+        memset(DDCAnchors, 0, sizeof(DDCAnchors));
+        memset(DDCBoundaries, 0, sizeof(DDCBoundaries));
+        ResetPPSLatch();
+        StartDDCShm();
         //
-        // initialise outgoing DDC packets - 1 per DDC
+        // start the demux and sender stages
         //
-        for (DDC = 0; DDC < VNUMDDC; DDC++)
+        DDCPipelineError = false;
+        DMAResult = 0;
+        DDCPipelineRun = true;
+        SendersRunning = 0;
+        if (StartVirtualDDCs(ThreadData->Portid))
+            printf("virtual DDCs not started\n");
+        if (pthread_create(&DemuxThread, NULL, DDCDemuxThread, NULL) != 0)
+        {
+            printf("DDC demux thread create failed\n");
+            InitError = true;
+            StreamThreadStopped();
+            break;
+        }
+        SetThreadName(DemuxThread, "DDC demux");
+        for (Sender = 0; Sender < DDCSenderCount; Sender++)
         {
-            SequenceCounter[DDC] = 0;
-            memcpy(&DestAddr[DDC], &reply_addr, sizeof(struct sockaddr_in));           // local copy of PC destination address (reply_addr is global)
-            memset(&iovecinst[DDC], 0, sizeof(struct iovec));
-            memset(&datagram[DDC], 0, sizeof(struct msghdr));
-            iovecinst[DDC].iov_base = UDPBuffer[DDC];
-            iovecinst[DDC].iov_len = VDDCPACKETSIZE;
-            datagram[DDC].msg_iov = &iovecinst[DDC];
-            datagram[DDC].msg_iovlen = 1;
-            datagram[DDC].msg_name = &DestAddr[DDC];                   // MAC addr & port to send to
-            datagram[DDC].msg_namelen = sizeof(DestAddr);
+            SenderArgs[Sender].SenderNum = Sender;
+            if (pthread_create(&SenderThreads[Sender], NULL, DDCSenderThread, &SenderArgs[Sender]) != 0)
+            {
+                printf("DDC sender thread create failed\n");
+                InitError = true;
+                break;
+            }
+            snprintf(SenderName, sizeof(SenderName), "DDC sender %u", Sender);
+            SetThreadName(SenderThreads[Sender], SenderName);
+            SendersRunning++;
         }
       //
       // enable Saturn DDC to transfer data
       //
         printf("outDDCIQ: enable data transfer\n");
         SetRXDDCEnabled(true);
-        HeaderFound = false;
-        while(!InitError && SDRActive)
+        StageProfilerStart(&Profiler);
+        ShortRead = P2Config.DDCShortRead && !DDCStreamActive && !DDCAsyncDMA;
+        if (UseDebug && ShortRead)
+            printf("DDC DMA: short reads; the FIFO depth is read with each transfer\n");
+        while(!InitError && StreamRunActive(Run) && !DDCPipelineError && !atomic_load(&IQRingsTooSmall)
+              && !StallRestartRequested(eBeatDDCDMA) && (DMAResult == 0))
         {
-
-        //
-        // loop through all DDC I/Q buffers.
-        // while there is enough I/Q data for this DDC in local (ARM) memory, make DDC Packets
-        // then put any residues at the heads of the buffer, ready for new data to come in
-        //
-            for (DDC = 0; DDC < VNUMDDC; DDC++)
+            Heartbeat(eBeatDDCDMA, eBeatRunning);
+            //
+            // bring in more data by DMA if there is some, else sleep for a while and try again
+            // we have the same issue with DMA: a transfer isn't exactly aligned to the amount we can read out
+            // according to the DDC settings. An incomplete fragment of a frame is left in the DMA ring
+            // so the next DMA appends to it and the next readout begins at a new frame.
+            //
+            if (!ShortRead)
+            {
+                Depth = ReadStreamFIFO(&Engine);				// read the FIFO Depth register
+                NoteDDCFIFOStatus(&Engine, true);
+                NoteDDCStreamPosition(Engine.Current, TelemetryTimestamp());
+            }
+// note this could often generate a message at low sample rate because we deliberately read it down to zero.
+// this isn't a problem as we can send the data on without the code becoming blocked. so not a useful trap.
+            if (DDCStreamActive)
             {
-                while ((IQHeadPtr[DDC] - IQReadPtr[DDC]) > VIQBYTESPERFRAME)
-                {
-//                    printf("enough data for packet: DDC= %d\n", DDC);
-                    *(uint32_t*)UDPBuffer[DDC] = htonl(SequenceCounter[DDC]++);     // add sequence count
-                    memset(UDPBuffer[DDC] + 4, 0, 8);                               // clear the timestamp data
-                    *(uint16_t*)(UDPBuffer[DDC] + 12) = htons(24);                  // bits per sample
-                    *(uint32_t*)(UDPBuffer[DDC] + 14) = htons(VIQSAMPLESPERFRAME);  // I/Q samples for ths frame
-                    //
-                    // now add I/Q data & send outgoing packet
-                    //
-                    memcpy(UDPBuffer[DDC] + 16, IQReadPtr[DDC], VIQBYTESPERFRAME);
-                    IQReadPtr[DDC] += VIQBYTESPERFRAME;
-
-                    int Error;
-                    Error = sendmsg((ThreadData+DDC)->Socketid, &datagram[DDC], 0);
-                    if(StartupCount != 0)                                   // decrement startup message count
-                        StartupCount--;
-
-                    if (Error == -1)
-                    {
-                        printf("Send Error, DDC=%d, errno=%d, socket id = %d\n", DDC, errno, (ThreadData+DDC)->Socketid);
-                        InitError = true;
-                    }
-                }
                 //
-                // now copy any residue to the start of the buffer (before the data copy in point)
-                // unless the buffer already starts at or below the base
-                // if we do a copy, the 1st free location is always base addr
+                // streaming ring: report consumed data, and make new engine data visible to the demux
                 //
-                ResidueBytes = IQHeadPtr[DDC] - IQReadPtr[DDC];
-                //		printf("Residue = %d bytes\n",ResidueBytes);
-                if (IQReadPtr[DDC] > IQBasePtr[DDC])                                // move data down
+                if (DMAStreamSync(Engine.fd, atomic_load(&DMARing.Tail), &StreamHead, &StreamOverruns))
                 {
-                    if (ResidueBytes != 0) 		// if there is residue to move
-                    {
-                        memcpy(IQBasePtr[DDC] - ResidueBytes, IQReadPtr[DDC], ResidueBytes);
-                        IQReadPtr[DDC] = IQBasePtr[DDC] - ResidueBytes;
-                    }
-                    else
-                        IQReadPtr[DDC] = IQBasePtr[DDC];
-                    IQHeadPtr[DDC] = IQBasePtr[DDC];                            // ready for new data at base
+                    printf("DDC streaming ring sync failed\n");
+                    DDCPipelineError = true;
+                    break;
+                }
+                if (StreamOverruns != PrevStreamOverruns)
+                {
+                    printf("DDC streaming ring overrun: demux has fallen behind\n");
+                    DDCPipelineError = true;
+                    break;
+                }
+                if (StreamHead != atomic_load(&DMARing.Head))
+                {
+                    TelemetryCountDMA(eTelDDCDMA, StreamHead - atomic_load(&DMARing.Head));
+                    Trace(eTraceDDCDMA, StreamHead - atomic_load(&DMARing.Head), Engine.Current);
+                    CommitDDCDMA(StreamHead - atomic_load(&DMARing.Head));
                 }
+                else
+                    usleep(P2Config.StageIdleWait);
+                continue;
             }
             //
-            // P2 packet sending complete.There are no DDC buffers with enough data to send out.
-            // bring in more data by DMA if there is some, else sleep for a while and try again
-            // we have the same issue with DMA: a transfer isn't exactly aligned to the amount we can read out 
-            // according to the DDC settings. So we either need to have the part-used DDC transfer variables
-            // persistent across DMAs, or we need to recognise an incomplete fragment of a frame as such
-            // and copy it like we do with IQ data so the next readout begins at a new frame
-            // the latter approach seems easier!
+            // find the transfer size that meets the latency target. Recalculated only if
+            // the DDC rates or the target change.
             //
-            Depth = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
-
-            if((StartupCount == 0) && FIFOOverThreshold)
+            if ((GetP2DDCRateWord() != TargetRateWord) || (DDCTargetLatency != TargetLatency))
             {
-                GlobalFIFOOverflows |= 0b00000001;
-                if(UseDebug)
-                    printf("RX DDC FIFO Overthreshold, depth now = %d\n", Current);
+                TargetRateWord = GetP2DDCRateWord();
+                TargetLatency = DDCTargetLatency;
+                TargetTransferSize = DDCTargetTransferSize(TargetRateWord);
+                TargetByteRate = DDCByteRate(TargetRateWord);
+                if (UseDebug)
+                    printf("DDC DMA target size = %d bytes\n", TargetTransferSize);
+            }
+            if (ShortRead)
+            {
+                //
+                // one call reads the FIFO depth and, if it holds at least the target size,
+                // all of it up to the ring space. Else sleep until it should.
+                //
+                MaxRead = RingBytesFree(&DMARing);
+                if (MaxRead > VMAXDDCDMASIZE)
+                    MaxRead = VMAXDDCDMASIZE;
+                if (MaxRead < TargetTransferSize)
+                {
+                    usleep(P2Config.StageIdleWait);                 // wait for the demux stage
+                    continue;
+                }
+                StageMark(&Profiler);
+                DMAStartTime = TelemetryTimestamp();
+                HeartbeatDMA(eBeatDDCDMA, eBeatDMARead, TargetTransferSize, 0);
+                Result = ReadFIFOAvailableDMA(eRXDDCDMA, Engine.fd, RingWritePtr(&DMARing), TargetTransferSize, MaxRead,
+                                              VMINDDCDMASIZE, VADDRDDCSTREAMREAD, &DMATransferSize,
+                                              &Engine.FIFOOverflow, &Engine.FIFOOverThreshold, &Engine.FIFOUnderflow, &Engine.Current);
+                if (Result != 0)
+                {
+                    HeartbeatError(eBeatDDCDMA, -Result);
+                    if (!StallRestartRequested(eBeatDDCDMA))
+                        DMAResult = Result;
+                    break;
+                }
+                NoteStreamFIFO(&Engine);
+                NoteDDCFIFOStatus(&Engine, true);
+                NoteDDCStreamPosition(Engine.Current, DMAStartTime);      // depth read as the transfer started
+                if (DMATransferSize == 0)
+                {
+                    HeartbeatDMA(eBeatDDCDMA, eBeatFIFOWait, TargetTransferSize, Engine.Current);
+                    Wait = (TargetByteRate != 0) ? (uint64_t)(TargetTransferSize - Engine.Current * 8U) * 1000000 / TargetByteRate : 0;
+                    if (Wait < P2Config.StageIdleWait)
+                        Wait = P2Config.StageIdleWait;
+                    else if (Wait > VFIFOWAITTIMEOUT)
+                        Wait = VFIFOWAITTIMEOUT;
+                    usleep((useconds_t)Wait);
+                    StageEnd(&Profiler, eStageDDCFIFOWait, 0);
+                    continue;
+                }
+                CommitDDCDMA(DMATransferSize);
+                TelemetryCountDMA(eTelDDCDMA, DMATransferSize);
+                Trace(eTraceDDCDMA, DMATransferSize, Engine.Current);
+                TelemetryLoopTime(eTelDDCDMA, DMAStartTime);
+                StageEnd(&Profiler, eStageDDCDMA, DMATransferSize);
+                continue;
             }
-// note this could often generate a message at low sample rate because we deliberately read it down to zero.
-// this isn't a problem as we can send the data on without the code becoming blocked. so not a useful trap.
-//            if((StartupCount == 0) && FIFOUnderflow)
-//                 printf("RX DDC FIFO Underflowed, depth now = %d\n", Current);
             //		printf("read: depth = %d\n", Depth);
-            while(Depth < (DMATransferSize/8U))			// 8 bytes per location
+            //
+            // words already requested by a queued DMA may not have left the FIFO yet,
+            // so don't count them as available.
+            // if a DMA is queued and there isn't enough for another, wait for it to finish instead.
+            //
+            StageMark(&Profiler);
+            Available = (Depth > DDCDMAPendingBytes/8U) ? Depth - DDCDMAPendingBytes/8U : 0;
+            if (DDCDMAInFlight != 0)
             {
-                usleep(500);								// 1ms wait
-                Depth = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
-                if((StartupCount == 0) && FIFOOverThreshold)
+                if ((DDCDMAInFlight == VDDCDMAINFLIGHT) || (Available < (TargetTransferSize/8U)))
                 {
-                    GlobalFIFOOverflows |= 0b00000001;
-                    if(UseDebug)
-                        printf("RX DDC FIFO Overthreshold, depth now = %d\n", Current);
+                    DMAResult = CollectDDCDMA();
+                    continue;
                 }
-//                if((StartupCount == 0) && FIFOUnderflow)
-//                    printf("RX DDC FIFO Underflowed, depth now = %d\n", Current);
+            }
+            else while((Available < (TargetTransferSize/8U)) && StreamRunActive(Run))	// 8 bytes per location
+            {
+                Available = WaitStreamFIFO(&Engine, TargetTransferSize/8U, VFIFOWAITTIMEOUT);	// wait for FIFO Depth
+                NoteDDCFIFOStatus(&Engine, false);
              }
 //            printf("DDC DMA read %d bytes from destination to base\n", DMATransferSize);
-            if(Depth > 4096)
-                DMATransferSize = 32768;
-            else if(Depth > 2048)
-                DMATransferSize = 16384;
-            else if(Depth > 1024)
-                DMATransferSize = 8192;
-            else
-                DMATransferSize = 4096;
+            //
+            // normally read the target size; if there is a backlog, read all of it (up to the max)
+            //
+            DMATransferSize = ((Available * 8U) / VMINDDCDMASIZE) * VMINDDCDMASIZE;
+            if (DMATransferSize < TargetTransferSize)
+                DMATransferSize = TargetTransferSize;
+            else if (DMATransferSize > VMAXDDCDMASIZE)
+                DMATransferSize = VMAXDDCDMASIZE;
+            StageEnd(&Profiler, eStageDDCFIFOWait, DMATransferSize);
 
-            DMAReadFromFPGA(IQReadfile_fd, DMAHeadPtr, DMATransferSize, VADDRDDCSTREAMREAD);
-            DMAHeadPtr += DMATransferSize;
             //
-            // find header: may not be the 1st word
+            // wait for the demux stage if the ring is too full to take the DMA
             //
-//            DumpMemoryBuffer(DMAReadPtr, DMATransferSize);
-            if(HeaderFound == false)                                                    // 1st time: look for header
-                for(Cntr=16; Cntr < (DMAHeadPtr - DMAReadPtr); Cntr+=8)                  // search for rate word; ignoring 1st
-                {
-                    if(*(DMAReadPtr + Cntr + 7) == 0x80)
-                    {
-//                        printf("found header at offset=%x\n", Cntr);
-                        HeaderFound = true;
-                        DMAReadPtr += Cntr;                                             // point read buffer where header is 
-                        break;
-                    }
-                }
-            if (HeaderFound == false)                                        // if rate flag not set
+            while((RingBytesFree(&DMARing) < (DDCDMAPendingBytes + DMATransferSize)) && StreamRunActive(Run)
+                  && !StallRestartRequested(eBeatDDCDMA))
             {
-//                printf("Rate word not found when expected. rate= %08x\n", RateWord);
-                InitError = true;
-                exit(1);
+                Heartbeat(eBeatDDCDMA, eBeatRunning);
+                usleep(P2Config.StageIdleWait);
             }
-
-
-            //
-            // finally copy data to DMA buffers according to the embedded DDC rate words
-            // the 1st word is pointed by DMAReadPtr and it should point to a DDC rate word
-            // search for it if not!
-            // (it should always be left in that state).
-            // the top half of the 1st 64 bit word should be 0x8000
-            // and that is located in the 2nd 32 bit location.
-            // assume that DMA is > 1 frame.
-//            printf("headptr = %x readptr = %x\n", DMAHeadPtr, DMAReadPtr);
-            DecodeByteCount = DMAHeadPtr - DMAReadPtr;
-            while (DecodeByteCount >= 16)                       // minimum size to try!
+            if(!StreamRunActive(Run) || StallRestartRequested(eBeatDDCDMA))
+                break;
+            StageMark(&Profiler);
+            if (DDCAsyncDMA)
             {
-                if(*(DMAReadPtr + 7) != 0x80)
-                {
-                    printf("header not found for rate word at addr %x\n", DMAReadPtr);
-                    exit(1);
-                }
-                else                                                                    // analyse word, then process
+                //
+                // queue the transfer to the ring space after any already queued
+                //
+                Slot = (DDCDMAOldest + DDCDMAInFlight) % VDDCDMAINFLIGHT;
+                DDCDMASize[Slot] = DMATransferSize;
+                DDCDMADone[Slot] = false;
+                DDCDMAStart[Slot] = TelemetryTimestamp();
+                HeartbeatDMA(eBeatDDCDMA, eBeatDMARead, DMATransferSize, Available);
+                if (DMAAsyncSubmitRead(&DDCDMAContext, Slot, RingWritePtr(&DMARing) + DDCDMAPendingBytes,
+                                       DMATransferSize, VADDRDDCSTREAMREAD))
                 {
-                    LongWordPtr = (uint32_t*)DMAReadPtr;                            // get 32 bit ptr
-                    RateWord = *LongWordPtr;                                      // read rate word
-
-                    if (RateWord != PrevRateWord)
-                    {
-                        FrameLength = AnalyseDDCHeader(RateWord, &DDCCounts[0]);           // read new settings
-//                        printf("new framelength = %d\n", FrameLength);
-                        PrevRateWord = RateWord;                                        // so so we know its analysed
-                    }
-                    if (DecodeByteCount >= ((FrameLength+1) * 8))             // if bytes for header & frame
-                    {
-                        //THEN COPY DMA DATA TO I / Q BUFFERS
-                        DMAReadPtr += 8;                                                // point to 1st location past rate word
-                        SrcWordPtr = (uint16_t*)DMAReadPtr;                             // read sample data in 16 bit chunks
-                        for (DDC = 0; DDC < VNUMDDC; DDC++)
-                        {
-                            HdrWord = DDCCounts[DDC];                                   // number of words for this DDC. reuse variable
-                            if (HdrWord != 0)
-                            {
-                                DestWordPtr = (uint16_t *)IQHeadPtr[DDC];
-                                for (Cntr = 0; Cntr < HdrWord; Cntr++)                  // count 64 bit words
-                                {
-                                    *DestWordPtr++ = *SrcWordPtr++;                     // move 48 bits of sample data
-                                    *DestWordPtr++ = *SrcWordPtr++;
-                                    *DestWordPtr++ = *SrcWordPtr++;
-                                    SrcWordPtr++;                                       // and skip 16 bits where theres no data
-                                }
-                                IQHeadPtr[DDC] += 6 * HdrWord;                          // 6 bytes per sample
-                            }
-                            // read N samples; write at head ptr
-                        }
-                        DMAReadPtr += FrameLength * 8;                                  // that's how many bytes we read out
-                        DecodeByteCount -= (FrameLength+1) * 8;
-                    }
-                    else
-                        break;                                                          // if not enough left, exit loop
+                    DMAResult = -EIO;
+                    break;
                 }
+                DDCDMAInFlight++;
+                DDCDMAPendingBytes += DMATransferSize;
+                TelemetryCountDMA(eTelDDCDMA, DMATransferSize);
+                Trace(eTraceDDCDMA, DMATransferSize, Engine.Current);
             }
-            //
-            // now copy any residue to the start of the buffer (before the data copy in point)
-            // unless the buffer already starts at or below the base
-            // if we do a copy, the 1st free location is always base addr
-            //
-            ResidueBytes = DMAHeadPtr - DMAReadPtr;
-            //		printf("Residue = %d bytes\n",ResidueBytes);
-            if (DMAReadPtr > DMABasePtr)                                // move data down
+            else
             {
-                if (ResidueBytes != 0) 		// if there is residue to move
+                DMAStartTime = TelemetryTimestamp();
+                HeartbeatDMA(eBeatDDCDMA, eBeatDMARead, DMATransferSize, Available);
+                Result = DMAReadFromFPGA(Engine.fd, RingWritePtr(&DMARing), DMATransferSize, VADDRDDCSTREAMREAD);
+                if (Result != 0)
                 {
-                    memcpy(DMABasePtr - ResidueBytes, DMAReadPtr, ResidueBytes);
-                    DMAReadPtr = DMABasePtr - ResidueBytes;
+                    //
+                    // no data: the engine and FIFO are reset once the pipeline has stopped,
+                    // unless the read was interrupted by the stall detector, which restarts it anyway
+                    //
+                    HeartbeatError(eBeatDDCDMA, -Result);
+                    if (!StallRestartRequested(eBeatDDCDMA))
+                        DMAResult = Result;
+                    break;
                 }
-                else
-                    DMAReadPtr = DMABasePtr;
-                DMAHeadPtr = DMABasePtr;                            // ready for new data at base
+                CommitDDCDMA(DMATransferSize);
+                TelemetryCountDMA(eTelDDCDMA, DMATransferSize);
+                Trace(eTraceDDCDMA, DMATransferSize, Engine.Current);
+                TelemetryLoopTime(eTelDDCDMA, DMAStartTime);
             }
+            StageEnd(&Profiler, eStageDDCDMA, DMATransferSize);
         }     // end of while(!InitError) loop
+        //
+        // collect any queued transfers; the FIFO held their data when they were queued
+        //
+        while (DDCDMAInFlight != 0)
+            if ((Result = CollectDDCDMA()) != 0)
+            {
+                if (DMAResult == 0)
+                    DMAResult = Result;
+                break;
+            }
+        //
+        // stop the pipeline stages
+        //
+        DDCPipelineRun = false;
+        if (DDCSenderPerDDC)
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+                eventfd_write(DDCWakeFd[DDC], 1);           // don't wait for the timeout
+        pthread_join(DemuxThread, NULL);
+        StopVirtualDDCs();
+        StopDDCShm();
+        for (Sender = 0; Sender < SendersRunning; Sender++)
+            pthread_join(SenderThreads[Sender], NULL);
+        if (!DDCStreamActive)
+            SetRXDDCEnabled(false);                         // stop filling the FIFO until the next run
+        //
+        // after a failed DMA, reset the engine and the FIFO. The pipeline then starts
+        // again as after any FIFO reset: the demux finds the framing from the first rate word.
+        //
+        if (DMAResult != 0)
+        {
+            if (DDCAsyncDMA)
+                DMAAsyncClose(&DDCDMAContext);
+            if (RecoverStreamDMA(&Engine, DMAResult))
+                InitError = true;
+            else if (DDCAsyncDMA)
+                DDCAsyncDMA = !DMAAsyncInit(&DDCDMAContext, Engine.fd, VDDCDMAINFLIGHT);
+        }
+        //
+        // an error from interrupting a stalled thread doesn't end the thread:
+        // the DDC FIFO is reset and the pipeline started again
+        //
+        StallRestart = StallRestartRequested(eBeatDDCDMA);
+        ClearStallRestart(eBeatDDCDMA);
+        if (DDCPipelineError && !StallRestart)
+            InitError = true;
+        if(UseDebug && (atomic_load(&DDCSendCalls) != 0))
+        {
+            printf("DDC I/Q: %d packets sent in %d sendmmsg calls (%.1f per call); %d samples discarded\n",
+                   atomic_load(&DDCPacketsSent), atomic_load(&DDCSendCalls),
+                   (float)atomic_load(&DDCPacketsSent) / (float)atomic_load(&DDCSendCalls),
+                   atomic_load(&DDCSamplesDiscarded));
+            printf("DDC I/Q: first packet %.1f ms after the run started\n",
+                   (atomic_load(&DDCFirstPacketTime) - DDCRunStartTime) / 1000.0);
+        }
+        RestartPipeline = !InitError && StreamRunActive(Run) && (atomic_load(&IQRingsTooSmall) || StallRestart || (DMAResult != 0));
+        if (!RestartPipeline)
+            StreamThreadStopped();
     }
 
 //
 // tidy shutdown of the thread
 //
     printf("shutting down DDC outgoing thread\n");
-    close(ThreadData->Socketid); 
+    StageProfilerStop(&Profiler);
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if (DDCWakeFd[DDC] >= 0)
+            close(DDCWakeFd[DDC]);
+    RegisterStreamThread(false);
+    if (DDCAsyncDMA)
+        DMAAsyncClose(&DDCDMAContext);
+    close(ThreadData->Socketid);
     ThreadData->Active = false;                   // signal closed
+    CloseDDCCapture();
+    CloseVirtualDDCs();
+    StopDDCRecorder();
+    CloseDDCShm();
     FreeDynamicMemory();
+    if (DDCStreamActive)
+        DMAStreamStop(Engine.fd);                           // after the ring is unmapped
+    HeartbeatStop(eBeatDDCDMA);
     return NULL;
 }
 
@@ -601,13 +2771,13 @@ void *OutgoingDDCIQ(void *arg)
 
 //
 // interface calls to get commands from PC settings
-// sample rate, DDC enabled and interleaved are all signalled through the socket 
+// sample rate, DDC enabled and interleaved are all signalled through the socket
 // data structure
 //
 // the meanings are:
 // enabled - the DDC sends data in its own right
 // interleaved - can be set for "even" DDCs; the next higher odd DDC also has its data routed
-// through here. That DDC is NOT enabled. 
+// through here. That DDC is NOT enabled.
 //
 
 
@@ -615,6 +2785,7 @@ void *OutgoingDDCIQ(void *arg)
 // HandlerCheckDDCSettings()
 // called when DDC settings have been changed. Check which DDCs are enabled, and sample rate.
 // arguably don't need this, as it finds out from the embedded data in the DDC stream
+// (the demux makes or grows a DDC's I/Q ring where its new rate starts in the stream)
 //
 void HandlerCheckDDCSettings(void)
 {
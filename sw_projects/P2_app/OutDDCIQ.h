@@ -19,10 +19,20 @@
 
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include "../common/saturntypes.h"
 
 
 #define VDDCPACKETSIZE 1444             // each DDC I/Qpacket
+#define VMAXDDCBATCH 64                 // max DDC packets sent per sendmmsg() call
+#define VDEFAULTDDCBATCH 32             // default DDC packets per sendmmsg() call
+#define VDEFAULTDDCLATENCY 2000         // default DDC DMA latency target, us
+#define VMAXDDCSUBSCRIBERS 4            // extra destinations each DDC stream can be sent to
+#define VDDCPACEOFF 0                   // ddc_pace settings: packets sent as soon as made
+#define VDDCPACEFQ 1                    // departure times on CLOCK_MONOTONIC, for the fq qdisc
+#define VDDCPACEETF 2                   // departure times on CLOCK_TAI, for the etf qdisc
+#define VDEFAULTDDCPACELEAD 200         // us from making a packet to its earliest departure
+#define VMAXDDCJUMBO 6                  // ddc_jumbo: most standard packets' samples in one jumbo packet
 
 
 //
@@ -31,11 +41,119 @@
 void *OutgoingDDCIQ(void *arg);
 
 
+//
+// SetDDCSendBatchSize(uint32_t Size)
+// set the max number of DDC packets for one DDC sent by a single sendmmsg() call
+// clipped to 1...VMAXDDCBATCH. Takes effect when the SDR is next started.
+//
+void SetDDCSendBatchSize(uint32_t Size);
+
+
+//
+// GetDDCSendStatistics(uint32_t* Packets, uint32_t* Calls)
+// return the number of DDC packets sent, and the number of sendmmsg() calls used
+// for the current (or last) run of the SDR
+//
+void GetDDCSendStatistics(uint32_t* Packets, uint32_t* Calls);
+
+
+//
+// SetDDCSenderThreads(uint32_t Count)
+// set the number of DDC sender threads, 1...VNUMDDC. Takes effect when the SDR is next started.
+// 0 gives a sender per DDC that sleeps until the demux has a packet for it, so a low
+// rate DDC never holds up a high rate one. Must be set before the DDC thread starts.
+//
+void SetDDCSenderThreads(uint32_t Count);
+
+
+//
+// SetDDCTargetLatency(uint32_t Microseconds)
+// set how much DDC data (in time) to collect before a DMA transfer is made.
+// the transfer size follows the DDC sample rates, from 512 bytes to 32KB; a backlog
+// is read in larger transfers. Can be changed while running.
+//
+void SetDDCTargetLatency(uint32_t Microseconds);
+
+
+//
+// AddDDCSubscriber(char* Setting)
+// add an extra destination for DDC data, as "address:port" or "address:port:mask".
+// bit n of the mask selects DDC n; with no mask all DDCs are sent. The address can be
+// a multicast group. Packets still go to the client that started the SDR; each is
+// built once and sent to every destination in the same sendmmsg() call.
+// Takes effect when the SDR is next started. Return true if error.
+//
+bool AddDDCSubscriber(char* Setting);
+
+
+//
+// IsDDCShedding(void)
+// true while the DDC engine is overloaded and the DDCs in ddc_low_priority are being
+// dropped so the others keep their continuity
+//
+bool IsDDCShedding(void);
+
+
+//
+// GetDiversityStatus(struct DiversityStatus* Status)
+// the diversity combiner's state: whether it is combining, which DDCs, and the
+// secondary weight in use (the fixed one, or the adaptive one as it is now)
+//
+struct DiversityStatus
+{
+    bool Active;
+    uint32_t Primary;
+    uint32_t Secondary;
+    float Gain;
+    float Phase;                                            // degrees
+    uint64_t Samples;                                       // samples combined
+};
+
+void GetDiversityStatus(struct DiversityStatus* Status);
+
+
+//
+// SendDDCPacket(uint32_t DDC, struct iovec* Iovecs, uint32_t Count)
+// send one packet, gathered from Count iovecs, on a DDC's port to the client and
+// any subscribers. Only while the DDC pipeline is running. Return true if error.
+//
+bool SendDDCPacket(uint32_t DDC, struct iovec* Iovecs, uint32_t Count);
+
+
+//
+// SetDDCPipelineCores(int ReaderCore, int DemuxCore, int SenderCore)
+// set the CPU core each DDC pipeline stage runs on; -1 = let the scheduler choose
+// all sender threads share SenderCore. Set before the DDC thread is started.
+// the DDC DMA completion interrupt is steered to ReaderCore too, if the driver allows.
+//
+void SetDDCPipelineCores(int ReaderCore, int DemuxCore, int SenderCore);
+
+
+//
+// GetDDCSequenceState(uint32_t* Sequence, uint64_t* SampleCount)
+// ResumeDDCSequence(const uint32_t* Sequence, const uint64_t* SampleCount)
+// the sequence number and sample count of each DDC's next packet (VNUMDDC of each),
+// read once the DDC stream has stopped. After a resume the next run carries on from
+// them instead of from 0: for a p2app taking over from another (see handover.h).
+//
+void GetDDCSequenceState(uint32_t* Sequence, uint64_t* SampleCount);
+void ResumeDDCSequence(const uint32_t* Sequence, const uint64_t* SampleCount);
+
+
 //
 // interface calls to get commands from PC settings
 //
 
 
+//
+// SetDDCStreamRing(bool Enabled)
+// if true, the DDC data is read through the xdma driver's C2H streaming ring rather than
+// one read per transfer. Falls back to read() if the driver doesn't support it.
+// Set before the DDC thread is started.
+//
+void SetDDCStreamRing(bool Enabled);
+
+
 //
 // HandlerCheckDDCSettings()
 // called when DDC settings have been changed. Check which DDCs are enabled, and sample rate.
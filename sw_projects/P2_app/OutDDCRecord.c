@@ -0,0 +1,673 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutDDCRecord.c:
+//
+// record DDC I/Q streams to local disc, as SigMF files
+//
+// one thread records all the selected DDCs. Samples are converted from the
+// ring's 24 bit big endian words to 32 bit little endian (SigMF has no 24 bit
+// type; "ci32_le", the sample in the top 24 bits) into 1MB staging blocks, and
+// each full block is queued as one O_DIRECT write. Samples that were lost (by
+// the recorder, or before the DDC rings) start a new SigMF capture segment,
+// whose core:global_index is the DDC packet sample number.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include "OutDDCRecord.h"
+#include "OutDDCShm.h"
+#include "threadplacement.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "../common/saturnregisters.h"
+#include "../common/ddcshm.h"
+
+
+#define VRECORDBLOCK 1048576                        // bytes per staging block and disc write
+#define VRECORDALIGN 4096                           // O_DIRECT buffer, offset and size alignment
+#define VRECORDSPAREBLOCKS 4                        // blocks in flight beyond one per DDC
+#define VRECORDMAXCAPTURES 256                      // capture segments per file; then a new file
+#define VRECORDINSAMPLEBYTES 6
+#define VRECORDOUTSAMPLEBYTES 8
+
+
+//
+// one capture segment: where the samples are continuous
+//
+struct RecordCapture
+{
+    uint64_t SampleStart;                           // sample in the file
+    uint64_t GlobalIndex;                           // DDC sample number
+};
+
+
+//
+// a DDC being recorded
+//
+struct RecordFile
+{
+    int Fd;                                         // -1 if no file open
+    bool Failed;                                    // write error: stop until the next run
+    uint32_t Generation;                            // DDC run being recorded
+    uint32_t SampleRate;                            // KHz
+    int32_t Block;                                  // staging block being filled; -1 if none
+    uint32_t BlockUsed;
+    uint32_t InFlight;                              // writes queued
+    uint64_t FileBytes;                             // bytes written or queued
+    uint64_t Samples;                               // samples in the file
+    uint64_t NextSample;                            // DDC sample number expected next
+    uint64_t Missing;                               // samples lost from the file
+    uint64_t Dropped;                               // of those, lost by the recorder
+    uint64_t CursorLost;                            // Cursor.SamplesLost already counted
+    uint32_t CaptureCount;
+    struct RecordCapture Captures[VRECORDMAXCAPTURES];
+    time_t StartTime;
+    char Stem[256];                                 // path without the .sigmf-data
+    struct DDCShmCursor Cursor;
+};
+
+
+struct RecordBlock
+{
+    uint8_t* Buffer;
+    int32_t Owner;                                  // DDC; -1 if free
+};
+
+
+//
+// io_uring, set up by hand: a submission and completion queue for writes only
+//
+struct RecordUring
+{
+    int Fd;                                         // -1 if not available: pwrite() is used
+    uint32_t Entries;
+    _Atomic uint32_t* SQHead;
+    _Atomic uint32_t* SQTail;
+    uint32_t SQMask;
+    uint32_t* SQArray;
+    struct io_uring_sqe* SQEs;
+    _Atomic uint32_t* CQHead;
+    _Atomic uint32_t* CQTail;
+    uint32_t CQMask;
+    struct io_uring_cqe* CQEs;
+    void* SQRing;
+    void* CQRing;
+    size_t SQRingSize;
+    size_t CQRingSize;
+    size_t SQEsSize;
+};
+
+
+char RecordDirectory[200];
+uint32_t RecordMask;                                // DDCs to record; 0 if not set
+uint64_t RecordFileBytes;                           // file size limit, a multiple of VRECORDBLOCK
+
+struct RecordFile RecordFiles[VNUMDDC];
+struct RecordBlock* RecordBlocks;
+uint32_t RecordBlockCount;
+struct RecordUring RecordUring = {.Fd = -1};
+struct DDCShmClient RecordClient;
+uint32_t RecordFileCount;                           // files opened, for the file names
+
+pthread_t RecordThreadId;
+volatile bool RecordRun;
+
+
+//
+// parse the setting
+//
+bool SetDDCRecording(char* Setting)
+{
+    char* Comma;
+    unsigned int Mask = 1;
+    unsigned int MB = VDEFAULTRECORDFILEMB;
+    struct stat Info;
+
+    Comma = strchr(Setting, ',');
+    if (Comma != NULL)
+    {
+        if ((sscanf(Comma + 1, "%i,%u", &Mask, &MB) < 1) || (MB == 0))
+        {
+            printf("error parsing DDC recording %s: must be directory[,mask[,MB]]\n", Setting);
+            return true;
+        }
+        *Comma = 0;
+    }
+    if ((stat(Setting, &Info) != 0) || !S_ISDIR(Info.st_mode) || (access(Setting, W_OK) != 0))
+    {
+        printf("DDC recording: %s is not a writable directory\n", Setting);
+        return true;
+    }
+    if ((Mask & ((1 << VNUMDDC) - 1)) == 0)
+    {
+        printf("DDC recording: mask 0x%x selects no DDCs\n", Mask);
+        return true;
+    }
+    strncpy(RecordDirectory, Setting, sizeof(RecordDirectory) - 1);
+    RecordMask = Mask & ((1 << VNUMDDC) - 1);
+    RecordFileBytes = (uint64_t)MB * 1048576;
+    RecordFileBytes -= RecordFileBytes % VRECORDBLOCK;
+    if (RecordFileBytes == 0)
+        RecordFileBytes = VRECORDBLOCK;
+    printf("DDC recording to %s: DDC mask 0x%03x, %uMB files\n", RecordDirectory, RecordMask, MB);
+    return false;
+}
+
+
+bool IsDDCRecordingSet(void)
+{
+    return RecordMask != 0;
+}
+
+
+//
+// set up the io_uring. Return true if not available.
+//
+static bool OpenRecordUring(uint32_t Entries)
+{
+    struct io_uring_params Params;
+    struct RecordUring* R = &RecordUring;
+    uint8_t* SQ;
+    uint8_t* CQ;
+
+    memset(&Params, 0, sizeof(Params));
+    R->Fd = syscall(__NR_io_uring_setup, Entries, &Params);
+    if (R->Fd < 0)
+        return true;
+    R->Entries = Params.sq_entries;
+    R->SQRingSize = Params.sq_off.array + Params.sq_entries * sizeof(uint32_t);
+    R->CQRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+    if (Params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (R->CQRingSize > R->SQRingSize)
+            R->SQRingSize = R->CQRingSize;
+        R->CQRingSize = R->SQRingSize;
+    }
+    R->SQRing = mmap(NULL, R->SQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, R->Fd, IORING_OFF_SQ_RING);
+    if (Params.features & IORING_FEAT_SINGLE_MMAP)
+        R->CQRing = R->SQRing;
+    else
+        R->CQRing = mmap(NULL, R->CQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, R->Fd, IORING_OFF_CQ_RING);
+    R->SQEsSize = Params.sq_entries * sizeof(struct io_uring_sqe);
+    R->SQEs = mmap(NULL, R->SQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, R->Fd, IORING_OFF_SQES);
+    if ((R->SQRing == MAP_FAILED) || (R->CQRing == MAP_FAILED) || (R->SQEs == MAP_FAILED))
+    {
+        if (R->SQEs != MAP_FAILED)
+            munmap(R->SQEs, R->SQEsSize);
+        if ((R->CQRing != MAP_FAILED) && (R->CQRing != R->SQRing))
+            munmap(R->CQRing, R->CQRingSize);
+        if (R->SQRing != MAP_FAILED)
+            munmap(R->SQRing, R->SQRingSize);
+        close(R->Fd);
+        R->Fd = -1;
+        return true;
+    }
+    SQ = (uint8_t*)R->SQRing;
+    CQ = (uint8_t*)R->CQRing;
+    R->SQHead = (_Atomic uint32_t*)(SQ + Params.sq_off.head);
+    R->SQTail = (_Atomic uint32_t*)(SQ + Params.sq_off.tail);
+    R->SQMask = *(uint32_t*)(SQ + Params.sq_off.ring_mask);
+    R->SQArray = (uint32_t*)(SQ + Params.sq_off.array);
+    R->CQHead = (_Atomic uint32_t*)(CQ + Params.cq_off.head);
+    R->CQTail = (_Atomic uint32_t*)(CQ + Params.cq_off.tail);
+    R->CQMask = *(uint32_t*)(CQ + Params.cq_off.ring_mask);
+    R->CQEs = (struct io_uring_cqe*)(CQ + Params.cq_off.cqes);
+    return false;
+}
+
+
+static void CloseRecordUring(void)
+{
+    struct RecordUring* R = &RecordUring;
+
+    if (R->Fd < 0)
+        return;
+    munmap(R->SQEs, R->SQEsSize);
+    if (R->CQRing != R->SQRing)
+        munmap(R->CQRing, R->CQRingSize);
+    munmap(R->SQRing, R->SQRingSize);
+    close(R->Fd);
+    R->Fd = -1;
+}
+
+
+//
+// a write has finished
+//
+static void RecordWriteDone(uint32_t Block, int Result)
+{
+    uint32_t DDC = RecordBlocks[Block].Owner;
+    struct RecordFile* File = RecordFiles + DDC;
+
+    RecordBlocks[Block].Owner = -1;
+    File->InFlight--;
+    if ((Result != VRECORDBLOCK) && !File->Failed)
+    {
+        printf("DDC%d recording: write error (%s); stopped until the next run\n",
+               DDC, (Result < 0) ? strerror(-Result) : "short write");
+        File->Failed = true;
+    }
+}
+
+
+//
+// collect finished writes. If Wait, wait for at least one (if any are queued).
+//
+static void ReapRecordWrites(bool Wait)
+{
+    struct RecordUring* R = &RecordUring;
+    struct io_uring_cqe* CQE;
+    uint32_t Head, Tail, DDC, InFlight = 0;
+
+    if (R->Fd < 0)
+        return;                                             // pwrite() finishes at once
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        InFlight += RecordFiles[DDC].InFlight;
+    if (InFlight == 0)
+        return;
+    Head = atomic_load_explicit(R->CQHead, memory_order_relaxed);
+    Tail = atomic_load_explicit(R->CQTail, memory_order_acquire);
+    if (Wait && (Head == Tail))
+    {
+        syscall(__NR_io_uring_enter, R->Fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        Tail = atomic_load_explicit(R->CQTail, memory_order_acquire);
+    }
+    while (Head != Tail)
+    {
+        CQE = R->CQEs + (Head & R->CQMask);
+        RecordWriteDone((uint32_t)CQE->user_data, CQE->res);
+        Head++;
+    }
+    atomic_store_explicit(R->CQHead, Head, memory_order_release);
+}
+
+
+//
+// queue the write of a staging block at an offset in a file
+//
+static void QueueRecordWrite(struct RecordFile* File, uint32_t Block, uint64_t Offset)
+{
+    struct RecordUring* R = &RecordUring;
+    struct io_uring_sqe* SQE;
+    uint32_t Tail, Index;
+    ssize_t Result;
+
+    File->InFlight++;
+    if (R->Fd < 0)
+    {
+        Result = pwrite(File->Fd, RecordBlocks[Block].Buffer, VRECORDBLOCK, Offset);
+        RecordWriteDone(Block, (Result < 0) ? -errno : (int)Result);
+        return;
+    }
+    Tail = atomic_load_explicit(R->SQTail, memory_order_relaxed);
+    Index = Tail & R->SQMask;
+    SQE = R->SQEs + Index;
+    memset(SQE, 0, sizeof(struct io_uring_sqe));
+    SQE->opcode = IORING_OP_WRITE;
+    SQE->fd = File->Fd;
+    SQE->addr = (uint64_t)(uintptr_t)RecordBlocks[Block].Buffer;
+    SQE->len = VRECORDBLOCK;
+    SQE->off = Offset;
+    SQE->user_data = Block;
+    R->SQArray[Index] = Index;
+    atomic_store_explicit(R->SQTail, Tail + 1, memory_order_release);
+    if (syscall(__NR_io_uring_enter, R->Fd, 1, 0, 0, NULL, 0) != 1)
+    {
+        atomic_store_explicit(R->SQTail, Tail, memory_order_relaxed);       // not taken: write it now
+        Result = pwrite(File->Fd, RecordBlocks[Block].Buffer, VRECORDBLOCK, Offset);
+        RecordWriteDone(Block, (Result < 0) ? -errno : (int)Result);
+    }
+}
+
+
+//
+// get a free staging block for a DDC, waiting for a write to finish if need be
+// return true if none
+//
+static bool GetRecordBlock(uint32_t DDC)
+{
+    uint32_t Block, Tries;
+
+    for (Tries = 0; Tries < 100; Tries++)
+    {
+        for (Block = 0; Block < RecordBlockCount; Block++)
+            if (RecordBlocks[Block].Owner < 0)
+            {
+                RecordBlocks[Block].Owner = DDC;
+                RecordFiles[DDC].Block = Block;
+                RecordFiles[DDC].BlockUsed = 0;
+                return false;
+            }
+        ReapRecordWrites(true);
+    }
+    return true;
+}
+
+
+//
+// write the SigMF metadata for a file
+//
+static void WriteRecordMeta(uint32_t DDC, struct RecordFile* File)
+{
+    char Path[272];
+    char Date[32];
+    FILE* Meta;
+    uint32_t Cntr;
+
+    snprintf(Path, sizeof(Path), "%s.sigmf-meta", File->Stem);
+    Meta = fopen(Path, "w");
+    if (Meta == NULL)
+    {
+        printf("DDC%d recording: can't write %s\n", DDC, Path);
+        return;
+    }
+    strftime(Date, sizeof(Date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&File->StartTime));
+    fprintf(Meta, "{\n  \"global\": {\n");
+    fprintf(Meta, "    \"core:datatype\": \"ci32_le\",\n");
+    fprintf(Meta, "    \"core:sample_rate\": %u,\n", File->SampleRate * 1000);
+    fprintf(Meta, "    \"core:version\": \"1.0.0\",\n");
+    fprintf(Meta, "    \"core:num_channels\": 1,\n");
+    fprintf(Meta, "    \"core:hw\": \"Saturn DDC%d\",\n", DDC);
+    fprintf(Meta, "    \"core:recorder\": \"p2app\",\n");
+    fprintf(Meta, "    \"core:description\": \"24 bit DDC samples in the top 24 bits of each word\",\n");
+    fprintf(Meta, "    \"core:extensions\": [{\"name\": \"p2app\", \"version\": \"1.0.0\", \"optional\": true}],\n");
+    fprintf(Meta, "    \"p2app:samples_missing\": %llu,\n", (unsigned long long)File->Missing);
+    fprintf(Meta, "    \"p2app:samples_dropped_by_recorder\": %llu\n", (unsigned long long)File->Dropped);
+    fprintf(Meta, "  },\n  \"captures\": [\n");
+    for (Cntr = 0; Cntr < File->CaptureCount; Cntr++)
+    {
+        fprintf(Meta, "    {\"core:sample_start\": %llu, \"core:global_index\": %llu",
+                (unsigned long long)File->Captures[Cntr].SampleStart, (unsigned long long)File->Captures[Cntr].GlobalIndex);
+        if (Cntr == 0)
+            fprintf(Meta, ", \"core:datetime\": \"%s\"", Date);
+        fprintf(Meta, "}%s\n", (Cntr + 1 < File->CaptureCount) ? "," : "");
+    }
+    fprintf(Meta, "  ],\n  \"annotations\": []\n}\n");
+    fclose(Meta);
+}
+
+
+//
+// finish a file: wait for its writes, write the last part block, then the metadata
+//
+static void CloseRecordFile(uint32_t DDC)
+{
+    struct RecordFile* File = RecordFiles + DDC;
+    struct RecordBlock* Block;
+    uint32_t Padded;
+
+    if (File->Fd < 0)
+        return;
+    while (File->InFlight != 0)
+        ReapRecordWrites(true);
+    if (File->Block >= 0)
+    {
+        Block = RecordBlocks + File->Block;
+        if ((File->BlockUsed != 0) && !File->Failed)
+        {
+            Padded = (File->BlockUsed + VRECORDALIGN - 1) & ~(VRECORDALIGN - 1);
+            memset(Block->Buffer + File->BlockUsed, 0, Padded - File->BlockUsed);
+            if ((pwrite(File->Fd, Block->Buffer, Padded, File->FileBytes) != (ssize_t)Padded)
+                || (ftruncate(File->Fd, File->FileBytes + File->BlockUsed) != 0))
+                printf("DDC%d recording: error writing the end of %s.sigmf-data\n", DDC, File->Stem);
+        }
+        Block->Owner = -1;
+        File->Block = -1;
+    }
+    close(File->Fd);
+    File->Fd = -1;
+    WriteRecordMeta(DDC, File);
+    printf("DDC%d recording: %s.sigmf-data closed, %llu samples, %llu missing (%llu dropped by the recorder)\n",
+           DDC, File->Stem, (unsigned long long)File->Samples, (unsigned long long)File->Missing,
+           (unsigned long long)File->Dropped);
+}
+
+
+//
+// start a file. Its first sample is DDC sample number SampleNumber.
+// return true if error
+//
+static bool OpenRecordFile(uint32_t DDC, uint32_t SampleRate, uint64_t SampleNumber)
+{
+    struct RecordFile* File = RecordFiles + DDC;
+    char Date[32];
+    char Path[272];
+
+    File->StartTime = time(NULL);
+    strftime(Date, sizeof(Date), "%Y%m%dT%H%M%SZ", gmtime(&File->StartTime));
+    snprintf(File->Stem, sizeof(File->Stem), "%s/ddc%d-%s-%04u", RecordDirectory, DDC, Date, RecordFileCount++);
+    snprintf(Path, sizeof(Path), "%s.sigmf-data", File->Stem);
+    File->Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+    if ((File->Fd < 0) && (errno == EINVAL))
+    {
+        File->Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (File->Fd >= 0)
+            printf("DDC%d recording: no O_DIRECT on this file system; writing through the page cache\n", DDC);
+    }
+    if (File->Fd < 0)
+    {
+        printf("DDC%d recording: can't create %s (%s); stopped until the next run\n", DDC, Path, strerror(errno));
+        File->Failed = true;
+        return true;
+    }
+    File->SampleRate = SampleRate;
+    File->FileBytes = 0;
+    File->Samples = 0;
+    File->Missing = 0;
+    File->Dropped = 0;
+    File->NextSample = SampleNumber;
+    File->Captures[0].SampleStart = 0;
+    File->Captures[0].GlobalIndex = SampleNumber;
+    File->CaptureCount = 1;
+    return false;
+}
+
+
+//
+// 24 bit big endian I/Q words to 32 bit little endian
+//
+static void ConvertRecordSamples(uint8_t* Dest, const uint8_t* Src, uint32_t Samples)
+{
+    uint32_t* Out = (uint32_t*)Dest;
+    uint32_t Count;
+
+    for (Count = 0; Count < 2 * Samples; Count++)
+    {
+        *Out++ = ((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8);
+        Src += 3;
+    }
+}
+
+
+//
+// record what is waiting for one DDC
+// return true if any samples were read
+//
+static bool RecordDDC(uint32_t DDC)
+{
+    struct RecordFile* File = RecordFiles + DDC;
+    const struct DDCShmChannel* Channel = &RecordClient.Control->DDC[DDC];
+    const uint8_t* Samples;
+    uint32_t Generation, Bytes, Count, SampleRate;
+    uint64_t SampleNumber;
+
+    Generation = atomic_load_explicit((_Atomic uint32_t*)&Channel->Generation, memory_order_acquire);
+    if (Generation != File->Generation)
+    {
+        CloseRecordFile(DDC);                               // the run has stopped, or a new one begun
+        File->Generation = Generation;
+        File->Failed = false;
+        File->CursorLost = File->Cursor.SamplesLost;
+    }
+    if (File->Failed)
+    {
+        CloseRecordFile(DDC);
+        return false;
+    }
+    Bytes = ReadDDCShm(&RecordClient, DDC, &File->Cursor, &Samples);
+    if (Bytes == 0)
+        return false;
+    SampleRate = atomic_load_explicit((_Atomic uint32_t*)&Channel->SampleRate, memory_order_relaxed);
+    if ((File->Fd >= 0) && (SampleRate != File->SampleRate))
+        CloseRecordFile(DDC);                               // a file has one rate
+    if (GetDDCShmSampleNumber(&RecordClient, DDC, File->Cursor.Position, &SampleNumber))
+        SampleNumber = File->NextSample;                    // no mark: take it as continuous
+    File->Dropped += File->Cursor.SamplesLost - File->CursorLost;
+    File->CursorLost = File->Cursor.SamplesLost;
+    if (File->Fd < 0)
+    {
+        if (OpenRecordFile(DDC, SampleRate, SampleNumber))
+            return false;
+    }
+    else if (SampleNumber != File->NextSample)
+    {
+        if (File->CaptureCount == VRECORDMAXCAPTURES)
+        {
+            CloseRecordFile(DDC);                           // segment list full: start another file
+            if (OpenRecordFile(DDC, SampleRate, SampleNumber))
+                return false;
+        }
+        else
+        {
+            if (SampleNumber > File->NextSample)
+                File->Missing += SampleNumber - File->NextSample;
+            File->Captures[File->CaptureCount].SampleStart = File->Samples;
+            File->Captures[File->CaptureCount++].GlobalIndex = SampleNumber;
+            File->NextSample = SampleNumber;
+        }
+    }
+    if ((File->Block < 0) && GetRecordBlock(DDC))
+        return false;
+
+    Count = Bytes / VRECORDINSAMPLEBYTES;
+    if (Count > (VRECORDBLOCK - File->BlockUsed) / VRECORDOUTSAMPLEBYTES)
+        Count = (VRECORDBLOCK - File->BlockUsed) / VRECORDOUTSAMPLEBYTES;
+    ConvertRecordSamples(RecordBlocks[File->Block].Buffer + File->BlockUsed, Samples, Count);
+    if (ReleaseDDCShm(&RecordClient, DDC, &File->Cursor, Count * VRECORDINSAMPLEBYTES))
+    {
+        File->Dropped += Count;                             // overwritten while converted: a gap
+        return true;
+    }
+    File->BlockUsed += Count * VRECORDOUTSAMPLEBYTES;
+    File->Samples += Count;
+    File->NextSample += Count;
+    if (File->BlockUsed == VRECORDBLOCK)
+    {
+        QueueRecordWrite(File, File->Block, File->FileBytes);
+        File->FileBytes += VRECORDBLOCK;
+        File->Block = -1;
+        if (File->FileBytes >= RecordFileBytes)
+            CloseRecordFile(DDC);                           // the next samples start a new file
+    }
+    return true;
+}
+
+
+//
+// recorder thread: woken by the demux thread after each pass
+//
+static void *DDCRecordThread(__attribute__((unused)) void *arg)
+{
+    uint32_t DDC;
+    bool Busy;
+
+    while (RecordRun)
+    {
+        Busy = false;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if (RecordMask & (1 << DDC))
+                Busy |= RecordDDC(DDC);
+        ReapRecordWrites(false);
+        if (!Busy)
+            WaitDDCShm(&RecordClient, 50);
+    }
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        CloseRecordFile(DDC);
+    return NULL;
+}
+
+
+//
+// allocate the staging blocks, set up io_uring and start the thread
+//
+bool StartDDCRecorder(void)
+{
+    uint32_t DDC, Block;
+
+    if (RecordMask == 0)
+        return false;
+    if (OpenLocalDDCShmClient(&RecordClient))
+    {
+        printf("DDC recording: the DDC rings can't be read\n");
+        return true;
+    }
+    RecordBlockCount = __builtin_popcount(RecordMask) + VRECORDSPAREBLOCKS;
+    RecordBlocks = calloc(RecordBlockCount, sizeof(struct RecordBlock));
+    for (Block = 0; (RecordBlocks != NULL) && (Block < RecordBlockCount); Block++)
+    {
+        RecordBlocks[Block].Owner = -1;
+        if (posix_memalign((void**)&RecordBlocks[Block].Buffer, VRECORDALIGN, VRECORDBLOCK) != 0)
+        {
+            RecordBlockCount = Block;
+            StopDDCRecorder();
+            printf("DDC recording: no memory for staging blocks\n");
+            return true;
+        }
+    }
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        memset(RecordFiles + DDC, 0, sizeof(struct RecordFile));
+        RecordFiles[DDC].Fd = -1;
+        RecordFiles[DDC].Block = -1;
+    }
+    if (OpenRecordUring(RecordBlockCount))
+        printf("DDC recording: io_uring not available (errno=%d); using pwrite()\n", errno);
+    RecordRun = true;
+    if (pthread_create(&RecordThreadId, NULL, DDCRecordThread, NULL) != 0)
+    {
+        printf("DDC recorder thread create failed\n");
+        RecordRun = false;
+        StopDDCRecorder();
+        return true;
+    }
+    SetThreadName(RecordThreadId, "DDC recorder");
+    return false;
+}
+
+
+void StopDDCRecorder(void)
+{
+    uint32_t Block;
+
+    if (RecordRun)
+    {
+        RecordRun = false;
+        pthread_join(RecordThreadId, NULL);
+    }
+    CloseRecordUring();
+    for (Block = 0; (RecordBlocks != NULL) && (Block < RecordBlockCount); Block++)
+        free(RecordBlocks[Block].Buffer);
+    free(RecordBlocks);
+    RecordBlocks = NULL;
+    RecordBlockCount = 0;
+    CloseLocalDDCShmClient(&RecordClient);
+}
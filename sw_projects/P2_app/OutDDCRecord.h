@@ -0,0 +1,68 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutDDCRecord.h:
+//
+// header: record DDC I/Q streams to local disc, as SigMF files
+//
+// the recorder is an in-process shared memory client (OutDDCShm.h): it reads
+// the per-DDC rings after the demux thread, so it never holds up the DMA,
+// demux or sender threads. If it falls more than a ring behind (a slow disc)
+// it loses samples, and they are counted; ddc_dma_buffer sets the margin.
+// each DDC run goes to a new file, opened when samples arrive, and a file is
+// closed and the next one started when it reaches the size limit.
+// the data is written in large aligned blocks with O_DIRECT, through io_uring
+// (or pwrite() if the kernel has no io_uring), so it does not fill the page cache.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __OutDDCRecord_h
+#define __OutDDCRecord_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VDEFAULTRECORDFILEMB 1024                   // MB per file before a new file is started
+
+
+//
+// SetDDCRecording(char* Setting)
+// record DDCs to files in a directory. Setting is "directory[,mask[,MB]]":
+// bit n of mask selects DDC n (default DDC0); MB is the file size limit.
+// files are <directory>/ddc<n>-<UTC date & time>-<count>.sigmf-data, with a
+// .sigmf-meta file written when each is closed.
+// Takes effect when the DDC thread starts. Return true if error.
+//
+bool SetDDCRecording(char* Setting);
+
+
+//
+// IsDDCRecordingSet(void)
+// true if SetDDCRecording() has been called
+//
+bool IsDDCRecordingSet(void);
+
+
+//
+// StartDDCRecorder(void)
+// start the recorder thread, after OpenDDCShm(). Return true if error.
+//
+bool StartDDCRecorder(void);
+
+
+//
+// StopDDCRecorder(void)
+// finish and close any files being written, before CloseDDCShm()
+//
+void StopDDCRecorder(void);
+
+
+#endif
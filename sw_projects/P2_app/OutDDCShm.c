@@ -0,0 +1,449 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutDDCShm.c:
+//
+// shared memory DDC transport: the p2app side
+//
+// the DDC rings are already slices of a memfd (the stream buffer arena), so
+// a client is given a read only fd of it and the rings' offsets, and maps
+// them itself. p2app never waits for a client; a listener thread accepts
+// and drops clients, and the demux thread only writes the control block
+// and (once per pass) each client's eventfd.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include "OutDDCShm.h"
+#include "p2config.h"
+#include "threadplacement.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include "../common/saturnregisters.h"
+#include "../common/bufferarena.h"
+#include "../common/ddcshm.h"
+
+
+#define VMAXSHMCLIENTS 8
+#define VSHMMARKINTERVAL 0x40000000                 // ring bytes between marks, so positions never wrap
+#define VDDCSHMSAMPLEBYTES 6
+
+
+struct DDCShmControl* ShmControl;                   // mapped read/write here; NULL if not open
+int ShmControlFd = -1;                              // read only fds given to clients
+int ShmBufferFd = -1;
+int ShmListenSocket = -1;
+const struct SPSCRingBuffer* ShmRings;              // the DDC rings, for an in-process client
+int ShmLocalEventFd = -1;                           // the in-process client's eventfd
+
+int ShmClientSockets[VMAXSHMCLIENTS];               // -1 if slot free
+int ShmClientEventFds[VMAXSHMCLIENTS];
+_Atomic uint32_t ShmClientCount;
+pthread_mutex_t ShmClientMutex = PTHREAD_MUTEX_INITIALIZER;
+
+pthread_t ShmListenThreadId;
+volatile bool ShmListenRun;
+bool ShmNotifyPending;                              // demux thread: samples written this pass
+
+uint32_t ShmLastMarkPosition[VNUMDDC];              // demux thread: newest mark of each DDC
+uint64_t ShmLastMarkSample[VNUMDDC];
+
+
+//
+// open an fd read only on the same file as Fd
+//
+static int ReopenReadOnly(int Fd)
+{
+    char Path[64];
+
+    snprintf(Path, sizeof(Path), "/proc/self/fd/%d", Fd);
+    return open(Path, O_RDONLY | O_CLOEXEC);
+}
+
+
+//
+// add a mark: the sample number at a ring position
+//
+static void AddShmMark(uint32_t DDC, uint32_t Position, uint64_t SampleNumber)
+{
+    struct DDCShmChannel* Channel = ShmControl->DDC + DDC;
+    uint32_t Sequence = atomic_load_explicit(&Channel->MarkCount, memory_order_relaxed);
+    struct DDCShmMark* Mark = Channel->Marks + ((Sequence / 2) % VDDCSHMMARKS);
+
+    //
+    // the count is odd while the mark is written (a seqlock), so a reader can tell
+    // if a mark it read was being replaced
+    //
+    atomic_store_explicit(&Channel->MarkCount, Sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    Mark->Position = Position;
+    Mark->SampleNumber = SampleNumber;
+    atomic_store_explicit(&Channel->MarkCount, Sequence + 2, memory_order_release);
+    ShmLastMarkPosition[DDC] = Position;
+    ShmLastMarkSample[DDC] = SampleNumber;
+}
+
+
+//
+// send a new client its file descriptors
+// return true if error
+//
+static bool AddShmClient(int Socket)
+{
+    struct msghdr Msg;
+    struct iovec Iov;
+    struct cmsghdr* Cmsg;
+    union
+    {
+        char Buffer[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr Align;
+    } Control;
+    uint32_t Version = VDDCSHMVERSION;
+    int Fds[3];
+    uint32_t Slot;
+
+    for (Slot = 0; Slot < VMAXSHMCLIENTS; Slot++)
+        if (ShmClientSockets[Slot] < 0)
+            break;
+    if (Slot == VMAXSHMCLIENTS)
+    {
+        printf("local DDC client refused: %d clients already\n", VMAXSHMCLIENTS);
+        return true;
+    }
+    Fds[0] = ShmControlFd;
+    Fds[1] = ShmBufferFd;
+    Fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (Fds[2] < 0)
+        return true;
+    memset(&Msg, 0, sizeof(Msg));
+    memset(&Control, 0, sizeof(Control));
+    Iov.iov_base = &Version;
+    Iov.iov_len = sizeof(Version);
+    Msg.msg_iov = &Iov;
+    Msg.msg_iovlen = 1;
+    Msg.msg_control = Control.Buffer;
+    Msg.msg_controllen = sizeof(Control.Buffer);
+    Cmsg = CMSG_FIRSTHDR(&Msg);
+    Cmsg->cmsg_level = SOL_SOCKET;
+    Cmsg->cmsg_type = SCM_RIGHTS;
+    Cmsg->cmsg_len = CMSG_LEN(sizeof(Fds));
+    memcpy(CMSG_DATA(Cmsg), Fds, sizeof(Fds));
+    if (sendmsg(Socket, &Msg, MSG_NOSIGNAL) != sizeof(Version))
+    {
+        close(Fds[2]);
+        return true;
+    }
+    pthread_mutex_lock(&ShmClientMutex);
+    ShmClientSockets[Slot] = Socket;
+    ShmClientEventFds[Slot] = Fds[2];
+    ShmClientCount++;
+    pthread_mutex_unlock(&ShmClientMutex);
+    printf("local DDC client %d connected\n", Slot);
+    return false;
+}
+
+
+static void RemoveShmClient(uint32_t Slot)
+{
+    pthread_mutex_lock(&ShmClientMutex);
+    close(ShmClientSockets[Slot]);
+    close(ShmClientEventFds[Slot]);
+    ShmClientSockets[Slot] = -1;
+    ShmClientEventFds[Slot] = -1;
+    ShmClientCount--;
+    pthread_mutex_unlock(&ShmClientMutex);
+    printf("local DDC client %d disconnected\n", Slot);
+}
+
+
+//
+// listener thread: accept clients, and notice when they go. Clients never send
+// anything, so a client socket becoming readable means it has closed.
+//
+static void *DDCShmListenThread(__attribute__((unused)) void *arg)
+{
+    struct pollfd PollFds[VMAXSHMCLIENTS + 1];
+    uint32_t Slots[VMAXSHMCLIENTS + 1];
+    uint32_t Count, Slot, Cntr;
+    int Socket;
+
+    while (ShmListenRun)
+    {
+        PollFds[0].fd = ShmListenSocket;
+        PollFds[0].events = POLLIN;
+        Count = 1;
+        for (Slot = 0; Slot < VMAXSHMCLIENTS; Slot++)
+            if (ShmClientSockets[Slot] >= 0)
+            {
+                PollFds[Count].fd = ShmClientSockets[Slot];
+                PollFds[Count].events = POLLIN;
+                Slots[Count++] = Slot;
+            }
+        if (poll(PollFds, Count, 500) <= 0)
+            continue;
+        for (Cntr = 1; Cntr < Count; Cntr++)
+            if (PollFds[Cntr].revents & (POLLIN | POLLHUP | POLLERR))
+                RemoveShmClient(Slots[Cntr]);
+        if (PollFds[0].revents & POLLIN)
+        {
+            Socket = accept4(ShmListenSocket, NULL, NULL, SOCK_CLOEXEC);
+            if ((Socket >= 0) && AddShmClient(Socket))
+                close(Socket);
+        }
+    }
+    return NULL;
+}
+
+
+//
+// make the control block and the listening socket
+//
+bool OpenDDCShm(const struct SPSCRingBuffer* Rings, bool InProcess)
+{
+    struct sockaddr_un Addr;
+    void* Mapping;
+    int Fd;
+    uint32_t DDC, Slot;
+
+    if ((P2Config.DDCShm == VDDCSHMOFF) && !InProcess)
+        return false;
+    for (Slot = 0; Slot < VMAXSHMCLIENTS; Slot++)
+        ShmClientSockets[Slot] = ShmClientEventFds[Slot] = -1;
+    Fd = memfd_create("saturn-ddc-control", MFD_CLOEXEC);
+    if ((Fd < 0) || (ftruncate(Fd, sizeof(struct DDCShmControl)) != 0))
+    {
+        printf("DDC shared memory: control block could not be made\n");
+        if (Fd >= 0)
+            close(Fd);
+        return true;
+    }
+    Mapping = mmap(NULL, sizeof(struct DDCShmControl), PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+    ShmControlFd = ReopenReadOnly(Fd);
+    ShmBufferFd = ReopenReadOnly(StreamArena.fd);
+    close(Fd);                                                  // the mapping keeps it
+    if ((Mapping == MAP_FAILED) || (ShmControlFd < 0) || (ShmBufferFd < 0))
+    {
+        printf("DDC shared memory: buffers could not be shared\n");
+        CloseDDCShm();
+        if (Mapping != MAP_FAILED)
+            munmap(Mapping, sizeof(struct DDCShmControl));
+        return true;
+    }
+    ShmControl = (struct DDCShmControl*)Mapping;
+    ShmRings = Rings;
+    ShmControl->Magic = VDDCSHMMAGIC;
+    ShmControl->Version = VDDCSHMVERSION;
+    ShmControl->NumDDC = VNUMDDC;
+    ShmControl->PageSize = StreamArena.PageSize;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        ShmControl->DDC[DDC].RingSize = Rings[DDC].Size;
+        ShmControl->DDC[DDC].RingOffset = Rings[DDC].FileOffset;
+    }
+    if (P2Config.DDCShm == VDDCSHMOFF)
+        return false;                                           // in-process reader only
+
+    ShmListenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    strncpy(Addr.sun_path + 1, VDDCSHMSOCKETNAME, sizeof(Addr.sun_path) - 2);      // abstract name: leading 0
+    if ((ShmListenSocket < 0)
+        || (bind(ShmListenSocket, (struct sockaddr*)&Addr, offsetof(struct sockaddr_un, sun_path) + 1 + strlen(VDDCSHMSOCKETNAME)) != 0)
+        || (listen(ShmListenSocket, VMAXSHMCLIENTS) != 0))
+    {
+        printf("DDC shared memory: can't listen on @%s (errno=%d)\n", VDDCSHMSOCKETNAME, errno);
+        CloseDDCShm();
+        return true;
+    }
+    ShmListenRun = true;
+    if (pthread_create(&ShmListenThreadId, NULL, DDCShmListenThread, NULL) != 0)
+    {
+        printf("DDC shared memory listener thread create failed\n");
+        ShmListenRun = false;
+        CloseDDCShm();
+        return true;
+    }
+    SetThreadName(ShmListenThreadId, "DDC shm listen");
+    printf("DDC shared memory: local clients can connect to @%s\n", VDDCSHMSOCKETNAME);
+    return false;
+}
+
+
+//
+// the in-process client: the control block and rings as they are here
+//
+bool OpenLocalDDCShmClient(struct DDCShmClient* Client)
+{
+    memset(Client, 0, sizeof(struct DDCShmClient));
+    Client->Socket = Client->ControlFd = Client->BufferFd = Client->EventFd = -1;
+    if ((ShmControl == NULL) || (ShmLocalEventFd >= 0))
+        return true;
+    ShmLocalEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ShmLocalEventFd < 0)
+        return true;
+    Client->EventFd = ShmLocalEventFd;
+    Client->Control = ShmControl;
+    memcpy(Client->Rings, ShmRings, sizeof(Client->Rings));    // Base set, so ReadDDCShm() maps nothing
+    return false;
+}
+
+
+void CloseLocalDDCShmClient(struct DDCShmClient* Client)
+{
+    if (ShmLocalEventFd >= 0)
+        close(ShmLocalEventFd);
+    ShmLocalEventFd = -1;
+    memset(Client, 0, sizeof(struct DDCShmClient));
+    Client->Socket = Client->ControlFd = Client->BufferFd = Client->EventFd = -1;
+}
+
+
+//
+// new run: the rings have been reset
+//
+void StartDDCShm(void)
+{
+    struct DDCShmChannel* Channel;
+    uint32_t DDC;
+
+    if (ShmControl == NULL)
+        return;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Channel = ShmControl->DDC + DDC;
+        atomic_store(&Channel->Head, 0);
+        atomic_store(&Channel->WriteLimit, 0);
+        atomic_store(&Channel->SampleRate, 0);
+        atomic_store(&Channel->MarkCount, 0);
+        AddShmMark(DDC, 0, 0);
+        atomic_fetch_add_explicit(&Channel->Generation, 1, memory_order_release);    // odd: running
+    }
+    ShmNotifyPending = false;
+}
+
+
+void DDCShmWriteStart(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t Bytes)
+{
+    if (ShmControl == NULL)
+        return;
+    atomic_store_explicit(&ShmControl->DDC[DDC].WriteLimit,
+                          atomic_load_explicit(&Ring->Head, memory_order_relaxed) + Bytes, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);                  // seen before any of the data is written
+}
+
+
+void DDCShmWriteDone(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t RateKHz)
+{
+    struct DDCShmChannel* Channel;
+    uint32_t Head;
+
+    if (ShmControl == NULL)
+        return;
+    Channel = ShmControl->DDC + DDC;
+    Head = atomic_load_explicit(&Ring->Head, memory_order_relaxed);
+    if ((Head - ShmLastMarkPosition[DDC]) >= VSHMMARKINTERVAL)
+        AddShmMark(DDC, Head, ShmLastMarkSample[DDC] + (Head - ShmLastMarkPosition[DDC]) / VDDCSHMSAMPLEBYTES);
+    if (atomic_load_explicit(&Channel->SampleRate, memory_order_relaxed) != RateKHz)
+        atomic_store_explicit(&Channel->SampleRate, RateKHz, memory_order_relaxed);
+    atomic_store_explicit(&Channel->Head, Head, memory_order_release);
+    ShmNotifyPending = true;
+}
+
+
+void DDCShmGap(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t Samples)
+{
+    uint32_t Head;
+
+    if (ShmControl == NULL)
+        return;
+    Head = atomic_load_explicit(&Ring->Head, memory_order_relaxed);
+    AddShmMark(DDC, Head, ShmLastMarkSample[DDC] + (Head - ShmLastMarkPosition[DDC]) / VDDCSHMSAMPLEBYTES + Samples);
+}
+
+
+//
+// wake the clients. If the listener is changing the client list, they are woken next pass.
+//
+void NotifyDDCShm(void)
+{
+    uint32_t Slot;
+
+    if (!ShmNotifyPending)
+        return;
+    if (ShmLocalEventFd >= 0)
+        eventfd_write(ShmLocalEventFd, 1);
+    if (ShmClientCount == 0)
+    {
+        ShmNotifyPending = false;
+        return;
+    }
+    if (pthread_mutex_trylock(&ShmClientMutex) != 0)
+        return;
+    for (Slot = 0; Slot < VMAXSHMCLIENTS; Slot++)
+        if (ShmClientEventFds[Slot] >= 0)
+            eventfd_write(ShmClientEventFds[Slot], 1);
+    pthread_mutex_unlock(&ShmClientMutex);
+    ShmNotifyPending = false;
+}
+
+
+void StopDDCShm(void)
+{
+    uint32_t DDC;
+
+    if (ShmControl == NULL)
+        return;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        atomic_fetch_add_explicit(&ShmControl->DDC[DDC].Generation, 1, memory_order_release);    // even: stopped
+    ShmNotifyPending = true;
+    NotifyDDCShm();
+}
+
+
+//
+// stop listening and drop the clients
+//
+void CloseDDCShm(void)
+{
+    uint32_t Slot;
+
+    if ((ShmControl == NULL) && (ShmControlFd < 0) && (ShmBufferFd < 0) && (ShmListenSocket < 0))
+        return;                                                 // never opened
+    if (ShmListenRun)
+    {
+        ShmListenRun = false;
+        pthread_join(ShmListenThreadId, NULL);
+    }
+    for (Slot = 0; Slot < VMAXSHMCLIENTS; Slot++)
+        if (ShmClientSockets[Slot] >= 0)
+            RemoveShmClient(Slot);
+    if (ShmListenSocket >= 0)
+        close(ShmListenSocket);
+    if (ShmControlFd >= 0)
+        close(ShmControlFd);
+    if (ShmBufferFd >= 0)
+        close(ShmBufferFd);
+    if (ShmControl != NULL)
+        munmap(ShmControl, sizeof(struct DDCShmControl));
+    ShmListenSocket = ShmControlFd = ShmBufferFd = -1;
+    ShmControl = NULL;
+    ShmRings = NULL;
+}
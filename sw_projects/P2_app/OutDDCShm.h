@@ -0,0 +1,113 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutDDCShm.h:
+//
+// header: shared memory DDC transport for client programs on the Pi
+//
+// with setting ddc_shm, local programs can connect to a unix socket and read
+// the DDC I/Q rings in place (common/ddcshm.h has the layout and the client
+// side). The demux thread publishes each DDC's ring position and sample number
+// marks as it writes, and signals the clients once per pass.
+// ddc_shm=1 sends the DDC packets over UDP as well; ddc_shm=2 does not.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __OutDDCShm_h
+#define __OutDDCShm_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/ringbuffer.h"
+#include "../common/ddcshm.h"
+
+
+#define VDDCSHMOFF 0                            // ddc_shm settings
+#define VDDCSHMANDUDP 1
+#define VDDCSHMONLY 2
+
+
+//
+// OpenDDCShm(const struct SPSCRingBuffer* Rings, bool InProcess)
+// if ddc_shm is set: make the control block for the DDC rings (VNUMDDC of them,
+// from the stream buffer arena) and start listening for local clients.
+// InProcess makes the control block even if ddc_shm is not set, for an
+// in-process client (the recorder).
+// return true if error; the DDCs still run, over UDP.
+//
+bool OpenDDCShm(const struct SPSCRingBuffer* Rings, bool InProcess);
+
+
+//
+// OpenLocalDDCShmClient(struct DDCShmClient* Client)
+// set up a client in p2app itself: it reads the rings with the functions in
+// common/ddcshm.h, and WaitDDCShm() is woken as for other clients. One only.
+// return true if error (the control block was not made)
+//
+bool OpenLocalDDCShmClient(struct DDCShmClient* Client);
+
+
+//
+// CloseLocalDDCShmClient(struct DDCShmClient* Client)
+// before CloseDDCShm()
+//
+void CloseLocalDDCShmClient(struct DDCShmClient* Client);
+
+
+//
+// StartDDCShm(void)
+// at the start of a DDC pipeline run, after the rings are reset and before the demux starts
+//
+void StartDDCShm(void);
+
+
+//
+// DDCShmWriteStart(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t Bytes)
+// demux thread: about to write Bytes at the ring write pointer
+//
+void DDCShmWriteStart(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t Bytes);
+
+
+//
+// DDCShmWriteDone(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t RateKHz)
+// demux thread: the write has been committed. RateKHz is the stream's sample rate.
+//
+void DDCShmWriteDone(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t RateKHz);
+
+
+//
+// DDCShmGap(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t Samples)
+// demux thread: Samples were lost at the ring write pointer
+//
+void DDCShmGap(uint32_t DDC, const struct SPSCRingBuffer* Ring, uint32_t Samples);
+
+
+//
+// NotifyDDCShm(void)
+// demux thread: at the end of a pass, wake the clients if samples were written
+//
+void NotifyDDCShm(void);
+
+
+//
+// StopDDCShm(void)
+// at the end of a run, after the demux thread has stopped
+//
+void StopDDCShm(void);
+
+
+//
+// CloseDDCShm(void)
+// disconnect the clients and stop listening, when the DDC thread shuts down
+//
+void CloseDDCShm(void);
+
+
+#endif
@@ -0,0 +1,236 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutDDCSnapshot.c:
+//
+// triggered in-memory snapshot of the raw DDC DMA data
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include "OutDDCSnapshot.h"
+#include "threadplacement.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include "../common/ddccapture.h"
+
+
+static const char* TriggerNames[VNUMSNAPSHOTTRIGGERS] = {"none", "fifo", "resync", "adc", "signal"};
+
+static struct DDCCaptureRing SnapshotRing;          // Base is NULL if not set
+static char SnapshotPath[256];
+static uint32_t SnapshotTriggers;                   // bit n set if ESnapshotTrigger n is enabled
+static _Atomic uint32_t SnapshotTrigger = eSnapshotNone;   // trigger waiting to freeze the ring
+static atomic_bool SnapshotFrozen = false;          // true from freeze until the dump is written
+static uint32_t FrozenTrigger;                      // what froze it
+static time_t HoldoffUntil;                         // CLOCK_MONOTONIC s: triggers ignored until then
+static sem_t SnapshotDumpSem;                       // wakes the dump thread
+static pthread_t SnapshotThreadId;
+
+
+//
+// CLOCK_MONOTONIC seconds
+//
+static time_t MonotonicSeconds(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec;
+}
+
+
+//
+// write the frozen ring to the next file, then start it again empty
+//
+static void* DDCSnapshotThread(__attribute__((unused)) void *arg)
+{
+    char Path[300];
+    uint32_t Count = 0;
+    uint8_t* Ptr;
+    size_t Remaining;
+    ssize_t Written;
+    int Fd;
+
+    while (1)
+    {
+        if (sem_wait(&SnapshotDumpSem) != 0)
+            continue;                                       // EINTR
+        snprintf(Path, sizeof(Path), "%s.%u", SnapshotPath, Count++);
+        Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        Ptr = SnapshotRing.Base;
+        Remaining = SnapshotRing.Size;
+        while ((Fd >= 0) && (Remaining != 0))
+        {
+            Written = write(Fd, Ptr, Remaining);
+            if ((Written < 0) && (errno == EINTR))
+                continue;
+            if (Written <= 0)
+                break;
+            Ptr += Written;
+            Remaining -= Written;
+        }
+        if ((Fd < 0) || (Remaining != 0))
+            printf("DDC snapshot (%s): can't write %s (errno=%d)\n", TriggerNames[FrozenTrigger], Path, errno);
+        else
+            printf("DDC snapshot (%s) written to %s: %llu segments\n", TriggerNames[FrozenTrigger], Path,
+                   (unsigned long long)((SnapshotRing.Sequence < SnapshotRing.Segments) ? SnapshotRing.Sequence : SnapshotRing.Segments));
+        if (Fd >= 0)
+            close(Fd);
+        InitDDCCaptureRing(&SnapshotRing, SnapshotRing.Base, SnapshotRing.Segments);
+        HoldoffUntil = MonotonicSeconds() + VSNAPSHOTHOLDOFF;
+        atomic_store(&SnapshotTrigger, eSnapshotNone);
+        atomic_store_explicit(&SnapshotFrozen, false, memory_order_release);
+    }
+    return NULL;
+}
+
+
+static void SnapshotSignalHandler(int Signal)
+{
+    (void)Signal;
+    TriggerDDCSnapshot(eSnapshotSignal);
+}
+
+
+//
+// parse "fifo+resync+adc+signal" into a trigger mask. Return true if error
+//
+static bool ParseSnapshotTriggers(char* Names, uint32_t* Mask)
+{
+    char* Name;
+    char* Save;
+    uint32_t Trigger;
+
+    *Mask = 0;
+    for (Name = strtok_r(Names, "+", &Save); Name != NULL; Name = strtok_r(NULL, "+", &Save))
+    {
+        for (Trigger = eSnapshotNone + 1; Trigger < VNUMSNAPSHOTTRIGGERS; Trigger++)
+            if (strcmp(Name, TriggerNames[Trigger]) == 0)
+                break;
+        if (Trigger == VNUMSNAPSHOTTRIGGERS)
+            return true;
+        *Mask |= 1U << Trigger;
+    }
+    return (*Mask == 0);
+}
+
+
+//
+// allocate the ring with its pages faulted in, so the DMA reader doesn't page fault
+//
+bool SetDDCSnapshot(char* Setting)
+{
+    char Work[256];
+    char* Field;
+    char* Save;
+    unsigned int Segments = VDEFAULTSNAPSHOTSEGMENTS;
+    struct sigaction Action;
+    void* Map;
+
+    snprintf(Work, sizeof(Work), "%s", Setting);
+    Field = strtok_r(Work, ",", &Save);
+    if (Field == NULL)
+    {
+        printf("error parsing DDC snapshot setting %s: must be path[,segments[,triggers]]\n", Setting);
+        return true;
+    }
+    snprintf(SnapshotPath, sizeof(SnapshotPath), "%s", Field);
+    SnapshotTriggers = ~0U;
+    Field = strtok_r(NULL, ",", &Save);
+    if ((Field != NULL) && ((sscanf(Field, "%u", &Segments) != 1) || (Segments < 2)))
+    {
+        printf("error parsing DDC snapshot setting %s: 2 or more segments needed\n", Setting);
+        return true;
+    }
+    Field = strtok_r(NULL, ",", &Save);
+    if ((Field != NULL) && ParseSnapshotTriggers(Field, &SnapshotTriggers))
+    {
+        printf("error parsing DDC snapshot setting %s: triggers are fifo, resync, adc, signal joined by +\n", Setting);
+        return true;
+    }
+    Map = mmap(NULL, GetDDCCaptureSize(Segments), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (Map == MAP_FAILED)
+    {
+        printf("DDC snapshot: no memory for %u segments\n", Segments);
+        return true;
+    }
+    InitDDCCaptureRing(&SnapshotRing, (uint8_t*)Map, Segments);
+    sem_init(&SnapshotDumpSem, 0, 0);
+    if (pthread_create(&SnapshotThreadId, NULL, DDCSnapshotThread, NULL) != 0)
+    {
+        printf("DDC snapshot thread create failed\n");
+        munmap(Map, SnapshotRing.Size);
+        SnapshotRing.Base = NULL;
+        return true;
+    }
+    SetThreadName(SnapshotThreadId, "DDC snapshot");
+    if (SnapshotTriggers & (1U << eSnapshotSignal))
+    {
+        memset(&Action, 0, sizeof(Action));
+        sigemptyset(&Action.sa_mask);
+        Action.sa_handler = SnapshotSignalHandler;
+        Action.sa_flags = SA_RESTART;
+        if (sigaction(SIGUSR2, &Action, NULL) != 0)
+            printf("can't catch SIGUSR2 for the DDC snapshot\n");
+    }
+    printf("DDC snapshot: last %u segments (%zu bytes) of DDC DMA data kept, dumped to %s.<n>\n",
+           Segments, SnapshotRing.Size, SnapshotPath);
+    return false;
+}
+
+
+//
+// reader thread only. On a trigger the ring is left as it is and the dump
+// thread owns it until it clears SnapshotFrozen.
+//
+void SnapshotDDCData(uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth)
+{
+    uint32_t Trigger;
+
+    if ((SnapshotRing.Base == NULL) || atomic_load_explicit(&SnapshotFrozen, memory_order_acquire))
+        return;
+    Trigger = atomic_load_explicit(&SnapshotTrigger, memory_order_relaxed);
+    if (Trigger != eSnapshotNone)
+    {
+        if ((Trigger == eSnapshotSignal) || (MonotonicSeconds() >= HoldoffUntil))
+        {
+            FrozenTrigger = Trigger;
+            atomic_store(&SnapshotFrozen, true);
+            sem_post(&SnapshotDumpSem);
+            return;
+        }
+        atomic_store(&SnapshotTrigger, eSnapshotNone);  // in the holdoff after a dump
+    }
+    WriteDDCCaptureRecord(&SnapshotRing, Data, Bytes, RateWord, FIFODepth);
+}
+
+
+//
+// the first trigger since the last dump is the one reported
+//
+void TriggerDDCSnapshot(ESnapshotTrigger Trigger)
+{
+    uint32_t Expected = eSnapshotNone;
+
+    if ((SnapshotRing.Base == NULL) || !(SnapshotTriggers & (1U << Trigger)))
+        return;
+    atomic_compare_exchange_strong(&SnapshotTrigger, &Expected, (uint32_t)Trigger);
+}
@@ -0,0 +1,76 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutDDCSnapshot.h:
+//
+// header: triggered in-memory snapshot of the raw DDC DMA data
+//
+// a "black box": the DDC DMA reader copies each transfer, with its rate word
+// and FIFO depth, into a preallocated ring in memory, in the DDC capture file
+// layout (ddccapture.h), so it always holds the last few hundred milliseconds.
+// a trigger (a DDC FIFO overflow, a resync, an ADC overload or SIGUSR2) freezes
+// the ring at the next transfer, and a low priority thread writes it to a file
+// that -Z can replay. Recording starts again when the file is written. Triggers
+// other than SIGUSR2 are ignored for VSNAPSHOTHOLDOFF seconds after a dump, so
+// a burst of errors makes one file. Normal running costs one memcpy per DMA.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __OutDDCSnapshot_h
+#define __OutDDCSnapshot_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VDEFAULTSNAPSHOTSEGMENTS 8                  // 2MB: about 500ms of 2 DDCs at 192KHz
+#define VSNAPSHOTHOLDOFF 10                         // seconds after a dump before another trigger
+
+
+//
+// what froze a snapshot
+//
+typedef enum
+{
+    eSnapshotNone,
+    eSnapshotFIFOOverflow,                          // DDC FIFO over threshold
+    eSnapshotResync,                                // DDC stream lost its framing
+    eSnapshotADCOverload,                           // ADC overflow bit
+    eSnapshotSignal,                                // SIGUSR2 from the operator
+    VNUMSNAPSHOTTRIGGERS
+} ESnapshotTrigger;
+
+
+//
+// SetDDCSnapshot(char* Setting)
+// allocate the snapshot ring and start the dump thread. Setting is
+// "path[,segments[,triggers]]": each dump is written to path.<n>; segments are
+// 256KB each (default VDEFAULTSNAPSHOTSEGMENTS); triggers are names joined by +
+// (fifo, resync, adc, signal; default all). Return true if error.
+//
+bool SetDDCSnapshot(char* Setting);
+
+
+//
+// SnapshotDDCData(uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth)
+// DDC DMA reader: add one transfer to the ring, unless it is frozen.
+// a pending trigger freezes it first.
+//
+void SnapshotDDCData(uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth);
+
+
+//
+// TriggerDDCSnapshot(ESnapshotTrigger Trigger)
+// ask for the ring to be frozen and dumped. Any thread; signal safe.
+//
+void TriggerDDCSnapshot(ESnapshotTrigger Trigger);
+
+
+#endif
@@ -24,11 +24,84 @@
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 #include "../common/saturnregisters.h"
-#include "LDGATU.h"
+#include "../common/saturndrivers.h"
+#include "telemetry.h"
+#include "pcapcapture.h"
+#include "p2config.h"
+#include "heartbeat.h"
+#include "OutDDCSnapshot.h"
+#include "keyedges.h"
+#include "adcoverload.h"
 
 
-uint8_t GlobalFIFOOverflows = 0;             // FIFO overflow words
+_Atomic uint8_t GlobalFIFOOverflows = 0;     // FIFO overflow words
+
+//
+// wait for the next status poll tick
+// ticks come from a periodic timerfd, so the poll rate does not drift with the
+// time taken to read the status; if that could not be created, sleep instead.
+// with a key watch thread running, a key or PTT edge it sees ends the wait too,
+// and with an ADC overload watch running, the start of an overload
+//
+static void WaitStatusPollTick(int TimerFd)
+{
+  struct pollfd Fds[3];
+  uint64_t Count;
+  int KeyFd = GetKeyWatchFd();
+  int OverloadFd = GetADCOverloadFd();
+
+  if (TimerFd < 0)
+  {
+    usleep(P2Config.StatusPollPeriod);
+    return;
+  }
+  if ((KeyFd < 0) && (OverloadFd < 0))
+  {
+    if (read(TimerFd, &Count, sizeof(Count)) != sizeof(Count))
+      usleep(P2Config.StatusPollPeriod);
+    return;
+  }
+  Fds[0].fd = TimerFd;
+  Fds[0].events = POLLIN;
+  Fds[1].fd = KeyFd;                                  // poll ignores a negative fd
+  Fds[1].events = POLLIN;
+  Fds[2].fd = OverloadFd;
+  Fds[2].events = POLLIN;
+  if (poll(Fds, 3, -1) < 0)
+  {
+    usleep(P2Config.StatusPollPeriod);
+    return;
+  }
+  if (Fds[0].revents & POLLIN)
+    read(TimerFd, &Count, sizeof(Count));
+  if (Fds[1].revents & POLLIN)
+    read(KeyFd, &Count, sizeof(Count));
+  if (Fds[2].revents & POLLIN)
+    read(OverloadFd, &Count, sizeof(Count));
+}
+
+
+//
+// start the status poll ticks at the configured period
+// return the period set, so a change to the setting can be seen
+//
+static uint32_t StartStatusPollTicks(int TimerFd)
+{
+  struct itimerspec PollPeriod;
+  uint32_t Period = P2Config.StatusPollPeriod;
+
+  if (TimerFd >= 0)
+  {
+    PollPeriod.it_value.tv_sec = Period / 1000000;
+    PollPeriod.it_value.tv_nsec = (Period % 1000000) * 1000;
+    PollPeriod.it_interval = PollPeriod.it_value;
+    timerfd_settime(TimerFd, 0, &PollPeriod, NULL);
+  }
+  return Period;
+}
 
 
 
@@ -50,39 +123,40 @@ void *OutgoingHighPriority(void *arg)
   struct ThreadSocketData *ThreadData;            // socket etc data for this thread
   struct sockaddr_in DestAddr;                    // destination address for outgoing data
   bool InitError = false;
+  uint32_t Run = 0;                                         // stream run number
   int Error;
   uint8_t Byte;                                   // data being encoded
   uint16_t Word;                                  // data being encoded
-  bool ATUTuneRequest = false;
-  bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;      // FIFO flags
-  uint32_t Depth = 0;                                       // FIFO locations available
   uint8_t FIFOOverflows;
+  struct StatusSnapshot Status;                             // all status registers for one packet
+  int TimerFd;
+  uint32_t PollPeriod;                                      // status poll period the timer is set to, us
+  uint64_t LastSent;                                        // time last packet sent, us
+  uint64_t LastPoll, Now;                                   // time of the last status poll, us
+  uint32_t Period;                                          // required time between packets, us
 
 //
 // initialise. Create memory buffers and open DMA file devices
 //
   ThreadData = (struct ThreadSocketData *)arg;
   ThreadData->Active = true;
+  RegisterStreamThread(true);
   printf("spinning up outgoing high priority with port %d\n", ThreadData->Portid);
+  TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (TimerFd < 0)
+    perror("high priority status timer");
 
 //
 // OK, now the main work
-// thread commanded to transfer / stop transferring data by global bool SDRActive
+// thread commanded to transfer / stop transferring data by the stream state machine (SetSDRActive())
 // threat may also be commanded to close down and re-open its socket by command byte 
 // VBITCHANGEPORT bit being set (shold only happen when not running)
 //
+  HeartbeatStart(eBeatStatus);
   while (!InitError)
   {
-    while(!(SDRActive))
-    {
-      if(ThreadData->Cmdid & VBITCHANGEPORT)
-      {
-        close(ThreadData->Socketid);                      // close old socket, open new one
-        MakeSocket(ThreadData, 0);                        // this binds to the new port.
-        ThreadData->Cmdid &= ~VBITCHANGEPORT;             // clear command bit
-      }
-      usleep(100);
-    }
+    Heartbeat(eBeatStatus, eBeatIdle);
+    WaitForStreamStart(ThreadData, 1, true, &Run);
     //
     // if we get here, run has been initiated
     // initialise outgoing data packet
@@ -99,6 +173,7 @@ void *OutgoingHighPriority(void *arg)
     datagram.msg_iovlen = 1;
     datagram.msg_name = &DestAddr;                   // MAC addr & port to send to
     datagram.msg_namelen = sizeof(DestAddr);
+    PollPeriod = StartStatusPollTicks(TimerFd);
 
     //
     // this is the main loop. SDR is running. transfer data;
@@ -108,29 +183,32 @@ void *OutgoingHighPriority(void *arg)
     // when a DDC becomes enabled, its paired DDC may not know yet and may still be set to interleaved.
     // when a DDC is set to interleaved, the paired DDC may not have been disabled yet.
     //
-    while(SDRActive && !InitError)                               // main loop
+    while(StreamRunActive(Run) && !InitError)                    // main loop
     {
-      uint8_t SleepCount;                                       // counter for sending next message
       uint8_t PTTBits;                                          // PTT bits - and change means a new message needed
       // create the packet
       *(uint32_t *)UDPBuffer = htonl(SequenceCounter++);        // add sequence count
-      ReadStatusRegister();
+      ReadStatusSnapshot(&Status);                              // one scatter read of all status
+      TelemetryStatusSnapshot(&Status);                         // keep it for the metrics
+      NoteADCOverflow(Status.ADCOverflow, TelemetryTimestamp());
+      Byte = (uint8_t)TakeADCOverload();                        // overflows since the last packet, both readers
+      if(Byte)
+        TriggerDDCSnapshot(eSnapshotADCOverload);
       PTTBits = (uint8_t)GetP2PTTKeyInputs();
       *(uint8_t *)(UDPBuffer+4) = PTTBits;
-      Byte = (uint8_t)GetADCOverflow();
       *(uint8_t *)(UDPBuffer+5) = Byte;
-      Word = (uint16_t)GetAnalogueIn(4);
+      Word = (uint16_t)Status.Analogue[4];
       *(uint16_t *)(UDPBuffer+6) = htons(Word);                // exciter power
-      Word = (uint16_t)GetAnalogueIn(0);
+      Word = (uint16_t)Status.Analogue[0];
       *(uint16_t *)(UDPBuffer+14) = htons(Word);               // forward power
-      Word = (uint16_t)GetAnalogueIn(1);
+      Word = (uint16_t)Status.Analogue[1];
       *(uint16_t *)(UDPBuffer+22) = htons(Word);               // reverse power
-      Word = (uint16_t)GetAnalogueIn(5);
+      Word = (uint16_t)Status.Analogue[5];
       *(uint16_t *)(UDPBuffer+49) = htons(Word);               // supply voltage
 
-      Word = (uint16_t)GetAnalogueIn(2);
+      Word = (uint16_t)Status.Analogue[2];
       *(uint16_t *)(UDPBuffer+57) = htons(Word);               // AIN3 user_analog1
-      Word = (uint16_t)GetAnalogueIn(3);
+      Word = (uint16_t)Status.Analogue[3];
       *(uint16_t *)(UDPBuffer+55) = htons(Word);               // AIN4 user_analog2
 
       Byte = (uint8_t)GetUserIOBits();                  // user I/O bits
@@ -142,43 +220,48 @@ void *OutgoingHighPriority(void *arg)
 // and they are cleared by the data transfer reads of the monitor channel
 //
       FIFOOverflows = 0;
-      Depth = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Word);				// read the DDC FIFO Depth register
+      Word = Status.FIFOs[eRXDDCDMA].Current;                          // DDC FIFO Depth
       *(uint16_t *)(UDPBuffer+31) = htons(Word);                // DDC ssmples
-      if(FIFOOverThreshold)
+      if(Status.FIFOs[eRXDDCDMA].OverThreshold)
         FIFOOverflows |= 0b00000001;
 
-      Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Word);				// read the mic FIFO Depth register
-      Word = Word*4;                                            // 4 samples per FIFO location
+      Word = Status.FIFOs[eMicCodecDMA].Current*4;                     // 4 samples per FIFO location
       *(uint16_t *)(UDPBuffer+33) = htons(Word);                // mic samples
-      if(FIFOOverThreshold)
+      if(Status.FIFOs[eMicCodecDMA].OverThreshold)
         FIFOOverflows |= 0b00000010;
 
-      Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Word);				// read the DUC FIFO Depth register
-      Word = (Word*4)/3;                                        // 4/3 samples per FIFO location
+      Word = (Status.FIFOs[eTXDUCDMA].Current*4)/3;                    // 4/3 samples per FIFO location
       *(uint16_t *)(UDPBuffer+35) = htons(Word);                // DUC samples
-      if(FIFOUnderflow)
+      if(Status.FIFOs[eTXDUCDMA].Underflowed)
         FIFOOverflows |= 0b00000100;
 
-      Depth = ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Word);				// read the speaker FIFO Depth register
-      Word = Word*2;                                            // 2 samples per FIFO location
+      Word = Status.FIFOs[eSpkCodecDMA].Current*2;                     // 2 samples per FIFO location
       *(uint16_t *)(UDPBuffer+37) = htons(Word);                // speaker samples
-      if(FIFOUnderflow)
+      if(Status.FIFOs[eSpkCodecDMA].Underflowed)
         FIFOOverflows |= 0b00001000;
 
-      FIFOOverflows |= GlobalFIFOOverflows;                   // copy in any bits set during normal data transfer
+      // take and clear, in one step, any bits set during normal data transfer
+      FIFOOverflows |= atomic_exchange_explicit(&GlobalFIFOOverflows, 0, memory_order_relaxed);
       *(uint8_t *)(UDPBuffer+30) = FIFOOverflows;
-      GlobalFIFOOverflows = 0;                                // clear any overflows
       FIFOOverflows = 0;
+      Heartbeat(eBeatStatus, eBeatSend);
       Error = sendmsg(ThreadData -> Socketid, &datagram, 0);
+      if(Error == -1)
+      {
+        HeartbeatError(eBeatStatus, errno);
+        TelemetryCountSendError(eTelStatus);
+      }
+      else
+      {
+        TelemetryCountPackets(eTelStatus, 1, VHIGHPRIOTIYFROMSDRSIZE);
+        CaptureBuffer(eCapStatus, true, &DestAddr, ThreadData->Portid, UDPBuffer, VHIGHPRIOTIYFROMSDRSIZE);
+        Trace(eTraceStatusSend, SequenceCounter - 1, PTTBits);
+        KeyEdgeSent(PTTBits);
+      }
+      LastSent = TelemetryTimestamp();
+      LastPoll = LastSent;
 
 
-      //
-      // get ATU bit and offer to LDG ATU handler
-      // power requested if bit 2 is zero
-      Byte = ((Byte >> 2) & 1) ^1;
-      ATUTuneRequest = (bool)Byte;
-      RequestATUTune(ATUTuneRequest);
-
       if(Error == -1)
       {
         printf("High Priority Send Error, errno=%d\n", errno);
@@ -186,20 +269,36 @@ void *OutgoingHighPriority(void *arg)
         InitError=true;
       }
       //
-      // now we need to sleep for 1ms (in TX) or 200ms (not in TX)
+      // now we need to wait for 1ms (in TX) or 200ms (not in TX)
       // BUT if any of the PTT or key inputs change, send a message immediately
-      // so break up the 200ms period with smaller sleeps
+      // so check the inputs at each poll tick (500us by default)
       // thank you to Rick N1GP for recommending this approach
+      // an ADC overload found by the overload watch is sent immediately too
+      // the period is checked against the time of the last send, so going into TX
+      // takes effect at the next tick
       //
-      SleepCount = (MOXAsserted)? 2: 400;
-      while (SleepCount-- > 0)
+      while (StreamRunActive(Run))
       {
+        if (P2Config.StatusPollPeriod != PollPeriod)        // setting reloaded
+          PollPeriod = StartStatusPollTicks(TimerFd);
+        Heartbeat(eBeatStatus, eBeatRunning);
+        WaitStatusPollTick(TimerFd);
         ReadStatusRegister();
+        Now = TelemetryTimestamp();
         if ((uint8_t)GetP2PTTKeyInputs() != PTTBits)
+        {
+          NoteKeyEdge((uint8_t)GetP2PTTKeyInputs(), Now, LastPoll);
+          break;
+        }
+        if (IsADCOverloadWaiting())
+          break;
+        LastPoll = Now;
+        Period = (MOXAsserted)? P2Config.TXStatusPeriod: P2Config.RXStatusPeriod;
+        if ((TelemetryTimestamp() - LastSent) >= Period)
           break;
-        usleep(500);
       }
     }
+    StreamThreadStopped();
   }
 //
 // tidy shutdown of the thread
@@ -207,7 +306,11 @@ void *OutgoingHighPriority(void *arg)
   if(InitError)                                           // if error, flag it to main program
     ThreadError = true;
   printf("shutting down outgoing high priority thread\n");
+  RegisterStreamThread(false);
   close(ThreadData->Socketid); 
+  if (TimerFd >= 0)
+    close(TimerFd);
+  HeartbeatStop(eBeatStatus);
   ThreadData->Active = false;                   // signal closed
   return NULL;
 }
@@ -17,6 +17,11 @@
 #include <stdint.h>
 #include "../common/saturntypes.h"
 #include "OutMicAudio.h"
+#include "telemetry.h"
+#include "pcapcapture.h"
+#include "p2config.h"
+#include "heartbeat.h"
+#include "streamengine.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -24,6 +29,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
 #include "../common/hwaccess.h"
@@ -31,10 +37,31 @@
 
 #define VMICSAMPLESPERFRAME 64
 #define VDMABUFFERSIZE 32768						// memory buffer to reserve
-#define VALIGNMENT 4096                             // buffer alignment
-#define VBASE 0x1000                                // offset into I/Q buffer for DMA to start
-#define VDMATRANSFERSIZE 128                        // read 1 message at a time
-#define VSTARTUPDELAY 100                           // 100 messages (~100ms) before reporting under or overflows
+#define VDMATRANSFERSIZE 128                        // bytes of samples in 1 message
+#define VMICFRAMELOCATIONS (VMICSAMPLESPERFRAME/4)  // FIFO locations per message: 4 mic samples per location
+#define VMAXMICBATCH 16                             // max messages per DMA & sendmmsg: the whole 256 location FIFO
+#define VMICBATCHTARGET 2                           // messages to wait for before a batch is sent...
+#define VMICFLUSHTIME 2000                          // ...but wait no longer than this (us) once 1 message is ready
+
+
+//
+// send a batch of mic packets, looping because sendmmsg() can send fewer than requested
+// return true if error
+//
+static bool SendMicBatch(int Socketid, struct mmsghdr* Msgs, uint32_t Count)
+{
+    int Sent;
+
+    while (Count != 0)
+    {
+        Sent = sendmmsg(Socketid, Msgs, Count, 0);
+        if (Sent == -1)
+            return true;
+        Msgs += Sent;
+        Count -= Sent;
+    }
+    return false;
+}
 
 
 
@@ -49,30 +76,26 @@ void *OutgoingMicSamples(void *arg)
 //
 // variables for outgoing UDP frame
 //
-    struct iovec iovecinst;                                 // instance of iovec
-    struct msghdr datagram;
-    uint8_t UDPBuffer[VMICPACKETSIZE];                      // DDC frame buffer
+    struct iovec MicIovecs[VMAXMICBATCH][2];                // per packet: sequence number, then samples
+    struct mmsghdr MicMsgs[VMAXMICBATCH];
+    uint32_t MicHeaders[VMAXMICBATCH];                      // sequence numbers, network order
     uint32_t SequenceCounter = 0;                           // UDP sequence count
+    uint32_t Frames;                                        // packets in this batch
+    uint32_t Cntr;
 
     struct ThreadSocketData* ThreadData;            // socket etc data for this thread
     struct sockaddr_in DestAddr;                    // destination address for outgoing data
     bool InitError = false;
-    int Error;
+    uint32_t Run = 0;                                           // stream run number
 
 //
-// variables for DMA buffer 
+// DMA from the mic FIFO
 //
-    uint8_t* MicReadBuffer = NULL;							// data for DMA read from DDC
-    uint32_t MicBufferSize = VDMABUFFERSIZE;
-    unsigned char* MicReadPtr;								// pointer for reading out a mic sample
-    unsigned char* MicHeadPtr;								// ptr to 1st free location in mic memory
+    struct StreamEngine Engine;                             // DMA buffer, device and FIFO
     unsigned char* MicBasePtr;								// ptr to DMA location in mic memory
     uint32_t Depth = 0;
-    int DMAReadfile_fd = -1;								// DMA read file device
-    uint32_t RegisterValue;
-    bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;
-    unsigned int Current;                                   // current occupied locations in FIFO
-    unsigned int StartupCount;                              // used to delay reporting of under & overflows
+    int Result;                                             // DMA result
+    uint64_t DMAStartTime;                                  // for telemetry
 
 
 
@@ -82,126 +105,116 @@ void *OutgoingMicSamples(void *arg)
 //
     ThreadData = (struct ThreadSocketData *)arg;
     ThreadData->Active = true;
+    RegisterStreamThread(true);
     printf("spinning up outgoing mic thread with port %d\n", ThreadData->Portid);
 
 //
-// setup DMA buffer
+// setup DMA buffer and open DMA device driver; read through the bypass BAR if it covers a batch
+// then initialise Saturn hardware: clear FIFO
 //
-    posix_memalign((void**)&MicReadBuffer, VALIGNMENT, MicBufferSize);
-    if (!MicReadBuffer)
-    {
-        printf("mic read buffer allocation failed\n");
-        InitError = true;
-    }
-    MicReadPtr = MicReadBuffer + VBASE;							// offset 4096 bytes into buffer
-    MicHeadPtr = MicReadBuffer + VBASE;
-    MicBasePtr = MicReadBuffer + VBASE;
-    memset(MicReadBuffer, 0, MicBufferSize);
-
-
-  //
-  // open DMA device driver
-  //
-    DMAReadfile_fd = open(VMICDMADEVICE, O_RDWR);
-    if (DMAReadfile_fd < 0)
-    {
-        printf("XDMA read device open failed for mic data\n");
-        InitError = true;
-    }
-
-  //
-  // now initialise Saturn hardware.
-  // clear FIFO
-  // then read depth
-  //
-    SetupFIFOMonitorChannel(eMicCodecDMA, false);
-    ResetDMAStreamFIFO(eMicCodecDMA);
-    RegisterValue = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
-    if(UseDebug)
-        printf("mic FIFO Depth register = %08x (should be ~0)\n", RegisterValue);
+    InitStreamEngine(&Engine, "Codec Mic", eMicCodecDMA, VMICDMADEVICE, VADDRMICSTREAMREAD, false,
+                     eTelMic, eBeatMic, 0b00000010);
+    InitError = OpenStreamEngine(&Engine, VDMABUFFERSIZE, VMAXMICBATCH * VDMATRANSFERSIZE, 0, 0);
+    MicBasePtr = Engine.BasePtr;
+    StartStreamFIFO(&Engine);
     Depth = 0;
 
 
   //
-  // planned strategy: just DMA mic data when available; don't copy and DMA a larger amount.
-  // if sufficient FIFO data available: DMA that data and transfer it out. 
-  // if it turns out to be too inefficient, we'll have to try larger DMA.
+  // strategy: DMA all the whole messages of mic data available in one transfer,
+  // and send them all with one sendmmsg(). Waiting briefly for a 2nd message
+  // halves the number of round trips while adding at most VMICFLUSHTIME latency.
   //
+    HeartbeatStart(eBeatMic);
     while (!InitError)
     {
-        while(!(SDRActive))
-        {
-            if(ThreadData->Cmdid & VBITCHANGEPORT)
-            {
-                printf("Mic data request change port\n");
-                close(ThreadData->Socketid);                      // close old socket, open new one
-                MakeSocket(ThreadData, 0);                        // this binds to the new port.
-                ThreadData->Cmdid &= ~VBITCHANGEPORT;             // clear command bit
-            }
-            usleep(100);
-        }
+        Heartbeat(eBeatMic, eBeatIdle);
+        WaitForStreamStart(ThreadData, 1, true, &Run);
     //
     // if we get here, run has been initiated
     // initialise outgoing data packet
     //
         printf("starting activity on mic thread\n");
-        StartupCount = VSTARTUPDELAY;
+        RestartStreamStartup(&Engine);
         SequenceCounter = 0;
         memcpy(&DestAddr, &reply_addr, sizeof(struct sockaddr_in));           // create local copy of PC destination address
-        memset(&iovecinst, 0, sizeof(struct iovec));
-        memset(&datagram, 0, sizeof(datagram));
-        iovecinst.iov_base = UDPBuffer;
-        iovecinst.iov_len = VMICPACKETSIZE;
-        datagram.msg_iov = &iovecinst;
-        datagram.msg_iovlen = 1;
-        datagram.msg_name = &DestAddr;                              // MAC addr & port to send to
-        datagram.msg_namelen = sizeof(DestAddr);
-
-        while(SDRActive && !InitError)                              // main loop
+        memset(MicMsgs, 0, sizeof(MicMsgs));
+        for (Cntr = 0; Cntr < VMAXMICBATCH; Cntr++)
+        {
+            MicIovecs[Cntr][0].iov_base = &MicHeaders[Cntr];
+            MicIovecs[Cntr][0].iov_len = sizeof(uint32_t);
+            MicIovecs[Cntr][1].iov_base = MicBasePtr + Cntr * VDMATRANSFERSIZE;   // samples sent straight from the DMA buffer
+            MicIovecs[Cntr][1].iov_len = VDMATRANSFERSIZE;
+            MicMsgs[Cntr].msg_hdr.msg_iov = MicIovecs[Cntr];
+            MicMsgs[Cntr].msg_hdr.msg_iovlen = 2;
+            MicMsgs[Cntr].msg_hdr.msg_name = &DestAddr;             // MAC addr & port to send to
+            MicMsgs[Cntr].msg_hdr.msg_namelen = sizeof(DestAddr);
+        }
+
+        while(StreamRunActive(Run) && !InitError)                   // main loop
         {
+            Heartbeat(eBeatMic, eBeatRunning);
             //
             // now wait until there is data, then DMA it
             //
-            Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);			// read the FIFO Depth register. 4 mic words per 64 bit word.
-            if((StartupCount == 0) && FIFOOverThreshold)
+            Depth = ReadStreamFIFO(&Engine);			            // read the FIFO Depth register. 4 mic words per 64 bit word.
+// note an underflow is not reported: it would often be, because we deliberately read it down to zero.
+// this isn't a problem as we can send the data on without the code becoming blocked.
+            //
+            // wait for at least one message of samples; once there is one, allow a
+            // short time for a second so two can go in one DMA and sendmmsg.
+            // then take every whole message available, up to the whole FIFO.
+            //
+            while (Depth < VMICFRAMELOCATIONS)
             {
-                GlobalFIFOOverflows |= 0b00000010;
-                if(UseDebug)
-                    printf("Codec Mic FIFO Overthreshold, depth now = %d\n", Current);
+                Depth = WaitStreamFIFO(&Engine, VMICFRAMELOCATIONS, VFIFOWAITTIMEOUT);	// wait for FIFO Depth
+                if(!StreamRunActive(Run))
+                    break;
             }
-
-// note this would often generate a message because we deliberately read it down to zero.
-// this isn't a problem as we can send the data on without the code becoming blocked.
-//            if((StartupCount == 0) && FIFOUnderflow)
-//                printf("Codec Mic FIFO Underflowed, depth now = %d\n", Current);
-            while (Depth < (VMICSAMPLESPERFRAME/4))			        // 16 locations = 64 samples
+            if(Depth < VMICFRAMELOCATIONS)
+                continue;
+            if(Depth < VMICBATCHTARGET * VMICFRAMELOCATIONS)
+                Depth = WaitStreamFIFO(&Engine, VMICBATCHTARGET * VMICFRAMELOCATIONS, VMICFLUSHTIME);
+            Frames = Depth / VMICFRAMELOCATIONS;
+            if(Frames > VMAXMICBATCH)
+                Frames = VMAXMICBATCH;
+
+            DMAStartTime = TelemetryTimestamp();
+            Result = TransferStreamDMA(&Engine, MicBasePtr, Frames * VDMATRANSFERSIZE);
+            if(Result != 0)
             {
-                usleep(1000);								        // 1ms wait
-                Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
-                if((StartupCount == 0) && FIFOOverThreshold)
+                //
+                // the buffer doesn't hold these samples: nothing is sent, and the FIFO starts again
+                //
+                if(RecoverStreamDMA(&Engine, Result))
                 {
-                    GlobalFIFOOverflows |= 0b00000010;
-                    if(UseDebug)
-                        printf("Codec Mic FIFO Overthreshold, depth now = %d\n", Current);
+                    InitError = true;
+                    break;
                 }
-//                if((StartupCount == 0) && FIFOUnderflow)
-//                    printf("Codec Mic FIFO Underflowed, depth now = %d\n", Current);
+                continue;
             }
 
-            DMAReadFromFPGA(DMAReadfile_fd, MicBasePtr, VDMATRANSFERSIZE, VADDRMICSTREAMREAD);
-
-            // create the packet into UDPBuffer
-            *(uint32_t*)UDPBuffer = htonl(SequenceCounter++);        // add sequence count
-            memcpy(UDPBuffer+4, MicBasePtr, VDMATRANSFERSIZE);       // copy in mic samples
-            Error = sendmsg(ThreadData -> Socketid, &datagram, 0);
-            if(StartupCount != 0)                                   // decrement startup message count
-                StartupCount--;
-            if(Error == -1)
+            // create the packets: sequence count, then samples straight from the DMA buffer
+            for (Cntr = 0; Cntr < Frames; Cntr++)
+                MicHeaders[Cntr] = htonl(SequenceCounter++);
+            CountStreamStartup(&Engine, Frames);                    // decrement startup message count
+            Heartbeat(eBeatMic, eBeatSend);
+            if(SendMicBatch(ThreadData -> Socketid, MicMsgs, Frames))
             {
-                perror("sendmsg, Mic Audio");
+                HeartbeatError(eBeatMic, errno);
+                TelemetryCountSendError(eTelMic);
+                perror("sendmmsg, Mic Audio");
                 InitError=true;
             }
+            else
+            {
+                TelemetryCountPackets(eTelMic, Frames, Frames * VMICPACKETSIZE);
+                CaptureMessages(eCapMic, true, MicMsgs, Frames, NULL, ThreadData->Portid);
+                Trace(eTraceMicSend, Frames, Engine.Current);
+            }
+            TelemetryLoopTime(eTelMic, DMAStartTime);
         }
+        StreamThreadStopped();
     }
 //
 // tidy shutdown of the thread
@@ -210,7 +223,9 @@ void *OutgoingMicSamples(void *arg)
       ThreadError = true;
 
     printf("shutting down outgoing mic data thread\n");
+    RegisterStreamThread(false);
     close(ThreadData->Socketid); 
+    HeartbeatStop(eBeatMic);
     ThreadData->Active = false;                   // signal closed
     return NULL;
 }
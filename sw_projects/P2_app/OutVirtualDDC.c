@@ -0,0 +1,293 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutVirtualDDC.c:
+//
+// virtual DDCs, made in software from one wide hardware DDC
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include "OutDDCIQ.h"
+#include "OutVirtualDDC.h"
+#include "p2config.h"
+#include "threadplacement.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include "../common/saturnregisters.h"
+#include "../common/ringbuffer.h"
+#include "../common/bufferarena.h"
+#include "../common/channelizer.h"
+
+
+#define VVDDCHEADERSIZE 16                          // P2 header bytes before the I/Q samples
+#define VVDDCSAMPLESPERPACKET 238                   // 24 bit I/Q samples in one packet
+#define VVDDCRINGSIZE 262144                        // source samples waiting for the channelizer
+
+
+int ChannelizerDDC = -1;                            // DDC feeding the channelizer this run
+
+struct SPSCRingBuffer VirtualDDCRing;               // source DDC samples, from the demux
+bool VirtualDDCRingMade;
+_Atomic uint32_t VirtualDDCFrameSamples;            // source samples per frame, set by the demux
+_Atomic uint32_t VirtualDDCDropped;                 // source samples that didn't fit in the ring
+
+uint8_t* VirtualDDCPackets;                         // one packet being filled per virtual DDC
+struct ThreadSocketData VirtualDDCSockets[VMAXVIRTUALDDC];
+bool VirtualDDCSocketOpen[VMAXVIRTUALDDC];
+uint32_t VirtualDDCSocketCount;                     // virtual DDCs set up for this run
+uint32_t VirtualDDCCount;                           // virtual DDCs sent: no more than the channels
+
+pthread_t VirtualDDCThreadId;
+volatile bool VirtualDDCRun;                        // true while the channelizer thread should run
+uint32_t VirtualDDCPacketsSent;
+uint32_t VirtualDDCSendErrors;
+
+
+//
+// point each channel that is sent at the next sample of its packet
+// virtual DDC n is channel (N/2 - Count/2 + n); the rest aren't made
+//
+static void SetChannelDests(uint8_t** Dest, uint32_t Channels, uint32_t Fill)
+{
+    uint32_t First = Channels / 2 - VirtualDDCCount / 2;
+    uint32_t VDDC;
+
+    memset(Dest, 0, VMAXCHANNELS * sizeof(uint8_t*));
+    for (VDDC = 0; VDDC < VirtualDDCCount; VDDC++)
+        Dest[First + VDDC] = VirtualDDCPackets + VDDC * VDDCPACKETSIZE + VVDDCHEADERSIZE + 6 * Fill;
+}
+
+
+//
+// complete the headers of the full packets and send one from each virtual DDC socket
+//
+static void SendVirtualDDCPackets(uint32_t* SequenceCounter, uint64_t SampleCount)
+{
+    uint8_t* PacketPtr;
+    uint32_t VDDC;
+
+    for (VDDC = 0; VDDC < VirtualDDCCount; VDDC++)
+    {
+        PacketPtr = VirtualDDCPackets + VDDC * VDDCPACKETSIZE;
+        *(uint32_t*)PacketPtr = htonl(SequenceCounter[VDDC]++);
+        if (GEnableTimeStamping)
+            *(uint64_t*)(PacketPtr + 4) = htobe64(SampleCount);         // timestamp = 1st sample number
+        else
+            memset(PacketPtr + 4, 0, 8);
+        *(uint16_t*)(PacketPtr + 12) = htons(24);                       // bits per sample
+        *(uint16_t*)(PacketPtr + 14) = htons(VVDDCSAMPLESPERPACKET);
+        if (send(VirtualDDCSockets[VDDC].Socketid, PacketPtr, VDDCPACKETSIZE, 0) == VDDCPACKETSIZE)
+            VirtualDDCPacketsSent++;
+        else if (VirtualDDCSendErrors++ == 0)
+            printf("virtual DDC%d send error, errno=%d\n", VNUMDDC + VDDC, errno);
+    }
+}
+
+
+//
+// channelizer thread
+// runs the filter bank over the source DDC samples; when every virtual DDC's
+// packet is full, sends them all. The bank is made again if the source DDC rate changes.
+//
+static void* VirtualDDCThread(__attribute__((unused)) void* arg)
+{
+    struct PFBChannelizer Channelizer;
+    bool ChannelizerMade = false;
+    uint32_t FrameSamples = 0;                      // source samples per frame the bank was made for
+    uint32_t Channels;
+    uint8_t* Dest[VMAXCHANNELS];
+    uint32_t Fill = 0;                              // samples in each packet so far
+    uint32_t SequenceCounter[VMAXVIRTUALDDC];
+    uint64_t SampleCount = 0;                       // sample number of the 1st sample of the packets
+    uint32_t Samples, Outputs;
+
+    memset(SequenceCounter, 0, sizeof(SequenceCounter));
+    memset(Dest, 0, sizeof(Dest));
+    while (VirtualDDCRun)
+    {
+        if (atomic_load(&VirtualDDCFrameSamples) != FrameSamples)
+        {
+            if (ChannelizerMade)
+                FreeChannelizer(&Channelizer);
+            ChannelizerMade = false;
+            FrameSamples = atomic_load(&VirtualDDCFrameSamples);
+            Channels = 2 * FrameSamples;                        // 48KHz channels, 2x oversampled
+            if (Channels > VMAXCHANNELS)
+                printf("virtual DDCs: DDC%d is too fast to channelize\n", ChannelizerDDC);
+            else if (CreateChannelizer(&Channelizer, Channels))
+                printf("virtual DDCs: DDC%d at %dKHz can't be channelized\n", ChannelizerDDC, 48 * FrameSamples);
+            else
+            {
+                ChannelizerMade = true;
+                VirtualDDCCount = (VirtualDDCSocketCount < Channels) ? VirtualDDCSocketCount : Channels;
+                Fill = 0;
+                SetChannelDests(Dest, Channels, Fill);
+                if (UseDebug)
+                    printf("virtual DDCs: %d of %d channels from DDC%d at %dKHz (%s filter bank)\n",
+                           VirtualDDCCount, Channels, ChannelizerDDC, 48 * FrameSamples, GetChannelizerName());
+            }
+        }
+        Samples = RingBytesUsed(&VirtualDDCRing) / 6;
+        if (!ChannelizerMade)
+        {
+            RingConsume(&VirtualDDCRing, Samples * 6);
+            usleep(P2Config.StageIdleWait);
+            continue;
+        }
+        if (Samples < Channelizer.Decimation)
+        {
+            usleep(P2Config.StageIdleWait);
+            continue;
+        }
+        Outputs = VVDDCSAMPLESPERPACKET - Fill;
+        Samples = RunChannelizer(&Channelizer, RingReadPtr(&VirtualDDCRing), Samples, Dest, &Outputs);
+        RingConsume(&VirtualDDCRing, Samples * 6);
+        Fill += Outputs;
+        if (Fill == VVDDCSAMPLESPERPACKET)
+        {
+            SendVirtualDDCPackets(SequenceCounter, SampleCount);
+            SampleCount += VVDDCSAMPLESPERPACKET;
+            Fill = 0;
+            SetChannelDests(Dest, Channelizer.Channels, Fill);
+        }
+    }
+    if (ChannelizerMade)
+        FreeChannelizer(&Channelizer);
+    return NULL;
+}
+
+
+//
+// make the sockets and start the channelizer thread, if set up
+//
+bool StartVirtualDDCs(uint16_t DDC0Port)
+{
+    uint32_t VDDC;
+    uint16_t Port;
+
+    ChannelizerDDC = -1;
+    VirtualDDCSocketCount = P2Config.VirtualDDCCount;
+    if (VirtualDDCSocketCount == 0)
+        return false;
+    if (!VirtualDDCRingMade)
+    {
+        VirtualDDCPackets = ArenaAlloc(&StreamArena, VMAXVIRTUALDDC * VDDCPACKETSIZE, 0);
+        if ((VirtualDDCPackets == NULL) || ArenaRingBuffer(&StreamArena, &VirtualDDCRing, VVDDCRINGSIZE))
+        {
+            printf("virtual DDCs: buffers could not be made\n");
+            return true;
+        }
+        VirtualDDCRingMade = true;
+    }
+    //
+    // a socket for each virtual DDC that can be sent, on the ports after the hardware DDCs
+    //
+    for (VDDC = 0; VDDC < VirtualDDCSocketCount; VDDC++)
+    {
+        Port = DDC0Port + VNUMDDC + VDDC;
+        if (VirtualDDCSocketOpen[VDDC] && (VirtualDDCSockets[VDDC].Portid != Port))
+        {
+            close(VirtualDDCSockets[VDDC].Socketid);
+            VirtualDDCSocketOpen[VDDC] = false;
+        }
+        if (!VirtualDDCSocketOpen[VDDC])
+        {
+            VirtualDDCSockets[VDDC].Portid = Port;
+            VirtualDDCSockets[VDDC].Nameid = "virtual DDC";
+            VirtualDDCSockets[VDDC].Class = eSocketDDC;
+            if (MakeSocket(&VirtualDDCSockets[VDDC], VNUMDDC + VDDC) != 0)
+            {
+                printf("virtual DDCs: socket for port %d could not be made\n", Port);
+                return true;
+            }
+            VirtualDDCSocketOpen[VDDC] = true;
+        }
+        if (ConnectSocket(&VirtualDDCSockets[VDDC], &reply_addr))
+            return true;
+    }
+
+    ResetRingBuffer(&VirtualDDCRing);
+    atomic_store(&VirtualDDCFrameSamples, 0);
+    atomic_store(&VirtualDDCDropped, 0);
+    VirtualDDCCount = 0;
+    VirtualDDCPacketsSent = 0;
+    VirtualDDCSendErrors = 0;
+    ChannelizerDDC = P2Config.VirtualDDCSource;
+    VirtualDDCRun = true;
+    if (pthread_create(&VirtualDDCThreadId, NULL, VirtualDDCThread, NULL) != 0)
+    {
+        printf("virtual DDC channelizer thread create failed\n");
+        VirtualDDCRun = false;
+        ChannelizerDDC = -1;
+        return true;
+    }
+    SetThreadName(VirtualDDCThreadId, "DDC channelizer");
+    return false;
+}
+
+
+//
+// demux thread: pass on the source DDC's samples
+//
+void WriteVirtualDDCSamples(const uint8_t* Samples, uint32_t Bytes, uint32_t FrameSamples)
+{
+    if (FrameSamples != atomic_load_explicit(&VirtualDDCFrameSamples, memory_order_relaxed))
+        atomic_store(&VirtualDDCFrameSamples, FrameSamples);
+    if (RingBytesFree(&VirtualDDCRing) < Bytes)
+    {
+        atomic_fetch_add(&VirtualDDCDropped, Bytes / 6);
+        return;
+    }
+    memcpy(RingWritePtr(&VirtualDDCRing), Samples, Bytes);
+    RingCommitWrite(&VirtualDDCRing, Bytes);
+}
+
+
+//
+// stop the channelizer thread
+//
+void StopVirtualDDCs(void)
+{
+    if (!VirtualDDCRun)
+        return;
+    VirtualDDCRun = false;
+    pthread_join(VirtualDDCThreadId, NULL);
+    ChannelizerDDC = -1;
+    if (UseDebug)
+        printf("virtual DDCs: %d packets sent, %d send errors; %d source samples dropped\n",
+               VirtualDDCPacketsSent, VirtualDDCSendErrors, atomic_load(&VirtualDDCDropped));
+}
+
+
+//
+// close the sockets, and release the ring's mapping
+//
+void CloseVirtualDDCs(void)
+{
+    uint32_t VDDC;
+
+    for (VDDC = 0; VDDC < VMAXVIRTUALDDC; VDDC++)
+        if (VirtualDDCSocketOpen[VDDC])
+        {
+            close(VirtualDDCSockets[VDDC].Socketid);
+            VirtualDDCSocketOpen[VDDC] = false;
+        }
+    if (VirtualDDCRingMade)
+        FreeRingBuffer(&VirtualDDCRing);
+    VirtualDDCRingMade = false;
+}
@@ -0,0 +1,76 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutVirtualDDC.h:
+//
+// header: virtual DDCs, made in software from one wide hardware DDC
+//
+// the DDC demux copies the samples of one DDC (vddc_source) to a channelizer
+// thread, which splits it into narrow 48KHz channels with a polyphase filter
+// bank (common/channelizer.c) and sends up to vddc_count of them as extra DDCs.
+// virtual DDC n is sent from port (DDC0 port + VNUMDDC + n), in the same packet
+// format as a hardware DDC at 48KHz, 24 bit samples; the client treats it as
+// DDC (VNUMDDC + n). A source at rate Fs gives Fs/24KHz channels, 24KHz apart:
+// 32 at 768KHz, 64 at 1536KHz. Virtual DDC n is centred (n - vddc_count/2) * 24KHz
+// from the source DDC frequency.
+// the source DDC must be enabled by the client, at 96KHz or more and not interleaved.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __OutVirtualDDC_h
+#define __OutVirtualDDC_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VMAXVIRTUALDDC 64                       // P2 has ports for 80 DDCs, VNUMDDC are hardware
+
+
+//
+// DDC whose samples feed the channelizer in the current run; -1 if none.
+// set before the DDC demux thread starts, and not changed while it runs.
+//
+extern int ChannelizerDDC;
+
+
+//
+// StartVirtualDDCs(uint16_t DDC0Port)
+// at the start of a DDC pipeline run: if virtual DDCs are set up in the config,
+// make their sockets (connected to the client) and start the channelizer thread.
+// return true if error; the hardware DDCs still run.
+//
+bool StartVirtualDDCs(uint16_t DDC0Port);
+
+
+//
+// WriteVirtualDDCSamples(const uint8_t* Samples, uint32_t Bytes, uint32_t FrameSamples)
+// called by the demux thread with the samples it has copied for ChannelizerDDC.
+// FrameSamples is that DDC's samples per DMA frame, which sets its sample rate.
+// samples that don't fit (the channelizer has fallen behind) are dropped.
+//
+void WriteVirtualDDCSamples(const uint8_t* Samples, uint32_t Bytes, uint32_t FrameSamples);
+
+
+//
+// StopVirtualDDCs(void)
+// at the end of a run, after the demux thread has stopped: stop the channelizer thread
+//
+void StopVirtualDDCs(void);
+
+
+//
+// CloseVirtualDDCs(void)
+// close the virtual DDC sockets, when the DDC thread shuts down
+//
+void CloseVirtualDDCs(void);
+
+
+#endif
@@ -0,0 +1,353 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutWideband.c:
+//
+// handle outgoing wideband ADC capture data
+// each update period a snapshot of raw ADC samples is read by DMA for each
+// enabled ADC, then sent as a burst of packets by sendmmsg().
+// the snapshot is read on its own DMA channel in small transfers, so it never
+// holds off the DDC stream for long, and frames are skipped rather than
+// caught up if the thread falls behind.
+// with wideband_spectrum set, the snapshot is turned into an averaged spectrum
+// here and only that is sent: a few KB per frame rather than the raw samples,
+// for clients (eg remote ones) that only draw a panadapter.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include "../common/saturntypes.h"
+#include "OutWideband.h"
+#include "telemetry.h"
+#include "pcapcapture.h"
+#include "p2config.h"
+#include "heartbeat.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+#include "../common/spectrum.h"
+
+
+#define VMAXWIDEBANDPACKETS 255                     // max packets per frame (8 bit setting)
+#define VDEFAULTWIDEBANDPACKETS 32                  // packets per frame if the client sets 0
+#define VMINWIDEBANDPERIOD 10                       // ms: limits the wideband DMA load
+#define VWIDEBANDCHUNK 8192                         // bytes per DMA transfer
+#define VALIGNMENT 4096                             // buffer alignment
+#define VNUMWIDEBAND 2                              // ADC1 and ADC2
+
+//
+// the wideband ports are the same numbers as the incoming high priority and speaker ports,
+// so their data goes out on those threads' sockets. The owners rebind them on a port change,
+// so the socket is always read from the owner's SocketData rather than copied.
+//
+static const uint32_t WidebandSocketOwner[VNUMWIDEBAND] = {VPORTHIGHPRIORITYTOSDR, VPORTSPKRAUDIO};
+
+
+
+//
+// read one ADC snapshot, in chunks, yielding between them
+// return true if error
+//
+static bool ReadWidebandSnapshot(int fd, uint8_t* Buffer, uint32_t Length, uint32_t AXIAddr)
+{
+    uint32_t Offset;
+    uint32_t Size;
+
+    for (Offset = 0; Offset < Length; Offset += Size)
+    {
+        Size = Length - Offset;
+        if (Size > VWIDEBANDCHUNK)
+            Size = VWIDEBANDCHUNK;
+        if (DMAReadFromFPGA(fd, Buffer + Offset, Size, AXIAddr) < 0)
+            return true;
+        sched_yield();
+    }
+    return false;
+}
+
+
+//
+// send a frame of wideband packets, looping because sendmmsg() can send fewer than requested
+// return true if error
+//
+static bool SendWidebandFrame(int Socketid, struct mmsghdr* Msgs, uint32_t Count)
+{
+    int Sent;
+
+    while (Count != 0)
+    {
+        Sent = sendmmsg(Socketid, Msgs, Count, 0);
+        if (Sent == -1)
+            return true;
+        Msgs += Sent;
+        Count -= Sent;
+    }
+    return false;
+}
+
+
+//
+// the FFT size for a wideband_spectrum setting; 0 for raw samples
+// a setting that is not a power of 2 is rounded down to one
+//
+static uint32_t SpectrumSize(uint32_t Setting)
+{
+    uint32_t Size = VMINSPECTRUMSIZE;
+
+    if (Setting == 0)
+        return 0;
+    while (((Size * 2) <= Setting) && ((Size * 2) <= VMAXSPECTRUMSIZE))
+        Size *= 2;
+    return Size;
+}
+
+
+//
+// send a spectrum as packets of up to VMAXSPECTRUMBINS bins
+// return true if error
+//
+static bool SendSpectrumFrame(int Socketid, uint16_t LocalPort, struct sockaddr_in* DestAddr, uint32_t* SequenceCounter,
+                              uint8_t* Bins, uint32_t FFTSize, uint32_t Averages, uint32_t* Packets)
+{
+    static uint8_t Packet[VSPECTRUMHEADERSIZE + VMAXSPECTRUMBINS];
+    uint32_t FirstBin, Count;
+
+    *Packets = 0;
+    memset(Packet, 0, VSPECTRUMHEADERSIZE);
+    for (FirstBin = 0; FirstBin < FFTSize / 2; FirstBin += Count)
+    {
+        Count = FFTSize / 2 - FirstBin;
+        if (Count > VMAXSPECTRUMBINS)
+            Count = VMAXSPECTRUMBINS;
+        *(uint32_t*)Packet = htonl((*SequenceCounter)++);
+        *(uint16_t*)(Packet + 4) = htons(FFTSize);
+        *(uint16_t*)(Packet + 6) = htons(FirstBin);
+        *(uint16_t*)(Packet + 8) = htons(Count);
+        *(uint16_t*)(Packet + 10) = htons(Averages);
+        memcpy(Packet + VSPECTRUMHEADERSIZE, Bins + FirstBin, Count);
+        if (sendto(Socketid, Packet, VSPECTRUMHEADERSIZE + Count, 0, (struct sockaddr*)DestAddr, sizeof(struct sockaddr_in)) < 0)
+            return true;
+        CaptureBuffer(eCapWideband, true, DestAddr, LocalPort, Packet, VSPECTRUMHEADERSIZE + Count);
+        (*Packets)++;
+    }
+    return false;
+}
+
+
+//
+// this runs as its own thread to send outgoing wideband data
+// it serves both wideband ports
+//
+void *OutgoingWideband(void *arg)
+{
+    struct ThreadSocketData* ThreadData;                    // VPORTWIDEBAND0; VPORTWIDEBAND1 follows
+    static uint8_t Headers[VNUMWIDEBAND][VMAXWIDEBANDPACKETS][4];
+    static struct iovec Iovecs[VNUMWIDEBAND][VMAXWIDEBANDPACKETS][2];   // [0]=sequence number; [1]=samples
+    static struct mmsghdr Msgs[VNUMWIDEBAND][VMAXWIDEBANDPACKETS];
+    struct sockaddr_in DestAddr[VNUMWIDEBAND];
+    uint32_t SequenceCounter[VNUMWIDEBAND];
+    uint8_t* SnapshotBuffer[VNUMWIDEBAND] = {NULL, NULL};   // one preallocated frame per ADC
+    const uint32_t AXIAddr[VNUMWIDEBAND] = {VADDRWIDEBAND0READ, VADDRWIDEBAND1READ};
+    bool Enabled[VNUMWIDEBAND];
+    uint32_t PacketsPerFrame;
+    uint32_t Period;
+    struct timespec NextFrame, Now;
+    uint64_t StartTime;
+    struct SpectrumAnalyser Analyser;                       // made when spectrum frames are selected
+    static uint8_t SpectrumBins[VMAXSPECTRUMSIZE / 2];
+    uint32_t FFTSize;                                       // 0 for raw sample frames
+    uint32_t FrameBytes;                                    // snapshot bytes per ADC
+    uint32_t Averages;
+    uint32_t Packets;
+    int DMAReadfile_fd = -1;
+    bool InitError = false;
+    uint32_t Generation;                                    // state change generation, while idle
+    uint32_t ADC;
+    uint32_t Packet;
+
+    ThreadData = (struct ThreadSocketData *)arg;
+    ThreadData->Active = true;
+    printf("spinning up outgoing wideband thread with ports %d, %d\n", ThreadData->Portid, (ThreadData+1)->Portid);
+
+    DMAReadfile_fd = OpenDMADevice(VWIDEBANDDMADEVICE, O_RDWR);
+    if (DMAReadfile_fd < 0)
+    {
+        printf("no wideband capture DMA device; wideband data not available\n");
+        ThreadData->Active = false;
+        return NULL;
+    }
+    memset(&Analyser, 0, sizeof(Analyser));
+    for (ADC = 0; ADC < VNUMWIDEBAND; ADC++)
+    {
+        SnapshotBuffer[ADC] = ArenaAlloc(&StreamArena, VMAXWIDEBANDPACKETS * VWIDEBANDSAMPLEBYTES, VALIGNMENT);
+        if (SnapshotBuffer[ADC] == NULL)
+        {
+            printf("wideband buffer allocation failed\n");
+            InitError = true;
+        }
+    }
+
+    HeartbeatStart(eBeatWideband);
+    while (!InitError)
+    {
+        Heartbeat(eBeatWideband, eBeatIdle);
+        Generation = GetStateGeneration();
+        while (!(SDRActive && (GWidebandADC1 || GWidebandADC2)))
+        {
+            for (ADC = 0; ADC < VNUMWIDEBAND; ADC++)
+                if ((ThreadData+ADC)->Cmdid & VBITCHANGEPORT)
+                {
+                    printf("Wideband data request change port\n");
+                    (ThreadData+ADC)->Cmdid &= ~VBITCHANGEPORT;         // socket is shared, so owner rebinds; clear command bit
+                }
+            Generation = WaitForStateChange(Generation, StateWaitTimeout());
+        }
+        //
+        // if we get here, run has been initiated: set up the packet headers and iovecs.
+        // each packet's samples are sent straight from the snapshot buffer.
+        //
+        printf("starting outgoing wideband data\n");
+        memset(Msgs, 0, sizeof(Msgs));
+        for (ADC = 0; ADC < VNUMWIDEBAND; ADC++)
+        {
+            SequenceCounter[ADC] = 0;
+            memcpy(&DestAddr[ADC], &reply_addr, sizeof(struct sockaddr_in));     // local copy of PC destination address
+            for (Packet = 0; Packet < VMAXWIDEBANDPACKETS; Packet++)
+            {
+                Iovecs[ADC][Packet][0].iov_base = Headers[ADC][Packet];
+                Iovecs[ADC][Packet][0].iov_len = 4;
+                Iovecs[ADC][Packet][1].iov_base = SnapshotBuffer[ADC] + Packet * VWIDEBANDSAMPLEBYTES;
+                Iovecs[ADC][Packet][1].iov_len = VWIDEBANDSAMPLEBYTES;
+                Msgs[ADC][Packet].msg_hdr.msg_iov = Iovecs[ADC][Packet];
+                Msgs[ADC][Packet].msg_hdr.msg_iovlen = 2;
+                Msgs[ADC][Packet].msg_hdr.msg_name = &DestAddr[ADC];
+                Msgs[ADC][Packet].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &NextFrame);
+
+        while (SDRActive && (GWidebandADC1 || GWidebandADC2) && !InitError)
+        {
+            Heartbeat(eBeatWideband, eBeatRunning);
+            //
+            // settings can change at any time: read them once per frame
+            //
+            Enabled[0] = GWidebandADC1;
+            Enabled[1] = GWidebandADC2;
+            PacketsPerFrame = GWidebandPacketsPerFrame;
+            if (PacketsPerFrame == 0)
+                PacketsPerFrame = VDEFAULTWIDEBANDPACKETS;
+            Period = GWidebandUpdateRate;
+            if (Period < VMINWIDEBANDPERIOD)
+                Period = VMINWIDEBANDPERIOD;
+            FFTSize = SpectrumSize(P2Config.WidebandSpectrum);
+            if (FFTSize != Analyser.Size)
+            {
+                if (Analyser.Size != 0)
+                    FreeSpectrum(&Analyser);
+                if ((FFTSize != 0) && CreateSpectrum(&Analyser, FFTSize))
+                {
+                    printf("wideband spectrum of %d points could not be made; sending raw samples\n", FFTSize);
+                    FFTSize = 0;
+                }
+                else if (FFTSize != 0)
+                    printf("wideband: sending %d point spectra\n", FFTSize);
+            }
+            //
+            // a spectrum needs at least one FFT's worth of samples
+            //
+            FrameBytes = PacketsPerFrame * VWIDEBANDSAMPLEBYTES;
+            if (FrameBytes < (FFTSize * 2))
+                FrameBytes = FFTSize * 2;
+
+            StartTime = TelemetryTimestamp();
+            for (ADC = 0; ADC < VNUMWIDEBAND; ADC++)
+            {
+                if (!Enabled[ADC])
+                    continue;
+                HeartbeatDMA(eBeatWideband, eBeatDMARead, FrameBytes, 0);
+                if (ReadWidebandSnapshot(DMAReadfile_fd, SnapshotBuffer[ADC], FrameBytes, AXIAddr[ADC]))
+                {
+                    printf("wideband DMA read failed\n");
+                    InitError = true;
+                    break;
+                }
+                TelemetryCountDMA(eTelWideband, FrameBytes);
+                Heartbeat(eBeatWideband, eBeatSend);
+                if (FFTSize != 0)
+                {
+                    Averages = ComputeSpectrum(&Analyser, SnapshotBuffer[ADC], FrameBytes / 2, SpectrumBins);
+                    if (SendSpectrumFrame(SocketData[WidebandSocketOwner[ADC]].Socketid, (ThreadData+ADC)->Portid, &DestAddr[ADC], &SequenceCounter[ADC],
+                                          SpectrumBins, FFTSize, Averages, &Packets))
+                    {
+                        TelemetryCountSendError(eTelWideband);
+                        perror("sendto, wideband spectrum");
+                        InitError = true;
+                        break;
+                    }
+                    TelemetryCountPackets(eTelWideband, Packets, Packets * VSPECTRUMHEADERSIZE + FFTSize / 2);
+                    continue;
+                }
+                for (Packet = 0; Packet < PacketsPerFrame; Packet++)
+                    *(uint32_t*)Headers[ADC][Packet] = htonl(SequenceCounter[ADC]++);
+                if (SendWidebandFrame(SocketData[WidebandSocketOwner[ADC]].Socketid, Msgs[ADC], PacketsPerFrame))
+                {
+                    TelemetryCountSendError(eTelWideband);
+                    perror("sendmmsg, wideband");
+                    InitError = true;
+                    break;
+                }
+                TelemetryCountPackets(eTelWideband, PacketsPerFrame, PacketsPerFrame * VWIDEBANDPACKETSIZE);
+                CaptureMessages(eCapWideband, true, Msgs[ADC], PacketsPerFrame, NULL, (ThreadData+ADC)->Portid);
+            }
+            TelemetryLoopTime(eTelWideband, StartTime);
+            //
+            // wait for the next frame time. If it has already passed, skip frames
+            // rather than send a burst to catch up.
+            //
+            NextFrame.tv_nsec += Period * 1000000L;
+            while (NextFrame.tv_nsec >= 1000000000L)
+            {
+                NextFrame.tv_nsec -= 1000000000L;
+                NextFrame.tv_sec++;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &Now);
+            if ((Now.tv_sec > NextFrame.tv_sec) || ((Now.tv_sec == NextFrame.tv_sec) && (Now.tv_nsec > NextFrame.tv_nsec)))
+                NextFrame = Now;
+            else
+            {
+                Heartbeat(eBeatWideband, eBeatIdle);                // the frame period can be long
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &NextFrame, NULL);
+            }
+        }
+    }
+//
+// tidy shutdown of the thread
+//
+    if(InitError)                                           // if error, flag it to main program
+      ThreadError = true;
+
+    printf("shutting down outgoing wideband thread\n");
+    if (Analyser.Size != 0)
+        FreeSpectrum(&Analyser);
+    close(DMAReadfile_fd);                                  // sockets belong to high priority and speaker threads
+    HeartbeatStop(eBeatWideband);
+    ThreadData->Active = false;                             // signal closed
+    return NULL;
+}
@@ -0,0 +1,53 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// OutWideband.h:
+//
+// header: handle outgoing wideband ADC capture data
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __OutWideband_h
+#define __OutWideband_h
+
+
+#include <stdint.h>
+#include "../common/saturntypes.h"
+
+
+#define VWIDEBANDPACKETSIZE 1028                // 4 byte sequence number + 512 16 bit samples
+#define VWIDEBANDSAMPLEBYTES 1024               // sample bytes per packet
+
+
+//
+// spectrum packets: with the wideband_spectrum setting, each frame is sent as an
+// averaged spectrum of the snapshot instead of the raw samples, in one or more
+// packets on the same port. Each has a 16 byte header, all big endian:
+//   bytes 0-3    sequence number
+//   bytes 4-5    FFT size; the bins cover 0 to half the ADC sample rate
+//   bytes 6-7    first bin in this packet
+//   bytes 8-9    bins in this packet
+//   bytes 10-11  FFTs averaged
+//   bytes 12-15  0
+// then one byte per bin: -2 x dB relative to a full scale sine (0 = 0dB, 255 = -127.5dB)
+//
+#define VSPECTRUMHEADERSIZE 16
+#define VMAXSPECTRUMBINS 1024                   // bins per packet
+
+
+//
+// protocol 2 handler for outgoing wideband data
+// arg points to the VPORTWIDEBAND0 socket data; the VPORTWIDEBAND1 data must follow it.
+// frames are sent at the client's wideband update rate, as raw samples or as spectra.
+// if the FPGA has no wideband capture DMA channel the thread exits without error.
+//
+void *OutgoingWideband(void *arg);
+
+
+#endif
@@ -0,0 +1,257 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// adcoverload.c:
+//
+// ADC overload episodes, and the overload watch thread
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "adcoverload.h"
+#include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+#include "p2config.h"
+#include "telemetry.h"
+#include "eventtrace.h"
+#include "threadplacement.h"
+
+
+#define VADCOVERLOADEVENTDEVICE "/dev/xdma0_events_%u"
+
+
+//
+// overload state, shared by the status thread and the watch thread
+//
+static pthread_mutex_t OverloadMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t OverloadActive;                 // bit per ADC: found set at its last read
+static uint64_t OverloadStart[VNUMOVERLOADADCS];
+static uint32_t OverloadBits;                   // found set since the last status packet
+static uint64_t OverloadDetected;               // start of an overload not yet reported; 0 if none
+static struct ADCOverloadStatistics OverloadStats;
+
+static int OverloadWakeFd = -1;
+static int OverloadEventFd = -1;
+static pthread_t OverloadWatchThread;
+
+
+bool NoteADCOverflow(uint32_t Bits, uint64_t Time)
+{
+  uint32_t Duration;
+  bool Started = false;
+  int ADC;
+
+  TelemetryCountADCOverflows(Bits);
+  pthread_mutex_lock(&OverloadMutex);
+  for (ADC = 0; ADC < VNUMOVERLOADADCS; ADC++)
+  {
+    if ((Bits & (1 << ADC)) && !(OverloadActive & (1 << ADC)))
+    {
+      OverloadActive |= (1 << ADC);
+      OverloadStart[ADC] = Time;
+      OverloadStats.Overloads[ADC]++;
+      Started = true;
+    }
+    else if (!(Bits & (1 << ADC)) && (OverloadActive & (1 << ADC)))
+    {
+      OverloadActive &= ~(1 << ADC);
+      Duration = (uint32_t)(Time - OverloadStart[ADC]);
+      OverloadStats.TotalDuration[ADC] += Duration;
+      if (Duration > OverloadStats.MaxDuration[ADC])
+        OverloadStats.MaxDuration[ADC] = Duration;
+      Trace(eTraceADCOverload, 1 << ADC, Duration);
+    }
+  }
+  OverloadBits |= Bits;
+  if (Started && (OverloadDetected == 0))
+    OverloadDetected = Time;
+  pthread_mutex_unlock(&OverloadMutex);
+  if (Started)
+    Trace(eTraceADCOverload, Bits, 0);
+  return Started;
+}
+
+
+bool IsADCOverloadWaiting(void)
+{
+  bool Waiting;
+
+  pthread_mutex_lock(&OverloadMutex);
+  Waiting = (OverloadDetected != 0);
+  pthread_mutex_unlock(&OverloadMutex);
+  return Waiting;
+}
+
+
+uint32_t TakeADCOverload(void)
+{
+  uint32_t Bits, Delay;
+
+  pthread_mutex_lock(&OverloadMutex);
+  Bits = OverloadBits;
+  OverloadBits = 0;
+  if (OverloadDetected != 0)
+  {
+    Delay = (uint32_t)(TelemetryTimestamp() - OverloadDetected);
+    OverloadDetected = 0;
+    OverloadStats.Reports++;
+    OverloadStats.TotalReportDelay += Delay;
+    if (Delay > OverloadStats.MaxReportDelay)
+      OverloadStats.MaxReportDelay = Delay;
+  }
+  pthread_mutex_unlock(&OverloadMutex);
+  return Bits;
+}
+
+
+void GetADCOverloadStatistics(struct ADCOverloadStatistics* Stats)
+{
+  pthread_mutex_lock(&OverloadMutex);
+  memcpy(Stats, &OverloadStats, sizeof(*Stats));
+  Stats->Active = OverloadActive;
+  pthread_mutex_unlock(&OverloadMutex);
+  Stats->Watching = (OverloadWakeFd >= 0);
+  Stats->Interrupt = (OverloadEventFd >= 0);
+}
+
+
+int GetADCOverloadFd(void)
+{
+  return OverloadWakeFd;
+}
+
+
+//
+// step an absolute wake time on by Period us
+//
+static void AddWatchPeriod(struct timespec* Time, uint32_t Period)
+{
+  Time->tv_nsec += (long)Period * 1000;
+  while (Time->tv_nsec >= 1000000000)
+  {
+    Time->tv_nsec -= 1000000000;
+    Time->tv_sec++;
+  }
+}
+
+
+//
+// wait for the next read of the overflow register: until the user interrupt, or
+// the next poll time; the poll times are absolute so the rate doesn't drift
+//
+static void WaitOverloadEvent(struct timespec* Next)
+{
+  struct pollfd EventPoll;
+  struct timespec Now, Wait;
+  uint32_t EventCount;
+
+  if (OverloadEventFd >= 0)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    Wait.tv_sec = Next->tv_sec - Now.tv_sec;
+    Wait.tv_nsec = Next->tv_nsec - Now.tv_nsec;
+    if (Wait.tv_nsec < 0)
+    {
+      Wait.tv_nsec += 1000000000;
+      Wait.tv_sec--;
+    }
+    if (Wait.tv_sec < 0)
+      return;
+    EventPoll.fd = OverloadEventFd;
+    EventPoll.events = POLLIN;
+    if ((ppoll(&EventPoll, 1, &Wait, NULL) > 0) && (EventPoll.revents & POLLIN))
+    {
+      if (read(OverloadEventFd, &EventCount, sizeof(EventCount)) != sizeof(EventCount))   // clear the event
+        nanosleep(&Wait, NULL);
+    }
+    return;
+  }
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, Next, NULL) == EINTR)
+    ;
+}
+
+
+//
+// the overload watch thread: while the SDR is running, read the ADC overflow
+// register at each interrupt or every adc_overload_watch us
+//
+static void* ADCOverloadWatch(__attribute__((unused)) void* arg)
+{
+  struct timespec Next = {0}, Now;
+  uint64_t Wake = 1;
+  uint32_t Generation;
+  bool Watching = false;
+
+  Generation = GetStateGeneration();
+  while (true)
+  {
+    if (!atomic_load(&SDRActive))
+    {
+      Watching = false;
+      Generation = WaitForStateChange(Generation, StateWaitTimeout());
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    if (!Watching || (Now.tv_sec > Next.tv_sec) || ((Now.tv_sec == Next.tv_sec) && (Now.tv_nsec >= Next.tv_nsec)))
+    {
+      if (!Watching)
+        Next = Now;
+      AddWatchPeriod(&Next, P2Config.ADCOverloadWatchPeriod);
+    }
+    WaitOverloadEvent(&Next);
+    if (NoteADCOverflow(GetADCOverflow(), TelemetryTimestamp())
+        && (write(OverloadWakeFd, &Wake, sizeof(Wake)) != sizeof(Wake)))
+      perror("ADC overload wake");
+    Watching = true;
+  }
+  return NULL;
+}
+
+
+bool StartADCOverloadWatch(void)
+{
+  char DeviceName[32];
+
+  if (P2Config.ADCOverloadWatchPeriod == 0)
+    return false;
+  OverloadWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (OverloadWakeFd < 0)
+  {
+    perror("ADC overload eventfd");
+    return true;
+  }
+  snprintf(DeviceName, sizeof(DeviceName), VADCOVERLOADEVENTDEVICE, P2Config.ADCOverloadIRQ);
+  OverloadEventFd = OpenDMADevice(DeviceName, O_RDONLY);
+  if (CreatePlacedThread(&OverloadWatchThread, eThreadKey, "ADC overload", ADCOverloadWatch, NULL) != 0)
+  {
+    perror("pthread_create ADC overload watch");
+    if (OverloadEventFd >= 0)
+      close(OverloadEventFd);
+    OverloadEventFd = -1;
+    close(OverloadWakeFd);
+    OverloadWakeFd = -1;
+    return true;
+  }
+  pthread_detach(OverloadWatchThread);
+  if (OverloadEventFd >= 0)
+    printf("ADC overload watch: on %s interrupts, and polled every %uus\n", DeviceName, P2Config.ADCOverloadWatchPeriod);
+  else
+    printf("ADC overload watch: %s not available; polled every %uus\n", DeviceName, P2Config.ADCOverloadWatchPeriod);
+  return false;
+}
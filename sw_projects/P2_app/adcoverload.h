@@ -0,0 +1,100 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// adcoverload.h:
+//
+// header: ADC overload detection and reporting
+//
+// the ADC overflow register (VADDRADCOVERFLOWBASE) latches an overflow of each
+// ADC until it is read, so every read of it, by the status packet's snapshot
+// or by the overload watch, is passed here. An overload starts at the first
+// read that finds it set and ends at the first that finds it clear; each one
+// is counted and timed per ADC. The bits found set are held until a status
+// packet takes them, so none are lost between packets.
+// with adc_overload_watch set, an overload watch thread (thread class "key")
+// waits on the XDMA user event device for interrupt adc_overload_irq
+// (/dev/xdma0_events_N), if the FPGA raises it, and polls every
+// adc_overload_watch us otherwise or as well. At the start of an overload it
+// wakes the status thread, which sends a high priority packet at once
+// instead of at the end of the 200ms RX period.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __adcoverload_h
+#define __adcoverload_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VNUMOVERLOADADCS 2                      // ADC1, ADC2
+
+
+//
+// overload counts and times, for telemetry
+//
+struct ADCOverloadStatistics
+{
+  bool Watching;                                // the overload watch thread is running
+  bool Interrupt;                               // it waits on the user interrupt event device
+  uint32_t Active;                              // bit per ADC: overloaded now
+  uint64_t Overloads[VNUMOVERLOADADCS];         // overloads started
+  uint64_t TotalDuration[VNUMOVERLOADADCS];     // us: sum of the overloads ended
+  uint32_t MaxDuration[VNUMOVERLOADADCS];       // us: longest overload
+  uint64_t Reports;                             // status packets that reported a new overload
+  uint64_t TotalReportDelay;                    // us: sum over those of detection until the packet
+  uint32_t MaxReportDelay;
+};
+
+
+//
+// StartADCOverloadWatch(void)
+// start the overload watch thread, if adc_overload_watch is set. Return true if error
+//
+bool StartADCOverloadWatch(void);
+
+
+//
+// GetADCOverloadFd(void)
+// an eventfd that is readable once the overload watch has seen an overload start;
+// -1 if there is no watch thread. The status thread waits on it too.
+//
+int GetADCOverloadFd(void);
+
+
+//
+// NoteADCOverflow(uint32_t Bits, uint64_t Time)
+// a read of the ADC overflow register at Time (TelemetryTimestamp() us) found Bits;
+// it is counted in the metrics. Returns true if an overload started.
+//
+bool NoteADCOverflow(uint32_t Bits, uint64_t Time);
+
+
+//
+// IsADCOverloadWaiting(void)
+// true if an overload has started that no status packet has reported yet
+//
+bool IsADCOverloadWaiting(void);
+
+
+//
+// TakeADCOverload(void)
+// status thread, making a packet: the overflow bits found set since the last packet
+//
+uint32_t TakeADCOverload(void);
+
+
+//
+// GetADCOverloadStatistics(struct ADCOverloadStatistics* Stats)
+//
+void GetADCOverloadStatistics(struct ADCOverloadStatistics* Stats);
+
+
+#endif
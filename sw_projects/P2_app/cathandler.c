@@ -29,6 +29,11 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <netinet/tcp.h>
 
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
@@ -36,6 +41,8 @@
 #include "../common/debugaids.h"
 #include "cathandler.h"
 #include "catmessages.h"
+#include "catparser.h"
+#include "threadplacement.h"
 
 
 
@@ -54,14 +61,31 @@ char ParsedString[20];                      // if string expected, it goes here
 
 
 
-#define VNUMOPSTRINGS 16                    // size of output queue
+#define VNUMOPSTRINGS 64                    // size of output queue. Must be a power of 2
 #define VOPSTRSIZE 40                       // size of each string in queue
 //
-// CAT output buffer
+// CAT output queue
+// lock free, multiple producer (panel, ATU and CAT parse code) and single consumer
+// (the CAT thread). Each slot has a sequence number: a producer claims slot Head by
+// advancing CATWritePtr, fills it, then sets its sequence to Head+1 to publish it.
+// the consumer releases a slot by setting its sequence to Tail+VNUMOPSTRINGS,
+// which makes it free for the producer one lap later.
 //
-char OutputStrings[VNUMOPSTRINGS] [VOPSTRSIZE];
-int CATWritePtr = 0;                        // pointer to next string to write
-int CATReadPtr = 0;                         // pointer to next string to read
+struct CATOutputSlot
+{
+  _Atomic uint32_t Sequence;
+  uint32_t Length;
+  char Text[VOPSTRSIZE];
+};
+
+struct CATOutputSlot OutputStrings[VNUMOPSTRINGS];
+_Atomic uint32_t CATWritePtr = 0;           // free running count of slots claimed
+uint32_t CATReadPtr = 0;                    // free running count of slots read (CAT thread only)
+_Atomic uint32_t CATMessagesDropped = 0;    // messages lost because the queue was full
+uint32_t CATSendOffset = 0;                 // bytes of the oldest message already sent
+int CATEventFd = -1;                        // signalled when a message is queued
+
+#define VCATPOLLTIMEOUT 100                 // ms; how often the CAT thread checks for shutdown or port change
 
 
 extern SCATCommands GCATCommands[];
@@ -96,11 +120,6 @@ long DivisorTable[] =
 
 
 
-// this array holds a 32 bit representation of the CAT command
-// to so a compare in a single test
-unsigned long GCATMatch[VNUMCATCMDS];
-
-
 //
 // helper: categorise character as lower case
 // (replaces Arduino function)
@@ -128,29 +147,6 @@ bool isDigit(char ch)
 
 
 
-//
-// Make32BitStr
-// simply a 4 char CAT command in a single 32 bit word for easy compare
-//
-unsigned long Make32BitStr(char* Input)
-{
-  unsigned long Result;
-  byte CharCntr;
-  char Ch;
-  
-  Result = 0;
-  for(CharCntr=0; CharCntr < 4; CharCntr++)
-  {
-    Ch = Input[CharCntr];                                           // input character
-    if (isLowerCase(Ch))                                             // force lower case to upper case
-      Ch -= 0x20;
-    Result = (Result << 8) | Ch;
-  }
-  return Result;
-}
-
-
-
 //
 // helper: constrain the size of a number
 // (replaces Arduino function)
@@ -175,14 +171,13 @@ int constrain(int Value, int Lower, int Upper)
 void InitCATHandler()
 {
   int CmdCntr;
-  unsigned long MatchWord;
+  char* Names[VNUMCATCMDS];
 
-// initialise the matching 32 bit words to hold a version of each CAT command
+// build the lookup table that finds a CAT command from its 4 character name
   for(CmdCntr=0; CmdCntr < VNUMCATCMDS; CmdCntr++)
-  {
-    MatchWord = Make32BitStr(GCATCommands[CmdCntr].CATString);
-    GCATMatch[CmdCntr] = MatchWord;
-  }
+    Names[CmdCntr] = GCATCommands[CmdCntr].CATString;
+  if(BuildCATLookup(Names, VNUMCATCMDS))
+    printf("CAT command lookup table build failed\n");
   CATPort = 0;                        // set port not assigned
   CATPortAssigned = false;
 }
@@ -211,13 +206,13 @@ bool isNumeric(char ch)
 // ParseCATCmd()
 // Parse a single command in the local input buffer
 // process it if it is a valid command
+// Length includes the terminating semicolon; the buffer need not be null terminated
 //
-void ParseCATCmd(char* Buffer)
+void ParseCATCmd(char* Buffer, uint32_t Length)
 {
   int CharCnt;                              // number of characters in the buffer (same as length of string)
-  unsigned long MatchWord;                  // 32 bit compressed input cmd
+  int LookupResult;                         // index of matched command, or -1
   ECATCommands MatchedCAT = eNoCommand;     // CAT command we've matched this to
-  int CmdCntr;                              // counts CAT commands
   SCATCommands* StructPtr;                  // pointer to structure with CAT data
   ERXParamType ParsedType;                  // type of parameter actually found
   int ByteCntr;
@@ -225,24 +220,21 @@ void ParseCATCmd(char* Buffer)
   bool ValidResult = true;                  // true if we get a valid parse result
   void (*HandlerPtr)(void); 
   
-  CharCnt = strlen(Buffer) - 1;
+  CharCnt = (int)Length - 1;
 //
-// CharCnt holds the input string length excluding the terminating null and excluding the semicolon
-// test minimum length for a valid CAT command: ZZxx; plus terminating 0
+// CharCnt holds the input string length excluding the semicolon
+// test minimum length for a valid CAT command: ZZxx; 
+// and that the parameter fits the parse string
 //
-  if (CharCnt < 4)
+  if ((CharCnt < 4) || ((CharCnt - 4) >= (int)sizeof(ParsedString)))
     ValidResult = false;
   else
   {
-    MatchWord = Make32BitStr(Buffer);
-    for (CmdCntr=0; CmdCntr < VNUMCATCMDS; CmdCntr++)         // loop thro commands we recognise
+    LookupResult = LookupCATCommand(Buffer);                          // one hash lookup, no string compares
+    if (LookupResult >= 0)
     {
-      if (GCATMatch[CmdCntr] == MatchWord)
-      {
-        MatchedCAT = (ECATCommands)CmdCntr;                           // if a match, exit loop
-        StructPtr = GCATCommands + (int)CmdCntr;
-        break;
-      }
+      MatchedCAT = (ECATCommands)LookupResult;
+      StructPtr = GCATCommands + LookupResult;
     }
     if(MatchedCAT == eNoCommand)                                      // if no match was found
       ValidResult = false;
@@ -330,31 +322,119 @@ void ParseCATCmd(char* Buffer)
 }
 
 //
-// get CAT o/p buffer Used
+// set the CAT output queue to empty, with every slot free
+// only call when no messages are being queued or sent
 //
-int GetCATOPBufferUsed(void)
+static void InitCATOutputQueue(void)
 {
-  int Used;                           // number of occupied locations
-  Used = CATWritePtr - CATReadPtr;
-  if(Used < 0)
-    Used +=  + VNUMOPSTRINGS;
-  return Used;
+  uint32_t Slot;
+
+  for(Slot = 0; Slot < VNUMOPSTRINGS; Slot++)
+    atomic_store_explicit(&OutputStrings[Slot].Sequence, Slot, memory_order_relaxed);
+  atomic_store_explicit(&CATWritePtr, 0, memory_order_relaxed);
+  CATReadPtr = 0;
+  CATSendOffset = 0;
 }
 
 
 //
 // send a CAT command
 // only attempt send if an active CAT port exists
+// can be called from any thread; never blocks. If the queue is full the message is dropped.
 //
 void SendCATMessage(char* Msg)
 {
-  if((GetCATOPBufferUsed() <= (VNUMOPSTRINGS - 1))&&(CATPortAssigned == true))
+  struct CATOutputSlot* Slot;
+  uint32_t Head;
+  int32_t Diff;
+
+  if(CATPortAssigned != true)
+    return;
+  Head = atomic_load_explicit(&CATWritePtr, memory_order_relaxed);
+  while(1)
   {
-    strcpy(OutputStrings[CATWritePtr++], Msg);
+    Slot = OutputStrings + (Head & (VNUMOPSTRINGS - 1));
+    Diff = (int32_t)(atomic_load_explicit(&Slot->Sequence, memory_order_acquire) - Head);
+    if(Diff == 0)
+    {
+      if(atomic_compare_exchange_weak_explicit(&CATWritePtr, &Head, Head + 1, memory_order_relaxed, memory_order_relaxed))
+        break;                                              // slot claimed
+    }
+    else if(Diff < 0)
+    {
+      atomic_fetch_add_explicit(&CATMessagesDropped, 1, memory_order_relaxed);
+      return;                                               // queue full
+    }
+    else
+      Head = atomic_load_explicit(&CATWritePtr, memory_order_relaxed);    // another producer got it
+  }
+  strncpy(Slot->Text, Msg, VOPSTRSIZE - 1);
+  Slot->Text[VOPSTRSIZE - 1] = 0;
+  Slot->Length = strlen(Slot->Text);
+  atomic_store_explicit(&Slot->Sequence, Head + 1, memory_order_release);
+  eventfd_write(CATEventFd, 1);                             // wake the CAT thread
+  if(UseDebug)
     printf("Sent CAT msg %s\n", Msg);                       // debug
-    if(CATWritePtr >= VNUMOPSTRINGS)
-      CATWritePtr = 0;
+}
+
+
+//
+// send every message waiting in the CAT output queue with one writev() call,
+// then free the slots that have been completely sent.
+// the socket is non blocking: if it accepts only part of the data, the rest stays
+// queued (CATSendOffset records how much of the oldest message has gone) and is
+// sent when the socket is writable again.
+// return true if messages are still waiting to be sent
+//
+static bool SendCATOutputQueue(int Socketid)
+{
+  struct iovec Iovecs[VNUMOPSTRINGS];
+  struct CATOutputSlot* Slot;
+  uint32_t Count = 0;
+  ssize_t Sent;
+
+  while(Count < VNUMOPSTRINGS)
+  {
+    Slot = OutputStrings + ((CATReadPtr + Count) & (VNUMOPSTRINGS - 1));
+    if(atomic_load_explicit(&Slot->Sequence, memory_order_acquire) != (CATReadPtr + Count + 1))
+      break;                                                // not yet published
+    Iovecs[Count].iov_base = Slot->Text;
+    Iovecs[Count].iov_len = Slot->Length;
+    Count++;
+  }
+  if(Count == 0)
+    return false;
+  Iovecs[0].iov_base = (char*)Iovecs[0].iov_base + CATSendOffset;      // part sent last time
+  Iovecs[0].iov_len -= CATSendOffset;
+
+  do
+    Sent = writev(Socketid, Iovecs, Count);
+  while((Sent < 0) && (errno == EINTR));
+  if(Sent < 0)
+  {
+    if((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      perror("CAT writev");
+    return true;
+  }
+  //
+  // release the messages fully sent
+  //
+  Sent += CATSendOffset;
+  CATSendOffset = 0;
+  while(Count != 0)
+  {
+    Slot = OutputStrings + (CATReadPtr & (VNUMOPSTRINGS - 1));
+    if((size_t)Sent < Slot->Length)
+    {
+      CATSendOffset = Sent;
+      return true;
+    }
+    Sent -= Slot->Length;
+    atomic_store_explicit(&Slot->Sequence, CATReadPtr + VNUMOPSTRINGS, memory_order_release);
+    CATReadPtr++;
+    Count--;
   }
+  return false;
 }
 
 
@@ -517,6 +597,9 @@ void MakeCATMessageString(ECATCommands Cmd, char* Param)
 // will be instructed to stop & exit by SDRActive becoming false
 // (connection to SDR client list so no port to make use of)
 // this is called when a connection port available; create socket on entry.
+// the thread waits in poll() for CAT data from the client, for a queued output
+// message (signalled on CATEventFd) or, if output is held up, for the socket to
+// become writable, so panel messages go out as soon as they are queued.
 //
 void* CATHandlerThread(void *arg)
 {
@@ -526,8 +609,10 @@ void* CATHandlerThread(void *arg)
     int ActiveCATPort;
     int ReadResult;
     char ReadBuffer[1024] = {0};
-    char SendBuffer[1024] = {0};
-    unsigned int TXMessageLength;
+    struct pollfd PollFds[2];                        // [0]=socket; [1]=output queue event
+    bool OutputWaiting = false;                      // true if the socket couldn't take all the output
+    eventfd_t EventCount;
+    struct CATStreamParser Parser;                   // holds a command split across reads
 //    bool DebugMessageSent = false;
 
     //
@@ -540,7 +625,6 @@ void* CATHandlerThread(void *arg)
       // create socket for TCP/IP connection
       //
       printf("Creating CAT socket on port %d\n", CATPort);
-      struct timeval ReadTimeout;                                       // read timeout
       int yes = 1;
       if((CATSocketid = socket(AF_INET, SOCK_STREAM, 0)) < 0)
       {
@@ -549,12 +633,10 @@ void* CATHandlerThread(void *arg)
       }
 
     //
-    // set 1ms timeout, and re-use any recently open ports
+    // re-use any recently open ports, and send each message straight away (no Nagle delay)
     //
       setsockopt(CATSocketid, SOL_SOCKET, SO_REUSEADDR, (void *)&yes , sizeof(yes));
-      ReadTimeout.tv_sec = 0;
-      ReadTimeout.tv_usec = 1000;
-      setsockopt(CATSocketid, SOL_SOCKET, SO_RCVTIMEO, (void *)&ReadTimeout , sizeof(ReadTimeout));
+      setsockopt(CATSocketid, IPPROTO_TCP, TCP_NODELAY, (void *)&yes , sizeof(yes));
 
     //
     // connect to destination port
@@ -568,9 +650,12 @@ void* CATHandlerThread(void *arg)
       if(connect(CATSocketid, (struct sockaddr *)&addr_cat, sizeof(struct sockaddr_in)) < 0)
       {
           perror("CAT connect");
+          close(CATSocketid);
           return NULL;
       }
+      fcntl(CATSocketid, F_SETFL, fcntl(CATSocketid, F_GETFL) | O_NONBLOCK);
       ThreadActive = true;
+      InitCATOutputQueue();
       CATPortAssigned = true;
 
       printf("connected to CAT\n");
@@ -580,29 +665,39 @@ void* CATHandlerThread(void *arg)
       // now loop; process read, write events
       // exit loop if port number changes
       //
+      OutputWaiting = false;
+      ResetCATStreamParser(&Parser);
       while(!ThreadError && SDRActive && !SignalThreadEnd && (ActiveCATPort == CATPort))    // thread main loop
       {
-  //        ReadResult = read(CATSocketid, ReadBuffer, 1023);
-          ReadResult = recv(CATSocketid, ReadBuffer, 1023, 0);
-          if(ReadResult > 0)
+          PollFds[0].fd = CATSocketid;
+          PollFds[0].events = POLLIN | (OutputWaiting ? POLLOUT : 0);
+          PollFds[1].fd = CATEventFd;
+          PollFds[1].events = POLLIN;
+          if(poll(PollFds, 2, VCATPOLLTIMEOUT) <= 0)
+              continue;                                       // timeout or signal: recheck loop conditions
+          if(PollFds[1].revents & POLLIN)
+              eventfd_read(CATEventFd, &EventCount);
+          if(PollFds[0].revents & (POLLIN | POLLHUP | POLLERR))
           {
-              ParseCATCmd(ReadBuffer);
-              memset(ReadBuffer, 0, sizeof(ReadBuffer));
+              ReadResult = recv(CATSocketid, ReadBuffer, sizeof(ReadBuffer), 0);
+              if(ReadResult > 0)
+                  CATParseStream(&Parser, ReadBuffer, ReadResult, ParseCATCmd);   // process every complete command
+              else if((ReadResult == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
+              {
+                  printf("CAT connection closed\n");
+                  ThreadError = true;                         // thread restarts when the client next sends the port
+              }
           }
           //
-          // if there are CAT messages available, send them
+          // if there are CAT messages available, send them.
+          // if the socket is full, wait until it is writable before trying again.
           //
-          while(GetCATOPBufferUsed() != 0)
-          {
-            TXMessageLength = strlen(OutputStrings[CATReadPtr]);
-            strcpy(SendBuffer, OutputStrings[CATReadPtr++]);
-            if(CATReadPtr >= VNUMOPSTRINGS)
-              CATReadPtr = 0;
-            send(CATSocketid, SendBuffer, TXMessageLength, 0);
-          }
-
+          if(!ThreadError && (OutputWaiting ? (PollFds[0].revents & POLLOUT) : (PollFds[1].revents & POLLIN)))
+              OutputWaiting = SendCATOutputQueue(CATSocketid);
       }                                                       // end of thread main loop
       close(CATSocketid);
+      if(atomic_load(&CATMessagesDropped) != 0)
+        printf("CAT output queue full: %u messages dropped\n", atomic_load(&CATMessagesDropped));
       ActiveCATPort = 0;
       CATPort = 0;                                            // set port not assigned
       CATPortAssigned = false;
@@ -620,13 +715,22 @@ void* CATHandlerThread(void *arg)
 // only process this if the port is not yet assigned
 void SetupCATPort(int Port)
 {
+    if (CATEventFd < 0)
+    {
+        CATEventFd = eventfd(0, EFD_NONBLOCK);
+        if (CATEventFd < 0)
+        {
+            perror("CAT eventfd");
+            return;
+        }
+    }
     if (CATPort == 0)
     {
         CATPort = Port;
         if((!ThreadActive) && SDRActive && (CATPort != 0))
         {
 
-          if(pthread_create(&CATThread, NULL, CATHandlerThread, NULL) < 0)
+          if(CreatePlacedThread(&CATThread, eThreadControl, "CAT", CATHandlerThread, NULL) != 0)
           {
               perror("pthread_create CAT handler");
               return;
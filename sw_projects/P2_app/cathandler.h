@@ -113,8 +113,9 @@ void SendCATMessage(char* CatString);
 
 //
 // parse a CAT command, and call appropriate handler
+// Length includes the terminating ;
 //
-void ParseCATCmd(char* CATString);
+void ParseCATCmd(char* CATString, uint32_t Length);
 
 //
 // make a CAT command with a numeric parameter into the provided string
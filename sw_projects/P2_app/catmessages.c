@@ -37,6 +37,7 @@
 #include "g2v2panel.h"
 #include "catmessages.h"
 #include "cathandler.h"
+#include "LDGATU.h"
 
 
 //
@@ -59,14 +60,24 @@ SCATCommands GCATCommands[VNUMCATCMDS] =
   {"ZZZP", eNum, 0, 999, 3, false, NULL},                       // pushbutton
   {"ZZZI", eNum, 0, 999, 3, false, HandleZZZI},                 // indicator
   {"ZZZS", eNum, 0, 9999999, 7, false, HandleZZZS},             // s/w version
-  {"ZZTU", eBool, 0, 1, 1, false, NULL},                        // tune
+  {"ZZTU", eBool, 0, 1, 1, false, HandleZZTU},                  // tune
   {"ZZFA", eStr, 0, 0, 11, false, HandleZZFA},                  // VFO A frequency
   {"ZZXV", eNum, 0, 1023, 4, false, HandleZZXV},                // VFO status
   {"ZZUT", eBool, 0, 1, 1, false, HandleZZUT},                  // 2 tone test
-  {"ZZYR", eBool, 0, 1, 1, false, HandleZZYR}                   // RX1/RX2 buttons
+  {"ZZYR", eBool, 0, 1, 1, false, HandleZZYR},                  // RX1/RX2 buttons
+  {"ZZAI", eBool, 0, 1, 1, false, NULL}                         // auto information (send changes unasked)
 };
 
 
+//
+// tune: the client's tune state, for the LDG ATU handler
+//
+void HandleZZTU(void)
+{
+    NoteATUTuneResponse(ParsedBool);
+}
+
+
 //
 // ZZFA
 // only really here for test - not used operationally
@@ -23,7 +23,7 @@
 // ordered as per documentation, not alphabetically!
 // this list must match exactly the table GCATCommands
 //
-#define VNUMCATCMDS 11
+#define VNUMCATCMDS 12
 
 typedef enum 
 {
@@ -38,12 +38,18 @@ typedef enum
   eZZXV,
   eZZUT,
   eZZYR,
+  eZZAI,                          // auto information
   eNoCommand                      // this is an exception condition
 }ECATCommands;
 
 
 
 
+//
+// tune
+//
+void HandleZZTU(void);                          // tune
+
 //
 // VFO A frequency 
 //
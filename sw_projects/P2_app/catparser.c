@@ -0,0 +1,193 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// catparser.c:
+//
+// split a TCP/IP CAT byte stream into commands, and look up
+// the 4 character command names
+// the lookup is a multiplicative hash: at initialise a multiplier is found that
+// puts every known name in a different table entry, so a lookup is one multiply
+// and one compare.
+//
+//////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "catparser.h"
+
+
+#define VCATHASHSIZE (1 << VCATHASHBITS)
+#define VCATHASHTRIES 100000                    // multipliers tried before giving up
+
+struct CATHashEntry
+{
+  uint32_t Word;                                // command name as 32 bit word; 0 = empty
+  int Index;
+};
+
+struct CATHashEntry CATHashTable[VCATHASHSIZE];
+uint32_t CATHashMultiplier;
+
+
+
+//
+// get the table entry for a command word
+//
+static inline uint32_t CATHash(uint32_t Word, uint32_t Multiplier)
+{
+  return (Word * Multiplier) >> (32 - VCATHASHBITS);
+}
+
+
+//
+// simplify a 4 char CAT command in a single 32 bit word for easy compare
+//
+uint32_t MakeCATWord(char* Cmd)
+{
+  uint32_t Result = 0;
+  uint32_t CharCntr;
+  char Ch;
+
+  for(CharCntr=0; CharCntr < 4; CharCntr++)
+  {
+    Ch = Cmd[CharCntr];
+    if ((Ch >= 'a') && (Ch <= 'z'))                             // force lower case to upper case
+      Ch -= 0x20;
+    Result = (Result << 8) | (uint8_t)Ch;
+  }
+  return Result;
+}
+
+
+//
+// find a multiplier that maps each name to its own table entry
+//
+bool BuildCATLookup(char* const Names[], uint32_t Count)
+{
+  uint32_t Multiplier = 0x9E3779B1;                             // start from the golden ratio
+  uint32_t Try;
+  uint32_t Cntr;
+  uint32_t Entry;
+  bool Collision;
+
+  if (Count > VCATHASHSIZE)
+    return true;
+  for (Try = 0; Try < VCATHASHTRIES; Try++, Multiplier += 2)
+  {
+    memset(CATHashTable, 0, sizeof(CATHashTable));
+    Collision = false;
+    for (Cntr = 0; (Cntr < Count) && !Collision; Cntr++)
+    {
+      Entry = CATHash(MakeCATWord(Names[Cntr]), Multiplier);
+      if (CATHashTable[Entry].Word != 0)
+        Collision = true;
+      CATHashTable[Entry].Word = MakeCATWord(Names[Cntr]);
+      CATHashTable[Entry].Index = Cntr;
+    }
+    if (!Collision)
+    {
+      CATHashMultiplier = Multiplier;
+      return false;
+    }
+  }
+  memset(CATHashTable, 0, sizeof(CATHashTable));
+  return true;
+}
+
+
+//
+// look up a command name
+//
+int LookupCATCommand(char* Cmd)
+{
+  uint32_t Word = MakeCATWord(Cmd);
+  struct CATHashEntry* Entry = CATHashTable + CATHash(Word, CATHashMultiplier);
+
+  return ((Entry->Word == Word) && (Word != 0)) ? Entry->Index : -1;
+}
+
+
+//
+// discard any partial command
+//
+void ResetCATStreamParser(struct CATStreamParser* Parser)
+{
+  Parser->PartialLength = 0;
+  Parser->Discarding = false;
+}
+
+
+//
+// split read data into commands
+//
+void CATParseStream(struct CATStreamParser* Parser, char* Data, uint32_t Length, void (*Dispatch)(char* Cmd, uint32_t Length))
+{
+  char* End = Data + Length;
+  char* Terminator;
+  uint32_t CmdLength;
+
+  while (Data < End)
+  {
+    Terminator = memchr(Data, ';', End - Data);
+    //
+    // finish a command carried over from the last read, or one being discarded
+    //
+    if (Parser->Discarding)
+    {
+      if (Terminator == NULL)
+        return;
+      Parser->Discarding = false;
+      Data = Terminator + 1;
+      continue;
+    }
+    if (Parser->PartialLength != 0)
+    {
+      CmdLength = (Terminator == NULL) ? (uint32_t)(End - Data) : (uint32_t)(Terminator + 1 - Data);
+      if ((Parser->PartialLength + CmdLength) > VCATMAXCMDLENGTH)
+      {
+        Parser->PartialLength = 0;
+        Parser->Discarding = (Terminator == NULL);
+        Data += CmdLength;
+        continue;
+      }
+      memcpy(Parser->Partial + Parser->PartialLength, Data, CmdLength);
+      Parser->PartialLength += CmdLength;
+      Data += CmdLength;
+      if (Terminator != NULL)
+      {
+        Dispatch(Parser->Partial, Parser->PartialLength);
+        Parser->PartialLength = 0;
+      }
+      continue;
+    }
+    //
+    // new command: skip separators, then dispatch in place or keep the start for next time
+    //
+    if ((uint8_t)*Data <= ' ')
+    {
+      Data++;
+      continue;
+    }
+    if (Terminator == NULL)
+    {
+      CmdLength = End - Data;
+      if (CmdLength > VCATMAXCMDLENGTH)
+        Parser->Discarding = true;
+      else
+      {
+        memcpy(Parser->Partial, Data, CmdLength);
+        Parser->PartialLength = CmdLength;
+      }
+      return;
+    }
+    CmdLength = Terminator + 1 - Data;
+    if (CmdLength <= VCATMAXCMDLENGTH)
+      Dispatch(Data, CmdLength);
+    Data = Terminator + 1;
+  }
+}
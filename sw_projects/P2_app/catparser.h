@@ -0,0 +1,79 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// catparser.h:
+//
+// header: split a TCP/IP CAT byte stream into commands, and look up
+// the 4 character command names
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __catparser_h
+#define __catparser_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VCATMAXCMDLENGTH 32                     // longest command accepted, including the ;
+#define VCATHASHBITS 6                          // command lookup table has 64 entries
+
+
+//
+// state kept between reads: the start of a command split across reads
+//
+struct CATStreamParser
+{
+  char Partial[VCATMAXCMDLENGTH];               // bytes of a command not yet terminated
+  uint32_t PartialLength;
+  bool Discarding;                              // true if skipping an over long command
+};
+
+
+//
+// ResetCATStreamParser(struct CATStreamParser* Parser)
+// discard any partial command
+//
+void ResetCATStreamParser(struct CATStreamParser* Parser);
+
+
+//
+// CATParseStream(struct CATStreamParser* Parser, char* Data, uint32_t Length, Dispatch)
+// split newly read data into ; terminated commands, and call Dispatch(Cmd, Length) for each.
+// Length includes the ;. Cmd is not null terminated. Commands contained in Data are
+// dispatched in place; only a command split across reads is copied. Characters that
+// can't start a command (spaces, CR, LF) are skipped, and over long commands discarded.
+//
+void CATParseStream(struct CATStreamParser* Parser, char* Data, uint32_t Length, void (*Dispatch)(char* Cmd, uint32_t Length));
+
+
+//
+// MakeCATWord(char* Cmd)
+// the 4 character command name as a 32 bit word, forced to upper case
+//
+uint32_t MakeCATWord(char* Cmd);
+
+
+//
+// BuildCATLookup(char* const Names[], uint32_t Count)
+// build a collision free hash table for the command names. Index n in the table
+// is Names[n]. Return true if error (too many names, or no hash found).
+//
+bool BuildCATLookup(char* const Names[], uint32_t Count);
+
+
+//
+// LookupCATCommand(char* Cmd)
+// find the 4 character command name at Cmd. Return its index, or -1 if not known.
+//
+int LookupCATCommand(char* Cmd);
+
+
+#endif
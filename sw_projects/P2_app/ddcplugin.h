@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcplugin.h:
+//
+// the interface between p2app and a DDC DSP plugin: a shared object loaded
+// at startup by "-L path[,args]". This is the only header a plugin needs.
+//
+// a plugin exports a function VDDCPLUGINENTRY, of type DDCPluginRegisterFn,
+// that fills in a struct DDCPlugin. Its Process() function is then called by
+// the DDC demux thread for each block of samples of the DDCs it asked for,
+// after any software decimation and before the samples are queued to be sent.
+// Samples are P2 format: 24 bit big endian I then Q, 6 bytes per sample.
+// Process() works in place and may:
+//   - change the sample values (filter, blank, limit, reduce resolution)
+//   - drop samples, by moving the ones it keeps to the front and returning
+//     how many it kept. Dropped samples are counted as a gap in the stream,
+//     so timestamps stay right.
+//   - annotate the stream, with Host->Annotate(): an event for the trace and
+//     a count in the telemetry.
+// Process() runs on the demux thread, so it must not block. Each plugin has a
+// CPU budget, ddc_plugin_budget percent of the time its samples represent;
+// one that keeps going over it is bypassed until the next stream run.
+// A plugin stays loaded until p2app exits.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ddcplugin_h
+#define __ddcplugin_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VDDCPLUGINAPIVERSION 1
+#define VDDCPLUGINENTRY "DDCPluginRegister"         // symbol the plugin exports
+
+
+//
+// given to a plugin by p2app
+//
+struct DDCPluginHost
+{
+  uint32_t APIVersion;                          // VDDCPLUGINAPIVERSION of p2app
+  uint32_t NumDDC;                              // DDCs 0 to NumDDC-1
+  void (*Annotate)(uint32_t Code);              // from Process() only: note an event on the DDC being processed
+};
+
+
+//
+// filled in by the plugin's register function
+//
+struct DDCPlugin
+{
+  const char* Name;                             // for messages and telemetry
+  uint32_t DDCMask;                             // bit n set to process DDC n
+  void* Context;                                // passed back to the functions below
+  //
+  // optional: called before the first samples of a DDC in each stream run, and when its rate changes
+  //
+  void (*Start)(void* Context, uint32_t DDC, uint32_t RateKHz);
+  //
+  // process Count samples in place. Return the number kept (Count if none dropped)
+  //
+  uint32_t (*Process)(void* Context, uint32_t DDC, uint8_t* Samples, uint32_t Count, uint32_t RateKHz);
+};
+
+
+//
+// the function a plugin exports as VDDCPLUGINENTRY. Args is the text after the
+// path's comma, or "" if none. Return true if error, and the plugin is not used.
+//
+typedef bool (*DDCPluginRegisterFn)(const struct DDCPluginHost* Host, struct DDCPlugin* Plugin, const char* Args);
+
+
+#endif
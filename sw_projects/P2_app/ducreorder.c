@@ -0,0 +1,220 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ducreorder.c:
+//
+// sequence number reorder buffer for DUC I/Q frames
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <string.h>
+#include "ducreorder.h"
+#include "telemetry.h"
+#include "eventtrace.h"
+#include "p2config.h"
+
+
+void ResetDUCReorder(struct DUCReorderBuffer* Buffer)
+{
+  uint32_t Slot;
+
+  for (Slot = 0; Slot < VDUCREORDERMAX; Slot++)
+    Buffer->Slots[Slot].Held = false;
+  Buffer->Started = false;
+  Buffer->Held = 0;
+  Buffer->LastReady = NULL;
+  memset(Buffer->Last, 0, sizeof(Buffer->Last));
+  memset(Buffer->Zero, 0, sizeof(Buffer->Zero));
+  TelemetryBufferFill(eTelDUC, 0);
+}
+
+
+//
+// the frames passed on last time have been used, and the frame a repeat would
+// copy may be overwritten from now on: keep a copy of it
+//
+static void KeepLastFrame(struct DUCReorderBuffer* Buffer)
+{
+  if ((Buffer->LastReady != NULL) && (Buffer->LastReady != Buffer->Last))
+    memcpy(Buffer->Last, Buffer->LastReady, VDUCREORDERFRAMEBYTES);
+  Buffer->LastReady = NULL;
+}
+
+
+static void PassOn(struct DUCReorderBuffer* Buffer, struct DUCReadyFrame* Ready, uint8_t* Samples,
+                   uint64_t Stamp, uint64_t Hardware)
+{
+  Ready->Samples = Samples;
+  Ready->Stamp = Stamp;
+  Ready->Hardware = Hardware;
+  Buffer->LastReady = Samples;
+  Buffer->Next++;
+}
+
+
+//
+// pass on the frame at Next: the one held, or a concealed frame if it is missing
+//
+static void PassOnNext(struct DUCReorderBuffer* Buffer, struct DUCReadyFrame* Ready)
+{
+  struct DUCReorderSlot* Slot = Buffer->Slots + (Buffer->Next % VDUCREORDERMAX);
+  uint8_t* Concealed;
+
+  if (Slot->Held && (Slot->Sequence == Buffer->Next))
+  {
+    Slot->Held = false;
+    Buffer->Held--;
+    PassOn(Buffer, Ready, Slot->Samples, Slot->Stamp, Slot->Hardware);
+    return;
+  }
+  Concealed = Buffer->Zero;
+  if (P2Config.DUCConceal && (Buffer->LastReady != NULL))
+    Concealed = Buffer->LastReady;
+  else if (P2Config.DUCConceal)
+    Concealed = Buffer->Last;
+  TelemetryCountConcealed(eTelDUC);
+  Trace(eTraceDUCConceal, Buffer->Next, Buffer->Held);
+  PassOn(Buffer, Ready, Concealed, 0, 0);
+}
+
+
+//
+// pass on the frames held in order from Next, stopping at a missing one
+//
+static uint32_t PassOnHeld(struct DUCReorderBuffer* Buffer, uint32_t Room, struct DUCReadyFrame* Ready)
+{
+  struct DUCReorderSlot* Slot;
+  uint32_t Count = 0;
+
+  while ((Buffer->Held != 0) && (Count < Room))
+  {
+    Slot = Buffer->Slots + (Buffer->Next % VDUCREORDERMAX);
+    if (!Slot->Held || (Slot->Sequence != Buffer->Next))
+      break;
+    PassOnNext(Buffer, Ready + Count++);
+  }
+  return Count;
+}
+
+
+//
+// pass on everything held, concealing the gaps; any that don't fit in Room are dropped
+//
+static uint32_t Flush(struct DUCReorderBuffer* Buffer, uint32_t Room, struct DUCReadyFrame* Ready)
+{
+  uint32_t Count = 0;
+  uint32_t Slot;
+
+  while ((Buffer->Held != 0) && (Count < Room))
+    PassOnNext(Buffer, Ready + Count++);
+  for (Slot = 0; (Slot < VDUCREORDERMAX) && (Buffer->Held != 0); Slot++)
+    if (Buffer->Slots[Slot].Held)
+    {
+      Buffer->Slots[Slot].Held = false;
+      Buffer->Held--;
+      TelemetryCountLate(eTelDUC);
+    }
+  return Count;
+}
+
+
+uint32_t AddDUCReorderFrame(struct DUCReorderBuffer* Buffer, uint32_t Sequence, uint8_t* Samples,
+                            uint64_t Stamp, uint64_t Hardware, uint32_t Room, struct DUCReadyFrame* Ready)
+{
+  struct DUCReorderSlot* Slot;
+  uint32_t Window = P2Config.DUCReorderFrames;
+  uint32_t Count = 0;
+  int32_t Diff;
+
+  KeepLastFrame(Buffer);
+  if (Window == 0)
+    Window = 1;
+  Diff = (int32_t)(Sequence - Buffer->Next);
+  if (!Buffer->Started || (Diff >= VDUCREORDERRESYNC) || (Diff <= -VDUCREORDERRESYNC))
+  {
+    //
+    // first frame, or the client has restarted its sequence: pass on what is held
+    //
+    Count = Flush(Buffer, Room, Ready);
+    Buffer->Started = true;
+    Buffer->Next = Sequence;
+    Diff = 0;
+  }
+  if (Diff < 0)                                             // its place has been filled already
+  {
+    TelemetryCountLate(eTelDUC);
+    return Count;
+  }
+  //
+  // a gap as wide as the window: stop waiting for the oldest missing frames
+  //
+  while ((Diff >= (int32_t)Window) && (Count < Room))
+  {
+    PassOnNext(Buffer, Ready + Count++);
+    Diff--;
+  }
+  if ((Diff == 0) && (Count < Room))
+  {
+    PassOn(Buffer, Ready + Count++, Samples, Stamp, Hardware);
+    Count += PassOnHeld(Buffer, Room - Count, Ready + Count);
+  }
+  else if (Diff >= (int32_t)Window)
+    TelemetryCountLate(eTelDUC);                            // no room to release the frames it pushes out
+  else
+  {
+    Slot = Buffer->Slots + (Sequence % VDUCREORDERMAX);
+    if (Slot->Held)
+      return Count;                                         // duplicate: counted by the sequence tracker
+    Slot->Held = true;
+    Slot->Sequence = Sequence;
+    Slot->Arrival = TelemetryTimestamp();
+    Slot->Stamp = Stamp;
+    Slot->Hardware = Hardware;
+    memcpy(Slot->Samples, Samples, VDUCREORDERFRAMEBYTES);
+    Buffer->Held++;
+  }
+  TelemetryBufferFill(eTelDUC, Buffer->Held);
+  return Count;
+}
+
+
+uint32_t DUCReorderWait(struct DUCReorderBuffer* Buffer)
+{
+  uint64_t Oldest = UINT64_MAX;
+  uint64_t Waited;
+  uint32_t Slot;
+
+  if (Buffer->Held == 0)
+    return UINT32_MAX;
+  if (P2Config.DUCReorderFrames == 0)
+    return 0;
+  for (Slot = 0; Slot < VDUCREORDERMAX; Slot++)
+    if (Buffer->Slots[Slot].Held && (Buffer->Slots[Slot].Arrival < Oldest))
+      Oldest = Buffer->Slots[Slot].Arrival;
+  Waited = TelemetryTimestamp() - Oldest;
+  if (Waited >= P2Config.DUCReorderDeadline)
+    return 0;
+  return P2Config.DUCReorderDeadline - (uint32_t)Waited;
+}
+
+
+uint32_t ReleaseDUCReorderFrames(struct DUCReorderBuffer* Buffer, uint32_t Room, struct DUCReadyFrame* Ready)
+{
+  uint32_t Count = 0;
+
+  KeepLastFrame(Buffer);
+  while ((Buffer->Held != 0) && (Count < Room) && (DUCReorderWait(Buffer) == 0))
+  {
+    PassOnNext(Buffer, Ready + Count++);
+    Count += PassOnHeld(Buffer, Room - Count, Ready + Count);
+  }
+  TelemetryBufferFill(eTelDUC, Buffer->Held);
+  return Count;
+}
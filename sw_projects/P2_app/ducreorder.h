@@ -0,0 +1,104 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ducreorder.h:
+//
+// header: sequence number reorder buffer for DUC I/Q frames
+//
+// frames are passed on in sequence order. One that arrives early, after a gap,
+// is held until the missing frames arrive, or until the first frame held has
+// waited duc_reorder_us, or until the gap is duc_reorder_frames wide; each
+// frame still missing then is concealed by a frame of zeros (duc_conceal 0)
+// or a repeat of the frame before it (duc_conceal 1), so the DUC FIFO keeps
+// its timing. A frame arriving after its place has gone is dropped as late.
+// in order frames are passed straight on, without a copy or any wait.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ducreorder_h
+#define __ducreorder_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VDUCREORDERMAX 8                        // max duc_reorder_frames: frames held
+#define VDUCREORDERRESYNC 16                    // bigger sequence jumps restart the buffer
+#define VDUCREORDERFRAMEBYTES 1440              // I/Q sample bytes per frame, as received
+
+
+//
+// one frame ready to be written, in sequence order. Valid until the next call.
+//
+struct DUCReadyFrame
+{
+  uint8_t* Samples;                             // as received: big endian I/Q
+  uint64_t Stamp;                               // kernel receive stamp; 0 if concealed
+  uint64_t Hardware;                            // NIC receive stamp; 0 if none
+};
+
+
+struct DUCReorderSlot
+{
+  bool Held;
+  uint32_t Sequence;
+  uint64_t Arrival;                             // TelemetryTimestamp() us
+  uint64_t Stamp;
+  uint64_t Hardware;
+  uint8_t Samples[VDUCREORDERFRAMEBYTES];
+};
+
+
+struct DUCReorderBuffer
+{
+  struct DUCReorderSlot Slots[VDUCREORDERMAX];  // frame with sequence n is in slot n % VDUCREORDERMAX
+  bool Started;
+  uint32_t Next;                                // sequence number of the next frame to pass on
+  uint32_t Held;                                // frames held
+  uint8_t* LastReady;                           // last frame passed on, while still valid
+  uint8_t Last[VDUCREORDERFRAMEBYTES];          // copy of it, for concealment by repeat
+  uint8_t Zero[VDUCREORDERFRAMEBYTES];          // for concealment by zeros
+};
+
+
+//
+// ResetDUCReorder(struct DUCReorderBuffer* Buffer)
+// drop any frames held and start again from the next frame received
+//
+void ResetDUCReorder(struct DUCReorderBuffer* Buffer);
+
+
+//
+// AddDUCReorderFrame(struct DUCReorderBuffer* Buffer, uint32_t Sequence, uint8_t* Samples,
+//                    uint64_t Stamp, uint64_t Hardware, uint32_t Room, struct DUCReadyFrame* Ready)
+// add a received frame. Up to Room frames ready to write are put in Ready, in order;
+// returns how many. Samples must stay valid until the next call.
+//
+uint32_t AddDUCReorderFrame(struct DUCReorderBuffer* Buffer, uint32_t Sequence, uint8_t* Samples,
+                            uint64_t Stamp, uint64_t Hardware, uint32_t Room, struct DUCReadyFrame* Ready);
+
+
+//
+// ReleaseDUCReorderFrames(struct DUCReorderBuffer* Buffer, uint32_t Room, struct DUCReadyFrame* Ready)
+// give up waiting for missing frames once the wait is over (or reordering is turned off):
+// conceal them and pass on the frames held after them. Returns the frames put in Ready.
+//
+uint32_t ReleaseDUCReorderFrames(struct DUCReorderBuffer* Buffer, uint32_t Room, struct DUCReadyFrame* Ready);
+
+
+//
+// DUCReorderWait(struct DUCReorderBuffer* Buffer)
+// us until ReleaseDUCReorderFrames() will next have frames to release: 0 if now;
+// UINT32_MAX if no frames are held
+//
+uint32_t DUCReorderWait(struct DUCReorderBuffer* Buffer);
+
+
+#endif
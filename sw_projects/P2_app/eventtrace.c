@@ -0,0 +1,294 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// eventtrace.c:
+//
+// per thread binary event trace rings, and writing them to a dump file
+// a dump can be requested while running with:
+//   kill -USR1 `pidof p2app`
+// and is decoded with sw_projects/tracedecode.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "eventtrace.h"
+
+
+#define VDEFAULTTRACEPATH "/tmp/p2app.trace"
+#define VTRACEPATHSIZE 256
+
+//
+// ring states
+//
+#define VTRACERINGINUSE 1
+#define VTRACERINGRELEASED 2
+
+__thread struct TraceRing* ThreadTraceRing;
+__thread bool ThreadTraceUnavailable;
+
+static struct TraceRing* _Atomic TraceRings[VMAXTRACETHREADS];
+static pthread_key_t TraceRingKey;
+static pthread_once_t TraceRingKeyOnce = PTHREAD_ONCE_INIT;
+static volatile sig_atomic_t TraceDumpRequested;
+static char TraceDumpPath[VTRACEPATHSIZE] = VDEFAULTTRACEPATH;
+
+
+//
+// called when a thread with a ring exits. Its events are kept for dumps until
+// all the free rings have been used and a new thread needs this one.
+//
+static void ReleaseTraceRing(void* Arg)
+{
+  struct TraceRing* Ring = (struct TraceRing*)Arg;
+
+  atomic_store(&Ring->State, VTRACERINGRELEASED);
+}
+
+
+static void MakeTraceRingKey(void)
+{
+  pthread_key_create(&TraceRingKey, ReleaseTraceRing);
+}
+
+
+//
+// give the calling thread a ring: a new one if there is an empty slot,
+// otherwise one released by a thread that has exited
+//
+struct TraceRing* TraceAttachThread(void)
+{
+  struct TraceRing* Ring = NULL;
+  struct TraceRing* Expected;
+  uint32_t Released;
+  uint32_t Slot;
+  uint32_t Tid;
+  char Name[VTRACETHREADNAMESIZE];
+
+  pthread_once(&TraceRingKeyOnce, MakeTraceRingKey);
+  Tid = (uint32_t)syscall(SYS_gettid);
+  if (pthread_getname_np(pthread_self(), Name, VTRACETHREADNAMESIZE) != 0)
+    snprintf(Name, VTRACETHREADNAMESIZE, "tid %u", Tid);
+  for (Slot = 0; Slot < VMAXTRACETHREADS; Slot++)
+  {
+    if (atomic_load(&TraceRings[Slot]) != NULL)
+      continue;
+    if (Ring == NULL)
+      Ring = calloc(1, sizeof(struct TraceRing));
+    if (Ring == NULL)
+      break;
+    Ring->State = VTRACERINGINUSE;
+    Ring->Tid = Tid;
+    memcpy(Ring->Name, Name, VTRACETHREADNAMESIZE);
+    Expected = NULL;
+    if (atomic_compare_exchange_strong(&TraceRings[Slot], &Expected, Ring))
+      break;
+  }
+  if (Slot == VMAXTRACETHREADS)
+  {
+    free(Ring);
+    Ring = NULL;
+    for (Slot = 0; Slot < VMAXTRACETHREADS; Slot++)
+    {
+      Released = VTRACERINGRELEASED;
+      if (atomic_compare_exchange_strong(&TraceRings[Slot]->State, &Released, VTRACERINGINUSE))
+      {
+        Ring = TraceRings[Slot];
+        atomic_store(&Ring->Head, 0);
+        Ring->Tid = Tid;
+        memcpy(Ring->Name, Name, VTRACETHREADNAMESIZE);
+        break;
+      }
+    }
+  }
+  if (Ring == NULL)
+  {
+    ThreadTraceUnavailable = true;
+    return NULL;
+  }
+  pthread_setspecific(TraceRingKey, Ring);
+  ThreadTraceRing = Ring;
+  Trace(eTraceThreadStart, Tid, 0);
+  return Ring;
+}
+
+
+//
+// write all of a buffer, looping on short writes. Signal safe.
+// return true if error
+//
+static bool WriteAll(int Fd, const void* Data, size_t Length)
+{
+  const uint8_t* Ptr = (const uint8_t*)Data;
+  ssize_t Written;
+
+  while (Length != 0)
+  {
+    Written = write(Fd, Ptr, Length);
+    if ((Written < 0) && (errno == EINTR))
+      continue;
+    if (Written <= 0)
+      return true;
+    Ptr += Written;
+    Length -= Written;
+  }
+  return false;
+}
+
+
+//
+// write all the rings to a file: only open, write and close, so it is signal safe
+// return true if error
+//
+bool WriteTraceDump(char* Path)
+{
+  struct TraceFileHeader FileHeader;
+  struct TraceThreadHeader ThreadHeader;
+  struct TraceRing* Ring;
+  struct timespec Now;
+  uint64_t Head, Start;
+  uint32_t First, Count;
+  uint32_t Slot;
+  bool Error = false;
+  int Fd;
+
+  Fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (Fd < 0)
+    return true;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  memset(&FileHeader, 0, sizeof(FileHeader));
+  FileHeader.Magic = VTRACEMAGIC;
+  FileHeader.Version = VTRACEVERSION;
+  FileHeader.EventSize = sizeof(struct TraceEvent);
+  FileHeader.DumpTime = (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+  for (Slot = 0; Slot < VMAXTRACETHREADS; Slot++)
+    if (atomic_load(&TraceRings[Slot]) != NULL)
+      FileHeader.NumThreads++;
+  Error = WriteAll(Fd, &FileHeader, sizeof(FileHeader));
+
+  //
+  // the number of threads was counted first, so write exactly that many
+  // even if another ring has appeared since
+  //
+  for (Slot = 0; (Slot < VMAXTRACETHREADS) && (FileHeader.NumThreads != 0) && !Error; Slot++)
+  {
+    Ring = atomic_load(&TraceRings[Slot]);
+    if (Ring == NULL)
+      continue;
+    FileHeader.NumThreads--;
+    Head = atomic_load_explicit(&Ring->Head, memory_order_acquire);
+    Start = (Head > VTRACERINGSIZE) ? Head - VTRACERINGSIZE : 0;
+    memset(&ThreadHeader, 0, sizeof(ThreadHeader));
+    memcpy(ThreadHeader.Name, Ring->Name, VTRACETHREADNAMESIZE);
+    ThreadHeader.Tid = Ring->Tid;
+    ThreadHeader.NumEvents = (uint32_t)(Head - Start);
+    ThreadHeader.FirstSequence = (uint32_t)Start;
+    Error = WriteAll(Fd, &ThreadHeader, sizeof(ThreadHeader));
+    //
+    // oldest first: from the start position to the end of the ring, then the wrapped part
+    //
+    First = (uint32_t)(Start & (VTRACERINGSIZE - 1));
+    Count = ThreadHeader.NumEvents;
+    if ((First + Count) > VTRACERINGSIZE)
+    {
+      if (!Error)
+        Error = WriteAll(Fd, Ring->Events + First, (VTRACERINGSIZE - First) * sizeof(struct TraceEvent));
+      Count -= VTRACERINGSIZE - First;
+      First = 0;
+    }
+    if (!Error)
+      Error = WriteAll(Fd, Ring->Events + First, Count * sizeof(struct TraceEvent));
+  }
+  close(Fd);
+  return Error;
+}
+
+
+//
+// crash handler: write the dump, then let the signal take its normal course.
+// SA_RESETHAND has already put back the default action.
+//
+static void TraceCrashHandler(int Signal)
+{
+  static const char Message[] = "p2app: fatal signal, event trace written\n";
+  ssize_t Written;
+
+  if (!WriteTraceDump(TraceDumpPath))
+  {
+    Written = write(STDERR_FILENO, Message, sizeof(Message) - 1);
+    (void)Written;
+  }
+  raise(Signal);
+}
+
+
+static void TraceDumpHandler(int Signal)
+{
+  (void)Signal;
+  RequestTraceDump();
+}
+
+
+//
+// set the dump file and install the signal handlers
+//
+void InitEventTrace(char* DumpPath)
+{
+  static const int CrashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+  struct sigaction Action;
+  uint32_t Cntr;
+
+  if (DumpPath != NULL)
+    snprintf(TraceDumpPath, sizeof(TraceDumpPath), "%s", DumpPath);
+
+  memset(&Action, 0, sizeof(Action));
+  sigemptyset(&Action.sa_mask);
+  Action.sa_handler = TraceCrashHandler;
+  Action.sa_flags = SA_RESETHAND;
+  for (Cntr = 0; Cntr < sizeof(CrashSignals) / sizeof(CrashSignals[0]); Cntr++)
+    if (sigaction(CrashSignals[Cntr], &Action, NULL) != 0)
+      printf("can't catch signal %d for the event trace\n", CrashSignals[Cntr]);
+
+  Action.sa_handler = TraceDumpHandler;
+  Action.sa_flags = SA_RESTART;
+  if (sigaction(SIGUSR1, &Action, NULL) != 0)
+    printf("\ncan't catch SIGUSR1\n");
+}
+
+
+//
+// signal safe: ask for a dump
+//
+void RequestTraceDump(void)
+{
+  TraceDumpRequested = 1;
+}
+
+
+//
+// write the dump if one has been requested
+//
+bool CheckTraceDump(void)
+{
+  if (!TraceDumpRequested)
+    return false;
+  TraceDumpRequested = 0;
+  if (WriteTraceDump(TraceDumpPath))
+    printf("event trace: can't write %s (errno=%d)\n", TraceDumpPath, errno);
+  else
+    printf("event trace written to %s\n", TraceDumpPath);
+  return true;
+}
@@ -0,0 +1,204 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// eventtrace.h:
+//
+// header: low overhead event trace. Each thread records events (time, id, two
+// arguments) in its own binary ring; the rings are written to a file on SIGUSR1
+// or on a crash, and decoded into a timeline by sw_projects/tracedecode.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __eventtrace_h
+#define __eventtrace_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+
+//
+// the events, with the meaning of their two arguments.
+// listed once here so that p2app and the decoder always agree.
+// new events go on the end, so that old dumps still decode.
+//
+#define TRACEEVENTLIST(X) \
+  X(eTraceThreadStart,     "thread_start",     "tid",        "-")               \
+  X(eTraceGeneralPacket,   "general_packet",   "seq",        "-")               \
+  X(eTraceHighPriority,    "hipri_packet",     "seq",        "run")             \
+  X(eTraceDDCSpecific,     "ddc_specific",     "seq",        "ddc_enables")     \
+  X(eTraceDUCSpecific,     "duc_specific",     "seq",        "-")               \
+  X(eTraceSDRActive,       "sdr_active",       "active",     "-")               \
+  X(eTraceDDCDMA,          "ddc_dma",          "bytes",      "fifo_depth")      \
+  X(eTraceDDCSend,         "ddc_send",         "ddc",        "packets")         \
+  X(eTraceDUCDMA,          "duc_dma",          "frames",     "fifo_depth")      \
+  X(eTraceSpeakerDMA,      "speaker_dma",      "frames",     "buffer_fill")     \
+  X(eTraceMicSend,         "mic_send",         "frames",     "fifo_depth")      \
+  X(eTraceStatusSend,      "status_send",      "seq",        "ptt_bits")        \
+  X(eTraceOverflow,        "overflow",         "stream",     "-")               \
+  X(eTraceUnderflow,       "underflow",        "stream",     "-")               \
+  X(eTraceResync,          "resync",           "stream",     "-")               \
+  X(eTraceSendError,       "send_error",       "stream",     "errno")           \
+  X(eTraceConfigReload,    "config_reload",    "-",          "-")               \
+  X(eTraceStreamState,     "stream_state",     "state",      "run")             \
+  X(eTraceStall,           "stall",            "thread",     "activity")        \
+  X(eTraceStallEnd,        "stall_end",        "thread",     "ms")              \
+  X(eTraceIdle,            "idle",             "idle",       "-")               \
+  X(eTraceShed,            "ddc_shed",         "on",         "mask")              \
+  X(eTracePluginNote,      "plugin_note",      "plugin_ddc", "code")              \
+  X(eTracePluginBypass,    "plugin_bypass",    "plugin",     "ddc")             \
+  X(eTraceKeyEdge,         "key_edge",         "ptt_bits",   "poll_gap_us")     \
+  X(eTraceKeySend,         "key_send",         "ptt_bits",   "delay_us")        \
+  X(eTraceDUCConceal,      "duc_conceal",      "seq",        "held")            \
+  X(eTraceDiversity,       "diversity",        "primary",    "secondary")       \
+  X(eTracePSCapture,       "ps_capture",       "block",      "pairs")           \
+  X(eTracePPS,             "pps",              "second",     "position")        \
+  X(eTraceADCOverload,     "adc_overload",     "bits",       "duration_us")     \
+  X(eTraceDDCRate,         "ddc_rate",         "ddc",        "rate_khz")        \
+  X(eTraceATU,             "atu",              "state",      "event")
+
+#define TRACEENUM(Id, Name, Arg1, Arg2) Id,
+typedef enum
+{
+  TRACEEVENTLIST(TRACEENUM)
+  VNUMTRACEEVENTS
+} ETraceEvent;
+#undef TRACEENUM
+
+
+//
+// dump file format: a TraceFileHeader, then for each thread a TraceThreadHeader
+// followed by its events, oldest first. All in the byte order of the Pi (little endian).
+//
+#define VTRACEMAGIC 0x52543250                  // "P2TR"
+#define VTRACEVERSION 1
+#define VTRACERINGSIZE 4096                     // events per thread; must be a power of 2
+#define VMAXTRACETHREADS 64
+#define VTRACETHREADNAMESIZE 16
+
+struct TraceEvent
+{
+  uint64_t Time;                                // ns, CLOCK_MONOTONIC
+  uint32_t Event;                               // ETraceEvent
+  uint32_t Sequence;                            // events recorded by this thread, to spot gaps
+  uint32_t Arg1;
+  uint32_t Arg2;
+};
+
+struct TraceFileHeader
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t NumThreads;
+  uint32_t EventSize;                           // sizeof(struct TraceEvent)
+  uint64_t DumpTime;                            // ns, CLOCK_MONOTONIC, when the dump was made
+};
+
+struct TraceThreadHeader
+{
+  char Name[VTRACETHREADNAMESIZE];
+  uint32_t Tid;
+  uint32_t NumEvents;
+  uint32_t FirstSequence;                       // sequence number the first event should have
+  uint32_t Spare;
+};
+
+
+//
+// one thread's ring. Only its own thread writes it.
+//
+struct TraceRing
+{
+  _Atomic uint64_t Head;                        // events written
+  _Atomic uint32_t State;                       // free, in use, or released by a thread that has exited
+  uint32_t Tid;
+  char Name[VTRACETHREADNAMESIZE];
+  struct TraceEvent Events[VTRACERINGSIZE];
+};
+
+extern __thread struct TraceRing* ThreadTraceRing;
+extern __thread bool ThreadTraceUnavailable;
+
+
+//
+// TraceAttachThread(void)
+// give the calling thread a ring. Called by Trace() on a thread's first event.
+// return the ring, or NULL if none are left
+//
+struct TraceRing* TraceAttachThread(void);
+
+
+//
+// Trace(ETraceEvent Event, uint32_t Arg1, uint32_t Arg2)
+// record an event in the calling thread's ring: a clock read and four stores.
+//
+static inline void Trace(uint32_t Event, uint32_t Arg1, uint32_t Arg2)
+{
+  struct TraceRing* Ring = ThreadTraceRing;
+  struct TraceEvent* Entry;
+  struct timespec Now;
+  uint64_t Head;
+
+  if (Ring == NULL)
+  {
+    if (ThreadTraceUnavailable)
+      return;
+    Ring = TraceAttachThread();
+    if (Ring == NULL)
+      return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  Head = atomic_load_explicit(&Ring->Head, memory_order_relaxed);
+  Entry = Ring->Events + (Head & (VTRACERINGSIZE - 1));
+  Entry->Time = (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+  Entry->Event = Event;
+  Entry->Sequence = (uint32_t)Head;
+  Entry->Arg1 = Arg1;
+  Entry->Arg2 = Arg2;
+  atomic_store_explicit(&Ring->Head, Head + 1, memory_order_release);
+}
+
+
+//
+// InitEventTrace(char* DumpPath)
+// set the dump file, and install the SIGUSR1 and crash signal handlers.
+// a crash (SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT) writes the dump, then the
+// signal is raised again so the process still ends with a core dump as before.
+//
+void InitEventTrace(char* DumpPath);
+
+
+//
+// RequestTraceDump(void)
+// signal safe: ask for a dump (on SIGUSR1)
+//
+void RequestTraceDump(void);
+
+
+//
+// CheckTraceDump(void)
+// write the dump if one has been requested. Called by the main thread event loop.
+// return true if one was requested, so other reports can be written with it
+//
+bool CheckTraceDump(void);
+
+
+//
+// WriteTraceDump(char* Path)
+// write all the rings to a file. Signal safe.
+// a thread may add events while its ring is copied; the decoder uses the
+// event sequence numbers to drop any that were overwritten.
+// return true if error
+//
+bool WriteTraceDump(char* Path);
+
+
+#endif
@@ -31,7 +31,8 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <gpiod.h>
-#include <pthread.h>
+#include <poll.h>
+#include <sys/timerfd.h>
 
 #include <linux/i2c-dev.h>
 #include "../common/saturnregisters.h"
@@ -42,6 +43,7 @@
 #include "i2cdriver.h"
 #include "cathandler.h"
 #include "andromedacatmessages.h"
+#include "threadplacement.h"
 
 
 //
@@ -68,6 +70,7 @@ int i2c_fd;                                  // file reference
 char* pi_i2c_device = "/dev/i2c-1";
 unsigned int G2MCP23017 = 0x20;                     // i2c slave address of MCP23017 on G2 panel
 unsigned int G2V2Arduino = 0x15;                    // i2c slave address of Arduino on G2V2
+struct I2CShadow G2MCPShadow;                       // MCP23017 register shadow
 
 bool G2PanelControlled = false;
 extern int i2c_fd;                                  // file reference
@@ -76,10 +79,8 @@ char* gpio_device = NULL;
 char *consumer = "p2app";
 struct gpiod_line *VFO1;                            // declare GPIO for VFO
 struct gpiod_line *VFO2;
-pthread_t VFOEncoderThread;                         // thread looks for encoder edge events
-pthread_t G2PanelTickThread;                        // thread with periodic
+pthread_t G2PanelTickThread;                        // thread waits for encoder edge events and the slow tick
 uint16_t GDeltaCount;                    // count stored since last retrieved
-struct timespec ts = {1, 0};
 bool G2PanelActive = false;                         // true while panel active and threads should run
 bool EncodersInitialised = false;                   // true after 1st scan
 bool CATDetected = false;                           // true if panel ID message has been sent
@@ -89,15 +90,20 @@ uint32_t VKeepAliveCount;                           // count of ticks for keepal
 #define VNUMMCPPUSHBUTTONS 16
 #define VNUMBUTTONS VNUMGPIOPUSHBUTTONS+VNUMMCPPUSHBUTTONS
 #define VNUMENCODERS 8
+#define VNUMENCODERPINS 2*VNUMENCODERS
 #define VNUMGPIO 2*VNUMENCODERS +  VNUMGPIOPUSHBUTTONS
+#define VSLOWTICKPERIOD 10000000                // ns: pushbutton scan and encoder report period
+#define VIDLESLOWTICKPERIOD 100000000           // ns: slow tick period in idle power saving
+#define VMAXLINEEVENTS 16                       // edge events read from a line at once
 //
 // IO pins for encoder inputs then 4 pushbutton inputs
+// the encoder pins are requested for edge events; the pushbutton pins are read each slow tick
 //
 uint32_t PBIOPins[VNUMGPIO] = {20, 26, 6, 5, 4, 21, 7, 9, 
                                16, 19, 10, 11, 25, 8, 12, 13,
                                22, 27, 23, 24};
+struct gpiod_line_bulk EncoderLines;
 struct gpiod_line_bulk PBInLines;
-struct gpiod_line_request_config config = {"p2app", GPIOD_LINE_REQUEST_DIRECTION_INPUT, 0};
 int32_t IOPinValues[VNUMGPIO] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
 
 //
@@ -248,29 +254,25 @@ int8_t ReadOpticalEncoder(void)
 
 
 //
-// VFO encoder pin interrupt handler
-// this executes as a thread; it waits for an event on a VFO encoder pin
+// VFO encoder pin event handler
+// called when there are rising edge events on VFO1
 // for a high res encoder at just one interrupt per pulse - use int on one edge and use the sense of the other to set direction.
 //
-void VFOEventHandler(void *arg)
+static void VFOEventHandler(void)
 {
-    int returnval;
+    int EventCount;
+    int Cntr;
     uint8_t DirectionBit;
-    struct gpiod_line_event Event;
+    struct gpiod_line_event Events[VMAXLINEEVENTS];
 
-    while(G2PanelActive)
+    EventCount = gpiod_line_event_read_multiple(VFO1, Events, VMAXLINEEVENTS);    // this is needed to clear the events
+    DirectionBit = gpiod_line_get_value(VFO2);
+    for(Cntr = 0; Cntr < EventCount; Cntr++)
     {
-        returnval = gpiod_line_event_wait(VFO1, &ts);
-        if(returnval > 0)
-        {
-            returnval = gpiod_line_event_read(VFO1, &Event);            // undocumented: this is needed to clear the event
-            DirectionBit = gpiod_line_get_value(VFO2);
-            if(DirectionBit)
-              GDeltaCount--;
-            else
-              GDeltaCount++;
-//            printf("delta count=%d\n", GDeltaCount);
-        }
+        if(DirectionBit)
+          GDeltaCount--;
+        else
+          GDeltaCount++;
     }
 }
 
@@ -291,8 +293,52 @@ void EncoderTick(uint32_t Enc, uint8_t Pin1, uint8_t Pin2)
 }
 
 
-uint32_t TickCounter;
-#define VFASTTICKSPERSLOWTICK 3
+
+
+//
+// process edge events on the two pins of a mechanical encoder
+// the events of both pins are applied in kernel timestamp order, so fast
+// spins decode correctly even if several edges arrive between wakeups
+// Ready[n] is true if pin n has events waiting
+//
+static void EncoderEventHandler(uint32_t Enc, bool Ready[2])
+{
+    struct gpiod_line_event Events[2][VMAXLINEEVENTS];
+    int EventCount[2] = {0, 0};
+    int Next[2] = {0, 0};
+    struct timespec* T0;
+    struct timespec* T1;
+    uint32_t Pin;
+    uint32_t LinePin;
+
+    for(Pin = 0; Pin < 2; Pin++)
+    {
+        if(Ready[Pin])
+            EventCount[Pin] = gpiod_line_event_read_multiple(EncoderLines.lines[2*Enc + Pin], Events[Pin], VMAXLINEEVENTS);
+        if(EventCount[Pin] < 0)
+            EventCount[Pin] = 0;
+    }
+    while((Next[0] < EventCount[0]) || (Next[1] < EventCount[1]))
+    {
+        //
+        // take the oldest event of the two pins
+        //
+        if(Next[0] >= EventCount[0])
+            Pin = 1;
+        else if(Next[1] >= EventCount[1])
+            Pin = 0;
+        else
+        {
+            T0 = &Events[0][Next[0]].ts;
+            T1 = &Events[1][Next[1]].ts;
+            Pin = ((T1->tv_sec < T0->tv_sec) || ((T1->tv_sec == T0->tv_sec) && (T1->tv_nsec < T0->tv_nsec))) ? 1 : 0;
+        }
+        LinePin = 2*Enc + Pin;
+        IOPinValues[LinePin] = (Events[Pin][Next[Pin]].event_type == GPIOD_LINE_EVENT_RISING_EDGE) ? 1 : 0;
+        Next[Pin]++;
+        EncoderTick(Enc, IOPinValues[2*Enc], IOPinValues[2*Enc+1]);
+    }
+}
 
 
 //
@@ -311,8 +357,10 @@ int8_t GetEncoderCount(uint8_t Enc)
 
 
 //
-// periodic timestep
-// perform a "fast tick" and then "slow tick" every N
+// panel thread
+// sleeps in poll() until an encoder edge occurs or the 10ms slow tick timer expires.
+// in idle power saving the slow tick is 100ms.
+// fds: [0] = slow tick timer; [1] = VFO encoder; then 2 per mechanical encoder
 //
 void G2PanelTick(void *arg)
 {
@@ -321,39 +369,82 @@ void G2PanelTick(void *arg)
     uint8_t PinCntr;                            // interates IO pins
     uint32_t MCPData;
     uint32_t Cntr;
-    uint32_t Version;
-    uint32_t CatParam;
     bool I2Cerror;
+    struct pollfd PollFds[2 + VNUMENCODERPINS];
+    struct itimerspec TickPeriod;
+    uint64_t Expirations;
+    int TimerFd;
+    bool Ready[2];
+    bool TickIdle = false;                      // true if the slow tick is at the idle period
+
+    TimerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if(TimerFd < 0)
+    {
+        perror("G2 panel timerfd");
+        return;
+    }
+    TickPeriod.it_interval.tv_sec = 0;
+    TickPeriod.it_interval.tv_nsec = VSLOWTICKPERIOD;
+    TickPeriod.it_value = TickPeriod.it_interval;
+    timerfd_settime(TimerFd, 0, &TickPeriod, NULL);
+    PollFds[0].fd = TimerFd;
+    PollFds[1].fd = gpiod_line_event_get_fd(VFO1);
+    for(Cntr = 0; Cntr < VNUMENCODERPINS; Cntr++)
+        PollFds[2 + Cntr].fd = gpiod_line_event_get_fd(EncoderLines.lines[Cntr]);
+    for(Cntr = 0; Cntr < (2 + VNUMENCODERPINS); Cntr++)
+        PollFds[Cntr].events = POLLIN;
+//
+// get the encoder starting states
+//
+    for(Cntr = 0; Cntr < VNUMENCODERPINS; Cntr++)
+        IOPinValues[Cntr] = gpiod_line_get_value(EncoderLines.lines[Cntr]);
+    for(Cntr=0; Cntr < VNUMENCODERS; Cntr++)
+        EncoderTick(Cntr, IOPinValues[2*Cntr], IOPinValues[2*Cntr+1]);
+    EncodersInitialised = true;
 
     while(G2PanelActive)
     {
-        if(CATPortAssigned)                     // see if CAT has become available for the 1st time
+        if(TickIdle != atomic_load(&SDRIdle))
         {
-            if(CATDetected == false)
-            {
-                CATDetected = true;
-                MakeProductVersionCAT(PRODUCTID, HWVERSION, GetP2appVersion());
-            }
+            TickIdle = !TickIdle;
+            TickPeriod.it_interval.tv_nsec = TickIdle ? VIDLESLOWTICKPERIOD : VSLOWTICKPERIOD;
+            TickPeriod.it_value = TickPeriod.it_interval;
+            timerfd_settime(TimerFd, 0, &TickPeriod, NULL);
         }
-        else
-            CATDetected = false;
-        TickCounter++;
-        gpiod_line_get_value_bulk(&PBInLines, IOPinValues);
+        if(poll(PollFds, 2 + VNUMENCODERPINS, 1000) <= 0)
+            continue;
 //
-// process encoders
+// process encoder edges
 //
+        if(PollFds[1].revents & POLLIN)
+            VFOEventHandler();
         for(Cntr=0; Cntr < VNUMENCODERS; Cntr++)
-            EncoderTick(Cntr, IOPinValues[2*Cntr], IOPinValues[2*Cntr+1]);
-        EncodersInitialised = true;
+        {
+            Ready[0] = (PollFds[2 + 2*Cntr].revents & POLLIN) != 0;
+            Ready[1] = (PollFds[3 + 2*Cntr].revents & POLLIN) != 0;
+            if(Ready[0] || Ready[1])
+                EncoderEventHandler(Cntr, Ready);
+        }
 //
 // execute slower code every 10ms
 //
-        if(TickCounter >= VFASTTICKSPERSLOWTICK)
+        if(PollFds[0].revents & POLLIN)
         {
-            TickCounter=0;
+            read(TimerFd, &Expirations, sizeof(Expirations));
+            if(CATPortAssigned)                     // see if CAT has become available for the 1st time
+            {
+                if(CATDetected == false)
+                {
+                    CATDetected = true;
+                    MakeProductVersionCAT(PRODUCTID, HWVERSION, GetP2appVersion());
+                }
+            }
+            else
+                CATDetected = false;
     //
     // now read MCP I2C pushbuttons, and scan all pushbuttons
     //
+            gpiod_line_get_value_bulk(&PBInLines, IOPinValues + VNUMENCODERPINS);
             MCPData = i2c_read_word_data(0x12, &I2Cerror);                  // read GPIOA, B into bottom 16 bits
             for (Cntr = 16; Cntr < 20; Cntr++)
                 MCPData |= (IOPinValues[Cntr] << Cntr);                     // add in PB IO pin
@@ -403,12 +494,9 @@ void G2PanelTick(void *arg)
                 VKeepAliveCount = 0;
                 MakeCATMessageNoParam(eZZXV);
             }
-
         }
-
-
-        usleep(3333);                                                  // 3.3ms period
     }
+    close(TimerFd);
 }
 
 
@@ -419,6 +507,8 @@ void G2PanelTick(void *arg)
 //
 void SetupG2PanelGPIO(void)
 {
+    uint32_t Cntr;
+
     chip = NULL;
 
     //
@@ -450,9 +540,13 @@ void SetupG2PanelGPIO(void)
         gpiod_line_request_rising_edge_events(VFO1, "VFO 1");
         gpiod_line_request_input(VFO2, "VFO 2");
 
-        printf("assigning line inputs for pushbuttons & encoders\n");
-        gpiod_chip_get_lines(chip, PBIOPins, VNUMGPIO, &PBInLines);
-        gpiod_line_request_bulk(&PBInLines, &config, &IOPinValues);
+        printf("assigning line edge events for encoders, and inputs for pushbuttons\n");
+        gpiod_chip_get_lines(chip, PBIOPins, VNUMENCODERPINS, &EncoderLines);
+        for (Cntr = 0; Cntr < VNUMENCODERPINS; Cntr++)
+            if (gpiod_line_request_both_edges_events(EncoderLines.lines[Cntr], consumer) < 0)
+                printf("encoder GPIO %d edge event request failed\n", PBIOPins[Cntr]);
+        gpiod_chip_get_lines(chip, PBIOPins + VNUMENCODERPINS, VNUMGPIOPUSHBUTTONS, &PBInLines);
+        gpiod_line_request_bulk_input(&PBInLines, consumer);
     }
 }
 
@@ -464,37 +558,48 @@ void SetupG2PanelGPIO(void)
 //
 void SetupG2PanelI2C(void)
 {
+  struct I2CBatch Batch;
+
+  //
+  // all 18 register writes go as one I2C_RDWR transaction; the shadow starts
+  // empty so every register is sent this time
+  //
+  I2CShadowInvalidate(&G2MCPShadow);
+  I2CBatchInit(&Batch, G2MCP23017, &G2MCPShadow);
+
   // setup IOCONA, B
-  if (i2c_write_byte_data(0x0A, 0x00) < 0) { return; }
-  if (i2c_write_byte_data(0x0B, 0x00) < 0) { return; }
+  I2CShadowWriteByte(&Batch, 0x0A, 0x00);
+  I2CShadowWriteByte(&Batch, 0x0B, 0x00);
 
   // GPINTENA, B: disable interrupt
-  if (i2c_write_byte_data(0x04, 0x00) < 0) { return; }
-  if (i2c_write_byte_data(0x05, 0x00) < 0) { return; }
+  I2CShadowWriteByte(&Batch, 0x04, 0x00);
+  I2CShadowWriteByte(&Batch, 0x05, 0x00);
 
   // DEFVALA, B: clear defaults
-  if (i2c_write_byte_data(0x06, 0x00) < 0) { return; }
-  if (i2c_write_byte_data(0x07, 0x00) < 0) { return; }
+  I2CShadowWriteByte(&Batch, 0x06, 0x00);
+  I2CShadowWriteByte(&Batch, 0x07, 0x00);
 
   // OLATA, B: no output data
-  if (i2c_write_byte_data(0x14, 0x00) < 0) { return; }
-  if (i2c_write_byte_data(0x15, 0x00) < 0) { return; }
+  I2CShadowWriteByte(&Batch, 0x14, 0x00);
+  I2CShadowWriteByte(&Batch, 0x15, 0x00);
 
   // set GPIOA, B to have pullups
-  if (i2c_write_byte_data(0x0C, 0xFF) < 0) { return; }
-  if (i2c_write_byte_data(0x0D, 0xFF) < 0) { return; }
+  I2CShadowWriteByte(&Batch, 0x0C, 0xFF);
+  I2CShadowWriteByte(&Batch, 0x0D, 0xFF);
 
   // IOPOLA, B: non inverted polarity polarity
-  if (i2c_write_byte_data(0x02, 0x00) < 0) { return; }
-  if (i2c_write_byte_data(0x03, 0x00) < 0) { return; }
+  I2CShadowWriteByte(&Batch, 0x02, 0x00);
+  I2CShadowWriteByte(&Batch, 0x03, 0x00);
 
   // IODIRA, B: set GPIOA/B for input
-  if (i2c_write_byte_data(0x00, 0xFF) < 0) { return; }
-  if (i2c_write_byte_data(0x01, 0xFF) < 0) { return; }
+  I2CShadowWriteByte(&Batch, 0x00, 0xFF);
+  I2CShadowWriteByte(&Batch, 0x01, 0xFF);
 
   // INTCONA, B
-  if (i2c_write_byte_data(0x08, 0x00) < 0) { return; }
-  if (i2c_write_byte_data(0x09, 0x00) < 0) { return; }
+  I2CShadowWriteByte(&Batch, 0x08, 0x00);
+  I2CShadowWriteByte(&Batch, 0x09, 0x00);
+
+  I2CBatchRun(&Batch);
 }
 
 
@@ -514,12 +619,9 @@ void InitialiseG2PanelHandler(void)
     SetupG2PanelI2C();
 
     G2PanelActive = true;                                   // enable threads
-    if(pthread_create(&VFOEncoderThread, NULL, VFOEventHandler, NULL) < 0)
-        perror("pthread_create VFO encoder");
-    pthread_detach(VFOEncoderThread);
-
     if(pthread_create(&G2PanelTickThread, NULL, G2PanelTick, NULL) < 0)
         perror("pthread_create G2 panel tick");
+    SetThreadName(G2PanelTickThread, "G2 panel tick");
     pthread_detach(G2PanelTickThread);
 }
 
@@ -535,6 +637,7 @@ void ShutdownG2PanelHandler(void)
         sleep(2);                                       // wait 2s to allow threads to close
         gpiod_line_release(VFO1);
         gpiod_line_release(VFO2);
+        gpiod_line_release_bulk(&EncoderLines);
         gpiod_line_release_bulk(&PBInLines);
         gpiod_chip_close(chip);
     }
@@ -31,6 +31,8 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <termios.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
@@ -42,6 +44,7 @@
 #include "i2cdriver.h"
 #include "gpiod.h"
 #include "andromedacatmessages.h"
+#include "threadplacement.h"
 
 
 bool G2V2PanelControlled = false;
@@ -57,7 +60,7 @@ uint8_t G2V2PanelSWID;
 uint8_t G2V2PanelHWVersion;
 uint8_t G2V2PanelProductID;
 uint32_t VKeepAliveCnt;                             // count of ticks for keepalive
-uint8_t CATPollCntr;                                // determines which message to poll for
+uint8_t CATPollCntr;                                // determines which message to poll for (EG2PollMessage)
 bool G2ToneState;                                   // true if 2 tone test in progress
 bool GVFOBSelected;                                 // true if VFO B selected
 uint32_t GCombinedVFOState;                         // reported VFO state bits
@@ -66,20 +69,131 @@ int SerialDev;                                      // serial device
 
 
 #define VKEEPALIVECOUNT 150                         // 15s period between keepalive requests (based on 100ms tick)
+#define VPANELOUTSIZE 256                           // panel output buffer: room for many CAT messages
+#define VPANELOUTQLOW 16                            // more is written once the UART queue is down to this
+#define VPANELPOLLTIMEOUT 100                       // ms; serial thread rechecks G2V2PanelActive
+#define VPANELTICK 100000                           // us: indicator and polling tick
+#define VPANELIDLETICK 500000                       // us: tick in idle power saving
+#define VPANELDRAINWAIT 5                           // ms between UART queue checks while output is held
+#define VSERIALCHARTIME 1042                        // us for one character at 9600 baud
+#define VSERIALGATHERCHARS 8                        // characters waited for when a message is part read
 
 
+//
+// output to the panel is collected here and written by the serial thread, several
+// messages to a write. While the UART is still sending, messages wait here, where a
+// newer indicator (ZZZI) message replaces an unsent one for the same indicator.
+//
+char PanelOutBuffer[VPANELOUTSIZE];
+int PanelOutLength = 0;
+pthread_mutex_t PanelOutMutex = PTHREAD_MUTEX_INITIALIZER;
+int PanelEventFd = -1;                              // wakes the serial thread for new output
+bool PanelOutOverflowed = false;                    // true once a message has been dropped
+
 
 
 //
-// send a CAT message to the panel
+// find an unsent message for the same indicator as ZZZI message Message
+// (same length, same text bar the state digit); NULL if none
 //
-void SendCATtoPanel(char* Message)
+static char* FindPendingIndicator(char* Message, int Length)
 {
-    int Length;                                     // message length in charactera
-    int Cntr;
+    char* Ptr = PanelOutBuffer;
+    char* End = PanelOutBuffer + PanelOutLength;
+    char* Semicolon;
+
+    if((Length < 3) || (strncmp(Message, "ZZZI", 4) != 0))
+        return NULL;
+    while(Ptr < End)
+    {
+        Semicolon = memchr(Ptr, ';', End - Ptr);
+        if(Semicolon == NULL)
+            break;
+        if(((Semicolon + 1 - Ptr) == Length) && (memcmp(Ptr, Message, Length - 2) == 0))
+            return Ptr;
+        Ptr = Semicolon + 1;
+    }
+    return NULL;
+}
+
+
+//
+// write as much of the output buffer as the UART will take, if its queue has emptied
+// enough. Called by the serial thread, or directly before that thread exists.
+// return true if output is still waiting
+//
+static bool WritePanelOutput(void)
+{
+    int Queued = 0;
+    int Written;
+
+    if((ioctl(SerialDev, TIOCOUTQ, &Queued) == 0) && (Queued > VPANELOUTQLOW))
+        return (PanelOutLength != 0);
+
+    pthread_mutex_lock(&PanelOutMutex);
+    if(PanelOutLength != 0)
+    {
+        Written = write(SerialDev, PanelOutBuffer, PanelOutLength);
+        if(Written > 0)
+        {
+            PanelOutLength -= Written;
+            memmove(PanelOutBuffer, PanelOutBuffer + Written, PanelOutLength);
+        }
+        else if((Written < 0) && (errno != EAGAIN) && (errno != EINTR))
+            PanelOutLength = 0;                     // serial port failed: drop the output
+    }
+    Written = PanelOutLength;
+    pthread_mutex_unlock(&PanelOutMutex);
+    return (Written != 0);
+}
+
+
+//
+// add a CAT message to the panel output buffer, without sending it yet
+//
+void QueueCATtoPanel(char* Message)
+{
+    int Length;                                     // message length in characters
+    char* Pending;
 
     Length = strlen(Message);
-    write(SerialDev, Message, Length);
+    pthread_mutex_lock(&PanelOutMutex);
+    Pending = FindPendingIndicator(Message, Length);
+    if(Pending != NULL)
+        memcpy(Pending, Message, Length);           // newer state for an indicator not yet sent
+    else if((PanelOutLength + Length) <= VPANELOUTSIZE)
+    {
+        memcpy(PanelOutBuffer + PanelOutLength, Message, Length);
+        PanelOutLength += Length;
+    }
+    else if(!PanelOutOverflowed)
+    {
+        PanelOutOverflowed = true;
+        printf("G2V2 panel output buffer full; messages dropped\n");
+    }
+    pthread_mutex_unlock(&PanelOutMutex);
+}
+
+
+//
+// send the queued CAT messages to the panel: wake the serial thread to write them
+//
+void FlushCATtoPanel(void)
+{
+    if(PanelEventFd >= 0)
+        eventfd_write(PanelEventFd, 1);
+    else
+        WritePanelOutput();
+}
+
+
+//
+// send a CAT message to the panel
+//
+void SendCATtoPanel(char* Message)
+{
+    QueueCATtoPanel(Message);
+    FlushCATtoPanel();
 }
 
 
@@ -99,7 +213,7 @@ void SetupG2V2PanelSerial(void)
 //
 // setup serial; then send CAT message to read product ID and version register
 //
-    SerialDev = open(G2ARDUINOPATH, O_RDWR);
+    SerialDev = open(G2ARDUINOPATH, O_RDWR | O_NOCTTY | O_NONBLOCK);
     if(SerialDev == 0)
     {
         printf("serial open failed\n");
@@ -136,7 +250,7 @@ void SetupG2V2PanelSerial(void)
 	cfsetospeed(&Ser, B9600);
 	cfsetispeed(&Ser, B9600);
     Ser.c_cc[VTIME] = 0;                // no timeout on read
-    Ser.c_cc[VMIN] = 1;                 // read will return just one character
+    Ser.c_cc[VMIN] = 0;                 // read returns what has arrived: the serial thread waits in poll()
 
 	if (tcsetattr(SerialDev, TCSANOW, &Ser) < 0) 
     {
@@ -169,7 +283,11 @@ bool CheckG2V2PanelPresent(void)
 
 #define VESERINSIZE 120                 // large enough to hold a whole CAT message
 //
-// serial read thread
+// serial thread
+// waits in poll() for characters from the panel, or for queued output (signalled on
+// PanelEventFd). A message that has only partly arrived is given time to finish before
+// the next read, so there are a few wakeups per message rather than one per character.
+// while the UART is still sending, output waits in the buffer and the queue is rechecked.
 //
 void G2V2PanelSerial(void *arg)
 {
@@ -180,6 +298,9 @@ void G2V2PanelSerial(void *arg)
     int CATWritePtr = 0;
     char ch;                                    // individual read character
     int MatchPosition;
+    struct pollfd PollFds[2];                   // [0]=serial port; [1]=output event
+    bool OutputWaiting = false;                 // true if the UART hasn't taken all the output
+    eventfd_t EventCount;
 
     printf("G2 panel Serial read handler thread established\n");
 //
@@ -187,7 +308,18 @@ void G2V2PanelSerial(void *arg)
 //
     while(G2V2PanelActive)
     {
-        ReadCnt = read(SerialDev, &SerialInputBuffer, VESERINSIZE);
+        PollFds[0].fd = SerialDev;
+        PollFds[0].events = POLLIN;
+        PollFds[1].fd = PanelEventFd;
+        PollFds[1].events = POLLIN;
+        PollFds[0].revents = PollFds[1].revents = 0;
+        poll(PollFds, 2, OutputWaiting ? VPANELDRAINWAIT : (atomic_load(&SDRIdle) ? VIDLEWAITTIMEOUT : VPANELPOLLTIMEOUT));
+        if(PollFds[1].revents & POLLIN)
+            eventfd_read(PanelEventFd, &EventCount);
+
+        ReadCnt = 0;
+        if(PollFds[0].revents & POLLIN)
+            ReadCnt = read(SerialDev, &SerialInputBuffer, VESERINSIZE);
         if (ReadCnt > 0)
         {
 //
@@ -198,19 +330,24 @@ void G2V2PanelSerial(void *arg)
             for(Cntr=0; Cntr < ReadCnt; Cntr++)
             {
                 ch=SerialInputBuffer[Cntr];
+                if(CATWritePtr >= (VESERINSIZE - 1))
+                    CATWritePtr = 0;                                // too long for a CAT message: abandon it
                 CATMessageBuffer[CATWritePtr++] = ch;
                 if (ch == ';')
                 {
                     CATMessageBuffer[CATWritePtr++] = 0;            // terminate the string
                     MatchPosition = (int)(strstr(CATMessageBuffer, "ZZZS") - CATMessageBuffer);
                     if(MatchPosition == 0)
-                        ParseCATCmd(CATMessageBuffer);              // if ZZZS, process locally; else send to TCPIP CAT port
+                        ParseCATCmd(CATMessageBuffer, strlen(CATMessageBuffer));              // if ZZZS, process locally; else send to TCPIP CAT port
                     else
                         SendCATMessage(CATMessageBuffer);
                     CATWritePtr = 0;                                // reset for next CAT message
                 }
             }
+            if(CATWritePtr != 0)
+                usleep(VSERIALCHARTIME * VSERIALGATHERCHARS);       // let the rest of the message arrive
         }
+        OutputWaiting = WritePanelOutput();
     }
 }
 
@@ -219,106 +356,178 @@ void G2V2PanelSerial(void *arg)
 
 
 #define VNUMG2V2INDICATORS 9
+#define VPOLLFASTTICKS 1                    // poll interval while states are changing: a message per tick
+#define VPOLLSLOWTICKS 10                   // longest interval while changes are only found by polling
+#define VPOLLPUSHEDTICKS 50                 // interval once the client is seen sending changes itself
+#define VPOLLREPLYTICKS 5                   // a state message this soon after its poll is the reply
+
+
 //
-// periodic timestep
+// CAT state polling
+// on connection the client is asked to send state changes itself (auto information).
+// a state message that arrives when it hasn't just been polled shows that it does, and
+// polling then drops to a slow check. Otherwise polling backs off while the states are
+// steady, doubling its interval each quiet cycle, and returns to fast on a change.
 //
-void G2V2PanelTick(void *arg)
+typedef enum
+{
+    eG2PollZZXV,
+    eG2PollZZUT,
+    eG2PollZZYR,
+    VNUMG2POLLS
+} EG2PollMessage;
+
+static const ECATCommands G2PollCommands[VNUMG2POLLS] = {eZZXV, eZZUT, eZZYR};
+uint32_t G2V2TickCount;                             // ticks since the handler started
+uint32_t G2PollTick[VNUMG2POLLS];                   // tick each state was last polled
+uint32_t G2PollInterval = VPOLLFASTTICKS;           // ticks between polls
+uint32_t G2PollTickCntr;                            // ticks since the last poll
+bool G2StateChangedInCycle;                         // a polled state changed this poll cycle
+bool G2AutoInfoSeen;                                // the client has sent a state change unasked
+pthread_mutex_t G2IndicatorMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+//
+// note a state message from the client, and whether it changed the state
+//
+static void NoteCATStateReport(EG2PollMessage Which, bool Changed)
+{
+    if((G2V2TickCount - G2PollTick[Which]) > VPOLLREPLYTICKS)
+    {
+        if(Changed && !G2AutoInfoSeen)
+        {
+            G2AutoInfoSeen = true;
+            printf("G2V2 panel: CAT client reports state changes; polling slowed\n");
+        }
+    }
+    else if(Changed)
+        G2StateChangedInCycle = true;
+}
+
+
+//
+// poll the next state, once the poll interval is up
+//
+static void PollCATState(void)
+{
+    uint32_t MaxInterval;
+
+    if(++G2PollTickCntr < G2PollInterval)
+        return;
+    G2PollTickCntr = 0;
+    G2PollTick[CATPollCntr] = G2V2TickCount;
+    MakeCATMessageNoParam(G2PollCommands[CATPollCntr]);
+    if(++CATPollCntr < VNUMG2POLLS)
+        return;
+//
+// end of a cycle through the states: back off if none changed
+//
+    CATPollCntr = 0;
+    MaxInterval = G2AutoInfoSeen ? VPOLLPUSHEDTICKS : VPOLLSLOWTICKS;
+    if(G2StateChangedInCycle && !G2AutoInfoSeen)
+        G2PollInterval = VPOLLFASTTICKS;
+    else if(G2PollInterval < MaxInterval)
+        G2PollInterval = ((G2PollInterval * 2) < MaxInterval) ? (G2PollInterval * 2) : MaxInterval;
+    G2StateChangedInCycle = false;
+}
+
+
+//
+// Set LEDs from values reported by CAT messages
+// store into NewLEDStates; then send a ZZZI to the panel for each that differs from before.
+// called when a state message arrives, so the panel follows straight away, and on each tick.
+// ATU tune LEDs are internal to P2app, not Thetis
+//
+static void UpdateG2V2Indicators(void)
 {
     uint32_t NewLEDStates = 0;
+    int Cntr;
+    int Mask = 1;
+    int NewState;
+    int Param;
+    char IndicatorMessage[10];
+
+    if(!G2V2PanelActive || GZZZIReceived)
+        return;
+
+    pthread_mutex_lock(&G2IndicatorMutex);
+    if((GCombinedVFOState & (1<<6)) != 0)
+        NewLEDStates |= 1;                          // MOX bit
+    if((GCombinedVFOState & (1<<7)) != 0)
+        NewLEDStates |= (1 << 1);                   // TUNE bit
+    if(G2ToneState)
+        NewLEDStates |= (1 << 2);                   // 2 tone bit
+    if((GCombinedVFOState & (1<<8)) != 0)
+        NewLEDStates |= (1 << 6);                   // XIT bit
+    if((GCombinedVFOState & (1<<0)) != 0)
+        NewLEDStates |= (1 << 5);                   // RIT bit
+    if(!GVFOBSelected)
+        NewLEDStates |= (1 << 7);                   // led lit if VFO A selected
+
+    if((((GCombinedVFOState & (1<<2)) != 0) && GVFOBSelected) ||
+    (((GCombinedVFOState & (1<<1)) != 0) && !GVFOBSelected))
+        NewLEDStates |= (1 << 8);                   // VFO Lock bit
 
+//
+// now loop through to find differences
+// do bitwise compares; if differences found, send a ZZZI message
+//
+    for(Cntr=0; Cntr < VNUMG2V2INDICATORS; Cntr++)
+    {
+        if((NewLEDStates & Mask) != (GLEDState & Mask))
+        {
+            NewState = (NewLEDStates & Mask) >> Cntr;
+            Param = ((Cntr +1)* 10) + NewState;
+            MakeCATMessageNumeric_Local(eZZZI, Param, IndicatorMessage);
+            QueueCATtoPanel(IndicatorMessage);
+        }
+        Mask = Mask << 1;                               // bitmask for next bit
+    }
+    if(NewLEDStates != GLEDState)
+        FlushCATtoPanel();                              // all the changed indicators in one write
+    GLEDState = NewLEDStates;
+    pthread_mutex_unlock(&G2IndicatorMutex);
+}
+
+
+//
+// periodic timestep
+//
+void G2V2PanelTick(void *arg)
+{
     while(G2V2PanelActive)
     {
+        G2V2TickCount++;
         if(CATPortAssigned)                     // see if CAT has become available for the 1st time
         {
             if(G2V2CATDetected == false)
             {
                 G2V2CATDetected = true;
                 MakeProductVersionCAT(G2V2PanelProductID, G2V2PanelHWVersion, G2V2PanelSWID);
+                MakeCATMessageBool(eZZAI, true);         // ask for changes to be sent as they happen
+                G2AutoInfoSeen = false;                 // poll fast until we see that they are
+                G2PollInterval = VPOLLFASTTICKS;
             }
-        }
-        else
-            G2V2CATDetected = false;
 //
 // poll CAT, if we haven't been sent an indicator message
 //
-        if(GZZZIReceived == false)
-            switch(CATPollCntr++)
-            {
-                case 0:
-                    MakeCATMessageNoParam(eZZXV);
-                    break;
-
-                case 1:
-                    MakeCATMessageNoParam(eZZUT);
-                    break;
-
-                case 2:
-                    MakeCATMessageNoParam(eZZYR);
-                    break;
-
-                default:
-                    CATPollCntr = 0;
-                    break;
-            }
+            if(GZZZIReceived == false)
+                PollCATState();
+        }
+        else
+            G2V2CATDetected = false;
 //
 // check keepalive
-// keep this in case we can ditch the polling at some point
 //
         if(VKeepAliveCnt++ > VKEEPALIVECOUNT)
         {
             VKeepAliveCnt = 0;
+            G2PollTick[eG2PollZZXV] = G2V2TickCount;
             MakeCATMessageNoParam(eZZXV);
         }
-//
-// Set LEDs from values reported by CAT messages
-// store into NewLEDStates; then set to I2C create ZZZI if different from what we had before
-// ATU tune LEDs are internal to P2app, not Thetis
-//
-        if(GZZZIReceived == false)
-        {
-            NewLEDStates = 0;
-            if((GCombinedVFOState & (1<<6)) != 0)
-                NewLEDStates |= 1;                          // MOX bit
-            if((GCombinedVFOState & (1<<7)) != 0)
-                NewLEDStates |= (1 << 1);                   // TUNE bit
-            if(G2ToneState)
-                NewLEDStates |= (1 << 2);                   // 2 tone bit
-            if((GCombinedVFOState & (1<<8)) != 0)
-                NewLEDStates |= (1 << 6);                   // XIT bit
-            if((GCombinedVFOState & (1<<0)) != 0)
-                NewLEDStates |= (1 << 5);                   // RIT bit
-            if(!GVFOBSelected)
-                NewLEDStates |= (1 << 7);                   // led lit if VFO A selected
-
-            if((((GCombinedVFOState & (1<<2)) != 0) && GVFOBSelected) ||
-            (((GCombinedVFOState & (1<<1)) != 0) && !GVFOBSelected))
-                NewLEDStates |= (1 << 8);                   // VFO Lock bit
-
-//
-// now loop through to find differences
-// do bitwise compares; if differences found, senz a ZZZI message
-            int Cntr;
-            int Mask = 1;
-            int NewState;
-            int Param;
-            char IndicatorMessage[10];
-
-            for(Cntr=0; Cntr < VNUMG2V2INDICATORS; Cntr++)
-            {
-                if((NewLEDStates & Mask) != (GLEDState & Mask))
-                {
-                    NewState = (NewLEDStates & Mask) >> Cntr;
-                    Param = ((Cntr +1)* 10) + NewState;
-                    MakeCATMessageNumeric_Local(eZZZI, Param, IndicatorMessage);
-                    SendCATtoPanel(IndicatorMessage);
-
-                }
-                Mask = Mask << 1;                               // bitmask for next bit
-            }
-            GLEDState = NewLEDStates;
-        }
+        UpdateG2V2Indicators();
 
-        usleep(100000);                                                  // 100ms period
+        usleep(atomic_load(&SDRIdle) ? VPANELIDLETICK : VPANELTICK);     // 100ms period; longer in idle
 
     }
 
@@ -335,13 +544,18 @@ void InitialiseG2V2PanelHandler(void)
     G2V2PanelControlled = true;
     printf("Initialising G2V2 panel handler\n");
     G2V2PanelActive = true;
+    PanelEventFd = eventfd(0, EFD_NONBLOCK);
+    if(PanelEventFd < 0)
+        perror("G2V2 panel eventfd");
 
     if(pthread_create(&G2V2PanelTickThread, NULL, G2V2PanelTick, NULL) < 0)
         perror("pthread_create G2 panel tick");
+    SetThreadName(G2V2PanelTickThread, "G2V2 panel tick");
     pthread_detach(G2V2PanelTickThread);
 
     if(pthread_create(&G2V2PanelSerialThread, NULL, G2V2PanelSerial, NULL) < 0)
         perror("pthread_create G2 panel tick");
+    SetThreadName(G2V2PanelSerialThread, "G2V2 panel serial");
     pthread_detach(G2V2PanelSerialThread);
 
 }
@@ -362,7 +576,9 @@ void ShutdownG2V2PanelHandler(void)
 //
 void SetG2V2ZZUTState(bool NewState)
 {
+    NoteCATStateReport(eG2PollZZUT, NewState != G2ToneState);
     G2ToneState = NewState;
+    UpdateG2V2Indicators();
 }
 
 
@@ -371,7 +587,9 @@ void SetG2V2ZZUTState(bool NewState)
 //
 void SetG2V2ZZYRState(bool NewState)
 {
+    NoteCATStateReport(eG2PollZZYR, NewState != GVFOBSelected);
     GVFOBSelected = NewState;
+    UpdateG2V2Indicators();
 }
 
 
@@ -381,7 +599,9 @@ void SetG2V2ZZYRState(bool NewState)
 //
 void SetG2V2ZZXVState(uint32_t NewState)
 {
+    NoteCATStateReport(eG2PollZZXV, NewState != GCombinedVFOState);
     GCombinedVFOState = NewState;
+    UpdateG2V2Indicators();
 }
 
 
@@ -42,6 +42,7 @@
 #include "i2cdriver.h"
 #include "gpiod.h"
 #include "andromedacatmessages.h"
+#include "threadplacement.h"
 
 
 bool G2V2PanelControlled = false;
@@ -62,7 +63,8 @@ static struct gpiod_chip *chip = NULL;
 bool G2ToneState;                                   // true if 2 tone test in progress
 bool GVFOBSelected;                                 // true if VFO B selected
 uint32_t GCombinedVFOState;                         // reported VFO state bits
-uint16_t GLEDState;                                 // LED state settings
+struct I2CShadow GLEDShadow;                        // Arduino register shadow; LED state is register 0x0A
+extern unsigned int G2V2Arduino;                    // i2c slave address of Arduino on G2V2
 
 
 
@@ -73,6 +75,9 @@ uint16_t GLEDState;                                 // LED state settings
 #define VPBPRESS 3
 #define VPBLONGRESS 4
 #define VPBRELEASE 5
+#define VMAXEVENTBATCH 15                           // event count field is 4 bits
+#define VPANELTICK 100000                           // us: indicator and keepalive tick
+#define VPANELIDLETICK 500000                       // us: tick in idle power saving
 
 
 //
@@ -178,21 +183,91 @@ uint8_t GetThetisScanCode(uint8_t V2Code, bool* Shifted)
 
 
 //
-// interrupt thread
+// process one event read from the Arduino i2c event register
+// returns the number of events that were queued, including this one
 //
-void G2V2PanelInterrupt(void *arg)
+static uint8_t ProcessG2V2Event(uint16_t Retval)
 {
-    uint16_t Retval;
     uint8_t EventCount;
     uint8_t EventID;
     uint8_t EventData;
     int8_t Steps;
+    uint8_t Encoder;
+
+    printf("data=%04x; ", Retval);
+    EventID = (Retval >> 8) & 0x0F;
+    EventCount = (Retval >> 12) & 0x0F;
+    EventData = Retval & 0x7F;
+
+    switch(EventID)
+    {
+        case VNOEVENT:
+            break;
+                
+        case VVFOSTEP:
+            Steps = (int8_t)(EventData);
+            Steps |= ((Steps & 0x40) << 1);         // sign extend
+            MakeVFOEncoderCAT(Steps);
+            break;
+
+        case VENCODERSTEP:
+            Steps = (int8_t)(EventData & 0x7);
+            if (Steps >= 4)
+                Steps = -(8-Steps);
+            Encoder = ((EventData>>3) + 1);
+            MakeEncoderCAT(Steps, Encoder);
+            break;
+
+        case VPBPRESS:
+//                            ThetisScanCode = GetThetisScanCode(EventData, &ThetisPBShift);
+//                            if(ThetisPBShift)
+//                            {
+//                                MakePushbuttonCAT(VTHETISSHIFTSCANCODE, 1);
+//                                MakePushbuttonCAT(VTHETISSHIFTSCANCODE, 0);
+//                            }
+//                            MakePushbuttonCAT(ThetisScanCode, 1);
+            MakePushbuttonCAT(EventData, 1);
+            printf("Pushbutton press, scan code = %d; ", EventData);
+            break;
+
+        case VPBLONGRESS:
+//                            ThetisScanCode = GetThetisScanCode(EventData, &ThetisPBShift);
+//                            MakePushbuttonCAT(ThetisScanCode, 2);
+            MakePushbuttonCAT(EventData, 2);
+            printf("Pushbutton longpress, scan code = %d; ", EventData);
+            break;
+
+        case VPBRELEASE:
+//                            ThetisScanCode = GetThetisScanCode(EventData, &ThetisPBShift);
+//                            MakePushbuttonCAT(ThetisScanCode, 0);
+            MakePushbuttonCAT(EventData, 0);
+            printf("Pushbutton release, scan code = %d; ", EventData);
+            break;
+
+        default:
+            printf("spurious event code = %d; ", EventID);
+            break;
+
+    }
+    printf(" Remaining Events Count = %d\n", EventCount);
+    return EventCount;
+}
+
+
+//
+// interrupt thread
+//
+void G2V2PanelInterrupt(void *arg)
+{
+    uint16_t Retval;
+    uint8_t EventCount;
+    uint8_t Remaining = 0;
+    uint16_t Events[VMAXEVENTBATCH];
+    struct I2CBatch Batch;
+    uint32_t Cntr;
     bool Error;
     struct timespec ts = {1, 0};                                    // timeout time = 1s
     struct gpiod_line_event intevent;
-    uint8_t Encoder;
-    bool ThetisPBShift;
-    uint8_t ThetisScanCode;
 
     printf("G2 panel Interrupt Handler thread established\n");
 //
@@ -212,67 +287,31 @@ void G2V2PanelInterrupt(void *arg)
             while(1)
             {
                 Retval = i2c_read_word_data(0x0B, &Error);                  // read Arduino i2c event register
-                if(!Error)
+                if(Error)
                 {
-                    printf("data=%04x; ", Retval);
-                    EventID = (Retval >> 8) & 0x0F;
-                    EventCount = (Retval >> 12) & 0x0F;
-                    EventData = Retval & 0x7F;
-
-                    switch(EventID)
-                    {
-                        case VNOEVENT:
-                            break;
-                                
-                        case VVFOSTEP:
-                            Steps = (int8_t)(EventData);
-                            Steps |= ((Steps & 0x40) << 1);         // sign extend
-                            MakeVFOEncoderCAT(Steps);
-                            break;
-
-                        case VENCODERSTEP:
-                            Steps = (int8_t)(EventData & 0x7);
-                            if (Steps >= 4)
-                                Steps = -(8-Steps);
-                            Encoder = ((EventData>>3) + 1);
-                            MakeEncoderCAT(Steps, Encoder);
-                            break;
-
-                        case VPBPRESS:
-//                            ThetisScanCode = GetThetisScanCode(EventData, &ThetisPBShift);
-//                            if(ThetisPBShift)
-//                            {
-//                                MakePushbuttonCAT(VTHETISSHIFTSCANCODE, 1);
-//                                MakePushbuttonCAT(VTHETISSHIFTSCANCODE, 0);
-//                            }
-//                            MakePushbuttonCAT(ThetisScanCode, 1);
-                            MakePushbuttonCAT(EventData, 1);
-                            printf("Pushbutton press, scan code = %d; ", EventData);
-                            break;
-
-                        case VPBLONGRESS:
-//                            ThetisScanCode = GetThetisScanCode(EventData, &ThetisPBShift);
-//                            MakePushbuttonCAT(ThetisScanCode, 2);
-                            MakePushbuttonCAT(EventData, 2);
-                            printf("Pushbutton longpress, scan code = %d; ", EventData);
-                            break;
-
-                        case VPBRELEASE:
-//                            ThetisScanCode = GetThetisScanCode(EventData, &ThetisPBShift);
-//                            MakePushbuttonCAT(ThetisScanCode, 0);
-                            MakePushbuttonCAT(EventData, 0);
-                            printf("Pushbutton release, scan code = %d; ", EventData);
-                            break;
-
-                        default:
-                            printf("spurious event code = %d; ", EventID);
-                            break;
-
-                    }
-                    printf(" Remaining Events Count = %d\n", EventCount);
-                    if(EventCount <= 1)
-                        break;
+                    usleep(1000);                                               // small 1ms delay between i2c reads
+                    continue;
                 }
+                EventCount = ProcessG2V2Event(Retval);
+                if(EventCount <= 1)
+                    break;
+                //
+                // the count says how many more are queued: read them back to back
+                // in one transaction rather than one ioctl each
+                //
+                usleep(1000);                                                   // small 1ms delay between i2c reads
+                EventCount--;
+                if(EventCount > VMAXEVENTBATCH)
+                    EventCount = VMAXEVENTBATCH;
+                I2CBatchInit(&Batch, G2V2Arduino, NULL);
+                for(Cntr = 0; Cntr < EventCount; Cntr++)
+                    I2CBatchReadWord(&Batch, 0x0B, &Events[Cntr]);
+                if(I2CBatchRun(&Batch) < 0)
+                    continue;
+                for(Cntr = 0; Cntr < EventCount; Cntr++)
+                    Remaining = ProcessG2V2Event(Events[Cntr]);
+                if(Remaining <= 1)
+                    break;
                 usleep(1000);                                                   // small 1ms delay between i2c reads
             }
         }
@@ -290,6 +329,7 @@ void G2V2PanelInterrupt(void *arg)
 void G2V2PanelTick(void *arg)
 {
     uint32_t NewLEDStates = 0;
+    struct I2CBatch Batch;
 
     while(G2V2PanelActive)
     {
@@ -357,13 +397,11 @@ void G2V2PanelTick(void *arg)
             NewLEDStates |= (1 << 8);                   // VFO Lock bit
 
 
-        if(NewLEDStates != GLEDState)
-        {
-            GLEDState = NewLEDStates;
-            i2c_write_word_data(0x0A, NewLEDStates);
-        }
+        I2CBatchInit(&Batch, G2V2Arduino, &GLEDShadow);
+        I2CShadowWriteWord(&Batch, 0x0A, NewLEDStates);         // only queued if changed
+        I2CBatchRun(&Batch);
 
-        usleep(100000);                                                  // 100ms period
+        usleep(atomic_load(&SDRIdle) ? VPANELIDLETICK : VPANELTICK);     // 100ms period; longer in idle
 
     }
 
@@ -385,10 +423,12 @@ void InitialiseG2V2PanelHandler(void)
 
     if(pthread_create(&G2V2PanelTickThread, NULL, G2V2PanelTick, NULL) < 0)
         perror("pthread_create G2 panel tick");
+    SetThreadName(G2V2PanelTickThread, "G2V2 panel tick");
     pthread_detach(G2V2PanelTickThread);
 
     if(pthread_create(&G2V2PanelInterruptThread, NULL, G2V2PanelInterrupt, NULL) < 0)
         perror("pthread_create G2 panel tick");
+    SetThreadName(G2V2PanelInterruptThread, "G2V2 panel interrupt");
     pthread_detach(G2V2PanelInterruptThread);
 }
 
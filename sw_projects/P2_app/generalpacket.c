@@ -18,90 +18,152 @@
 #include <stddef.h>
 #include <stdio.h>
 #include "generalpacket.h"
+#include "eventtrace.h"
+#include "packetfields.h"
 #include "../common/saturnregisters.h"
 
 
 bool HW_Timer_Enable = true;
 
+struct PacketFieldCache GeneralPacketCache;             // last general packet
+
+
 //
-// protocol 2 handler for General Packet to SDR
-// parameter is a pointer to the UDP message buffer.
-// copy port numbers to port table, 
-// then create listener threads for incoming packets & senders foroutgoing
+// setters for the general packet fields
 //
-int HandleGeneralPacket(uint8_t *PacketBuffer)
+static void GPPort(uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
 {
-  uint16_t Port;                                  // port number from table
-  int i;
-  uint8_t Byte;
-
-  SetPort(VPORTDDCSPECIFIC, ntohs(*(uint16_t*)(PacketBuffer+5)));
-  SetPort(VPORTDUCSPECIFIC, ntohs(*(uint16_t*)(PacketBuffer+7)));
-  SetPort(VPORTHIGHPRIORITYTOSDR, ntohs(*(uint16_t*)(PacketBuffer+9)));
-  SetPort(VPORTSPKRAUDIO, ntohs(*(uint16_t*)(PacketBuffer+13)));
-  SetPort(VPORTDUCIQ, ntohs(*(uint16_t*)(PacketBuffer+15)));
-  SetPort(VPORTHIGHPRIORITYFROMSDR, ntohs(*(uint16_t*)(PacketBuffer+11)));
-  SetPort(VPORTMICAUDIO, ntohs(*(uint16_t*)(PacketBuffer+19)));
-
-// DDC ports start at the transferred value then increment
-  Port = ntohs(*(uint16_t*)(PacketBuffer+17));            // DDC0
-  for (i=0; i<10; i++)
-  {
-    if(Port==0)
-      SetPort(VPORTDDCIQ0+i, 0);
-    else
-      SetPort(VPORTDDCIQ0+i, Port+i);
-  }  
+  SetPort(Index, Value);
+}
 
-// similarly, wideband ports start at the transferred value then increment
-  Port = ntohs(*(uint16_t*)(PacketBuffer+21));            // DDC0
-  for (i=0; i<2; i++)
+
+//
+// DDC and wideband ports start at the transferred value then increment
+//
+static void GPPortRange(uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  uint32_t Count;
+  uint32_t i;
+
+  Count = (Index == VPORTDDCIQ0) ? 10 : 2;
+  for (i=0; i<Count; i++)
   {
-    if(Port==0)
-      SetPort(VPORTWIDEBAND0+i, 0);
+    if(Value==0)
+      SetPort(Index+i, 0);
     else
-      SetPort(VPORTWIDEBAND0+i, Port+i);
+      SetPort(Index+i, Value+i);
   }  
+}
+
+
+static void GPWidebandEnables(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetWidebandEnable(eADC1, (bool)(Value&1));
+  SetWidebandEnable(eADC2, (bool)(Value&2));
+}
+
+
+static void GPWidebandSampleCount(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetWidebandSampleCount(Value);
+}
+
+
+static void GPWidebandSampleSize(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetWidebandSampleSize(Value);
+}
+
+
+static void GPWidebandUpdateRate(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetWidebandUpdateRate(Value);
+}
+
+
+static void GPWidebandPacketsPerFrame(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetWidebandPacketsPerFrame(Value);
+}
+
+
 //
-// now set the other data carried by this packet
-// wideband capture data:
-//
-  Byte = *(uint8_t*)(PacketBuffer+23);                // get wideband enables
-  SetWidebandEnable(eADC1, (bool)(Byte&1));
-  SetWidebandEnable(eADC2, (bool)(Byte&2));
-  Port = ntohs(*(uint16_t*)(PacketBuffer+24));        // wideband sample count
-  SetWidebandSampleCount(Port);
-  Byte = *(uint8_t*)(PacketBuffer+26);                // wideband sample size
-  SetWidebandSampleSize(Byte);
-  Byte = *(uint8_t*)(PacketBuffer+27);                // wideband update rate
-  SetWidebandUpdateRate(Byte);
-  Byte = *(uint8_t*)(PacketBuffer+28);                // wideband packets per frame
-  SetWidebandPacketsPerFrame(Byte);
-//
-// envelope PWM data:
-//
-  Port = ntohs(*(uint16_t*)(PacketBuffer+33));        // PWM min
-  SetMinPWMWidth(Port);
-  Port = ntohs(*(uint16_t*)(PacketBuffer+35));        // PWM max
-  SetMaxPWMWidth(Port);
-//
-// various bits
+// envelope PWM data
 //
-  Byte = *(uint8_t*)(PacketBuffer+37);                // flag bits
-  EnableTimeStamp((bool)(Byte&1));
-  EnableVITA49((bool)(Byte&2));
-  SetFreqPhaseWord((bool)(Byte&8));
+static void GPMinPWM(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetMinPWMWidth(Value);
+}
+
+
+static void GPMaxPWM(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetMaxPWMWidth(Value);
+}
 
-  Byte = *(uint8_t*)(PacketBuffer+38);                // enable timeout
-  HW_Timer_Enable = ((bool)(Byte&1));
-  
-  Byte = *(uint8_t*)(PacketBuffer+58);                // flag bits
-  SetPAEnabled((bool)(Byte&1));
-  SetApolloEnabled((bool)(Byte&2));
 
-  Byte = *(uint8_t*)(PacketBuffer+59);                // Alex enable bits
-  SetAlexEnabled(Byte);
+static void GPFlags(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  EnableTimeStamp((bool)(Value&1));
+  EnableVITA49((bool)(Value&2));
+  SetFreqPhaseWord((bool)(Value&8));
+}
 
-  return 0;
+
+static void GPTimeout(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  HW_Timer_Enable = ((bool)(Value&1));
+}
+
+
+static void GPPAApollo(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetPAEnabled((bool)(Value&1));
+  SetApolloEnabled((bool)(Value&2));
 }
 
+
+static void GPAlexEnables(__attribute__((unused)) uint32_t Index, uint32_t Value, __attribute__((unused)) const uint8_t* Packet)
+{
+  SetAlexEnabled(Value);
+}
+
+
+static const struct PacketField GeneralPacketFields[] =
+{
+  {5, 2, VFIELDBIGENDIAN, VPORTDDCSPECIFIC, GPPort},
+  {7, 2, VFIELDBIGENDIAN, VPORTDUCSPECIFIC, GPPort},
+  {9, 2, VFIELDBIGENDIAN, VPORTHIGHPRIORITYTOSDR, GPPort},
+  {13, 2, VFIELDBIGENDIAN, VPORTSPKRAUDIO, GPPort},
+  {15, 2, VFIELDBIGENDIAN, VPORTDUCIQ, GPPort},
+  {11, 2, VFIELDBIGENDIAN, VPORTHIGHPRIORITYFROMSDR, GPPort},
+  {19, 2, VFIELDBIGENDIAN, VPORTMICAUDIO, GPPort},
+  {17, 2, VFIELDBIGENDIAN, VPORTDDCIQ0, GPPortRange},
+  {21, 2, VFIELDBIGENDIAN, VPORTWIDEBAND0, GPPortRange},
+  {23, 1, 0, 0, GPWidebandEnables},
+  {24, 2, VFIELDBIGENDIAN, 0, GPWidebandSampleCount},
+  {26, 1, 0, 0, GPWidebandSampleSize},
+  {27, 1, 0, 0, GPWidebandUpdateRate},
+  {28, 1, 0, 0, GPWidebandPacketsPerFrame},
+  {33, 2, VFIELDBIGENDIAN, 0, GPMinPWM},
+  {35, 2, VFIELDBIGENDIAN, 0, GPMaxPWM},
+  {37, 1, 0, 0, GPFlags},
+  {38, 1, 0, 0, GPTimeout},
+  {58, 1, 0, 0, GPPAApollo},
+  {59, 1, 0, 0, GPAlexEnables}
+};
+
+
+//
+// protocol 2 handler for General Packet to SDR
+// parameter is a pointer to the UDP message buffer.
+// copy port numbers to port table, and set the other data carried by this packet.
+// only the fields that have changed since the last packet are set
+//
+int HandleGeneralPacket(uint8_t *PacketBuffer)
+{
+  Trace(eTraceGeneralPacket, ntohl(*(uint32_t*)PacketBuffer), 0);
+  DecodePacketFields(GeneralPacketFields, sizeof(GeneralPacketFields) / sizeof(struct PacketField),
+                     PacketBuffer, VGENERALPACKETSIZE, &GeneralPacketCache);
+  return 0;
+}
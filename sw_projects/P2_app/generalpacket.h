@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include "../common/saturntypes.h"
 
+#define VGENERALPACKETSIZE 60           // general packet to SDR
+
 extern bool HW_Timer_Enable;
 
 //
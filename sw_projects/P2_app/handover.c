@@ -0,0 +1,594 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// handover.c:
+//
+// hot standby p2app: handover of the sockets and client state between instances
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "handover.h"
+#include "../common/saturnregisters.h"
+#include "packetfields.h"
+#include "generalpacket.h"
+#include "IncomingDDCSpecific.h"
+#include "IncomingDUCSpecific.h"
+#include "InHighPriority.h"
+#include "OutDDCIQ.h"
+#include "threadplacement.h"
+
+
+#define VHANDOVERSOCKETNAME "saturn-p2app-handover-%u"  // abstract UNIX socket name, per board
+#define VHANDOVERMAGIC 0x50324801                       // "P2H" and the message layout version
+#define VNUMHANDOVERPACKETS 4                           // port table entries 0-3: general, DDC specific, DUC specific, high priority
+#define VHANDOVERSTOPWAIT 500                           // ms for the streams to stop before a handover
+#define VHANDOVEREXITWAIT 1000                          // ms for the active instance to exit after a handover
+
+
+typedef enum
+{
+  eHandoverSockets,                             // the UDP sockets, as SCM_RIGHTS fds
+  eHandoverPacket,                              // the last control packet of one type
+  eHandoverState                                // the rest of the client state: the active instance exits next
+} EHandoverMessage;
+
+
+//
+// one message on the SOCK_SEQPACKET connection; always sent whole
+//
+struct HandoverMessage
+{
+  uint32_t Magic;
+  uint32_t Type;
+  union
+  {
+    struct
+    {
+      uint32_t Count;
+      uint8_t Entry[VPORTTABLESIZE];            // port table entry of each fd sent
+      uint16_t Port[VPORTTABLESIZE];
+    } Sockets;
+    struct
+    {
+      uint32_t Port;                            // port table entry it arrived on
+      uint32_t Size;                            // bytes; 0 if none received yet
+      struct sockaddr_in From;
+      uint8_t Data[VMAXFIELDPACKET];
+    } Packet;
+    struct
+    {
+      bool Running;
+      bool ReplyAddressSet;
+      bool StartBitReceived;
+      struct sockaddr_in ReplyAddr;
+      uint32_t DDCSequence[VNUMDDC];
+      uint64_t DDCSampleCount[VNUMDDC];
+    } State;
+  };
+};
+
+
+//
+// both sides: the last of each control packet. The active instance keeps them to
+// forward; the standby keeps what it was sent, and forwards it in turn once active.
+//
+static pthread_mutex_t HandoverMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct HandoverMessage LastPackets[VNUMHANDOVERPACKETS];
+
+//
+// active instance
+//
+static int HandoverListenSocket = -1;
+static int StandbySocket = -1;                  // connected standby (under HandoverMutex)
+static pthread_t HandoverListenThread;
+
+//
+// standby
+//
+static bool Standby = false;
+static int ActiveSocket = -1;                   // connection to the active instance
+static int HandedSockets[VPORTTABLESIZE];
+static bool HandedSocketValid[VPORTTABLESIZE];
+static uint16_t HandedPorts[VPORTTABLESIZE];
+static struct HandoverMessage TakenState;
+
+
+//
+// the abstract socket address for a board. Returns its length
+//
+static socklen_t MakeHandoverAddress(struct sockaddr_un* Addr, uint32_t Board)
+{
+  memset(Addr, 0, sizeof(*Addr));
+  Addr->sun_family = AF_UNIX;
+  snprintf(Addr->sun_path + 1, sizeof(Addr->sun_path) - 1, VHANDOVERSOCKETNAME, Board);     // abstract name: leading 0
+  return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(Addr->sun_path + 1);
+}
+
+
+bool ConnectHandover(uint32_t Board)
+{
+  struct sockaddr_un Addr;
+  socklen_t Length;
+  int Socket;
+
+  Length = MakeHandoverAddress(&Addr, Board);
+  Socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (Socket < 0)
+    return false;
+  if (connect(Socket, (struct sockaddr*)&Addr, Length) != 0)
+  {
+    close(Socket);                              // no active instance: this one is it
+    return false;
+  }
+  ActiveSocket = Socket;
+  Standby = true;
+  printf("hot standby: an active p2app is running for board %u\n", Board);
+  return true;
+}
+
+
+bool IsHandoverStandby(void)
+{
+  return Standby;
+}
+
+
+//
+// send the sockets: each table entry that MakeSocket() made one for. Return true if error
+//
+static bool SendHandoverSockets(int Socket)
+{
+  struct HandoverMessage Message;
+  struct msghdr Msg;
+  struct iovec Iov;
+  struct cmsghdr* Cmsg;
+  union
+  {
+    char Buffer[CMSG_SPACE(sizeof(int) * VPORTTABLESIZE)];
+    struct cmsghdr Align;
+  } Control;
+  int Fds[VPORTTABLESIZE];
+  uint32_t Entry;
+
+  memset(&Message, 0, sizeof(Message));
+  Message.Magic = VHANDOVERMAGIC;
+  Message.Type = eHandoverSockets;
+  for (Entry = 0; Entry < VPORTTABLESIZE; Entry++)
+  {
+    if (SocketData[Entry].SocketCount == 0)
+      continue;                                 // shares another entry's socket, or has none
+    Fds[Message.Sockets.Count] = SocketData[Entry].Socketid;
+    Message.Sockets.Entry[Message.Sockets.Count] = Entry;
+    Message.Sockets.Port[Message.Sockets.Count] = SocketData[Entry].Portid;
+    Message.Sockets.Count++;
+  }
+  memset(&Msg, 0, sizeof(Msg));
+  memset(&Control, 0, sizeof(Control));
+  Iov.iov_base = &Message;
+  Iov.iov_len = sizeof(Message);
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  if (Message.Sockets.Count != 0)
+  {
+    Msg.msg_control = Control.Buffer;
+    Msg.msg_controllen = CMSG_SPACE(sizeof(int) * Message.Sockets.Count);
+    Cmsg = CMSG_FIRSTHDR(&Msg);
+    Cmsg->cmsg_level = SOL_SOCKET;
+    Cmsg->cmsg_type = SCM_RIGHTS;
+    Cmsg->cmsg_len = CMSG_LEN(sizeof(int) * Message.Sockets.Count);
+    memcpy(CMSG_DATA(Cmsg), Fds, sizeof(int) * Message.Sockets.Count);
+  }
+  return sendmsg(Socket, &Msg, MSG_NOSIGNAL) != sizeof(Message);
+}
+
+
+//
+// send the control packets kept so far. Call with HandoverMutex held. Return true if error
+//
+static bool SendHandoverPackets(int Socket)
+{
+  uint32_t Port;
+
+  for (Port = 0; Port < VNUMHANDOVERPACKETS; Port++)
+    if ((LastPackets[Port].Packet.Size != 0)
+        && (send(Socket, &LastPackets[Port], sizeof(struct HandoverMessage), MSG_NOSIGNAL) != sizeof(struct HandoverMessage)))
+      return true;
+  return false;
+}
+
+
+//
+// the listener thread: take one standby at a time. One that has gone is replaced.
+//
+static void* HandoverListen(__attribute__((unused)) void* arg)
+{
+  struct pollfd Poll;
+  int Socket;
+
+  while (true)
+  {
+    Socket = accept4(HandoverListenSocket, NULL, NULL, SOCK_CLOEXEC);
+    if (Socket < 0)
+    {
+      if (errno != EINTR)
+        usleep(100000);
+      continue;
+    }
+    pthread_mutex_lock(&HandoverMutex);
+    if (StandbySocket >= 0)
+    {
+      Poll.fd = StandbySocket;
+      Poll.events = POLLRDHUP;
+      if ((poll(&Poll, 1, 0) > 0) && (Poll.revents & (POLLRDHUP | POLLHUP | POLLERR)))
+      {
+        close(StandbySocket);
+        StandbySocket = -1;
+        printf("standby p2app disconnected\n");
+      }
+    }
+    if (StandbySocket >= 0)
+    {
+      pthread_mutex_unlock(&HandoverMutex);
+      printf("standby p2app refused: one is already waiting\n");
+      close(Socket);
+      continue;
+    }
+    if (SendHandoverSockets(Socket) || SendHandoverPackets(Socket))
+    {
+      pthread_mutex_unlock(&HandoverMutex);
+      printf("standby p2app connection failed\n");
+      close(Socket);
+      continue;
+    }
+    StandbySocket = Socket;
+    pthread_mutex_unlock(&HandoverMutex);
+    printf("standby p2app connected\n");
+  }
+  return NULL;
+}
+
+
+bool StartHandoverListener(uint32_t Board)
+{
+  struct sockaddr_un Addr;
+  socklen_t Length;
+
+  Length = MakeHandoverAddress(&Addr, Board);
+  HandoverListenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if ((HandoverListenSocket < 0)
+      || (bind(HandoverListenSocket, (struct sockaddr*)&Addr, Length) != 0)
+      || (listen(HandoverListenSocket, 2) != 0))
+  {
+    printf("hot standby: can't listen on @%s (errno=%d)\n", Addr.sun_path + 1, errno);
+    if (HandoverListenSocket >= 0)
+      close(HandoverListenSocket);
+    HandoverListenSocket = -1;
+    return true;
+  }
+  if (CreatePlacedThread(&HandoverListenThread, eThreadControl, "handover", HandoverListen, NULL) != 0)
+  {
+    perror("pthread_create handover listener");
+    close(HandoverListenSocket);
+    HandoverListenSocket = -1;
+    return true;
+  }
+  pthread_detach(HandoverListenThread);
+  printf("hot standby: a standby p2app can connect to @%s\n", Addr.sun_path + 1);
+  return false;
+}
+
+
+void NoteHandoverPacket(uint32_t Port, struct sockaddr_in* From, uint8_t* Packet, uint32_t Size)
+{
+  struct HandoverMessage* Last;
+
+  if ((HandoverListenSocket < 0) || (Port >= VNUMHANDOVERPACKETS) || (Size < 4) || (Size > VMAXFIELDPACKET))
+    return;
+  Last = &LastPackets[Port];
+  pthread_mutex_lock(&HandoverMutex);
+  //
+  // every packet starts with its sequence number: the rest is compared
+  //
+  if ((Last->Packet.Size == Size) && (memcmp(Last->Packet.Data + 4, Packet + 4, Size - 4) == 0)
+      && (Last->Packet.From.sin_addr.s_addr == From->sin_addr.s_addr) && (Last->Packet.From.sin_port == From->sin_port))
+  {
+    pthread_mutex_unlock(&HandoverMutex);
+    return;
+  }
+  Last->Magic = VHANDOVERMAGIC;
+  Last->Type = eHandoverPacket;
+  Last->Packet.Port = Port;
+  Last->Packet.Size = Size;
+  Last->Packet.From = *From;
+  memcpy(Last->Packet.Data, Packet, Size);
+  if ((StandbySocket >= 0) && (send(StandbySocket, Last, sizeof(*Last), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+      && (errno != EAGAIN))
+  {
+    close(StandbySocket);
+    StandbySocket = -1;
+    printf("standby p2app disconnected\n");
+  }
+  pthread_mutex_unlock(&HandoverMutex);
+}
+
+
+bool HandOverToStandby(void)
+{
+  struct HandoverMessage Message;
+  struct timespec Start, Now;
+  uint32_t Wait;
+  int Socket;
+  bool Error;
+
+  pthread_mutex_lock(&HandoverMutex);
+  Socket = StandbySocket;
+  StandbySocket = -1;                           // nothing more is forwarded
+  pthread_mutex_unlock(&HandoverMutex);
+  if (Socket < 0)
+    return false;
+
+  //
+  // stop the streams, so the standby's DMA and packets never overlap these
+  //
+  clock_gettime(CLOCK_MONOTONIC, &Start);
+  memset(&Message, 0, sizeof(Message));
+  Message.Magic = VHANDOVERMAGIC;
+  Message.Type = eHandoverState;
+  Message.State.Running = atomic_load(&SDRActive);
+  Message.State.ReplyAddressSet = ReplyAddressSet;
+  Message.State.StartBitReceived = StartBitReceived;
+  Message.State.ReplyAddr = reply_addr;
+  SetSDRActive(false);
+  for (Wait = 0; (GetStreamState() != eStreamIdle) && (Wait < VHANDOVERSTOPWAIT); Wait++)
+    usleep(1000);
+  GetDDCSequenceState(Message.State.DDCSequence, Message.State.DDCSampleCount);
+
+  pthread_mutex_lock(&HandoverMutex);
+  Error = SendHandoverPackets(Socket);
+  pthread_mutex_unlock(&HandoverMutex);
+  Error = Error || SendHandoverSockets(Socket)
+          || (send(Socket, &Message, sizeof(Message), MSG_NOSIGNAL) != sizeof(Message));
+  if (Error)
+  {
+    printf("handover to the standby p2app failed\n");
+    close(Socket);
+    return false;
+  }
+  //
+  // the connection is left open: the standby takes over when it closes, at this process's exit
+  //
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  printf("handed over to the standby p2app in %.1fms\n",
+         (Now.tv_sec - Start.tv_sec) * 1.0e3 + (Now.tv_nsec - Start.tv_nsec) * 1.0e-6);
+  return true;
+}
+
+
+//
+// take the fds of a received sockets message, in place of any held
+//
+static void TakeHandedSockets(struct HandoverMessage* Message, struct msghdr* Msg)
+{
+  struct cmsghdr* Cmsg;
+  int Fds[VPORTTABLESIZE];
+  uint32_t Count = 0;
+  uint32_t Cntr, Entry;
+
+  for (Cmsg = CMSG_FIRSTHDR(Msg); Cmsg != NULL; Cmsg = CMSG_NXTHDR(Msg, Cmsg))
+    if ((Cmsg->cmsg_level == SOL_SOCKET) && (Cmsg->cmsg_type == SCM_RIGHTS))
+    {
+      Count = (Cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      if (Count > VPORTTABLESIZE)
+        Count = VPORTTABLESIZE;
+      memcpy(Fds, CMSG_DATA(Cmsg), sizeof(int) * Count);
+    }
+  for (Entry = 0; Entry < VPORTTABLESIZE; Entry++)
+    if (HandedSocketValid[Entry])
+    {
+      close(HandedSockets[Entry]);
+      HandedSocketValid[Entry] = false;
+    }
+  for (Cntr = 0; Cntr < Count; Cntr++)
+  {
+    Entry = Message->Sockets.Entry[Cntr];
+    if ((Cntr >= Message->Sockets.Count) || (Entry >= VPORTTABLESIZE) || HandedSocketValid[Entry])
+    {
+      close(Fds[Cntr]);
+      continue;
+    }
+    HandedSockets[Entry] = Fds[Cntr];
+    HandedPorts[Entry] = Message->Sockets.Port[Cntr];
+    HandedSocketValid[Entry] = true;
+  }
+}
+
+
+//
+// close the fds of a message that isn't used
+//
+static void DropHandedFds(struct msghdr* Msg)
+{
+  struct cmsghdr* Cmsg;
+  int Fd;
+  uint32_t Cntr, Count;
+
+  for (Cmsg = CMSG_FIRSTHDR(Msg); Cmsg != NULL; Cmsg = CMSG_NXTHDR(Msg, Cmsg))
+    if ((Cmsg->cmsg_level == SOL_SOCKET) && (Cmsg->cmsg_type == SCM_RIGHTS))
+    {
+      Count = (Cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (Cntr = 0; Cntr < Count; Cntr++)
+      {
+        memcpy(&Fd, CMSG_DATA(Cmsg) + Cntr * sizeof(int), sizeof(int));
+        close(Fd);
+      }
+    }
+}
+
+
+ETakeover WaitForTakeover(void)
+{
+  struct HandoverMessage Message;
+  struct msghdr Msg;
+  struct iovec Iov;
+  struct pollfd Poll;
+  union
+  {
+    char Buffer[CMSG_SPACE(sizeof(int) * VPORTTABLESIZE)];
+    struct cmsghdr Align;
+  } Control;
+  bool SocketsTaken = false;
+  bool StateTaken = false;
+  uint32_t Entry;
+  ssize_t Size;
+  int Ready;
+
+  printf("hot standby: prepared; waiting for the active p2app to hand over\n");
+  Poll.fd = ActiveSocket;
+  Poll.events = POLLIN;
+  while (!ExitRequested)
+  {
+    Ready = poll(&Poll, 1, StateTaken ? VHANDOVEREXITWAIT : -1);
+    if ((Ready < 0) && (errno == EINTR))
+      continue;                                 // (a signal: see if it asks for an exit)
+    if (Ready == 0)
+    {
+      printf("hot standby: the active p2app has not exited; taking over anyway\n");
+      break;
+    }
+    memset(&Msg, 0, sizeof(Msg));
+    Iov.iov_base = &Message;
+    Iov.iov_len = sizeof(Message);
+    Msg.msg_iov = &Iov;
+    Msg.msg_iovlen = 1;
+    Msg.msg_control = Control.Buffer;
+    Msg.msg_controllen = sizeof(Control.Buffer);
+    Size = recvmsg(ActiveSocket, &Msg, MSG_CMSG_CLOEXEC);
+    if ((Size < 0) && (errno == EINTR))
+      continue;
+    if (Size <= 0)
+      break;                                    // the active instance has gone
+    if ((Size != sizeof(Message)) || (Message.Magic != VHANDOVERMAGIC))
+    {
+      DropHandedFds(&Msg);
+      continue;                                 // (not a version this can take over from)
+    }
+    switch (Message.Type)
+    {
+      case eHandoverSockets:
+        TakeHandedSockets(&Message, &Msg);
+        SocketsTaken = true;
+        break;
+
+      case eHandoverPacket:
+        DropHandedFds(&Msg);
+        if ((Message.Packet.Port < VNUMHANDOVERPACKETS) && (Message.Packet.Size <= VMAXFIELDPACKET))
+          memcpy(&LastPackets[Message.Packet.Port], &Message, sizeof(Message));
+        break;
+
+      case eHandoverState:
+        DropHandedFds(&Msg);
+        memcpy(&TakenState, &Message, sizeof(Message));
+        StateTaken = true;
+        break;
+
+      default:
+        DropHandedFds(&Msg);
+        break;
+    }
+  }
+  close(ActiveSocket);
+  ActiveSocket = -1;
+  Standby = false;
+  if (ExitRequested)
+    return eTakeoverNone;
+  if (!SocketsTaken)
+  {
+    printf("hot standby: refused by the active p2app (another standby is waiting, or it is an incompatible version)\n");
+    return eTakeoverNone;
+  }
+  for (Entry = 0; Entry < VPORTTABLESIZE; Entry++)
+    if (HandedSocketValid[Entry])
+      SocketData[Entry].Portid = HandedPorts[Entry];
+  if (StateTaken)
+  {
+    printf("hot standby: taking over from the active p2app\n");
+    return eTakeoverState;
+  }
+  printf("hot standby: the active p2app ended without a handover; starting with its sockets\n");
+  return eTakeoverCold;
+}
+
+
+void ReplayHandoverState(ETakeover Takeover)
+{
+  struct HandoverMessage* Packet;
+
+  Packet = &LastPackets[VPORTCOMMAND];
+  if (Packet->Packet.Size == VGENERALPACKETSIZE)
+  {
+    NoteMessageReceived(VPORTCOMMAND);
+    memset(&reply_addr, 0, sizeof(reply_addr));
+    reply_addr.sin_family = AF_INET;
+    reply_addr.sin_addr.s_addr = Packet->Packet.From.sin_addr.s_addr;
+    reply_addr.sin_port = Packet->Packet.From.sin_port;
+    HandleGeneralPacket(Packet->Packet.Data);
+    ReplyAddressSet = true;
+  }
+  if (Takeover == eTakeoverState)
+  {
+    reply_addr = TakenState.State.ReplyAddr;
+    ReplyAddressSet = TakenState.State.ReplyAddressSet;
+    if (TakenState.State.Running)
+      ResumeDDCSequence(TakenState.State.DDCSequence, TakenState.State.DDCSampleCount);
+  }
+  Packet = &LastPackets[VPORTDDCSPECIFIC];
+  if (Packet->Packet.Size == VDDCSPECIFICSIZE)
+    HandleDDCSpecificPacket(Packet->Packet.Data);
+  Packet = &LastPackets[VPORTDUCSPECIFIC];
+  if (Packet->Packet.Size == VDUCSPECIFICSIZE)
+    HandleDUCSpecificPacket(Packet->Packet.Data);
+  Packet = &LastPackets[VPORTHIGHPRIORITYTOSDR];
+  if (Packet->Packet.Size == VHIGHPRIOTIYTOSDRSIZE)
+    HandleHighPriorityPacket(Packet->Packet.Data);        // its run bit starts the streams, if the client had
+  if (Takeover == eTakeoverState)
+    StartBitReceived = TakenState.State.StartBitReceived;
+  NotifyStateChange();
+  printf("hot standby: client state taken over; %s\n", atomic_load(&SDRActive) ? "running" : "not running");
+}
+
+
+bool TakeHandoverSocket(struct ThreadSocketData* Ptr)
+{
+  socklen_t Length = sizeof(Ptr->addr_cmddata);
+  uint32_t Entry;
+
+  if ((Ptr < SocketData) || (Ptr >= SocketData + VPORTTABLESIZE))
+    return false;
+  Entry = Ptr - SocketData;
+  if (!HandedSocketValid[Entry])
+    return false;
+  HandedSocketValid[Entry] = false;
+  Ptr->Socketid = HandedSockets[Entry];
+  Ptr->SocketCount++;
+  if (getsockname(Ptr->Socketid, (struct sockaddr*)&Ptr->addr_cmddata, &Length) != 0)
+    perror("getsockname");
+  return true;
+}
@@ -0,0 +1,121 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// handover.h:
+//
+// header: hot standby p2app, and the handover of the client connection to it
+//
+// with -H, a p2app that finds another running for the same board (the active
+// instance) becomes its standby. It opens the FPGA, reads its settings and
+// options, and then waits; its register writes so far are held in a register
+// transaction, so it never drives hardware the active instance is using.
+// the active instance listens on the abstract UNIX socket
+// @saturn-p2app-handover-<board>. When a standby connects it is sent the
+// protocol 2 UDP sockets at once (SCM_RIGHTS), and the last of each control
+// packet (general, DDC specific, DUC specific, high priority); control packets
+// that change are forwarded to it from then on.
+// on exit (x, SIGINT, SIGTERM, or a thread error) the active instance stops its
+// streams, sends the standby the client's reply address, run state and DDC
+// sequence numbers, and exits without touching the hardware. Once it has gone the
+// standby replays the control packets to set itself up as the client had it, makes
+// its held register writes, and carries on with the same sockets: the client sees
+// a gap of a few ms in the streams, but doesn't have to reconnect.
+// if the active instance ends without a handover (a crash or SIGKILL), the standby
+// starts as a new p2app would, with the sockets and the forwarded packets.
+// the standby then listens for a standby of its own. An upgrade is: start the new
+// p2app with -H, then stop the old one. Use different capture and recording
+// files (-C, -W, -D) for the two.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __handover_h
+#define __handover_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include "threaddata.h"
+
+
+//
+// what the standby found when the active instance had gone
+//
+typedef enum
+{
+  eTakeoverNone,                                // no takeover: refused (another standby waits), or exit requested
+  eTakeoverCold,                                // the active instance ended without a handover
+  eTakeoverState                                // it handed over its state
+} ETakeover;
+
+
+//
+// ConnectHandover(uint32_t Board)
+// look for an active p2app on Board: if there is one, this instance becomes its
+// standby. Call before the hardware is set up. Returns true if standby.
+//
+bool ConnectHandover(uint32_t Board);
+
+
+//
+// IsHandoverStandby(void)
+// true if this instance is a standby that has not yet taken over
+//
+bool IsHandoverStandby(void);
+
+
+//
+// WaitForTakeover(void)
+// standby: wait until the active instance has gone, keeping the sockets and packets it sends
+//
+ETakeover WaitForTakeover(void);
+
+
+//
+// ReplayHandoverState(ETakeover Takeover)
+// standby, after WaitForTakeover(): decode the control packets the active instance
+// sent, and take its reply address, run state and DDC sequence numbers if it handed
+// them over. May start the streams.
+//
+void ReplayHandoverState(ETakeover Takeover);
+
+
+//
+// TakeHandoverSocket(struct ThreadSocketData* Ptr)
+// called by MakeSocket(): if the active instance handed over the socket of this
+// table entry, use it. Returns true if it did.
+//
+bool TakeHandoverSocket(struct ThreadSocketData* Ptr);
+
+
+//
+// StartHandoverListener(uint32_t Board)
+// active instance, once its sockets are made: listen for a standby. Return true if error
+//
+bool StartHandoverListener(uint32_t Board);
+
+
+//
+// NoteHandoverPacket(uint32_t Port, struct sockaddr_in* From, uint8_t* Packet, uint32_t Size)
+// the network event loop has handled a control packet, from port table entry Port
+// (VPORTCOMMAND for a general packet). If it differs from the last, the standby is sent it.
+//
+void NoteHandoverPacket(uint32_t Port, struct sockaddr_in* From, uint8_t* Packet, uint32_t Size);
+
+
+//
+// HandOverToStandby(void)
+// active instance, exiting: if a standby is waiting, stop the streams and hand it the
+// client. Returns true if handed over: the hardware is the standby's then, and must
+// be left as it is.
+//
+bool HandOverToStandby(void);
+
+
+#endif
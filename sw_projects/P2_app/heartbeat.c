@@ -0,0 +1,181 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// heartbeat.c:
+//
+// stream thread heartbeats, and a stall detector
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include "heartbeat.h"
+#include "p2config.h"
+#include "eventtrace.h"
+
+
+#define VSTALLSIGNAL (SIGRTMIN + 1)                 // interrupts a stalled thread's system call
+
+
+struct ThreadHeartbeat Heartbeats[VNUMBEATTHREADS];
+
+static bool Stalled[VNUMBEATTHREADS];               // supervisor's view: reported as stalled
+static uint32_t StallStart[VNUMBEATTHREADS];        // time of the beat before the stall
+static pthread_mutex_t ThreadMutex = PTHREAD_MUTEX_INITIALIZER;    // Thread and Started, for pthread_kill()
+
+static const char* ActivityNames[VNUMBEATACTIVITIES] =
+{
+  "idle", "running", "FIFO wait", "DMA read", "DMA write", "send", "packet handling"
+};
+
+
+//
+// the thread that leads the engine each thread belongs to, or -1 if it can't be restarted
+//
+static int32_t EngineLeader(uint32_t Beat)
+{
+  if (Beat < eBeatDUC)
+    return eBeatDDCDMA;
+  return -1;
+}
+
+
+const char* GetBeatThreadName(uint32_t Beat)
+{
+  static const char* Names[] = {"ddcdma", "ddcdemux"};
+  static const char* OtherNames[] = {"duc", "speaker", "mic", "status", "wideband", "eventloop"};
+  static char SenderNames[VNUMDDC][12];
+
+  if (Beat < eBeatDDCSender)
+    return Names[Beat];
+  if (Beat < eBeatDUC)
+  {
+    if (SenderNames[Beat - eBeatDDCSender][0] == 0)
+      snprintf(SenderNames[Beat - eBeatDDCSender], sizeof(SenderNames[0]), "ddcsend%u", Beat - eBeatDDCSender);
+    return SenderNames[Beat - eBeatDDCSender];
+  }
+  return OtherNames[Beat - eBeatDUC];
+}
+
+
+void HeartbeatStart(uint32_t Beat)
+{
+  atomic_store(&Heartbeats[Beat].Activity, eBeatIdle);
+  pthread_mutex_lock(&ThreadMutex);
+  Heartbeats[Beat].Thread = pthread_self();
+  atomic_store(&Heartbeats[Beat].Started, true);
+  pthread_mutex_unlock(&ThreadMutex);
+}
+
+
+//
+// once Started is clear the thread may have been joined, so its handle can't be signalled
+//
+void HeartbeatStop(uint32_t Beat)
+{
+  pthread_mutex_lock(&ThreadMutex);
+  atomic_store(&Heartbeats[Beat].Started, false);
+  pthread_mutex_unlock(&ThreadMutex);
+  atomic_store(&Heartbeats[Beat].Activity, eBeatIdle);
+}
+
+
+void ClearStallRestart(uint32_t Beat)
+{
+  atomic_store(&Heartbeats[Beat].RestartRequested, false);
+}
+
+
+uint32_t GetHeartbeatAge(uint32_t Beat)
+{
+  if (!atomic_load(&Heartbeats[Beat].Started) || (atomic_load(&Heartbeats[Beat].Activity) == eBeatIdle))
+    return 0;
+  return HeartbeatNow() - atomic_load(&Heartbeats[Beat].Time);
+}
+
+
+//
+// the signal does nothing but make the blocked call return EINTR.
+// installed without SA_RESTART so the call isn't restarted.
+//
+static void StallSignalHandler(__attribute__((unused)) int Signal)
+{
+}
+
+
+void StartStallDetector(void)
+{
+  struct sigaction Action;
+
+  memset(&Action, 0, sizeof(Action));
+  Action.sa_handler = StallSignalHandler;
+  sigemptyset(&Action.sa_mask);
+  Action.sa_flags = 0;
+  if (sigaction(VSTALLSIGNAL, &Action, NULL) != 0)
+    printf("stall detector: can't install its signal; stalled threads can't be interrupted\n");
+}
+
+
+//
+// report one stalled thread, and restart its engine if allowed
+//
+static void ReportStall(uint32_t Beat, uint32_t Age)
+{
+  struct ThreadHeartbeat* Ptr = Heartbeats + Beat;
+  uint32_t Activity = atomic_load(&Ptr->Activity);
+  int Error = atomic_load(&Ptr->Error);
+  int32_t Leader = EngineLeader(Beat);
+
+  atomic_fetch_add(&Ptr->Stalls, 1);
+  Trace(eTraceStall, Beat, Activity);
+  printf("stall: %s thread no progress for %ums, in %s; last DMA %u bytes, FIFO depth %u, errno %d%s%s\n",
+         GetBeatThreadName(Beat), Age, (Activity < VNUMBEATACTIVITIES) ? ActivityNames[Activity] : "?",
+         atomic_load(&Ptr->DMASize), atomic_load(&Ptr->FIFODepth), Error,
+         (Error != 0) ? " " : "", (Error != 0) ? strerror(Error) : "");
+  if ((P2Config.StallRestart == 0) || (Leader < 0) || atomic_load(&Heartbeats[Leader].RestartRequested))
+    return;
+  printf("stall: restarting the DDC engine\n");
+  atomic_store(&Heartbeats[Leader].RestartRequested, true);
+  pthread_mutex_lock(&ThreadMutex);
+  if (atomic_load(&Ptr->Started))                   // not exited since it was seen stalled
+    pthread_kill(Ptr->Thread, VSTALLSIGNAL);
+  pthread_mutex_unlock(&ThreadMutex);
+}
+
+
+void CheckHeartbeats(void)
+{
+  uint32_t Beat, Age, Now;
+  uint32_t Timeout = P2Config.StallTimeout;
+
+  Now = HeartbeatNow();
+  for (Beat = 0; Beat < VNUMBEATTHREADS; Beat++)
+  {
+    if (!atomic_load_explicit(&Heartbeats[Beat].Started, memory_order_relaxed))
+      continue;
+    Age = Now - atomic_load_explicit(&Heartbeats[Beat].Time, memory_order_relaxed);
+    if ((atomic_load_explicit(&Heartbeats[Beat].Activity, memory_order_relaxed) == eBeatIdle) || (Age < Timeout) || (Timeout == 0))
+    {
+      if (Stalled[Beat])
+      {
+        Stalled[Beat] = false;
+        Trace(eTraceStallEnd, Beat, Now - StallStart[Beat]);
+        printf("stall: %s thread running again after %ums\n", GetBeatThreadName(Beat), Now - StallStart[Beat]);
+      }
+      continue;
+    }
+    if (!Stalled[Beat])
+    {
+      Stalled[Beat] = true;
+      StallStart[Beat] = Now - Age;
+      ReportStall(Beat, Age);
+    }
+  }
+}
@@ -0,0 +1,200 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// heartbeat.h:
+//
+// header: stream thread heartbeats, and a stall detector
+//
+// each stream thread beats once per pass of its loop: the time, a progress
+// count, and what it is about to do (eg a DMA, with its size and the FIFO
+// depth). Before a wait that is not a stall (for a client packet, or for a
+// stream to start) a thread goes idle. The activity check thread looks at
+// the heartbeats: a thread that is not idle and has not beaten for longer than
+// stall_timeout is reported as stalled, with the state it recorded, once.
+// with stall_restart set, a stall in the DDC DMA reader, demux or senders
+// restarts the DDC engine only: the stalled thread is interrupted out of its
+// system call by a signal, and the DDC thread resets the DDC FIFO and starts
+// its pipeline again within the same run.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __heartbeat_h
+#define __heartbeat_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include "../common/saturnregisters.h"
+
+
+#define VDEFAULTSTALLTIMEOUT 2000                   // ms
+
+
+//
+// threads watched
+//
+typedef enum
+{
+  eBeatDDCDMA,                                      // DDC DMA reader: leads the DDC engine
+  eBeatDDCDemux,                                    // DDC demux
+  eBeatDDCSender,                                   // DDC senders: one each, from here
+  eBeatDUC = eBeatDDCSender + VNUMDDC,              // DUC I/Q from client
+  eBeatSpeaker,                                     // speaker audio from client
+  eBeatMic,                                         // mic audio to client
+  eBeatStatus,                                      // high priority status to client
+  eBeatWideband,                                    // wideband data to client
+  eBeatEventLoop,                                   // network event loop
+  VNUMBEATTHREADS
+} EBeatThread;
+
+
+//
+// what a thread was doing at its last beat
+//
+typedef enum
+{
+  eBeatIdle,                                        // waiting, not expected to beat
+  eBeatRunning,                                     // going round its loop
+  eBeatFIFOWait,                                    // waiting for FIFO data or space
+  eBeatDMARead,                                     // in a DMA read
+  eBeatDMAWrite,                                    // in a DMA write
+  eBeatSend,                                        // sending packets
+  eBeatHandle,                                      // handling a received packet
+  VNUMBEATACTIVITIES
+} EBeatActivity;
+
+
+struct ThreadHeartbeat
+{
+  _Atomic uint64_t Progress;                        // beats since startup
+  _Atomic uint32_t Time;                            // ms (CLOCK_MONOTONIC_COARSE) of the last beat
+  _Atomic uint32_t Activity;                        // EBeatActivity
+  _Atomic uint32_t DMASize;                         // bytes of the last DMA started
+  _Atomic uint32_t FIFODepth;                       // FIFO depth when it started
+  _Atomic int32_t Error;                            // errno of the last failed call; 0 if none
+  _Atomic bool Started;                             // true once the thread has beaten
+  _Atomic bool RestartRequested;                    // set by the supervisor; cleared by the thread
+  _Atomic uint32_t Stalls;                          // stalls detected
+  pthread_t Thread;
+} __attribute__((aligned(64)));
+
+extern struct ThreadHeartbeat Heartbeats[VNUMBEATTHREADS];
+
+
+//
+// HeartbeatStart(EBeatThread Beat)
+// called by a watched thread before its first beat
+//
+void HeartbeatStart(uint32_t Beat);
+
+
+//
+// HeartbeatStop(EBeatThread Beat)
+// called by a watched thread as it exits: it is not watched, or signalled, after this
+//
+void HeartbeatStop(uint32_t Beat);
+
+
+static inline uint32_t HeartbeatNow(void)
+{
+  struct timespec Now;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &Now);
+  return (uint32_t)(Now.tv_sec * 1000 + Now.tv_nsec / 1000000);
+}
+
+
+//
+// Heartbeat(EBeatThread Beat, EBeatActivity Activity)
+// the thread has made progress and is about to do Activity.
+// eBeatIdle, before a wait that can legitimately be long, means the thread is
+// not watched until its next beat.
+//
+static inline void Heartbeat(uint32_t Beat, uint32_t Activity)
+{
+  struct ThreadHeartbeat* Ptr = Heartbeats + Beat;
+
+  atomic_store_explicit(&Ptr->Time, HeartbeatNow(), memory_order_relaxed);
+  atomic_store_explicit(&Ptr->Activity, Activity, memory_order_relaxed);
+  atomic_fetch_add_explicit(&Ptr->Progress, 1, memory_order_release);
+}
+
+
+//
+// HeartbeatDMA(EBeatThread Beat, EBeatActivity Activity, uint32_t Size, uint32_t FIFODepth)
+// a beat before a DMA, recording its size and the FIFO depth
+//
+static inline void HeartbeatDMA(uint32_t Beat, uint32_t Activity, uint32_t Size, uint32_t FIFODepth)
+{
+  atomic_store_explicit(&Heartbeats[Beat].DMASize, Size, memory_order_relaxed);
+  atomic_store_explicit(&Heartbeats[Beat].FIFODepth, FIFODepth, memory_order_relaxed);
+  Heartbeat(Beat, Activity);
+}
+
+
+//
+// HeartbeatError(EBeatThread Beat, int Error)
+// record the errno of a failed call, for the stall report
+//
+static inline void HeartbeatError(uint32_t Beat, int Error)
+{
+  atomic_store_explicit(&Heartbeats[Beat].Error, Error, memory_order_relaxed);
+}
+
+
+//
+// StallRestartRequested(EBeatThread Beat)
+// true if the supervisor wants the engine led by this thread restarted
+//
+static inline bool StallRestartRequested(uint32_t Beat)
+{
+  return atomic_load_explicit(&Heartbeats[Beat].RestartRequested, memory_order_relaxed);
+}
+
+
+//
+// ClearStallRestart(EBeatThread Beat)
+// called by the engine's thread once it has restarted
+//
+void ClearStallRestart(uint32_t Beat);
+
+
+//
+// StartStallDetector(void)
+// install the signal used to interrupt a stalled thread. Call before threads are made.
+//
+void StartStallDetector(void);
+
+
+//
+// CheckHeartbeats(void)
+// the supervisor: report stalls and recoveries, and request restarts.
+// called periodically by the activity check thread.
+//
+void CheckHeartbeats(void);
+
+
+//
+// GetBeatThreadName(EBeatThread Beat)
+// name of a watched thread, for reports
+//
+const char* GetBeatThreadName(uint32_t Beat);
+
+
+//
+// GetHeartbeatAge(EBeatThread Beat)
+// ms since the thread last beat; 0 if it is idle or has not started
+//
+uint32_t GetHeartbeatAge(uint32_t Beat);
+
+
+#endif
@@ -97,3 +97,165 @@ uint16_t i2c_read_word_data(uint8_t reg, bool *error)
   }
   return (uint16_t) (data & 0xFFFF);
 }
+
+
+
+//
+// batched register access
+// each message is a register write, or a register address write followed by a read;
+// the whole batch goes to the driver in one I2C_RDWR ioctl
+//
+void I2CBatchInit(struct I2CBatch* Batch, uint16_t Address, struct I2CShadow* Shadow)
+{
+  Batch->Address = Address;
+  Batch->Shadow = Shadow;
+  Batch->NumMsgs = 0;
+}
+
+
+//
+// check there is room for Count more messages; return true if error
+//
+static bool I2CBatchFull(struct I2CBatch* Batch, uint32_t Count)
+{
+  if (Batch->NumMsgs + Count > VMAXI2CBATCH)
+  {
+    printf("%s: i2c batch full\n", __FUNCTION__);
+    return true;
+  }
+  return false;
+}
+
+
+//
+// append one message using the next data buffer; returns the buffer
+//
+static uint8_t* I2CBatchAdd(struct I2CBatch* Batch, uint16_t Flags, uint16_t Length, uint16_t* Dest)
+{
+  struct i2c_msg* Msg = &Batch->Msgs[Batch->NumMsgs];
+  uint8_t* Buffer = Batch->Data[Batch->NumMsgs];
+
+  Msg->addr = Batch->Address;
+  Msg->flags = Flags;
+  Msg->len = Length;
+  Msg->buf = Buffer;
+  Batch->ReadDest[Batch->NumMsgs++] = Dest;
+  return Buffer;
+}
+
+
+bool I2CBatchWriteByte(struct I2CBatch* Batch, uint8_t reg, uint8_t data)
+{
+  uint8_t* Buffer;
+
+  if (I2CBatchFull(Batch, 1))
+    return true;
+  Buffer = I2CBatchAdd(Batch, 0, 2, NULL);
+  Buffer[0] = reg;
+  Buffer[1] = data;
+  return false;
+}
+
+
+bool I2CBatchWriteWord(struct I2CBatch* Batch, uint8_t reg, uint16_t data)
+{
+  uint8_t* Buffer;
+
+  if (I2CBatchFull(Batch, 1))
+    return true;
+  Buffer = I2CBatchAdd(Batch, 0, 3, NULL);
+  Buffer[0] = reg;
+  Buffer[1] = data & 0xFF;
+  Buffer[2] = (data >> 8) & 0xFF;
+  return false;
+}
+
+
+bool I2CBatchReadWord(struct I2CBatch* Batch, uint8_t reg, uint16_t* Dest)
+{
+  uint8_t* Buffer;
+
+  if (I2CBatchFull(Batch, 2))
+    return true;
+  Buffer = I2CBatchAdd(Batch, 0, 1, NULL);                // register address
+  Buffer[0] = reg;
+  I2CBatchAdd(Batch, I2C_M_RD, 2, Dest);                  // repeated start, read 2 bytes
+  return false;
+}
+
+
+int I2CBatchRun(struct I2CBatch* Batch)
+{
+  struct i2c_rdwr_ioctl_data Transfer;
+  uint32_t Cntr;
+  int rc = 0;
+
+  if (Batch->NumMsgs == 0)
+    return 0;
+
+  Transfer.msgs = Batch->Msgs;
+  Transfer.nmsgs = Batch->NumMsgs;
+  if ((rc = ioctl(i2c_fd, I2C_RDWR, &Transfer)) < 0)
+  {
+    printf("%s: i2c batch of %d messages failed, errno=%d\n", __FUNCTION__, Batch->NumMsgs, errno);
+    if (Batch->Shadow != NULL)
+      I2CShadowInvalidate(Batch->Shadow);
+  }
+  else
+  {
+    for (Cntr = 0; Cntr < Batch->NumMsgs; Cntr++)
+      if (Batch->ReadDest[Cntr] != NULL)
+        *Batch->ReadDest[Cntr] = Batch->Data[Cntr][0] | (Batch->Data[Cntr][1] << 8);
+  }
+  Batch->NumMsgs = 0;
+  return rc;
+}
+
+
+//
+// register shadow
+//
+void I2CShadowInvalidate(struct I2CShadow* Shadow)
+{
+  memset(Shadow->Valid, 0, sizeof(Shadow->Valid));
+}
+
+
+bool I2CShadowWriteByte(struct I2CBatch* Batch, uint8_t reg, uint8_t data)
+{
+  struct I2CShadow* Shadow = Batch->Shadow;
+
+  if ((Shadow != NULL) && Shadow->Valid[reg] && (Shadow->Value[reg] == data))
+    return false;
+  if (I2CBatchWriteByte(Batch, reg, data))
+    return true;
+  if (Shadow != NULL)
+  {
+    Shadow->Value[reg] = data;
+    Shadow->Valid[reg] = true;
+  }
+  return false;
+}
+
+
+bool I2CShadowWriteWord(struct I2CBatch* Batch, uint8_t reg, uint16_t data)
+{
+  struct I2CShadow* Shadow = Batch->Shadow;
+  uint8_t Low = data & 0xFF;
+  uint8_t High = (data >> 8) & 0xFF;
+  uint8_t NextReg = reg + 1;
+
+  if ((Shadow != NULL) && Shadow->Valid[reg] && Shadow->Valid[NextReg]
+      && (Shadow->Value[reg] == Low) && (Shadow->Value[NextReg] == High))
+    return false;
+  if (I2CBatchWriteWord(Batch, reg, data))
+    return true;
+  if (Shadow != NULL)
+  {
+    Shadow->Value[reg] = Low;
+    Shadow->Value[NextReg] = High;
+    Shadow->Valid[reg] = true;
+    Shadow->Valid[NextReg] = true;
+  }
+  return false;
+}
@@ -22,6 +22,36 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <linux/i2c.h>
+
+
+#define VMAXI2CBATCH 32                         // max messages in one I2C_RDWR transaction
+
+
+//
+// register shadow: the last value known to be in each device register.
+// writes queued through the shadow are skipped if the register already holds the value.
+//
+struct I2CShadow
+{
+  uint8_t Value[256];
+  bool Valid[256];
+};
+
+
+//
+// a batch of register accesses to one slave, sent as one I2C_RDWR ioctl
+// with repeated starts between the messages
+//
+struct I2CBatch
+{
+  uint16_t Address;                             // 7 bit slave address
+  struct I2CShadow* Shadow;                     // shadow to invalidate if the transfer fails; may be NULL
+  uint32_t NumMsgs;
+  struct i2c_msg Msgs[VMAXI2CBATCH];
+  uint8_t Data[VMAXI2CBATCH][3];                // register address + up to 16 bits of data per message
+  uint16_t* ReadDest[VMAXI2CBATCH];             // for read messages: where to put the result
+};
 
 
 //
@@ -45,5 +75,46 @@ uint8_t i2c_read_byte_data(uint8_t reg, bool *error);
 uint16_t i2c_read_word_data(uint8_t reg, bool *error); 
 
 
+//
+// I2CBatchInit(struct I2CBatch* Batch, uint16_t Address, struct I2CShadow* Shadow)
+// start an empty batch for the slave at Address. Shadow may be NULL.
+//
+void I2CBatchInit(struct I2CBatch* Batch, uint16_t Address, struct I2CShadow* Shadow);
+
+//
+// queue an 8 or 16 bit register write. 16 bit data is sent low byte first, as SMBus.
+// return true if error (batch full)
+//
+bool I2CBatchWriteByte(struct I2CBatch* Batch, uint8_t reg, uint8_t data);
+bool I2CBatchWriteWord(struct I2CBatch* Batch, uint8_t reg, uint16_t data);
+
+//
+// queue a 16 bit register read; *Dest is written when the batch is run
+// return true if error (batch full)
+//
+bool I2CBatchReadWord(struct I2CBatch* Batch, uint8_t reg, uint16_t* Dest);
+
+//
+// I2CBatchRun(struct I2CBatch* Batch)
+// send all queued messages in one transaction, then empty the batch.
+// on failure the shadow (if any) is invalidated. Return <0 if error.
+//
+int I2CBatchRun(struct I2CBatch* Batch);
+
+//
+// I2CShadowInvalidate(struct I2CShadow* Shadow)
+// forget all register values, so the next write to each is always sent
+//
+void I2CShadowInvalidate(struct I2CShadow* Shadow);
+
+//
+// queue an 8 or 16 bit register write only if the shadow says the register(s) differ.
+// the shadow is updated when the write is queued.
+// return true if error (batch full)
+//
+bool I2CShadowWriteByte(struct I2CBatch* Batch, uint8_t reg, uint8_t data);
+bool I2CShadowWriteWord(struct I2CBatch* Batch, uint8_t reg, uint16_t data);
+
+
 
 #endif  //#ifndef
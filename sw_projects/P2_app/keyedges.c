@@ -0,0 +1,195 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// keyedges.c:
+//
+// CW key and PTT edge timing, and the key watch thread
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "keyedges.h"
+#include "../common/saturnregisters.h"
+#include "p2config.h"
+#include "eventtrace.h"
+#include "threadplacement.h"
+
+
+//
+// the edge waiting to be sent: Detected is 0 if none
+//
+static _Atomic uint64_t PendingDetected = 0;
+static _Atomic uint32_t PendingPollGap;
+static atomic_bool PendingWatched;
+
+static _Atomic uint64_t KeyEdges;
+static _Atomic uint64_t KeyEdgesWatched;
+static _Atomic uint32_t KeyLastBits;
+static _Atomic uint64_t KeyTotalPollGap;
+static _Atomic uint32_t KeyMaxPollGap;
+static _Atomic uint64_t KeyTotalSendDelay;
+static _Atomic uint32_t KeyMaxSendDelay;
+static _Atomic uint32_t KeySendDelays[VTELLATENCYBINS];
+
+static int KeyWatchFd = -1;
+static pthread_t KeyWatchThread;
+
+
+static void RecordKeyEdge(uint8_t Bits, uint64_t Detected, uint64_t LastPoll, bool Watched)
+{
+  uint64_t Expected = 0;
+  uint32_t Gap = (uint32_t)(Detected - LastPoll);
+
+  if (!atomic_compare_exchange_strong(&PendingDetected, &Expected, Detected))
+    return;                                               // an older edge is still to be sent
+  atomic_store(&PendingPollGap, Gap);
+  atomic_store(&PendingWatched, Watched);
+  Trace(eTraceKeyEdge, Bits, Gap);
+}
+
+
+void NoteKeyEdge(uint8_t Bits, uint64_t Detected, uint64_t LastPoll)
+{
+  RecordKeyEdge(Bits, Detected, LastPoll, false);
+}
+
+
+void KeyEdgeSent(uint8_t Bits)
+{
+  uint64_t Detected = atomic_exchange(&PendingDetected, 0);
+  uint32_t Delay, Gap;
+
+  if (Detected == 0)
+    return;
+  Delay = (uint32_t)(TelemetryTimestamp() - Detected);
+  Gap = atomic_load(&PendingPollGap);
+  atomic_fetch_add_explicit(&KeyEdges, 1, memory_order_relaxed);
+  if (atomic_load(&PendingWatched))
+    atomic_fetch_add_explicit(&KeyEdgesWatched, 1, memory_order_relaxed);
+  atomic_store_explicit(&KeyLastBits, Bits, memory_order_relaxed);
+  atomic_fetch_add_explicit(&KeyTotalPollGap, Gap, memory_order_relaxed);
+  if (Gap > atomic_load_explicit(&KeyMaxPollGap, memory_order_relaxed))
+    atomic_store_explicit(&KeyMaxPollGap, Gap, memory_order_relaxed);
+  atomic_fetch_add_explicit(&KeyTotalSendDelay, Delay, memory_order_relaxed);
+  if (Delay > atomic_load_explicit(&KeyMaxSendDelay, memory_order_relaxed))
+    atomic_store_explicit(&KeyMaxSendDelay, Delay, memory_order_relaxed);
+  atomic_fetch_add_explicit(&KeySendDelays[TelemetryLog2Bin(Delay, VTELLATENCYBINS)], 1, memory_order_relaxed);
+  Trace(eTraceKeySend, Bits, Delay);
+}
+
+
+void GetKeyEdgeStatistics(struct KeyEdgeStatistics* Stats)
+{
+  uint32_t Bin;
+
+  Stats->Edges = atomic_load_explicit(&KeyEdges, memory_order_relaxed);
+  Stats->Watched = atomic_load_explicit(&KeyEdgesWatched, memory_order_relaxed);
+  Stats->LastBits = atomic_load_explicit(&KeyLastBits, memory_order_relaxed);
+  Stats->TotalPollGap = atomic_load_explicit(&KeyTotalPollGap, memory_order_relaxed);
+  Stats->MaxPollGap = atomic_load_explicit(&KeyMaxPollGap, memory_order_relaxed);
+  Stats->TotalSendDelay = atomic_load_explicit(&KeyTotalSendDelay, memory_order_relaxed);
+  Stats->MaxSendDelay = atomic_load_explicit(&KeyMaxSendDelay, memory_order_relaxed);
+  for (Bin = 0; Bin < VTELLATENCYBINS; Bin++)
+    Stats->SendDelays[Bin] = atomic_load_explicit(&KeySendDelays[Bin], memory_order_relaxed);
+}
+
+
+int GetKeyWatchFd(void)
+{
+  return KeyWatchFd;
+}
+
+
+//
+// step an absolute wake time on by Period us
+//
+static void AddPollPeriod(struct timespec* Time, uint32_t Period)
+{
+  Time->tv_nsec += (long)Period * 1000;
+  while (Time->tv_nsec >= 1000000000)
+  {
+    Time->tv_nsec -= 1000000000;
+    Time->tv_sec++;
+  }
+}
+
+
+//
+// the key watch thread: while the SDR is running, read the status register
+// every key_watch us, on absolute wake times so the rate doesn't drift
+//
+static void* KeyWatch(__attribute__((unused)) void* arg)
+{
+  struct timespec Next;
+  uint64_t Now, LastPoll = 0;
+  uint64_t Wake = 1;
+  uint32_t Generation;
+  uint8_t Bits, LastBits = 0;
+  bool Watching = false;
+
+  Generation = GetStateGeneration();
+  while (true)
+  {
+    if (!atomic_load(&SDRActive))
+    {
+      Watching = false;
+      Generation = WaitForStateChange(Generation, StateWaitTimeout());
+      continue;
+    }
+    if (!Watching)
+      clock_gettime(CLOCK_MONOTONIC, &Next);
+    AddPollPeriod(&Next, P2Config.KeyWatchPeriod);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Next, NULL) == EINTR)
+      ;
+    ReadStatusRegister();
+    Bits = (uint8_t)GetP2PTTKeyInputs();
+    Now = TelemetryTimestamp();
+    if (Watching && (Bits != LastBits))
+    {
+      RecordKeyEdge(Bits, Now, LastPoll, true);
+      if (write(KeyWatchFd, &Wake, sizeof(Wake)) != sizeof(Wake))
+        perror("key watch wake");
+    }
+    LastBits = Bits;
+    LastPoll = Now;
+    Watching = true;
+  }
+  return NULL;
+}
+
+
+bool StartKeyWatch(void)
+{
+  if (P2Config.KeyWatchPeriod == 0)
+    return false;
+  KeyWatchFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (KeyWatchFd < 0)
+  {
+    perror("key watch eventfd");
+    return true;
+  }
+  if (CreatePlacedThread(&KeyWatchThread, eThreadKey, "key watch", KeyWatch, NULL) != 0)
+  {
+    perror("pthread_create key watch");
+    close(KeyWatchFd);
+    KeyWatchFd = -1;
+    return true;
+  }
+  pthread_detach(KeyWatchThread);
+  printf("key watch: PTT and key inputs polled every %uus\n", P2Config.KeyWatchPeriod);
+  return false;
+}
@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// keyedges.h:
+//
+// header: timing of CW key and PTT edges, from the status register poll that
+// sees them to the high priority packet that reports them to the client
+//
+// an edge happened after the last poll that saw the old state and no later
+// than the poll that saw the new one: the gap between them is how uncertain
+// its time is. The status thread polls every status_poll us. With key_watch
+// set, a key watch thread (thread class "key", so it can have a core of its
+// own) polls every key_watch us instead, and wakes the status thread to send
+// at once, so edges are seen sooner and timed closer.
+// each edge is traced (key_edge, then key_send with the delay) and counted
+// for telemetry: poll gap, and detection to send delay.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __keyedges_h
+#define __keyedges_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "telemetry.h"
+
+
+//
+// edge timing, for telemetry
+//
+struct KeyEdgeStatistics
+{
+  uint64_t Edges;                               // edges reported to the client
+  uint64_t Watched;                             // of those, seen by the key watch thread
+  uint32_t LastBits;                            // GetP2PTTKeyInputs() bits after the last edge
+  uint64_t TotalPollGap;                        // us: sum over edges of the time between the polls either side
+  uint32_t MaxPollGap;
+  uint64_t TotalSendDelay;                      // us: sum over edges of detection until the packet was sent
+  uint32_t MaxSendDelay;
+  uint32_t SendDelays[VTELLATENCYBINS];         // log2 us histogram of detection to send
+};
+
+
+//
+// StartKeyWatch(void)
+// start the key watch thread, if key_watch is set. Return true if error
+//
+bool StartKeyWatch(void);
+
+
+//
+// GetKeyWatchFd(void)
+// an eventfd that is readable once the key watch thread has seen an edge;
+// -1 if there is no key watch thread. The status thread waits on it too.
+//
+int GetKeyWatchFd(void);
+
+
+//
+// NoteKeyEdge(uint8_t Bits, uint64_t Detected, uint64_t LastPoll)
+// an edge to Bits was seen by a poll at Detected, the previous poll being at
+// LastPoll (TelemetryTimestamp() us). Kept until the packet reporting it is
+// sent; an edge already waiting to be sent is kept instead, as it is older.
+//
+void NoteKeyEdge(uint8_t Bits, uint64_t Detected, uint64_t LastPoll);
+
+
+//
+// KeyEdgeSent(uint8_t Bits)
+// a status packet with Bits has just been sent: time the edge waiting, if any
+//
+void KeyEdgeSent(uint8_t Bits);
+
+
+//
+// GetKeyEdgeStatistics(struct KeyEdgeStatistics* Stats)
+//
+void GetKeyEdgeStatistics(struct KeyEdgeStatistics* Stats);
+
+
+#endif
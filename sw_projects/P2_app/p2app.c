@@ -26,12 +26,17 @@
 #include <math.h>
 #include <pthread.h>
 #include <termios.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <ifaddrs.h>
+#include <linux/if_packet.h>
 #include <semaphore.h>
 #include <signal.h>
 
@@ -41,6 +46,12 @@
 #include "../common/codecwrite.h"                   // codec register I/O for Saturn
 #include "../common/version.h"                      // version I/O for Saturn
 #include "../common/auxadc.h"                       // version I/O for Saturn
+#include "../common/saturndrivers.h"                // FIFO monitor
+#include "../common/simbackend.h"                   // simulated FPGA backend
+#include "../common/vfiobackend.h"                  // user space VFIO DMA backend
+#include "../common/ddccapture.h"                   // DDC DMA recording
+#include "../common/regqueue.h"                     // register write owner thread
+#include "../common/regprofile.h"                   // register access profiler
 
 #include "threaddata.h"
 #include "generalpacket.h"
@@ -50,11 +61,28 @@
 #include "InDUCIQ.h"
 #include "InSpkrAudio.h"
 #include "OutMicAudio.h"
+#include "OutWideband.h"
 #include "OutDDCIQ.h"
+#include "OutDDCRecord.h"
+#include "OutDDCSnapshot.h"
+#include "pluginhost.h"
 #include "OutHighPriority.h"
 #include "cathandler.h"
 #include "LDGATU.h"
 #include "frontpanelhandler.h"
+#include "threadplacement.h"
+#include "telemetry.h"
+#include "eventtrace.h"
+#include "p2config.h"
+#include "packetfields.h"
+#include "rxtimestamp.h"
+#include "pcapcapture.h"
+#include "heartbeat.h"
+#include "keyedges.h"
+#include "adcoverload.h"
+#include "pscapture.h"
+#include "ppstime.h"
+#include "handover.h"
 
 #define P2APPVERSION 27
 #define FIRMWARE_MIN_VERSION  8               // Minimum FPGA software version that this software requires
@@ -106,18 +134,21 @@ extern sem_t RFGPIOMutex;                   // protect access to RF GPIO registe
 extern sem_t CodecRegMutex;                 // protect writes to codec
 
 struct sockaddr_in reply_addr;              // destination address for outgoing data
+struct BufferArena StreamArena;             // stream buffers, taken by each thread as it starts
 
-bool IsTXMode;                              // true if in TX
-bool SDRActive;                             // true if this SDR is running at the moment
+atomic_bool IsTXMode;                       // true if in TX
+atomic_bool SDRActive;                      // true if this SDR is running at the moment
+atomic_bool SDRIdle;                        // true while in idle power saving
 bool ReplyAddressSet = false;               // true when reply address has been set
 bool StartBitReceived = false;              // true when "run" bit has been set
-bool NewMessageReceived = false;            // set whenever a message is received
+_Atomic uint32_t MessageTime[VNUMINCOMINGPORTS];   // ms of the last message to each incoming port
 bool ExitRequested = false;                 // true if "exit checking" thread requests shutdown
 bool SkipExitCheck = false;                 // true to skip "exit checking", if running as a service
-bool ThreadError = false;                   // true if a thread reports an error
+atomic_bool ThreadError = false;            // true if a thread reports an error
 bool UseDebug = false;                      // true if to enable debugging
 bool UseControlPanel = false;               // true if to use a control panel
 bool UseLDGATU = false;                     // true if to use an LDG ATU via CAT
+char DataInterface[IFNAMSIZ] = "";          // interface the streams are bound to (-I); "" for any
 
 
 #define SDRBOARDID 1                        // Hermes
@@ -125,33 +156,47 @@ bool UseLDGATU = false;                     // true if to use an LDG ATU via CAT
 #define VDISCOVERYSIZE 60                   // discovery packet
 #define VDISCOVERYREPLYSIZE 60              // reply packet
 #define VWIDEBANDSIZE 1028                  // wideband scalar samples
+#define VNUMLISTENERS 4                     // incoming control sockets owned by the event loop
 #define VCONSTTXAMPLSCALEFACTOR 0x0001FFFF  // 18 bit scale value - set to 1/2 of full scale
 #define VCONSTTXAMPLSCALEFACTOR_13 0x0002000  // 18 bit scale value - set to 1/32 of full scale FWV13+
 #define VCONSTTXAMPLSCALEFACTOR_17 0x0002000  // 18 bit scale value - set to 1/32 of full scale FWV17+
 //#define VCONSTTXAMPLSCALEFACTOR_17 0x0002800  // 18 bit scale value - set to 1/32 of full scale FWV17+
 
+//
+// incoming control sockets serviced by the main event loop, with their packet sizes.
+// when several are ready together they are handled in this order.
+//
+const uint32_t ListenerPorts[VNUMLISTENERS] = {VPORTHIGHPRIORITYTOSDR, VPORTDDCSPECIFIC, VPORTDUCSPECIFIC, VPORTCOMMAND};
+const uint32_t ListenerSizes[VNUMLISTENERS] = {VHIGHPRIOTIYTOSDRSIZE, VDDCSPECIFICSIZE, VDUCSPECIFICSIZE, VDDCPACKETSIZE};
+const uint32_t ListenerCaptures[VNUMLISTENERS] = {eCapHighPriority, eCapDDCSpecific, eCapDUCSpecific, eCapCommand};
+
+//
+// table of threads and their sockets. The socket option class of an outgoing thread
+// that shares a socket (eg. wideband 0 sends from the high priority in socket)
+// is the same as that of the socket's owner.
+//
 struct ThreadSocketData SocketData[VPORTTABLESIZE] =
 {
-  {0, 0, 1024, "Cmd", false,{}, 0, 0},                      // command (incoming) thread
-  {0, 0, 1025, "DDC Specific", false,{}, 0, 0},             // DDC specifc (incoming) thread
-  {0, 0, 1026, "DUC Specific", false,{}, 0, 0},             // DUC specific (incoming) thread
-  {0, 0, 1027, "High Priority In", false,{}, 0, 0},         // High Priority (incoming) thread
-  {0, 0, 1028, "Spkr Audio", false,{}, 0, 0},               // Speaker Audio (incoming) thread
-  {0, 0, 1029, "DUC I/Q", false,{}, 0, 0},                  // DUC IQ (incoming) thread
-  {0, 0, 1025, "High Priority Out", false,{}, 0, 0},        // High Priority (outgoing) thread
-  {0, 0, 1026, "Mic Audio", false,{}, 0, 0},                // Mic Audio (outgoing) thread
-  {0, 0, 1035, "DDC I/Q 0", false,{}, 0, 0},                // DDC IQ 0 (outgoing) thread
-  {0, 0, 1036, "DDC I/Q 1", false,{}, 0, 0},                // DDC IQ 1 (outgoing) thread
-  {0, 0, 1037, "DDC I/Q 2", false,{}, 0, 0},                // DDC IQ 2 (outgoing) thread
-  {0, 0, 1038, "DDC I/Q 3", false,{}, 0, 0},                // DDC IQ 3 (outgoing) thread
-  {0, 0, 1039, "DDC I/Q 4", false,{}, 0, 0},                // DDC IQ 4 (outgoing) thread
-  {0, 0, 1040, "DDC I/Q 5", false,{}, 0, 0},                // DDC IQ 5 (outgoing) thread
-  {0, 0, 1041, "DDC I/Q 6", false,{}, 0, 0},                // DDC IQ 6 (outgoing) thread
-  {0, 0, 1042, "DDC I/Q 7", false,{}, 0, 0},                // DDC IQ 7 (outgoing) thread
-  {0, 0, 1043, "DDC I/Q 8", false,{}, 0, 0},                // DDC IQ 8 (outgoing) thread
-  {0, 0, 1044, "DDC I/Q 9", false,{}, 0, 0},                // DDC IQ 9 (outgoing) thread
-  {0, 0, 1027, "Wideband 0", false,{}, 0, 0},               // Wideband 0 (outgoing) thread
-  {0, 0, 1028, "Wideband 1", false,{}, 0, 0}                // Wideband 1 (outgoing) thread
+  {0, 0, 1024, "Cmd", false,{}, 0, 0, eSocketControl, 0},                    // command (incoming) thread
+  {0, 0, 1025, "DDC Specific", false,{}, 0, 0, eSocketHighPriority, 0},      // DDC specifc (incoming) thread
+  {0, 0, 1026, "DUC Specific", false,{}, 0, 0, eSocketDUC, 0},               // DUC specific (incoming) thread
+  {0, 0, 1027, "High Priority In", false,{}, 0, 0, eSocketHighPriority, 0},  // High Priority (incoming) thread
+  {0, 0, 1028, "Spkr Audio", false,{}, 0, 0, eSocketDUC, 0},                 // Speaker Audio (incoming) thread
+  {0, 0, 1029, "DUC I/Q", false,{}, 0, 0, eSocketDUC, 0},                    // DUC IQ (incoming) thread
+  {0, 0, 1025, "High Priority Out", false,{}, 0, 0, eSocketHighPriority, 0}, // High Priority (outgoing) thread
+  {0, 0, 1026, "Mic Audio", false,{}, 0, 0, eSocketDUC, 0},                  // Mic Audio (outgoing) thread
+  {0, 0, 1035, "DDC I/Q 0", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 0 (outgoing) thread
+  {0, 0, 1036, "DDC I/Q 1", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 1 (outgoing) thread
+  {0, 0, 1037, "DDC I/Q 2", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 2 (outgoing) thread
+  {0, 0, 1038, "DDC I/Q 3", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 3 (outgoing) thread
+  {0, 0, 1039, "DDC I/Q 4", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 4 (outgoing) thread
+  {0, 0, 1040, "DDC I/Q 5", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 5 (outgoing) thread
+  {0, 0, 1041, "DDC I/Q 6", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 6 (outgoing) thread
+  {0, 0, 1042, "DDC I/Q 7", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 7 (outgoing) thread
+  {0, 0, 1043, "DDC I/Q 8", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 8 (outgoing) thread
+  {0, 0, 1044, "DDC I/Q 9", false,{}, 0, 0, eSocketDDC, 0},                  // DDC IQ 9 (outgoing) thread
+  {0, 0, 1027, "Wideband 0", false,{}, 0, 0, eSocketHighPriority, 0},        // Wideband 0 (outgoing) thread
+  {0, 0, 1028, "Wideband 1", false,{}, 0, 0, eSocketDUC, 0}                  // Wideband 1 (outgoing) thread
 };
 
 
@@ -167,16 +212,15 @@ uint16_t DefaultPorts[VPORTTABLESIZE] =
 };
 
 
-pthread_t DDCSpecificThread;
-pthread_t DUCSpecificThread;
-pthread_t HighPriorityToSDRThread;
 pthread_t SpkrAudioThread;
 pthread_t DUCIQThread;
 pthread_t DDCIQThread[VNUMDDC];               // array, but not sure how many
 pthread_t MicThread;
 pthread_t HighPriorityFromSDRThread;
+pthread_t WidebandThread;
 pthread_t CheckForExitThread;                 // thread looks for types "exit" command
 pthread_t CheckForNoActivityThread;           // thread looks for inactvity
+pthread_t RegisterQueueOwnerThread;           // applies queued register transactions
 
 
 //
@@ -189,8 +233,15 @@ uint32_t GetP2appVersion(void)
 
 void sig_handler(int signo)
 {
+    if (signo == SIGHUP)
+    {
+        RequestConfigReload();                  // settings re-read by the event loop
+        return;
+    }
     if (signo == SIGINT)
         printf("received SIGINT\n");
+    else if (signo == SIGTERM)
+        printf("received SIGTERM\n");
     ExitRequested = true;
 }
 
@@ -232,10 +283,312 @@ void SetPort(uint32_t ThreadNum, uint16_t PortNum)
     SocketData[ThreadNum].Portid = PortNum;
 
   if (SocketData[ThreadNum].Portid != CurrentPort)
+  {
     SocketData[ThreadNum].Cmdid |= VBITCHANGEPORT;
+    NotifyStateChange();
+  }
+}
+
+
+
+//
+// state change notification. The condition variable uses CLOCK_MONOTONIC, so a
+// clock step (eg NTP at boot) does not stretch the timeout.
+//
+static pthread_mutex_t StateChangeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t StateChangeCond;
+static pthread_once_t StateChangeOnce = PTHREAD_ONCE_INIT;
+static uint32_t StateGeneration = 0;                    // protected by StateChangeMutex
+
+
+static void InitStateChange(void)
+{
+  pthread_condattr_t Attr;
+
+  pthread_condattr_init(&Attr);
+  pthread_condattr_setclock(&Attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&StateChangeCond, &Attr);
+  pthread_condattr_destroy(&Attr);
+}
+
+
+uint32_t GetStateGeneration(void)
+{
+  uint32_t Generation;
+
+  pthread_mutex_lock(&StateChangeMutex);
+  Generation = StateGeneration;
+  pthread_mutex_unlock(&StateChangeMutex);
+  return Generation;
+}
+
+
+void NotifyStateChange(void)
+{
+  pthread_once(&StateChangeOnce, InitStateChange);
+  pthread_mutex_lock(&StateChangeMutex);
+  StateGeneration++;
+  pthread_cond_broadcast(&StateChangeCond);
+  pthread_mutex_unlock(&StateChangeMutex);
+}
+
+
+uint32_t WaitForStateChange(uint32_t Generation, uint32_t TimeoutMs)
+{
+  struct timespec Deadline;
+  uint64_t Ns;
+
+  pthread_once(&StateChangeOnce, InitStateChange);
+  clock_gettime(CLOCK_MONOTONIC, &Deadline);
+  Ns = Deadline.tv_nsec + (uint64_t)TimeoutMs * 1000000ULL;
+  Deadline.tv_sec += Ns / 1000000000ULL;
+  Deadline.tv_nsec = Ns % 1000000000ULL;
+  pthread_mutex_lock(&StateChangeMutex);
+  while (StateGeneration == Generation)
+    if (pthread_cond_timedwait(&StateChangeCond, &StateChangeMutex, &Deadline) == ETIMEDOUT)
+      break;
+  Generation = StateGeneration;
+  pthread_mutex_unlock(&StateChangeMutex);
+  return Generation;
+}
+
+
+//
+// stream state machine; all protected by StateChangeMutex.
+// SDRActive and StreamRun are also read without it, by StreamRunActive().
+//
+_Atomic uint32_t StreamRun = 0;
+static EStreamState StreamState = eStreamIdle;
+static uint32_t StreamThreads = 0;                      // registered stream threads
+static uint32_t StreamThreadsStarted = 0;               // threads that have started the current run
+static uint32_t StreamThreadsInRun = 0;                 // threads in any run loop
+
+
+static void SetStreamState(EStreamState State)
+{
+  if (State != StreamState)
+  {
+    StreamState = State;
+    Trace(eTraceStreamState, State, atomic_load(&StreamRun));
+  }
+}
+
+
+//
+// go to running if every registered thread has started this run, or to idle if
+// the run has ended and all have left their loops
+//
+static void UpdateStreamState(void)
+{
+  if (atomic_load(&SDRActive))
+  {
+    if (StreamThreadsStarted >= StreamThreads)
+      SetStreamState(eStreamRunning);
+  }
+  else if (StreamThreadsInRun == 0)
+    SetStreamState(eStreamIdle);
+}
+
+
+void SetSDRActive(bool Active)
+{
+  pthread_once(&StateChangeOnce, InitStateChange);
+  pthread_mutex_lock(&StateChangeMutex);
+  if (atomic_exchange(&SDRActive, Active) != Active)
+  {
+    Trace(eTraceSDRActive, Active, 0);
+    if (Active)
+    {
+      if (atomic_exchange(&SDRIdle, false))
+        Trace(eTraceIdle, false, 0);
+      atomic_fetch_add(&StreamRun, 1);
+      StreamThreadsStarted = 0;
+      SetStreamState(eStreamStarting);
+    }
+    else
+      SetStreamState(eStreamStopping);
+    UpdateStreamState();
+    StateGeneration++;
+    pthread_cond_broadcast(&StateChangeCond);
+  }
+  pthread_mutex_unlock(&StateChangeMutex);
+}
+
+
+void SetSDRIdle(bool Idle)
+{
+  bool Changed;
+
+  pthread_once(&StateChangeOnce, InitStateChange);
+  pthread_mutex_lock(&StateChangeMutex);
+  if (Idle && (atomic_load(&SDRActive) || (StreamState != eStreamIdle)))
+    Idle = false;
+  Changed = (atomic_exchange(&SDRIdle, Idle) != Idle);
+  if (Changed)
+  {
+    Trace(eTraceIdle, Idle, 0);
+    //
+    // disabled with the lock held: a run starts with SetSDRActive(true), which takes it,
+    // so the DDC thread's enable for the new run can't be overtaken by this one
+    //
+    if (Idle)
+      SetRXDDCEnabled(false);
+    StateGeneration++;
+    pthread_cond_broadcast(&StateChangeCond);
+  }
+  pthread_mutex_unlock(&StateChangeMutex);
+  if (Changed)
+    printf("%s idle power saving\n", Idle ? "Entered" : "Left");
+}
+
+
+void RegisterStreamThread(bool Register)
+{
+  pthread_mutex_lock(&StateChangeMutex);
+  if (Register)
+    StreamThreads++;
+  else
+    StreamThreads--;
+  UpdateStreamState();
+  pthread_mutex_unlock(&StateChangeMutex);
+}
+
+
+void WaitForStreamStart(struct ThreadSocketData* Threads, uint32_t NumThreads, bool Rebind, uint32_t* Run)
+{
+  struct timespec Deadline;
+  uint32_t Cntr, Timeout;
+
+  pthread_once(&StateChangeOnce, InitStateChange);
+  pthread_mutex_lock(&StateChangeMutex);
+  while (!atomic_load(&SDRActive) || (atomic_load(&StreamRun) == *Run))
+  {
+    //
+    // port changes are made with the lock released: MakeSocket() can be slow
+    //
+    for (Cntr = 0; Cntr < NumThreads; Cntr++)
+      if (Threads[Cntr].Cmdid & VBITCHANGEPORT)
+      {
+        pthread_mutex_unlock(&StateChangeMutex);
+        printf("%s: change to port %d\n", Threads[Cntr].Nameid, Threads[Cntr].Portid);
+        if (Rebind)
+        {
+          close(Threads[Cntr].Socketid);                      // close old socket, open new one
+          MakeSocket(Threads + Cntr, 0);                      // this binds to the new port.
+        }
+        Threads[Cntr].Cmdid &= ~VBITCHANGEPORT;               // clear command bit
+        pthread_mutex_lock(&StateChangeMutex);
+      }
+    if (!atomic_load(&SDRActive) || (atomic_load(&StreamRun) == *Run))
+    {
+      Timeout = StateWaitTimeout();
+      clock_gettime(CLOCK_MONOTONIC, &Deadline);
+      Deadline.tv_sec += Timeout / 1000;
+      Deadline.tv_nsec += (Timeout % 1000) * 1000000L;
+      if (Deadline.tv_nsec >= 1000000000L)
+      {
+        Deadline.tv_sec++;
+        Deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&StateChangeCond, &StateChangeMutex, &Deadline);
+    }
+  }
+  *Run = atomic_load(&StreamRun);
+  StreamThreadsStarted++;
+  StreamThreadsInRun++;
+  UpdateStreamState();
+  pthread_mutex_unlock(&StateChangeMutex);
+}
+
+
+void StreamThreadStopped(void)
+{
+  pthread_mutex_lock(&StateChangeMutex);
+  StreamThreadsInRun--;
+  UpdateStreamState();
+  pthread_mutex_unlock(&StateChangeMutex);
+}
+
+
+EStreamState GetStreamState(void)
+{
+  EStreamState State;
+
+  pthread_mutex_lock(&StateChangeMutex);
+  State = StreamState;
+  pthread_mutex_unlock(&StateChangeMutex);
+  return State;
+}
+
+
+
+//
+// discovery replies, one prebuilt per network interface with that interface's MAC address.
+// the command socket receives on all interfaces; IP_PKTINFO gives the interface each
+// discovery came in on, so it is answered with that interface's MAC address
+//
+#define VMAXDISCOVERYINTERFACES 8
+
+struct DiscoveryInterface
+{
+  int IfIndex;                                      // interface index
+  char Name[IFNAMSIZ];
+  uint8_t Reply[VDISCOVERYREPLYSIZE];
+};
+
+struct DiscoveryInterface DiscoveryInterfaces[VMAXDISCOVERYINTERFACES];
+uint32_t DiscoveryInterfaceCount = 0;
+
+
+//
+// build a discovery reply for each interface that has a MAC address, from the template reply
+//
+void BuildDiscoveryReplies(uint8_t* Template)
+{
+  struct ifaddrs* Interfaces;
+  struct ifaddrs* Interface;
+  struct sockaddr_ll* Link;
+  struct DiscoveryInterface* Entry;
+
+  DiscoveryInterfaceCount = 0;
+  if(getifaddrs(&Interfaces) != 0)
+  {
+    perror("getifaddrs");
+    return;
+  }
+  for(Interface = Interfaces; Interface != NULL; Interface = Interface->ifa_next)
+  {
+    if((Interface->ifa_addr == NULL) || (Interface->ifa_addr->sa_family != AF_PACKET))
+      continue;
+    Link = (struct sockaddr_ll*)Interface->ifa_addr;
+    if((Link->sll_halen != 6) || (Interface->ifa_flags & IFF_LOOPBACK))
+      continue;
+    if(DiscoveryInterfaceCount == VMAXDISCOVERYINTERFACES)
+      break;
+    Entry = DiscoveryInterfaces + DiscoveryInterfaceCount++;
+    Entry->IfIndex = Link->sll_ifindex;
+    snprintf(Entry->Name, IFNAMSIZ, "%s", Interface->ifa_name);
+    memcpy(Entry->Reply, Template, VDISCOVERYREPLYSIZE);
+    memcpy(Entry->Reply + 5, Link->sll_addr, 6);
+  }
+  freeifaddrs(Interfaces);
 }
 
 
+//
+// find the discovery reply for an interface index
+// returns NULL if there isn't one (then the default reply is used)
+//
+uint8_t* FindDiscoveryReply(int IfIndex)
+{
+  uint32_t Cntr;
+
+  for(Cntr = 0; Cntr < DiscoveryInterfaceCount; Cntr++)
+    if(DiscoveryInterfaces[Cntr].IfIndex == IfIndex)
+      return DiscoveryInterfaces[Cntr].Reply;
+  return NULL;
+}
+
 
 //
 // function to make an incoming or outgoing socket, bound to the specified port in the structure
@@ -243,9 +596,18 @@ void SetPort(uint32_t ThreadNum, uint16_t PortNum)
 //
 int MakeSocket(struct ThreadSocketData* Ptr, int DDCid)
 {
-  struct timeval ReadTimeout;                                       // read timeout
   int yes = 1;
 //  struct sockaddr_in addr_cmddata;
+  //
+  // a socket handed over by the p2app this one took over from is bound already;
+  // it gets this instance's socket options
+  //
+  if(TakeHandoverSocket(Ptr))
+  {
+    ApplySocketOptions(Ptr);
+    Ptr->DDCid = DDCid;
+    return 0;
+  }
   //
   // create socket for incoming data
   //
@@ -254,14 +616,24 @@ int MakeSocket(struct ThreadSocketData* Ptr, int DDCid)
     perror("socket fail");
     return EXIT_FAILURE;
   }
+  Ptr->SocketCount++;
 
   //
-  // set 1ms timeout, and re-use any recently open ports
+  // re-use any recently open ports; then set the receive timeout (1ms by default)
+  // and the buffer sizes, DSCP marking, priority and busy poll for the socket's class
   //
   setsockopt(Ptr->Socketid, SOL_SOCKET, SO_REUSEADDR, (void *)&yes , sizeof(yes));
-  ReadTimeout.tv_sec = 0;
-  ReadTimeout.tv_usec = 1000;
-  setsockopt(Ptr->Socketid, SOL_SOCKET, SO_RCVTIMEO, (void *)&ReadTimeout , sizeof(ReadTimeout));
+  ApplySocketOptions(Ptr);
+
+  //
+  // the stream sockets can be tied to one interface (-I); the command socket
+  // takes discovery from every interface, so it is left unbound
+  //
+  if((DataInterface[0] != 0) && (Ptr != SocketData))
+  {
+    if(setsockopt(Ptr->Socketid, SOL_SOCKET, SO_BINDTODEVICE, DataInterface, strlen(DataInterface)) < 0)
+      perror("SO_BINDTODEVICE");
+  }
 
   //
   // bind application to the specified port
@@ -287,6 +659,21 @@ int MakeSocket(struct ThreadSocketData* Ptr, int DDCid)
 }
 
 
+//
+// connect an outgoing only socket to its destination
+// connect() again replaces the previous destination, so this is called each time a stream starts
+//
+bool ConnectSocket(struct ThreadSocketData* Ptr, struct sockaddr_in* Dest)
+{
+  if(connect(Ptr->Socketid, (struct sockaddr *)Dest, sizeof(struct sockaddr_in)) < 0)
+  {
+    perror("connect");
+    return true;
+  }
+  return false;
+}
+
+
 //
 // this runs as its own thread to monitor command line activity. A string "exist" exits the application. 
 // thread initiated at the start.
@@ -311,26 +698,80 @@ void* CheckForExitCommand(void *arg)
 
 //
 // this runs as its own thread to see if messages have stopped being received.
-// if nomessages in a second, goes back to "inactive" state.
+// if no message to any port within the activity timeout (setting activity_timeout),
+// goes back to "inactive" state. It wakes from a timerfd a few times per timeout,
+// so a client that has gone is noticed within about 1.25 timeouts.
+// once the stream threads have stopped it enters idle power saving if enabled;
+// then it ticks once per VIDLEWAITTIMEOUT.
+// each tick it also checks the stream threads' heartbeats for stalls.
 //
+#define VMINACTIVITYTICK 10                     // ms
+#define VMAXACTIVITYTICK 250                    // ms
+
 void* CheckForActivity(void *arg)
 {
-  bool PreviouslyActiveState;               
+  bool PreviouslyActiveState;
+  bool Reverted = false;                        // true once reverted, until the next message
+  struct itimerspec Period;
+  struct timespec Now;
+  uint64_t Expirations;
+  uint32_t Timeout, Tick = 0, NewTick;
+  uint32_t Age, NewestAge, Port;
+  int TimerFd;
+
+  TimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
   while(1)
   {
-    sleep(1);                                   // wait for 1 second
-    PreviouslyActiveState = SDRActive;          // see if active on entry
-    if (!NewMessageReceived && HW_Timer_Enable) // if no messages received,
+    Timeout = P2Config.ActivityTimeout;         // can be changed while running
+    NewTick = Timeout / 4;
+    if (NewTick < VMINACTIVITYTICK)
+      NewTick = VMINACTIVITYTICK;
+    else if (NewTick > VMAXACTIVITYTICK)
+      NewTick = VMAXACTIVITYTICK;
+    if (atomic_load(&SDRIdle))
+      NewTick = VIDLEWAITTIMEOUT;
+    if ((NewTick != Tick) && (TimerFd >= 0))
+    {
+      Period.it_interval.tv_sec = NewTick / 1000;
+      Period.it_interval.tv_nsec = (NewTick % 1000) * 1000000;
+      Period.it_value = Period.it_interval;
+      timerfd_settime(TimerFd, 0, &Period, NULL);
+    }
+    Tick = NewTick;
+    if ((TimerFd < 0) || (read(TimerFd, &Expirations, sizeof(Expirations)) != sizeof(Expirations)))
+      usleep(Tick * 1000);
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &Now);
+    NewestAge = UINT32_MAX;
+    for (Port = 0; Port < VNUMINCOMINGPORTS; Port++)
+    {
+      Age = (uint32_t)(Now.tv_sec * 1000 + Now.tv_nsec / 1000000) - atomic_load_explicit(&MessageTime[Port], memory_order_relaxed);
+      if (Age < NewestAge)
+        NewestAge = Age;
+    }
+    if (NewestAge < Timeout)
+      Reverted = false;
+    else if (!Reverted && HW_Timer_Enable)      // if no messages received,
     {
-      SDRActive = false;                        // set back to inactive
+      PreviouslyActiveState = SDRActive;        // see if active on entry
+      SetSDRActive(false);                      // set back to inactive
       SetTXEnable(false);
       EnableCW(false, false);
       ReplyAddressSet = false;
       StartBitReceived = false;
+      InvalidatePacketFields();                 // the client's next packets are decoded in full
+      Reverted = true;
       if(PreviouslyActiveState)
-        printf("Reverted to Inactive State after no activity\n");
+        printf("Reverted to Inactive State after no activity for %ums\n", NewestAge);
+    }
+    if (!P2Config.IdlePowerSave)
+    {
+      if (atomic_load(&SDRIdle))                // setting turned off while idle
+        SetSDRIdle(false);
     }
-    NewMessageReceived = false;
+    else if ((NewestAge >= Timeout) && !atomic_load(&SDRActive) && !atomic_load(&SDRIdle))
+      SetSDRIdle(true);                         // (not until the last run has ended)
+    CheckHeartbeats();                          // stall detector
   }
 }
 
@@ -355,9 +796,121 @@ void Shutdown()
   SetMOX(false);
   SetTXEnable(false);
   EnableCW(false, false);
+  StopPacketCapture();
+}
+
+
+
+//
+// startup: discovery only needs the FPGA version and the MAC address, so it is
+// answered as soon as the sockets are open. The slow hardware setup (codec,
+// CW keyer ramp) runs in its own thread meanwhile; any packet other than
+// discovery waits until it has finished.
+//
+struct timespec StartupTime;                            // when main() started
+pthread_t HardwareInitThread;                           // slow hardware setup thread
+bool HardwareInitPending = false;                       // true until that thread has been joined
+
+
+//
+// log the time since startup at the end of a startup phase
+//
+void LogStartupPhase(const char* Phase)
+{
+  struct timespec Now;
+
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  printf("startup: %s at %.1f ms\n", Phase,
+         (Now.tv_sec - StartupTime.tv_sec) * 1.0e3 + (Now.tv_nsec - StartupTime.tv_nsec) * 1.0e-6);
 }
 
 
+//
+// the slow part of the hardware setup. Nothing else uses the codec or the
+// keyer ramp until a client has sent a packet
+//
+void* InitialiseHardware(__attribute__((unused)) void *arg)
+{
+  CodecInitialise();
+  LogStartupPhase("codec initialised");
+  InitialiseCWKeyerRamp(true, 5000);                                // create initial default 5 ms ramp, P2
+  LogStartupPhase("CW keyer ramp loaded");
+  return NULL;
+}
+
+
+//
+// start the slow hardware setup in its own thread
+//
+void StartHardwareInit(void)
+{
+  if(pthread_create(&HardwareInitThread, NULL, InitialiseHardware, NULL) == 0)
+  {
+    SetThreadName(HardwareInitThread, "hardware init");
+    HardwareInitPending = true;
+  }
+  else
+    InitialiseHardware(NULL);                                       // no thread: do it now
+}
+
+
+//
+// wait for the slow hardware setup, if it is still running
+// only called from the main thread
+//
+void WaitForHardwareInit(void)
+{
+  static bool KeyerRAMMapped = false;
+
+  if(HardwareInitPending)
+  {
+    pthread_join(HardwareInitThread, NULL);
+    HardwareInitPending = false;
+    LogStartupPhase("hardware ready");
+  }
+//
+// the startup ramp is loaded, and only client packets write the keyer RAM from here:
+// it can be given its write-combined map without racing a block write
+//
+  if(P2Config.KeyerRAMWriteCombine && !KeyerRAMMapped)
+  {
+    KeyerRAMMapped = true;
+    MapWriteCombinedRegisters(VADDRCWKEYERRAM, VCWKEYERRAMSIZE);
+  }
+}
+
+
+//
+// hot standby: wait until the active p2app has handed over, or ended without,
+// then take the hardware over. The register writes made so far were held in a
+// transaction on this thread. After a handover the codec and keyer RAM keep what
+// the active p2app loaded (only the default ramp's keyer settings are made again),
+// and the client's control packets set the rest, so the writes are made once,
+// after them; otherwise this starts as a new p2app would.
+// Returns true if there was no takeover.
+//
+bool TakeOverHardware(void)
+{
+  ETakeover Takeover;
+
+  Takeover = WaitForTakeover();
+  if(Takeover == eTakeoverNone)
+    return true;
+  if(Takeover == eTakeoverState)
+    InitialiseCWKeyerRamp(true, 5000);
+  else
+  {
+    CommitRegisterTransaction();
+    StartHardwareInit();
+  }
+  WaitForHardwareInit();
+  ReplayHandoverState(Takeover);
+  if(Takeover == eTakeoverState)
+    CommitRegisterTransaction();
+  LogStartupPhase("taken over");
+  return false;
+}
+
 
 //
 // main program. Initialise, then handle incoming command/general data
@@ -370,6 +923,9 @@ void Shutdown()
 int main(int argc, char *argv[])
 {
   int i, size;
+  bool Simulate = false;                          // true if the simulated FPGA is to be used
+  bool UseHandover = false;                       // true for hot standby handover (-H)
+  uint32_t Board = 0;                             // Saturn board number (-B)
 //
 // part written discovery reply packet
 //
@@ -397,14 +953,34 @@ int main(int argc, char *argv[])
   uint8_t UDPInBuffer[VDDCPACKETSIZE];                              // outgoing buffer
   struct iovec iovecinst;                                           // iovcnt buffer - 1 for each outgoing buffer
   struct msghdr datagram;                                           // multiple incoming message header
+  uint8_t PacketInfo[CMSG_SPACE(sizeof(struct in_pktinfo))];        // arrival interface of a command packet
+  uint8_t StampInfo[VRXSTAMPCMSGSIZE];                              // receive stamps of a high priority packet
+  uint64_t SoftwareStamp, HardwareStamp;
+  struct cmsghdr* Cmsg;
+  int ArrivalIfIndex;                                               // interface a command packet came in on, or 0
+  uint8_t* Reply;                                                   // discovery reply sent
+  int EventFd;                                                      // epoll set of incoming control sockets
+  struct epoll_event Event;                                         // one socket to add to the set
+  struct epoll_event Events[VNUMLISTENERS];                         // sockets reported ready
+  int EventCount;                                                   // number of ready sockets
+  int EventTimeout;                                                 // ms epoll_wait timeout
+  uint32_t ReadyPorts;                                              // bit set for each ready port
+  uint32_t Port;                                                    // port table index being serviced
 
   uint32_t TestFrequency;                                           // test source DDS freq
   int CmdOption;                                                    // command line option
+  int ReaderCore, DemuxCore, SenderCore;                            // DDC pipeline core numbers
+  int CoalesceFrames, CoalesceDeadline;                             // DUC coalescing settings
+  char* TelemetryPath = NULL;                                       // telemetry socket, if requested
+  char* TracePath = NULL;                                           // event trace dump file, if not the default
+  char* PPSPath = NULL;                                             // PPS device for DDC timestamps, if any
+  int MetricsPort = 0;                                              // Prometheus metrics HTTP port, if requested
   char BuildDate[]=GIT_DATE;
 	ESoftwareID ID;
 	unsigned int Version = 0;
   bool IncompatibleFirmware = false;                                // becomes set if firmware is not compatible with this version
 
+  clock_gettime(CLOCK_MONOTONIC, &StartupTime);
   //
   // initialise register access semaphores
   //
@@ -415,19 +991,62 @@ int main(int argc, char *argv[])
 
 //
 // setup Saturn hardware
+// the simulated FPGA and the board have to be selected before the hardware is opened,
+// so their options are found before the other options are processed
 //
   printf("SATURN Protocol 2 App. press 'x <enter>' in console to close\n");
 
+  for(i = 1; i < (argc - 1); i++)
+  {
+    if(strcmp(argv[i], "-z") == 0)
+    {
+      if(SetSimulatedDDCRates(argv[i + 1]))
+        return EXIT_FAILURE;
+      Simulate = true;
+    }
+    else if(strcmp(argv[i], "-Z") == 0)
+    {
+      if(SetSimulatedDDCReplay(argv[i + 1]))
+        return EXIT_FAILURE;
+      Simulate = true;
+    }
+    else if(strcmp(argv[i], "-B") == 0)
+    {
+      if(SetSaturnDeviceIndex(atoi(argv[i + 1])))
+        return EXIT_FAILURE;
+      Board = atoi(argv[i + 1]);
+      printf("using Saturn board %d (/dev/xdma%d_...)\n", atoi(argv[i + 1]), atoi(argv[i + 1]));
+    }
+    else if(strcmp(argv[i], "-V") == 0)
+    {
+      if(UseVFIOHardware(argv[i + 1]))
+        return EXIT_FAILURE;
+      printf("using VFIO user space DMA for %s: no XDMA driver\n", argv[i + 1]);
+    }
+  }
+  for(i = 1; i < argc; i++)
+    if(strcmp(argv[i], "-H") == 0)
+      UseHandover = true;
+  if(Simulate)
+  {
+    printf("running with simulated FPGA: no Saturn hardware used\n");
+    UseSimulatedHardware();
+  }
+  if(UseHandover)
+    ConnectHandover(Board);                                         // a standby if another p2app has the board
   OpenXDMADriver();
+  ProbeHardwareCapabilities();                                      // read FPGA version registers once
   PrintVersionInfo();
   printf("p2app client app software Version:%d Build Date:%s\n", P2APPVERSION, BuildDate);
   PrintAuxADCInfo();
   if (IsFallbackConfig())
       printf("FPGA load is a fallback - you should re-flash the primary FPGA image!\n");
+  LogStartupPhase("FPGA opened");
 
-  CodecInitialise();
-  InitialiseDACAttenROMs();
-  InitialiseCWKeyerRamp(true, 5000);                                // create initial default 5 ms ramp, P2
+  if(IsHandoverStandby())
+    BeginRegisterTransaction();                                     // the active p2app has the hardware until it hands over
+  else
+    StartHardwareInit();
   SetCWSidetoneEnabled(true);
   SetTXProtocol(true);                                              // set to protocol 2
   SetTXModulationSource(eIQData);                                   // disable debug options
@@ -436,7 +1055,7 @@ int main(int argc, char *argv[])
   SetSpkrMute(false);
 
   Version = GetFirmwareVersion(&ID);                                // TX scaling changed at FW V13
-  if(Version < 13)
+  if(!HasCapability(VCAPTXSCALEV13))
     SetTXAmplitudeScaling(VCONSTTXAMPLSCALEFACTOR);
   else if (Version < 17)
     SetTXAmplitudeScaling(VCONSTTXAMPLSCALEFACTOR_13);
@@ -466,22 +1085,16 @@ int main(int argc, char *argv[])
 
   if (signal(SIGINT, sig_handler) == SIG_ERR)
     printf("\ncan't catch SIGINT\n");
-
-//
-// start up thread to check for no longer getting messages, to set back to inactive
-//
-  if(pthread_create(&CheckForNoActivityThread, NULL, CheckForActivity, NULL) < 0)
-  {
-    perror("pthread_create check for exit");
-    return EXIT_FAILURE;
-  }
-  pthread_detach(CheckForNoActivityThread);
+  if (signal(SIGHUP, sig_handler) == SIG_ERR)
+    printf("\ncan't catch SIGHUP\n");
+  if (UseHandover && (signal(SIGTERM, sig_handler) == SIG_ERR))     // so a stopped service hands over
+    printf("\ncan't catch SIGTERM\n");
 
 //
 // option string needs a colon after each option letter that has a parameter after it
 // and it has a leading colon to suppress error messages
 //
-  while((CmdOption = getopt(argc, argv, ":a:i:f:m:sdph")) != -1)
+  while((CmdOption = getopt(argc, argv, ":a:b:B:c:g:I:o:P:t:u:w:i:f:m:x:y:z:Z:V:F:C:D:T:R:M:S:W:X:K:L:Q:lersdphH")) != -1)
   {
     switch(CmdOption)
     {
@@ -489,14 +1102,52 @@ int main(int argc, char *argv[])
         printf("usage: ./p2app <optional arguments>\n");
         printf("optional arguments:\n");
         printf("-a LDG        control TUNE for LDG ATU\n");
+        printf("-b <packets>  max DDC packets sent per sendmmsg call (1-%d, default %d)\n", VMAXDDCBATCH, VDEFAULTDDCBATCH);
+        printf("-B <board>    use Saturn board n: XDMA driver instance /dev/xdma<n>_... (0-%d, default 0)\n", VMAXSATURNDEVICES - 1);
+        printf("-c r,d,s      run DDC DMA reader, demux and sender threads on cores r, d, s\n");
+        printf("-g <file>     read settings from config file; SIGHUP reads it again\n");
+        printf("-I <ifname>   bind the data streams to one network interface, and take its MAC address\n");
+        printf("-o name=value set one setting, overriding the config file\n");
+        printf("-P <profile>  operating profile: lowlatency, throughput or wan (see the list below)\n");
+        printf("-t <threads>  number of DDC sender threads (1-%d, default 1; 0 = one per DDC, woken by data)\n", VNUMDDC);
+        printf("-u n,us       coalesce up to n TX DUC frames per DMA, held max us microseconds\n");
+        printf("-w <us>       DDC DMA latency target in microseconds (default %d)\n", VDEFAULTDDCLATENCY);
+        printf("-x c,p,mask   run thread class c (ddc, duc, hipri, control, key) at SCHED_FIFO priority p on CPU mask\n");
+        printf("-y <file>     read thread placement settings from file\n");
+        printf("-l            lock all memory pages (mlockall) to avoid page faults\n");
+        printf("-z n,rate[,m] simulated FPGA, no hardware: generate n DDCs at rate KHz, unpaced if m=max, DDCs 0 and 1\n");
+        printf("              interleaved if m=pair (both may be given, joined by a comma; 0 = as set by client)\n");
+        printf("-Z f[,max]    simulated FPGA, no hardware: replay DDC capture file f, at recorded or max speed\n");
+        printf("-V <pci addr> run the DMA engines from user space through VFIO (board bound to vfio-pci)\n");
+        printf("-F s,n[,t]    simulated FPGA: fail every nth DMA of stream s (ddc, duc, mic, speaker) with a\n");
+        printf("              timeout, engine or short error t (default timeout); or for ddc, corrupt every nth frame:\n");
+        printf("              t = word (sample lost), marker (rate word marker lost), false (false marker) or frame\n");
+        printf("-C f[,n]      record raw DDC DMA data to file f, a ring of n 256KB segments (default %d)\n", VDEFAULTDDCCAPTURESEGMENTS);
+        printf("-K f[,n[,t]]  keep the last n 256KB segments of DDC DMA data in memory (default %d), written to\n", VDEFAULTSNAPSHOTSEGMENTS);
+        printf("              file f.<count> on triggers t (fifo, resync, adc, signal joined by +; default all)\n");
+        printf("-D d[,m[,MB]] record DDCs in mask m (default DDC0) to SigMF files in directory d, MB per file (default %d)\n", VDEFAULTRECORDFILEMB);
+        printf("-T <path>     serve stream telemetry (JSON, or text if requested) on UNIX socket path\n");
+        printf("-M <port>     serve Prometheus metrics by HTTP on TCP port (GET /metrics)\n");
+        printf("-R <file>     write the event trace to file on SIGUSR1 or a crash (default /tmp/p2app.trace)\n");
+        printf("-S a:p[:m]    also send DDC data to address a port p (DDCs in mask m); up to %d, repeat option\n", VMAXDDCSUBSCRIBERS);
+        printf("-W f[,s[,pps]] capture packets of streams s (names joined by +, default all) to pcapng file f,\n");
+        printf("              at most pps packets/s (default %d, 0 = no limit)\n", VDEFAULTCAPTURERATE);
+        printf("-L p[,args]   load DDC DSP plugin shared object p, with its arguments; up to %d, repeat option\n", VMAXDDCPLUGINS);
+        printf("-Q <device>   discipline DDC timestamps to UTC from PPS device (eg. /dev/pps0)\n");
+        printf("-H            hot standby: take over from the p2app running for this board when it exits,\n");
+        printf("              with its sockets and client; or hand over to a standby on exit\n");
+        printf("-X <file>     play TX I/Q file (24 bit I/Q at 192KHz, looped) into the DUC instead of client data\n");
         printf("-f <frequency in Hz> turns on test source for all DDCs\n");
         printf("-i saturn     board responds as board id = Saturn\n");
         printf("-i orionmk2   board responds as board id = Orion mk 2\n");
         printf("-m xlr        selects balanced XLR microphone input\n");
         printf("-m jack       selects unbalanced 3.5mm microphone input\n");
+        printf("-e            wait for FIFO monitor interrupt events (/dev/xdma0_events_n)\n");
+        printf("-r            DDC DMA through the driver's streaming ring (needs updated xdma driver)\n");
         printf("-s            skip checking for exit keys, run as service\n");
         printf("-d            print additional debug\n");
         printf("-p            drive G2 control panel\n");
+        PrintConfigHelp();
         return EXIT_SUCCESS;
         break;
 
@@ -514,6 +1165,161 @@ int main(int argc, char *argv[])
         }
         break;
 
+      case 'b':
+        SetConfigValue("ddc_batch", atoi(optarg));
+        printf("DDC packets per send call requested = %d\n", atoi(optarg));
+        break;
+
+      case 'c':
+        if(sscanf(optarg, "%d,%d,%d", &ReaderCore, &DemuxCore, &SenderCore) == 3)
+        {
+          printf("DDC pipeline cores: reader=%d demux=%d sender=%d\n", ReaderCore, DemuxCore, SenderCore);
+          SetDDCPipelineCores(ReaderCore, DemuxCore, SenderCore);
+        }
+        else
+        {
+          printf("error parsing core list\n");
+          printf("-B <board>    use Saturn board n: XDMA driver instance /dev/xdma<n>_... (0-%d, default 0)\n", VMAXSATURNDEVICES - 1);
+        printf("-c r,d,s      run DDC DMA reader, demux and sender threads on cores r, d, s\n");
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 't':
+        SetDDCSenderThreads(atoi(optarg));
+        printf("DDC sender threads requested = %d\n", atoi(optarg));
+        break;
+
+      case 'u':
+        if(sscanf(optarg, "%d,%d", &CoalesceFrames, &CoalesceDeadline) == 2)
+        {
+          printf("DUC coalescing: up to %d frames, %dus deadline\n", CoalesceFrames, CoalesceDeadline);
+          SetConfigValue("duc_coalesce_frames", CoalesceFrames);
+          SetConfigValue("duc_coalesce_us", CoalesceDeadline);
+        }
+        else
+        {
+          printf("error parsing DUC coalescing settings\n");
+          printf("-u n,us       coalesce up to n TX DUC frames per DMA, held max us microseconds\n");
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 'g':
+        if(SetConfigFile(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'o':
+        if(SetConfigOverride(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'P':
+        if(SetConfigProfile(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'w':
+        SetConfigValue("ddc_latency", atoi(optarg));
+        printf("DDC DMA latency target = %dus\n", atoi(optarg));
+        break;
+
+      case 'x':
+        if(ParseThreadPlacement(optarg))
+        {
+          printf("-x c,p,mask   run thread class c (ddc, duc, hipri, control, key) at SCHED_FIFO priority p on CPU mask\n");
+          printf("              p = 0 for normal scheduling; mask = 0 for any CPU\n");
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 'y':
+        if(ReadThreadPlacementFile(optarg))
+          return EXIT_SUCCESS;
+        printf("thread placement read from %s\n", optarg);
+        break;
+
+      case 'z':
+      case 'Z':
+      case 'V':
+      case 'H':
+        break;                                                      // handled before the hardware was opened
+
+      case 'F':
+        if(SetSimulatedDMAFaults(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'C':
+        if(OpenDDCCapture(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'K':
+        if(SetDDCSnapshot(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'D':
+        if(SetDDCRecording(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'T':
+        TelemetryPath = optarg;
+        break;
+
+      case 'R':
+        TracePath = optarg;
+        break;
+
+      case 'Q':
+        PPSPath = optarg;
+        break;
+
+      case 'M':
+        MetricsPort = atoi(optarg);
+        break;
+
+      case 'B':                                                     // already done before the hardware was opened
+        break;
+
+      case 'I':
+        if((strlen(optarg) >= IFNAMSIZ) || (if_nametoindex(optarg) == 0))
+        {
+          printf("network interface %s not found\n", optarg);
+          return EXIT_FAILURE;
+        }
+        snprintf(DataInterface, IFNAMSIZ, "%s", optarg);
+        printf("data streams bound to interface %s\n", DataInterface);
+        break;
+
+      case 'S':
+        if(AddDDCSubscriber(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'W':
+        if(SetPacketCapture(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'X':
+        if(SetDUCPlayback(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'L':
+        if(LoadDDCPlugin(optarg))
+          return EXIT_FAILURE;
+        break;
+
+      case 'l':
+        printf("memory locking requested\n");
+        SetMemoryLock(true);
+        break;
+
       case 'i':
         if(strcmp(optarg,"saturn") == 0)
         {
@@ -562,6 +1368,16 @@ int main(int argc, char *argv[])
         printf ("Test source selected, frequency = %dHz\n", TestFrequency);                  
         break;
 
+      case 'e':
+        printf ("FIFO interrupt events enabled\n");
+        EnableFIFOEvents(true);
+        break;
+
+      case 'r':
+        printf ("DDC streaming ring DMA requested\n");
+        SetDDCStreamRing(true);
+        break;
+
       case 's':
         printf ("Skipping check for exit keys\n");                  
         SkipExitCheck = true;
@@ -578,13 +1394,96 @@ int main(int argc, char *argv[])
     }
   }
   printf("\n");
+  ApplyConfig();
+
+//
+// lock memory and place this thread in the control class before any more threads are made,
+// so control threads created from here (front panel, ATU) inherit normal placement.
+// the data threads are created with their own class placement.
+//
+  LogStartupPhase("options processed");
+  LockProcessMemory();
+  ApplyThreadPlacement(eThreadControl, "main (startup)");
+//
+// a hot standby waits here until the active p2app has gone
+//
+  if(IsHandoverStandby() && TakeOverHardware())
+    return ExitRequested ? EXIT_SUCCESS : EXIT_FAILURE;
+  if(TelemetryPath != NULL)
+    StartTelemetryServer(TelemetryPath);
+  if((MetricsPort > 0) && (MetricsPort < 65536))
+    StartMetricsServer(MetricsPort);
+  InitEventTrace(TracePath);
+  StartStallDetector();
+  if(StartPacketCapture())
+    return EXIT_FAILURE;
+  if(CreateBufferArena(&StreamArena, P2Config.BufferHugePages, P2Config.BufferLock))
+    return EXIT_FAILURE;
+//
+// optionally map the DMA bypass BAR, for the mic and speaker threads to move their
+// small transfers with loads and stores; without it they use their SGDMA engines
+//
+  if(P2Config.CodecBypass)
+    OpenDMABypass();
+
+//
+// optionally start the register write owner thread: the control packet handlers then
+// queue their register transactions and return, and it applies them in order.
+// it runs in the high priority class, like the network event loop that queues to it.
+//
+  if(P2Config.RegisterQueue)
+  {
+    if(CreatePlacedThread(&RegisterQueueOwnerThread, eThreadHighPriority, "register queue", RegisterQueueThread, NULL) != 0)
+    {
+      perror("pthread_create register queue");
+      return EXIT_FAILURE;
+    }
+    pthread_detach(RegisterQueueOwnerThread);
+    if(StartRegisterQueue())
+      return EXIT_FAILURE;
+  }
+
+//
+// optionally start the key watch thread, to see PTT and key edges between status polls
+//
+  if(StartKeyWatch())
+    return EXIT_FAILURE;
+
+//
+// optionally start the ADC overload watch thread, to report overloads without waiting for the next status packet
+//
+  if(StartADCOverloadWatch())
+    return EXIT_FAILURE;
+
+//
+// PureSignal capture buffers and sender thread; capture itself is turned on by ps_capture
+//
+  if(StartPSCapture())
+    return EXIT_FAILURE;
+
+//
+// PPS device to discipline DDC timestamps, if requested
+//
+  if((PPSPath != NULL) && SetPPSDevice(PPSPath))
+    return EXIT_FAILURE;
+
+//
+// start up thread to check for no longer getting messages, to set back to inactive
+//
+  if(CreatePlacedThread(&CheckForNoActivityThread, eThreadControl, "activity check", CheckForActivity, NULL) != 0)
+  {
+    perror("pthread_create check for exit");
+    return EXIT_FAILURE;
+  }
+  pthread_detach(CheckForNoActivityThread);
+
 
 
 //
 // startup ATU handler if needed
 //
-  if(UseLDGATU)
-    InitialiseLDGHandler();
+  if(UseLDGATU && InitialiseLDGHandler())
+    return EXIT_FAILURE;
 
 //
 // startup G2 front panel handler if needed
@@ -597,7 +1496,7 @@ int main(int argc, char *argv[])
 //
   if (SkipExitCheck == false)
   {
-    if(pthread_create(&CheckForExitThread, NULL, CheckForExitCommand, NULL) < 0)
+    if(CreatePlacedThread(&CheckForExitThread, eThreadControl, "exit check", CheckForExitCommand, NULL) != 0)
     {
       perror("pthread_create check for exit");
       return EXIT_FAILURE;
@@ -609,41 +1508,27 @@ int main(int argc, char *argv[])
   // create socket for incoming data on the command port
   //
   MakeSocket(SocketData, 0);
+  i = 1;
+  setsockopt(SocketData[VPORTCOMMAND].Socketid, IPPROTO_IP, IP_PKTINFO, &i, sizeof(i));   // report arrival interface
 
   //
-  // get this device MAC address
+  // get this device MAC address: that of the data interface if set, else eth0.
+  // then prebuild the discovery reply for each interface
   //
   memset(&hwaddr, 0, sizeof(hwaddr));
-  strncpy(hwaddr.ifr_name, "eth0", IFNAMSIZ - 1);
+  strncpy(hwaddr.ifr_name, (DataInterface[0] != 0) ? DataInterface : "eth0", IFNAMSIZ - 1);
   ioctl(SocketData[VPORTCOMMAND].Socketid, SIOCGIFHWADDR, &hwaddr);
   for(i = 0; i < 6; ++i) DiscoveryReply[i + 5] = hwaddr.ifr_addr.sa_data[i];         // copy MAC to reply message
+  BuildDiscoveryReplies(DiscoveryReply);
 
-  MakeSocket(SocketData+VPORTDDCSPECIFIC, 0);            // create and bind a socket
-  if(pthread_create(&DDCSpecificThread, NULL, IncomingDDCSpecific, (void*)&SocketData[VPORTDDCSPECIFIC]) < 0)
-  {
-    perror("pthread_create DDC specific");
-    return EXIT_FAILURE;
-  }
-  pthread_detach(DDCSpecificThread);
+  MakeSocket(SocketData+VPORTDDCSPECIFIC, 0);            // create and bind a socket; serviced by the event loop
 
-  MakeSocket(SocketData+VPORTDUCSPECIFIC, 0);            // create and bind a socket
-  if(pthread_create(&DUCSpecificThread, NULL, IncomingDUCSpecific, (void*)&SocketData[VPORTDUCSPECIFIC]) < 0)
-  {
-    perror("pthread_create DUC specific");
-    return EXIT_FAILURE;
-  }
-  pthread_detach(DUCSpecificThread);
+  MakeSocket(SocketData+VPORTDUCSPECIFIC, 0);            // create and bind a socket; serviced by the event loop
 
-  MakeSocket(SocketData+VPORTHIGHPRIORITYTOSDR, 0);            // create and bind a socket
-  if(pthread_create(&HighPriorityToSDRThread, NULL, IncomingHighPriority, (void*)&SocketData[VPORTHIGHPRIORITYTOSDR]) < 0)
-  {
-    perror("pthread_create High priority to SDR");
-    return EXIT_FAILURE;
-  }
-  pthread_detach(HighPriorityToSDRThread);
+  MakeSocket(SocketData+VPORTHIGHPRIORITYTOSDR, 0);            // create and bind a socket; serviced by the event loop
 
   MakeSocket(SocketData+VPORTSPKRAUDIO, 0);            // create and bind a socket
-  if(pthread_create(&SpkrAudioThread, NULL, IncomingSpkrAudio, (void*)&SocketData[VPORTSPKRAUDIO]) < 0)
+  if(CreatePlacedThread(&SpkrAudioThread, eThreadDUC, "speaker audio", IncomingSpkrAudio, (void*)&SocketData[VPORTSPKRAUDIO]) != 0)
   {
     perror("pthread_create speaker audio");
     return EXIT_FAILURE;
@@ -651,7 +1536,7 @@ int main(int argc, char *argv[])
   pthread_detach(SpkrAudioThread);
 
   MakeSocket(SocketData+VPORTDUCIQ, 0);            // create and bind a socket
-  if(pthread_create(&DUCIQThread, NULL, IncomingDUCIQ, (void*)&SocketData[VPORTDUCIQ]) < 0)
+  if(CreatePlacedThread(&DUCIQThread, eThreadDUC, "DUC I/Q", IncomingDUCIQ, (void*)&SocketData[VPORTDUCIQ]) != 0)
   {
     perror("pthread_create DUC I/Q");
     return EXIT_FAILURE;
@@ -665,7 +1550,7 @@ int main(int argc, char *argv[])
 //
   SocketData[VPORTMICAUDIO].Socketid = SocketData[VPORTDUCSPECIFIC].Socketid;
   memcpy(&SocketData[VPORTMICAUDIO].addr_cmddata, &SocketData[VPORTDUCSPECIFIC].addr_cmddata, sizeof(struct sockaddr_in));
-  if(pthread_create(&MicThread, NULL, OutgoingMicSamples, (void*)&SocketData[VPORTMICAUDIO]) < 0)
+  if(CreatePlacedThread(&MicThread, eThreadHighPriority, "mic audio", OutgoingMicSamples, (void*)&SocketData[VPORTMICAUDIO]) != 0)
   {
     perror("pthread_create Mic");
     return EXIT_FAILURE;
@@ -683,16 +1568,32 @@ int main(int argc, char *argv[])
 //
   SocketData[VPORTHIGHPRIORITYFROMSDR].Socketid = SocketData[VPORTDDCSPECIFIC].Socketid;
   memcpy(&SocketData[VPORTHIGHPRIORITYFROMSDR].addr_cmddata, &SocketData[VPORTDDCSPECIFIC].addr_cmddata, sizeof(struct sockaddr_in));
-  if(pthread_create(&HighPriorityFromSDRThread, NULL, OutgoingHighPriority, (void*)&SocketData[VPORTHIGHPRIORITYFROMSDR]) < 0)
+  if(CreatePlacedThread(&HighPriorityFromSDRThread, eThreadHighPriority, "high priority out", OutgoingHighPriority, (void*)&SocketData[VPORTHIGHPRIORITYFROMSDR]) != 0)
   {
     perror("pthread_create outgoing hi priority");
     return EXIT_FAILURE;
   }
   pthread_detach(HighPriorityFromSDRThread);
 
+//
+// create outgoing wideband data thread, serving both wideband ports
+// note these share ports with incoming high priority and speaker data, so don't create new ports
+// instead copy socket settings from the VPORTHIGHPRIORITYTOSDR and VPORTSPKRAUDIO sockets.
+// the thread sends on those sockets through their own SocketData, as they are rebound on a port change:
+//
+  memcpy(&SocketData[VPORTWIDEBAND0].addr_cmddata, &SocketData[VPORTHIGHPRIORITYTOSDR].addr_cmddata, sizeof(struct sockaddr_in));
+  memcpy(&SocketData[VPORTWIDEBAND1].addr_cmddata, &SocketData[VPORTSPKRAUDIO].addr_cmddata, sizeof(struct sockaddr_in));
+  if(CreatePlacedThread(&WidebandThread, eThreadControl, "wideband", OutgoingWideband, (void*)&SocketData[VPORTWIDEBAND0]) != 0)
+  {
+    perror("pthread_create wideband");
+    return EXIT_FAILURE;
+  }
+  pthread_detach(WidebandThread);
+
 
 //
-// and for now create just one outgoing DDC data thread for DDC 0
+// create one outgoing DDC data thread, for all DDCs: it runs the DMA reader and
+// starts the demux and sender stages (with -t 0, a sender per DDC).
 // create all the sockets though!
 //
   MakeSocket(SocketData + VPORTDDCIQ0, 0);
@@ -705,7 +1606,7 @@ int main(int argc, char *argv[])
   MakeSocket(SocketData + VPORTDDCIQ7, 0);
   MakeSocket(SocketData + VPORTDDCIQ8, 0);
   MakeSocket(SocketData + VPORTDDCIQ9, 0);
-  if(pthread_create(&DDCIQThread[0], NULL, OutgoingDDCIQ, (void*)&SocketData[VPORTDDCIQ0]) < 0)
+  if(CreatePlacedThread(&DDCIQThread[0], eThreadDDC, "DDC I/Q", OutgoingDDCIQ, (void*)&SocketData[VPORTDDCIQ0]) != 0)
   {
     perror("pthread_create DUC I/Q");
     return EXIT_FAILURE;
@@ -714,96 +1615,215 @@ int main(int argc, char *argv[])
 
 
   //
-  // now main processing loop. Process received Command packets arriving at port 1024
-  // these are identified by the command byte (byte 4)
+  // create the network event loop. One epoll set holds all the incoming control sockets
+  // (command, DDC specific, DUC specific, high priority) so the main thread sleeps until
+  // a packet arrives. The bulk data sockets (speaker audio, DUC I/Q) keep their own threads.
+  //
+  EventFd = epoll_create1(0);
+  if(EventFd < 0)
+  {
+    perror("epoll_create1");
+    return EXIT_FAILURE;
+  }
+  for(i = 0; i < VNUMLISTENERS; i++)
+  {
+    memset(&Event, 0, sizeof(Event));
+    Event.events = EPOLLIN;
+    Event.data.u32 = ListenerPorts[i];
+    if(epoll_ctl(EventFd, EPOLL_CTL_ADD, SocketData[ListenerPorts[i]].Socketid, &Event) < 0)
+    {
+      perror("epoll_ctl");
+      return EXIT_FAILURE;
+    }
+    SocketData[ListenerPorts[i]].Active = true;
+  }
+
+  //
+  // with -H, let a standby p2app connect, to take over on exit
+  //
+  if(UseHandover)
+    StartHandoverListener(Board);
+
+  //
+  // the main thread now becomes the network event loop; report where everything runs
+  //
+  ApplyThreadPlacement(eThreadHighPriority, "main (event loop)");
+  ReportThreadPlacement();
+  LogStartupPhase("network event loop ready");
+
+  //
+  // now main processing loop. Wait for any control socket to be ready, then
+  // take one packet from each ready socket in the fixed ListenerPorts order.
+  // sockets stay "ready" while they hold data so a backlog is taken next time round.
+  // Command packets arriving at port 1024 are identified by the command byte (byte 4)
   // cmd=00: general packet
   // cmd=02: discovery
   // cmd=03: set IP address (not supported)
   // cmd=04: erase (not supported)
   // cmd=05: program (not supported)
   //
+  HeartbeatStart(eBeatEventLoop);
   while(1)
   {
-    memset(&iovecinst, 0, sizeof(struct iovec));
-    memset(&datagram, 0, sizeof(datagram));
-    iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
-    iovecinst.iov_len = VDDCPACKETSIZE;
-    datagram.msg_iov = &iovecinst;
-    datagram.msg_iovlen = 1;
-    datagram.msg_name = &addr_from;
-    datagram.msg_namelen = sizeof(addr_from);
-    size = recvmsg(SocketData[0].Socketid, &datagram, 0);         // get one message. If it times out, gets size=-1
-    if(size < 0 && errno != EAGAIN)
+    Heartbeat(eBeatEventLoop, eBeatIdle);
+    EventTimeout = P2Config.EventLoopTimeout;
+    if(atomic_load(&SDRIdle) && (EventTimeout < VIDLEWAITTIMEOUT))
+      EventTimeout = VIDLEWAITTIMEOUT;                              // packets still wake it at once
+    EventCount = epoll_wait(EventFd, Events, VNUMLISTENERS, EventTimeout);
+    Heartbeat(eBeatEventLoop, eBeatHandle);
+    if(EventCount < 0 && errno != EINTR)
     {
-      perror("recvfrom, port 1024");
+      perror("epoll_wait");
       return EXIT_FAILURE;
     }
+    ReloadConfigFile();                                             // if SIGHUP received
+    if(CheckTraceDump() && P2Config.RegisterProfile)                // if SIGUSR1 received
+      PrintRegisterProfile(stdout, P2Config.RegisterProfile);
     if(ExitRequested)
       break;
     if(ThreadError)
       break;
 
+    ReadyPorts = 0;
+    for(i = 0; i < EventCount; i++)
+      ReadyPorts |= (1 << Events[i].data.u32);
 
-//
-// only process packets of length 60 bytes on this port, to exclude protocol 1 discovery for example.
-// (that means we can't handle the programming packet but we don't use that anyway)
-//
-    CmdByte = UDPInBuffer[4];
-    if(size==VDISCOVERYSIZE)  
+    for(i = 0; i < VNUMLISTENERS; i++)
     {
-      NewMessageReceived = true;
-      switch(CmdByte)
+      Port = ListenerPorts[i];
+      if(!(ReadyPorts & (1 << Port)))
+        continue;
+      memset(&iovecinst, 0, sizeof(struct iovec));
+      memset(&datagram, 0, sizeof(datagram));
+      iovecinst.iov_base = &UDPInBuffer;
+      iovecinst.iov_len = ListenerSizes[i];
+      datagram.msg_iov = &iovecinst;
+      datagram.msg_iovlen = 1;
+      datagram.msg_name = &addr_from;
+      datagram.msg_namelen = sizeof(addr_from);
+      if(Port == VPORTCOMMAND)
+      {
+        datagram.msg_control = PacketInfo;
+        datagram.msg_controllen = sizeof(PacketInfo);
+      }
+      else if(Port == VPORTHIGHPRIORITYTOSDR)
       {
-        //
-        // general packet. Get the port numbers and establish listener threads
-        //
-        case 0:
-          printf("P2 General packet to SDR, size= %d\n", size);
-          //
-          // get "from" MAC address and port; this is where the data goes back to
-          //
-          memset(&reply_addr, 0, sizeof(reply_addr));
-          reply_addr.sin_family = AF_INET;
-          reply_addr.sin_addr.s_addr = addr_from.sin_addr.s_addr;
-          reply_addr.sin_port = addr_from.sin_port;                       // (but each outgoing thread needs to set its own sin_port)
-          HandleGeneralPacket(UDPInBuffer);
-          ReplyAddressSet = true;
-          if(ReplyAddressSet && StartBitReceived)
+        datagram.msg_control = StampInfo;
+        datagram.msg_controllen = sizeof(StampInfo);
+      }
+      size = recvmsg(SocketData[Port].Socketid, &datagram, MSG_DONTWAIT);
+      if(size < 0)
+      {
+        if(errno == EAGAIN || errno == EINTR)
+          continue;
+        perror("recvmsg, event loop");
+        return EXIT_FAILURE;
+      }
+      CaptureBuffer(ListenerCaptures[i], false, &addr_from, SocketData[Port].Portid, UDPInBuffer, size);
+      if((Port != VPORTCOMMAND) || (size != VDISCOVERYSIZE) || (UDPInBuffer[4] != 2))
+      {
+        Heartbeat(eBeatEventLoop, eBeatIdle);
+        WaitForHardwareInit();                                      // only discovery is answered before that
+        Heartbeat(eBeatEventLoop, eBeatHandle);
+      }
+
+      switch(Port)
+      {
+        case VPORTHIGHPRIORITYTOSDR:
+          if(size == VHIGHPRIOTIYTOSDRSIZE)
           {
-            SDRActive = true;                                       // only set active if we have start bit too
-            SetTXEnable(true);
+            HandleHighPriorityPacket(UDPInBuffer);
+            if(GetReceiveTimestamps(&datagram, &SoftwareStamp, &HardwareStamp))
+              TelemetryReceiveDelay(eTelHighPriority, SoftwareStamp, HardwareStamp);
+            NoteHandoverPacket(Port, &addr_from, UDPInBuffer, size);
           }
           break;
 
-        //
-        // discovery packet
-        //
-        case 2:
-          printf("P2 Discovery packet\n");
-          if(SDRActive || IncompatibleFirmware)
-            DiscoveryReply[4] = 3;                             // response 2 if not active, 3 if running
-          else
-            DiscoveryReply[4] = 2;                             // response 2 if not active, 3 if running
-
-          memset(&UDPInBuffer, 0, VDISCOVERYREPLYSIZE);
-          memcpy(&UDPInBuffer, DiscoveryReply, VDISCOVERYREPLYSIZE);
-          sendto(SocketData[0].Socketid, &UDPInBuffer, VDISCOVERYREPLYSIZE, 0, (struct sockaddr *)&addr_from, sizeof(addr_from));
-          break;
-
-        case 3:
-        case 4:
-        case 5:
-          printf("Unsupported packet\n");
+        case VPORTDDCSPECIFIC:
+          if(size == VDDCSPECIFICSIZE)
+          {
+            HandleDDCSpecificPacket(UDPInBuffer);
+            NoteHandoverPacket(Port, &addr_from, UDPInBuffer, size);
+          }
           break;
 
-        default:
+        case VPORTDUCSPECIFIC:
+          if(size == VDUCSPECIFICSIZE)
+          {
+            HandleDUCSpecificPacket(UDPInBuffer);
+            NoteHandoverPacket(Port, &addr_from, UDPInBuffer, size);
+          }
           break;
 
-      }// end switch (packet type)
-    }
 //
-// now do any "post packet" processing
+// command port: only process packets of length 60 bytes, to exclude protocol 1 discovery for example.
+// (that means we can't handle the programming packet but we don't use that anyway)
 //
+        case VPORTCOMMAND:
+          CmdByte = UDPInBuffer[4];
+          if(size==VDISCOVERYSIZE)
+          {
+            NoteMessageReceived(VPORTCOMMAND);
+            switch(CmdByte)
+            {
+              //
+              // general packet. Get the port numbers and establish listener threads
+              //
+              case 0:
+                printf("P2 General packet to SDR, size= %d\n", size);
+                //
+                // get "from" MAC address and port; this is where the data goes back to
+                //
+                memset(&reply_addr, 0, sizeof(reply_addr));
+                reply_addr.sin_family = AF_INET;
+                reply_addr.sin_addr.s_addr = addr_from.sin_addr.s_addr;
+                reply_addr.sin_port = addr_from.sin_port;                       // (but each outgoing thread needs to set its own sin_port)
+                SetSDRIdle(false);                                      // a client is (re)connecting
+                HandleGeneralPacket(UDPInBuffer);
+                NoteHandoverPacket(Port, &addr_from, UDPInBuffer, size);
+                NotifyStateChange();                                    // eg wideband enables may have changed
+                ReplyAddressSet = true;
+                if(ReplyAddressSet && StartBitReceived)
+                {
+                  SetSDRActive(true);                                     // only set active if we have start bit too
+                  SetTXEnable(true);
+                }
+                break;
+
+              //
+              // discovery packet
+              //
+              case 2:
+                ArrivalIfIndex = 0;
+                for(Cmsg = CMSG_FIRSTHDR(&datagram); Cmsg != NULL; Cmsg = CMSG_NXTHDR(&datagram, Cmsg))
+                  if((Cmsg->cmsg_level == IPPROTO_IP) && (Cmsg->cmsg_type == IP_PKTINFO))
+                    ArrivalIfIndex = ((struct in_pktinfo*)CMSG_DATA(Cmsg))->ipi_ifindex;
+                Reply = FindDiscoveryReply(ArrivalIfIndex);
+                if(Reply == NULL)
+                  Reply = DiscoveryReply;
+                printf("P2 Discovery packet\n");
+                if(SDRActive || IncompatibleFirmware)
+                  Reply[4] = 3;                                      // response 2 if not active, 3 if running
+                else
+                  Reply[4] = 2;                                      // response 2 if not active, 3 if running
+                sendto(SocketData[0].Socketid, Reply, VDISCOVERYREPLYSIZE, 0, (struct sockaddr *)&addr_from, sizeof(addr_from));
+                CaptureBuffer(eCapCommand, true, &addr_from, SocketData[0].Portid, Reply, VDISCOVERYREPLYSIZE);
+                break;
+
+              case 3:
+              case 4:
+              case 5:
+                printf("Unsupported packet\n");
+                break;
+
+              default:
+                break;
+
+            }// end switch (packet type)
+          }
+          break;
+      }
+    }
   } //while(1)
   if(ThreadError)
     printf("Thread error reported - exiting\n");
@@ -811,7 +1831,17 @@ int main(int argc, char *argv[])
   // clean exit
   //
   printf("Exiting\n");
+  Heartbeat(eBeatEventLoop, eBeatIdle);
+  close(EventFd);
+  WaitForHardwareInit();
+  if(HandOverToStandby())
+  {
+    StopPacketCapture();
+    return EXIT_SUCCESS;                                            // the standby has the hardware now: leave it be
+  }
   Shutdown();
+  if(P2Config.RegisterProfile)
+    PrintRegisterProfile(stdout, P2Config.RegisterProfile);
   return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,726 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p2config.c:
+//
+// runtime tunable settings for p2app
+// settings come from a config file (p2app -g) and from command line overrides
+// (p2app -o name=value, and the older options such as -b and -w).
+// on SIGHUP the config file is read again; settings that can change while
+// running are applied without dropping the client.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "p2config.h"
+#include "threaddata.h"
+#include "OutDDCIQ.h"
+#include "OutVirtualDDC.h"
+#include "OutDDCShm.h"
+#include "InDUCIQ.h"
+#include "ducreorder.h"
+#include "pscapture.h"
+#include "eventtrace.h"
+#include "rxtimestamp.h"
+#include "heartbeat.h"
+#include "../common/saturnregisters.h"
+#include "../common/saturndrivers.h"
+#include "../common/spectrum.h"
+#include "../common/ddccompress.h"
+#include "../common/ddcfec.h"
+#include "../common/regprofile.h"
+
+
+struct P2Config P2Config =
+{
+  131072,                                       // DDCDMABufferSize
+  4096,                                         // DDCDMATransferSize
+  100,                                          // StartupDelay
+  1000,                                         // SocketTimeout
+  100,                                          // StageIdleWait
+  500,                                          // StatusPollPeriod
+  1000,                                         // TXStatusPeriod
+  200000,                                       // RXStatusPeriod
+  100,                                          // EventLoopTimeout
+  1000,                                         // ActivityTimeout
+  VDEFAULTDDCBATCH,                             // DDCSendBatch
+  VDEFAULTDDCLATENCY,                           // DDCTargetLatency
+  1,                                            // DUCCoalesceFrames
+  0,                                            // DUCCoalesceDeadline
+  0,                                            // DUCPrearmFrames
+  0,                                            // DUCPrearmRamp
+  0,                                            // DUCEER
+  0,                                            // DDCGSO
+  0,                                            // DDCXDP
+  0,                                            // BufferHugePages
+  0,                                            // BufferLock
+  0,                                            // VirtualDDCCount
+  0,                                            // VirtualDDCSource
+  0,                                            // WidebandSpectrum
+  0,                                            // DDCCompress
+  12,                                           // DDCCompressBits
+  0,                                            // DDCJumbo
+  0,                                            // DDCVITA49
+  0,                                            // DDCShm
+  VDDCPACEOFF,                                  // DDCPace
+  VDEFAULTDDCPACELEAD,                          // DDCPaceLead
+  0,                                            // RegisterQueue
+  0,                                            // RxTimestamps
+  VDEFAULTSTALLTIMEOUT,                         // StallTimeout
+  0,                                            // StallRestart
+  0,                                            // KeyerRAMWriteCombine
+  0,                                            // CodecBypass
+  0,                                            // TXStreamRing
+  1,                                            // IdlePowerSave
+  0,                                            // DDCLowPriority
+  0,                                            // StageProfile
+  20,                                           // DDCPluginBudget
+  0,                                            // DDCShortRead
+  0,                                            // RegisterProfile
+  0,                                            // KeyWatchPeriod
+  0,                                            // DUCDirectReceive
+  0,                                            // DUCReorderFrames
+  2000,                                         // DUCReorderDeadline
+  0,                                            // DUCConceal
+  0,                                            // DiversityMode
+  0,                                            // DiversityDDC
+  1,                                            // DiversitySecond
+  1000,                                         // DiversityGain
+  0,                                            // DiversityPhase
+  200,                                          // DiversityTimeConstant
+  0,                                            // PSCapture
+  100,                                          // PSCaptureInterval
+  0,                                            // PPSTimestamp
+  0,                                            // ADCOverloadWatchPeriod
+  4,                                            // ADCOverloadIRQ
+  5000,                                         // ATUPollPeriod
+  500,                                          // ATUAckTimeout
+  20000,                                        // ATUMaxTune
+  0,                                            // DDCFEC
+  0,                                            // DDCSplitPairs
+  {
+    {0, 0, 0, 0, 0},                            // control
+    {0, 0, 46, 0, 0},                           // high priority: EF
+    {0, 1048576, 46, 0, 0},                     // DUC: EF, and room for bursts of TX data
+    {1048576, 0, 0, 0, 0}                       // DDC: room for bursts at 1536KHz
+  }
+};
+
+
+//
+// table of settings: name in file / on command line, and allowed range
+//
+struct ConfigSetting
+{
+  char* Name;
+  uint32_t* Value;
+  uint32_t Min;
+  uint32_t Max;
+  bool HotReload;                               // true if it can be changed while running
+  bool Overridden;                              // true if set on the command line
+};
+
+struct ConfigSetting ConfigSettings[] =
+{
+  {"ddc_dma_buffer", &P2Config.DDCDMABufferSize, 131072, 16777216, false, false},
+  {"ddc_dma_size", &P2Config.DDCDMATransferSize, 512, 32768, false, false},
+  {"startup_delay", &P2Config.StartupDelay, 0, 100000, true, false},
+  {"socket_timeout", &P2Config.SocketTimeout, 100, 1000000, true, false},
+  {"stage_idle_wait", &P2Config.StageIdleWait, 10, 100000, true, false},
+  {"status_poll", &P2Config.StatusPollPeriod, 100, 100000, true, false},
+  {"tx_status_period", &P2Config.TXStatusPeriod, 100, 1000000, true, false},
+  {"rx_status_period", &P2Config.RXStatusPeriod, 1000, 10000000, true, false},
+  {"event_loop_timeout", &P2Config.EventLoopTimeout, 10, 10000, true, false},
+  {"activity_timeout", &P2Config.ActivityTimeout, 100, 60000, true, false},
+  {"ddc_batch", &P2Config.DDCSendBatch, 1, VMAXDDCBATCH, true, false},
+  {"ddc_latency", &P2Config.DDCTargetLatency, 0, 1000000, true, false},
+  {"duc_coalesce_frames", &P2Config.DUCCoalesceFrames, 1, 64, true, false},
+  {"duc_coalesce_us", &P2Config.DUCCoalesceDeadline, 0, 100000, true, false},
+  {"duc_prearm_frames", &P2Config.DUCPrearmFrames, 0, VMAXDUCPREARM, true, false},
+  {"duc_prearm_ramp", &P2Config.DUCPrearmRamp, 0, 1, true, false},
+  {"duc_eer", &P2Config.DUCEER, 0, 1, true, false},
+  {"ddc_gso", &P2Config.DDCGSO, 0, 1, true, false},
+  {"ddc_xdp", &P2Config.DDCXDP, 0, 1, true, false},
+  {"buffer_hugepages", &P2Config.BufferHugePages, 0, 1, false, false},
+  {"buffer_mlock", &P2Config.BufferLock, 0, 1, false, false},
+  {"vddc_count", &P2Config.VirtualDDCCount, 0, VMAXVIRTUALDDC, true, false},
+  {"vddc_source", &P2Config.VirtualDDCSource, 0, VNUMDDC - 1, true, false},
+  {"wideband_spectrum", &P2Config.WidebandSpectrum, 0, VMAXSPECTRUMSIZE, true, false},
+  {"ddc_compress", &P2Config.DDCCompress, 0, VDDCCOMPRESSMODES - 1, true, false},
+  {"ddc_compress_bits", &P2Config.DDCCompressBits, VMINBFPBITS, VMAXBFPBITS, true, false},
+  {"ddc_jumbo", &P2Config.DDCJumbo, 0, VMAXDDCJUMBO, true, false},
+  {"ddc_vita49", &P2Config.DDCVITA49, 0, 1, true, false},
+  {"ddc_shm", &P2Config.DDCShm, VDDCSHMOFF, VDDCSHMONLY, false, false},
+  {"ddc_pace", &P2Config.DDCPace, VDDCPACEOFF, VDDCPACEETF, true, false},
+  {"ddc_pace_lead", &P2Config.DDCPaceLead, 0, 100000, true, false},
+  {"register_queue", &P2Config.RegisterQueue, 0, 1, false, false},
+  {"rx_timestamps", &P2Config.RxTimestamps, 0, 1, true, false},
+  {"stall_timeout", &P2Config.StallTimeout, 0, 60000, true, false},
+  {"stall_restart", &P2Config.StallRestart, 0, 1, true, false},
+  {"keyer_ram_write_combine", &P2Config.KeyerRAMWriteCombine, 0, 1, false, false},
+  {"codec_bypass", &P2Config.CodecBypass, 0, 1, false, false},
+  {"tx_stream_ring", &P2Config.TXStreamRing, 0, 1, false, false},
+  {"idle_power_save", &P2Config.IdlePowerSave, 0, 1, true, false},
+  {"ddc_low_priority", &P2Config.DDCLowPriority, 0, (1 << VNUMDDC) - 1, true, false},
+  {"stage_profile", &P2Config.StageProfile, 0, 1, true, false},
+  {"ddc_plugin_budget", &P2Config.DDCPluginBudget, 1, 100, true, false},
+  {"ddc_short_read", &P2Config.DDCShortRead, 0, 1, true, false},
+  {"register_profile", &P2Config.RegisterProfile, 0, 256, true, false},
+  {"key_watch", &P2Config.KeyWatchPeriod, 0, 1000, false, false},
+  {"duc_direct_receive", &P2Config.DUCDirectReceive, 0, 1, true, false},
+  {"duc_reorder_frames", &P2Config.DUCReorderFrames, 0, VDUCREORDERMAX, true, false},
+  {"duc_reorder_us", &P2Config.DUCReorderDeadline, 0, 100000, true, false},
+  {"duc_conceal", &P2Config.DUCConceal, 0, 1, true, false},
+  {"diversity_mode", &P2Config.DiversityMode, 0, 2, true, false},
+  {"diversity_ddc", &P2Config.DiversityDDC, 0, VNUMDDC - 1, true, false},
+  {"diversity_second", &P2Config.DiversitySecond, 0, VNUMDDC - 1, true, false},
+  {"diversity_gain", &P2Config.DiversityGain, 0, 10000, true, false},
+  {"diversity_phase", &P2Config.DiversityPhase, 0, 3599, true, false},
+  {"diversity_tau_ms", &P2Config.DiversityTimeConstant, 1, 10000, true, false},
+  {"ps_capture", &P2Config.PSCapture, 0, VPSCAPTUREMAX, true, false},
+  {"ps_capture_interval", &P2Config.PSCaptureInterval, 0, 10000, true, false},
+  {"pps_timestamp", &P2Config.PPSTimestamp, 0, 1, true, false},
+  {"adc_overload_watch", &P2Config.ADCOverloadWatchPeriod, 0, 100000, false, false},
+  {"adc_overload_irq", &P2Config.ADCOverloadIRQ, 0, 15, false, false},
+  {"atu_poll", &P2Config.ATUPollPeriod, 500, 100000, false, false},
+  {"atu_ack_timeout", &P2Config.ATUAckTimeout, 10, 10000, true, false},
+  {"atu_max_tune", &P2Config.ATUMaxTune, 0, 600000, true, false},
+  {"ddc_fec", &P2Config.DDCFEC, 0, VMAXDDCFECGROUP, true, false},
+  {"ddc_split_pairs", &P2Config.DDCSplitPairs, 0, 1, true, false},
+  {"control_sndbuf", &P2Config.Socket[eSocketControl].SendBuffer, 0, 67108864, true, false},
+  {"control_rcvbuf", &P2Config.Socket[eSocketControl].ReceiveBuffer, 0, 67108864, true, false},
+  {"control_dscp", &P2Config.Socket[eSocketControl].DSCP, 0, 63, true, false},
+  {"control_priority", &P2Config.Socket[eSocketControl].Priority, 0, 7, true, false},
+  {"control_busy_poll", &P2Config.Socket[eSocketControl].BusyPoll, 0, 1000, true, false},
+  {"hipri_sndbuf", &P2Config.Socket[eSocketHighPriority].SendBuffer, 0, 67108864, true, false},
+  {"hipri_rcvbuf", &P2Config.Socket[eSocketHighPriority].ReceiveBuffer, 0, 67108864, true, false},
+  {"hipri_dscp", &P2Config.Socket[eSocketHighPriority].DSCP, 0, 63, true, false},
+  {"hipri_priority", &P2Config.Socket[eSocketHighPriority].Priority, 0, 7, true, false},
+  {"hipri_busy_poll", &P2Config.Socket[eSocketHighPriority].BusyPoll, 0, 1000, true, false},
+  {"duc_sndbuf", &P2Config.Socket[eSocketDUC].SendBuffer, 0, 67108864, true, false},
+  {"duc_rcvbuf", &P2Config.Socket[eSocketDUC].ReceiveBuffer, 0, 67108864, true, false},
+  {"duc_dscp", &P2Config.Socket[eSocketDUC].DSCP, 0, 63, true, false},
+  {"duc_priority", &P2Config.Socket[eSocketDUC].Priority, 0, 7, true, false},
+  {"duc_busy_poll", &P2Config.Socket[eSocketDUC].BusyPoll, 0, 1000, true, false},
+  {"ddc_sndbuf", &P2Config.Socket[eSocketDDC].SendBuffer, 0, 67108864, true, false},
+  {"ddc_rcvbuf", &P2Config.Socket[eSocketDDC].ReceiveBuffer, 0, 67108864, true, false},
+  {"ddc_dscp", &P2Config.Socket[eSocketDDC].DSCP, 0, 63, true, false},
+  {"ddc_priority", &P2Config.Socket[eSocketDDC].Priority, 0, 7, true, false},
+  {"ddc_busy_poll", &P2Config.Socket[eSocketDDC].BusyPoll, 0, 1000, true, false}
+};
+
+#define VNUMCONFIGSETTINGS (sizeof(ConfigSettings) / sizeof(ConfigSettings[0]))
+
+
+//
+// operating profiles: a named set of values for the settings that trade latency
+// against efficiency, across all the stream threads. A profile is a base: settings
+// in the config file, and command line overrides, take priority over it.
+// wake strategy is set by the idle waits and busy polling; the DDC sender threads
+// (-t) and FIFO interrupt events (-e) stay command line options.
+//
+#define VMAXPROFILEVALUES 24
+
+struct ConfigProfileValue
+{
+  char* Name;                                   // setting name; NULL ends the list
+  uint32_t Value;
+};
+
+struct ConfigProfile
+{
+  char* Name;
+  char* Description;
+  struct ConfigProfileValue Values[VMAXPROFILEVALUES];
+};
+
+struct ConfigProfile ConfigProfiles[] =
+{
+  {"default", "the built in settings", {{NULL, 0}}},
+  {"lowlatency", "contest/QSK: small DMAs and batches, short waits, busy polling",
+    {
+      {"ddc_dma_size", 1024},
+      {"ddc_latency", 500},
+      {"ddc_batch", 4},
+      {"stage_idle_wait", 20},
+      {"status_poll", 200},
+      {"tx_status_period", 1000},
+      {"rx_status_period", 50000},
+      {"duc_coalesce_frames", 1},
+      {"duc_coalesce_us", 0},
+      {"duc_prearm_frames", 2},
+      {"duc_prearm_ramp", 1},
+      {"ddc_gso", 0},
+      {"ddc_pace", VDDCPACEOFF},
+      {"ddc_busy_poll", 50},
+      {"duc_busy_poll", 50},
+      {"hipri_busy_poll", 50},
+      {"activity_timeout", 250},
+      {NULL, 0}
+    }
+  },
+  {"throughput", "skimmer: large DMAs and batches, GSO, long waits",
+    {
+      {"ddc_dma_buffer", 1048576},
+      {"ddc_dma_size", 32768},
+      {"ddc_latency", 8000},
+      {"ddc_batch", VMAXDDCBATCH},
+      {"stage_idle_wait", 1000},
+      {"duc_coalesce_frames", 8},
+      {"duc_coalesce_us", 4000},
+      {"ddc_gso", 1},
+      {"ddc_pace", VDDCPACEOFF},
+      {"ddc_sndbuf", 4194304},
+      {"ddc_busy_poll", 0},
+      {"duc_busy_poll", 0},
+      {"hipri_busy_poll", 0},
+      {NULL, 0}
+    }
+  },
+  {"wan", "remote: paced DDC packets, DUC jitter tolerance, slower status",
+    {
+      {"ddc_latency", 4000},
+      {"ddc_batch", 16},
+      {"ddc_gso", 0},
+      {"ddc_pace", VDDCPACEFQ},
+      {"ddc_pace_lead", 500},
+      {"ddc_sndbuf", 2097152},
+      {"duc_coalesce_frames", 4},
+      {"duc_coalesce_us", 4000},
+      {"duc_reorder_frames", 4},
+      {"duc_reorder_us", 3000},
+      {"duc_rcvbuf", 2097152},
+      {"tx_status_period", 2000},
+      {"rx_status_period", 200000},
+      {"activity_timeout", 5000},
+      {"stage_idle_wait", 200},
+      {"ddc_busy_poll", 0},
+      {"duc_busy_poll", 0},
+      {"hipri_busy_poll", 0},
+      {NULL, 0}
+    }
+  }
+};
+
+#define VNUMCONFIGPROFILES (sizeof(ConfigProfiles) / sizeof(ConfigProfiles[0]))
+
+char* ConfigFilename = NULL;                    // config file, if one was given
+volatile sig_atomic_t ConfigReloadRequested = 0;
+int ConfigProfileIndex = -1;                    // profile in use; -1 if none
+bool ConfigProfileOverridden = false;           // true if the profile was set on the command line
+bool ConfigFilePresent[VNUMCONFIGSETTINGS];     // settings given in the config file, when last read
+
+
+//
+// find a setting by name; return NULL if not found
+//
+static struct ConfigSetting* FindConfigSetting(char* Name)
+{
+  uint32_t Cntr;
+
+  for (Cntr = 0; Cntr < VNUMCONFIGSETTINGS; Cntr++)
+    if (strcmp(ConfigSettings[Cntr].Name, Name) == 0)
+      return ConfigSettings + Cntr;
+  return NULL;
+}
+
+
+//
+// check a value is in range for a setting
+// return true if error
+//
+static bool CheckConfigValue(struct ConfigSetting* Setting, char* Text, uint32_t* Value)
+{
+  char* End;
+  unsigned long Parsed;
+
+  Parsed = strtoul(Text, &End, 0);
+  if ((End == Text) || (*End != 0) || (Parsed < Setting->Min) || (Parsed > Setting->Max))
+  {
+    printf("setting %s = %s: must be a number %u...%u\n", Setting->Name, Text, Setting->Min, Setting->Max);
+    return true;
+  }
+  *Value = (uint32_t)Parsed;
+  return false;
+}
+
+
+//
+// find a profile by name; return -1 if not found
+//
+static int FindConfigProfile(char* Name)
+{
+  uint32_t Cntr;
+
+  for (Cntr = 0; Cntr < VNUMCONFIGPROFILES; Cntr++)
+    if (strcmp(ConfigProfiles[Cntr].Name, Name) == 0)
+      return (int)Cntr;
+  printf("unknown profile %s: must be one of", Name);
+  for (Cntr = 0; Cntr < VNUMCONFIGPROFILES; Cntr++)
+    printf(" %s", ConfigProfiles[Cntr].Name);
+  printf("\n");
+  return -1;
+}
+
+
+//
+// put a profile's values into Values, with Present set for each, skipping
+// any setting already Present. The profile table is checked when first used.
+//
+static void GetConfigProfileValues(int Profile, uint32_t* Values, bool* Present)
+{
+  struct ConfigProfileValue* Entry;
+  struct ConfigSetting* Setting;
+  uint32_t Index;
+
+  if (Profile < 0)
+    return;
+  for (Entry = ConfigProfiles[Profile].Values; Entry->Name != NULL; Entry++)
+  {
+    Setting = FindConfigSetting(Entry->Name);
+    if ((Setting == NULL) || (Entry->Value < Setting->Min) || (Entry->Value > Setting->Max))
+    {
+      printf("profile %s: bad entry %s\n", ConfigProfiles[Profile].Name, Entry->Name);
+      continue;
+    }
+    Index = Setting - ConfigSettings;
+    if (!Present[Index])
+    {
+      Values[Index] = Entry->Value;
+      Present[Index] = true;
+    }
+  }
+}
+
+
+//
+// read the config file into Values, with Present set for each setting found, and
+// the profile it names (-1 if none) into Profile.
+// nothing is applied, so a file with an error leaves all settings as they were.
+// return true if error
+//
+static bool ReadConfigFile(uint32_t* Values, bool* Present, int* Profile)
+{
+  FILE* File;
+  char Line[128];
+  char Name[32];
+  char Text[32];
+  char Extra[2];
+  struct ConfigSetting* Setting;
+  int LineNumber = 0;
+  bool Error = false;
+
+  memset(Present, 0, VNUMCONFIGSETTINGS * sizeof(bool));
+  *Profile = -1;
+  File = fopen(ConfigFilename, "r");
+  if (File == NULL)
+  {
+    printf("could not open config file %s\n", ConfigFilename);
+    return true;
+  }
+  while (fgets(Line, sizeof(Line), File) != NULL)
+  {
+    LineNumber++;
+    if (strchr(Line, '#') != NULL)
+      *strchr(Line, '#') = 0;                               // strip comment
+    if (sscanf(Line, "%31s", Name) != 1)
+      continue;                                             // blank line
+    if (strcmp(Name, "profile") == 0)
+    {
+      if ((sscanf(Line, "%*s %31s %1s", Text, Extra) != 1) || ((*Profile = FindConfigProfile(Text)) < 0))
+      {
+        printf("%s line %d: not understood\n", ConfigFilename, LineNumber);
+        Error = true;
+      }
+      continue;
+    }
+    Setting = FindConfigSetting(Name);
+    if ((Setting == NULL) || (sscanf(Line, "%*s %31s %1s", Text, Extra) != 1))
+    {
+      printf("%s line %d: not understood\n", ConfigFilename, LineNumber);
+      Error = true;
+    }
+    else if (CheckConfigValue(Setting, Text, Values + (Setting - ConfigSettings)))
+      Error = true;
+    else
+      Present[Setting - ConfigSettings] = true;
+  }
+  fclose(File);
+  return Error;
+}
+
+
+//
+// set and read the config file
+//
+bool SetConfigFile(char* Filename)
+{
+  uint32_t Values[VNUMCONFIGSETTINGS];
+  bool Present[VNUMCONFIGSETTINGS];
+  uint32_t Cntr;
+  int Profile;
+
+  ConfigFilename = Filename;
+  if (ReadConfigFile(Values, Present, &Profile))
+    return true;
+  memcpy(ConfigFilePresent, Present, sizeof(ConfigFilePresent));
+  if ((Profile >= 0) && !ConfigProfileOverridden)
+  {
+    ConfigProfileIndex = Profile;
+    printf("profile %s: %s\n", ConfigProfiles[Profile].Name, ConfigProfiles[Profile].Description);
+  }
+  GetConfigProfileValues(ConfigProfileIndex, Values, Present);        // the file's own values come first
+  for (Cntr = 0; Cntr < VNUMCONFIGSETTINGS; Cntr++)
+    if (Present[Cntr] && !ConfigSettings[Cntr].Overridden)
+      *ConfigSettings[Cntr].Value = Values[Cntr];
+  printf("settings read from %s\n", Filename);
+  return false;
+}
+
+
+//
+// set one setting from the command line, "name=value"
+//
+bool SetConfigOverride(char* Setting)
+{
+  char Name[32];
+  char Text[32];
+  struct ConfigSetting* Found;
+
+  if ((sscanf(Setting, "%31[^=]=%31s", Name, Text) == 2) && (strcmp(Name, "profile") == 0))
+    return SetConfigProfile(Text);
+  if ((sscanf(Setting, "%31[^=]=%31s", Name, Text) != 2) || ((Found = FindConfigSetting(Name)) == NULL))
+  {
+    printf("error parsing setting %s: must be name=value\n", Setting);
+    PrintConfigHelp();
+    return true;
+  }
+  if (CheckConfigValue(Found, Text, Found->Value))
+    return true;
+  Found->Overridden = true;
+  return false;
+}
+
+
+//
+// choose a profile on the command line: its values are set except where
+// the config file or a command line override gives one
+//
+bool SetConfigProfile(char* Name)
+{
+  uint32_t Values[VNUMCONFIGSETTINGS];
+  bool Present[VNUMCONFIGSETTINGS];
+  uint32_t Cntr;
+  int Profile;
+
+  Profile = FindConfigProfile(Name);
+  if (Profile < 0)
+    return true;
+  ConfigProfileIndex = Profile;
+  ConfigProfileOverridden = true;
+  memcpy(Present, ConfigFilePresent, sizeof(Present));
+  GetConfigProfileValues(Profile, Values, Present);
+  for (Cntr = 0; Cntr < VNUMCONFIGSETTINGS; Cntr++)
+    if (Present[Cntr] && !ConfigFilePresent[Cntr] && !ConfigSettings[Cntr].Overridden)
+      *ConfigSettings[Cntr].Value = Values[Cntr];
+  printf("profile %s: %s\n", ConfigProfiles[Profile].Name, ConfigProfiles[Profile].Description);
+  return false;
+}
+
+
+//
+// set one setting by name as a command line override, clipped to its range
+//
+bool SetConfigValue(char* Name, uint32_t Value)
+{
+  struct ConfigSetting* Found;
+
+  Found = FindConfigSetting(Name);
+  if (Found == NULL)
+  {
+    printf("unknown setting %s\n", Name);
+    return true;
+  }
+  if (Value < Found->Min)
+    Value = Found->Min;
+  else if (Value > Found->Max)
+    Value = Found->Max;
+  *Found->Value = Value;
+  Found->Overridden = true;
+  return false;
+}
+
+
+//
+// pass on the settings held by other modules
+//
+void ApplyConfig(void)
+{
+  SetDDCSendBatchSize(P2Config.DDCSendBatch);
+  SetDDCTargetLatency(P2Config.DDCTargetLatency);
+  SetDUCCoalescing(P2Config.DUCCoalesceFrames, P2Config.DUCCoalesceDeadline);
+  SetDUCPrearm(P2Config.DUCPrearmFrames, P2Config.DUCPrearmRamp != 0);
+  SetTXAmplitudeEER(P2Config.DUCEER != 0);
+  if (SetRegisterProfiling(P2Config.RegisterProfile != 0))
+    printf("register profiling: no memory for its tables\n");
+}
+
+
+//
+// ask for a reload. Called from the SIGHUP handler, so it only sets a flag
+//
+void RequestConfigReload(void)
+{
+  ConfigReloadRequested = 1;
+}
+
+
+//
+// set a socket buffer size. SO_xxxBUFFORCE can exceed the net.core limits
+// but needs CAP_NET_ADMIN; if it is refused the limited option is used.
+//
+static void SetSocketBuffer(struct ThreadSocketData* Ptr, int ForceOption, int Option, uint32_t Size, char* Name)
+{
+  int Value = (int)Size;
+  socklen_t Length = sizeof(Value);
+
+  if ((setsockopt(Ptr->Socketid, SOL_SOCKET, ForceOption, (void *)&Value, sizeof(Value)) < 0) &&
+      (setsockopt(Ptr->Socketid, SOL_SOCKET, Option, (void *)&Value, sizeof(Value)) < 0))
+    printf("%s socket: %s buffer %u not set: %s\n", Ptr->Nameid, Name, Size, strerror(errno));
+  else if (UseDebug && (getsockopt(Ptr->Socketid, SOL_SOCKET, Option, (void *)&Value, &Length) == 0))
+    printf("%s socket: %s buffer %u requested, %d allocated\n", Ptr->Nameid, Name, Size, Value);
+}
+
+
+//
+// set the receive timeout and class socket options on a socket
+// the kernel reports twice the requested buffer size, for its own overhead
+//
+void ApplySocketOptions(struct ThreadSocketData* Ptr)
+{
+  struct SocketClassConfig* Options = P2Config.Socket + Ptr->Class;
+  struct timeval ReadTimeout;
+  int Value;
+
+  ReadTimeout.tv_sec = P2Config.SocketTimeout / 1000000;
+  ReadTimeout.tv_usec = P2Config.SocketTimeout % 1000000;
+  setsockopt(Ptr->Socketid, SOL_SOCKET, SO_RCVTIMEO, (void *)&ReadTimeout, sizeof(ReadTimeout));
+  if (Options->SendBuffer != 0)
+    SetSocketBuffer(Ptr, SO_SNDBUFFORCE, SO_SNDBUF, Options->SendBuffer, "send");
+  if (Options->ReceiveBuffer != 0)
+    SetSocketBuffer(Ptr, SO_RCVBUFFORCE, SO_RCVBUF, Options->ReceiveBuffer, "receive");
+
+  Value = Options->DSCP << 2;                               // DSCP is the top 6 bits of TOS
+  if (setsockopt(Ptr->Socketid, IPPROTO_IP, IP_TOS, (void *)&Value, sizeof(Value)) < 0)
+    printf("%s socket: DSCP %u not set: %s\n", Ptr->Nameid, Options->DSCP, strerror(errno));
+  //
+  // setting TOS also sets the priority from it, so an explicit priority goes after it
+  //
+  Value = Options->Priority;
+  if ((Value != 0) && (setsockopt(Ptr->Socketid, SOL_SOCKET, SO_PRIORITY, (void *)&Value, sizeof(Value)) < 0))
+    printf("%s socket: priority %u not set: %s\n", Ptr->Nameid, Options->Priority, strerror(errno));
+  Value = Options->BusyPoll;
+  if ((Value != 0) && (setsockopt(Ptr->Socketid, SOL_SOCKET, SO_BUSY_POLL, (void *)&Value, sizeof(Value)) < 0))
+    printf("%s socket: busy poll %uus not set: %s\n", Ptr->Nameid, Options->BusyPoll, strerror(errno));
+  //
+  // receive stamps on the incoming sockets whose delays are measured
+  //
+  if ((Ptr == SocketData + VPORTHIGHPRIORITYTOSDR) || (Ptr == SocketData + VPORTDUCIQ))
+    SetReceiveTimestamps(Ptr->Socketid, Ptr->Nameid, P2Config.RxTimestamps != 0);
+}
+
+
+//
+// read the config file again, if requested, and apply what can change while running
+//
+void ReloadConfigFile(void)
+{
+  uint32_t Values[VNUMCONFIGSETTINGS];
+  bool Present[VNUMCONFIGSETTINGS];
+  struct ConfigSetting* Setting;
+  uint32_t Cntr;
+  int Profile;
+
+  if (!ConfigReloadRequested)
+    return;
+  ConfigReloadRequested = 0;
+  if (ConfigFilename == NULL)
+  {
+    printf("SIGHUP: no config file to reload\n");
+    return;
+  }
+  if (ReadConfigFile(Values, Present, &Profile))
+  {
+    printf("config file %s not reloaded; settings unchanged\n", ConfigFilename);
+    return;
+  }
+  Trace(eTraceConfigReload, 0, 0);
+  memcpy(ConfigFilePresent, Present, sizeof(ConfigFilePresent));
+  if (ConfigProfileOverridden && (Profile >= 0) && (Profile != ConfigProfileIndex))
+    printf("config: profile set on the command line; file profile ignored\n");
+  else if (!ConfigProfileOverridden && (Profile != ConfigProfileIndex))
+  {
+    printf("config: profile changed to %s\n", (Profile < 0) ? "none (settings left as they are)" : ConfigProfiles[Profile].Name);
+    ConfigProfileIndex = Profile;
+  }
+  GetConfigProfileValues(ConfigProfileIndex, Values, Present);
+  for (Cntr = 0; Cntr < VNUMCONFIGSETTINGS; Cntr++)
+  {
+    Setting = ConfigSettings + Cntr;
+    if (!Present[Cntr] || (Values[Cntr] == *Setting->Value))
+      continue;
+    if (Setting->Overridden)
+      printf("config: %s set on the command line; file value ignored\n", Setting->Name);
+    else if (!Setting->HotReload)
+      printf("config: %s needs a restart; left at %u\n", Setting->Name, *Setting->Value);
+    else
+    {
+      printf("config: %s changed from %u to %u\n", Setting->Name, *Setting->Value, Values[Cntr]);
+      *Setting->Value = Values[Cntr];
+    }
+  }
+  ApplyConfig();
+  //
+  // socket options are set again on every open socket
+  // a socket shared by two threads is set twice, which is harmless: both have the same class
+  //
+  for (Cntr = 0; Cntr < VPORTTABLESIZE; Cntr++)
+    if (SocketData[Cntr].Socketid > 0)
+      ApplySocketOptions(SocketData + Cntr);
+  printf("settings reloaded from %s\n", ConfigFilename);
+}
+
+
+//
+// print the settings
+//
+void PrintConfigHelp(void)
+{
+  uint32_t Cntr;
+  struct ConfigSetting* Setting;
+
+  printf("settings (config file \"name value\", or -o name=value):\n");
+  for (Cntr = 0; Cntr < VNUMCONFIGSETTINGS; Cntr++)
+  {
+    Setting = ConfigSettings + Cntr;
+    printf("  %-20s %9u  (%u...%u%s)\n", Setting->Name, *Setting->Value,
+           Setting->Min, Setting->Max, Setting->HotReload ? "" : ", restart needed");
+  }
+  printf("profiles (-P name, config file \"profile name\", or -o profile=name):\n");
+  for (Cntr = 0; Cntr < VNUMCONFIGPROFILES; Cntr++)
+    printf("  %-20s %s%s\n", ConfigProfiles[Cntr].Name, ConfigProfiles[Cntr].Description,
+           ((int)Cntr == ConfigProfileIndex) ? " (in use)" : "");
+}
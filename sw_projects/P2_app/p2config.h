@@ -0,0 +1,192 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p2config.h:
+//
+// header: runtime tunable settings for p2app, from a config file and the command line
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __p2config_h
+#define __p2config_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "threaddata.h"
+
+
+//
+// socket options for one socket class. 0 = leave the system default.
+// buffer sizes above the net.core limits need CAP_NET_ADMIN.
+//
+struct SocketClassConfig
+{
+  uint32_t SendBuffer;                          // SO_SNDBUF bytes
+  uint32_t ReceiveBuffer;                       // SO_RCVBUF bytes
+  uint32_t DSCP;                                // IP DSCP code point (46 = EF)
+  uint32_t Priority;                            // SO_PRIORITY
+  uint32_t BusyPoll;                            // SO_BUSY_POLL us
+};
+
+
+//
+// the settings. Written by the main thread only; every other thread just reads them.
+// each is a single aligned 32 bit word, so a reader sees either the old or new value.
+// the defaults are the values that used to be compiled in.
+//
+struct P2Config
+{
+  uint32_t DDCDMABufferSize;                    // DDC DMA ring bytes (restart needed)
+  uint32_t DDCDMATransferSize;                  // DDC DMA bytes before a latency target applies (restart needed)
+  uint32_t StartupDelay;                        // DMAs or messages before under/overflows are reported
+  uint32_t SocketTimeout;                       // us receive timeout on each socket
+  uint32_t StageIdleWait;                       // us a DDC pipeline stage sleeps when it has no work
+  uint32_t StatusPollPeriod;                    // us between PTT/key input checks
+  uint32_t TXStatusPeriod;                      // us between high priority packets when in TX
+  uint32_t RXStatusPeriod;                      // us between high priority packets when not in TX
+  uint32_t EventLoopTimeout;                    // ms between exit checks when no packets arrive
+  uint32_t ActivityTimeout;                     // ms without a message before reverting to inactive
+  uint32_t DDCSendBatch;                        // DDC packets per sendmmsg() call
+  uint32_t DDCTargetLatency;                    // us of DDC data to collect before a DMA
+  uint32_t DUCCoalesceFrames;                   // DUC frames held for one DMA
+  uint32_t DUCCoalesceDeadline;                 // us a DUC frame may be held
+  uint32_t DUCPrearmFrames;                     // zero frames in the TX FIFO on MOX; 0 = none
+  uint32_t DUCPrearmRamp;                       // 1 to ramp up the first TX frame after pre-arm
+  uint32_t DUCEER;                              // 1 to make EER envelope samples in the DUC stream
+  uint32_t DDCGSO;                              // 1 to send DDC packets by UDP GSO
+  uint32_t DDCXDP;                              // 1 to send DDC packets by AF_XDP on eth0
+  uint32_t BufferHugePages;                     // 1 to make the stream buffers from huge pages (restart needed)
+  uint32_t BufferLock;                          // 1 to mlock the stream buffers (restart needed)
+  uint32_t VirtualDDCCount;                     // virtual DDCs channelized from one DDC; 0 = none
+  uint32_t VirtualDDCSource;                    // DDC the virtual DDCs are made from
+  uint32_t WidebandSpectrum;                    // FFT size for wideband spectrum frames; 0 = raw samples
+  uint32_t DDCCompress;                         // DDC payload compression: 0 none, 1 lossless, 2 block floating point
+  uint32_t DDCCompressBits;                     // mantissa bits for block floating point compression
+  uint32_t DDCJumbo;                            // DDC packets of this many times the standard samples, if the path MTU allows; 0 or 1 = standard
+  uint32_t DDCVITA49;                           // 1 to send VITA-49 DDC packets even if the client hasn't asked for them
+  uint32_t DDCShm;                              // local shared memory DDC clients: 0 no, 1 as well as UDP, 2 instead (restart needed)
+  uint32_t DDCPace;                             // DDC packet departure times: 0 none, 1 for fq, 2 for etf
+  uint32_t DDCPaceLead;                         // us from making a paced packet to its earliest departure
+  uint32_t RegisterQueue;                       // 1 to commit register transactions through the owner thread (restart needed)
+  uint32_t RxTimestamps;                        // 1 to measure receive delays of high priority and DUC I/Q packets
+  uint32_t StallTimeout;                        // ms without a heartbeat before a thread is reported stalled; 0 = off
+  uint32_t StallRestart;                        // 1 to restart the DDC engine when one of its threads stalls
+  uint32_t KeyerRAMWriteCombine;                // 1 to write the CW keyer RAM through a write-combined map (restart needed)
+  uint32_t CodecBypass;                         // 1 to move mic and speaker samples through the DMA bypass BAR (restart needed)
+  uint32_t TXStreamRing;                        // 1 to write DUC and speaker samples through driver H2C streaming rings (restart needed)
+  uint32_t IdlePowerSave;                       // 1 to disable the DDCs and slow periodic wakeups while no client is connected
+  uint32_t DDCLowPriority;                      // bit n set: DDC n is shed first when the DDC engine is overloaded
+  uint32_t StageProfile;                        // 1 to count CPU cycles and instructions in the DDC and DUC pipeline stages
+  uint32_t DDCPluginBudget;                     // % of real time each DDC plugin may use before it is bypassed
+  uint32_t DDCShortRead;                        // 1 to read the DDC FIFO depth and its data in one driver call
+  uint32_t RegisterProfile;                     // rows of register access profile to report on SIGUSR1 and exit; 0 = off
+  uint32_t KeyWatchPeriod;                      // us between key watch thread polls of the PTT and key inputs; 0 = off
+  uint32_t DUCDirectReceive;                    // 1 to receive DUC I/Q samples straight into the DMA buffer
+  uint32_t DUCReorderFrames;                    // DUC I/Q reorder window, frames; 0 = frames written as they arrive
+  uint32_t DUCReorderDeadline;                  // us a frame is held waiting for missing ones before them
+  uint32_t DUCConceal;                          // missing DUC I/Q frames: 0 = zeros, 1 = repeat the frame before
+  uint32_t DiversityMode;                       // combine two DDCs: 0 = off, 1 = fixed weight, 2 = adaptive
+  uint32_t DiversityDDC;                        // diversity primary DDC: carries the combined stream
+  uint32_t DiversitySecond;                     // diversity secondary DDC: combined in, not sent
+  uint32_t DiversityGain;                       // fixed secondary gain, thousandths
+  uint32_t DiversityPhase;                      // fixed secondary phase, tenths of a degree
+  uint32_t DiversityTimeConstant;               // ms the adaptive weight is averaged over
+  uint32_t PSCapture;                           // PureSignal capture: sample pairs per block; 0 = pair streamed as normal
+  uint32_t PSCaptureInterval;                   // ms from the start of one PureSignal capture block to the next
+  uint32_t PPSTimestamp;                        // 1 = P2 DDC header timestamp is PPS UTC second << 32 | samples into it
+  uint32_t ADCOverloadWatchPeriod;              // us between overload watch thread reads of the ADC overflow register; 0 = off
+  uint32_t ADCOverloadIRQ;                      // XDMA user interrupt the overload watch waits on
+  uint32_t ATUPollPeriod;                       // us between LDG ATU thread reads of the ATU input
+  uint32_t ATUAckTimeout;                       // ms to wait for the client to confirm a TUNE change
+  uint32_t ATUMaxTune;                          // ms of TUNE power before it is released; 0 = no limit
+  uint32_t DDCFEC;                              // DDC packets per FEC parity packet, for clients through ddcproxy; 0 = off
+  uint32_t DDCSplitPairs;                       // 1 = send each DDC of an interleaved pair on its own stream
+  struct SocketClassConfig Socket[VNUMSOCKETCLASSES];  // socket options by class
+};
+
+extern struct P2Config P2Config;
+
+
+//
+// SetConfigFile(char* Filename)
+// set and read the config file. It is read again by ReloadConfigFile().
+// one setting per line, "name value"; # starts a comment.
+// a line "profile <name>" chooses an operating profile, which the file's settings refine.
+// return true if error
+//
+bool SetConfigFile(char* Filename);
+
+
+//
+// SetConfigOverride(char* Setting)
+// set one setting from the command line, "name=value".
+// an override takes priority over the config file, including when it is reloaded.
+// return true if error
+//
+bool SetConfigOverride(char* Setting);
+
+
+//
+// SetConfigProfile(char* Name)
+// choose an operating profile on the command line: "default", "lowlatency",
+// "throughput" or "wan". It sets its values for the settings the config file and
+// command line overrides don't give, and a profile in the config file is ignored.
+// return true if error
+//
+bool SetConfigProfile(char* Name);
+
+
+//
+// SetConfigValue(char* Name, uint32_t Value)
+// set one setting by name as a command line override, clipped to its range
+// return true if error
+//
+bool SetConfigValue(char* Name, uint32_t Value);
+
+
+//
+// ApplySocketOptions(struct ThreadSocketData* Ptr)
+// set the receive timeout and the socket options of its class on a thread's socket
+//
+void ApplySocketOptions(struct ThreadSocketData* Ptr);
+
+
+//
+// ApplyConfig(void)
+// pass the settings that are held by other modules on to them.
+// call after the settings have been read or changed.
+//
+void ApplyConfig(void);
+
+
+//
+// RequestConfigReload(void)
+// signal safe: ask for the config file to be read again (on SIGHUP)
+//
+void RequestConfigReload(void);
+
+
+//
+// ReloadConfigFile(void)
+// if a reload has been requested, read the config file again and apply the settings
+// that can change while running. Called by the main thread.
+// settings that need a restart are reported and left unchanged.
+//
+void ReloadConfigFile(void);
+
+
+//
+// PrintConfigHelp(void)
+// print the setting names, with their current values and ranges
+//
+void PrintConfigHelp(void);
+
+
+#endif
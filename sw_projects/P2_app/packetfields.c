@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// packetfields.c:
+//
+// table driven decoding of protocol 2 control packets
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "packetfields.h"
+
+
+static _Atomic uint32_t PacketFieldGeneration = 0;      // incremented to invalidate all caches
+
+
+//
+// decode a 1, 2 or 4 byte field; wider fields give 0
+//
+static uint32_t FieldValue(const struct PacketField* Field, const uint8_t* Data)
+{
+    bool BigEndian = (Field->Flags & VFIELDBIGENDIAN) != 0;
+
+    switch (Field->Width)
+    {
+        case 1:
+            return Data[0];
+        case 2:
+            return BigEndian ? ((uint32_t)Data[0] << 8) | Data[1] : ((uint32_t)Data[1] << 8) | Data[0];
+        case 4:
+            return BigEndian ? ((uint32_t)Data[0] << 24) | ((uint32_t)Data[1] << 16) | ((uint32_t)Data[2] << 8) | Data[3]
+                             : ((uint32_t)Data[3] << 24) | ((uint32_t)Data[2] << 16) | ((uint32_t)Data[1] << 8) | Data[0];
+        default:
+            return 0;
+    }
+}
+
+
+//
+// call the setters of the changed fields, then keep the packet
+//
+uint32_t DecodePacketFields(const struct PacketField* Fields, uint32_t Count, const uint8_t* Packet, uint32_t Length, struct PacketFieldCache* Cache)
+{
+    const struct PacketField* Field;
+    uint32_t Generation;
+    uint32_t Called = 0;
+    uint32_t Cntr;
+    bool All;
+
+    if (Length > VMAXFIELDPACKET)
+        Length = VMAXFIELDPACKET;
+    Generation = atomic_load_explicit(&PacketFieldGeneration, memory_order_acquire);
+    All = !Cache->Valid || (Cache->Generation != Generation);
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Field = Fields + Cntr;
+        if ((Field->Offset + Field->Width) > Length)
+            continue;
+        if (All || (Field->Flags & VFIELDALWAYS)
+                || (memcmp(Packet + Field->Offset, Cache->Last + Field->Offset, Field->Width) != 0))
+        {
+            Field->Setter(Field->Index, FieldValue(Field, Packet + Field->Offset), Packet);
+            Called++;
+        }
+    }
+    memcpy(Cache->Last, Packet, Length);
+    Cache->Generation = Generation;
+    Cache->Valid = true;
+    return Called;
+}
+
+
+//
+// make every cache out of date
+//
+void InvalidatePacketFields(void)
+{
+    atomic_fetch_add_explicit(&PacketFieldGeneration, 1, memory_order_release);
+}
@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// packetfields.h:
+//
+// header: table driven decoding of protocol 2 control packets
+//
+// each control packet handler describes its packet as a table of fields: the
+// offset and width of each, its byte order, and the setter that takes it.
+// the last packet of each type is kept, and a new packet is compared with it
+// field by field: only the setters of fields that have changed are called, so
+// a client repeating the same high priority packet at 1KHz causes no register
+// traffic. Everything is decoded again after InvalidatePacketFields(), when
+// the app's state has been changed by something other than the packets.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __packetfields_h
+#define __packetfields_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VMAXFIELDPACKET 1444                    // largest control packet, bytes
+
+#define VFIELDBIGENDIAN 1                       // flags: 2 or 4 byte value is big endian (network order)
+#define VFIELDALWAYS 2                          // call the setter for every packet, changed or not
+
+
+//
+// one field. Width bytes from Offset are compared with the last packet;
+// a 1, 2 or 4 byte field is decoded into Value, in the byte order given.
+// a wider field (eg several words that are used together) passes Value 0:
+// its setter reads the packet itself.
+//
+struct PacketField
+{
+    uint16_t Offset;                            // first byte in the packet
+    uint16_t Width;                             // bytes
+    uint8_t Flags;
+    uint32_t Index;                             // passed to the setter, eg a DDC number
+    void (*Setter)(uint32_t Index, uint32_t Value, const uint8_t* Packet);
+};
+
+
+//
+// the last packet of one type
+//
+struct PacketFieldCache
+{
+    uint32_t Generation;                        // InvalidatePacketFields() count when Last was kept
+    bool Valid;                                 // true once a packet has been kept
+    uint8_t Last[VMAXFIELDPACKET];
+};
+
+
+//
+// DecodePacketFields(const struct PacketField* Fields, uint32_t Count, const uint8_t* Packet, uint32_t Length, struct PacketFieldCache* Cache)
+// call the setter of each field of Packet that differs from the last packet in
+// Cache (all of them if there is no valid last packet), in table order.
+// then keep Packet in Cache. Returns the number of setters called.
+//
+uint32_t DecodePacketFields(const struct PacketField* Fields, uint32_t Count, const uint8_t* Packet, uint32_t Length, struct PacketFieldCache* Cache);
+
+
+//
+// InvalidatePacketFields(void)
+// forget every kept packet, so the next packet of each type is decoded in full.
+// call when the state the packets set has been changed another way (eg the SDR
+// being set inactive). Can be called from any thread.
+//
+void InvalidatePacketFields(void);
+
+
+#endif
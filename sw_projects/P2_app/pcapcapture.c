@@ -0,0 +1,520 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// pcapcapture.c:
+//
+// capture protocol 2 packets to a pcapng file, from inside p2app
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include "pcapcapture.h"
+#include "threaddata.h"
+#include "threadplacement.h"
+
+
+#define VCAPTURESLOTS 1024                          // packets the ring holds (power of 2)
+#define VCAPTURESNAPLEN 1472                        // UDP payload bytes kept: a 1500 byte MTU's worth
+#define VCAPTUREWINDOW 100000000ULL                 // ns: rate limit window
+#define VCAPTUREIDLEWAIT 2000                       // us the writer sleeps when the ring is empty
+#define VCAPTUREFLUSHTIME 500000000ULL              // ns between file flushes while packets arrive
+#define VCAPTURENICE 10                             // writer thread nice value
+
+#define VPCAPNGSHB 0x0A0D0D0A                       // pcapng block types
+#define VPCAPNGIDB 0x00000001
+#define VPCAPNGEPB 0x00000006
+#define VLINKTYPEIPV4 228                           // raw IPv4 packets
+#define VIPUDPHEADERS 28                            // IPv4 + UDP header bytes
+
+
+//
+// one captured packet. Sequence says whose turn the slot is (the free running
+// ring position it is next written or read at), as a bounded multi producer queue.
+//
+struct CaptureSlot
+{
+  _Atomic uint64_t Sequence;
+  uint64_t Time;                                    // ns since the epoch
+  uint32_t RemoteAddr;                              // network order
+  uint16_t RemotePort;                              // network order
+  uint16_t LocalPort;                               // host order
+  uint16_t Length;                                  // bytes kept
+  uint16_t OriginalLength;                          // bytes in the packet
+  uint8_t Stream;
+  bool Outgoing;
+  uint8_t Data[VCAPTURESNAPLEN];
+};
+
+
+static char* CaptureStreamNames[VNUMCAPTURESTREAMS] =
+{
+  "command", "ddcspecific", "ducspecific", "highpri", "speaker", "duc", "status", "mic", "ddc", "wideband"
+};
+
+
+_Atomic uint32_t CaptureMask;                       // streams captured while the writer runs
+static uint32_t CaptureStreams;                     // streams chosen by the setting
+static char* CaptureFilename = NULL;
+static uint32_t CaptureWindowLimit;                 // packets per rate limit window; 0 = no limit
+static struct CaptureSlot* CaptureSlots = NULL;
+static _Atomic uint64_t CaptureHead;                // next ring position to write
+static uint64_t CaptureTail;                        // next ring position to read (writer thread only)
+static _Atomic uint64_t CaptureWindowStart;         // rate limit window being counted
+static _Atomic uint32_t CaptureWindowCount;
+static _Atomic uint64_t CapturedPackets;
+static _Atomic uint64_t RateLimitedPackets;
+static _Atomic uint64_t RingFullPackets;
+static FILE* CaptureFile = NULL;
+static uint32_t CaptureLocalAddr;                   // network order
+static bool CaptureRun = false;
+static pthread_t CaptureThreadId;
+
+
+//
+// parse "file[,streams[,pps]]"
+//
+bool SetPacketCapture(char* Setting)
+{
+  char* Copy = strdup(Setting);
+  char* Streams;
+  char* Rate;
+  char* Name;
+  char* Save;
+  uint32_t Stream;
+  uint32_t PacketRate = VDEFAULTCAPTURERATE;
+
+  Streams = strchr(Copy, ',');
+  if (Streams != NULL)
+  {
+    *Streams++ = 0;
+    Rate = strchr(Streams, ',');
+    if (Rate != NULL)
+    {
+      *Rate++ = 0;
+      PacketRate = atoi(Rate);
+    }
+  }
+  CaptureStreams = 0;
+  if ((Streams == NULL) || (strcmp(Streams, "all") == 0))
+    CaptureStreams = (1 << VNUMCAPTURESTREAMS) - 1;
+  else
+    for (Name = strtok_r(Streams, "+", &Save); Name != NULL; Name = strtok_r(NULL, "+", &Save))
+    {
+      for (Stream = 0; Stream < VNUMCAPTURESTREAMS; Stream++)
+        if (strcmp(Name, CaptureStreamNames[Stream]) == 0)
+          break;
+      if (Stream == VNUMCAPTURESTREAMS)
+      {
+        printf("packet capture: unknown stream %s; streams are:", Name);
+        for (Stream = 0; Stream < VNUMCAPTURESTREAMS; Stream++)
+          printf(" %s", CaptureStreamNames[Stream]);
+        printf(" or all\n");
+        free(Copy);
+        return true;
+      }
+      CaptureStreams |= (1 << Stream);
+    }
+  if ((Copy[0] == 0) || (CaptureStreams == 0))
+  {
+    printf("packet capture: needs a file and at least one stream\n");
+    free(Copy);
+    return true;
+  }
+  free(CaptureFilename);
+  CaptureFilename = Copy;
+  CaptureWindowLimit = (PacketRate == 0) ? 0 : (PacketRate * (VCAPTUREWINDOW / 1000000) + 999) / 1000;
+  return false;
+}
+
+
+//
+// rate limit: packets are counted in fixed windows. A new window is claimed by
+// the first thread to see it; a race at the boundary lets a few extra through.
+//
+static bool CaptureRateLimited(uint64_t Time)
+{
+  uint64_t Window = Time / VCAPTUREWINDOW;
+  uint64_t Current = atomic_load_explicit(&CaptureWindowStart, memory_order_relaxed);
+
+  if (CaptureWindowLimit == 0)
+    return false;
+  if ((Window != Current) &&
+      atomic_compare_exchange_strong_explicit(&CaptureWindowStart, &Current, Window, memory_order_relaxed, memory_order_relaxed))
+    atomic_store_explicit(&CaptureWindowCount, 0, memory_order_relaxed);
+  return atomic_fetch_add_explicit(&CaptureWindowCount, 1, memory_order_relaxed) >= CaptureWindowLimit;
+}
+
+
+//
+// copy a packet into the next free slot
+//
+void CapturePacket(uint32_t Stream, bool Outgoing, const struct sockaddr_in* Remote, uint16_t LocalPort,
+                   const struct iovec* Iov, uint32_t IovCount, uint32_t Length)
+{
+  struct CaptureSlot* Slot;
+  struct timespec Now;
+  uint64_t Position, Time;
+  uint32_t Cntr, Copied, Chunk;
+
+  if (!CaptureWanted(Stream))
+    return;
+  clock_gettime(CLOCK_REALTIME, &Now);
+  Time = (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+  if (CaptureRateLimited(Time))
+  {
+    atomic_fetch_add_explicit(&RateLimitedPackets, 1, memory_order_relaxed);
+    return;
+  }
+  //
+  // claim a slot: it is free if its sequence is the position; if it is behind,
+  // the writer hasn't read it yet and the ring is full
+  //
+  Position = atomic_load_explicit(&CaptureHead, memory_order_relaxed);
+  while (true)
+  {
+    Slot = CaptureSlots + (Position % VCAPTURESLOTS);
+    if (atomic_load_explicit(&Slot->Sequence, memory_order_acquire) != Position)
+    {
+      if ((int64_t)(atomic_load_explicit(&Slot->Sequence, memory_order_acquire) - Position) < 0)
+      {
+        atomic_fetch_add_explicit(&RingFullPackets, 1, memory_order_relaxed);
+        return;
+      }
+      Position = atomic_load_explicit(&CaptureHead, memory_order_relaxed);
+    }
+    else if (atomic_compare_exchange_weak_explicit(&CaptureHead, &Position, Position + 1,
+                                                   memory_order_relaxed, memory_order_relaxed))
+      break;
+  }
+  Slot->Time = Time;
+  Slot->RemoteAddr = (Remote != NULL) ? Remote->sin_addr.s_addr : 0;
+  Slot->RemotePort = (Remote != NULL) ? Remote->sin_port : 0;
+  Slot->LocalPort = LocalPort;
+  Slot->OriginalLength = Length;
+  Slot->Stream = Stream;
+  Slot->Outgoing = Outgoing;
+  if (Length > VCAPTURESNAPLEN)
+    Length = VCAPTURESNAPLEN;
+  for (Cntr = 0, Copied = 0; (Cntr < IovCount) && (Copied < Length); Cntr++)
+  {
+    Chunk = Iov[Cntr].iov_len;
+    if (Chunk > Length - Copied)
+      Chunk = Length - Copied;
+    memcpy(Slot->Data + Copied, Iov[Cntr].iov_base, Chunk);
+    Copied += Chunk;
+  }
+  Slot->Length = Copied;
+  atomic_store_explicit(&Slot->Sequence, Position + 1, memory_order_release);   // the writer's turn
+  atomic_fetch_add_explicit(&CapturedPackets, 1, memory_order_relaxed);
+}
+
+
+void CaptureBuffer(uint32_t Stream, bool Outgoing, const struct sockaddr_in* Remote, uint16_t LocalPort,
+                   const void* Data, uint32_t Length)
+{
+  struct iovec Iov;
+
+  Iov.iov_base = (void*)Data;
+  Iov.iov_len = Length;
+  CapturePacket(Stream, Outgoing, Remote, LocalPort, &Iov, 1, Length);
+}
+
+
+void CaptureMessages(uint32_t Stream, bool Outgoing, const struct mmsghdr* Msgs, uint32_t Count,
+                     const struct sockaddr_in* Remote, uint16_t LocalPort)
+{
+  const struct msghdr* Msg;
+  uint32_t Cntr, Iov, Length;
+
+  if (!CaptureWanted(Stream))
+    return;
+  for (Cntr = 0; Cntr < Count; Cntr++)
+  {
+    Msg = &Msgs[Cntr].msg_hdr;
+    if (Outgoing)
+      for (Iov = 0, Length = 0; Iov < Msg->msg_iovlen; Iov++)
+        Length += Msg->msg_iov[Iov].iov_len;
+    else
+      Length = Msgs[Cntr].msg_len;
+    CapturePacket(Stream, Outgoing, (Msg->msg_name != NULL) ? (struct sockaddr_in*)Msg->msg_name : Remote,
+                  LocalPort, Msg->msg_iov, Msg->msg_iovlen, Length);
+  }
+}
+
+
+void GetCaptureCounts(uint64_t* Captured, uint64_t* RateLimited, uint64_t* RingFull)
+{
+  *Captured = atomic_load_explicit(&CapturedPackets, memory_order_relaxed);
+  *RateLimited = atomic_load_explicit(&RateLimitedPackets, memory_order_relaxed);
+  *RingFull = atomic_load_explicit(&RingFullPackets, memory_order_relaxed);
+}
+
+
+//
+// write a pcapng option: code, length, value padded to 32 bits
+//
+static void WriteOption(uint16_t Code, const void* Value, uint16_t Length)
+{
+  static const uint8_t Padding[4] = {0};
+
+  fwrite(&Code, 2, 1, CaptureFile);
+  fwrite(&Length, 2, 1, CaptureFile);
+  if (Length != 0)
+  {
+    fwrite(Value, Length, 1, CaptureFile);
+    fwrite(Padding, (4 - (Length & 3)) & 3, 1, CaptureFile);
+  }
+}
+
+
+//
+// section header and the one interface. Timestamps are in ns (if_tsresol 9)
+//
+static void WriteCaptureHeader(void)
+{
+  static const char Application[] = "p2app";
+  uint32_t Word;
+  uint16_t Half;
+  uint64_t Section = (uint64_t)-1;                  // section length not known
+  uint8_t Resolution = 9;
+
+  Word = VPCAPNGSHB;
+  fwrite(&Word, 4, 1, CaptureFile);
+  Word = 24 + 12 + 4 + 4;                           // header, shb_userappl, end of options, length
+  fwrite(&Word, 4, 1, CaptureFile);
+  Word = 0x1A2B3C4D;                                // byte order magic
+  fwrite(&Word, 4, 1, CaptureFile);
+  Half = 1;                                         // version 1.0
+  fwrite(&Half, 2, 1, CaptureFile);
+  Half = 0;
+  fwrite(&Half, 2, 1, CaptureFile);
+  fwrite(&Section, 8, 1, CaptureFile);
+  WriteOption(4, Application, 5);                   // shb_userappl
+  WriteOption(0, NULL, 0);
+  Word = 24 + 12 + 4 + 4;
+  fwrite(&Word, 4, 1, CaptureFile);
+
+  Word = VPCAPNGIDB;
+  fwrite(&Word, 4, 1, CaptureFile);
+  Word = 16 + 8 + 4 + 4;                            // header, if_tsresol, end of options, length
+  fwrite(&Word, 4, 1, CaptureFile);
+  Half = VLINKTYPEIPV4;
+  fwrite(&Half, 2, 1, CaptureFile);
+  Half = 0;
+  fwrite(&Half, 2, 1, CaptureFile);
+  Word = VCAPTURESNAPLEN + VIPUDPHEADERS;
+  fwrite(&Word, 4, 1, CaptureFile);
+  WriteOption(9, &Resolution, 1);                   // if_tsresol
+  WriteOption(0, NULL, 0);
+  Word = 16 + 8 + 4 + 4;
+  fwrite(&Word, 4, 1, CaptureFile);
+}
+
+
+//
+// write one slot as an enhanced packet block: an IPv4/UDP packet, and its direction
+//
+static void WriteCaptureSlot(struct CaptureSlot* Slot)
+{
+  static const uint8_t Padding[4] = {0};
+  uint8_t Headers[VIPUDPHEADERS];
+  uint32_t Word, Checksum, Cntr;
+  uint32_t Captured = VIPUDPHEADERS + Slot->Length;
+  uint32_t Padded = (Captured + 3) & ~3;
+  uint32_t BlockLength = 28 + Padded + 8 + 4 + 4;   // header, data, epb_flags, end of options, length
+  uint32_t Local = CaptureLocalAddr;
+  uint16_t LocalPort = htons(Slot->LocalPort);
+
+  //
+  // IPv4 header, then UDP header with no checksum
+  //
+  memset(Headers, 0, sizeof(Headers));
+  Headers[0] = 0x45;
+  *(uint16_t*)(Headers + 2) = htons(VIPUDPHEADERS + Slot->OriginalLength);
+  Headers[8] = 64;                                  // TTL
+  Headers[9] = IPPROTO_UDP;
+  memcpy(Headers + 12, Slot->Outgoing ? &Local : &Slot->RemoteAddr, 4);
+  memcpy(Headers + 16, Slot->Outgoing ? &Slot->RemoteAddr : &Local, 4);
+  for (Cntr = 0, Checksum = 0; Cntr < 20; Cntr += 2)
+    Checksum += (Headers[Cntr] << 8) | Headers[Cntr + 1];
+  Checksum = (Checksum & 0xFFFF) + (Checksum >> 16);
+  Checksum = (Checksum & 0xFFFF) + (Checksum >> 16);
+  *(uint16_t*)(Headers + 10) = htons(~Checksum & 0xFFFF);
+  memcpy(Headers + 20, Slot->Outgoing ? &LocalPort : &Slot->RemotePort, 2);
+  memcpy(Headers + 22, Slot->Outgoing ? &Slot->RemotePort : &LocalPort, 2);
+  *(uint16_t*)(Headers + 24) = htons(8 + Slot->OriginalLength);
+
+  Word = VPCAPNGEPB;
+  fwrite(&Word, 4, 1, CaptureFile);
+  fwrite(&BlockLength, 4, 1, CaptureFile);
+  Word = 0;                                         // interface 0
+  fwrite(&Word, 4, 1, CaptureFile);
+  Word = Slot->Time >> 32;
+  fwrite(&Word, 4, 1, CaptureFile);
+  Word = Slot->Time & 0xFFFFFFFF;
+  fwrite(&Word, 4, 1, CaptureFile);
+  fwrite(&Captured, 4, 1, CaptureFile);
+  Word = VIPUDPHEADERS + Slot->OriginalLength;
+  fwrite(&Word, 4, 1, CaptureFile);
+  fwrite(Headers, VIPUDPHEADERS, 1, CaptureFile);
+  fwrite(Slot->Data, Slot->Length, 1, CaptureFile);
+  fwrite(Padding, Padded - Captured, 1, CaptureFile);
+  Word = Slot->Outgoing ? 2 : 1;                    // epb_flags: outbound or inbound
+  WriteOption(2, &Word, 4);
+  WriteOption(0, NULL, 0);
+  fwrite(&BlockLength, 4, 1, CaptureFile);
+}
+
+
+//
+// write every slot that is ready. Return the number written.
+//
+static uint32_t WriteCaptureSlots(void)
+{
+  struct CaptureSlot* Slot;
+  uint32_t Written = 0;
+
+  while (true)
+  {
+    Slot = CaptureSlots + (CaptureTail % VCAPTURESLOTS);
+    if (atomic_load_explicit(&Slot->Sequence, memory_order_acquire) != CaptureTail + 1)
+      break;
+    WriteCaptureSlot(Slot);
+    atomic_store_explicit(&Slot->Sequence, CaptureTail + VCAPTURESLOTS, memory_order_release);   // free again
+    CaptureTail++;
+    Written++;
+  }
+  return Written;
+}
+
+
+//
+// writer thread: at a low priority, so it only uses time the stream threads don't
+//
+static void *CaptureWriterThread(__attribute__((unused)) void *arg)
+{
+  struct timespec Now;
+  uint64_t Time, LastFlush = 0;
+
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), VCAPTURENICE);
+  while (CaptureRun)
+  {
+    if (WriteCaptureSlots() == 0)
+    {
+      fflush(CaptureFile);
+      usleep(VCAPTUREIDLEWAIT);
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    Time = (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+    if ((Time - LastFlush) > VCAPTUREFLUSHTIME)
+    {
+      fflush(CaptureFile);
+      LastFlush = Time;
+    }
+  }
+  WriteCaptureSlots();
+  return NULL;
+}
+
+
+//
+// the data interface's IPv4 address, for the radio end of each packet
+//
+static uint32_t GetLocalAddress(void)
+{
+  struct ifreq Request;
+  int Socket;
+  uint32_t Addr = 0;
+
+  Socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (Socket < 0)
+    return 0;
+  memset(&Request, 0, sizeof(Request));
+  snprintf(Request.ifr_name, IFNAMSIZ, "%s", (DataInterface[0] != 0) ? DataInterface : "eth0");
+  Request.ifr_addr.sa_family = AF_INET;
+  if (ioctl(Socket, SIOCGIFADDR, &Request) == 0)
+    Addr = ((struct sockaddr_in*)&Request.ifr_addr)->sin_addr.s_addr;
+  close(Socket);
+  return Addr;
+}
+
+
+bool StartPacketCapture(void)
+{
+  uint32_t Slot;
+
+  if (CaptureFilename == NULL)
+    return false;
+  CaptureSlots = calloc(VCAPTURESLOTS, sizeof(struct CaptureSlot));
+  if (CaptureSlots == NULL)
+  {
+    printf("packet capture: no memory for the ring\n");
+    return true;
+  }
+  for (Slot = 0; Slot < VCAPTURESLOTS; Slot++)
+    atomic_init(&CaptureSlots[Slot].Sequence, Slot);
+  CaptureFile = fopen(CaptureFilename, "wb");
+  if (CaptureFile == NULL)
+  {
+    printf("packet capture: can't open %s: %s\n", CaptureFilename, strerror(errno));
+    free(CaptureSlots);
+    CaptureSlots = NULL;
+    return true;
+  }
+  setvbuf(CaptureFile, NULL, _IOFBF, 1 << 20);
+  CaptureLocalAddr = GetLocalAddress();
+  WriteCaptureHeader();
+  CaptureRun = true;
+  if (pthread_create(&CaptureThreadId, NULL, CaptureWriterThread, NULL) != 0)
+  {
+    printf("packet capture thread create failed\n");
+    CaptureRun = false;
+    fclose(CaptureFile);
+    CaptureFile = NULL;
+    return true;
+  }
+  SetThreadName(CaptureThreadId, "packet capture");
+  atomic_store(&CaptureMask, CaptureStreams);
+  if (CaptureWindowLimit == 0)
+    printf("packet capture to %s: no rate limit\n", CaptureFilename);
+  else
+    printf("packet capture to %s: %u packets/s max\n", CaptureFilename,
+           (uint32_t)(CaptureWindowLimit * (1000000000ULL / VCAPTUREWINDOW)));
+  return false;
+}
+
+
+void StopPacketCapture(void)
+{
+  uint64_t Captured, RateLimited, RingFull;
+
+  if (!CaptureRun)
+    return;
+  atomic_store(&CaptureMask, 0);
+  usleep(VCAPTUREIDLEWAIT);                         // for a packet being copied to finish
+  CaptureRun = false;
+  pthread_join(CaptureThreadId, NULL);
+  fclose(CaptureFile);
+  CaptureFile = NULL;
+  GetCaptureCounts(&Captured, &RateLimited, &RingFull);
+  printf("packet capture: %llu packets written to %s; %llu over the rate limit, %llu with the ring full\n",
+         (unsigned long long)Captured, CaptureFilename, (unsigned long long)RateLimited, (unsigned long long)RingFull);
+}
@@ -0,0 +1,134 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// pcapcapture.h:
+//
+// header: capture protocol 2 packets to a pcapng file, from inside p2app
+//
+// instead of running tcpdump alongside p2app, the threads that send and
+// receive packets copy those of the selected streams into a lock free ring
+// of slots. A low priority writer thread makes each into an IPv4/UDP packet
+// and writes it to the file, with the time it was sent or received and its
+// direction. The cost to a stream thread is a copy of the packet; if the ring
+// is full, or the packets per second limit is reached, packets are not
+// captured, and are counted, rather than the stream thread waiting.
+// the radio's address in the file is that of the data interface (-I, or eth0).
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __pcapcapture_h
+#define __pcapcapture_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+
+#define VDEFAULTCAPTURERATE 20000                   // default limit, packets per second
+
+
+//
+// streams that can be captured, with their names in the capture setting
+//
+typedef enum
+{
+  eCapCommand,                                      // "command": command port, both directions
+  eCapDDCSpecific,                                  // "ddcspecific": DDC specific from client
+  eCapDUCSpecific,                                  // "ducspecific": DUC specific from client
+  eCapHighPriority,                                 // "highpri": high priority from client
+  eCapSpeaker,                                      // "speaker": speaker audio from client
+  eCapDUC,                                          // "duc": DUC I/Q from client
+  eCapStatus,                                       // "status": high priority status to client
+  eCapMic,                                          // "mic": mic audio to client
+  eCapDDC,                                          // "ddc": DDC I/Q to client (all DDCs)
+  eCapWideband,                                     // "wideband": wideband data to client
+  VNUMCAPTURESTREAMS
+} ECaptureStream;
+
+
+extern _Atomic uint32_t CaptureMask;                // bit set for each stream being captured
+
+
+//
+// CaptureWanted(ECaptureStream Stream)
+// true if a stream's packets are being captured. Cheap enough to call per packet.
+//
+static inline bool CaptureWanted(uint32_t Stream)
+{
+  return (atomic_load_explicit(&CaptureMask, memory_order_relaxed) & (1 << Stream)) != 0;
+}
+
+
+//
+// SetPacketCapture(char* Setting)
+// capture packets to a pcapng file. Setting is "file[,streams[,pps]]":
+// streams is a list of stream names joined by +, or "all" (the default);
+// pps limits the packets captured per second (default VDEFAULTCAPTURERATE, 0 = no limit).
+// Return true if error.
+//
+bool SetPacketCapture(char* Setting);
+
+
+//
+// StartPacketCapture(void)
+// open the file and start the writer thread, if SetPacketCapture() was called.
+// Return true if error.
+//
+bool StartPacketCapture(void);
+
+
+//
+// StopPacketCapture(void)
+// stop capturing, write what the ring holds and close the file
+//
+void StopPacketCapture(void);
+
+
+//
+// CapturePacket(ECaptureStream Stream, bool Outgoing, struct sockaddr_in* Remote,
+//               uint16_t LocalPort, const struct iovec* Iov, uint32_t IovCount, uint32_t Length)
+// capture one packet (if CaptureWanted()), Length bytes gathered from the iovecs.
+// Remote is the client's address and port; LocalPort the socket's port.
+//
+void CapturePacket(uint32_t Stream, bool Outgoing, const struct sockaddr_in* Remote, uint16_t LocalPort,
+                   const struct iovec* Iov, uint32_t IovCount, uint32_t Length);
+
+
+//
+// CaptureBuffer(ECaptureStream Stream, bool Outgoing, struct sockaddr_in* Remote,
+//               uint16_t LocalPort, const void* Data, uint32_t Length)
+// capture one packet held in one buffer
+//
+void CaptureBuffer(uint32_t Stream, bool Outgoing, const struct sockaddr_in* Remote, uint16_t LocalPort,
+                   const void* Data, uint32_t Length);
+
+
+//
+// CaptureMessages(ECaptureStream Stream, bool Outgoing, const struct mmsghdr* Msgs, uint32_t Count,
+//                 const struct sockaddr_in* Remote, uint16_t LocalPort)
+// capture a batch of messages given to sendmmsg() or returned by recvmmsg().
+// a message's own address is used if it has one, or else Remote.
+// received messages are msg_len bytes; sent messages are their whole iovecs.
+//
+void CaptureMessages(uint32_t Stream, bool Outgoing, const struct mmsghdr* Msgs, uint32_t Count,
+                     const struct sockaddr_in* Remote, uint16_t LocalPort);
+
+
+//
+// GetCaptureCounts(uint64_t* Captured, uint64_t* RateLimited, uint64_t* RingFull)
+// return the packets captured, and those not captured for each reason
+//
+void GetCaptureCounts(uint64_t* Captured, uint64_t* RateLimited, uint64_t* RingFull);
+
+
+#endif
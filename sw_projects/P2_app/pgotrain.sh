@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# pgotrain.sh: the p2app profile training and benchmark workload
+#
+# ./pgotrain.sh [-t <seconds>] [-Z <DDC capture file>] [-X <TX I/Q file>] <p2app> [<p2app> ...]
+# runs each p2app given on the simulated FPGA (no hardware needed), with p2soak
+# as the client, through these workloads of -t seconds each (default 10):
+#   rx2x192   2 DDCs at 192KHz, with DUC I/Q and speaker audio sent
+#   rx4x384   4 DDCs at 384KHz, receive only
+#   rx2x24    2 DDCs at 24KHz: software decimation
+#   replay    -Z: the recorded DDC capture file, replayed
+#   duc       -X: the TX I/Q file played into the DUC, with 2 DDCs at 192KHz
+# "make pgo" runs it on the instrumented build, to collect the profile.
+# with more than one p2app it is a benchmark: for each workload it prints the CPU
+# seconds each p2app used and the p2soak results, then CPU time relative to the first.
+#
+
+SECONDS_EACH=10
+REPLAY=
+DUCFILE=
+P2SOAK=../../sw_tools/p2soak/p2soak
+TICKS=$(getconf CLK_TCK)
+
+while getopts "t:Z:X:" opt; do
+	case $opt in
+	t) SECONDS_EACH=$OPTARG ;;
+	Z) REPLAY=$OPTARG ;;
+	X) DUCFILE=$OPTARG ;;
+	*) echo "usage: $0 [-t seconds] [-Z capture file] [-X TX I/Q file] p2app [p2app ...]"; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ "$#" -lt 1 ]; then
+	echo "usage: $0 [-t seconds] [-Z capture file] [-X TX I/Q file] p2app [p2app ...]"
+	exit 1
+fi
+if [ ! -x $P2SOAK ]; then
+	make -C ../../sw_tools/p2soak || exit 1
+fi
+
+#
+# run one workload: p2app, its simulated FPGA options, p2soak options
+# prints the CPU seconds p2app used, taken just before it is stopped
+#
+run_workload() {
+	local app=$1 sim=$2 soak=$3 pid cpu
+	$app -s $sim > /tmp/pgotrain.$$.log 2>&1 &
+	pid=$!
+	sleep 1
+	$P2SOAK $soak -t $SECONDS_EACH > /tmp/pgotrain.$$.soak 2>&1
+	cpu=$(awk -v t=$TICKS '{ printf "%.2f", ($14 + $15) / t }' /proc/$pid/stat 2>/dev/null)
+	kill -INT $pid 2>/dev/null
+	wait $pid                                   # exit normally, so the profile is written
+	echo "${cpu:-0}"
+}
+
+WORKLOADS="rx2x192 rx4x384 rx2x24"
+[ -n "$REPLAY" ] && WORKLOADS="$WORKLOADS replay"
+[ -n "$DUCFILE" ] && WORKLOADS="$WORKLOADS duc"
+
+for w in $WORKLOADS; do
+	case $w in
+	rx2x192) sim="-z 2,192"; soak="-d 2 -s 192" ;;
+	rx4x384) sim="-z 4,384"; soak="-d 4 -s 384 -n" ;;
+	rx2x24)  sim="-z 0";     soak="-d 2 -s 24 -n" ;;
+	replay)  sim="-Z $REPLAY"; soak="-d 2 -s 192 -n" ;;
+	duc)     sim="-z 2,192 -X $DUCFILE"; soak="-d 2 -s 192 -n" ;;
+	esac
+	first=
+	for app in "$@"; do
+		cpu=$(run_workload $app "$sim" "$soak")
+		if [ -z "$first" ]; then
+			first=$cpu
+			rel="1.00"
+		else
+			rel=$(awk -v a=$cpu -v b=$first 'BEGIN { printf "%.2f", (b > 0) ? a / b : 0 }')
+		fi
+		printf "%-8s %-24s %6ss CPU  x%s\n" $w $app $cpu $rel
+		if [ "$#" -gt 1 ]; then
+			grep -E "^(DDC|mic|start)" /tmp/pgotrain.$$.soak | sed 's/^/         /'
+		fi
+	done
+done
+rm -f /tmp/pgotrain.$$.log /tmp/pgotrain.$$.soak
@@ -0,0 +1,217 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// pluginhost.c:
+//
+// loading DDC DSP plugins and running them on the demux thread
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include "pluginhost.h"
+#include "ddcplugin.h"
+#include "../common/saturnregisters.h"
+#include "p2config.h"
+#include "eventtrace.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+
+
+//
+// a loaded plugin. The counts are written by the demux thread and read by telemetry
+//
+struct LoadedPlugin
+{
+  struct DDCPlugin Plugin;
+  void* Handle;                                 // from dlopen()
+  uint32_t StartedRate[VNUMDDC];                // rate Start() was last called for; 0 if not this run
+  uint32_t OverrunRun;                          // overruns in a row
+  _Atomic uint64_t Calls;
+  _Atomic uint64_t Samples;
+  _Atomic uint64_t Dropped;
+  _Atomic uint64_t Nanoseconds;
+  _Atomic uint64_t Overruns;
+  _Atomic uint64_t Annotations;
+  _Atomic uint32_t MaxNanoseconds;
+  atomic_bool Bypassed;
+};
+
+uint32_t DDCPluginCount = 0;
+static struct LoadedPlugin Plugins[VMAXDDCPLUGINS];
+static uint32_t CurrentPlugin;                  // plugin and DDC being run, for Annotate()
+static uint32_t CurrentDDC;
+
+
+//
+// CLOCK_MONOTONIC ns
+//
+static inline uint64_t PluginTimeNow(void)
+{
+  struct timespec Now;
+
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// the host's Annotate(): only valid while a plugin's Process() is running
+//
+static void AnnotateDDCPlugin(uint32_t Code)
+{
+  atomic_fetch_add_explicit(&Plugins[CurrentPlugin].Annotations, 1, memory_order_relaxed);
+  Trace(eTracePluginNote, (CurrentPlugin << 8) | CurrentDDC, Code);
+}
+
+
+static const struct DDCPluginHost PluginHost =
+{
+  VDDCPLUGINAPIVERSION,
+  VNUMDDC,
+  AnnotateDDCPlugin
+};
+
+
+bool LoadDDCPlugin(char* Setting)
+{
+  char Path[256];
+  char* Args;
+  struct LoadedPlugin* Loaded;
+  DDCPluginRegisterFn Register;
+
+  if (DDCPluginCount >= VMAXDDCPLUGINS)
+  {
+    printf("DDC plugin %s: no more than %d plugins\n", Setting, VMAXDDCPLUGINS);
+    return true;
+  }
+  snprintf(Path, sizeof(Path), "%s", Setting);
+  Args = strchr(Path, ',');
+  if (Args != NULL)
+    *Args++ = 0;
+  else
+    Args = "";
+  Loaded = Plugins + DDCPluginCount;
+  memset(Loaded, 0, sizeof(struct LoadedPlugin));
+  Loaded->Handle = dlopen(Path, RTLD_NOW | RTLD_LOCAL);
+  if (Loaded->Handle == NULL)
+  {
+    printf("DDC plugin: can't load %s: %s\n", Path, dlerror());
+    return true;
+  }
+  Register = (DDCPluginRegisterFn)dlsym(Loaded->Handle, VDDCPLUGINENTRY);
+  if (Register == NULL)
+  {
+    printf("DDC plugin %s: no %s function\n", Path, VDDCPLUGINENTRY);
+    dlclose(Loaded->Handle);
+    return true;
+  }
+  if (Register(&PluginHost, &Loaded->Plugin, Args) || (Loaded->Plugin.Process == NULL))
+  {
+    printf("DDC plugin %s: failed to register\n", Path);
+    dlclose(Loaded->Handle);
+    return true;
+  }
+  if (Loaded->Plugin.Name == NULL)
+    Loaded->Plugin.Name = "unnamed";
+  Loaded->Plugin.DDCMask &= (1U << VNUMDDC) - 1;
+  printf("DDC plugin %s loaded from %s: DDC mask 0x%x\n", Loaded->Plugin.Name, Path, Loaded->Plugin.DDCMask);
+  DDCPluginCount++;
+  return false;
+}
+
+
+void ResetDDCPlugins(void)
+{
+  uint32_t Index;
+
+  for (Index = 0; Index < DDCPluginCount; Index++)
+  {
+    memset(Plugins[Index].StartedRate, 0, sizeof(Plugins[Index].StartedRate));
+    Plugins[Index].OverrunRun = 0;
+    atomic_store(&Plugins[Index].Bypassed, false);
+  }
+}
+
+
+//
+// the allowance for a call is Count / RateKHz ms, times the budget percentage:
+// Count * 10000 * Budget / RateKHz ns
+//
+uint32_t RunDDCPluginChain(uint32_t DDC, uint8_t* Samples, uint32_t Count, uint32_t RateKHz)
+{
+  struct LoadedPlugin* Loaded;
+  uint64_t Start, Elapsed, Allowed;
+  uint32_t Kept;
+
+  CurrentDDC = DDC;
+  for (CurrentPlugin = 0; (CurrentPlugin < DDCPluginCount) && (Count != 0); CurrentPlugin++)
+  {
+    Loaded = Plugins + CurrentPlugin;
+    if (!(Loaded->Plugin.DDCMask & (1U << DDC)) || atomic_load_explicit(&Loaded->Bypassed, memory_order_relaxed))
+      continue;
+    if (Loaded->StartedRate[DDC] != RateKHz)
+    {
+      Loaded->StartedRate[DDC] = RateKHz;
+      if (Loaded->Plugin.Start != NULL)
+        Loaded->Plugin.Start(Loaded->Plugin.Context, DDC, RateKHz);
+    }
+    Start = PluginTimeNow();
+    Kept = Loaded->Plugin.Process(Loaded->Plugin.Context, DDC, Samples, Count, RateKHz);
+    Elapsed = PluginTimeNow() - Start;
+    if (Kept > Count)
+      Kept = Count;
+    //
+    // accounting, then the budget
+    //
+    atomic_fetch_add_explicit(&Loaded->Calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&Loaded->Samples, Count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&Loaded->Nanoseconds, Elapsed, memory_order_relaxed);
+    if (Kept != Count)
+      atomic_fetch_add_explicit(&Loaded->Dropped, Count - Kept, memory_order_relaxed);
+    if (Elapsed > atomic_load_explicit(&Loaded->MaxNanoseconds, memory_order_relaxed))
+      atomic_store_explicit(&Loaded->MaxNanoseconds, (Elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)Elapsed,
+                            memory_order_relaxed);
+    Allowed = (uint64_t)Count * 10000 * P2Config.DDCPluginBudget / (RateKHz ? RateKHz : 48);
+    if (Elapsed <= Allowed)
+      Loaded->OverrunRun = 0;
+    else
+    {
+      atomic_fetch_add_explicit(&Loaded->Overruns, 1, memory_order_relaxed);
+      if (++Loaded->OverrunRun >= VPLUGINOVERRUNLIMIT)
+      {
+        atomic_store(&Loaded->Bypassed, true);
+        Trace(eTracePluginBypass, CurrentPlugin, DDC);
+        printf("DDC plugin %s: over its %u%% CPU budget %d times in a row; bypassed until the next run\n",
+               Loaded->Plugin.Name, P2Config.DDCPluginBudget, VPLUGINOVERRUNLIMIT);
+      }
+    }
+    Count = Kept;
+  }
+  return Count;
+}
+
+
+void GetDDCPluginStatistics(uint32_t Index, struct DDCPluginStatistics* Stats)
+{
+  struct LoadedPlugin* Loaded = Plugins + Index;
+
+  Stats->Name = Loaded->Plugin.Name;
+  Stats->Calls = atomic_load_explicit(&Loaded->Calls, memory_order_relaxed);
+  Stats->Samples = atomic_load_explicit(&Loaded->Samples, memory_order_relaxed);
+  Stats->Dropped = atomic_load_explicit(&Loaded->Dropped, memory_order_relaxed);
+  Stats->Nanoseconds = atomic_load_explicit(&Loaded->Nanoseconds, memory_order_relaxed);
+  Stats->Overruns = atomic_load_explicit(&Loaded->Overruns, memory_order_relaxed);
+  Stats->Annotations = atomic_load_explicit(&Loaded->Annotations, memory_order_relaxed);
+  Stats->MaxNanoseconds = atomic_load_explicit(&Loaded->MaxNanoseconds, memory_order_relaxed);
+  Stats->Bypassed = atomic_load_explicit(&Loaded->Bypassed, memory_order_relaxed);
+}
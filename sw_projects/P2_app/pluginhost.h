@@ -0,0 +1,90 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// pluginhost.h:
+//
+// header: loading DDC DSP plugins (ddcplugin.h) and running them on the
+// demux thread, with a CPU budget and accounting for each
+//
+// each call is timed. A call that takes longer than ddc_plugin_budget percent
+// of the time its samples cover is an overrun; after VPLUGINOVERRUNLIMIT
+// overruns in a row the plugin is bypassed, with its samples passed on
+// unchanged, until the next stream run.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __pluginhost_h
+#define __pluginhost_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VMAXDDCPLUGINS 4
+#define VPLUGINOVERRUNLIMIT 32                  // overruns in a row before a plugin is bypassed
+
+
+//
+// accounting for one plugin, for telemetry
+//
+struct DDCPluginStatistics
+{
+  const char* Name;
+  uint64_t Calls;
+  uint64_t Samples;                             // samples given to the plugin
+  uint64_t Dropped;                             // samples it didn't keep
+  uint64_t Nanoseconds;                         // time spent in it
+  uint64_t Overruns;                            // calls over budget
+  uint64_t Annotations;
+  uint32_t MaxNanoseconds;                      // longest call
+  bool Bypassed;                                // true if bypassed for going over budget
+};
+
+
+//
+// LoadDDCPlugin(char* Setting)
+// load a plugin from "path[,args]" and register it. Return true if error.
+//
+bool LoadDDCPlugin(char* Setting);
+
+
+//
+// ResetDDCPlugins(void)
+// demux thread, at the start of a stream run: take plugins out of bypass,
+// and call Start() again before each DDC's first samples
+//
+void ResetDDCPlugins(void);
+
+
+//
+// RunDDCPlugins(uint32_t DDC, uint8_t* Samples, uint32_t Count, uint32_t RateKHz)
+// demux thread: run the plugins for a DDC in order on Count samples.
+// returns the number of samples left.
+//
+extern uint32_t DDCPluginCount;
+
+uint32_t RunDDCPluginChain(uint32_t DDC, uint8_t* Samples, uint32_t Count, uint32_t RateKHz);
+
+static inline uint32_t RunDDCPlugins(uint32_t DDC, uint8_t* Samples, uint32_t Count, uint32_t RateKHz)
+{
+  if ((DDCPluginCount == 0) || (Count == 0))
+    return Count;
+  return RunDDCPluginChain(DDC, Samples, Count, RateKHz);
+}
+
+
+//
+// GetDDCPluginStatistics(uint32_t Index, struct DDCPluginStatistics* Stats)
+// read the accounting for plugin Index, 0 to DDCPluginCount-1
+//
+void GetDDCPluginStatistics(uint32_t Index, struct DDCPluginStatistics* Stats);
+
+
+#endif
@@ -0,0 +1,224 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ppstime.c:
+//
+// PPS disciplined DDC timestamps: the PPS thread and the stream position latch
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/pps.h>
+#include "ppstime.h"
+#include "telemetry.h"
+#include "eventtrace.h"
+#include "threadplacement.h"
+
+
+#define VPPSLATCHWINDOW 500000                  // us after a pulse that it can still be latched
+#define VPPSFETCHTIMEOUT 2                      // s to wait for a pulse
+
+
+static int PPSFd = -1;
+static pthread_t PPSThread;
+
+//
+// the pulse waiting to be latched: Edge is 0 if none
+//
+static _Atomic uint64_t PendingEdge;            // TelemetryTimestamp() us of the pulse
+static _Atomic uint32_t PendingSecond;
+
+//
+// the latched pulse, for the demux
+//
+static atomic_bool LatchReady;
+static uint32_t LatchPosition;
+static uint32_t LatchSecond;
+
+//
+// DMA reader: the last latch, to measure the stream rate against PPS
+//
+static bool HaveLastLatch;
+static uint32_t LastPosition;
+static uint32_t LastSecond;
+static uint32_t LastByteRate;
+
+static _Atomic uint64_t PPSEdges;
+static _Atomic uint64_t PPSLatches;
+static _Atomic uint64_t PPSMissed;
+static _Atomic uint32_t PPSLastSecond;
+static _Atomic double PPSClockPPM;
+
+
+//
+// the PPS thread: for each pulse, work out its UTC second and its monotonic time,
+// and leave it for the DMA reader to latch
+//
+static void* PPSWatch(__attribute__((unused)) void* arg)
+{
+  struct pps_fdata Data;
+  struct timespec Real, Mono;
+  uint32_t LastSequence = 0;
+  int64_t SinceEdge;
+  uint64_t Edge;
+  uint32_t Second;
+
+  while (true)
+  {
+    memset(&Data, 0, sizeof(Data));
+    Data.timeout.sec = VPPSFETCHTIMEOUT;
+    if (ioctl(PPSFd, PPS_FETCH, &Data) < 0)
+    {
+      if ((errno != EINTR) && (errno != ETIMEDOUT))
+      {
+        perror("PPS fetch");
+        sleep(1);
+      }
+      continue;
+    }
+    if (Data.info.assert_sequence == LastSequence)
+      continue;
+    LastSequence = Data.info.assert_sequence;
+    clock_gettime(CLOCK_REALTIME, &Real);
+    clock_gettime(CLOCK_MONOTONIC, &Mono);
+    //
+    // the pulse's time on the monotonic clock, from how long ago it was by the real time clock
+    //
+    SinceEdge = ((int64_t)Real.tv_sec - Data.info.assert_tu.sec) * 1000000
+                + ((int64_t)Real.tv_nsec - Data.info.assert_tu.nsec) / 1000;
+    Edge = (uint64_t)Mono.tv_sec * 1000000ULL + Mono.tv_nsec / 1000 - SinceEdge;
+    Second = (uint32_t)Data.info.assert_tu.sec + ((Data.info.assert_tu.nsec >= 500000000) ? 1 : 0);
+    atomic_fetch_add_explicit(&PPSEdges, 1, memory_order_relaxed);
+    if (atomic_load(&PendingEdge) != 0)
+      atomic_fetch_add_explicit(&PPSMissed, 1, memory_order_relaxed);     // the last one wasn't latched
+    atomic_store(&PendingSecond, Second);
+    atomic_store(&PendingEdge, Edge);
+  }
+  return NULL;
+}
+
+
+bool SetPPSDevice(char* Path)
+{
+  struct pps_kparams Params;
+  int Caps;
+
+  PPSFd = open(Path, O_RDWR | O_CLOEXEC);
+  if (PPSFd < 0)
+  {
+    printf("PPS: can't open %s (errno=%d)\n", Path, errno);
+    return true;
+  }
+  if ((ioctl(PPSFd, PPS_GETCAP, &Caps) < 0) || !(Caps & PPS_CAPTUREASSERT) || !(Caps & PPS_CANWAIT))
+  {
+    printf("PPS: %s can't capture and wait for pulses\n", Path);
+    close(PPSFd);
+    PPSFd = -1;
+    return true;
+  }
+  if (ioctl(PPSFd, PPS_GETPARAMS, &Params) == 0)
+  {
+    Params.mode |= PPS_CAPTUREASSERT | PPS_TSFMT_TSPEC;
+    if (ioctl(PPSFd, PPS_SETPARAMS, &Params) < 0)
+      printf("PPS: can't set capture mode on %s; using its current mode\n", Path);
+  }
+  if (CreatePlacedThread(&PPSThread, eThreadControl, "PPS", PPSWatch, NULL) != 0)
+  {
+    perror("pthread_create PPS");
+    close(PPSFd);
+    PPSFd = -1;
+    return true;
+  }
+  pthread_detach(PPSThread);
+  printf("PPS: DDC timestamps disciplined by %s\n", Path);
+  return false;
+}
+
+
+bool IsPPSEnabled(void)
+{
+  return (PPSFd >= 0);
+}
+
+
+void ResetPPSLatch(void)
+{
+  atomic_store(&PendingEdge, 0);
+  atomic_store(&LatchReady, false);
+  HaveLastLatch = false;
+}
+
+
+void NotePPSStreamPosition(uint32_t Position, uint64_t Time, uint32_t ByteRate)
+{
+  uint64_t Edge = atomic_load_explicit(&PendingEdge, memory_order_acquire);
+  uint32_t Second, Since;
+  double PPM;
+
+  if ((Edge == 0) || (Time < Edge))
+    return;
+  atomic_store(&PendingEdge, 0);
+  Second = atomic_load(&PendingSecond);
+  if (((Time - Edge) > VPPSLATCHWINDOW) || (ByteRate == 0) || atomic_load(&LatchReady))
+  {
+    atomic_fetch_add_explicit(&PPSMissed, 1, memory_order_relaxed);
+    return;
+  }
+  Since = (uint32_t)((Time - Edge) * ByteRate / 1000000) & ~7U;   // bytes made since the pulse: whole words
+  LatchPosition = Position - Since;
+  LatchSecond = Second;
+  atomic_store_explicit(&LatchReady, true, memory_order_release);
+  //
+  // the stream rate against PPS: smoothed, as each latch has the depth read's jitter
+  //
+  if (HaveLastLatch && (ByteRate == LastByteRate) && ((Second - LastSecond) >= 1) && ((Second - LastSecond) <= 10))
+  {
+    PPM = ((double)(uint32_t)(LatchPosition - LastPosition) / ((double)ByteRate * (Second - LastSecond)) - 1.0) * 1e6;
+    atomic_store_explicit(&PPSClockPPM, 0.9 * atomic_load_explicit(&PPSClockPPM, memory_order_relaxed) + 0.1 * PPM,
+                          memory_order_relaxed);
+  }
+  HaveLastLatch = true;
+  LastPosition = LatchPosition;
+  LastSecond = Second;
+  LastByteRate = ByteRate;
+  atomic_fetch_add_explicit(&PPSLatches, 1, memory_order_relaxed);
+  atomic_store_explicit(&PPSLastSecond, Second, memory_order_relaxed);
+  Trace(eTracePPS, Second, LatchPosition);
+}
+
+
+bool GetPPSLatch(uint32_t* Position, uint32_t* Second)
+{
+  if (!atomic_load_explicit(&LatchReady, memory_order_acquire))
+    return false;
+  *Position = LatchPosition;
+  *Second = LatchSecond;
+  atomic_store_explicit(&LatchReady, false, memory_order_release);
+  return true;
+}
+
+
+void GetPPSStatistics(struct PPSStatistics* Stats)
+{
+  Stats->Enabled = IsPPSEnabled();
+  Stats->Edges = atomic_load_explicit(&PPSEdges, memory_order_relaxed);
+  Stats->Latches = atomic_load_explicit(&PPSLatches, memory_order_relaxed);
+  Stats->Missed = atomic_load_explicit(&PPSMissed, memory_order_relaxed);
+  Stats->LastSecond = atomic_load_explicit(&PPSLastSecond, memory_order_relaxed);
+  Stats->ClockPPM = atomic_load_explicit(&PPSClockPPM, memory_order_relaxed);
+}
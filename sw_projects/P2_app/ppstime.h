@@ -0,0 +1,127 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ppstime.h:
+//
+// header: PPS disciplined DDC timestamps
+//
+// a thread waits for each pulse per second on a Linux PPS device (-Q /dev/ppsN,
+// eg. a GPS receiver's PPS on a GPIO pin). The pulse's kernel timestamp names
+// the UTC second, from the system clock (kept to GPS time by gpsd or chrony),
+// and marks the instant. Once a second the DDC DMA reader latches the DDC
+// stream position at that instant: the DMA bytes moved so far plus the FIFO
+// depth, both known when the depth is read, less the bytes made since the
+// pulse at the current rate. The demux turns the latched position into a
+// ring position for each DDC, where its sample is the first of the second,
+// and each DDC sender sets its stream epoch from it (PPSEpoch). Packet
+// timestamps are then interpolated from the epoch by sample count, with no
+// register read per packet: the VITA-49 header has a UTC integer timestamp
+// and the samples into the second, and with pps_timestamp set the P2 header
+// timestamp field has the UTC second in its top 32 bits and the samples into
+// the second below. Between pulses, or if one is missed, the count steps on
+// at the nominal rate.
+// the latch is only as good as the time between reading the FIFO depth and
+// stamping it: a FIFO depth taken with the count in the FPGA would replace
+// it, with the rest unchanged.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ppstime_h
+#define __ppstime_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+//
+// a DDC stream's time: sample Sample is the first of UTC second Second
+//
+struct PPSEpoch
+{
+  bool Valid;
+  uint64_t Sample;
+  uint32_t Second;
+};
+
+
+struct PPSStatistics
+{
+  bool Enabled;                                 // a PPS device is in use
+  uint64_t Edges;                               // pulses seen
+  uint64_t Latches;                             // pulses latched in the DDC stream
+  uint64_t Missed;                              // pulses not latched: no FIFO reading to latch them with
+  uint32_t LastSecond;                          // UTC second of the last pulse latched
+  double ClockPPM;                              // DDC stream rate error against PPS, parts per million
+};
+
+
+//
+// SetPPSDevice(char* Path)
+// open a PPS device and start the thread that waits for its pulses. Return true if error.
+//
+bool SetPPSDevice(char* Path);
+
+
+//
+// IsPPSEnabled(void)
+// true if a PPS device is in use
+//
+bool IsPPSEnabled(void);
+
+
+//
+// ResetPPSLatch(void)
+// a new DDC run: forget any pulse not yet latched
+//
+void ResetPPSLatch(void);
+
+
+//
+// NotePPSStreamPosition(uint32_t Position, uint64_t Time, uint32_t ByteRate)
+// DDC DMA reader: at Time (TelemetryTimestamp() us) the FPGA had made Position bytes
+// of DDC stream (free running, as the DMA ring head), at ByteRate bytes/s. Latches a
+// waiting pulse.
+//
+void NotePPSStreamPosition(uint32_t Position, uint64_t Time, uint32_t ByteRate);
+
+
+//
+// GetPPSLatch(uint32_t* Position, uint32_t* Second)
+// demux: take the last latched pulse: the DDC stream byte position of UTC second Second.
+// Returns false if there is none new.
+//
+bool GetPPSLatch(uint32_t* Position, uint32_t* Second);
+
+
+//
+// GetPPSStamp(const struct PPSEpoch* Epoch, uint64_t SampleNumber, uint32_t RateHz)
+// the P2 header timestamp for SampleNumber: UTC second << 32 | samples into the second
+//
+static inline uint64_t GetPPSStamp(const struct PPSEpoch* Epoch, uint64_t SampleNumber, uint32_t RateHz)
+{
+  uint64_t Offset = SampleNumber - Epoch->Sample;
+  uint32_t Second = Epoch->Second;
+
+  if ((RateHz != 0) && (Offset >= RateHz))                  // a pulse is late or missing
+  {
+    Second += (uint32_t)(Offset / RateHz);
+    Offset %= RateHz;
+  }
+  return ((uint64_t)Second << 32) | (uint32_t)Offset;
+}
+
+
+//
+// GetPPSStatistics(struct PPSStatistics* Stats)
+//
+void GetPPSStatistics(struct PPSStatistics* Stats);
+
+
+#endif
@@ -0,0 +1,327 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// pscapture.c:
+//
+// synchronised PureSignal feedback capture
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include "pscapture.h"
+#include "OutDDCIQ.h"
+#include "p2config.h"
+#include "telemetry.h"
+#include "eventtrace.h"
+#include "threadplacement.h"
+#include "../common/saturnregisters.h"
+
+
+#define VPSCAPTUREBUFFERS 2                     // one filling while the other is sent
+#define VPSCAPTUREBYTES (VPSCAPTUREMAX * 12)    // 2 24 bit I/Q samples per pair
+#define VPSCAPTURECHUNK 4096                    // samples per DDC demultiplexed at a time
+#define VPSPAIRSPERPACKET 119                   // 238 samples: a standard DDC packet
+#define VPSHEADERSIZE 16
+
+
+//
+// a captured block: owned by the demux thread until Full, then by the sender until it clears it
+//
+struct PSCaptureBlock
+{
+  uint8_t* Samples;
+  uint32_t Pairs;
+  uint32_t Number;
+  uint32_t DDC;                                 // even DDC: its port carries the block
+  atomic_bool Full;
+};
+
+static struct PSCaptureBlock Blocks[VPSCAPTUREBUFFERS];
+static sem_t PSCaptureSem;                      // wakes the sender
+static pthread_t PSCaptureThread;
+
+//
+// demux thread state
+//
+static int Filling = -1;                        // block being filled, or -1
+static uint32_t Fill;                           // pairs in it so far
+static uint32_t BlockPairs;                     // pairs it will hold
+static uint32_t BlockNumber;
+static uint64_t NextBlockTime;                  // TelemetryTimestamp() us when the next block is due
+static bool WasMOX;
+static uint8_t EvenSamples[VPSCAPTURECHUNK * 6];
+static uint8_t OddSamples[VPSCAPTURECHUNK * 6];
+
+static atomic_bool RestartSequence;             // sender: start the packet sequence again
+static _Atomic uint32_t ActiveDDC;              // even DDC + 1 while a pair is captured, else 0
+static _Atomic uint64_t BlocksSent;
+static _Atomic uint64_t BlocksAborted;
+static _Atomic uint64_t BlocksSkipped;
+static _Atomic uint64_t PairsSent;
+
+
+//
+// send a block as packets of up to VPSPAIRSPERPACKET pairs
+//
+static void SendPSCaptureBlock(struct PSCaptureBlock* Block, uint32_t* Sequence)
+{
+  uint8_t Header[VPSHEADERSIZE];
+  struct iovec Iovecs[2];
+  uint32_t Pair, Pairs;
+
+  for (Pair = 0; (Pair < Block->Pairs) && atomic_load(&SDRActive); Pair += Pairs)
+  {
+    Pairs = Block->Pairs - Pair;
+    if (Pairs > VPSPAIRSPERPACKET)
+      Pairs = VPSPAIRSPERPACKET;
+    *(uint32_t*)Header = htonl((*Sequence)++);
+    *(uint64_t*)(Header + 4) = htobe64(VPSCAPTUREMARKER | ((uint64_t)(Block->Number & 0x7FFFFFFF) << 32) | Pair);
+    *(uint16_t*)(Header + 12) = htons(24);
+    *(uint16_t*)(Header + 14) = htons(2 * Pairs);
+    Iovecs[0].iov_base = Header;
+    Iovecs[0].iov_len = VPSHEADERSIZE;
+    Iovecs[1].iov_base = Block->Samples + Pair * 12;
+    Iovecs[1].iov_len = Pairs * 12;
+    if (SendDDCPacket(Block->DDC, Iovecs, 2))
+      return;
+  }
+  atomic_fetch_add_explicit(&BlocksSent, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&PairsSent, Block->Pairs, memory_order_relaxed);
+}
+
+
+//
+// sender thread: send each full block, oldest first
+//
+static void* PSCaptureSender(__attribute__((unused)) void* arg)
+{
+  uint32_t Sequence = 0;
+  struct PSCaptureBlock* Oldest;
+  uint32_t Cntr;
+
+  while (true)
+  {
+    if (sem_wait(&PSCaptureSem) != 0)
+      continue;                                           // EINTR
+    if (atomic_exchange(&RestartSequence, false))
+      Sequence = 0;
+    Oldest = NULL;
+    for (Cntr = 0; Cntr < VPSCAPTUREBUFFERS; Cntr++)
+      if (atomic_load_explicit(&Blocks[Cntr].Full, memory_order_acquire)
+          && ((Oldest == NULL) || ((int32_t)(Blocks[Cntr].Number - Oldest->Number) < 0)))
+        Oldest = Blocks + Cntr;
+    if (Oldest == NULL)
+      continue;
+    SendPSCaptureBlock(Oldest, &Sequence);
+    atomic_store_explicit(&Oldest->Full, false, memory_order_release);
+  }
+  return NULL;
+}
+
+
+bool StartPSCapture(void)
+{
+  uint8_t* Map;
+  uint32_t Cntr;
+
+  Map = mmap(NULL, VPSCAPTUREBUFFERS * VPSCAPTUREBYTES, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (Map == MAP_FAILED)
+  {
+    perror("PureSignal capture buffers");
+    return true;
+  }
+  for (Cntr = 0; Cntr < VPSCAPTUREBUFFERS; Cntr++)
+  {
+    Blocks[Cntr].Samples = Map + Cntr * VPSCAPTUREBYTES;
+    atomic_store(&Blocks[Cntr].Full, false);
+  }
+  sem_init(&PSCaptureSem, 0, 0);
+  if (CreatePlacedThread(&PSCaptureThread, eThreadDDC, "PS capture", PSCaptureSender, NULL) != 0)
+  {
+    perror("pthread_create PS capture");
+    munmap(Map, VPSCAPTUREBUFFERS * VPSCAPTUREBYTES);
+    Blocks[0].Samples = NULL;
+    return true;
+  }
+  pthread_detach(PSCaptureThread);
+  return false;
+}
+
+
+void ResetPSCapture(void)
+{
+  Filling = -1;
+  WasMOX = false;
+  atomic_store(&RestartSequence, true);
+}
+
+
+bool GetPSCapturePair(const struct DDCFramePlan* Plan, struct PSCapturePair* Pair)
+{
+  uint32_t DDC, Even, Cntr;
+  uint32_t Active = 0;
+
+  Pair->Even = NULL;
+  Pair->Odd = NULL;
+  if ((P2Config.PSCapture != 0) && (Blocks[0].Samples != NULL))
+  {
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+      if (GetDDCADC(DDC) == eTXSamples)
+        break;
+    Even = DDC & ~1U;
+    if (Even + 1 < VNUMDDC)
+    {
+      for (Cntr = 0; Cntr < Plan->NumEntries; Cntr++)
+      {
+        if (Plan->Entries[Cntr].DDC == Even)
+          Pair->Even = Plan->Entries + Cntr;
+        else if (Plan->Entries[Cntr].DDC == Even + 1)
+          Pair->Odd = Plan->Entries + Cntr;
+      }
+    }
+    if ((Pair->Even != NULL) && (Pair->Odd == NULL) && (((Plan->RateWord >> (Even * 3)) & 7) == 7))
+      Active = Even + 1;                                  // interleaved by the FPGA
+    else if ((Pair->Even != NULL) && (Pair->Odd != NULL) && (Pair->Even->WordCount == Pair->Odd->WordCount)
+             && ((Pair->Even->WordCount != 1) || ((GetP2SampleRate(Even) == 48) && (GetP2SampleRate(Even + 1) == 48))))
+      Active = Even + 1;
+  }
+  if (Active != atomic_load_explicit(&ActiveDDC, memory_order_relaxed))
+  {
+    atomic_store(&ActiveDDC, Active);
+    if (UseDebug)
+    {
+      if (Active != 0)
+        printf("PureSignal capture: DDC%d and DDC%d, %d sample pairs per block\n", Active - 1, Active, P2Config.PSCapture);
+      else
+        printf("PureSignal capture: off\n");
+    }
+  }
+  if (Active == 0)
+  {
+    if (Filling >= 0)
+      atomic_fetch_add_explicit(&BlocksAborted, 1, memory_order_relaxed);
+    Filling = -1;
+    return false;
+  }
+  return true;
+}
+
+
+//
+// copy Frames frames of the pair into the block being filled
+//
+static void CapturePSFrames(const struct PSCapturePair* Pair, const uint8_t* Src, uint32_t FrameBytes, uint32_t Frames)
+{
+  uint8_t* Dest = Blocks[Filling].Samples + Fill * 12;
+  uint32_t WordCount = Pair->Even->WordCount;
+  uint32_t Chunk, Sample;
+
+  if (Pair->Odd == NULL)
+  {
+    Pair->Even->Demux(Dest, Src + Pair->Even->SrcOffset, FrameBytes, Frames, WordCount);
+    Fill += Frames * WordCount / 2;
+    return;
+  }
+  while (Frames != 0)
+  {
+    Chunk = VPSCAPTURECHUNK / WordCount;
+    if (Chunk > Frames)
+      Chunk = Frames;
+    Pair->Even->Demux(EvenSamples, Src + Pair->Even->SrcOffset, FrameBytes, Chunk, WordCount);
+    Pair->Odd->Demux(OddSamples, Src + Pair->Odd->SrcOffset, FrameBytes, Chunk, WordCount);
+    for (Sample = 0; Sample < Chunk * WordCount; Sample++)
+    {
+      memcpy(Dest, EvenSamples + Sample * 6, 6);
+      memcpy(Dest + 6, OddSamples + Sample * 6, 6);
+      Dest += 12;
+    }
+    Fill += Chunk * WordCount;
+    Src += Chunk * FrameBytes;
+    Frames -= Chunk;
+  }
+}
+
+
+void RunPSCapture(const struct PSCapturePair* Pair, const uint8_t* Frames, uint32_t FrameBytes, uint32_t FrameCount)
+{
+  uint32_t PairsPerFrame = (Pair->Odd == NULL) ? Pair->Even->WordCount / 2 : Pair->Even->WordCount;
+  uint64_t Now = TelemetryTimestamp();
+  uint32_t Cntr, Count;
+
+  if (!atomic_load(&IsTXMode))
+  {
+    if (Filling >= 0)
+      atomic_fetch_add_explicit(&BlocksAborted, 1, memory_order_relaxed);
+    Filling = -1;
+    WasMOX = false;
+    return;
+  }
+  if (!WasMOX)
+    NextBlockTime = Now;                                  // a block straight away at MOX
+  WasMOX = true;
+  if (PairsPerFrame == 0)
+    return;
+  if (Filling < 0)
+  {
+    if (Now < NextBlockTime)
+      return;
+    NextBlockTime = Now + (uint64_t)P2Config.PSCaptureInterval * 1000;
+    for (Cntr = 0; Cntr < VPSCAPTUREBUFFERS; Cntr++)
+      if (!atomic_load_explicit(&Blocks[Cntr].Full, memory_order_acquire))
+        break;
+    if (Cntr == VPSCAPTUREBUFFERS)
+    {
+      atomic_fetch_add_explicit(&BlocksSkipped, 1, memory_order_relaxed);
+      return;
+    }
+    Filling = Cntr;
+    Fill = 0;
+    BlockPairs = P2Config.PSCapture / PairsPerFrame * PairsPerFrame;     // whole DMA frames
+    if (BlockPairs == 0)
+      BlockPairs = PairsPerFrame;
+    Blocks[Filling].Number = BlockNumber++;
+    Blocks[Filling].DDC = Pair->Even->DDC;
+  }
+  Count = (BlockPairs - Fill) / PairsPerFrame;
+  if (Count > FrameCount)
+    Count = FrameCount;
+  CapturePSFrames(Pair, Frames, FrameBytes, Count);
+  if (Fill == BlockPairs)
+  {
+    Blocks[Filling].Pairs = Fill;
+    Trace(eTracePSCapture, Blocks[Filling].Number, Fill);
+    atomic_store_explicit(&Blocks[Filling].Full, true, memory_order_release);
+    sem_post(&PSCaptureSem);
+    Filling = -1;
+  }
+}
+
+
+void GetPSCaptureStatistics(struct PSCaptureStatistics* Stats)
+{
+  uint32_t Active = atomic_load_explicit(&ActiveDDC, memory_order_relaxed);
+
+  Stats->Active = (Active != 0);
+  Stats->EvenDDC = Active ? Active - 1 : 0;
+  Stats->Blocks = atomic_load_explicit(&BlocksSent, memory_order_relaxed);
+  Stats->Aborted = atomic_load_explicit(&BlocksAborted, memory_order_relaxed);
+  Stats->Skipped = atomic_load_explicit(&BlocksSkipped, memory_order_relaxed);
+  Stats->Pairs = atomic_load_explicit(&PairsSent, memory_order_relaxed);
+}
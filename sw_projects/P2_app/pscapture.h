@@ -0,0 +1,102 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// pscapture.h:
+//
+// header: synchronised PureSignal feedback capture
+//
+// with ps_capture set, the DDC fed from the TX samples (ADC select 2 in the DDC
+// specific packet) and the other DDC of its pair are not streamed. Instead,
+// while MOX is asserted, the demux thread captures blocks of ps_capture sample
+// pairs from the same DMA frames of both, so they are sample aligned, into a
+// preallocated buffer: one at MOX, then one every ps_capture_interval ms.
+// a thread sends each block on the even DDC's port as one interleaved stream,
+// like a synchronised pair: even DDC sample then odd DDC sample. The timestamp
+// field of each packet is the alignment marker: VPSCAPTUREMARKER, the block
+// number in bits 62:32, and the pair index of the packet's first sample in
+// bits 31:0, so a block starts where the pair index is 0. A block that MOX
+// ends before it is full is dropped. Nothing is sent outside MOX.
+// the pair must be at 48KHz or more, and both DDCs at the same rate.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __pscapture_h
+#define __pscapture_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/ddcdemux.h"
+
+
+#define VPSCAPTUREMAX 16384                     // max ps_capture: sample pairs per block
+#define VPSCAPTUREMARKER 0x8000000000000000ULL  // timestamp bit set in capture packets
+
+
+//
+// the pair's place in the frame plan: Even and Odd DDC entries, or just
+// Even if the FPGA interleaves the pair
+//
+struct PSCapturePair
+{
+  const struct DDCFramePlanEntry* Even;
+  const struct DDCFramePlanEntry* Odd;          // NULL if interleaved by the FPGA
+};
+
+
+//
+// capture counts, for telemetry
+//
+struct PSCaptureStatistics
+{
+  bool Active;                                  // true while a pair is being captured
+  uint32_t EvenDDC;                             // the pair, while active
+  uint64_t Blocks;                              // blocks sent
+  uint64_t Aborted;                             // blocks dropped when MOX ended
+  uint64_t Skipped;                             // blocks not captured: the last was still being sent
+  uint64_t Pairs;                               // sample pairs sent
+};
+
+
+//
+// StartPSCapture(void)
+// allocate the capture buffers and start the sender thread. Return true if error.
+//
+bool StartPSCapture(void);
+
+
+//
+// ResetPSCapture(void)
+// demux thread: a new run; drop any part captured block and start the packet sequence again
+//
+void ResetPSCapture(void);
+
+
+//
+// GetPSCapturePair(const struct DDCFramePlan* Plan, struct PSCapturePair* Pair)
+// demux thread: find the PureSignal pair in a frame plan. Returns true if it is
+// being captured, when the demux must not stream the pair's DDCs itself.
+//
+bool GetPSCapturePair(const struct DDCFramePlan* Plan, struct PSCapturePair* Pair);
+
+
+//
+// RunPSCapture(const struct PSCapturePair* Pair, const uint8_t* Frames, uint32_t FrameBytes, uint32_t FrameCount)
+// demux thread: capture from FrameCount DMA frames, if MOX is asserted and a block is due
+//
+void RunPSCapture(const struct PSCapturePair* Pair, const uint8_t* Frames, uint32_t FrameBytes, uint32_t FrameCount);
+
+
+//
+// GetPSCaptureStatistics(struct PSCaptureStatistics* Stats)
+//
+void GetPSCaptureStatistics(struct PSCaptureStatistics* Stats);
+
+
+#endif
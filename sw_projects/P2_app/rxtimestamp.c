@@ -0,0 +1,108 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// rxtimestamp.c:
+//
+// kernel receive timestamps on incoming packets
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include "rxtimestamp.h"
+#include "threaddata.h"
+
+
+static bool HardwareStampingTried = false;
+
+
+//
+// switch on hardware stamping of all received packets at the NIC
+// needs CAP_NET_ADMIN, and a driver that supports it; not an error if it doesn't
+//
+static void EnableHardwareStamping(int Socket)
+{
+  struct hwtstamp_config Config;
+  struct ifreq Request;
+
+  memset(&Config, 0, sizeof(Config));
+  Config.tx_type = HWTSTAMP_TX_OFF;
+  Config.rx_filter = HWTSTAMP_FILTER_ALL;
+  memset(&Request, 0, sizeof(Request));
+  snprintf(Request.ifr_name, IFNAMSIZ, "%s", (DataInterface[0] != 0) ? DataInterface : "eth0");
+  Request.ifr_data = (char*)&Config;
+  if (ioctl(Socket, SIOCSHWTSTAMP, &Request) < 0)
+    printf("receive timestamps: no hardware stamps on %s (%s): software only\n", Request.ifr_name, strerror(errno));
+  else
+    printf("receive timestamps: hardware stamps on %s\n", Request.ifr_name);
+}
+
+
+//
+// ask for receive stamps on a socket
+//
+bool SetReceiveTimestamps(int Socket, const char* Name, bool Enabled)
+{
+  int Flags = 0;
+
+  if (Enabled)
+  {
+    Flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+        | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    if (!HardwareStampingTried)
+    {
+      HardwareStampingTried = true;
+      EnableHardwareStamping(Socket);
+    }
+  }
+  if (setsockopt(Socket, SOL_SOCKET, SO_TIMESTAMPING, &Flags, sizeof(Flags)) < 0)
+  {
+    printf("%s socket: receive timestamps not set: %s\n", Name, strerror(errno));
+    return true;
+  }
+  return false;
+}
+
+
+static inline uint64_t TimespecMicroseconds(const struct timespec* Time)
+{
+  return (uint64_t)Time->tv_sec * 1000000ULL + Time->tv_nsec / 1000;
+}
+
+
+//
+// ts[0] is the software stamp, ts[2] the raw hardware stamp; ts[1] is no longer used
+//
+bool GetReceiveTimestamps(struct msghdr* Msg, uint64_t* Software, uint64_t* Hardware)
+{
+  struct cmsghdr* Cmsg;
+  struct scm_timestamping* Stamps;
+
+  *Software = 0;
+  *Hardware = 0;
+  if (Msg->msg_control == NULL)
+    return false;
+  for (Cmsg = CMSG_FIRSTHDR(Msg); Cmsg != NULL; Cmsg = CMSG_NXTHDR(Msg, Cmsg))
+  {
+    if ((Cmsg->cmsg_level != SOL_SOCKET) || (Cmsg->cmsg_type != SCM_TIMESTAMPING))
+      continue;
+    Stamps = (struct scm_timestamping*)CMSG_DATA(Cmsg);
+    *Software = TimespecMicroseconds(&Stamps->ts[0]);
+    *Hardware = TimespecMicroseconds(&Stamps->ts[2]);
+  }
+  return (*Software != 0);
+}
+
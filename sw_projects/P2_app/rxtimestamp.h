@@ -0,0 +1,59 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// rxtimestamp.h:
+//
+// header: kernel receive timestamps on incoming packets
+//
+// with setting rx_timestamps, the high priority and DUC I/Q sockets ask for
+// SO_TIMESTAMPING receive stamps: the time the kernel took each packet from
+// the NIC, and the NIC's own hardware stamp if the driver supports them.
+// the time from that stamp to when the packet's work is done (registers
+// committed, samples DMAed to the FPGA) shows how long packets wait in
+// socket queues, ie the effect of the thread priorities and placement.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __rxtimestamp_h
+#define __rxtimestamp_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+
+
+//
+// control message space for the stamps, for msg_control of a receive
+//
+#define VRXSTAMPCMSGSIZE CMSG_SPACE(sizeof(struct scm_timestamping))
+
+
+//
+// SetReceiveTimestamps(int Socket, const char* Name, bool Enabled)
+// ask for (or stop) software and hardware receive stamps on a socket.
+// the 1st time it is enabled, hardware stamping of received packets is switched on
+// at the NIC too, if the driver allows it.
+// return true if error
+//
+bool SetReceiveTimestamps(int Socket, const char* Name, bool Enabled);
+
+
+//
+// GetReceiveTimestamps(struct msghdr* Msg, uint64_t* Software, uint64_t* Hardware)
+// find the stamps in a received message's control data, in us of CLOCK_REALTIME
+// (the hardware stamp is in the NIC's clock, which is only comparable if it is
+// kept in step with the system clock, eg by phc2sys). a stamp not present is 0.
+// return true if there was a software stamp. TelemetryReceiveDelay() records them
+//
+bool GetReceiveTimestamps(struct msghdr* Msg, uint64_t* Software, uint64_t* Hardware);
+
+
+#endif
@@ -0,0 +1,198 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// stageprofile.c:
+//
+// CPU cost of the DDC and DUC pipeline stages, from per thread hardware counters
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "stageprofile.h"
+#include "p2config.h"
+
+
+struct StageTotals StageTotals[VNUMPROFILESTAGES];
+
+static _Atomic uint32_t LatestSource = eProfileOff;     // source of the last profiler started
+static atomic_bool PMUReported;                         // true once the PMU failure has been reported
+#if defined(__aarch64__)
+static uint64_t CounterFrequency;                       // ARM virtual counter Hz
+#endif
+
+static const char* StageNames[VNUMPROFILESTAGES] =
+{
+  "ddc_fifo_wait", "ddc_dma", "ddc_demux", "ddc_build", "ddc_send", "duc_receive", "duc_swap", "duc_dma"
+};
+
+
+const char* GetStageName(uint32_t Stage)
+{
+  return (Stage < VNUMPROFILESTAGES) ? StageNames[Stage] : "unknown";
+}
+
+
+const char* GetStageSourceName(void)
+{
+  static const char* Names[] = {"off", "pmu", "time"};
+
+  return Names[atomic_load(&LatestSource)];
+}
+
+
+//
+// timestamp: on aarch64 the virtual counter, read directly; otherwise ns
+//
+static inline uint64_t ProfileTime(void)
+{
+#if defined(__aarch64__)
+  uint64_t Ticks;
+
+  __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(Ticks));
+  return Ticks;
+#else
+  struct timespec Now;
+
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+#endif
+}
+
+
+//
+// convert a ProfileTime() difference to ns
+//
+static inline uint64_t ProfileNanoseconds(uint64_t Elapsed)
+{
+#if defined(__aarch64__)
+  return (CounterFrequency != 0) ? (Elapsed * 1000000000ULL) / CounterFrequency : 0;
+#else
+  return Elapsed;
+#endif
+}
+
+
+//
+// open one counter for the calling thread, on whichever CPU it runs.
+// kernel time is counted if allowed, so system calls are costed too;
+// with a stricter perf_event_paranoid, user time only
+//
+static int OpenCounter(uint64_t Config, int GroupFd)
+{
+  struct perf_event_attr Attr;
+  int Fd;
+
+  memset(&Attr, 0, sizeof(Attr));
+  Attr.type = PERF_TYPE_HARDWARE;
+  Attr.size = sizeof(Attr);
+  Attr.config = Config;
+  Attr.read_format = PERF_FORMAT_GROUP;
+  Attr.exclude_hv = 1;
+  Fd = syscall(SYS_perf_event_open, &Attr, 0, -1, GroupFd, PERF_FLAG_FD_CLOEXEC);
+  if (Fd < 0)
+  {
+    Attr.exclude_kernel = 1;
+    Fd = syscall(SYS_perf_event_open, &Attr, 0, -1, GroupFd, PERF_FLAG_FD_CLOEXEC);
+  }
+  return Fd;
+}
+
+
+void StageProfilerInit(struct StageProfiler* Profiler)
+{
+  memset(Profiler, 0, sizeof(*Profiler));
+  Profiler->Source = eProfileOff;
+  Profiler->GroupFd = -1;
+  Profiler->InstructionFd = -1;
+}
+
+
+void StageProfilerStart(struct StageProfiler* Profiler)
+{
+  if (!P2Config.StageProfile)
+  {
+    StageProfilerStop(Profiler);
+    return;
+  }
+  if (Profiler->Source != eProfileOff)
+    return;                                             // already open
+#if defined(__aarch64__)
+  if (CounterFrequency == 0)
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(CounterFrequency));
+#endif
+  Profiler->GroupFd = OpenCounter(PERF_COUNT_HW_CPU_CYCLES, -1);
+  if (Profiler->GroupFd >= 0)
+    Profiler->InstructionFd = OpenCounter(PERF_COUNT_HW_INSTRUCTIONS, Profiler->GroupFd);
+  if ((Profiler->GroupFd >= 0) && (Profiler->InstructionFd >= 0))
+    Profiler->Source = eProfilePMU;
+  else
+  {
+    if (!atomic_exchange(&PMUReported, true))
+      perror("stage profile: hardware counters not available, timing only");
+    if (Profiler->GroupFd >= 0)
+      close(Profiler->GroupFd);
+    Profiler->GroupFd = -1;
+    Profiler->Source = eProfileTimeOnly;
+  }
+  atomic_store(&LatestSource, Profiler->Source);
+  StageMark(Profiler);
+}
+
+
+void StageProfilerStop(struct StageProfiler* Profiler)
+{
+  if (Profiler->InstructionFd >= 0)
+    close(Profiler->InstructionFd);
+  if (Profiler->GroupFd >= 0)
+    close(Profiler->GroupFd);
+  Profiler->InstructionFd = -1;
+  Profiler->GroupFd = -1;
+  Profiler->Source = eProfileOff;
+}
+
+
+//
+// one read() returns both counts of the group
+//
+void StageProfilerRead(struct StageProfiler* Profiler, uint64_t* Cycles, uint64_t* Instructions, uint64_t* Time)
+{
+  uint64_t Values[3];                                   // count of events, then cycles, instructions
+
+  *Time = ProfileTime();
+  if ((Profiler->Source == eProfilePMU) &&
+      (read(Profiler->GroupFd, Values, sizeof(Values)) == (ssize_t)sizeof(Values)))
+  {
+    *Cycles = Values[1];
+    *Instructions = Values[2];
+  }
+}
+
+
+void StageProfilerEnd(struct StageProfiler* Profiler, uint32_t Stage, uint32_t Bytes)
+{
+  uint64_t Cycles = Profiler->Cycles;
+  uint64_t Instructions = Profiler->Instructions;
+  uint64_t Time;
+  struct StageTotals* Totals = StageTotals + Stage;
+
+  StageProfilerRead(Profiler, &Cycles, &Instructions, &Time);
+  atomic_fetch_add_explicit(&Totals->Calls, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&Totals->Bytes, Bytes, memory_order_relaxed);
+  atomic_fetch_add_explicit(&Totals->Cycles, Cycles - Profiler->Cycles, memory_order_relaxed);
+  atomic_fetch_add_explicit(&Totals->Instructions, Instructions - Profiler->Instructions, memory_order_relaxed);
+  atomic_fetch_add_explicit(&Totals->Nanoseconds, ProfileNanoseconds(Time - Profiler->Time), memory_order_relaxed);
+  Profiler->Cycles = Cycles;
+  Profiler->Instructions = Instructions;
+  Profiler->Time = Time;
+}
@@ -0,0 +1,160 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// stageprofile.h:
+//
+// header: CPU cost of the DDC and DUC pipeline stages
+//
+// with stage_profile set, each stream thread opens a pair of per thread
+// hardware counters (CPU cycles and instructions retired) through
+// perf_event_open(). A thread marks the start of a stage, and at its end adds
+// the counts, the elapsed time and the bytes it handled to that stage's totals,
+// so telemetry can report cycles and instructions per byte for each one.
+// the counters only count while the thread runs, so time blocked in a system
+// call (a FIFO wait, a blocking receive) costs no cycles, but still adds to the
+// elapsed time. Where the PMU can't be used (no kernel support, or
+// perf_event_paranoid too high) only the elapsed time is counted; on aarch64
+// that is from the ARM virtual counter, otherwise the monotonic clock.
+// reading the counters is a system call, so stages are marked once per DMA or
+// batch of packets, not per packet. A disabled profiler costs one test per mark.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __stageprofile_h
+#define __stageprofile_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+
+//
+// pipeline stages profiled
+//
+typedef enum
+{
+  eStageDDCFIFOWait,                                // DDC DMA reader: waiting for FIFO data
+  eStageDDCDMA,                                     // DDC DMA reader: DMA read
+  eStageDDCDemux,                                   // DDC demux: frames to the I/Q rings
+  eStageDDCBuild,                                   // DDC senders: packet headers and payload packing
+  eStageDDCSend,                                    // DDC senders: sendmmsg() or other send path
+  eStageDUCReceive,                                 // DUC I/Q: recvmmsg()
+  eStageDUCSwap,                                    // DUC I/Q: I/Q swap or EER interleave
+  eStageDUCDMA,                                     // DUC I/Q: DMA write
+  VNUMPROFILESTAGES
+} EProfileStage;
+
+
+//
+// where a profiler's counts come from
+//
+typedef enum
+{
+  eProfileOff,                                      // not profiling
+  eProfilePMU,                                      // cycle and instruction counters
+  eProfileTimeOnly                                  // elapsed time only
+} EProfileSource;
+
+
+//
+// totals for one stage, added to by the profiling threads
+//
+struct StageTotals
+{
+  _Atomic uint64_t Calls;                           // stages ended
+  _Atomic uint64_t Bytes;                           // bytes handled
+  _Atomic uint64_t Cycles;                          // CPU cycles (PMU only)
+  _Atomic uint64_t Instructions;                    // instructions retired (PMU only)
+  _Atomic uint64_t Nanoseconds;                     // elapsed time
+};
+
+extern struct StageTotals StageTotals[VNUMPROFILESTAGES];
+
+
+//
+// one per profiling thread
+//
+struct StageProfiler
+{
+  uint32_t Source;                                  // EProfileSource
+  int GroupFd;                                      // perf event group leader (cycles), or -1
+  int InstructionFd;                                // perf event group member, or -1
+  uint64_t Cycles;                                  // counts at the last mark
+  uint64_t Instructions;
+  uint64_t Time;                                    // timestamp at the last mark
+};
+
+
+//
+// void StageProfilerInit(struct StageProfiler* Profiler)
+// set a profiler to off, before its first StageProfilerStart()
+//
+void StageProfilerInit(struct StageProfiler* Profiler);
+
+
+//
+// void StageProfilerStart(struct StageProfiler* Profiler)
+// called by the thread that will use it, at the start of a stream run:
+// opens its counters if stage_profile is set, or closes them if it has been cleared
+//
+void StageProfilerStart(struct StageProfiler* Profiler);
+
+
+//
+// void StageProfilerStop(struct StageProfiler* Profiler)
+// close a profiler's counters
+//
+void StageProfilerStop(struct StageProfiler* Profiler);
+
+
+//
+// void StageMark(struct StageProfiler* Profiler)
+// note the counts at the start of a stage. StageProfilerRead() reads the counts
+// and time; it is only called when the profiler is on
+//
+void StageProfilerRead(struct StageProfiler* Profiler, uint64_t* Cycles, uint64_t* Instructions, uint64_t* Time);
+
+static inline void StageMark(struct StageProfiler* Profiler)
+{
+  if (Profiler->Source != eProfileOff)
+    StageProfilerRead(Profiler, &Profiler->Cycles, &Profiler->Instructions, &Profiler->Time);
+}
+
+
+//
+// void StageEnd(struct StageProfiler* Profiler, EProfileStage Stage, uint32_t Bytes)
+// add the counts since the last mark to a stage's totals. This is also a mark,
+// so stages that follow each other need only one call between them.
+// StageProfilerEnd() does the work when the profiler is on
+//
+void StageProfilerEnd(struct StageProfiler* Profiler, uint32_t Stage, uint32_t Bytes);
+
+static inline void StageEnd(struct StageProfiler* Profiler, uint32_t Stage, uint32_t Bytes)
+{
+  if (Profiler->Source != eProfileOff)
+    StageProfilerEnd(Profiler, Stage, Bytes);
+}
+
+
+//
+// const char* GetStageName(uint32_t Stage)
+// name of a stage, for reports
+//
+const char* GetStageName(uint32_t Stage);
+
+
+//
+// const char* GetStageSourceName(void)
+// how the stages are being measured: "pmu", "time" or "off"
+//
+const char* GetStageSourceName(void);
+
+
+#endif
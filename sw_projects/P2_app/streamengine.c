@@ -0,0 +1,201 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// streamengine.c:
+//
+// the DMA side of a stream thread: buffer, device, FIFO monitor and transfers
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include "threaddata.h"
+#include "streamengine.h"
+#include "telemetry.h"
+#include "heartbeat.h"
+#include "p2config.h"
+#include "../common/saturnregisters.h"
+#include "../common/saturndrivers.h"
+#include "../common/hwaccess.h"
+
+
+void InitStreamEngine(struct StreamEngine* Engine, const char* Name, EDMAStreamSelect Channel, const char* Device,
+                      uint32_t AXIAddr, bool ToFPGA, ETelemetryStream Telemetry, uint32_t Beat, uint8_t FIFOErrorBit)
+{
+  memset(Engine, 0, sizeof(struct StreamEngine));
+  Engine->Name = Name;
+  Engine->Channel = Channel;
+  Engine->Device = Device;
+  Engine->AXIAddr = AXIAddr;
+  Engine->ToFPGA = ToFPGA;
+  Engine->Telemetry = Telemetry;
+  Engine->Beat = Beat;
+  Engine->FIFOErrorBit = FIFOErrorBit;
+  Engine->ReportFull = true;
+  Engine->fd = -1;
+}
+
+
+bool OpenStreamEngine(struct StreamEngine* Engine, uint32_t BufferSize, uint32_t MaxTransfer,
+                      uint32_t RingSize, uint32_t RingBlockSize)
+{
+  if (BufferSize != 0)
+  {
+    Engine->Buffer = ArenaAlloc(&StreamArena, BufferSize, VSTREAMALIGNMENT);
+    if (Engine->Buffer == NULL)
+    {
+      printf("%s DMA buffer allocation failed\n", Engine->Name);
+      return true;
+    }
+    memset(Engine->Buffer, 0, BufferSize);
+    Engine->BufferSize = BufferSize;
+    Engine->BasePtr = Engine->Buffer + VSTREAMBASE;
+  }
+  Engine->RingSize = RingSize;
+  Engine->RingBlockSize = RingBlockSize;
+
+  Engine->fd = OpenDMADevice(Engine->Device, O_RDWR);
+  if (Engine->fd < 0)
+  {
+    printf("XDMA device open failed for %s data\n", Engine->Name);
+    return true;
+  }
+  Engine->UseBypass = (MaxTransfer != 0) && DMABypassCovers(Engine->AXIAddr, MaxTransfer);
+  if (Engine->UseBypass)
+    printf("%s data %s through the DMA bypass BAR\n", Engine->Name, Engine->ToFPGA ? "written" : "read");
+  else if (Engine->ToFPGA && (RingSize != 0) && P2Config.TXStreamRing)
+  {
+    if (StartDMAStreamRing(&Engine->Ring, Engine->fd, RingSize, RingBlockSize, Engine->AXIAddr))
+      printf("%s streaming ring not available; using write()\n", Engine->Name);
+    else
+      printf("%s streaming ring started\n", Engine->Name);
+  }
+  if ((Engine->Buffer != NULL) && !StreamRingActive(Engine)
+      && !DMARegisterBuffer(Engine->fd, Engine->Buffer, Engine->BufferSize) && UseDebug)
+    printf("%s DMA buffer registered with the driver\n", Engine->Name);
+  return false;
+}
+
+
+void StartStreamFIFO(struct StreamEngine* Engine)
+{
+  uint32_t RegisterValue;
+
+  SetupFIFOMonitorChannel(Engine->Channel, false);
+  ResetDMAStreamFIFO(Engine->Channel);
+  RegisterValue = ReadFIFOMonitorChannel(Engine->Channel, &Engine->FIFOOverflow, &Engine->FIFOOverThreshold,
+                                         &Engine->FIFOUnderflow, &Engine->Current);     // clears the flags
+  if (UseDebug)
+    printf("%s FIFO Depth register = %08x\n", Engine->Name, RegisterValue);
+}
+
+
+void RestartStreamStartup(struct StreamEngine* Engine)
+{
+  Engine->StartupCount = P2Config.StartupDelay;
+}
+
+
+void CountStreamStartup(struct StreamEngine* Engine, uint32_t Work)
+{
+  if (Engine->StartupCount > Work)
+    Engine->StartupCount -= Work;
+  else
+    Engine->StartupCount = 0;
+}
+
+
+//
+// an overflow of a read FIFO, or an underflow of a write FIFO, is flagged to the client and counted
+//
+void NoteStreamFIFO(struct StreamEngine* Engine)
+{
+  TelemetryFIFODepth(Engine->Telemetry, Engine->Current, DMAFIFODepths[Engine->Channel]);
+  if (Engine->StartupCount != 0)
+    return;
+  if (StreamFIFOError(Engine))
+  {
+    GlobalFIFOOverflows |= Engine->FIFOErrorBit;
+    if (Engine->ToFPGA)
+      TelemetryCountUnderflow(Engine->Telemetry);
+    else
+      TelemetryCountOverflow(Engine->Telemetry);
+    if (UseDebug)
+      printf("%s FIFO %s, depth now = %d\n", Engine->Name, Engine->ToFPGA ? "Underflowed" : "Overthreshold", Engine->Current);
+  }
+  else if (Engine->ToFPGA && Engine->FIFOOverThreshold && Engine->ReportFull && UseDebug)
+    printf("%s FIFO Overthreshold, depth now = %d\n", Engine->Name, Engine->Current);
+}
+
+
+uint32_t ReadStreamFIFO(struct StreamEngine* Engine)
+{
+  uint32_t Depth;
+
+  Depth = ReadFIFOMonitorChannel(Engine->Channel, &Engine->FIFOOverflow, &Engine->FIFOOverThreshold,
+                                 &Engine->FIFOUnderflow, &Engine->Current);
+  NoteStreamFIFO(Engine);
+  return Depth;
+}
+
+
+uint32_t WaitStreamFIFO(struct StreamEngine* Engine, uint32_t Locations, uint32_t Timeout)
+{
+  uint32_t Depth;
+
+  HeartbeatDMA(Engine->Beat, eBeatFIFOWait, Locations * 8, Engine->Current);
+  Depth = WaitFIFOMonitorChannel(Engine->Channel, Locations, Timeout, &Engine->FIFOOverflow, &Engine->FIFOOverThreshold,
+                                 &Engine->FIFOUnderflow, &Engine->Current);
+  NoteStreamFIFO(Engine);
+  return Depth;
+}
+
+
+int TransferStreamDMA(struct StreamEngine* Engine, uint8_t* Data, uint32_t Length)
+{
+  int Result;
+
+  HeartbeatDMA(Engine->Beat, Engine->ToFPGA ? eBeatDMAWrite : eBeatDMARead, Length, Engine->Current);
+  if (Engine->UseBypass)
+    Result = Engine->ToFPGA ? DMABypassWriteToFPGA(Data, Length, Engine->AXIAddr)
+                            : DMABypassReadFromFPGA(Data, Length, Engine->AXIAddr);
+  else if (StreamRingActive(Engine))
+    Result = WriteDMAStreamRing(&Engine->Ring, Engine->fd, Data, Length);
+  else if (Engine->ToFPGA)
+    Result = DMAWriteToFPGA(Engine->fd, Data, Length, Engine->AXIAddr);
+  else
+    Result = DMAReadFromFPGA(Engine->fd, Data, Length, Engine->AXIAddr);
+  if (Result != 0)
+    HeartbeatError(Engine->Beat, -Result);
+  else
+    TelemetryCountDMA(Engine->Telemetry, Length);
+  return Result;
+}
+
+
+void DrainStreamDMA(struct StreamEngine* Engine)
+{
+  if (StreamRingActive(Engine))
+    WriteDMAStreamRing(&Engine->Ring, Engine->fd, NULL, 0);
+}
+
+
+bool RecoverStreamDMA(struct StreamEngine* Engine, int Result)
+{
+  bool UseRing = StreamRingActive(Engine);
+
+  StopDMAStreamRing(&Engine->Ring, Engine->fd);
+  if (RecoverDMAStream(Engine->Channel, &Engine->fd, Engine->Device, Result))
+    return true;
+  if (UseRing && StartDMAStreamRing(&Engine->Ring, Engine->fd, Engine->RingSize, Engine->RingBlockSize, Engine->AXIAddr))
+    printf("%s streaming ring not restarted; using write()\n", Engine->Name);
+  return false;
+}
@@ -0,0 +1,182 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// streamengine.h:
+//
+// header: the DMA side of a stream thread, shared by the DDC, mic, DUC and
+// speaker threads
+//
+// an engine is one FPGA stream FIFO and its XDMA channel: the DMA buffer (made
+// in the stream arena, transfers starting VSTREAMBASE into it), the device, the
+// FIFO monitor channel, and the transfer path: the DMA bypass BAR if it covers
+// the largest transfer, else (H2C, with tx_stream_ring set) the driver's
+// streaming ring, else read() / write(). Every transfer, FIFO monitor reading
+// and recovery goes through here, so the heartbeat, telemetry and error
+// reporting are the same for each stream.
+// FIFO errors are only reported once the startup count (setting startup_delay)
+// has run down; the thread counts it down by its own unit of work.
+// the threads keep their own packet handling: each P2 stream's format and
+// pacing is different.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __streamengine_h
+#define __streamengine_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/saturndrivers.h"
+#include "../common/ringbuffer.h"
+#include "telemetry.h"
+
+
+#define VSTREAMALIGNMENT 4096                   // DMA buffer alignment
+#define VSTREAMBASE 0x1000                      // offset into the DMA buffer for transfers to start
+
+
+struct StreamEngine
+{
+  const char* Name;                             // for messages, eg "Codec Mic"
+  EDMAStreamSelect Channel;                     // FIFO monitor channel
+  const char* Device;                           // XDMA device name, as saturnregisters.h
+  uint32_t AXIAddr;                             // stream address in the FPGA
+  bool ToFPGA;                                  // true for an H2C (write) stream
+  ETelemetryStream Telemetry;
+  uint32_t Beat;                                // EBeatThread of the thread
+  uint8_t FIFOErrorBit;                         // GlobalFIFOOverflows bit of an overflow (C2H) or underflow (H2C)
+  bool ReportFull;                              // H2C: print over threshold readings (with -debug)
+  uint8_t* Buffer;                              // DMA buffer; NULL if none
+  uint32_t BufferSize;
+  uint8_t* BasePtr;                             // Buffer + VSTREAMBASE
+  int fd;                                       // device; -1 if not open
+  bool UseBypass;                               // true if transferred through the bypass BAR
+  struct SPSCRingBuffer Ring;                   // H2C streaming ring; Base NULL if not used
+  uint32_t RingSize;                            // its size and descriptor size; 0 if not wanted
+  uint32_t RingBlockSize;
+  unsigned int StartupCount;                    // work before FIFO errors are reported
+  bool FIFOOverflow;                            // flags of the last FIFO monitor reading
+  bool FIFOOverThreshold;
+  bool FIFOUnderflow;
+  unsigned int Current;                         // occupied locations at the last reading
+};
+
+
+//
+// InitStreamEngine(struct StreamEngine* Engine, const char* Name, EDMAStreamSelect Channel, const char* Device,
+//                  uint32_t AXIAddr, bool ToFPGA, ETelemetryStream Telemetry, uint32_t Beat, uint8_t FIFOErrorBit)
+// set up an engine, before OpenStreamEngine()
+//
+void InitStreamEngine(struct StreamEngine* Engine, const char* Name, EDMAStreamSelect Channel, const char* Device,
+                      uint32_t AXIAddr, bool ToFPGA, ETelemetryStream Telemetry, uint32_t Beat, uint8_t FIFOErrorBit);
+
+
+//
+// OpenStreamEngine(struct StreamEngine* Engine, uint32_t BufferSize, uint32_t MaxTransfer,
+//                  uint32_t RingSize, uint32_t RingBlockSize)
+// make the DMA buffer (none if BufferSize is 0) and open the device. Transfers use the
+// bypass BAR if MaxTransfer is not 0 and the BAR covers it; else an H2C stream with a
+// RingSize uses the streaming ring, if tx_stream_ring is set; else read() / write() on
+// the buffer registered with the driver.
+// return true if error
+//
+bool OpenStreamEngine(struct StreamEngine* Engine, uint32_t BufferSize, uint32_t MaxTransfer,
+                      uint32_t RingSize, uint32_t RingBlockSize);
+
+
+//
+// StartStreamFIFO(struct StreamEngine* Engine)
+// set up the FIFO monitor channel, reset the FIFO and clear the monitor flags
+//
+void StartStreamFIFO(struct StreamEngine* Engine);
+
+
+//
+// RestartStreamStartup(struct StreamEngine* Engine)
+// at the start of a run: FIFO errors are not reported for the next startup_delay work
+//
+void RestartStreamStartup(struct StreamEngine* Engine);
+
+
+//
+// CountStreamStartup(struct StreamEngine* Engine, uint32_t Work)
+// count down the startup delay by Work (messages, or FIFO readings)
+//
+void CountStreamStartup(struct StreamEngine* Engine, uint32_t Work);
+
+
+//
+// ReadStreamFIFO(struct StreamEngine* Engine)
+// read the FIFO monitor, note its depth in telemetry and report any error.
+// returns the locations available: occupied (C2H) or free (H2C)
+//
+uint32_t ReadStreamFIFO(struct StreamEngine* Engine);
+
+
+//
+// WaitStreamFIFO(struct StreamEngine* Engine, uint32_t Locations, uint32_t Timeout)
+// as ReadStreamFIFO(), waiting up to Timeout us for Locations to be available
+//
+uint32_t WaitStreamFIFO(struct StreamEngine* Engine, uint32_t Locations, uint32_t Timeout);
+
+
+//
+// NoteStreamFIFO(struct StreamEngine* Engine)
+// act on a FIFO monitor reading made into the engine's flags by other means,
+// eg ReadFIFOAvailableDMA(), as ReadStreamFIFO() does
+//
+void NoteStreamFIFO(struct StreamEngine* Engine);
+
+
+//
+// StreamFIFOError(struct StreamEngine* Engine)
+// true if the last reading was reported as an overflow (C2H) or underflow (H2C)
+//
+static inline bool StreamFIFOError(struct StreamEngine* Engine)
+{
+  return (Engine->StartupCount == 0) && (Engine->ToFPGA ? Engine->FIFOUnderflow : Engine->FIFOOverThreshold);
+}
+
+
+//
+// StreamRingActive(struct StreamEngine* Engine)
+// true if transfers go through the streaming ring: the FPGA holds the engine off
+// while the FIFO is full, so its depth needn't be read before a write
+//
+static inline bool StreamRingActive(struct StreamEngine* Engine)
+{
+  return Engine->Ring.Base != NULL;
+}
+
+
+//
+// TransferStreamDMA(struct StreamEngine* Engine, uint8_t* Data, uint32_t Length)
+// DMA Length bytes between Data and the FPGA, by the engine's path
+// return 0, or a negative errno as DMAReadFromFPGA() / DMAWriteToFPGA()
+//
+int TransferStreamDMA(struct StreamEngine* Engine, uint8_t* Data, uint32_t Length);
+
+
+//
+// DrainStreamDMA(struct StreamEngine* Engine)
+// wait for a streaming ring to be read out, eg before the FIFO is reset
+//
+void DrainStreamDMA(struct StreamEngine* Engine);
+
+
+//
+// RecoverStreamDMA(struct StreamEngine* Engine, int Result)
+// recover after a failed transfer (see RecoverDMAStream()); a streaming ring is
+// stopped for the engine reset and started again
+// return true if the device could not be opened again
+//
+bool RecoverStreamDMA(struct StreamEngine* Engine, int Result);
+
+
+#endif
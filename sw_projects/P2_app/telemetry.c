@@ -0,0 +1,1113 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// telemetry.c:
+//
+// per stream telemetry server
+// a thread samples the counters once per second to work out rates, and
+// answers connections to a UNIX socket with a report, eg:
+//   socat - UNIX-CONNECT:/tmp/p2app.telemetry
+//   echo text | socat - UNIX-CONNECT:/tmp/p2app.telemetry
+// and, if enabled, HTTP requests for Prometheus metrics, eg:
+//   curl http://saturn:9101/metrics                   (p2app -M 9101)
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "telemetry.h"
+#include "threadplacement.h"
+#include "../common/auxadc.h"
+#include "../common/regqueue.h"
+#include "pcapcapture.h"
+#include "heartbeat.h"
+#include "stageprofile.h"
+#include "pluginhost.h"
+#include "keyedges.h"
+#include "adcoverload.h"
+#include "pscapture.h"
+#include "ppstime.h"
+#include "p2config.h"
+#include "OutDDCIQ.h"
+
+
+#define VTELSAMPLEPERIOD 1000                   // ms between rate samples
+#define VTELREQUESTWAIT 100                     // ms to wait for a client's format request
+#define VTELREPORTSIZE 24576                    // bytes, big enough for a report of all streams and threads
+#define VTELMETRICSSIZE 65536                   // bytes, big enough for the metrics of all streams
+#define VTELHTTPREQUESTSIZE 512                 // bytes of an HTTP request read; only the 1st line is used
+
+struct StreamTelemetry Telemetry[VNUMTELSTREAMS];
+
+char* TelemetryStreamNames[VNUMTELSTREAMS] =
+{
+  "ddc0", "ddc1", "ddc2", "ddc3", "ddc4", "ddc5", "ddc6", "ddc7", "ddc8", "ddc9",
+  "ddcdma", "mic", "duc", "speaker", "wideband", "highpri", "status"
+};
+
+struct RadioTelemetry RadioTelemetry;
+
+int TelemetrySocketid = -1;                     // UNIX listening socket
+int MetricsSocketid = -1;                       // HTTP listening socket
+pthread_t TelemetryThread;
+bool TelemetryThreadStarted;
+
+//
+// rates, worked out each sample period by the server thread
+//
+uint64_t LastPackets[VNUMTELSTREAMS];
+uint64_t LastBytes[VNUMTELSTREAMS];
+uint64_t LastDMABytes[VNUMTELSTREAMS];
+uint32_t PacketRate[VNUMTELSTREAMS];            // packets/s
+uint32_t ByteRate[VNUMTELSTREAMS];              // UDP bytes/s
+uint32_t DMARate[VNUMTELSTREAMS];               // DMA bytes/s
+uint64_t LastRegisterWrites, LastRegisterSkips;
+uint32_t RegisterWriteRate;                     // shadowed register writes/s
+uint32_t RegisterSkipRate;                      // shadowed register writes/s skipped as unchanged
+
+
+
+//
+// work out rates from the change in counters since the last call
+//
+static void SampleTelemetryRates(uint64_t Elapsed)
+{
+  uint32_t Stream;
+  uint64_t Packets, Bytes, DMABytes;
+  uint64_t Writes, Skips;
+
+  if (Elapsed == 0)
+    return;
+  for (Stream = 0; Stream < VNUMTELSTREAMS; Stream++)
+  {
+    Packets = atomic_load_explicit(&Telemetry[Stream].Packets, memory_order_relaxed);
+    Bytes = atomic_load_explicit(&Telemetry[Stream].Bytes, memory_order_relaxed);
+    DMABytes = atomic_load_explicit(&Telemetry[Stream].DMABytes, memory_order_relaxed);
+    PacketRate[Stream] = ((Packets - LastPackets[Stream]) * 1000000ULL) / Elapsed;
+    ByteRate[Stream] = ((Bytes - LastBytes[Stream]) * 1000000ULL) / Elapsed;
+    DMARate[Stream] = ((DMABytes - LastDMABytes[Stream]) * 1000000ULL) / Elapsed;
+    LastPackets[Stream] = Packets;
+    LastBytes[Stream] = Bytes;
+    LastDMABytes[Stream] = DMABytes;
+  }
+  GetRegisterWriteCounts(&Writes, &Skips);
+  RegisterWriteRate = ((Writes - LastRegisterWrites) * 1000000ULL) / Elapsed;
+  RegisterSkipRate = ((Skips - LastRegisterSkips) * 1000000ULL) / Elapsed;
+  LastRegisterWrites = Writes;
+  LastRegisterSkips = Skips;
+}
+
+
+//
+// find a percentile of a latency histogram
+// returns the upper bound of the bin holding it, in us
+//
+static uint32_t LatencyPercentile(_Atomic uint32_t* Bins, uint32_t Percent)
+{
+  uint64_t Total = 0;
+  uint64_t Count = 0;
+  uint32_t Bin;
+
+  for (Bin = 0; Bin < VTELLATENCYBINS; Bin++)
+    Total += atomic_load_explicit(&Bins[Bin], memory_order_relaxed);
+  if (Total == 0)
+    return 0;
+  for (Bin = 0; Bin < VTELLATENCYBINS; Bin++)
+  {
+    Count += atomic_load_explicit(&Bins[Bin], memory_order_relaxed);
+    if (Count * 100 >= Total * Percent)
+      break;
+  }
+  return 1 << Bin;
+}
+
+
+//
+// print an array of histogram counts
+//
+static int PrintHistogram(char* Dest, uint32_t Length, _Atomic uint32_t* Bins, uint32_t NumBins, char* Separator)
+{
+  uint32_t Bin;
+  int Used = 0;
+
+  for (Bin = 0; (Bin < NumBins) && (Used < (int)Length); Bin++)
+    Used += snprintf(Dest + Used, Length - Used, "%s%u", (Bin == 0) ? "" : Separator,
+                     atomic_load_explicit(&Bins[Bin], memory_order_relaxed));
+  return Used;
+}
+
+
+//
+// create a report of all streams that have seen any activity,
+// and of register writes made and skipped. Returns its length
+//
+static int MakeTelemetryReport(char* Report, uint32_t Length, bool UseJSON)
+{
+  uint32_t Stream;
+  struct StreamTelemetry* Tel;
+  int Used = 0;
+  bool First = true;
+  uint64_t Writes, Skips;
+  uint64_t Calls, Bytes;
+  struct StageTotals* Totals;
+  struct DDCPluginStatistics Plugin;
+  struct KeyEdgeStatistics Keys;
+  struct ADCOverloadStatistics Overload;
+  struct DiversityStatus Diversity;
+  struct PSCaptureStatistics Capture;
+  struct PPSStatistics PPS;
+  struct ThreadAccounting Threads[VMAXTRACKEDTHREADS];
+  uint32_t Bin, Thread, NumThreads;
+
+#define REPORT(...)  do { if (Used < (int)Length) Used += snprintf(Report + Used, Length - Used, __VA_ARGS__); } while (0)
+#define HISTOGRAM(Bins, Num, Sep) if (Used < (int)Length) Used += PrintHistogram(Report + Used, Length - Used, Bins, Num, Sep)
+
+  REPORT(UseJSON ? "{\"streams\":{" : "");
+  for (Stream = 0; Stream < VNUMTELSTREAMS; Stream++)
+  {
+    Tel = Telemetry + Stream;
+    if ((atomic_load_explicit(&Tel->Packets, memory_order_relaxed) == 0) &&
+        (atomic_load_explicit(&Tel->DMATransfers, memory_order_relaxed) == 0) &&
+        (atomic_load_explicit(&Tel->SendErrors, memory_order_relaxed) == 0))
+      continue;
+    if (UseJSON)
+    {
+      REPORT("%s\"%s\":{\"packets\":%llu,\"bytes\":%llu,\"packets_per_s\":%u,\"bytes_per_s\":%u,"
+             "\"dma_transfers\":%llu,\"dma_bytes\":%llu,\"dma_bytes_per_s\":%u,"
+             "\"overflows\":%u,\"underflows\":%u,\"send_errors\":%u,\"resyncs\":%u,",
+             First ? "" : ",", TelemetryStreamNames[Stream],
+             (unsigned long long)atomic_load(&Tel->Packets), (unsigned long long)atomic_load(&Tel->Bytes),
+             PacketRate[Stream], ByteRate[Stream],
+             (unsigned long long)atomic_load(&Tel->DMATransfers), (unsigned long long)atomic_load(&Tel->DMABytes),
+             DMARate[Stream], atomic_load(&Tel->Overflows), atomic_load(&Tel->Underflows), atomic_load(&Tel->SendErrors),
+             atomic_load(&Tel->Resyncs));
+      REPORT("\"send_again\":%u,\"seq_gaps\":%u,\"seq_reorders\":%u,\"seq_duplicates\":%u,\"seq_restarts\":%u,",
+             atomic_load(&Tel->SendAgains), atomic_load(&Tel->SeqGaps), atomic_load(&Tel->SeqReorders),
+             atomic_load(&Tel->SeqDuplicates), atomic_load(&Tel->SeqRestarts));
+      REPORT("\"samples_shed\":%llu,\"concealed\":%u,\"late\":%u,", (unsigned long long)atomic_load(&Tel->SamplesShed),
+             atomic_load(&Tel->Concealed), atomic_load(&Tel->Late));
+      REPORT("\"dma_size_hist\":[");
+      HISTOGRAM(Tel->DMASizes, VTELDMABINS, ",");
+      REPORT("],\"fifo_depth_hist\":[");
+      HISTOGRAM(Tel->FIFODepths, VTELDEPTHBINS, ",");
+      REPORT("],\"loop_us_hist\":[");
+      HISTOGRAM(Tel->LoopTimes, VTELLATENCYBINS, ",");
+      REPORT("],\"loop_us_p50\":%u,\"loop_us_p99\":%u,\"loop_us_max\":%u,\"buffer_fill\":%u,\"buffer_fill_max\":%u,",
+             LatencyPercentile(Tel->LoopTimes, 50), LatencyPercentile(Tel->LoopTimes, 99), atomic_load(&Tel->MaxLoopTime),
+             atomic_load(&Tel->BufferFill), atomic_load(&Tel->MaxBufferFill));
+      REPORT("\"receive_us_hist\":[");
+      HISTOGRAM(Tel->ReceiveDelays, VTELLATENCYBINS, ",");
+      REPORT("],\"receive_us_p50\":%u,\"receive_us_p99\":%u,\"receive_us_max\":%u,\"stack_us_hist\":[",
+             LatencyPercentile(Tel->ReceiveDelays, 50), LatencyPercentile(Tel->ReceiveDelays, 99),
+             atomic_load(&Tel->MaxReceiveDelay));
+      HISTOGRAM(Tel->StackDelays, VTELLATENCYBINS, ",");
+      REPORT("]}");
+    }
+    else
+    {
+      REPORT("%s: packets %llu (%u/s), bytes %llu (%u/s), DMA %llu transfers %llu bytes (%u/s)\n",
+             TelemetryStreamNames[Stream],
+             (unsigned long long)atomic_load(&Tel->Packets), PacketRate[Stream],
+             (unsigned long long)atomic_load(&Tel->Bytes), ByteRate[Stream],
+             (unsigned long long)atomic_load(&Tel->DMATransfers), (unsigned long long)atomic_load(&Tel->DMABytes),
+             DMARate[Stream]);
+      REPORT("  overflows %u, underflows %u, send errors %u (%u no buffer), resyncs %u\n",
+             atomic_load(&Tel->Overflows), atomic_load(&Tel->Underflows), atomic_load(&Tel->SendErrors),
+             atomic_load(&Tel->SendAgains), atomic_load(&Tel->Resyncs));
+      REPORT("  sequence gaps %u, reorders %u, duplicates %u, restarts %u\n",
+             atomic_load(&Tel->SeqGaps), atomic_load(&Tel->SeqReorders),
+             atomic_load(&Tel->SeqDuplicates), atomic_load(&Tel->SeqRestarts));
+      REPORT("  DMA size (<1K..>=64K): ");
+      HISTOGRAM(Tel->DMASizes, VTELDMABINS, " ");
+      REPORT("\n  FIFO depth (eighths): ");
+      HISTOGRAM(Tel->FIFODepths, VTELDEPTHBINS, " ");
+      REPORT("\n  loop time (log2 us): ");
+      HISTOGRAM(Tel->LoopTimes, VTELLATENCYBINS, " ");
+      REPORT("\n  loop time p50 %uus, p99 %uus, max %uus\n",
+             LatencyPercentile(Tel->LoopTimes, 50), LatencyPercentile(Tel->LoopTimes, 99), atomic_load(&Tel->MaxLoopTime));
+      if (LatencyPercentile(Tel->ReceiveDelays, 100) != 0)
+      {
+        REPORT("  receive delay (log2 us): ");
+        HISTOGRAM(Tel->ReceiveDelays, VTELLATENCYBINS, " ");
+        REPORT("\n  receive delay p50 %uus, p99 %uus, max %uus\n",
+               LatencyPercentile(Tel->ReceiveDelays, 50), LatencyPercentile(Tel->ReceiveDelays, 99),
+               atomic_load(&Tel->MaxReceiveDelay));
+        if (LatencyPercentile(Tel->StackDelays, 100) != 0)
+        {
+          REPORT("  NIC to kernel (log2 us): ");
+          HISTOGRAM(Tel->StackDelays, VTELLATENCYBINS, " ");
+          REPORT("\n");
+        }
+      }
+      if (atomic_load(&Tel->SamplesShed) != 0)
+      {
+        REPORT("  samples shed under overload %llu\n", (unsigned long long)atomic_load(&Tel->SamplesShed));
+      }
+      if (atomic_load(&Tel->MaxBufferFill) != 0)
+      {
+        REPORT("  jitter buffer %u frames (max %u)\n", atomic_load(&Tel->BufferFill), atomic_load(&Tel->MaxBufferFill));
+      }
+      if ((atomic_load(&Tel->Concealed) != 0) || (atomic_load(&Tel->Late) != 0))
+      {
+        REPORT("  frames concealed %u, dropped as late %u\n", atomic_load(&Tel->Concealed), atomic_load(&Tel->Late));
+      }
+    }
+    First = false;
+  }
+  GetRegisterWriteCounts(&Writes, &Skips);
+  if (UseJSON)
+  {
+    REPORT("},\"registers\":{\"writes\":%llu,\"skipped\":%llu,\"writes_per_s\":%u,\"skipped_per_s\":%u}",
+           (unsigned long long)Writes, (unsigned long long)Skips, RegisterWriteRate, RegisterSkipRate);
+  }
+  else
+  {
+    REPORT("registers: writes %llu (%u/s), skipped as unchanged %llu (%u/s)\n",
+           (unsigned long long)Writes, RegisterWriteRate, (unsigned long long)Skips, RegisterSkipRate);
+  }
+  //
+  // pipeline stage CPU cost, for the stages profiled so far
+  //
+  REPORT(UseJSON ? ",\"stages\":{\"source\":\"%s\"" : "stage profile: %s\n", GetStageSourceName());
+  for (Stream = 0; Stream < VNUMPROFILESTAGES; Stream++)
+  {
+    Totals = StageTotals + Stream;
+    Calls = atomic_load_explicit(&Totals->Calls, memory_order_relaxed);
+    Bytes = atomic_load_explicit(&Totals->Bytes, memory_order_relaxed);
+    if ((Calls == 0) || (Bytes == 0))
+      continue;
+    if (UseJSON)
+      REPORT(",\"%s\":{\"calls\":%llu,\"bytes\":%llu,\"cycles_per_byte\":%.3f,\"instructions_per_byte\":%.3f,"
+             "\"ns_per_byte\":%.3f}", GetStageName(Stream), (unsigned long long)Calls, (unsigned long long)Bytes,
+             (double)atomic_load(&Totals->Cycles) / Bytes, (double)atomic_load(&Totals->Instructions) / Bytes,
+             (double)atomic_load(&Totals->Nanoseconds) / Bytes);
+    else
+      REPORT("  %s: %llu calls, %llu bytes, %.3f cycles/byte, %.3f instructions/byte, %.3f ns/byte\n",
+             GetStageName(Stream), (unsigned long long)Calls, (unsigned long long)Bytes,
+             (double)atomic_load(&Totals->Cycles) / Bytes, (double)atomic_load(&Totals->Instructions) / Bytes,
+             (double)atomic_load(&Totals->Nanoseconds) / Bytes);
+  }
+  REPORT(UseJSON ? "}" : "");
+  //
+  // DDC plugins and their CPU use
+  //
+  if (DDCPluginCount != 0)
+  {
+    REPORT(UseJSON ? ",\"plugins\":[" : "DDC plugins: budget %u%%\n", P2Config.DDCPluginBudget);
+    for (Stream = 0; Stream < DDCPluginCount; Stream++)
+    {
+      GetDDCPluginStatistics(Stream, &Plugin);
+      if (UseJSON)
+      {
+        REPORT("%s{\"name\":\"%s\",\"calls\":%llu,\"samples\":%llu,\"dropped\":%llu,\"ns\":%llu,"
+               "\"max_ns\":%u,\"overruns\":%llu,\"annotations\":%llu,\"bypassed\":%s}", Stream ? "," : "",
+               Plugin.Name, (unsigned long long)Plugin.Calls, (unsigned long long)Plugin.Samples,
+               (unsigned long long)Plugin.Dropped, (unsigned long long)Plugin.Nanoseconds, Plugin.MaxNanoseconds,
+               (unsigned long long)Plugin.Overruns, (unsigned long long)Plugin.Annotations,
+               Plugin.Bypassed ? "true" : "false");
+      }
+      else
+      {
+        REPORT("  %s: %llu calls, %llu samples, %llu dropped, %.3f ns/sample, max %u ns, %llu overruns, "
+               "%llu annotations%s\n", Plugin.Name, (unsigned long long)Plugin.Calls,
+               (unsigned long long)Plugin.Samples, (unsigned long long)Plugin.Dropped,
+               Plugin.Samples ? (double)Plugin.Nanoseconds / Plugin.Samples : 0.0, Plugin.MaxNanoseconds,
+               (unsigned long long)Plugin.Overruns, (unsigned long long)Plugin.Annotations,
+               Plugin.Bypassed ? ", bypassed" : "");
+      }
+    }
+    REPORT(UseJSON ? "]" : "");
+  }
+  //
+  // CW key and PTT edges: poll gap and detection to send delay
+  //
+  GetKeyEdgeStatistics(&Keys);
+  if (Keys.Edges != 0)
+  {
+    if (UseJSON)
+    {
+      REPORT(",\"key_edges\":{\"edges\":%llu,\"watched\":%llu,\"bits\":%u,\"poll_gap_us\":%llu,"
+             "\"max_poll_gap_us\":%u,\"send_delay_us\":%llu,\"max_send_delay_us\":%u,\"send_delays\":[",
+             (unsigned long long)Keys.Edges, (unsigned long long)Keys.Watched, Keys.LastBits,
+             (unsigned long long)Keys.TotalPollGap, Keys.MaxPollGap,
+             (unsigned long long)Keys.TotalSendDelay, Keys.MaxSendDelay);
+      for (Bin = 0; Bin < VTELLATENCYBINS; Bin++)
+        REPORT("%s%u", Bin ? "," : "", Keys.SendDelays[Bin]);
+      REPORT("]}");
+    }
+    else
+    {
+      REPORT("key edges: %llu (%llu by key watch), bits now 0x%02x, poll gap mean %.1fus max %uus, "
+             "send delay mean %.1fus max %uus\n  send delay (log2 us):", (unsigned long long)Keys.Edges,
+             (unsigned long long)Keys.Watched, Keys.LastBits, (double)Keys.TotalPollGap / Keys.Edges,
+             Keys.MaxPollGap, (double)Keys.TotalSendDelay / Keys.Edges, Keys.MaxSendDelay);
+      for (Bin = 0; Bin < VTELLATENCYBINS; Bin++)
+        REPORT(" %u", Keys.SendDelays[Bin]);
+      REPORT("\n");
+    }
+  }
+  //
+  // ADC overloads: count and duration per ADC, and detection to report delay
+  //
+  GetADCOverloadStatistics(&Overload);
+  if ((Overload.Overloads[0] + Overload.Overloads[1]) != 0)
+  {
+    if (UseJSON)
+      REPORT(",\"adc_overload\":{\"watch\":%s,\"interrupt\":%s,\"active\":%u,\"overloads\":[%llu,%llu],"
+             "\"duration_us\":[%llu,%llu],\"max_duration_us\":[%u,%u],\"reports\":%llu,"
+             "\"report_delay_us\":%llu,\"max_report_delay_us\":%u}",
+             Overload.Watching ? "true" : "false", Overload.Interrupt ? "true" : "false", Overload.Active,
+             (unsigned long long)Overload.Overloads[0], (unsigned long long)Overload.Overloads[1],
+             (unsigned long long)Overload.TotalDuration[0], (unsigned long long)Overload.TotalDuration[1],
+             Overload.MaxDuration[0], Overload.MaxDuration[1], (unsigned long long)Overload.Reports,
+             (unsigned long long)Overload.TotalReportDelay, Overload.MaxReportDelay);
+    else
+      REPORT("ADC overloads: ADC1 %llu (%lluus, max %uus), ADC2 %llu (%lluus, max %uus), active 0x%x; "
+             "%llu reported%s, delay mean %.1fus max %uus\n",
+             (unsigned long long)Overload.Overloads[0], (unsigned long long)Overload.TotalDuration[0],
+             Overload.MaxDuration[0], (unsigned long long)Overload.Overloads[1],
+             (unsigned long long)Overload.TotalDuration[1], Overload.MaxDuration[1], Overload.Active,
+             (unsigned long long)Overload.Reports,
+             Overload.Watching ? (Overload.Interrupt ? " (watched, interrupt)" : " (watched)") : "",
+             Overload.Reports ? (double)Overload.TotalReportDelay / Overload.Reports : 0.0,
+             Overload.MaxReportDelay);
+  }
+  //
+  // diversity combining: the secondary weight in use
+  //
+  GetDiversityStatus(&Diversity);
+  if (Diversity.Active)
+  {
+    if (UseJSON)
+      REPORT(",\"diversity\":{\"primary\":%u,\"secondary\":%u,\"gain\":%.3f,\"phase\":%.1f,\"samples\":%llu}",
+             Diversity.Primary, Diversity.Secondary, Diversity.Gain, Diversity.Phase,
+             (unsigned long long)Diversity.Samples);
+    else
+      REPORT("diversity: DDC%u combined into DDC%u, weight %.3f at %.1f degrees, %llu samples\n",
+             Diversity.Secondary, Diversity.Primary, Diversity.Gain, Diversity.Phase,
+             (unsigned long long)Diversity.Samples);
+  }
+  //
+  // PureSignal capture blocks
+  //
+  GetPSCaptureStatistics(&Capture);
+  if (Capture.Active || (Capture.Blocks != 0))
+  {
+    if (UseJSON)
+      REPORT(",\"ps_capture\":{\"active\":%s,\"ddc\":%u,\"blocks\":%llu,\"aborted\":%llu,\"skipped\":%llu,\"pairs\":%llu}",
+             Capture.Active ? "true" : "false", Capture.EvenDDC, (unsigned long long)Capture.Blocks,
+             (unsigned long long)Capture.Aborted, (unsigned long long)Capture.Skipped, (unsigned long long)Capture.Pairs);
+    else
+      REPORT("PureSignal capture%s: %llu blocks (%llu sample pairs) sent on DDC%u, %llu ended by MOX, %llu skipped\n",
+             Capture.Active ? "" : " (off)", (unsigned long long)Capture.Blocks, (unsigned long long)Capture.Pairs,
+             Capture.EvenDDC, (unsigned long long)Capture.Aborted, (unsigned long long)Capture.Skipped);
+  }
+  //
+  // PPS disciplined timestamps
+  //
+  GetPPSStatistics(&PPS);
+  if (PPS.Enabled)
+  {
+    if (UseJSON)
+      REPORT(",\"pps\":{\"edges\":%llu,\"latches\":%llu,\"missed\":%llu,\"last_second\":%u,\"clock_ppm\":%.3f}",
+             (unsigned long long)PPS.Edges, (unsigned long long)PPS.Latches, (unsigned long long)PPS.Missed,
+             PPS.LastSecond, PPS.ClockPPM);
+    else
+      REPORT("PPS: %llu pulses, %llu latched (%llu missed), last at UTC %u; DDC clock %+.3f ppm\n",
+             (unsigned long long)PPS.Edges, (unsigned long long)PPS.Latches, (unsigned long long)PPS.Missed,
+             PPS.LastSecond, PPS.ClockPPM);
+  }
+  //
+  // CPU time and context switches of each named thread
+  //
+  NumThreads = GetThreadAccounting(Threads, VMAXTRACKEDTHREADS);
+  REPORT(UseJSON ? ",\"threads\":[" : "threads: CPU ms, wakeups, preemptions\n");
+  for (Thread = 0; Thread < NumThreads; Thread++)
+  {
+    if (UseJSON)
+      REPORT("%s{\"name\":\"%s\",\"tid\":%d,\"cpu_ns\":%llu,\"wakeups\":%llu,\"preemptions\":%llu}",
+             Thread ? "," : "", Threads[Thread].Name, Threads[Thread].Tid,
+             (unsigned long long)Threads[Thread].CPUTime, (unsigned long long)Threads[Thread].Wakeups,
+             (unsigned long long)Threads[Thread].Preemptions);
+    else
+      REPORT("  %-20s %6d %10.1f %10llu %10llu\n", Threads[Thread].Name, Threads[Thread].Tid,
+             (double)Threads[Thread].CPUTime / 1e6, (unsigned long long)Threads[Thread].Wakeups,
+             (unsigned long long)Threads[Thread].Preemptions);
+  }
+  REPORT(UseJSON ? "]" : "");
+  REPORT(UseJSON ? "}\n" : "");
+  if (Used >= (int)Length)
+    Used = Length - 1;
+  return Used;
+
+#undef REPORT
+#undef HISTOGRAM
+}
+
+
+//
+// Prometheus histogram of one latency histogram field, for streams that have counts in it
+// the sum is not kept, so it is estimated from the bin lower bounds
+//
+static void LatencyHistogram(char* Report, uint32_t Length, int* Used, const char* Name, const char* Help, size_t Field)
+{
+  _Atomic uint32_t* Bins;
+  uint32_t Stream, Bin;
+  uint64_t Cumulative, Sum;
+
+#define REPORT(...)  do { if (*Used < (int)Length) *Used += snprintf(Report + *Used, Length - *Used, __VA_ARGS__); } while (0)
+
+  REPORT("# HELP saturn_%s %s\n# TYPE saturn_%s histogram\n", Name, Help, Name);
+  for (Stream = 0; Stream < VNUMTELSTREAMS; Stream++)
+  {
+    Bins = (_Atomic uint32_t*)((char*)&Telemetry[Stream] + Field);
+    if (LatencyPercentile(Bins, 100) == 0)
+      continue;
+    Cumulative = 0;
+    Sum = 0;
+    for (Bin = 0; Bin < VTELLATENCYBINS; Bin++)
+    {
+      Cumulative += atomic_load_explicit(&Bins[Bin], memory_order_relaxed);
+      Sum += (Bin == 0) ? 0 : (uint64_t)atomic_load_explicit(&Bins[Bin], memory_order_relaxed) << (Bin - 1);
+      if (Bin == VTELLATENCYBINS - 1)
+      {
+        REPORT("saturn_%s_bucket{stream=\"%s\",le=\"+Inf\"} %llu\n", Name, TelemetryStreamNames[Stream],
+               (unsigned long long)Cumulative);
+      }
+      else
+      {
+        REPORT("saturn_%s_bucket{stream=\"%s\",le=\"%u\"} %llu\n", Name, TelemetryStreamNames[Stream],
+               (1U << Bin) - 1, (unsigned long long)Cumulative);
+      }
+    }
+    REPORT("saturn_%s_sum{stream=\"%s\"} %llu\n", Name, TelemetryStreamNames[Stream], (unsigned long long)Sum);
+    REPORT("saturn_%s_count{stream=\"%s\"} %llu\n", Name, TelemetryStreamNames[Stream], (unsigned long long)Cumulative);
+  }
+
+#undef REPORT
+}
+
+
+//
+// Prometheus text format metrics of all streams and the radio state. Returns its length.
+// rates are left to the monitoring system, from the counters.
+//
+static int MakeMetricsReport(char* Report, uint32_t Length)
+{
+  static const char* FIFONames[VNUMFIFOCHANNELS] = {"ddc", "duc", "mic", "speaker"};
+  static const char* FIFODevices[VNUMFIFOCHANNELS] = {VDDCDMADEVICE, VDUCDMADEVICE, VMICDMADEVICE, VSPKDMADEVICE};
+  static const char* AnalogueUses[VNUMANALOGUEIN] =
+    {"forward_power", "reverse_power", "user_analog1", "user_analog2", "exciter_power", "supply_voltage"};
+  uint32_t Stream, Bin, Cntr;
+  uint64_t Cumulative;
+  uint64_t Writes, Skips;
+  uint64_t Groups, QueuedWrites, Waits;
+  uint64_t Captured, RateLimited, RingFull;
+  struct DMARecoveryCounts Recovery[VNUMFIFOCHANNELS];
+  struct DMAEngineStats Engines[VNUMFIFOCHANNELS];
+  struct DDCPluginStatistics Plugins[VMAXDDCPLUGINS];
+  struct KeyEdgeStatistics Keys;
+  struct ADCOverloadStatistics Overload;
+  struct DiversityStatus Diversity;
+  struct PSCaptureStatistics Capture;
+  struct PPSStatistics PPS;
+  struct ThreadAccounting Threads[VMAXTRACKEDTHREADS];
+  uint32_t NumThreads;
+  bool EngineStats = false;
+  int Used = 0;
+
+#define REPORT(...)  do { if (Used < (int)Length) Used += snprintf(Report + Used, Length - Used, __VA_ARGS__); } while (0)
+#define FAMILY(Name, Type, Help) REPORT("# HELP saturn_" Name " " Help "\n# TYPE saturn_" Name " " Type "\n")
+#define STREAMS(Name, Field)                                                              \
+  for (Stream = 0; Stream < VNUMTELSTREAMS; Stream++)                                     \
+    REPORT("saturn_" Name "{stream=\"%s\"} %llu\n", TelemetryStreamNames[Stream],        \
+           (unsigned long long)atomic_load_explicit(&Telemetry[Stream].Field, memory_order_relaxed))
+#define ENGINES(Name, Type, Help, Field)                                                  \
+  FAMILY(Name, Type, Help);                                                               \
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)                                         \
+    REPORT("saturn_" Name "{fifo=\"%s\"} %llu\n", FIFONames[Cntr], (unsigned long long)Engines[Cntr].Field)
+
+  FAMILY("stream_packets_total", "counter", "UDP packets sent or received");
+  STREAMS("stream_packets_total", Packets);
+  FAMILY("stream_bytes_total", "counter", "UDP payload bytes sent or received");
+  STREAMS("stream_bytes_total", Bytes);
+  FAMILY("stream_overflows_total", "counter", "FIFO over threshold events");
+  STREAMS("stream_overflows_total", Overflows);
+  FAMILY("stream_underflows_total", "counter", "FIFO underflow events");
+  STREAMS("stream_underflows_total", Underflows);
+  FAMILY("stream_send_errors_total", "counter", "failed sends");
+  STREAMS("stream_send_errors_total", SendErrors);
+  FAMILY("stream_send_no_buffer_total", "counter", "failed sends for lack of socket buffer");
+  STREAMS("stream_send_no_buffer_total", SendAgains);
+  FAMILY("stream_resyncs_total", "counter", "times the stream framing was lost and found again");
+  STREAMS("stream_resyncs_total", Resyncs);
+  FAMILY("stream_samples_shed_total", "counter", "DDC samples dropped by overload protection");
+  STREAMS("stream_samples_shed_total", SamplesShed);
+  FAMILY("ddc_shedding", "gauge", "1 while low priority DDCs are shed under overload");
+  REPORT("saturn_ddc_shedding %d\n", IsDDCShedding() ? 1 : 0);
+  GetDiversityStatus(&Diversity);
+  FAMILY("diversity_active", "gauge", "1 while two DDCs are combined into one stream");
+  REPORT("saturn_diversity_active %d\n", Diversity.Active ? 1 : 0);
+  FAMILY("diversity_gain", "gauge", "diversity secondary DDC weight: gain");
+  REPORT("saturn_diversity_gain %.4f\n", Diversity.Gain);
+  FAMILY("diversity_phase_degrees", "gauge", "diversity secondary DDC weight: phase");
+  REPORT("saturn_diversity_phase_degrees %.2f\n", Diversity.Phase);
+  FAMILY("diversity_samples_total", "counter", "samples combined by the diversity combiner");
+  REPORT("saturn_diversity_samples_total %llu\n", (unsigned long long)Diversity.Samples);
+  GetPSCaptureStatistics(&Capture);
+  FAMILY("ps_capture_active", "gauge", "1 while the PureSignal DDC pair is captured in blocks instead of streamed");
+  REPORT("saturn_ps_capture_active %d\n", Capture.Active ? 1 : 0);
+  FAMILY("ps_capture_blocks_total", "counter", "PureSignal capture blocks sent");
+  REPORT("saturn_ps_capture_blocks_total %llu\n", (unsigned long long)Capture.Blocks);
+  FAMILY("ps_capture_aborted_total", "counter", "PureSignal capture blocks dropped because MOX ended");
+  REPORT("saturn_ps_capture_aborted_total %llu\n", (unsigned long long)Capture.Aborted);
+  FAMILY("ps_capture_skipped_total", "counter", "PureSignal capture blocks not taken while the last was still being sent");
+  REPORT("saturn_ps_capture_skipped_total %llu\n", (unsigned long long)Capture.Skipped);
+  FAMILY("ps_capture_pairs_total", "counter", "PureSignal capture sample pairs sent");
+  REPORT("saturn_ps_capture_pairs_total %llu\n", (unsigned long long)Capture.Pairs);
+  GetPPSStatistics(&PPS);
+  if (PPS.Enabled)
+  {
+    FAMILY("pps_edges_total", "counter", "PPS pulses seen");
+    REPORT("saturn_pps_edges_total %llu\n", (unsigned long long)PPS.Edges);
+    FAMILY("pps_latches_total", "counter", "PPS pulses latched in the DDC stream");
+    REPORT("saturn_pps_latches_total %llu\n", (unsigned long long)PPS.Latches);
+    FAMILY("pps_missed_total", "counter", "PPS pulses not latched in the DDC stream");
+    REPORT("saturn_pps_missed_total %llu\n", (unsigned long long)PPS.Missed);
+    FAMILY("pps_last_second", "gauge", "UTC second of the last PPS pulse latched");
+    REPORT("saturn_pps_last_second %u\n", PPS.LastSecond);
+    FAMILY("pps_clock_ppm", "gauge", "DDC stream rate error against PPS, parts per million");
+    REPORT("saturn_pps_clock_ppm %.3f\n", PPS.ClockPPM);
+  }
+  FAMILY("stream_sequence_missing", "gauge", "inbound packets missing by sequence number");
+  STREAMS("stream_sequence_missing", SeqGaps);
+  FAMILY("stream_sequence_reorders_total", "counter", "inbound packets that arrived after a later one");
+  STREAMS("stream_sequence_reorders_total", SeqReorders);
+  FAMILY("stream_sequence_duplicates_total", "counter", "inbound packets received twice");
+  STREAMS("stream_sequence_duplicates_total", SeqDuplicates);
+  FAMILY("stream_sequence_restarts_total", "counter", "inbound sequence restarts");
+  STREAMS("stream_sequence_restarts_total", SeqRestarts);
+  FAMILY("stream_buffer_fill", "gauge", "software jitter buffer fill, frames");
+  STREAMS("stream_buffer_fill", BufferFill);
+  FAMILY("stream_frames_concealed_total", "counter", "missing frames filled in by the reorder buffer");
+  STREAMS("stream_frames_concealed_total", Concealed);
+  FAMILY("stream_frames_late_total", "counter", "frames dropped by the reorder buffer for arriving too late");
+  STREAMS("stream_frames_late_total", Late);
+  FAMILY("stream_loop_max_microseconds", "gauge", "longest loop time");
+  STREAMS("stream_loop_max_microseconds", MaxLoopTime);
+  FAMILY("stream_receive_delay_max_microseconds", "gauge", "longest time from kernel receive stamp to work done");
+  STREAMS("stream_receive_delay_max_microseconds", MaxReceiveDelay);
+
+  //
+  // DMA sizes: bin 0 is <1KB, bin n is [2^(n-1)KB, 2^n KB), the last is open ended
+  //
+  FAMILY("stream_dma_size_bytes", "histogram", "DMA transfer sizes");
+  for (Stream = 0; Stream < VNUMTELSTREAMS; Stream++)
+  {
+    if (atomic_load_explicit(&Telemetry[Stream].DMATransfers, memory_order_relaxed) == 0)
+      continue;
+    Cumulative = 0;
+    for (Bin = 0; Bin < VTELDMABINS; Bin++)
+    {
+      Cumulative += atomic_load_explicit(&Telemetry[Stream].DMASizes[Bin], memory_order_relaxed);
+      if (Bin == VTELDMABINS - 1)
+      {
+        REPORT("saturn_stream_dma_size_bytes_bucket{stream=\"%s\",le=\"+Inf\"} %llu\n",
+               TelemetryStreamNames[Stream], (unsigned long long)Cumulative);
+      }
+      else
+      {
+        REPORT("saturn_stream_dma_size_bytes_bucket{stream=\"%s\",le=\"%u\"} %llu\n",
+               TelemetryStreamNames[Stream], (1024U << Bin) - 1, (unsigned long long)Cumulative);
+      }
+    }
+    REPORT("saturn_stream_dma_size_bytes_sum{stream=\"%s\"} %llu\n", TelemetryStreamNames[Stream],
+           (unsigned long long)atomic_load(&Telemetry[Stream].DMABytes));
+    REPORT("saturn_stream_dma_size_bytes_count{stream=\"%s\"} %llu\n", TelemetryStreamNames[Stream],
+           (unsigned long long)Cumulative);
+  }
+
+  //
+  // receive delays (rx_timestamps): bin 0 is <1us, bin n is [2^(n-1), 2^n) us, the last is open ended
+  //
+  LatencyHistogram(Report, Length, &Used, "stream_receive_delay_microseconds",
+                   "time from kernel receive stamp to DMA done or registers committed", offsetof(struct StreamTelemetry, ReceiveDelays));
+  LatencyHistogram(Report, Length, &Used, "stream_nic_to_kernel_microseconds",
+                   "time from NIC hardware receive stamp to kernel receive stamp", offsetof(struct StreamTelemetry, StackDelays));
+
+  //
+  // radio state from the status reads
+  //
+  FAMILY("status_reads_total", "counter", "status register snapshots read");
+  REPORT("saturn_status_reads_total %u\n", atomic_load(&RadioTelemetry.StatusReads));
+  FAMILY("fifo_depth", "gauge", "FIFO locations occupied at the last status read");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    REPORT("saturn_fifo_depth{fifo=\"%s\"} %u\n", FIFONames[Cntr], atomic_load(&RadioTelemetry.FIFODepth[Cntr]));
+  FAMILY("fifo_size", "gauge", "FIFO size in locations");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    REPORT("saturn_fifo_size{fifo=\"%s\"} %u\n", FIFONames[Cntr], DMAFIFODepths[Cntr]);
+  FAMILY("fifo_over_threshold_total", "counter", "status reads that found the FIFO over threshold");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    REPORT("saturn_fifo_over_threshold_total{fifo=\"%s\"} %u\n", FIFONames[Cntr],
+           atomic_load(&RadioTelemetry.FIFOOverThreshold[Cntr]));
+  FAMILY("fifo_underflow_total", "counter", "status reads that found the FIFO underflowed");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    REPORT("saturn_fifo_underflow_total{fifo=\"%s\"} %u\n", FIFONames[Cntr],
+           atomic_load(&RadioTelemetry.FIFOUnderflows[Cntr]));
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    GetDMARecoveryCounts((EDMAStreamSelect)Cntr, &Recovery[Cntr]);
+  FAMILY("dma_errors_total", "counter", "failed DMA transfers, by class of failure");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    for (Bin = eDMAErrorTimeout; Bin < VNUMDMAERRORCLASSES; Bin++)
+      REPORT("saturn_dma_errors_total{fifo=\"%s\",class=\"%s\"} %u\n", FIFONames[Cntr],
+             GetDMAErrorClassName((EDMAErrorClass)Bin), Recovery[Cntr].Errors[Bin]);
+  FAMILY("dma_recoveries_total", "counter", "DMA engine and FIFO resets after a failed transfer");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    REPORT("saturn_dma_recoveries_total{fifo=\"%s\"} %u\n", FIFONames[Cntr], Recovery[Cntr].Recoveries);
+  FAMILY("dma_recovery_failures_total", "counter", "DMA recoveries where the device could not be opened again");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    REPORT("saturn_dma_recovery_failures_total{fifo=\"%s\"} %u\n", FIFONames[Cntr], Recovery[Cntr].Failures);
+  FAMILY("dma_recovery_microseconds_total", "counter", "time spent resetting DMA engines and FIFOs");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    REPORT("saturn_dma_recovery_microseconds_total{fifo=\"%s\"} %llu\n", FIFONames[Cntr],
+           (unsigned long long)Recovery[Cntr].TotalMicroseconds);
+  FAMILY("dma_recovery_max_microseconds", "gauge", "longest DMA engine and FIFO reset");
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    REPORT("saturn_dma_recovery_max_microseconds{fifo=\"%s\"} %u\n", FIFONames[Cntr], Recovery[Cntr].MaxMicroseconds);
+  //
+  // the XDMA driver's own counts for each engine, if its stats files are there
+  //
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+    EngineStats |= !ReadDMAEngineStats(FIFODevices[Cntr], &Engines[Cntr]);
+  if (EngineStats)
+  {
+    ENGINES("dma_engine_transfers_total", "counter", "DMA transfers completed by the engine", Transfers);
+    ENGINES("dma_engine_bytes_total", "counter", "bytes of DMA transfers completed by the engine", Bytes);
+    ENGINES("dma_engine_descriptors_total", "counter", "descriptors of DMA transfers completed by the engine", Descriptors);
+    ENGINES("dma_engine_errors_total", "counter", "DMA transfers failed by the engine", Errors);
+    ENGINES("dma_engine_timeouts_total", "counter", "DMA transfers aborted by the driver after their timeout", Timeouts);
+    ENGINES("dma_engine_interrupts_total", "counter", "DMA engine interrupts taken", Interrupts);
+    ENGINES("dma_engine_latency_nanoseconds_total", "counter", "DMA transfer time from queueing to completion", LatencyNs);
+    ENGINES("dma_engine_latency_max_nanoseconds", "gauge", "longest DMA transfer time from queueing to completion", MaxLatencyNs);
+  }
+  FAMILY("adc_overflow_total", "counter", "overflow register reads that found the ADC overflowed");
+  for (Cntr = 0; Cntr < 2; Cntr++)
+    REPORT("saturn_adc_overflow_total{adc=\"%u\"} %u\n", Cntr + 1, atomic_load(&RadioTelemetry.ADCOverflows[Cntr]));
+  GetADCOverloadStatistics(&Overload);
+  FAMILY("adc_overloads_total", "counter", "ADC overloads started: reads finding the overflow set after one finding it clear");
+  for (Cntr = 0; Cntr < VNUMOVERLOADADCS; Cntr++)
+    REPORT("saturn_adc_overloads_total{adc=\"%u\"} %llu\n", Cntr + 1, (unsigned long long)Overload.Overloads[Cntr]);
+  FAMILY("adc_overload_active", "gauge", "1 while the ADC is overloaded");
+  for (Cntr = 0; Cntr < VNUMOVERLOADADCS; Cntr++)
+    REPORT("saturn_adc_overload_active{adc=\"%u\"} %u\n", Cntr + 1, (Overload.Active >> Cntr) & 1);
+  FAMILY("adc_overload_microseconds_total", "counter", "time the ADC was overloaded, over the overloads ended");
+  for (Cntr = 0; Cntr < VNUMOVERLOADADCS; Cntr++)
+    REPORT("saturn_adc_overload_microseconds_total{adc=\"%u\"} %llu\n", Cntr + 1,
+           (unsigned long long)Overload.TotalDuration[Cntr]);
+  FAMILY("adc_overload_max_microseconds", "gauge", "longest ADC overload");
+  for (Cntr = 0; Cntr < VNUMOVERLOADADCS; Cntr++)
+    REPORT("saturn_adc_overload_max_microseconds{adc=\"%u\"} %u\n", Cntr + 1, Overload.MaxDuration[Cntr]);
+  FAMILY("adc_overload_reports_total", "counter", "status packets that reported a new ADC overload");
+  REPORT("saturn_adc_overload_reports_total %llu\n", (unsigned long long)Overload.Reports);
+  FAMILY("adc_overload_report_delay_microseconds_total", "counter", "sum over reports of the time from detection to the status packet");
+  REPORT("saturn_adc_overload_report_delay_microseconds_total %llu\n", (unsigned long long)Overload.TotalReportDelay);
+  FAMILY("adc_overload_report_delay_max_microseconds", "gauge", "longest time from an overload being detected to its status packet");
+  REPORT("saturn_adc_overload_report_delay_max_microseconds %u\n", Overload.MaxReportDelay);
+  FAMILY("analogue_input_raw", "gauge", "RF board analogue input ADC value at the last status read");
+  for (Cntr = 0; Cntr < VNUMANALOGUEIN; Cntr++)
+    REPORT("saturn_analogue_input_raw{input=\"ain%u\",use=\"%s\"} %u\n", Cntr + 1, AnalogueUses[Cntr],
+           atomic_load(&RadioTelemetry.Analogue[Cntr]));
+  FAMILY("die_temperature_celsius", "gauge", "FPGA die temperature");
+  REPORT("saturn_die_temperature_celsius %.1f\n", ReadDieTemperature());
+
+  GetRegisterWriteCounts(&Writes, &Skips);
+  FAMILY("register_writes_total", "counter", "shadowed register writes made");
+  REPORT("saturn_register_writes_total %llu\n", (unsigned long long)Writes);
+  FAMILY("register_writes_skipped_total", "counter", "shadowed register writes skipped as unchanged");
+  REPORT("saturn_register_writes_skipped_total %llu\n", (unsigned long long)Skips);
+  GetRegisterQueueCounts(&Groups, &QueuedWrites, &Waits);
+  FAMILY("register_queue_groups_total", "counter", "register transactions applied by the register queue owner thread");
+  REPORT("saturn_register_queue_groups_total %llu\n", (unsigned long long)Groups);
+  FAMILY("register_queue_writes_total", "counter", "register writes applied by the register queue owner thread");
+  REPORT("saturn_register_queue_writes_total %llu\n", (unsigned long long)QueuedWrites);
+  FAMILY("register_queue_waits_total", "counter", "register accesses that waited for queued writes");
+  REPORT("saturn_register_queue_waits_total %llu\n", (unsigned long long)Waits);
+  GetCaptureCounts(&Captured, &RateLimited, &RingFull);
+  FAMILY("capture_packets_total", "counter", "packets copied for the packet capture file");
+  REPORT("saturn_capture_packets_total %llu\n", (unsigned long long)Captured);
+  FAMILY("capture_skipped_total", "counter", "packets not captured");
+  REPORT("saturn_capture_skipped_total{reason=\"rate_limit\"} %llu\n", (unsigned long long)RateLimited);
+  REPORT("saturn_capture_skipped_total{reason=\"ring_full\"} %llu\n", (unsigned long long)RingFull);
+
+  //
+  // stream thread heartbeats, for threads that have started
+  //
+  FAMILY("thread_progress_total", "counter", "stream thread heartbeats");
+  for (Cntr = 0; Cntr < VNUMBEATTHREADS; Cntr++)
+    if (atomic_load(&Heartbeats[Cntr].Started))
+      REPORT("saturn_thread_progress_total{thread=\"%s\"} %llu\n", GetBeatThreadName(Cntr),
+             (unsigned long long)atomic_load(&Heartbeats[Cntr].Progress));
+  FAMILY("thread_heartbeat_age_milliseconds", "gauge", "time since a working stream thread last beat; 0 if idle");
+  for (Cntr = 0; Cntr < VNUMBEATTHREADS; Cntr++)
+    if (atomic_load(&Heartbeats[Cntr].Started))
+      REPORT("saturn_thread_heartbeat_age_milliseconds{thread=\"%s\"} %u\n", GetBeatThreadName(Cntr), GetHeartbeatAge(Cntr));
+  FAMILY("thread_stalls_total", "counter", "stalls found by the stall detector");
+  for (Cntr = 0; Cntr < VNUMBEATTHREADS; Cntr++)
+    if (atomic_load(&Heartbeats[Cntr].Started))
+      REPORT("saturn_thread_stalls_total{thread=\"%s\"} %u\n", GetBeatThreadName(Cntr), atomic_load(&Heartbeats[Cntr].Stalls));
+
+  //
+  // pipeline stage CPU cost, for the stages profiled so far
+  //
+#define STAGES(Name, Field)                                                                 \
+  for (Cntr = 0; Cntr < VNUMPROFILESTAGES; Cntr++)                                          \
+    if (atomic_load(&StageTotals[Cntr].Calls) != 0)                                         \
+      REPORT("saturn_" Name "{stage=\"%s\"} %llu\n", GetStageName(Cntr),                    \
+             (unsigned long long)atomic_load(&StageTotals[Cntr].Field))
+  FAMILY("stage_calls_total", "counter", "pipeline stages profiled");
+  STAGES("stage_calls_total", Calls);
+  FAMILY("stage_bytes_total", "counter", "bytes handled by profiled pipeline stages");
+  STAGES("stage_bytes_total", Bytes);
+  FAMILY("stage_cycles_total", "counter", "CPU cycles spent in profiled pipeline stages");
+  STAGES("stage_cycles_total", Cycles);
+  FAMILY("stage_instructions_total", "counter", "instructions retired in profiled pipeline stages");
+  STAGES("stage_instructions_total", Instructions);
+  FAMILY("stage_nanoseconds_total", "counter", "elapsed time in profiled pipeline stages");
+  STAGES("stage_nanoseconds_total", Nanoseconds);
+
+  //
+  // DDC plugins and their CPU use
+  //
+#define PLUGINS(Metric, Field)                                                              \
+  for (Cntr = 0; Cntr < DDCPluginCount; Cntr++)                                             \
+    REPORT("saturn_" Metric "{plugin=\"%s\"} %llu\n", Plugins[Cntr].Name,                   \
+           (unsigned long long)Plugins[Cntr].Field)
+  if (DDCPluginCount != 0)
+  {
+    for (Cntr = 0; Cntr < DDCPluginCount; Cntr++)
+      GetDDCPluginStatistics(Cntr, Plugins + Cntr);
+    FAMILY("plugin_calls_total", "counter", "DDC plugin calls");
+    PLUGINS("plugin_calls_total", Calls);
+    FAMILY("plugin_samples_total", "counter", "samples given to DDC plugins");
+    PLUGINS("plugin_samples_total", Samples);
+    FAMILY("plugin_dropped_samples_total", "counter", "samples dropped by DDC plugins");
+    PLUGINS("plugin_dropped_samples_total", Dropped);
+    FAMILY("plugin_nanoseconds_total", "counter", "time spent in DDC plugins");
+    PLUGINS("plugin_nanoseconds_total", Nanoseconds);
+    FAMILY("plugin_overruns_total", "counter", "DDC plugin calls over the CPU budget");
+    PLUGINS("plugin_overruns_total", Overruns);
+    FAMILY("plugin_annotations_total", "counter", "annotations made by DDC plugins");
+    PLUGINS("plugin_annotations_total", Annotations);
+    FAMILY("plugin_bypassed", "gauge", "1 if a DDC plugin is bypassed for going over its CPU budget");
+    PLUGINS("plugin_bypassed", Bypassed);
+  }
+
+  //
+  // CW key and PTT edges
+  //
+  GetKeyEdgeStatistics(&Keys);
+  FAMILY("key_edges_total", "counter", "PTT and key input edges reported to the client");
+  REPORT("saturn_key_edges_total %llu\n", (unsigned long long)Keys.Edges);
+  FAMILY("key_edges_watched_total", "counter", "PTT and key input edges seen by the key watch thread");
+  REPORT("saturn_key_edges_watched_total %llu\n", (unsigned long long)Keys.Watched);
+  FAMILY("key_poll_gap_microseconds_total", "counter", "sum over edges of the time between the polls either side");
+  REPORT("saturn_key_poll_gap_microseconds_total %llu\n", (unsigned long long)Keys.TotalPollGap);
+  FAMILY("key_poll_gap_max_microseconds", "gauge", "widest poll gap an edge was seen in");
+  REPORT("saturn_key_poll_gap_max_microseconds %u\n", Keys.MaxPollGap);
+  FAMILY("key_send_delay_microseconds", "histogram", "time from an edge being seen to the status packet reporting it");
+  Cumulative = 0;
+  for (Bin = 0; Bin < VTELLATENCYBINS - 1; Bin++)
+  {
+    Cumulative += Keys.SendDelays[Bin];
+    REPORT("saturn_key_send_delay_microseconds_bucket{le=\"%u\"} %llu\n", (1U << Bin) - 1,
+           (unsigned long long)Cumulative);
+  }
+  REPORT("saturn_key_send_delay_microseconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)Keys.Edges);
+  REPORT("saturn_key_send_delay_microseconds_sum %llu\n", (unsigned long long)Keys.TotalSendDelay);
+  REPORT("saturn_key_send_delay_microseconds_count %llu\n", (unsigned long long)Keys.Edges);
+  FAMILY("key_send_delay_max_microseconds", "gauge", "longest time from an edge being seen to its status packet");
+  REPORT("saturn_key_send_delay_max_microseconds %u\n", Keys.MaxSendDelay);
+
+  //
+  // CPU use of each named thread
+  //
+  NumThreads = GetThreadAccounting(Threads, VMAXTRACKEDTHREADS);
+  FAMILY("thread_cpu_seconds_total", "counter", "CPU time used by each p2app thread");
+  for (Cntr = 0; Cntr < NumThreads; Cntr++)
+    REPORT("saturn_thread_cpu_seconds_total{thread=\"%s\",tid=\"%d\"} %.6f\n", Threads[Cntr].Name,
+           Threads[Cntr].Tid, (double)Threads[Cntr].CPUTime / 1e9);
+  FAMILY("thread_wakeups_total", "counter", "voluntary context switches: times a thread blocked and was woken");
+  for (Cntr = 0; Cntr < NumThreads; Cntr++)
+    REPORT("saturn_thread_wakeups_total{thread=\"%s\",tid=\"%d\"} %llu\n", Threads[Cntr].Name,
+           Threads[Cntr].Tid, (unsigned long long)Threads[Cntr].Wakeups);
+  FAMILY("thread_preemptions_total", "counter", "involuntary context switches of each thread");
+  for (Cntr = 0; Cntr < NumThreads; Cntr++)
+    REPORT("saturn_thread_preemptions_total{thread=\"%s\",tid=\"%d\"} %llu\n", Threads[Cntr].Name,
+           Threads[Cntr].Tid, (unsigned long long)Threads[Cntr].Preemptions);
+  if (Used >= (int)Length)
+    Used = Length - 1;
+  return Used;
+
+#undef REPORT
+#undef FAMILY
+#undef STREAMS
+#undef ENGINES
+#undef STAGES
+#undef PLUGINS
+}
+
+
+void TelemetryCountADCOverflows(uint32_t Bits)
+{
+  uint32_t Cntr;
+
+  for (Cntr = 0; Cntr < 2; Cntr++)
+    if (Bits & (1 << Cntr))
+      atomic_fetch_add_explicit(&RadioTelemetry.ADCOverflows[Cntr], 1, memory_order_relaxed);
+}
+
+
+//
+// keep the radio state from a status snapshot
+//
+void TelemetryStatusSnapshot(struct StatusSnapshot* Snapshot)
+{
+  struct FIFOMonitorReading* FIFO;
+  uint32_t Cntr;
+
+  atomic_fetch_add_explicit(&RadioTelemetry.StatusReads, 1, memory_order_relaxed);
+  for (Cntr = 0; Cntr < VNUMANALOGUEIN; Cntr++)
+    atomic_store_explicit(&RadioTelemetry.Analogue[Cntr], Snapshot->Analogue[Cntr], memory_order_relaxed);
+  for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+  {
+    FIFO = &Snapshot->FIFOs[Cntr];
+    atomic_store_explicit(&RadioTelemetry.FIFODepth[Cntr], FIFO->Current, memory_order_relaxed);
+    if (FIFO->OverThreshold)
+      atomic_fetch_add_explicit(&RadioTelemetry.FIFOOverThreshold[Cntr], 1, memory_order_relaxed);
+    if (FIFO->Underflowed)
+      atomic_fetch_add_explicit(&RadioTelemetry.FIFOUnderflows[Cntr], 1, memory_order_relaxed);
+  }
+}
+
+
+//
+// answer one client: wait briefly for a format request, then send the report
+//
+static void ServeTelemetryClient(int Clientid)
+{
+  static char Report[VTELREPORTSIZE];
+  char Request[16];
+  struct pollfd Poll;
+  bool UseJSON = true;
+  int Length;
+
+  memset(Request, 0, sizeof(Request));
+  Poll.fd = Clientid;
+  Poll.events = POLLIN;
+  if ((poll(&Poll, 1, VTELREQUESTWAIT) == 1) && (recv(Clientid, Request, sizeof(Request) - 1, 0) > 0))
+    UseJSON = (strncmp(Request, "text", 4) != 0);
+
+  Length = MakeTelemetryReport(Report, sizeof(Report), UseJSON);
+  send(Clientid, Report, Length, MSG_NOSIGNAL);
+  close(Clientid);
+}
+
+
+//
+// answer one HTTP client: read the request, and send the metrics for GET /metrics
+//
+static void ServeMetricsClient(int Clientid)
+{
+  static char Report[VTELMETRICSSIZE];
+  static const char NotFound[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+  char Request[VTELHTTPREQUESTSIZE];
+  char Header[160];
+  struct pollfd Poll;
+  int Received = 0;
+  int Length;
+  int HeaderLength;
+
+  //
+  // only the request line is needed; wait for it briefly
+  //
+  memset(Request, 0, sizeof(Request));
+  Poll.fd = Clientid;
+  Poll.events = POLLIN;
+  while ((Received < (int)sizeof(Request) - 1) && (strchr(Request, '\n') == NULL) &&
+         (poll(&Poll, 1, VTELREQUESTWAIT) == 1))
+  {
+    Length = recv(Clientid, Request + Received, sizeof(Request) - 1 - Received, 0);
+    if (Length <= 0)
+      break;
+    Received += Length;
+  }
+  if ((strncmp(Request, "GET /metrics ", 13) != 0) && (strncmp(Request, "GET /metrics?", 13) != 0))
+    send(Clientid, NotFound, sizeof(NotFound) - 1, MSG_NOSIGNAL);
+  else
+  {
+    Length = MakeMetricsReport(Report, sizeof(Report));
+    HeaderLength = snprintf(Header, sizeof(Header), "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                            "Content-Length: %d\r\nConnection: close\r\n\r\n", Length);
+    send(Clientid, Header, HeaderLength, MSG_NOSIGNAL | MSG_MORE);
+    send(Clientid, Report, Length, MSG_NOSIGNAL);
+  }
+  close(Clientid);
+}
+
+
+//
+// server thread: serves the telemetry socket and the metrics port, whichever are open
+//
+static void* TelemetryServerThread(__attribute__((unused)) void *arg)
+{
+  struct pollfd Poll[2];
+  uint64_t LastSample, Now;
+  int Clientid;
+
+  LastSample = TelemetryTimestamp();
+  while (1)
+  {
+    Poll[0].fd = TelemetrySocketid;
+    Poll[0].events = POLLIN;
+    Poll[0].revents = 0;
+    Poll[1].fd = MetricsSocketid;
+    Poll[1].events = POLLIN;
+    Poll[1].revents = 0;
+    if (poll(Poll, 2, VTELSAMPLEPERIOD) > 0)
+    {
+      if (Poll[0].revents & POLLIN)
+      {
+        Clientid = accept(TelemetrySocketid, NULL, NULL);
+        if (Clientid >= 0)
+          ServeTelemetryClient(Clientid);
+      }
+      if (Poll[1].revents & POLLIN)
+      {
+        Clientid = accept(MetricsSocketid, NULL, NULL);
+        if (Clientid >= 0)
+          ServeMetricsClient(Clientid);
+      }
+    }
+    Now = TelemetryTimestamp();
+    if ((Now - LastSample) >= VTELSAMPLEPERIOD * 1000ULL)
+    {
+      SampleTelemetryRates(Now - LastSample);
+      LastSample = Now;
+    }
+  }
+  return NULL;
+}
+
+
+//
+// start the server thread, if not already running
+// return true if error
+//
+static bool StartTelemetryThread(void)
+{
+  if (TelemetryThreadStarted)
+    return false;
+  if (CreatePlacedThread(&TelemetryThread, eThreadControl, "telemetry", TelemetryServerThread, NULL) != 0)
+  {
+    perror("pthread_create telemetry");
+    return true;
+  }
+  pthread_detach(TelemetryThread);
+  TelemetryThreadStarted = true;
+  return false;
+}
+
+
+//
+// create the socket and server thread
+//
+bool StartTelemetryServer(char* SocketPath)
+{
+  struct sockaddr_un Addr;
+  int Socketid;
+
+  if (strlen(SocketPath) >= sizeof(Addr.sun_path))
+  {
+    printf("telemetry socket path %s too long\n", SocketPath);
+    return true;
+  }
+  Socketid = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Socketid < 0)
+  {
+    perror("telemetry socket");
+    return true;
+  }
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  strcpy(Addr.sun_path, SocketPath);
+  unlink(SocketPath);                                       // remove any left by a previous run
+  if ((bind(Socketid, (struct sockaddr*)&Addr, sizeof(Addr)) < 0) || (listen(Socketid, 4) < 0))
+  {
+    perror("telemetry socket bind");
+    close(Socketid);
+    return true;
+  }
+  TelemetrySocketid = Socketid;
+  if (StartTelemetryThread())
+  {
+    TelemetrySocketid = -1;
+    close(Socketid);
+    return true;
+  }
+  printf("telemetry available at %s\n", SocketPath);
+  return false;
+}
+
+
+//
+// create the metrics TCP socket, and the server thread if needed
+//
+bool StartMetricsServer(uint16_t Port)
+{
+  struct sockaddr_in Addr;
+  int Socketid;
+  int Enable = 1;
+
+  Socketid = socket(AF_INET, SOCK_STREAM, 0);
+  if (Socketid < 0)
+  {
+    perror("metrics socket");
+    return true;
+  }
+  setsockopt(Socketid, SOL_SOCKET, SO_REUSEADDR, &Enable, sizeof(Enable));
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sin_family = AF_INET;
+  Addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  Addr.sin_port = htons(Port);
+  if ((bind(Socketid, (struct sockaddr*)&Addr, sizeof(Addr)) < 0) || (listen(Socketid, 4) < 0))
+  {
+    perror("metrics socket bind");
+    close(Socketid);
+    return true;
+  }
+  MetricsSocketid = Socketid;
+  if (StartTelemetryThread())
+  {
+    MetricsSocketid = -1;
+    close(Socketid);
+    return true;
+  }
+  printf("metrics available at http://<address>:%d/metrics\n", Port);
+  return false;
+}
@@ -0,0 +1,372 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// telemetry.h:
+//
+// header: per stream throughput, FIFO and latency counters
+// counters are updated lock free by the stream threads, and read
+// by a server thread that reports them over a local UNIX socket.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __telemetry_h
+#define __telemetry_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include "../common/saturnregisters.h"
+#include "../common/saturndrivers.h"
+#include "eventtrace.h"
+
+
+//
+// streams counted. DDC streams are indexed by DDC number.
+//
+typedef enum
+{
+  eTelDDCDMA = VNUMDDC,                         // DDC DMA reader (all DDCs share one FIFO)
+  eTelMic,                                      // mic audio to client
+  eTelDUC,                                      // DUC I/Q from client
+  eTelSpeaker,                                  // speaker audio from client
+  eTelWideband,                                 // wideband ADC capture to client (both ADCs)
+  eTelHighPriority,                             // high priority packets from client
+  eTelStatus,                                   // high priority status packets to client
+  VNUMTELSTREAMS
+} ETelemetryStream;
+
+#define VTELDMABINS 8                           // DMA size histogram: <1K, 1K, 2K ... >=64K, log2 bins
+#define VTELDEPTHBINS 8                         // FIFO depth histogram: eighths of the FIFO size
+#define VTELLATENCYBINS 16                      // loop time histogram: <1us ... >=16ms, log2 bins
+#define VTELSEQWINDOW 64                        // inbound sequence numbers remembered, for reorders & duplicates
+#define VTELSEQMAXJUMP 4096                     // bigger forward jumps are taken as a client restart
+
+
+struct StreamTelemetry
+{
+  _Atomic uint64_t Packets;                     // UDP packets sent or received
+  _Atomic uint64_t Bytes;                       // UDP payload bytes sent or received
+  _Atomic uint64_t DMATransfers;                // DMA transfers made
+  _Atomic uint64_t DMABytes;                    // bytes moved by DMA
+  _Atomic uint32_t Overflows;                   // FIFO over threshold events
+  _Atomic uint32_t Underflows;                  // FIFO underflow events
+  _Atomic uint32_t SendErrors;                  // failed sends
+  _Atomic uint32_t SendAgains;                  // of those, failed for lack of socket buffer (EAGAIN/ENOBUFS)
+  _Atomic uint32_t SeqGaps;                     // inbound packets missing, by sequence number
+  _Atomic uint32_t SeqReorders;                 // inbound packets that arrived after a later one
+  _Atomic uint32_t SeqDuplicates;               // inbound packets received twice
+  _Atomic uint32_t SeqRestarts;                 // inbound sequence jumped: taken as a client restart
+  _Atomic uint32_t Resyncs;                     // times the stream framing was lost and found again
+  _Atomic uint64_t SamplesShed;                 // DDC samples dropped by overload protection
+  _Atomic uint32_t DMASizes[VTELDMABINS];
+  _Atomic uint32_t FIFODepths[VTELDEPTHBINS];
+  _Atomic uint32_t LoopTimes[VTELLATENCYBINS];
+  _Atomic uint32_t MaxLoopTime;                 // us
+  _Atomic uint32_t ReceiveDelays[VTELLATENCYBINS];  // kernel receive stamp to work done (rx_timestamps)
+  _Atomic uint32_t MaxReceiveDelay;             // us
+  _Atomic uint32_t StackDelays[VTELLATENCYBINS];    // NIC hardware stamp to kernel stamp, if the NIC stamps
+  _Atomic uint32_t BufferFill;                  // software jitter buffer fill, frames (streams that have one)
+  _Atomic uint32_t MaxBufferFill;
+  _Atomic uint32_t Concealed;                   // missing frames filled in by a reorder buffer
+  _Atomic uint32_t Late;                        // frames dropped by a reorder buffer, for arriving too late
+};
+
+extern struct StreamTelemetry Telemetry[VNUMTELSTREAMS];
+
+
+//
+// radio state, kept from the status reads made for each high priority packet
+//
+struct RadioTelemetry
+{
+  _Atomic uint32_t StatusReads;                 // status snapshots taken
+  _Atomic uint32_t Analogue[VNUMANALOGUEIN];    // AIN1-6 raw values at the last read
+  _Atomic uint32_t ADCOverflows[2];             // overflow register reads that found each ADC overflowed
+  _Atomic uint32_t FIFODepth[VNUMFIFOCHANNELS]; // FIFO locations occupied at the last read
+  _Atomic uint32_t FIFOOverThreshold[VNUMFIFOCHANNELS];  // reads that found the flag set
+  _Atomic uint32_t FIFOUnderflows[VNUMFIFOCHANNELS];     // reads that found the flag set
+};
+
+extern struct RadioTelemetry RadioTelemetry;
+
+
+//
+// inbound sequence number state for one stream. Owned by the thread that receives it.
+// Window bit n is set if sequence number (Expected - 1 - n) has been received.
+//
+struct SequenceTracker
+{
+  bool Started;                                 // false until the first packet
+  uint32_t Expected;                            // next sequence number due
+  uint64_t Window;
+  uint32_t History;                             // sequence numbers covered by Window since the start
+};
+
+
+//
+// StartTelemetryServer(char* SocketPath)
+// create a UNIX stream socket at SocketPath and a thread to serve it.
+// each connection gets one report then is closed. A client that sends "text"
+// gets a plain text report; otherwise the report is JSON.
+// return true if error
+//
+bool StartTelemetryServer(char* SocketPath);
+
+
+//
+// StartMetricsServer(uint16_t Port)
+// listen for HTTP on a TCP port; GET /metrics returns the telemetry and radio
+// state in the Prometheus/OpenMetrics text format. Served by the telemetry thread.
+// return true if error
+//
+bool StartMetricsServer(uint16_t Port);
+
+
+//
+// TelemetryStatusSnapshot(struct StatusSnapshot* Snapshot)
+// keep the radio state from a status snapshot that has just been read
+//
+void TelemetryStatusSnapshot(struct StatusSnapshot* Snapshot);
+
+
+//
+// TelemetryCountADCOverflows(uint32_t Bits)
+// count a read of the ADC overflow register (bit per ADC). The register clears
+// on read, so this is called from NoteADCOverflow() for every reader's reads.
+//
+void TelemetryCountADCOverflows(uint32_t Bits);
+
+
+//
+// TelemetryTimestamp(void)
+// monotonic time in microseconds, for loop time measurement
+//
+static inline uint64_t TelemetryTimestamp(void)
+{
+  struct timespec Now;
+
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return (uint64_t)Now.tv_sec * 1000000ULL + Now.tv_nsec / 1000;
+}
+
+
+//
+// index of the highest set bit + 1; 0 for 0
+//
+static inline uint32_t TelemetryLog2Bin(uint64_t Value, uint32_t NumBins)
+{
+  uint32_t Bin = (Value == 0) ? 0 : 64 - __builtin_clzll(Value);
+
+  return (Bin < NumBins) ? Bin : NumBins - 1;
+}
+
+
+//
+// TelemetryCountPackets(ETelemetryStream Stream, uint32_t Packets, uint32_t Bytes)
+// count UDP packets sent or received
+//
+static inline void TelemetryCountPackets(uint32_t Stream, uint32_t Packets, uint32_t Bytes)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].Packets, Packets, memory_order_relaxed);
+  atomic_fetch_add_explicit(&Telemetry[Stream].Bytes, Bytes, memory_order_relaxed);
+}
+
+
+//
+// TelemetryCountDMA(ETelemetryStream Stream, uint32_t Bytes)
+// count one DMA transfer, and add its size to the histogram
+//
+static inline void TelemetryCountDMA(uint32_t Stream, uint32_t Bytes)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].DMATransfers, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&Telemetry[Stream].DMABytes, Bytes, memory_order_relaxed);
+  atomic_fetch_add_explicit(&Telemetry[Stream].DMASizes[TelemetryLog2Bin(Bytes >> 10, VTELDMABINS)], 1, memory_order_relaxed);
+}
+
+
+//
+// TelemetryFIFODepth(ETelemetryStream Stream, uint32_t Current, uint32_t Size)
+// add a FIFO occupancy reading to the histogram
+//
+static inline void TelemetryFIFODepth(uint32_t Stream, uint32_t Current, uint32_t Size)
+{
+  uint32_t Bin = (Size == 0) ? 0 : (uint32_t)(((uint64_t)Current * VTELDEPTHBINS) / Size);
+
+  if (Bin >= VTELDEPTHBINS)
+    Bin = VTELDEPTHBINS - 1;
+  atomic_fetch_add_explicit(&Telemetry[Stream].FIFODepths[Bin], 1, memory_order_relaxed);
+}
+
+
+//
+// TelemetryLoopTime(ETelemetryStream Stream, uint64_t StartTime)
+// add the time since StartTime (from TelemetryTimestamp()) to the loop time histogram
+//
+static inline void TelemetryLoopTime(uint32_t Stream, uint64_t StartTime)
+{
+  uint64_t Elapsed = TelemetryTimestamp() - StartTime;
+
+  atomic_fetch_add_explicit(&Telemetry[Stream].LoopTimes[TelemetryLog2Bin(Elapsed, VTELLATENCYBINS)], 1, memory_order_relaxed);
+  if (Elapsed > atomic_load_explicit(&Telemetry[Stream].MaxLoopTime, memory_order_relaxed))
+    atomic_store_explicit(&Telemetry[Stream].MaxLoopTime, (uint32_t)Elapsed, memory_order_relaxed);
+}
+
+
+//
+// TelemetryReceiveDelay(ETelemetryStream Stream, uint64_t Software, uint64_t Hardware)
+// add the time from a packet's receive stamps (CLOCK_REALTIME us, 0 if none) to now
+// to the receive delay histograms. Call once the packet's work is done.
+// negative times (the clock stepped, or an unsynchronised NIC clock) are dropped.
+//
+static inline void TelemetryReceiveDelay(uint32_t Stream, uint64_t Software, uint64_t Hardware)
+{
+  struct timespec Now;
+  uint64_t Delay;
+
+  if (Software == 0)
+    return;
+  clock_gettime(CLOCK_REALTIME, &Now);
+  Delay = (uint64_t)Now.tv_sec * 1000000ULL + Now.tv_nsec / 1000;
+  if (Delay < Software)
+    return;
+  Delay -= Software;
+  atomic_fetch_add_explicit(&Telemetry[Stream].ReceiveDelays[TelemetryLog2Bin(Delay, VTELLATENCYBINS)], 1, memory_order_relaxed);
+  if (Delay > atomic_load_explicit(&Telemetry[Stream].MaxReceiveDelay, memory_order_relaxed))
+    atomic_store_explicit(&Telemetry[Stream].MaxReceiveDelay, (uint32_t)Delay, memory_order_relaxed);
+  if ((Hardware != 0) && (Hardware <= Software))
+    atomic_fetch_add_explicit(&Telemetry[Stream].StackDelays[TelemetryLog2Bin(Software - Hardware, VTELLATENCYBINS)], 1,
+                              memory_order_relaxed);
+}
+
+
+//
+// event counters. Each event also goes in the event trace.
+//
+static inline void TelemetryCountOverflow(uint32_t Stream)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].Overflows, 1, memory_order_relaxed);
+  Trace(eTraceOverflow, Stream, 0);
+}
+
+static inline void TelemetryCountUnderflow(uint32_t Stream)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].Underflows, 1, memory_order_relaxed);
+  Trace(eTraceUnderflow, Stream, 0);
+}
+
+//
+// call straight after the failed send, while errno is still its error
+//
+static inline void TelemetryCountSendError(uint32_t Stream)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].SendErrors, 1, memory_order_relaxed);
+  if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS))
+    atomic_fetch_add_explicit(&Telemetry[Stream].SendAgains, 1, memory_order_relaxed);
+  Trace(eTraceSendError, Stream, errno);
+}
+
+static inline void TelemetryCountShed(uint32_t Stream, uint32_t Samples)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].SamplesShed, Samples, memory_order_relaxed);
+}
+
+static inline void TelemetryCountResync(uint32_t Stream)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].Resyncs, 1, memory_order_relaxed);
+  Trace(eTraceResync, Stream, 0);
+}
+
+
+//
+// TelemetryResetSequence(struct SequenceTracker* Tracker)
+// forget the sequence state, eg. when a stream starts again
+//
+static inline void TelemetryResetSequence(struct SequenceTracker* Tracker)
+{
+  Tracker->Started = false;
+}
+
+
+//
+// TelemetrySequence(ETelemetryStream Stream, struct SequenceTracker* Tracker, uint32_t Sequence)
+// check the sequence number of a received packet, counting gaps, reorders and duplicates.
+// a packet that fills an earlier gap is a reorder, and the gap is no longer counted as missing.
+// a big jump either way starts the tracking again from the new number.
+//
+static inline void TelemetrySequence(uint32_t Stream, struct SequenceTracker* Tracker, uint32_t Sequence)
+{
+  struct StreamTelemetry* Tel = Telemetry + Stream;
+  int32_t Diff = (int32_t)(Sequence - Tracker->Expected);
+  uint32_t Age;
+
+  if (Tracker->Started && (Diff >= 0) && (Diff < VTELSEQMAXJUMP))
+  {
+    if (Diff != 0)
+      atomic_fetch_add_explicit(&Tel->SeqGaps, Diff, memory_order_relaxed);
+    Tracker->Window = (Diff >= VTELSEQWINDOW - 1) ? 1 : (Tracker->Window << (Diff + 1)) | 1;
+    Tracker->History += Diff + 1;
+    Tracker->Expected = Sequence + 1;
+  }
+  else if (Tracker->Started && (Diff < 0) && (Diff >= -VTELSEQWINDOW))
+  {
+    Age = -Diff - 1;                            // 0 = the latest packet
+    if (Tracker->Window & (1ULL << Age))
+      atomic_fetch_add_explicit(&Tel->SeqDuplicates, 1, memory_order_relaxed);
+    else
+    {
+      Tracker->Window |= 1ULL << Age;
+      atomic_fetch_add_explicit(&Tel->SeqReorders, 1, memory_order_relaxed);
+      if (Age < Tracker->History)               // it was counted as missing
+        atomic_fetch_sub_explicit(&Tel->SeqGaps, 1, memory_order_relaxed);
+    }
+  }
+  else
+  {
+    if (Tracker->Started)
+      atomic_fetch_add_explicit(&Tel->SeqRestarts, 1, memory_order_relaxed);
+    Tracker->Started = true;
+    Tracker->Expected = Sequence + 1;
+    Tracker->Window = 1;
+    Tracker->History = 1;
+  }
+}
+
+
+//
+// TelemetryCountConcealed(ETelemetryStream Stream)
+// TelemetryCountLate(ETelemetryStream Stream)
+// count frames concealed, or dropped as late, by a stream's reorder buffer
+//
+static inline void TelemetryCountConcealed(uint32_t Stream)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].Concealed, 1, memory_order_relaxed);
+}
+
+static inline void TelemetryCountLate(uint32_t Stream)
+{
+  atomic_fetch_add_explicit(&Telemetry[Stream].Late, 1, memory_order_relaxed);
+}
+
+
+//
+// TelemetryBufferFill(ETelemetryStream Stream, uint32_t Frames)
+// record the current fill of a stream's software jitter buffer
+//
+static inline void TelemetryBufferFill(uint32_t Stream, uint32_t Frames)
+{
+  atomic_store_explicit(&Telemetry[Stream].BufferFill, Frames, memory_order_relaxed);
+  if (Frames > atomic_load_explicit(&Telemetry[Stream].MaxBufferFill, memory_order_relaxed))
+    atomic_store_explicit(&Telemetry[Stream].MaxBufferFill, Frames, memory_order_relaxed);
+}
+
+
+#endif
@@ -19,8 +19,11 @@
 
 
 #include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <netinet/in.h>
 #include "../common/saturntypes.h"
+#include "../common/bufferarena.h"
 
 
 //
@@ -34,6 +37,7 @@
 #define VPORTHIGHPRIORITYTOSDR 3
 #define VPORTSPKRAUDIO 4
 #define VPORTDUCIQ 5
+#define VNUMINCOMINGPORTS 6
 // outgoing port numbers:
 #define VPORTHIGHPRIORITYFROMSDR 6
 #define VPORTMICAUDIO 7
@@ -51,6 +55,21 @@
 #define VPORTWIDEBAND1 19
 
 
+//
+// socket option classes. Each socket has the buffer sizes, DSCP marking,
+// priority and busy poll setting of its class (see p2config.h).
+// where two threads share a socket, both table entries have the same class.
+//
+typedef enum
+{
+  eSocketControl,                               // command port: discovery and general packets
+  eSocketHighPriority,                          // high priority in and out (and wideband 0)
+  eSocketDUC,                                   // DUC specific, DUC I/Q, mic, speaker (and wideband 1)
+  eSocketDDC,                                   // DDC I/Q
+  VNUMSOCKETCLASSES
+} ESocketClass;
+
+
 //
 // a type to hold data for each incoming or outgoing data thread
 //
@@ -62,21 +81,44 @@ struct ThreadSocketData
   char *Nameid;                                 // name (for error msg etc)
   bool Active;                                  // true if thread is active
   struct sockaddr_in addr_cmddata;
-  uint32_t Cmdid;                               // command from app to thread - bits set for each command
+  _Atomic uint32_t Cmdid;                       // command from app to thread - bits set for each command
   uint32_t DDCSampleRate;                       // DDC sample rate
+  ESocketClass Class;                           // socket option class
+  uint32_t SocketCount;                         // sockets made by MakeSocket(), so a new one can be spotted
 };
 
 
 extern struct ThreadSocketData SocketData[];        // data for each thread
 extern struct sockaddr_in reply_addr;               // destination address for outgoing data
-extern bool IsTXMode;                               // true if in TX
-extern bool SDRActive;                              // true if this SDR is running at the moment
+//
+// flags shared between threads are atomic. Plain reads and writes of them are
+// sequentially consistent; SDRActive should be changed through SetSDRActive()
+// so that threads blocked in WaitForStateChange() are woken.
+//
+extern atomic_bool IsTXMode;                        // true if in TX
+extern atomic_bool SDRActive;                       // true if this SDR is running at the moment
 extern bool ReplyAddressSet;                        // true when reply address has been set
 extern bool StartBitReceived;                       // true when "run" bit has been set
-extern bool NewMessageReceived;                     // set whenever a message is received
-extern bool ThreadError;                            // set true if a thread reports an error
+extern _Atomic uint32_t MessageTime[VNUMINCOMINGPORTS];   // ms (CLOCK_MONOTONIC_COARSE) of the last message to each port
+extern atomic_bool ThreadError;                     // set true if a thread reports an error
+extern bool ExitRequested;                          // true once SIGINT, SIGTERM or 'x' asks for an exit
 extern bool UseDebug;                               // true if debugging enabled
-extern uint8_t GlobalFIFOOverflows;                 // FIFO overflow words
+extern char DataInterface[];                        // network interface the streams are bound to; "" if any
+extern _Atomic uint8_t GlobalFIFOOverflows;         // FIFO overflow words: set with atomic_fetch_or
+extern struct BufferArena StreamArena;              // all the stream buffers; released at exit
+
+//
+// NoteMessageReceived(uint32_t Port)
+// record a message arriving on an incoming port (VPORTCOMMAND...VPORTDUCIQ), for the
+// activity watchdog. The coarse clock is read without a system call.
+//
+static inline void NoteMessageReceived(uint32_t Port)
+{
+  struct timespec Now;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &Now);
+  atomic_store_explicit(&MessageTime[Port], (uint32_t)(Now.tv_sec * 1000 + Now.tv_nsec / 1000000), memory_order_relaxed);
+}
 
 #define VBITCHANGEPORT 1                        // if set, thread must close its socket and open a new one on different port
 #define VBITINTERLEAVE 2                        // if set, DDC threads should interleave data
@@ -97,12 +139,160 @@ extern uint16_t DefaultPorts[];
 void SetPort(uint32_t ThreadNum, uint16_t PortNum);
 
 
+//
+// state change notification, so that idle threads can block instead of polling.
+// a generation count is stepped by every change of SDRActive, of a thread's
+// Cmdid bits, or of the general packet settings. An idle thread reads the
+// generation before testing its run condition, then waits for it to move on:
+//
+//   Generation = GetStateGeneration();
+//   while (!SDRActive)
+//   {
+//     (handle Cmdid bits)
+//     Generation = WaitForStateChange(Generation, StateWaitTimeout());
+//   }
+//
+// the wait times out so that a thread still sees anything changed without a notification.
+//
+#define VSTATEWAITTIMEOUT 100                       // ms
+
+uint32_t GetStateGeneration(void);
+void NotifyStateChange(void);
+
+
+//
+// WaitForStateChange(uint32_t Generation, uint32_t TimeoutMs)
+// block until the state generation differs from Generation, or TimeoutMs passes.
+// returns the current generation
+//
+uint32_t WaitForStateChange(uint32_t Generation, uint32_t TimeoutMs);
+
+
+//
+// SetSDRActive(bool Active)
+// set the run state of the whole app, trace a change, and notify waiting threads.
+// a change to true begins a new stream run.
+//
+void SetSDRActive(bool Active);
+
+
+//
+// idle power saving (setting idle_power_save).
+// once the SDR is inactive, with no stream thread in a run and no client message
+// for the activity timeout, it goes idle: the DDCs are disabled so the FIFO stops
+// filling, and threads that wake periodically use longer waits. Waits for a state
+// change are VIDLEWAITTIMEOUT long; they still end at once on a notification.
+// a general packet or the start of a run leaves idle.
+//
+#define VIDLEWAITTIMEOUT 1000                       // ms
+
+extern atomic_bool SDRIdle;                         // true while in idle power saving
+
+
+//
+// SetSDRIdle(bool Idle)
+// enter or leave idle, trace a change, and notify waiting threads.
+// idle is not entered while the SDR is active or a stream run has still to end.
+//
+void SetSDRIdle(bool Idle);
+
+
+//
+// StateWaitTimeout(void)
+// ms an idle thread should wait for a state change: longer when in idle
+//
+static inline uint32_t StateWaitTimeout(void)
+{
+  return atomic_load(&SDRIdle) ? VIDLEWAITTIMEOUT : VSTATEWAITTIMEOUT;
+}
+
+
+//
+// outgoing stream state machine.
+// SetSDRActive(true) begins a numbered run: the state goes to starting, then to
+// running once every registered stream thread has started that run. SetSDRActive(false)
+// goes to stopping, then to idle once they have all left their run loops.
+// because each run has a number, a stop and restart quicker than a thread's loop
+// still ends the old run in that thread and starts the new one from the beginning.
+// a stream thread is:
+//
+//   RegisterStreamThread(true);
+//   while (!InitError)
+//   {
+//     WaitForStreamStart(ThreadData, 1, true, &Run);
+//     (set up)
+//     while (StreamRunActive(Run) && !InitError)
+//       (transfer)
+//     StreamThreadStopped();
+//   }
+//   RegisterStreamThread(false);
+//
+typedef enum
+{
+  eStreamIdle,
+  eStreamStarting,
+  eStreamRunning,
+  eStreamStopping
+} EStreamState;
+
+extern _Atomic uint32_t StreamRun;                  // number of the current (or last) run
+
+
+//
+// RegisterStreamThread(bool Register)
+// add (or remove) the calling thread to the threads a run waits for
+//
+void RegisterStreamThread(bool Register);
+
+
+//
+// WaitForStreamStart(struct ThreadSocketData* Threads, uint32_t NumThreads, bool Rebind, uint32_t* Run)
+// block until a run later than *Run has begun, then count the thread as started and
+// set *Run to the new run's number. *Run should be 0 before the first call.
+// while waiting, any VBITCHANGEPORT command to Threads is carried out: if Rebind,
+// the thread's socket is closed and made again on the new port; the bit is cleared.
+//
+void WaitForStreamStart(struct ThreadSocketData* Threads, uint32_t NumThreads, bool Rebind, uint32_t* Run);
+
+
+//
+// StreamRunActive(uint32_t Run)
+// true while run number Run is in progress. Cheap enough for every loop pass.
+//
+static inline bool StreamRunActive(uint32_t Run)
+{
+  return atomic_load(&SDRActive) && (atomic_load(&StreamRun) == Run);
+}
+
+
+//
+// StreamThreadStopped(void)
+// called by a stream thread when it has left its run loop
+//
+void StreamThreadStopped(void);
+
+
+//
+// GetStreamState(void)
+// current state of the stream state machine
+//
+EStreamState GetStreamState(void);
+
+
 //
 // function to make an incoming or outgoing socket, bound to the specified port in the structure
 // 1st parameter is a link into the socket data table
 //
 int MakeSocket(struct ThreadSocketData* Ptr, int DDCid);
 
+//
+// connect an outgoing only socket to its destination, so packets can be sent without an address
+// and the kernel does not look up the route for each one. A socket that also receives must not be
+// connected: it would then only receive from that address and port.
+// return true if error
+//
+bool ConnectSocket(struct ThreadSocketData* Ptr, struct sockaddr_in* Dest);
+
 //
 // function ot get program version
 //
@@ -0,0 +1,477 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// threadplacement.c:
+//
+// real time scheduling priority and CPU affinity for p2app threads
+// each thread belongs to a class; each class has a priority and a CPU mask.
+// a class with priority 0 and mask 0 runs with normal scheduling on the CPUs
+// the application was started on.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "threadplacement.h"
+
+
+//
+// placement requested for each class
+//
+struct ThreadClassPlacement
+{
+  char* Name;                                   // class name on command line / in file
+  int Priority;                                 // 0 = normal; 1-99 = SCHED_FIFO priority
+  uint32_t CPUMask;                             // bit n = CPU n; 0 = startup CPUs
+};
+
+struct ThreadClassPlacement ClassPlacement[VNUMTHREADCLASSES] =
+{
+  {"ddc", 0, 0},
+  {"duc", 0, 0},
+  {"hipri", 0, 0},
+  {"control", 0, 0},
+  {"key", 0, 0}
+};
+
+
+//
+// placement actually applied to each recorded thread
+//
+struct PlacedThread
+{
+  char* Name;
+  EThreadClass Class;
+  bool Applied;                                 // false if the placement was refused
+};
+
+struct PlacedThread PlacedThreads[VMAXPLACEDTHREADS];
+uint32_t PlacedThreadCount = 0;
+bool PlacementReported = false;                 // true once the startup report has been printed
+
+bool MemoryLockRequested = false;               // true if mlockall() requested
+bool MemoryLocked = false;                      // true if mlockall() succeeded
+bool StartupCPUsRead = false;
+cpu_set_t StartupCPUs;                          // CPUs the application was started on
+
+
+//
+// threads tracked for CPU accounting: every named thread, and the main thread
+//
+struct TrackedThread
+{
+  bool Used;
+  pid_t Tid;
+  clockid_t Clock;                              // the thread's CPU time clock
+  char Name[VTHREADNAMESIZE];
+};
+
+static struct TrackedThread TrackedThreads[VMAXTRACKEDTHREADS];
+static pthread_mutex_t TrackedMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+//
+// get the CPU set for a class
+// the 1st call saves the CPUs the application was started on, used for mask 0
+//
+static void GetClassCPUs(EThreadClass Class, cpu_set_t* CPUs)
+{
+  uint32_t CPU;
+
+  if (!StartupCPUsRead)
+  {
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &StartupCPUs) != 0)
+    {
+      CPU_ZERO(&StartupCPUs);
+      for (CPU = 0; CPU < (uint32_t)sysconf(_SC_NPROCESSORS_CONF); CPU++)
+        CPU_SET(CPU, &StartupCPUs);
+    }
+    StartupCPUsRead = true;
+  }
+
+  if (ClassPlacement[Class].CPUMask == 0)
+    memcpy(CPUs, &StartupCPUs, sizeof(cpu_set_t));
+  else
+  {
+    CPU_ZERO(CPUs);
+    for (CPU = 0; CPU < 32; CPU++)
+      if (ClassPlacement[Class].CPUMask & (1u << CPU))
+        CPU_SET(CPU, CPUs);
+  }
+}
+
+
+//
+// add a thread to the report table
+// threads created after the startup report are reported straight away
+//
+static void RecordPlacedThread(char* Name, EThreadClass Class, bool Applied)
+{
+  struct PlacedThread* Entry;
+
+  if (PlacedThreadCount >= VMAXPLACEDTHREADS)
+    return;
+  Entry = PlacedThreads + PlacedThreadCount++;
+  Entry->Name = Name;
+  Entry->Class = Class;
+  Entry->Applied = Applied;
+  if (PlacementReported)
+    ReportThreadPlacement();
+}
+
+
+//
+// set the placement for a thread class
+//
+bool SetThreadPlacement(EThreadClass Class, int Priority, uint32_t CPUMask)
+{
+  uint32_t NumCPUs;
+
+  NumCPUs = sysconf(_SC_NPROCESSORS_CONF);
+  if ((Priority < 0) || (Priority > sched_get_priority_max(SCHED_FIFO)))
+  {
+    printf("thread priority %d out of range\n", Priority);
+    return true;
+  }
+  if ((NumCPUs < 32) && ((CPUMask >> NumCPUs) != 0))
+  {
+    printf("CPU mask 0x%x selects CPUs that don't exist\n", CPUMask);
+    return true;
+  }
+  ClassPlacement[Class].Priority = Priority;
+  ClassPlacement[Class].CPUMask = CPUMask;
+  return false;
+}
+
+
+//
+// find a class by name, and set its placement
+//
+static bool SetNamedThreadPlacement(char* ClassName, int Priority, uint32_t CPUMask)
+{
+  int Class;
+
+  for (Class = 0; Class < VNUMTHREADCLASSES; Class++)
+    if (strcmp(ClassName, ClassPlacement[Class].Name) == 0)
+      return SetThreadPlacement((EThreadClass)Class, Priority, CPUMask);
+  printf("unknown thread class %s: must be ddc, duc, hipri, control or key\n", ClassName);
+  return true;
+}
+
+
+//
+// parse command line placement "class,priority,mask"
+//
+bool ParseThreadPlacement(char* Setting)
+{
+  char ClassName[16];
+  int Priority;
+  unsigned int CPUMask;
+
+  if (sscanf(Setting, "%15[^,],%d,%i", ClassName, &Priority, &CPUMask) != 3)
+  {
+    printf("error parsing thread placement %s\n", Setting);
+    return true;
+  }
+  return SetNamedThreadPlacement(ClassName, Priority, CPUMask);
+}
+
+
+//
+// read placement settings from a file
+//
+bool ReadThreadPlacementFile(char* Filename)
+{
+  FILE* File;
+  char Line[128];
+  char Keyword[16];
+  char ClassName[16];
+  int Priority;
+  unsigned int CPUMask;
+  int LineNumber = 0;
+  bool Error = false;
+
+  File = fopen(Filename, "r");
+  if (File == NULL)
+  {
+    printf("could not open thread placement file %s\n", Filename);
+    return true;
+  }
+  while (fgets(Line, sizeof(Line), File) != NULL)
+  {
+    LineNumber++;
+    if (strchr(Line, '#') != NULL)
+      *strchr(Line, '#') = 0;                               // strip comment
+    if (sscanf(Line, "%15s", Keyword) != 1)
+      continue;                                             // blank line
+    if (strcmp(Keyword, "mlockall") == 0)
+      SetMemoryLock(true);
+    else if ((strcmp(Keyword, "thread") == 0) &&
+             (sscanf(Line, "%*s %15s %d %i", ClassName, &Priority, &CPUMask) == 3))
+      Error |= SetNamedThreadPlacement(ClassName, Priority, CPUMask);
+    else
+    {
+      printf("%s line %d: not understood\n", Filename, LineNumber);
+      Error = true;
+    }
+  }
+  fclose(File);
+  return Error;
+}
+
+
+//
+// request memory locking
+//
+void SetMemoryLock(bool Enabled)
+{
+  MemoryLockRequested = Enabled;
+}
+
+
+//
+// lock all pages into RAM, so real time threads never take a page fault
+//
+bool LockProcessMemory(void)
+{
+  if (!MemoryLockRequested)
+    return false;
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+  {
+    perror("mlockall");
+    return true;
+  }
+  MemoryLocked = true;
+  return false;
+}
+
+
+//
+// the kernel makes a thread's CPU time clock id from its tid:
+// (~tid << 3) | per thread flag | CPUCLOCK_SCHED
+//
+static pid_t ClockTid(clockid_t Clock)
+{
+  return (pid_t)~(Clock >> 3);
+}
+
+
+//
+// add a thread to the accounting table, or rename it if it is there already
+// entries of threads that have ended (their CPU clock is gone) are reused
+//
+static void TrackThread(clockid_t Clock, char* Name)
+{
+  struct TrackedThread* Entry;
+  struct TrackedThread* Found = NULL;
+  struct timespec Time;
+  pid_t Tid = ClockTid(Clock);
+  uint32_t Cntr;
+
+  pthread_mutex_lock(&TrackedMutex);
+  for (Cntr = 0; Cntr < VMAXTRACKEDTHREADS; Cntr++)
+  {
+    Entry = TrackedThreads + Cntr;
+    if (Entry->Used && (Entry->Tid == Tid))
+      Found = Entry;
+    else if (Entry->Used && (clock_gettime(Entry->Clock, &Time) != 0))
+      Entry->Used = false;
+  }
+  for (Cntr = 0; (Found == NULL) && (Cntr < VMAXTRACKEDTHREADS); Cntr++)
+    if (!TrackedThreads[Cntr].Used)
+      Found = TrackedThreads + Cntr;
+  if (Found != NULL)
+  {
+    Found->Used = true;
+    Found->Tid = Tid;
+    Found->Clock = Clock;
+    snprintf(Found->Name, sizeof(Found->Name), "%s", Name);
+  }
+  pthread_mutex_unlock(&TrackedMutex);
+}
+
+
+//
+// read the context switch counts of a thread from /proc
+//
+static void ReadContextSwitches(pid_t Tid, struct ThreadAccounting* Account)
+{
+  char Path[48], Line[80];
+  unsigned long long Count;
+  FILE* File;
+
+  Account->Wakeups = 0;
+  Account->Preemptions = 0;
+  snprintf(Path, sizeof(Path), "/proc/self/task/%d/status", (int)Tid);
+  File = fopen(Path, "r");
+  if (File == NULL)
+    return;
+  while (fgets(Line, sizeof(Line), File) != NULL)
+  {
+    if (sscanf(Line, "voluntary_ctxt_switches: %llu", &Count) == 1)
+      Account->Wakeups = Count;
+    else if (sscanf(Line, "nonvoluntary_ctxt_switches: %llu", &Count) == 1)
+      Account->Preemptions = Count;
+  }
+  fclose(File);
+}
+
+
+uint32_t GetThreadAccounting(struct ThreadAccounting* Threads, uint32_t MaxThreads)
+{
+  struct TrackedThread* Entry;
+  struct timespec Time;
+  uint32_t Cntr, Count = 0;
+
+  pthread_mutex_lock(&TrackedMutex);
+  for (Cntr = 0; (Cntr < VMAXTRACKEDTHREADS) && (Count < MaxThreads); Cntr++)
+  {
+    Entry = TrackedThreads + Cntr;
+    if (!Entry->Used)
+      continue;
+    if (clock_gettime(Entry->Clock, &Time) != 0)
+    {
+      Entry->Used = false;                                  // the thread has ended
+      continue;
+    }
+    memcpy(Threads[Count].Name, Entry->Name, sizeof(Entry->Name));
+    Threads[Count].Tid = Entry->Tid;
+    Threads[Count].CPUTime = (uint64_t)Time.tv_sec * 1000000000ULL + Time.tv_nsec;
+    ReadContextSwitches(Entry->Tid, Threads + Count);
+    Count++;
+  }
+  pthread_mutex_unlock(&TrackedMutex);
+  return Count;
+}
+
+
+//
+// name a thread for top, gdb and the event trace; linux truncates names to 15 characters
+// the thread is tracked for CPU accounting too
+//
+void SetThreadName(pthread_t Thread, char* Name)
+{
+  char Truncated[16];
+  clockid_t Clock;
+
+  snprintf(Truncated, sizeof(Truncated), "%s", Name);
+  pthread_setname_np(Thread, Truncated);
+  if (pthread_getcpuclockid(Thread, &Clock) == 0)
+    TrackThread(Clock, Name);
+}
+
+
+//
+// create a thread with its class placement
+//
+int CreatePlacedThread(pthread_t* Thread, EThreadClass Class, char* Name, void* (*Function)(void*), void* Arg)
+{
+  pthread_attr_t Attributes;
+  struct sched_param Param;
+  cpu_set_t CPUs;
+  int Result;
+
+  memset(&Param, 0, sizeof(Param));
+  Param.sched_priority = ClassPlacement[Class].Priority;
+  GetClassCPUs(Class, &CPUs);
+
+  pthread_attr_init(&Attributes);
+  pthread_attr_setinheritsched(&Attributes, PTHREAD_EXPLICIT_SCHED);
+  pthread_attr_setschedpolicy(&Attributes, (Param.sched_priority == 0) ? SCHED_OTHER : SCHED_FIFO);
+  pthread_attr_setschedparam(&Attributes, &Param);
+  pthread_attr_setaffinity_np(&Attributes, sizeof(cpu_set_t), &CPUs);
+  Result = pthread_create(Thread, &Attributes, Function, Arg);
+  pthread_attr_destroy(&Attributes);
+
+  if (Result == EPERM || Result == EINVAL)
+  {
+    printf("%s thread: placement refused, using default scheduling\n", Name);
+    Result = pthread_create(Thread, NULL, Function, Arg);
+    if (Result == 0)
+      RecordPlacedThread(Name, Class, false);
+  }
+  else if (Result == 0)
+    RecordPlacedThread(Name, Class, true);
+  if (Result == 0)
+    SetThreadName(*Thread, Name);
+  return Result;
+}
+
+
+//
+// apply a class placement to the calling thread
+//
+void ApplyThreadPlacement(EThreadClass Class, char* Name)
+{
+  struct sched_param Param;
+  cpu_set_t CPUs;
+  clockid_t Clock;
+  bool Applied = true;
+
+  memset(&Param, 0, sizeof(Param));
+  Param.sched_priority = ClassPlacement[Class].Priority;
+  GetClassCPUs(Class, &CPUs);
+
+  if (pthread_setschedparam(pthread_self(), (Param.sched_priority == 0) ? SCHED_OTHER : SCHED_FIFO, &Param) != 0)
+    Applied = false;
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &CPUs) != 0)
+    Applied = false;
+  if (!Applied)
+    printf("%s thread: placement refused\n", Name);
+  RecordPlacedThread(Name, Class, Applied);
+  if (pthread_getcpuclockid(pthread_self(), &Clock) == 0)
+    TrackThread(Clock, Name);
+}
+
+
+//
+// print the placement of each recorded thread
+// after the 1st call only the newly recorded thread is printed
+//
+void ReportThreadPlacement(void)
+{
+  uint32_t Cntr;
+  struct PlacedThread* Entry;
+  struct ThreadClassPlacement* Placement;
+
+  if (!PlacementReported)
+  {
+    printf("thread placement (memory %slocked):\n", MemoryLocked ? "" : "not ");
+    Cntr = 0;
+  }
+  else
+    Cntr = PlacedThreadCount - 1;
+  PlacementReported = true;
+
+  for (; Cntr < PlacedThreadCount; Cntr++)
+  {
+    Entry = PlacedThreads + Cntr;
+    Placement = ClassPlacement + Entry->Class;
+    if (!Entry->Applied)
+      printf("  %-20s class %-8s default scheduling (placement refused)\n", Entry->Name, Placement->Name);
+    else
+    {
+      printf("  %-20s class %-8s ", Entry->Name, Placement->Name);
+      if (Placement->Priority == 0)
+        printf("normal scheduling, ");
+      else
+        printf("SCHED_FIFO %d, ", Placement->Priority);
+      if (Placement->CPUMask == 0)
+        printf("startup CPUs\n");
+      else
+        printf("CPUs 0x%x\n", Placement->CPUMask);
+    }
+  }
+}
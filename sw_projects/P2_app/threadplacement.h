@@ -0,0 +1,140 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// threadplacement.h:
+//
+// header: real time scheduling priority and CPU affinity for p2app threads
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __threadplacement_h
+#define __threadplacement_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+
+//
+// thread classes. Each class has one scheduling priority and one CPU mask.
+//
+typedef enum
+{
+  eThreadDDC,                                   // DDC I/Q reader, demux and sender threads
+  eThreadDUC,                                   // DUC I/Q and speaker audio from the client
+  eThreadHighPriority,                          // network event loop, outgoing high priority and mic
+  eThreadControl,                               // CAT, front panel, console and activity checking
+  eThreadKey,                                   // key watch: fast polling of the PTT and key inputs
+  VNUMTHREADCLASSES
+} EThreadClass;
+
+#define VMAXPLACEDTHREADS 16                    // max threads recorded for the startup report
+#define VMAXTRACKEDTHREADS 48                   // max threads tracked for CPU accounting
+#define VTHREADNAMESIZE 24
+
+
+//
+// CPU use of one thread, for telemetry
+//
+struct ThreadAccounting
+{
+  char Name[VTHREADNAMESIZE];                   // as given to SetThreadName() or ApplyThreadPlacement()
+  int Tid;
+  uint64_t CPUTime;                             // ns: the thread's CPU time clock
+  uint64_t Wakeups;                             // voluntary context switches: the thread blocked and was woken
+  uint64_t Preemptions;                         // involuntary context switches
+};
+
+
+//
+// SetThreadPlacement(EThreadClass Class, int Priority, uint32_t CPUMask)
+// set the placement for a thread class. Priority 0 = normal scheduling; 1-99 = SCHED_FIFO.
+// CPUMask has bit n set for CPU n; 0 = any CPU.
+// return true if error
+//
+bool SetThreadPlacement(EThreadClass Class, int Priority, uint32_t CPUMask);
+
+
+//
+// ParseThreadPlacement(char* Setting)
+// parse a command line placement "class,priority,mask" eg. "ddc,80,0x8"
+// class is one of ddc, duc, hipri, control, key
+// return true if error
+//
+bool ParseThreadPlacement(char* Setting);
+
+
+//
+// ReadThreadPlacementFile(char* Filename)
+// read placement settings from a file. One setting per line; # starts a comment.
+//   thread <class> <priority> <mask>
+//   mlockall
+// return true if error
+//
+bool ReadThreadPlacementFile(char* Filename);
+
+
+//
+// SetMemoryLock(bool Enabled)
+// if true, LockProcessMemory() locks all current and future pages into RAM
+//
+void SetMemoryLock(bool Enabled);
+
+
+//
+// LockProcessMemory(void)
+// call mlockall() if it has been requested
+// return true if error
+//
+bool LockProcessMemory(void);
+
+
+//
+// CreatePlacedThread(pthread_t* Thread, EThreadClass Class, char* Name, void* (*Function)(void*), void* Arg)
+// pthread_create() a thread with the placement of its class, and record it for the startup report.
+// if the placement is refused (eg. no permission for SCHED_FIFO) the thread is created without it.
+// the thread is also named, as SetThreadName().
+// return value as pthread_create()
+//
+int CreatePlacedThread(pthread_t* Thread, EThreadClass Class, char* Name, void* (*Function)(void*), void* Arg);
+
+
+//
+// SetThreadName(pthread_t Thread, char* Name)
+// name a thread, as seen by top -H, gdb and the event trace. Names over 15 characters are cut short.
+// the thread is tracked for GetThreadAccounting() too. Call before the thread is detached.
+//
+void SetThreadName(pthread_t Thread, char* Name);
+
+
+//
+// ApplyThreadPlacement(EThreadClass Class, char* Name)
+// apply a class placement to the calling thread, and record it for the startup report.
+// threads created later by the calling thread inherit the placement.
+// the calling thread is tracked for GetThreadAccounting() under Name.
+//
+void ApplyThreadPlacement(EThreadClass Class, char* Name);
+
+
+//
+// ReportThreadPlacement(void)
+// print the placement applied to each recorded thread
+//
+void ReportThreadPlacement(void);
+
+
+//
+// GetThreadAccounting(struct ThreadAccounting* Threads, uint32_t MaxThreads)
+// CPU time and context switches of each tracked thread still running. Returns the number found.
+//
+uint32_t GetThreadAccounting(struct ThreadAccounting* Threads, uint32_t MaxThreads);
+
+
+#endif
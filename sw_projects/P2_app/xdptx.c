@@ -0,0 +1,452 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// xdptx.c:
+//
+// AF_XDP transmitter for outgoing DDC I/Q packets
+// the packets bypass the kernel UDP/IP stack: each packet is written complete
+// (ethernet, IP and UDP headers then the payload) into a frame of packet memory
+// (the UMEM) shared with the network driver, and its frame number is put on the
+// TX ring. The driver returns sent frames on the completion ring.
+// only the linux uapi header is needed; there is no libbpf or libxdp dependency.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_xdp.h>
+#include "xdptx.h"
+#include "p2config.h"
+
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define VXDPFRAMESIZE 2048                      // bytes per UMEM frame: one packet
+#define VXDPNUMFRAMES 4096                      // frames in UMEM (8MB)
+#define VXDPRINGSIZE 2048                       // entries in each ring
+#define VXDPSENDTIMEOUT 10000                   // us to wait for a free frame before giving up
+#define VXDPWAIT 50                             // us between checks for a free frame
+
+
+//
+// one ring, mapped from the socket. Producer and consumer are free running counts
+//
+struct XDPRing
+{
+  uint32_t* Producer;
+  uint32_t* Consumer;
+  uint32_t* Flags;
+  void* Entries;
+  uint32_t Mask;                                // entries - 1
+  void* Map;
+  size_t MapSize;
+};
+
+static int XDPfd = -1;
+static bool XDPNeedWakeup = false;              // true if the TX ring must be kicked with sendto()
+static uint8_t* UMEM = NULL;
+static struct XDPRing TXRing, CompletionRing, FillRing;
+static uint64_t FreeFrames[VXDPNUMFRAMES];      // UMEM addresses not in use
+static uint32_t FreeFrameCount = 0;
+static uint32_t TXCached;                       // TX ring producer, before it is published
+static uint16_t IPIdent = 0;
+static pthread_mutex_t XDPMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char XDPInterface[IFNAMSIZ];
+static uint8_t SourceMAC[6];
+static uint32_t SourceIP;                       // network byte order
+
+
+//
+// map one ring from the socket
+// return true if error
+//
+static bool MapRing(struct XDPRing* Ring, struct xdp_ring_offset* Offsets, size_t EntrySize, off_t PageOffset)
+{
+  uint8_t* Map;
+
+  Ring->MapSize = Offsets->desc + VXDPRINGSIZE * EntrySize;
+  Map = mmap(NULL, Ring->MapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, XDPfd, PageOffset);
+  if (Map == MAP_FAILED)
+    return true;
+  Ring->Map = Map;
+  Ring->Producer = (uint32_t*)(Map + Offsets->producer);
+  Ring->Consumer = (uint32_t*)(Map + Offsets->consumer);
+  Ring->Flags = (uint32_t*)(Map + Offsets->flags);
+  Ring->Entries = Map + Offsets->desc;
+  Ring->Mask = VXDPRINGSIZE - 1;
+  return false;
+}
+
+
+//
+// find the interface MAC and IPv4 address
+// return true if error
+//
+static bool GetInterfaceAddresses(char* Interface)
+{
+  struct ifreq Request;
+  int fd;
+  bool Error = false;
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    return true;
+  memset(&Request, 0, sizeof(Request));
+  strncpy(Request.ifr_name, Interface, IFNAMSIZ - 1);
+  if (ioctl(fd, SIOCGIFHWADDR, &Request) < 0)
+    Error = true;
+  else
+    memcpy(SourceMAC, Request.ifr_hwaddr.sa_data, 6);
+  if (!Error && (ioctl(fd, SIOCGIFADDR, &Request) < 0))
+    Error = true;
+  else if (!Error)
+    SourceIP = ((struct sockaddr_in*)&Request.ifr_addr)->sin_addr.s_addr;
+  close(fd);
+  return Error;
+}
+
+
+//
+// open the transmitter
+//
+bool OpenXDPTransmitter(char* Interface)
+{
+  struct xdp_umem_reg UMEMReg;
+  struct xdp_mmap_offsets Offsets;
+  struct sockaddr_xdp Addr;
+  socklen_t Length = sizeof(Offsets);
+  int RingSize = VXDPRINGSIZE;
+  uint32_t Cntr;
+  uint32_t Mode;                                // BindFlags entry that was accepted
+  uint16_t BindFlags[3] = {XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP, XDP_COPY | XDP_USE_NEED_WAKEUP, XDP_COPY};
+
+  if (XDPfd >= 0)
+    return false;
+  memset(XDPInterface, 0, sizeof(XDPInterface));
+  strncpy(XDPInterface, Interface, IFNAMSIZ - 1);
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sxdp_family = AF_XDP;
+  Addr.sxdp_ifindex = if_nametoindex(Interface);
+  Addr.sxdp_queue_id = 0;
+  if ((Addr.sxdp_ifindex == 0) || GetInterfaceAddresses(Interface))
+  {
+    printf("XDP: interface %s has no address\n", Interface);
+    return true;
+  }
+
+  XDPfd = socket(AF_XDP, SOCK_RAW, 0);
+  if (XDPfd < 0)
+  {
+    printf("XDP: AF_XDP socket not available: %s\n", strerror(errno));
+    return true;
+  }
+  UMEM = mmap(NULL, VXDPNUMFRAMES * VXDPFRAMESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (UMEM == MAP_FAILED)
+  {
+    UMEM = NULL;
+    printf("XDP: packet memory not allocated\n");
+    CloseXDPTransmitter();
+    return true;
+  }
+  memset(&UMEMReg, 0, sizeof(UMEMReg));
+  UMEMReg.addr = (uint64_t)(uintptr_t)UMEM;
+  UMEMReg.len = VXDPNUMFRAMES * VXDPFRAMESIZE;
+  UMEMReg.chunk_size = VXDPFRAMESIZE;
+  UMEMReg.headroom = 0;
+  memset(&TXRing, 0, sizeof(TXRing));
+  memset(&CompletionRing, 0, sizeof(CompletionRing));
+  memset(&FillRing, 0, sizeof(FillRing));
+  //
+  // the fill ring is only used to receive, but the kernel needs it to bind
+  //
+  if ((setsockopt(XDPfd, SOL_XDP, XDP_UMEM_REG, &UMEMReg, sizeof(UMEMReg)) < 0) ||
+      (setsockopt(XDPfd, SOL_XDP, XDP_UMEM_FILL_RING, &RingSize, sizeof(RingSize)) < 0) ||
+      (setsockopt(XDPfd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &RingSize, sizeof(RingSize)) < 0) ||
+      (setsockopt(XDPfd, SOL_XDP, XDP_TX_RING, &RingSize, sizeof(RingSize)) < 0) ||
+      (getsockopt(XDPfd, SOL_XDP, XDP_MMAP_OFFSETS, &Offsets, &Length) < 0))
+  {
+    printf("XDP: socket setup failed: %s\n", strerror(errno));
+    CloseXDPTransmitter();
+    return true;
+  }
+  if (MapRing(&FillRing, &Offsets.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+      MapRing(&CompletionRing, &Offsets.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+      MapRing(&TXRing, &Offsets.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+  {
+    printf("XDP: ring map failed: %s\n", strerror(errno));
+    CloseXDPTransmitter();
+    return true;
+  }
+  //
+  // bind: zero copy if the driver supports it, else copy mode
+  //
+  for (Mode = 0; Mode < 3; Mode++)
+  {
+    Addr.sxdp_flags = BindFlags[Mode];
+    if (bind(XDPfd, (struct sockaddr*)&Addr, sizeof(Addr)) == 0)
+      break;
+  }
+  if (Mode == 3)
+  {
+    printf("XDP: bind to %s queue 0 failed: %s\n", Interface, strerror(errno));
+    CloseXDPTransmitter();
+    return true;
+  }
+  XDPNeedWakeup = (BindFlags[Mode] & XDP_USE_NEED_WAKEUP) != 0;
+
+  for (Cntr = 0; Cntr < VXDPNUMFRAMES; Cntr++)
+    FreeFrames[Cntr] = (uint64_t)Cntr * VXDPFRAMESIZE;
+  FreeFrameCount = VXDPNUMFRAMES;
+  TXCached = *TXRing.Producer;
+  printf("XDP: transmitting on %s queue 0, %s mode\n", Interface, (Mode == 0) ? "zero copy" : "copy");
+  return false;
+}
+
+
+//
+// return true if open
+//
+bool XDPTransmitterOpen(void)
+{
+  return XDPfd >= 0;
+}
+
+
+//
+// ones complement sum of 16 bit big endian words
+//
+static uint32_t HeaderSum(uint8_t* Data, uint32_t Length)
+{
+  uint32_t Sum = 0;
+  uint32_t Cntr;
+
+  for (Cntr = 0; Cntr < Length; Cntr += 2)
+    Sum += (Data[Cntr] << 8) | Data[Cntr + 1];
+  return Sum;
+}
+
+
+//
+// find a MAC address in the neighbour table
+// return true if not found
+//
+static bool FindNeighbourMAC(struct in_addr Addr, uint8_t* MAC)
+{
+  FILE* File;
+  char Line[256];
+  char IP[INET_ADDRSTRLEN];
+  char Wanted[INET_ADDRSTRLEN];
+  char Device[IFNAMSIZ + 1];
+  unsigned int Type, Flags;
+  bool Error = true;
+
+  inet_ntop(AF_INET, &Addr, Wanted, sizeof(Wanted));
+  File = fopen("/proc/net/arp", "r");
+  if (File == NULL)
+    return true;
+  while (Error && (fgets(Line, sizeof(Line), File) != NULL))
+  {
+    if ((sscanf(Line, "%15s %x %x %hhx:%hhx:%hhx:%hhx:%hhx:%hhx %*s %16s", IP, &Type, &Flags,
+                MAC, MAC + 1, MAC + 2, MAC + 3, MAC + 4, MAC + 5, Device) == 10) &&
+        (strcmp(IP, Wanted) == 0) && (strcmp(Device, XDPInterface) == 0) && (Flags & 2))
+      Error = false;                                        // flag 2 = complete entry
+  }
+  fclose(File);
+  return Error;
+}
+
+
+//
+// build the headers for one destination
+//
+bool XDPSetDestination(struct XDPDest* Dest, struct sockaddr_in* Addr, uint16_t SourcePort)
+{
+  uint8_t* Header = Dest->Header;
+
+  memset(Dest, 0, sizeof(struct XDPDest));
+  if (FindNeighbourMAC(Addr->sin_addr, Header))
+    return true;
+  memcpy(Header + 6, SourceMAC, 6);
+  Header[12] = 0x08;                                        // ethertype IPv4
+  Header[13] = 0x00;
+  Header[14] = 0x45;                                        // IPv4, 20 byte header
+  Header[15] = P2Config.Socket[eSocketDDC].DSCP << 2;       // same marking as the DDC sockets
+  Header[20] = 0x40;                                        // don't fragment
+  Header[22] = 64;                                          // TTL
+  Header[23] = 17;                                          // UDP
+  memcpy(Header + 26, &SourceIP, 4);
+  memcpy(Header + 30, &Addr->sin_addr.s_addr, 4);
+  Header[34] = SourcePort >> 8;
+  Header[35] = SourcePort & 0xFF;
+  memcpy(Header + 36, &Addr->sin_port, 2);                  // UDP checksum 0 = none (allowed for IPv4)
+  Dest->HeaderSum = HeaderSum(Header + 14, 20);
+  return false;
+}
+
+
+//
+// return sent frames from the completion ring to the free list
+//
+static void ReapCompletions(void)
+{
+  uint32_t Consumer = *CompletionRing.Consumer;
+  uint32_t Producer = __atomic_load_n(CompletionRing.Producer, __ATOMIC_ACQUIRE);
+  uint64_t* Entries = (uint64_t*)CompletionRing.Entries;
+
+  while (Consumer != Producer)
+    FreeFrames[FreeFrameCount++] = Entries[Consumer++ & CompletionRing.Mask];
+  __atomic_store_n(CompletionRing.Consumer, Consumer, __ATOMIC_RELEASE);
+}
+
+
+//
+// publish the TX ring entries written so far, and kick the driver if it needs it
+// return true if error
+//
+static bool KickTX(void)
+{
+  __atomic_store_n(TXRing.Producer, TXCached, __ATOMIC_RELEASE);
+  if (XDPNeedWakeup && !(__atomic_load_n(TXRing.Flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP))
+    return false;
+  if ((sendto(XDPfd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0) &&
+      (errno != EAGAIN) && (errno != EBUSY) && (errno != ENOBUFS))
+    return true;
+  return false;
+}
+
+
+//
+// get a free frame and a TX ring entry, waiting for the driver to send a frame if needed
+// return true if error
+//
+static bool WaitForFrame(void)
+{
+  uint32_t Waited = 0;
+
+  while (true)
+  {
+    ReapCompletions();
+    if ((FreeFrameCount != 0) &&
+        ((TXCached - __atomic_load_n(TXRing.Consumer, __ATOMIC_ACQUIRE)) < VXDPRINGSIZE))
+      return false;
+    if (KickTX() || (Waited >= VXDPSENDTIMEOUT))
+      return true;
+    usleep(VXDPWAIT);
+    Waited += VXDPWAIT;
+  }
+}
+
+
+//
+// send packets
+//
+uint32_t XDPSendPackets(struct XDPDest* Dest, struct iovec* Iovecs, uint32_t IovecsPerPacket, uint32_t Count)
+{
+  struct xdp_desc* Desc;
+  uint8_t* Frame;
+  uint32_t Packet;
+  uint32_t Cntr;
+  uint32_t Length;
+  uint32_t Sum;
+  bool Error = false;
+
+  if (XDPfd < 0)
+    return 0;
+  pthread_mutex_lock(&XDPMutex);
+  for (Packet = 0; Packet < Count; Packet++)
+  {
+    if (WaitForFrame())
+    {
+      Error = true;
+      break;
+    }
+    Desc = (struct xdp_desc*)TXRing.Entries + (TXCached & TXRing.Mask);
+    Desc->addr = FreeFrames[--FreeFrameCount];
+    Desc->options = 0;
+    Frame = UMEM + Desc->addr;
+    memcpy(Frame, Dest->Header, VXDPHEADERSIZE);
+    Length = VXDPHEADERSIZE;
+    for (Cntr = 0; Cntr < IovecsPerPacket; Cntr++, Iovecs++)
+    {
+      if ((Length + Iovecs->iov_len) > VXDPFRAMESIZE)
+      {
+        Error = true;                                       // too big for one frame
+        break;
+      }
+      memcpy(Frame + Length, Iovecs->iov_base, Iovecs->iov_len);
+      Length += Iovecs->iov_len;
+    }
+    if (Error)
+    {
+      FreeFrameCount++;                                     // frame not used
+      break;
+    }
+    //
+    // fill in the per packet IP and UDP fields
+    //
+    Frame[16] = (Length - 14) >> 8;                         // IP total length
+    Frame[17] = (Length - 14) & 0xFF;
+    Frame[18] = IPIdent >> 8;
+    Frame[19] = IPIdent & 0xFF;
+    IPIdent++;
+    Sum = Dest->HeaderSum + (Length - 14) + ((Frame[18] << 8) | Frame[19]);
+    while (Sum >> 16)
+      Sum = (Sum & 0xFFFF) + (Sum >> 16);
+    Sum = ~Sum & 0xFFFF;
+    Frame[24] = Sum >> 8;
+    Frame[25] = Sum & 0xFF;
+    Frame[38] = (Length - 34) >> 8;                         // UDP length
+    Frame[39] = (Length - 34) & 0xFF;
+    Desc->len = Length;
+    TXCached++;
+  }
+  if (KickTX())
+    Packet = 0;
+  pthread_mutex_unlock(&XDPMutex);
+  return Packet;
+}
+
+
+//
+// close the transmitter
+//
+void CloseXDPTransmitter(void)
+{
+  if (TXRing.Map != NULL)
+    munmap(TXRing.Map, TXRing.MapSize);
+  if (CompletionRing.Map != NULL)
+    munmap(CompletionRing.Map, CompletionRing.MapSize);
+  if (FillRing.Map != NULL)
+    munmap(FillRing.Map, FillRing.MapSize);
+  memset(&TXRing, 0, sizeof(TXRing));
+  memset(&CompletionRing, 0, sizeof(CompletionRing));
+  memset(&FillRing, 0, sizeof(FillRing));
+  if (XDPfd >= 0)
+    close(XDPfd);
+  XDPfd = -1;
+  if (UMEM != NULL)
+    munmap(UMEM, VXDPNUMFRAMES * VXDPFRAMESIZE);
+  UMEM = NULL;
+  FreeFrameCount = 0;
+}
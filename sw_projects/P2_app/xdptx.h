@@ -0,0 +1,85 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// xdptx.h:
+//
+// header: AF_XDP transmitter for outgoing DDC I/Q packets
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __xdptx_h
+#define __xdptx_h
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+
+#define VXDPHEADERSIZE 42                       // ethernet 14 + IPv4 20 + UDP 8
+
+
+//
+// one destination: a prebuilt ethernet, IP and UDP header
+// the IP length, ID and checksum and the UDP length are filled in for each packet
+//
+struct XDPDest
+{
+  uint8_t Header[VXDPHEADERSIZE];
+  uint32_t HeaderSum;                           // IP header checksum of the fixed fields
+};
+
+
+//
+// OpenXDPTransmitter(char* Interface)
+// open an AF_XDP socket on queue 0 of the interface, with its own packet memory (UMEM).
+// zero copy mode is used if the network driver supports it, otherwise copy mode.
+// no XDP program is needed: the socket only transmits.
+// return true if error (eg. a kernel without AF_XDP, or no CAP_NET_RAW)
+//
+bool OpenXDPTransmitter(char* Interface);
+
+
+//
+// XDPTransmitterOpen(void)
+// return true if the transmitter is open
+//
+bool XDPTransmitterOpen(void);
+
+
+//
+// XDPSetDestination(struct XDPDest* Dest, struct sockaddr_in* Addr, uint16_t SourcePort)
+// build the headers for packets from SourcePort (host byte order) to Addr.
+// the destination MAC address is found in the kernel neighbour (ARP) table,
+// so Addr must be on the local network and have already sent to us.
+// return true if error
+//
+bool XDPSetDestination(struct XDPDest* Dest, struct sockaddr_in* Addr, uint16_t SourcePort);
+
+
+//
+// XDPSendPackets(struct XDPDest* Dest, struct iovec* Iovecs, uint32_t IovecsPerPacket, uint32_t Count)
+// send Count UDP packets to Dest. The payload of packet n is the IovecsPerPacket iovecs
+// starting at Iovecs[n * IovecsPerPacket]; it is copied into the packet memory.
+// safe to call from more than one thread.
+// return the packets queued to send: fewer than Count if error. If the driver
+// can't be woken to send them, 0, as they may not go.
+//
+uint32_t XDPSendPackets(struct XDPDest* Dest, struct iovec* Iovecs, uint32_t IovecsPerPacket, uint32_t Count);
+
+
+//
+// CloseXDPTransmitter(void)
+// close the socket and free the packet memory
+//
+void CloseXDPTransmitter(void);
+
+
+#endif
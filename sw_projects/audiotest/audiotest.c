@@ -2,10 +2,15 @@
 // main file for audio test GUI app
 // GUI created with GTK3
 //
+// ./audiotest -l [-n chirps]
+// runs the loopback latency test instead of the GUI: needs the line out
+// (or speaker) output connected to the line input.
+//
 #include <gtk/gtk.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,6 +21,7 @@
 #include <math.h>
 #include <semaphore.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "../common/saturntypes.h"
 #include "../common/hwaccess.h"                     // access to PCIe read & write
@@ -74,6 +80,7 @@ bool GSpeakerTestIsLeftChannel;		// true for left channel speaker test
 #define VSAMPLEWORDSPERDMA 256
 #define VDMAWORDSPERDMA 128							// 8 byte memory words
 #define VDMATRANSFERS (VTOTALSAMPLES * 4) / VDMATRANSFERSIZE
+#define VMAXLOOPCHIRPS 20							// loopback test chirps (0.5s each; fits the buffers)
 
 
 int DMAWritefile_fd = -1;											// DMA write file device
@@ -293,6 +300,238 @@ void DMAReadFromCodec(char* MemPtr, uint32_t Length)
 
 
 
+//////////////////////////////////////////////////////////////////////////////////////
+// loopback latency test
+// the speaker and mic streams run at the same time, each in its own thread. The speaker
+// thread plays a chirp at the start of each period; the mic thread records, with two
+// DMAs in flight (double buffered) so the FIFO is never left waiting for a DMA to be set up.
+// each chirp is then found in the recording by cross-correlation with the chirp played.
+// the latency reported is from the speaker DMA of the chirp's 1st sample to its arrival
+// in the mic data: so it includes time queued in the speaker FIFO, as p2app audio would be.
+//
+#define VLOOPPERIOD (VSAMPLERATE / 2)				// samples between chirps
+#define VCHIRPSAMPLES (VSAMPLERATE / 20)			// 50ms chirp
+#define VCHIRPSTART 500.0F							// Hz
+#define VCHIRPRAMP 4500.0F							// Hz swept over the chirp
+#define VCHIRPAMPLITUDE 0.5F
+#define VDEFAULTCHIRPS 10
+#define VMAXLOOPLATENCY (VSAMPLERATE / 5)			// correlation search range: 200ms
+#define VMINCORRELATION 0.3							// normalised correlation needed to find a chirp
+#define VLOOPTAILSAMPLES (VSAMPLERATE / 2)			// extra recording after the last chirp
+#define VLOOPDMAINFLIGHT 2
+
+struct LoopbackTest
+{
+	uint32_t Chirps;
+	uint32_t SpkBytes;								// bytes of speaker data to play
+	uint32_t MicBytes;								// bytes of mic data to record
+	uint64_t MicStartTime;							// ns: time the mic FIFO was reset
+	uint64_t ChirpTime[VMAXLOOPCHIRPS];				// ns: time of the DMA holding each chirp's 1st sample
+	uint32_t ChirpSpkDepth[VMAXLOOPCHIRPS];			// speaker FIFO free locations then
+	uint32_t SpkUnderflows;
+	uint32_t MicOverflows;
+	uint32_t MicDMAs;
+};
+
+
+static uint64_t LoopbackTime(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// speaker thread: write the test signal, as fast as the FIFO has space
+//
+static void* LoopbackSpeakerThread(void *arg)
+{
+	struct LoopbackTest* Test = (struct LoopbackTest*)arg;
+	bool FIFOOverflow, OverThreshold, Underflow;
+	uint32_t Spare, Depth;
+	uint32_t Offset, Chirp = 0;
+
+	for(Offset = 0; Offset < Test->SpkBytes; Offset += VDMATRANSFERSIZE)
+	{
+		Depth = WaitFIFOMonitorChannel(eSpkCodecDMA, VDMAWORDSPERDMA, 1000000, &FIFOOverflow, &OverThreshold, &Underflow, &Spare);
+		if(Underflow && (Offset != 0))
+			Test->SpkUnderflows++;
+		if((Chirp < Test->Chirps) && ((Offset / 4) >= (Chirp * VLOOPPERIOD)))
+		{
+			Test->ChirpTime[Chirp] = LoopbackTime();
+			Test->ChirpSpkDepth[Chirp] = Depth;
+			Chirp++;
+		}
+		DMAWriteToFPGA(DMAWritefile_fd, (unsigned char*)WriteBuffer + Offset, VDMATRANSFERSIZE, AXIBaseAddress);
+	}
+	return NULL;
+}
+
+
+//
+// mic thread: record with two DMAs in flight; falls back to one at a time
+// if async DMA isn't available
+//
+static void* LoopbackMicThread(void *arg)
+{
+	struct LoopbackTest* Test = (struct LoopbackTest*)arg;
+	struct DMAAsyncContext Context;
+	bool FIFOOverflow, OverThreshold, Underflow;
+	uint32_t Spare, Slot;
+	uint32_t Submitted = 0, Completed = 0;
+	uint32_t TotalDMAs = Test->MicBytes / VDMATRANSFERSIZE;
+	bool Async;
+
+	Async = !DMAAsyncInit(&Context, DMAReadfile_fd, VLOOPDMAINFLIGHT);
+	while(Completed < TotalDMAs)
+	{
+		while((Submitted < TotalDMAs) && ((Submitted - Completed) < (Async ? VLOOPDMAINFLIGHT : 1)))
+		{
+			WaitFIFOMonitorChannel(eMicCodecDMA, VDMAWORDSPERDMA * (Submitted - Completed + 1), 1000000,
+				&FIFOOverflow, &OverThreshold, &Underflow, &Spare);
+			if(FIFOOverflow)
+				Test->MicOverflows++;
+			if(!Async)
+			{
+				DMAReadFromFPGA(DMAReadfile_fd, (unsigned char*)ReadBuffer + Submitted * VDMATRANSFERSIZE, VDMATRANSFERSIZE, AXIBaseAddress);
+				Completed++;
+			}
+			else if(DMAAsyncSubmitRead(&Context, Submitted % VLOOPDMAINFLIGHT, (unsigned char*)ReadBuffer + Submitted * VDMATRANSFERSIZE,
+				VDMATRANSFERSIZE, AXIBaseAddress))
+				break;
+			Submitted++;
+		}
+		if(Async && (DMAAsyncWaitComplete(&Context, &Slot) < 0))
+		{
+			printf("mic DMA failed after %d transfers\n", Completed);
+			break;
+		}
+		else if(Async)
+			Completed++;
+	}
+	if(Async)
+		DMAAsyncClose(&Context);
+	Test->MicDMAs = Completed;
+	return NULL;
+}
+
+
+//
+// find a chirp in the mic recording: the lag with the highest normalised
+// correlation between the chirp played (L channel) and the mic samples from Start
+// returns the lag in samples, or -1 if not found
+//
+static int FindChirp(int16_t* Mic, uint32_t MicSamples, int16_t* Spk, uint32_t Start, double* Correlation)
+{
+	double Sum, MicPower, SpkPower = 0.0;
+	double Best = 0.0;
+	int BestLag = -1;
+	uint32_t Lag, Cntr;
+
+	for(Cntr = 0; Cntr < VCHIRPSAMPLES; Cntr++)
+		SpkPower += (double)Spk[2*Cntr] * Spk[2*Cntr];
+	for(Lag = 0; (Lag < VMAXLOOPLATENCY) && ((Start + Lag + VCHIRPSAMPLES) <= MicSamples); Lag++)
+	{
+		Sum = 0.0;
+		MicPower = 0.0;
+		for(Cntr = 0; Cntr < VCHIRPSAMPLES; Cntr++)
+		{
+			Sum += (double)Mic[Start + Lag + Cntr] * Spk[2*Cntr];
+			MicPower += (double)Mic[Start + Lag + Cntr] * Mic[Start + Lag + Cntr];
+		}
+		if((MicPower > 0.0) && (SpkPower > 0.0))
+		{
+			Sum /= sqrt(MicPower * SpkPower);
+			if(Sum > Best)
+			{
+				Best = Sum;
+				BestLag = Lag;
+			}
+		}
+	}
+	*Correlation = Best;
+	return (Best >= VMINCORRELATION) ? BestLag : -1;
+}
+
+
+//
+// run the loopback test and print the results
+// return true if no chirp was found
+//
+static bool RunLoopbackTest(uint32_t Chirps)
+{
+	static struct LoopbackTest Test;
+	pthread_t SpkThread, MicThread;
+	int16_t* Mic = (int16_t*)ReadBuffer;
+	uint32_t Chirp, Found = 0;
+	uint32_t MicSamples, ChirpSample;
+	double Correlation, Latency;
+	double Min = 1.0E9, Max = 0.0, Total = 0.0;
+	int Lag;
+
+	memset(&Test, 0, sizeof(Test));
+	Test.Chirps = (Chirps > VMAXLOOPCHIRPS) ? VMAXLOOPCHIRPS : Chirps;
+	Test.SpkBytes = Test.Chirps * VLOOPPERIOD * 4;
+	Test.MicBytes = ((Test.Chirps * VLOOPPERIOD + VLOOPTAILSAMPLES) * 2 / VDMATRANSFERSIZE) * VDMATRANSFERSIZE;
+	if((Test.SpkBytes > BufferSize) || (Test.MicBytes > BufferSize))
+	{
+		printf("too many chirps for the buffers\n");
+		return true;
+	}
+	memset(WriteBuffer, 0, Test.SpkBytes);
+	for(Chirp = 0; Chirp < Test.Chirps; Chirp++)
+		CreateSpkTestData(WriteBuffer + Chirp * VLOOPPERIOD * 4, VCHIRPSAMPLES, VCHIRPSTART, VCHIRPRAMP, VCHIRPAMPLITUDE, true);
+
+	printf("loopback test: %d chirps, %dms apart\n", Test.Chirps, 1000 * VLOOPPERIOD / VSAMPLERATE);
+	ResetDMAStreamFIFO(eSpkCodecDMA);
+	ResetDMAStreamFIFO(eMicCodecDMA);
+	Test.MicStartTime = LoopbackTime();
+	if((pthread_create(&MicThread, NULL, LoopbackMicThread, &Test) != 0) ||
+	   (pthread_create(&SpkThread, NULL, LoopbackSpeakerThread, &Test) != 0))
+	{
+		perror("pthread_create loopback test");
+		return true;
+	}
+	pthread_join(SpkThread, NULL);
+	pthread_join(MicThread, NULL);
+
+	//
+	// a mic sample's arrival time is taken as the FIFO reset time plus its sample count
+	//
+	MicSamples = Test.MicDMAs * VDMATRANSFERSIZE / 2;
+	printf("chirp   latency(ms)  correlation  spk FIFO free\n");
+	for(Chirp = 0; Chirp < Test.Chirps; Chirp++)
+	{
+		ChirpSample = (uint32_t)((Test.ChirpTime[Chirp] - Test.MicStartTime) * (uint64_t)VSAMPLERATE / 1000000000ULL);
+		Lag = FindChirp(Mic, MicSamples, (int16_t*)(WriteBuffer + Chirp * VLOOPPERIOD * 4), ChirpSample, &Correlation);
+		if(Lag < 0)
+		{
+			printf("%5d   not found    %5.2f\n", Chirp, Correlation);
+			continue;
+		}
+		Latency = 1000.0 * (double)Lag / (double)VSAMPLERATE
+		        + ((ChirpSample * 1.0E9 / VSAMPLERATE) - (Test.ChirpTime[Chirp] - Test.MicStartTime)) * 1.0E-6;
+		printf("%5d   %8.2f     %5.2f        %d\n", Chirp, Latency, Correlation, Test.ChirpSpkDepth[Chirp]);
+		Found++;
+		Total += Latency;
+		if(Latency < Min)
+			Min = Latency;
+		if(Latency > Max)
+			Max = Latency;
+	}
+	if(Found != 0)
+		printf("round trip latency: mean %5.2fms, min %5.2fms, max %5.2fms (%d of %d chirps found)\n",
+			Total / Found, Min, Max, Found, Test.Chirps);
+	printf("dropouts: %d speaker FIFO underflows, %d mic FIFO overflows; %d of %d mic DMAs done\n",
+		Test.SpkUnderflows, Test.MicOverflows, Test.MicDMAs, Test.MicBytes / VDMATRANSFERSIZE);
+	return (Found == 0);
+}
+
+
+
+
 //////////////////////////////////////////////////////////////////////////////////////
 // GUI event handlers
 
@@ -489,12 +728,91 @@ void* CheckForPttPressed(void *arg)
 
 
 
+//
+// set up register access, the codec, the buffers and the DMA devices
+// return true if error
+//
+static bool InitialiseHardware(void)
+{
+  //
+  // initialise register access semaphores
+  //
+  	sem_init(&DDCInSelMutex, 0, 1);                                   // for DDC input select register
+  	sem_init(&DDCResetFIFOMutex, 0, 1);                               // for FIFO reset register
+  	sem_init(&RFGPIOMutex, 0, 1);                                     // for RF GPIO register
+  	sem_init(&CodecRegMutex, 0, 1);                                   // for codec writes
+
+	OpenXDMADriver();
+	PrintVersionInfo();
+	CodecInitialise();
+	SetByteSwapping(false);                                            // h/w to generate normalbyte order
+	SetSpkrMute(false);
+	posix_memalign((void **)&WriteBuffer, VALIGNMENT, BufferSize);
+	if(!WriteBuffer)
+	{
+		printf("write buffer allocation failed\n");
+		return true;
+	}
+
+	posix_memalign((void **)&ReadBuffer, VALIGNMENT, BufferSize);
+	if(!ReadBuffer)
+	{
+		printf("read buffer allocation failed\n");
+		return true;
+	}
+
+	DMAWritefile_fd = open("/dev/xdma0_h2c_0", O_RDWR);
+	if(DMAWritefile_fd < 0)
+	{
+		printf("XDMA write device open failed\n");
+		return true;
+	}
+
+	DMAReadfile_fd = open("/dev/xdma0_c2h_0", O_RDWR);
+	if(DMAReadfile_fd < 0)
+	{
+		printf("XDMA read device open failed\n");
+		return true;
+	}
+	return false;
+}
+
+
+
+
 //
 // "main" essentially creates the window and attaches event handlers
 //
 int main(int argc, char *argv[])
 {
     guint Context;                                  // status bar context
+    bool LoopbackTest = false;
+    uint32_t Chirps = VDEFAULTCHIRPS;
+    int Option;
+
+//
+// loopback latency test: no GUI
+//
+    while ((Option = getopt(argc, argv, "ln:")) != -1)
+    {
+        if (Option == 'l')
+            LoopbackTest = true;
+        else if (Option == 'n')
+            Chirps = atoi(optarg);
+        else
+        {
+            printf("usage: audiotest [-l [-n chirps]]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (LoopbackTest)
+    {
+        if (InitialiseHardware())
+            return EXIT_FAILURE;
+        SetMicLineInput(true);
+        SetCodecLineInGain(23);                                         // 0dB
+        return RunLoopbackTest(Chirps) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
     gtk_init(&argc, &argv);
 
@@ -532,46 +850,8 @@ int main(int argc, char *argv[])
     g_object_unref(Builder);
     gtk_widget_show(Window);                
     Context = gtk_statusbar_get_context_id(StatusBar, "context");
-  //
-  // initialise register access semaphores
-  //
-  	sem_init(&DDCInSelMutex, 0, 1);                                   // for DDC input select register
-  	sem_init(&DDCResetFIFOMutex, 0, 1);                               // for FIFO reset register
-  	sem_init(&RFGPIOMutex, 0, 1);                                     // for RF GPIO register
-  	sem_init(&CodecRegMutex, 0, 1);                                   // for codec writes
-
-	OpenXDMADriver();
-	PrintVersionInfo();
-	CodecInitialise();
-	SetByteSwapping(false);                                            // h/w to generate normalbyte order
-	SetSpkrMute(false);
-	posix_memalign((void **)&WriteBuffer, VALIGNMENT, BufferSize);
-	if(!WriteBuffer)
-	{
-		printf("write buffer allocation failed\n");
-		goto out;
-	}
-
-	posix_memalign((void **)&ReadBuffer, VALIGNMENT, BufferSize);
-	if(!ReadBuffer)
-	{
-		printf("read buffer allocation failed\n");
+	if(InitialiseHardware())
 		goto out;
-	}
-
-	DMAWritefile_fd = open("/dev/xdma0_h2c_0", O_RDWR);
-	if(DMAWritefile_fd < 0)
-	{
-		printf("XDMA write device open failed\n");
-		goto out;
-	}
-
-	DMAReadfile_fd = open("/dev/xdma0_c2h_0", O_RDWR);
-	if(DMAReadfile_fd < 0)
-	{
-		printf("XDMA read device open failed\n");
-		goto out;
-	}
 	//
 	// we have devices and memory.
 	//
@@ -0,0 +1,284 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// catparsebench.c:
+// replay and fuzz harness for the CAT stream parser.
+// a capture of Thetis CAT traffic (or, with no file, generated traffic) is
+// parsed as one block and then split into random sized reads; both must
+// dispatch exactly the same commands. Fuzz passes mix random bytes into the
+// stream. Then times the parser and the name lookup against a linear search.
+// No network or FPGA hardware is needed.
+//
+// usage: catparsebench [-n passes] [-f fuzz passes] [capture file]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../P2_app/catparser.h"
+
+#define VDEFAULTPASSES 200
+#define VDEFAULTFUZZPASSES 1000
+#define VGENERATEDCMDS 100000                       // commands in generated traffic
+#define VMAXREAD 1024                               // largest read, as the CAT thread
+
+
+//
+// command names, in the order of GCATCommands[] in catmessages.c
+//
+char* const CATNames[] =
+{
+  "ZZZD", "ZZZU", "ZZZE", "ZZZP", "ZZZI", "ZZZS", "ZZTU", "ZZFA", "ZZXV", "ZZUT", "ZZYR"
+};
+#define VNUMNAMES (sizeof(CATNames) / sizeof(CATNames[0]))
+
+//
+// result of a parse: count and a running checksum of each dispatched command and its lookup
+//
+uint64_t DispatchCount;
+uint64_t DispatchSum;
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+static void Dispatch(char* Cmd, uint32_t Length)
+{
+    uint32_t Cntr;
+    int Index = (Length >= 5) ? LookupCATCommand(Cmd) : -1;
+
+    DispatchCount++;
+    DispatchSum = DispatchSum * 31 + Length + (uint32_t)Index;
+    for (Cntr = 0; Cntr < Length; Cntr++)
+        DispatchSum = DispatchSum * 131 + (uint8_t)Cmd[Cntr];
+}
+
+
+//
+// generate traffic like a Thetis session: mostly VFO and status updates
+//
+static uint32_t GenerateTraffic(char* Buffer, uint32_t Size)
+{
+    uint32_t Used = 0;
+    uint32_t Cmd;
+    int Length;
+
+    for (Cmd = 0; Cmd < VGENERATEDCMDS; Cmd++)
+    {
+        switch (rand() % 6)
+        {
+            case 0:
+            case 1:
+                Length = snprintf(Buffer + Used, Size - Used, "ZZFA%011d;", 7000000 + rand() % 300000);
+                break;
+            case 2:
+                Length = snprintf(Buffer + Used, Size - Used, "ZZXV%04d;", rand() % 1024);
+                break;
+            case 3:
+                Length = snprintf(Buffer + Used, Size - Used, "ZZ%s%d;", (rand() & 1) ? "UT" : "YR", rand() & 1);
+                break;
+            case 4:
+                Length = snprintf(Buffer + Used, Size - Used, "ZZZI%03d;", rand() % 1000);
+                break;
+            default:
+                Length = snprintf(Buffer + Used, Size - Used, "ZZSM%03d;", rand() % 256);   // not handled by p2app
+                break;
+        }
+        if ((Length < 0) || ((uint32_t)Length >= Size - Used))
+            break;
+        Used += Length;
+    }
+    return Used;
+}
+
+
+//
+// parse a stream as reads of random size up to MaxRead; MaxRead = 0 for one read
+//
+static void ParseInReads(char* Data, uint32_t Length, uint32_t MaxRead)
+{
+    struct CATStreamParser Parser;
+    uint32_t Offset = 0;
+    uint32_t ReadSize;
+
+    DispatchCount = 0;
+    DispatchSum = 0;
+    ResetCATStreamParser(&Parser);
+    while (Offset < Length)
+    {
+        ReadSize = (MaxRead == 0) ? Length : 1 + rand() % MaxRead;
+        if (ReadSize > Length - Offset)
+            ReadSize = Length - Offset;
+        CATParseStream(&Parser, Data + Offset, ReadSize, Dispatch);
+        Offset += ReadSize;
+    }
+}
+
+
+//
+// check a split parse dispatches the same as a whole parse
+//
+static bool CheckSplit(char* Data, uint32_t Length, uint32_t MaxRead)
+{
+    uint64_t Count, Sum;
+
+    ParseInReads(Data, Length, 0);
+    Count = DispatchCount;
+    Sum = DispatchSum;
+    ParseInReads(Data, Length, MaxRead);
+    return (Count == DispatchCount) && (Sum == DispatchSum);
+}
+
+
+//
+// the lookup p2app used before: compare with each name in turn
+//
+static int LinearLookup(char* Cmd)
+{
+    uint32_t Word = MakeCATWord(Cmd);
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < VNUMNAMES; Cntr++)
+        if (MakeCATWord(CATNames[Cntr]) == Word)
+            return Cntr;
+    return -1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    char* Traffic;
+    char* Fuzzed;
+    uint32_t Length;
+    uint32_t Size = 4 * 1024 * 1024;
+    uint32_t Passes = VDEFAULTPASSES;
+    uint32_t FuzzPasses = VDEFAULTFUZZPASSES;
+    uint32_t Pass, Cntr;
+    FILE* File;
+    double Start, Elapsed;
+    uint64_t Commands;
+    volatile int Sink = 0;
+    bool Failed = false;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:f:h")) != -1)
+    {
+        if (Opt == 'n')
+            Passes = atoi(optarg);
+        else if (Opt == 'f')
+            FuzzPasses = atoi(optarg);
+        else
+        {
+            printf("usage: catparsebench [-n passes] [-f fuzz passes] [capture file]\n");
+            return 0;
+        }
+    }
+    if (Passes == 0)
+        Passes = 1;
+
+    Traffic = malloc(Size);
+    Fuzzed = malloc(Size);
+    if ((Traffic == NULL) || (Fuzzed == NULL))
+    {
+        printf("buffer allocation failed\n");
+        return 1;
+    }
+    if (BuildCATLookup(CATNames, VNUMNAMES))
+    {
+        printf("CAT lookup table build failed\n");
+        return 1;
+    }
+    if (optind < argc)
+    {
+        File = fopen(argv[optind], "rb");
+        if (File == NULL)
+        {
+            printf("could not open capture file %s\n", argv[optind]);
+            return 1;
+        }
+        Length = fread(Traffic, 1, Size, File);
+        fclose(File);
+        printf("replaying %u bytes from %s\n", Length, argv[optind]);
+    }
+    else
+    {
+        Length = GenerateTraffic(Traffic, Size);
+        printf("replaying %u bytes of generated traffic\n", Length);
+    }
+
+    //
+    // reads split at every size must give the same commands as one read
+    //
+    for (Pass = 0; Pass < 64; Pass++)
+        if (!CheckSplit(Traffic, Length, 1 + Pass))
+        {
+            printf("split parse mismatch, max read %u\n", 1 + Pass);
+            Failed = true;
+        }
+    ParseInReads(Traffic, Length, 0);
+    printf("%llu commands dispatched\n", (unsigned long long)DispatchCount);
+
+    //
+    // fuzz: corrupt a few bytes, and split at random
+    //
+    for (Pass = 0; Pass < FuzzPasses; Pass++)
+    {
+        memcpy(Fuzzed, Traffic, Length);
+        for (Cntr = 0; Cntr < 1 + (uint32_t)rand() % 64; Cntr++)
+            Fuzzed[rand() % Length] = (char)rand();
+        if (!CheckSplit(Fuzzed, Length > 65536 ? 65536 : Length, 1 + rand() % VMAXREAD))
+        {
+            printf("fuzz pass %u: split parse mismatch\n", Pass);
+            Failed = true;
+        }
+    }
+    printf("%u fuzz passes %s\n", FuzzPasses, Failed ? "FAILED" : "passed");
+
+    //
+    // timing: the parser at the CAT thread's read size, then the two lookups
+    //
+    Start = GetSeconds();
+    Commands = 0;
+    for (Pass = 0; Pass < Passes; Pass++)
+    {
+        ParseInReads(Traffic, Length, VMAXREAD);
+        Commands += DispatchCount;
+    }
+    Elapsed = GetSeconds() - Start;
+    printf("%-20s %14.0f commands/s %10.1f MB/s\n", "stream parse", Commands / Elapsed,
+           (double)Length * Passes / Elapsed / 1.0e6);
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes * 100; Pass++)
+        for (Cntr = 0; Cntr < VNUMNAMES; Cntr++)
+            Sink += LookupCATCommand(CATNames[Cntr]);
+    Elapsed = GetSeconds() - Start;
+    printf("%-20s %14.0f lookups/s\n", "hash lookup", Passes * 100.0 * VNUMNAMES / Elapsed);
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes * 100; Pass++)
+        for (Cntr = 0; Cntr < VNUMNAMES; Cntr++)
+            Sink += LinearLookup(CATNames[Cntr]);
+    Elapsed = GetSeconds() - Start;
+    printf("%-20s %14.0f lookups/s\n", "linear lookup", Passes * 100.0 * VNUMNAMES / Elapsed);
+
+    free(Traffic);
+    free(Fuzzed);
+    return Failed ? 1 : 0;
+}
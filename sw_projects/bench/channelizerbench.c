@@ -0,0 +1,187 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// channelizerbench.c:
+// micro-benchmark for the polyphase filter bank that makes virtual DDCs.
+// for each wide DDC rate, puts a tone into one channel and checks it comes
+// out of that channel and is well down in the others, then times the bank
+// and compares that with the rate it must keep up with.
+// No FPGA hardware is needed.
+//
+// usage: channelizerbench [-n passes]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/channelizer.h"
+
+#define VBENCHSAMPLES 65536                         // input samples per pass
+#define VDEFAULTPASSES 20
+#define VTONEAMPLITUDE 4000000.0
+#define VMINREJECTION 60.0                          // dB required 2 channels away
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// fill the input with a tone Offset cycles per sample from the centre, in DDC sample format
+//
+static void BuildTone(uint8_t* Buffer, uint32_t Samples, double Offset)
+{
+    int32_t I, Q;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < Samples; Cntr++)
+    {
+        I = (int32_t)(VTONEAMPLITUDE * cos(2.0 * M_PI * Offset * Cntr));
+        Q = (int32_t)(VTONEAMPLITUDE * sin(2.0 * M_PI * Offset * Cntr));
+        Buffer[6*Cntr] = (uint8_t)(I >> 16);
+        Buffer[6*Cntr+1] = (uint8_t)(I >> 8);
+        Buffer[6*Cntr+2] = (uint8_t)I;
+        Buffer[6*Cntr+3] = (uint8_t)(Q >> 16);
+        Buffer[6*Cntr+4] = (uint8_t)(Q >> 8);
+        Buffer[6*Cntr+5] = (uint8_t)Q;
+    }
+}
+
+
+//
+// mean power of the 2nd half of a channel's output (after the filter has settled)
+//
+static double ChannelPower(const uint8_t* Samples, uint32_t Count)
+{
+    double Sum = 0.0;
+    int32_t I, Q;
+    uint32_t Cntr;
+
+    for (Cntr = Count / 2; Cntr < Count; Cntr++)
+    {
+        I = (int32_t)(((uint32_t)Samples[6*Cntr] << 24) | ((uint32_t)Samples[6*Cntr+1] << 16) | ((uint32_t)Samples[6*Cntr+2] << 8)) >> 8;
+        Q = (int32_t)(((uint32_t)Samples[6*Cntr+3] << 24) | ((uint32_t)Samples[6*Cntr+4] << 16) | ((uint32_t)Samples[6*Cntr+5] << 8)) >> 8;
+        Sum += (double)I * I + (double)Q * Q;
+    }
+    return Sum / (Count - Count / 2) + 1.0;                 // +1: no log of 0
+}
+
+
+//
+// check and time one bank size; return true if the check failed
+//
+static bool BenchChannels(uint32_t Channels, uint32_t Passes, const uint8_t* Input, uint8_t** Outputs)
+{
+    uint32_t ToneChannel = Channels * 3 / 4;
+    struct PFBChannelizer Channelizer;
+    uint8_t* Dest[VMAXCHANNELS];
+    uint32_t Count, Used;
+    uint32_t Channel, Pass, Worst = 0;
+    double Power[VMAXCHANNELS];
+    double Rejection, WorstRejection = 1000.0;
+    double Start, Rate, InputRate;
+
+    if (CreateChannelizer(&Channelizer, Channels))
+    {
+        printf("%d channels: create failed\n", Channels);
+        return true;
+    }
+    for (Channel = 0; Channel < Channels; Channel++)
+        Dest[Channel] = Outputs[Channel];
+    Count = VBENCHSAMPLES;
+    Used = RunChannelizer(&Channelizer, Input, VBENCHSAMPLES, Dest, &Count);
+    for (Channel = 0; Channel < Channels; Channel++)
+        Power[Channel] = ChannelPower(Outputs[Channel], Count);
+    for (Channel = 0; Channel < Channels; Channel++)
+    {
+        if (abs((int)Channel - (int)ToneChannel) < 2)
+            continue;
+        Rejection = 10.0 * log10(Power[ToneChannel] / Power[Channel]);
+        if (Rejection < WorstRejection)
+        {
+            WorstRejection = Rejection;
+            Worst = Channel;
+        }
+    }
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+    {
+        for (Channel = 0; Channel < Channels; Channel++)
+            Dest[Channel] = Outputs[Channel];
+        Count = VBENCHSAMPLES;
+        RunChannelizer(&Channelizer, Input, VBENCHSAMPLES, Dest, &Count);
+    }
+    Rate = (double)VBENCHSAMPLES * Passes / (GetSeconds() - Start);
+    InputRate = Channels * 24000.0;                         // 48KHz outputs, 2x oversampled
+    printf("%4d channels (%5.0fKHz in): %7.2f Msamples/s, %5.1fx real time; "
+           "%d outputs from %d samples; tone gain %.2fdB, %.1fdB over channel %d\n",
+           Channels, InputRate / 1000.0, Rate / 1.0e6, Rate / InputRate, Count, Used,
+           10.0 * log10(Power[ToneChannel] / (VTONEAMPLITUDE * VTONEAMPLITUDE)), WorstRejection, Worst);
+    FreeChannelizer(&Channelizer);
+    if (WorstRejection < VMINREJECTION)
+    {
+        printf("%d channels: tone not rejected enough in channel %d\n", Channels, Worst);
+        return true;
+    }
+    return false;
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint8_t* Input;
+    uint8_t* Outputs[VMAXCHANNELS];
+    uint32_t Passes = VDEFAULTPASSES;
+    uint32_t Channels, Channel;
+    bool Failed = false;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        if (Opt == 'n')
+            Passes = atoi(optarg);
+        else
+        {
+            printf("usage: channelizerbench [-n passes]\n");
+            return 0;
+        }
+    }
+    if (Passes == 0)
+        Passes = 1;
+
+    Input = malloc(6 * VBENCHSAMPLES);
+    for (Channel = 0; Channel < VMAXCHANNELS; Channel++)
+        Outputs[Channel] = malloc(6 * VBENCHSAMPLES);
+    printf("channelizer benchmark: %s code, %d taps per branch, %d passes of %d samples\n",
+           GetChannelizerName(), VCHANNELIZERTAPS, Passes, VBENCHSAMPLES);
+    for (Channels = 8; Channels <= VMAXCHANNELS; Channels <<= 1)
+    {
+        //
+        // the tone is a quarter of a channel spacing off the centre of a channel N/4 above the middle
+        //
+        BuildTone(Input, VBENCHSAMPLES, (Channels / 4 + 0.25) / Channels);
+        if (BenchChannels(Channels, Passes, Input, Outputs))
+            Failed = true;
+    }
+    for (Channel = 0; Channel < VMAXCHANNELS; Channel++)
+        free(Outputs[Channel]);
+    free(Input);
+    return Failed ? 1 : 0;
+}
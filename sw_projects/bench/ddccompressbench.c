@@ -0,0 +1,208 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddccompressbench.c:
+// micro-benchmark for the compressed DDC payloads.
+// for noise at several levels, with and without a strong tone, codes
+// packets of DDC samples in each mode and reports the compression ratio,
+// the compress and decompress rates in MB of 24 bit samples per second,
+// and checks the lossless mode decodes exactly and BFP is within its step.
+// No FPGA hardware is needed.
+//
+// usage: ddccompressbench [-n passes]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/ddccompress.h"
+
+#define VPACKETSAMPLES 238                          // I/Q samples in a 24 bit DDC packet
+#define VPACKETBYTES (VPACKETSAMPLES * 6)
+#define VBENCHPACKETS 1024                          // packets per pass
+#define VDEFAULTPASSES 20
+#define VBFPBITS 12
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+static int32_t ReadSample(const uint8_t* Src)
+{
+    return (int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8;
+}
+
+
+static void WriteSample(uint8_t* Dest, double Value)
+{
+    int32_t Sample;
+
+    if (Value > 8388607.0)
+        Value = 8388607.0;
+    else if (Value < -8388608.0)
+        Value = -8388608.0;
+    Sample = (int32_t)lrint(Value);
+    Dest[0] = (uint8_t)(Sample >> 16);
+    Dest[1] = (uint8_t)(Sample >> 8);
+    Dest[2] = (uint8_t)Sample;
+}
+
+
+//
+// gaussian noise of rms NoiseLevel, plus a tone of amplitude ToneLevel
+//
+static void BuildSignal(uint8_t* Buffer, uint32_t Samples, double NoiseLevel, double ToneLevel)
+{
+    double U1, U2, Radius;
+    uint32_t Cntr;
+
+    srand(1);
+    for (Cntr = 0; Cntr < Samples; Cntr++)
+    {
+        U1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+        U2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+        Radius = NoiseLevel * sqrt(-2.0 * log(U1));
+        WriteSample(Buffer + 6 * Cntr, Radius * cos(2.0 * M_PI * U2) + ToneLevel * cos(0.0123 * Cntr));
+        WriteSample(Buffer + 6 * Cntr + 3, Radius * sin(2.0 * M_PI * U2) + ToneLevel * sin(0.0123 * Cntr));
+    }
+}
+
+
+//
+// code and decode every packet of the input in one mode; return true if the check failed
+//
+static bool BenchMode(const char* SignalName, uint32_t Mode, uint32_t Passes, const uint8_t* Input,
+                      uint8_t* Coded, uint32_t* CodedBytes, uint8_t* Output)
+{
+    uint32_t Packet, Pass, Cntr;
+    uint64_t TotalBytes = 0;
+    uint32_t Raw = 0;
+    int32_t Error, WorstError = 0;
+    double Start, CompressRate, DecompressRate;
+    double MBytes = (double)VBENCHPACKETS * VPACKETBYTES * Passes / 1.0e6;
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+        for (Packet = 0; Packet < VBENCHPACKETS; Packet++)
+            CodedBytes[Packet] = CompressDDCSamples(Coded + Packet * VPACKETBYTES, VPACKETBYTES,
+                                                    Input + Packet * VPACKETBYTES, VPACKETSAMPLES, Mode, VBFPBITS);
+    CompressRate = MBytes / (GetSeconds() - Start);
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+        for (Packet = 0; Packet < VBENCHPACKETS; Packet++)
+        {
+            if (CodedBytes[Packet] == 0)
+                memcpy(Output + Packet * VPACKETBYTES, Input + Packet * VPACKETBYTES, VPACKETBYTES);
+            else if (DecompressDDCSamples(Output + Packet * VPACKETBYTES, Coded + Packet * VPACKETBYTES,
+                                          CodedBytes[Packet], VPACKETSAMPLES, Mode))
+            {
+                printf("%s: packet %d does not decode\n", SignalName, Packet);
+                return true;
+            }
+        }
+    DecompressRate = MBytes / (GetSeconds() - Start);
+
+    for (Packet = 0; Packet < VBENCHPACKETS; Packet++)
+    {
+        TotalBytes += (CodedBytes[Packet] == 0) ? VPACKETBYTES : CodedBytes[Packet];
+        if (CodedBytes[Packet] == 0)
+            Raw++;
+    }
+    for (Cntr = 0; Cntr < VBENCHPACKETS * VPACKETSAMPLES * 2; Cntr++)
+    {
+        Error = abs(ReadSample(Output + 3 * Cntr) - ReadSample(Input + 3 * Cntr));
+        if (Error > WorstError)
+            WorstError = Error;
+    }
+    printf("  %-10s %-8s: ratio %5.2f (%5.1f bits/sample), %d sent raw; compress %7.1f MB/s, decompress %7.1f MB/s; max error %d\n",
+           SignalName, (Mode == VDDCCOMPRESSLOSSLESS) ? "lossless" : "BFP 12",
+           (double)VBENCHPACKETS * VPACKETBYTES / TotalBytes, 8.0 * TotalBytes / (VBENCHPACKETS * VPACKETSAMPLES * 2.0),
+           Raw, CompressRate, DecompressRate, WorstError);
+    if ((Mode == VDDCCOMPRESSLOSSLESS) && (WorstError != 0))
+    {
+        printf("%s: lossless mode is not exact\n", SignalName);
+        return true;
+    }
+    if ((Mode == VDDCCOMPRESSBFP) && (WorstError > (1 << (24 - VBFPBITS))))
+    {
+        printf("%s: BFP error larger than its step\n", SignalName);
+        return true;
+    }
+    return false;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const struct
+    {
+        const char* Name;
+        double Noise;
+        double Tone;
+    } Signals[] =
+    {
+        {"noise 2^6", 64.0, 0.0},
+        {"noise 2^10", 1024.0, 0.0},
+        {"noise 2^14", 16384.0, 0.0},
+        {"tone -6dB", 64.0, 4000000.0},
+        {"tone -60dB", 64.0, 8000.0},
+    };
+    uint8_t* Input;
+    uint8_t* Coded;
+    uint8_t* Output;
+    uint32_t* CodedBytes;
+    uint32_t Passes = VDEFAULTPASSES;
+    uint32_t Signal;
+    bool Failed = false;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        if (Opt == 'n')
+            Passes = atoi(optarg);
+        else
+        {
+            printf("usage: ddccompressbench [-n passes]\n");
+            return 0;
+        }
+    }
+    if (Passes == 0)
+        Passes = 1;
+
+    Input = malloc(VBENCHPACKETS * VPACKETBYTES);
+    Coded = malloc(VBENCHPACKETS * VPACKETBYTES);
+    Output = malloc(VBENCHPACKETS * VPACKETBYTES);
+    CodedBytes = malloc(VBENCHPACKETS * sizeof(uint32_t));
+    printf("DDC compression benchmark: %d passes of %d packets of %d samples\n", Passes, VBENCHPACKETS, VPACKETSAMPLES);
+    for (Signal = 0; Signal < sizeof(Signals) / sizeof(Signals[0]); Signal++)
+    {
+        BuildSignal(Input, VBENCHPACKETS * VPACKETSAMPLES, Signals[Signal].Noise, Signals[Signal].Tone);
+        if (BenchMode(Signals[Signal].Name, VDDCCOMPRESSLOSSLESS, Passes, Input, Coded, CodedBytes, Output))
+            Failed = true;
+        if (BenchMode(Signals[Signal].Name, VDDCCOMPRESSBFP, Passes, Input, Coded, CodedBytes, Output))
+            Failed = true;
+    }
+    free(CodedBytes);
+    free(Output);
+    free(Coded);
+    free(Input);
+    return Failed ? 1 : 0;
+}
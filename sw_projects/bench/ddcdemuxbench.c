@@ -0,0 +1,385 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcdemuxbench.c:
+// micro-benchmark for the DDC frame demultiplex code.
+// builds a buffer of synthetic DDC frames for several DDC rate layouts,
+// then times the scalar and the selected (NEON if enabled) demux kernels
+// called for each DDC of each frame, and the frame plan's demux, specialised
+// for each DDC's sample count, called for each DDC over all the frames as
+// OutgoingDDCIQ() does.
+// then does the same for an interleaved pair split to its 2 DDCs, and
+// for the 16 bit sample pack on one packet's samples.
+// No FPGA hardware is needed.
+//
+// usage: ddcdemuxbench [-n passes]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/ddcdemux.h"
+
+#define VNUMDDC 10                                  // DDCs in a frame (as saturnregisters.h)
+#define VBENCHBUFFERSIZE 32768                      // bytes of DMA data per pass: one max size DMA
+#define VDEFAULTPASSES 20000
+
+
+typedef void (*DemuxFunction)(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount);
+
+//
+// samples per DDC per frame for each layout
+// these are the counts AnalyseDDCHeader() returns for the equivalent rate word
+//
+struct DDCLayout
+{
+    const char* Name;
+    uint32_t Counts[VNUMDDC];
+};
+
+static const struct DDCLayout Layouts[] =
+{
+    {"1 DDC @ 1536k",               {32, 0, 0, 0, 0, 0, 0, 0, 0, 0}},
+    {"1 DDC @ 48k",                 {1, 0, 0, 0, 0, 0, 0, 0, 0, 0}},
+    {"2 DDC @ 384k",                {8, 8, 0, 0, 0, 0, 0, 0, 0, 0}},
+    {"2 DDC interleaved @ 1536k",   {64, 0, 0, 0, 0, 0, 0, 0, 0, 0}},
+    {"4 DDC @ 192k",                {4, 4, 4, 4, 0, 0, 0, 0, 0, 0}},
+    {"4 DDC mixed rate",            {32, 8, 2, 1, 0, 0, 0, 0, 0, 0}},
+    {"10 DDC @ 768k",               {16, 16, 16, 16, 16, 16, 16, 16, 16, 16}}
+};
+#define VNUMLAYOUTS (sizeof(Layouts)/sizeof(Layouts[0]))
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// fill DMA buffer with frames: a rate word then sample words; returns bytes of whole frames
+//
+static uint32_t BuildFrames(uint8_t* Buffer, const struct DDCLayout* Layout)
+{
+    uint32_t FrameLength = 0;
+    uint32_t Bytes = 0;
+    uint32_t DDC, Cntr;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        FrameLength += Layout->Counts[DDC];
+    while (Bytes + (FrameLength + 1) * 8 <= VBENCHBUFFERSIZE)
+    {
+        memset(Buffer + Bytes, 0, 8);
+        Buffer[Bytes + 7] = 0x80;                               // header flag
+        Bytes += 8;
+        for (Cntr = 0; Cntr < FrameLength * 8; Cntr++)
+            Buffer[Bytes++] = (uint8_t)rand();
+    }
+    return Bytes;
+}
+
+
+//
+// demux all frames in the buffer once, as OutgoingDDCIQ() does
+//
+static void DemuxFrames(DemuxFunction Demux, const uint8_t* Buffer, uint32_t Bytes,
+                        const struct DDCLayout* Layout, uint8_t** IQBuffers)
+{
+    const uint8_t* ReadPtr = Buffer;
+    const uint8_t* EndPtr = Buffer + Bytes;
+    uint8_t* HeadPtr[VNUMDDC];
+    uint32_t DDC;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        HeadPtr[DDC] = IQBuffers[DDC];
+    while (ReadPtr < EndPtr)
+    {
+        ReadPtr += 8;                                           // skip rate word
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if (Layout->Counts[DDC] != 0)
+            {
+                Demux(HeadPtr[DDC], ReadPtr, Layout->Counts[DDC]);
+                ReadPtr += 8 * Layout->Counts[DDC];
+                HeadPtr[DDC] += 6 * Layout->Counts[DDC];
+            }
+    }
+}
+
+
+//
+// demux all frames in the buffer with a frame plan: each DDC over all frames at once
+//
+static void DemuxPlanned(const struct DDCFramePlan* Plan, const uint8_t* Buffer, uint32_t Bytes, uint8_t** IQBuffers)
+{
+    const struct DDCFramePlanEntry* Entry;
+    uint32_t Frames = Bytes / Plan->FrameBytes;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < Plan->NumEntries; Cntr++)
+    {
+        Entry = Plan->Entries + Cntr;
+        Entry->Demux(IQBuffers[Entry->DDC], Buffer + Entry->SrcOffset, Plan->FrameBytes, Frames, Entry->WordCount);
+    }
+}
+
+
+//
+// time one kernel over one layout; returns MB/s of DMA data processed
+//
+static double TimeKernel(DemuxFunction Demux, const uint8_t* Buffer, uint32_t Bytes,
+                         const struct DDCLayout* Layout, uint8_t** IQBuffers, uint32_t Passes)
+{
+    double Start, Elapsed;
+    uint32_t Pass;
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+        DemuxFrames(Demux, Buffer, Bytes, Layout, IQBuffers);
+    Elapsed = GetSeconds() - Start;
+    return ((double)Bytes * Passes) / (Elapsed * 1.0e6);
+}
+
+
+//
+// time the frame plan over one layout; returns MB/s of DMA data processed
+//
+static double TimePlanned(const struct DDCFramePlan* Plan, const uint8_t* Buffer, uint32_t Bytes,
+                          uint8_t** IQBuffers, uint32_t Passes)
+{
+    double Start, Elapsed;
+    uint32_t Pass;
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+        DemuxPlanned(Plan, Buffer, Bytes, IQBuffers);
+    Elapsed = GetSeconds() - Start;
+    return ((double)Bytes * Passes) / (Elapsed * 1.0e6);
+}
+
+
+//
+// demux an interleaved pair's frames, split to its 2 DDCs, with the scalar or the selected kernel,
+// as the general code would without a plan
+//
+static void DemuxPairFrames(bool Scalar, const uint8_t* Buffer, uint32_t Bytes, uint32_t PairWords, uint8_t** IQBuffers)
+{
+    const uint8_t* ReadPtr;
+    uint32_t Frames = Bytes / (8 * (PairWords + 1));
+    uint32_t Frame;
+
+    for (Frame = 0; Frame < Frames; Frame++)
+    {
+        ReadPtr = Buffer + Frame * 8 * (PairWords + 1) + 8;
+        if (Scalar)
+        {
+            DemuxDDCPairSamplesScalar(IQBuffers[0] + Frame * 3 * PairWords, ReadPtr, PairWords / 2, false);
+            DemuxDDCPairSamplesScalar(IQBuffers[1] + Frame * 3 * PairWords, ReadPtr, PairWords / 2, true);
+        }
+        else
+        {
+            DemuxDDCPairSamples(IQBuffers[0] + Frame * 3 * PairWords, ReadPtr, PairWords / 2, false);
+            DemuxDDCPairSamples(IQBuffers[1] + Frame * 3 * PairWords, ReadPtr, PairWords / 2, true);
+        }
+    }
+}
+
+
+//
+// check and time the split of an interleaved pair (DDC0 and 1 at 1536KHz) by the scalar code,
+// the selected kernel and a split frame plan; return true if mismatch
+//
+static bool BenchPairSplit(uint8_t* Buffer, uint8_t** RefBuffers, uint8_t** TestBuffers, uint32_t Passes)
+{
+    static const struct DDCLayout PairLayout = {"2 DDC interleaved, split", {64, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
+    struct DDCFramePlan Plan;
+    double Start, ScalarRate, KernelRate, PlannedRate;
+    uint32_t Bytes, DDC, Cntr, Pass;
+    bool Mismatch = false;
+
+    Bytes = BuildFrames(Buffer, &PairLayout);
+    for (DDC = 0; DDC < 2; DDC++)
+    {
+        memset(RefBuffers[DDC], 0, VBENCHBUFFERSIZE);
+        memset(TestBuffers[DDC], 0, VBENCHBUFFERSIZE);
+    }
+    //
+    // the reference: sample words alternately from each DDC, straight from the frames
+    //
+    for (Cntr = 0; Cntr < Bytes / 8; Cntr++)
+        if ((Cntr % 65) != 0)
+            memcpy(RefBuffers[((Cntr % 65) - 1) & 1] + 6 * (Cntr / 65 * 32 + ((Cntr % 65) - 1) / 2), Buffer + 8 * Cntr, 6);
+    DemuxPairFrames(false, Buffer, Bytes, 64, TestBuffers);
+    for (DDC = 0; DDC < 2; DDC++)
+        if (memcmp(RefBuffers[DDC], TestBuffers[DDC], VBENCHBUFFERSIZE) != 0)
+        {
+            printf("%s: output mismatch for DDC%d\n", PairLayout.Name, DDC);
+            Mismatch = true;
+        }
+    BuildDDCFramePlanSplit(&Plan, 7 | (6 << 3), PairLayout.Counts, 1);
+    for (DDC = 0; DDC < 2; DDC++)
+        memset(TestBuffers[DDC], 0, VBENCHBUFFERSIZE);
+    DemuxPlanned(&Plan, Buffer, Bytes, TestBuffers);
+    for (DDC = 0; DDC < 2; DDC++)
+        if (memcmp(RefBuffers[DDC], TestBuffers[DDC], VBENCHBUFFERSIZE) != 0)
+        {
+            printf("%s: planned output mismatch for DDC%d\n", PairLayout.Name, DDC);
+            Mismatch = true;
+        }
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+        DemuxPairFrames(true, Buffer, Bytes, 64, RefBuffers);
+    ScalarRate = ((double)Bytes * Passes) / ((GetSeconds() - Start) * 1.0e6);
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+        DemuxPairFrames(false, Buffer, Bytes, 64, TestBuffers);
+    KernelRate = ((double)Bytes * Passes) / ((GetSeconds() - Start) * 1.0e6);
+    PlannedRate = TimePlanned(&Plan, Buffer, Bytes, TestBuffers, Passes);
+    printf("%-28s %12.1f %12.1f %12.1f\n", PairLayout.Name, ScalarRate, KernelRate, PlannedRate);
+    return Mismatch;
+}
+
+
+//
+// check and time the 16 bit pack kernels on one 16 bit DDC packet's worth
+// of samples (357 samples -> 1428 bytes); return true if mismatch
+//
+#define VPACKSAMPLES 357
+static bool BenchPack16(uint32_t Passes)
+{
+    uint8_t Src[6 * VPACKSAMPLES];
+    uint8_t Ref[4 * VPACKSAMPLES];
+    uint8_t Test[4 * VPACKSAMPLES];
+    double Start, ScalarRate, KernelRate;
+    uint32_t Cntr, Pass;
+
+    for (Cntr = 0; Cntr < sizeof(Src); Cntr++)
+        Src[Cntr] = (uint8_t)(Cntr * 7 + 3);
+    PackDDCSamples16Scalar(Ref, Src, VPACKSAMPLES);
+    PackDDCSamples16(Test, Src, VPACKSAMPLES);
+    for (Cntr = 0; Cntr < VPACKSAMPLES; Cntr++)
+        if ((Ref[4*Cntr] != Src[6*Cntr]) || (Ref[4*Cntr+1] != Src[6*Cntr+1]) ||
+            (Ref[4*Cntr+2] != Src[6*Cntr+3]) || (Ref[4*Cntr+3] != Src[6*Cntr+4]))
+            break;
+    if ((Cntr != VPACKSAMPLES) || (memcmp(Ref, Test, sizeof(Ref)) != 0))
+    {
+        printf("16 bit pack: output mismatch\n");
+        return true;
+    }
+
+    Passes *= 20;
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+        PackDDCSamples16Scalar(Ref, Src, VPACKSAMPLES);
+    ScalarRate = ((double)sizeof(Src) * Passes) / ((GetSeconds() - Start) * 1.0e6);
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+        PackDDCSamples16(Test, Src, VPACKSAMPLES);
+    KernelRate = ((double)sizeof(Src) * Passes) / ((GetSeconds() - Start) * 1.0e6);
+    printf("%-28s %12.1f %12.1f\n", "16 bit pack (1 packet)", ScalarRate, KernelRate);
+    return false;
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint8_t* DMABuffer;
+    uint8_t* RefBuffers[VNUMDDC];
+    uint8_t* TestBuffers[VNUMDDC];
+    uint32_t Passes = VDEFAULTPASSES;
+    uint32_t Layout, DDC, Bytes;
+    struct DDCFramePlan Plan;
+    double ScalarRate, KernelRate, PlannedRate;
+    bool Mismatch = false;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        if (Opt == 'n')
+            Passes = atoi(optarg);
+        else
+        {
+            printf("usage: ddcdemuxbench [-n passes]\n");
+            return 0;
+        }
+    }
+    if (Passes == 0)
+        Passes = 1;
+
+    if (posix_memalign((void**)&DMABuffer, 4096, VBENCHBUFFERSIZE) != 0)
+    {
+        printf("buffer allocation failed\n");
+        return 1;
+    }
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        RefBuffers[DDC] = malloc(VBENCHBUFFERSIZE);
+        TestBuffers[DDC] = malloc(VBENCHBUFFERSIZE);
+    }
+
+    printf("DDC demux benchmark: selected kernel = %s, %d passes of %d bytes\n",
+           GetDDCDemuxName(), Passes, VBENCHBUFFERSIZE);
+    printf("%-28s %12s %12s %12s\n", "layout", "scalar MB/s", "kernel MB/s", "planned MB/s");
+    for (Layout = 0; Layout < VNUMLAYOUTS; Layout++)
+    {
+        Bytes = BuildFrames(DMABuffer, &Layouts[Layout]);
+        //
+        // check the selected kernel gives the same result as the scalar code
+        //
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+        {
+            memset(RefBuffers[DDC], 0, VBENCHBUFFERSIZE);
+            memset(TestBuffers[DDC], 0, VBENCHBUFFERSIZE);
+        }
+        DemuxFrames(DemuxDDCSamplesScalar, DMABuffer, Bytes, &Layouts[Layout], RefBuffers);
+        DemuxFrames(DemuxDDCSamples, DMABuffer, Bytes, &Layouts[Layout], TestBuffers);
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if (memcmp(RefBuffers[DDC], TestBuffers[DDC], VBENCHBUFFERSIZE) != 0)
+            {
+                printf("%s: output mismatch for DDC%d\n", Layouts[Layout].Name, DDC);
+                Mismatch = true;
+            }
+
+        BuildDDCFramePlan(&Plan, 0, Layouts[Layout].Counts);
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            memset(TestBuffers[DDC], 0, VBENCHBUFFERSIZE);
+        DemuxPlanned(&Plan, DMABuffer, Bytes, TestBuffers);
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if (memcmp(RefBuffers[DDC], TestBuffers[DDC], VBENCHBUFFERSIZE) != 0)
+            {
+                printf("%s: planned output mismatch for DDC%d\n", Layouts[Layout].Name, DDC);
+                Mismatch = true;
+            }
+
+        ScalarRate = TimeKernel(DemuxDDCSamplesScalar, DMABuffer, Bytes, &Layouts[Layout], RefBuffers, Passes);
+        KernelRate = TimeKernel(DemuxDDCSamples, DMABuffer, Bytes, &Layouts[Layout], TestBuffers, Passes);
+        PlannedRate = TimePlanned(&Plan, DMABuffer, Bytes, TestBuffers, Passes);
+        printf("%-28s %12.1f %12.1f %12.1f\n", Layouts[Layout].Name, ScalarRate, KernelRate, PlannedRate);
+    }
+
+    if (BenchPairSplit(DMABuffer, RefBuffers, TestBuffers, Passes))
+        Mismatch = true;
+    if (BenchPack16(Passes))
+        Mismatch = true;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        free(RefBuffers[DDC]);
+        free(TestBuffers[DDC]);
+    }
+    free(DMABuffer);
+    return Mismatch ? 1 : 0;
+}
@@ -0,0 +1,193 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcfecbench.c:
+// check and micro-benchmark for the DDC stream XOR parity FEC.
+// for random groups (1 to VMAXDDCFECGROUP packets of random lengths, sent as
+// a header and a payload iovec as p2app does), makes the parity packet, then
+// for every loss position recovers the lost packet from the parity and the
+// rest, and checks it is the packet sent. Then reports the rate parity is
+// made at for full groups of standard DDC packets, in MB of packets per second.
+// No FPGA hardware is needed.
+//
+// usage: ddcfecbench [-g groups] [-n passes]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include "../common/ddcfec.h"
+
+#define VDEFAULTGROUPS 2000                         // random groups checked
+#define VDEFAULTPASSES 20000                        // groups per timing run
+#define VDDCHEADERBYTES 16                          // P2 DDC packet header
+#define VDDCPACKETBYTES 1444                        // standard 24 bit DDC packet
+#define VBENCHGROUP 8                               // packets per group for the timing
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// add packets of a group to the parity, each as a header and a payload iovec.
+// returns the parity packet length after the last, or 0
+//
+static uint32_t MakeParity(struct DDCFECGroup* Group, uint8_t Packets[][VMAXDDCFECDATA],
+                           const uint32_t* Lengths, uint32_t Count)
+{
+    struct iovec Iovecs[2];
+    uint32_t Parity = 0;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Iovecs[0].iov_base = Packets[Cntr];
+        Iovecs[0].iov_len = VDDCHEADERBYTES;
+        Iovecs[1].iov_base = Packets[Cntr] + VDDCHEADERBYTES;
+        Iovecs[1].iov_len = Lengths[Cntr] - VDDCHEADERBYTES;
+        Parity = AddDDCFECPacket(Group, Iovecs, 2);
+    }
+    return Parity;
+}
+
+
+//
+// check one random group: every single loss must be recovered exactly.
+// return true if the check failed
+//
+static bool CheckGroup(uint32_t GroupNum, uint32_t Sequence, struct DDCFECGroup* Group)
+{
+    static uint8_t Packets[VMAXDDCFECGROUP][VMAXDDCFECDATA];
+    uint8_t Recovered[VMAXDDCFECDATA];
+    const uint8_t* Arrived[VMAXDDCFECGROUP];
+    uint32_t Lengths[VMAXDDCFECGROUP];
+    uint32_t ArrivedLengths[VMAXDDCFECGROUP];
+    uint32_t GroupSize, ParityLength, FirstSequence, ParityGroup;
+    uint32_t Lost, Cntr, Count, Length, Byte;
+
+    GroupSize = 1 + rand() % VMAXDDCFECGROUP;
+    for (Cntr = 0; Cntr < GroupSize; Cntr++)
+    {
+        Lengths[Cntr] = VDDCHEADERBYTES + 1 + rand() % (VMAXDDCFECDATA - VDDCHEADERBYTES);
+        for (Byte = 0; Byte < Lengths[Cntr]; Byte++)
+            Packets[Cntr][Byte] = (uint8_t)rand();
+        *(uint32_t*)Packets[Cntr] = htonl(Sequence + Cntr);
+    }
+    InitDDCFECGroup(Group, GroupSize);
+    ParityLength = MakeParity(Group, Packets, Lengths, GroupSize);
+    if ((ParityLength == 0) || !IsDDCFECPacket(Group->Packet, ParityLength, &FirstSequence, &ParityGroup)
+        || (FirstSequence != Sequence) || (ParityGroup != GroupSize))
+    {
+        printf("group %d of %d packets: no valid parity packet\n", GroupNum, GroupSize);
+        return true;
+    }
+    for (Lost = 0; Lost < GroupSize; Lost++)
+    {
+        Count = 0;
+        for (Cntr = 0; Cntr < GroupSize; Cntr++)
+            if (Cntr != Lost)
+            {
+                Arrived[Count] = Packets[Cntr];
+                ArrivedLengths[Count++] = Lengths[Cntr];
+            }
+        Length = RecoverDDCFECPacket(Recovered, Group->Packet, ParityLength, Arrived, ArrivedLengths, Count);
+        if ((Length != Lengths[Lost]) || (memcmp(Recovered, Packets[Lost], Length) != 0))
+        {
+            printf("group %d of %d packets: packet %d not recovered\n", GroupNum, GroupSize, Lost);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+//
+// time AddDDCFECPacket() for groups of standard DDC packets
+//
+static void BenchParity(uint32_t Passes, struct DDCFECGroup* Group)
+{
+    static uint8_t Packets[VBENCHGROUP][VMAXDDCFECDATA];
+    uint32_t Lengths[VBENCHGROUP];
+    uint32_t Pass, Cntr, Byte;
+    uint32_t Sequence = 0;
+    uint32_t ParityBytes = 0;
+    double Start, Seconds;
+
+    for (Cntr = 0; Cntr < VBENCHGROUP; Cntr++)
+    {
+        Lengths[Cntr] = VDDCPACKETBYTES;
+        for (Byte = 0; Byte < VDDCPACKETBYTES; Byte++)
+            Packets[Cntr][Byte] = (uint8_t)rand();
+    }
+    InitDDCFECGroup(Group, VBENCHGROUP);
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+    {
+        for (Cntr = 0; Cntr < VBENCHGROUP; Cntr++)
+            *(uint32_t*)Packets[Cntr] = htonl(Sequence++);
+        ParityBytes += MakeParity(Group, Packets, Lengths, VBENCHGROUP);
+    }
+    Seconds = GetSeconds() - Start;
+    printf("  parity of %d x %d byte packets: %7.1f MB/s (%.0f ns per packet)\n", VBENCHGROUP, VDDCPACKETBYTES,
+           (double)Passes * VBENCHGROUP * VDDCPACKETBYTES / Seconds / 1.0e6,
+           Seconds * 1.0e9 / ((double)Passes * VBENCHGROUP));
+    if (ParityBytes == 0)
+        printf("  no parity packets made\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    static struct DDCFECGroup Group;
+    uint32_t Groups = VDEFAULTGROUPS;
+    uint32_t Passes = VDEFAULTPASSES;
+    uint32_t Sequence = 0xFFFFFF00;                             // the sequence number wraps during the check
+    uint32_t Cntr;
+    bool Failed = false;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "g:n:h")) != -1)
+    {
+        if (Opt == 'g')
+            Groups = atoi(optarg);
+        else if (Opt == 'n')
+            Passes = atoi(optarg);
+        else
+        {
+            printf("usage: ddcfecbench [-g groups] [-n passes]\n");
+            return 0;
+        }
+    }
+    if (Passes == 0)
+        Passes = 1;
+
+    srand(1);
+    printf("DDC FEC benchmark: %d random groups checked, %d groups timed\n", Groups, Passes);
+    for (Cntr = 0; (Cntr < Groups) && !Failed; Cntr++)
+    {
+        Failed = CheckGroup(Cntr, Sequence, &Group);
+        Sequence += VMAXDDCFECGROUP;
+    }
+    if (!Failed)
+        printf("  every single loss recovered in %d groups\n", Groups);
+    BenchParity(Passes, &Group);
+    return Failed ? 1 : 0;
+}
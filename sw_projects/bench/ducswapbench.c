@@ -0,0 +1,198 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ducswapbench.c:
+// micro-benchmark for the TX DUC I/Q sample swap.
+// times the original per-byte loop from IncomingDUCIQ(), the scalar kernel
+// and the selected (NEON if enabled) kernel over one P2 DUC frame of
+// random samples, as IncomingDUCIQ() does for each received frame.
+// also times the in place swap, used when frames are received straight into
+// the DMA buffer, and the EER conversion, which adds an envelope sample after each one.
+// No FPGA hardware is needed.
+//
+// usage: ducswapbench [-n passes]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/txsamples.h"
+
+#define VIQSAMPLESPERFRAME 240                      // samples per DUC frame (as InDUCIQ.c)
+#define VFRAMEBYTES (VIQSAMPLESPERFRAME * 6)
+#define VDEFAULTPASSES 200000
+
+
+typedef void (*SwapFunction)(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount);
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// the loop IncomingDUCIQ() used before the swap kernels were added
+//
+static void OriginalLoop(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+{
+    const uint8_t* SrcPtr = Src;
+    uint8_t* DestPtr = Dest;
+    uint32_t Cntr;
+
+    for (Cntr=0; Cntr < SampleCount; Cntr++)
+    {
+        *DestPtr++ = *(SrcPtr+3);
+        *DestPtr++ = *(SrcPtr+4);
+        *DestPtr++ = *(SrcPtr+5);
+        *DestPtr++ = *(SrcPtr+0);
+        *DestPtr++ = *(SrcPtr+1);
+        *DestPtr++ = *(SrcPtr+2);
+        SrcPtr += 6;
+    }
+}
+
+
+//
+// the in place kernel, with the same signature as the others so it can be timed the same way:
+// Dest is swapped in place; each pass swaps it back again, so the cost is the same
+//
+static void InPlaceSwap(uint8_t* Dest, __attribute__((unused)) const uint8_t* Src, uint32_t SampleCount)
+{
+    SwapIQSamplesInPlace(Dest, SampleCount);
+}
+
+
+//
+// time one kernel; returns frames per second. Src is offset 4 bytes as in a UDP frame
+//
+static double TimeKernel(SwapFunction Swap, uint8_t* Dest, const uint8_t* Src, uint32_t Passes)
+{
+    double Start, Elapsed;
+    uint32_t Pass;
+
+    Start = GetSeconds();
+    for (Pass = 0; Pass < Passes; Pass++)
+    {
+        Swap(Dest, Src, VIQSAMPLESPERFRAME);
+        __asm__ volatile("" : : "r"(Dest) : "memory");          // stop the compiler removing the work
+    }
+    Elapsed = GetSeconds() - Start;
+    return (double)Passes / Elapsed;
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint8_t* UDPFrame;
+    uint8_t* RefBuffer;
+    uint8_t* TestBuffer;
+    uint8_t* EERBuffer;
+    uint8_t EERSample[6] = {0x00, 0x30, 0x00, 0xFF, 0xC0, 0x00};    // I = 12288, Q = -16384
+    uint8_t EERResult[12];
+    uint32_t Passes = VDEFAULTPASSES;
+    uint32_t Cntr;
+    double OriginalRate, ScalarRate, KernelRate, InPlaceRate, EERRate;
+    bool Mismatch = false;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        if (Opt == 'n')
+            Passes = atoi(optarg);
+        else
+        {
+            printf("usage: ducswapbench [-n passes]\n");
+            return 0;
+        }
+    }
+    if (Passes == 0)
+        Passes = 1;
+
+    UDPFrame = malloc(VFRAMEBYTES + 4);
+    if (posix_memalign((void**)&RefBuffer, 4096, VFRAMEBYTES) != 0 ||
+        posix_memalign((void**)&TestBuffer, 4096, VFRAMEBYTES) != 0 ||
+        posix_memalign((void**)&EERBuffer, 4096, 2 * VFRAMEBYTES) != 0 || (UDPFrame == NULL))
+    {
+        printf("buffer allocation failed\n");
+        return 1;
+    }
+    for (Cntr = 0; Cntr < VFRAMEBYTES + 4; Cntr++)
+        UDPFrame[Cntr] = (uint8_t)rand();
+
+    //
+    // check both kernels give the same result as the original loop
+    //
+    OriginalLoop(RefBuffer, UDPFrame + 4, VIQSAMPLESPERFRAME);
+    SwapIQSamplesScalar(TestBuffer, UDPFrame + 4, VIQSAMPLESPERFRAME);
+    if (memcmp(RefBuffer, TestBuffer, VFRAMEBYTES) != 0)
+    {
+        printf("scalar kernel output mismatch\n");
+        Mismatch = true;
+    }
+    memset(TestBuffer, 0, VFRAMEBYTES);
+    SwapIQSamples(TestBuffer, UDPFrame + 4, VIQSAMPLESPERFRAME);
+    if (memcmp(RefBuffer, TestBuffer, VFRAMEBYTES) != 0)
+    {
+        printf("%s kernel output mismatch\n", GetTXSampleKernelName());
+        Mismatch = true;
+    }
+    memcpy(TestBuffer, UDPFrame + 4, VFRAMEBYTES);
+    SwapIQSamplesInPlace(TestBuffer, VIQSAMPLESPERFRAME);
+    if (memcmp(RefBuffer, TestBuffer, VFRAMEBYTES) != 0)
+    {
+        printf("in place kernel output mismatch\n");
+        Mismatch = true;
+    }
+    //
+    // EER: alternate samples must be the swapped samples; check the envelope of a 3-4-5 sample
+    //
+    InterleaveEERSamples(EERBuffer, UDPFrame + 4, VIQSAMPLESPERFRAME);
+    for (Cntr = 0; Cntr < VIQSAMPLESPERFRAME; Cntr++)
+        if (memcmp(RefBuffer + Cntr * 6, EERBuffer + Cntr * 12, 6) != 0)
+        {
+            printf("EER modulation sample mismatch\n");
+            Mismatch = true;
+            break;
+        }
+    InterleaveEERSamples(EERResult, EERSample, 1);
+    if ((((uint32_t)EERResult[9] << 16) | ((uint32_t)EERResult[10] << 8) | EERResult[11]) != 20480)
+    {
+        printf("EER envelope mismatch\n");
+        Mismatch = true;
+    }
+
+    OriginalRate = TimeKernel(OriginalLoop, TestBuffer, UDPFrame + 4, Passes);
+    ScalarRate = TimeKernel(SwapIQSamplesScalar, TestBuffer, UDPFrame + 4, Passes);
+    KernelRate = TimeKernel(SwapIQSamples, TestBuffer, UDPFrame + 4, Passes);
+    InPlaceRate = TimeKernel(InPlaceSwap, TestBuffer, NULL, Passes);
+    EERRate = TimeKernel(InterleaveEERSamples, EERBuffer, UDPFrame + 4, Passes);
+    printf("DUC I/Q swap benchmark: selected kernel = %s, %d passes of %d samples\n",
+           GetTXSampleKernelName(), Passes, VIQSAMPLESPERFRAME);
+    printf("%-20s %14s %10s\n", "kernel", "frames/s", "MB/s");
+    printf("%-20s %14.0f %10.1f\n", "original loop", OriginalRate, OriginalRate * VFRAMEBYTES / 1.0e6);
+    printf("%-20s %14.0f %10.1f\n", "scalar", ScalarRate, ScalarRate * VFRAMEBYTES / 1.0e6);
+    printf("%-20s %14.0f %10.1f\n", GetTXSampleKernelName(), KernelRate, KernelRate * VFRAMEBYTES / 1.0e6);
+    printf("%-20s %14.0f %10.1f\n", "in place", InPlaceRate, InPlaceRate * VFRAMEBYTES / 1.0e6);
+    printf("%-20s %14.0f %10.1f\n", "EER interleave", EERRate, EERRate * VFRAMEBYTES / 1.0e6);
+
+    free(UDPFrame);
+    free(RefBuffer);
+    free(TestBuffer);
+    free(EERBuffer);
+    return Mismatch ? 1 : 0;
+}
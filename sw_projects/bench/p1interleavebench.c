@@ -0,0 +1,187 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p1interleavebench.c:
+// check and micro-benchmark for the protocol 1 USB frame interleave.
+// for 1 to 8 receivers, fills USB frames from random I/Q samples with the
+// per sample copy p1app used before and with the interleave selected for the
+// receiver count (NEON for 1 receiver if enabled), and checks the frames match
+// byte for byte, including the bytes after the sample area, which neither may
+// write. Then times both, in MB of USB frame per second.
+// No FPGA hardware is needed.
+//
+// usage: p1interleavebench [-n passes]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/p1interleave.h"
+
+#define VUSBFRAMESIZE 512                           // USB frame, including the C&C bytes
+#define VUSBSAMPLESIZE 504                          // sample area of a USB frame
+#define VBENCHFRAMES 64                             // USB frames per pass
+#define VIQBUFFERSIZE (VBENCHFRAMES * VUSBSAMPLESIZE)   // I/Q bytes per receiver: enough for 1 receiver
+#define VGUARDBYTE 0xA5                             // fill for bytes that must not be written
+#define VDEFAULTPASSES 20000
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// the reference: one 6 byte copy per sample, the mic bytes skipped
+// (as MakeMetisFrame() did before the interleave was specialised)
+//
+static void InterleaveReference(uint8_t* Dest, uint8_t** IQReadPtr, uint32_t SampleCount, uint32_t Receivers)
+{
+    uint32_t Sample;
+    uint32_t RX;
+
+    for (Sample = 0; Sample < SampleCount; Sample++)
+    {
+        for (RX = 0; RX < Receivers; RX++)
+        {
+            memcpy(Dest, IQReadPtr[RX], 6);
+            Dest += 6;
+            IQReadPtr[RX] += 6;
+        }
+        Dest += 2;
+    }
+}
+
+
+//
+// set up USB frames as PrepareMetisFrames() leaves them: the mic bytes zero.
+// every other byte is the guard value, so any byte not written by the interleave shows
+//
+static void PrepareFrames(uint8_t* Frames, uint32_t Receivers)
+{
+    uint32_t SamplesPerUSBFrame = VUSBSAMPLESIZE / (6 * Receivers + 2);
+    uint32_t Frame, Sample;
+    uint8_t* MicPtr;
+
+    memset(Frames, VGUARDBYTE, VBENCHFRAMES * VUSBFRAMESIZE);
+    for (Frame = 0; Frame < VBENCHFRAMES; Frame++)
+    {
+        MicPtr = Frames + Frame * VUSBFRAMESIZE;
+        for (Sample = 0; Sample < SamplesPerUSBFrame; Sample++)
+        {
+            MicPtr += 6 * Receivers;
+            memset(MicPtr, 0, 2);
+            MicPtr += 2;
+        }
+    }
+}
+
+
+//
+// fill all the USB frames of a pass from the I/Q buffers, one call per USB frame as
+// MakeMetisFrame() does; the test interleave if Interleave is set, else the reference.
+// returns the I/Q bytes read from each receiver
+//
+static uint32_t FillFrames(P1Interleave Interleave, uint8_t* Frames, uint8_t** IQBuffers, uint32_t Receivers)
+{
+    uint32_t SamplesPerUSBFrame = VUSBSAMPLESIZE / (6 * Receivers + 2);
+    uint8_t* IQReadPtr[VMAXP1RECEIVERS];
+    uint32_t Frame, RX;
+
+    for (RX = 0; RX < Receivers; RX++)
+        IQReadPtr[RX] = IQBuffers[RX];
+    for (Frame = 0; Frame < VBENCHFRAMES; Frame++)
+    {
+        if (Interleave)
+            Interleave(Frames + Frame * VUSBFRAMESIZE, IQReadPtr, SamplesPerUSBFrame);
+        else
+            InterleaveReference(Frames + Frame * VUSBFRAMESIZE, IQReadPtr, SamplesPerUSBFrame, Receivers);
+    }
+    return IQReadPtr[0] - IQBuffers[0];
+}
+
+
+int main(int argc, char *argv[])
+{
+    static uint8_t IQData[VMAXP1RECEIVERS][VIQBUFFERSIZE];
+    static uint8_t RefFrames[VBENCHFRAMES * VUSBFRAMESIZE];
+    static uint8_t TestFrames[VBENCHFRAMES * VUSBFRAMESIZE];
+    uint8_t* IQBuffers[VMAXP1RECEIVERS];
+    uint32_t Passes = VDEFAULTPASSES;
+    uint32_t Receivers, RX, Cntr, Pass, RefBytes, TestBytes;
+    P1Interleave Interleave;
+    double Start, RefRate, TestRate;
+    bool Mismatch = false;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        if (Opt == 'n')
+            Passes = atoi(optarg);
+        else
+        {
+            printf("usage: p1interleavebench [-n passes]\n");
+            return 0;
+        }
+    }
+    if (Passes == 0)
+        Passes = 1;
+
+    for (RX = 0; RX < VMAXP1RECEIVERS; RX++)
+    {
+        IQBuffers[RX] = IQData[RX];
+        for (Cntr = 0; Cntr < VIQBUFFERSIZE; Cntr++)
+            IQData[RX][Cntr] = (uint8_t)rand();
+    }
+
+    printf("P1 interleave benchmark: %d passes of %d USB frames\n", Passes, VBENCHFRAMES);
+    printf("%-12s %14s %14s\n", "receivers", "per sample MB/s", "selected MB/s");
+    for (Receivers = 1; Receivers <= VMAXP1RECEIVERS; Receivers++)
+    {
+        //
+        // check the selected interleave makes the same frames as the reference
+        //
+        Interleave = SelectP1Interleave(Receivers);
+        PrepareFrames(RefFrames, Receivers);
+        PrepareFrames(TestFrames, Receivers);
+        RefBytes = FillFrames(NULL, RefFrames, IQBuffers, Receivers);
+        TestBytes = FillFrames(Interleave, TestFrames, IQBuffers, Receivers);
+        if (TestBytes != RefBytes)
+        {
+            printf("%d receivers: %d I/Q bytes read, not %d\n", Receivers, TestBytes, RefBytes);
+            Mismatch = true;
+        }
+        for (Cntr = 0; Cntr < VBENCHFRAMES; Cntr++)
+            if (memcmp(RefFrames + Cntr * VUSBFRAMESIZE, TestFrames + Cntr * VUSBFRAMESIZE, VUSBFRAMESIZE) != 0)
+            {
+                printf("%d receivers: USB frame %d mismatch\n", Receivers, Cntr);
+                Mismatch = true;
+                break;
+            }
+
+        Start = GetSeconds();
+        for (Pass = 0; Pass < Passes; Pass++)
+            FillFrames(NULL, RefFrames, IQBuffers, Receivers);
+        RefRate = ((double)VBENCHFRAMES * VUSBSAMPLESIZE * Passes) / ((GetSeconds() - Start) * 1.0e6);
+        Start = GetSeconds();
+        for (Pass = 0; Pass < Passes; Pass++)
+            FillFrames(Interleave, TestFrames, IQBuffers, Receivers);
+        TestRate = ((double)VBENCHFRAMES * VUSBSAMPLESIZE * Passes) / ((GetSeconds() - Start) * 1.0e6);
+        printf("%-12d %14.1f %14.1f\n", Receivers, RefRate, TestRate);
+    }
+    return Mismatch ? 1 : 0;
+}
@@ -0,0 +1,434 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p2parsebench.c:
+// fuzz and throughput harness for the protocol 2 control packet handlers
+// (general, DDC specific, DUC specific and high priority packets).
+// the handlers run against a mock register backend that holds a register file
+// and counts accesses, so no FPGA hardware or network is needed.
+// fuzz passes give each handler random packets, and random changes to valid
+// ones, in buffers of exactly the packet size the event loop accepts; build
+// with -fsanitize=address to catch out of bounds accesses. Then times each
+// handler for a repeated packet and for one with a changing field, in packets/s
+// and register writes per packet.
+//
+// usage: p2parsebench [-n packets] [-f fuzz packets] [input file...]
+// each input file is one fuzz case (see P2ParseOneInput()), run and then exit:
+// for AFL, run "afl-fuzz -i in -o out -- ./p2parsebench @@".
+// "make p2parsefuzz" builds the same harness as a libFuzzer target (needs clang).
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include "../common/hwaccess.h"
+#include "../common/saturnregisters.h"
+#include "../P2_app/threaddata.h"
+#include "../P2_app/generalpacket.h"
+#include "../P2_app/IncomingDDCSpecific.h"
+#include "../P2_app/IncomingDUCSpecific.h"
+#include "../P2_app/InHighPriority.h"
+#include "../P2_app/telemetry.h"
+#include "../P2_app/packetfields.h"
+#include "../P2_app/p2config.h"
+
+#define VDEFAULTPACKETS 200000
+#define VDEFAULTFUZZPACKETS 200000
+#define VMOCKREGISTERSPACE 0x40000                  // bytes of register space in the mock
+
+
+//
+// the state p2app.c and the other P2_app modules would provide
+//
+atomic_bool IsTXMode;
+atomic_bool SDRActive;
+bool ReplyAddressSet = true;                        // as if a general packet had arrived
+bool StartBitReceived;
+bool UseDebug = false;
+_Atomic uint32_t MessageTime[VNUMINCOMINGPORTS];
+struct StreamTelemetry Telemetry[VNUMTELSTREAMS];
+uint16_t HarnessPorts[VPORTTABLESIZE];              // ports set by general packets
+uint32_t DDCSettingsChecks;                         // HandlerCheckDDCSettings() calls
+struct ThreadSocketData SocketData[VPORTTABLESIZE];  // for the DDC command bits
+struct P2Config P2Config;                           // all settings 0
+
+extern sem_t DDCInSelMutex;                 // protect access to shared DDC input select register
+extern sem_t DDCResetFIFOMutex;             // protect access to FIFO reset register
+extern sem_t RFGPIOMutex;                   // protect access to RF GPIO register
+extern sem_t CodecRegMutex;                 // protect writes to codec
+
+
+void SetPort(uint32_t ThreadNum, uint16_t PortNum)
+{
+    if (ThreadNum < VPORTTABLESIZE)
+        HarnessPorts[ThreadNum] = PortNum;
+}
+
+
+void SetSDRActive(bool Active)
+{
+    SDRActive = Active;
+}
+
+
+void HandlerCheckDDCSettings(void)
+{
+    DDCSettingsChecks++;
+}
+
+
+void SetupCATPort(__attribute__((unused)) int Port)
+{
+
+}
+
+
+void HandlerSetEERMode(__attribute__((unused)) bool Unused)
+{
+
+}
+
+
+//
+// mock register backend: a register file, with counts of accesses
+//
+static uint32_t MockRegisters[VMOCKREGISTERSPACE / 4];
+static uint64_t MockReads, MockWrites;
+
+static int MockOpenDMADevice(__attribute__((unused)) const char* Path, __attribute__((unused)) int Flags)
+{
+    return -1;
+}
+
+static uint32_t MockRegisterRead(uint32_t Address)
+{
+    MockReads++;
+    return (Address < VMOCKREGISTERSPACE) ? MockRegisters[Address >> 2] : 0;
+}
+
+static void MockRegisterWrite(uint32_t Address, uint32_t Data)
+{
+    MockWrites++;
+    if (Address < VMOCKREGISTERSPACE)
+        MockRegisters[Address >> 2] = Data;
+}
+
+static int MockDMA(__attribute__((unused)) int fd, __attribute__((unused)) unsigned char* Data,
+                   __attribute__((unused)) uint32_t Length, __attribute__((unused)) uint32_t AXIAddr)
+{
+    return 0;
+}
+
+static const struct HardwareBackend MockBackend =
+{
+    "mock register",
+    MockOpenDMADevice,
+    MockRegisterRead,
+    MockRegisterWrite,
+    MockDMA,
+    MockDMA
+};
+
+
+//
+// the handlers, with the packet size the event loop passes each
+//
+typedef void (*PacketHandler)(uint8_t* Packet);
+
+static void GeneralPacketHandler(uint8_t* Packet)
+{
+    HandleGeneralPacket(Packet);
+}
+
+struct ParserEntry
+{
+    const char* Name;
+    PacketHandler Handler;
+    uint32_t Size;
+};
+
+static const struct ParserEntry Parsers[] =
+{
+    {"general", GeneralPacketHandler, VGENERALPACKETSIZE},
+    {"DDC specific", HandleDDCSpecificPacket, VDDCSPECIFICSIZE},
+    {"DUC specific", HandleDUCSpecificPacket, VDUCSPECIFICSIZE},
+    {"high priority", HandleHighPriorityPacket, VHIGHPRIOTIYTOSDRSIZE}
+};
+
+#define VNUMPARSERS (sizeof(Parsers) / sizeof(struct ParserEntry))
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+static void Setup(void)
+{
+    static bool Done = false;
+
+    if (Done)
+        return;
+    sem_init(&DDCInSelMutex, 0, 1);                 // as p2app's main() does
+    sem_init(&DDCResetFIFOMutex, 0, 1);
+    sem_init(&RFGPIOMutex, 0, 1);
+    sem_init(&CodecRegMutex, 0, 1);
+    SetHardwareBackend(&MockBackend);
+    OpenXDMADriver();
+    Done = true;
+}
+
+
+//
+// fill a packet as a client would send it: run, 2 DDCs at 192KHz, CW keyer set up
+//
+static void MakeValidPacket(uint32_t Parser, uint8_t* Packet, uint32_t Sequence)
+{
+    memset(Packet, 0, Parsers[Parser].Size);
+    Packet[0] = Sequence >> 24;
+    Packet[1] = Sequence >> 16;
+    Packet[2] = Sequence >> 8;
+    Packet[3] = Sequence;
+    switch (Parser)
+    {
+        case 0:                                     // general: default ports, timestamps, watchdog
+            Packet[37] = 1;
+            Packet[38] = 1;
+            Packet[59] = 1;
+            break;
+        case 1:                                     // DDC specific
+            Packet[4] = 1;
+            Packet[7] = 3;
+            for (int DDC = 0; DDC < 2; DDC++)
+            {
+                Packet[DDC * 6 + 19] = 192;
+                Packet[DDC * 6 + 22] = 24;
+            }
+            break;
+        case 2:                                     // DUC specific: keyer at 20WPM, 600Hz sidetone
+            Packet[4] = 1;
+            Packet[5] = 0x16;
+            Packet[6] = 64;
+            Packet[7] = 600 >> 8;
+            Packet[8] = 600 & 0xFF;
+            Packet[9] = 20;
+            Packet[10] = 50;
+            Packet[17] = 5;
+            break;
+        case 3:                                     // high priority: run, 7.1MHz on DDC0
+            Packet[4] = 1;
+            Packet[9] = 0x12;
+            Packet[10] = 0x34;
+            Packet[11] = 0x56;
+            Packet[12] = 0x78;
+            Packet[345] = 128;
+            break;
+    }
+}
+
+
+//
+// one fuzz case: the first byte picks the handler, the rest is the packet.
+// the packet is given in a buffer of exactly the size the event loop accepts,
+// zero padded or truncated to it, as it would arrive from the network
+//
+int P2ParseOneInput(const uint8_t* Data, size_t Size)
+{
+    uint32_t Parser;
+    uint8_t* Packet;
+
+    if (Size == 0)
+        return 0;
+    Setup();
+    Parser = Data[0] % VNUMPARSERS;
+    Packet = calloc(1, Parsers[Parser].Size);      // exact size, so a sanitizer sees any overrun
+    if (Packet == NULL)
+        return 0;
+    Size--;
+    if (Size > Parsers[Parser].Size)
+        Size = Parsers[Parser].Size;
+    memcpy(Packet, Data + 1, Size);
+    Parsers[Parser].Handler(Packet);
+    free(Packet);
+    return 0;
+}
+
+
+#ifdef LIBFUZZER
+//
+// libFuzzer entry point; the fuzzer provides main()
+//
+int LLVMFuzzerTestOneInput(const uint8_t* Data, size_t Size)
+{
+    return P2ParseOneInput(Data, Size);
+}
+
+
+#else
+//
+// run one input file through P2ParseOneInput()
+//
+static int RunInputFile(const char* Name)
+{
+    static uint8_t Data[VMAXFIELDPACKET + 1];
+    FILE* File;
+    size_t Size;
+
+    File = fopen(Name, "rb");
+    if (File == NULL)
+    {
+        printf("can't open %s\n", Name);
+        return 1;
+    }
+    Size = fread(Data, 1, sizeof(Data), File);
+    fclose(File);
+    return P2ParseOneInput(Data, Size);
+}
+
+
+//
+// fuzz: random packets, and valid packets with random bytes changed
+//
+static void FuzzParsers(uint32_t Count)
+{
+    uint8_t Data[VMAXFIELDPACKET + 1];
+    uint32_t Cntr, Byte, Changes;
+    uint32_t Parser;
+
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Parser = rand() % VNUMPARSERS;
+        Data[0] = Parser;
+        if (Cntr & 1)
+        {
+            for (Byte = 0; Byte < Parsers[Parser].Size; Byte++)
+                Data[Byte + 1] = rand();
+        }
+        else
+        {
+            MakeValidPacket(Parser, Data + 1, Cntr);
+            for (Changes = rand() % 4; Changes > 0; Changes--)
+                Data[1 + rand() % Parsers[Parser].Size] = rand();
+        }
+        P2ParseOneInput(Data, Parsers[Parser].Size + 1);
+    }
+}
+
+
+//
+// time one handler for Count packets. Changing: the sequence number and one
+// field change each packet (a tuning DDC0, or a changing keyer speed), as a
+// client the user is operating sends them
+//
+static void TimeParser(uint32_t Parser, uint32_t Count, bool Changing)
+{
+    static uint8_t Packet[VMAXFIELDPACKET];
+    uint64_t WritesBefore, ReadsBefore;
+    uint32_t Cntr;
+    double Start, Seconds;
+
+    MakeValidPacket(Parser, Packet, 0);
+    Parsers[Parser].Handler(Packet);                // the first packet sets everything
+    WritesBefore = MockWrites;
+    ReadsBefore = MockReads;
+    Start = GetSeconds();
+    for (Cntr = 1; Cntr <= Count; Cntr++)
+    {
+        Packet[3] = Cntr;                           // sequence number low byte
+        if (Changing)
+        {
+            if (Parser == 3)
+                Packet[12] = Cntr;                  // DDC0 frequency
+            else if (Parser == 2)
+                Packet[9] = 10 + (Cntr & 15);       // keyer speed
+            else if (Parser == 1)
+                Packet[19] = (Cntr & 1) ? 192 : 96; // DDC0 rate
+            else
+                Packet[27] = Cntr;                  // wideband update rate
+        }
+        Parsers[Parser].Handler(Packet);
+    }
+    Seconds = GetSeconds() - Start;
+    printf("%-14s %-9s %10.0f packets/s, %6.2f register writes, %6.2f reads per packet\n",
+           Parsers[Parser].Name, Changing ? "changing" : "repeated", Count / Seconds,
+           (double)(MockWrites - WritesBefore) / Count, (double)(MockReads - ReadsBefore) / Count);
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint32_t Packets = VDEFAULTPACKETS;
+    uint32_t FuzzPackets = VDEFAULTFUZZPACKETS;
+    uint32_t Parser;
+    uint64_t Made, Skipped;
+    double Start;
+    int StdOut, NullOut;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:f:")) != -1)
+    {
+        switch (Opt)
+        {
+            case 'n':
+                Packets = atoi(optarg);
+                break;
+            case 'f':
+                FuzzPackets = atoi(optarg);
+                break;
+            default:
+                printf("usage: p2parsebench [-n packets] [-f fuzz packets] [input file...]\n");
+                return 1;
+        }
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (optind < argc)                              // input files: run them and exit (AFL, crash replay)
+    {
+        for (; optind < argc; optind++)
+            if (RunInputFile(argv[optind]))
+                return 1;
+        return 0;
+    }
+    Setup();
+
+    srand(1);
+    Start = GetSeconds();
+    fflush(stdout);
+    StdOut = dup(1);                                // the handlers' messages would swamp the results
+    NullOut = open("/dev/null", O_WRONLY);
+    dup2(NullOut, 1);
+    FuzzParsers(FuzzPackets);
+    fflush(stdout);
+    dup2(StdOut, 1);
+    close(NullOut);
+    close(StdOut);
+    printf("fuzz: %u packets handled in %.2fs\n", FuzzPackets, GetSeconds() - Start);
+
+    for (Parser = 0; Parser < VNUMPARSERS; Parser++)
+    {
+        InvalidatePacketFields();
+        TimeParser(Parser, Packets, false);
+        TimeParser(Parser, Packets, true);
+    }
+    GetRegisterWriteCounts(&Made, &Skipped);
+    printf("register layer: %llu writes made, %llu skipped as unchanged; %u DDC settings checks\n",
+           (unsigned long long)Made, (unsigned long long)Skipped, DDCSettingsChecks);
+    return 0;
+}
+#endif
@@ -0,0 +1,227 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// packetbuildbench.c:
+// micro-benchmark for making outgoing P2 DDC packets.
+// times building the 16 byte header and iovec for each packet, both in full
+// and as DDCSenderThread() does, patching the sequence number and timestamp
+// into header templates made once; against copying header and samples into
+// one buffer; then sending batches to a loopback socket with sendmmsg(),
+// as a batch of packets leaves p2app. No FPGA hardware is needed.
+//
+// usage: packetbuildbench [-n packets] [-b batch size]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define VDDCPACKETSIZE 1444                         // as OutDDCIQ.c
+#define VDDCHEADERSIZE 16
+#define VIQSAMPLESPERFRAME 238
+#define VIQBYTESPERFRAME (6 * VIQSAMPLESPERFRAME)
+#define VMAXBATCH 64
+#define VSAMPLEBUFFERPACKETS 256                    // packets of samples to cycle through
+#define VDEFAULTPACKETS 1000000
+#define VDEFAULTBATCH 16
+#define VBENCHPORT 50099                            // loopback port packets are sent to
+
+
+static uint8_t Headers[VMAXBATCH * VDDCHEADERSIZE];
+static uint8_t Assembled[VMAXBATCH][VDDCPACKETSIZE];
+static struct iovec Iovecs[VMAXBATCH][2];
+static struct mmsghdr Msgs[VMAXBATCH];
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// write one whole P2 DDC header
+//
+static inline void MakeHeader(uint8_t* PacketPtr, uint32_t Sequence, uint64_t SampleCount)
+{
+    *(uint32_t*)PacketPtr = htonl(Sequence);
+    *(uint64_t*)(PacketPtr + 4) = htobe64(SampleCount);
+    *(uint16_t*)(PacketPtr + 12) = htons(24);
+    *(uint16_t*)(PacketPtr + 14) = htons(VIQSAMPLESPERFRAME);
+}
+
+
+//
+// write the per packet fields of a P2 DDC header over its template, as DDCSenderThread()
+//
+static inline void PatchHeader(uint8_t* PacketPtr, uint32_t Sequence, uint64_t SampleCount)
+{
+    *(uint32_t*)PacketPtr = htonl(Sequence);
+    *(uint64_t*)(PacketPtr + 4) = htobe64(SampleCount);
+}
+
+
+//
+// build Packets packets in batches of Batch: header + iovec pointing at the samples.
+// if Template, only patch each header's template (made by SetupMessages()).
+// if Copy, assemble header and samples into one buffer instead.
+// if Socket >= 0, send each batch, counting part sent batches in SendErrors. Return ns per packet
+//
+static double TimeBuild(uint8_t* Samples, uint32_t Packets, uint32_t Batch, bool Copy, bool Template, int Socket, uint32_t* SendErrors)
+{
+    double Start;
+    uint32_t Sequence;
+    uint32_t InBatch = 0;
+    uint8_t* SamplePtr;
+
+    Start = GetSeconds();
+    for (Sequence = 0; Sequence < Packets; Sequence++)
+    {
+        SamplePtr = Samples + (Sequence % VSAMPLEBUFFERPACKETS) * VIQBYTESPERFRAME;
+        if (Copy)
+        {
+            MakeHeader(Assembled[InBatch], Sequence, (uint64_t)Sequence * VIQSAMPLESPERFRAME);
+            memcpy(Assembled[InBatch] + VDDCHEADERSIZE, SamplePtr, VIQBYTESPERFRAME);
+        }
+        else
+        {
+            if (Template)
+                PatchHeader(Headers + InBatch * VDDCHEADERSIZE, Sequence, (uint64_t)Sequence * VIQSAMPLESPERFRAME);
+            else
+                MakeHeader(Headers + InBatch * VDDCHEADERSIZE, Sequence, (uint64_t)Sequence * VIQSAMPLESPERFRAME);
+            Iovecs[InBatch][1].iov_base = SamplePtr;
+        }
+        if (++InBatch == Batch)
+        {
+            if ((Socket >= 0) && (sendmmsg(Socket, Msgs, Batch, 0) != (int)Batch))
+                (*SendErrors)++;
+            __asm__ volatile("" : : "r"(Headers), "r"(Assembled) : "memory");     // stop the compiler removing the work
+            InBatch = 0;
+        }
+    }
+    return (GetSeconds() - Start) * 1.0e9 / Packets;
+}
+
+
+//
+// point the batch messages at header + samples iovecs, or at the assembled packets;
+// each header starts as the template
+//
+static void SetupMessages(uint32_t Batch, bool Copy, struct sockaddr_in* Dest)
+{
+    uint32_t Cntr;
+
+    memset(Msgs, 0, sizeof(Msgs));
+    for (Cntr = 0; Cntr < Batch; Cntr++)
+    {
+        if (Copy)
+        {
+            Iovecs[Cntr][0].iov_base = Assembled[Cntr];
+            Iovecs[Cntr][0].iov_len = VDDCPACKETSIZE;
+        }
+        else
+        {
+            Iovecs[Cntr][0].iov_base = Headers + Cntr * VDDCHEADERSIZE;
+            Iovecs[Cntr][0].iov_len = VDDCHEADERSIZE;
+            Iovecs[Cntr][1].iov_len = VIQBYTESPERFRAME;
+            MakeHeader(Headers + Cntr * VDDCHEADERSIZE, 0, 0);
+        }
+        Msgs[Cntr].msg_hdr.msg_iov = Iovecs[Cntr];
+        Msgs[Cntr].msg_hdr.msg_iovlen = Copy ? 1 : 2;
+        Msgs[Cntr].msg_hdr.msg_name = Dest;
+        Msgs[Cntr].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint8_t* Samples;
+    uint32_t Packets = VDEFAULTPACKETS;
+    uint32_t Batch = VDEFAULTBATCH;
+    uint32_t SendPackets;                           // packets sent: fewer, as sending is slower
+    uint32_t Cntr;
+    uint32_t SendErrors = 0;
+    int Socket;
+    struct sockaddr_in Dest;
+    double Iovec, Templated, Copy, IovecSend, CopySend;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:b:h")) != -1)
+    {
+        if (Opt == 'n')
+            Packets = atoi(optarg);
+        else if (Opt == 'b')
+            Batch = atoi(optarg);
+        else
+        {
+            printf("usage: packetbuildbench [-n packets] [-b batch size, 1-%d]\n", VMAXBATCH);
+            return 0;
+        }
+    }
+    if (Batch == 0)
+        Batch = 1;
+    else if (Batch > VMAXBATCH)
+        Batch = VMAXBATCH;
+    if (Packets < Batch)
+        Packets = Batch;
+    Packets -= Packets % Batch;
+    SendPackets = (Packets / 10 > Batch) ? (Packets / 10) - (Packets / 10) % Batch : Batch;
+
+    Samples = malloc(VSAMPLEBUFFERPACKETS * VIQBYTESPERFRAME);
+    if (Samples == NULL)
+    {
+        printf("buffer allocation failed\n");
+        return 1;
+    }
+    for (Cntr = 0; Cntr < VSAMPLEBUFFERPACKETS * VIQBYTESPERFRAME; Cntr++)
+        Samples[Cntr] = (uint8_t)rand();
+    memset(&Dest, 0, sizeof(Dest));
+    Dest.sin_family = AF_INET;
+    Dest.sin_port = htons(VBENCHPORT);
+    Dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+    SetupMessages(Batch, false, &Dest);
+    Iovec = TimeBuild(Samples, Packets, Batch, false, false, -1, &SendErrors);
+    Templated = TimeBuild(Samples, Packets, Batch, false, true, -1, &SendErrors);
+    IovecSend = (Socket >= 0) ? TimeBuild(Samples, SendPackets, Batch, false, true, Socket, &SendErrors) : 0.0;
+    SetupMessages(Batch, true, &Dest);
+    Copy = TimeBuild(Samples, Packets, Batch, true, false, -1, &SendErrors);
+    CopySend = (Socket >= 0) ? TimeBuild(Samples, SendPackets, Batch, true, false, Socket, &SendErrors) : 0.0;
+
+    printf("DDC packet build benchmark: %d packets, batches of %d\n", Packets, Batch);
+    printf("%-28s %10s %10s\n", "method", "ns/packet", "MB/s");
+    printf("%-28s %10.1f %10.1f\n", "header + iovec", Iovec, VDDCPACKETSIZE * 1.0e3 / Iovec);
+    printf("%-28s %10.1f %10.1f\n", "template + iovec", Templated, VDDCPACKETSIZE * 1.0e3 / Templated);
+    printf("%-28s %10.1f %10.1f\n", "header + copy", Copy, VDDCPACKETSIZE * 1.0e3 / Copy);
+    if (Socket >= 0)
+    {
+        printf("%-28s %10.1f %10.1f\n", "template + iovec + sendmmsg", IovecSend, VDDCPACKETSIZE * 1.0e3 / IovecSend);
+        printf("%-28s %10.1f %10.1f\n", "header + copy + sendmmsg", CopySend, VDDCPACKETSIZE * 1.0e3 / CopySend);
+        if (SendErrors != 0)
+            printf("%d sendmmsg calls sent a part batch\n", SendErrors);
+        close(Socket);
+    }
+    else
+        printf("no UDP socket: send not timed\n");
+    free(Samples);
+    return 0;
+}
@@ -0,0 +1,83 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// regaccessbench.c:
+// time 32 bit register reads through the memory mapped user BAR
+// and through pread() on /dev/xdma0_user. Needs Saturn hardware.
+// only the read-only board ID register is accessed.
+//
+// usage: regaccessbench [-n reads]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/hwaccess.h"
+
+#define VADDRBOARDID1 0xC000                        // read only register (as saturnregisters.h)
+#define VDEFAULTREADS 100000
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// time Reads register reads; return ns per read
+//
+static double TimeReads(uint32_t Reads)
+{
+    double Start;
+    uint32_t Cntr;
+    volatile uint32_t Value;
+
+    Start = GetSeconds();
+    for (Cntr = 0; Cntr < Reads; Cntr++)
+        Value = RegisterRead(VADDRBOARDID1);
+    (void)Value;
+    return (GetSeconds() - Start) * 1.0e9 / Reads;
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint32_t Reads = VDEFAULTREADS;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        if (Opt == 'n')
+            Reads = atoi(optarg);
+        else
+        {
+            printf("usage: regaccessbench [-n reads]\n");
+            return 0;
+        }
+    }
+    if (Reads == 0)
+        Reads = 1;
+
+    if (OpenXDMADriver() == 0)
+        return 1;
+    if (GetRegisterAccessMapped())
+        printf("memory mapped:  %8.1f ns per register read\n", TimeReads(Reads));
+    else
+        printf("memory mapped:  not available\n");
+    SetRegisterAccessMapped(false);
+    printf("pread syscall:  %8.1f ns per register read\n", TimeReads(Reads));
+    return 0;
+}
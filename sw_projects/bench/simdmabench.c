@@ -0,0 +1,162 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// simdmabench.c:
+// micro-benchmark for register and DMA access through the hardware backend,
+// using the simulated FPGA with an unpaced DDC stream (10 DDCs at 1536KHz).
+// this measures the software cost of the access layer and DDC stream
+// generation, not the XDMA engine. No FPGA hardware is needed.
+//
+// usage: simdmabench [-n operations]
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../common/hwaccess.h"
+#include "../common/saturnregisters.h"
+#include "../common/saturndrivers.h"
+#include "../common/simbackend.h"
+
+#define VDEFAULTOPERATIONS 100000
+#define VMAXTRANSFER 32768                          // largest DDC DMA, as OutDDCIQ.c
+#define VDDCENABLE (1 << 30)                        // DDC enable bit in VADDRDDCINSEL
+
+
+//
+// callback from saturn register code; not needed here
+//
+void HandlerSetEERMode(__attribute__((unused)) bool Unused)
+{
+
+}
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// time register reads; return ns per read
+//
+static double TimeRegisterReads(uint32_t Reads)
+{
+    double Start;
+    uint32_t Cntr;
+    volatile uint32_t Value;
+
+    Start = GetSeconds();
+    for (Cntr = 0; Cntr < Reads; Cntr++)
+        Value = RegisterRead(VADDRBOARDID1);
+    (void)Value;
+    return (GetSeconds() - Start) * 1.0e9 / Reads;
+}
+
+
+//
+// time FIFO monitor reads; return ns per read
+//
+static double TimeFIFOReads(uint32_t Reads)
+{
+    double Start;
+    uint32_t Cntr;
+    bool Overflow, OverThreshold, Underflow;
+    unsigned int Current;
+
+    Start = GetSeconds();
+    for (Cntr = 0; Cntr < Reads; Cntr++)
+        ReadFIFOMonitorChannel(eRXDDCDMA, &Overflow, &OverThreshold, &Underflow, &Current);
+    return (GetSeconds() - Start) * 1.0e9 / Reads;
+}
+
+
+//
+// time DMA transfers of Size bytes; return ns per transfer
+//
+static double TimeDMA(int fd, uint8_t* Buffer, uint32_t Size, uint32_t Transfers, bool Read)
+{
+    double Start;
+    uint32_t Cntr;
+
+    Start = GetSeconds();
+    for (Cntr = 0; Cntr < Transfers; Cntr++)
+    {
+        if (Read)
+            DMAReadFromFPGA(fd, Buffer, Size, VADDRDDCSTREAMREAD);
+        else
+            DMAWriteToFPGA(fd, Buffer, Size, VADDRDUCSTREAMWRITE);
+    }
+    return (GetSeconds() - Start) * 1.0e9 / Transfers;
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint32_t Operations = VDEFAULTOPERATIONS;
+    uint32_t Size;
+    uint8_t* Buffer;
+    int DDCfd, DUCfd;
+    double ReadTime, WriteTime;
+    char Setting[] = "10,1536,max";
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        if (Opt == 'n')
+            Operations = atoi(optarg);
+        else
+        {
+            printf("usage: simdmabench [-n operations]\n");
+            return 0;
+        }
+    }
+    if (Operations < 10)
+        Operations = 10;
+
+    if (SetSimulatedDDCRates(Setting))
+        return 1;
+    UseSimulatedHardware();
+    OpenXDMADriver();
+    DDCfd = OpenDMADevice(VDDCDMADEVICE, O_RDWR);
+    DUCfd = OpenDMADevice(VDUCDMADEVICE, O_RDWR);
+    if ((DDCfd < 0) || (DUCfd < 0) || (posix_memalign((void**)&Buffer, 4096, VMAXTRANSFER) != 0))
+    {
+        printf("simulated DMA device or buffer not available\n");
+        return 1;
+    }
+    memset(Buffer, 0, VMAXTRANSFER);
+    RegisterWrite(VADDRDDCINSEL, VDDCENABLE);                  // direct: the register shadow mutexes aren't set up here
+
+    printf("simulated backend benchmark: %d operations\n", Operations);
+    printf("register read:      %8.1f ns\n", TimeRegisterReads(Operations));
+    printf("FIFO monitor read:  %8.1f ns\n", TimeFIFOReads(Operations));
+    printf("%-10s %14s %10s %14s %10s\n", "DMA bytes", "read ns/op", "MB/s", "write ns/op", "MB/s");
+    for (Size = 4096; Size <= VMAXTRANSFER; Size *= 2)
+    {
+        ReadTime = TimeDMA(DDCfd, Buffer, Size, Operations / 10, true);
+        WriteTime = TimeDMA(DUCfd, Buffer, Size, Operations / 10, false);
+        printf("%-10d %14.0f %10.1f %14.0f %10.1f\n", Size, ReadTime, Size * 1.0e3 / ReadTime,
+               WriteTime, Size * 1.0e3 / WriteTime);
+    }
+    RegisterWrite(VADDRDDCINSEL, 0);
+    close(DDCfd);
+    close(DUCfd);
+    free(Buffer);
+    return 0;
+}
@@ -2,6 +2,11 @@
 // main file for audio test GUI app
 // GUI created with GTK3
 //
+// ./biascheck [-r samples/s] [-d decimation] [-o file]
+// the PA and driver currents are sampled at <samples/s> (default 1000) and the
+// mean of every <decimation> samples (default 100) is displayed while in TX.
+// with -o, each displayed reading is also written to a CSV file with its min and max.
+//
 
 //
 // this value may need to be edited depending on the current sensing circuit
@@ -33,6 +38,13 @@
 #include "../common/codecwrite.h"                   // codec register I/O for Saturn
 #include "../common/version.h"                      // version I/O for Saturn
 #include "../common/debugaids.h"
+#include "../common/adcsampler.h"
+
+
+#define VDEFAULTSAMPLERATE 1000                 // aux ADC samples per second
+#define VDEFAULTDECIMATION 100                  // samples per displayed reading
+#define VDRIVERCURRENTCHANNEL 6                 // aux ADC inputs of the current sensors
+#define VPACURRENTCHANNEL 3
 
 
 //
@@ -50,7 +62,8 @@ GtkEntry *PACurrentText;
 //
 int fd;                             // device identifier
 gboolean DriverPresent;             // true if device driver is accessible
-pthread_t CurrentReadThread;        // thread looks for PTT press
+struct AuxADCSampler CurrentSampler; // samples the PA and driver currents
+FILE* LogFile;                      // CSV log of the readings, or NULL
 gboolean GPTTPressed;               // true if in TX
 #define VALIGNMENT 4096
 
@@ -122,32 +135,54 @@ void on_close_button_clicked()
 
 
 
-// this runs as its own thread to read PA and bias currents periodically
-// thread initiated at the start.
-// done in a thread so GUI event handlers not hung
 //
-void* CurrentRead(void *arg)
+// one reading, passed from the sampler thread to the GUI thread
+//
+struct CurrentReading
 {
-	gint Duration;					// record and replay duration in seconds
-	uint32_t PAReading, DriverReading;
-    float PACurrent, DriverCurrent;
+    float DriverCurrent;
+    float PACurrent;
+};
+
+
+//
+// runs in the GUI thread: display a reading
+//
+static gboolean DisplayCurrents(gpointer Data)
+{
+    struct CurrentReading* Reading = (struct CurrentReading*)Data;
     char DisplayedValue [100];
 
-	while (1)
-	{
-		usleep(100000);												// 100ms wait
-		if(GPTTPressed)
-		{
-            DriverReading = GetAnalogueIn(6);               // current = ADC reading /1638.4
-            PAReading = GetAnalogueIn(3);                   // current = ADC reading * 0.01387
-            DriverCurrent = (float)DriverReading / 1638.4F;
-            PACurrent = (float)PAReading * PACURRENTSCALE;
-            sprintf(DisplayedValue, "%6.3f", DriverCurrent);
-            gtk_entry_set_text(DriverCurrentText, DisplayedValue);
-            sprintf(DisplayedValue, "%6.2f", PACurrent);
-            gtk_entry_set_text(PACurrentText, DisplayedValue);
-		}
-	}
+    sprintf(DisplayedValue, "%6.3f", Reading->DriverCurrent);
+    gtk_entry_set_text(DriverCurrentText, DisplayedValue);
+    sprintf(DisplayedValue, "%6.2f", Reading->PACurrent);
+    gtk_entry_set_text(PACurrentText, DisplayedValue);
+    g_free(Reading);
+    return G_SOURCE_REMOVE;
+}
+
+
+//
+// called by the sampler thread with each decimated reading of the PA and bias currents
+// driver current = ADC reading /1638.4; PA current = ADC reading * PACURRENTSCALE
+// the display is updated from the GUI thread
+//
+void CurrentRead(const struct AuxADCReading* ADCReading, void* Context)
+{
+    struct CurrentReading* Reading;
+
+    if(!GPTTPressed)
+        return;
+    Reading = g_new(struct CurrentReading, 1);
+    Reading->DriverCurrent = ADCReading->Mean[VDRIVERCURRENTCHANNEL] / 1638.4F;
+    Reading->PACurrent = ADCReading->Mean[VPACURRENTCHANNEL] * PACURRENTSCALE;
+    if (LogFile != NULL)
+        fprintf(LogFile, "%.6f,%.4f,%.4f,%.4f,%.3f,%.3f,%.3f\n", ADCReading->Time * 1.0E-9,
+                Reading->DriverCurrent, ADCReading->Min[VDRIVERCURRENTCHANNEL] / 1638.4F,
+                ADCReading->Max[VDRIVERCURRENTCHANNEL] / 1638.4F, Reading->PACurrent,
+                ADCReading->Min[VPACURRENTCHANNEL] * PACURRENTSCALE,
+                ADCReading->Max[VPACURRENTCHANNEL] * PACURRENTSCALE);
+    g_idle_add(DisplayCurrents, Reading);
 }
 
 
@@ -158,8 +193,33 @@ void* CurrentRead(void *arg)
 int main(int argc, char *argv[])
 {
     guint Context;                                  // status bar context
+    uint32_t SampleRate = VDEFAULTSAMPLERATE;
+    uint32_t Decimation = VDEFAULTDECIMATION;
+    int Option;
 
     gtk_init(&argc, &argv);
+    while ((Option = getopt(argc, argv, "r:d:o:")) != -1)
+    {
+        switch (Option)
+        {
+            case 'r':
+                SampleRate = atoi(optarg);
+                break;
+            case 'd':
+                Decimation = atoi(optarg);
+                break;
+            case 'o':
+                LogFile = fopen(optarg, "w");
+                if (LogFile == NULL)
+                    perror(optarg);
+                else
+                    fprintf(LogFile, "time,driver_mean,driver_min,driver_max,pa_mean,pa_min,pa_max\n");
+                break;
+            default:
+                printf("usage: biascheck [-r samples/s] [-d decimation] [-o file]\n");
+                return EXIT_FAILURE;
+        }
+    }
 
     // Update October 2019: The line below replaces the 2 lines above
     Builder = gtk_builder_new_from_file("biascheck.ui");
@@ -198,14 +258,10 @@ int main(int argc, char *argv[])
     SetTXEnable(true);
 
 //
-// now start current reading thread
+// now start current sampling
 //
-	if(pthread_create(&CurrentReadThread, NULL, CurrentRead, NULL) < 0)
-	{
-	    perror("pthread_create check for current read");
+	if (StartAuxADCSampler(&CurrentSampler, SampleRate, Decimation, VDRIVERCURRENTCHANNEL + 1, CurrentRead, NULL))
 	    return EXIT_FAILURE;
-	}
-	pthread_detach(CurrentReadThread);
 
 
     gtk_entry_set_text(DriverCurrentText, "0.0");
@@ -214,6 +270,9 @@ int main(int argc, char *argv[])
 
 
     gtk_main();
+    StopAuxADCSampler(&CurrentSampler);
+    if (LogFile != NULL)
+        fclose(LogFile);
 
 out:
     return 0;
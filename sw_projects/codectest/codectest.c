@@ -5,6 +5,14 @@
 // ./codectest <frequency in Hz>
 // so for 400 Hz test: command line ./codectest 400
 //
+// ./codectest <frequency in Hz> -soak <seconds> [-sim]
+// scripted audio path throughput test: plays the tone on the speaker and reads
+// the mic at the same time, for the set time, with the DMA sizes p2app uses.
+// It measures the sustained rate of each stream, the FIFO fill range from the
+// FIFO monitor, and the mic overflows and speaker underflows. The exit status is
+// 1 if either rate is more than 1% from the codec rate, or any FIFO error was seen.
+// -sim uses the simulated FPGA, so the test itself can be checked without a board.
+//
 
 #define _DEFAULT_SOURCE
 #define _XOPEN_SOURCE 500
@@ -43,6 +51,7 @@
 #include "../common/codecwrite.h"                   // codec register I/O for Saturn
 #include "../common/version.h"                      // version I/O for Saturn
 #include "../common/debugaids.h"
+#include "../common/simbackend.h"
 
 extern sem_t DDCInSelMutex;                 // protect access to shared DDC input select register
 extern sem_t DDCResetFIFOMutex;             // protect access to FIFO reset register
@@ -66,11 +75,41 @@ extern sem_t CodecRegMutex;                 // protect writes to codec
 
 #define VAMPLITUDE 0.2F
 
+//
+// soak test: DMA sizes as p2app's mic and speaker threads
+//
+#define VMICSOAKLOCATIONS 16						// FIFO locations per mic message: 64 samples
+#define VMICSOAKBATCH 2								// messages waited for before a mic DMA
+#define VMICSOAKMAXBATCH 16							// most messages per mic DMA: the whole FIFO
+#define VSPKSOAKLOCATIONS 32						// FIFO locations per speaker message: 64 stereo samples
+#define VSPKSOAKBATCH 2								// messages per speaker DMA, at least
+#define VSPKSOAKMAXBATCH 16
+#define VMICBYTERATE (VSAMPLERATE * 2)				// 16 bit mono
+#define VSPKBYTERATE (VSAMPLERATE * 4)				// 16 bit stereo
+#define VSOAKRATETOLERANCE 0.01						// largest rate error passed
+
+//
+// one stream's results
+//
+struct AudioSoakStats
+{
+	uint64_t Bytes;									// bytes transferred by DMA
+	uint64_t DMAs;
+	uint64_t DMAErrors;
+	uint64_t FIFOErrors;							// mic overflows, or speaker underflows
+	uint32_t MinFill;								// FIFO occupied locations range seen
+	uint32_t MaxFill;
+	uint32_t FinalFill;								// occupied at the end, to correct the rate for
+	double Rate;									// sustained bytes/s
+};
+
 
 int DMAWritefile_fd = -1;											// DMA write file device
 int DMAReadfile_fd = -1;											// DMA read file device
 bool PTTPressed = false;
 int MaxMicLevel = 0;
+static volatile bool SoakRun;
+static struct AudioSoakStats MicStats, SpkStats;
 
 ///
 // not really needed!
@@ -139,7 +178,8 @@ void CreateTestData(char* MemPtr, uint32_t Samples, uint32_t Freq)
 void DMAWriteToCodec(char* MemPtr, uint32_t Length)
 {
 	uint32_t Depth = 0;
-	bool FIFOOverflow;
+	bool FIFOOverflow, FIFOOverThreshold, FIFOUnderflow;
+	unsigned int Current;
 	uint32_t DMACount;
 	uint32_t  TotalDMACount;
 
@@ -148,15 +188,15 @@ void DMAWriteToCodec(char* MemPtr, uint32_t Length)
 
 	for(DMACount = 0; DMACount < TotalDMACount; DMACount++)
 	{
-		Depth = ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow);        // read the FIFO free locations
+		Depth = ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);        // read the FIFO free locations
 //		printf("FIFO monitor read; depth = %d\n", Depth);
 		while (Depth < VDMAWORDSPERDMA)       // loop till space available
 		{
 			usleep(1000);								                    // 1ms wait
-			Depth = ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow);    // read the FIFO free locations
+			Depth = ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);    // read the FIFO free locations
 		}
 		// DMA write next batch
-		DMAWriteToFPGA(DMAWritefile_fd, MemPtr, VDMATRANSFERSIZE, AXIBaseAddress);
+		DMAWriteToFPGA(DMAWritefile_fd, (unsigned char*)MemPtr, VDMATRANSFERSIZE, VADDRSPKRSTREAMWRITE);
 		MemPtr += VDMATRANSFERSIZE;
 		CheckPTT();
 	}
@@ -199,7 +239,8 @@ void CopyMicToSpeaker(char* Read, char *Write, uint32_t Length)
 void DMAReadFromCodec(char* MemPtr, uint32_t Length)
 {
 	uint32_t Depth = 0;
-	bool FIFOOverflow;
+	bool FIFOOverflow, FIFOOverThreshold, FIFOUnderflow;
+	unsigned int Current;
 	uint32_t DMACount;
 	uint32_t  TotalDMACount;
 	int16_t *MicReadPtr;
@@ -212,17 +253,17 @@ void DMAReadFromCodec(char* MemPtr, uint32_t Length)
 
 	for(DMACount = 0; DMACount < TotalDMACount; DMACount++)
 	{
-		Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow);        // read the FIFO free locations
+		Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);        // read the FIFO free locations
 		//printf("FIFO monitor read; depth = %d\n", Depth);
 		while (Depth < VDMAWORDSPERDMA)       // loop till enough data available
 		{
 			usleep(1000);								                    // 1ms wait
-			Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow);    // read the FIFO free locations
+			Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);    // read the FIFO free locations
 		}
 		// DMA read next batch of 16 bit mic samples
 		// then updatre mic amplitude
 		//
-		DMAReadFromFPGA(DMAReadfile_fd, MemPtr, VDMATRANSFERSIZE, AXIBaseAddress);
+		DMAReadFromFPGA(DMAReadfile_fd, (unsigned char*)MemPtr, VDMATRANSFERSIZE, VADDRMICSTREAMREAD);
 		for(SampleCntr=0; SampleCntr < VDMATRANSFERSIZE/2; SampleCntr++)
 		{
 			MicSample = *MicReadPtr++;		// get mic sample
@@ -238,6 +279,174 @@ void DMAReadFromCodec(char* MemPtr, uint32_t Length)
 
 
 
+//
+// note a FIFO monitor reading in a stream's fill range
+//
+static void NoteSoakFill(struct AudioSoakStats* Stats, unsigned int Current)
+{
+	if(Current < Stats->MinFill)
+		Stats->MinFill = Current;
+	if(Current > Stats->MaxFill)
+		Stats->MaxFill = Current;
+}
+
+
+//
+// soak mic thread: read the mic as p2app does, a message or more at a time once 2 are ready
+//
+static void* MicSoakThread(void* arg)
+{
+	unsigned char* Buffer = (unsigned char*)arg;
+	bool FIFOOverflow, FIFOOverThreshold, FIFOUnderflow;
+	unsigned int Current;
+	uint32_t Depth;
+	uint32_t Messages;
+
+	while(SoakRun)
+	{
+		Depth = WaitFIFOMonitorChannel(eMicCodecDMA, VMICSOAKBATCH * VMICSOAKLOCATIONS, VFIFOWAITTIMEOUT,
+									   &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+		if(FIFOOverflow)
+			MicStats.FIFOErrors++;
+		NoteSoakFill(&MicStats, Current);
+		Messages = Depth / VMICSOAKLOCATIONS;
+		if(Messages < VMICSOAKBATCH)
+			continue;
+		if(Messages > VMICSOAKMAXBATCH)
+			Messages = VMICSOAKMAXBATCH;
+		if(DMAReadFromFPGA(DMAReadfile_fd, Buffer, Messages * VMICSOAKLOCATIONS * 8, VADDRMICSTREAMREAD) != 0)
+			MicStats.DMAErrors++;
+		else
+			MicStats.Bytes += Messages * VMICSOAKLOCATIONS * 8;
+		MicStats.DMAs++;
+	}
+	return NULL;
+}
+
+
+//
+// soak speaker thread: keep the FIFO topped up with the tone, 2 or more messages per DMA.
+// Tone is 1 second of samples, so it loops without a phase step
+//
+static void* SpeakerSoakThread(void* arg)
+{
+	unsigned char* Tone = (unsigned char*)arg;
+	bool FIFOOverflow, FIFOOverThreshold, FIFOUnderflow;
+	unsigned int Current;
+	uint32_t Depth;
+	uint32_t Messages;
+	uint32_t Bytes;
+	uint32_t ToneOffset = 0;
+	bool Started = false;
+
+	while(SoakRun)
+	{
+		Depth = WaitFIFOMonitorChannel(eSpkCodecDMA, VSPKSOAKBATCH * VSPKSOAKLOCATIONS, VFIFOWAITTIMEOUT,
+									   &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+		if(Started)											// empty before the 1st write is not an underflow
+		{
+			if(FIFOUnderflow)
+				SpkStats.FIFOErrors++;
+			NoteSoakFill(&SpkStats, Current);
+		}
+		Messages = Depth / VSPKSOAKLOCATIONS;
+		if(Messages < VSPKSOAKBATCH)
+			continue;
+		if(Messages > VSPKSOAKMAXBATCH)
+			Messages = VSPKSOAKMAXBATCH;
+		Bytes = Messages * VSPKSOAKLOCATIONS * 8;
+		if((ToneOffset + Bytes) > VSPKBYTERATE)
+			ToneOffset = 0;									// 1s of tone is a whole number of DMAs
+		if(DMAWriteToFPGA(DMAWritefile_fd, Tone + ToneOffset, Bytes, VADDRSPKRSTREAMWRITE) != 0)
+			SpkStats.DMAErrors++;
+		else
+		{
+			SpkStats.Bytes += Bytes;
+			ToneOffset += Bytes;
+			Started = true;
+		}
+		SpkStats.DMAs++;
+	}
+	return NULL;
+}
+
+
+//
+// print one stream's results; return true if it failed
+//
+static bool ReportSoakStream(const char* Name, struct AudioSoakStats* Stats, uint32_t ExpectedRate, const char* ErrorName)
+{
+	bool Failed;
+
+	Failed = (Stats->DMAErrors != 0) || (Stats->FIFOErrors != 0)
+			 || (fabs(Stats->Rate - ExpectedRate) > (VSOAKRATETOLERANCE * ExpectedRate));
+	printf("%-8s %10.0f B/s (expected %d), %llu DMAs, %llu DMA errors, %llu %s, FIFO fill %d-%d of %d locations: %s\n",
+		   Name, Stats->Rate, ExpectedRate, (unsigned long long)Stats->DMAs, (unsigned long long)Stats->DMAErrors,
+		   (unsigned long long)Stats->FIFOErrors, ErrorName, (Stats->MinFill > Stats->MaxFill) ? 0 : Stats->MinFill,
+		   Stats->MaxFill, DMAFIFODepths[(Stats == &MicStats) ? eMicCodecDMA : eSpkCodecDMA], Failed ? "FAIL" : "pass");
+	return Failed;
+}
+
+
+//
+// scripted throughput test of the mic and speaker paths together, for Seconds.
+// the rates are of the data the codec made and played: the mic bytes read plus those
+// still in the FIFO, and the speaker bytes written less those not yet played.
+// return true if failed
+//
+bool RunAudioSoak(uint32_t Seconds, uint32_t Frequency, char* ToneBuffer, char* MicBuffer)
+{
+	pthread_t MicThread, SpeakerThread;
+	struct timespec Start, End;
+	bool FIFOOverflow, FIFOOverThreshold, FIFOUnderflow;
+	unsigned int Current;
+	double Elapsed;
+	bool Failed;
+
+	memset(&MicStats, 0, sizeof(MicStats));
+	memset(&SpkStats, 0, sizeof(SpkStats));
+	MicStats.MinFill = SpkStats.MinFill = UINT_MAX;
+	CreateTestData(ToneBuffer, VSAMPLERATE, Frequency);
+	SetupFIFOMonitorChannel(eMicCodecDMA, false);
+	SetupFIFOMonitorChannel(eSpkCodecDMA, false);
+	ResetDMAStreamFIFO(eSpkCodecDMA);
+	ResetDMAStreamFIFO(eMicCodecDMA);
+	ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);		// clear the flags
+	ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+	printf("audio soak: mic and speaker DMA for %d s, %dHz tone\n", Seconds, Frequency);
+
+	SoakRun = true;
+	clock_gettime(CLOCK_MONOTONIC, &Start);
+	if((pthread_create(&MicThread, NULL, MicSoakThread, MicBuffer) != 0)
+	   || (pthread_create(&SpeakerThread, NULL, SpeakerSoakThread, ToneBuffer) != 0))
+	{
+		printf("soak thread create failed\n");
+		return true;
+	}
+	sleep(Seconds);
+	SoakRun = false;
+	pthread_join(MicThread, NULL);
+	pthread_join(SpeakerThread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &End);
+	Elapsed = (End.tv_sec - Start.tv_sec) + (End.tv_nsec - Start.tv_nsec) * 1.0e-9;
+
+	ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+	MicStats.FinalFill = Current;
+	if(FIFOOverflow)
+		MicStats.FIFOErrors++;
+	MicStats.Rate = (MicStats.Bytes + 8.0 * MicStats.FinalFill) / Elapsed;
+	ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+	SpkStats.FinalFill = Current;
+	SpkStats.Rate = ((double)SpkStats.Bytes - 8.0 * SpkStats.FinalFill) / Elapsed;
+
+	Failed = ReportSoakStream("mic", &MicStats, VMICBYTERATE, "overflows");
+	Failed |= ReportSoakStream("speaker", &SpkStats, VSPKBYTERATE, "underflows");
+	printf("%s\n", Failed ? "FAIL: audio path below production rate, or FIFO errors" : "PASS");
+	return Failed;
+}
+
+
+
 //
 // main program
 //
@@ -246,8 +455,11 @@ int main(int argc, char *argv[])
   	char* WriteBuffer = NULL;											// data for DMA write
   	char* ReadBuffer = NULL;											// data for DMA read
 	uint32_t BufferSize = VMEMBUFFERSIZE;
-	uint32_t Frequency;
+	uint32_t Frequency = 0;
 	uint32_t Length;
+	uint32_t SoakSeconds = 0;
+	bool Simulate = false;
+	int Result = 0;
 	bool MicRing = false;
 	bool EnableBias =false;
 	bool EnableBoost =false;
@@ -265,6 +477,8 @@ int main(int argc, char *argv[])
 		printf("-mictip: connect mic to tip\n");
 		printf("-micring: connect mic to ring\n");
 		printf("-xlr: connect mic to XLR input\n");
+		printf("-soak <seconds>: scripted mic and speaker throughput test; exit status 1 if it fails\n");
+		printf("-sim: use the simulated FPGA, no hardware\n");
 	}
 	else
 	{
@@ -297,6 +511,16 @@ int main(int argc, char *argv[])
 					MicRing = true;
 					printf("mic on ring\n");
 				}
+				if((strcmp(argv[Cntr], "-soak") == 0) && (Cntr + 1 < (uint32_t)argc))
+				{
+					SoakSeconds = atoi(argv[++Cntr]);
+					printf("soak test for %d seconds\n", SoakSeconds);
+				}
+				if(strcmp(argv[Cntr], "-sim") == 0)
+				{
+					Simulate = true;
+					printf("using simulated FPGA\n");
+				}
 			}
 	}
 	if(Frequency > 0)
@@ -309,6 +533,8 @@ int main(int argc, char *argv[])
   		sem_init(&RFGPIOMutex, 0, 1);                                     // for RF GPIO register
   		sem_init(&CodecRegMutex, 0, 1);                                   // for codec writes
 
+		if(Simulate)
+			UseSimulatedHardware();
 		OpenXDMADriver();
 		PrintVersionInfo();
 		CodecInitialise();
@@ -328,14 +554,14 @@ int main(int argc, char *argv[])
 			goto out;
 		}
 
-		DMAWritefile_fd = open("/dev/xdma0_h2c_0", O_RDWR);
+		DMAWritefile_fd = OpenDMADevice(VSPKDMADEVICE, O_RDWR);
 		if(DMAWritefile_fd < 0)
 		{
 			printf("XDMA write device open failed\n");
 			goto out;
 		}
 
-		DMAReadfile_fd = open("/dev/xdma0_c2h_0", O_RDWR);
+		DMAReadfile_fd = OpenDMADevice(VMICDMADEVICE, O_RDWR);
 		if(DMAReadfile_fd < 0)
 		{
 			printf("XDMA read device open failed\n");
@@ -349,6 +575,12 @@ int main(int argc, char *argv[])
 		SetOrionMicOptions(MicRing, EnableBias, true);
 		SetMicBoost(EnableBoost);
 		SetBalancedMicInput(IsXLR);
+		if(SoakSeconds != 0)
+		{
+			if(RunAudioSoak(SoakSeconds, Frequency, WriteBuffer, ReadBuffer))
+				Result = 1;
+			goto out;
+		}
 
 		printf("resetting FIFO..\n");
 		ResetDMAStreamFIFO(eSpkCodecDMA);
@@ -384,10 +616,11 @@ out:
 		close(DMAWritefile_fd);
 		close(DMAReadfile_fd);
 		free(WriteBuffer);
+		free(ReadBuffer);
   		sem_destroy(&DDCInSelMutex);
   		sem_destroy(&DDCResetFIFOMutex);
   		sem_destroy(&RFGPIOMutex);
   		sem_destroy(&CodecRegMutex);
 	}
+	return Result;
 }
-
@@ -0,0 +1,158 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// adcsampler.c:
+// continuous sampling of the RF board (Alex) aux ADC inputs
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "../common/adcsampler.h"
+#include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+
+
+#define VNSPERSECOND 1000000000ULL
+
+
+static void AddTime(struct timespec* Time, uint64_t Ns)
+{
+    Ns += Time->tv_nsec;
+    Time->tv_sec += Ns / VNSPERSECOND;
+    Time->tv_nsec = Ns % VNSPERSECOND;
+}
+
+
+static uint64_t TimespecNs(const struct timespec* Time)
+{
+    return (uint64_t)Time->tv_sec * VNSPERSECOND + Time->tv_nsec;
+}
+
+
+//
+// clear the statistics for the next reading
+//
+static void ClearReading(struct AuxADCReading* Reading, uint32_t NumChannels)
+{
+    uint32_t Cntr;
+
+    Reading->Samples = 0;
+    for (Cntr = 0; Cntr < NumChannels; Cntr++)
+    {
+        Reading->Mean[Cntr] = 0.0F;
+        Reading->Min[Cntr] = UINT32_MAX;
+        Reading->Max[Cntr] = 0;
+    }
+}
+
+
+//
+// sampler thread: wait for each sample time, read the register block, and
+// accumulate. The sums are kept as integers and turned into means at the end.
+//
+static void* AuxADCSamplerThread(void* Arg)
+{
+    struct AuxADCSampler* Sampler = (struct AuxADCSampler*)Arg;
+    struct AuxADCReading Reading;
+    struct timespec Next, Now;
+    uint64_t Sums[VMAXAUXADCCHANNELS];
+    uint64_t Period;
+    uint32_t Data[VMAXAUXADCCHANNELS];
+    uint32_t Cntr;
+
+    Period = VNSPERSECOND / Sampler->Rate;
+    memset(&Reading, 0, sizeof(Reading));
+    memset(Sums, 0, sizeof(Sums));
+    ClearReading(&Reading, Sampler->NumChannels);
+    clock_gettime(CLOCK_MONOTONIC, &Next);
+    while (Sampler->Running)
+    {
+        AddTime(&Next, Period);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Next, NULL) == EINTR)
+            ;
+        //
+        // if more than a whole period late, skip the missed sample times
+        //
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        while (TimespecNs(&Now) >= (TimespecNs(&Next) + Period))
+        {
+            AddTime(&Next, Period);
+            Sampler->Overruns++;
+        }
+
+        RegisterReadBlock(VADDRALEXADCBASE, Data, Sampler->NumChannels);
+        for (Cntr = 0; Cntr < Sampler->NumChannels; Cntr++)
+        {
+            Sums[Cntr] += Data[Cntr];
+            if (Data[Cntr] < Reading.Min[Cntr])
+                Reading.Min[Cntr] = Data[Cntr];
+            if (Data[Cntr] > Reading.Max[Cntr])
+                Reading.Max[Cntr] = Data[Cntr];
+        }
+        if (++Reading.Samples == Sampler->Decimation)
+        {
+            for (Cntr = 0; Cntr < Sampler->NumChannels; Cntr++)
+            {
+                Reading.Mean[Cntr] = (float)Sums[Cntr] / (float)Reading.Samples;
+                Sums[Cntr] = 0;
+            }
+            Reading.Time = TimespecNs(&Now);
+            Reading.Overruns = Sampler->Overruns;
+            Sampler->Callback(&Reading, Sampler->Context);
+            ClearReading(&Reading, Sampler->NumChannels);
+        }
+    }
+    return NULL;
+}
+
+
+//
+// start the sampler thread
+//
+bool StartAuxADCSampler(struct AuxADCSampler* Sampler, uint32_t Rate, uint32_t Decimation,
+                        uint32_t NumChannels, AuxADCCallback Callback, void* Context)
+{
+    if ((Rate == 0) || (Rate > VMAXAUXADCRATE) || (Decimation == 0) || (NumChannels == 0)
+        || (NumChannels > VMAXAUXADCCHANNELS) || (Callback == NULL))
+    {
+        printf("aux ADC sampler: bad settings: %d samples/s, decimation %d, %d channels\n",
+               Rate, Decimation, NumChannels);
+        return true;
+    }
+    Sampler->Rate = Rate;
+    Sampler->Decimation = Decimation;
+    Sampler->NumChannels = NumChannels;
+    Sampler->Callback = Callback;
+    Sampler->Context = Context;
+    Sampler->Overruns = 0;
+    Sampler->Running = true;
+    if (pthread_create(&Sampler->Thread, NULL, AuxADCSamplerThread, Sampler) != 0)
+    {
+        perror("pthread_create aux ADC sampler");
+        Sampler->Running = false;
+        return true;
+    }
+    return false;
+}
+
+
+//
+// stop the sampler thread
+//
+void StopAuxADCSampler(struct AuxADCSampler* Sampler)
+{
+    if (!Sampler->Running)
+        return;
+    Sampler->Running = false;
+    pthread_join(Sampler->Thread, NULL);
+}
@@ -0,0 +1,85 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// adcsampler.h:
+// continuous sampling of the RF board (Alex) aux ADC inputs
+//
+// a thread reads the whole aux ADC register block in one batched read at a
+// fixed rate, and every Decimation samples passes on the mean, minimum and
+// maximum of each channel over those samples.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __adcsampler_h
+#define __adcsampler_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+
+#define VMAXAUXADCCHANNELS 8                    // registers in the aux ADC block
+#define VMAXAUXADCRATE 100000                   // samples per second
+
+
+//
+// one decimated output: the statistics of Samples register block reads
+//
+struct AuxADCReading
+{
+    uint64_t Time;                              // ns, CLOCK_MONOTONIC, of the last sample
+    uint32_t Samples;                           // samples combined
+    uint32_t Overruns;                          // sample times missed since the sampler started
+    float Mean[VMAXAUXADCCHANNELS];
+    uint32_t Min[VMAXAUXADCCHANNELS];
+    uint32_t Max[VMAXAUXADCCHANNELS];
+};
+
+
+//
+// called from the sampler thread with each decimated reading
+//
+typedef void (*AuxADCCallback)(const struct AuxADCReading* Reading, void* Context);
+
+
+struct AuxADCSampler
+{
+    pthread_t Thread;
+    uint32_t Rate;                              // samples per second
+    uint32_t Decimation;                        // samples per reading
+    uint32_t NumChannels;                       // registers read from VADDRALEXADCBASE
+    AuxADCCallback Callback;
+    void* Context;
+    volatile bool Running;
+    uint32_t Overruns;
+};
+
+
+//
+// StartAuxADCSampler(struct AuxADCSampler* Sampler, uint32_t Rate, uint32_t Decimation,
+//                    uint32_t NumChannels, AuxADCCallback Callback, void* Context)
+// start a thread sampling NumChannels aux ADC registers at Rate samples per second
+// (up to VMAXAUXADCRATE), calling Callback with a reading every Decimation samples.
+// the register device must be open (OpenXDMADriver()).
+// a sample time that is missed (eg the thread was descheduled) is counted as an
+// overrun and skipped, so readings stay evenly spaced.
+// return true if error
+//
+bool StartAuxADCSampler(struct AuxADCSampler* Sampler, uint32_t Rate, uint32_t Decimation,
+                        uint32_t NumChannels, AuxADCCallback Callback, void* Context);
+
+
+//
+// StopAuxADCSampler(struct AuxADCSampler* Sampler)
+// stop the thread and wait for it to exit. A partial reading is discarded.
+//
+void StopAuxADCSampler(struct AuxADCSampler* Sampler);
+
+
+#endif
@@ -25,4 +25,11 @@
 void PrintAuxADCInfo(void);
 
 
+//
+// ReadDieTemperature(void)
+// read the FPGA die temperature from the XADC, in degrees C
+//
+float ReadDieTemperature(void);
+
+
 #endif
\ No newline at end of file
@@ -0,0 +1,200 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// bufferarena.c:
+// one memory region for all the stream buffers
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../common/bufferarena.h"
+
+
+//
+// grow the file to NewSize bytes and map the new part after the rest.
+// called with the mutex held. return true if error
+//
+static bool GrowArena(struct BufferArena* Arena, size_t NewSize)
+{
+    void* Mapping;
+
+    NewSize = (NewSize + Arena->PageSize - 1) & ~(Arena->PageSize - 1);
+    if (NewSize <= Arena->Size)
+        return false;
+    if (NewSize > VARENARESERVE)
+    {
+        printf("buffer arena: %zu bytes is more than the %lu reserved\n", NewSize, VARENARESERVE);
+        return true;
+    }
+    if (ftruncate(Arena->fd, NewSize) != 0)
+    {
+        perror("buffer arena size");
+        return true;
+    }
+    Mapping = mmap(Arena->Base + Arena->Size, NewSize - Arena->Size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED | MAP_POPULATE, Arena->fd, Arena->Size);
+    if (Mapping == MAP_FAILED)
+    {
+        if (Arena->HugePages)
+            printf("buffer arena: no huge pages free for %zu more bytes (see /proc/sys/vm/nr_hugepages)\n",
+                   NewSize - Arena->Size);
+        else
+            perror("buffer arena map");
+        if (ftruncate(Arena->fd, Arena->Size) != 0)
+            perror("buffer arena size");
+        return true;
+    }
+    if (Arena->Locked && (mlock(Mapping, NewSize - Arena->Size) != 0))
+    {
+        printf("buffer arena: mlock failed (errno=%d); memory not locked\n", errno);
+        Arena->Locked = false;
+    }
+    Arena->Size = NewSize;
+    return false;
+}
+
+
+//
+// open the memfd and reserve the address range; then add the first page,
+// to find out whether huge pages can really be had
+// return true if error
+//
+static bool OpenArena(struct BufferArena* Arena, bool HugePages)
+{
+    uint8_t* Reserved;
+    struct stat Stat;
+
+    Arena->fd = memfd_create("saturnarena", HugePages ? MFD_HUGETLB : 0);
+    if (Arena->fd < 0)
+        return true;
+    Arena->HugePages = HugePages;
+    Arena->PageSize = sysconf(_SC_PAGESIZE);
+    if (HugePages && (fstat(Arena->fd, &Stat) == 0))
+        Arena->PageSize = Stat.st_blksize;                      // huge page size
+    //
+    // reserve space for the arena, aligned to its page size
+    //
+    Reserved = mmap(NULL, VARENARESERVE + Arena->PageSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Reserved == MAP_FAILED)
+    {
+        close(Arena->fd);
+        return true;
+    }
+    Arena->Base = (uint8_t*)(((uintptr_t)Reserved + Arena->PageSize - 1) & ~((uintptr_t)Arena->PageSize - 1));
+    if (Arena->Base != Reserved)
+        munmap(Reserved, Arena->Base - Reserved);
+    munmap(Arena->Base + VARENARESERVE, Arena->PageSize - (Arena->Base - Reserved));
+    if (GrowArena(Arena, Arena->PageSize))
+    {
+        munmap(Arena->Base, VARENARESERVE);
+        close(Arena->fd);
+        return true;
+    }
+    return false;
+}
+
+
+//
+// create an empty arena
+//
+bool CreateBufferArena(struct BufferArena* Arena, bool HugePages, bool Lock)
+{
+    memset(Arena, 0, sizeof(struct BufferArena));
+    Arena->fd = -1;
+    Arena->Locked = Lock;
+    pthread_mutex_init(&Arena->Mutex, NULL);
+    if (HugePages)
+    {
+        if (!OpenArena(Arena, true))
+        {
+            printf("stream buffers: %zu KB huge pages%s\n", Arena->PageSize / 1024, Arena->Locked ? ", locked" : "");
+            return false;
+        }
+        printf("stream buffers: huge pages not available; using normal pages\n");
+        Arena->Size = 0;
+        Arena->Locked = Lock;
+    }
+    if (OpenArena(Arena, false))
+    {
+        perror("buffer arena");
+        Arena->fd = -1;
+        return true;
+    }
+    return false;
+}
+
+
+//
+// take a slice from the end of the arena
+//
+void* ArenaAlloc(struct BufferArena* Arena, size_t Size, size_t Alignment)
+{
+    uint8_t* Buffer = NULL;
+    size_t Start;
+
+    if (Alignment < VCACHELINESIZE)
+        Alignment = VCACHELINESIZE;
+    pthread_mutex_lock(&Arena->Mutex);
+    Start = (Arena->Used + Alignment - 1) & ~(Alignment - 1);
+    if ((Arena->fd >= 0) && !GrowArena(Arena, Start + Size))
+    {
+        Buffer = Arena->Base + Start;
+        Arena->Used = Start + Size;
+    }
+    pthread_mutex_unlock(&Arena->Mutex);
+    if (Buffer != NULL)
+        memset(Buffer, 0, Size);
+    return Buffer;
+}
+
+
+//
+// take whole pages for a ring, and map them mirrored
+//
+bool ArenaRingBuffer(struct BufferArena* Arena, struct SPSCRingBuffer* Ring, uint32_t Size)
+{
+    uint32_t RingSize;
+    size_t Start;
+    bool Error = true;
+
+    memset(Ring, 0, sizeof(struct SPSCRingBuffer));
+    pthread_mutex_lock(&Arena->Mutex);
+    RingSize = Arena->PageSize;
+    while (RingSize < Size)
+        RingSize <<= 1;
+    Start = (Arena->Used + Arena->PageSize - 1) & ~(Arena->PageSize - 1);
+    if ((Arena->fd >= 0) && !GrowArena(Arena, Start + RingSize))
+    {
+        Error = MapFileRingBuffer(Ring, Arena->fd, Start, RingSize, Arena->PageSize);
+        if (!Error)
+            Arena->Used = Start + RingSize;
+    }
+    pthread_mutex_unlock(&Arena->Mutex);
+    return Error;
+}
+
+
+//
+// release everything
+//
+void FreeBufferArena(struct BufferArena* Arena)
+{
+    if (Arena->fd < 0)
+        return;
+    munmap(Arena->Base, VARENARESERVE);
+    close(Arena->fd);
+    Arena->fd = -1;
+    Arena->Size = 0;
+    Arena->Used = 0;
+}
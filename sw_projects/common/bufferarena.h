@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// bufferarena.h:
+// one memory region for all the stream buffers
+//
+// the arena is a memfd, optionally of huge pages, mapped once in a reserved
+// address range and grown as buffers are taken from it. Buffers are cache line
+// aligned slices; ring buffers are page aligned slices, also mapped mirrored.
+// so the hot buffers share a few (huge) pages, can be locked in memory with
+// one mlock, and are all released together when the arena is freed.
+// buffers are never freed one at a time.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __bufferarena_h
+#define __bufferarena_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "../common/ringbuffer.h"
+
+
+#define VARENARESERVE (256UL * 1024 * 1024)     // address space reserved for an arena
+#define VCACHELINESIZE 64                       // Cortex-A72 cache line
+
+
+struct BufferArena
+{
+    int fd;                                     // memfd holding the memory; -1 if not created
+    uint8_t* Base;                              // all of the file is mapped from here
+    size_t Size;                                // bytes of file so far
+    size_t Used;                                // bytes given out
+    size_t PageSize;                            // huge page size, if huge pages
+    bool HugePages;
+    bool Locked;                                // true if the memory is mlock()ed
+    pthread_mutex_t Mutex;
+};
+
+
+//
+// CreateBufferArena(struct BufferArena* Arena, bool HugePages, bool Lock)
+// create an empty arena. With HugePages it is made of huge pages if the kernel
+// can (they must be reserved, eg in /proc/sys/vm/nr_hugepages), else of normal
+// pages. With Lock, the memory is locked in RAM as it is added.
+// return true if error
+//
+bool CreateBufferArena(struct BufferArena* Arena, bool HugePages, bool Lock);
+
+
+//
+// ArenaAlloc(struct BufferArena* Arena, size_t Size, size_t Alignment)
+// take Size bytes, zeroed, aligned to Alignment (a power of 2; 0 for a cache line).
+// thread safe. return NULL if the arena can't grow
+//
+void* ArenaAlloc(struct BufferArena* Arena, size_t Size, size_t Alignment);
+
+
+//
+// ArenaRingBuffer(struct BufferArena* Arena, struct SPSCRingBuffer* Ring, uint32_t Size)
+// make a ring buffer of at least Size bytes from the arena. Size is rounded up to a
+// power of 2 arena pages, so with huge pages each ring is at least one huge page.
+// FreeRingBuffer() removes the ring's mirrored mapping; the memory stays in the arena.
+// return true if error
+//
+bool ArenaRingBuffer(struct BufferArena* Arena, struct SPSCRingBuffer* Ring, uint32_t Size);
+
+
+//
+// FreeBufferArena(struct BufferArena* Arena)
+// release all the memory given out. Rings from the arena must be freed first.
+//
+void FreeBufferArena(struct BufferArena* Arena);
+
+
+#endif
@@ -0,0 +1,288 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// channelizer.c:
+// polyphase FFT filter bank: split one wide I/Q stream into narrow channels
+//
+// output k of the bank at block m is the input mixed down by k/N cycles per
+// sample, low pass filtered by the prototype h[] and taken every N/2 samples:
+//   y[k] = sum(n) h[n] x[t-n] exp(-j2.pi.k(t-n)/N)
+// the terms of the sum with the same n mod N fold into N branches u[r], and
+// exp(-j2.pi.k.t/N) is (-1)^(k.m) because t moves on N/2 per block, so
+//   y[k] = (-1)^(k.m) * sum(r) u[r] exp(+j2.pi.k.r/N)
+// which is an inverse FFT of the branches. The delay line is kept newest
+// first, so each branch is a run of multiplies of contiguous data.
+// With USENEON defined (make USENEON=1) on an ARM target, the branches
+// are folded 4 at a time; the FFT (fft.c) uses NEON for its butterflies.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../common/channelizer.h"
+
+#if defined(USENEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VCHANNELIZERNEON 1
+#endif
+
+#define VMAXSAMPLE24 8388607.0F                 // 24 bit full scale
+
+
+//
+// prototype low pass filter: Blackman windowed sinc, -6dB at 0.75 channel spacings
+// so the passband reaches the half way point to each neighbour, and the stopband
+// begins before the output sample rate would alias into it. Gain 1 at DC.
+//
+static void DesignPrototype(float* Coeffs, uint32_t TapCount, uint32_t Channels)
+{
+    double Cutoff = 0.75 / Channels;                            // cycles per sample
+    double Centre = (TapCount - 1) / 2.0;
+    double X, Window, Sum = 0.0;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < TapCount; Cntr++)
+    {
+        X = Cntr - Centre;
+        Window = 0.42 - 0.5 * cos(2.0 * M_PI * Cntr / (TapCount - 1))
+                      + 0.08 * cos(4.0 * M_PI * Cntr / (TapCount - 1));
+        if (X == 0.0)
+            Coeffs[Cntr] = 2.0 * Cutoff * Window;
+        else
+            Coeffs[Cntr] = sin(2.0 * M_PI * Cutoff * X) / (M_PI * X) * Window;
+        Sum += Coeffs[Cntr];
+    }
+    for (Cntr = 0; Cntr < TapCount; Cntr++)
+        Coeffs[Cntr] /= Sum;
+}
+
+
+//
+// create the filter bank
+//
+bool CreateChannelizer(struct PFBChannelizer* Channelizer, uint32_t Channels)
+{
+    uint32_t TapCount;
+    float* Floats;
+
+    memset(Channelizer, 0, sizeof(struct PFBChannelizer));
+    if ((Channels < 4) || (Channels > VMAXCHANNELS) || (Channels & (Channels - 1)))
+        return true;
+    if (CreateFFT(&Channelizer->FFT, Channels, true))
+        return true;
+    TapCount = Channels * VCHANNELIZERTAPS;
+    //
+    // coefficients, 2 delay lines of twice the filter length, and the FFT data
+    //
+    Channelizer->Memory = calloc(1, (TapCount * 5 + Channels * 2) * sizeof(float));
+    if (Channelizer->Memory == NULL)
+    {
+        FreeFFT(&Channelizer->FFT);
+        return true;
+    }
+    Floats = (float*)Channelizer->Memory;
+    Channelizer->Channels = Channels;
+    Channelizer->Decimation = Channels / 2;
+    Channelizer->TapCount = TapCount;
+    Channelizer->Coeffs = Floats;
+    Channelizer->DelayI = Floats + TapCount;
+    Channelizer->DelayQ = Floats + TapCount * 3;
+    Channelizer->FFTI = Floats + TapCount * 5;
+    Channelizer->FFTQ = Channelizer->FFTI + Channels;
+    DesignPrototype(Channelizer->Coeffs, TapCount, Channels);
+    ResetChannelizer(Channelizer);
+    return false;
+}
+
+
+//
+// clear the delay line and the part block
+//
+void ResetChannelizer(struct PFBChannelizer* Channelizer)
+{
+    memset(Channelizer->DelayI, 0, Channelizer->TapCount * 2 * sizeof(float));
+    memset(Channelizer->DelayQ, 0, Channelizer->TapCount * 2 * sizeof(float));
+    Channelizer->Head = Channelizer->TapCount;
+    Channelizer->Fill = 0;
+    Channelizer->Block = 0;
+}
+
+
+//
+// release the memory
+//
+void FreeChannelizer(struct PFBChannelizer* Channelizer)
+{
+    FreeFFT(&Channelizer->FFT);
+    free(Channelizer->Memory);
+    memset(Channelizer, 0, sizeof(struct PFBChannelizer));
+}
+
+
+//
+// add a sample to the front of the delay line. The line is twice the filter
+// length; when the front is reached, the newest samples are moved to the back half.
+//
+static inline void PushSample(struct PFBChannelizer* Channelizer, float I, float Q)
+{
+    if (Channelizer->Head == 0)
+    {
+        memmove(Channelizer->DelayI + Channelizer->TapCount, Channelizer->DelayI,
+                (Channelizer->TapCount - 1) * sizeof(float));
+        memmove(Channelizer->DelayQ + Channelizer->TapCount, Channelizer->DelayQ,
+                (Channelizer->TapCount - 1) * sizeof(float));
+        Channelizer->Head = Channelizer->TapCount;
+    }
+    Channelizer->Head--;
+    Channelizer->DelayI[Channelizer->Head] = I;
+    Channelizer->DelayQ[Channelizer->Head] = Q;
+}
+
+
+//
+// multiply the delay line by the filter and fold it into the branches,
+// putting them into the FFT in bit reversed order
+//
+static void FoldBranches(struct PFBChannelizer* Channelizer)
+{
+    const float* ZI = Channelizer->DelayI + Channelizer->Head;
+    const float* ZQ = Channelizer->DelayQ + Channelizer->Head;
+    const float* H = Channelizer->Coeffs;
+    uint32_t N = Channelizer->Channels;
+    uint32_t Branch, Tap;
+#ifdef VCHANNELIZERNEON
+    float32x4_t SumI, SumQ, Coeff;
+    float BranchI[4], BranchQ[4];
+    uint32_t Cntr;
+
+    for (Branch = 0; Branch < N; Branch += 4)
+    {
+        SumI = vdupq_n_f32(0.0F);
+        SumQ = vdupq_n_f32(0.0F);
+        for (Tap = Branch; Tap < Channelizer->TapCount; Tap += N)
+        {
+            Coeff = vld1q_f32(H + Tap);
+            SumI = vmlaq_f32(SumI, Coeff, vld1q_f32(ZI + Tap));
+            SumQ = vmlaq_f32(SumQ, Coeff, vld1q_f32(ZQ + Tap));
+        }
+        vst1q_f32(BranchI, SumI);
+        vst1q_f32(BranchQ, SumQ);
+        for (Cntr = 0; Cntr < 4; Cntr++)
+        {
+            Channelizer->FFTI[Channelizer->FFT.BitReverse[Branch + Cntr]] = BranchI[Cntr];
+            Channelizer->FFTQ[Channelizer->FFT.BitReverse[Branch + Cntr]] = BranchQ[Cntr];
+        }
+    }
+#else
+    float SumI, SumQ;
+
+    for (Branch = 0; Branch < N; Branch++)
+    {
+        SumI = 0.0F;
+        SumQ = 0.0F;
+        for (Tap = Branch; Tap < Channelizer->TapCount; Tap += N)
+        {
+            SumI += H[Tap] * ZI[Tap];
+            SumQ += H[Tap] * ZQ[Tap];
+        }
+        Channelizer->FFTI[Channelizer->FFT.BitReverse[Branch]] = SumI;
+        Channelizer->FFTQ[Channelizer->FFT.BitReverse[Branch]] = SumQ;
+    }
+#endif
+}
+
+
+//
+// 24 bit big endian sample conversion
+//
+static inline float ReadSample24(const uint8_t* Src)
+{
+    return (float)((int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8);
+}
+
+
+static inline void WriteSample24(uint8_t* Dest, float Value)
+{
+    int32_t Sample;
+
+    if (Value > VMAXSAMPLE24)
+        Value = VMAXSAMPLE24;
+    else if (Value < -VMAXSAMPLE24)
+        Value = -VMAXSAMPLE24;
+    Sample = (int32_t)(Value + ((Value >= 0.0F) ? 0.5F : -0.5F));
+    Dest[0] = (uint8_t)(Sample >> 16);
+    Dest[1] = (uint8_t)(Sample >> 8);
+    Dest[2] = (uint8_t)Sample;
+}
+
+
+//
+// write one output sample for each channel that has a destination
+// channel c is FFT bin (c + N/2) mod N
+//
+static void WriteOutputs(struct PFBChannelizer* Channelizer, uint8_t** Dest)
+{
+    uint32_t N = Channelizer->Channels;
+    uint32_t Channel, Bin;
+    float Sign;
+
+    for (Channel = 0; Channel < N; Channel++)
+    {
+        if (Dest[Channel] == NULL)
+            continue;
+        Bin = (Channel + N / 2) & (N - 1);
+        Sign = (Bin & Channelizer->Block & 1) ? -1.0F : 1.0F;
+        WriteSample24(Dest[Channel], Sign * Channelizer->FFTI[Bin]);
+        WriteSample24(Dest[Channel] + 3, Sign * Channelizer->FFTQ[Bin]);
+        Dest[Channel] += 6;
+    }
+}
+
+
+//
+// filter a run of samples
+//
+uint32_t RunChannelizer(struct PFBChannelizer* Channelizer, const uint8_t* Src, uint32_t SampleCount,
+                        uint8_t** Dest, uint32_t* Outputs)
+{
+    uint32_t MaxOutputs = *Outputs;
+    uint32_t Used = 0;
+
+    *Outputs = 0;
+    while ((Used < SampleCount) && (*Outputs < MaxOutputs))
+    {
+        PushSample(Channelizer, ReadSample24(Src), ReadSample24(Src + 3));
+        Src += 6;
+        Used++;
+        if (++Channelizer->Fill == Channelizer->Decimation)
+        {
+            Channelizer->Fill = 0;
+            FoldBranches(Channelizer);
+            RunFFT(&Channelizer->FFT, Channelizer->FFTI, Channelizer->FFTQ);
+            WriteOutputs(Channelizer, Dest);
+            Channelizer->Block++;
+            (*Outputs)++;
+        }
+    }
+    return Used;
+}
+
+
+//
+// say which code is in use
+//
+const char* GetChannelizerName(void)
+{
+#ifdef VCHANNELIZERNEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
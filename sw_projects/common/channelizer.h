@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// channelizer.h:
+// polyphase FFT filter bank: split one wide I/Q stream into narrow channels
+//
+// the filter bank is 2x oversampled: N channels spaced Fs/N apart, each
+// output at 2Fs/N, so neighbouring channels overlap by half and a signal
+// anywhere in the band is well inside one of them. A DDC at 768KHz gives
+// 32 channels at 48KHz, 24KHz apart; at 1536KHz, 64 channels.
+// every N/2 input samples, the delay line is multiplied by the prototype
+// low pass filter and folded into N branches, and an N point FFT of the
+// branches gives one output sample for every channel.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __channelizer_h
+#define __channelizer_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/fft.h"
+
+
+#define VMAXCHANNELS 128                        // channels from one filter bank (power of 2)
+#define VCHANNELIZERTAPS 12                     // prototype filter taps per polyphase branch
+
+
+struct PFBChannelizer
+{
+    uint32_t Channels;                          // N; FFT size
+    uint32_t Decimation;                        // N/2 input samples per output sample
+    uint32_t TapCount;                          // prototype filter length, N * VCHANNELIZERTAPS
+    float* Coeffs;                              // prototype filter
+    float* DelayI;                              // input samples, newest first from Head
+    float* DelayQ;
+    uint32_t Head;
+    uint32_t Fill;                              // input samples in the current block
+    uint32_t Block;                             // output blocks made; sets the sign of odd channels
+    struct SplitFFT FFT;                        // N point inverse FFT
+    float* FFTI;                                // FFT work area
+    float* FFTQ;
+    void* Memory;                               // one allocation for the filter and delay line
+};
+
+
+//
+// CreateChannelizer(struct PFBChannelizer* Channelizer, uint32_t Channels)
+// make a filter bank of Channels channels (a power of 2, 4...VMAXCHANNELS)
+// return true if error
+//
+bool CreateChannelizer(struct PFBChannelizer* Channelizer, uint32_t Channels);
+
+
+//
+// RunChannelizer(struct PFBChannelizer* Channelizer, const uint8_t* Src, uint32_t SampleCount,
+//                uint8_t** Dest, uint32_t* Outputs)
+// filter up to SampleCount 48 bit I/Q samples (24 bit I then Q, big endian, as
+// DemuxDDCSamples() writes them), stopping once *Outputs output samples have been made.
+// Dest[c] is where channel c's output goes, in the same format; channel c is centred
+// (c - N/2) * Fs/N from the input centre frequency, so channel N/2 is the centre.
+// each Dest pointer is moved on past the samples written; NULL channels are not made.
+// sets *Outputs to the samples written per channel, and returns the input samples used.
+// a part block of input is kept for next time.
+//
+uint32_t RunChannelizer(struct PFBChannelizer* Channelizer, const uint8_t* Src, uint32_t SampleCount,
+                        uint8_t** Dest, uint32_t* Outputs);
+
+
+//
+// ResetChannelizer(struct PFBChannelizer* Channelizer)
+// clear the delay line, eg after a gap in the input
+//
+void ResetChannelizer(struct PFBChannelizer* Channelizer);
+
+
+//
+// FreeChannelizer(struct PFBChannelizer* Channelizer)
+// release the filter bank's memory
+//
+void FreeChannelizer(struct PFBChannelizer* Channelizer);
+
+
+//
+// GetChannelizerName(void)
+// return a string saying which kernels the filter bank uses
+//
+const char* GetChannelizerName(void);
+
+
+#endif
@@ -18,6 +18,7 @@
 #include "../common/hwaccess.h"
 #include "../common/saturnregisters.h"
 #include "stdio.h"
+#include <stdbool.h>
 #include <semaphore.h>
 
 //
@@ -25,19 +26,104 @@
 //
 sem_t CodecRegMutex;
 
+
+#define VCODECNUMREGS 16                            // codec registers 0-15
+#define VCODECRESETADDR 15                          // writing this resets every register
+
+
+//
+// shadow of the codec registers: the value last sent to each, if known.
+// a batch is staged per thread, in the order the writes were asked for.
+//
+static uint32_t CodecShadow[VCODECNUMREGS];         // protected by CodecRegMutex
+static uint32_t CodecShadowKnown;                   // 1 bit per register: shadow is valid
+
+static __thread bool InCodecBatch;
+static __thread uint32_t CodecBatchCount;
+static __thread uint32_t CodecBatchAddress[VCODECNUMREGS];
+static __thread uint32_t CodecBatchData[VCODECNUMREGS];
+
+
+//
+// send one write to the SPI writer IP, unless the codec already holds the value
+// call with CodecRegMutex held. Returns true if written
+//
+static bool CodecSendWrite(uint32_t Address, uint32_t Data)
+{
+	uint32_t WriteData;
+
+	Data &= 0x01FFUL;
+	if ((Address < VCODECNUMREGS) && (Address != VCODECRESETADDR)
+	    && (CodecShadowKnown & (1 << Address)) && (CodecShadow[Address] == Data))
+		return false;
+	WriteData = (Address << 9) | Data;
+//	printf("writing data %04x to codec register %04x\n", Data, Address);
+	RegisterWrite(VADDRCODECSPIREG, WriteData);  	// and write to it
+	if (Address == VCODECRESETADDR)
+		CodecShadowKnown = 0;                       // every register back to its default
+	else if (Address < VCODECNUMREGS)
+	{
+		CodecShadow[Address] = Data;
+		CodecShadowKnown |= (1 << Address);
+	}
+	return true;
+}
+
+
 //
 // 8 bit Codec register write over the AXILite bus via SPI
 // // using simple SPI writer IP
 // given 7 bit register address and 9 bit data
+// not sent if the codec already has that value; staged if a batch is open
 //
 void CodecRegisterWrite(uint32_t Address, uint32_t Data)
 {
-	uint32_t WriteData;
+	uint32_t Cntr;
 
-	WriteData = (Address << 9) | (Data & 0x01FFUL);
+	if (InCodecBatch && (Address < VCODECNUMREGS) && (Address != VCODECRESETADDR))
+	{
+		for (Cntr = 0; Cntr < CodecBatchCount; Cntr++)
+			if (CodecBatchAddress[Cntr] == Address)
+				break;
+		CodecBatchAddress[Cntr] = Address;          // a repeated register keeps its place
+		CodecBatchData[Cntr] = Data;
+		if (Cntr == CodecBatchCount)
+			CodecBatchCount++;
+		return;
+	}
     sem_wait(&CodecRegMutex);                       // get protected access
-//	printf("writing data %04x to codec register %04x\n", Data, Address);
-	RegisterWrite(VADDRCODECSPIREG, WriteData);  	// and write to it
+	CodecSendWrite(Address, Data);
     sem_post(&CodecRegMutex);                       // clear protected access
 }
 
+
+//
+// start staging this thread's codec writes
+//
+void CodecBeginBatch(void)
+{
+	InCodecBatch = true;
+	CodecBatchCount = 0;
+}
+
+
+//
+// send the staged writes in one burst, in the order they were made
+// the SPI writer IP holds off each AXI write until the previous shift has finished
+//
+unsigned int CodecCommitBatch(void)
+{
+	unsigned int Count = 0;
+	uint32_t Cntr;
+
+	InCodecBatch = false;
+	if (CodecBatchCount == 0)
+		return 0;
+    sem_wait(&CodecRegMutex);                       // get protected access
+	for (Cntr = 0; Cntr < CodecBatchCount; Cntr++)
+		if (CodecSendWrite(CodecBatchAddress[Cntr], CodecBatchData[Cntr]))
+			Count++;
+    sem_post(&CodecRegMutex);                       // clear protected access
+	CodecBatchCount = 0;
+	return Count;
+}
@@ -21,8 +21,22 @@
 // 8 bit Codec register write over the AXILite bus via SPI
 // // using simple SPI writer IP
 // given 7 bit register address and 9 bit data
+// a shadow of each register is kept: a write of the value it already holds is not sent.
+// writing the reset register (15) resets the shadow too.
 //
 void CodecRegisterWrite(uint32_t Address, uint32_t Data);
 
 
+//
+// CodecBeginBatch(void)
+// CodecCommitBatch(void)
+// between these calls this thread's codec writes are staged; the commit sends the
+// changed ones in one burst, in the order they were made, a register written
+// twice once. Commit returns the number of writes sent.
+// the reset register is never staged: it is written at once.
+//
+void CodecBeginBatch(void);
+unsigned int CodecCommitBatch(void);
+
+
 #endif
\ No newline at end of file
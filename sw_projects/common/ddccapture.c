@@ -0,0 +1,327 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddccapture.c:
+// record raw DDC DMA data to a file, and read it back for replay
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../common/ddccapture.h"
+
+
+#define VDDCCAPTUREHEADERSIZE 4096                  // file header area; segments follow
+#define VMAXREPLAYGAP 100000000ULL                  // ns: longer gaps between records (SDR stopped) are shortened to this
+
+//
+// capture file state. Only the DDC DMA reader thread writes records.
+//
+static int CaptureFd = -1;
+static struct DDCCaptureRing Capture;               // the file mapping
+
+
+
+//
+// address of a segment's header in a capture file mapping
+//
+static struct DDCCaptureSegmentHeader* CaptureSegmentHeader(uint8_t* Base, uint32_t Segment)
+{
+    return (struct DDCCaptureSegmentHeader*)(Base + VDDCCAPTUREHEADERSIZE + (size_t)Segment * VDDCCAPTURESEGMENTSIZE);
+}
+
+
+//
+// start writing the next segment of the ring, overwriting the oldest when full.
+// the sequence number is written last so a part written header is never valid.
+//
+static void StartCaptureSegment(struct DDCCaptureRing* Ring)
+{
+    Ring->Sequence++;
+    Ring->Segment = CaptureSegmentHeader(Ring->Base, (uint32_t)((Ring->Sequence - 1) % Ring->Segments));
+    Ring->Segment->Sequence = 0;
+    Ring->Segment->Used = 0;
+    Ring->Segment->Records = 0;
+    Ring->Segment->Sequence = Ring->Sequence;
+}
+
+
+//
+// bytes for a capture ring of a number of segments
+//
+size_t GetDDCCaptureSize(uint32_t Segments)
+{
+    return VDDCCAPTUREHEADERSIZE + (size_t)Segments * VDDCCAPTURESEGMENTSIZE;
+}
+
+
+//
+// write the file header and mark every segment unwritten
+//
+void InitDDCCaptureRing(struct DDCCaptureRing* Ring, uint8_t* Base, uint32_t Segments)
+{
+    struct DDCCaptureFileHeader* Header;
+    uint32_t Cntr;
+
+    Ring->Base = Base;
+    Ring->Size = GetDDCCaptureSize(Segments);
+    Ring->Segments = Segments;
+    Ring->Sequence = 0;
+    Header = (struct DDCCaptureFileHeader*)Base;
+    Header->Magic = VDDCCAPTUREMAGIC;
+    Header->Version = VDDCCAPTUREVERSION;
+    Header->SegmentSize = VDDCCAPTURESEGMENTSIZE;
+    Header->SegmentCount = Segments;
+    for (Cntr = 0; Cntr < Segments; Cntr++)
+        CaptureSegmentHeader(Base, Cntr)->Sequence = 0;
+    StartCaptureSegment(Ring);
+}
+
+
+//
+// create the capture file, preallocate it and map it with its pages faulted in,
+// so recording doesn't page fault in the DMA reader
+//
+bool OpenDDCCapture(char* Setting)
+{
+    char Path[256];
+    char* Comma;
+    unsigned int Segments = VDEFAULTDDCCAPTURESEGMENTS;
+    size_t CaptureSize;
+    void* Map;
+
+    strncpy(Path, Setting, sizeof(Path) - 1);
+    Path[sizeof(Path) - 1] = 0;
+    Comma = strchr(Path, ',');
+    if (Comma != NULL)
+    {
+        *Comma = 0;
+        if ((sscanf(Comma + 1, "%u", &Segments) != 1) || (Segments < 2))
+        {
+            printf("error parsing DDC capture setting %s: must be path[,segments] with 2 or more segments\n", Setting);
+            return true;
+        }
+    }
+    CaptureSize = GetDDCCaptureSize(Segments);
+    CaptureFd = open(Path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (CaptureFd < 0)
+    {
+        printf("DDC capture file %s could not be created\n", Path);
+        return true;
+    }
+    if (ftruncate(CaptureFd, (off_t)CaptureSize) != 0)
+    {
+        printf("DDC capture file %s: could not allocate %zu bytes\n", Path, CaptureSize);
+        close(CaptureFd);
+        CaptureFd = -1;
+        return true;
+    }
+    Map = mmap(NULL, CaptureSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, CaptureFd, 0);
+    if (Map == MAP_FAILED)
+    {
+        printf("DDC capture file %s could not be mapped\n", Path);
+        close(CaptureFd);
+        CaptureFd = -1;
+        return true;
+    }
+    InitDDCCaptureRing(&Capture, (uint8_t*)Map, Segments);
+    printf("recording DDC DMA data to %s: %u segments, %zu bytes\n", Path, Segments, CaptureSize);
+    return false;
+}
+
+
+//
+// true if recording
+//
+bool IsDDCCaptureOpen(void)
+{
+    return (Capture.Base != NULL);
+}
+
+
+//
+// append a DMA transfer. A transfer too big for the space left in a segment is
+// split into records with the same timestamp.
+//
+void WriteDDCCaptureRecord(struct DDCCaptureRing* Ring, uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth)
+{
+    struct DDCCaptureRecord* Record;
+    struct timespec Now;
+    uint64_t Timestamp;
+    uint32_t Space;
+    uint32_t Chunk;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    Timestamp = (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+    while (Bytes != 0)
+    {
+        Space = VDDCCAPTURESEGMENTSIZE - sizeof(struct DDCCaptureSegmentHeader) - Ring->Segment->Used;
+        if (Space < (sizeof(struct DDCCaptureRecord) + 8))
+        {
+            StartCaptureSegment(Ring);
+            continue;
+        }
+        Chunk = (Space - sizeof(struct DDCCaptureRecord)) & ~7U;
+        if (Chunk > Bytes)
+            Chunk = Bytes;
+        Record = (struct DDCCaptureRecord*)((uint8_t*)(Ring->Segment + 1) + Ring->Segment->Used);
+        Record->Timestamp = Timestamp;
+        Record->RateWord = RateWord;
+        Record->FIFODepth = FIFODepth;
+        Record->Bytes = Chunk;
+        Record->Spare = 0;
+        memcpy(Record + 1, Data, Chunk);
+        Ring->Segment->Used += sizeof(struct DDCCaptureRecord) + ((Chunk + 7) & ~7U);
+        Ring->Segment->Records++;
+        Data += Chunk;
+        Bytes -= Chunk;
+    }
+}
+
+
+void CaptureDDCData(uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth)
+{
+    if (Capture.Base != NULL)
+        WriteDDCCaptureRecord(&Capture, Data, Bytes, RateWord, FIFODepth);
+}
+
+
+//
+// stop recording
+//
+void CloseDDCCapture(void)
+{
+    if (Capture.Base == NULL)
+        return;
+    msync(Capture.Base, Capture.Size, MS_SYNC);
+    munmap(Capture.Base, Capture.Size);
+    close(CaptureFd);
+    Capture.Base = NULL;
+    CaptureFd = -1;
+    printf("DDC capture closed: %llu segments written\n", (unsigned long long)Capture.Sequence);
+}
+
+
+//
+// load a capture for replay.
+// the oldest segment is the one with the lowest sequence number; segments are then
+// read in ring order for as long as their sequence numbers follow on.
+//
+uint32_t LoadDDCCapture(char* Path, struct DDCCaptureEntry** Entries)
+{
+    int fd;
+    struct stat Stat;
+    uint8_t* Base;
+    struct DDCCaptureFileHeader* Header;
+    struct DDCCaptureSegmentHeader* Segment;
+    struct DDCCaptureRecord* Record;
+    struct DDCCaptureEntry* Entry;
+    uint32_t Oldest = 0;
+    uint64_t OldestSequence = 0;
+    uint32_t Cntr, Rec;
+    uint32_t Pass;
+    uint32_t Count = 0;
+    uint32_t Offset;
+    uint64_t PrevTimestamp = 0;
+    uint64_t Gap;
+
+    *Entries = NULL;
+    fd = open(Path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &Stat) != 0) || ((size_t)Stat.st_size < VDDCCAPTUREHEADERSIZE))
+    {
+        printf("DDC capture file %s could not be opened\n", Path);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    Base = mmap(NULL, Stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);                                                  // mapping stays valid
+    if (Base == MAP_FAILED)
+    {
+        printf("DDC capture file %s could not be mapped\n", Path);
+        return 0;
+    }
+    Header = (struct DDCCaptureFileHeader*)Base;
+    if ((Header->Magic != VDDCCAPTUREMAGIC) || (Header->Version != VDDCCAPTUREVERSION)
+        || (Header->SegmentSize != VDDCCAPTURESEGMENTSIZE)
+        || ((size_t)Stat.st_size < VDDCCAPTUREHEADERSIZE + (size_t)Header->SegmentCount * VDDCCAPTURESEGMENTSIZE))
+    {
+        printf("%s is not a DDC capture file\n", Path);
+        munmap(Base, Stat.st_size);
+        return 0;
+    }
+    for (Cntr = 0; Cntr < Header->SegmentCount; Cntr++)
+    {
+        Segment = CaptureSegmentHeader(Base, Cntr);
+        if ((Segment->Sequence != 0) && ((OldestSequence == 0) || (Segment->Sequence < OldestSequence)))
+        {
+            OldestSequence = Segment->Sequence;
+            Oldest = Cntr;
+        }
+    }
+    //
+    // pass 0 counts the records; pass 1 indexes them
+    //
+    for (Pass = 0; Pass < 2; Pass++)
+    {
+        Entry = *Entries;
+        for (Cntr = 0; Cntr < Header->SegmentCount; Cntr++)
+        {
+            Segment = CaptureSegmentHeader(Base, (Oldest + Cntr) % Header->SegmentCount);
+            if ((Segment->Sequence != OldestSequence + Cntr) || (OldestSequence == 0)
+                || (Segment->Used > (VDDCCAPTURESEGMENTSIZE - sizeof(struct DDCCaptureSegmentHeader))))
+                break;
+            Offset = 0;
+            for (Rec = 0; Rec < Segment->Records; Rec++)
+            {
+                Record = (struct DDCCaptureRecord*)((uint8_t*)(Segment + 1) + Offset);
+                if ((Offset + sizeof(struct DDCCaptureRecord) + Record->Bytes) > Segment->Used)
+                    break;
+                Offset += sizeof(struct DDCCaptureRecord) + ((Record->Bytes + 7) & ~7U);
+                if (Pass == 0)
+                {
+                    Count++;
+                    continue;
+                }
+                Gap = (Entry == *Entries) ? 0 : Record->Timestamp - PrevTimestamp;
+                if ((Record->Timestamp < PrevTimestamp) || (Gap > VMAXREPLAYGAP))
+                    Gap = VMAXREPLAYGAP;
+                PrevTimestamp = Record->Timestamp;
+                Entry->Time = (Entry == *Entries) ? 0 : (Entry - 1)->Time + Gap;
+                Entry->Data = (uint8_t*)(Record + 1);
+                Entry->Bytes = Record->Bytes;
+                Entry->RateWord = Record->RateWord;
+                Entry->FIFODepth = Record->FIFODepth;
+                Entry++;
+            }
+        }
+        if (Pass == 0)
+        {
+            if (Count == 0)
+            {
+                printf("DDC capture file %s holds no data\n", Path);
+                munmap(Base, Stat.st_size);
+                return 0;
+            }
+            *Entries = (struct DDCCaptureEntry*)malloc(Count * sizeof(struct DDCCaptureEntry));
+            if (*Entries == NULL)
+            {
+                munmap(Base, Stat.st_size);
+                return 0;
+            }
+        }
+    }
+    return Count;
+}
@@ -0,0 +1,148 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddccapture.h:
+// record raw DDC DMA data to a file, and read it back for replay
+//
+// the capture file is memory mapped and preallocated when opened: a file header,
+// then a ring of fixed size segments. Each segment holds a header then records;
+// a record is a header (timestamp, DDC rate word, FIFO depth, byte count) then
+// the raw DMA bytes, padded to a multiple of 8 bytes. When the ring is full the
+// oldest segment is overwritten, so the file holds the most recent data.
+// Writing a record is a memcpy into pages that were faulted in when the file was
+// opened; the kernel writes them back to the file in the background.
+// the same ring can be kept in memory (see struct DDCCaptureRing), and written
+// out as a capture file later.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ddccapture_h
+#define __ddccapture_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VDDCCAPTUREMAGIC 0x43444453                 // "SDDC"
+#define VDDCCAPTUREVERSION 1
+#define VDDCCAPTURESEGMENTSIZE 262144               // bytes per segment, including its header
+#define VDEFAULTDDCCAPTURESEGMENTS 256              // 64MB file
+
+
+struct DDCCaptureFileHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t SegmentSize;                           // bytes per segment
+    uint32_t SegmentCount;
+};
+
+struct DDCCaptureSegmentHeader
+{
+    uint64_t Sequence;                              // 1 for the 1st segment written; 0 = never written
+    uint32_t Used;                                  // bytes of records in the segment
+    uint32_t Records;                               // records in the segment
+};
+
+struct DDCCaptureRecord
+{
+    uint64_t Timestamp;                             // CLOCK_MONOTONIC ns when the DMA completed
+    uint32_t RateWord;                              // DDC rate word set by the client at the time
+    uint32_t FIFODepth;                             // FIFO locations occupied when last read
+    uint32_t Bytes;                                 // DMA bytes following
+    uint32_t Spare;
+};
+
+
+//
+// one record of a capture file loaded for replay
+//
+struct DDCCaptureEntry
+{
+    uint64_t Time;                                  // ns from the start of the capture
+    uint8_t* Data;                                  // raw DMA bytes
+    uint32_t Bytes;
+    uint32_t RateWord;
+    uint32_t FIFODepth;
+};
+
+
+//
+// a ring of segments being written: the file image, header first
+//
+struct DDCCaptureRing
+{
+    uint8_t* Base;                                  // NULL if not in use
+    size_t Size;                                    // bytes, from GetDDCCaptureSize()
+    uint32_t Segments;
+    uint64_t Sequence;                              // sequence number of the segment being written
+    struct DDCCaptureSegmentHeader* Segment;        // segment being written
+};
+
+
+//
+// size_t GetDDCCaptureSize(uint32_t Segments)
+// bytes in a capture file, or ring, of Segments segments
+//
+size_t GetDDCCaptureSize(uint32_t Segments);
+
+
+//
+// void InitDDCCaptureRing(struct DDCCaptureRing* Ring, uint8_t* Base, uint32_t Segments)
+// start a ring in GetDDCCaptureSize(Segments) bytes at Base, empty
+//
+void InitDDCCaptureRing(struct DDCCaptureRing* Ring, uint8_t* Base, uint32_t Segments);
+
+
+//
+// void WriteDDCCaptureRecord(struct DDCCaptureRing* Ring, uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth)
+// append one DMA transfer to a ring, overwriting the oldest segment when full
+//
+void WriteDDCCaptureRecord(struct DDCCaptureRing* Ring, uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth);
+
+
+//
+// bool OpenDDCCapture(char* Setting)
+// create the capture file and start recording. Setting is "path[,segments]".
+// return true if error
+//
+bool OpenDDCCapture(char* Setting);
+
+
+//
+// bool IsDDCCaptureOpen(void)
+// true if DDC data is being recorded
+//
+bool IsDDCCaptureOpen(void);
+
+
+//
+// void CaptureDDCData(uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth)
+// append one DMA transfer to the capture. Call from one thread only.
+//
+void CaptureDDCData(uint8_t* Data, uint32_t Bytes, uint32_t RateWord, uint32_t FIFODepth);
+
+
+//
+// void CloseDDCCapture(void)
+// stop recording, and write the file back to disc
+//
+void CloseDDCCapture(void);
+
+
+//
+// uint32_t LoadDDCCapture(char* Path, struct DDCCaptureEntry** Entries)
+// map a capture file and index its records, oldest first. The file stays mapped
+// and *Entries allocated for the rest of the program.
+// returns the number of records; 0 if error or empty
+//
+uint32_t LoadDDCCapture(char* Path, struct DDCCaptureEntry** Entries);
+
+
+#endif
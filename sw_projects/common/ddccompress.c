@@ -0,0 +1,356 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddccompress.c:
+// compressed DDC I/Q payloads, for clients on a slow (WAN) link
+//
+// the format is described in ddccompress.h. DDC samples are mostly noise
+// a few bits deep in a 24 bit word, so most of the saving comes from not
+// sending the empty top bits: the Rice parameter follows the level of
+// each block. The difference predictor helps strong, narrow signals.
+//
+//////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "../common/ddccompress.h"
+
+
+#define VMAXRICEK 24                            // largest Rice parameter
+#define VRAWBITS 25                             // bits of an escaped zigzag value
+
+
+//
+// bit stream writer and reader, most significant bit first
+//
+struct BitWriter
+{
+    uint64_t Acc;                               // bits not yet written, at the bottom
+    uint32_t Bits;                              // number of them (< 8 between calls)
+    uint8_t* Ptr;
+    uint8_t* End;
+    bool Overflow;                              // true if the output would pass End
+};
+
+
+struct BitReader
+{
+    uint64_t Acc;
+    uint32_t Bits;
+    const uint8_t* Ptr;
+    const uint8_t* End;
+    bool Underflow;                             // true if a read went past End
+};
+
+
+//
+// write Count (up to 32) bits
+//
+static inline void PutBits(struct BitWriter* Writer, uint32_t Value, uint32_t Count)
+{
+    Writer->Acc = (Writer->Acc << Count) | (Value & (uint32_t)((1ULL << Count) - 1));
+    Writer->Bits += Count;
+    while (Writer->Bits >= 8)
+    {
+        Writer->Bits -= 8;
+        if (Writer->Ptr == Writer->End)
+        {
+            Writer->Overflow = true;
+            return;
+        }
+        *Writer->Ptr++ = (uint8_t)(Writer->Acc >> Writer->Bits);
+    }
+}
+
+
+//
+// read Count (up to 32) bits; zeros once past the end
+//
+static inline uint32_t GetBits(struct BitReader* Reader, uint32_t Count)
+{
+    while (Reader->Bits < Count)
+    {
+        Reader->Acc <<= 8;
+        if (Reader->Ptr < Reader->End)
+            Reader->Acc |= *Reader->Ptr++;
+        else
+            Reader->Underflow = true;
+        Reader->Bits += 8;
+    }
+    Reader->Bits -= Count;
+    return (uint32_t)(Reader->Acc >> Reader->Bits) & (uint32_t)((1ULL << Count) - 1);
+}
+
+
+//
+// 24 bit big endian sample conversion
+//
+static inline int32_t ReadSample24(const uint8_t* Src)
+{
+    return (int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8;
+}
+
+
+static inline void WriteSample24(uint8_t* Dest, int32_t Sample)
+{
+    Dest[0] = (uint8_t)(Sample >> 16);
+    Dest[1] = (uint8_t)(Sample >> 8);
+    Dest[2] = (uint8_t)Sample;
+}
+
+
+static inline uint32_t ZigZag(int32_t Value)
+{
+    return ((uint32_t)Value << 1) ^ (uint32_t)(Value >> 31);
+}
+
+
+static inline int32_t UnZigZag(uint32_t Value)
+{
+    return (int32_t)(Value >> 1) ^ -(int32_t)(Value & 1);
+}
+
+
+//
+// bits to code a block of zigzag values with Rice parameter K
+//
+static uint32_t RiceCost(const uint32_t* Values, uint32_t Count, uint32_t K)
+{
+    uint32_t Cost = Count * (K + 1);
+    uint32_t Quotient;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Quotient = Values[Cntr] >> K;
+        Cost += (Quotient < VRICEESCAPE) ? Quotient : VRICEESCAPE + VRAWBITS - K - 1;
+    }
+    return Cost;
+}
+
+
+//
+// code one channel (I or Q: Offset 0 or 3) of a block. Previous is the last
+// sample of the channel in the packet, for the difference predictor.
+//
+static void CompressLosslessBlock(struct BitWriter* Writer, const uint8_t* Src, uint32_t Count, int32_t* Previous)
+{
+    uint32_t Values[2][VCOMPRESSBLOCK];
+    uint64_t Sum[2] = {0, 0};
+    int32_t Sample, Last = *Previous;
+    uint32_t Order, K, BestK, Cost, BestCost, Cntr;
+
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Sample = ReadSample24(Src + 6 * Cntr);
+        Values[0][Cntr] = ZigZag(Sample);
+        Values[1][Cntr] = ZigZag(Sample - Last);
+        Sum[0] += Values[0][Cntr];
+        Sum[1] += Values[1][Cntr];
+        Last = Sample;
+    }
+    *Previous = Last;
+    Order = (Sum[1] < Sum[0]) ? 1 : 0;
+    //
+    // the best k is near log2 of the mean; try the ones either side
+    //
+    K = 0;
+    while ((K < VMAXRICEK) && (((uint64_t)Count << (K + 1)) <= Sum[Order]))
+        K++;
+    BestK = K;
+    BestCost = RiceCost(Values[Order], Count, K);
+    if (K < VMAXRICEK)
+    {
+        Cost = RiceCost(Values[Order], Count, K + 1);
+        if (Cost < BestCost)
+        {
+            BestCost = Cost;
+            BestK = K + 1;
+        }
+    }
+    if ((K > 0) && (RiceCost(Values[Order], Count, K - 1) < BestCost))
+        BestK = K - 1;
+
+    PutBits(Writer, (Order << 5) | BestK, 6);
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        if ((Values[Order][Cntr] >> BestK) < VRICEESCAPE)
+        {
+            PutBits(Writer, 0xFFFFFFFEu, (Values[Order][Cntr] >> BestK) + 1);
+            if (BestK != 0)
+                PutBits(Writer, Values[Order][Cntr], BestK);
+        }
+        else
+        {
+            PutBits(Writer, 0xFFFFFFFFu, VRICEESCAPE);
+            PutBits(Writer, Values[Order][Cntr], VRAWBITS);
+        }
+    }
+}
+
+
+static bool DecompressLosslessBlock(struct BitReader* Reader, uint8_t* Dest, uint32_t Count, int32_t* Previous)
+{
+    uint32_t Header = GetBits(Reader, 6);
+    uint32_t Order = Header >> 5;
+    uint32_t K = Header & 0x1F;
+    uint32_t Quotient, Value, Cntr;
+    int32_t Sample, Last = *Previous;
+
+    if (K > VMAXRICEK)
+        return true;
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Quotient = 0;
+        while ((Quotient < VRICEESCAPE) && GetBits(Reader, 1))
+            Quotient++;
+        if (Quotient == VRICEESCAPE)
+            Value = GetBits(Reader, VRAWBITS);
+        else
+            Value = (Quotient << K) | ((K != 0) ? GetBits(Reader, K) : 0);
+        if (Reader->Underflow)
+            return true;
+        Sample = UnZigZag(Value);
+        if (Order)
+            Sample += Last;
+        Last = Sample;
+        WriteSample24(Dest + 6 * Cntr, Sample);
+    }
+    *Previous = Last;
+    return false;
+}
+
+
+//
+// code one channel of a block in block floating point
+//
+static void CompressBFPBlock(struct BitWriter* Writer, const uint8_t* Src, uint32_t Count, uint32_t MantissaBits)
+{
+    int32_t Samples[VCOMPRESSBLOCK];
+    int32_t Largest = (1 << (MantissaBits - 1)) - 1;
+    int32_t Mantissa;
+    uint32_t Magnitude = 0;
+    uint32_t SignedBits = 1;
+    uint32_t Shift = 0;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Samples[Cntr] = ReadSample24(Src + 6 * Cntr);
+        Magnitude |= (uint32_t)(Samples[Cntr] ^ (Samples[Cntr] >> 31));
+    }
+    while (Magnitude >> (SignedBits - 1))
+        SignedBits++;
+    if (SignedBits > MantissaBits)
+        Shift = SignedBits - MantissaBits;
+
+    PutBits(Writer, Shift, 5);
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Mantissa = Samples[Cntr];
+        if (Shift != 0)
+            Mantissa = (Mantissa + (1 << (Shift - 1))) >> Shift;
+        if (Mantissa > Largest)
+            Mantissa = Largest;
+        PutBits(Writer, (uint32_t)Mantissa, MantissaBits);
+    }
+}
+
+
+static bool DecompressBFPBlock(struct BitReader* Reader, uint8_t* Dest, uint32_t Count, uint32_t MantissaBits)
+{
+    uint32_t Shift = GetBits(Reader, 5);
+    int32_t Mantissa;
+    uint32_t Cntr;
+
+    if ((Shift + MantissaBits) > 24)
+        return true;
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Mantissa = (int32_t)(GetBits(Reader, MantissaBits) << (32 - MantissaBits)) >> (32 - MantissaBits);
+        WriteSample24(Dest + 6 * Cntr, (int32_t)((uint32_t)Mantissa << Shift));
+    }
+    return Reader->Underflow;
+}
+
+
+//
+// compress a packet's samples
+//
+uint32_t CompressDDCSamples(uint8_t* Dest, uint32_t MaxBytes, const uint8_t* Src, uint32_t SampleCount,
+                            uint32_t Mode, uint32_t MantissaBits)
+{
+    struct BitWriter Writer;
+    int32_t PreviousI = 0, PreviousQ = 0;
+    uint32_t Start, Count;
+
+    if ((MaxBytes < 1) || ((Mode != VDDCCOMPRESSLOSSLESS) && (Mode != VDDCCOMPRESSBFP)))
+        return 0;
+    if ((Mode == VDDCCOMPRESSBFP) && ((MantissaBits < VMINBFPBITS) || (MantissaBits > VMAXBFPBITS)))
+        return 0;
+    Dest[0] = (Mode == VDDCCOMPRESSBFP) ? (uint8_t)MantissaBits : 0;
+    memset(&Writer, 0, sizeof(Writer));
+    Writer.Ptr = Dest + 1;
+    Writer.End = Dest + MaxBytes;
+    for (Start = 0; (Start < SampleCount) && !Writer.Overflow; Start += Count)
+    {
+        Count = SampleCount - Start;
+        if (Count > VCOMPRESSBLOCK)
+            Count = VCOMPRESSBLOCK;
+        if (Mode == VDDCCOMPRESSLOSSLESS)
+        {
+            CompressLosslessBlock(&Writer, Src + 6 * Start, Count, &PreviousI);
+            CompressLosslessBlock(&Writer, Src + 6 * Start + 3, Count, &PreviousQ);
+        }
+        else
+        {
+            CompressBFPBlock(&Writer, Src + 6 * Start, Count, MantissaBits);
+            CompressBFPBlock(&Writer, Src + 6 * Start + 3, Count, MantissaBits);
+        }
+    }
+    if (Writer.Bits != 0)
+        PutBits(&Writer, 0, 8 - Writer.Bits);                       // pad the last byte
+    if (Writer.Overflow)
+        return 0;
+    return (uint32_t)(Writer.Ptr - Dest);
+}
+
+
+//
+// decompress a packet's samples
+//
+bool DecompressDDCSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SrcBytes, uint32_t SampleCount, uint32_t Mode)
+{
+    struct BitReader Reader;
+    int32_t PreviousI = 0, PreviousQ = 0;
+    uint32_t MantissaBits;
+    uint32_t Start, Count;
+    bool Error = false;
+
+    if ((SrcBytes < 1) || ((Mode != VDDCCOMPRESSLOSSLESS) && (Mode != VDDCCOMPRESSBFP)))
+        return true;
+    MantissaBits = Src[0];
+    if ((Mode == VDDCCOMPRESSBFP) && ((MantissaBits < VMINBFPBITS) || (MantissaBits > VMAXBFPBITS)))
+        return true;
+    memset(&Reader, 0, sizeof(Reader));
+    Reader.Ptr = Src + 1;
+    Reader.End = Src + SrcBytes;
+    for (Start = 0; (Start < SampleCount) && !Error; Start += Count)
+    {
+        Count = SampleCount - Start;
+        if (Count > VCOMPRESSBLOCK)
+            Count = VCOMPRESSBLOCK;
+        if (Mode == VDDCCOMPRESSLOSSLESS)
+            Error = DecompressLosslessBlock(&Reader, Dest + 6 * Start, Count, &PreviousI)
+                 || DecompressLosslessBlock(&Reader, Dest + 6 * Start + 3, Count, &PreviousQ);
+        else
+            Error = DecompressBFPBlock(&Reader, Dest + 6 * Start, Count, MantissaBits)
+                 || DecompressBFPBlock(&Reader, Dest + 6 * Start + 3, Count, MantissaBits);
+    }
+    return Error;
+}
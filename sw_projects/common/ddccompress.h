@@ -0,0 +1,71 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddccompress.h:
+// compressed DDC I/Q payloads, for clients on a slow (WAN) link
+//
+// a compressed DDC packet has the usual 16 byte header (sequence, timestamp,
+// bits per sample, samples) but its bits per sample field is
+// VDDCCOMPRESSEDBITS(mode), and the payload after it is:
+//   byte 0: the mode's parameter (BFP: mantissa bits; lossless: 0)
+//   then a bit stream, most significant bit first, padded to a byte.
+// the samples are coded in blocks of VCOMPRESSBLOCK, I then Q for each block:
+// lossless: 1 bit predictor (0 = the sample, 1 = its difference from the
+//   previous sample), 5 bits Rice parameter k, then each residual zigzag
+//   coded (0,-1,1,-2...) as u>>k in unary (ones ended by a zero) then the
+//   low k bits. u>>k of VRICEESCAPE or more is sent as VRICEESCAPE ones then
+//   u in 25 bits.
+// BFP (block floating point, lossy): 5 bits shift e, then each sample >> e
+//   rounded, in the mantissa bits as two's complement.
+// each packet is coded on its own, so a lost packet loses only its samples.
+// the use of compression is set up out of band (setting ddc_compress); a
+// client that knows nothing of it gets no compressed packets unless asked.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ddccompress_h
+#define __ddccompress_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VDDCCOMPRESSNONE 0                      // compression modes
+#define VDDCCOMPRESSLOSSLESS 1
+#define VDDCCOMPRESSBFP 2
+#define VDDCCOMPRESSMODES 3
+
+#define VDDCCOMPRESSEDBITS(Mode) (0x8000 | (Mode))  // bits per sample field of a compressed packet
+#define VCOMPRESSBLOCK 14                       // samples per block; 17 blocks in a 238 sample packet
+#define VRICEESCAPE 20                          // unary length that escapes to a raw value
+#define VMINBFPBITS 6                           // BFP mantissa bits allowed
+#define VMAXBFPBITS 16
+
+
+//
+// CompressDDCSamples(uint8_t* Dest, uint32_t MaxBytes, const uint8_t* Src, uint32_t SampleCount,
+//                    uint32_t Mode, uint32_t MantissaBits)
+// code SampleCount 48 bit I/Q samples (24 bit I then Q, big endian) in Mode.
+// MantissaBits is used by BFP only.
+// returns the payload bytes written, or 0 if the payload would be more than
+// MaxBytes: then the packet should be sent uncompressed.
+//
+uint32_t CompressDDCSamples(uint8_t* Dest, uint32_t MaxBytes, const uint8_t* Src, uint32_t SampleCount,
+                            uint32_t Mode, uint32_t MantissaBits);
+
+
+//
+// DecompressDDCSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SrcBytes, uint32_t SampleCount, uint32_t Mode)
+// decode a payload of SrcBytes back to SampleCount 48 bit I/Q samples at Dest.
+// return true if error (unknown mode or the payload is too short)
+//
+bool DecompressDDCSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SrcBytes, uint32_t SampleCount, uint32_t Mode);
+
+
+#endif
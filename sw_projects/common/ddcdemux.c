@@ -0,0 +1,386 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcdemux.c:
+// DDC frame demultiplex: unpack 64 bit FPGA words to 48 bit I/Q samples
+//
+// the FPGA writes one I/Q sample per 64 bit word: 3 16 bit words of sample
+// data then 16 bits of padding. The P2 packet needs them packed at 6 bytes
+// per sample. With USENEON defined (make USENEON=1) on an ARM target, 8
+// words at a time are de-interleaved into 4 vectors of 16 bit lanes by vld4
+// and the 3 data vectors stored back interleaved by vst3, dropping the pad.
+// for DDCs the client asks to be sent 16 bit samples, PackDDCSamples16()
+// packs those again to 4 bytes per sample.
+// an interleaved pair (rate code 7) can be split to its 2 DDCs as it is
+// demuxed: with NEON, 16 words are loaded by 2 vld4, and vuzp takes the
+// even (1st DDC) or odd (2nd DDC) words' lanes of both before the vst3.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/ddcdemux.h"
+
+#if defined(USENEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VDEMUXNEON 1
+#endif
+
+
+
+//
+// scalar copy: move 48 bits of sample data and skip 16 bits where there's no data
+// Src must be 16 bit aligned; Dest is always advanced by 6 bytes so stays 16 bit aligned
+//
+void DemuxDDCSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount)
+{
+    const uint16_t* SrcWordPtr = (const uint16_t*)Src;
+    uint16_t* DestWordPtr = (uint16_t*)Dest;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < WordCount; Cntr++)                    // count 64 bit words
+    {
+        *DestWordPtr++ = *SrcWordPtr++;                         // move 48 bits of sample data
+        *DestWordPtr++ = *SrcWordPtr++;
+        *DestWordPtr++ = *SrcWordPtr++;
+        SrcWordPtr++;                                           // and skip 16 bits where theres no data
+    }
+}
+
+
+//
+// demux using NEON if available, else the scalar code
+// NEON handles 8 words (64 bytes in, 48 bytes out) per iteration; any tail is done scalar.
+// always inlined, so a constant WordCount gives a straight line copy
+//
+static inline __attribute__((always_inline)) void DemuxWords(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount)
+{
+#ifdef VDEMUXNEON
+    uint16x8x4_t InWords;
+    uint16x8x3_t OutWords;
+
+    while (WordCount >= 8)
+    {
+        InWords = vld4q_u16((const uint16_t*)Src);             // lane n of val[k] = 16 bit word k of sample n
+        OutWords.val[0] = InWords.val[0];
+        OutWords.val[1] = InWords.val[1];
+        OutWords.val[2] = InWords.val[2];                       // val[3] is the pad word: dropped
+        vst3q_u16((uint16_t*)Dest, OutWords);
+        Src += 64;
+        Dest += 48;
+        WordCount -= 8;
+    }
+#endif
+    DemuxDDCSamplesScalar(Dest, Src, WordCount);
+}
+
+
+void DemuxDDCSamples(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount)
+{
+    DemuxWords(Dest, Src, WordCount);
+}
+
+
+//
+// demux a DDC's samples from consecutive frames, general and specialised versions
+//
+void DemuxDDCFrames(uint8_t* Dest, const uint8_t* Src, uint32_t FrameBytes, uint32_t Frames, uint32_t WordCount)
+{
+    uint32_t Frame;
+
+    for (Frame = 0; Frame < Frames; Frame++)
+    {
+        DemuxWords(Dest, Src, WordCount);
+        Dest += 6 * WordCount;
+        Src += FrameBytes;
+    }
+}
+
+
+#define DEMUXFRAMES(Words)                                                                          \
+static void DemuxDDCFrames##Words(uint8_t* Dest, const uint8_t* Src, uint32_t FrameBytes,           \
+                                  uint32_t Frames, uint32_t WordCount)                              \
+{                                                                                                   \
+    uint32_t Frame;                                                                                 \
+                                                                                                    \
+    (void)WordCount;                                                                                \
+    for (Frame = 0; Frame < Frames; Frame++)                                                        \
+    {                                                                                               \
+        DemuxWords(Dest, Src, Words);                                                               \
+        Dest += 6 * (Words);                                                                        \
+        Src += FrameBytes;                                                                          \
+    }                                                                                               \
+}
+
+DEMUXFRAMES(1)
+DEMUXFRAMES(2)
+DEMUXFRAMES(4)
+DEMUXFRAMES(8)
+DEMUXFRAMES(16)
+DEMUXFRAMES(32)
+DEMUXFRAMES(64)
+
+
+//
+// scalar copy of one DDC of an interleaved pair: every other word, from the 1st (Odd false) or 2nd
+//
+void DemuxDDCPairSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount, bool Odd)
+{
+    const uint16_t* SrcWordPtr = (const uint16_t*)Src + (Odd ? 4 : 0);
+    uint16_t* DestWordPtr = (uint16_t*)Dest;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < WordCount; Cntr++)                    // count this DDC's 64 bit words
+    {
+        *DestWordPtr++ = SrcWordPtr[0];                         // move 48 bits of sample data
+        *DestWordPtr++ = SrcWordPtr[1];
+        *DestWordPtr++ = SrcWordPtr[2];
+        SrcWordPtr += 8;                                        // skip the pad and the other DDC's word
+    }
+}
+
+
+//
+// split one DDC of a pair using NEON if available: 8 of its words (128 bytes in, 48 out) per iteration.
+// lane n of the 1st vld4's val[k] is 16 bit word k of pair word n, and of the 2nd's, of pair word 8 + n;
+// vuzp's val[0] has the even pair words' lanes, val[1] the odd's.
+// never reads past the pair's last word, so the 2nd DDC needs no guard space
+//
+static inline __attribute__((always_inline)) void DemuxPairWords(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount, bool Odd)
+{
+#ifdef VDEMUXNEON
+    uint16x8x4_t FirstWords, SecondWords;
+    uint16x8x3_t OutWords;
+    uint32_t Lane = Odd ? 1 : 0;
+
+    while (WordCount >= 8)
+    {
+        FirstWords = vld4q_u16((const uint16_t*)Src);
+        SecondWords = vld4q_u16((const uint16_t*)(Src + 64));
+        OutWords.val[0] = vuzpq_u16(FirstWords.val[0], SecondWords.val[0]).val[Lane];
+        OutWords.val[1] = vuzpq_u16(FirstWords.val[1], SecondWords.val[1]).val[Lane];
+        OutWords.val[2] = vuzpq_u16(FirstWords.val[2], SecondWords.val[2]).val[Lane];
+        vst3q_u16((uint16_t*)Dest, OutWords);
+        Src += 128;
+        Dest += 48;
+        WordCount -= 8;
+    }
+#endif
+    DemuxDDCPairSamplesScalar(Dest, Src, WordCount, Odd);
+}
+
+
+void DemuxDDCPairSamples(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount, bool Odd)
+{
+    DemuxPairWords(Dest, Src, WordCount, Odd);
+}
+
+
+//
+// demux one DDC of a pair from consecutive frames; WordCount is that DDC's words per frame
+//
+#define DEMUXPAIRFRAMES(Name, Words, Odd)                                                           \
+static void DemuxDDCPair##Name(uint8_t* Dest, const uint8_t* Src, uint32_t FrameBytes,              \
+                               uint32_t Frames, uint32_t WordCount)                                 \
+{                                                                                                   \
+    uint32_t Frame;                                                                                 \
+                                                                                                    \
+    for (Frame = 0; Frame < Frames; Frame++)                                                        \
+    {                                                                                               \
+        DemuxPairWords(Dest, Src, (Words) ? (Words) : WordCount, Odd);                              \
+        Dest += 6 * ((Words) ? (Words) : WordCount);                                                \
+        Src += FrameBytes;                                                                          \
+    }                                                                                               \
+}
+
+DEMUXPAIRFRAMES(Even, 0, false)
+DEMUXPAIRFRAMES(Odd, 0, true)
+DEMUXPAIRFRAMES(Even1, 1, false)
+DEMUXPAIRFRAMES(Odd1, 1, true)
+DEMUXPAIRFRAMES(Even2, 2, false)
+DEMUXPAIRFRAMES(Odd2, 2, true)
+DEMUXPAIRFRAMES(Even4, 4, false)
+DEMUXPAIRFRAMES(Odd4, 4, true)
+DEMUXPAIRFRAMES(Even8, 8, false)
+DEMUXPAIRFRAMES(Odd8, 8, true)
+DEMUXPAIRFRAMES(Even16, 16, false)
+DEMUXPAIRFRAMES(Odd16, 16, true)
+DEMUXPAIRFRAMES(Even32, 32, false)
+DEMUXPAIRFRAMES(Odd32, 32, true)
+
+
+DDCFrameDemux SelectDDCPairDemux(uint32_t WordCount, bool Odd)
+{
+    switch (WordCount)
+    {
+        case 1:  return Odd ? DemuxDDCPairOdd1 : DemuxDDCPairEven1;             // 48KHz pair
+        case 2:  return Odd ? DemuxDDCPairOdd2 : DemuxDDCPairEven2;
+        case 4:  return Odd ? DemuxDDCPairOdd4 : DemuxDDCPairEven4;
+        case 8:  return Odd ? DemuxDDCPairOdd8 : DemuxDDCPairEven8;
+        case 16: return Odd ? DemuxDDCPairOdd16 : DemuxDDCPairEven16;
+        case 32: return Odd ? DemuxDDCPairOdd32 : DemuxDDCPairEven32;           // 1536KHz pair
+        default: return Odd ? DemuxDDCPairOdd : DemuxDDCPairEven;
+    }
+}
+
+
+DDCFrameDemux SelectDDCFrameDemux(uint32_t WordCount)
+{
+    switch (WordCount)
+    {
+        case 1:  return DemuxDDCFrames1;                        // 48KHz
+        case 2:  return DemuxDDCFrames2;
+        case 4:  return DemuxDDCFrames4;
+        case 8:  return DemuxDDCFrames8;
+        case 16: return DemuxDDCFrames16;
+        case 32: return DemuxDDCFrames32;                       // 1536KHz
+        case 64: return DemuxDDCFrames64;                       // interleaved pair at 1536KHz
+        default: return DemuxDDCFrames;
+    }
+}
+
+
+//
+// scalar 16 bit pack: keep the top 2 bytes of I and of Q (the samples are truncated)
+//
+void PackDDCSamples16Scalar(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+{
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < SampleCount; Cntr++)
+    {
+        Dest[0] = Src[0];                                       // I bits 23:8
+        Dest[1] = Src[1];
+        Dest[2] = Src[3];                                       // Q bits 23:8
+        Dest[3] = Src[4];
+        Src += 6;
+        Dest += 4;
+    }
+}
+
+
+//
+// 16 bit pack using NEON if available: 8 samples (48 bytes in, 32 out) per iteration.
+// vld3 splits each sample into 16 bit lanes {I2 I1}, {I0 Q2}, {Q1 Q0} (little endian lanes,
+// so the 1st byte in memory is the low byte); Q's top bytes are put together with a shift
+// and or of the 2nd and 3rd lanes, and vst2 stores {I2 I1} {Q2 Q1} interleaved.
+//
+void PackDDCSamples16(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+{
+#ifdef VDEMUXNEON
+    uint16x8x3_t InWords;
+    uint16x8x2_t OutWords;
+
+    while (SampleCount >= 8)
+    {
+        InWords = vld3q_u16((const uint16_t*)Src);
+        OutWords.val[0] = InWords.val[0];
+        OutWords.val[1] = vorrq_u16(vshrq_n_u16(InWords.val[1], 8), vshlq_n_u16(InWords.val[2], 8));
+        vst2q_u16((uint16_t*)Dest, OutWords);
+        Src += 48;
+        Dest += 32;
+        SampleCount -= 8;
+    }
+#endif
+    PackDDCSamples16Scalar(Dest, Src, SampleCount);
+}
+
+
+//
+// make the copy plan: only DDCs with samples get an entry, with the demux for their count.
+// a pair to be split gets an entry for each of its DDCs, both at the pair's offset
+//
+void BuildDDCFramePlan(struct DDCFramePlan* Plan, uint32_t RateWord, const uint32_t* DDCCounts)
+{
+    BuildDDCFramePlanSplit(Plan, RateWord, DDCCounts, 0);
+}
+
+
+void BuildDDCFramePlanSplit(struct DDCFramePlan* Plan, uint32_t RateWord, const uint32_t* DDCCounts, uint32_t SplitMask)
+{
+    uint32_t DDC;
+    uint32_t Offset = 8;                                        // 1st sample is past the rate word
+    struct DDCFramePlanEntry* Entry;
+
+    Plan->RateWord = RateWord;
+    Plan->NumEntries = 0;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        if (DDCCounts[DDC] == 0)
+            continue;
+        if ((SplitMask & (1U << DDC)) && (DDC < (VNUMDDC - 1)) && (((RateWord >> (3 * DDC)) & 7) == 7))
+        {
+            Entry = Plan->Entries + Plan->NumEntries;
+            Entry[0].DDC = DDC;
+            Entry[1].DDC = DDC + 1;
+            Entry[0].SrcOffset = Entry[1].SrcOffset = Offset;
+            Entry[0].WordCount = Entry[1].WordCount = DDCCounts[DDC] / 2;
+            Entry[0].Demux = SelectDDCPairDemux(DDCCounts[DDC] / 2, false);
+            Entry[1].Demux = SelectDDCPairDemux(DDCCounts[DDC] / 2, true);
+            Plan->NumEntries += 2;
+            Offset += 8 * DDCCounts[DDC];
+            continue;
+        }
+        Plan->Entries[Plan->NumEntries].DDC = DDC;
+        Plan->Entries[Plan->NumEntries].SrcOffset = Offset;
+        Plan->Entries[Plan->NumEntries].WordCount = DDCCounts[DDC];
+        Plan->Entries[Plan->NumEntries].Demux = SelectDDCFrameDemux(DDCCounts[DDC]);
+        Plan->NumEntries++;
+        Offset += 8 * DDCCounts[DDC];
+    }
+    Plan->FrameBytes = Offset;
+}
+
+
+//
+// find the next rate word marker
+// with NEON, vld4 on 64 bytes puts bytes 3, 7, 11 ... into val[3]: the odd lanes
+// hold the top byte of each of the 8 words, so one compare tests them all.
+//
+uint32_t FindDDCRateWord(const uint8_t* Src, uint32_t ByteCount)
+{
+    uint32_t Offset = 0;
+
+    ByteCount &= ~7U;
+#ifdef VDEMUXNEON
+    static const uint8_t OddLanes[16] = {0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF};
+    uint8x16_t LaneMask = vld1q_u8(OddLanes);
+    uint8x16_t Marker = vdupq_n_u8(0x80);
+    uint8x16x4_t Bytes;
+    uint8x16_t Match;
+    uint8x8_t Folded;
+
+    while ((Offset + 64) <= ByteCount)
+    {
+        Bytes = vld4q_u8(Src + Offset);
+        Match = vandq_u8(vceqq_u8(Bytes.val[3], Marker), LaneMask);
+        Folded = vorr_u8(vget_low_u8(Match), vget_high_u8(Match));
+        if (vget_lane_u64(vreinterpret_u64_u8(Folded), 0) != 0)
+            break;                                              // it's in these 8 words
+        Offset += 64;
+    }
+#endif
+    for (; Offset < ByteCount; Offset += 8)
+        if (Src[Offset + 7] == 0x80)
+            return Offset;
+    return ByteCount;
+}
+
+
+//
+// report which kernel is in use
+//
+const char* GetDDCDemuxName(void)
+{
+#ifdef VDEMUXNEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
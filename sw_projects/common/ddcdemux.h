@@ -0,0 +1,160 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcdemux.h:
+// DDC frame demultiplex: unpack 64 bit FPGA words to 48 bit I/Q samples
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ddcdemux_h
+#define __ddcdemux_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/saturnregisters.h"
+
+
+//
+// demux one DDC's samples from Frames consecutive DMA frames of FrameBytes each:
+// WordCount words from Src, then from Src + FrameBytes, and so on, written end to end
+// at Dest. There is a version of this for each of the sample counts the rates give
+// (1...32 words, and 64 for an interleaved pair), with the count a constant so the
+// compiler unrolls the copy; the plan picks one for each DDC when it is built.
+//
+typedef void (*DDCFrameDemux)(uint8_t* Dest, const uint8_t* Src, uint32_t FrameBytes, uint32_t Frames, uint32_t WordCount);
+
+
+//
+// copy plan for one DDC rate word: where each enabled DDC's samples sit in a DMA frame.
+// built once when the rate word changes, then run over every frame with that rate word.
+// the 2 entries of a split interleaved pair have the pair's offset: their demux takes
+// every other word, from the 1st word for the 1st DDC or the 2nd word for the 2nd.
+//
+struct DDCFramePlanEntry
+{
+    uint32_t DDC;                               // DDC whose samples these are
+    uint32_t SrcOffset;                         // bytes from the start of the frame (the rate word)
+    uint32_t WordCount;                         // 64 bit sample words per frame
+    DDCFrameDemux Demux;                        // demux for WordCount words per frame
+};
+
+struct DDCFramePlan
+{
+    uint32_t RateWord;                          // rate word the plan was built for
+    uint32_t FrameBytes;                        // bytes per frame, including the rate word
+    uint32_t NumEntries;                        // enabled DDCs
+    struct DDCFramePlanEntry Entries[VNUMDDC];
+};
+
+
+//
+// BuildDDCFramePlan(struct DDCFramePlan* Plan, uint32_t RateWord, const uint32_t* DDCCounts)
+// make the copy plan for a rate word. DDCCounts is the per DDC sample count
+// for that rate word, as found by AnalyseDDCHeader().
+//
+void BuildDDCFramePlan(struct DDCFramePlan* Plan, uint32_t RateWord, const uint32_t* DDCCounts);
+
+
+//
+// BuildDDCFramePlanSplit(struct DDCFramePlan* Plan, uint32_t RateWord, const uint32_t* DDCCounts, uint32_t SplitMask)
+// as BuildDDCFramePlan(), but each interleaved pair whose 1st DDC's bit is set in
+// SplitMask is split: its DDCs get an entry each, of half the pair's words per frame
+//
+void BuildDDCFramePlanSplit(struct DDCFramePlan* Plan, uint32_t RateWord, const uint32_t* DDCCounts, uint32_t SplitMask);
+
+
+//
+// SelectDDCPairDemux(uint32_t WordCount, bool Odd)
+// return the demux of one DDC of a split pair, specialised for WordCount words per frame
+// of that DDC (half the pair's) if there is one; Odd selects the pair's 2nd DDC
+//
+DDCFrameDemux SelectDDCPairDemux(uint32_t WordCount, bool Odd);
+
+
+//
+// SelectDDCFrameDemux(uint32_t WordCount)
+// return the demux specialised for WordCount words per frame, or the general one
+// (which takes any count) if there isn't one for it
+//
+DDCFrameDemux SelectDDCFrameDemux(uint32_t WordCount);
+
+
+//
+// DemuxDDCFrames(uint8_t* Dest, const uint8_t* Src, uint32_t FrameBytes, uint32_t Frames, uint32_t WordCount)
+// the general version: DemuxDDCSamples() on each frame
+//
+void DemuxDDCFrames(uint8_t* Dest, const uint8_t* Src, uint32_t FrameBytes, uint32_t Frames, uint32_t WordCount);
+
+
+//
+// FindDDCRateWord(const uint8_t* Src, uint32_t ByteCount)
+// find the 1st 64 bit word in Src that has the rate word marker (0x80 in its top byte).
+// returns its byte offset, or ByteCount rounded down to a whole word if there is none.
+// uses NEON to test 8 words at a time if built with USENEON=1 on an ARM target
+//
+uint32_t FindDDCRateWord(const uint8_t* Src, uint32_t ByteCount);
+
+
+//
+// DemuxDDCSamples(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount)
+// copy WordCount 64 bit FPGA words from Src to Dest.
+// each 64 bit word holds one 48 bit I/Q sample in its low 6 bytes; the top 16 bits are padding.
+// 6 bytes are written to Dest per word.
+// uses NEON if built with USENEON=1 on an ARM target, else a scalar copy
+//
+void DemuxDDCSamples(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount);
+
+
+//
+// DemuxDDCSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount)
+// the portable version; always available, so it can be benchmarked against the NEON kernel
+//
+void DemuxDDCSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount);
+
+
+//
+// DemuxDDCPairSamples(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount, bool Odd)
+// copy WordCount samples of one DDC of an interleaved pair: Src is the pair's 1st word, and
+// the DDC's samples are every other word from it (or, if Odd, from the next). 6 bytes per
+// sample are written to Dest. Uses NEON if built with USENEON=1 on an ARM target
+//
+void DemuxDDCPairSamples(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount, bool Odd);
+
+
+//
+// DemuxDDCPairSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount, bool Odd)
+// the portable version of DemuxDDCPairSamples()
+//
+void DemuxDDCPairSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t WordCount, bool Odd);
+
+
+//
+// PackDDCSamples16(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+// pack SampleCount demultiplexed 48 bit I/Q samples (24 bit I then Q, big endian, as
+// DemuxDDCSamples() writes them) to 32 bit I/Q samples by dropping the low byte of each.
+// 4 bytes are written to Dest per sample. Uses NEON if built with USENEON=1 on an ARM target.
+//
+void PackDDCSamples16(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount);
+
+
+//
+// PackDDCSamples16Scalar(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+// the portable version of PackDDCSamples16()
+//
+void PackDDCSamples16Scalar(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount);
+
+
+//
+// GetDDCDemuxName(void)
+// return a string saying which kernel DemuxDDCSamples() uses
+//
+const char* GetDDCDemuxName(void);
+
+
+#endif
@@ -0,0 +1,172 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcfec.c:
+// forward error correction for DDC streams: XOR parity over groups of packets
+//
+// the parity is made as each packet of a group is sent, so each packet is
+// read once while it is still in the cache, and the parity packet is ready
+// when the group's last packet is. With USENEON defined (make USENEON=1) on
+// an ARM target, the XOR is done 64 bytes at a time in 4 NEON registers.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "../common/ddcfec.h"
+
+#if defined(USENEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VFECNEON 1
+#endif
+
+
+
+void XorDDCFECBytes(uint8_t* Dest, const uint8_t* Src, uint32_t Bytes)
+{
+    uint64_t DestWord, SrcWord;
+
+#ifdef VFECNEON
+    uint8x16x4_t DestVec, SrcVec;
+
+    while (Bytes >= 64)
+    {
+        DestVec = vld1q_u8_x4(Dest);
+        SrcVec = vld1q_u8_x4(Src);
+        DestVec.val[0] = veorq_u8(DestVec.val[0], SrcVec.val[0]);
+        DestVec.val[1] = veorq_u8(DestVec.val[1], SrcVec.val[1]);
+        DestVec.val[2] = veorq_u8(DestVec.val[2], SrcVec.val[2]);
+        DestVec.val[3] = veorq_u8(DestVec.val[3], SrcVec.val[3]);
+        vst1q_u8_x4(Dest, DestVec);
+        Dest += 64;
+        Src += 64;
+        Bytes -= 64;
+    }
+#endif
+    while (Bytes >= 8)                                          // packets are at any byte alignment
+    {
+        memcpy(&DestWord, Dest, 8);
+        memcpy(&SrcWord, Src, 8);
+        DestWord ^= SrcWord;
+        memcpy(Dest, &DestWord, 8);
+        Dest += 8;
+        Src += 8;
+        Bytes -= 8;
+    }
+    while (Bytes--)
+        *Dest++ ^= *Src++;
+}
+
+
+void InitDDCFECGroup(struct DDCFECGroup* Group, uint32_t GroupSize)
+{
+    if (GroupSize > VMAXDDCFECGROUP)
+        GroupSize = VMAXDDCFECGROUP;
+    Group->GroupSize = GroupSize;
+    Group->Packets = 0;
+    Group->Bytes = 0;
+    Group->LengthXor = 0;
+}
+
+
+uint32_t AddDDCFECPacket(struct DDCFECGroup* Group, const struct iovec* Iovecs, uint32_t Count)
+{
+    uint32_t Sequence;
+    uint32_t Length = 0;
+    uint32_t Offset;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < Count; Cntr++)
+        Length += Iovecs[Cntr].iov_len;
+    if ((Group->GroupSize == 0) || (Length > VMAXDDCFECDATA) || (Iovecs[0].iov_len < 4))
+    {
+        Group->Packets = 0;
+        return 0;
+    }
+    memcpy(&Sequence, Iovecs[0].iov_base, 4);
+    Sequence = ntohl(Sequence);
+    if ((Group->Packets == Group->GroupSize) || ((Group->Packets != 0) && (Sequence != Group->NextSequence)))
+        Group->Packets = 0;
+    if (Group->Packets == 0)
+    {
+        //
+        // 1st packet of a group: it is copied, rather than XORed into a cleared parity
+        //
+        memset(Group->Packet, 0, VDDCFECHEADERSIZE);
+        *(uint32_t*)Group->Packet = htonl(Sequence);
+        *(uint16_t*)(Group->Packet + 12) = htons(VDDCFECBITS(Group->GroupSize));
+        Offset = VDDCFECHEADERSIZE;
+        for (Cntr = 0; Cntr < Count; Cntr++)
+        {
+            memcpy(Group->Packet + Offset, Iovecs[Cntr].iov_base, Iovecs[Cntr].iov_len);
+            Offset += Iovecs[Cntr].iov_len;
+        }
+        Group->Bytes = Length;
+        Group->LengthXor = 0;
+    }
+    else
+    {
+        if (Length > Group->Bytes)
+        {
+            memset(Group->Packet + VDDCFECHEADERSIZE + Group->Bytes, 0, Length - Group->Bytes);    // pad the parity out
+            Group->Bytes = Length;
+        }
+        Offset = VDDCFECHEADERSIZE;
+        for (Cntr = 0; Cntr < Count; Cntr++)
+        {
+            XorDDCFECBytes(Group->Packet + Offset, Iovecs[Cntr].iov_base, Iovecs[Cntr].iov_len);
+            Offset += Iovecs[Cntr].iov_len;
+        }
+    }
+    Group->LengthXor ^= (uint16_t)Length;
+    Group->NextSequence = Sequence + 1;
+    if (++Group->Packets < Group->GroupSize)
+        return 0;
+    *(uint16_t*)(Group->Packet + 4) = htons(Group->LengthXor);
+    return VDDCFECHEADERSIZE + Group->Bytes;
+}
+
+
+bool IsDDCFECPacket(const uint8_t* Packet, uint32_t Length, uint32_t* FirstSequence, uint32_t* GroupSize)
+{
+    uint16_t Bits;
+
+    if ((Length <= VDDCFECHEADERSIZE) || (Length > (VDDCFECHEADERSIZE + VMAXDDCFECDATA)))
+        return false;
+    Bits = (Packet[12] << 8) | Packet[13];
+    if ((Bits & 0xC000) != VDDCFECMARKER)
+        return false;
+    *GroupSize = Bits & 0x3FFF;
+    *FirstSequence = ((uint32_t)Packet[0] << 24) | ((uint32_t)Packet[1] << 16) | ((uint32_t)Packet[2] << 8) | Packet[3];
+    return (*GroupSize >= 1) && (*GroupSize <= VMAXDDCFECGROUP);
+}
+
+
+uint32_t RecoverDDCFECPacket(uint8_t* Dest, const uint8_t* Parity, uint32_t ParityLength,
+                             const uint8_t* const* Packets, const uint32_t* Lengths, uint32_t Count)
+{
+    uint32_t Bytes = ParityLength - VDDCFECHEADERSIZE;
+    uint16_t Length;
+    uint32_t Cntr;
+
+    Length = (Parity[4] << 8) | Parity[5];
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        if (Lengths[Cntr] > Bytes)
+            return 0;
+        Length ^= (uint16_t)Lengths[Cntr];
+    }
+    if ((Length == 0) || (Length > Bytes))
+        return 0;
+    memcpy(Dest, Parity + VDDCFECHEADERSIZE, Bytes);
+    for (Cntr = 0; Cntr < Count; Cntr++)
+        XorDDCFECBytes(Dest, Packets[Cntr], Lengths[Cntr]);
+    return Length;
+}
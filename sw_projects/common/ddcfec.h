@@ -0,0 +1,103 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcfec.h:
+// forward error correction for DDC streams, for clients on a lossy (WAN) link
+//
+// after each group of N consecutive DDC packets (setting ddc_fec = N) a parity
+// packet is sent on the same stream: the XOR of the group's packets, each
+// taken as a whole (header and payload) and padded with zeros to the longest.
+// the receiver (ddcproxy) can make any one lost packet of a group again from
+// the others and the parity, without asking for it to be sent again.
+// a parity packet has a 16 byte header laid out like a DDC packet's:
+//   bytes 0-3:   sequence number of the group's 1st packet
+//   bytes 4-5:   XOR of the lengths of the group's packets
+//   bytes 6-11:  zero
+//   bytes 12-13: bits per sample field VDDCFECBITS(N)
+//   bytes 14-15: zero
+// then the parity, as many bytes as the longest packet of the group.
+// the use of FEC is set up out of band; a client that knows nothing of it
+// must be reached through ddcproxy, which takes the parity packets out.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ddcfec_h
+#define __ddcfec_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+
+#define VDDCFECHEADERSIZE 16                    // parity packet header
+#define VMAXDDCFECGROUP 16                      // most packets in a group
+#define VMAXDDCFECDATA 1456                     // longest packet protected: parity packet fits a 1500 byte MTU
+#define VDDCFECBITS(Group) (0x4000 | (Group))   // bits per sample field of a parity packet
+#define VDDCFECMARKER 0x4000
+
+
+//
+// a group being made: the parity packet of the packets so far
+//
+struct DDCFECGroup
+{
+    uint8_t Packet[VDDCFECHEADERSIZE + VMAXDDCFECDATA];     // parity packet
+    uint32_t GroupSize;                         // packets per group
+    uint32_t Packets;                           // packets in the parity so far
+    uint32_t Bytes;                             // longest packet so far
+    uint32_t NextSequence;                      // sequence number the next packet must have
+    uint16_t LengthXor;                         // XOR of the packet lengths so far
+};
+
+
+//
+// XorDDCFECBytes(uint8_t* Dest, const uint8_t* Src, uint32_t Bytes)
+// Dest ^= Src for Bytes bytes. Uses NEON, 64 bytes at a time, if built with
+// USENEON=1 on an ARM target, else 64 bit words
+//
+void XorDDCFECBytes(uint8_t* Dest, const uint8_t* Src, uint32_t Bytes);
+
+
+//
+// InitDDCFECGroup(struct DDCFECGroup* Group, uint32_t GroupSize)
+// clear a group, for groups of GroupSize packets (1...VMAXDDCFECGROUP)
+//
+void InitDDCFECGroup(struct DDCFECGroup* Group, uint32_t GroupSize);
+
+
+//
+// AddDDCFECPacket(struct DDCFECGroup* Group, const struct iovec* Iovecs, uint32_t Count)
+// add a sent DDC packet (Count iovecs; its sequence number in the 1st 4 bytes) to
+// the group. A packet that doesn't follow the last starts a new group; one longer
+// than VMAXDDCFECDATA isn't protected, and ends the group.
+// returns the length of the parity packet at Group->Packet when the packet
+// completes its group, else 0. The next packet starts a new group.
+//
+uint32_t AddDDCFECPacket(struct DDCFECGroup* Group, const struct iovec* Iovecs, uint32_t Count);
+
+
+//
+// IsDDCFECPacket(const uint8_t* Packet, uint32_t Length, uint32_t* FirstSequence, uint32_t* GroupSize)
+// true if Packet is a valid parity packet; then FirstSequence and GroupSize are set
+//
+bool IsDDCFECPacket(const uint8_t* Packet, uint32_t Length, uint32_t* FirstSequence, uint32_t* GroupSize);
+
+
+//
+// RecoverDDCFECPacket(uint8_t* Dest, const uint8_t* Parity, uint32_t ParityLength,
+//                     const uint8_t* const* Packets, const uint32_t* Lengths, uint32_t Count)
+// make the one lost packet of a group at Dest, from its parity packet and the
+// Count (group size - 1) packets that did arrive.
+// returns the length of the packet made, or 0 if the packets don't fit the parity
+//
+uint32_t RecoverDDCFECPacket(uint8_t* Dest, const uint8_t* Parity, uint32_t ParityLength,
+                             const uint8_t* const* Packets, const uint32_t* Lengths, uint32_t Count);
+
+
+#endif
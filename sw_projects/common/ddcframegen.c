@@ -0,0 +1,274 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcframegen.c:
+// golden model of the FPGA DDC stream framing, to generate and check it
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <string.h>
+#include "../common/ddcframegen.h"
+
+
+#define VDDCGENMARKER 0x8000000000000000ULL             // top byte 0x80: a rate word
+
+
+//
+// sample words per frame for each rate code, as the FPGA DDC mux sends them
+//
+static const uint32_t DDCGenWordsPerFrame[8] =
+{
+    0,                                              // eDisabled
+    1,                                              // e48KHz
+    2,                                              // e96KHz
+    4,                                              // e192KHz
+    8,                                              // e384KHz
+    16,                                             // e768KHz
+    32,                                             // e1536KHz
+    0                                               // eInterleaveWithNext: set by the next DDC
+};
+
+static const char* DDCGenCorruptionNames[] = {"none", "word", "marker", "false", "frame"};
+
+
+
+uint32_t DDCGenFrameLayout(uint32_t RateWord, uint32_t* DDCCounts)
+{
+    uint32_t DDC;
+    uint32_t Code;
+    uint32_t Total = 0;
+
+    memset(DDCCounts, 0, VNUMDDC * sizeof(uint32_t));
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Code = (RateWord >> (3 * DDC)) & 7;
+        if (Code != eInterleaveWithNext)
+            DDCCounts[DDC] = DDCGenWordsPerFrame[Code];
+        else if (DDC < (VNUMDDC - 1))
+        {
+            //
+            // a pair: all its words are sent in the 1st DDC's place, none in the 2nd's
+            //
+            DDCCounts[DDC] = 2 * DDCGenWordsPerFrame[(RateWord >> (3 * (DDC + 1))) & 7];
+            Total += DDCCounts[DDC++];
+            continue;
+        }
+        Total += DDCCounts[DDC];
+    }
+    return Total;
+}
+
+
+bool DDCGenRateCode(uint32_t RateKHz, uint32_t* Code)
+{
+    uint32_t Cntr;
+
+    for (Cntr = e48KHz; Cntr <= e1536KHz; Cntr++)
+        if ((48U << (Cntr - e48KHz)) == RateKHz)
+        {
+            *Code = Cntr;
+            return false;
+        }
+    return true;
+}
+
+
+uint32_t MakeDDCGenRateWord(uint32_t Count, uint32_t Code, bool Pair)
+{
+    uint32_t RateWord = 0;
+    uint32_t DDC;
+
+    for (DDC = 0; (DDC < Count) && (DDC < VNUMDDC); DDC++)
+        RateWord |= (Code & 7) << (3 * DDC);
+    if (Pair && (Count >= 2))
+        RateWord = (RateWord & ~7U) | eInterleaveWithNext;
+    return RateWord;
+}
+
+
+bool ParseDDCGenCorruption(const char* Name, EDDCGenCorruption* Corruption)
+{
+    uint32_t Cntr;
+
+    for (Cntr = eDDCGenDropWord; Cntr <= eDDCGenDropFrame; Cntr++)
+        if (strcmp(Name, DDCGenCorruptionNames[Cntr]) == 0)
+        {
+            *Corruption = (EDDCGenCorruption)Cntr;
+            return false;
+        }
+    return true;
+}
+
+
+void InitDDCFrameGen(struct DDCFrameGen* Gen, uint32_t RateWord)
+{
+    memset(Gen, 0, sizeof(*Gen));
+    Gen->RateWord = RateWord;
+    Gen->NextRateWord = RateWord;
+}
+
+
+void RestartDDCFrameGen(struct DDCFrameGen* Gen)
+{
+    Gen->FrameWords = 0;
+    Gen->FramePos = 0;
+}
+
+
+void SetDDCFrameGenRate(struct DDCFrameGen* Gen, uint32_t RateWord)
+{
+    Gen->NextRateWord = RateWord;
+}
+
+
+void SetDDCFrameGenCorruption(struct DDCFrameGen* Gen, EDDCGenCorruption Corruption, uint32_t Period)
+{
+    Gen->Corruption = Corruption;
+    Gen->CorruptPeriod = (Corruption == eDDCGenCorruptNone) ? 0 : Period;
+}
+
+
+//
+// make the next frame: the rate word, then each enabled DDC's samples in DDC order;
+// an interleaved pair's alternately from its two DDCs, the 1st DDC's first.
+// every CorruptPeriod frames, the frame is corrupted
+//
+static void MakeDDCGenFrame(struct DDCFrameGen* Gen)
+{
+    uint32_t DDCCounts[VNUMDDC];
+    uint32_t DDC;
+    uint32_t Word;
+    uint32_t Source;
+    uint32_t Pos;
+    bool Corrupt;
+
+    while (true)
+    {
+        Gen->RateWord = Gen->NextRateWord;
+        DDCGenFrameLayout(Gen->RateWord, DDCCounts);
+        Gen->Frame[0] = VDDCGENMARKER | Gen->RateWord;
+        Pos = 1;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            for (Word = 0; Word < DDCCounts[DDC]; Word++)
+            {
+                Source = (((Gen->RateWord >> (3 * DDC)) & 7) == eInterleaveWithNext) ? DDC + (Word & 1) : DDC;
+                Gen->Frame[Pos++] = DDCGenSample(Source, Gen->Samples[Source]++);
+            }
+        Gen->FrameWords = Pos;
+        Gen->FramePos = 0;
+        Gen->Frames++;
+        Corrupt = (Gen->CorruptPeriod != 0) && ((Gen->Frames % Gen->CorruptPeriod) == 0);
+        if (!Corrupt)
+            return;
+
+        Gen->Corrupted++;
+        switch (Gen->Corruption)
+        {
+            case eDDCGenDropWord:                           // the middle sample word is lost
+                if (Pos > 1)
+                {
+                    Word = Pos / 2 + ((Pos == 2) ? 1 : 0);
+                    memmove(Gen->Frame + Word, Gen->Frame + Word + 1, (Pos - Word - 1) * sizeof(uint64_t));
+                    Gen->FrameWords--;
+                    Gen->SamplesDropped++;
+                }
+                return;
+
+            case eDDCGenLoseMarker:
+                Gen->Frame[0] &= ~VDDCGENMARKER;
+                return;
+
+            case eDDCGenFalseMarker:                        // the sample itself is still intact in the low 48 bits
+                if (Pos > 1)
+                    Gen->Frame[Pos / 2 + ((Pos == 2) ? 1 : 0)] |= VDDCGENMARKER;
+                return;
+
+            case eDDCGenDropFrame:                          // the next frame follows straight on
+                Gen->SamplesDropped += Pos - 1;
+                break;
+
+            default:
+                return;
+        }
+    }
+}
+
+
+void MakeDDCFrameWords(struct DDCFrameGen* Gen, uint64_t* Dest, uint32_t Words)
+{
+    uint32_t Count;
+
+    while (Words != 0)
+    {
+        if (Gen->FramePos >= Gen->FrameWords)
+            MakeDDCGenFrame(Gen);
+        Count = Gen->FrameWords - Gen->FramePos;
+        if (Count > Words)
+            Count = Words;
+        memcpy(Dest, Gen->Frame + Gen->FramePos, Count * sizeof(uint64_t));
+        Gen->FramePos += Count;
+        Dest += Count;
+        Words -= Count;
+    }
+}
+
+
+void InitDDCGenCheck(struct DDCGenCheck* Check)
+{
+    memset(Check, 0, sizeof(*Check));
+}
+
+
+void ResyncDDCGenCheck(struct DDCGenCheck* Check)
+{
+    memset(Check->HaveNext, 0, sizeof(Check->HaveNext));
+}
+
+
+uint32_t CheckDDCGenSamples(struct DDCGenCheck* Check, uint32_t DDC, bool Pair, const uint8_t* Samples, uint32_t Count)
+{
+    uint64_t Sample;
+    uint64_t Number;
+    uint32_t SampleDDC;
+    uint32_t Errors = 0;
+
+    while (Count--)
+    {
+        //
+        // the low 6 bytes of the FPGA word, as DemuxDDCSamples() copies them
+        //
+        Sample = (uint64_t)Samples[0] | ((uint64_t)Samples[1] << 8) | ((uint64_t)Samples[2] << 16)
+               | ((uint64_t)Samples[3] << 24) | ((uint64_t)Samples[4] << 32) | ((uint64_t)Samples[5] << 40);
+        Samples += 6;
+        Check->Samples++;
+        SampleDDC = (uint32_t)(Sample >> VDDCGENDDCSHIFT);
+        Number = Sample & VDDCGENSAMPLEMASK;
+        if ((SampleDDC != DDC) && (!Pair || (SampleDDC != (DDC + 1))))
+        {
+            Check->Bad++;                               // another DDC's sample, or not a sample at all
+            Errors++;
+            continue;
+        }
+        if (Check->HaveNext[SampleDDC] && (Number != Check->Next[SampleDDC]))
+        {
+            if (((Number - Check->Next[SampleDDC]) & VDDCGENSAMPLEMASK) < (VDDCGENSAMPLEMASK / 2))
+            {
+                Check->Gaps++;
+                Check->Lost += (Number - Check->Next[SampleDDC]) & VDDCGENSAMPLEMASK;
+            }
+            else
+                Check->Bad++;                           // a sample repeated, or out of order
+            Errors++;
+        }
+        Check->Next[SampleDDC] = (Number + 1) & VDDCGENSAMPLEMASK;
+        Check->HaveNext[SampleDDC] = true;
+    }
+    return Errors;
+}
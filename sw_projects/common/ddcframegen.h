@@ -0,0 +1,187 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcframegen.h:
+// golden model of the FPGA DDC stream framing, to generate and check it
+//
+// the FPGA DDC mux writes a frame at 48000 frames/s to the DDC FIFO: a rate word
+// (top byte 0x80, the DDC rate register in the low 30 bits) then the samples of
+// each enabled DDC in turn, one 64 bit word per sample, the sample in the low
+// 48 bits. A DDC's 3 bit rate code gives its words per frame (48KHz: 1, doubling
+// up to 1536KHz: 32); code 7 (eInterleaveWithNext) sends it and the next DDC as
+// a pair, at the next DDC's rate: twice its words, alternately from each.
+// this is the format as the FPGA IP makes it, written out independently of the
+// decoder's AnalyseDDCHeader(), so the simulated FPGA, ddcsoak and decoder
+// changes are all checked against the same definition.
+// each sample generated is tagged: DDC number in bits 47:44, and the number of
+// samples made for that DDC before it in bits 43:0, so a check of the decoded
+// samples finds any lost, repeated or misplaced sample bit exactly.
+// deliberate corruption (one frame in every n) exercises the decoder resync.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ddcframegen_h
+#define __ddcframegen_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/saturnregisters.h"
+
+
+#define VMAXDDCGENFRAMEWORDS (1 + VNUMDDC * 32)         // rate word + every DDC at 1536KHz
+#define VDDCGENSAMPLEMASK 0x00000FFFFFFFFFFFULL          // sample number bits of a tagged sample
+#define VDDCGENDDCSHIFT 44                               // DDC number bits 47:44
+
+
+//
+// deliberate corruption of a frame
+//
+typedef enum
+{
+    eDDCGenCorruptNone,
+    eDDCGenDropWord,                                // a sample word of the frame is not sent
+    eDDCGenLoseMarker,                              // the rate word has no 0x80 marker
+    eDDCGenFalseMarker,                             // a sample word has 0x80 in its top byte
+    eDDCGenDropFrame                                // the whole frame is not sent (a FIFO overflow)
+} EDDCGenCorruption;
+
+
+//
+// generator state: frames are made a whole frame at a time, and copied out by the word
+//
+struct DDCFrameGen
+{
+    uint32_t RateWord;                              // rate word of the frame being sent
+    uint32_t NextRateWord;                          // takes effect at the start of the next frame
+    uint64_t Frame[VMAXDDCGENFRAMEWORDS];           // the frame being sent
+    uint32_t FrameWords;                            // words in it
+    uint32_t FramePos;                              // next word of it to send
+    uint64_t Samples[VNUMDDC];                      // samples made for each DDC
+    EDDCGenCorruption Corruption;
+    uint32_t CorruptPeriod;                         // frames per corrupted frame; 0 = none
+    uint64_t Frames;                                // frames made
+    uint64_t Corrupted;                             // frames corrupted
+    uint64_t SamplesDropped;                        // samples made but not sent
+};
+
+
+//
+// checker for decoded samples: the tag each DDC's next sample should have
+//
+struct DDCGenCheck
+{
+    uint64_t Next[VNUMDDC];                         // next sample number expected
+    bool HaveNext[VNUMDDC];                         // false until a DDC's 1st sample
+    uint64_t Samples;                               // samples checked
+    uint64_t Gaps;                                  // jumps in a DDC's sample numbers
+    uint64_t Lost;                                  // samples missing across the jumps
+    uint64_t Bad;                                   // samples of the wrong DDC, or not a tagged sample
+};
+
+
+//
+// DDCGenFrameLayout(uint32_t RateWord, uint32_t* DDCCounts)
+// the FPGA's frame layout for a rate word: the words per frame of each DDC (an
+// interleaved pair's all at the 1st of the pair) into DDCCounts[VNUMDDC].
+// returns the sample words per frame, not counting the rate word
+//
+uint32_t DDCGenFrameLayout(uint32_t RateWord, uint32_t* DDCCounts);
+
+
+//
+// DDCGenRateCode(uint32_t RateKHz, uint32_t* Code)
+// the rate code for 48...1536KHz. return true if error (not a DDC rate)
+//
+bool DDCGenRateCode(uint32_t RateKHz, uint32_t* Code);
+
+
+//
+// MakeDDCGenRateWord(uint32_t Count, uint32_t Code, bool Pair)
+// rate word with DDCs 0...Count-1 at rate code Code; if Pair, DDCs 0 and 1 are an interleaved pair
+//
+uint32_t MakeDDCGenRateWord(uint32_t Count, uint32_t Code, bool Pair);
+
+
+//
+// ParseDDCGenCorruption(const char* Name, EDDCGenCorruption* Corruption)
+// corruption by name: word, marker, false or frame. return true if error
+//
+bool ParseDDCGenCorruption(const char* Name, EDDCGenCorruption* Corruption);
+
+
+//
+// InitDDCFrameGen(struct DDCFrameGen* Gen, uint32_t RateWord)
+// start a stream at its 1st frame, with sample numbers from 0 and no corruption
+//
+void InitDDCFrameGen(struct DDCFrameGen* Gen, uint32_t RateWord);
+
+
+//
+// RestartDDCFrameGen(struct DDCFrameGen* Gen)
+// start the next word sent at a frame boundary (a FIFO reset); the sample numbers carry on
+//
+void RestartDDCFrameGen(struct DDCFrameGen* Gen);
+
+
+//
+// SetDDCFrameGenRate(struct DDCFrameGen* Gen, uint32_t RateWord)
+// set the rate word; it takes effect at the start of the next frame, as in the FPGA
+//
+void SetDDCFrameGenRate(struct DDCFrameGen* Gen, uint32_t RateWord);
+
+
+//
+// SetDDCFrameGenCorruption(struct DDCFrameGen* Gen, EDDCGenCorruption Corruption, uint32_t Period)
+// corrupt one frame in every Period; Period 0 or eDDCGenCorruptNone for none
+//
+void SetDDCFrameGenCorruption(struct DDCFrameGen* Gen, EDDCGenCorruption Corruption, uint32_t Period);
+
+
+//
+// MakeDDCFrameWords(struct DDCFrameGen* Gen, uint64_t* Dest, uint32_t Words)
+// write the next Words 64 bit words of the stream to Dest
+//
+void MakeDDCFrameWords(struct DDCFrameGen* Gen, uint64_t* Dest, uint32_t Words);
+
+
+//
+// DDCGenSample(uint32_t DDC, uint64_t Sample)
+// the word generated for sample number Sample of a DDC
+//
+static inline uint64_t DDCGenSample(uint32_t DDC, uint64_t Sample)
+{
+    return ((uint64_t)DDC << VDDCGENDDCSHIFT) | (Sample & VDDCGENSAMPLEMASK);
+}
+
+
+//
+// InitDDCGenCheck(struct DDCGenCheck* Check)
+// clear a checker: each DDC's 1st sample may have any number
+//
+void InitDDCGenCheck(struct DDCGenCheck* Check);
+
+
+//
+// ResyncDDCGenCheck(struct DDCGenCheck* Check)
+// the decoder has discarded data to find the framing again: samples missing
+// across the gap are not counted as lost
+//
+void ResyncDDCGenCheck(struct DDCGenCheck* Check);
+
+
+//
+// CheckDDCGenSamples(struct DDCGenCheck* Check, uint32_t DDC, bool Pair, const uint8_t* Samples, uint32_t Count)
+// check Count samples of DDC decoded to 6 bytes each (as DemuxDDCSamples() writes them).
+// with Pair, they are an interleaved pair: alternately DDC and DDC + 1.
+// returns the number of samples that were not as expected
+//
+uint32_t CheckDDCGenSamples(struct DDCGenCheck* Check, uint32_t DDC, bool Pair, const uint8_t* Samples, uint32_t Count);
+
+
+#endif
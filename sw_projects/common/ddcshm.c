@@ -0,0 +1,240 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcshm.c:
+// shared memory DDC transport: the client side
+//
+// the rings are read without any lock: the data between the cursor and Head
+// is read in place, and afterwards WriteLimit shows whether p2app has begun
+// to write over any of it (as a seqlock reader checks its sequence count).
+//
+//////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include "../common/ddcshm.h"
+
+
+#define VSAMPLEBYTES 6                          // 24 bit I and Q
+
+
+//
+// connect and receive the file descriptors
+//
+bool ConnectDDCShm(struct DDCShmClient* Client)
+{
+    struct sockaddr_un Addr;
+    struct msghdr Msg;
+    struct iovec Iov;
+    struct cmsghdr* Cmsg;
+    union
+    {
+        char Buffer[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr Align;
+    } Control;
+    uint32_t Version = 0;
+    int Fds[3];
+    void* Mapping;
+
+    memset(Client, 0, sizeof(struct DDCShmClient));
+    Client->ControlFd = Client->BufferFd = Client->EventFd = -1;
+    Client->Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (Client->Socket < 0)
+        return true;
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    strncpy(Addr.sun_path + 1, VDDCSHMSOCKETNAME, sizeof(Addr.sun_path) - 2);      // abstract name: leading 0
+    if (connect(Client->Socket, (struct sockaddr*)&Addr,
+                offsetof(struct sockaddr_un, sun_path) + 1 + strlen(VDDCSHMSOCKETNAME)) != 0)
+    {
+        close(Client->Socket);
+        return true;
+    }
+
+    memset(&Msg, 0, sizeof(Msg));
+    Iov.iov_base = &Version;
+    Iov.iov_len = sizeof(Version);
+    Msg.msg_iov = &Iov;
+    Msg.msg_iovlen = 1;
+    Msg.msg_control = Control.Buffer;
+    Msg.msg_controllen = sizeof(Control.Buffer);
+    Cmsg = NULL;
+    if (recvmsg(Client->Socket, &Msg, MSG_CMSG_CLOEXEC) == sizeof(Version))
+        Cmsg = CMSG_FIRSTHDR(&Msg);
+    if ((Cmsg == NULL) || (Cmsg->cmsg_type != SCM_RIGHTS) || (Cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))))
+    {
+        printf("DDC shared memory: no file descriptors from p2app\n");
+        close(Client->Socket);
+        return true;
+    }
+    memcpy(Fds, CMSG_DATA(Cmsg), sizeof(Fds));
+    Client->ControlFd = Fds[0];
+    Client->BufferFd = Fds[1];
+    Client->EventFd = Fds[2];
+    Mapping = mmap(NULL, sizeof(struct DDCShmControl), PROT_READ, MAP_SHARED, Client->ControlFd, 0);
+    if (Mapping != MAP_FAILED)
+        Client->Control = (const struct DDCShmControl*)Mapping;
+    if ((Version != VDDCSHMVERSION) || (Client->Control == NULL) || (Client->Control->Magic != VDDCSHMMAGIC)
+        || (Client->Control->Version != VDDCSHMVERSION) || (Client->Control->NumDDC != VNUMDDC))
+    {
+        printf("DDC shared memory: p2app version does not match\n");
+        DisconnectDDCShm(Client);
+        return true;
+    }
+    return false;
+}
+
+
+//
+// the samples waiting at the cursor
+//
+uint32_t ReadDDCShm(struct DDCShmClient* Client, uint32_t DDC, struct DDCShmCursor* Cursor, const uint8_t** Samples)
+{
+    struct DDCShmChannel* Channel;
+    struct SPSCRingBuffer* Ring;
+    uint32_t Generation, Head, WriteLimit, Back, Behind;
+
+    if (DDC >= VNUMDDC)
+        return 0;
+    Channel = (struct DDCShmChannel*)&Client->Control->DDC[DDC];
+    Ring = Client->Rings + DDC;
+    Generation = atomic_load_explicit(&Channel->Generation, memory_order_acquire);
+    if ((Generation & 1) == 0)
+        return 0;
+    if ((Ring->Base == NULL) &&
+        MapReadOnlyRingBuffer(Ring, Client->BufferFd, Channel->RingOffset, Channel->RingSize, Client->Control->PageSize))
+        return 0;
+    Head = atomic_load_explicit(&Channel->Head, memory_order_acquire);
+    WriteLimit = atomic_load_explicit(&Channel->WriteLimit, memory_order_acquire);
+    //
+    // positions always move in whole samples from Head, which is a whole number of
+    // samples from the start of the run
+    //
+    if (Cursor->Generation != Generation)
+    {
+        Back = Ring->Size - (WriteLimit - Head);                // oldest data left, or the run start
+        if (Back > Head)
+            Back = Head;
+        Cursor->Generation = Generation;
+        Cursor->Position = Head - (Back - Back % VSAMPLEBYTES);
+    }
+    else if ((WriteLimit - Cursor->Position) > Ring->Size)
+    {
+        Behind = (WriteLimit - Ring->Size) - Cursor->Position;  // fallen behind: skip to the oldest sample left
+        Behind += (VSAMPLEBYTES - Behind % VSAMPLEBYTES) % VSAMPLEBYTES;
+        Cursor->Position += Behind;
+        Cursor->SamplesLost += Behind / VSAMPLEBYTES;
+    }
+    *Samples = Ring->Base + (Cursor->Position & Ring->Mask);
+    return Head - Cursor->Position;
+}
+
+
+//
+// move the cursor on, checking the data was still valid
+//
+bool ReleaseDDCShm(struct DDCShmClient* Client, uint32_t DDC, struct DDCShmCursor* Cursor, uint32_t Bytes)
+{
+    struct DDCShmChannel* Channel = (struct DDCShmChannel*)&Client->Control->DDC[DDC];
+    uint32_t WriteLimit;
+    bool Overwritten;
+
+    atomic_thread_fence(memory_order_acquire);                  // the data reads come before this
+    WriteLimit = atomic_load_explicit(&Channel->WriteLimit, memory_order_relaxed);
+    Overwritten = ((WriteLimit - Cursor->Position) > Client->Rings[DDC].Size)
+               || (atomic_load_explicit(&Channel->Generation, memory_order_relaxed) != Cursor->Generation);
+    Cursor->Position += Bytes - Bytes % VSAMPLEBYTES;
+    return Overwritten;
+}
+
+
+//
+// sample number from the newest mark at or before the position
+//
+bool GetDDCShmSampleNumber(struct DDCShmClient* Client, uint32_t DDC, uint32_t Position, uint64_t* SampleNumber)
+{
+    const struct DDCShmChannel* Channel = &Client->Control->DDC[DDC];
+    const struct DDCShmMark* Mark;
+    uint32_t Sequence, Count, Age, Tries;
+    bool Found;
+
+    for (Tries = 0; Tries < 4; Tries++)
+    {
+        Sequence = atomic_load_explicit((_Atomic uint32_t*)&Channel->MarkCount, memory_order_acquire);
+        if (Sequence & 1)
+            continue;                                           // a mark is being written
+        Count = Sequence / 2;
+        Found = false;
+        for (Age = 1; (Age <= Count) && (Age <= VDDCSHMMARKS) && !Found; Age++)
+        {
+            Mark = Channel->Marks + ((Count - Age) % VDDCSHMMARKS);
+            if ((int32_t)(Position - Mark->Position) >= 0)
+            {
+                *SampleNumber = Mark->SampleNumber + (Position - Mark->Position) / VSAMPLEBYTES;
+                Found = true;
+            }
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit((_Atomic uint32_t*)&Channel->MarkCount, memory_order_relaxed) == Sequence)
+            return !Found;                                      // no mark changed while reading
+    }
+    return true;
+}
+
+
+//
+// sleep until signalled
+//
+bool WaitDDCShm(struct DDCShmClient* Client, int Milliseconds)
+{
+    struct pollfd PollFds[2];
+    eventfd_t Count;
+
+    PollFds[0].fd = Client->EventFd;
+    PollFds[0].events = POLLIN;
+    PollFds[1].fd = Client->Socket;
+    PollFds[1].events = POLLIN;
+    PollFds[0].revents = PollFds[1].revents = 0;
+    if (poll(PollFds, 2, Milliseconds) <= 0)
+        return false;
+    if (PollFds[0].revents & POLLIN)
+        eventfd_read(Client->EventFd, &Count);
+    return (PollFds[1].revents & (POLLIN | POLLHUP | POLLERR)) != 0;     // p2app only closes the socket
+}
+
+
+//
+// release everything
+//
+void DisconnectDDCShm(struct DDCShmClient* Client)
+{
+    uint32_t DDC;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        FreeRingBuffer(Client->Rings + DDC);
+    if (Client->Control != NULL)
+        munmap((void*)Client->Control, sizeof(struct DDCShmControl));
+    if (Client->ControlFd >= 0)
+        close(Client->ControlFd);
+    if (Client->BufferFd >= 0)
+        close(Client->BufferFd);
+    if (Client->EventFd >= 0)
+        close(Client->EventFd);
+    close(Client->Socket);
+    memset(Client, 0, sizeof(struct DDCShmClient));
+    Client->Socket = Client->ControlFd = Client->BufferFd = Client->EventFd = -1;
+}
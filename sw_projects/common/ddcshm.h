@@ -0,0 +1,159 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcshm.h:
+// shared memory DDC transport, for client programs running on the Pi
+//
+// with setting ddc_shm, p2app lets local programs read its per-DDC I/Q rings
+// directly, with no copies and no system calls in the data path. A client
+// connects to the unix socket VDDCSHMSOCKETNAME (abstract namespace) and is
+// passed three file descriptors:
+//   a read only memfd of one struct DDCShmControl: the state of each DDC
+//   a read only fd of the stream buffer memory, holding the DDC rings
+//   an eventfd that p2app signals after each batch of DDC samples
+// the rings hold 24 bit samples, I then Q, big endian, exactly as they go into
+// DDC packets. The client is a reader only: p2app does not wait for it, so a
+// client that falls more than a ring behind loses samples (ring size set by
+// ddc_dma_buffer). p2app still needs a protocol 2 client (UDP) to set up and
+// start the DDCs; ddc_shm=2 stops it sending the DDC packets over UDP.
+// the functions below are the client side; p2app's side is OutDDCShm.c.
+//
+// each DDC has "marks": the sample number at a ring position, written at the
+// start and after any samples were lost. The sample number is the one a DDC
+// packet's timestamp would carry.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ddcshm_h
+#define __ddcshm_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "../common/saturnregisters.h"
+#include "../common/ringbuffer.h"
+
+
+#define VDDCSHMSOCKETNAME "saturn-ddc"          // abstract unix socket name
+#define VDDCSHMMAGIC 0x53444331                 // "SDC1"
+#define VDDCSHMVERSION 1
+#define VDDCSHMMARKS 16                         // sample number marks kept per DDC
+
+
+struct DDCShmMark
+{
+    uint32_t Position;                          // ring position (free running byte count)
+    uint32_t Spare;
+    uint64_t SampleNumber;                      // sample number of the sample at Position
+};
+
+
+struct DDCShmChannel
+{
+    _Atomic uint32_t Head;                      // ring bytes written: data before Head can be read
+    _Atomic uint32_t WriteLimit;                // Head + bytes being written now: only data after
+                                                // WriteLimit - RingSize is still valid
+    _Atomic uint32_t Generation;                // odd while the DDC stream runs; changes on start and stop
+    _Atomic uint32_t SampleRate;                // KHz; 0 until known
+    _Atomic uint32_t MarkCount;                 // 2 x marks written, +1 while one is being written;
+                                                // mark n is Marks[n % VDDCSHMMARKS]
+    uint32_t RingSize;                          // bytes, a power of 2
+    uint64_t RingOffset;                        // where the ring is in the buffer fd
+    struct DDCShmMark Marks[VDDCSHMMARKS];
+};
+
+
+struct DDCShmControl
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t NumDDC;
+    uint32_t PageSize;                          // page size of the buffer fd (huge page size if huge)
+    struct DDCShmChannel DDC[VNUMDDC];
+};
+
+
+//
+// client side state
+//
+struct DDCShmClient
+{
+    int Socket;                                 // connection to p2app; closed by p2app when it exits
+    int ControlFd;
+    int BufferFd;
+    int EventFd;
+    const struct DDCShmControl* Control;
+    struct SPSCRingBuffer Rings[VNUMDDC];       // read only mirrored maps; Base NULL until first used
+};
+
+
+//
+// the client's place in one DDC's stream
+//
+struct DDCShmCursor
+{
+    uint32_t Generation;                        // stream the cursor is in
+    uint32_t Position;                          // ring position of the next sample to read
+    uint64_t SamplesLost;                       // samples skipped because the client fell behind
+};
+
+
+//
+// ConnectDDCShm(struct DDCShmClient* Client)
+// connect to p2app and map its DDC control block.
+// return true if error (p2app not running, or ddc_shm not set)
+//
+bool ConnectDDCShm(struct DDCShmClient* Client);
+
+
+//
+// ReadDDCShm(struct DDCShmClient* Client, uint32_t DDC, struct DDCShmCursor* Cursor, const uint8_t** Samples)
+// find the samples of a DDC waiting to be read from the cursor. A cursor that is
+// zeroed, or from an earlier run of the DDC, is moved to the oldest data of the current
+// run still in the ring; one that has fallen behind is moved to the oldest valid data,
+// counting the samples lost.
+// sets *Samples and returns the bytes that can be read there (a whole number of samples),
+// or 0 if none (or the DDC is not running). the data stays in p2app's ring: call
+// ReleaseDDCShm() when done with it, to check it was not overwritten meanwhile.
+//
+uint32_t ReadDDCShm(struct DDCShmClient* Client, uint32_t DDC, struct DDCShmCursor* Cursor, const uint8_t** Samples);
+
+
+//
+// ReleaseDDCShm(struct DDCShmClient* Client, uint32_t DDC, struct DDCShmCursor* Cursor, uint32_t Bytes)
+// move the cursor on past Bytes read after ReadDDCShm().
+// return true if p2app may have overwritten some of them while they were being read
+//
+bool ReleaseDDCShm(struct DDCShmClient* Client, uint32_t DDC, struct DDCShmCursor* Cursor, uint32_t Bytes);
+
+
+//
+// GetDDCShmSampleNumber(struct DDCShmClient* Client, uint32_t DDC, uint32_t Position, uint64_t* SampleNumber)
+// the sample number of the sample at a ring position (eg Cursor->Position), from the marks.
+// return true if not known (the position is older than the marks kept)
+//
+bool GetDDCShmSampleNumber(struct DDCShmClient* Client, uint32_t DDC, uint32_t Position, uint64_t* SampleNumber);
+
+
+//
+// WaitDDCShm(struct DDCShmClient* Client, int Milliseconds)
+// sleep until p2app writes more DDC samples, or for Milliseconds.
+// return true if p2app has gone away
+//
+bool WaitDDCShm(struct DDCShmClient* Client, int Milliseconds);
+
+
+//
+// DisconnectDDCShm(struct DDCShmClient* Client)
+// unmap everything and disconnect
+//
+void DisconnectDDCShm(struct DDCShmClient* Client);
+
+
+#endif
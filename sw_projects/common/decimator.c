@@ -0,0 +1,200 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// decimator.c:
+// halfband decimator cascade: sample rates below the FPGA DDC's 48KHz
+//
+// filter h[0..2N-2] has its centre at N-1; h[N-1] = 0.5 and the other taps
+// at an even distance from the centre are 0. An output made after input x[n] is
+//   y = 0.5 x[n-(N-1)] + sum(m) h[2m] x[n-2m]
+// so the FIR branch needs only the inputs of the same phase as x[n], and
+// the centre tap only a delay of the other phase. With USENEON defined
+// (make USENEON=1) on an ARM target, the branch is summed 4 taps at a time.
+//
+//////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <math.h>
+#include "../common/decimator.h"
+
+#if defined(USENEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VDECIMATORNEON 1
+#endif
+
+#define VMAXSAMPLE24 8388607.0F                 // 24 bit full scale
+
+
+//
+// the FIR branch taps h[0], h[2] ... h[2N-2]: a Blackman windowed sinc at a quarter
+// of the input rate, scaled so the branch sums to 0.5 and the gain is 1 at DC.
+// made the first time a decimator is reset
+//
+static float BranchCoeffs[VHALFBANDBRANCHTAPS] __attribute__((aligned(16)));
+static bool CoeffsMade = false;
+
+static void DesignHalfband(void)
+{
+    double Length = 2 * VHALFBANDBRANCHTAPS - 1;
+    double X, Window, Sum = 0.0;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < VHALFBANDBRANCHTAPS; Cntr++)
+    {
+        X = 2.0 * Cntr - (VHALFBANDBRANCHTAPS - 1);             // distance from the centre tap: odd
+        Window = 0.42 - 0.5 * cos(2.0 * M_PI * 2 * Cntr / (Length - 1))
+                      + 0.08 * cos(4.0 * M_PI * 2 * Cntr / (Length - 1));
+        BranchCoeffs[Cntr] = sin(M_PI * X / 2.0) / (M_PI * X) * Window;
+        Sum += BranchCoeffs[Cntr];
+    }
+    for (Cntr = 0; Cntr < VHALFBANDBRANCHTAPS; Cntr++)
+        BranchCoeffs[Cntr] = BranchCoeffs[Cntr] * 0.5 / Sum;
+    CoeffsMade = true;
+}
+
+
+void ResetDecimator(struct DDCDecimator* Decimator, uint32_t Factor)
+{
+    uint32_t Stage;
+
+    if (!CoeffsMade)
+        DesignHalfband();
+    memset(Decimator, 0, sizeof(struct DDCDecimator));
+    Decimator->Factor = ((Factor == 2) || (Factor == 4)) ? Factor : 1;
+    Decimator->Stages = (Decimator->Factor == 4) ? 2 : (Decimator->Factor == 2) ? 1 : 0;
+    for (Stage = 0; Stage < VMAXDECIMATORSTAGES; Stage++)
+        Decimator->Stage[Stage].Head = VHALFBANDBRANCHTAPS;
+}
+
+
+//
+// the FIR branch: dot product of the taps with the newest samples
+//
+static inline float RunBranch(const float* Samples)
+{
+#ifdef VDECIMATORNEON
+    float32x4_t Sum = vdupq_n_f32(0.0F);
+    uint32_t Tap;
+
+    for (Tap = 0; Tap < VHALFBANDBRANCHTAPS; Tap += 4)
+        Sum = vmlaq_f32(Sum, vld1q_f32(BranchCoeffs + Tap), vld1q_f32(Samples + Tap));
+    return vaddvq_f32(Sum);
+#else
+    float Sum = 0.0F;
+    uint32_t Tap;
+
+    for (Tap = 0; Tap < VHALFBANDBRANCHTAPS; Tap++)
+        Sum += BranchCoeffs[Tap] * Samples[Tap];
+    return Sum;
+#endif
+}
+
+
+//
+// put one sample into a stage. Return true, with the output, every 2nd sample.
+// the branch delay line is twice the filter length; when the front is reached,
+// the newest samples are moved to the back half.
+//
+static inline bool RunStage(struct HalfbandStage* Stage, float* I, float* Q)
+{
+    float CentreI, CentreQ;
+
+    if (!Stage->OddInput)
+    {
+        Stage->CentreI[Stage->CentrePos] = *I;
+        Stage->CentreQ[Stage->CentrePos] = *Q;
+        if (++Stage->CentrePos == VHALFBANDCENTREDELAY)
+            Stage->CentrePos = 0;
+        Stage->OddInput = true;
+        return false;
+    }
+    Stage->OddInput = false;
+    if (Stage->Head == 0)
+    {
+        memmove(Stage->BranchI + VHALFBANDBRANCHTAPS, Stage->BranchI, (VHALFBANDBRANCHTAPS - 1) * sizeof(float));
+        memmove(Stage->BranchQ + VHALFBANDBRANCHTAPS, Stage->BranchQ, (VHALFBANDBRANCHTAPS - 1) * sizeof(float));
+        Stage->Head = VHALFBANDBRANCHTAPS;
+    }
+    Stage->Head--;
+    Stage->BranchI[Stage->Head] = *I;
+    Stage->BranchQ[Stage->Head] = *Q;
+    CentreI = Stage->CentreI[Stage->CentrePos];                 // oldest: N-1 inputs back
+    CentreQ = Stage->CentreQ[Stage->CentrePos];
+    *I = 0.5F * CentreI + RunBranch(Stage->BranchI + Stage->Head);
+    *Q = 0.5F * CentreQ + RunBranch(Stage->BranchQ + Stage->Head);
+    return true;
+}
+
+
+//
+// 24 bit big endian sample conversion
+//
+static inline float ReadSample24(const uint8_t* Src)
+{
+    return (float)((int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8);
+}
+
+
+static inline void WriteSample24(uint8_t* Dest, float Value)
+{
+    int32_t Sample;
+
+    if (Value > VMAXSAMPLE24)
+        Value = VMAXSAMPLE24;
+    else if (Value < -VMAXSAMPLE24)
+        Value = -VMAXSAMPLE24;
+    Sample = (int32_t)(Value + ((Value >= 0.0F) ? 0.5F : -0.5F));
+    Dest[0] = (uint8_t)(Sample >> 16);
+    Dest[1] = (uint8_t)(Sample >> 8);
+    Dest[2] = (uint8_t)Sample;
+}
+
+
+uint32_t RunDecimator(struct DDCDecimator* Decimator, uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+{
+    uint32_t Outputs = 0;
+    uint32_t Stage;
+    float I, Q;
+
+    if (Decimator->Factor == 1)
+    {
+        if (Dest != Src)
+            memmove(Dest, Src, SampleCount * 6);
+        return SampleCount;
+    }
+    while (SampleCount--)
+    {
+        I = ReadSample24(Src);
+        Q = ReadSample24(Src + 3);
+        Src += 6;
+        for (Stage = 0; Stage < Decimator->Stages; Stage++)
+            if (!RunStage(Decimator->Stage + Stage, &I, &Q))
+                break;
+        if (Stage < Decimator->Stages)
+            continue;
+        WriteSample24(Dest, I);
+        WriteSample24(Dest + 3, Q);
+        Dest += 6;
+        Outputs++;
+    }
+    return Outputs;
+}
+
+
+//
+// say which code is in use
+//
+const char* GetDecimatorName(void)
+{
+#ifdef VDECIMATORNEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
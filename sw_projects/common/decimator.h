@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// decimator.h:
+// halfband decimator cascade: sample rates below the FPGA DDC's 48KHz
+//
+// each stage is a 47 tap halfband low pass filter that halves the sample rate.
+// all but the centre tap of a halfband filter's odd taps are zero, so each
+// stage is run as 2 polyphase branches: a 24 tap FIR on one input phase plus
+// the centre tap on the other, once per output sample. The passband is flat
+// to 0.19 of the input rate (9KHz at 48KHz in), and anything that would alias
+// into it is at least 74dB down. 1 stage gives 24KHz, 2 give 12KHz.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __decimator_h
+#define __decimator_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VMAXDECIMATORSTAGES 2                   // 48KHz to 12KHz
+#define VHALFBANDBRANCHTAPS 24                  // taps in the FIR branch; the filter is 2N-1 taps
+#define VHALFBANDCENTREDELAY (VHALFBANDBRANCHTAPS / 2)  // other phase samples back to the centre tap
+
+
+struct HalfbandStage
+{
+    float BranchI[2 * VHALFBANDBRANCHTAPS];     // FIR phase samples, newest first from Head
+    float BranchQ[2 * VHALFBANDBRANCHTAPS];
+    uint32_t Head;
+    float CentreI[VHALFBANDCENTREDELAY];        // centre tap phase samples, a circular delay
+    float CentreQ[VHALFBANDCENTREDELAY];
+    uint32_t CentrePos;                         // oldest centre tap sample
+    bool OddInput;                              // true if the next input is on the FIR phase
+};
+
+
+struct DDCDecimator
+{
+    uint32_t Factor;                            // 1, 2 or 4
+    uint32_t Stages;                            // log2(Factor)
+    struct HalfbandStage Stage[VMAXDECIMATORSTAGES];
+};
+
+
+//
+// ResetDecimator(struct DDCDecimator* Decimator, uint32_t Factor)
+// set the decimation (1, 2 or 4; others are taken as 1) and clear the filters,
+// eg at the start of a stream or after a gap in its input
+//
+void ResetDecimator(struct DDCDecimator* Decimator, uint32_t Factor);
+
+
+//
+// RunDecimator(struct DDCDecimator* Decimator, uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+// decimate SampleCount 48 bit I/Q samples (24 bit I then Q, big endian, as
+// DemuxDDCSamples() writes them) into the same format at Dest.
+// Dest may be Src: the output is never ahead of the input.
+// returns the samples written: SampleCount / Factor, give or take one,
+// as the filter phase is kept from one call to the next.
+//
+uint32_t RunDecimator(struct DDCDecimator* Decimator, uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount);
+
+
+//
+// GetDecimatorName(void)
+// return a string saying which kernels the decimator uses
+//
+const char* GetDecimatorName(void);
+
+
+#endif
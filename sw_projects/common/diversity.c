@@ -0,0 +1,199 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// diversity.c:
+// diversity combining of two phase locked DDC streams
+//
+// samples are converted to float a block at a time. The kernel forms
+// (P + W * S) / 2 for the block and, for an adaptive weight, the sums of
+// P * conj(S) and |S|^2 it needs. The sums are per block in float, then
+// added into double averages, so long runs don't lose precision.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "../common/diversity.h"
+
+#if defined(USENEON) && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define VDIVERSITYNEON 1
+#endif
+
+#define VDIVERSITYBLOCK 64                                      // samples per kernel call
+#define VMAXSAMPLE 8388607.0f                                   // 24 bit full scale
+
+
+//
+// block sums for the adaptive weight
+//
+struct DiversitySums
+{
+    float CrossI;
+    float CrossQ;
+    float SecondaryPower;
+};
+
+
+//
+// signed 24 bit big endian value
+//
+static inline float Get24(const uint8_t* Src)
+{
+    return (float)((int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8);
+}
+
+
+static inline void Put24(uint8_t* Dest, float Value)
+{
+    int32_t Sample;
+
+    if (Value > VMAXSAMPLE)
+        Value = VMAXSAMPLE;
+    else if (Value < -VMAXSAMPLE)
+        Value = -VMAXSAMPLE;
+    Sample = (int32_t)lrintf(Value);
+    Dest[0] = (Sample >> 16) & 0xFF;
+    Dest[1] = (Sample >> 8) & 0xFF;
+    Dest[2] = Sample & 0xFF;
+}
+
+
+//
+// combine a block of float samples into PI, PQ: P = (P + W * S) / 2,
+// and sum P * conj(S) and |S|^2 over the block (from P before it is combined)
+//
+static void DiversityKernel(float* PI, float* PQ, const float* SI, const float* SQ, uint32_t Count,
+                            float WI, float WQ, struct DiversitySums* Sums)
+{
+    uint32_t Cntr = 0;
+    float CrossI = 0.0f, CrossQ = 0.0f, Power = 0.0f;
+
+#ifdef VDIVERSITYNEON
+    float32x4_t VPI, VPQ, VSI, VSQ, OI, OQ;
+    float32x4_t AccI = vdupq_n_f32(0.0f), AccQ = vdupq_n_f32(0.0f), AccP = vdupq_n_f32(0.0f);
+    float32x4_t VWI = vdupq_n_f32(0.5f * WI), VWQ = vdupq_n_f32(0.5f * WQ);
+    float32x4_t Half = vdupq_n_f32(0.5f);
+
+    for (; Cntr + 4 <= Count; Cntr += 4)
+    {
+        VPI = vld1q_f32(PI + Cntr);
+        VPQ = vld1q_f32(PQ + Cntr);
+        VSI = vld1q_f32(SI + Cntr);
+        VSQ = vld1q_f32(SQ + Cntr);
+        AccI = vmlaq_f32(vmlaq_f32(AccI, VPI, VSI), VPQ, VSQ); // P * conj(S)
+        AccQ = vmlsq_f32(vmlaq_f32(AccQ, VPQ, VSI), VPI, VSQ);
+        AccP = vmlaq_f32(vmlaq_f32(AccP, VSI, VSI), VSQ, VSQ);
+        OI = vmlsq_f32(vmlaq_f32(vmulq_f32(VPI, Half), VSI, VWI), VSQ, VWQ);
+        OQ = vmlaq_f32(vmlaq_f32(vmulq_f32(VPQ, Half), VSQ, VWI), VSI, VWQ);
+        vst1q_f32(PI + Cntr, OI);
+        vst1q_f32(PQ + Cntr, OQ);
+    }
+    CrossI = vaddvq_f32(AccI);
+    CrossQ = vaddvq_f32(AccQ);
+    Power = vaddvq_f32(AccP);
+#endif
+    for (; Cntr < Count; Cntr++)
+    {
+        CrossI += PI[Cntr] * SI[Cntr] + PQ[Cntr] * SQ[Cntr];
+        CrossQ += PQ[Cntr] * SI[Cntr] - PI[Cntr] * SQ[Cntr];
+        Power += SI[Cntr] * SI[Cntr] + SQ[Cntr] * SQ[Cntr];
+        PI[Cntr] = 0.5f * (PI[Cntr] + WI * SI[Cntr] - WQ * SQ[Cntr]);
+        PQ[Cntr] = 0.5f * (PQ[Cntr] + WI * SQ[Cntr] + WQ * SI[Cntr]);
+    }
+    Sums->CrossI = CrossI;
+    Sums->CrossQ = CrossQ;
+    Sums->SecondaryPower = Power;
+}
+
+
+void ResetDiversityCombiner(struct DiversityCombiner* Combiner, float Gain, float Phase)
+{
+    SetDiversityWeight(Combiner, Gain, Phase);
+    Combiner->CrossI = 0.0;
+    Combiner->CrossQ = 0.0;
+    Combiner->SecondaryPower = 0.0;
+    Combiner->Averaging = false;
+}
+
+
+void SetDiversityWeight(struct DiversityCombiner* Combiner, float Gain, float Phase)
+{
+    Combiner->WeightI = Gain * cosf(Phase);
+    Combiner->WeightQ = Gain * sinf(Phase);
+}
+
+
+void RunDiversityCombiner(struct DiversityCombiner* Combiner, uint8_t* Primary, const uint8_t* Secondary,
+                          uint32_t SampleCount, uint32_t TimeConstant)
+{
+    float PI[VDIVERSITYBLOCK], PQ[VDIVERSITYBLOCK], SI[VDIVERSITYBLOCK], SQ[VDIVERSITYBLOCK];
+    struct DiversitySums Sums;
+    double CrossI = 0.0, CrossQ = 0.0, Power = 0.0;
+    double Alpha;
+    uint32_t Total = SampleCount;
+    uint32_t Block, Cntr;
+
+    while (SampleCount != 0)
+    {
+        Block = (SampleCount < VDIVERSITYBLOCK) ? SampleCount : VDIVERSITYBLOCK;
+        for (Cntr = 0; Cntr < Block; Cntr++)
+        {
+            PI[Cntr] = Get24(Primary + Cntr * 6);
+            PQ[Cntr] = Get24(Primary + Cntr * 6 + 3);
+            SI[Cntr] = Get24(Secondary + Cntr * 6);
+            SQ[Cntr] = Get24(Secondary + Cntr * 6 + 3);
+        }
+        DiversityKernel(PI, PQ, SI, SQ, Block, Combiner->WeightI, Combiner->WeightQ, &Sums);
+        for (Cntr = 0; Cntr < Block; Cntr++)
+        {
+            Put24(Primary + Cntr * 6, PI[Cntr]);
+            Put24(Primary + Cntr * 6 + 3, PQ[Cntr]);
+        }
+        CrossI += Sums.CrossI;
+        CrossQ += Sums.CrossQ;
+        Power += Sums.SecondaryPower;
+        Primary += Block * 6;
+        Secondary += Block * 6;
+        SampleCount -= Block;
+    }
+    if ((TimeConstant == 0) || (Total == 0))
+        return;
+    //
+    // adaptive: a first order average of the per sample sums, then the weight from them
+    //
+    Alpha = Combiner->Averaging ? (double)Total / ((double)Total + TimeConstant) : 1.0;
+    Combiner->CrossI += Alpha * (CrossI / Total - Combiner->CrossI);
+    Combiner->CrossQ += Alpha * (CrossQ / Total - Combiner->CrossQ);
+    Combiner->SecondaryPower += Alpha * (Power / Total - Combiner->SecondaryPower);
+    Combiner->Averaging = true;
+    if (Combiner->SecondaryPower > 1.0)                         // else keep the weight: no secondary signal
+    {
+        Combiner->WeightI = (float)(Combiner->CrossI / Combiner->SecondaryPower);
+        Combiner->WeightQ = (float)(Combiner->CrossQ / Combiner->SecondaryPower);
+    }
+}
+
+
+void GetDiversityWeight(struct DiversityCombiner* Combiner, float* Gain, float* Phase)
+{
+    *Gain = hypotf(Combiner->WeightI, Combiner->WeightQ);
+    *Phase = atan2f(Combiner->WeightQ, Combiner->WeightI);
+}
+
+
+const char* GetDiversityKernelName(void)
+{
+#ifdef VDIVERSITYNEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// diversity.h:
+// diversity combining of two phase locked DDC streams
+//
+// the combined sample is the mean of the primary sample and the secondary
+// sample times a complex weight: out = (P + W * S) / 2.
+// the weight can be fixed (a gain and phase, as a diversity control on the PC
+// would set) or adaptive: W = <P * conj(S)> / <|S|^2>, the averages taken over a
+// time constant. That is the weight that best matches the secondary to the
+// primary, so the wanted signal adds in phase and each branch counts in
+// proportion to how strongly it carries it: maximal ratio combining, for
+// branches with equal noise.
+// samples are 24 bit I then Q, big endian, as DemuxDDCSamples() writes them.
+// With USENEON defined (make USENEON=1) on a 64 bit ARM target the complex
+// multiply and accumulate is done 4 samples at a time.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __diversity_h
+#define __diversity_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+struct DiversityCombiner
+{
+    float WeightI;                              // secondary weight, real and imaginary parts
+    float WeightQ;
+    double CrossI;                              // adaptive: averaged P * conj(S)
+    double CrossQ;
+    double SecondaryPower;                      // adaptive: averaged |S|^2
+    bool Averaging;                             // false until the first block has been averaged
+};
+
+
+//
+// ResetDiversityCombiner(struct DiversityCombiner* Combiner, float Gain, float Phase)
+// start again with a fixed weight of Gain at Phase radians, and no adaptive history
+//
+void ResetDiversityCombiner(struct DiversityCombiner* Combiner, float Gain, float Phase);
+
+
+//
+// SetDiversityWeight(struct DiversityCombiner* Combiner, float Gain, float Phase)
+// change the fixed weight
+//
+void SetDiversityWeight(struct DiversityCombiner* Combiner, float Gain, float Phase);
+
+
+//
+// RunDiversityCombiner(struct DiversityCombiner* Combiner, uint8_t* Primary, const uint8_t* Secondary,
+//                      uint32_t SampleCount, uint32_t TimeConstant)
+// combine SampleCount secondary samples into the primary samples, in place.
+// TimeConstant is the adaptive averaging time in samples; 0 keeps the weight fixed.
+// an adaptive weight is updated after each call, from the samples it was given.
+//
+void RunDiversityCombiner(struct DiversityCombiner* Combiner, uint8_t* Primary, const uint8_t* Secondary,
+                          uint32_t SampleCount, uint32_t TimeConstant);
+
+
+//
+// GetDiversityWeight(struct DiversityCombiner* Combiner, float* Gain, float* Phase)
+// the weight in use: gain, and phase in radians
+//
+void GetDiversityWeight(struct DiversityCombiner* Combiner, float* Gain, float* Phase);
+
+
+//
+// GetDiversityKernelName(void)
+// return a string saying which kernel the combiner uses
+//
+const char* GetDiversityKernelName(void);
+
+
+#endif
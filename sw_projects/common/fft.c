@@ -0,0 +1,131 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// fft.c:
+// radix 2 complex FFT on separate I and Q float arrays
+//
+// decimation in time: after the bit reversed input, stage s combines pairs
+// of transforms of 2^s points. The twiddles of each stage are stored
+// together, so with USENEON defined (make USENEON=1) on an ARM target the
+// butterflies of every stage of 4 or more are done 4 at a time.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../common/fft.h"
+
+#if defined(USENEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VFFTNEON 1
+#endif
+
+
+//
+// make the twiddle and bit reverse tables
+//
+bool CreateFFT(struct SplitFFT* FFT, uint32_t Size, bool Inverse)
+{
+    uint32_t Bits = 0;
+    uint32_t Half, Cntr, Bit;
+    double Sign = Inverse ? 1.0 : -1.0;
+
+    memset(FFT, 0, sizeof(struct SplitFFT));
+    if ((Size < 2) || (Size > VMAXFFTSIZE) || (Size & (Size - 1)))
+        return true;
+    while ((1U << Bits) < Size)
+        Bits++;
+    FFT->Memory = calloc(1, Size * 2 * sizeof(float) + Size * sizeof(uint16_t));
+    if (FFT->Memory == NULL)
+        return true;
+    FFT->Size = Size;
+    FFT->TwiddleI = (float*)FFT->Memory;
+    FFT->TwiddleQ = FFT->TwiddleI + Size;
+    FFT->BitReverse = (uint16_t*)(FFT->TwiddleQ + Size);
+    for (Half = 1; Half < Size; Half <<= 1)
+        for (Cntr = 0; Cntr < Half; Cntr++)
+        {
+            FFT->TwiddleI[Half - 1 + Cntr] = cos(M_PI * Cntr / Half);
+            FFT->TwiddleQ[Half - 1 + Cntr] = Sign * sin(M_PI * Cntr / Half);
+        }
+    for (Cntr = 0; Cntr < Size; Cntr++)
+    {
+        FFT->BitReverse[Cntr] = 0;
+        for (Bit = 0; Bit < Bits; Bit++)
+            if (Cntr & (1 << Bit))
+                FFT->BitReverse[Cntr] |= 1 << (Bits - 1 - Bit);
+    }
+    return false;
+}
+
+
+//
+// in place transform of bit reversed data
+//
+void RunFFT(const struct SplitFFT* FFT, float* XI, float* XQ)
+{
+    const float* WI;
+    const float* WQ;
+    uint32_t Half, Group, Cntr, A, B;
+    float TI, TQ;
+#ifdef VFFTNEON
+    float32x4_t AI, AQ, BI, BQ, VWI, VWQ, VTI, VTQ;
+#endif
+
+    for (Half = 1; Half < FFT->Size; Half <<= 1)
+    {
+        WI = FFT->TwiddleI + Half - 1;
+        WQ = FFT->TwiddleQ + Half - 1;
+        for (Group = 0; Group < FFT->Size; Group += 2 * Half)
+        {
+            Cntr = 0;
+#ifdef VFFTNEON
+            for (; (Cntr + 4) <= Half; Cntr += 4)
+            {
+                A = Group + Cntr;
+                B = A + Half;
+                AI = vld1q_f32(XI + A);
+                AQ = vld1q_f32(XQ + A);
+                BI = vld1q_f32(XI + B);
+                BQ = vld1q_f32(XQ + B);
+                VWI = vld1q_f32(WI + Cntr);
+                VWQ = vld1q_f32(WQ + Cntr);
+                VTI = vmlsq_f32(vmulq_f32(BI, VWI), BQ, VWQ);
+                VTQ = vmlaq_f32(vmulq_f32(BI, VWQ), BQ, VWI);
+                vst1q_f32(XI + B, vsubq_f32(AI, VTI));
+                vst1q_f32(XQ + B, vsubq_f32(AQ, VTQ));
+                vst1q_f32(XI + A, vaddq_f32(AI, VTI));
+                vst1q_f32(XQ + A, vaddq_f32(AQ, VTQ));
+            }
+#endif
+            for (; Cntr < Half; Cntr++)
+            {
+                A = Group + Cntr;
+                B = A + Half;
+                TI = XI[B] * WI[Cntr] - XQ[B] * WQ[Cntr];
+                TQ = XI[B] * WQ[Cntr] + XQ[B] * WI[Cntr];
+                XI[B] = XI[A] - TI;
+                XQ[B] = XQ[A] - TQ;
+                XI[A] += TI;
+                XQ[A] += TQ;
+            }
+        }
+    }
+}
+
+
+//
+// release the tables
+//
+void FreeFFT(struct SplitFFT* FFT)
+{
+    free(FFT->Memory);
+    memset(FFT, 0, sizeof(struct SplitFFT));
+}
@@ -0,0 +1,63 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// fft.h:
+// radix 2 complex FFT on separate I and Q float arrays
+//
+// the data is put into the arrays in bit reversed order (BitReverse[n] is
+// where sample n goes), so the caller can combine that with its own input
+// processing; the transform then runs in place and leaves natural order.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __fft_h
+#define __fft_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VMAXFFTSIZE 65536                       // largest transform (bit reverse table is 16 bit)
+
+
+struct SplitFFT
+{
+    uint32_t Size;                              // points; a power of 2
+    float* TwiddleI;                            // Size-1 twiddle factors, stage by stage
+    float* TwiddleQ;
+    uint16_t* BitReverse;                       // input position of each sample
+    void* Memory;                               // one allocation for the tables
+};
+
+
+//
+// CreateFFT(struct SplitFFT* FFT, uint32_t Size, bool Inverse)
+// make the tables for a Size point transform (a power of 2, 2...VMAXFFTSIZE).
+// Inverse selects exp(+j...) twiddles. Neither direction is scaled.
+// return true if error
+//
+bool CreateFFT(struct SplitFFT* FFT, uint32_t Size, bool Inverse);
+
+
+//
+// RunFFT(const struct SplitFFT* FFT, float* XI, float* XQ)
+// transform Size points in place. The input must be in bit reversed order.
+// uses NEON for the butterflies of the wider stages if built with USENEON=1 on an ARM target
+//
+void RunFFT(const struct SplitFFT* FFT, float* XI, float* XQ);
+
+
+//
+// FreeFFT(struct SplitFFT* FFT)
+// release the tables
+//
+void FreeFFT(struct SplitFFT* FFT);
+
+
+#endif
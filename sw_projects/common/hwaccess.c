@@ -22,47 +22,474 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #define VMEMBUFFERSIZE 32768										// memory buffer to reserve
 #define AXIBaseAddress 0x10000									// address of StreamRead/Writer IP
 
 #include "../common/hwaccess.h"
+#include "../common/regprofile.h"
+#include "../../linuxdriver/xdma/cdev_sgdma.h"
 
 
 //
-// mem read/write variables:
+// memory mapped register access
+// each board's user BAR is mapped once when it is opened; register reads & writes are then
+// plain volatile loads and stores, with no syscall. If the map fails, or for an address
+// beyond the mapped window, pread/pwrite on the device are used instead.
 //
-	int register_fd;                             // device identifier
+#define VMAXREGISTERMAP 0x100000                        // largest BAR window to try mapping (1MB)
+#define VMINREGISTERMAP 0x20000                         // smallest useful window: all registers + keyer RAM
+#define VMAXBYPASSMAP 0x1000000                         // largest DMA bypass BAR window to try mapping (16MB)
+#define VMINBYPASSMAP 0x10000                           // smallest tried
 
+//
+// Saturn boards, indexed by XDMA driver instance. The calls without a device
+// argument go to the calling thread's selected board, else to the default board.
+//
+static struct SaturnDevice SaturnDevices[VMAXSATURNDEVICES];
+static uint32_t DefaultDeviceIndex = 0;                 // board OpenXDMADriver() opens
+static struct SaturnDevice* DefaultDevice = NULL;       // board opened by OpenXDMADriver(), or NULL
+static __thread struct SaturnDevice* ThreadDevice = NULL;   // board selected by this thread, or NULL
+static struct SaturnDevice ClosedDevice = {0, false, -1, NULL, 0, false, NULL, 0, 0, -1, NULL, 0};  // used while no board is open
+
+static const struct HardwareBackend* HWBackend = NULL;  // installed backend, or NULL for the XDMA driver
+static const struct RegisterWriteQueue* WriteQueue = NULL;  // installed write queue, or NULL
+static __thread bool QueueingWrites = false;            // true between Begin/EndQueuedRegisterWrites()
+
+//
+// buffers registered with the driver (DMARegisterBuffer), kept to unregister them.
+// the driver itself spots reads and writes that lie in a registered buffer.
+//
+#define VMAXREGISTEREDBUFFERS 8
+
+struct RegisteredDMABuffer
+{
+    int fd;                                             // device, or -1 if released
+    unsigned char* Base;
+    uint32_t Length;
+    uint32_t Id;                                        // driver buffer id
+};
+
+static struct RegisteredDMABuffer RegisteredBuffers[VMAXREGISTEREDBUFFERS];
+static uint32_t RegisteredBufferCount = 0;
+static pthread_mutex_t RegisteredBufferMutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 
+
+//
+// map the user BAR. The BAR size isn't known here: the driver refuses a map larger than the BAR,
+// so try from 1MB downwards until one succeeds
+//
+static void MapRegisterSpace(struct SaturnDevice* Device)
+{
+    uint32_t Size;
+    void* Map;
+
+    for (Size = VMAXREGISTERMAP; Size >= VMINREGISTERMAP; Size >>= 1)
+    {
+        Map = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Device->RegisterFd, 0);
+        if (Map != MAP_FAILED)
+        {
+            Device->RegisterBase = (volatile uint32_t*)Map;
+            Device->RegisterMapSize = Size;
+            Device->UseMappedRegisters = true;
+            printf("register access memory mapped, %dKB window\n", Size / 1024);
+            return;
+        }
+    }
+    printf("register memory map failed; using pread/pwrite\n");
+}
+
+
+//
+// install a hardware backend in place of the XDMA driver
+//
+void SetHardwareBackend(const struct HardwareBackend* Backend)
+{
+    HWBackend = Backend;
+}
+
+
+bool IsHardwareBackendInstalled(void)
+{
+    return (HWBackend != NULL);
+}
+
+
+//
+// install a register write queue
+//
+void SetRegisterWriteQueue(const struct RegisterWriteQueue* Queue)
+{
+    WriteQueue = Queue;
+    if (Queue != NULL)
+        printf("register writes through %s queue\n", Queue->Name);
+}
+
+
+void BeginQueuedRegisterWrites(void)
+{
+    if (WriteQueue == NULL)
+        return;
+    WriteQueue->BeginGroup();
+    QueueingWrites = true;
+}
+
+
+void EndQueuedRegisterWrites(void)
+{
+    if (!QueueingWrites)
+        return;
+    QueueingWrites = false;
+    WriteQueue->EndGroup();
+}
+
+
+//
+// offer a register write to the installed queue. returns true if it was taken;
+// if not, the writes already queued are let go first and the caller writes it
+//
+static inline bool QueueRegisterWrite(struct SaturnDevice* Device, uint32_t Address, uint32_t Data)
+{
+    if (WriteQueue == NULL)
+        return false;
+    if (QueueingWrites && WriteQueue->Queue(Device, Address, Data))
+        return true;
+    WriteQueue->Drain();
+    return false;
+}
+
+
+//
+// before a register read: let the queued writes go first
+//
+static inline void DrainRegisterWriteQueue(void)
+{
+    if (WriteQueue != NULL)
+        WriteQueue->Drain();
+}
+
+
+//
+// the board that the calls without a device argument go to
+//
+static inline struct SaturnDevice* CurrentDevice(void)
+{
+    if (ThreadDevice != NULL)
+        return ThreadDevice;
+    if (DefaultDevice != NULL)
+        return DefaultDevice;
+    return &ClosedDevice;
+}
+
+
+//
+// choose the board OpenXDMADriver() opens
+//
+bool SetSaturnDeviceIndex(uint32_t Index)
+{
+    if (Index >= VMAXSATURNDEVICES)
+    {
+        printf("board must be 0 to %d\n", VMAXSATURNDEVICES - 1);
+        return true;
+    }
+    DefaultDeviceIndex = Index;
+    return false;
+}
+
+
+//
+// open register access to board Index: /dev/xdma<Index>_user
+// with a backend installed there is no device to open: every board is the backend
+//
+struct SaturnDevice* OpenSaturnDevice(uint32_t Index)
+{
+    struct SaturnDevice* Device;
+    char Path[32];
+
+    if (Index >= VMAXSATURNDEVICES)
+        return NULL;
+    Device = SaturnDevices + Index;
+    if (Device->Open)
+        return Device;
+    Device->Index = Index;
+    Device->RegisterFd = -1;
+    Device->RegisterBase = NULL;
+    Device->RegisterMapSize = 0;
+    Device->UseMappedRegisters = false;
+    Device->WriteCombineBase = NULL;
+    Device->WriteCombineAddress = 0;
+    Device->WriteCombineSize = 0;
+    Device->BypassFd = -1;
+    Device->BypassBase = NULL;
+    Device->BypassMapSize = 0;
+    if (HWBackend == NULL)
+    {
+        snprintf(Path, sizeof(Path), "/dev/xdma%u_user", Index);
+        if ((Device->RegisterFd = open(Path, O_RDWR)) == -1)
+        {
+            printf("register R/W address space not available\n");
+            return NULL;
+        }
+        printf("register access connected to %s\n", Path);
+        MapRegisterSpace(Device);
+    }
+    Device->Open = true;
+    return Device;
+}
+
+
+//
+// close a board's register access
+//
+void CloseSaturnDevice(struct SaturnDevice* Device)
+{
+    if ((Device == NULL) || !Device->Open)
+        return;
+    if (Device->RegisterBase != NULL)
+        munmap((void*)Device->RegisterBase, Device->RegisterMapSize);
+    Device->RegisterBase = NULL;
+    Device->RegisterMapSize = 0;
+    Device->UseMappedRegisters = false;
+    if (Device->WriteCombineBase != NULL)
+        munmap((void*)Device->WriteCombineBase, Device->WriteCombineSize);
+    Device->WriteCombineBase = NULL;
+    Device->WriteCombineSize = 0;
+    if (Device->BypassBase != NULL)
+        munmap((void*)Device->BypassBase, Device->BypassMapSize);
+    Device->BypassBase = NULL;
+    Device->BypassMapSize = 0;
+    if (Device->BypassFd != -1)
+        close(Device->BypassFd);
+    Device->BypassFd = -1;
+    if (Device->RegisterFd != -1)
+        close(Device->RegisterFd);
+    Device->RegisterFd = -1;
+    Device->Open = false;
+    if (DefaultDevice == Device)
+        DefaultDevice = NULL;
+}
+
+
+//
+// set the calling thread's board; NULL returns it to the default board
+//
+void SelectSaturnDevice(struct SaturnDevice* Device)
+{
+    ThreadDevice = Device;
+}
+
+
+//
+// the calling thread's board, or NULL if none is open
+//
+struct SaturnDevice* GetSaturnDevice(void)
+{
+    return (ThreadDevice != NULL) ? ThreadDevice : DefaultDevice;
+}
+
+
+//
+// device name on the calling thread's board: /dev/xdma0_c2h_0 -> /dev/xdma<n>_c2h_0
+// names that are not on board 0 are copied unchanged
+//
+const char* SaturnDevicePath(const char* Path, char* Name, uint32_t Size)
+{
+    uint32_t Index;
+
+    Index = (ThreadDevice != NULL) ? ThreadDevice->Index : DefaultDeviceIndex;
+    if ((Index != 0) && (strncmp(Path, VBOARD0DEVICEPREFIX, strlen(VBOARD0DEVICEPREFIX)) == 0))
+        snprintf(Name, Size, "/dev/xdma%u_%s", Index, Path + strlen(VBOARD0DEVICEPREFIX));
+    else
+        snprintf(Name, Size, "%s", Path);
+    return Name;
+}
+
+
 //
 // open connection to the XDMA device driver for register and DMA access
 //
 int OpenXDMADriver(void)
 {
-    int Result = 0;
-	if ((register_fd = open("/dev/xdma0_user", O_RDWR)) == -1)
+    if (HWBackend != NULL)
+        printf("register and DMA access through %s backend\n", HWBackend->Name);
+    DefaultDevice = OpenSaturnDevice(DefaultDeviceIndex);
+    return (DefaultDevice != NULL) ? 1 : 0;
+}
+
+
+//
+// close the register devices of all boards
+//
+void CloseXDMADriver(void)
+{
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < VMAXSATURNDEVICES; Cntr++)
+        CloseSaturnDevice(SaturnDevices + Cntr);
+}
+
+
+//
+// open a DMA device, on the calling thread's board
+//
+int OpenDMADevice(const char* Path, int Flags)
+{
+    char Name[64];
+
+    if (HWBackend != NULL)
+        return HWBackend->OpenDMADevice(Path, Flags);
+    return open(SaturnDevicePath(Path, Name, sizeof(Name)), Flags);
+}
+
+
+//
+// select memory mapped (if available) or syscall register access
+//
+void SetRegisterAccessMapped(bool Mapped)
+{
+    struct SaturnDevice* Device = CurrentDevice();
+
+    Device->UseMappedRegisters = Mapped && (Device->RegisterBase != NULL);
+}
+
+
+//
+// report whether registers are accessed through the memory map
+//
+bool GetRegisterAccessMapped(void)
+{
+    return CurrentDevice()->UseMappedRegisters;
+}
+
+
+//
+// map a RAM-like range write-combined, at the driver's flagged offset
+//
+bool MapWriteCombinedRegisters(uint32_t Address, uint32_t Size)
+{
+    struct SaturnDevice* Device = CurrentDevice();
+    uint32_t PageSize = (uint32_t)sysconf(_SC_PAGESIZE);
+    void* Map;
+
+    if (HWBackend != NULL)
     {
-		printf("register R/W address space not available\n");
+        printf("write-combined registers: not available with the %s backend\n", HWBackend->Name);
+        return true;
     }
-    else
+    if ((Device->RegisterFd == -1) || (Device->WriteCombineBase != NULL))
+        return true;
+    if ((Address % PageSize) != 0)
     {
-		printf("register access connected to /dev/xdma0_user\n");
-        Result = 1;
+        printf("write-combined registers: 0x%05X is not page aligned\n", Address);
+        return true;
     }
-    return Result;
+    Size = (Size + PageSize - 1) & ~(PageSize - 1);
+    Map = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Device->RegisterFd,
+               (off_t)(XDMA_MMAP_WC_OFFSET | Address));
+    if (Map == MAP_FAILED)
+    {
+        printf("write-combined registers: map of 0x%05X failed (%s); driver without write combining?\n",
+               Address, strerror(errno));
+        return true;
+    }
+    Device->WriteCombineBase = (volatile uint32_t*)Map;
+    Device->WriteCombineAddress = Address;
+    Device->WriteCombineSize = Size;
+    printf("registers 0x%05X to 0x%05X mapped write-combined\n", Address, Address + Size - 1);
+    return false;
+}
+
+
+//
+// store barrier for a write-combined map: the merged stores are made before any later
+// store. On arm the map is Normal non-cacheable memory, not Device, so a DSB is needed.
+//
+static inline void FlushWriteCombined(void)
+{
+#if defined(__aarch64__) || defined(__arm__)
+    __asm__ volatile("dsb st" : : : "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+    __asm__ volatile("sfence" : : : "memory");
+#else
+    __sync_synchronize();
+#endif
 }
 
 
 
 
+//
+// register a persistent DMA buffer for device fd
+// return true if error
+//
+bool DMARegisterBuffer(int fd, unsigned char* Buffer, uint32_t Length)
+{
+    struct xdma_buf_ioctl Reg;
+    struct RegisteredDMABuffer* Entry;
+    uint32_t Count;
+    uint32_t Cntr;
+    bool Error = true;
+
+    if (HWBackend != NULL)
+        return true;                                // driver feature: not available
+    pthread_mutex_lock(&RegisteredBufferMutex);
+    Count = RegisteredBufferCount;
+    for (Cntr = 0; Cntr < Count; Cntr++)            // reuse a released slot
+        if (RegisteredBuffers[Cntr].fd < 0)
+            break;
+    if (Cntr < VMAXREGISTEREDBUFFERS)
+    {
+        memset(&Reg, 0, sizeof(Reg));
+        Reg.addr = (uint64_t)(uintptr_t)Buffer;
+        Reg.len = Length;
+        if (ioctl(fd, IOCTL_XDMA_BUF_REGISTER, &Reg) == 0)
+        {
+            Entry = RegisteredBuffers + Cntr;
+            Entry->Base = Buffer;
+            Entry->Length = Length;
+            Entry->Id = Reg.id;
+            Entry->fd = fd;
+            if (Cntr == Count)
+                RegisteredBufferCount++;
+            Error = false;
+        }
+    }
+    pthread_mutex_unlock(&RegisteredBufferMutex);
+    return Error;
+}
+
+
+//
+// release the buffers registered for fd
+//
+void DMAUnregisterBuffers(int fd)
+{
+    uint32_t Cntr;
+
+    pthread_mutex_lock(&RegisteredBufferMutex);
+    for (Cntr = 0; Cntr < RegisteredBufferCount; Cntr++)
+    {
+        if (RegisteredBuffers[Cntr].fd == fd)
+        {
+            RegisteredBuffers[Cntr].fd = -1;
+            ioctl(fd, IOCTL_XDMA_BUF_UNREGISTER, RegisteredBuffers[Cntr].Id);
+        }
+    }
+    pthread_mutex_unlock(&RegisteredBufferMutex);
+}
+
+
 //
 // initiate a DMA to the FPGA with specified parameters
 // returns 1 if success, else 0
@@ -76,22 +503,22 @@ int DMAWriteToFPGA(int fd, unsigned char*SrcData, uint32_t Length, uint32_t AXIA
 	ssize_t rc;									// response code
 	off_t OffsetAddr;
 
+	if (HWBackend != NULL)
+		return HWBackend->DMAWrite(fd, SrcData, Length, AXIAddr);
 	OffsetAddr = AXIAddr;
-	rc = lseek(fd, OffsetAddr, SEEK_SET);
-	if (rc != OffsetAddr)
-	{
-		printf("seek off 0x%lx != 0x%lx.\n", rc, OffsetAddr);
-		perror("seek file");
-		return -EIO;
-	}
-
-	// write data to FPGA from memory buffer
-	rc = write(fd, SrcData, Length);
+	// write data to FPGA from memory buffer. pwrite() sets the AXI address in the same syscall
+	rc = pwrite(fd, SrcData, Length, OffsetAddr);
 	if (rc < 0)
 	{
+		rc = -errno;
 		printf("write 0x%x @ 0x%lx failed %ld.\n", Length, OffsetAddr, rc);
 		perror("DMA write");
-		return -EIO;
+		return (int)rc;
+	}
+	if ((uint32_t)rc != Length)
+	{
+		printf("write 0x%x @ 0x%lx: only 0x%lx written\n", Length, OffsetAddr, rc);
+		return -ENODATA;
 	}
 	return 0;
 }
@@ -109,34 +536,508 @@ int DMAReadFromFPGA(int fd, unsigned char*DestData, uint32_t Length, uint32_t AX
 	ssize_t rc;									// response code
 	off_t OffsetAddr;
 
+	if (HWBackend != NULL)
+		return HWBackend->DMARead(fd, DestData, Length, AXIAddr);
 	OffsetAddr = AXIAddr;
-	rc = lseek(fd, OffsetAddr, SEEK_SET);
-	if (rc != OffsetAddr)
-	{
-		printf("seek off 0x%lx != 0x%lx.\n", rc, OffsetAddr);
-		perror("seek file");
-		return -EIO;
-	}
-
-	// write data to FPGA from memory buffer
-	rc = read(fd, DestData, Length);
+	// read data from FPGA to memory buffer. pread() sets the AXI address in the same syscall
+	rc = pread(fd, DestData, Length, OffsetAddr);
 	if (rc < 0)
 	{
+		rc = -errno;
 		printf("read 0x%x @ 0x%lx failed %ld.\n", Length, OffsetAddr, rc);
 		perror("DMA read");
-		return -EIO;
+		return (int)rc;
+	}
+	if ((uint32_t)rc != Length)
+	{
+		printf("read 0x%x @ 0x%lx: only 0x%lx read\n", Length, OffsetAddr, rc);
+		return -ENODATA;
 	}
 	return 0;
 }
 
+
+//
+// short read. The driver call is tried until the driver rejects it once; after that,
+// and under a backend, the register read and the DMA are separate calls
+//
+static bool DriverShortRead = true;
+
+int DMAReadAvailableFromFPGA(int fd, unsigned char* DestData, struct DMAShortRead* Read)
+{
+    struct xdma_read_available Request;
+    uint64_t Available;
+
+    if ((HWBackend == NULL) && DriverShortRead)
+    {
+        memset(&Request, 0, sizeof(Request));
+        Request.addr = (uint64_t)(uintptr_t)DestData;
+        Request.ep_addr = Read->AXIAddr;
+        Request.min_len = Read->MinLength;
+        Request.max_len = Read->MaxLength;
+        Request.granule = Read->Granule;
+        Request.status_reg = Read->StatusAddr;
+        Request.depth_mask = Read->DepthMask;
+        Request.word_bytes = Read->WordBytes;
+        if (ioctl(fd, IOCTL_XDMA_READ_AVAILABLE, &Request) == 0)
+        {
+            Read->Length = Request.len;
+            Read->Status = Request.status;
+            return 0;
+        }
+        if ((errno != ENOTTY) && (errno != EINVAL))
+            return -errno;
+        printf("DMA short read: not supported by the driver; reading the FIFO depth separately\n");
+        DriverShortRead = false;
+    }
+    Read->Status = RegisterRead(Read->StatusAddr);
+    Available = (uint64_t)(Read->Status & Read->DepthMask) * Read->WordBytes;
+    if (Available > Read->MaxLength)
+        Available = Read->MaxLength;
+    Available -= Available % Read->Granule;
+    Read->Length = 0;
+    if ((Available == 0) || (Available < Read->MinLength))
+        return 0;
+    Read->Length = (uint32_t)Available;
+    return DMAReadFromFPGA(fd, DestData, Read->Length, Read->AXIAddr);
+}
+
+
+//
+// map the DMA bypass BAR. As for the user BAR its size isn't known here, so try
+// from 16MB downwards until the driver accepts one
+//
+bool OpenDMABypass(void)
+{
+    struct SaturnDevice* Device = CurrentDevice();
+    char Path[32];
+    uint32_t Size;
+    void* Map;
+
+    if (HWBackend != NULL)
+    {
+        printf("DMA bypass: not available with the %s backend\n", HWBackend->Name);
+        return true;
+    }
+    if (!Device->Open)
+        return true;
+    if (Device->BypassBase != NULL)
+        return false;
+    snprintf(Path, sizeof(Path), "/dev/xdma%u_bypass", Device->Index);
+    if ((Device->BypassFd = open(Path, O_RDWR)) == -1)
+    {
+        printf("DMA bypass: %s not available (%s); FPGA built without the bypass BAR?\n", Path, strerror(errno));
+        return true;
+    }
+    for (Size = VMAXBYPASSMAP; Size >= VMINBYPASSMAP; Size >>= 1)
+    {
+        Map = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Device->BypassFd, 0);
+        if (Map != MAP_FAILED)
+        {
+            Device->BypassBase = (volatile uint64_t*)Map;
+            Device->BypassMapSize = Size;
+            printf("DMA bypass BAR memory mapped, %dKB window\n", Size / 1024);
+            return false;
+        }
+    }
+    printf("DMA bypass: memory map failed\n");
+    close(Device->BypassFd);
+    Device->BypassFd = -1;
+    return true;
+}
+
+
+bool DMABypassCovers(uint32_t AXIAddr, uint32_t Length)
+{
+    struct SaturnDevice* Device = CurrentDevice();
+
+    return (Device->BypassBase != NULL) && ((AXIAddr & 7) == 0) && ((Length & 7) == 0)
+        && ((uint64_t)AXIAddr + Length <= Device->BypassMapSize);
+}
+
+
+//
+// one 64 bit load or store per 8 bytes: each is a single 8 byte PCIe read or write,
+// and the FIFO reader/writer takes one word per AXI beat as a DMA burst would give it
+//
+int DMABypassWriteToFPGA(const unsigned char* SrcData, uint32_t Length, uint32_t AXIAddr)
+{
+    volatile uint64_t* Dest;
+    const uint64_t* Src = (const uint64_t*)SrcData;
+    uint32_t Cntr;
+
+    if (!DMABypassCovers(AXIAddr, Length))
+        return -ENODEV;
+    Dest = CurrentDevice()->BypassBase + (AXIAddr >> 3);
+    for (Cntr = 0; Cntr < Length / 8; Cntr++)
+        Dest[Cntr] = Src[Cntr];
+    return 0;
+}
+
+
+int DMABypassReadFromFPGA(unsigned char* DestData, uint32_t Length, uint32_t AXIAddr)
+{
+    volatile uint64_t* Src;
+    uint64_t* Dest = (uint64_t*)DestData;
+    uint32_t Cntr;
+
+    if (!DMABypassCovers(AXIAddr, Length))
+        return -ENODEV;
+    Src = CurrentDevice()->BypassBase + (AXIAddr >> 3);
+    for (Cntr = 0; Cntr < Length / 8; Cntr++)
+        Dest[Cntr] = Src[Cntr];
+    return 0;
+}
+
+
+//
+// classify a DMA failure. When a transfer doesn't complete in its timeout the XDMA
+// driver aborts it, stops the engine and returns the kernel's ERESTARTSYS, which
+// reaches user space as errno 512 when no signal is pending. EIO is an engine error.
+//
+#define VERRNORESTARTSYS 512
+
+EDMAErrorClass ClassifyDMAError(int Result)
+{
+    if (Result >= 0)
+        return eDMAErrorNone;
+    switch (-Result)
+    {
+        case VERRNORESTARTSYS:
+        case ETIMEDOUT:
+        case ETIME:
+            return eDMAErrorTimeout;
+        case EINTR:
+            return eDMAErrorInterrupted;
+        case ENODATA:
+            return eDMAErrorShort;
+        default:
+            return eDMAErrorEngine;
+    }
+}
+
+
+const char* GetDMAErrorClassName(EDMAErrorClass Class)
+{
+    static const char* Names[VNUMDMAERRORCLASSES] = {"none", "timeout", "interrupted", "short", "engine"};
+
+    return (Class < VNUMDMAERRORCLASSES) ? Names[Class] : "unknown";
+}
+
+
+//
+// reset a DMA engine by closing and reopening its device
+// the buffer registrations go with the old fd, so any are made again
+//
+int ReopenDMADevice(int fd, const char* Path, int Flags)
+{
+    struct xdma_buf_ioctl Reg;
+    struct RegisteredDMABuffer* Entry;
+    int NewFd;
+    uint32_t Cntr;
+
+    pthread_mutex_lock(&RegisteredBufferMutex);
+    close(fd);
+    NewFd = OpenDMADevice(Path, Flags);
+    for (Cntr = 0; Cntr < RegisteredBufferCount; Cntr++)
+    {
+        Entry = RegisteredBuffers + Cntr;
+        if (Entry->fd != fd)
+            continue;
+        Entry->fd = -1;
+        if (NewFd < 0)
+            continue;
+        memset(&Reg, 0, sizeof(Reg));
+        Reg.addr = (uint64_t)(uintptr_t)Entry->Base;
+        Reg.len = Entry->Length;
+        if (ioctl(NewFd, IOCTL_XDMA_BUF_REGISTER, &Reg) == 0)
+        {
+            Entry->fd = NewFd;
+            Entry->Id = Reg.id;
+        }
+    }
+    pthread_mutex_unlock(&RegisteredBufferMutex);
+    if (NewFd < 0)
+        printf("DMA device %s could not be opened again\n", Path);
+    return NewFd;
+}
+
+
+//
+// asynchronous DMA using the kernel AIO syscalls directly (no libaio needed)
+// the XDMA driver implements read_iter/write_iter, so an IOCB_CMD_PREAD is queued
+// to the engine and io_submit() returns without waiting for the transfer.
+//
+static inline int sys_io_setup(unsigned NumEvents, aio_context_t* Context)
+{
+    return syscall(__NR_io_setup, NumEvents, Context);
+}
+
+static inline int sys_io_destroy(aio_context_t Context)
+{
+    return syscall(__NR_io_destroy, Context);
+}
+
+static inline int sys_io_submit(aio_context_t Context, long Count, struct iocb** Requests)
+{
+    return syscall(__NR_io_submit, Context, Count, Requests);
+}
+
+static inline int sys_io_getevents(aio_context_t Context, long MinCount, long MaxCount, struct io_event* Events, struct timespec* Timeout)
+{
+    return syscall(__NR_io_getevents, Context, MinCount, MaxCount, Events, Timeout);
+}
+
+
+//
+// create an AIO context for up to MaxInFlight outstanding transfers on device fd
+// return true if error (then the caller should use the synchronous calls)
+//
+bool DMAAsyncInit(struct DMAAsyncContext* Ctx, int fd, uint32_t MaxInFlight)
+{
+    memset(Ctx, 0, sizeof(struct DMAAsyncContext));
+    if (MaxInFlight > VMAXDMAINFLIGHT)
+        MaxInFlight = VMAXDMAINFLIGHT;
+    Ctx->fd = fd;
+    Ctx->MaxInFlight = MaxInFlight;
+    if (HWBackend != NULL)
+        return true;                                // driver feature: not available
+    if (sys_io_setup(MaxInFlight, &Ctx->Context) != 0)
+    {
+        perror("DMA io_setup");
+        Ctx->Context = 0;
+        return true;
+    }
+    return false;
+}
+
+
+//
+// queue a read of Length bytes from AXIAddr into DestData, using request slot Slot
+// the slot number is returned by DMAAsyncWaitComplete() when the transfer finishes
+// return true if error
+//
+bool DMAAsyncSubmitRead(struct DMAAsyncContext* Ctx, uint32_t Slot, unsigned char* DestData, uint32_t Length, uint32_t AXIAddr)
+{
+    struct iocb* Request;
+
+    if (Slot >= Ctx->MaxInFlight)
+        return true;
+    Request = &Ctx->Requests[Slot];
+    memset(Request, 0, sizeof(struct iocb));
+    Request->aio_data = Slot;
+    Request->aio_lio_opcode = IOCB_CMD_PREAD;
+    Request->aio_fildes = Ctx->fd;
+    Request->aio_buf = (uint64_t)(uintptr_t)DestData;
+    Request->aio_nbytes = Length;
+    Request->aio_offset = AXIAddr;
+    if (sys_io_submit(Ctx->Context, 1, &Request) != 1)
+    {
+        printf("async read 0x%x @ 0x%x submit failed\n", Length, AXIAddr);
+        perror("DMA io_submit");
+        return true;
+    }
+    Ctx->InFlight++;
+    return false;
+}
+
+
+//
+// wait for one submitted transfer to complete
+// returns the bytes transferred (or negative error) and sets *Slot
+// returns -EIO if nothing is in flight
+//
+int DMAAsyncWaitComplete(struct DMAAsyncContext* Ctx, uint32_t* Slot)
+{
+    struct io_event Event;
+    int rc;
+
+    if (Ctx->InFlight == 0)
+        return -EIO;
+    do
+        rc = sys_io_getevents(Ctx->Context, 1, 1, &Event, NULL);
+    while ((rc < 0) && (errno == EINTR));
+    if (rc != 1)
+    {
+        perror("DMA io_getevents");
+        return -EIO;
+    }
+    Ctx->InFlight--;
+    *Slot = (uint32_t)Event.data;
+    if ((int64_t)Event.res < 0)
+        printf("async DMA read failed %lld\n", (long long)(int64_t)Event.res);
+    return (int)(int64_t)Event.res;
+}
+
+
+//
+// wait for any outstanding transfers, then release the AIO context
+//
+void DMAAsyncClose(struct DMAAsyncContext* Ctx)
+{
+    uint32_t Slot;
+
+    if (Ctx->Context == 0)
+        return;
+    while (Ctx->InFlight != 0)
+        if (DMAAsyncWaitComplete(Ctx, &Slot) == -EIO)
+            break;                                  // can't collect them: io_destroy() will wait
+    sys_io_destroy(Ctx->Context);
+    Ctx->Context = 0;
+}
+
+//
+// start the XDMA driver's C2H streaming ring on device fd
+// return true if error (eg a driver without streaming support)
+//
+bool DMAStreamStart(int fd, uint32_t RingSize, uint32_t BlockSize, uint32_t AXIAddr)
+{
+    struct xdma_stream_ioctl Stream;
+
+    if (HWBackend != NULL)
+        return true;                                // driver feature: not available
+    Stream.ring_size = RingSize;
+    Stream.block_size = BlockSize;
+    Stream.ep_addr = AXIAddr;
+    if (ioctl(fd, IOCTL_XDMA_STREAM_START, &Stream) != 0)
+    {
+        perror("DMA stream start");
+        return true;
+    }
+    return false;
+}
+
+
+//
+// tell the driver how much has been consumed; get the write position back
+// return true if error
+//
+bool DMAStreamSync(int fd, uint32_t Tail, uint32_t* Head, uint32_t* Overruns)
+{
+    struct xdma_stream_status Status;
+
+    memset(&Status, 0, sizeof(Status));
+    Status.tail = Tail;
+    if (ioctl(fd, IOCTL_XDMA_STREAM_SYNC, &Status) != 0)
+        return true;
+    *Head = Status.head;
+    *Overruns = Status.overruns;
+    return false;
+}
+
+
+//
+// give an H2C streaming ring's data up to Head to the engine; get back how much it has read
+// return 0 or a negative errno
+//
+int DMAStreamCredit(int fd, uint32_t Head, uint32_t* Tail)
+{
+    struct xdma_stream_status Status;
+
+    memset(&Status, 0, sizeof(Status));
+    Status.head = Head;
+    if (ioctl(fd, IOCTL_XDMA_STREAM_SYNC, &Status) != 0)
+        return -errno;
+    *Tail = Status.tail;
+    return 0;
+}
+
+
+//
+// stop the streaming ring. The ring must be unmapped first: the driver won't
+// stop a mapped ring (EBUSY), or one started through another fd (EPERM).
+//
+void DMAStreamStop(int fd)
+{
+    if (ioctl(fd, IOCTL_XDMA_STREAM_STOP) != 0)
+        perror("DMA stream stop");
+}
+
+
+//
+// write the driver's per engine irq_cpu file: /dev/xdma0_c2h_0 -> /sys/class/xdma/xdma0_c2h_0/irq_cpu
+// return true if error
+//
+//
+// sysfs file Attribute of the driver's device for DMA device Path, on the calling thread's board
+//
+static const char* DMASysfsName(const char* Path, const char* Attribute, char* SysfsName, uint32_t Size)
+{
+    char Name[64];
+    const char* DeviceName;
+
+    Path = SaturnDevicePath(Path, Name, sizeof(Name));
+    DeviceName = strrchr(Path, '/');
+    DeviceName = (DeviceName != NULL) ? DeviceName + 1 : Path;
+    snprintf(SysfsName, Size, "/sys/class/xdma/%s/%s", DeviceName, Attribute);
+    return SysfsName;
+}
+
+
+bool SetDMAInterruptCPU(const char* Path, int CPU)
+{
+    char SysfsName[128];
+    FILE* File;
+    bool Error;
+
+    if (HWBackend != NULL)
+        return true;                                // driver feature: not available
+    File = fopen(DMASysfsName(Path, "irq_cpu", SysfsName, sizeof(SysfsName)), "w");
+    if (File == NULL)
+        return true;
+    Error = (fprintf(File, "%d\n", CPU) < 0);
+    Error |= (fclose(File) != 0);                   // the driver's answer arrives on close
+    return Error;
+}
+
+
+//
+// the stats file is one line: the counts in the order of struct DMAEngineStats
+//
+bool ReadDMAEngineStats(const char* Path, struct DMAEngineStats* Stats)
+{
+    char SysfsName[128];
+    unsigned long long Values[8];
+    FILE* File;
+    int Count;
+
+    memset(Stats, 0, sizeof(*Stats));
+    if (HWBackend != NULL)
+        return true;                                // driver feature: not available
+    File = fopen(DMASysfsName(Path, "stats", SysfsName, sizeof(SysfsName)), "r");
+    if (File == NULL)
+        return true;
+    Count = fscanf(File, "%llu %llu %llu %llu %llu %llu %llu %llu", Values, Values + 1, Values + 2,
+                   Values + 3, Values + 4, Values + 5, Values + 6, Values + 7);
+    fclose(File);
+    if (Count != 8)
+        return true;
+    Stats->Transfers = Values[0];
+    Stats->Bytes = Values[1];
+    Stats->Descriptors = Values[2];
+    Stats->Errors = Values[3];
+    Stats->Timeouts = Values[4];
+    Stats->Interrupts = Values[5];
+    Stats->LatencyNs = Values[6];
+    Stats->MaxLatencyNs = Values[7];
+    return false;
+}
+
+
 //
 // 32 bit register read over the AXILite bus
 //
-uint32_t RegisterRead(uint32_t Address)
+uint32_t DeviceRegisterRead(struct SaturnDevice* Device, uint32_t Address)
 {
 	uint32_t result = 0;
 
-    ssize_t nread = pread(register_fd, &result, sizeof(result), (off_t) Address);
+    DrainRegisterWriteQueue();
+    if (HWBackend != NULL)
+        return HWBackend->RegisterRead(Address);
+    if (Device->UseMappedRegisters && (Address < Device->RegisterMapSize))
+        return Device->RegisterBase[Address >> 2];
+
+    ssize_t nread = pread(Device->RegisterFd, &result, sizeof(result), (off_t) Address);
     if (nread != sizeof(result))
         printf("ERROR: register read: addr=0x%08X   error=%s\n",Address, strerror(errno));
 	
@@ -146,12 +1047,215 @@ uint32_t RegisterRead(uint32_t Address)
 //
 // 32 bit register write over the AXILite bus
 //
-void RegisterWrite(uint32_t Address, uint32_t Data)
+void DeviceRegisterWrite(struct SaturnDevice* Device, uint32_t Address, uint32_t Data)
 {
-    ssize_t nsent = pwrite(register_fd, &Data, sizeof(Data), (off_t) Address); 
+    if (QueueRegisterWrite(Device, Address, Data))
+        return;
+    if (HWBackend != NULL)
+    {
+        HWBackend->RegisterWrite(Address, Data);
+        return;
+    }
+    if (Device->UseMappedRegisters && (Address < Device->RegisterMapSize))
+    {
+        Device->RegisterBase[Address >> 2] = Data;
+        return;
+    }
+    ssize_t nsent = pwrite(Device->RegisterFd, &Data, sizeof(Data), (off_t) Address); 
     if (nsent != sizeof(Data))
         printf("ERROR: Write: addr=0x%08X   error=%s\n",Address, strerror(errno));
 }
 
 
+//
+// block write of consecutive 32 bit registers
+// write-combined: the stores are barriered before and after, so the block is ordered
+// with the uncached register writes either side (eg a RAM, then its length register).
+// mapped: one 32 bit store per word (the AXI-Lite bus takes 32 bit accesses only).
+// syscall: pwrite the whole block; if the driver takes fewer bytes than offered
+// (the XDMA user device transfers one word per call) carry on from where it stopped.
+//
+void DeviceRegisterWriteBlock(struct SaturnDevice* Device, uint32_t Address, const uint32_t* Data, uint32_t Count)
+{
+    const uint8_t* Src = (const uint8_t*)Data;
+    size_t Remaining = (size_t)Count * sizeof(uint32_t);
+    uint32_t Cntr;
+    ssize_t nsent;
+
+    if ((Count != 0) && QueueRegisterWrite(Device, Address, Data[0]))
+    {
+        for (Cntr = 1; Cntr < Count; Cntr++)
+            WriteQueue->Queue(Device, Address + 4 * Cntr, Data[Cntr]);
+        return;
+    }
+    if (HWBackend != NULL)
+    {
+        for (Cntr = 0; Cntr < Count; Cntr++)
+            HWBackend->RegisterWrite(Address + 4 * Cntr, Data[Cntr]);
+        return;
+    }
+    if (Device->UseMappedRegisters && (Device->WriteCombineBase != NULL) && (Address >= Device->WriteCombineAddress)
+        && (Address + Remaining <= Device->WriteCombineAddress + Device->WriteCombineSize))
+    {
+        volatile uint32_t* Dest = Device->WriteCombineBase + ((Address - Device->WriteCombineAddress) >> 2);
+
+        FlushWriteCombined();
+        for (Cntr = 0; Cntr < Count; Cntr++)
+            Dest[Cntr] = Data[Cntr];
+        FlushWriteCombined();
+        return;
+    }
+    if (Device->UseMappedRegisters && (Address + Remaining <= Device->RegisterMapSize))
+    {
+        for (Cntr = 0; Cntr < Count; Cntr++)
+            Device->RegisterBase[(Address >> 2) + Cntr] = Data[Cntr];
+        return;
+    }
+    while (Remaining != 0)
+    {
+        nsent = pwrite(Device->RegisterFd, Src, Remaining, (off_t) Address);
+        if ((nsent <= 0) || (nsent & 3))
+        {
+            printf("ERROR: block write: addr=0x%08X   error=%s\n",Address, strerror(errno));
+            return;
+        }
+        Src += nsent;
+        Address += nsent;
+        Remaining -= nsent;
+    }
+}
+
+
+//
+// block read of consecutive 32 bit registers; as DeviceRegisterWriteBlock()
+//
+void DeviceRegisterReadBlock(struct SaturnDevice* Device, uint32_t Address, uint32_t* Data, uint32_t Count)
+{
+    uint8_t* Dest = (uint8_t*)Data;
+    size_t Remaining = (size_t)Count * sizeof(uint32_t);
+    uint32_t Cntr;
+    ssize_t nread;
+
+    DrainRegisterWriteQueue();
+    if (HWBackend != NULL)
+    {
+        for (Cntr = 0; Cntr < Count; Cntr++)
+            Data[Cntr] = HWBackend->RegisterRead(Address + 4 * Cntr);
+        return;
+    }
+    if (Device->UseMappedRegisters && (Address + Remaining <= Device->RegisterMapSize))
+    {
+        for (Cntr = 0; Cntr < Count; Cntr++)
+            Data[Cntr] = Device->RegisterBase[(Address >> 2) + Cntr];
+        return;
+    }
+    while (Remaining != 0)
+    {
+        nread = pread(Device->RegisterFd, Dest, Remaining, (off_t) Address);
+        if ((nread <= 0) || (nread & 3))
+        {
+            printf("ERROR: block read: addr=0x%08X   error=%s\n",Address, strerror(errno));
+            memset(Dest, 0, Remaining);
+            return;
+        }
+        Dest += nread;
+        Address += nread;
+        Remaining -= nread;
+    }
+}
+
+
+//
+// register access on the calling thread's board
+// while the register profiler is on, each call is timed and counted against its caller.
+// a queued write is timed as far as the queue.
+//
+uint32_t RegisterRead(uint32_t Address)
+{
+    uint64_t Start;
+    uint32_t Value;
+
+    if (!RegisterProfiling)
+        return DeviceRegisterRead(CurrentDevice(), Address);
+    Start = RegisterProfileTime();
+    Value = DeviceRegisterRead(CurrentDevice(), Address);
+    ProfileRegisterAccess(Address, __builtin_return_address(0), eRegProfileRead, NULL, 1, Start);
+    return Value;
+}
+
+
+void RegisterWrite(uint32_t Address, uint32_t Data)
+{
+    uint64_t Start;
+
+    if (!RegisterProfiling)
+    {
+        DeviceRegisterWrite(CurrentDevice(), Address, Data);
+        return;
+    }
+    Start = RegisterProfileTime();
+    DeviceRegisterWrite(CurrentDevice(), Address, Data);
+    ProfileRegisterAccess(Address, __builtin_return_address(0), eRegProfileWrite, &Data, 1, Start);
+}
+
+
+void RegisterWriteBlock(uint32_t Address, const uint32_t* Data, uint32_t Count)
+{
+    uint64_t Start;
+
+    if (!RegisterProfiling)
+    {
+        DeviceRegisterWriteBlock(CurrentDevice(), Address, Data, Count);
+        return;
+    }
+    Start = RegisterProfileTime();
+    DeviceRegisterWriteBlock(CurrentDevice(), Address, Data, Count);
+    ProfileRegisterAccess(Address, __builtin_return_address(0), eRegProfileWriteBlock, Data, Count, Start);
+}
+
+
+//
+// block read, counted against CallSite when profiling
+//
+static void ProfiledRegisterReadBlock(uint32_t Address, uint32_t* Data, uint32_t Count, const void* CallSite)
+{
+    uint64_t Start;
+
+    if (!RegisterProfiling)
+    {
+        DeviceRegisterReadBlock(CurrentDevice(), Address, Data, Count);
+        return;
+    }
+    Start = RegisterProfileTime();
+    DeviceRegisterReadBlock(CurrentDevice(), Address, Data, Count);
+    ProfileRegisterAccess(Address, CallSite, eRegProfileReadBlock, NULL, Count, Start);
+}
+
+
+void RegisterReadBlock(uint32_t Address, uint32_t* Data, uint32_t Count)
+{
+    ProfiledRegisterReadBlock(Address, Data, Count, __builtin_return_address(0));
+}
+
+
+//
+// scatter read: split the address list into runs of consecutive registers,
+// and read each run as a block
+//
+void RegisterReadScatter(const uint32_t* Addresses, uint32_t* Data, uint32_t Count)
+{
+    uint32_t Start = 0;
+    uint32_t Run;
+
+    while (Start < Count)
+    {
+        Run = 1;
+        while (((Start + Run) < Count) && (Addresses[Start + Run] == Addresses[Start] + 4 * Run))
+            Run++;
+        ProfiledRegisterReadBlock(Addresses[Start], Data + Start, Run, __builtin_return_address(0));
+        Start += Run;
+    }
+}
+
+
 
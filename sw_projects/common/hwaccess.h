@@ -16,19 +16,201 @@
 #define __hwaccess_h
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <linux/aio_abi.h>
+
+
+#define VMAXDMAINFLIGHT 4                       // max outstanding async DMA transfers per context
+#define VMAXSATURNDEVICES 4                     // Saturn boards (XDMA driver instances) that can be open
+#define VBOARD0DEVICEPREFIX "/dev/xdma0_"       // device names (eg VDDCDMADEVICE) are given for board 0
+
+
+//
+// one Saturn board: XDMA driver instance Index, with devices /dev/xdma<Index>_...
+// holds the board's register access. Several boards can be open at once: the
+// register and DMA device calls without a device argument go to the calling
+// thread's selected board (SelectSaturnDevice()), or else to the default board
+// opened by OpenXDMADriver().
+//
+struct SaturnDevice
+{
+    uint32_t Index;                             // XDMA driver instance
+    bool Open;
+    int RegisterFd;                             // /dev/xdma<Index>_user, or -1
+    volatile uint32_t* RegisterBase;            // mapped BAR, or NULL
+    uint32_t RegisterMapSize;                   // bytes mapped
+    bool UseMappedRegisters;                    // true if loads & stores are used
+    volatile uint32_t* WriteCombineBase;        // write-combined map of a RAM-like range, or NULL
+    uint32_t WriteCombineAddress;               // register address it starts at
+    uint32_t WriteCombineSize;                  // bytes mapped
+    int BypassFd;                               // /dev/xdma<Index>_bypass, or -1
+    volatile uint64_t* BypassBase;              // mapped DMA bypass BAR, or NULL
+    uint32_t BypassMapSize;                     // bytes mapped
+};
+
+//
+// asynchronous DMA context: one per DMA device
+//
+struct DMAAsyncContext
+{
+    aio_context_t Context;                      // kernel AIO context, 0 if not set up
+    int fd;                                     // XDMA device
+    uint32_t MaxInFlight;                       // request slots in use
+    uint32_t InFlight;                          // transfers submitted but not yet completed
+    struct iocb Requests[VMAXDMAINFLIGHT];      // one request block per slot
+};
+
+
+//
+// classes of DMA failure, from the negative errno a DMA call returns
+//
+typedef enum
+{
+    eDMAErrorNone,                              // the transfer completed
+    eDMAErrorTimeout,                           // the engine did not complete in the driver's timeout
+    eDMAErrorInterrupted,                       // the call was interrupted by a signal
+    eDMAErrorShort,                             // fewer bytes were transferred than requested
+    eDMAErrorEngine,                            // the engine or driver reported an error
+    VNUMDMAERRORCLASSES
+} EDMAErrorClass;
+
+
+//
+// hardware backend
+// register and DMA access normally go to the XDMA driver. Another backend (eg the
+// simulated FPGA in simbackend.c) can be installed instead, before OpenXDMADriver().
+// FIFO depths are read through the FIFO monitor registers, so a backend provides
+// them through its register reads. Async DMA and the streaming ring are driver
+// features: with a backend installed they report not available.
+//
+struct HardwareBackend
+{
+    const char* Name;
+    int (*OpenDMADevice)(const char* Path, int Flags);          // returns fd, or -1 if not present
+    uint32_t (*RegisterRead)(uint32_t Address);
+    void (*RegisterWrite)(uint32_t Address, uint32_t Data);
+    int (*DMARead)(int fd, unsigned char* DestData, uint32_t Length, uint32_t AXIAddr);  // 0, or negative errno
+    int (*DMAWrite)(int fd, unsigned char* SrcData, uint32_t Length, uint32_t AXIAddr);
+};
 
 
 //
-// open connection to the XDMA device driver for register and DMA access
+// install a hardware backend in place of the XDMA driver
+//
+void SetHardwareBackend(const struct HardwareBackend* Backend);
+
+
+//
+// return true if a backend other than the XDMA driver is installed
+//
+bool IsHardwareBackendInstalled(void);
+
+
+//
+// register write queue
+// a queue (eg regqueue.c) can be installed to take register writes from one thread
+// and apply them in order on another. While one is installed, writes made between
+// BeginQueuedRegisterWrites() and EndQueuedRegisterWrites() are passed to Queue() as
+// one group; every other register access calls Drain() first, so it happens after
+// the writes already queued.
+//
+struct RegisterWriteQueue
+{
+    const char* Name;
+    bool (*Queue)(struct SaturnDevice* Device, uint32_t Address, uint32_t Data);  // true if the write was taken
+    void (*Drain)(void);                                        // wait for the queued writes, unless the calling thread applies them
+    void (*BeginGroup)(void);
+    void (*EndGroup)(void);
+};
+
+
+//
+// install a register write queue, or NULL to write straight through again
+//
+void SetRegisterWriteQueue(const struct RegisterWriteQueue* Queue);
+
+
+//
+// BeginQueuedRegisterWrites(void)
+// EndQueuedRegisterWrites(void)
+// pass the register writes this thread makes in between to the queue, as one group.
+// with no queue installed the writes are made straight away as usual.
+//
+void BeginQueuedRegisterWrites(void);
+void EndQueuedRegisterWrites(void);
+
+
+//
+// SetSaturnDeviceIndex(uint32_t Index)
+// choose the board OpenXDMADriver() opens (default 0), before it is called
+// return true if error (Index out of range)
+//
+bool SetSaturnDeviceIndex(uint32_t Index);
+
+
+//
+// open connection to the XDMA device driver for register and DMA access,
+// on the default board. returns 1 if success, else 0
 //
 int OpenXDMADriver(void);
 
 
+//
+// close the register access of all open boards
+//
+void CloseXDMADriver(void);
+
+
+//
+// OpenSaturnDevice(uint32_t Index)
+// open register access to another board (or return it if already open).
+// call before the threads that use it start. returns NULL if error
+//
+struct SaturnDevice* OpenSaturnDevice(uint32_t Index);
+
+
+//
+// CloseSaturnDevice(struct SaturnDevice* Device)
+// close a board's register access
+//
+void CloseSaturnDevice(struct SaturnDevice* Device);
+
+
+//
+// SelectSaturnDevice(struct SaturnDevice* Device)
+// select the board for the calling thread's register and DMA device calls.
+// NULL returns the thread to the default board
+//
+void SelectSaturnDevice(struct SaturnDevice* Device);
+
+
+//
+// GetSaturnDevice(void)
+// return the calling thread's board, or NULL if no board is open
+//
+struct SaturnDevice* GetSaturnDevice(void);
+
+
+//
+// SaturnDevicePath(const char* Path, char* Name, uint32_t Size)
+// convert a board 0 device name (eg VDDCDMADEVICE) to the calling thread's board;
+// writes it to Name and returns Name
+//
+const char* SaturnDevicePath(const char* Path, char* Name, uint32_t Size);
+
+
+//
+// open a DMA or event device (eg VDDCDMADEVICE) on the calling thread's board,
+// through the backend if installed. returns the fd, or -1 if error
+//
+int OpenDMADevice(const char* Path, int Flags);
+
+
 
 
 //
 // initiate a DMA to the FPGA with specified parameters
-// returns 1 if success, else 0
+// returns 0 if success, else a negative errno: -ENODATA if the transfer was short
 // fd: file device (an open file)
 // SrcData: pointer to memory block to transfer
 // Length: number of bytes to copy
@@ -40,7 +222,7 @@ int DMAWriteToFPGA(int fd, unsigned char*SrcData, uint32_t Length, uint32_t AXIA
 
 //
 // initiate a DMA from the FPGA with specified parameters
-// returns 1 if success, else 0
+// returns 0 if success, else a negative errno: -ENODATA if the transfer was short
 // fd: file device (an open file)
 // DestData: pointer to memory block to transfer
 // Length: number of bytes to copy
@@ -49,16 +231,264 @@ int DMAWriteToFPGA(int fd, unsigned char*SrcData, uint32_t Length, uint32_t AXIA
 int DMAReadFromFPGA(int fd, unsigned char*DestData, uint32_t Length, uint32_t AXIAddr);
 
 
+//
+// DMAReadAvailableFromFPGA(int fd, unsigned char* DestData, struct DMAShortRead* Read)
+// short read of a FIFO behind an AXI-MM reader: read the FIFO monitor register
+// Status, then as much data as the FIFO holds into DestData: at most MaxLength,
+// rounded down to a multiple of Granule, and nothing if less than MinLength.
+// With the XDMA driver this is one call (IOCTL_XDMA_READ_AVAILABLE); under other
+// backends, or an older driver, it is a register read then DMAReadFromFPGA().
+// returns 0 with Length and Status set, else a negative errno as DMAReadFromFPGA()
+//
+struct DMAShortRead
+{
+    uint32_t MinLength;                         // bytes
+    uint32_t MaxLength;                         // bytes
+    uint32_t Granule;                           // bytes
+    uint32_t AXIAddr;                           // AXI address to read
+    uint32_t StatusAddr;                        // FIFO monitor register
+    uint32_t DepthMask;                         // FIFO depth field of the register
+    uint32_t WordBytes;                         // bytes per unit of depth
+    uint32_t Length;                            // out: bytes read
+    uint32_t Status;                            // out: register value before the read
+};
+
+int DMAReadAvailableFromFPGA(int fd, unsigned char* DestData, struct DMAShortRead* Read);
+
+
+//
+// small stream transfers through the DMA bypass BAR
+// an FPGA built with the XDMA's DMA bypass interface, and that routed to the stream
+// FIFOs at the AXI addresses the DMA engines use, shows a bypass BAR (/dev/xdma<Index>_bypass).
+// a few hundred bytes can then be moved with plain 64 bit loads and stores, without
+// the descriptors, doorbell and completion interrupt of an SGDMA transfer.
+// OpenDMABypass() maps the calling thread's board's bypass BAR; return true if not available.
+// DMABypassCovers() is true if it is mapped and holds a transfer of Length bytes at AXIAddr.
+// the transfers return 0 if success, or -ENODEV if the bypass doesn't cover them;
+// Length must be a multiple of 8 bytes.
+//
+bool OpenDMABypass(void);
+bool DMABypassCovers(uint32_t AXIAddr, uint32_t Length);
+int DMABypassWriteToFPGA(const unsigned char* SrcData, uint32_t Length, uint32_t AXIAddr);
+int DMABypassReadFromFPGA(unsigned char* DestData, uint32_t Length, uint32_t AXIAddr);
+
+
+//
+// EDMAErrorClass ClassifyDMAError(int Result)
+// the class of failure of a DMA call that returned Result
+//
+EDMAErrorClass ClassifyDMAError(int Result);
+
+
+//
+// const char* GetDMAErrorClassName(EDMAErrorClass Class)
+// short name of an error class for reports, eg "timeout"
+//
+const char* GetDMAErrorClassName(EDMAErrorClass Class);
+
+
+//
+// int ReopenDMADevice(int fd, const char* Path, int Flags)
+// close DMA device fd and open Path again: the driver stops the engine and
+// abandons its transfers when the device is closed, so this resets the engine.
+// buffers registered for fd are registered again for the new device.
+// returns the new fd, or -1 if error
+//
+int ReopenDMADevice(int fd, const char* Path, int Flags);
+
+
+//
+// DMAAsyncInit(struct DMAAsyncContext* Ctx, int fd, uint32_t MaxInFlight)
+// set up asynchronous DMA on device fd, for up to MaxInFlight transfers at once
+// return true if error; the synchronous calls above can still be used
+//
+bool DMAAsyncInit(struct DMAAsyncContext* Ctx, int fd, uint32_t MaxInFlight);
+
+
+//
+// DMAAsyncSubmitRead(struct DMAAsyncContext* Ctx, uint32_t Slot, unsigned char* DestData, uint32_t Length, uint32_t AXIAddr)
+// start a DMA from the FPGA and return without waiting for it. Slot (0...MaxInFlight-1)
+// identifies the transfer and must not be reused until it has completed.
+// return true if error
+//
+bool DMAAsyncSubmitRead(struct DMAAsyncContext* Ctx, uint32_t Slot, unsigned char* DestData, uint32_t Length, uint32_t AXIAddr);
+
+
+//
+// DMAAsyncWaitComplete(struct DMAAsyncContext* Ctx, uint32_t* Slot)
+// block until a submitted transfer completes. Sets *Slot to its slot number
+// returns bytes transferred, or negative if error
+//
+int DMAAsyncWaitComplete(struct DMAAsyncContext* Ctx, uint32_t* Slot);
+
+
+//
+// DMAAsyncClose(struct DMAAsyncContext* Ctx)
+// wait for outstanding transfers, then release the context
+//
+void DMAAsyncClose(struct DMAAsyncContext* Ctx);
+
+
+//
+// DMAStreamStart(int fd, uint32_t RingSize, uint32_t BlockSize, uint32_t AXIAddr)
+// start the driver's streaming mode: the driver allocates a RingSize ring once, with a
+// descriptor per BlockSize bytes. On a C2H device the engine DMAs from AXIAddr into it
+// continuously; on an H2C device it writes to AXIAddr what DMAStreamCredit() gives it.
+// the ring is then mapped with MapDeviceRingBuffer() on the same fd.
+// return true if error
+//
+bool DMAStreamStart(int fd, uint32_t RingSize, uint32_t BlockSize, uint32_t AXIAddr);
+
+
+//
+// DMAStreamSync(int fd, uint32_t Tail, uint32_t* Head, uint32_t* Overruns)
+// pass the bytes consumed (free running) to the driver; returns the bytes written
+// (free running, advances a block at a time) and the count of ring overruns.
+// return true if error
+//
+bool DMAStreamSync(int fd, uint32_t Tail, uint32_t* Head, uint32_t* Overruns);
+
+
+//
+// DMAStreamCredit(int fd, uint32_t Head, uint32_t* Tail)
+// H2C streaming ring: give the engine the data written into the ring up to Head (bytes,
+// free running); returns the bytes it has read (free running) in Tail. The engine only
+// reads credited data, and its writes are held off by the FPGA while the FIFO is full,
+// so there is no need to read the FIFO depth. The batch credited by the previous call
+// is waited for first, so a second call with the same Head returns Tail == Head.
+// return 0, or a negative errno if the ring's DMA failed
+//
+int DMAStreamCredit(int fd, uint32_t Head, uint32_t* Tail);
+
+
+//
+// DMAStreamStop(int fd)
+// stop streaming and free the driver's ring. Unmap the ring first.
+//
+void DMAStreamStop(int fd);
+
+
+//
+// DMARegisterBuffer(int fd, unsigned char* Buffer, uint32_t Length)
+// register a buffer with the XDMA driver for device fd. Its pages stay pinned and mapped,
+// and the driver keeps the descriptors for each transfer size and address used, so a
+// repeated transfer is only queued to the engine. DMAReadFromFPGA() and DMAWriteToFPGA()
+// calls on fd with data inside the buffer then use it automatically.
+// return true if error (eg an older driver): the calls then use read()/write() as before
+//
+bool DMARegisterBuffer(int fd, unsigned char* Buffer, uint32_t Length);
+
+
+//
+// DMAUnregisterBuffers(int fd)
+// release the buffers registered for fd. Closing fd also releases them in the driver.
+//
+void DMAUnregisterBuffers(int fd);
+
+
+//
+// SetDMAInterruptCPU(const char* Path, int CPU)
+// steer the completion interrupt of DMA device Path (eg VDDCDMADEVICE) to one CPU,
+// through the driver's irq_cpu sysfs file; -1 removes the steering. Needs MSI-X and
+// write access to the sysfs file.
+// return true if error
+//
+bool SetDMAInterruptCPU(const char* Path, int CPU);
+
+
+//
+// XDMA driver statistics of one DMA engine, counted since the module loaded
+//
+struct DMAEngineStats
+{
+    uint64_t Transfers;                         // transfers completed
+    uint64_t Bytes;                             // bytes of completed transfers
+    uint64_t Descriptors;                       // descriptors of completed transfers
+    uint64_t Errors;                            // transfers failed by the engine
+    uint64_t Timeouts;                          // transfers aborted after their timeout
+    uint64_t Interrupts;                        // engine interrupts taken
+    uint64_t LatencyNs;                         // total queue to completion time; average is / Transfers
+    uint64_t MaxLatencyNs;                      // longest queue to completion time
+};
+
+
+//
+// read the statistics of the engine of DMA device Path (eg VDDCDMADEVICE) from the
+// driver's stats sysfs file. The device isn't opened, so a running stream isn't disturbed.
+// return true if error (eg a driver without the file)
+//
+bool ReadDMAEngineStats(const char* Path, struct DMAEngineStats* Stats);
+
+
+//
+// select register access method, for the calling thread's board
+// registers are memory mapped when a board is opened if possible; this allows the
+// pread/pwrite syscall path to be selected instead at runtime
+//
+void SetRegisterAccessMapped(bool Mapped);
+
+
+//
+// return true if registers are being accessed through the memory map
+//
+bool GetRegisterAccessMapped(void);
+
+
+//
+// map the RAM-like register range Address to Address + Size of the calling thread's board
+// write-combined as well (the driver's XDMA_MMAP_WC_OFFSET): a block write that lies in it
+// is then stored through that map, so sequential words can merge into larger PCIe writes,
+// followed by a store barrier. Address must be page aligned. Only for memory, never
+// for FIFO or control registers, as merged stores may be combined or reordered.
+// return true if error; register access is unchanged then
+//
+bool MapWriteCombinedRegisters(uint32_t Address, uint32_t Size);
+
+
 //
 // single 32 bit register read, from AXI-Lite bus
+// (memory mapped load if available, else pread)
 //
 uint32_t RegisterRead(uint32_t Address);
 
 
 //
 // single 32 bit register write, to AXI-Lite bus
+// (memory mapped store if available, else pwrite)
 //
 void RegisterWrite(uint32_t Address, uint32_t Data);
 
 
+//
+// write Count consecutive 32 bit registers from Data, starting at Address
+// (write-combined stores in a MapWriteCombinedRegisters() range, else memory
+// mapped stores if available, else pwrite of the whole block)
+//
+void RegisterWriteBlock(uint32_t Address, const uint32_t* Data, uint32_t Count);
+
+
+//
+// read Count consecutive 32 bit registers into Data, starting at Address
+// (memory mapped loads if available, else pread of the whole block)
+//
+void RegisterReadBlock(uint32_t Address, uint32_t* Data, uint32_t Count);
+
+
+//
+// register access to a given board, eg from a thread serving several boards
+// (the calls above are these on the calling thread's board)
+//
+uint32_t DeviceRegisterRead(struct SaturnDevice* Device, uint32_t Address);
+void DeviceRegisterWrite(struct SaturnDevice* Device, uint32_t Address, uint32_t Data);
+void DeviceRegisterWriteBlock(struct SaturnDevice* Device, uint32_t Address, const uint32_t* Data, uint32_t Count);
+void DeviceRegisterReadBlock(struct SaturnDevice* Device, uint32_t Address, uint32_t* Data, uint32_t Count);
+
+
+//
+// read Count registers at arbitrary Addresses into Data[0..Count-1]
+// runs of consecutive addresses are read as one block
+//
+void RegisterReadScatter(const uint32_t* Addresses, uint32_t* Data, uint32_t Count);
+
+
 #endif
\ No newline at end of file
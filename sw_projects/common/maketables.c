@@ -0,0 +1,65 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// maketables.c:
+// build time generator for saturntables.h: the DAC attenuation ROMs
+// and the default P1 and P2 CW keyer ramps, as const tables, so
+// startup does no libm work. Run by tables.mk; writes to stdout.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "saturntablecalc.h"
+
+
+//
+// print an array of values, 8 per line
+//
+static void PrintTable(const char* Declaration, const uint32_t* Values, uint32_t Count)
+{
+    uint32_t Cntr;
+
+    printf("%s =\n{", Declaration);
+    for (Cntr = 0; Cntr < Count; Cntr++)
+        printf("%s%u%s", (Cntr % 8) ? " " : "\n    ", Values[Cntr], (Cntr < Count - 1) ? "," : "");
+    printf("\n};\n\n");
+}
+
+
+int main(void)
+{
+    static uint32_t Ramp[VRAMPSIZE];
+    uint32_t Current[256];
+    uint32_t Step[256];
+    unsigned int DACDrive, StepValue;
+    uint32_t Level;
+
+    for (Level = 0; Level < 256; Level++)
+    {
+        CalcDACAtten(Level, &DACDrive, &StepValue);
+        Current[Level] = DACDrive;
+        Step[Level] = StepValue;
+    }
+
+    printf("//\n// saturntables.h: generated by maketables.c at build time; do not edit\n//\n\n");
+    printf("#ifndef __saturntables_h\n#define __saturntables_h\n\n");
+    PrintTable("static const unsigned int DACCurrentROM[256]", Current, 256);
+    PrintTable("static const unsigned int DACStepAttenROM[256]", Step, 256);
+
+    printf("#define VDEFAULTCWRAMPLENGTHP2 %u\n", CalcCWRampLength(true, VDEFAULTCWRAMPDURATION));
+    CalcCWRamp(Ramp, CalcCWRampLength(true, VDEFAULTCWRAMPDURATION));
+    PrintTable("static const uint32_t DefaultCWRampP2[VRAMPSIZE]", Ramp, VRAMPSIZE);
+    printf("#define VDEFAULTCWRAMPLENGTHP1 %u\n", CalcCWRampLength(false, VDEFAULTCWRAMPDURATION));
+    CalcCWRamp(Ramp, CalcCWRampLength(false, VDEFAULTCWRAMPDURATION));
+    PrintTable("static const uint32_t DefaultCWRampP1[VRAMPSIZE]", Ramp, VRAMPSIZE);
+    printf("#endif\n");
+    return 0;
+}
@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p1interleave.c:
+// protocol 1 USB frame interleave: per receiver I/Q samples to frame order
+//
+// each sample is moved as one 64 bit store: its top 2 bytes are zero, and are
+// overwritten by the next receiver's sample, or are the mic bytes after the last.
+// There is a version of this for each receiver count, with the count a constant
+// so the compiler unrolls the loop. With USENEON defined (make USENEON=1) on an
+// ARM target, the one receiver case does 8 samples at a time: vld3 splits them
+// into 16 bit lanes and vst4 stores them with a zero 4th lane.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <string.h>
+#include "../common/p1interleave.h"
+
+#if defined(USENEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VP1INTERLEAVENEON 1
+#endif
+
+
+static inline __attribute__((always_inline)) void InterleaveSamples(uint8_t* Dest, uint8_t** IQReadPtr,
+                                                                    uint32_t SampleCount, uint32_t Receivers)
+{
+    const uint8_t* Src[VMAXP1RECEIVERS];
+    uint64_t Word;
+    uint32_t Low;
+    uint16_t High;
+    uint32_t Sample;
+    uint32_t RX;
+
+    for (RX = 0; RX < Receivers; RX++)                              // local: the byte stores can't alias them
+        Src[RX] = IQReadPtr[RX];
+    for (Sample = 0; Sample < SampleCount; Sample++)
+    {
+        for (RX = 0; RX < Receivers; RX++)
+        {
+            memcpy(&Low, Src[RX], 4);                               // 2 loads, not 6 bytes to a word in memory:
+            memcpy(&High, Src[RX] + 4, 2);                          // that reload can't be store forwarded
+            Word = Low | ((uint64_t)High << 32);                    // sample in the low 6 bytes (little endian)
+            memcpy(Dest, &Word, 8);
+            Src[RX] += 6;
+            Dest += 6;
+        }
+        Dest += 2;                                                  // past the mic bytes just zeroed
+    }
+    for (RX = 0; RX < Receivers; RX++)
+        IQReadPtr[RX] += 6 * SampleCount;
+}
+
+
+//
+// one receiver: a USB frame sample is 8 bytes, so with NEON, 8 samples (48 bytes in,
+// 64 out) are split into 16 bit lanes by vld3 and stored by vst4 with a zero 4th lane
+//
+static void InterleaveSamples1(uint8_t* Dest, uint8_t** IQReadPtr, uint32_t SampleCount)
+{
+#ifdef VP1INTERLEAVENEON
+    uint16x8x3_t InWords;
+    uint16x8x4_t OutWords;
+
+    OutWords.val[3] = vdupq_n_u16(0);                               // mic bytes
+    while (SampleCount >= 8)
+    {
+        InWords = vld3q_u16((const uint16_t*)IQReadPtr[0]);
+        OutWords.val[0] = InWords.val[0];
+        OutWords.val[1] = InWords.val[1];
+        OutWords.val[2] = InWords.val[2];
+        vst4q_u16((uint16_t*)Dest, OutWords);
+        IQReadPtr[0] += 48;
+        Dest += 64;
+        SampleCount -= 8;
+    }
+#endif
+    InterleaveSamples(Dest, IQReadPtr, SampleCount, 1);
+}
+
+
+#define INTERLEAVE(Receivers)                                                                     \
+static void InterleaveSamples##Receivers(uint8_t* Dest, uint8_t** IQReadPtr, uint32_t SampleCount) \
+{                                                                                                 \
+    InterleaveSamples(Dest, IQReadPtr, SampleCount, Receivers);                                   \
+}
+
+INTERLEAVE(2)
+INTERLEAVE(3)
+INTERLEAVE(4)
+INTERLEAVE(5)
+INTERLEAVE(6)
+INTERLEAVE(7)
+INTERLEAVE(8)
+
+
+//
+// the interleave for each receiver count; entry 0 is unused
+//
+static const P1Interleave Interleavers[VMAXP1RECEIVERS + 1] =
+{
+    InterleaveSamples1, InterleaveSamples1, InterleaveSamples2, InterleaveSamples3, InterleaveSamples4,
+    InterleaveSamples5, InterleaveSamples6, InterleaveSamples7, InterleaveSamples8
+};
+
+
+//
+// SelectP1Interleave(uint32_t Receivers)
+// return the interleave specialised for Receivers receivers
+//
+P1Interleave SelectP1Interleave(uint32_t Receivers)
+{
+    if (Receivers > VMAXP1RECEIVERS)
+        Receivers = VMAXP1RECEIVERS;
+    return Interleavers[Receivers];
+}
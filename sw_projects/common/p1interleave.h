@@ -0,0 +1,41 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p1interleave.h:
+// protocol 1 USB frame interleave: per receiver I/Q samples to frame order
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __p1interleave_h
+#define __p1interleave_h
+
+#include <stdint.h>
+
+
+#define VMAXP1RECEIVERS 8                           // receivers in a protocol 1 frame
+
+
+//
+// interleave SampleCount I/Q samples of each receiver into a USB frame at Dest:
+// for each sample time, one 6 byte sample from each receiver then 2 (zero) mic bytes.
+// the read pointers (one per receiver) are advanced past the samples used.
+// no byte is written beyond the mic bytes of the last sample, and no I/Q data
+// is read beyond the last sample.
+//
+typedef void (*P1Interleave)(uint8_t* Dest, uint8_t** IQReadPtr, uint32_t SampleCount);
+
+
+//
+// SelectP1Interleave(uint32_t Receivers)
+// return the interleave specialised for Receivers receivers (1...VMAXP1RECEIVERS)
+//
+P1Interleave SelectP1Interleave(uint32_t Receivers);
+
+
+#endif
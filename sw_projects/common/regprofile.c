@@ -0,0 +1,240 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// regprofile.c:
+// register access profiler: counts by register address and call site
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../common/regprofile.h"
+
+
+//
+// one address, call site and kind. Entries with Accesses == 0 are free
+//
+struct RegProfileEntry
+{
+    uint32_t Address;
+    ERegProfileKind Kind;
+    const void* CallSite;
+    uint64_t Accesses;
+    uint64_t Registers;                             // registers accessed (more than Accesses for blocks)
+    uint64_t Nanoseconds;
+    uint64_t MaxNanoseconds;
+    uint64_t Redundant;                             // registers written with the value they already held
+};
+
+bool RegisterProfiling = false;
+static pthread_mutex_t ProfileMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct RegProfileEntry* ProfileTable = NULL;
+static uint32_t* LastWritten = NULL;                // last value written to each register below VREGPROFILESPAN
+static uint32_t* WrittenMap = NULL;                 // bit set if that register has been written
+static uint64_t Unrecorded = 0;                     // accesses not counted because the table was full
+
+static const char* KindNames[] = {"read", "write", "readblock", "writeblock"};
+
+
+bool SetRegisterProfiling(bool Enabled)
+{
+    bool Error = false;
+
+    pthread_mutex_lock(&ProfileMutex);
+    if (Enabled && (ProfileTable == NULL))
+    {
+        ProfileTable = calloc(VREGPROFILEENTRIES, sizeof(struct RegProfileEntry));
+        LastWritten = calloc(VREGPROFILESPAN / 4, sizeof(uint32_t));
+        WrittenMap = calloc(VREGPROFILESPAN / 128, sizeof(uint32_t));
+        if ((ProfileTable == NULL) || (LastWritten == NULL) || (WrittenMap == NULL))
+        {
+            free(ProfileTable);
+            free(LastWritten);
+            free(WrittenMap);
+            ProfileTable = NULL;
+            LastWritten = WrittenMap = NULL;
+            Enabled = false;
+            Error = true;
+        }
+    }
+    if (Enabled != RegisterProfiling)
+        printf("register profiling %s\n", Enabled ? "on" : "off");
+    RegisterProfiling = Enabled;
+    pthread_mutex_unlock(&ProfileMutex);
+    return Error;
+}
+
+
+//
+// count the registers written with the value they already held
+//
+static uint64_t CountRedundantWrites(uint32_t Address, const uint32_t* Data, uint32_t Count)
+{
+    uint64_t Redundant = 0;
+    uint32_t Word;
+    uint32_t Bit;
+
+    for (; (Count != 0) && (Address < VREGPROFILESPAN); Count--, Address += 4, Data++)
+    {
+        Word = Address >> 2;
+        Bit = 1U << (Word & 31);
+        if ((WrittenMap[Word >> 5] & Bit) && (LastWritten[Word] == *Data))
+            Redundant++;
+        WrittenMap[Word >> 5] |= Bit;
+        LastWritten[Word] = *Data;
+    }
+    return Redundant;
+}
+
+
+//
+// open addressed table, keyed by address, call site and kind
+//
+static struct RegProfileEntry* FindProfileEntry(uint32_t Address, const void* CallSite, ERegProfileKind Kind)
+{
+    struct RegProfileEntry* Entry;
+    uint32_t Hash;
+    uint32_t Probe;
+
+    Hash = (Address >> 2) * 2654435761U ^ (uint32_t)((uintptr_t)CallSite * 40503U) ^ Kind;
+    for (Probe = 0; Probe < VREGPROFILEENTRIES; Probe++)
+    {
+        Entry = ProfileTable + ((Hash + Probe) % VREGPROFILEENTRIES);
+        if (Entry->Accesses == 0)
+        {
+            Entry->Address = Address;
+            Entry->CallSite = CallSite;
+            Entry->Kind = Kind;
+            return Entry;
+        }
+        if ((Entry->Address == Address) && (Entry->CallSite == CallSite) && (Entry->Kind == Kind))
+            return Entry;
+    }
+    return NULL;
+}
+
+
+void ProfileRegisterAccess(uint32_t Address, const void* CallSite, ERegProfileKind Kind, const uint32_t* Data, uint32_t Count, uint64_t Start)
+{
+    struct RegProfileEntry* Entry;
+    uint64_t Elapsed;
+
+    Elapsed = RegisterProfileTime() - Start;
+    pthread_mutex_lock(&ProfileMutex);
+    if (ProfileTable != NULL)
+    {
+        Entry = FindProfileEntry(Address, CallSite, Kind);
+        if (Entry == NULL)
+            Unrecorded++;
+        else
+        {
+            Entry->Accesses++;
+            Entry->Registers += Count;
+            Entry->Nanoseconds += Elapsed;
+            if (Elapsed > Entry->MaxNanoseconds)
+                Entry->MaxNanoseconds = Elapsed;
+            if ((Data != NULL) && ((Kind == eRegProfileWrite) || (Kind == eRegProfileWriteBlock)))
+                Entry->Redundant += CountRedundantWrites(Address, Data, Count);
+        }
+    }
+    pthread_mutex_unlock(&ProfileMutex);
+}
+
+
+//
+// most accesses first
+//
+static int CompareProfileEntries(const void* A, const void* B)
+{
+    const struct RegProfileEntry* EntryA = A;
+    const struct RegProfileEntry* EntryB = B;
+
+    if (EntryA->Accesses != EntryB->Accesses)
+        return (EntryA->Accesses > EntryB->Accesses) ? -1 : 1;
+    return (EntryA->Address > EntryB->Address) - (EntryA->Address < EntryB->Address);
+}
+
+
+//
+// write a call site as file+offset from /proc/self/maps, or the bare address if not found
+// or if file+offset does not fit
+//
+static void FormatCallSite(const void* CallSite, char* Text, uint32_t Size)
+{
+    FILE* Maps;
+    char Line[512];
+    char Path[384];
+    unsigned long MapStart, MapEnd, MapOffset;
+    uintptr_t Addr = (uintptr_t)CallSite;
+    const char* Name;
+    bool Found = false;
+
+    snprintf(Text, Size, "%p", CallSite);
+    Maps = fopen("/proc/self/maps", "r");
+    if (Maps == NULL)
+        return;
+    while (!Found && (fgets(Line, sizeof(Line), Maps) != NULL))
+        if ((sscanf(Line, "%lx-%lx %*s %lx %*s %*s %383s", &MapStart, &MapEnd, &MapOffset, Path) == 4)
+            && (Addr >= MapStart) && (Addr < MapEnd))
+        {
+            Name = strrchr(Path, '/');
+            Name = (Name != NULL) ? Name + 1 : Path;
+            if (snprintf(Text, Size, "%s+0x%lx", Name, (unsigned long)(Addr - MapStart + MapOffset)) >= (int)Size)
+                snprintf(Text, Size, "%p", CallSite);       // name too long: the bare address, not a cut off name
+            Found = true;
+        }
+    fclose(Maps);
+}
+
+
+void PrintRegisterProfile(FILE* File, uint32_t Rows)
+{
+    struct RegProfileEntry* Sorted;
+    uint32_t Used = 0;
+    uint32_t Cntr;
+    uint64_t Accesses = 0;
+    uint64_t Redundant = 0;
+    uint64_t Nanoseconds = 0;
+    char CallSite[128];
+
+    Sorted = malloc(VREGPROFILEENTRIES * sizeof(struct RegProfileEntry));
+    if (Sorted == NULL)
+        return;
+    pthread_mutex_lock(&ProfileMutex);
+    if (ProfileTable != NULL)
+        for (Cntr = 0; Cntr < VREGPROFILEENTRIES; Cntr++)
+            if (ProfileTable[Cntr].Accesses != 0)
+                Sorted[Used++] = ProfileTable[Cntr];
+    pthread_mutex_unlock(&ProfileMutex);
+
+    qsort(Sorted, Used, sizeof(struct RegProfileEntry), CompareProfileEntries);
+    for (Cntr = 0; Cntr < Used; Cntr++)
+    {
+        Accesses += Sorted[Cntr].Accesses;
+        Redundant += Sorted[Cntr].Redundant;
+        Nanoseconds += Sorted[Cntr].Nanoseconds;
+    }
+    fprintf(File, "register profile: %llu accesses, %llu us, %llu redundant writes, %llu not recorded; top %u of %u:\n",
+            (unsigned long long)Accesses, (unsigned long long)(Nanoseconds / 1000), (unsigned long long)Redundant,
+            (unsigned long long)Unrecorded, (Rows < Used) ? Rows : Used, Used);
+    fprintf(File, "  address  kind        accesses  registers   total us  mean ns   max ns  redundant  call site\n");
+    for (Cntr = 0; (Cntr < Used) && (Cntr < Rows); Cntr++)
+    {
+        FormatCallSite(Sorted[Cntr].CallSite, CallSite, sizeof(CallSite));
+        fprintf(File, "  0x%05x  %-10s %9llu %10llu %10llu %8llu %8llu %10llu  %s\n",
+                Sorted[Cntr].Address, KindNames[Sorted[Cntr].Kind],
+                (unsigned long long)Sorted[Cntr].Accesses, (unsigned long long)Sorted[Cntr].Registers,
+                (unsigned long long)(Sorted[Cntr].Nanoseconds / 1000),
+                (unsigned long long)(Sorted[Cntr].Nanoseconds / Sorted[Cntr].Accesses),
+                (unsigned long long)Sorted[Cntr].MaxNanoseconds, (unsigned long long)Sorted[Cntr].Redundant, CallSite);
+    }
+    fflush(File);
+    free(Sorted);
+}
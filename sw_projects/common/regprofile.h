@@ -0,0 +1,85 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// regprofile.h:
+// register access profiler: which registers are accessed, from where, how
+// often and for how long
+//
+// while it is on, each RegisterRead(), RegisterWrite(), RegisterReadBlock()
+// and RegisterWriteBlock() call is timed and counted by register address,
+// call site (return address) and kind. A write of the value last written to
+// the same register is counted as redundant: a candidate for a shadow copy.
+// the report lists the entries with the most accesses; call sites are given
+// as file+offset, for "addr2line -f -e file offset".
+// off, it costs the register calls one test of a flag.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __regprofile_h
+#define __regprofile_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+
+#define VREGPROFILEENTRIES 1024                     // address/call site pairs counted
+#define VREGPROFILESPAN 0x20000                     // redundant writes are found below this address
+
+
+typedef enum
+{
+    eRegProfileRead,
+    eRegProfileWrite,
+    eRegProfileReadBlock,
+    eRegProfileWriteBlock
+} ERegProfileKind;
+
+
+extern bool RegisterProfiling;                      // true while accesses are being counted
+
+
+//
+// RegisterProfileTime(void)
+// CLOCK_MONOTONIC ns, for the start of a profiled access
+//
+static inline uint64_t RegisterProfileTime(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// SetRegisterProfiling(bool Enabled)
+// start or stop counting. The counts are kept when it is stopped.
+// return true if error (no memory for the tables)
+//
+bool SetRegisterProfiling(bool Enabled);
+
+
+//
+// ProfileRegisterAccess(uint32_t Address, const void* CallSite, ERegProfileKind Kind, const uint32_t* Data, uint32_t Count, uint64_t Start)
+// count an access of Count registers from Address that started at Start.
+// for writes, Data is the values written
+//
+void ProfileRegisterAccess(uint32_t Address, const void* CallSite, ERegProfileKind Kind, const uint32_t* Data, uint32_t Count, uint64_t Start);
+
+
+//
+// PrintRegisterProfile(FILE* File, uint32_t Rows)
+// write the Rows entries with the most accesses
+//
+void PrintRegisterProfile(FILE* File, uint32_t Rows);
+
+
+#endif
@@ -0,0 +1,196 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// regqueue.c:
+// register write queue: one thread owns the register writes
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "../common/hwaccess.h"
+#include "../common/regqueue.h"
+
+
+//
+// one group: the writes of one register transaction, in the order made
+//
+struct RegisterGroup
+{
+    uint32_t Count;
+    struct SaturnDevice* Device[VMAXQUEUEDWRITES];
+    uint32_t Address[VMAXQUEUEDWRITES];
+    uint32_t Data[VMAXQUEUEDWRITES];
+};
+
+static struct RegisterGroup QueuedGroups[VREGQUEUEDEPTH];
+static _Atomic uint32_t QueueHead;                      // groups queued (free running)
+static _Atomic uint32_t QueueTail;                      // groups applied (free running)
+static pthread_mutex_t QueueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t GroupQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t GroupApplied = PTHREAD_COND_INITIALIZER;
+static bool OwnerRunning = false;
+
+static __thread bool IsOwnerThread = false;
+static __thread struct RegisterGroup OpenGroup;         // this thread's group being made
+
+static _Atomic uint64_t GroupsApplied;
+static _Atomic uint64_t WritesApplied;
+static _Atomic uint64_t AccessWaits;
+
+
+//
+// queue a group; waits if the queue is full
+//
+static void SubmitGroup(const struct RegisterGroup* Group)
+{
+    uint32_t Head;
+
+    pthread_mutex_lock(&QueueMutex);
+    Head = atomic_load_explicit(&QueueHead, memory_order_relaxed);
+    while ((Head - atomic_load_explicit(&QueueTail, memory_order_relaxed)) >= VREGQUEUEDEPTH)
+        pthread_cond_wait(&GroupApplied, &QueueMutex);
+    QueuedGroups[Head % VREGQUEUEDEPTH] = *Group;
+    atomic_store_explicit(&QueueHead, Head + 1, memory_order_release);
+    pthread_cond_signal(&GroupQueued);
+    pthread_mutex_unlock(&QueueMutex);
+}
+
+
+//
+// RegisterWriteQueue hooks, called from hwaccess.c
+//
+static bool QueueWrite(struct SaturnDevice* Device, uint32_t Address, uint32_t Data)
+{
+    struct RegisterGroup* Group = &OpenGroup;
+
+    if (Group->Count == VMAXQUEUEDWRITES)
+    {
+        SubmitGroup(Group);
+        Group->Count = 0;
+    }
+    Group->Device[Group->Count] = Device;
+    Group->Address[Group->Count] = Address;
+    Group->Data[Group->Count] = Data;
+    Group->Count++;
+    return true;
+}
+
+
+static void DrainQueue(void)
+{
+    uint32_t Target;
+
+    if (IsOwnerThread)
+        return;
+    Target = atomic_load_explicit(&QueueHead, memory_order_acquire);
+    if (atomic_load_explicit(&QueueTail, memory_order_acquire) == Target)
+        return;                                         // nothing queued: the usual case
+    atomic_fetch_add_explicit(&AccessWaits, 1, memory_order_relaxed);
+    pthread_mutex_lock(&QueueMutex);
+    while ((int32_t)(atomic_load_explicit(&QueueTail, memory_order_relaxed) - Target) < 0)
+        pthread_cond_wait(&GroupApplied, &QueueMutex);
+    pthread_mutex_unlock(&QueueMutex);
+}
+
+
+static void BeginGroup(void)
+{
+    OpenGroup.Count = 0;
+}
+
+
+static void EndGroup(void)
+{
+    if (OpenGroup.Count != 0)
+        SubmitGroup(&OpenGroup);
+    OpenGroup.Count = 0;
+}
+
+
+static const struct RegisterWriteQueue OwnerQueue =
+{
+    "owner thread",
+    QueueWrite,
+    DrainQueue,
+    BeginGroup,
+    EndGroup
+};
+
+
+//
+// the owner thread: apply each group in turn. A group's slot isn't reused
+// until the tail has moved past it, so it is applied without the mutex held.
+//
+void* RegisterQueueThread(__attribute__((unused)) void* arg)
+{
+    struct RegisterGroup* Group;
+    uint32_t Tail;
+    uint32_t Cntr;
+
+    IsOwnerThread = true;
+    pthread_mutex_lock(&QueueMutex);
+    OwnerRunning = true;
+    while (true)
+    {
+        Tail = atomic_load_explicit(&QueueTail, memory_order_relaxed);
+        while (atomic_load_explicit(&QueueHead, memory_order_relaxed) == Tail)
+            pthread_cond_wait(&GroupQueued, &QueueMutex);
+        pthread_mutex_unlock(&QueueMutex);
+
+        Group = &QueuedGroups[Tail % VREGQUEUEDEPTH];
+        for (Cntr = 0; Cntr < Group->Count; Cntr++)
+            DeviceRegisterWrite(Group->Device[Cntr], Group->Address[Cntr], Group->Data[Cntr]);
+        atomic_fetch_add_explicit(&GroupsApplied, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&WritesApplied, Group->Count, memory_order_relaxed);
+
+        pthread_mutex_lock(&QueueMutex);
+        atomic_store_explicit(&QueueTail, Tail + 1, memory_order_release);
+        pthread_cond_broadcast(&GroupApplied);
+    }
+    return NULL;
+}
+
+
+//
+// install the queue once the owner thread has started
+//
+bool StartRegisterQueue(void)
+{
+    bool Running;
+    int Tries;
+
+    for (Tries = 0; Tries < 100; Tries++)
+    {
+        pthread_mutex_lock(&QueueMutex);
+        Running = OwnerRunning;
+        pthread_mutex_unlock(&QueueMutex);
+        if (Running)
+        {
+            SetRegisterWriteQueue(&OwnerQueue);
+            return false;
+        }
+        usleep(1000);
+    }
+    printf("register queue: owner thread not running\n");
+    return true;
+}
+
+
+//
+// counts since startup
+//
+void GetRegisterQueueCounts(uint64_t* Groups, uint64_t* Writes, uint64_t* Waits)
+{
+    *Groups = atomic_load_explicit(&GroupsApplied, memory_order_relaxed);
+    *Writes = atomic_load_explicit(&WritesApplied, memory_order_relaxed);
+    *Waits = atomic_load_explicit(&AccessWaits, memory_order_relaxed);
+}
@@ -0,0 +1,59 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// regqueue.h:
+// register write queue: one thread owns the register writes
+//
+// control threads (the network event loop decoding high priority and DUC
+// specific packets) commit their register transactions into the queue as
+// one group each, and carry on. The owner thread applies the groups in the
+// order they were queued. Any other register access, eg a data thread
+// enabling a DDC or reading a FIFO depth, first waits for the writes already
+// queued, so the order in which the hardware sees writes is the order in
+// which they were made. Semaphores protecting register shadows are then only
+// held while a commit is queued, not for the AXI writes themselves.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __regqueue_h
+#define __regqueue_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VREGQUEUEDEPTH 16                       // groups that can be waiting
+#define VMAXQUEUEDWRITES 64                     // writes in one group; a larger one is split
+
+
+//
+// RegisterQueueThread(void* arg)
+// the owner thread: applies queued groups until the process exits.
+// create it (eg with the app's thread placement), then call StartRegisterQueue()
+//
+void* RegisterQueueThread(void* arg);
+
+
+//
+// StartRegisterQueue(void)
+// install the queue, so register transactions are committed through it
+// return true if error (the owner thread isn't running)
+//
+bool StartRegisterQueue(void);
+
+
+//
+// GetRegisterQueueCounts(uint64_t* Groups, uint64_t* Writes, uint64_t* Waits)
+// return the groups and writes applied, and the register accesses that had to
+// wait for queued writes
+//
+void GetRegisterQueueCounts(uint64_t* Groups, uint64_t* Writes, uint64_t* Waits);
+
+
+#endif
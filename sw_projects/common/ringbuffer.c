@@ -0,0 +1,176 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ringbuffer.c:
+// single producer, single consumer ring buffer using mirrored virtual memory
+//
+// memory is an anonymous memfd file, mapped twice into one reserved
+// region of 2*Size bytes: data written past the end of the 1st mapping
+// appears at the start of it.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../common/ringbuffer.h"
+
+
+
+//
+// map RingSize bytes of file fd, from Offset, twice at adjacent addresses into the ring.
+// the region is aligned to Alignment (a power of 2 pages) as huge page mappings need.
+// return true if error
+//
+static bool MapMirrored(struct SPSCRingBuffer* Ring, int fd, off_t Offset, uint32_t RingSize, uint32_t Alignment, int Protection)
+{
+    uint8_t* Reserved;
+    uint8_t* Region;
+    void* Mapping;
+    size_t Slack;
+
+//
+// reserve 2x the ring size of address space, plus room to align it, and release the
+// unaligned ends; then map the file at the start and in the middle
+//
+    Slack = (Alignment > (uint32_t)sysconf(_SC_PAGESIZE)) ? Alignment : 0;
+    Reserved = mmap(NULL, 2 * RingSize + Slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Reserved == MAP_FAILED)
+    {
+        printf("ring buffer address reservation failed\n");
+        return true;
+    }
+    Region = Reserved;
+    if (Slack != 0)
+    {
+        Region = (uint8_t*)(((uintptr_t)Reserved + Alignment - 1) & ~((uintptr_t)Alignment - 1));
+        if (Region != Reserved)
+            munmap(Reserved, Region - Reserved);
+        munmap(Region + 2 * RingSize, Slack - (Region - Reserved));
+    }
+    Mapping = mmap(Region, RingSize, Protection, MAP_SHARED | MAP_FIXED, fd, Offset);
+    if (Mapping != MAP_FAILED)
+        Mapping = mmap(Region + RingSize, RingSize, Protection, MAP_SHARED | MAP_FIXED, fd, Offset);
+    if (Mapping == MAP_FAILED)
+    {
+        printf("ring buffer mirror mapping failed\n");
+        munmap(Region, 2 * RingSize);
+        return true;
+    }
+
+    Ring->Base = Region;
+    Ring->Size = RingSize;
+    Ring->Mask = RingSize - 1;
+    Ring->FileOffset = Offset;
+    atomic_init(&Ring->Head, 0);
+    atomic_init(&Ring->Tail, 0);
+    return false;
+}
+
+
+//
+// create the ring: round up size, then map a memfd twice
+//
+bool CreateRingBuffer(struct SPSCRingBuffer* Ring, uint32_t Size)
+{
+    uint32_t PageSize;
+    uint32_t RingSize;
+    bool Error;
+    int fd;
+
+    memset(Ring, 0, sizeof(struct SPSCRingBuffer));
+    PageSize = sysconf(_SC_PAGESIZE);
+    RingSize = PageSize;
+    while (RingSize < Size)
+        RingSize <<= 1;
+
+    fd = memfd_create("saturnring", 0);
+    if (fd < 0)
+    {
+        printf("ring buffer memfd_create failed\n");
+        return true;
+    }
+    if (ftruncate(fd, RingSize) != 0)
+    {
+        printf("ring buffer size set failed\n");
+        close(fd);
+        return true;
+    }
+    Error = MapMirrored(Ring, fd, 0, RingSize, PageSize, PROT_READ | PROT_WRITE);
+    close(fd);                                              // mappings keep the memory
+    return Error;
+}
+
+
+//
+// map a ring of memory provided by a device driver
+//
+bool MapDeviceRingBuffer(struct SPSCRingBuffer* Ring, int fd, uint32_t Size)
+{
+    memset(Ring, 0, sizeof(struct SPSCRingBuffer));
+    if ((Size == 0) || ((Size & (Size - 1)) != 0) || ((Size % sysconf(_SC_PAGESIZE)) != 0))
+    {
+        printf("device ring size %d must be a power of 2 pages\n", Size);
+        return true;
+    }
+    return MapMirrored(Ring, fd, 0, Size, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE);
+}
+
+
+//
+// map a ring of the memory of a file, eg a buffer arena
+//
+bool MapFileRingBuffer(struct SPSCRingBuffer* Ring, int fd, off_t Offset, uint32_t Size, uint32_t PageSize)
+{
+    memset(Ring, 0, sizeof(struct SPSCRingBuffer));
+    if ((Size == 0) || ((Size & (Size - 1)) != 0) || ((Size % PageSize) != 0) || ((Offset % PageSize) != 0))
+    {
+        printf("file ring size %d at offset %lld must be a power of 2 pages, on a page\n", Size, (long long)Offset);
+        return true;
+    }
+    return MapMirrored(Ring, fd, Offset, Size, PageSize, PROT_READ | PROT_WRITE);
+}
+
+
+//
+// map a ring of a file for reading only, eg another process's ring shared with us
+//
+bool MapReadOnlyRingBuffer(struct SPSCRingBuffer* Ring, int fd, off_t Offset, uint32_t Size, uint32_t PageSize)
+{
+    memset(Ring, 0, sizeof(struct SPSCRingBuffer));
+    if ((Size == 0) || ((Size & (Size - 1)) != 0) || ((Size % PageSize) != 0) || ((Offset % PageSize) != 0))
+    {
+        printf("file ring size %d at offset %lld must be a power of 2 pages, on a page\n", Size, (long long)Offset);
+        return true;
+    }
+    return MapMirrored(Ring, fd, Offset, Size, PageSize, PROT_READ);
+}
+
+
+//
+// free the ring's memory
+//
+void FreeRingBuffer(struct SPSCRingBuffer* Ring)
+{
+    if (Ring->Base != NULL)
+        munmap(Ring->Base, 2 * Ring->Size);
+    Ring->Base = NULL;
+}
+
+
+//
+// discard all data
+//
+void ResetRingBuffer(struct SPSCRingBuffer* Ring)
+{
+    atomic_store(&Ring->Head, 0);
+    atomic_store(&Ring->Tail, 0);
+}
@@ -0,0 +1,149 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ringbuffer.h:
+// single producer, single consumer ring buffer using mirrored virtual memory
+//
+// the buffer memory is mapped twice, at adjacent virtual addresses, so any
+// block of up to Size bytes starting at the read or write pointer is
+// contiguous: a read or write never has to wrap, and data never has to be
+// moved. Head and Tail are free running byte counts; one thread may write
+// (advance Head) while another thread reads (advances Tail) with no lock.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ringbuffer_h
+#define __ringbuffer_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+
+struct SPSCRingBuffer
+{
+    uint8_t* Base;                          // start of 1st mapping; 2nd mapping follows at Base+Size
+    uint32_t Size;                          // bytes. Power of 2, multiple of page size
+    uint32_t Mask;                          // Size-1
+    uint64_t FileOffset;                    // where the memory is in the file mapped
+    _Atomic uint32_t Head;                  // total bytes written (written by producer only)
+    _Atomic uint32_t Tail;                  // total bytes read (written by consumer only)
+};
+
+
+//
+// CreateRingBuffer(struct SPSCRingBuffer* Ring, uint32_t Size)
+// allocate and double map the buffer memory. Size is rounded up to a power of 2
+// and at least one page. Return true if error.
+//
+bool CreateRingBuffer(struct SPSCRingBuffer* Ring, uint32_t Size);
+
+
+//
+// MapDeviceRingBuffer(struct SPSCRingBuffer* Ring, int fd, uint32_t Size)
+// double map Size bytes of device memory (eg the XDMA streaming ring) from offset 0 of fd.
+// Size must be a power of 2 pages. Return true if error.
+//
+bool MapDeviceRingBuffer(struct SPSCRingBuffer* Ring, int fd, uint32_t Size);
+
+
+//
+// MapFileRingBuffer(struct SPSCRingBuffer* Ring, int fd, off_t Offset, uint32_t Size, uint32_t PageSize)
+// double map Size bytes of a file from Offset, eg a slice of a buffer arena. PageSize is
+// the file's page size (the huge page size for a hugetlb file): Size must be a power of
+// 2 pages, and Offset a whole number of pages. Return true if error.
+//
+bool MapFileRingBuffer(struct SPSCRingBuffer* Ring, int fd, off_t Offset, uint32_t Size, uint32_t PageSize);
+
+
+//
+// MapReadOnlyRingBuffer(struct SPSCRingBuffer* Ring, int fd, off_t Offset, uint32_t Size, uint32_t PageSize)
+// as MapFileRingBuffer(), but mapped read only (fd may be opened O_RDONLY), for a reader
+// in another process. Head and Tail are not shared: the reader gets them some other way.
+// Return true if error.
+//
+bool MapReadOnlyRingBuffer(struct SPSCRingBuffer* Ring, int fd, off_t Offset, uint32_t Size, uint32_t PageSize);
+
+
+//
+// FreeRingBuffer(struct SPSCRingBuffer* Ring)
+// release the memory mappings
+//
+void FreeRingBuffer(struct SPSCRingBuffer* Ring);
+
+
+//
+// ResetRingBuffer(struct SPSCRingBuffer* Ring)
+// discard all data. Only call when neither producer nor consumer is active.
+//
+void ResetRingBuffer(struct SPSCRingBuffer* Ring);
+
+
+//
+// RingBytesUsed(struct SPSCRingBuffer* Ring)
+// bytes available to read. Can be called by either thread.
+//
+static inline uint32_t RingBytesUsed(struct SPSCRingBuffer* Ring)
+{
+    return atomic_load_explicit(&Ring->Head, memory_order_acquire) - atomic_load_explicit(&Ring->Tail, memory_order_acquire);
+}
+
+
+//
+// RingBytesFree(struct SPSCRingBuffer* Ring)
+// bytes of space available to write. Can be called by either thread.
+//
+static inline uint32_t RingBytesFree(struct SPSCRingBuffer* Ring)
+{
+    return Ring->Size - RingBytesUsed(Ring);
+}
+
+
+//
+// RingWritePtr(struct SPSCRingBuffer* Ring)
+// producer: pointer to 1st free location. Up to RingBytesFree() bytes can be written linearly.
+//
+static inline uint8_t* RingWritePtr(struct SPSCRingBuffer* Ring)
+{
+    return Ring->Base + (atomic_load_explicit(&Ring->Head, memory_order_relaxed) & Ring->Mask);
+}
+
+
+//
+// RingCommitWrite(struct SPSCRingBuffer* Ring, uint32_t Bytes)
+// producer: make Bytes written at RingWritePtr() visible to the consumer
+//
+static inline void RingCommitWrite(struct SPSCRingBuffer* Ring, uint32_t Bytes)
+{
+    atomic_store_explicit(&Ring->Head, atomic_load_explicit(&Ring->Head, memory_order_relaxed) + Bytes, memory_order_release);
+}
+
+
+//
+// RingReadPtr(struct SPSCRingBuffer* Ring)
+// consumer: pointer to 1st occupied location. Up to RingBytesUsed() bytes can be read linearly.
+//
+static inline uint8_t* RingReadPtr(struct SPSCRingBuffer* Ring)
+{
+    return Ring->Base + (atomic_load_explicit(&Ring->Tail, memory_order_relaxed) & Ring->Mask);
+}
+
+
+//
+// RingConsume(struct SPSCRingBuffer* Ring, uint32_t Bytes)
+// consumer: release Bytes at RingReadPtr() back to the producer
+//
+static inline void RingConsume(struct SPSCRingBuffer* Ring, uint32_t Bytes)
+{
+    atomic_store_explicit(&Ring->Tail, atomic_load_explicit(&Ring->Tail, memory_order_relaxed) + Bytes, memory_order_release);
+}
+
+
+#endif
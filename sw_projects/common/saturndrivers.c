@@ -19,10 +19,29 @@
 #include "../common/saturnregisters.h"
 #include "../common/hwaccess.h"                   // low level access
 #include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 
 sem_t DDCResetFIFOMutex;
 
+//
+// FIFO monitor event devices, one per FIFO channel, or -1 if not open
+// XDMA user interrupt n appears as /dev/xdma0_events_n (named for board 0:
+// OpenDMADevice() opens it on the calling thread's board)
+//
+#define VFIFOEVENTDEVICE "/dev/xdma0_events_%d"
+#define VMINFIFOWAIT 50                         // shortest sleep between FIFO reads, us
+#define VMAXFIFOWAIT 1000                       // longest sleep between FIFO reads, us
+int FIFOEventfd[VNUMFIFOCHANNELS] = {-1, -1, -1, -1};
+
 bool GFIFOSizesInitialised = false;
+bool GFIFOEventsEnabled = false;                // true to wait on FIFO monitor interrupts
 
 
 
@@ -44,6 +63,8 @@ void SetupFIFOMonitorChannel(EDMAStreamSelect Channel, bool EnableInterrupt)
 			InitialiseFIFOSizes();				// load FIFO size table, if not already done
 			GFIFOSizesInitialised = true;
 	}
+	if (GFIFOEventsEnabled)
+		EnableInterrupt = OpenFIFOEventDevice(Channel);		// interrupt only if we can wait for it
 	Address = VADDRFIFOMONBASE + 4 * Channel + 0x10;			// config register address
 	Data = DMAFIFODepths[(int)Channel];							// memory depth
 	if (EnableInterrupt)
@@ -53,6 +74,136 @@ void SetupFIFOMonitorChannel(EDMAStreamSelect Channel, bool EnableInterrupt)
 
 
 
+//
+// void EnableFIFOEvents(bool Enabled)
+// if enabled, SetupFIFOMonitorChannel() enables the FIFO monitor interrupt and opens
+// the channel's event device, so WaitFIFOMonitorChannel() sleeps on the interrupt.
+// call before the FIFO monitor channels are set up.
+//
+void EnableFIFOEvents(bool Enabled)
+{
+	GFIFOEventsEnabled = Enabled;
+}
+
+
+
+//
+// bool OpenFIFOEventDevice(EDMAStreamSelect Channel)
+// open the XDMA event device for a FIFO monitor channel, so WaitFIFOMonitorChannel()
+// can sleep until the FIFO monitor interrupts. Interrupt generation must also be enabled
+// by SetupFIFOMonitorChannel(Channel, true).
+// returns true if the device is available
+//
+bool OpenFIFOEventDevice(EDMAStreamSelect Channel)
+{
+	char DeviceName[32];
+
+	if (FIFOEventfd[(int)Channel] >= 0)
+		return true;
+	snprintf(DeviceName, sizeof(DeviceName), VFIFOEVENTDEVICE, (int)Channel);
+	FIFOEventfd[(int)Channel] = OpenDMADevice(DeviceName, O_RDONLY);
+	if (FIFOEventfd[(int)Channel] < 0)
+	{
+		printf("%s not available; FIFO waits will use timed polling\n", DeviceName);
+		return false;
+	}
+	return true;
+}
+
+
+
+static uint64_t GetMicroseconds(void)
+{
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (uint64_t)Now.tv_sec * 1000000 + Now.tv_nsec / 1000;
+}
+
+
+
+//
+// uint32_t WaitFIFOMonitorChannel(EDMAStreamSelect Channel, uint32_t Required, uint32_t TimeoutUs,
+//                                 bool* Overflowed, bool* OverThreshold, bool* Underflowed, unsigned int* Current);
+//
+// wait until a FIFO has at least Required locations available, or until TimeoutUs has passed.
+// for a read FIFO that is occupied locations; for a write FIFO it is free locations.
+// if the channel's event device is open, sleeps on it and is woken by the FIFO monitor interrupt;
+// otherwise (and as a timeout fallback) it sleeps for the time the FIFO is predicted to take to
+// reach Required, from the fill rate seen so far, limited to 50us...1ms.
+// returns the last depth read; the flags are true if set by any read made during the wait.
+//
+uint32_t WaitFIFOMonitorChannel(EDMAStreamSelect Channel, uint32_t Required, uint32_t TimeoutUs,
+                                bool* Overflowed, bool* OverThreshold, bool* Underflowed, unsigned int* Current)
+{
+	uint32_t Depth;
+	uint32_t PrevDepth;
+	uint64_t StartTime, PrevTime, Now;
+	uint32_t Wait;
+	uint32_t EventCount;
+	bool Overflow, OverThresh, Underflow;
+	bool AnyOverflow = false, AnyOverThresh = false, AnyUnderflow = false;
+	struct pollfd EventPoll;
+	struct timespec PollTime;
+	int fd;
+
+	fd = FIFOEventfd[(int)Channel];
+	StartTime = GetMicroseconds();
+	PrevTime = StartTime;
+	Depth = ReadFIFOMonitorChannel(Channel, &Overflow, &OverThresh, &Underflow, Current);
+	AnyOverflow |= Overflow;
+	AnyOverThresh |= OverThresh;
+	AnyUnderflow |= Underflow;
+	PrevDepth = Depth;
+	Wait = VMINFIFOWAIT;
+	while (Depth < Required)
+	{
+		Now = GetMicroseconds();
+		if ((Now - StartTime) >= TimeoutUs)
+			break;
+		if (Wait > (TimeoutUs - (Now - StartTime)))
+			Wait = TimeoutUs - (Now - StartTime);
+		if (fd >= 0)
+		{
+			EventPoll.fd = fd;
+			EventPoll.events = POLLIN;
+			PollTime.tv_sec = 0;
+			PollTime.tv_nsec = Wait * 1000;
+			if ((ppoll(&EventPoll, 1, &PollTime, NULL) > 0) && (EventPoll.revents & POLLIN))
+			{
+				if (read(fd, &EventCount, sizeof(EventCount)) != sizeof(EventCount))	// clear the event
+					usleep(Wait);
+			}
+		}
+		else
+			usleep(Wait);
+
+		Depth = ReadFIFOMonitorChannel(Channel, &Overflow, &OverThresh, &Underflow, Current);
+		AnyOverflow |= Overflow;
+		AnyOverThresh |= OverThresh;
+		AnyUnderflow |= Underflow;
+		//
+		// predict time to reach the required depth from the rate seen since the last read
+		//
+		Now = GetMicroseconds();
+		if ((Depth > PrevDepth) && (Now > PrevTime))
+			Wait = (uint32_t)(((uint64_t)(Required - Depth) * (Now - PrevTime)) / (Depth - PrevDepth));
+		else
+			Wait = Wait * 2;
+		if (Wait < VMINFIFOWAIT)
+			Wait = VMINFIFOWAIT;
+		else if (Wait > VMAXFIFOWAIT)
+			Wait = VMAXFIFOWAIT;
+		PrevDepth = Depth;
+		PrevTime = Now;
+	}
+	*Overflowed = AnyOverflow;
+	*OverThreshold = AnyOverThresh;
+	*Underflowed = AnyUnderflow;
+	return Depth;
+}
+
+
+
 //
 // uint32_t ReadFIFOMonitorChannel(EDMAStreamSelect Channel, bool* Overflowed, bool* OverThreshold, bool* Underflowed,  unsigned int* Current);
 //
@@ -65,16 +216,15 @@ void SetupFIFOMonitorChannel(EDMAStreamSelect Channel, bool EnableInterrupt)
 //   Underflowed:       true if underflow has occurred. Cleared by read.
 //   Current:           number of locations occupied (in either FIFO type)
 //
-uint32_t ReadFIFOMonitorChannel(EDMAStreamSelect Channel, bool* Overflowed, bool* OverThreshold, bool* Underflowed,  unsigned int* Current)
+//
+// decode a FIFO monitor status register value
+//
+static uint32_t DecodeFIFOMonitorChannel(EDMAStreamSelect Channel, uint32_t Data, bool* Overflowed, bool* OverThreshold, bool* Underflowed,  unsigned int* Current)
 {
-	uint32_t Address;							// register address
-	uint32_t Data = 0;							// register content
 	bool Overflow = false;
 	bool OverThresh = false;
 	bool Underflow = false;
 
-	Address = VADDRFIFOMONBASE + 4 * (uint32_t)Channel;			// status register address
-	Data = RegisterRead(Address);
 	if (Data & 0x80000000)										// if top bit set, declare overflow
 		Overflow = true;
 	if (Data & 0x40000000)										// if bit 30 set, declare over threshold
@@ -92,6 +242,80 @@ uint32_t ReadFIFOMonitorChannel(EDMAStreamSelect Channel, bool* Overflowed, bool
 }
 
 
+uint32_t ReadFIFOMonitorChannel(EDMAStreamSelect Channel, bool* Overflowed, bool* OverThreshold, bool* Underflowed,  unsigned int* Current)
+{
+	uint32_t Address;							// register address
+	uint32_t Data = 0;							// register content
+
+	Address = VADDRFIFOMONBASE + 4 * (uint32_t)Channel;			// status register address
+	Data = RegisterRead(Address);
+	return DecodeFIFOMonitorChannel(Channel, Data, Overflowed, OverThreshold, Underflowed, Current);
+}
+
+
+//
+// short read of a read FIFO: 8 bytes per location
+//
+int ReadFIFOAvailableDMA(EDMAStreamSelect Channel, int fd, unsigned char* DestData, uint32_t MinLength, uint32_t MaxLength,
+						 uint32_t Granule, uint32_t AXIAddr, uint32_t* Length,
+						 bool* Overflowed, bool* OverThreshold, bool* Underflowed, unsigned int* Current)
+{
+	struct DMAShortRead Read;
+	int Result;
+
+	Read.MinLength = MinLength;
+	Read.MaxLength = MaxLength;
+	Read.Granule = Granule;
+	Read.AXIAddr = AXIAddr;
+	Read.StatusAddr = VADDRFIFOMONBASE + 4 * (uint32_t)Channel;
+	Read.DepthMask = 0xFFFF;
+	Read.WordBytes = 8;
+	Result = DMAReadAvailableFromFPGA(fd, DestData, &Read);
+	*Length = Read.Length;
+	if (Result == 0)
+		DecodeFIFOMonitorChannel(Channel, Read.Status, Overflowed, OverThreshold, Underflowed, Current);
+	return Result;
+}
+
+
+//
+// register list for a status snapshot. Runs of consecutive addresses become block reads,
+// so this is 4 transactions: status, ADC overflow, FIFO monitors, analogue inputs
+//
+#define VSNAPSHOTFIFO 2							// index of 1st FIFO monitor
+#define VSNAPSHOTANALOGUE (VSNAPSHOTFIFO + VNUMFIFOCHANNELS)
+#define VSNAPSHOTSIZE (VSNAPSHOTANALOGUE + VNUMANALOGUEIN)
+
+static const uint32_t SnapshotAddresses[VSNAPSHOTSIZE] =
+{
+	VADDRSTATUSREG, VADDRADCOVERFLOWBASE,
+	VADDRFIFOMONBASE, VADDRFIFOMONBASE + 4, VADDRFIFOMONBASE + 8, VADDRFIFOMONBASE + 12,
+	VADDRALEXADCBASE, VADDRALEXADCBASE + 4, VADDRALEXADCBASE + 8,
+	VADDRALEXADCBASE + 12, VADDRALEXADCBASE + 16, VADDRALEXADCBASE + 20
+};
+
+
+void ReadStatusSnapshot(struct StatusSnapshot* Snapshot)
+{
+	uint32_t Data[VSNAPSHOTSIZE];
+	uint32_t Cntr;
+	struct FIFOMonitorReading* FIFO;
+
+	RegisterReadScatter(SnapshotAddresses, Data, VSNAPSHOTSIZE);
+	Snapshot->Status = Data[0];
+	SetStatusRegisterValue(Data[0]);
+	Snapshot->ADCOverflow = Data[1] & 0x3;
+	for (Cntr = 0; Cntr < VNUMFIFOCHANNELS; Cntr++)
+	{
+		FIFO = &Snapshot->FIFOs[Cntr];
+		FIFO->Depth = DecodeFIFOMonitorChannel((EDMAStreamSelect)Cntr, Data[VSNAPSHOTFIFO + Cntr],
+			&FIFO->Overflowed, &FIFO->OverThreshold, &FIFO->Underflowed, &FIFO->Current);
+	}
+	for (Cntr = 0; Cntr < VNUMANALOGUEIN; Cntr++)
+		Snapshot->Analogue[Cntr] = Data[VSNAPSHOTANALOGUE + Cntr];
+}
+
+
 
 
 
@@ -133,6 +357,110 @@ void ResetDMAStreamFIFO(EDMAStreamSelect DDCNum)
 
 
 
+//
+// DMA error recovery. The counts are read by the metrics thread, so are kept under a mutex.
+//
+static const char* DMAStreamNames[VNUMFIFOCHANNELS] = {"DDC", "DUC", "mic", "speaker"};
+static struct DMARecoveryCounts DMARecoveries[VNUMFIFOCHANNELS];
+static pthread_mutex_t DMARecoveryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+bool RecoverDMAStream(EDMAStreamSelect Channel, int* fd, const char* Path, int Result)
+{
+	struct timespec Start, End;
+	struct DMARecoveryCounts* Counts = DMARecoveries + Channel;
+	EDMAErrorClass Class;
+	uint32_t Microseconds;
+	bool Error;
+
+	clock_gettime(CLOCK_MONOTONIC, &Start);
+	Class = ClassifyDMAError(Result);
+	printf("%s DMA %s error (%d): resetting the DMA engine and FIFO\n", DMAStreamNames[Channel],
+		GetDMAErrorClassName(Class), Result);
+	*fd = ReopenDMADevice(*fd, Path, O_RDWR);
+	Error = (*fd < 0);
+	if (!Error)
+		ResetDMAStreamFIFO(Channel);
+	clock_gettime(CLOCK_MONOTONIC, &End);
+	Microseconds = (End.tv_sec - Start.tv_sec) * 1000000 + (End.tv_nsec - Start.tv_nsec) / 1000;
+
+	pthread_mutex_lock(&DMARecoveryMutex);
+	Counts->Errors[Class]++;
+	if (Error)
+		Counts->Failures++;
+	else
+		Counts->Recoveries++;
+	Counts->TotalMicroseconds += Microseconds;
+	if (Microseconds > Counts->MaxMicroseconds)
+		Counts->MaxMicroseconds = Microseconds;
+	pthread_mutex_unlock(&DMARecoveryMutex);
+	if (!Error)
+		printf("%s DMA recovered in %uus\n", DMAStreamNames[Channel], Microseconds);
+	return Error;
+}
+
+
+void GetDMARecoveryCounts(EDMAStreamSelect Channel, struct DMARecoveryCounts* Counts)
+{
+	pthread_mutex_lock(&DMARecoveryMutex);
+	*Counts = DMARecoveries[Channel];
+	pthread_mutex_unlock(&DMARecoveryMutex);
+}
+
+
+
+//
+// H2C streaming rings. Tail follows the bytes the engine has read, as told by the driver.
+//
+bool StartDMAStreamRing(struct SPSCRingBuffer* Ring, int fd, uint32_t Size, uint32_t BlockSize, uint32_t AXIAddr)
+{
+	if (DMAStreamStart(fd, Size, BlockSize, AXIAddr))
+		return true;
+	if (MapDeviceRingBuffer(Ring, fd, Size))
+	{
+		DMAStreamStop(fd);
+		return true;
+	}
+	return false;
+}
+
+
+int WriteDMAStreamRing(struct SPSCRingBuffer* Ring, int fd, const unsigned char* Data, uint32_t Length)
+{
+	uint32_t Tail;
+	int Result;
+
+	if (Length > Ring->Size)
+		return -EINVAL;
+	while (RingBytesFree(Ring) < Length)				// at most twice: each credit waits for the last batch
+	{
+		Result = DMAStreamCredit(fd, atomic_load(&Ring->Head), &Tail);
+		if (Result != 0)
+			return Result;
+		atomic_store(&Ring->Tail, Tail);
+	}
+	if (Length != 0)
+	{
+		memcpy(RingWritePtr(Ring), Data, Length);
+		RingCommitWrite(Ring, Length);
+	}
+	Result = DMAStreamCredit(fd, atomic_load(&Ring->Head), &Tail);
+	if (Result == 0)
+		atomic_store(&Ring->Tail, Tail);
+	return Result;
+}
+
+
+void StopDMAStreamRing(struct SPSCRingBuffer* Ring, int fd)
+{
+	if (Ring->Base == NULL)
+		return;
+	FreeRingBuffer(Ring);
+	DMAStreamStop(fd);
+}
+
+
+
 //
 // SetTXAmplitudeEER (bool EEREnabled)
 // enables amplitude restoratino mode. Generates envelope output alongside I/Q samples.
@@ -19,6 +19,8 @@
 #include <stdint.h>
 #include "../common/saturntypes.h"
 #include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+#include "../common/ringbuffer.h"
 #include "../P2_app/InDUCIQ.h"
 
 
@@ -48,6 +50,90 @@ void SetupFIFOMonitorChannel(EDMAStreamSelect Channel, bool EnableInterrupt);
 uint32_t ReadFIFOMonitorChannel(EDMAStreamSelect Channel, bool* Overflowed, bool* OverThreshold, bool* Underflowed, unsigned int* Current);
 
 
+//
+// int ReadFIFOAvailableDMA(EDMAStreamSelect Channel, int fd, unsigned char* DestData, uint32_t MinLength, uint32_t MaxLength,
+//                          uint32_t Granule, uint32_t AXIAddr, uint32_t* Length,
+//                          bool* Overflowed, bool* OverThreshold, bool* Underflowed, unsigned int* Current);
+//
+// read FIFO: read its monitor register and DMA what it holds in one call
+// (DMAReadAvailableFromFPGA()), in place of ReadFIFOMonitorChannel() then a DMA of a size
+// worked out from the depth. At most MaxLength bytes are read, a multiple of Granule;
+// none if fewer than MinLength are available.
+//   Length:			bytes read; 0 if not enough were available
+//   flags and Current:	as ReadFIFOMonitorChannel(), from the depth before the read
+// returns 0, or a negative errno as DMAReadFromFPGA()
+//
+int ReadFIFOAvailableDMA(EDMAStreamSelect Channel, int fd, unsigned char* DestData, uint32_t MinLength, uint32_t MaxLength,
+						 uint32_t Granule, uint32_t AXIAddr, uint32_t* Length,
+						 bool* Overflowed, bool* OverThreshold, bool* Underflowed, unsigned int* Current);
+
+
+//
+// struct FIFOMonitorReading
+// one FIFO monitor channel reading, decoded as ReadFIFOMonitorChannel()
+//
+#define VNUMFIFOCHANNELS 4
+
+struct FIFOMonitorReading
+{
+	uint32_t Depth;								// locations available, as returned by ReadFIFOMonitorChannel()
+	unsigned int Current;						// locations occupied
+	bool Overflowed;
+	bool OverThreshold;
+	bool Underflowed;
+};
+
+
+//
+// void ReadStatusSnapshot(struct StatusSnapshot* Snapshot)
+//
+// read everything reported in a P2 high priority status packet in one scatter read:
+// status register, ADC overflow, analogue inputs and FIFO monitors.
+// the status register value is also stored, as ReadStatusRegister(), so the
+// GetP2PTTKeyInputs() and GetUserIOBits() calls use it.
+// reading clears the ADC overflow and FIFO monitor flags, as the single reads do.
+//
+struct StatusSnapshot
+{
+	uint32_t Status;							// status register
+	uint32_t ADCOverflow;						// bit0: ADC1 overflow; bit1: ADC2 overflow
+	uint32_t Analogue[VNUMANALOGUEIN];			// AIN1 ... AIN6
+	struct FIFOMonitorReading FIFOs[VNUMFIFOCHANNELS];	// indexed by EDMAStreamSelect
+};
+
+void ReadStatusSnapshot(struct StatusSnapshot* Snapshot);
+
+
+//
+// void EnableFIFOEvents(bool Enabled)
+// select FIFO monitor interrupt events for all channels set up afterwards
+//
+void EnableFIFOEvents(bool Enabled);
+
+
+//
+// bool OpenFIFOEventDevice(EDMAStreamSelect Channel)
+// open the XDMA user event device for a FIFO monitor channel.
+// returns true if available; if not, WaitFIFOMonitorChannel() uses timed polling
+//
+bool OpenFIFOEventDevice(EDMAStreamSelect Channel);
+
+
+//
+// uint32_t WaitFIFOMonitorChannel(EDMAStreamSelect Channel, uint32_t Required, uint32_t TimeoutUs,
+//                                 bool* Overflowed, bool* OverThreshold, bool* Underflowed, unsigned int* Current);
+//
+// wait until a FIFO has at least Required locations available (occupied for a read FIFO,
+// free for a write FIFO), or until TimeoutUs has passed.
+// returns the last depth read, as ReadFIFOMonitorChannel(). The flags are set if set
+// by any read during the wait.
+//
+#define VFIFOWAITTIMEOUT 10000                  // default wait timeout, us, so callers can check for stop
+
+uint32_t WaitFIFOMonitorChannel(EDMAStreamSelect Channel, uint32_t Required, uint32_t TimeoutUs,
+                                bool* Overflowed, bool* OverThreshold, bool* Underflowed, unsigned int* Current);
+
+
 //
 // reset a stream FIFO
 // clears the FIFOs directly read ori written by the FPGA
@@ -55,6 +141,64 @@ uint32_t ReadFIFOMonitorChannel(EDMAStreamSelect Channel, bool* Overflowed, bool
 void ResetDMAStreamFIFO(EDMAStreamSelect DDCNum);
 
 
+//
+// DMA error recovery counts for one stream FIFO's DMA device
+//
+struct DMARecoveryCounts
+{
+    uint32_t Errors[VNUMDMAERRORCLASSES];               // failed transfers by class (eDMAErrorNone unused)
+    uint32_t Recoveries;                                // engine and FIFO resets made
+    uint32_t Failures;                                  // recoveries where the device could not be opened again
+    uint64_t TotalMicroseconds;                         // time spent recovering
+    uint32_t MaxMicroseconds;                           // longest recovery
+};
+
+
+//
+// bool RecoverDMAStream(EDMAStreamSelect Channel, int* fd, const char* Path, int Result)
+// recover a stream whose DMA call on *fd returned Result (a negative errno), without
+// restarting the program: the transfer is abandoned, the XDMA engine reset by opening
+// its device Path again (*fd is updated), and the stream FIFO reset. The caller discards
+// its buffered data and resynchronises its framing. Counted in the recovery counts.
+// return true if the device could not be opened again (*fd is then -1)
+//
+bool RecoverDMAStream(EDMAStreamSelect Channel, int* fd, const char* Path, int Result);
+
+
+//
+// void GetDMARecoveryCounts(EDMAStreamSelect Channel, struct DMARecoveryCounts* Counts)
+// copy the error and recovery counts of one stream
+//
+void GetDMARecoveryCounts(EDMAStreamSelect Channel, struct DMARecoveryCounts* Counts);
+
+
+//
+// bool StartDMAStreamRing(struct SPSCRingBuffer* Ring, int fd, uint32_t Size, uint32_t BlockSize, uint32_t AXIAddr)
+// start the driver's H2C streaming ring on write device fd, writing to AXIAddr, and map it
+// as Ring. Samples are then written with WriteDMAStreamRing() instead of DMAWriteToFPGA().
+// the FPGA must hold off the engine's AXI writes while the stream FIFO is full.
+// return true if not possible (eg an older driver, or the simulated FPGA)
+//
+bool StartDMAStreamRing(struct SPSCRingBuffer* Ring, int fd, uint32_t Size, uint32_t BlockSize, uint32_t AXIAddr);
+
+
+//
+// int WriteDMAStreamRing(struct SPSCRingBuffer* Ring, int fd, const unsigned char* Data, uint32_t Length)
+// copy Length bytes into an H2C streaming ring and credit them to the engine. If the ring
+// hasn't room, waits for the engine to read enough of what it holds. Length 0 waits
+// for the engine to read everything credited, eg before the FIFO is reset.
+// return 0, or a negative errno as DMAWriteToFPGA()
+//
+int WriteDMAStreamRing(struct SPSCRingBuffer* Ring, int fd, const unsigned char* Data, uint32_t Length);
+
+
+//
+// void StopDMAStreamRing(struct SPSCRingBuffer* Ring, int fd)
+// unmap and stop an H2C streaming ring, eg before RecoverDMAStream()
+//
+void StopDMAStreamRing(struct SPSCRingBuffer* Ring, int fd);
+
+
 //
 // SetTXAmplitudeEER (bool EEREnabled)
 // enables amplitude restoratino mode. Generates envelope output alongside I/Q samples.
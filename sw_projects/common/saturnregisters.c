@@ -21,8 +21,13 @@
 #include <math.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "version.h"
+#include "saturntablecalc.h"
+#include "saturntables.h"                 // generated at build time by tables.mk
 #include <stdio.h>
+#include <string.h>
 
 //
 // semaphores to protect registers that are accessed from several threads
@@ -33,15 +38,14 @@ sem_t RFGPIOMutex;
 
 //
 // ROMs for DAC Current Setting and 0.5dB step digital attenuator
+// are DACCurrentROM[] and DACStepAttenROM[] in saturntables.h
 //
-unsigned int DACCurrentROM[256];                    // used for residual attenuation
-unsigned int DACStepAttenROM[256];                  // provides most atten setting
 
 
 //
 // local copies of values written to registers
 //
-#define VMAXP1DDCS 7                                // max number of DDCs used for P1
+#define VMAXP1DDCS 8                                // max number of DDCs used for P1
 #define VSAMPLERATE 122880000                       // sample rate in Hz
 
 uint32_t DDCDeltaPhase[VNUMDDC];                    // DDC frequency settings
@@ -89,12 +93,12 @@ uint32_t GClassEPWMMax;                             // max class E PWM. NOT USED
 uint32_t GCodecConfigReg;                           // codec configuration
 bool GSidetoneEnabled;                              // true if sidetone is enabled
 unsigned int GSidetoneVolume;                       // assigned sidetone volume (8 bit signed)
-bool GWidebandADC1;                                 // true if wideband on ADC1. For P2 - not used yet.
-bool GWidebandADC2;                                 // true if wideband on ADC2. For P2 - not used yet.
+bool GWidebandADC1;                                 // true if wideband on ADC1
+bool GWidebandADC2;                                 // true if wideband on ADC2
 unsigned int GWidebandSampleCount;                  // P2 - not used yet
 unsigned int GWidebandSamplesPerPacket;             // P2 - not used yet
-unsigned int GWidebandUpdateRate;                   // update rate in ms. P2 - not used yet. 
-unsigned int GWidebandPacketsPerFrame;              // P2 - not used yet
+unsigned int GWidebandUpdateRate;                   // update rate in ms
+unsigned int GWidebandPacketsPerFrame;              // packets per wideband frame
 unsigned int GAlexEnabledBits;                      // P2. True if Alex1-8 enabled. NOT USED YET.
 bool GPAEnabled;                                    // P2. True if PA enabled. NOT USED YET.
 unsigned int GTXDACCount;                           // P2. #TX DACs. NOT USED YET.
@@ -118,21 +122,20 @@ bool GEEREnabled;                                   // P2. true if EER is enable
 ETXModulationSource GTXModulationSource;            // values added to register
 bool GTXProtocolP2;                                 // true if P2
 uint32_t TXModulationTestReg;                       // modulation test DDS
-bool GEnableTimeStamping;                           // true if timestamps to be added to data. NOT IMPLEMENTED YET
-bool GEnableVITA49;                                 // true if to enable VITA49 formatting. NOT SUPPORTED YET
+bool GEnableTimeStamping;                           // true if timestamps to be added to DDC data
+uint8_t GDDCSampleSize[VNUMDDC] = {24, 24, 24, 24, 24, 24, 24, 24, 24, 24};  // bits per DDC sample sent
+bool GEnableVITA49;                                 // true if to enable VITA49 formatting of the DDC packets
 unsigned int GCWKeyerRampms = 0;                    // ramp length for keyer, in ms
 bool GCWKeyerRamp_IsP2 = false;                     // true if ramp initialised for protocol 2
 
-unsigned int DACCurrentROM[256];                    // used for residual attenuation
-unsigned int DACStepAttenROM[256];                  // provides most atten setting
 unsigned int GNumADCs;                              // count of ADCs available
 
 
 //
 // local copies of Codec registers
 //
-unsigned int GCodecLineGain;                        // value written in Codec left line in gain register
-unsigned int GCodecAnaloguePath;                    // value written in Codec analogue path register
+unsigned int GCodecLineGain = 0;                    // value written in Codec left line in gain register
+unsigned int GCodecAnaloguePath = 0x14;             // value written in Codec analogue path register (as CodecInitialise())
 
 
 //
@@ -253,7 +256,6 @@ uint32_t DDCRegisters[VNUMDDC] =
 #define VCWKEYERDELAY 0                                 // delay bits 7:0
 #define VCWKEYERHANG 8                                  // hang time is 17:8
 #define VCWKEYERRAMP 18                                 // ramp time
-#define VRAMPSIZE 4096                                  // max ramp length in words
 
 
 //
@@ -294,59 +296,235 @@ uint32_t DDCRegisters[VNUMDDC] =
 //
 void InitialiseFIFOSizes(void)
 {
-	ESoftwareID ID;
-	unsigned int Version = 0;
-    Version = GetFirmwareVersion(&ID);
-    if((Version >= 10) && (Version <= 12))
-    {
-        printf("loading new FIFO sizes for updated firmware <= 12\n");
-        DMAFIFODepths[0] = 16384;       //  eRXDDCDMA,		selects RX
-        DMAFIFODepths[1] = 2048;        //  eTXDUCDMA,		selects TX
-        DMAFIFODepths[2] = 256;         //  eMicCodecDMA,	selects mic samples
-        DMAFIFODepths[3] = 1024;        //  eSpkCodecDMA	selects speaker samples
-    }
-    else if(Version >= 13)
+    const struct SaturnCapabilities* Caps = GetHardwareCapabilities();
+
+    memcpy(DMAFIFODepths, Caps->FIFODepths, sizeof(DMAFIFODepths));
+    printf("FIFO sizes loaded for firmware V%d\n", Caps->FirmwareVersion);
+}
+
+
+
+//
+// register write transactions
+// most setters read-modify-write a shadow copy of a hardware register, then write it.
+// between BeginRegisterTransaction() and CommitRegisterTransaction() the setters below
+// only update the shadow and mark the register dirty; the commit then writes each dirty
+// register once, with the shadow value at the time of the commit.
+// transactions are per thread: setters called from any other thread write straight through.
+// they nest: only the outermost commit writes.
+//
+typedef enum
+{
+    eShadowRFGPIO,
+    eShadowKeyerConfig,
+    eShadowIambicConfig,
+    eShadowDACCtrl,
+    eShadowADCCtrl,
+    eShadowDDCInSel,
+    eShadowAlexRX,
+    eShadowAlexTXFilt,
+    eShadowAlexTXAnt,
+    eShadowCodecConfig,
+    eShadowTXConfig,
+    eShadowDDCRate,
+    VNUMSHADOWREGS
+} EShadowRegister;
+
+struct ShadowRegister
+{
+    uint32_t Address;                               // hardware register address
+    uint32_t* Value;                                // shadow (local copy) of its content
+    sem_t* Mutex;                                   // semaphore protecting the shadow, or NULL
+};
+
+static const struct ShadowRegister ShadowRegisters[VNUMSHADOWREGS] =
+{
+    {VADDRRFGPIOREG, &GPIORegValue, &RFGPIOMutex},
+    {VADDRKEYERCONFIGREG, &GCWKeyerSetup, NULL},
+    {VADDRIAMBICCONFIG, &GIambicConfigReg, NULL},
+    {VADDRDACCTRLREG, &GTXDACCtrl, NULL},
+    {VADDRADCCTRLREG, &GRXADCCtrl, NULL},
+    {VADDRDDCINSEL, &DDCInSelReg, &DDCInSelMutex},
+    {VADDRALEXSPIREG+VOFFSETALEXRXREG, &GAlexRXRegister, NULL},
+    {VADDRALEXSPIREG+VOFFSETALEXTXFILTREG, &GAlexTXFiltRegister, NULL},
+    {VADDRALEXSPIREG+VOFFSETALEXTXANTREG, &GAlexTXAntRegister, NULL},
+    {VADDRCODECCONFIGREG, &GCodecConfigReg, NULL},
+    {VADDRTXCONFIGREG, &TXConfigRegValue, NULL},
+    {VADDRDDCRATES, &DDCRateReg, NULL}
+};
+
+static __thread bool InRegisterTransaction;         // true if this thread has a transaction open
+static __thread uint32_t RegisterTransactionDepth;  // transactions open on this thread, outermost first
+static __thread uint32_t DirtyShadowRegisters;      // 1 bit per EShadowRegister
+static __thread uint32_t DirtyDDCFrequencies;       // 1 bit per DDC whose delta phase is staged
+
+static uint32_t HardwareValue[VNUMSHADOWREGS];      // value last written to each register
+static bool HardwareValueKnown[VNUMSHADOWREGS];     // false until the 1st write
+static pthread_mutex_t HardwareValueMutex = PTHREAD_MUTEX_INITIALIZER;     // protects the two above
+static _Atomic uint64_t RegisterWritesMade;         // AXI writes made through the shadow
+static _Atomic uint64_t RegisterWritesSkipped;      // AXI writes not needed: value unchanged
+
+
+//
+// write a shadowed register, unless the hardware already holds that value
+// call with the register's semaphore held, if it has one. Most registers have none and
+// their setters run on several threads, so the compare, write and record are made under
+// HardwareValueMutex: otherwise two writers could each find the other's value "unchanged".
+// returns true if the register was written
+//
+static bool CachedRegisterWrite(EShadowRegister Reg, uint32_t Value)
+{
+    pthread_mutex_lock(&HardwareValueMutex);
+    if(HardwareValueKnown[Reg] && (HardwareValue[Reg] == Value))
     {
-        printf("loading new FIFO sizes for updated firmware V13+\n");
-        DMAFIFODepths[0] = 16384;       //  eRXDDCDMA,		selects RX
-        DMAFIFODepths[1] = 4096;        //  eTXDUCDMA,		selects TX
-        DMAFIFODepths[2] = 256;         //  eMicCodecDMA,	selects mic samples
-        DMAFIFODepths[3] = 1024;        //  eSpkCodecDMA	selects speaker samples
+        pthread_mutex_unlock(&HardwareValueMutex);
+        atomic_fetch_add_explicit(&RegisterWritesSkipped, 1, memory_order_relaxed);
+        return false;
     }
+    RegisterWrite(ShadowRegisters[Reg].Address, Value);
+    HardwareValue[Reg] = Value;
+    HardwareValueKnown[Reg] = true;
+    pthread_mutex_unlock(&HardwareValueMutex);
+    atomic_fetch_add_explicit(&RegisterWritesMade, 1, memory_order_relaxed);
+    return true;
+}
+
+
+//
+// write a shadowed register, or defer it if this thread has a transaction open.
+// Value must already have been stored into the shadow.
+//
+static void ShadowRegisterWrite(EShadowRegister Reg, uint32_t Value)
+{
+    if(InRegisterTransaction)
+        DirtyShadowRegisters |= (1 << Reg);
+    else
+        CachedRegisterWrite(Reg, Value);
+}
+
+
+//
+// GetRegisterWriteCounts(uint64_t* Made, uint64_t* Skipped)
+// return the number of shadowed register writes made, and skipped because unchanged
+//
+void GetRegisterWriteCounts(uint64_t* Made, uint64_t* Skipped)
+{
+    *Made = atomic_load_explicit(&RegisterWritesMade, memory_order_relaxed);
+    *Skipped = atomic_load_explicit(&RegisterWritesSkipped, memory_order_relaxed);
 }
 
 
+//
+// BeginRegisterTransaction(void)
+// start deferring shadowed register writes made by this thread
+//
+void BeginRegisterTransaction(void)
+{
+    if(RegisterTransactionDepth++ != 0)
+        return;                                     // nested: the outer transaction's commit writes
+    InRegisterTransaction = true;
+    DirtyShadowRegisters = 0;
+    DirtyDDCFrequencies = 0;
+    CodecBeginBatch();                              // codec SPI writes are batched too
+}
+
 
 //
-// initialise the DAC Atten ROMs
-// these set the step attenuator and DAC drive level
-// for "attenuation intent" values from 0 to 255
+// write the staged DDC delta phases together, so DDCs retuned by one message
+// (eg a diversity or PureSignal pair) change as close in time as possible.
+// each run of consecutive frequency registers is written as one block.
+// returns the number of register writes made.
 //
-void InitialiseDACAttenROMs(void)
+static unsigned int CommitDDCFrequencies(void)
 {
-    unsigned int Level;                         // input demand value
-    double DesiredAtten;                        // desired attenuation in dB
-    unsigned int StepValue;                     // integer step atten drive value
-    double ResidualAtten;                       // atten to go in the current setting DAC
-    unsigned int DACDrive;                      // int value to go to DAC ROM
+    uint32_t Phases[VNUMDDC];
+    unsigned int Count = 0;
+    unsigned int First, Last;
+
+    if(DirtyDDCFrequencies == 0)
+        return 0;
+    memcpy(Phases, DDCDeltaPhase, sizeof(Phases));      // take them all, then write with no gaps
+    for(First = 0; First < VNUMDDC; First = Last + 1)
+    {
+        Last = First;
+        if((DirtyDDCFrequencies & (1 << First)) == 0)
+            continue;
+        while(((Last + 1) < VNUMDDC) && (DirtyDDCFrequencies & (1 << (Last + 1)))
+              && (DDCRegisters[Last + 1] == DDCRegisters[Last] + 4))
+            Last++;
+        RegisterWriteBlock(DDCRegisters[First], Phases + First, Last - First + 1);
+        Count += Last - First + 1;
+    }
+    DirtyDDCFrequencies = 0;
+    return Count;
+}
+
 
 //
-// do the max atten values separately; then calculate point by point
+// commit one dirty register of a transaction
+// returns true if it was written
 //
-    DACCurrentROM[0] = 0;                       // min level
-    DACStepAttenROM[0] = 63;                    // max atten
+static bool CommitShadowRegister(EShadowRegister Reg)
+{
+    const struct ShadowRegister* Shadow = &ShadowRegisters[Reg];
+    bool Written;
+
+    if(Shadow->Mutex != NULL)
+        sem_wait(Shadow->Mutex);                    // another thread may own the shadow right now
+    Written = CachedRegisterWrite(Reg, *Shadow->Value);
+    if(Shadow->Mutex != NULL)
+        sem_post(Shadow->Mutex);
+    return Written;
+}
 
-    for (Level = 1; Level < 256; Level++)
+
+//
+// CommitRegisterTransaction(void)
+// write every register changed since BeginRegisterTransaction() once, and
+// end the transaction. Registers set back to the value they already held are not written.
+// if the transaction asserts MOX, the RF GPIO register (MOX, TX enable) is written last,
+// so the Alex antenna and filter words, attenuators and DAC settings for TX are in place
+// before the PA is keyed; otherwise it is written first, so MOX drops before RX settings.
+// staged DDC frequencies are written first of all, in one burst; staged codec writes last.
+// with a register write queue installed (regqueue.c) the writes are queued as one group,
+// in that order, and the owner thread makes them.
+// Returns the number of register writes made.
+//
+unsigned int CommitRegisterTransaction(void)
+{
+    unsigned int Count = 0;
+    unsigned int Cntr;
+    bool KeyDown = false;
+
+    if((RegisterTransactionDepth != 0) && (--RegisterTransactionDepth != 0))
+        return 0;
+    InRegisterTransaction = false;
+    BeginQueuedRegisterWrites();
+    Count += CommitDDCFrequencies();
+    if(DirtyShadowRegisters & (1 << eShadowRFGPIO))
+    {
+        sem_wait(&RFGPIOMutex);
+        pthread_mutex_lock(&HardwareValueMutex);
+        KeyDown = (GPIORegValue & (1 << VMOXBIT))
+                  && !(HardwareValueKnown[eShadowRFGPIO] && (HardwareValue[eShadowRFGPIO] & (1 << VMOXBIT)));
+        pthread_mutex_unlock(&HardwareValueMutex);
+        sem_post(&RFGPIOMutex);
+    }
+    for(Cntr = 0; Cntr < VNUMSHADOWREGS; Cntr++)
     {
-        DesiredAtten = 20.0*log10(255.0/(double)Level);     // this is the atten value we want after the high speed DAC
-        StepValue = (int)(2.0*DesiredAtten);                // 6 bit step atten should be set to
-        if(StepValue > 63)                                  // clip to 6 bits
-            StepValue = 63;
-        ResidualAtten = DesiredAtten - ((double)StepValue * 0.5);        // this needs to be achieved through the current setting drive
-        DACDrive = (unsigned int)(255.0/pow(10.0,(ResidualAtten/20.0)));
-        DACCurrentROM[Level] = DACDrive;
-        DACStepAttenROM[Level] = StepValue;
+        if((DirtyShadowRegisters & (1 << Cntr)) == 0)
+            continue;
+        if(KeyDown && (Cntr == eShadowRFGPIO))
+            continue;
+        if(CommitShadowRegister(Cntr))
+            Count++;
     }
+    if(KeyDown && CommitShadowRegister(eShadowRFGPIO))
+        Count++;
+    DirtyShadowRegisters = 0;
+    Count += CodecCommitBatch();
+    EndQueuedRegisterWrites();
+    return Count;
 }
 
 
@@ -367,7 +545,7 @@ void SetByteSwapping(bool IsSwapped)
         Register &= ~(1<<VDATAENDIAN);              // clear bit for raspberry pi local order
 
     GPIORegValue = Register;                        // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);        // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);        // and write to it
     sem_post(&RFGPIOMutex);                         // clear protection
 }
 
@@ -387,7 +565,7 @@ void ActivateCWKeyer(bool Keyer)
     if(Register != GCWKeyerSetup)                       // write back if different
     {
         GCWKeyerSetup = Register;                       // store it back
-        RegisterWrite(VADDRKEYERCONFIGREG, Register);   // and write to it
+        ShadowRegisterWrite(eShadowKeyerConfig, Register);   // and write to it
     }
 
 }
@@ -412,7 +590,7 @@ void SetMOX(bool Mox)
     else
         Register &= ~(1 << VMOXBIT);
     GPIORegValue = Register;                        // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);        // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);        // and write to it
 //
 // now set CW keyer if required
 //
@@ -441,7 +619,7 @@ void SetTXEnable(bool Enabled)
     else
         Register &= ~(1 << VTXENABLEBIT);
     GPIORegValue = Register;                        // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);        // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);        // and write to it
     sem_post(&RFGPIOMutex);                         // clear protected access
 }
 
@@ -462,7 +640,7 @@ void SetATUTune(bool TuneEnabled)
     else
         Register &= ~(1 << VATUTUNEBIT);
     GPIORegValue = Register;                        // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);        // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);        // and write to it
     sem_post(&RFGPIOMutex);                         // clear protected access
 }
 
@@ -487,7 +665,7 @@ void SetP1SampleRate(ESampleRate Rate, unsigned int DDCCount)
     P1SampleRate = Rate;                                // rate for all DDC
 //
     // set all DDC up to max to rate; rest to 0
-    for (Cntr = 0; Cntr < (DDCCount + 1); Cntr++)
+    for (Cntr = 0; Cntr < DDCCount; Cntr++)
     {
         RegisterValue |= RateBits;                      // add in rate bits for this DDC
         RateBits = RateBits << 3;                       // get ready for next DDC
@@ -503,7 +681,8 @@ void SetP1SampleRate(ESampleRate Rate, unsigned int DDCCount)
 //
 // SetP2SampleRate(unsigned int DDC, bool Enabled, unsigned int SampleRate, bool InterleaveWithNext)
 // sets the sample rate for a single DDC (used in protocol 2)
-// allowed rates are 48KHz to 1536KHz.
+// allowed rates are 48KHz to 1536KHz; lower rates (12, 24KHz) set 48KHz and are
+// decimated in software.
 // This sets the DDCRateReg variable and does NOT write to hardware
 // The WriteP2DDCRateRegister() call must be made after setting values for all DDCs
 //
@@ -562,16 +741,37 @@ void SetP2SampleRate(unsigned int DDC, bool Enabled, unsigned int SampleRate, bo
 //
 bool WriteP2DDCRateRegister(void)
 {
-    uint32_t CurrentValue;                          // current register setting
-    bool Result = false;                            // return value
-    CurrentValue = RegisterRead(VADDRDDCRATES);
-    if (CurrentValue != DDCRateReg)
-        Result = true;
-    RegisterWrite(VADDRDDCRATES, DDCRateReg);        // and write to hardware register
-    return Result;
+    pthread_mutex_lock(&HardwareValueMutex);
+    if(!HardwareValueKnown[eShadowDDCRate])          // 1st time: find what the hardware has
+    {
+        HardwareValue[eShadowDDCRate] = RegisterRead(VADDRDDCRATES);
+        HardwareValueKnown[eShadowDDCRate] = true;
+    }
+    pthread_mutex_unlock(&HardwareValueMutex);
+    return CachedRegisterWrite(eShadowDDCRate, DDCRateReg); // write to hardware register if changed
+}
+
+
+
+//
+// unsigned int GetP2SampleRate(unsigned int DDC)
+// get a DDC's sample rate in KHz last set by SetP2SampleRate()
+//
+unsigned int GetP2SampleRate(unsigned int DDC)
+{
+    return P2SampleRates[DDC];
 }
 
 
+//
+// uint32_t GetP2DDCRateWord(void)
+// get the DDC rate register value last set by SetP2SampleRate()
+//
+uint32_t GetP2DDCRateWord(void)
+{
+    return DDCRateReg;
+}
+
 
 //
 // uint32_t GetDDCEnables(void)
@@ -610,7 +810,7 @@ void SetOpenCollectorOutputs(unsigned int bits)
     Register = Register & ~BitMask;                 // strip old bits, add new
     Register |= (bits << VOPENCOLLECTORBITS);
     GPIORegValue = Register;                    // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);  // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);  // and write to it
     sem_post(&RFGPIOMutex);                         // clear protected access
 }
 
@@ -657,7 +857,7 @@ void SetADCOptions(EADCSelect ADC, bool PGA, bool Dither, bool Random)
         Register |= (1 << RandBit);
 
     GPIORegValue = Register;                    // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);  // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);  // and write to it
     sem_post(&RFGPIOMutex);                         // clear protected access
 }
 
@@ -670,7 +870,8 @@ void SetADCOptions(EADCSelect ADC, bool PGA, bool Dither, bool Random)
 // Value: 32 bit phase word or frequency word (1Hz resolution)
 // IsDeltaPhase: true if a delta phase value, false if a frequency value (P1)
 // calculate delta phase if required. Delta=2^32 * (F/Fs)
-// store delta phase; write to FPGA register.
+// store delta phase; write to FPGA register, or stage it if this thread has a
+// register transaction open, to be written with the others at the commit.
 //
 void SetDDCFrequency(uint32_t DDC, uint32_t Value, bool IsDeltaPhase)
 {
@@ -691,6 +892,11 @@ void SetDDCFrequency(uint32_t DDC, uint32_t Value, bool IsDeltaPhase)
     if(DDCDeltaPhase[DDC] != DeltaPhase)    // write back if changed
     {
         DDCDeltaPhase[DDC] = DeltaPhase;        // store this delta phase
+        if(InRegisterTransaction)
+        {
+            DirtyDDCFrequencies |= (1 << DDC);  // write at the commit, with the other DDCs
+            return;
+        }
         RegAddress =DDCRegisters[DDC];          // get DDC reg address, 
         RegisterWrite(RegAddress, DeltaPhase);  // and write to it
     }
@@ -811,6 +1017,27 @@ void SetDUCFrequency(unsigned int Value, bool IsDeltaPhase)		// only accepts DUC
 
 
 
+//
+// the Alex words: every setter below changes one of the three Alex SPI words
+// (TX filter/RX ant, RX, TX filter/TX ant) through UpdateAlexWord(). A changed word
+// goes through the register shadow, so within a transaction (one high priority packet)
+// each word is written once at the commit, and only if it differs from the last one
+// written; the Alex SPI IP then shifts out only the words that changed.
+// the P1 setters keep their words up to date but don't write them: P1 does not
+// select the Alex filters, so the words are not complete.
+//
+static void UpdateAlexWord(EShadowRegister Reg, uint32_t Value, bool Write)
+{
+    uint32_t* Word = ShadowRegisters[Reg].Value;
+
+    if(Value == *Word)
+        return;
+    *Word = Value;
+    if(Write)
+        ShadowRegisterWrite(Reg, Value);
+}
+
+
 //
 // SetAlexRXAnt(unsigned int Bits)
 // P1: set the Alex RX antenna bits.
@@ -840,11 +1067,7 @@ void SetAlexRXAnt(unsigned int Bits)
             Register |= 00004100;                       // turn on master in & transverter bits
             break;
     }
-    if(Register != GAlexRXRegister)                     // write back if changed
-    {
-        GAlexRXRegister = Register;
-//        RegisterWrite(VADDRALEXSPIREG+VOFFSETALEXRXREG, Register);  // and write to it
-    }
+    UpdateAlexWord(eShadowAlexRX, Register, false);
 }
 
 
@@ -889,11 +1112,7 @@ void SetAlexTXAnt(unsigned int Bits)
             Register |=0x0400;                          // turn on ANT3
             break;
     }
-    if(Register != GAlexTXAntRegister)                     // write back if changed
-    {
-        GAlexTXAntRegister = Register;
-//        RegisterWrite(VADDRALEXSPIREG+VOFFSETALEXTXREG, Register);  // and write to it
-    }
+    UpdateAlexWord(eShadowAlexTXAnt, Register, false);
 }
 
 
@@ -940,12 +1159,7 @@ void SetAlexRXFilters(bool IsRX1, unsigned int Bits)
             Register |= (Bits & 0x20)<<23;                      // bit 5 moved up
             Register |= (Bits & 0x80)<<21;                      // bit 7 moved up
         }
-
-        if(Register != GAlexRXRegister)                     // write back if changed
-        {
-            GAlexRXRegister = Register;
-    //        RegisterWrite(VADDRALEXSPIREG+VOFFSETALEXRXREG, Register);  // and write to it
-        }
+        UpdateAlexWord(eShadowAlexRX, Register, false);
     }
 }
 
@@ -974,23 +1188,13 @@ void SetAlexTXFilters(unsigned int Bits)
         Register &= 0x1F0F;                                 // turn off all affected bits
         Register |= (Bits & 0x0F)<<4;                       // bits 3-0, moved up
         Register |= (Bits & 0x1C)<<9;                      // bits 6-4, moved up
-
-        if(Register != GAlexTXFiltRegister)                     // write back if changed
-        {
-            GAlexTXFiltRegister = Register;
-    //        RegisterWrite(VADDRALEXSPIREG+VOFFSETALEXTXREG, Register);  // and write to it
-        }
+        UpdateAlexWord(eShadowAlexTXFilt, Register, false);
 
         Register = GAlexTXAntRegister;                         // copy original register
         Register &= 0x1F0F;                                 // turn off all affected bits
         Register |= (Bits & 0x0F)<<4;                       // bits 3-0, moved up
         Register |= (Bits & 0x1C)<<9;                      // bits 6-4, moved up
-
-        if(Register != GAlexTXAntRegister)                     // write back if changed
-        {
-            GAlexTXAntRegister = Register;
-    //        RegisterWrite(VADDRALEXSPIREG+VOFFSETALEXTXREG, Register);  // and write to it
-        }
+        UpdateAlexWord(eShadowAlexTXAnt, Register, false);
     }
 }
 
@@ -1029,11 +1233,7 @@ void AlexManualRXFilters(unsigned int Bits, int RX)
             Register &= 0x0000FFFF;                             // turn off all affected bits
             Register |= (Bits<<16);                             // add back all new bits
         }
-        if(Register != GAlexRXRegister)                     // write back if changed
-        {
-            GAlexRXRegister = Register;
-            RegisterWrite(VADDRALEXSPIREG+VOFFSETALEXRXREG, Register);  // and write to it
-        }
+        UpdateAlexWord(eShadowAlexRX, Register, true);
     }
 }
 
@@ -1058,21 +1258,8 @@ void DisableAlexTRRelay(bool IsDisabled)
 //
 void AlexManualTXFilters(unsigned int Bits, bool HasTXAntExplicitly)
 {
-    uint32_t Register;                                  // modified register
     if(GAlexManualFilterSelect)
-    {
-        Register = Bits;                         // new setting
-        if(HasTXAntExplicitly && (Register != GAlexTXAntRegister))
-        {
-            GAlexTXAntRegister = Register;
-            RegisterWrite(VADDRALEXSPIREG+VOFFSETALEXTXANTREG, Register);  // and write to it
-        }
-        else if(!HasTXAntExplicitly &&(Register != GAlexTXFiltRegister))                     // write back if changed
-        {
-            GAlexTXFiltRegister = Register;
-            RegisterWrite(VADDRALEXSPIREG+VOFFSETALEXTXFILTREG, Register);  // and write to it
-        }
-    }
+        UpdateAlexWord(HasTXAntExplicitly ? eShadowAlexTXAnt : eShadowAlexTXFilt, Bits, true);
 }
 
 
@@ -1124,7 +1311,7 @@ void EnablePPSStamp(bool Enabled)
 // sets the TX DAC current via a PWM DAC output
 // level: 0 to 255 drive level value (255 = max current)
 // sets both step attenuator drive and PWM DAC drive for high speed DAC current,
-// using ROMs calculated at initialise.
+// using the ROMs generated at build time.
 //
 void SetTXDriveLevel(unsigned int Level)
 {
@@ -1139,7 +1326,7 @@ void SetTXDriveLevel(unsigned int Level)
     RegisterValue |= (AttenDrive << 16);            // set step atten when RX
     RegisterValue |= (AttenDrive << 24);            // set step atten when TX
     GTXDACCtrl = RegisterValue;
-    RegisterWrite(VADDRDACCTRLREG, RegisterValue);  // and write to it
+    ShadowRegisterWrite(eShadowDACCtrl, RegisterValue);  // and write to it
 }
 
 
@@ -1222,7 +1409,7 @@ void SetOrionMicOptions(bool MicRing, bool EnableBias, bool EnablePTT)
     GPTTEnabled = !EnablePTT;                       // used when PTT read back - just store opposite state
 
     GPIORegValue = Register;                        // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);      // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);      // and write to it
     sem_post(&RFGPIOMutex);                         // clear protected access
 }
 
@@ -1243,7 +1430,7 @@ void SetBalancedMicInput(bool Balanced)
         Register |= (1 << VBALANCEDMICSELECT);      // set new bit
     
     GPIORegValue = Register;                        // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);      // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);      // and write to it
     sem_post(&RFGPIOMutex);                         // clear protected access
 }
 
@@ -1325,7 +1512,7 @@ void SetADCAttenuator(EADCSelect ADC, unsigned int Atten, bool RXAtten, bool TXA
         }
     }
         GRXADCCtrl = Register; 
-        RegisterWrite(VADDRADCCTRLREG, Register);      // and write to it
+        ShadowRegisterWrite(eShadowADCCtrl, Register);      // and write to it
 }
 
 
@@ -1370,7 +1557,7 @@ void SetCWIambicKeyer(uint8_t Speed, uint8_t Weight, bool ReverseKeys, bool Mode
     if (Register != GIambicConfigReg)               // save if changed
     {
         GIambicConfigReg = Register;
-        RegisterWrite(VADDRIAMBICCONFIG, Register);
+        ShadowRegisterWrite(eShadowIambicConfig, Register);
     }
 }
 
@@ -1397,7 +1584,7 @@ void SetCWXBits(bool CWXEnabled, bool CWXDash, bool CWXDot)
     if (Register != GIambicConfigReg)               // save if changed
     {
         GIambicConfigReg = Register;
-        RegisterWrite(VADDRIAMBICCONFIG, Register);
+        ShadowRegisterWrite(eShadowIambicConfig, Register);
     }
 }
 
@@ -1427,11 +1614,21 @@ void SetDDCADC(int DDC, EADCSelect ADC)
     RegisterValue |= ADCSetting;
 
     DDCInSelReg = RegisterValue;                    // write back
-    RegisterWrite(VADDRDDCINSEL, RegisterValue);    // and write to it
+    ShadowRegisterWrite(eShadowDDCInSel, RegisterValue);    // and write to it
     sem_post(&DDCInSelMutex);
 }
 
 
+//
+// EADCSelect GetDDCADC(int DDC)
+// get the ADC a DDC uses, as last set by SetDDCADC()
+//
+EADCSelect GetDDCADC(int DDC)
+{
+    return (EADCSelect)((DDCInSelReg >> (DDC*2)) & 0x3);
+}
+
+
 
 //
 // void SetRXDDCEnabled(bool IsEnabled);
@@ -1439,11 +1636,8 @@ void SetDDCADC(int DDC, EADCSelect ADC)
 //
 void SetRXDDCEnabled(bool IsEnabled)
 {
-    uint32_t Address;									// register address
     uint32_t Data;										// register content
 
-    Address = VADDRDDCINSEL;							// DDC config register address
-
     sem_wait(&DDCInSelMutex);                           // get protected access
     Data = DDCInSelReg;                                 // get current register setting
     if (IsEnabled)
@@ -1452,14 +1646,59 @@ void SetRXDDCEnabled(bool IsEnabled)
         Data &= ~(1 << 30);								// clear new bit
 
     DDCInSelReg = Data;          // write back
-    RegisterWrite(Address, Data);					// write back
+    ShadowRegisterWrite(eShadowDDCInSel, Data);	// write back
     sem_post(&DDCInSelMutex);
 }
 
 
 #define VMINCWRAMPDURATION 3000                     // 3ms min
-#define VMAXCWRAMPDURATION 10000                    // 10ms max
-#define VMAXCWRAMPDURATIONV14PLUS 20000             // 20ms max
+
+
+//
+// CW ramps already calculated, so a change back to a previous ramp length
+// is just an upload. Keyed by (length, protocol); replaced round robin.
+//
+#define VNUMCACHEDRAMPS 4
+
+struct CWRampCacheEntry
+{
+    bool Valid;
+    bool Protocol2;
+    uint32_t Length_us;
+    uint32_t RampLength;                    // words
+    uint32_t Samples[VRAMPSIZE];            // whole RAM image, including the fill after the ramp
+};
+
+static struct CWRampCacheEntry CWRampCache[VNUMCACHEDRAMPS];
+static uint32_t CWRampCacheNext;            // entry to replace next
+
+
+//
+// find a cached ramp, or calculate it into a free cache entry
+//
+static struct CWRampCacheEntry* GetCWKeyerRamp(bool Protocol2, uint32_t Length_us)
+{
+    struct CWRampCacheEntry* Entry;
+    uint32_t Cntr;
+
+    for(Cntr = 0; Cntr < VNUMCACHEDRAMPS; Cntr++)
+    {
+        Entry = &CWRampCache[Cntr];
+        if(Entry->Valid && (Entry->Length_us == Length_us) && (Entry->Protocol2 == Protocol2))
+            return Entry;
+    }
+
+    printf("calculating new CW ramp, length = %d us\n", Length_us);
+    Entry = &CWRampCache[CWRampCacheNext];
+    CWRampCacheNext = (CWRampCacheNext + 1) % VNUMCACHEDRAMPS;
+
+    Entry->RampLength = CalcCWRampLength(Protocol2, Length_us);
+    CalcCWRamp(Entry->Samples, Entry->RampLength);
+    Entry->Protocol2 = Protocol2;
+    Entry->Length_us = Length_us;
+    Entry->Valid = true;
+    return Entry;
+}
 
 
 //
@@ -1468,33 +1707,19 @@ void SetRXDDCEnabled(bool IsEnabled)
 // needs to be called before keyer enabled!
 // parameter is length in microseconds; typically 5000-10000
 // setup ramp memory and ramp length fields
-// only calculate if paramters have changed!
+// only calculate if paramters have changed! The default length ramps are
+// generated at build time (saturntables.h), so startup doesn't calculate one.
+// the RAM is loaded with one block write rather than a register write per word
 //
 void InitialiseCWKeyerRamp(bool Protocol2, uint32_t Length_us)
 {
-    const double a0 = 0.35875;
-    const double a1 = -0.48829;
-    const double a2 = 0.14128;
-    const double a3 = -0.01168;
-    double LargestSample;
-    double Fraction;                        // fractional position in ramp
-    double SamplePeriod;                    // sample period in us
-    double Length;                          // length required in us
-    uint32_t RampLength;                    // integer length in WORDS not bytes!
-    double RampSample[VRAMPSIZE];           // array samples
-    uint32_t Cntr;
-    uint32_t Sample;                        // ramp sample value
+    struct CWRampCacheEntry* Ramp;
+    const uint32_t* Samples;                // keyer RAM image
+    uint32_t RampLength;                    // words
     uint32_t Register;
-	ESoftwareID ID;
-	unsigned int FPGAVersion = 0;
     unsigned int MaxDuration;               // max ramp duration in microseconds
-    double y, y2, y4, y6,rampsample;
 
-    FPGAVersion = GetFirmwareVersion(&ID);
-    if(FPGAVersion >= 14)
-        MaxDuration = VMAXCWRAMPDURATIONV14PLUS;        // get version dependent max length
-    else
-        MaxDuration = VMAXCWRAMPDURATION;
+    MaxDuration = GetHardwareCapabilities()->MaxCWRampDuration;     // version dependent max length
 
     // first find out if the length is OK and clip if not
     if(Length_us < VMINCWRAMPDURATION)
@@ -1507,49 +1732,31 @@ void InitialiseCWKeyerRamp(bool Protocol2, uint32_t Length_us)
     {
         GCWKeyerRampms = Length_us;
         GCWKeyerRamp_IsP2 = Protocol2;
-        printf("calculating new CW ramp, length = %d us\n", Length_us);
-    // work out required length in samples
-        if(Protocol2)
-            SamplePeriod = 1000.0/192.0;
+        if(Length_us == VDEFAULTCWRAMPDURATION)
+        {
+            Samples = Protocol2 ? DefaultCWRampP2 : DefaultCWRampP1;
+            RampLength = Protocol2 ? VDEFAULTCWRAMPLENGTHP2 : VDEFAULTCWRAMPLENGTHP1;
+        }
         else
-            SamplePeriod = 1000.0/48.0;
-        RampLength = (uint32_t)(((double)Length_us / SamplePeriod) + 1);
-
-
-//
-// DL1YCF code:
-//
-        for (Cntr = 0; Cntr < RampLength; Cntr++)
         {
-            y = (double) Cntr / (double) RampLength;           // between 0 and 1
-            y2 = y * 6.2831853071795864769252867665590;  // 2 Pi y
-            y4 = y * 12.566370614359172953850573533118;  // 4 Pi y
-            y6 = y * 18.849555921538759430775860299677;  // 6 Pi y
-            rampsample = 2.787456445993031358885017421602787456445993031358885 * 
-                    (
-                        0.358750000000000000000000000000000000000000000000000    * y
-                        - 0.0777137671623415735025882528171650378378063004186075  * sin(y2)
-                        + 0.01124270518001148651871394904463441453411422937510584 * sin(y4)
-                        - 0.00061964324510444584059352078539698924952082955408284 * sin(y6)
-                    );
-            Sample = (uint32_t) (rampsample * 8388607.0);
-            RegisterWrite(VADDRCWKEYERRAM + 4*Cntr, Sample);
+            Ramp = GetCWKeyerRamp(Protocol2, Length_us);
+            Samples = Ramp->Samples;
+            RampLength = Ramp->RampLength;
         }
-        for(Cntr = RampLength; Cntr < VRAMPSIZE; Cntr++)                        // fill remainder of RAM
-            RegisterWrite(VADDRCWKEYERRAM + 4*Cntr, 8388607);
+        RegisterWriteBlock(VADDRCWKEYERRAM, Samples, VRAMPSIZE);
 
     //
     // finally write the ramp length
     // in FPGA V14 onwards this is a word address
         Register = GCWKeyerSetup;                    // get current settings
         Register &= 0x8003FFFF;                      // strip out ramp bits
-        if(FPGAVersion >= 14)
+        if(HasCapability(VCAPCWRAMPWORDADDR))
             Register |= (RampLength << VCWKEYERRAMP);        // word end address
         else
             Register |= ((RampLength << 2) << VCWKEYERRAMP);        // byte end address
 
         GCWKeyerSetup = Register;                    // store it back
-        RegisterWrite(VADDRKEYERCONFIGREG, Register);  // and write to it
+        ShadowRegisterWrite(eShadowKeyerConfig, Register);  // and write to it
     }
 }
 
@@ -1596,7 +1803,7 @@ void SetCWSidetoneEnabled(bool Enabled)
         if(Enabled)
             Register |= (GSidetoneVolume & 0xFF) << 24; // add back new bits; resize to 16 bits
         GCodecConfigReg = Register;                     // store it back
-        RegisterWrite(VADDRCODECCONFIGREG, Register);   // and write to it
+        ShadowRegisterWrite(eShadowCodecConfig, Register);   // and write to it
     }
 }
 
@@ -1617,7 +1824,7 @@ void SetCWSidetoneVol(uint8_t Volume)
         if(GSidetoneEnabled)
             Register |= (GSidetoneVolume & 0xFF) << 24; // add back new bits; resize to 16 bits
         GCodecConfigReg = Register;                     // store it back
-        RegisterWrite(VADDRCODECCONFIGREG, Register);   // and write to it
+        ShadowRegisterWrite(eShadowCodecConfig, Register);   // and write to it
     }
 }
 
@@ -1636,7 +1843,7 @@ void SetCWPTTDelay(unsigned int Delay)
     if(Register != GCWKeyerSetup)                       // write back if different
     {
         GCWKeyerSetup = Register;                       // store it back
-        RegisterWrite(VADDRKEYERCONFIGREG, Register);   // and write to it
+        ShadowRegisterWrite(eShadowKeyerConfig, Register);   // and write to it
     }
 }
 
@@ -1656,7 +1863,7 @@ void SetCWHangTime(unsigned int HangTime)
     if(Register != GCWKeyerSetup)                       // write back if different
     {
         GCWKeyerSetup = Register;                       // store it back
-        RegisterWrite(VADDRKEYERCONFIGREG, Register);   // and write to it
+        ShadowRegisterWrite(eShadowKeyerConfig, Register);   // and write to it
     }
 }
 
@@ -1683,7 +1890,7 @@ void SetCWSidetoneFrequency(unsigned int Frequency)
     if(Register != GCodecConfigReg)                     // write back if different
     {
         GCodecConfigReg = Register;                     // store it back
-        RegisterWrite(VADDRCODECCONFIGREG, Register);   // and write to it
+        ShadowRegisterWrite(eShadowCodecConfig, Register);   // and write to it
     }
 }
 
@@ -1730,7 +1937,7 @@ void SetXvtrEnable(bool Enabled)
 //
 // SetWidebandEnable(EADCSelect ADC, bool Enabled)
 // enables wideband sample collection from an ADC.
-// P2 - not yet implemented
+// used by the wideband capture thread
 //
 void SetWidebandEnable(EADCSelect ADC, bool Enabled)
 {
@@ -1767,7 +1974,6 @@ void SetWidebandSampleSize(unsigned int Bits)
 //
 // SetWidebandUpdateRate(unsigned int Period_ms)
 // sets the period (ms) between collections of wideband data
-// P2 - not yet implemented
 //
 void SetWidebandUpdateRate(unsigned int Period_ms)
 {
@@ -1778,7 +1984,6 @@ void SetWidebandUpdateRate(unsigned int Period_ms)
 //
 // SetWidebandPacketsPerFrame(unsigned int Count)
 // sets the number of packets to be transferred per wideband data frame
-// P2 - not yet implemented
 //
 void SetWidebandPacketsPerFrame(unsigned int Count)
 {
@@ -1789,20 +1994,21 @@ void SetWidebandPacketsPerFrame(unsigned int Count)
 //
 // EnableTimeStamp(bool Enabled)
 // enables a timestamp for RX packets
+// the DDC packet timestamp is the sample number of the packet's 1st sample
 //
 void EnableTimeStamp(bool Enabled)
 {
-    GEnableTimeStamping = Enabled;                          // P2. true if enabled. NOT SUPPORTED YET
+    GEnableTimeStamping = Enabled;                          // P2. true if enabled
 }
 
 
 //
 // EnableVITA49(bool Enabled)
-// enables VITA49 mode
+// enables VITA49 mode: the DDC senders read this for each batch
 //
 void EnableVITA49(bool Enabled)
 {
-    GEnableVITA49 = Enabled;                                // P2. true if enabled. NOT SUPPORTED YET
+    GEnableVITA49 = Enabled;                                // P2. true if enabled
 }
 
 
@@ -1832,7 +2038,7 @@ void SetPAEnabled(bool Enabled)
     else
         Register &= ~(1<<VTXRELAYDISABLEBIT);
     GPIORegValue = Register;                    // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);  // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);  // and write to it
     sem_post(&RFGPIOMutex);                         // clear protected access
 }
 
@@ -1897,7 +2103,7 @@ void SetSpkrMute(bool IsMuted)
     else
         Register &= ~(1<<VSPKRMUTEBIT);
     GPIORegValue = Register;                        // store it back
-    RegisterWrite(VADDRRFGPIOREG, Register);        // and write to it
+    ShadowRegisterWrite(eShadowRFGPIO, Register);        // and write to it
     sem_post(&RFGPIOMutex);                         // clear protected access
 }
 
@@ -1930,6 +2136,16 @@ void ReadStatusRegister(void)
     GStatusRegister = StatusRegisterValue;                        // save to global
 }
 
+
+//
+// SetStatusRegisterValue(uint32_t Value)
+// store a status register value read as part of a snapshot
+//
+void SetStatusRegisterValue(uint32_t Value)
+{
+    GStatusRegister = Value;                                      // save to global
+}
+
 //
 // GetPTTInput(void)
 // return true if PTT input is pressed.
@@ -2085,22 +2301,16 @@ void CodecInitialise(void)
     GCodecAnaloguePath = 0x14;                              // Codec analogue path register (mic input, no boost)
     CodecRegisterWrite(VCODECRESETREG, 0x0);          // reset register: reset deveice
     usleep(100);
+    CodecBeginBatch();                                      // then the settings in one burst
     CodecRegisterWrite(VCODECACTIVATIONREG, 0x1);     // digital activation set to ACTIVE
-    usleep(100);
     CodecRegisterWrite(VCODECANALOGUEPATHREG, GCodecAnaloguePath);        // mic input, no boost
-    usleep(100);
     CodecRegisterWrite(VCODECPOWERDOWNREG, 0x0);      // all elements powered on
-    usleep(100);
     CodecRegisterWrite(VCODECDIGITALFORMATREG, 0x2);  // slave; no swap; right when LRC high; 16 bit, I2S
-    usleep(100);
     CodecRegisterWrite(VCODECSAMPLERATEREG, 0x0);     // no clock divide; rate ctrl=0; normal mode, oversample 256Fs
-    usleep(100);
     CodecRegisterWrite(VCODECDIGITALPATHREG, 0x0);    // no soft mute; no deemphasis; ADC high pss filter enabled
-    usleep(100);
     CodecRegisterWrite(VCODECLLINEVOLREG, GCodecLineGain);        // line in gain=0
     CodecRegisterWrite(VCODECRLINEVOLREG, GCodecLineGain);        // line in gain=0
-    usleep(100);
-
+    CodecCommitBatch();
 }
 
 
@@ -2117,7 +2327,7 @@ void SetTXAmplitudeScaling (unsigned int Amplitude)
     Register &= 0xFFC0000F;                                     // remove old bits
     Register |= ((Amplitude & 0x3FFFF) << VTXCONFIGSCALEBIT);   // add new bits
     TXConfigRegValue = Register;                                // store it back
-    RegisterWrite(VADDRTXCONFIGREG, Register);                  // and write to it
+    ShadowRegisterWrite(eShadowTXConfig, Register);                  // and write to it
 }
 
 
@@ -2135,7 +2345,7 @@ void SetTXProtocol (bool Protocol)
     Register &= 0xFFFFFF7;                              // remove old bit
     Register |= ((((unsigned int)Protocol)&1) << VTXCONFIGPROTOCOLBIT);            // add new bit
     TXConfigRegValue = Register;                    // store it back
-    RegisterWrite(VADDRTXCONFIGREG, Register);  // and write to it
+    ShadowRegisterWrite(eShadowTXConfig, Register);  // and write to it
 }
 
 
@@ -2152,9 +2362,12 @@ void ResetDUCMux(void)
     BitMask = (1 << 29);
     Register = TXConfigRegValue;                        // get current settings
     Register |= BitMask;                                // set reset bit
+    pthread_mutex_lock(&HardwareValueMutex);
     RegisterWrite(VADDRTXCONFIGREG, Register);          // and write to it
     Register &= ~BitMask;                               // remove old bit
     RegisterWrite(VADDRTXCONFIGREG, Register);          // and write to it
+    HardwareValueKnown[eShadowTXConfig] = false;        // written behind the shadow's back
+    pthread_mutex_unlock(&HardwareValueMutex);
 }
 
 
@@ -2177,7 +2390,7 @@ void SetTXOutputGate(bool AlwaysOn)
         else
         Register &= ~BitMask;                           // clear bit if false
     TXConfigRegValue = Register;                    // store it back
-    RegisterWrite(VADDRTXCONFIGREG, Register);  // and write to it
+    ShadowRegisterWrite(eShadowTXConfig, Register);  // and write to it
 }
 
 
@@ -2202,7 +2415,7 @@ void SetTXIQDeinterleaved(bool Interleaved)
     else
         Register &= ~BitMask;                           // clear bit if false
     TXConfigRegValue = Register;                    // store it back
-    RegisterWrite(VADDRTXCONFIGREG, Register);    // and write to it
+    ShadowRegisterWrite(eShadowTXConfig, Register);    // and write to it
 }
 
 
@@ -2224,7 +2437,7 @@ void EnableDUCMux(bool Enabled)
     else
         Register &= ~BitMask;                           // clear bit if false
     TXConfigRegValue = Register;                    // store it back
-    RegisterWrite(VADDRTXCONFIGREG, Register);    // and write to it
+    ShadowRegisterWrite(eShadowTXConfig, Register);    // and write to it
 }
 
 
@@ -2261,7 +2474,7 @@ void SetTXModulationSource(ETXModulationSource Source)
     Register &= 0xFFFFFFFC;                             // remove old bits
     Register |= ((unsigned int)Source);                 // add new bits
     TXConfigRegValue = Register;                    // store it back
-    RegisterWrite(VADDRTXCONFIGREG, Register);  // and write to it
+    ShadowRegisterWrite(eShadowTXConfig, Register);  // and write to it
 }
 
 
@@ -2301,11 +2514,24 @@ void SetFreqPhaseWord(bool IsPhase)
 
 
 // SetDDCSampleSize(unsigned int DDC, unsgned int Size)
-// set sample resolution for DDC (only 24 bits supported, so ignore)
+// set sample resolution for DDC: 16 or 24 bits.
+// the FPGA always makes 24 bit samples, so this is only used by the DDC sender
 //
 void SetDDCSampleSize(unsigned int DDC, unsigned int Size)
 {
+    if (DDC >= VNUMDDC)
+        return;
+    GDDCSampleSize[DDC] = (Size == 16) ? 16 : 24;
+}
 
+
+//
+// GetDDCSampleSize(unsigned int DDC)
+// return the sample resolution for DDC in bits
+//
+unsigned int GetDDCSampleSize(unsigned int DDC)
+{
+    return (DDC < VNUMDDC) ? GDDCSampleSize[DDC] : 24;
 }
 
 
@@ -75,11 +75,13 @@ typedef enum
 
 //
 // DMA channel allocations
+// the names are for board 0; OpenDMADevice() converts them for the board in use
 //
 #define VMICDMADEVICE "/dev/xdma0_c2h_1"
 #define VDDCDMADEVICE "/dev/xdma0_c2h_0"
 #define VSPKDMADEVICE "/dev/xdma0_h2c_1"
 #define VDUCDMADEVICE "/dev/xdma0_h2c_0"
+#define VWIDEBANDDMADEVICE "/dev/xdma0_c2h_2"          // optional: only present if the FPGA has wideband capture
 
 
 //
@@ -122,12 +124,15 @@ typedef enum
 #define VADDRCODECSPIREG 0x14000
 #define VADDRXADCREG 0x18000                    // on-chip XADC (temp, VCC...)
 #define VADDRCWKEYERRAM 0x1C000                 // keyer RAM mapped here
+#define VCWKEYERRAMSIZE 0x4000                  // keyer RAM bytes (VRAMPSIZE words)
 
 #define VNUMDMAFIFO 4							// DMA streams available
 #define VADDRDDCSTREAMREAD 0x0L					// stream reader/writer on AXI-4 bus
 #define VADDRDUCSTREAMWRITE 0x0L				// stream reader/writer on AXI-4 bus
 #define VADDRMICSTREAMREAD 0x40000L				// stream reader/writer on AXI-4 bus
 #define VADDRSPKRSTREAMWRITE 0x40000L			// stream reader/writer on AXI-4 bus
+#define VADDRWIDEBAND0READ 0x0L                 // wideband ADC1 capture reader on AXI-4 bus
+#define VADDRWIDEBAND1READ 0x40000L             // wideband ADC2 capture reader on AXI-4 bus
 
 #define VBITDDCFIFORESET 2						// reset bit in register
 #define VBITDUCFIFORESET 3						// reset bit in register
@@ -156,6 +161,17 @@ extern uint32_t DDCConfigRegs[VNUMDDC];
 extern uint32_t DMAFIFODepths[VNUMDMAFIFO];
 
 extern bool GEEREnabled;                                   // P2. true if EER is enabled
+extern bool GEnableTimeStamping;                           // P2. true if DDC packets carry a sample count timestamp
+extern bool GEnableVITA49;                                 // P2. true if DDC packets are VITA-49 formatted
+extern uint8_t GDDCSampleSize[VNUMDDC];                    // P2. bits per DDC sample sent, 16 or 24
+
+//
+// wideband capture settings from the general packet
+//
+extern bool GWidebandADC1;                                 // true if wideband on ADC1
+extern bool GWidebandADC2;                                 // true if wideband on ADC2
+extern unsigned int GWidebandUpdateRate;                   // ms between wideband frames
+extern unsigned int GWidebandPacketsPerFrame;              // packets in each wideband frame
 
 
 
@@ -170,13 +186,6 @@ void InitialiseCWKeyerRamp(bool Protocol2, uint32_t Length_us);
 
 
 
-//
-// initialise the DAC Atten ROMs
-// these set the step attenuator and DAC drive level
-// for "attenuation intent" values from 0 to 255
-//
-void InitialiseDACAttenROMs(void);
-
 //
 // InitialiseFIFOSizes(void)
 // initialise the FIFO size table, which is FPGA version dependent
@@ -223,10 +232,36 @@ void SetATUTune(bool TuneEnabled);
 void SetP1SampleRate(ESampleRate Rate, unsigned int Count);
 
 
+//
+// BeginRegisterTransaction(void)
+// CommitRegisterTransaction(void)
+// between these calls, setters that keep a shadow of their register on this thread
+// update the shadow only; the commit then writes each changed register once.
+// use around the decoding of one protocol message. Commit returns the number of writes made.
+// a commit that asserts MOX writes the RF GPIO register last, after the TX antenna,
+// filter and attenuator settings; any other commit writes it first.
+// DDC frequencies set in a transaction are staged too, and written first in one burst,
+// so DDCs retuned together (eg diversity or PureSignal pairs) change together.
+// codec register writes are batched as well (see CodecBeginBatch()), and sent last.
+// transactions nest: an inner commit returns 0, and the outermost writes everything.
+//
+void BeginRegisterTransaction(void);
+unsigned int CommitRegisterTransaction(void);
+
+
+//
+// GetRegisterWriteCounts(uint64_t* Made, uint64_t* Skipped)
+// shadowed registers are only written if their value has changed.
+// returns the number of writes made, and the number skipped because the hardware already had the value.
+//
+void GetRegisterWriteCounts(uint64_t* Made, uint64_t* Skipped);
+
+
 //
 // SetP2SampleRate(unsigned int DDC, bool Enabled, unsigned int SampleRate, bool InterleaveWithNext)
 // sets the sample rate for a single DDC (used in protocol 2)
-// allowed rates are 48KHz to 1536KHz.
+// allowed rates are 48KHz to 1536KHz; lower rates (12, 24KHz) set 48KHz and are
+// decimated in software.
 // This sets the DDCRateReg variable and does NOT write to hardware
 // The WriteP2DDCRateRegister() call must be made after setting values for all DDCs
 //
@@ -243,6 +278,22 @@ void SetP2SampleRate(unsigned int DDC, bool Enabled, unsigned int SampleRate, bo
 bool WriteP2DDCRateRegister(void);
 
 
+//
+// unsigned int GetP2SampleRate(unsigned int DDC)
+// get the sample rate in KHz last set for a DDC by SetP2SampleRate(), or 0 if it
+// is disabled. Rates below 48KHz run the DDC at 48KHz, to be decimated in software.
+//
+unsigned int GetP2SampleRate(unsigned int DDC);
+
+
+//
+// uint32_t GetP2DDCRateWord(void)
+// get the DDC rate register value last set by SetP2SampleRate(). This is the same
+// encoding as the rate word at the start of each DDC DMA frame.
+//
+uint32_t GetP2DDCRateWord(void);
+
+
 //
 // uint32_t GetDDCEnables(void)
 // get enable bits for each DDC; 1 bit per DDC
@@ -286,6 +337,7 @@ void SetADCOptions(EADCSelect ADC, bool PGA, bool Dither, bool Random);
 // DDC: DDC number (0-9)
 // Value: 32 bit phase word or frequency word (1Hz resolution)
 // IsDeltaPhase: true if a delta phase value, false if a frequency value (P1)
+// inside a register transaction the write is staged until the commit
 //
 void SetDDCFrequency(uint32_t DDC, uint32_t Value, bool IsDeltaPhase);
 
@@ -513,6 +565,13 @@ void SetCWXBits(bool CWXEnabled, bool CWXDash, bool CWXDot);
 void SetDDCADC(int DDC, EADCSelect ADC);
 
 
+//
+// EADCSelect GetDDCADC(int DDC)
+// get the ADC a DDC uses, as last set by SetDDCADC()
+//
+EADCSelect GetDDCADC(int DDC);
+
+
 //
 // void SetDDCInterleaved(uint32_t DDCNum, bool Interleaved)
 //
@@ -642,7 +701,7 @@ void EnableTimeStamp(bool Enabled);
 
 //
 // EnableVITA49(bool Enabled)
-// enables VITA49 mode
+// enables VITA49 mode: the DDC streams are sent as VITA-49 packets
 //
 void EnableVITA49(bool Enabled);
 
@@ -720,6 +779,14 @@ void SetUserOutputBits(unsigned int Bits);
 void ReadStatusRegister(void);
 
 
+//
+// SetStatusRegisterValue(uint32_t Value)
+// as ReadStatusRegister(), but with a value the caller has already read
+// from VADDRSTATUSREG (as part of a register snapshot)
+//
+void SetStatusRegisterValue(uint32_t Value);
+
+
 //
 // GetPTTInput(void)
 // return true if PTT input is pressed.
@@ -783,6 +850,9 @@ unsigned int GetUserIOBits(void);
 unsigned int GetAnalogueIn(unsigned int AnalogueSelect);
 
 
+#define VNUMANALOGUEIN 6                        // RF board analogue inputs AIN1-6
+
+
 //////////////////////////////////////////////////////////////////////////////////
 // internal App register settings
 // these are things not accessible from external SDR applications, including debug
@@ -884,10 +954,18 @@ void SetFreqPhaseWord(bool IsPhase);
 
 //
 // SetDDCSampleSize(unsigned int DDC, unsgned int Size)
-// set sample resolution for DDC (only 24 bits supported)
+// set sample resolution for DDC, in bits: 16 or 24 (any other value is taken as 24).
+// the FPGA always makes 24 bit samples; 16 bit samples are packed by the DDC sender.
 //
 void SetDDCSampleSize(unsigned int DDC, unsigned int Size);
 
+
+//
+// GetDDCSampleSize(unsigned int DDC)
+// return the sample resolution for DDC in bits, 16 or 24
+//
+unsigned int GetDDCSampleSize(unsigned int DDC);
+
 //
 // UseTestDDSSource(void)
 // override ADC1 and ADC2 selection; use test source instead.
@@ -0,0 +1,104 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// saturntablecalc.h:
+// calculations for the DAC attenuation ROMs and CW keyer ramps.
+// maketables.c uses these at build time to make saturntables.h;
+// saturnregisters.c uses the ramp calculation for other ramp lengths.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __saturntablecalc_h
+#define __saturntablecalc_h
+
+#include <stdint.h>
+#include <math.h>
+
+
+#define VRAMPSIZE 4096                                  // max ramp length in words
+#define VDEFAULTCWRAMPDURATION 5000                     // us; ramp loaded at startup
+
+
+//
+// CalcDACAtten(unsigned int Level, unsigned int* DACDrive, unsigned int* StepValue)
+// DAC current setting and 0.5dB step attenuator for an "attenuation intent" 0-255
+//
+static inline void CalcDACAtten(unsigned int Level, unsigned int* DACDrive, unsigned int* StepValue)
+{
+    double DesiredAtten;                                // desired attenuation in dB
+    double ResidualAtten;                               // atten to go in the current setting DAC
+
+    if (Level == 0)
+    {
+        *DACDrive = 0;                                  // min level
+        *StepValue = 63;                                // max atten
+        return;
+    }
+    DesiredAtten = 20.0*log10(255.0/(double)Level);     // this is the atten value we want after the high speed DAC
+    *StepValue = (int)(2.0*DesiredAtten);               // 6 bit step atten should be set to
+    if(*StepValue > 63)                                 // clip to 6 bits
+        *StepValue = 63;
+    ResidualAtten = DesiredAtten - ((double)*StepValue * 0.5);        // this needs to be achieved through the current setting drive
+    *DACDrive = (unsigned int)(255.0/pow(10.0,(ResidualAtten/20.0)));
+}
+
+
+//
+// CalcCWRampLength(bool Protocol2, uint32_t Length_us)
+// ramp length in words (not bytes!) for a duration in us
+//
+static inline uint32_t CalcCWRampLength(bool Protocol2, uint32_t Length_us)
+{
+    double SamplePeriod;                                // sample period in us
+    uint32_t RampLength;
+
+    if(Protocol2)
+        SamplePeriod = 1000.0/192.0;
+    else
+        SamplePeriod = 1000.0/48.0;
+    RampLength = (uint32_t)(((double)Length_us / SamplePeriod) + 1);
+    if(RampLength > VRAMPSIZE)
+        RampLength = VRAMPSIZE;
+    return RampLength;
+}
+
+
+//
+// CalcCWRamp(uint32_t* Samples, uint32_t RampLength)
+// the whole keyer RAM image: an "S" shape ramp of RampLength words, then full scale
+//
+static inline void CalcCWRamp(uint32_t* Samples, uint32_t RampLength)
+{
+    uint32_t Cntr;
+    double y, y2, y4, y6,rampsample;
+
+//
+// DL1YCF code:
+//
+    for (Cntr = 0; Cntr < RampLength; Cntr++)
+    {
+        y = (double) Cntr / (double) RampLength;           // between 0 and 1
+        y2 = y * 6.2831853071795864769252867665590;  // 2 Pi y
+        y4 = y * 12.566370614359172953850573533118;  // 4 Pi y
+        y6 = y * 18.849555921538759430775860299677;  // 6 Pi y
+        rampsample = 2.787456445993031358885017421602787456445993031358885 * 
+                (
+                    0.358750000000000000000000000000000000000000000000000    * y
+                    - 0.0777137671623415735025882528171650378378063004186075  * sin(y2)
+                    + 0.01124270518001148651871394904463441453411422937510584 * sin(y4)
+                    - 0.00061964324510444584059352078539698924952082955408284 * sin(y6)
+                );
+        Samples[Cntr] = (uint32_t) (rampsample * 8388607.0);
+    }
+    for(Cntr = RampLength; Cntr < VRAMPSIZE; Cntr++)                        // fill remainder of RAM
+        Samples[Cntr] = 8388607;
+}
+
+
+#endif
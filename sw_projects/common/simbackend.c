@@ -0,0 +1,640 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// simbackend.c:
+// simulated FPGA hardware backend, so the apps can run without a Saturn board
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "../common/simbackend.h"
+#include "../common/hwaccess.h"
+#include "../common/saturnregisters.h"
+#include "../common/saturndrivers.h"
+#include "../common/ddccapture.h"
+#include "../common/ddcframegen.h"
+
+
+#define VSIMREGISTERSPACE 0x20000                   // bytes of register space simulated
+#define VSIMFIRMWAREVERSION 17                      // firmware version reported
+#define VSIMSWID 4                                  // full function firmware
+#define VSIMPRODUCTID 1                             // Saturn
+#define VSIMDDCFRAMERATE 48000                      // DDC frames per second (one rate word per frame)
+#define VSIMDDCENABLEBIT 30                         // DDC enable bit in the DDC input select register
+#define VSIMMAXDMAWAIT 100000000                    // ns: longest a DMA read waits for data to "arrive"
+#define VSIMREPLAYPOLL 100000                       // ns: DMA read poll interval while waiting for replay data
+
+//
+// one simulated DMA stream FIFO.
+// a read stream (FPGA to host) fills at its word rate and is emptied by DMA reads;
+// a write stream (host to FPGA) is filled by DMA writes and drains at its word rate.
+// Occupied is the number of 64 bit locations in the FIFO, as the FIFO monitor reports it.
+//
+struct SimStream
+{
+    const char* Device;                             // DMA device path
+    bool IsRead;                                    // true if FPGA to host
+    uint32_t ResetBit;                              // bit in the FIFO reset register
+    uint32_t WordRate;                              // locations per second; 0 for DDC (set by rate word)
+    int fd;                                         // fd returned when the device was opened, or -1
+    double Occupied;                                // locations occupied
+    uint64_t LastUpdate;                            // time Occupied was last brought up to date, ns
+    bool Overflowed;                                // FIFO monitor flags, cleared when read
+    bool OverThreshold;
+    bool Underflowed;
+};
+
+//
+// indexed by EDMAStreamSelect
+// DUC: 192KHz, 6 bytes per sample; mic: 48KHz, 4 samples per location;
+// speaker: 48KHz, 2 stereo samples per location
+//
+static struct SimStream SimStreams[VNUMDMAFIFO] =
+{
+    {VDDCDMADEVICE, true, VBITDDCFIFORESET, 0, -1, 0.0, 0, false, false, false},
+    {VDUCDMADEVICE, false, VBITDUCFIFORESET, 144000, -1, 0.0, 0, false, false, false},
+    {VMICDMADEVICE, true, VBITCODECMICFIFORESET, 12000, -1, 0.0, 0, false, false, false},
+    {VSPKDMADEVICE, false, VBITCODECSPKFIFORESET, 24000, -1, 0.0, 0, false, false, false}
+};
+
+static uint32_t SimRegisters[VSIMREGISTERSPACE / 4];      // register file
+static pthread_mutex_t SimMutex = PTHREAD_MUTEX_INITIALIZER;  // protects SimStreams
+static uint32_t SimDDCRateOverride = 0;                   // rate word to generate; 0 = follow register
+static bool SimDDCMaxSpeed = false;                       // true if the DDC FIFO always reads as full
+
+//
+// DMA fault injection: every nth transfer of a stream fails. Each stream's counts
+// are used only by the thread doing its DMA.
+//
+static const char* SimStreamNames[VNUMDMAFIFO] = {"ddc", "duc", "mic", "speaker"};
+static uint32_t SimFaultPeriod[VNUMDMAFIFO];              // transfers per fault; 0 = none
+static uint32_t SimFaultCount[VNUMDMAFIFO];               // transfers since the last fault
+static int SimFaultResult[VNUMDMAFIFO];                   // negative errno returned
+
+//
+// DDC stream generator (used by the DDC DMA reader only): the golden model of the FPGA framing
+//
+static struct DDCFrameGen SimDDCGen;
+
+//
+// DDC replay state: if a capture is loaded, the DDC stream is read from it instead
+// each record "arrives" in the FIFO at its recorded time, measured from when the DDCs
+// were enabled after a FIFO reset (or at max speed, as fast as it is read).
+// the capture loops continuously. Replay time only advances while the DDCs are enabled.
+// arriving data is never discarded: any FIFO overflow in the field is already in the
+// captured data, so the stream read by DMA is always the captured stream.
+//
+static struct DDCCaptureEntry* SimReplay = NULL;    // capture records, or NULL if not replaying
+static uint32_t SimReplayCount;                     // records in capture
+static uint64_t SimReplayPeriod;                    // ns for one pass of the capture
+static uint64_t SimReplayTime;                      // ns the DDCs have been enabled since reset
+static uint64_t SimReplayPassStart;                 // replay time the current pass started
+static uint32_t SimReplayNextArrival;               // next record to arrive in the FIFO
+static uint32_t SimReplayRecord;                    // record being read by DMA
+static uint32_t SimReplayOffset;                    // bytes of it already read
+static uint32_t SimReplayPasses;                    // complete passes read
+
+
+
+//
+// monotonic time in ns
+//
+static uint64_t SimTimeNow(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// locations per second a stream fills or drains at, and whether it is running
+//
+static double SimStreamRate(EDMAStreamSelect Channel)
+{
+    uint32_t DDCCounts[VNUMDDC];
+    uint32_t Samples;
+
+    if (Channel != eRXDDCDMA)
+        return (double)SimStreams[Channel].WordRate;
+    if (((SimRegisters[VADDRDDCINSEL >> 2] & (1 << VSIMDDCENABLEBIT)) == 0) || (SimReplay != NULL))
+        return 0.0;
+    Samples = DDCGenFrameLayout(GetSimulatedDDCRateWord(), DDCCounts);
+    if (Samples == 0)
+        return 0.0;
+    return (double)VSIMDDCFRAMERATE * (Samples + 1);
+}
+
+
+//
+// bring the replayed DDC FIFO's occupancy up to date: add the records whose time has come.
+// Call with SimMutex held.
+//
+static void SimUpdateReplay(struct SimStream* Stream, uint64_t Now)
+{
+    uint32_t Depth = DMAFIFODepths[eRXDDCDMA];
+
+    if (SimRegisters[VADDRDDCINSEL >> 2] & (1 << VSIMDDCENABLEBIT))
+        SimReplayTime += Now - Stream->LastUpdate;
+    Stream->LastUpdate = Now;
+    while (SimReplayTime >= (SimReplayPassStart + SimReplay[SimReplayNextArrival].Time))
+    {
+        Stream->Occupied += (double)(SimReplay[SimReplayNextArrival].Bytes / 8);
+        if (++SimReplayNextArrival == SimReplayCount)
+        {
+            SimReplayNextArrival = 0;
+            SimReplayPassStart += SimReplayPeriod;
+        }
+    }
+    if (Stream->Occupied > Depth)
+    {
+        Stream->Overflowed = true;
+        Stream->OverThreshold = true;
+    }
+}
+
+
+//
+// bring a stream FIFO's occupancy up to date. Call with SimMutex held.
+//
+static void SimUpdateStream(EDMAStreamSelect Channel)
+{
+    struct SimStream* Stream = SimStreams + Channel;
+    uint64_t Now;
+    double Words;
+    uint32_t Depth;
+
+    Now = SimTimeNow();
+    if ((Channel == eRXDDCDMA) && SimDDCMaxSpeed)
+    {
+        Stream->LastUpdate = Now;                   // DDC data is there as soon as it is enabled
+        Stream->Occupied = (SimRegisters[VADDRDDCINSEL >> 2] & (1 << VSIMDDCENABLEBIT)) ? DMAFIFODepths[Channel] : 0.0;
+        return;
+    }
+    if ((Channel == eRXDDCDMA) && (SimReplay != NULL))
+    {
+        SimUpdateReplay(Stream, Now);
+        return;
+    }
+    Words = SimStreamRate(Channel) * (double)(Now - Stream->LastUpdate) / 1.0e9;
+    Stream->LastUpdate = Now;
+    Depth = DMAFIFODepths[Channel];
+    if (Stream->IsRead)
+    {
+        Stream->Occupied += Words;
+        if (Stream->Occupied > Depth)
+        {
+            Stream->Occupied = Depth;
+            Stream->Overflowed = true;
+            Stream->OverThreshold = true;
+        }
+    }
+    else if (Stream->Occupied > 0.0)
+    {
+        Stream->Occupied -= Words;
+        if (Stream->Occupied < 0.0)
+        {
+            Stream->Occupied = 0.0;
+            Stream->Underflowed = true;
+        }
+    }
+}
+
+
+//
+// empty a stream FIFO, as the FPGA does while its reset bit is 0
+//
+static void SimResetStream(EDMAStreamSelect Channel)
+{
+    pthread_mutex_lock(&SimMutex);
+    SimStreams[Channel].Occupied = 0.0;
+    SimStreams[Channel].LastUpdate = SimTimeNow();
+    SimStreams[Channel].Overflowed = false;
+    SimStreams[Channel].OverThreshold = false;
+    SimStreams[Channel].Underflowed = false;
+    if (Channel == eRXDDCDMA)
+    {
+        RestartDDCFrameGen(&SimDDCGen);             // next data starts with a rate word
+        SimReplayTime = 0;                          // replay restarts from the beginning
+        SimReplayPassStart = 0;
+        SimReplayNextArrival = 0;
+        SimReplayRecord = 0;
+        SimReplayOffset = 0;
+    }
+    pthread_mutex_unlock(&SimMutex);
+}
+
+
+//
+// find the stream a DMA fd was opened for
+// returns VNUMDMAFIFO if none
+//
+static uint32_t SimFindStream(int fd)
+{
+    uint32_t Channel;
+
+    for (Channel = 0; Channel < VNUMDMAFIFO; Channel++)
+        if (SimStreams[Channel].fd == fd)
+            break;
+    return Channel;
+}
+
+
+//
+// generate DDC stream words, as the FPGA frames them (see ddcframegen.h).
+// a new rate word takes effect at the start of the next frame.
+//
+static void SimMakeDDCWords(uint64_t* Dest, uint32_t Words)
+{
+    SetDDCFrameGenRate(&SimDDCGen, GetSimulatedDDCRateWord());
+    MakeDDCFrameWords(&SimDDCGen, Dest, Words);
+}
+
+
+
+//
+// copy DDC stream bytes from the replayed capture, looping at its end
+//
+static void SimReplayDDCBytes(uint8_t* Dest, uint32_t Bytes)
+{
+    struct DDCCaptureEntry* Entry;
+    uint32_t Chunk;
+
+    while (Bytes != 0)
+    {
+        Entry = SimReplay + SimReplayRecord;
+        Chunk = Entry->Bytes - SimReplayOffset;
+        if (Chunk > Bytes)
+            Chunk = Bytes;
+        memcpy(Dest, Entry->Data + SimReplayOffset, Chunk);
+        Dest += Chunk;
+        Bytes -= Chunk;
+        SimReplayOffset += Chunk;
+        if (SimReplayOffset >= Entry->Bytes)
+        {
+            SimReplayOffset = 0;
+            if (++SimReplayRecord == SimReplayCount)
+            {
+                SimReplayRecord = 0;
+                SimReplayPasses++;
+                printf("DDC replay: pass %d complete\n", SimReplayPasses);
+            }
+        }
+    }
+}
+
+
+
+//
+// backend calls
+//
+static int SimOpenDMADevice(const char* Path, int Flags)
+{
+    uint32_t Channel;
+
+    for (Channel = 0; Channel < VNUMDMAFIFO; Channel++)
+        if (strcmp(Path, SimStreams[Channel].Device) == 0)
+        {
+            SimStreams[Channel].fd = open("/dev/null", Flags);          // a real fd, so close() works
+            SimResetStream((EDMAStreamSelect)Channel);
+            return SimStreams[Channel].fd;
+        }
+    return -1;                                                          // eg wideband, events: not simulated
+}
+
+
+static uint32_t SimRegisterRead(uint32_t Address)
+{
+    struct SimStream* Stream;
+    uint32_t Channel;
+    uint32_t Data;
+
+    if (Address >= VSIMREGISTERSPACE)
+        return 0;
+    if ((Address >= VADDRFIFOMONBASE) && (Address < (VADDRFIFOMONBASE + 4 * VNUMDMAFIFO)))
+    {
+        Channel = (Address - VADDRFIFOMONBASE) / 4;
+        Stream = SimStreams + Channel;
+        pthread_mutex_lock(&SimMutex);
+        SimUpdateStream((EDMAStreamSelect)Channel);
+        Data = (uint32_t)Stream->Occupied & 0xFFFF;
+        if (Stream->Overflowed)
+            Data |= 0x80000000;
+        if (Stream->OverThreshold)
+            Data |= 0x40000000;
+        if (Stream->Underflowed)
+            Data |= 0x20000000;
+        Stream->Overflowed = false;                                     // cleared by read
+        Stream->OverThreshold = false;
+        Stream->Underflowed = false;
+        pthread_mutex_unlock(&SimMutex);
+        return Data;
+    }
+    return SimRegisters[Address >> 2];
+}
+
+
+static void SimRegisterWrite(uint32_t Address, uint32_t Data)
+{
+    uint32_t Channel;
+
+    if (Address >= VSIMREGISTERSPACE)
+        return;
+    if (Address == VADDRDDCINSEL)
+    {
+        pthread_mutex_lock(&SimMutex);
+        SimUpdateStream(eRXDDCDMA);                                     // at the old enable state
+        SimRegisters[Address >> 2] = Data;
+        pthread_mutex_unlock(&SimMutex);
+        return;
+    }
+    SimRegisters[Address >> 2] = Data;
+    if (Address == VADDRFIFORESET)
+        for (Channel = 0; Channel < VNUMDMAFIFO; Channel++)
+            if ((Data & (1 << SimStreams[Channel].ResetBit)) == 0)
+                SimResetStream((EDMAStreamSelect)Channel);
+}
+
+
+//
+// return the injected failure for this transfer, or 0
+//
+static int SimDMAFault(uint32_t Channel)
+{
+    if ((SimFaultPeriod[Channel] == 0) || (++SimFaultCount[Channel] < SimFaultPeriod[Channel]))
+        return 0;
+    SimFaultCount[Channel] = 0;
+    return SimFaultResult[Channel];
+}
+
+
+//
+// DMA read: like the FPGA stream reader, hold off until the FIFO has the data
+//
+static int SimDMARead(int fd, unsigned char* DestData, uint32_t Length, __attribute__((unused)) uint32_t AXIAddr)
+{
+    struct SimStream* Stream;
+    uint32_t Channel;
+    double Rate;
+    double Words;
+    uint64_t Waited = 0;
+    uint64_t Wait;
+    struct timespec Delay;
+    int Fault;
+
+    Channel = SimFindStream(fd);
+    if ((Channel == VNUMDMAFIFO) || !SimStreams[Channel].IsRead)
+        return -EBADF;
+    if ((Fault = SimDMAFault(Channel)) != 0)
+        return Fault;
+    Stream = SimStreams + Channel;
+    Words = (double)(Length / 8);
+    pthread_mutex_lock(&SimMutex);
+    SimUpdateStream((EDMAStreamSelect)Channel);
+    while ((Stream->Occupied < Words) && (Waited < VSIMMAXDMAWAIT))
+    {
+        Rate = SimStreamRate((EDMAStreamSelect)Channel);
+        if ((Channel == eRXDDCDMA) && (SimReplay != NULL))
+            Wait = VSIMREPLAYPOLL;
+        else
+            Wait = (Rate > 0.0) ? (uint64_t)((Words - Stream->Occupied) * 1.0e9 / Rate) + 1000 : 1000000;
+        pthread_mutex_unlock(&SimMutex);
+        Delay.tv_sec = Wait / 1000000000ULL;
+        Delay.tv_nsec = Wait % 1000000000ULL;
+        nanosleep(&Delay, NULL);
+        Waited += Wait;
+        pthread_mutex_lock(&SimMutex);
+        SimUpdateStream((EDMAStreamSelect)Channel);
+    }
+    Stream->Occupied = (Stream->Occupied > Words) ? Stream->Occupied - Words : 0.0;
+    pthread_mutex_unlock(&SimMutex);
+
+    if ((Channel == eRXDDCDMA) && (SimReplay != NULL))
+        SimReplayDDCBytes(DestData, Length);
+    else if (Channel == eRXDDCDMA)
+    {
+        SimMakeDDCWords((uint64_t*)DestData, Length / 8);
+        memset(DestData + (Length & ~7U), 0, Length & 7);
+    }
+    else
+        memset(DestData, 0, Length);                                    // mic: silence
+    return 0;
+}
+
+
+//
+// DMA write: the data is discarded; it occupies the FIFO until drained
+//
+static int SimDMAWrite(int fd, __attribute__((unused)) unsigned char* SrcData, uint32_t Length, __attribute__((unused)) uint32_t AXIAddr)
+{
+    struct SimStream* Stream;
+    uint32_t Channel;
+    int Fault;
+
+    Channel = SimFindStream(fd);
+    if ((Channel == VNUMDMAFIFO) || SimStreams[Channel].IsRead)
+        return -EBADF;
+    if ((Fault = SimDMAFault(Channel)) != 0)
+        return Fault;
+    Stream = SimStreams + Channel;
+    pthread_mutex_lock(&SimMutex);
+    SimUpdateStream((EDMAStreamSelect)Channel);
+    Stream->Occupied += (double)(Length / 8);
+    if (Stream->Occupied > DMAFIFODepths[Channel])
+    {
+        Stream->Occupied = DMAFIFODepths[Channel];
+        Stream->Overflowed = true;
+        Stream->OverThreshold = true;
+    }
+    pthread_mutex_unlock(&SimMutex);
+    return 0;
+}
+
+
+static const struct HardwareBackend SimBackend =
+{
+    "simulated FPGA",
+    SimOpenDMADevice,
+    SimRegisterRead,
+    SimRegisterWrite,
+    SimDMARead,
+    SimDMAWrite
+};
+
+
+
+//
+// inject DMA faults: "stream,n[,type]"
+//
+bool SetSimulatedDMAFaults(char* Setting)
+{
+    char Name[16] = "";
+    char Type[16] = "timeout";
+    unsigned int Period = 0;
+    uint32_t Channel;
+    EDDCGenCorruption Corruption;
+
+    if (sscanf(Setting, "%15[^,],%u,%15s", Name, &Period, Type) < 2)
+    {
+        printf("error parsing simulated DMA faults %s: must be stream,n[,type]\n", Setting);
+        return true;
+    }
+    for (Channel = 0; Channel < VNUMDMAFIFO; Channel++)
+        if (strcmp(Name, SimStreamNames[Channel]) == 0)
+            break;
+    if (Channel == VNUMDMAFIFO)
+    {
+        printf("simulated DMA faults: stream must be ddc, duc, mic or speaker\n");
+        return true;
+    }
+    if ((Channel == eRXDDCDMA) && !ParseDDCGenCorruption(Type, &Corruption))
+    {
+        SetDDCFrameGenCorruption(&SimDDCGen, Corruption, Period);      // corrupt the framing, not the DMA
+        return false;
+    }
+    if (strcmp(Type, "timeout") == 0)
+        SimFaultResult[Channel] = -512;                             // the XDMA driver's ERESTARTSYS
+    else if (strcmp(Type, "engine") == 0)
+        SimFaultResult[Channel] = -EIO;
+    else if (strcmp(Type, "short") == 0)
+        SimFaultResult[Channel] = -ENODATA;
+    else
+    {
+        printf("simulated DMA faults: type must be timeout, engine or short; or for ddc word, marker, false or frame\n");
+        return true;
+    }
+    SimFaultPeriod[Channel] = Period;
+    SimFaultCount[Channel] = 0;
+    return false;
+}
+
+
+//
+// install the simulated FPGA as the hardware backend
+// the version registers read as full function Saturn firmware
+//
+void UseSimulatedHardware(void)
+{
+    memset(SimRegisters, 0, sizeof(SimRegisters));
+    SimRegisters[VADDRBOARDID1 >> 2] = (VSIMSWID << 20) | (VSIMFIRMWAREVERSION << 4);
+    SimRegisters[VADDRBOARDID2 >> 2] = (VSIMPRODUCTID << 16) | 1;
+    SimRegisters[VADDRFIFORESET >> 2] = (1 << VBITDDCFIFORESET) | (1 << VBITDUCFIFORESET)
+                                      | (1 << VBITCODECMICFIFORESET) | (1 << VBITCODECSPKFIFORESET);
+    SetHardwareBackend(&SimBackend);
+}
+
+
+//
+// set the DDC rates generated, as "count,rate in KHz[,max][,pair]"; or "0" to follow the rate register
+//
+bool SetSimulatedDDCRates(char* Setting)
+{
+    unsigned int Count = 0;
+    unsigned int Rate = 0;
+    char Options[16] = "";
+    char* Option;
+    char* Saved;
+    uint32_t RateCode;
+    bool Pair = false;
+    bool MaxSpeed = false;
+
+    if ((sscanf(Setting, "%u,%u,%15s", &Count, &Rate, Options) < 1) || (Count > VNUMDDC))
+    {
+        printf("error parsing simulated DDC rates %s: must be count,rate in KHz[,max][,pair] or 0\n", Setting);
+        return true;
+    }
+    for (Option = strtok_r(Options, ",", &Saved); Option != NULL; Option = strtok_r(NULL, ",", &Saved))
+    {
+        if (strcmp(Option, "max") == 0)
+            MaxSpeed = true;
+        else if ((strcmp(Option, "pair") == 0) && (Count >= 2))
+            Pair = true;
+        else
+        {
+            printf("error parsing simulated DDC rates %s: options are max, and pair for 2 or more DDCs\n", Setting);
+            return true;
+        }
+    }
+    SimDDCMaxSpeed = MaxSpeed;
+    RateCode = 0;
+    if ((Count != 0) && DDCGenRateCode(Rate, &RateCode))
+    {
+        printf("simulated DDC rate must be 48, 96, 192, 384, 768 or 1536KHz\n");
+        return true;
+    }
+    SimDDCRateOverride = MakeDDCGenRateWord(Count, RateCode, Pair);
+    return false;
+}
+
+
+//
+// rate word being generated
+//
+uint32_t GetSimulatedDDCRateWord(void)
+{
+    if (SimDDCRateOverride != 0)
+        return SimDDCRateOverride;
+    return SimRegisters[VADDRDDCRATES >> 2];
+}
+
+
+//
+// replay a DDC capture as the DDC stream, as "path[,max]"
+//
+bool SetSimulatedDDCReplay(char* Setting)
+{
+    char Path[256];
+    char* Comma;
+    struct DDCCaptureEntry* Last;
+
+    strncpy(Path, Setting, sizeof(Path) - 1);
+    Path[sizeof(Path) - 1] = 0;
+    SimDDCMaxSpeed = false;
+    Comma = strchr(Path, ',');
+    if (Comma != NULL)
+    {
+        *Comma = 0;
+        if (strcmp(Comma + 1, "max") != 0)
+        {
+            printf("error parsing DDC replay setting %s: must be path[,max]\n", Setting);
+            return true;
+        }
+        SimDDCMaxSpeed = true;
+    }
+    SimReplayCount = LoadDDCCapture(Path, &SimReplay);
+    if (SimReplayCount == 0)
+        return true;
+    //
+    // a pass lasts until the last record, plus one average record interval before the 1st comes round again
+    //
+    Last = SimReplay + SimReplayCount - 1;
+    SimReplayPeriod = Last->Time + ((SimReplayCount > 1) ? Last->Time / (SimReplayCount - 1) : 1000000);
+    if (SimReplayPeriod == 0)
+        SimReplayPeriod = 1000000;
+    printf("replaying DDC capture %s: %d records over %.3fs, %s\n", Path, SimReplayCount,
+           (double)SimReplayPeriod / 1.0e9, SimDDCMaxSpeed ? "at max speed" : "at original speed");
+    return false;
+}
+
+
+//
+// the simulated DDC stream generator, for its counts of frames made and corrupted
+//
+const struct DDCFrameGen* GetSimulatedDDCFrameGen(void)
+{
+    return &SimDDCGen;
+}
@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// simbackend.h:
+// simulated FPGA hardware backend, so the apps can run without a Saturn board
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __simbackend_h
+#define __simbackend_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/ddcframegen.h"
+
+
+//
+// UseSimulatedHardware(void)
+// install the simulated FPGA as the hardware backend.
+// must be called before OpenXDMADriver().
+// the simulation holds a register file, models the 4 DMA stream FIFOs filling
+// and draining in real time, and reports them through the FIFO monitor registers:
+// DDC: frames of a rate word then samples, at 48000 frames/s, made by the golden
+//      model of the FPGA framing in ddcframegen.h: each sample tagged with its DDC and number
+// mic: zero samples at 48KHz
+// DUC and speaker: written data is discarded at the real sample rates
+//
+void UseSimulatedHardware(void);
+
+
+//
+// bool SetSimulatedDDCRates(char* Setting)
+// set the DDC stream the simulation generates, independent of client settings.
+// Setting is "count,rate", eg "10,1536" for 10 DDCs at 1536KHz; "0" follows the
+// DDC rate register as set by the client (the default).
+// "count,rate,max" generates data as fast as it is read: the DDC FIFO always reads as full.
+// "count,rate,pair" makes DDCs 0 and 1 an interleaved pair (count 2 or more).
+// return true if error
+//
+bool SetSimulatedDDCRates(char* Setting);
+
+
+//
+// uint32_t GetSimulatedDDCRateWord(void)
+// return the DDC rate word the simulation is generating frames for
+//
+uint32_t GetSimulatedDDCRateWord(void);
+
+
+//
+// bool SetSimulatedDDCReplay(char* Setting)
+// replay a DDC capture file (see ddccapture.h) as the simulated DDC stream.
+// Setting is "path[,max]": the data arrives in the FIFO at the times it was recorded,
+// or with ",max" as fast as it is read. The capture loops, and restarts from the
+// beginning each time the DDC FIFO is reset.
+// return true if error
+//
+bool SetSimulatedDDCReplay(char* Setting);
+
+
+//
+// bool SetSimulatedDMAFaults(char* Setting)
+// make every nth DMA of one stream fail, to exercise error recovery.
+// Setting is "stream,n[,type]": stream is ddc, duc, mic or speaker; type is
+// timeout (the default), engine or short. n = 0 stops the faults.
+// for ddc, type may instead corrupt every nth frame of the stream: word (a sample
+// word lost), marker (the rate word marker lost), false (a sample with the marker)
+// or frame (the whole frame lost). These are set apart from the DMA faults.
+// return true if error
+//
+bool SetSimulatedDMAFaults(char* Setting);
+
+
+//
+// const struct DDCFrameGen* GetSimulatedDDCFrameGen(void)
+// the simulated DDC stream generator, for its counts of frames made and corrupted
+//
+const struct DDCFrameGen* GetSimulatedDDCFrameGen(void);
+
+
+#endif
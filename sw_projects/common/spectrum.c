@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// spectrum.c:
+// averaged power spectrum of real ADC samples, for a panadapter display
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../common/spectrum.h"
+
+
+#define VMAXSAMPLE16 32768.0
+
+
+//
+// create the analyser. A sine of amplitude A gives a bin of magnitude
+// A * sum(w) / 2, so the window is scaled to make that 1 at full scale.
+//
+bool CreateSpectrum(struct SpectrumAnalyser* Analyser, uint32_t Size)
+{
+    double Sum = 0.0;
+    double Phase;
+    uint32_t Cntr;
+
+    memset(Analyser, 0, sizeof(struct SpectrumAnalyser));
+    if ((Size < VMINSPECTRUMSIZE) || (Size > VMAXSPECTRUMSIZE) || (Size & (Size - 1)))
+        return true;
+    if (CreateFFT(&Analyser->FFT, Size, false))
+        return true;
+    Analyser->Memory = calloc(1, (Size * 3 + Size / 2) * sizeof(float));
+    if (Analyser->Memory == NULL)
+    {
+        FreeFFT(&Analyser->FFT);
+        return true;
+    }
+    Analyser->Size = Size;
+    Analyser->Window = (float*)Analyser->Memory;
+    Analyser->FFTI = Analyser->Window + Size;
+    Analyser->FFTQ = Analyser->FFTI + Size;
+    Analyser->Power = Analyser->FFTQ + Size;
+    for (Cntr = 0; Cntr < Size; Cntr++)
+    {
+        Phase = 2.0 * M_PI * Cntr / Size;
+        Analyser->Window[Cntr] = 0.35875 - 0.48829 * cos(Phase) + 0.14128 * cos(2.0 * Phase) - 0.01168 * cos(3.0 * Phase);
+        Sum += Analyser->Window[Cntr];
+    }
+    for (Cntr = 0; Cntr < Size; Cntr++)
+        Analyser->Window[Cntr] *= 2.0 / (VMAXSAMPLE16 * Sum);
+    return false;
+}
+
+
+//
+// Welch average over 50% overlapped blocks
+//
+uint32_t ComputeSpectrum(struct SpectrumAnalyser* Analyser, const uint8_t* Samples, uint32_t SampleCount, uint8_t* Bins)
+{
+    uint32_t Size = Analyser->Size;
+    uint32_t Start, Cntr;
+    uint32_t Count = 0;
+    int16_t Sample;
+    float Scale, Value;
+
+    memset(Analyser->Power, 0, Size / 2 * sizeof(float));
+    for (Start = 0; (Start + Size) <= SampleCount; Start += Size / 2)
+    {
+        for (Cntr = 0; Cntr < Size; Cntr++)
+        {
+            Sample = (int16_t)((Samples[2 * (Start + Cntr)] << 8) | Samples[2 * (Start + Cntr) + 1]);
+            Analyser->FFTI[Analyser->FFT.BitReverse[Cntr]] = Sample * Analyser->Window[Cntr];
+            Analyser->FFTQ[Cntr] = 0.0F;
+        }
+        RunFFT(&Analyser->FFT, Analyser->FFTI, Analyser->FFTQ);
+        for (Cntr = 0; Cntr < Size / 2; Cntr++)
+            Analyser->Power[Cntr] += Analyser->FFTI[Cntr] * Analyser->FFTI[Cntr] + Analyser->FFTQ[Cntr] * Analyser->FFTQ[Cntr];
+        Count++;
+    }
+    if (Count == 0)
+        return 0;
+    //
+    // -2 x dB is -20 x log10(power)
+    //
+    Scale = 1.0F / Count;
+    for (Cntr = 0; Cntr < Size / 2; Cntr++)
+    {
+        Value = -20.0F * log10f(Analyser->Power[Cntr] * Scale + 1.0e-20F);
+        if (Value < 0.0F)
+            Value = 0.0F;
+        else if (Value > 255.0F)
+            Value = 255.0F;
+        Bins[Cntr] = (uint8_t)(Value + 0.5F);
+    }
+    return Count;
+}
+
+
+//
+// release the memory
+//
+void FreeSpectrum(struct SpectrumAnalyser* Analyser)
+{
+    FreeFFT(&Analyser->FFT);
+    free(Analyser->Memory);
+    memset(Analyser, 0, sizeof(struct SpectrumAnalyser));
+}
@@ -0,0 +1,68 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// spectrum.h:
+// averaged power spectrum of real ADC samples, for a panadapter display
+//
+// the samples are cut into 50% overlapped blocks of the FFT size, each is
+// Blackman-Harris windowed and transformed, and the bin powers are averaged
+// over all the blocks (Welch's method). The result is one byte per bin.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __spectrum_h
+#define __spectrum_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../common/fft.h"
+
+
+#define VMINSPECTRUMSIZE 256                    // FFT sizes allowed (powers of 2)
+#define VMAXSPECTRUMSIZE 16384
+
+
+struct SpectrumAnalyser
+{
+    uint32_t Size;                              // FFT points; Size/2 bins are made
+    struct SplitFFT FFT;
+    float* Window;                              // scaled so a full scale sine reads 0dB
+    float* FFTI;
+    float* FFTQ;
+    float* Power;                               // bin powers summed over the blocks
+    void* Memory;
+};
+
+
+//
+// CreateSpectrum(struct SpectrumAnalyser* Analyser, uint32_t Size)
+// make an analyser with a Size point FFT (a power of 2, VMINSPECTRUMSIZE...VMAXSPECTRUMSIZE)
+// return true if error
+//
+bool CreateSpectrum(struct SpectrumAnalyser* Analyser, uint32_t Size);
+
+
+//
+// ComputeSpectrum(struct SpectrumAnalyser* Analyser, const uint8_t* Samples, uint32_t SampleCount, uint8_t* Bins)
+// average the spectra of SampleCount 16 bit big endian real samples into Size/2 bins,
+// from 0 to half the sample rate. Each bin is written as -2 x its power in dB relative
+// to a full scale sine: 0 = full scale, 255 = -127.5dB or below.
+// returns the number of FFTs averaged; 0 (and no bins written) if SampleCount < Size.
+//
+uint32_t ComputeSpectrum(struct SpectrumAnalyser* Analyser, const uint8_t* Samples, uint32_t SampleCount, uint8_t* Bins);
+
+
+//
+// FreeSpectrum(struct SpectrumAnalyser* Analyser)
+// release the analyser's memory
+//
+void FreeSpectrum(struct SpectrumAnalyser* Analyser);
+
+
+#endif
@@ -0,0 +1,13 @@
+# generated constant tables for saturnregisters.c
+# included by each Makefile that builds saturnregisters.o: maketables runs on
+# the build machine and writes saturntables.h next to saturnregisters.c
+# *****************************************************
+
+TABLESDIR := $(dir $(lastword $(MAKEFILE_LIST)))
+HOSTCC ?= gcc
+
+$(TABLESDIR)saturntables.h: $(TABLESDIR)maketables.c $(TABLESDIR)saturntablecalc.h
+	$(HOSTCC) -O2 -o $(TABLESDIR)maketables $(TABLESDIR)maketables.c -lm
+	$(TABLESDIR)maketables > $@.tmp && mv $@.tmp $@
+
+saturnregisters.o: $(TABLESDIR)saturntables.h
@@ -0,0 +1,302 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// txsamples.c:
+// TX sample format conversion: repack client I/Q samples for the FPGA
+//
+// the DUC I/Q samples from the client are 6 bytes: two 24 bit values, which
+// the FPGA wants in the opposite order. With USENEON defined (make USENEON=1) on an ARM
+// target, 8 samples (48 bytes) at a time are loaded by vld3 as 3 byte groups:
+// lane n of each vector is from group n, and I and Q are alternate groups,
+// so swapping each pair of adjacent lanes with vrev16 swaps I and Q; vst3
+// stores them back in order.
+//
+// for EER each sample is followed by an envelope sample: the magnitude of the
+// I/Q value, found a block at a time by a float kernel (NEON on 64 bit ARM).
+//
+// protocol 1 TX samples (16 bit, 48KHz) are interpolated 4x by a polyphase FIR
+// to the 24 bit 192KHz samples the DUC takes.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "../common/txsamples.h"
+
+#if defined(USENEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VTXSAMPLESNEON 1
+#endif
+
+#define VEERBLOCK 16                                            // samples per envelope kernel call
+#define VMAXENVELOPE 0x7FFFFF                                   // 24 bit full scale
+#define VINTERPCUTOFF (20000.0 / 192000.0)                      // interpolator passband edge, of the output rate
+#define VP1TXSCALE 256.0f                                       // 16 bit to 24 bit samples
+
+
+
+//
+// scalar copy, one byte at a time so there are no alignment requirements
+//
+void SwapIQSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+{
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < SampleCount; Cntr++)                  // samplecounter
+    {
+        *Dest++ = *(Src+3);                                     // get I sample (3 bytes)
+        *Dest++ = *(Src+4);
+        *Dest++ = *(Src+5);
+        *Dest++ = *(Src+0);                                     // get Q sample (3 bytes)
+        *Dest++ = *(Src+1);
+        *Dest++ = *(Src+2);
+        Src += 6;                                               // point at next source sample
+    }
+}
+
+
+//
+// swap using NEON if available, else the scalar code
+// NEON handles 8 samples (48 bytes) per iteration; any tail is done scalar
+//
+void SwapIQSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+{
+#ifdef VTXSAMPLESNEON
+    uint8x16x3_t Groups;
+
+    while (SampleCount >= 8)
+    {
+        Groups = vld3q_u8(Src);                                 // lane n of val[k] = byte k of group n
+        Groups.val[0] = vrev16q_u8(Groups.val[0]);              // swap groups 2n, 2n+1: I <-> Q
+        Groups.val[1] = vrev16q_u8(Groups.val[1]);
+        Groups.val[2] = vrev16q_u8(Groups.val[2]);
+        vst3q_u8(Dest, Groups);
+        Src += 48;
+        Dest += 48;
+        SampleCount -= 8;
+    }
+#endif
+    SwapIQSamplesScalar(Dest, Src, SampleCount);
+}
+
+
+//
+// in place swap: vld3 takes each 48 bytes before vst3 writes them back, so the
+// NEON loop works in place as it is; the tail swaps 3 bytes at a time
+//
+void SwapIQSamplesInPlace(uint8_t* Samples, uint32_t SampleCount)
+{
+    uint8_t Byte;
+    uint32_t Cntr;
+
+#ifdef VTXSAMPLESNEON
+    uint8x16x3_t Groups;
+
+    while (SampleCount >= 8)
+    {
+        Groups = vld3q_u8(Samples);
+        Groups.val[0] = vrev16q_u8(Groups.val[0]);
+        Groups.val[1] = vrev16q_u8(Groups.val[1]);
+        Groups.val[2] = vrev16q_u8(Groups.val[2]);
+        vst3q_u8(Samples, Groups);
+        Samples += 48;
+        SampleCount -= 8;
+    }
+#endif
+    while (SampleCount-- != 0)
+    {
+        for (Cntr = 0; Cntr < 3; Cntr++)
+        {
+            Byte = Samples[Cntr];
+            Samples[Cntr] = Samples[Cntr + 3];
+            Samples[Cntr + 3] = Byte;
+        }
+        Samples += 6;
+    }
+}
+
+
+//
+// signed 24 bit big endian value
+//
+static inline float Get24(const uint8_t* Src)
+{
+    return (float)((int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8);
+}
+
+
+//
+// Mag[n] = sqrt(I[n]^2 + Q[n]^2) for a block of samples
+//
+static void EnvelopeKernel(float* Mag, const float* I, const float* Q, uint32_t Count)
+{
+    uint32_t Cntr = 0;
+
+#if defined(VTXSAMPLESNEON) && defined(__aarch64__)
+    float32x4_t VI, VQ;
+
+    for (; Cntr + 4 <= Count; Cntr += 4)
+    {
+        VI = vld1q_f32(I + Cntr);
+        VQ = vld1q_f32(Q + Cntr);
+        vst1q_f32(Mag + Cntr, vsqrtq_f32(vmlaq_f32(vmulq_f32(VI, VI), VQ, VQ)));
+    }
+#endif
+    for (; Cntr < Count; Cntr++)
+        Mag[Cntr] = sqrtf(I[Cntr] * I[Cntr] + Q[Cntr] * Q[Cntr]);
+}
+
+
+//
+// swap each sample as SwapIQSamples(), and follow it by its envelope sample
+//
+void InterleaveEERSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+{
+    float I[VEERBLOCK], Q[VEERBLOCK], Mag[VEERBLOCK];
+    uint32_t Block, Cntr;
+    uint32_t Envelope;
+
+    while (SampleCount != 0)
+    {
+        Block = (SampleCount < VEERBLOCK) ? SampleCount : VEERBLOCK;
+        for (Cntr = 0; Cntr < Block; Cntr++)
+        {
+            I[Cntr] = Get24(Src + Cntr * 6);
+            Q[Cntr] = Get24(Src + Cntr * 6 + 3);
+        }
+        EnvelopeKernel(Mag, I, Q, Block);
+        for (Cntr = 0; Cntr < Block; Cntr++)
+        {
+            SwapIQSamplesScalar(Dest, Src, 1);                  // modulation sample
+            Envelope = (uint32_t)(Mag[Cntr] + 0.5f);
+            if (Envelope > VMAXENVELOPE)
+                Envelope = VMAXENVELOPE;
+            Dest[6] = 0;                                        // envelope sample: Q position 0,
+            Dest[7] = 0;
+            Dest[8] = 0;
+            Dest[9] = (Envelope >> 16) & 0xFF;                  // envelope in the I position
+            Dest[10] = (Envelope >> 8) & 0xFF;
+            Dest[11] = Envelope & 0xFF;
+            Src += 6;
+            Dest += 12;
+        }
+        SampleCount -= Block;
+    }
+}
+
+
+//
+// interpolator coefficients, by phase: output sample p of each input sample n is
+// the sum of Phase[p][k] * x[n - k]. Made once, from a Blackman windowed sinc;
+// the gain of each phase is VTXINTERPOLATION, so the zeros between samples don't lose level
+//
+static float InterpCoeffs[VTXINTERPOLATION][VTXINTERPTAPS];
+static bool InterpCoeffsMade = false;
+
+static void MakeInterpolatorCoeffs(void)
+{
+    double Coeffs[VTXINTERPOLATION * VTXINTERPTAPS];
+    double Centre = (VTXINTERPOLATION * VTXINTERPTAPS - 1) / 2.0;
+    double N = VTXINTERPOLATION * VTXINTERPTAPS - 1;
+    double Sum = 0.0;
+    double X;
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < VTXINTERPOLATION * VTXINTERPTAPS; Cntr++)
+    {
+        X = 2.0 * VINTERPCUTOFF * (Cntr - Centre);
+        Coeffs[Cntr] = sin(M_PI * X) / (M_PI * X)
+                     * (0.42 - 0.5 * cos(2.0 * M_PI * Cntr / N) + 0.08 * cos(4.0 * M_PI * Cntr / N));
+        Sum += Coeffs[Cntr];
+    }
+    for (Cntr = 0; Cntr < VTXINTERPOLATION * VTXINTERPTAPS; Cntr++)
+        InterpCoeffs[Cntr % VTXINTERPOLATION][Cntr / VTXINTERPOLATION] = (float)(Coeffs[Cntr] * VTXINTERPOLATION / Sum);
+    InterpCoeffsMade = true;
+}
+
+
+void ResetTXInterpolator(struct TXInterpolator* State)
+{
+    if (!InterpCoeffsMade)
+        MakeInterpolatorCoeffs();
+    memset(State, 0, sizeof(*State));
+}
+
+
+//
+// signed 16 bit big endian value
+//
+static inline float Get16(const uint8_t* Src)
+{
+    return (float)(int16_t)(((uint16_t)Src[0] << 8) | Src[1]);
+}
+
+
+//
+// 24 bit big endian value, clipped to full scale
+//
+static inline void Put24(uint8_t* Dest, float Value)
+{
+    int32_t Sample;
+
+    if (Value > (float)VMAXENVELOPE)
+        Value = (float)VMAXENVELOPE;
+    else if (Value < -(float)VMAXENVELOPE)
+        Value = -(float)VMAXENVELOPE;
+    Sample = (int32_t)lrintf(Value);
+    Dest[0] = (Sample >> 16) & 0xFF;
+    Dest[1] = (Sample >> 8) & 0xFF;
+    Dest[2] = Sample & 0xFF;
+}
+
+
+void InterpolateP1TXSamples(struct TXInterpolator* State, uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+{
+    const float* I;
+    const float* Q;
+    float SumI, SumQ;
+    uint32_t Phase, Tap;
+
+    for (; SampleCount != 0; SampleCount--, Src += 8)
+    {
+        State->Pos = (State->Pos == 0) ? VTXINTERPTAPS - 1 : State->Pos - 1;
+        State->I[State->Pos] = State->I[State->Pos + VTXINTERPTAPS] = Get16(Src + 4) * VP1TXSCALE;
+        State->Q[State->Pos] = State->Q[State->Pos + VTXINTERPTAPS] = Get16(Src + 6) * VP1TXSCALE;
+        I = State->I + State->Pos;                              // I[k] = x[n - k]
+        Q = State->Q + State->Pos;
+        for (Phase = 0; Phase < VTXINTERPOLATION; Phase++)
+        {
+            SumI = 0.0f;
+            SumQ = 0.0f;
+            for (Tap = 0; Tap < VTXINTERPTAPS; Tap++)
+            {
+                SumI += InterpCoeffs[Phase][Tap] * I[Tap];
+                SumQ += InterpCoeffs[Phase][Tap] * Q[Tap];
+            }
+            Put24(Dest, SumQ);                                  // FPGA order: Q position first
+            Put24(Dest + 3, SumI);
+            Dest += 6;
+        }
+    }
+}
+
+
+//
+// report which kernel is in use
+//
+const char* GetTXSampleKernelName(void)
+{
+#ifdef VTXSAMPLESNEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// txsamples.h:
+// TX sample format conversion: repack client I/Q samples for the FPGA
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __txsamples_h
+#define __txsamples_h
+
+#include <stdint.h>
+
+
+//
+// SwapIQSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+// copy SampleCount 48 bit I/Q samples from Src to Dest, swapping the two 24 bit
+// halves (I and Q) of each sample, as the FPGA needs for TX.
+// Src and Dest must not overlap. Either may have any alignment.
+// uses NEON if built with USENEON=1 on an ARM target, else a scalar copy
+//
+void SwapIQSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount);
+
+
+//
+// SwapIQSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+// the portable version; always available, so it can be benchmarked against the NEON kernel
+//
+void SwapIQSamplesScalar(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount);
+
+
+//
+// SwapIQSamplesInPlace(uint8_t* Samples, uint32_t SampleCount)
+// swap I and Q of SampleCount samples as SwapIQSamples() does, in place:
+// for samples received straight into the DMA buffer
+//
+void SwapIQSamplesInPlace(uint8_t* Samples, uint32_t SampleCount);
+
+
+//
+// InterleaveEERSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+// for EER mode: write 2 * SampleCount samples to Dest. Each I/Q sample from Src is
+// swapped as SwapIQSamples() does, and followed by an envelope sample holding the
+// magnitude of the I/Q value in the I position (24 bit, clipped to full scale) and
+// 0 in the Q position. The FPGA takes alternate samples for modulation and envelope.
+//
+void InterleaveEERSamples(uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount);
+
+
+//
+// protocol 1 TX samples are 16 bit at 48KHz; the DUC takes 24 bit samples at 192KHz.
+// a TXInterpolator holds the state of a 4x polyphase lowpass interpolator
+// (VTXINTERPTAPS taps per phase, 20KHz passband) between calls.
+//
+#define VTXINTERPOLATION 4                          // output samples per input sample
+#define VTXINTERPTAPS 16                            // input samples in each output sample
+
+struct TXInterpolator
+{
+    float I[2 * VTXINTERPTAPS];                     // input history, stored twice so the
+    float Q[2 * VTXINTERPTAPS];                     // newest VTXINTERPTAPS are always contiguous
+    uint32_t Pos;                                   // position of the newest sample
+};
+
+
+//
+// ResetTXInterpolator(struct TXInterpolator* State)
+// clear the history, eg at the start of a stream
+//
+void ResetTXInterpolator(struct TXInterpolator* State);
+
+
+//
+// InterpolateP1TXSamples(struct TXInterpolator* State, uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount)
+// Src holds SampleCount protocol 1 EP2 samples, 8 bytes each: L and R audio, then I and Q;
+// all 16 bit big endian. Writes VTXINTERPOLATION * SampleCount 24 bit I/Q samples to Dest,
+// in the order SwapIQSamples() makes for the FPGA. The audio bytes are ignored.
+//
+void InterpolateP1TXSamples(struct TXInterpolator* State, uint8_t* Dest, const uint8_t* Src, uint32_t SampleCount);
+
+
+//
+// GetTXSampleKernelName(void)
+// return a string saying which kernel the TX sample conversions use
+//
+const char* GetTXSampleKernelName(void);
+
+
+#endif
@@ -78,43 +78,105 @@ char* ClockStrings[] =
 
 
 
+#define VMAXCWRAMPDURATION 10000                    // 10ms max
+#define VMAXCWRAMPDURATIONV14PLUS 20000             // 20ms max
+
+
+struct SaturnCapabilities GSaturnCaps;              // read once by ProbeHardwareCapabilities()
+
+
+
 //
-// Check for a fallback configuration
-// returns true if FPGA is a fallback load
+// read the version registers once, and decode them and everything that depends on the firmware version
 //
-bool IsFallbackConfig(void)
+void ProbeHardwareCapabilities(void)
 {
-	bool Result = false;
 	uint32_t SoftwareInformation;			// swid & version
 	uint32_t ProductInformation;			// product id & version
-	uint32_t DateCode;						// date code from user register in FPGA
-
-	uint32_t SWVer, SWID;					// s/w version and id
-	uint32_t ProdVer, ProdID;				// product version and id
-	uint32_t ClockInfo;						// clock status
-	uint32_t Cntr;
-
-	char* ProdString;
-	char* SWString;
+	struct SaturnCapabilities* Caps = &GSaturnCaps;
 
 	//
 	// read the raw data from registers
 	//
 	SoftwareInformation = RegisterRead(VADDRSWVERSIONREG);
 	ProductInformation = RegisterRead(VADDRPRODVERSIONREG);
-	DateCode = RegisterRead(VADDRUSERVERSIONREG);
+	Caps->DateCode = RegisterRead(VADDRUSERVERSIONREG);
+
+	Caps->ClockInfo = (SoftwareInformation & 0xF);				// 4 clock bits
+	Caps->FirmwareVersion = (SoftwareInformation >> 4) & 0xFFFF;	// 16 bit sw version
+	Caps->SWID = (ESoftwareID)(SoftwareInformation >> 20);		// 12 bit software ID
+	Caps->ProductVersion = ProductInformation & 0xFFFF;			// 16 bit product version
+	Caps->ProductID = ProductInformation >> 16;					// 16 bit product ID
+	Caps->NumDDC = VNUMDDC;
+
+	//
+	// DMA FIFO sizes are version dependent
+	//
+	if ((Caps->FirmwareVersion >= 10) && (Caps->FirmwareVersion <= 12))
+	{
+		Caps->FIFODepths[0] = 16384;       //  eRXDDCDMA,		selects RX
+		Caps->FIFODepths[1] = 2048;        //  eTXDUCDMA,		selects TX
+		Caps->FIFODepths[2] = 256;         //  eMicCodecDMA,	selects mic samples
+		Caps->FIFODepths[3] = 1024;        //  eSpkCodecDMA	selects speaker samples
+	}
+	else if (Caps->FirmwareVersion >= 13)
+	{
+		Caps->FIFODepths[0] = 16384;       //  eRXDDCDMA,		selects RX
+		Caps->FIFODepths[1] = 4096;        //  eTXDUCDMA,		selects TX
+		Caps->FIFODepths[2] = 256;         //  eMicCodecDMA,	selects mic samples
+		Caps->FIFODepths[3] = 1024;        //  eSpkCodecDMA	selects speaker samples
+	}
+	else
+		memcpy(Caps->FIFODepths, DMAFIFODepths, sizeof(Caps->FIFODepths));		// original sizes
+
+	//
+	// feature flags
+	//
+	Caps->Features = 0;
+	if ((Caps->ProductID == SATURNPRODUCTID) && (Caps->SWID == SATURNGOLDENCONFIGID))
+		Caps->Features |= VCAPFALLBACKLOAD;
+	if (Caps->FirmwareVersion >= 12)
+		Caps->Features |= VCAPSEPARATEALEXANT;
+	if (Caps->FirmwareVersion >= 13)
+		Caps->Features |= VCAPTXSCALEV13;
+	if (Caps->FirmwareVersion >= 14)
+	{
+		Caps->Features |= VCAPCWRAMPWORDADDR;
+		Caps->MaxCWRampDuration = VMAXCWRAMPDURATIONV14PLUS;
+	}
+	else
+		Caps->MaxCWRampDuration = VMAXCWRAMPDURATION;
+	Caps->Probed = true;
+}
 
-	ClockInfo = (SoftwareInformation & 0xF);				// 4 clock bits
-	SWVer = (SoftwareInformation >> 4) & 0xFFFF;			// 16 bit sw version
-	SWID = SoftwareInformation >> 20;						// 12 bit software ID
 
-	ProdVer = ProductInformation & 0xFFFF;					// 16 bit product version
-	ProdID = ProductInformation >> 16;						// 16 bit product ID
+//
+// return the capabilities, probing the first time if needed
+//
+const struct SaturnCapabilities* GetHardwareCapabilities(void)
+{
+	if (!GSaturnCaps.Probed)
+		ProbeHardwareCapabilities();
+	return &GSaturnCaps;
+}
 
-	if ((ProdID == SATURNPRODUCTID) && (SWID == SATURNGOLDENCONFIGID))
-		Result = true;
 
-	return Result;
+//
+// check for one feature
+//
+bool HasCapability(uint32_t Feature)
+{
+	return (GetHardwareCapabilities()->Features & Feature) != 0;
+}
+
+
+//
+// Check for a fallback configuration
+// returns true if FPGA is a fallback load
+//
+bool IsFallbackConfig(void)
+{
+	return HasCapability(VCAPFALLBACKLOAD);
 }
 
 //
@@ -122,49 +184,33 @@ bool IsFallbackConfig(void)
 //
 void PrintVersionInfo(void)
 {
-	uint32_t SoftwareInformation;			// swid & version
-	uint32_t ProductInformation;			// product id & version
-	uint32_t DateCode;						// date code from user register in FPGA
-
-	uint32_t SWVer, SWID;					// s/w version and id
-	uint32_t ProdVer, ProdID;				// product version and id
+	const struct SaturnCapabilities* Caps;
 	uint32_t ClockInfo;						// clock status
 	uint32_t Cntr;
 
 	char* ProdString;
 	char* SWString;
 
-	//
-	// read the raw data from registers
-	//
-	SoftwareInformation = RegisterRead(VADDRSWVERSIONREG);
-	ProductInformation = RegisterRead(VADDRPRODVERSIONREG);
-	DateCode = RegisterRead(VADDRUSERVERSIONREG);
-	printf("FPGA BIT file data code = %08x\n", DateCode);
-
-	ClockInfo = (SoftwareInformation & 0xF);				// 4 clock bits
-	SWVer = (SoftwareInformation >> 4) & 0xFFFF;			// 16 bit sw version
-	SWID = SoftwareInformation >> 20;						// 12 bit software ID
-
-	ProdVer = ProductInformation & 0xFFFF;					// 16 bit product version
-	ProdID = ProductInformation >> 16;						// 16 bit product ID
+	Caps = GetHardwareCapabilities();
+	printf("FPGA BIT file data code = %08x\n", Caps->DateCode);
 
 	//
 	// now chack if IDs are valid and print strings
 	//
-	if (ProdID > VMAXPRODUCTID)
+	if (Caps->ProductID > VMAXPRODUCTID)
 		ProdString = ProductIDStrings[0];
 	else
-		ProdString = ProductIDStrings[ProdID];
+		ProdString = ProductIDStrings[Caps->ProductID];
 
-	if (SWID > VMAXSWID)
+	if ((uint32_t)Caps->SWID > VMAXSWID)
 		SWString = SWIDStrings[0];
 	else
-		SWString = SWIDStrings[SWID];
+		SWString = SWIDStrings[Caps->SWID];
 
-	printf(" Product: %s; Version = %d\n", ProdString, ProdVer);
-	printf(" FPGA Firmware loaded: %s; FW Version = %d\n", SWString, SWVer);
+	printf(" Product: %s; Version = %d\n", ProdString, Caps->ProductVersion);
+	printf(" FPGA Firmware loaded: %s; FW Version = %d\n", SWString, Caps->FirmwareVersion);
 
+	ClockInfo = Caps->ClockInfo;
 	if (ClockInfo == 0xF)
 		printf("All clocks present\n");
 	else
@@ -187,13 +233,8 @@ void PrintVersionInfo(void)
 //
 unsigned int GetFirmwareVersion(ESoftwareID* ID)
 {
-	unsigned int Version = 0;
-	uint32_t SoftwareInformation;			// swid & version
+	const struct SaturnCapabilities* Caps = GetHardwareCapabilities();
 
-	SoftwareInformation = RegisterRead(VADDRSWVERSIONREG);
-	Version = (SoftwareInformation >> 4) & 0xFFFF;			// 16 bit sw version
-	*ID = (ESoftwareID)(SoftwareInformation >> 20);						// 12 bit software ID
-	return Version;
+	*ID = Caps->SWID;
+	return Caps->FirmwareVersion;
 }
-
-
@@ -16,6 +16,8 @@
 #define __version_h
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "../common/saturnregisters.h"
 
 
 
@@ -45,7 +47,58 @@ typedef enum
 
 
 //
-// function call to get firmware ID and version
+// hardware capability feature flags
+//
+#define VCAPFALLBACKLOAD 0x0001             // FPGA is the fallback "golden" image
+#define VCAPSEPARATEALEXANT 0x0002          // V12+: separate TX and RX Alex antenna words
+#define VCAPCWRAMPWORDADDR 0x0004           // V14+: CW ramp length is a word address
+#define VCAPTXSCALEV13 0x0008               // V13+: changed TX amplitude scaling
+
+
+//
+// hardware capabilities: read from the FPGA once, then used by every subsystem
+// instead of re-reading and decoding the version registers
+//
+struct SaturnCapabilities
+{
+    bool Probed;                            // true once the registers have been read
+    uint32_t DateCode;                      // FPGA BIT file date code
+    uint32_t ProductID;
+    uint32_t ProductVersion;
+    ESoftwareID SWID;                       // firmware type
+    uint32_t FirmwareVersion;
+    uint32_t ClockInfo;                     // 4 clock present bits
+    uint32_t FIFODepths[VNUMDMAFIFO];       // DMA FIFO depths, 64 bit words
+    uint32_t MaxCWRampDuration;             // microseconds
+    uint32_t NumDDC;                        // DDCs available
+    uint32_t Features;                      // VCAP... flags
+};
+
+
+//
+// ProbeHardwareCapabilities(void)
+// read and decode the FPGA identification registers. Call once the XDMA driver is open
+// and before threads start; later calls re-read the registers.
+//
+void ProbeHardwareCapabilities(void);
+
+
+//
+// GetHardwareCapabilities(void)
+// return the capability struct. Probes the hardware if that hasn't been done yet.
+//
+const struct SaturnCapabilities* GetHardwareCapabilities(void);
+
+
+//
+// HasCapability(uint32_t Feature)
+// true if the FPGA has the VCAP... feature
+//
+bool HasCapability(uint32_t Feature);
+
+
+//
+// function call to get firmware ID and version (from the capability struct)
 //
 unsigned int GetFirmwareVersion(ESoftwareID* ID);
 
@@ -0,0 +1,805 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// vfiobackend.c:
+// user space XDMA backend through VFIO
+//
+// a small port of the descriptor handling in the XDMA driver (libxdma.c: transfer_init(),
+// engine_start(), engine_service_poll()): each transfer is one descriptor list, in a
+// per-engine descriptor area mapped for the device, ending in a descriptor with the
+// stopped and completed flags. The engine runs in poll mode, writing its completed
+// descriptor count to a writeback word, and the caller spins on that.
+// PCIe on the Pi is not cache coherent, so on arm64 the descriptors, writeback word
+// and data are cleaned/invalidated by address from user space (DC CIVAC).
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/vfio.h>
+#include "vfiobackend.h"
+#include "hwaccess.h"
+
+
+//
+// XDMA register map and descriptor format (as libxdma.h)
+//
+#define VXDMAENGINEH2C 0x0000                       // H2C channel n engine registers at + n * 0x100
+#define VXDMAENGINEC2H 0x1000
+#define VXDMAIRQBLOCK 0x2000
+#define VXDMACONFIGBLOCK 0x3000
+#define VXDMASGDMAOFFSET 0x4000                     // SGDMA registers, from the engine's
+#define VXDMACHANNELSPACING 0x100
+#define VXDMAIDH2C 0x1fc0                           // identifier register top 16 bits
+#define VXDMAIDC2H 0x1fc1
+#define VXDMAIDIRQ 0x1fc2
+#define VXDMAIDCONFIG 0x1fc3
+#define VXDMAIDSTREAM 0x8000                        // AXI-ST engine, not AXI-MM
+
+#define VENGCONTROL 0x04                            // engine register offsets (struct engine_regs)
+#define VENGSTATUS 0x40
+#define VENGSTATUSRC 0x44
+#define VENGWBLO 0x88
+#define VENGWBHI 0x8C
+#define VENGINTMASK 0x90
+#define VSGFIRSTLO 0x80                             // SGDMA register offsets (struct engine_sgdma_regs)
+#define VSGFIRSTHI 0x84
+#define VSGADJACENT 0x88
+
+#define VCTRLRUN (1U << 0)
+#define VCTRLPOLLWB (1U << 26)
+#define VSTATBUSY (1U << 0)
+#define VSTATERRORS 0x00FFFE38U                     // alignment, magic, length, read, write and descriptor errors
+#define VDESCMAGIC 0xAD4B0000U
+#define VDESCSTOPPED (1U << 0)
+#define VDESCCOMPLETED (1U << 1)
+#define VDESCEOP (1U << 4)
+#define VDESCMAXBYTES ((1U << 28) - 1)
+#define VMAXADJACENT 63
+#define VWBERROR (1U << 31)
+#define VWBCOUNTMASK 0x00FFFFFFU
+
+#define VMAXVFIOCHANNELS 4                          // per direction
+#define VMAXVFIODESC 2048                           // descriptors per transfer (as the driver)
+#define VVFIODESCAREA (VMAXVFIODESC * sizeof(struct XDMADescriptor))
+#define VVFIOWBSIZE 4096                            // writeback words: one page, for all engines
+#define VMAXVFIOREGIONS 32                          // memory areas mapped for DMA
+#define VMAXVFIOREGION (64 * 1024 * 1024)           // largest area mapped at once
+#define VVFIOREGIONALIGN (2 * 1024 * 1024)          // a larger allocation is mapped in these pieces
+#define VVFIOIOVABASE 0x100000ULL                   // IOVAs given out from here (IOMMU only)
+#define VVFIOTIMEOUT 1000                           // ms before a transfer is aborted
+
+
+struct XDMADescriptor
+{
+    uint32_t Control;
+    uint32_t Bytes;
+    uint32_t SrcLo;
+    uint32_t SrcHi;
+    uint32_t DstLo;
+    uint32_t DstHi;
+    uint32_t NextLo;
+    uint32_t NextHi;
+};
+
+
+//
+// an area of memory mapped for DMA: with an IOMMU one run of IOVAs from IOVA;
+// without, the bus (physical) address of each page
+//
+struct VFIORegion
+{
+    unsigned char* Base;                            // page aligned
+    uint64_t Length;
+    uint64_t IOVA;
+    uint64_t* Pages;                                // no IOMMU: bus address per page, else NULL
+};
+
+
+struct VFIOEngine
+{
+    bool Present;
+    bool ToDevice;                                  // H2C
+    uint32_t Channel;
+    int fd;                                         // fd given to the caller, or -1
+    volatile uint32_t* Regs;                        // engine registers
+    volatile uint32_t* SGRegs;                      // SGDMA registers
+    struct XDMADescriptor* Descriptors;             // mapped for the device
+    uint64_t DescriptorBus;
+    uint32_t MaxDescriptors;                        // that are contiguous on the bus
+    volatile uint32_t* Writeback;                   // completed descriptor count
+    uint64_t WritebackBus;
+    pthread_mutex_t Lock;
+};
+
+
+static int VFIOContainer = -1;
+static int VFIOGroup = -1;
+static int VFIODevice = -1;
+static bool VFIONoIOMMU = false;                    // true if there is no IOMMU: DMA to physical pages
+static int PagemapFd = -1;                          // /proc/self/pagemap, no IOMMU only
+static uint32_t PageSize;
+static volatile uint32_t* UserBAR = NULL;           // AXI-Lite registers
+static uint64_t UserBARSize = 0;
+static volatile uint8_t* ConfigBAR = NULL;          // XDMA DMA registers
+static struct VFIOEngine Engines[2][VMAXVFIOCHANNELS];  // [C2H, H2C][channel]
+static struct VFIORegion Regions[VMAXVFIOREGIONS];
+static uint32_t RegionCount = 0;
+static uint64_t NextIOVA = VVFIOIOVABASE;
+static pthread_mutex_t RegionMutex = PTHREAD_MUTEX_INITIALIZER;
+#if defined(__aarch64__)
+static uint32_t CacheLineSize = 64;                 // from CTR_EL0
+#endif
+
+
+
+//
+// cache maintenance for a device that doesn't snoop the CPU caches.
+// clean and invalidate: dirty lines are written out before the device reads, and no
+// stale lines remain to hide what it wrote. x86 PCIe is coherent, so nothing is needed.
+//
+static inline void CacheFlush(const volatile void* Start, uint64_t Length)
+{
+#if defined(__aarch64__)
+    uintptr_t Addr = (uintptr_t)Start & ~(uintptr_t)(CacheLineSize - 1);
+    uintptr_t End = (uintptr_t)Start + Length;
+
+    for (; Addr < End; Addr += CacheLineSize)
+        __asm__ volatile("dc civac, %0" : : "r"(Addr) : "memory");
+    __asm__ volatile("dsb sy" : : : "memory");
+#else
+    (void)Start;
+    (void)Length;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+
+static inline void SpinPause(void)
+{
+#if defined(__aarch64__)
+    __asm__ volatile("yield");
+#elif defined(__x86_64__) || defined(__i386__)
+    __asm__ volatile("pause");
+#endif
+}
+
+
+static inline uint32_t ReadReg(volatile uint32_t* Base, uint32_t Offset)
+{
+    return Base[Offset / 4];
+}
+
+
+static inline void WriteReg(volatile uint32_t* Base, uint32_t Offset, uint32_t Value)
+{
+    Base[Offset / 4] = Value;
+}
+
+
+static uint32_t NowMilliseconds(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &Now);
+    return (uint32_t)(Now.tv_sec * 1000 + Now.tv_nsec / 1000000);
+}
+
+
+
+//
+// DMA memory mapping
+//
+// find the mapping of /proc/self/maps that holds Addr
+//
+static bool FindMapping(uintptr_t Addr, uintptr_t* Start, uintptr_t* End)
+{
+    FILE* Maps;
+    char Line[512];
+    unsigned long MapStart, MapEnd;
+    bool Found = false;
+
+    Maps = fopen("/proc/self/maps", "r");
+    if (Maps == NULL)
+        return false;
+    while (!Found && (fgets(Line, sizeof(Line), Maps) != NULL))
+        if ((sscanf(Line, "%lx-%lx", &MapStart, &MapEnd) == 2) && (Addr >= MapStart) && (Addr < MapEnd))
+        {
+            *Start = MapStart;
+            *End = MapEnd;
+            Found = true;
+        }
+    fclose(Maps);
+    return Found;
+}
+
+
+//
+// no IOMMU: lock the pages and read their physical addresses
+//
+static bool MapRegionPages(struct VFIORegion* Region)
+{
+    uint64_t Count = Region->Length / PageSize;
+    uint64_t Entry;
+    uint64_t Page;
+
+    if (mlock(Region->Base, Region->Length) != 0)
+    {
+        printf("VFIO: can't lock DMA memory: %s\n", strerror(errno));
+        return true;
+    }
+    Region->Pages = malloc(Count * sizeof(uint64_t));
+    if (Region->Pages == NULL)
+        return true;
+    for (Page = 0; Page < Count; Page++)
+    {
+        Region->Base[Page * PageSize] |= 0;                         // fault the page in
+        if (pread(PagemapFd, &Entry, sizeof(Entry), (off_t)(((uintptr_t)Region->Base / PageSize + Page) * sizeof(Entry))) != sizeof(Entry)
+            || !(Entry & (1ULL << 63)) || ((Entry & ((1ULL << 55) - 1)) == 0))
+        {
+            printf("VFIO: no physical address for DMA memory (needs root)\n");
+            free(Region->Pages);
+            Region->Pages = NULL;
+            return true;
+        }
+        Region->Pages[Page] = (Entry & ((1ULL << 55) - 1)) * PageSize;
+    }
+    return false;
+}
+
+
+//
+// IOMMU: map the area to a run of IOVAs
+//
+static bool MapRegionIOVA(struct VFIORegion* Region)
+{
+    struct vfio_iommu_type1_dma_map Map;
+
+    memset(&Map, 0, sizeof(Map));
+    Map.argsz = sizeof(Map);
+    Map.flags = VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE;
+    Map.vaddr = (uintptr_t)Region->Base;
+    Map.iova = NextIOVA;
+    Map.size = Region->Length;
+    if (ioctl(VFIOContainer, VFIO_IOMMU_MAP_DMA, &Map) != 0)
+    {
+        printf("VFIO: DMA map of %lluKB failed: %s (locked memory limit?)\n",
+               (unsigned long long)Region->Length / 1024, strerror(errno));
+        return true;
+    }
+    Region->IOVA = NextIOVA;
+    NextIOVA += (Region->Length + VVFIOREGIONALIGN - 1) & ~(uint64_t)(VVFIOREGIONALIGN - 1);
+    return false;
+}
+
+
+//
+// the mapped area holding Buffer to Buffer + Length, mapping it if this is its first use:
+// the whole allocation it is in, or for a large one the 2MB pieces it spans
+//
+static struct VFIORegion* GetRegion(unsigned char* Buffer, uint32_t Length)
+{
+    struct VFIORegion* Region = NULL;
+    uintptr_t Start, End;
+    uintptr_t First = (uintptr_t)Buffer;
+    uintptr_t Last = First + Length;
+    uint32_t Cntr;
+
+    pthread_mutex_lock(&RegionMutex);
+    for (Cntr = 0; Cntr < RegionCount; Cntr++)
+        if ((First >= (uintptr_t)Regions[Cntr].Base) && (Last <= (uintptr_t)Regions[Cntr].Base + Regions[Cntr].Length))
+        {
+            Region = Regions + Cntr;
+            break;
+        }
+    if ((Region == NULL) && (RegionCount < VMAXVFIOREGIONS) && FindMapping(First, &Start, &End) && (Last <= End))
+    {
+        if ((End - Start) > VMAXVFIOREGION)
+        {
+            Start = (First & ~(uintptr_t)(VVFIOREGIONALIGN - 1)) > Start ? (First & ~(uintptr_t)(VVFIOREGIONALIGN - 1)) : Start;
+            End = ((Last + VVFIOREGIONALIGN - 1) & ~(uintptr_t)(VVFIOREGIONALIGN - 1)) < End
+                ? ((Last + VVFIOREGIONALIGN - 1) & ~(uintptr_t)(VVFIOREGIONALIGN - 1)) : End;
+        }
+        Region = Regions + RegionCount;
+        memset(Region, 0, sizeof(*Region));
+        Region->Base = (unsigned char*)Start;
+        Region->Length = End - Start;
+        if (VFIONoIOMMU ? MapRegionPages(Region) : MapRegionIOVA(Region))
+            Region = NULL;
+        else
+            RegionCount++;
+    }
+    else if (Region == NULL)
+        printf("VFIO: can't map DMA buffer %p for the device\n", (void*)Buffer);
+    pthread_mutex_unlock(&RegionMutex);
+    return Region;
+}
+
+
+//
+// bus address of Buffer, and the bytes from there that are contiguous on the bus
+//
+static uint64_t BusAddress(struct VFIORegion* Region, unsigned char* Buffer, uint32_t Length, uint32_t* Contiguous)
+{
+    uint64_t Offset = Buffer - Region->Base;
+    uint64_t Page, Bus, Run;
+
+    if (Region->Pages == NULL)
+    {
+        *Contiguous = Length;
+        return Region->IOVA + Offset;
+    }
+    Page = Offset / PageSize;
+    Bus = Region->Pages[Page] + Offset % PageSize;
+    Run = PageSize - Offset % PageSize;
+    while ((Run < Length) && (Region->Pages[Page + 1] == Region->Pages[Page] + PageSize))
+    {
+        Page++;
+        Run += PageSize;
+    }
+    *Contiguous = (Run < Length) ? (uint32_t)Run : Length;
+    return Bus;
+}
+
+
+
+//
+// engines
+//
+// a descriptor can be fetched with up to 63 following it, if they don't cross a 4KB page
+//
+static uint32_t Adjacent(struct VFIOEngine* Engine, uint32_t Index, uint32_t Count)
+{
+    uint32_t Left = Count - Index - 1;
+    uint32_t InPage = (uint32_t)((4096 - ((Engine->DescriptorBus + Index * sizeof(struct XDMADescriptor)) & 4095))
+                                 / sizeof(struct XDMADescriptor)) - 1;
+
+    if (Left > InPage)
+        Left = InPage;
+    return (Left > VMAXADJACENT) ? VMAXADJACENT : Left;
+}
+
+
+//
+// build the descriptor list for a transfer, as transfer_init(); returns the count or 0 if too many
+//
+static uint32_t BuildDescriptors(struct VFIOEngine* Engine, struct VFIORegion* Region, unsigned char* Buffer,
+                                 uint32_t Length, uint32_t AXIAddr)
+{
+    struct XDMADescriptor* Desc;
+    uint32_t Count = 0;
+    uint32_t Chunk;
+    uint64_t Bus, Next;
+
+    while (Length != 0)
+    {
+        if (Count == Engine->MaxDescriptors)
+            return 0;
+        Bus = BusAddress(Region, Buffer, Length, &Chunk);
+        if (Chunk > VDESCMAXBYTES)
+            Chunk = VDESCMAXBYTES & ~(uint32_t)(PageSize - 1);
+        Desc = Engine->Descriptors + Count;
+        Desc->Bytes = Chunk;
+        if (Engine->ToDevice)
+        {
+            Desc->SrcLo = (uint32_t)Bus;
+            Desc->SrcHi = (uint32_t)(Bus >> 32);
+            Desc->DstLo = AXIAddr;
+            Desc->DstHi = 0;
+        }
+        else
+        {
+            Desc->SrcLo = AXIAddr;
+            Desc->SrcHi = 0;
+            Desc->DstLo = (uint32_t)Bus;
+            Desc->DstHi = (uint32_t)(Bus >> 32);
+        }
+        Next = Engine->DescriptorBus + (Count + 1) * sizeof(struct XDMADescriptor);
+        Desc->NextLo = (uint32_t)Next;
+        Desc->NextHi = (uint32_t)(Next >> 32);
+        Buffer += Chunk;
+        AXIAddr += Chunk;
+        Length -= Chunk;
+        Count++;
+    }
+    for (Chunk = 0; Chunk < Count; Chunk++)
+        Engine->Descriptors[Chunk].Control = VDESCMAGIC | (Adjacent(Engine, Chunk, Count) << 8);
+    Desc = Engine->Descriptors + Count - 1;
+    Desc->Control |= VDESCSTOPPED | VDESCCOMPLETED | VDESCEOP;
+    Desc->NextLo = 0;
+    Desc->NextHi = 0;
+    return Count;
+}
+
+
+static void StopEngine(struct VFIOEngine* Engine)
+{
+    WriteReg(Engine->Regs, VENGCONTROL, 0);
+    (void)ReadReg(Engine->Regs, VENGSTATUSRC);                     // read to clear
+}
+
+
+//
+// one transfer: start the engine on the list and spin on the writeback, as engine_service_poll()
+//
+static int Transfer(int fd, unsigned char* Buffer, uint32_t Length, uint32_t AXIAddr, bool ToDevice)
+{
+    struct VFIOEngine* Engine = NULL;
+    struct VFIORegion* Region;
+    uint32_t Count, Written, Status, Cntr, Start;
+    int Result = 0;
+
+    for (Cntr = 0; Cntr < VMAXVFIOCHANNELS; Cntr++)
+        if (Engines[ToDevice][Cntr].Present && (Engines[ToDevice][Cntr].fd == fd))
+            Engine = &Engines[ToDevice][Cntr];
+    if (Engine == NULL)
+        return -EBADF;
+    if (Length == 0)
+        return 0;
+    if ((Region = GetRegion(Buffer, Length)) == NULL)
+        return -ENOMEM;
+
+    pthread_mutex_lock(&Engine->Lock);
+    Count = BuildDescriptors(Engine, Region, Buffer, Length, AXIAddr);
+    if (Count == 0)
+    {
+        pthread_mutex_unlock(&Engine->Lock);
+        return -EINVAL;
+    }
+    *Engine->Writeback = 0;
+    CacheFlush(Engine->Descriptors, Count * sizeof(struct XDMADescriptor));
+    CacheFlush(Engine->Writeback, sizeof(uint32_t));
+    CacheFlush(Buffer, Length);
+    WriteReg(Engine->SGRegs, VSGFIRSTLO, (uint32_t)Engine->DescriptorBus);
+    WriteReg(Engine->SGRegs, VSGFIRSTHI, (uint32_t)(Engine->DescriptorBus >> 32));
+    WriteReg(Engine->SGRegs, VSGADJACENT, Adjacent(Engine, 0, Count));
+    WriteReg(Engine->Regs, VENGCONTROL, VCTRLRUN | VCTRLPOLLWB);
+
+    Start = NowMilliseconds();
+    for (Cntr = 1; ; Cntr++)
+    {
+        CacheFlush(Engine->Writeback, sizeof(uint32_t));
+        Written = *Engine->Writeback;
+        if (Written & VWBERROR)
+        {
+            Result = -EIO;
+            break;
+        }
+        if ((Written & VWBCOUNTMASK) >= Count)
+            break;
+        if (((Cntr & 1023) == 0) && ((NowMilliseconds() - Start) > VVFIOTIMEOUT))
+        {
+            Result = -ETIMEDOUT;
+            break;
+        }
+        SpinPause();
+    }
+    Status = ReadReg(Engine->Regs, VENGSTATUS);
+    if ((Result == 0) && (Status & VSTATERRORS))
+        Result = -EIO;
+    StopEngine(Engine);
+    if ((Result != 0) && (Status & VSTATBUSY))
+        printf("VFIO: %s %u transfer %uB @ 0x%x %s, status 0x%08x\n", ToDevice ? "H2C" : "C2H", Engine->Channel,
+               Length, AXIAddr, (Result == -ETIMEDOUT) ? "timed out" : "failed", Status);
+    if (!ToDevice)
+        CacheFlush(Buffer, Length);                                 // drop lines fetched while the engine wrote
+    pthread_mutex_unlock(&Engine->Lock);
+    return Result;
+}
+
+
+
+//
+// backend calls
+//
+// "/dev/xdma0_c2h_1" -> C2H engine 1; a real fd is returned, so close() works
+//
+static int VFIOOpenDMADevice(const char* Path, int Flags)
+{
+    const char* Name;
+    bool ToDevice;
+    uint32_t Channel;
+    uint32_t Cntr;
+    struct VFIOEngine* Engine;
+    int fd;
+
+    if ((Name = strstr(Path, "_h2c_")) != NULL)
+        ToDevice = true;
+    else if ((Name = strstr(Path, "_c2h_")) != NULL)
+        ToDevice = false;
+    else
+        return -1;                                                  // eg events: not available
+    Channel = (uint32_t)atoi(Name + 5);
+    if ((Channel >= VMAXVFIOCHANNELS) || !Engines[ToDevice][Channel].Present)
+        return -1;
+    fd = open("/dev/null", Flags);
+    if (fd < 0)
+        return -1;
+    for (Cntr = 0; Cntr < 2 * VMAXVFIOCHANNELS; Cntr++)            // a closed fd's number may have been reused
+    {
+        Engine = &Engines[Cntr / VMAXVFIOCHANNELS][Cntr % VMAXVFIOCHANNELS];
+        if (Engine->fd == fd)
+            Engine->fd = -1;
+    }
+    Engine = &Engines[ToDevice][Channel];
+    pthread_mutex_lock(&Engine->Lock);
+    StopEngine(Engine);                                             // no transfer left running from before
+    Engine->fd = fd;
+    pthread_mutex_unlock(&Engine->Lock);
+    return fd;
+}
+
+
+static uint32_t VFIORegisterRead(uint32_t Address)
+{
+    if ((uint64_t)Address + 4 > UserBARSize)
+        return 0;
+    return UserBAR[Address >> 2];
+}
+
+
+static void VFIORegisterWrite(uint32_t Address, uint32_t Data)
+{
+    if ((uint64_t)Address + 4 <= UserBARSize)
+        UserBAR[Address >> 2] = Data;
+}
+
+
+static int VFIODMARead(int fd, unsigned char* DestData, uint32_t Length, uint32_t AXIAddr)
+{
+    return Transfer(fd, DestData, Length, AXIAddr, false);
+}
+
+
+static int VFIODMAWrite(int fd, unsigned char* SrcData, uint32_t Length, uint32_t AXIAddr)
+{
+    return Transfer(fd, SrcData, Length, AXIAddr, true);
+}
+
+
+static const struct HardwareBackend VFIOBackend =
+{
+    "VFIO user space XDMA",
+    VFIOOpenDMADevice,
+    VFIORegisterRead,
+    VFIORegisterWrite,
+    VFIODMARead,
+    VFIODMAWrite
+};
+
+
+
+//
+// setup
+//
+// open the board's IOMMU group and device, in a container of its own
+//
+static bool OpenVFIODevice(const char* PCIAddress)
+{
+    char Link[PATH_MAX];
+    char Path[PATH_MAX + 32];
+    const char* Group;
+    ssize_t Size;
+    struct vfio_group_status Status;
+    int Type;
+
+    snprintf(Path, sizeof(Path), "/sys/bus/pci/devices/%s/iommu_group", PCIAddress);
+    Size = readlink(Path, Link, sizeof(Link) - 1);
+    if (Size < 0)
+    {
+        printf("VFIO: no IOMMU group for %s: is it bound to vfio-pci?\n", PCIAddress);
+        return true;
+    }
+    Link[Size] = 0;
+    Group = strrchr(Link, '/');
+    Group = (Group != NULL) ? Group + 1 : Link;
+
+    VFIOContainer = open("/dev/vfio/vfio", O_RDWR);
+    if ((VFIOContainer < 0) || (ioctl(VFIOContainer, VFIO_GET_API_VERSION) != VFIO_API_VERSION))
+    {
+        printf("VFIO: /dev/vfio/vfio not available\n");
+        return true;
+    }
+    if (ioctl(VFIOContainer, VFIO_CHECK_EXTENSION, VFIO_TYPE1v2_IOMMU) > 0)
+        Type = VFIO_TYPE1v2_IOMMU;
+    else if (ioctl(VFIOContainer, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU) > 0)
+        Type = VFIO_TYPE1_IOMMU;
+    else if (ioctl(VFIOContainer, VFIO_CHECK_EXTENSION, VFIO_NOIOMMU_IOMMU) > 0)
+    {
+        Type = VFIO_NOIOMMU_IOMMU;
+        VFIONoIOMMU = true;
+    }
+    else
+    {
+        printf("VFIO: no IOMMU, and vfio not loaded with enable_unsafe_noiommu_mode=1\n");
+        return true;
+    }
+
+    snprintf(Path, sizeof(Path), VFIONoIOMMU ? "/dev/vfio/noiommu-%s" : "/dev/vfio/%s", Group);
+    VFIOGroup = open(Path, O_RDWR);
+    if (VFIOGroup < 0)
+    {
+        printf("VFIO: can't open %s: %s\n", Path, strerror(errno));
+        return true;
+    }
+    memset(&Status, 0, sizeof(Status));
+    Status.argsz = sizeof(Status);
+    if ((ioctl(VFIOGroup, VFIO_GROUP_GET_STATUS, &Status) != 0) || !(Status.flags & VFIO_GROUP_FLAGS_VIABLE))
+    {
+        printf("VFIO: group %s is not viable: bind all its devices to vfio-pci\n", Group);
+        return true;
+    }
+    if ((ioctl(VFIOGroup, VFIO_GROUP_SET_CONTAINER, &VFIOContainer) != 0)
+        || (ioctl(VFIOContainer, VFIO_SET_IOMMU, Type) != 0))
+    {
+        printf("VFIO: can't set up the IOMMU container: %s\n", strerror(errno));
+        return true;
+    }
+    VFIODevice = ioctl(VFIOGroup, VFIO_GROUP_GET_DEVICE_FD, PCIAddress);
+    if (VFIODevice < 0)
+    {
+        printf("VFIO: can't get device %s: %s\n", PCIAddress, strerror(errno));
+        return true;
+    }
+    if (VFIONoIOMMU && ((PagemapFd = open("/proc/self/pagemap", O_RDONLY)) < 0))
+        return true;
+    return false;
+}
+
+
+//
+// turn on memory decoding and bus mastering in the PCI command register
+//
+static bool EnableBusMaster(void)
+{
+    struct vfio_region_info Info;
+    uint16_t Command;
+
+    memset(&Info, 0, sizeof(Info));
+    Info.argsz = sizeof(Info);
+    Info.index = VFIO_PCI_CONFIG_REGION_INDEX;
+    if ((ioctl(VFIODevice, VFIO_DEVICE_GET_REGION_INFO, &Info) != 0)
+        || (pread(VFIODevice, &Command, sizeof(Command), (off_t)(Info.offset + 4)) != sizeof(Command)))
+        return true;
+    Command |= 0x0006;
+    return (pwrite(VFIODevice, &Command, sizeof(Command), (off_t)(Info.offset + 4)) != sizeof(Command));
+}
+
+
+//
+// map the BARs: the XDMA config BAR has the IRQ and config block identifiers (as the
+// driver's is_config_bar()); the user BAR is the first other one
+//
+static bool MapBARs(void)
+{
+    struct vfio_region_info Info;
+    volatile uint32_t* Map;
+    uint32_t Index;
+
+    for (Index = VFIO_PCI_BAR0_REGION_INDEX; Index <= VFIO_PCI_BAR5_REGION_INDEX; Index++)
+    {
+        memset(&Info, 0, sizeof(Info));
+        Info.argsz = sizeof(Info);
+        Info.index = Index;
+        if ((ioctl(VFIODevice, VFIO_DEVICE_GET_REGION_INFO, &Info) != 0) || (Info.size == 0)
+            || !(Info.flags & VFIO_REGION_INFO_FLAG_MMAP))
+            continue;
+        Map = mmap(NULL, Info.size, PROT_READ | PROT_WRITE, MAP_SHARED, VFIODevice, (off_t)Info.offset);
+        if (Map == MAP_FAILED)
+            continue;
+        if ((ConfigBAR == NULL) && (Info.size > VXDMACONFIGBLOCK)
+            && ((Map[VXDMAIRQBLOCK / 4] >> 16) == VXDMAIDIRQ) && ((Map[VXDMACONFIGBLOCK / 4] >> 16) == VXDMAIDCONFIG))
+        {
+            ConfigBAR = (volatile uint8_t*)Map;
+            printf("VFIO: XDMA DMA registers in BAR%u\n", Index);
+        }
+        else if (UserBAR == NULL)
+        {
+            UserBAR = Map;
+            UserBARSize = Info.size;
+            printf("VFIO: user registers in BAR%u, %lluKB\n", Index, (unsigned long long)Info.size / 1024);
+        }
+        else
+            munmap((void*)Map, Info.size);
+    }
+    if ((ConfigBAR == NULL) || (UserBAR == NULL))
+    {
+        printf("VFIO: XDMA %s BAR not found\n", (ConfigBAR == NULL) ? "config" : "user");
+        return true;
+    }
+    return false;
+}
+
+
+//
+// find the AXI-MM engines, and give each a descriptor area and writeback word mapped for the device.
+// the descriptors of a transfer must be in one run on the bus: without an IOMMU that is
+// the physically contiguous pages at the start of the area (at least one page, 128
+// descriptors), as anonymous memory doesn't promise more.
+//
+static bool SetupEngines(void)
+{
+    unsigned char* Memory;
+    struct VFIORegion* Region;
+    struct VFIOEngine* Engine;
+    uint32_t Dir, Channel, Id, Offset, Chunk;
+    uint32_t Found = 0;
+    size_t Size = (2 * VMAXVFIOCHANNELS) * VVFIODESCAREA + VVFIOWBSIZE;
+
+    Memory = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Memory == MAP_FAILED)
+        return true;
+    memset(Memory, 0, Size);
+    if ((Region = GetRegion(Memory, (uint32_t)Size)) == NULL)
+        return true;
+    for (Dir = 0; Dir < 2; Dir++)
+        for (Channel = 0; Channel < VMAXVFIOCHANNELS; Channel++)
+        {
+            Engine = &Engines[Dir][Channel];
+            Offset = (Dir ? VXDMAENGINEH2C : VXDMAENGINEC2H) + Channel * VXDMACHANNELSPACING;
+            Engine->fd = -1;
+            pthread_mutex_init(&Engine->Lock, NULL);
+            Engine->Regs = (volatile uint32_t*)(ConfigBAR + Offset);
+            Engine->SGRegs = (volatile uint32_t*)(ConfigBAR + Offset + VXDMASGDMAOFFSET);
+            Id = ReadReg(Engine->Regs, 0);
+            if (((Id >> 16) != (Dir ? VXDMAIDH2C : VXDMAIDC2H)) || (Id & VXDMAIDSTREAM))
+                continue;                                           // not there, or AXI-ST
+            Engine->Present = true;
+            Engine->ToDevice = (Dir != 0);
+            Engine->Channel = Channel;
+            Engine->Descriptors = (struct XDMADescriptor*)(Memory + (Dir * VMAXVFIOCHANNELS + Channel) * VVFIODESCAREA);
+            Engine->DescriptorBus = BusAddress(Region, (unsigned char*)Engine->Descriptors, VVFIODESCAREA, &Chunk);
+            Engine->MaxDescriptors = Chunk / sizeof(struct XDMADescriptor);
+            Engine->Writeback = (volatile uint32_t*)(Memory + 2 * VMAXVFIOCHANNELS * VVFIODESCAREA + (Dir * VMAXVFIOCHANNELS + Channel) * 64);
+            Engine->WritebackBus = BusAddress(Region, (unsigned char*)Engine->Writeback, 4, &Chunk);
+            StopEngine(Engine);
+            WriteReg(Engine->Regs, VENGINTMASK, 0);                 // polled: no interrupts
+            WriteReg(Engine->Regs, VENGWBLO, (uint32_t)Engine->WritebackBus);
+            WriteReg(Engine->Regs, VENGWBHI, (uint32_t)(Engine->WritebackBus >> 32));
+            printf("VFIO: %s engine %u\n", Dir ? "H2C" : "C2H", Channel);
+            Found++;
+        }
+    return (Found == 0);
+}
+
+
+bool UseVFIOHardware(const char* PCIAddress)
+{
+#if defined(__arm__)
+    printf("VFIO: not supported on 32 bit arm: user space can't do the cache maintenance\n");
+    (void)PCIAddress;
+    return true;
+#else
+#if defined(__aarch64__)
+    uint64_t CTR;
+
+    __asm__ volatile("mrs %0, ctr_el0" : "=r"(CTR));
+    CacheLineSize = 4U << ((CTR >> 16) & 0xF);
+#endif
+    PageSize = (uint32_t)sysconf(_SC_PAGESIZE);
+    if (OpenVFIODevice(PCIAddress) || EnableBusMaster() || MapBARs() || SetupEngines())
+    {
+        printf("VFIO: %s can't be used for DMA\n", PCIAddress);
+        return true;
+    }
+    if (VFIONoIOMMU)
+        printf("VFIO: no IOMMU: DMA to locked physical pages\n");
+    SetHardwareBackend(&VFIOBackend);
+    return false;
+#endif
+}
@@ -0,0 +1,42 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// vfiobackend.h:
+// user space XDMA backend through VFIO: the engines are run from user space,
+// with no XDMA driver, so there are no system calls or interrupts on the DMA path
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __vfiobackend_h
+#define __vfiobackend_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+//
+// bool UseVFIOHardware(const char* PCIAddress)
+// install the VFIO backend in place of the XDMA driver, for the board at PCIAddress
+// (eg "0000:01:00.0"), which must be bound to vfio-pci. Must be called before OpenXDMADriver().
+// registers are loads and stores to the mapped user BAR. A DMA builds the XDMA descriptors
+// for the buffer in user space, starts the engine with its completion writeback enabled,
+// and the calling thread spins on the writeback word until it completes: run the stream
+// threads on their own cores (thread placement) so the spin doesn't take time from others.
+// buffers are mapped for the device the first time they are used, a whole allocation at a time.
+// with an IOMMU the memory is pinned by VFIO. Without one (eg the Pi 4) VFIO must be loaded
+// with enable_unsafe_noiommu_mode=1: buffers are then locked and DMA goes to their physical
+// pages, which needs root, and page compaction must not move locked pages
+// (vm.compact_unevictable_allowed=0).
+// async DMA and the streaming ring are XDMA driver features, so are not available.
+// return true if error; nothing is installed then
+//
+bool UseVFIOHardware(const char* PCIAddress);
+
+
+#endif
@@ -0,0 +1,167 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// vita49.c:
+// VITA-49 (VRT) IF data and context packet headers for the DDC streams
+//
+//////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <endian.h>
+#include "../common/vita49.h"
+
+
+//
+// header word 0 fields (VITA 49.0 section 6.1.1)
+//
+#define VVRTTYPEDATA (1U << 28)                    // IF data packet with stream ID
+#define VVRTTYPECONTEXT (4U << 28)                 // IF context packet
+#define VVRTTSIUTC (1U << 22)                      // integer timestamp: UTC
+#define VVRTTSIOTHER (3U << 22)                    // integer timestamp: other (seconds from stream start)
+#define VVRTTSFSAMPLES (1U << 20)                  // fractional timestamp: sample count
+#define VVRTCOUNTSHIFT 16
+
+//
+// context indicator field 0 bits (section 7.1.5)
+//
+#define VCIFCHANGED (1U << 31)                      // context field change indicator
+#define VCIFSAMPLERATE (1U << 21)
+#define VCIFPAYLOADFORMAT (1U << 15)
+
+//
+// data packet payload format word 1 (section 7.1.5.18)
+//
+#define VFORMATLINKEFFICIENT (1U << 31)
+#define VFORMATCOMPLEX (1U << 29)                   // complex, cartesian; signed fixed point items
+#define VFORMATPACKSHIFT 6                          // item packing field size - 1
+
+
+void InitVITA49Stream(struct VITA49Stream* Stream, uint32_t StreamID)
+{
+    memset(Stream, 0, sizeof(struct VITA49Stream));
+    Stream->StreamID = StreamID;
+    Stream->Changed = true;
+}
+
+
+bool SetVITA49Format(struct VITA49Stream* Stream, uint32_t RateHz, uint32_t Bits)
+{
+    if ((RateHz == Stream->RateHz) && (Bits == Stream->Bits))
+        return false;
+    Stream->RateHz = RateHz;
+    Stream->Bits = Bits;
+    Stream->NextSample = ~0ULL;                     // timestamps are worked out again at the new rate
+    Stream->Changed = true;
+    return true;
+}
+
+
+//
+// bring the timestamp to a sample number: by division only after a gap or a rate change
+//
+static void SetVITA49Time(struct VITA49Stream* Stream, uint64_t SampleNumber)
+{
+    uint64_t Offset, Back;
+
+    if (SampleNumber == Stream->NextSample)
+        return;
+    if (Stream->RateHz == 0)
+    {
+        Stream->Seconds = 0;
+        Stream->Fraction = (uint32_t)SampleNumber;
+    }
+    else if (!Stream->UTC)
+    {
+        Stream->Seconds = (uint32_t)(SampleNumber / Stream->RateHz);
+        Stream->Fraction = (uint32_t)(SampleNumber % Stream->RateHz);
+    }
+    else if (SampleNumber >= Stream->EpochSample)
+    {
+        Offset = SampleNumber - Stream->EpochSample;
+        Stream->Seconds = Stream->EpochSeconds + (uint32_t)(Offset / Stream->RateHz);
+        Stream->Fraction = (uint32_t)(Offset % Stream->RateHz);
+    }
+    else
+    {
+        Back = Stream->EpochSample - SampleNumber + Stream->RateHz - 1;     // seconds before the epoch, rounded up
+        Stream->Seconds = Stream->EpochSeconds - (uint32_t)(Back / Stream->RateHz);
+        Stream->Fraction = Stream->RateHz - 1 - (uint32_t)(Back % Stream->RateHz);
+    }
+    Stream->NextSample = SampleNumber;
+}
+
+
+void SetVITA49Epoch(struct VITA49Stream* Stream, uint64_t SampleNumber, uint32_t Seconds)
+{
+    if (!Stream->UTC)
+        Stream->Word0Bytes = 0;                     // make word 0 again, for the timestamp type
+    Stream->UTC = true;
+    Stream->EpochSample = SampleNumber;
+    Stream->EpochSeconds = Seconds;
+    Stream->NextSample = ~0ULL;                     // worked out again from the epoch
+}
+
+
+//
+// write the stream ID and timestamps after word 0
+//
+static void WriteVITA49Prologue(struct VITA49Stream* Stream, uint32_t* Words)
+{
+    Words[1] = htobe32(Stream->StreamID);
+    Words[2] = htobe32(Stream->Seconds);
+    Words[3] = 0;                                   // 64 bit fraction: a sample count fits the low word
+    Words[4] = htobe32(Stream->Fraction);
+}
+
+
+void MakeVITA49DataHeader(struct VITA49Stream* Stream, uint8_t* Header, uint64_t SampleNumber, uint32_t Samples, uint32_t PayloadBytes)
+{
+    uint32_t* Words = (uint32_t*)Header;
+
+    if (PayloadBytes != Stream->Word0Bytes)
+    {
+        Stream->Word0Bytes = PayloadBytes;
+        Stream->Word0 = VVRTTYPEDATA | (Stream->UTC ? VVRTTSIUTC : VVRTTSIOTHER) | VVRTTSFSAMPLES
+                        | ((VVITA49DATAHEADERSIZE + PayloadBytes) / 4);
+    }
+    SetVITA49Time(Stream, SampleNumber);
+    Words[0] = htobe32(Stream->Word0 | ((Stream->DataCount++ & 0xF) << VVRTCOUNTSHIFT));
+    WriteVITA49Prologue(Stream, Words);
+    //
+    // step on to the next packet's 1st sample
+    //
+    Stream->NextSample += Samples;
+    Stream->Fraction += Samples;
+    while ((Stream->RateHz != 0) && (Stream->Fraction >= Stream->RateHz))
+    {
+        Stream->Fraction -= Stream->RateHz;
+        Stream->Seconds++;
+    }
+}
+
+
+uint32_t MakeVITA49ContextPacket(struct VITA49Stream* Stream, uint8_t* Packet, uint64_t SampleNumber)
+{
+    uint32_t* Words = (uint32_t*)Packet;
+    uint64_t Rate;
+
+    SetVITA49Time(Stream, SampleNumber);
+    Words[0] = htobe32(VVRTTYPECONTEXT | (Stream->UTC ? VVRTTSIUTC : VVRTTSIOTHER) | VVRTTSFSAMPLES
+                       | ((Stream->ContextCount++ & 0xF) << VVRTCOUNTSHIFT) | (VVITA49CONTEXTSIZE / 4));
+    WriteVITA49Prologue(Stream, Words);
+    Words[5] = htobe32((Stream->Changed ? VCIFCHANGED : 0) | VCIFSAMPLERATE | VCIFPAYLOADFORMAT);
+    Rate = (uint64_t)Stream->RateHz << 20;          // Hz, 20 bit binary fraction
+    Words[6] = htobe32((uint32_t)(Rate >> 32));
+    Words[7] = htobe32((uint32_t)Rate);
+    Words[8] = htobe32(VFORMATLINKEFFICIENT | VFORMATCOMPLEX
+                       | ((Stream->Bits - 1) << VFORMATPACKSHIFT) | (Stream->Bits - 1));
+    Words[9] = 0;                                   // repeat count 1, vector size 1
+    Stream->Changed = false;
+    return VVITA49CONTEXTSIZE;
+}
@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// vita49.h:
+// VITA-49 (VRT) IF data and context packet headers for the DDC streams
+//
+// a data packet is a 5 word header (packet type IF data with stream ID, no
+// class ID or trailer), then the I/Q samples as P2 sends them: big endian
+// 24 or 16 bit I then Q, link efficient packed, so the payload needs no copy.
+// the integer timestamp ("other": seconds from the start of the stream) and
+// the fractional timestamp (sample count within that second) come from the
+// stream's sample number, kept step by step so there is no division per
+// packet except after a gap. Once an epoch is set (the sample number that
+// begins a UTC second, eg. from PPS) the integer timestamp is UTC seconds,
+// counted on from the epoch. A context packet with the same stream ID gives
+// the sample rate and payload format; it is sent when either changes and
+// at intervals so a receiver that joins late can decode the stream.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __vita49_h
+#define __vita49_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define VVITA49DATAHEADERSIZE 20                    // bytes before the samples
+#define VVITA49CONTEXTSIZE 40                       // bytes in a context packet
+#define VVITA49CONTEXTINTERVAL 1024                 // data packets between context packets
+
+
+struct VITA49Stream
+{
+    uint32_t StreamID;
+    uint32_t RateHz;                                // sample rate; 0 until set
+    uint32_t Bits;                                  // bits per I or Q sample
+    bool Changed;                                   // rate or format changed since the last context packet
+    uint32_t DataCount;                             // data packets made; the header has the low 4 bits
+    uint32_t ContextCount;                          // context packets made
+    uint64_t NextSample;                            // sample number Seconds and Fraction are for
+    uint32_t Seconds;                               // integer timestamp
+    uint32_t Fraction;                              // fractional timestamp: samples into the second
+    uint32_t Word0Bytes;                            // payload bytes Word0 was made for
+    bool UTC;                                       // true once an epoch is set
+    uint64_t EpochSample;                           // sample number that begins UTC second EpochSeconds
+    uint32_t EpochSeconds;
+    uint32_t Word0;                                 // header word 0, less the packet count
+};
+
+
+//
+// InitVITA49Stream(struct VITA49Stream* Stream, uint32_t StreamID)
+// start a stream at sample 0, with no format set
+//
+void InitVITA49Stream(struct VITA49Stream* Stream, uint32_t StreamID);
+
+
+//
+// SetVITA49Format(struct VITA49Stream* Stream, uint32_t RateHz, uint32_t Bits)
+// set the sample rate and bits per sample (16 or 24) of the following packets.
+// return true if they changed, so a context packet should be sent
+//
+bool SetVITA49Format(struct VITA49Stream* Stream, uint32_t RateHz, uint32_t Bits);
+
+
+//
+// SetVITA49Epoch(struct VITA49Stream* Stream, uint64_t SampleNumber, uint32_t Seconds)
+// sample SampleNumber is the first of UTC second Seconds: timestamps are UTC from now on
+//
+void SetVITA49Epoch(struct VITA49Stream* Stream, uint64_t SampleNumber, uint32_t Seconds);
+
+
+//
+// MakeVITA49DataHeader(struct VITA49Stream* Stream, uint8_t* Header, uint64_t SampleNumber, uint32_t Samples, uint32_t PayloadBytes)
+// write a data packet header for Samples samples from SampleNumber, whose
+// payload is PayloadBytes (a multiple of 4)
+//
+void MakeVITA49DataHeader(struct VITA49Stream* Stream, uint8_t* Header, uint64_t SampleNumber, uint32_t Samples, uint32_t PayloadBytes);
+
+
+//
+// MakeVITA49ContextPacket(struct VITA49Stream* Stream, uint8_t* Packet, uint64_t SampleNumber)
+// write a context packet for the stream at SampleNumber (the next data packet's).
+// returns its size, VVITA49CONTEXTSIZE
+//
+uint32_t MakeVITA49ContextPacket(struct VITA49Stream* Stream, uint8_t* Packet, uint64_t SampleNumber);
+
+
+#endif
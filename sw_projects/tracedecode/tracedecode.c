@@ -0,0 +1,275 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// tracedecode.c:
+// decode a p2app event trace dump (written on SIGUSR1 or a crash) into
+// a timeline: the events of all threads merged in time order, with the
+// time since the previous event on the same thread. With -s, print instead
+// a summary of each event on each thread: count, and min/mean/max interval.
+// events overwritten while the dump was being written are dropped.
+//
+// usage: tracedecode [-s] [-l last ms] <dump file>
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../P2_app/eventtrace.h"
+
+
+//
+// names of the events and their arguments, from the list shared with p2app
+//
+#define TRACENAME(Id, Name, Arg1, Arg2) Name,
+#define TRACEARG1(Id, Name, Arg1, Arg2) Arg1,
+#define TRACEARG2(Id, Name, Arg1, Arg2) Arg2,
+static const char* EventNames[VNUMTRACEEVENTS] = { TRACEEVENTLIST(TRACENAME) };
+static const char* Arg1Names[VNUMTRACEEVENTS] = { TRACEEVENTLIST(TRACEARG1) };
+static const char* Arg2Names[VNUMTRACEEVENTS] = { TRACEEVENTLIST(TRACEARG2) };
+
+
+struct DecodedThread
+{
+  struct TraceThreadHeader Header;
+  struct TraceEvent* Events;
+  uint32_t NumEvents;                           // after dropping overwritten events
+  uint32_t Next;                                // next event to print
+  uint64_t LastTime;                            // time of the previous printed event
+};
+
+
+struct EventSummary
+{
+  uint32_t Count;
+  uint64_t LastTime;
+  uint64_t MinInterval;
+  uint64_t MaxInterval;
+  uint64_t TotalInterval;
+};
+
+
+//
+// read one thread's events, keeping only those with the sequence number expected
+// at their position: any other was written over while the dump was made
+// return true if error
+//
+static bool ReadThread(FILE* File, struct DecodedThread* Thread)
+{
+  struct TraceEvent* Event;
+  uint32_t Cntr;
+
+  if (fread(&Thread->Header, sizeof(Thread->Header), 1, File) != 1)
+    return true;
+  Thread->Header.Name[VTRACETHREADNAMESIZE - 1] = 0;
+  Thread->Events = malloc((Thread->Header.NumEvents + 1) * sizeof(struct TraceEvent));
+  if (Thread->Events == NULL)
+    return true;
+  if (fread(Thread->Events, sizeof(struct TraceEvent), Thread->Header.NumEvents, File) != Thread->Header.NumEvents)
+    return true;
+  Thread->NumEvents = 0;
+  for (Cntr = 0; Cntr < Thread->Header.NumEvents; Cntr++)
+  {
+    Event = Thread->Events + Cntr;
+    if (Event->Sequence != (uint32_t)(Thread->Header.FirstSequence + Cntr))
+      continue;
+    Thread->Events[Thread->NumEvents++] = *Event;
+  }
+  if (Thread->NumEvents != Thread->Header.NumEvents)
+    printf("# thread %s (%u): %u events overwritten during the dump, dropped\n", Thread->Header.Name,
+           Thread->Header.Tid, Thread->Header.NumEvents - Thread->NumEvents);
+  return false;
+}
+
+
+static void PrintEvent(struct DecodedThread* Thread, struct TraceEvent* Event, uint64_t BaseTime)
+{
+  const char* Name = (Event->Event < VNUMTRACEEVENTS) ? EventNames[Event->Event] : "unknown";
+
+  printf("%12.3f %10.3f  %-15s %6u  %-16s", (Event->Time - BaseTime) * 1.0e-3,
+         (Thread->LastTime == 0) ? 0.0 : (Event->Time - Thread->LastTime) * 1.0e-3,
+         Thread->Header.Name, Thread->Header.Tid, Name);
+  if (Event->Event >= VNUMTRACEEVENTS)
+    printf(" id=%u %u %u", Event->Event, Event->Arg1, Event->Arg2);
+  else
+  {
+    if (strcmp(Arg1Names[Event->Event], "-") != 0)
+      printf(" %s=%u", Arg1Names[Event->Event], Event->Arg1);
+    if (strcmp(Arg2Names[Event->Event], "-") != 0)
+      printf(" %s=%u", Arg2Names[Event->Event], Event->Arg2);
+  }
+  printf("\n");
+  Thread->LastTime = Event->Time;
+}
+
+
+//
+// print all events in time order: repeatedly take the earliest next event of any thread
+//
+static void PrintTimeline(struct DecodedThread* Threads, uint32_t NumThreads, uint64_t StartTime, uint64_t BaseTime)
+{
+  struct DecodedThread* Earliest;
+  struct TraceEvent* Event;
+  uint32_t Cntr;
+
+  printf("#    time(us)   delta(us)  thread             tid  event\n");
+  while (1)
+  {
+    Earliest = NULL;
+    for (Cntr = 0; Cntr < NumThreads; Cntr++)
+    {
+      if (Threads[Cntr].Next == Threads[Cntr].NumEvents)
+        continue;
+      if ((Earliest == NULL) ||
+          (Threads[Cntr].Events[Threads[Cntr].Next].Time < Earliest->Events[Earliest->Next].Time))
+        Earliest = Threads + Cntr;
+    }
+    if (Earliest == NULL)
+      break;
+    Event = Earliest->Events + Earliest->Next++;
+    if (Event->Time >= StartTime)
+      PrintEvent(Earliest, Event, BaseTime);
+    else
+      Earliest->LastTime = Event->Time;
+  }
+}
+
+
+//
+// print the count and intervals of each event on each thread
+//
+static void PrintSummary(struct DecodedThread* Threads, uint32_t NumThreads, uint64_t StartTime)
+{
+  struct EventSummary Summary[VNUMTRACEEVENTS];
+  struct EventSummary* Entry;
+  struct TraceEvent* Event;
+  uint32_t Cntr, Index;
+  uint64_t Interval;
+
+  printf("# thread             tid  event             count   min(us)  mean(us)   max(us)\n");
+  for (Cntr = 0; Cntr < NumThreads; Cntr++)
+  {
+    memset(Summary, 0, sizeof(Summary));
+    for (Index = 0; Index < Threads[Cntr].NumEvents; Index++)
+    {
+      Event = Threads[Cntr].Events + Index;
+      if ((Event->Event >= VNUMTRACEEVENTS) || (Event->Time < StartTime))
+        continue;
+      Entry = Summary + Event->Event;
+      if (Entry->Count != 0)
+      {
+        Interval = Event->Time - Entry->LastTime;
+        if ((Entry->Count == 1) || (Interval < Entry->MinInterval))
+          Entry->MinInterval = Interval;
+        if (Interval > Entry->MaxInterval)
+          Entry->MaxInterval = Interval;
+        Entry->TotalInterval += Interval;
+      }
+      Entry->Count++;
+      Entry->LastTime = Event->Time;
+    }
+    for (Index = 0; Index < VNUMTRACEEVENTS; Index++)
+    {
+      Entry = Summary + Index;
+      if (Entry->Count == 0)
+        continue;
+      printf("%-15s %6u  %-16s %6u", Threads[Cntr].Header.Name, Threads[Cntr].Header.Tid, EventNames[Index], Entry->Count);
+      if (Entry->Count > 1)
+        printf(" %9.3f %9.3f %9.3f", Entry->MinInterval * 1.0e-3,
+               Entry->TotalInterval * 1.0e-3 / (Entry->Count - 1), Entry->MaxInterval * 1.0e-3);
+      printf("\n");
+    }
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  struct TraceFileHeader Header;
+  struct DecodedThread* Threads;
+  uint64_t BaseTime = UINT64_MAX;
+  uint64_t StartTime = 0;
+  uint32_t LastMs = 0;
+  uint32_t Cntr;
+  bool Summary = false;
+  FILE* File;
+  int Option;
+
+  while ((Option = getopt(argc, argv, "sl:")) != -1)
+  {
+    switch (Option)
+    {
+      case 's':
+        Summary = true;
+        break;
+
+      case 'l':
+        LastMs = atoi(optarg);
+        break;
+
+      default:
+        printf("usage: tracedecode [-s] [-l last ms] <dump file>\n");
+        printf("-s          summary of event counts and intervals per thread\n");
+        printf("-l <ms>     only the last ms milliseconds before the dump\n");
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc)
+  {
+    printf("usage: tracedecode [-s] [-l last ms] <dump file>\n");
+    return EXIT_FAILURE;
+  }
+
+  File = fopen(argv[optind], "rb");
+  if (File == NULL)
+  {
+    perror(argv[optind]);
+    return EXIT_FAILURE;
+  }
+  if ((fread(&Header, sizeof(Header), 1, File) != 1) || (Header.Magic != VTRACEMAGIC))
+  {
+    printf("%s is not a p2app event trace\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  if ((Header.Version != VTRACEVERSION) || (Header.EventSize != sizeof(struct TraceEvent)))
+  {
+    printf("%s: trace version %u, event size %u not supported\n", argv[optind], Header.Version, Header.EventSize);
+    return EXIT_FAILURE;
+  }
+
+  Threads = calloc(Header.NumThreads + 1, sizeof(struct DecodedThread));
+  if (Threads == NULL)
+    return EXIT_FAILURE;
+  for (Cntr = 0; Cntr < Header.NumThreads; Cntr++)
+  {
+    if (ReadThread(File, Threads + Cntr))
+    {
+      printf("%s: truncated at thread %u\n", argv[optind], Cntr);
+      return EXIT_FAILURE;
+    }
+    if ((Threads[Cntr].NumEvents != 0) && (Threads[Cntr].Events[0].Time < BaseTime))
+      BaseTime = Threads[Cntr].Events[0].Time;
+  }
+  fclose(File);
+  if (BaseTime == UINT64_MAX)
+    BaseTime = Header.DumpTime;
+  if ((LastMs != 0) && (Header.DumpTime > (uint64_t)LastMs * 1000000ULL))
+    StartTime = Header.DumpTime - (uint64_t)LastMs * 1000000ULL;
+
+  printf("# %u threads; dump made %.3f ms after the first event\n", Header.NumThreads,
+         (Header.DumpTime - BaseTime) * 1.0e-6);
+  if (Summary)
+    PrintSummary(Threads, Header.NumThreads, StartTime);
+  else
+    PrintTimeline(Threads, Header.NumThreads, StartTime, BaseTime);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,515 @@
+//////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddcsoak.c:
+// sustained rate DDC soak test and loss detector, to qualify a new
+// FPGA firmware version for a DDC load before it is deployed.
+// enables DDCs at a chosen rate, fed by the test DDS, and reads the DDC
+// stream continuously through the same DMA path as p2app. It checks:
+//     the rate word framing of every frame
+//     the sample pattern of every DDC for gaps
+//     FIFO overflows reported by the FIFO monitor
+// and reports sustained throughput and the FIFO high water mark.
+//
+// sample patterns:
+//     tone: the test DDS set a few KHz from the DDC LO gives each DDC a steady
+//           tone, so the phase advances by the same step every sample; a lost
+//           sample is a step of the wrong size. A loss of a whole number of
+//           tone cycles is not visible this way; the framing and FIFO checks
+//           still see a lost DMA.
+//     golden: the simulated FPGA (-S) makes the stream with the golden model
+//           of the FPGA framing (ddcframegen.h), each sample tagged with its
+//           DDC and number. Each frame is put through the same demux plan as
+//           p2app, and its output checked bit exactly: any lost, repeated or
+//           misplaced sample is found. -p interleaves DDCs 0 and 1, and -F
+//           ddc,n,type corrupts the framing to exercise the resync.
+//
+// usage: ddcsoak [-n DDCs] [-r rate KHz] [-t seconds] [-i report seconds]
+//                [-f test DDS Hz] [-o tone offset Hz] [-b DMA bytes] [-S] [-p] [-F s,n,t]
+// the exit status is 1 if any loss was found.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include "../../sw_projects/common/saturntypes.h"
+#include "../../sw_projects/common/hwaccess.h"
+#include "../../sw_projects/common/saturnregisters.h"
+#include "../../sw_projects/common/saturndrivers.h"
+#include "../../sw_projects/common/ddcdemux.h"
+#include "../../sw_projects/common/ddcframegen.h"
+#include "../../sw_projects/common/simbackend.h"
+#include "../../sw_projects/common/version.h"
+
+
+#define VDEFAULTDDCS 4
+#define VDEFAULTRATE 192                            // KHz
+#define VDEFAULTREPORT 10                           // seconds between reports
+#define VDEFAULTTESTFREQ 10000000                   // test DDS frequency, Hz
+#define VDEFAULTTONEOFFSET 1000                     // DDC LO below the test DDS, Hz
+#define VDEFAULTDMASIZE 8192                        // bytes per DMA
+#define VMAXDMASIZE 32768                           // as the largest p2app DDC DMA
+#define VBUFFERSIZE (2 * VMAXDMASIZE)               // DMA data plus a part frame left from the last one
+#define VDDCFRAMERATE 48000                         // frames per second (one rate word per frame)
+#define VTONELEARNSAMPLES 4096                      // samples to learn each DDC's phase step
+#define VMINTONEAMPLITUDE 1000.0                    // smaller is treated as no tone
+
+
+//
+// per DDC state for the pattern checks
+//
+struct DDCCheck
+{
+    bool HaveLast;                                  // true once a sample has been seen
+    double LastI, LastQ;                            // tone: previous sample
+    double StepSum;                                 // tone: sum of phase steps while learning
+    uint32_t StepCount;                             // tone: steps summed
+    double Step;                                    // tone: learned phase step per sample
+    uint64_t Samples;
+    uint64_t Gaps;                                  // discontinuities found
+};
+
+
+//
+// soak test totals
+//
+struct SoakStats
+{
+    uint64_t Bytes;                                 // bytes read by DMA
+    uint64_t Frames;                                // complete frames checked
+    uint64_t FramingErrors;                         // frames without a rate word where one was due
+    uint64_t RateWordErrors;                        // rate words that were not the one set
+    uint64_t SkippedBytes;                          // bytes discarded finding the framing again
+    uint64_t Overflows;                             // FIFO overflows reported by the FIFO monitor
+    uint32_t HighWater;                             // largest FIFO depth seen, 64 bit words
+};
+
+
+extern sem_t DDCInSelMutex;                 // protect access to shared DDC input select register
+extern sem_t DDCResetFIFOMutex;             // protect access to FIFO reset register
+extern sem_t RFGPIOMutex;                   // protect access to RF GPIO register
+extern sem_t CodecRegMutex;                 // protect writes to codec
+
+static volatile sig_atomic_t SoakRun = true;
+static struct DDCCheck DDCChecks[VNUMDDC];
+static struct SoakStats Stats;
+static struct DDCFramePlan Plan;
+static bool UseGoldenPattern = false;
+static bool Synced = false;                         // true while the framing is known
+static struct DDCGenCheck GoldenCheck;
+static uint8_t DemuxBuffer[VMAXDDCGENFRAMEWORDS * 6];
+
+
+//
+// callback from saturn register code; not needed here
+//
+void HandlerSetEERMode(__attribute__((unused)) bool Unused)
+{
+
+}
+
+
+static void SoakSignalHandler(__attribute__((unused)) int Signal)
+{
+    SoakRun = false;
+}
+
+
+static double GetSeconds(void)
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// check one tone sample against the phase step learned for its DDC.
+// the samples are in network byte order (SetByteSwapping(true)): I then Q, 24 bits each
+//
+static void CheckToneSample(struct DDCCheck* Check, const uint8_t* Word)
+{
+    double I, Q, Phase, Error;
+
+    I = (int32_t)(((uint32_t)Word[0] << 24) | ((uint32_t)Word[1] << 16) | ((uint32_t)Word[2] << 8)) / 256;
+    Q = (int32_t)(((uint32_t)Word[3] << 24) | ((uint32_t)Word[4] << 16) | ((uint32_t)Word[5] << 8)) / 256;
+    Check->Samples++;
+    if (Check->HaveLast)
+    {
+        //
+        // phase step from the last sample: angle of this sample times the conjugate of the last
+        //
+        Phase = atan2(Q * Check->LastI - I * Check->LastQ, I * Check->LastI + Q * Check->LastQ);
+        if (Check->StepCount < VTONELEARNSAMPLES)
+        {
+            if (hypot(I, Q) >= VMINTONEAMPLITUDE)
+            {
+                Check->StepSum += Phase;
+                if (++Check->StepCount == VTONELEARNSAMPLES)
+                    Check->Step = Check->StepSum / VTONELEARNSAMPLES;
+            }
+            else
+            {
+                Check->StepSum = 0.0;                           // the DDC filters are still settling
+                Check->StepCount = 0;
+            }
+        }
+        else if (hypot(I, Q) < VMINTONEAMPLITUDE)
+            Check->Gaps++;                                      // no tone: the data isn't from the DDS
+        else
+        {
+            Error = remainder(Phase - Check->Step, 2.0 * M_PI);
+            if (fabs(Error) > fabs(Check->Step) / 2.0)          // more than half a sample out
+                Check->Gaps++;
+        }
+    }
+    Check->LastI = I;
+    Check->LastQ = Q;
+    Check->HaveLast = true;
+}
+
+
+//
+// check one frame's samples bit exactly against the golden model: each DDC of
+// the plan is demuxed as p2app does it, and its output checked
+//
+static void CheckGoldenFrame(const uint8_t* Frame, uint32_t RateWord)
+{
+    struct DDCFramePlanEntry* Entry;
+    uint32_t Cntr;
+    bool Pair;
+
+    for (Cntr = 0; Cntr < Plan.NumEntries; Cntr++)
+    {
+        Entry = Plan.Entries + Cntr;
+        Pair = (((RateWord >> (3 * Entry->DDC)) & 7) == eInterleaveWithNext);
+        Entry->Demux(DemuxBuffer, Frame + Entry->SrcOffset, Plan.FrameBytes, 1, Entry->WordCount);
+        CheckDDCGenSamples(&GoldenCheck, Entry->DDC, Pair, DemuxBuffer, Entry->WordCount);
+    }
+}
+
+
+//
+// check the frames in Bytes of DDC data at Ptr.
+// returns the bytes checked; the rest is a part frame to check when more data arrives
+//
+static uint32_t CheckDDCFrames(const uint8_t* Ptr, uint32_t Bytes, uint32_t RateWord)
+{
+    uint32_t Offset = 0;
+    uint32_t Skip;
+    uint32_t Entry;
+    uint32_t Word;
+    const uint8_t* SamplePtr;
+
+    while ((Bytes - Offset) >= 8)
+    {
+        if (!Synced)
+        {
+            //
+            // find the framing: a rate word, and another where the next frame should start
+            //
+            Skip = FindDDCRateWord(Ptr + Offset, Bytes - Offset);
+            Stats.SkippedBytes += Skip;
+            Offset += Skip;
+            if (((Bytes - Offset) < (Plan.FrameBytes + 8)))
+                break;
+            if (*(Ptr + Offset + Plan.FrameBytes + 7) != 0x80)
+            {
+                Offset += 8;                                    // a sample that looks like a marker
+                Stats.SkippedBytes += 8;
+                continue;
+            }
+            Synced = true;
+            ResyncDDCGenCheck(&GoldenCheck);                    // the samples skipped are not gaps
+            for (Entry = 0; Entry < VNUMDDC; Entry++)
+                DDCChecks[Entry].HaveLast = false;
+        }
+        if ((Bytes - Offset) < Plan.FrameBytes)
+            break;                                              // part frame: wait for the rest
+        if (*(Ptr + Offset + 7) != 0x80)
+        {
+            Stats.FramingErrors++;
+            Synced = false;
+            continue;
+        }
+        if (*(const uint32_t*)(Ptr + Offset) != RateWord)
+        {
+            Stats.RateWordErrors++;
+            Synced = false;
+            Offset += 8;
+            continue;
+        }
+        if (UseGoldenPattern)
+            CheckGoldenFrame(Ptr + Offset, RateWord);
+        else
+            for (Entry = 0; Entry < Plan.NumEntries; Entry++)
+            {
+                SamplePtr = Ptr + Offset + Plan.Entries[Entry].SrcOffset;
+                for (Word = 0; Word < Plan.Entries[Entry].WordCount; Word++, SamplePtr += 8)
+                    CheckToneSample(DDCChecks + Plan.Entries[Entry].DDC, SamplePtr);
+            }
+        Stats.Frames++;
+        Offset += Plan.FrameBytes;
+    }
+    return Offset;
+}
+
+
+//
+// total sample discontinuities found so far
+//
+static uint64_t GetSampleGaps(void)
+{
+    uint64_t Gaps = GoldenCheck.Gaps + GoldenCheck.Bad;
+    uint32_t DDC;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        Gaps += DDCChecks[DDC].Gaps;
+    return Gaps;
+}
+
+
+static void PrintUsage(void)
+{
+    printf("usage: ddcsoak [-n DDCs, 1-%d] [-r rate KHz] [-t seconds, 0 = until ^C] [-i report seconds]\n", VNUMDDC);
+    printf("               [-f test DDS Hz] [-o tone offset Hz] [-b DMA bytes] [-S] [-p] [-F s,n,t]\n");
+    printf("-S uses the simulated FPGA, and checks its samples bit exactly against the golden model\n");
+    printf("-p interleaves DDCs 0 and 1 as a pair\n");
+    printf("-F s,n,t simulated FPGA faults, as p2app -F: eg ddc,100,word loses a sample word every 100 frames\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint32_t DDCCount = VDEFAULTDDCS;
+    uint32_t Rate = VDEFAULTRATE;
+    uint32_t Duration = 0;
+    uint32_t ReportInterval = VDEFAULTREPORT;
+    uint32_t TestFrequency = VDEFAULTTESTFREQ;
+    uint32_t ToneOffset = VDEFAULTTONEOFFSET;
+    uint32_t DMASize = VDEFAULTDMASIZE;
+    bool Simulate = false;
+    bool Pair = false;
+    char* Faults = NULL;
+    const struct DDCFrameGen* Gen;
+    uint32_t DDCCounts[VNUMDDC];
+    uint32_t DDC;
+    uint32_t RateWord;
+    uint8_t* Buffer;
+    uint32_t Residue = 0;
+    uint32_t Checked;
+    int DDCfd;
+    bool Overflow, OverThreshold, Underflow;
+    unsigned int Current;
+    uint32_t Available;
+    uint32_t IntervalHighWater = 0;
+    uint64_t IntervalBytes = 0;
+    double Start, Now, LastReport, ExpectedRate;
+    uint64_t Losses;
+    int Opt;
+
+    while ((Opt = getopt(argc, argv, "n:r:t:i:f:o:b:SpF:h")) != -1)
+    {
+        switch (Opt)
+        {
+            case 'n':
+                DDCCount = atoi(optarg);
+                break;
+            case 'r':
+                Rate = atoi(optarg);
+                break;
+            case 't':
+                Duration = atoi(optarg);
+                break;
+            case 'i':
+                ReportInterval = atoi(optarg);
+                break;
+            case 'f':
+                TestFrequency = atoi(optarg);
+                break;
+            case 'o':
+                ToneOffset = atoi(optarg);
+                break;
+            case 'b':
+                DMASize = atoi(optarg);
+                break;
+            case 'S':
+                Simulate = true;
+                break;
+            case 'p':
+                Pair = true;
+                break;
+            case 'F':
+                Faults = optarg;
+                break;
+            default:
+                PrintUsage();
+                return 0;
+        }
+    }
+    if ((DDCCount == 0) || (DDCCount > VNUMDDC) || (DMASize < 4096) || (DMASize > VMAXDMASIZE) || (DMASize % 4096)
+        || ((Rate != 48) && (Rate != 96) && (Rate != 192) && (Rate != 384) && (Rate != 768) && (Rate != 1536)))
+    {
+        printf("DDCs must be 1-%d, rate 48-1536KHz and DMA size a multiple of 4096 up to %d bytes\n", VNUMDDC, VMAXDMASIZE);
+        PrintUsage();
+        return 1;
+    }
+    if ((Pair && (DDCCount < 2)) || ((Faults != NULL) && !Simulate))
+    {
+        printf("-p needs 2 or more DDCs, and -F the simulated FPGA (-S)\n");
+        PrintUsage();
+        return 1;
+    }
+    if (ReportInterval == 0)
+        ReportInterval = VDEFAULTREPORT;
+    UseGoldenPattern = Simulate;
+    InitDDCGenCheck(&GoldenCheck);
+
+    sem_init(&DDCInSelMutex, 0, 1);                                   // for DDC input select register
+    sem_init(&DDCResetFIFOMutex, 0, 1);                               // for FIFO reset register
+    sem_init(&RFGPIOMutex, 0, 1);                                     // for RF GPIO register
+    sem_init(&CodecRegMutex, 0, 1);                                   // for codec writes
+    if (Simulate)
+    {
+        printf("running with simulated FPGA: no Saturn hardware used\n");
+        UseSimulatedHardware();
+        if ((Faults != NULL) && SetSimulatedDMAFaults(Faults))
+            return 1;
+    }
+    OpenXDMADriver();
+    ProbeHardwareCapabilities();
+    PrintVersionInfo();
+    SetByteSwapping(true);                                            // network byte order, as p2app
+
+    //
+    // DDCs at the test rate, fed by the test DDS
+    //
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        SetP2SampleRate(DDC, DDC < DDCCount, Rate, Pair && (DDC == 0));
+        SetDDCFrequency(DDC, TestFrequency - ToneOffset, false);
+    }
+    WriteP2DDCRateRegister();
+    SetTestDDSFrequency(TestFrequency, false);
+    UseTestDDSSource();
+    RateWord = GetP2DDCRateWord();
+    AnalyseDDCHeader(RateWord, DDCCounts);
+    BuildDDCFramePlan(&Plan, RateWord, DDCCounts);
+    ExpectedRate = (double)VDDCFRAMERATE * Plan.FrameBytes / 1.0e6;
+
+    DDCfd = OpenDMADevice(VDDCDMADEVICE, O_RDWR);
+    if ((DDCfd < 0) || (posix_memalign((void**)&Buffer, 4096, VBUFFERSIZE) != 0))
+    {
+        printf("XDMA read device or buffer not available\n");
+        return 1;
+    }
+    DMARegisterBuffer(DDCfd, Buffer, VBUFFERSIZE);                  // as p2app; if not, plain reads
+    signal(SIGINT, SoakSignalHandler);
+
+    SetRXDDCEnabled(false);
+    usleep(1000);                                                     // give FIFO time to stop recording
+    SetupFIFOMonitorChannel(eRXDDCDMA, false);
+    ResetDMAStreamFIFO(eRXDDCDMA);
+    ReadFIFOMonitorChannel(eRXDDCDMA, &Overflow, &OverThreshold, &Underflow, &Current);     // clear the flags
+
+    printf("DDC soak: %d DDCs at %dKHz%s, %d byte DMA, %s pattern, expected %.3f MB/s\n", DDCCount, Rate,
+           Pair ? " (0 and 1 paired)" : "", DMASize, UseGoldenPattern ? "golden" : "tone", ExpectedRate);
+    if (Duration != 0)
+        printf("running for %d s; ^C to stop early\n", Duration);
+    else
+        printf("running until ^C\n");
+    printf("%10s %9s %8s %8s %8s %8s %8s\n", "time s", "MB/s", "FIFO max", "overflow", "framing", "rateword", "gaps");
+
+    SetRXDDCEnabled(true);
+    Start = GetSeconds();
+    LastReport = Start;
+    while (SoakRun)
+    {
+        Available = WaitFIFOMonitorChannel(eRXDDCDMA, DMASize / 8U, VFIFOWAITTIMEOUT,
+                                           &Overflow, &OverThreshold, &Underflow, &Current);
+        if (Overflow)
+            Stats.Overflows++;
+        if (Current > IntervalHighWater)
+            IntervalHighWater = Current;
+        if (Available >= (DMASize / 8U))
+        {
+            if (DMAReadFromFPGA(DDCfd, Buffer + Residue, DMASize, VADDRDDCSTREAMREAD) != 0)
+            {
+                printf("DDC DMA read failed\n");
+                break;
+            }
+            Stats.Bytes += DMASize;
+            IntervalBytes += DMASize;
+            Checked = CheckDDCFrames(Buffer, Residue + DMASize, RateWord);
+            Residue = Residue + DMASize - Checked;
+            memmove(Buffer, Buffer + Checked, Residue);            // keep the part frame
+        }
+
+        Now = GetSeconds();
+        if ((Now - LastReport) >= ReportInterval)
+        {
+            if (IntervalHighWater > Stats.HighWater)
+                Stats.HighWater = IntervalHighWater;
+            printf("%10.0f %9.3f %8d %8llu %8llu %8llu %8llu\n", Now - Start, IntervalBytes / (Now - LastReport) / 1.0e6,
+                   IntervalHighWater, (unsigned long long)Stats.Overflows, (unsigned long long)Stats.FramingErrors,
+                   (unsigned long long)Stats.RateWordErrors, (unsigned long long)GetSampleGaps());
+            LastReport = Now;
+            IntervalBytes = 0;
+            IntervalHighWater = 0;
+        }
+        if ((Duration != 0) && ((Now - Start) >= Duration))
+            break;
+    }
+    SetRXDDCEnabled(false);
+    Now = GetSeconds();
+    if (IntervalHighWater > Stats.HighWater)
+        Stats.HighWater = IntervalHighWater;
+
+    //
+    // summary
+    //
+    Losses = Stats.Overflows + Stats.FramingErrors + Stats.RateWordErrors + GetSampleGaps();
+    printf("\nDDC soak summary after %.0f s:\n", Now - Start);
+    printf("throughput %.3f MB/s sustained (expected %.3f MB/s), %llu frames checked\n",
+           Stats.Bytes / (Now - Start) / 1.0e6, ExpectedRate, (unsigned long long)Stats.Frames);
+    printf("FIFO high water %d of %d words\n", Stats.HighWater, DMAFIFODepths[eRXDDCDMA]);
+    printf("FIFO overflows %llu; framing errors %llu; wrong rate words %llu; %llu bytes skipped resyncing\n",
+           (unsigned long long)Stats.Overflows, (unsigned long long)Stats.FramingErrors,
+           (unsigned long long)Stats.RateWordErrors, (unsigned long long)Stats.SkippedBytes);
+    if (UseGoldenPattern)
+    {
+        Gen = GetSimulatedDDCFrameGen();
+        printf("golden check: %llu samples, %llu gaps, %llu samples lost, %llu wrong\n",
+               (unsigned long long)GoldenCheck.Samples, (unsigned long long)GoldenCheck.Gaps,
+               (unsigned long long)GoldenCheck.Lost, (unsigned long long)GoldenCheck.Bad);
+        printf("simulated FPGA: %llu frames made, %llu corrupted, %llu samples not sent\n",
+               (unsigned long long)Gen->Frames, (unsigned long long)Gen->Corrupted,
+               (unsigned long long)Gen->SamplesDropped);
+    }
+    else
+        for (DDC = 0; DDC < DDCCount; DDC++)
+            printf("DDC%d: %llu samples, phase step %.5f rad, %llu gaps\n", DDC,
+                   (unsigned long long)DDCChecks[DDC].Samples, DDCChecks[DDC].Step,
+                   (unsigned long long)DDCChecks[DDC].Gaps);
+    printf("%s\n", (Losses == 0) ? "PASS: no loss found" : "FAIL: loss found");
+
+    DMAUnregisterBuffers(DDCfd);
+    close(DDCfd);
+    free(Buffer);
+    return (Losses == 0) ? 0 : 1;
+}
@@ -34,97 +34,12 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "../../sw_projects/common/hwaccess.h"
 
 #define VTRANSFERSIZE 4096										// size in bytes to DMA transfer
 #define VMEMBUFFERSIZE 32768									// memory buffer to reserve
 #define AXIBaseAddress 0x18000									// address of StreamRead/Writer IP
 
-//
-// mem read/write variables:
-//
-	int register_fd;                             // device identifier
-
-
-//
-// dump a memory buffer to terminal in hex
-// should be a multiple of 16 bytes long!
-//
-void DumpMemoryBuffer(char* MemPtr, uint32_t Length)
-{
-	unsigned char Byte;
-	uint32_t ByteCntr;
-  uint32_t RowCntr;
-
-	for (RowCntr=0; RowCntr < Length/16; RowCntr++)
-	{
-		printf("%04x   ", RowCntr*16);
-		for (ByteCntr = 0; ByteCntr < 16; ByteCntr++)
-			printf("%02x ", *MemPtr++);
-		printf("\n");
-	}
-}
-
-
-
-
-
-//
-// initiate a DMA from the FPGA with specified parameters
-// returns 1 if success, else 0
-// fd: file device (an open file)
-// DestData: pointer to memory block to transfer
-// Length: number of bytes to copy
-// AXIAddr: offset address in the FPGA window 
-//
-int DMAReadFromFPGA(int fd, char*DestData, uint32_t Length, uint32_t AXIAddr)
-{
-	ssize_t rc;									// response code
-	off_t OffsetAddr;
-
-	OffsetAddr = AXIAddr;
-	rc = lseek(fd, OffsetAddr, SEEK_SET);
-	if (rc != OffsetAddr)
-	{
-		printf("seek off 0x%lx != 0x%lx.\n", rc, OffsetAddr);
-		perror("seek file");
-		return -EIO;
-	}
-
-	// write data to FPGA from memory buffer
-	rc = read(fd, DestData, Length);
-	if (rc < 0)
-	{
-		printf("read 0x%lx @ 0x%lx failed %ld.\n", Length, OffsetAddr, rc);
-		perror("DMA read");
-		return -EIO;
-	}
-	return 0;
-}
-
-
-
-uint32_t RegisterRead(uint32_t Address)
-{
-	uint32_t result = 0;
-
-    ssize_t nread = pread(register_fd, &result, sizeof(result), (off_t) Address);
-    if (nread != sizeof(result))
-        printf("ERROR: register read: addr=0x%08X   error=%s\n",Address, strerror(errno));
-	return result;
-}
-
-
-//
-// 32 bit register write over the AXILite bus
-//
-void RegisterWrite(uint32_t Address, uint32_t Data)
-{
-    ssize_t nsent = pwrite(register_fd, &Data, sizeof(Data), (off_t) Address); 
-    if (nsent != sizeof(Data))
-        printf("ERROR: Write: addr=0x%08X   error=%s\n",Address, strerror(errno));
-}
-
-
 #define VCSVCOUNT 83					// 83 I/Q pairs similar to one USB frame
 #define VPACKETSIZE VCSVCOUNT*6			// number of bytes needed for one CSV record
 //
@@ -193,13 +108,8 @@ int main(int argc, char *argv[])
 //
 // try to open memory device, then DMA device
 //
-	if ((register_fd = open("/dev/xdma0_user", O_RDWR)) == -1)
-    {
-		printf("register R/W address space not available\n");
+	if (OpenXDMADriver() == 0)
 		goto out;
-    }
-    else
-		printf("register access connected to /dev/xdma0_user\n");
 
 
 	printf("Initialising XDMA read\n");
@@ -301,7 +211,7 @@ int main(int argc, char *argv[])
 //
 out:
 	close(DMAReadfile_fd);
-	close(register_fd);
+	CloseXDMADriver();
 
 	free(ReadBuffer);
 }
@@ -0,0 +1,369 @@
+//
+// axibatch.c
+// headless batch register access for axi_rw, for bring-up and regression tests
+// Saturn project, GNU GPL3
+//
+// ./axi_rw -b <script> [-o <csv file>]
+// the script has one operation per line; # starts a comment. Numbers are C style
+// (0x prefix for hex). mask defaults to 0xffffffff, count to 1.
+//   w <addr> <value> [mask]                write; with a mask, read-modify-write of the mask bits
+//   r <addr> [count]                       read count consecutive registers
+//   c <addr> <value> [mask]                read and check (read & mask) == (value & mask)
+//   p <addr> <value> [mask] [timeout us]   poll until (read & mask) == (value & mask), or timeout
+//   d <us>                                 delay
+// the whole script is parsed first, then run as one burst with nothing else between
+// the register accesses; the results are written as CSV afterwards. Each line has
+// the time an operation took: for a poll, the time to the matching read and the
+// number of reads made, so poll of a register already at its value gives the read latency.
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "axibatch.h"
+#include "../../sw_projects/common/hwaccess.h"
+
+#define VDEFAULTPOLLTIMEOUT 1000000                 // us
+#define VMAXLINE 256
+#define VMAXWORDS 6                                 // one more than any operation takes
+
+typedef enum
+{
+	eOpWrite,
+	eOpRead,
+	eOpCheck,
+	eOpPoll,
+	eOpDelay
+} EBatchOp;
+
+static const char* OpNames[] = {"write", "read", "check", "poll", "delay"};
+
+typedef enum
+{
+	eStatusOK,
+	eStatusMismatch,
+	eStatusTimeout
+} EBatchStatus;
+
+static const char* StatusNames[] = {"ok", "mismatch", "timeout"};
+
+struct BatchOp
+{
+	uint32_t Line;                                  // script line number
+	EBatchOp Op;
+	uint32_t Address;
+	uint32_t Value;
+	uint32_t Mask;
+	uint32_t Count;                                 // registers to read, poll timeout us, or delay us
+	uint32_t* Results;                              // value(s) read, or written
+	uint32_t Reads;                                 // register reads made
+	uint64_t TimeNs;
+	EBatchStatus Status;
+};
+
+
+static uint64_t NowNs(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// parse one script line into Op
+// returns 1 if an operation was found, 0 for a blank or comment line, -1 if error
+//
+static int ParseLine(char* Line, uint32_t LineNumber, struct BatchOp* Op)
+{
+	char* Words[VMAXWORDS];
+	char* Word;
+	char* Save;
+	char* End;
+	uint32_t Numbers[VMAXWORDS];
+	uint32_t WordCount = 0;
+	uint32_t Cntr;
+	uint32_t MinWords, MaxWords;
+
+	if ((End = strchr(Line, '#')) != NULL)
+		*End = 0;
+	while ((WordCount < VMAXWORDS) &&
+	       ((Word = strtok_r((WordCount == 0) ? Line : NULL, " \t\r\n,", &Save)) != NULL))
+		Words[WordCount++] = Word;
+	if (WordCount == 0)
+		return 0;
+
+	memset(Op, 0, sizeof(*Op));
+	Op->Line = LineNumber;
+	Op->Mask = 0xFFFFFFFF;
+	Op->Count = 1;
+	switch (Words[0][0])
+	{
+		case 'w': Op->Op = eOpWrite; MinWords = 3; MaxWords = 4; break;
+		case 'r': Op->Op = eOpRead;  MinWords = 2; MaxWords = 3; break;
+		case 'c': Op->Op = eOpCheck; MinWords = 3; MaxWords = 4; break;
+		case 'p': Op->Op = eOpPoll;  MinWords = 3; MaxWords = 5; Op->Count = VDEFAULTPOLLTIMEOUT; break;
+		case 'd': Op->Op = eOpDelay; MinWords = 2; MaxWords = 2; break;
+		default:
+			printf("line %d: unknown operation %s\n", LineNumber, Words[0]);
+			return -1;
+	}
+	if ((Words[0][1] != 0) || (WordCount < MinWords) || (WordCount > MaxWords))
+	{
+		printf("line %d: wrong parameters for %s\n", LineNumber, Words[0]);
+		return -1;
+	}
+	for (Cntr = 1; Cntr < WordCount; Cntr++)
+	{
+		Numbers[Cntr - 1] = strtoul(Words[Cntr], &End, 0);
+		if (*End != 0)
+		{
+			printf("line %d: %s is not a number\n", LineNumber, Words[Cntr]);
+			return -1;
+		}
+	}
+
+	if (Op->Op == eOpDelay)
+	{
+		Op->Count = Numbers[0];
+		return 1;
+	}
+	Op->Address = Numbers[0];
+	if (Op->Op == eOpRead)
+	{
+		if (WordCount == 3)
+			Op->Count = Numbers[1];
+	}
+	else
+	{
+		Op->Value = Numbers[1];
+		if (WordCount >= 4)
+			Op->Mask = Numbers[2];
+		if (WordCount == 5)
+			Op->Count = Numbers[3];
+	}
+	if ((Op->Count == 0) && (Op->Op == eOpRead))
+		Op->Count = 1;
+	if ((Op->Address & 3) || ((Op->Address + 4ULL * ((Op->Op == eOpRead) ? Op->Count : 1)) > ADDRWINDOWSIZE))
+	{
+		printf("line %d: address 0x%x is not a register in the AXI-lite window\n", LineNumber, Op->Address);
+		return -1;
+	}
+	Op->Results = calloc((Op->Op == eOpRead) ? Op->Count : 1, sizeof(uint32_t));
+	return (Op->Results == NULL) ? -1 : 1;
+}
+
+
+//
+// run one operation, recording its result and time taken
+//
+static void RunOp(struct BatchOp* Op)
+{
+	uint64_t Start, Deadline;
+	uint32_t Data;
+
+	Start = NowNs();
+	switch (Op->Op)
+	{
+		case eOpWrite:
+			Data = Op->Value;
+			if (Op->Mask != 0xFFFFFFFF)
+			{
+				Data = (RegisterRead(Op->Address) & ~Op->Mask) | (Op->Value & Op->Mask);
+				Op->Reads = 1;
+			}
+			RegisterWrite(Op->Address, Data);
+			Op->Results[0] = Data;
+			break;
+
+		case eOpRead:
+			if (Op->Count == 1)
+				Op->Results[0] = RegisterRead(Op->Address);
+			else
+				RegisterReadBlock(Op->Address, Op->Results, Op->Count);
+			Op->Reads = Op->Count;
+			break;
+
+		case eOpCheck:
+			Op->Results[0] = RegisterRead(Op->Address);
+			Op->Reads = 1;
+			if ((Op->Results[0] & Op->Mask) != (Op->Value & Op->Mask))
+				Op->Status = eStatusMismatch;
+			break;
+
+		case eOpPoll:
+			Deadline = Start + (uint64_t)Op->Count * 1000ULL;
+			while (1)
+			{
+				Op->Results[0] = RegisterRead(Op->Address);
+				Op->Reads++;
+				if ((Op->Results[0] & Op->Mask) == (Op->Value & Op->Mask))
+					break;
+				if (NowNs() > Deadline)
+				{
+					Op->Status = eStatusTimeout;
+					break;
+				}
+			}
+			break;
+
+		case eOpDelay:
+			usleep(Op->Count);
+			break;
+	}
+	Op->TimeNs = NowNs() - Start;
+}
+
+
+//
+// write the CSV results: one line per register read for a block read
+//
+static void WriteResults(FILE* CSVFile, struct BatchOp* Ops, uint32_t NumOps)
+{
+	struct BatchOp* Op;
+	uint32_t Cntr, Index;
+
+	fprintf(CSVFile, "line,op,address,value,mask,result,status,reads,time_ns\n");
+	for (Cntr = 0; Cntr < NumOps; Cntr++)
+	{
+		Op = Ops + Cntr;
+		if (Op->Op == eOpDelay)
+		{
+			fprintf(CSVFile, "%u,%s,,,,,%s,0,%llu\n", Op->Line, OpNames[Op->Op], StatusNames[Op->Status],
+			        (unsigned long long)Op->TimeNs);
+			continue;
+		}
+		for (Index = 0; Index < ((Op->Op == eOpRead) ? Op->Count : 1); Index++)
+			fprintf(CSVFile, "%u,%s,0x%04x,0x%08x,0x%08x,0x%08x,%s,%u,%llu\n", Op->Line, OpNames[Op->Op],
+			        Op->Address + 4 * Index, Op->Value, Op->Mask, Op->Results[Index], StatusNames[Op->Status],
+			        (Index == 0) ? Op->Reads : 0, (Index == 0) ? (unsigned long long)Op->TimeNs : 0ULL);
+	}
+}
+
+
+//
+// read and parse a script, run it, and write the results
+//
+int RunRegisterScript(const char* ScriptPath, FILE* CSVFile)
+{
+	FILE* Script;
+	struct BatchOp* Ops = NULL;
+	struct BatchOp* NewOps;
+	uint32_t NumOps = 0, MaxOps = 0;
+	uint32_t LineNumber = 0;
+	uint32_t Failures = 0;
+	uint32_t Cntr;
+	char Line[VMAXLINE];
+	int Found;
+	bool Error = false;
+
+	Script = fopen(ScriptPath, "r");
+	if (Script == NULL)
+	{
+		perror(ScriptPath);
+		return 2;
+	}
+	while (!Error && (fgets(Line, sizeof(Line), Script) != NULL))
+	{
+		LineNumber++;
+		if (NumOps == MaxOps)
+		{
+			MaxOps = (MaxOps == 0) ? 256 : MaxOps * 2;
+			NewOps = realloc(Ops, MaxOps * sizeof(struct BatchOp));
+			if (NewOps == NULL)
+			{
+				Error = true;
+				break;
+			}
+			Ops = NewOps;
+		}
+		Found = ParseLine(Line, LineNumber, Ops + NumOps);
+		if (Found < 0)
+			Error = true;
+		else
+			NumOps += Found;
+	}
+	fclose(Script);
+
+	if (!Error)
+	{
+		for (Cntr = 0; Cntr < NumOps; Cntr++)
+			RunOp(Ops + Cntr);
+		WriteResults(CSVFile, Ops, NumOps);
+		for (Cntr = 0; Cntr < NumOps; Cntr++)
+			if (Ops[Cntr].Status != eStatusOK)
+				Failures++;
+		fprintf(stderr, "%d operations, %d failed\n", NumOps, Failures);
+	}
+	for (Cntr = 0; Cntr < NumOps; Cntr++)
+		free(Ops[Cntr].Results);
+	free(Ops);
+	if (Error)
+		return 2;
+	return (Failures != 0) ? 1 : 0;
+}
+
+
+//
+// command line batch mode
+//
+int BatchMain(int argc, char* argv[])
+{
+	const char* ScriptPath = NULL;
+	FILE* CSVFile = stdout;
+	int Result;
+	int Option;
+
+	while ((Option = getopt(argc, argv, "b:o:")) != -1)
+	{
+		switch (Option)
+		{
+			case 'b':
+				ScriptPath = optarg;
+				break;
+
+			case 'o':
+				CSVFile = fopen(optarg, "w");
+				if (CSVFile == NULL)
+				{
+					perror(optarg);
+					return 2;
+				}
+				break;
+
+			default:
+				ScriptPath = NULL;
+				optind = argc;
+				break;
+		}
+	}
+	if (ScriptPath == NULL)
+	{
+		printf("usage: axi_rw -b <script> [-o <csv file>]\n");
+		printf("the CSV results go to stdout, after the driver messages, if no file is given\n");
+		return 2;
+	}
+	if (OpenXDMADriver() == 0)
+		return 2;
+	Result = RunRegisterScript(ScriptPath, CSVFile);
+	CloseXDMADriver();
+	if (CSVFile != stdout)
+		fclose(CSVFile);
+	return Result;
+}
+
+
+#ifdef AXIBATCHONLY
+//
+// axi_batch: batch mode only, for systems without GTK ("make axi_batch")
+//
+int main(int argc, char* argv[])
+{
+	return BatchMain(argc, argv);
+}
+#endif
@@ -0,0 +1,34 @@
+//
+// axibatch.h
+// headless batch register access for axi_rw
+// Saturn project, GNU GPL3
+//
+
+#ifndef __axibatch_h
+#define __axibatch_h
+
+#include <stdio.h>
+
+#define ADDRWINDOWSIZE 0x20000L                     // size of mapped window for AXI-lite bus
+
+//
+// RunRegisterScript(const char* ScriptPath, FILE* CSVFile)
+// read a script of register operations, run them all as one burst, then
+// write one CSV line per operation to CSVFile.
+// the register device must already be open (OpenXDMADriver()).
+// returns 0 if every operation passed; 1 if a check or poll failed; 2 if the
+// script could not be read
+//
+int RunRegisterScript(const char* ScriptPath, FILE* CSVFile);
+
+
+//
+// BatchMain(int argc, char* argv[])
+// command line batch mode: axi_rw -b <script> [-o <csv file>]
+// opens the register device, runs the script and closes it again.
+// returns the program exit code
+//
+int BatchMain(int argc, char* argv[]);
+
+
+#endif
@@ -24,38 +24,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include "xiic_regdefs.h"
+#include "../../sw_projects/common/hwaccess.h"
 
 //#define VTRANSFERSIZE 65536											// size in bytes to transfer
 #define VMEMBUFFERSIZE 32768										// memory buffer to reserve
 #define AXIBaseAddress 0x10000									// address of StreamRead/Writer IP
 
-//
-// mem read/write variables:
-//
-	int register_fd;                             // device identifier
-
-//
-// 32 bit register write over the AXILite bus
-//
-void RegisterWrite(uint32_t Address, uint32_t Data)
-{
-    ssize_t nsent = pwrite(register_fd, &Data, sizeof(Data), (off_t) Address); 
-    if (nsent != sizeof(Data))
-        printf("ERROR: Write: addr=0x%08X   error=%s\n",Address, strerror(errno));
-}
-
-
-uint32_t RegisterRead(uint32_t Address)
-{
-	uint32_t result = 0;
-
-    ssize_t nread = pread(register_fd, &result, sizeof(result), (off_t) Address);
-    if (nread != sizeof(result))
-        printf("ERROR: register read: addr=0x%08X   error=%s\n",Address, strerror(errno));
-    return result;
-}
-
-
 ////////////////////////////////////// code cut from xiic_l.c //////////////////////////////////
 
 //
@@ -650,15 +624,8 @@ int main(int argc, char *argv[])
 	//
 	// try to open memory device
 	//
-	if ((register_fd = open("/dev/xdma0_user", O_RDWR)) == -1)
-	{
-		printf("register R/W address space not available\n");
+	if (OpenXDMADriver() == 0)
 		goto out;
-	}
-	else
-	{
-		printf("register access connected to /dev/xdma0_user\n");
-	}
 
 	//
 	// now read the user access register (it should have a date code)
@@ -708,6 +675,6 @@ int main(int argc, char *argv[])
 	// close down. Deallocate memory and close files
 	//
 out:
-	close(register_fd);
+	CloseXDMADriver();
 }
 
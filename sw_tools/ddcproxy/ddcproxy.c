@@ -0,0 +1,460 @@
+//
+// protocol 2 relay that decompresses DDC packets, for a client on the far
+// end of a slow link from a Saturn running p2app with ddc_compress set.
+// Laurence Barker July 2022
+//
+// ./ddcproxy -r <radio address> [-l <local address>] [-p <first port>] [-n <ports>] [-v]
+// run it near the client, and point the client at this machine (or at the
+// local address given) instead of the radio. Every packet from the client is
+// passed to the radio at the same port; every packet from the radio is passed
+// to the client from the port it came from, so the client sees the radio.
+// compressed DDC packets (bits per sample field VDDCCOMPRESSEDBITS(mode)) are
+// decompressed to ordinary 24 bit packets on the way. Ports are bound from
+// <first port> (default 1024) for <ports> (default 85: up to the virtual DDCs).
+// with ddc_fec set, the FEC parity packets that follow each group of DDC
+// packets are taken out, and a packet lost from a group is made again from
+// the rest and the parity, and sent on late (see ddcfec.h).
+// one client at a time: the client is whoever sent the last packet.
+// If the client binds ports 1024... itself, run this on another machine or
+// give it a local address of its own (eg -l 127.0.0.2 and point the client there).
+// -v prints packet counts every 5 seconds.
+//
+
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../../sw_projects/common/ddccompress.h"
+#include "../../sw_projects/common/ddcfec.h"
+
+#define VMAXPORTS 128
+#define VDEFAULTPORTS 85							// 1024...1108: base ports, 10 DDCs, 64 virtual DDCs
+#define VHEADERSIZE 16								// DDC packet header
+#define VMAXPACKET 2048
+#define VSTATSPERIOD 5								// seconds between -v reports
+#define VFECWINDOW 128								// packets kept per stream for FEC recovery
+#define VFECPARITYSLOTS 8							// parity packets kept per stream waiting for their group
+
+int Sockets[VMAXPORTS];
+struct pollfd PollFds[VMAXPORTS];
+struct sockaddr_in RadioAddr;
+struct sockaddr_in ClientAddr;
+bool ClientKnown;
+uint16_t FirstPort = 1024;
+uint32_t PortCount = VDEFAULTPORTS;
+
+//
+// FEC state for a stream from the radio, made when its 1st parity packet arrives.
+// the last VFECWINDOW packets are kept by sequence number. A parity packet waits
+// until all but one of its group have arrived (the parity can overtake paced
+// packets), then the missing one is made; if it arrives after all, it is dropped.
+//
+struct FECPacket
+{
+	bool Valid;
+	bool Recovered;									// made from the parity, not yet arrived
+	uint32_t Sequence;
+	uint32_t Length;
+	uint8_t Data[VMAXPACKET];
+};
+
+struct FECParity
+{
+	bool Valid;
+	uint32_t FirstSequence;
+	uint32_t GroupSize;
+	uint32_t Length;
+	uint8_t Data[VMAXPACKET];
+};
+
+struct FECStream
+{
+	struct FECPacket Packets[VFECWINDOW];
+	struct FECParity Parity[VFECPARITYSLOTS];
+	uint32_t NextParity;							// slot for the next parity packet
+	uint32_t Newest;								// highest sequence number seen
+	uint32_t Oldest;								// 1st packet kept: earlier groups can't be checked
+	bool Started;									// true once a packet has been kept
+};
+
+struct FECStream* FECStreams[VMAXPORTS];
+
+uint64_t ToRadio, FromRadio, Decompressed, Dropped;
+uint64_t ParityIn, Recovered, Unrecovered, Duplicates;
+uint64_t BytesIn, BytesOut;
+
+static volatile sig_atomic_t StopRequested;
+
+static void StopHandler(int Signal)
+{
+	(void)Signal;
+	StopRequested = 1;
+}
+
+
+static void Usage(void)
+{
+	printf("usage: ddcproxy -r <radio address> [-l <local address>] [-p <first port>] [-n <ports>] [-v]\n");
+}
+
+
+//
+// open and bind one socket per port
+// return true if error
+//
+static bool OpenSockets(struct in_addr LocalAddr)
+{
+	struct sockaddr_in Addr;
+	int Yes = 1;
+	int BufferSize = 4 * 1024 * 1024;
+	uint32_t Port;
+
+	for (Port = 0; Port < PortCount; Port++)
+	{
+		Sockets[Port] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (Sockets[Port] < 0)
+		{
+			perror("socket");
+			return true;
+		}
+		setsockopt(Sockets[Port], SOL_SOCKET, SO_REUSEADDR, &Yes, sizeof(Yes));
+		setsockopt(Sockets[Port], SOL_SOCKET, SO_RCVBUF, &BufferSize, sizeof(BufferSize));
+		memset(&Addr, 0, sizeof(Addr));
+		Addr.sin_family = AF_INET;
+		Addr.sin_addr = LocalAddr;
+		Addr.sin_port = htons(FirstPort + Port);
+		if (bind(Sockets[Port], (struct sockaddr*)&Addr, sizeof(Addr)) < 0)
+		{
+			printf("bind to port %d failed: %s\n", FirstPort + Port, strerror(errno));
+			return true;
+		}
+		PollFds[Port].fd = Sockets[Port];
+		PollFds[Port].events = POLLIN;
+	}
+	return false;
+}
+
+
+//
+// if a packet from the radio is a compressed DDC packet, decompress it into Out.
+// returns the length of the packet to send: Out's, or the original's if not compressed;
+// 0 if it can't be decoded
+//
+static ssize_t ExpandPacket(const uint8_t* In, ssize_t Length, uint8_t* Out, const uint8_t** Send)
+{
+	uint16_t Bits, Samples;
+	uint32_t Mode;
+
+	*Send = In;
+	if (Length < VHEADERSIZE + 1)
+		return Length;
+	Bits = (In[12] << 8) | In[13];
+	Samples = (In[14] << 8) | In[15];
+	if ((Bits & 0x8000) == 0)
+		return Length;
+	Mode = Bits & 0x7FFF;
+	if ((VHEADERSIZE + Samples * 6) > VMAXPACKET)
+		return 0;
+	memcpy(Out, In, VHEADERSIZE);
+	Out[12] = 0;
+	Out[13] = 24;
+	if (DecompressDDCSamples(Out + VHEADERSIZE, In + VHEADERSIZE, Length - VHEADERSIZE, Samples, Mode))
+		return 0;
+	*Send = Out;
+	Decompressed++;
+	return VHEADERSIZE + Samples * 6;
+}
+
+
+//
+// send a packet from the radio's stream (source port FirstPort + Stream) on to the client
+//
+static void SendToClient(uint32_t Stream, const uint8_t* Packet, ssize_t Length)
+{
+	uint8_t Out[VMAXPACKET];
+	const uint8_t* Send;
+	ssize_t SendLength;
+
+	SendLength = ExpandPacket(Packet, Length, Out, &Send);
+	if (SendLength == 0)
+	{
+		Dropped++;
+		return;
+	}
+	BytesOut += SendLength;
+	sendto(Sockets[Stream], Send, SendLength, 0, (struct sockaddr*)&ClientAddr, sizeof(ClientAddr));
+}
+
+
+//
+// if all but one of a parity packet's group have arrived, make that one and send it.
+// returns true when the parity is finished with
+//
+static bool RecoverFECGroup(uint32_t Stream, struct FECParity* Parity)
+{
+	struct FECStream* FEC = FECStreams[Stream];
+	struct FECPacket* Entry;
+	struct FECPacket* Missing = NULL;
+	const uint8_t* Packets[VMAXDDCFECGROUP];
+	uint32_t Lengths[VMAXDDCFECGROUP];
+	uint32_t Count = 0;
+	uint32_t Sequence;
+	uint32_t MissingSequence = 0;
+	uint32_t Cntr;
+
+	if (!FEC->Started)
+		return false;
+	if ((int32_t)(Parity->FirstSequence - FEC->Oldest) < 0)
+		return true;									// some of its group came before the stream's FEC state
+	for (Cntr = 0; Cntr < Parity->GroupSize; Cntr++)
+	{
+		Sequence = Parity->FirstSequence + Cntr;
+		Entry = &FEC->Packets[Sequence % VFECWINDOW];
+		if (Entry->Valid && (Entry->Sequence == Sequence))
+		{
+			Packets[Count] = Entry->Data;
+			Lengths[Count++] = Entry->Length;
+		}
+		else if (Missing != NULL)
+			return false;								// 2 missing so far: wait for more
+		else
+		{
+			Missing = Entry;
+			MissingSequence = Sequence;
+		}
+	}
+	if (Missing == NULL)
+		return true;									// none lost
+	Missing->Sequence = MissingSequence;
+	Missing->Length = RecoverDDCFECPacket(Missing->Data, Parity->Data, Parity->Length, Packets, Lengths, Count);
+	if (Missing->Length == 0)
+	{
+		Missing->Valid = false;
+		return true;
+	}
+	Missing->Valid = true;
+	Missing->Recovered = true;
+	Recovered++;
+	SendToClient(Stream, Missing->Data, Missing->Length);
+	return true;
+}
+
+
+//
+// a parity packet from the radio: keep it until its group can be checked
+//
+static void NoteFECParity(uint32_t Stream, const uint8_t* In, ssize_t Length, uint32_t FirstSequence, uint32_t GroupSize)
+{
+	struct FECParity* Parity;
+
+	ParityIn++;
+	if (FECStreams[Stream] == NULL)
+	{
+		FECStreams[Stream] = calloc(1, sizeof(struct FECStream));
+		if (FECStreams[Stream] == NULL)
+			return;
+	}
+	Parity = &FECStreams[Stream]->Parity[FECStreams[Stream]->NextParity];
+	FECStreams[Stream]->NextParity = (FECStreams[Stream]->NextParity + 1) % VFECPARITYSLOTS;
+	if (Parity->Valid)
+		Unrecovered++;									// its group lost more than one
+	Parity->FirstSequence = FirstSequence;
+	Parity->GroupSize = GroupSize;
+	Parity->Length = Length;
+	memcpy(Parity->Data, In, Length);
+	Parity->Valid = !RecoverFECGroup(Stream, Parity);
+}
+
+
+//
+// a DDC packet from a stream with FEC: keep it, and check the groups waiting for it.
+// returns false if it has been sent already, made from the parity
+//
+static bool NoteFECPacket(uint32_t Stream, const uint8_t* In, ssize_t Length)
+{
+	struct FECStream* FEC = FECStreams[Stream];
+	struct FECPacket* Entry;
+	struct FECParity* Parity;
+	uint32_t Sequence;
+	int32_t Ahead;
+	uint32_t Cntr;
+
+	Sequence = ((uint32_t)In[0] << 24) | ((uint32_t)In[1] << 16) | ((uint32_t)In[2] << 8) | In[3];
+	Ahead = (int32_t)(Sequence - FEC->Newest);
+	if (FEC->Started && ((Ahead > VFECWINDOW) || (Ahead < -VFECWINDOW)))
+		memset(FEC, 0, sizeof(struct FECStream));		// the stream has restarted
+	if (!FEC->Started)
+	{
+		FEC->Started = true;
+		FEC->Oldest = Sequence;
+		FEC->Newest = Sequence;
+	}
+	else if (Ahead > 0)
+		FEC->Newest = Sequence;
+	Entry = &FEC->Packets[Sequence % VFECWINDOW];
+	if (Entry->Valid && (Entry->Sequence == Sequence) && Entry->Recovered)
+	{
+		Entry->Recovered = false;
+		Duplicates++;
+		return false;
+	}
+	Entry->Valid = true;
+	Entry->Recovered = false;
+	Entry->Sequence = Sequence;
+	Entry->Length = Length;
+	memcpy(Entry->Data, In, Length);
+	for (Cntr = 0; Cntr < VFECPARITYSLOTS; Cntr++)
+	{
+		Parity = &FEC->Parity[Cntr];
+		if (Parity->Valid && (((Sequence - Parity->FirstSequence) < Parity->GroupSize)
+			|| ((int32_t)(Parity->FirstSequence - FEC->Oldest) < 0)))
+			Parity->Valid = !RecoverFECGroup(Stream, Parity);
+	}
+	return true;
+}
+
+
+//
+// handle one packet arriving on a socket
+//
+static void RelayPacket(uint32_t Port)
+{
+	uint8_t In[VMAXPACKET];
+	struct sockaddr_in From;
+	socklen_t FromLength = sizeof(From);
+	ssize_t Length;
+	uint16_t SourcePort;
+	uint32_t Stream;
+	uint32_t FirstSequence, GroupSize;
+
+	Length = recvfrom(Sockets[Port], In, sizeof(In), MSG_DONTWAIT, (struct sockaddr*)&From, &FromLength);
+	if (Length <= 0)
+		return;
+	if (From.sin_addr.s_addr == RadioAddr.sin_addr.s_addr)
+	{
+		//
+		// from the radio: all of it comes to the port the client's general packet
+		// was sent from; its source port says which stream it is
+		//
+		FromRadio++;
+		BytesIn += Length;
+		SourcePort = ntohs(From.sin_port);
+		if (!ClientKnown || (SourcePort < FirstPort) || (SourcePort >= (FirstPort + PortCount)))
+		{
+			Dropped++;
+			return;
+		}
+		Stream = SourcePort - FirstPort;
+		if (IsDDCFECPacket(In, Length, &FirstSequence, &GroupSize))
+			NoteFECParity(Stream, In, Length, FirstSequence, GroupSize);
+		else if ((FECStreams[Stream] == NULL) || (Length < VHEADERSIZE) || NoteFECPacket(Stream, In, Length))
+			SendToClient(Stream, In, Length);
+	}
+	else
+	{
+		//
+		// from the client: pass on to the same port at the radio
+		//
+		if (!ClientKnown || (From.sin_addr.s_addr != ClientAddr.sin_addr.s_addr) || (From.sin_port != ClientAddr.sin_port))
+			printf("client is %s:%d\n", inet_ntoa(From.sin_addr), ntohs(From.sin_port));
+		memcpy(&ClientAddr, &From, sizeof(ClientAddr));
+		ClientKnown = true;
+		ToRadio++;
+		RadioAddr.sin_port = htons(FirstPort + Port);
+		sendto(Sockets[Port], In, Length, 0, (struct sockaddr*)&RadioAddr, sizeof(RadioAddr));
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct in_addr LocalAddr;
+	bool Verbose = false;
+	time_t LastReport;
+	uint32_t Port;
+	int Opt;
+
+	memset(&RadioAddr, 0, sizeof(RadioAddr));
+	RadioAddr.sin_family = AF_INET;
+	LocalAddr.s_addr = htonl(INADDR_ANY);
+	while ((Opt = getopt(argc, argv, "r:l:p:n:vh")) != -1)
+	{
+		switch (Opt)
+		{
+		case 'r':
+			if (inet_aton(optarg, &RadioAddr.sin_addr) == 0)
+			{
+				printf("bad radio address %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'l':
+			if (inet_aton(optarg, &LocalAddr) == 0)
+			{
+				printf("bad local address %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			FirstPort = atoi(optarg);
+			break;
+		case 'n':
+			PortCount = atoi(optarg);
+			break;
+		case 'v':
+			Verbose = true;
+			break;
+		default:
+			Usage();
+			return 0;
+		}
+	}
+	if ((RadioAddr.sin_addr.s_addr == 0) || (PortCount == 0) || (PortCount > VMAXPORTS)
+		|| ((FirstPort + PortCount) > 65536))
+	{
+		Usage();
+		return 1;
+	}
+	if (OpenSockets(LocalAddr))
+		return 1;
+	signal(SIGINT, StopHandler);
+	signal(SIGTERM, StopHandler);
+	printf("relaying ports %d-%d to %s\n", FirstPort, FirstPort + PortCount - 1, inet_ntoa(RadioAddr.sin_addr));
+
+	LastReport = time(NULL);
+	while (!StopRequested)
+	{
+		if (poll(PollFds, PortCount, 500) > 0)
+			for (Port = 0; Port < PortCount; Port++)
+				if (PollFds[Port].revents & POLLIN)
+					RelayPacket(Port);
+		if (Verbose && (time(NULL) - LastReport) >= VSTATSPERIOD)
+		{
+			LastReport = time(NULL);
+			printf("to radio %llu, from radio %llu (%llu decompressed, %llu dropped); %.2f MB in, %.2f MB out\n",
+				(unsigned long long)ToRadio, (unsigned long long)FromRadio, (unsigned long long)Decompressed,
+				(unsigned long long)Dropped, BytesIn / 1.0e6, BytesOut / 1.0e6);
+			if (ParityIn != 0)
+				printf("FEC: %llu parity packets, %llu packets recovered, %llu groups lost more than one, %llu late duplicates\n",
+					(unsigned long long)ParityIn, (unsigned long long)Recovered, (unsigned long long)Unrecovered,
+					(unsigned long long)Duplicates);
+		}
+	}
+	for (Port = 0; Port < PortCount; Port++)
+	{
+		close(Sockets[Port]);
+		free(FECStreams[Port]);
+	}
+	return 0;
+}
@@ -0,0 +1,121 @@
+//
+// reads one DDC's I/Q samples from p2app through shared memory (setting ddc_shm)
+// an example of the client side in sw_projects/common/ddcshm.h
+// Laurence Barker July 2022
+//
+// ./ddcshmread [-d ddc] [-t seconds] [-o file]
+// reads DDC <ddc> (default 0) while p2app runs it, and prints the sample rate,
+// samples read and lost, and the sample number reached, each second.
+// with -o the samples (24 bit I then Q, big endian) are written to <file>.
+// runs for <seconds>, or until ctrl-C if not given.
+//
+
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <signal.h>
+#include "../../sw_projects/common/ddcshm.h"
+
+static volatile sig_atomic_t StopRequested;
+
+static void StopHandler(int Signal)
+{
+	(void)Signal;
+	StopRequested = 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct DDCShmClient Client;
+	struct DDCShmCursor Cursor;
+	const uint8_t* Samples;
+	FILE* OutFile = NULL;
+	uint32_t DDC = 0;
+	uint32_t Bytes;
+	uint64_t SamplesRead = 0, LastRead = 0;
+	uint64_t SampleNumber = 0;
+	uint32_t Overwritten = 0;
+	int Seconds = 0;
+	time_t Start, LastReport;
+	int Opt;
+
+	while ((Opt = getopt(argc, argv, "d:t:o:h")) != -1)
+	{
+		switch (Opt)
+		{
+		case 'd':
+			DDC = atoi(optarg);
+			break;
+		case 't':
+			Seconds = atoi(optarg);
+			break;
+		case 'o':
+			OutFile = fopen(optarg, "wb");
+			if (OutFile == NULL)
+			{
+				printf("can't open %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			printf("usage: ddcshmread [-d ddc] [-t seconds] [-o file]\n");
+			return 0;
+		}
+	}
+	if (DDC >= VNUMDDC)
+	{
+		printf("DDC must be 0 to %d\n", VNUMDDC - 1);
+		return 1;
+	}
+	if (ConnectDDCShm(&Client))
+	{
+		printf("can't connect to p2app: is it running, with ddc_shm set?\n");
+		return 1;
+	}
+	signal(SIGINT, StopHandler);
+	signal(SIGTERM, StopHandler);
+	memset(&Cursor, 0, sizeof(Cursor));
+
+	Start = LastReport = time(NULL);
+	while (!StopRequested && ((Seconds == 0) || ((time(NULL) - Start) < Seconds)))
+	{
+		Bytes = ReadDDCShm(&Client, DDC, &Cursor, &Samples);
+		if (Bytes == 0)
+		{
+			if (WaitDDCShm(&Client, 100))
+			{
+				printf("p2app has closed\n");
+				break;
+			}
+		}
+		else
+		{
+			GetDDCShmSampleNumber(&Client, DDC, Cursor.Position + Bytes, &SampleNumber);
+			if (OutFile != NULL)
+				fwrite(Samples, 1, Bytes, OutFile);
+			if (ReleaseDDCShm(&Client, DDC, &Cursor, Bytes))
+				Overwritten++;
+			SamplesRead += Bytes / 6;
+		}
+		if (time(NULL) != LastReport)
+		{
+			LastReport = time(NULL);
+			printf("DDC%d: %dKHz, %llu samples/s, %llu lost, %u reads overwritten, at sample %llu\n",
+				DDC, atomic_load(&Client.Control->DDC[DDC].SampleRate),
+				(unsigned long long)(SamplesRead - LastRead), (unsigned long long)Cursor.SamplesLost,
+				Overwritten, (unsigned long long)SampleNumber);
+			LastRead = SamplesRead;
+		}
+	}
+	if (OutFile != NULL)
+		fclose(OutFile);
+	DisconnectDDCShm(&Client);
+	return 0;
+}
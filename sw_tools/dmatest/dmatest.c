@@ -0,0 +1,621 @@
+//
+// test of write and read DME using XDMA driver
+// Laurence Barker July 2021
+//
+// ./dmatest <transfersize>
+// so for 512 byte test: command line ./dmatest 512
+// ./dmatest -s [options]
+// sweeps transfer size, queue depth and sync/async for both channels; ./dmatest -h for options
+//
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 500
+#include <assert.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <signal.h>
+#include <unistd.h>
+#include "../../sw_projects/common/hwaccess.h"
+#include "../../sw_projects/common/debugaids.h"
+
+//#define VTRANSFERSIZE 65536											// size in bytes to transfer
+#define VMEMBUFFERSIZE 32768										// memory buffer to reserve
+#define AXIBaseAddress 0x10000									// address of StreamRead/Writer IP
+
+//
+// create test data into memory buffer
+// size is the number of bytes to create - should be a multiple of 4
+// 
+void CreateTestData(char* MemPtr, uint32_t Size)
+{
+	uint16_t* Data;						// ptr to memory block to write data
+	uint16_t Word;						// a word of write data
+
+	uint32_t Cntr;						// memory counter
+
+	Data = (uint16_t *) MemPtr;
+	for(Cntr=0; Cntr < Size/2; Cntr++)
+		*Data++ = Cntr;
+}
+
+
+//
+// compare memory buffers to see if there are differences
+// report success, or 1st error
+// size is the number of bytes to compare - should be a multiple of 4
+// return 0 if fail
+//
+int CompareMemoryBuffers (char* Block1, char* Block2, uint32_t Size)
+{
+	uint32_t* Ptr1;
+	uint32_t* Ptr2;
+	uint32_t Cntr;
+	uint32_t Word1, Word2;
+  int Result = 1;																// success or fail
+	Ptr1 = (uint32_t *) Block1;
+	Ptr2 = (uint32_t *) Block2;
+
+	for(Cntr=0; Cntr < Size/4; Cntr++)
+	{
+		Word1 = *Ptr1++;
+		Word2 = *Ptr2++;
+		if (Word1 != Word2)
+		{
+			printf("Compare error. 1st nonmatching data at address %04x; data should be %04x; data found = %04x\n", Cntr*4, Word1, Word2);
+			Result = 0;
+			break;
+		}
+	}
+	if (Result == 1)
+		printf("Compare OK\n");
+	return Result;
+}
+
+
+
+/* Subtract timespec t2 from t1
+ *
+ * Both t1 and t2 must already be normalized
+ * i.e. 0 <= nsec < 1000000000
+ */
+static int timespec_check(struct timespec *t)
+{
+	if ((t->tv_nsec < 0) || (t->tv_nsec >= 1000000000))
+		return -1;
+	return 0;
+
+}
+
+void timespec_sub(struct timespec *t1, struct timespec *t2)
+{
+	if (timespec_check(t1) < 0) {
+		fprintf(stderr, "invalid time #1: %lld.%.9ld.\n",
+			(long long)t1->tv_sec, t1->tv_nsec);
+		return;
+	}
+	if (timespec_check(t2) < 0) {
+		fprintf(stderr, "invalid time #2: %lld.%.9ld.\n",
+			(long long)t2->tv_sec, t2->tv_nsec);
+		return;
+	}
+	t1->tv_sec -= t2->tv_sec;
+	t1->tv_nsec -= t2->tv_nsec;
+	if (t1->tv_nsec >= 1000000000) {
+		t1->tv_sec++;
+		t1->tv_nsec -= 1000000000;
+	} else if (t1->tv_nsec < 0) {
+		t1->tv_sec--;
+		t1->tv_nsec += 1000000000;
+	}
+}
+
+
+double timespec2double(struct timespec *t1)
+{
+	double Result;
+
+	Result = t1->tv_sec+((double)(t1->tv_nsec)/1.0E9);
+	return Result;
+}
+
+
+#define VALIGNMENT 4096
+
+
+//
+// DMA throughput and latency sweep
+// for each channel, transfer size and submission mode, run a number of transfers and report
+// throughput, latency percentiles and CPU utilisation. Latency is the time from submitting a
+// transfer to its completion, so with a queue depth >1 it includes time spent queued.
+// sync mode uses pread()/pwrite(), one transfer at a time; async mode uses the kernel AIO
+// syscalls directly (as sw_projects/common/hwaccess.c) with up to QueueDepth transfers in flight.
+// C2H needs the FPGA to supply data (eg the DDC stream enabled); a transfer not complete in
+// VSWEEPTIMEOUT seconds ends the sweep of that channel.
+//
+#define VSWEEPMINSIZE 256											// default smallest transfer
+#define VSWEEPMAXSIZE 1048576										// default largest transfer
+#define VSWEEPTRANSFERS 1000										// default transfers per point
+#define VMAXQUEUEDEPTH 16
+#define VDEFAULTQUEUEDEPTH 8
+#define VSWEEPTIMEOUT 2												// seconds
+
+struct SweepResult
+{
+	double MBps;													// throughput
+	double P50, P99, P999;											// latency, us
+	double CPU;														// % of one core, user + system
+};
+
+static volatile int SweepTimedOut;
+
+static void SweepAlarmHandler(int Signal)
+{
+	(void)Signal;
+	SweepTimedOut = 1;
+}
+
+static inline int sys_io_setup(unsigned NumEvents, aio_context_t* Context)
+{
+	return syscall(__NR_io_setup, NumEvents, Context);
+}
+
+static inline int sys_io_destroy(aio_context_t Context)
+{
+	return syscall(__NR_io_destroy, Context);
+}
+
+static inline int sys_io_submit(aio_context_t Context, long Count, struct iocb** Requests)
+{
+	return syscall(__NR_io_submit, Context, Count, Requests);
+}
+
+static inline int sys_io_getevents(aio_context_t Context, long MinCount, long MaxCount, struct io_event* Events, struct timespec* Timeout)
+{
+	return syscall(__NR_io_getevents, Context, MinCount, MaxCount, Events, Timeout);
+}
+
+
+static uint64_t NowNs(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+static double CPUSeconds(void)
+{
+	struct rusage Usage;
+
+	getrusage(RUSAGE_SELF, &Usage);
+	return Usage.ru_utime.tv_sec + Usage.ru_utime.tv_usec * 1.0E-6
+	     + Usage.ru_stime.tv_sec + Usage.ru_stime.tv_usec * 1.0E-6;
+}
+
+
+static int CompareLatencies(const void* A, const void* B)
+{
+	uint64_t X = *(const uint64_t*)A;
+	uint64_t Y = *(const uint64_t*)B;
+
+	return (X > Y) - (X < Y);
+}
+
+
+//
+// latency percentile in us from a sorted array of ns latencies
+//
+static double Percentile(uint64_t* Sorted, uint32_t Count, double Fraction)
+{
+	uint32_t Index;
+
+	Index = (uint32_t)(Fraction * (Count - 1) + 0.5);
+	return Sorted[Index] / 1000.0;
+}
+
+
+//
+// run one sweep point: Transfers transfers of Size bytes
+// Depth = 0 for sync; else async with up to Depth in flight
+// Buffers holds Depth (or 1) buffers of at least Size bytes
+// returns 0 if OK
+//
+static int RunSweepPoint(int fd, int IsRead, char** Buffers, uint32_t Size, uint32_t Depth,
+                         uint32_t Transfers, uint32_t AXIAddr, uint64_t* Latencies, struct SweepResult* Result)
+{
+	aio_context_t Context = 0;
+	struct iocb Requests[VMAXQUEUEDEPTH];
+	struct iocb* RequestPtr;
+	struct io_event Events[VMAXQUEUEDEPTH];
+	struct timespec Timeout;
+	uint64_t SubmitTime[VMAXQUEUEDEPTH];
+	uint64_t StartTime, EndTime;
+	double StartCPU;
+	uint32_t Submitted = 0, Completed = 0;
+	uint32_t Slot;
+	ssize_t rc;
+	int Count, Cntr;
+	int Error = 0;
+
+	SweepTimedOut = 0;
+	if ((Depth != 0) && (sys_io_setup(Depth, &Context) != 0))		// set up outside the timed section
+	{
+		perror("io_setup");
+		return 1;
+	}
+	StartCPU = CPUSeconds();
+	StartTime = NowNs();
+	if (Depth == 0)
+	{
+		for (Completed = 0; Completed < Transfers; Completed++)
+		{
+			alarm(VSWEEPTIMEOUT);
+			SubmitTime[0] = NowNs();
+			if (IsRead)
+				rc = pread(fd, Buffers[0], Size, AXIAddr);
+			else
+				rc = pwrite(fd, Buffers[0], Size, AXIAddr);
+			alarm(0);
+			if (rc != (ssize_t)Size)
+			{
+				Error = 1;
+				break;
+			}
+			Latencies[Completed] = NowNs() - SubmitTime[0];
+		}
+	}
+	else
+	{
+		while (!Error && (Completed < Transfers))
+		{
+			//
+			// keep the queue full; slot n always uses buffer n
+			//
+			while ((Submitted < Transfers) && ((Submitted - Completed) < Depth))
+			{
+				Slot = Submitted % Depth;
+				RequestPtr = &Requests[Slot];
+				memset(RequestPtr, 0, sizeof(struct iocb));
+				RequestPtr->aio_data = Slot;
+				RequestPtr->aio_lio_opcode = IsRead ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+				RequestPtr->aio_fildes = fd;
+				RequestPtr->aio_buf = (uint64_t)(uintptr_t)Buffers[Slot];
+				RequestPtr->aio_nbytes = Size;
+				RequestPtr->aio_offset = AXIAddr;
+				SubmitTime[Slot] = NowNs();
+				if (sys_io_submit(Context, 1, &RequestPtr) != 1)
+				{
+					perror("io_submit");
+					Error = 1;
+					break;
+				}
+				Submitted++;
+			}
+			if (Error)
+				break;
+			Timeout.tv_sec = VSWEEPTIMEOUT;
+			Timeout.tv_nsec = 0;
+			Count = sys_io_getevents(Context, 1, Depth, Events, &Timeout);
+			if (Count <= 0)
+			{
+				SweepTimedOut = (Count == 0);
+				Error = 1;
+				break;
+			}
+			EndTime = NowNs();
+			for (Cntr = 0; Cntr < Count; Cntr++)
+			{
+				if ((int64_t)Events[Cntr].res != (int64_t)Size)
+					Error = 1;
+				Latencies[Completed++] = EndTime - SubmitTime[Events[Cntr].data];
+			}
+		}
+	}
+	EndTime = NowNs();
+	Result->CPU = 100.0 * (CPUSeconds() - StartCPU) / ((EndTime - StartTime) * 1.0E-9);
+	if (Depth != 0)
+		sys_io_destroy(Context);										// cancels any still queued
+	if (Error)
+	{
+		if (SweepTimedOut)
+			printf("%s %d bytes: timed out; is the FPGA %s data?\n", IsRead ? "C2H" : "H2C", Size, IsRead ? "supplying" : "accepting");
+		else
+			printf("%s %d bytes: transfer failed\n", IsRead ? "C2H" : "H2C", Size);
+		return 1;
+	}
+	qsort(Latencies, Transfers, sizeof(uint64_t), CompareLatencies);
+	Result->MBps = ((double)Size * Transfers) / ((EndTime - StartTime) / 1000.0);
+	Result->P50 = Percentile(Latencies, Transfers, 0.5);
+	Result->P99 = Percentile(Latencies, Transfers, 0.99);
+	Result->P999 = Percentile(Latencies, Transfers, 0.999);
+	return 0;
+}
+
+
+static void SweepUsage(void)
+{
+	printf("Usage: ./dmatest <transfersize>      single write, read and compare\n");
+	printf("       ./dmatest -s [options]        throughput/latency sweep\n");
+	printf("  -m r|w|rw    channels: r=C2H (read), w=H2C (write); default rw\n");
+	printf("  -r min,max   transfer sizes, powers of 2 (default %d,%d)\n", VSWEEPMINSIZE, VSWEEPMAXSIZE);
+	printf("  -q depth     largest async queue depth, 1-%d (default %d)\n", VMAXQUEUEDEPTH, VDEFAULTQUEUEDEPTH);
+	printf("  -n count     transfers per point (default %d)\n", VSWEEPTRANSFERS);
+	printf("  -a addr      AXI address of the stream, hex (default %x)\n", AXIBaseAddress);
+	printf("  -c file      also write results to file as CSV\n");
+}
+
+
+//
+// sweep: for each channel, size, then sync and async at depth 1, 2, 4... up to MaxDepth
+//
+static int RunSweep(int argc, char *argv[])
+{
+	int Opt;
+	int DoRead = 1, DoWrite = 1;
+	uint32_t MinSize = VSWEEPMINSIZE, MaxSize = VSWEEPMAXSIZE;
+	uint32_t MaxDepth = VDEFAULTQUEUEDEPTH;
+	uint32_t Transfers = VSWEEPTRANSFERS;
+	uint32_t AXIAddr = AXIBaseAddress;
+	char* CSVPath = NULL;
+	FILE* CSVFile = NULL;
+	char* Buffers[VMAXQUEUEDEPTH];
+	uint64_t* Latencies;
+	struct SweepResult Result;
+	struct sigaction Action;
+	uint32_t Size, Depth, Cntr;
+	int Channel, fd;
+	int ChannelFailed;
+
+	while ((Opt = getopt(argc, argv, "sm:r:q:n:a:c:h")) != -1)
+	{
+		switch (Opt)
+		{
+			case 's':
+				break;
+			case 'm':
+				DoRead = (strchr(optarg, 'r') != NULL);
+				DoWrite = (strchr(optarg, 'w') != NULL);
+				break;
+			case 'r':
+				if (sscanf(optarg, "%u,%u", &MinSize, &MaxSize) != 2)
+				{
+					SweepUsage();
+					return 1;
+				}
+				break;
+			case 'q':
+				MaxDepth = atoi(optarg);
+				break;
+			case 'n':
+				Transfers = atoi(optarg);
+				break;
+			case 'a':
+				AXIAddr = strtoul(optarg, NULL, 16);
+				break;
+			case 'c':
+				CSVPath = optarg;
+				break;
+			default:
+				SweepUsage();
+				return 0;
+		}
+	}
+	if ((MinSize < 4) || (MaxSize < MinSize) || (MaxDepth < 1) || (MaxDepth > VMAXQUEUEDEPTH) || (Transfers < 1))
+	{
+		SweepUsage();
+		return 1;
+	}
+
+	for (Cntr = 0; Cntr < MaxDepth; Cntr++)
+		if (posix_memalign((void **)&Buffers[Cntr], VALIGNMENT, MaxSize) != 0)
+		{
+			printf("buffer allocation failed\n");
+			return 1;
+		}
+		else
+			CreateTestData(Buffers[Cntr], MaxSize);
+	Latencies = malloc(Transfers * sizeof(uint64_t));
+	if (Latencies == NULL)
+	{
+		printf("buffer allocation failed\n");
+		return 1;
+	}
+	if (CSVPath != NULL)
+	{
+		CSVFile = fopen(CSVPath, "w");
+		if (CSVFile == NULL)
+		{
+			printf("could not create %s\n", CSVPath);
+			return 1;
+		}
+		fprintf(CSVFile, "direction,size_bytes,mode,queue_depth,transfers,MBps,p50_us,p99_us,p999_us,cpu_percent\n");
+	}
+	memset(&Action, 0, sizeof(Action));
+	Action.sa_handler = SweepAlarmHandler;							// no SA_RESTART: a blocked read returns EINTR
+	sigaction(SIGALRM, &Action, NULL);
+
+	printf("%-4s %8s %-6s %5s %10s %10s %10s %10s %6s\n", "dir", "bytes", "mode", "depth", "MB/s", "p50 us", "p99 us", "p999 us", "CPU%");
+	for (Channel = 0; Channel < 2; Channel++)
+	{
+		if ((Channel == 0) && !DoWrite)
+			continue;
+		if ((Channel == 1) && !DoRead)
+			continue;
+		fd = open((Channel == 1) ? "/dev/xdma0_c2h_0" : "/dev/xdma0_h2c_0", O_RDWR);
+		if (fd < 0)
+		{
+			printf("XDMA %s device open failed\n", (Channel == 1) ? "read" : "write");
+			continue;
+		}
+		ChannelFailed = 0;
+		for (Size = MinSize; !ChannelFailed && (Size <= MaxSize); Size *= 2)
+			for (Depth = 0; !ChannelFailed && (Depth <= MaxDepth); Depth = (Depth == 0) ? 1 : Depth * 2)
+			{
+				if (RunSweepPoint(fd, Channel, Buffers, Size, Depth, Transfers, AXIAddr, Latencies, &Result))
+				{
+					ChannelFailed = 1;
+					break;
+				}
+				printf("%-4s %8d %-6s %5d %10.1f %10.1f %10.1f %10.1f %6.1f\n", Channel ? "C2H" : "H2C",
+				       Size, Depth ? "async" : "sync", Depth ? Depth : 1, Result.MBps, Result.P50, Result.P99, Result.P999, Result.CPU);
+				if (CSVFile != NULL)
+					fprintf(CSVFile, "%s,%d,%s,%d,%d,%.2f,%.2f,%.2f,%.2f,%.1f\n", Channel ? "C2H" : "H2C",
+					        Size, Depth ? "async" : "sync", Depth ? Depth : 1, Transfers,
+					        Result.MBps, Result.P50, Result.P99, Result.P999, Result.CPU);
+			}
+		close(fd);
+	}
+	if (CSVFile != NULL)
+		fclose(CSVFile);
+	for (Cntr = 0; Cntr < MaxDepth; Cntr++)
+		free(Buffers[Cntr]);
+	free(Latencies);
+	return 0;
+}
+
+
+
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+	int DMAReadfile_fd = -1;											// DMA read file device
+	int DMAWritefile_fd = -1;											// DMA write file device
+  	char* WriteBuffer = NULL;											// data for DMA write
+  	char* ReadBuffer = NULL;											// data for DMA write
+	uint32_t BufferSize = 32768;
+	struct timespec ts_start, ts_read, ts_write;
+	ssize_t rc;																		// return code from time functions
+	double WriteTime, ReadTime;
+	double WriteRate, ReadRate;
+	uint32_t RegisterValue;
+	uint32_t TransferSize = 0;
+
+	if ((argc >= 2) && (argv[1][0] == '-'))
+		return RunSweep(argc, argv);
+	if (argc != 2)
+		printf("Usage: ./dmatest <transfersize>\n");
+	else
+		TransferSize = (atoi(argv[1]));
+	if(TransferSize > 0)
+	{
+	//
+	// initialise. Create memory buffers and open DMA file devices
+	//
+		posix_memalign((void **)&WriteBuffer, VALIGNMENT, BufferSize);
+		posix_memalign((void **)&ReadBuffer, VALIGNMENT, BufferSize);
+		if(!WriteBuffer)
+		{
+			printf("write buffer allocation failed\n");
+			goto out;
+		}
+		if(!ReadBuffer)
+		{
+			printf("read buffer allocation failed\n");
+			goto out;
+		}
+
+	//
+	// try to open memory device
+	//
+		if (OpenXDMADriver() == 0)
+			goto out;
+
+	//
+	// now read the user access register (it should have a date code)
+	//
+		RegisterValue = RegisterRead(0xB000);				// read the user access register
+		printf("User register = %08x\n", RegisterValue);
+
+
+		printf("Initialising XDMA write\n");
+		DMAReadfile_fd = open("/dev/xdma0_c2h_0", O_RDWR);
+
+		printf("Initialising XDMA read\n");
+		DMAWritefile_fd = open("/dev/xdma0_h2c_0", O_RDWR);
+		if(DMAReadfile_fd < 0)
+		{
+			printf("XDMA read device open failed\n");
+			goto out;
+		}
+		if(DMAWritefile_fd < 0)
+		{
+			printf("XDMA write device open failed\n");
+			goto out;
+		}
+
+	//
+	// we have devices and memory.
+	// create test data, and display it
+	//
+		CreateTestData(WriteBuffer, TransferSize);
+
+	//
+	// do DMA write; get time taken into ts_write
+	//
+		printf("DMA write %d bytes to destination\n", TransferSize);
+		rc = clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		DMAWriteToFPGA(DMAWritefile_fd, (unsigned char*)WriteBuffer, TransferSize, AXIBaseAddress);
+		rc = clock_gettime(CLOCK_MONOTONIC, &ts_write);
+		timespec_sub(&ts_write, &ts_start);
+
+	//
+	// now read the FIFO write and read depth FIFOs
+	//
+		RegisterValue = RegisterRead(0xD000);				// read the write depth count
+		printf("FIFO write depth = %d\n", RegisterValue);
+		RegisterValue = RegisterRead(0xD004);				// read the read depth count
+		printf("FIFO read depth = %d\n", RegisterValue);
+
+	//
+	// do DMA read; get time taken into ts_read
+	//
+		printf("DMA read %d bytes from destination\n", TransferSize);
+		rc = clock_gettime(CLOCK_MONOTONIC, &ts_start);
+		DMAReadFromFPGA(DMAReadfile_fd, (unsigned char*)ReadBuffer, TransferSize, AXIBaseAddress);
+		rc = clock_gettime(CLOCK_MONOTONIC, &ts_read);
+		timespec_sub(&ts_read, &ts_start);
+		
+		CompareMemoryBuffers(WriteBuffer, ReadBuffer, TransferSize);
+		DumpMemoryBuffer(ReadBuffer, TransferSize);
+
+	//
+	// now check timings
+	//
+		WriteTime = 1000.0*timespec2double(&ts_write);
+		ReadTime = 1000.0*timespec2double(&ts_read);
+		WriteRate = ((double)TransferSize) /(1.0E3*WriteTime);		// Mbyte/s
+		ReadRate = ((double)TransferSize) /(1.0E3*ReadTime);		// Mbyte/s
+		printf("Write time = %1.3fms; data rate = %3.1fMByte/s\n", WriteTime, WriteRate);
+		printf("Read time = %1.3fms; data rate = %3.1fMByte/s\n", ReadTime, ReadRate);
+
+	//
+	// close down. Deallocate memory and close files
+	//
+out:
+		close(DMAWritefile_fd);
+		close(DMAReadfile_fd);
+		CloseXDMADriver();
+
+		free(WriteBuffer);
+		free(ReadBuffer);
+	}
+}
+
@@ -0,0 +1,247 @@
+//-----------------------------------------------------------------------------
+// Name: flashjob.cpp
+// Description: Background flash job engine for the flash writer GUI
+//-----------------------------------------------------------------------------
+
+#include "flashjob.hpp"
+
+#include <cmath>
+#include <cstdio>
+
+/**
+ * @brief Start the worker thread
+ *
+ * @param cfg: The SPI configuration each run of jobs initialises the driver with
+ * @param notify: Called from the worker when there are events to take
+ */
+FlashJobEngine_c::FlashJobEngine_c(const XSpi_Config& cfg, const std::function<void()>& notify)
+   : mCfg(cfg), mNotify(notify)
+{
+   mThread = std::thread(&FlashJobEngine_c::Worker, this);
+}
+
+FlashJobEngine_c::~FlashJobEngine_c()
+{
+   {
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+      mStop = true;
+      mJobs.clear();
+   }
+   mCancel = true;
+   mWake.notify_one();
+   mThread.join();
+}
+
+/**
+ * @brief Queue a job, to run after any already queued
+ *
+ * @param job: The job to run
+ */
+void FlashJobEngine_c::Queue(const flash_job_s& job)
+{
+   {
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+      if (!mRunning && mJobs.empty())
+         mCancel = false;               // A cancel only applies to the jobs queued before it
+      mJobs.push_back(job);
+   }
+   mWake.notify_one();
+}
+
+/**
+ * @brief Stop the running job and drop the queued ones
+ */
+void FlashJobEngine_c::Cancel(void)
+{
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+   if (mRunning || !mJobs.empty())
+      mCancel = true;
+}
+
+/**
+ * @brief True from queueing a job until its DONE event has been taken
+ */
+bool FlashJobEngine_c::IsBusy(void)
+{
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+   return mRunning || !mJobs.empty() || mDoneWaiting;
+}
+
+/**
+ * @brief Collect the events so far, for the main loop
+ *
+ * @param events: Receives the stage, text and DONE events, oldest first
+ * @param fraction: Receives the latest progress of the running job, 0 to 1
+ */
+void FlashJobEngine_c::TakeEvents(std::vector<flash_event_s>& events, double& fraction)
+{
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+   mNotifyWaiting = false;
+   events.clear();
+   events.swap(mEvents);
+   mDoneWaiting = false;
+   fraction = mFraction;
+}
+
+
+//--------------------------------------------------------------------------------
+// Worker
+// The worker thread: runs queued jobs until the engine is destroyed
+// The driver is initialised once for each run of queued jobs
+//--------------------------------------------------------------------------------
+void FlashJobEngine_c::Worker(void)
+{
+   std::unique_lock<decltype(mMutex)> lock(mMutex);
+   while (!mStop)
+   {
+      if (mJobs.empty())
+      {
+         mWake.wait(lock);
+         continue;
+      }
+      mRunning = true;
+      lock.unlock();
+      bool ok = true;
+      try
+      {
+         SPI_S25FL_c flash;
+         flash.RegisterStatusCallback([this](const pgm_status_s& stat) { OnStatus(stat); });
+         Post(FLASH_EVENT_STAGE, "Initialise");
+         flash.Init(mCfg);
+         while (true)
+         {
+            flash_job_s job;
+            {
+               std::lock_guard<decltype(mMutex)> jobs_lock(mMutex);
+               if (mJobs.empty() || mStop)
+                  break;
+               job = mJobs.front();
+               mJobs.pop_front();
+            }
+            if (mCancel)
+               throw flash_cancelled_c();
+            RunJob(flash, job);
+         }
+      }
+      catch (const flash_cancelled_c&)
+      {
+         Post(FLASH_EVENT_TEXT, "\nCancelled: the flash may be partly written\n", false);
+         ok = false;
+      }
+      catch (const std::exception& ex)
+      {
+         Post(FLASH_EVENT_TEXT, std::string("\nException occurred: ") + ex.what() + "\n", false);
+         ok = false;
+      }
+      lock.lock();
+      mJobs.clear();                    // A failed or cancelled job's verify would mean nothing
+      mRunning = false;
+      mDoneWaiting = true;
+      mEvents.push_back({FLASH_EVENT_DONE, ok ? "Complete" : (mCancel ? "Cancelled" : "Failed"), ok});
+      lock.unlock();
+      Notify(false);
+      lock.lock();
+   }
+}
+
+//--------------------------------------------------------------------------------
+// RunJob
+// Runs one job on an initialised driver, posting its stage and result
+//--------------------------------------------------------------------------------
+void FlashJobEngine_c::RunJob(SPI_S25FL_c& flash, const flash_job_s& job)
+{
+   char text[100];
+   const uint8_t* data = job.data ? job.data->data() : nullptr;
+   const size_t len = job.data ? job.data->size() : job.len;
+
+   mFraction = 0.0;
+   const auto start = std::chrono::steady_clock::now();
+   switch (job.kind)
+   {
+   case FLASH_JOB_ERASE:
+      Post(FLASH_EVENT_STAGE, "Erase");
+      Post(FLASH_EVENT_TEXT, "Erasing: ");
+      flash.EraseRange(job.addr, len);
+      snprintf(text, sizeof(text), "complete in %.3fs...\n",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      break;
+
+   case FLASH_JOB_PROGRAM:
+      Post(FLASH_EVENT_STAGE, "Program");
+      Post(FLASH_EVENT_TEXT, "Erasing and programming: ");
+      flash.EraseWrite(job.addr, data, len);
+      snprintf(text, sizeof(text), "complete in %.3fs...\n",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      break;
+
+   case FLASH_JOB_UPDATE:
+   {
+      Post(FLASH_EVENT_STAGE, "Update");
+      Post(FLASH_EVENT_TEXT, "Updating changed sectors: ");
+      const size_t changed = flash.WriteChanged(job.addr, data, len);
+      snprintf(text, sizeof(text), "%zu sectors updated in %.3fs...\n", changed,
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      break;
+   }
+
+   case FLASH_JOB_VERIFY:
+   {
+      Post(FLASH_EVENT_STAGE, "Verify");
+      Post(FLASH_EVENT_TEXT, "Verifying: ");
+      const bool verified = flash.Verify(job.addr, data, len);
+      snprintf(text, sizeof(text), "read complete in %.3fs...\n%s\n",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+               verified ? "Verify Successful" : "Verify FAIL");
+      if (!verified)
+      {
+         Post(FLASH_EVENT_TEXT, text);
+         throw std::runtime_error("flash does not match the file");
+      }
+      break;
+   }
+   }
+   mFraction = 1.0;
+   Post(FLASH_EVENT_TEXT, text);
+}
+
+//--------------------------------------------------------------------------------
+// OnStatus
+// The driver's status callback, on the worker thread: keeps the progress and
+// throws flash_cancelled_c once a cancel is asked for
+//--------------------------------------------------------------------------------
+void FlashJobEngine_c::OnStatus(const pgm_status_s& stat)
+{
+   if (mCancel)
+      throw flash_cancelled_c();
+   if (!std::isnan(stat.pcnt_cmplt))
+   {
+      mFraction = stat.pcnt_cmplt;
+      Notify(true);
+   }
+}
+
+//--------------------------------------------------------------------------------
+// Post/Notify
+// Post queues an event and notifies; Notify calls the notify function unless a
+// notify is already waiting to be taken, and for progress alone, unless one was
+// made less than PROGRESS_INTERVAL_S ago
+//--------------------------------------------------------------------------------
+void FlashJobEngine_c::Post(flash_event_kind_e kind, const std::string& text, bool ok)
+{
+   {
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+      mEvents.push_back({kind, text, ok});
+   }
+   Notify(false);
+}
+
+void FlashJobEngine_c::Notify(bool progress_only)
+{
+   const auto now = std::chrono::steady_clock::now();
+   if (progress_only && (std::chrono::duration<double>(now - mLastNotify).count() < PROGRESS_INTERVAL_S))
+      return;
+   if (mNotifyWaiting.exchange(true))
+      return;
+   mLastNotify = now;
+   mNotify();
+}
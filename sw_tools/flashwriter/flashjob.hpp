@@ -0,0 +1,167 @@
+//-----------------------------------------------------------------------------
+// Name: flashjob.hpp
+// Description: Header file for the background flash job engine
+//
+// The flash writer GUI queues erase, program, update and verify jobs here; one
+// worker thread runs them in order on the S25FL driver, so the SPI loops never
+// wait for the GTK main loop. The worker reports back as events: stage changes
+// and log text are all kept, progress only as the latest fraction. The notify
+// function is called from the worker when there are events to collect, at most
+// once until they are collected, and for progress alone at most every
+// PROGRESS_INTERVAL_S. The GUI's notify posts to its main loop (g_idle_add),
+// which calls TakeEvents.
+// Cancel stops the running job at its next progress report and drops those
+// queued after it; so does a job failing, as a verify of a failed program would
+// mean nothing.
+//-----------------------------------------------------------------------------
+#pragma once
+
+#include "spi-s25fl.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+
+//-------------------------------------------------------------------------------------//
+// Jobs and events
+//-------------------------------------------------------------------------------------//
+
+enum flash_job_kind_e
+{
+   FLASH_JOB_ERASE,        // Erase len bytes from addr
+   FLASH_JOB_PROGRAM,      // Erase and program data at addr
+   FLASH_JOB_UPDATE,       // Rewrite only the sectors of data at addr that differ
+   FLASH_JOB_VERIFY        // Compare the flash at addr with data
+};
+
+struct flash_job_s
+{
+   flash_job_kind_e kind;
+   uint32_t addr = 0;
+   size_t len = 0;                                       // Erase only: others use data's size
+   std::shared_ptr<const std::vector<uint8_t>> data;     // Shared by a program job and its verify
+};
+
+enum flash_event_kind_e
+{
+   FLASH_EVENT_STAGE,      // A job started: text is its stage name
+   FLASH_EVENT_TEXT,       // Log text
+   FLASH_EVENT_DONE        // The queue is empty: ok is false if a job failed or was cancelled
+};
+
+struct flash_event_s
+{
+   flash_event_kind_e kind;
+   std::string text;
+   bool ok = true;
+};
+
+// Thrown through the driver from its status callback to stop a cancelled job
+class flash_cancelled_c : public std::runtime_error
+{
+public:
+   flash_cancelled_c() : std::runtime_error("Cancelled") {}
+};
+
+class FlashJobEngine_c
+{
+
+public:
+
+/**
+ * @brief Start the worker thread
+ *
+ * @param cfg: The SPI configuration each run of jobs initialises the driver with
+ * @param notify: Called from the worker when there are events to take
+ */
+   FlashJobEngine_c(const XSpi_Config& cfg, const std::function<void()>& notify);
+
+   ~FlashJobEngine_c();
+
+/**
+ * @brief Queue a job, to run after any already queued
+ *
+ * @param job: The job to run
+ */
+   void Queue(const flash_job_s& job);
+
+/**
+ * @brief Stop the running job and drop the queued ones
+ */
+   void Cancel(void);
+
+/**
+ * @brief True from queueing a job until its DONE event has been taken
+ */
+   bool IsBusy(void);
+
+/**
+ * @brief Collect the events so far, for the main loop
+ *
+ * @param events: Receives the stage, text and DONE events, oldest first
+ * @param fraction: Receives the latest progress of the running job, 0 to 1
+ */
+   void TakeEvents(std::vector<flash_event_s>& events, double& fraction);
+
+
+private:
+
+   //-------------------------------------------------------------------------------------//
+   // Private functions
+   //-------------------------------------------------------------------------------------//
+
+//--------------------------------------------------------------------------------
+// Worker
+// The worker thread: runs queued jobs until the engine is destroyed
+//--------------------------------------------------------------------------------
+   void Worker(void);
+
+//--------------------------------------------------------------------------------
+// RunJob
+// Runs one job on an initialised driver, posting its stage and result
+//--------------------------------------------------------------------------------
+   void RunJob(SPI_S25FL_c& flash, const flash_job_s& job);
+
+//--------------------------------------------------------------------------------
+// OnStatus
+// The driver's status callback, on the worker thread: keeps the progress and
+// throws flash_cancelled_c once a cancel is asked for
+//--------------------------------------------------------------------------------
+   void OnStatus(const pgm_status_s& stat);
+
+//--------------------------------------------------------------------------------
+// Post/Notify
+// Post queues an event and notifies; Notify calls the notify function unless a
+// notify is already waiting to be taken, and for progress alone, unless one was
+// made less than PROGRESS_INTERVAL_S ago
+//--------------------------------------------------------------------------------
+   void Post(flash_event_kind_e kind, const std::string& text, bool ok = true);
+   void Notify(bool progress_only);
+
+   //-------------------------------------------------------------------------------------//
+   // Private data
+   //-------------------------------------------------------------------------------------//
+
+   static constexpr double PROGRESS_INTERVAL_S = 0.1;     // Progress bar redraws at most 10 per second
+
+   XSpi_Config mCfg;
+   std::function<void()> mNotify;
+
+   // Job queue, and the events for the main loop, both under mMutex
+   std::mutex mMutex;
+   std::condition_variable mWake;
+   std::deque<flash_job_s> mJobs;
+   std::vector<flash_event_s> mEvents;
+   bool mRunning = false;                 // A job is being run
+   bool mDoneWaiting = false;             // DONE posted and not yet taken
+   bool mStop = false;                    // Engine being destroyed
+
+   std::atomic<bool> mCancel{false};
+   std::atomic<bool> mNotifyWaiting{false};
+   std::atomic<double> mFraction{0.0};
+   std::chrono::steady_clock::time_point mLastNotify = std::chrono::steady_clock::now();   // Worker only
+
+   std::thread mThread;
+};
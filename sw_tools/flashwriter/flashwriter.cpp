@@ -0,0 +1,382 @@
+//
+// main file for SPI flash writer GUI app
+// flash write created from command line code; GUI created with GTK3
+//
+#include <gtk/gtk.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <getopt.h>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "spi-s25fl.hpp"                // class to access S25FL256x devices
+#include "flashjob.hpp"                 // worker thread running the flash jobs
+
+//
+// global variables: for GUI:
+//
+GtkBuilder      *Builder; 
+GtkWidget       *Window;
+GtkTextBuffer   *TextBuffer;
+GtkStatusbar      *StatusBar;
+GtkLabel *LblStage;
+GtkLabel *LblFilename;
+GtkProgressBar *ProgressBar;
+GtkToggleButton *RbPrimary;
+GtkToggleButton *RbFallback;
+GtkToggleButton *CbChanged;
+GtkWidget       *BtnProgram;
+GtkWidget       *BtnErase;
+GtkWidget       *BtnCancel;
+GtkWidget       *DlgFileChoose;
+    
+
+//
+// mem read/write variables:
+//
+int fd;                             // device identifier
+gboolean DriverPresent;             // true if device driver is accessible
+gboolean FileNameSet;               // true if filename has been set by "file open"
+gboolean PrimaryImage;              // set true if primary image to be written
+
+#define VFALLBACKADDR 0x00000000    // start of flash Flash
+#define VPRIMARYADDR  0x00980000    // at end of 1st image + timer barrier
+#define VDEVICESIZE 0x02000000      // 32MByte
+//
+// SPI writer constron structure:
+//
+XSpi_Config cfg;
+uint32_t FlashStartAddress; 
+FlashJobEngine_c *FlashJobs;        // runs erase/program/verify off the GTK main thread
+
+
+//
+// global needed to re-use Xilinx code
+// pathname for the PCIe device driver axi-lite bus access device
+//
+const char* gAXI_FNAME = "/dev/xdma/card0/user";
+
+
+//
+// Load a raw binary file into memory for programming 
+//   aOffset: offset into the file to start loading 
+//   alen: Number of bytes to load (0=read all) 
+//   return Raw data to program
+//
+static std::vector<uint8_t> LoadBin(const char* fname, long int aOffset, long int aLen)
+{
+    // Load file data into a vector
+    std::vector<uint8_t> rez(aLen);
+    FILE* fp = fopen(fname, "rb");
+    if (fp)
+    {
+        // obtain file size
+        fseek (fp, 0, SEEK_END);
+        const auto fsize = ftell(fp);
+
+        // Seek to the desired offset
+        if (aOffset >= fsize)
+            throw std::runtime_error("File offset index exceeds file size");
+
+        // OK seek to desired offset.
+        fseek(fp, aOffset, SEEK_SET);
+
+        // Compute the number of bytes to program
+        if (0 == aLen)
+            aLen = fsize - aOffset;         // Whole file
+
+        // Read into rez
+        rez.resize(aLen);
+        const size_t num_read = fread(rez.data(), 1, aLen, fp);
+        rez.resize(num_read);
+
+        // Done
+        fclose(fp);
+    }
+    else
+    {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Failed to open %s:%s\n", fname, strerror(errno));
+        throw std::runtime_error(std::string(msg));
+    }
+
+    return rez;
+}
+
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// GUI event handlers
+
+
+//
+// SPI writer settings, for the job engine
+//
+static void SetupSPIConfig(void)
+{
+    cfg.BaseAddress = 0x10000;                // Base address of the SPI IP
+    cfg.HasFifos = 1;                         // Does device have FIFOs?
+    cfg.SlaveOnly = 0;                        // Is the device slave only?
+    cfg.NumSlaveBits = 1;                     // Num of slave select bits on the device
+    cfg.DataWidth = XSP_DATAWIDTH_BYTE;       // Data transfer Width. 0=byte
+    cfg.SpiMode = XSP_QUAD_MODE;              // Standard/Dual/Quad mode
+    cfg.AxiFullBaseAddress = 0x10000;         // AXI Full Interface Base address of the SPI IP (unused?)
+    cfg.XipMode = 0;                          // 0 if Non-XIP, 1 if XIP Mode
+    cfg.Use_Startup = 1;                      // 1 if Startup block is used in h/w
+    cfg.dev_fname = gAXI_FNAME;               // Default to XDMA driver, first device
+
+  // Unused properties
+    cfg.AxiInterface = 0;             // AXI-Lite/AXI Full Interface
+    cfg.DeviceId = 0;                 // Unique ID  of device
+}
+
+
+//
+// program and erase are not offered while jobs run; cancel only then
+//
+static void SetJobButtons(gboolean Busy)
+{
+    gtk_widget_set_sensitive(BtnProgram, !Busy);
+    gtk_widget_set_sensitive(BtnErase, !Busy);
+    gtk_widget_set_sensitive(BtnCancel, Busy);
+}
+
+
+//
+// main loop: collect the job engine's events, posted from its worker thread by g_idle_add.
+// progress arrives at most 10 times a second, so the redraw costs the SPI loop nothing.
+//
+static gboolean OnFlashEvents(gpointer Data)
+{
+    std::vector<flash_event_s> Events;
+    double Fraction;
+
+    FlashJobs->TakeEvents(Events, Fraction);
+    gtk_progress_bar_set_fraction(ProgressBar, Fraction);
+    for (const auto& Event : Events)
+    {
+        switch (Event.kind)
+        {
+            case FLASH_EVENT_STAGE:
+                gtk_label_set_label(LblStage, Event.text.c_str());
+                break;
+            case FLASH_EVENT_TEXT:
+                gtk_text_buffer_insert_at_cursor(TextBuffer, Event.text.c_str(), -1);
+                break;
+            case FLASH_EVENT_DONE:
+                gtk_label_set_label(LblStage, Event.text.c_str());
+                break;
+        }
+    }
+    SetJobButtons(FlashJobs->IsBusy());
+    return G_SOURCE_REMOVE;
+}
+
+
+// called when "erase device" button is clicked
+void on_erase_button_clicked()
+{
+    flash_job_s Job;
+
+    if(DriverPresent && !FlashJobs->IsBusy())
+    {
+        gtk_text_buffer_insert_at_cursor(TextBuffer, "Erase Whole device:\n", -1);
+        Job.kind = FLASH_JOB_ERASE;
+        Job.addr = 0x0;
+        Job.len = VDEVICESIZE;                     // 32MByte
+        SetJobButtons(TRUE);
+        FlashJobs->Queue(Job);
+    }
+}
+
+
+// called when "cancel" button is clicked: the job stops at its next progress step
+void on_cancel_button_clicked()
+{
+    if(DriverPresent && FlashJobs->IsBusy())
+    {
+        gtk_text_buffer_insert_at_cursor(TextBuffer, "\nCancelling...", -1);
+        FlashJobs->Cancel();
+    }
+}
+
+
+
+// called when "open file" button is clicked
+void on_file_button_clicked()
+{
+    gchar *FileName = NULL;                     // filename from dialog
+    gboolean Success = FALSE;
+
+    gtk_widget_show(DlgFileChoose);                     // show the file chooser dialog
+//
+// now wait till it closes, and get the filename
+//
+    if(gtk_dialog_run(GTK_DIALOG(DlgFileChoose)) == GTK_RESPONSE_OK)
+    {
+        FileName = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(DlgFileChoose));
+        if(FileName!= NULL)
+            Success = TRUE;
+        if(Success == TRUE)
+        {
+            gtk_text_buffer_insert_at_cursor(TextBuffer, "open succeeded\n", -1);
+            gtk_label_set_label(LblFilename, FileName);
+        }
+
+    }
+    else
+        gtk_text_buffer_insert_at_cursor(TextBuffer, "open cancelled\n", -1);
+
+    gtk_widget_hide(DlgFileChoose);
+    FileNameSet = Success;
+}
+  
+//
+// called when program button is clicked
+//
+void on_program_button_clicked()
+{
+    gchar TempString[100];
+
+    if(gtk_toggle_button_get_active(RbPrimary))
+    {
+        PrimaryImage = TRUE;
+        FlashStartAddress = VPRIMARYADDR;
+    }
+    else
+    {
+        PrimaryImage = FALSE; 
+        FlashStartAddress = VFALLBACKADDR;
+    }
+
+//
+// if we have a device driver and filename, queue the programming jobs: program
+// (or update changed sectors) then verify. They run on the job engine's thread.
+//
+    if(DriverPresent && FileNameSet && !FlashJobs->IsBusy())
+    {
+//
+// read and check binary file
+//
+      // Load file and make sure not empty
+        std::shared_ptr<std::vector<uint8_t>> data_to_write;
+        try
+        {
+            data_to_write = std::make_shared<std::vector<uint8_t>>(LoadBin(gtk_label_get_label(LblFilename), 0, 0));
+        }
+        catch (const std::exception& ex)
+        {
+            sprintf(TempString, "\nException occurred: %s\n", ex.what());
+            gtk_text_buffer_insert_at_cursor(TextBuffer, TempString, -1);
+            return;
+        }
+        if (data_to_write->empty())
+            gtk_text_buffer_insert_at_cursor(TextBuffer, "file is empty\n", -1);
+        else
+        {
+            sprintf(TempString, "programming %zu bytes at address 0x%08x\n", data_to_write->size(), FlashStartAddress);
+            gtk_text_buffer_insert_at_cursor(TextBuffer, TempString, -1);
+            flash_job_s Job;
+            Job.addr = FlashStartAddress;
+            Job.data = data_to_write;
+            // compare, then erase and program changed sectors only; or erase and program, a sector at a time
+            Job.kind = gtk_toggle_button_get_active(CbChanged) ? FLASH_JOB_UPDATE : FLASH_JOB_PROGRAM;
+            SetJobButtons(TRUE);
+            FlashJobs->Queue(Job);
+            // compare flash with the file as it is read
+            Job.kind = FLASH_JOB_VERIFY;
+            FlashJobs->Queue(Job);
+        }
+    }
+}
+
+
+
+
+// called when window is closed
+void on_window_main_destroy()
+{
+    gtk_main_quit();
+}
+
+
+// called when window is closed
+void on_close_button_clicked()
+{
+    gtk_main_quit();
+} 
+
+
+
+//
+// "main" essentially creates the window and attaches event handlers
+//
+int main(int argc, char *argv[])
+{
+    guint Context;                                  // status bar context
+
+    gtk_init(&argc, &argv);
+    PrimaryImage = FALSE;
+    FileNameSet = FALSE;
+
+    // Update October 2019: The line below replaces the 2 lines above
+    Builder = gtk_builder_new_from_file("flashwriter.ui");
+
+    Window = GTK_WIDGET(gtk_builder_get_object(Builder, "window_main"));
+    DlgFileChoose = GTK_WIDGET(gtk_builder_get_object(Builder, "dlg_file_choose"));
+    StatusBar = GTK_STATUSBAR(gtk_builder_get_object(Builder, "statusbar_main"));
+    TextBuffer = GTK_TEXT_BUFFER(gtk_builder_get_object(Builder, "textbuffer_main"));
+    LblStage = GTK_LABEL(gtk_builder_get_object(Builder, "lbl_stage"));
+    LblFilename = GTK_LABEL(gtk_builder_get_object(Builder, "lbl_filename"));
+    ProgressBar = GTK_PROGRESS_BAR(gtk_builder_get_object(Builder, "id_progress"));
+    RbPrimary = GTK_TOGGLE_BUTTON(gtk_builder_get_object(Builder, "rb_1"));
+    RbFallback = GTK_TOGGLE_BUTTON(gtk_builder_get_object(Builder, "rb_2"));
+    CbChanged = GTK_TOGGLE_BUTTON(gtk_builder_get_object(Builder, "cb_changed"));
+    BtnProgram = GTK_WIDGET(gtk_builder_get_object(Builder, "btn_program"));
+    BtnErase = GTK_WIDGET(gtk_builder_get_object(Builder, "btn_erase"));
+    BtnCancel = GTK_WIDGET(gtk_builder_get_object(Builder, "btn_cancel"));
+
+    gtk_builder_add_callback_symbol (Builder, "OnEraseButtonClicked", G_CALLBACK (on_erase_button_clicked));
+    gtk_builder_add_callback_symbol (Builder, "on_program_button_clicked", G_CALLBACK (on_program_button_clicked));
+    gtk_builder_add_callback_symbol (Builder, "on_file_button_clicked", G_CALLBACK (on_file_button_clicked));
+    gtk_builder_add_callback_symbol (Builder, "on_cancel_button_clicked", G_CALLBACK (on_cancel_button_clicked));
+    gtk_builder_add_callback_symbol (Builder, "on_window_main_destroy", G_CALLBACK (on_window_main_destroy));
+    gtk_builder_add_callback_symbol (Builder, "on_close_button_clicked", G_CALLBACK (on_close_button_clicked));
+    gtk_builder_connect_signals(Builder, NULL);
+
+    g_object_unref(Builder);
+    gtk_widget_show(Window);                
+    Context = gtk_statusbar_get_context_id(StatusBar, "context");
+//
+// try to open PCIe device temporarily
+//
+	if ((fd = open("/dev/xdma0_user", O_RDWR)) == -1)
+    {
+        gtk_statusbar_push(StatusBar, Context, "No PCIe Driver");
+        DriverPresent = FALSE;
+    }
+    else
+    {
+        gtk_statusbar_push(StatusBar, Context, "Connected to /dev/xdma0_user");    
+        DriverPresent = TRUE;
+       	close(fd);
+    }
+    SetupSPIConfig();
+    FlashJobs = new FlashJobEngine_c(cfg, [](){ g_idle_add(OnFlashEvents, NULL); });
+    SetJobButtons(FALSE);
+
+    gtk_main();
+
+    delete FlashJobs;                       // cancels and waits for any job running
+    return 0;
+}
+
@@ -0,0 +1,778 @@
+//-----------------------------------------------------------------------------
+// Name: spi-s25fl.hpp
+// Description: Header file for module to implement spansion S25FL flash routines
+//-----------------------------------------------------------------------------
+
+#include "spi-s25fl.hpp"
+
+SPI_S25FL_c::~SPI_S25FL_c()
+{
+   // Clean up
+   XSpi_Stop(&mSPI);
+   XSpi_Reset(&mSPI);
+}
+
+/**
+ * @brief Initialize this object with hardware-specific settings
+ * 
+ * @param cfg: The configuration structure that describes the hardware 
+ */
+void SPI_S25FL_c::Init(const XSpi_Config& cfg)
+{
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+   // Store settings
+   mCfg = cfg;
+
+   int Status = XSpi_CfgInitialize(&mSPI, &mCfg, mCfg.BaseAddress);
+   if (Status != XST_SUCCESS)
+   {
+      throw std::runtime_error("Failed initializing flash library");
+   }
+
+   /*
+    * Set the SPI device as a master and in manual slave select mode such
+    * that the slave select signal does not toggle for every byte of a
+    * transfer, this must be done before the slave select is set.
+    */
+   Status = XSpi_SetOptions(&mSPI, XSP_MASTER_OPTION | XSP_MANUAL_SSELECT_OPTION);
+   if (Status != XST_SUCCESS)
+   {
+      throw std::runtime_error("Failed configuring flash library");
+   }
+
+   // We only have one slave
+   Status = XSpi_SetSlaveSelect(&mSPI, 1);
+   if (Status != XST_SUCCESS)
+   {
+      throw std::runtime_error("Failed configuring flash library");
+   }
+
+   // Get up and running, then disable interrupts before calling any other functions
+   XSpi_Start(&mSPI);
+   XSpi_IntrGlobalDisable(&mSPI);
+
+   // Find the erase granularity of the part fitted
+   ReadSectorSize();
+}
+
+/**
+ * @brief Register a callback function for flash status updates 
+ * 
+ * @param cb: The callback function to register 
+ */
+void SPI_S25FL_c::RegisterStatusCallback(const status_callback_t& cb)
+{
+   mCallBacks.push_back(cb);
+}
+
+/**
+ * @brief Erase a section of the flash. 
+ *  
+ * @note: Flash naturally erases on sector boundaries; this function doesn't attempt to 
+ * preserve data in a sector that isn't fully covered by addr, len 
+ * 
+ * @param addr: The Address to start erasing (will erase the entire sector containing this address) 
+ * @param len: The desired number of bytes to erase. 
+ */
+void SPI_S25FL_c::EraseRange(uint32_t addr, size_t len)
+{
+   // We don't support erase/write if not on an even sector boundary
+   CheckSectorAligned(addr);
+
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+   // Clear error bits
+   ClearStatusRegister();
+   // For now, no range checking. Just erase
+   size_t num_sectors_erased = 0;
+   size_t erased_bytes = 0;
+   StartProgress();
+   while (erased_bytes < len)
+   {
+      WriteEnable();
+      SectorErase(addr + erased_bytes);
+      erased_bytes += mSectorBytes;
+      SayProgress("Erased", std::min(erased_bytes, len), len);
+      num_sectors_erased++;
+   }
+
+   SayStatus("Erased " + std::to_string(num_sectors_erased) + " sectors", 1.0);
+
+
+   // For erase, because they take so long, we'll wait here to avoid skewing stats
+   WaitForFlashNotBusy(FLASH_ERASE_TIMEOUT_S);
+
+   // Check for errors
+   const auto stat = GetStatusRegister();
+   if (stat & SR_ANY_ERR_MASK)
+   {
+      SayStatus("Warning: Flash indicated an error while erasing");
+   }
+}
+
+/**
+ * @brief Write to flash 
+ * 
+ * @param flash_addr: First address to start writing to 
+ * @param src: Pointer to source data 
+ * @param len: Number of bytes to write 
+ */
+void SPI_S25FL_c::Write(uint32_t flash_addr, const uint8_t* src, const size_t len)
+{
+   size_t numwritten = 0;
+
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+   // ASSUME the proper locations have been erased
+
+   // Clear error bits
+   ClearStatusRegister();
+   StartProgress();
+
+   // We can write a page at a time. The flash only takes one page per program command,
+   // so the next page's command is built while the previous page is still programming:
+   // the busy wait is left to WriteEnable(), just before the flash is needed again.
+   while (numwritten < len)
+   {
+      // Write up to one page
+      const auto flash_page_bytes = FLASH_PAGE_BYTES;  // Needed to compile C++11/C++14. Fixed in C++17. See https://stackoverflow.com/questions/8016780/undefined-reference-to-static-constexpr-char
+      const size_t real_count = std::min(flash_page_bytes, len - numwritten);
+      ProgramPage(flash_addr, src + numwritten, real_count);
+
+      flash_addr += real_count;
+      numwritten += real_count;
+      // Report status
+      SayProgress("Wrote", numwritten, len);
+   }
+
+   // Check for errors
+   const auto stat = GetStatusRegister();
+   if (stat & SR_ANY_ERR_MASK)
+   {
+      SayStatus("Warning: Flash indicated an error while writing");
+   }
+
+}
+
+
+/**
+ * @brief Erase and write a region of flash in one pass
+ *
+ * @note: Each sector's erase is started, then the pages of it that need programming
+ * (those not all 0xFF) are found while it erases, and programmed as soon as it is done;
+ * then the next sector. As with EraseRange, the last sector is erased in full, even past len
+ *
+ * @param flash_addr: First address to write (must be on a sector boundary)
+ * @param src: Pointer to source data
+ * @param len: Number of bytes to write
+ */
+void SPI_S25FL_c::EraseWrite(uint32_t flash_addr, const uint8_t* src, const size_t len)
+{
+   CheckSectorAligned(flash_addr);
+
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+   std::vector<size_t> pages;
+   pages.reserve(mSectorBytes / FLASH_PAGE_BYTES);
+   size_t numdone = 0;
+
+   // Clear error bits
+   ClearStatusRegister();
+   StartProgress();
+
+   while (numdone < len)
+   {
+      // Start the sector erasing
+      const auto flash_page_bytes = FLASH_PAGE_BYTES;  // Copy needed to compile C++11/C++14, as in Write()
+      const size_t sector_count = std::min(mSectorBytes, len - numdone);
+      const uint32_t sector_addr = flash_addr + numdone;
+      WriteEnable();
+      SectorErase(sector_addr);
+
+      // Plan its pages while it erases
+      pages.clear();
+      for (size_t inx = 0; inx < sector_count; inx += FLASH_PAGE_BYTES)
+      {
+         if (!IsBlank(src + numdone + inx, std::min(flash_page_bytes, sector_count - inx)))
+         {
+            pages.push_back(inx);
+         }
+      }
+
+      // Program them. The first waits for the erase, each after for the page before
+      for (const size_t inx : pages)
+      {
+         SendPageProgram(sector_addr + inx, src + numdone + inx, std::min(flash_page_bytes, sector_count - inx));
+      }
+      numdone += sector_count;
+
+      // Report status
+      SayProgress("Erased and wrote", numdone, len);
+   }
+
+   // Check for errors
+   WaitForFlashNotBusy(FLASH_ERASE_TIMEOUT_S);
+   const auto stat = GetStatusRegister();
+   if (stat & SR_ANY_ERR_MASK)
+   {
+      SayStatus("Warning: Flash indicated an error while writing");
+   }
+}
+
+
+/**
+ * @brief Update flash to hold new data, rewriting only the sectors that differ
+ *
+ * @note: Each sector is read back and compared with the new data. A sector that differs is
+ * erased, unless the new data only clears bits, then programmed; a sector that matches is
+ * left alone. As with EraseRange, a rewritten sector is erased in full, even past len
+ *
+ * @param flash_addr: First address to update (must be on a sector boundary)
+ * @param src: Pointer to new data
+ * @param len: Number of bytes to update
+ * @return The number of sectors rewritten
+ */
+size_t SPI_S25FL_c::WriteChanged(uint32_t flash_addr, const uint8_t* src, const size_t len)
+{
+   // We don't support erase/write if not on an even sector boundary
+   CheckSectorAligned(flash_addr);
+
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+   std::vector<uint8_t> current(mSectorBytes);
+   size_t numchecked = 0;
+   size_t num_sectors_written = 0;
+
+   // Clear error bits
+   ClearStatusRegister();
+   StartProgress();
+
+   while (numchecked < len)
+   {
+      // Read back up to one sector
+      const auto flash_page_bytes = FLASH_PAGE_BYTES;  // Copy needed to compile C++11/C++14, as in Write()
+      const size_t sector_count = std::min(mSectorBytes, len - numchecked);
+      const uint32_t sector_addr = flash_addr + numchecked;
+      StartRead(sector_addr);
+      ContinueRead(current.data(), sector_count, true);
+
+      // Rewrite it if different. Programming can only clear bits, so erase unless that is all that's needed
+      if (memcmp(current.data(), src + numchecked, sector_count) != 0)
+      {
+         bool need_erase = false;
+         for (size_t xx = 0; xx < sector_count; xx++)
+         {
+            if ((current[xx] & src[numchecked + xx]) != src[numchecked + xx])
+            {
+               need_erase = true;
+               break;
+            }
+         }
+         if (need_erase)
+         {
+            WriteEnable();
+            SectorErase(sector_addr);
+         }
+         for (size_t inx = 0; inx < sector_count; inx += FLASH_PAGE_BYTES)
+         {
+            ProgramPage(sector_addr + inx, src + numchecked + inx, std::min(flash_page_bytes, sector_count - inx));
+         }
+         num_sectors_written++;
+      }
+
+      numchecked += sector_count;
+
+      // Report status
+      SayProgress("Checked", numchecked, len);
+   }
+
+   // Check for errors
+   WaitForFlashNotBusy(FLASH_ERASE_TIMEOUT_S);
+   const auto stat = GetStatusRegister();
+   if (stat & SR_ANY_ERR_MASK)
+   {
+      SayStatus("Warning: Flash indicated an error while writing");
+   }
+
+   return num_sectors_written;
+}
+
+
+/**
+ * @brief Read data from flash into buffer
+ * 
+ * @param flash_addr: Flash address to read from 
+ * @param dst: Buffer to place data from flash into 
+ * @param len: Number of bytes to read 
+ */
+void SPI_S25FL_c::Read(uint32_t flash_addr, uint8_t* dst, const size_t len)
+{
+   size_t numread = 0;
+
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+   if (0 == len)
+   {
+      return;
+   }
+
+   // One read command for the whole range; the data is received straight into dst
+   StartProgress();
+   StartRead(flash_addr);
+   while (numread < len)
+   {
+      // Read up to one chunk
+      const auto flash_read_chunk_bytes = FLASH_READ_CHUNK_BYTES;  // Needed to compile C++11/C++14, as in Write()
+      const size_t real_count = std::min(flash_read_chunk_bytes, len - numread);
+      ContinueRead(dst + numread, real_count, (numread + real_count) == len);
+
+      numread += real_count;
+
+      // Report status
+      SayProgress("Read", numread, len);
+   }
+}
+
+
+/**
+ * @brief Compare flash with a buffer, without reading the flash into a second buffer
+ *
+ * @param flash_addr: Flash address to compare from
+ * @param src: Data the flash should hold
+ * @param len: Number of bytes to compare
+ * @return true if the flash matches src
+ */
+bool SPI_S25FL_c::Verify(uint32_t flash_addr, const uint8_t* src, const size_t len)
+{
+   size_t numchecked = 0;
+
+   std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+   if (0 == len)
+   {
+      return true;
+   }
+
+   // One read command for the whole range, checked a chunk at a time
+   StartProgress();
+   StartRead(flash_addr);
+   while (numchecked < len)
+   {
+      const auto flash_read_chunk_bytes = FLASH_READ_CHUNK_BYTES;  // Needed to compile C++11/C++14, as in Write()
+      const size_t real_count = std::min(flash_read_chunk_bytes, len - numchecked);
+      const bool last = (numchecked + real_count) == len;
+      ContinueRead(mVerifyBuf, real_count, last);
+
+      if (memcmp(mVerifyBuf, src + numchecked, real_count) != 0)
+      {
+         // Find the first difference, finish the read command, then report it
+         size_t inx = 0;
+         while (mVerifyBuf[inx] == src[numchecked + inx])
+         {
+            inx++;
+         }
+         if (!last)
+         {
+            ContinueRead(mVerifyBuf, 1, true);
+         }
+         SayStatus("Verify failed at address " + std::to_string(flash_addr + numchecked + inx), static_cast<double>(numchecked + inx) / static_cast<double>(len));
+         return false;
+      }
+
+      numchecked += real_count;
+
+      // Report status
+      SayProgress("Verified", numchecked, len);
+   }
+   return true;
+}
+
+
+
+//-------------------------------------------------------------------------------------//
+// Private functions
+//-------------------------------------------------------------------------------------//
+
+
+//--------------------------------------------------------------------------------
+// GetStatusRegister
+// Reads status register and returns it
+//--------------------------------------------------------------------------------
+uint8_t SPI_S25FL_c::GetStatusRegister(void)
+{
+   // Special case- don't call execute
+   // Don't need to wait for flash to be un-busy before reading status register
+   uint8_t sendbuf[16];
+   uint8_t recvbuf[16];
+
+   sendbuf[0] = CMD_STATUSREG_READ;
+
+   // Execute
+   const int status = XSpi_Transfer(&mSPI, sendbuf, recvbuf, 2);
+   if (status != XST_SUCCESS)
+   {
+      throw std::runtime_error("SPI transaction failed getting status register code " + std::to_string((int)status));
+   }
+
+   return recvbuf[1];
+}
+
+
+//--------------------------------------------------------------------------------
+// ClearStatusRegister
+// Clears volatile/error bits in the status register
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::ClearStatusRegister(void)
+{
+   StartCommand(CMD_STATUSREG_CLEAR);
+   Execute(0);
+}
+
+
+
+//--------------------------------------------------------------------------------
+// WaitForFlashNotBusy
+// Waits up to wait_s seconds for flash to indicate it is done with the previous operation
+// Sleeps through most of the time the same kind of command took before, then polls the
+// status register, back to back at first and then with a growing sleep between polls
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::WaitForFlashNotBusy(double wait_s)
+{
+   // Get the current time
+   const auto start = std::chrono::steady_clock::now();
+   double& estimate = mBusyEstimate_s[mBusyKind];
+   const std::chrono::duration<double> so_far = start - mBusyStart;
+   const double first_sleep = (estimate * FLASH_FIRST_SLEEP_FRACTION) - so_far.count();
+   if (first_sleep >= FLASH_MIN_SLEEP_S)
+   {
+      std::this_thread::sleep_for(std::chrono::duration<double>(first_sleep));
+   }
+
+   double backoff = FLASH_MIN_POLL_S;
+   const double max_backoff = std::max(FLASH_MIN_SLEEP_S, estimate * FLASH_MAX_BACKOFF_FRACTION);
+   while (1)
+   {
+      if ((GetStatusRegister() & SR_IS_READY_MASK) == 0)
+      {
+         mFlashBusy = false;
+
+         // Learn how long this kind of command takes
+         const std::chrono::duration<double> busy = std::chrono::steady_clock::now() - mBusyStart;
+         estimate += (busy.count() - estimate) / 4.0;
+         break;
+      }
+
+      // Get the elapsed time in s
+      const std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+      if (dt.count() > wait_s)
+      {
+         throw std::runtime_error("Timeout waiting for flash ready");
+      }
+
+      // Short intervals are polled back to back: a sleep can't be that short
+      if (backoff >= FLASH_MIN_SLEEP_S)
+      {
+         std::this_thread::sleep_for(std::chrono::duration<double>(backoff));
+      }
+      backoff = std::min(backoff * 2.0, max_backoff);
+   }
+}
+
+//--------------------------------------------------------------------------------
+// StartCommand
+// Initialize the system in prep for sending a flash command
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::StartCommand(uint8_t cmd)
+{
+   mCurrWriteBufInx = 0;
+   mWriteBuf[mCurrWriteBufInx++] = cmd;
+}
+
+void SPI_S25FL_c::AddAddr(uint32_t addr)
+{
+   mWriteBuf[mCurrWriteBufInx++] = (uint8_t)(addr >> 24);
+   mWriteBuf[mCurrWriteBufInx++] = (uint8_t)(addr >> 16);
+   mWriteBuf[mCurrWriteBufInx++] = (uint8_t)(addr >> 8);
+   mWriteBuf[mCurrWriteBufInx++] = (uint8_t)(addr);
+}
+
+
+//--------------------------------------------------------------------------------
+// AddFromBuffer
+// Add len bytes from buf into transmit buffer to send to flash
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::AddFromBuffer(const uint8_t* buf, size_t len)
+{
+   if ((len + mCurrWriteBufInx) > TOTAL_BUFFER_SIZE)
+   {
+      throw std::runtime_error("Attempt to write too many bytes");
+   }
+
+   memcpy(mWriteBuf + mCurrWriteBufInx, buf, len);
+   mCurrWriteBufInx += len;
+}
+
+// Executes the command. Returns a pointer to read data.
+uint8_t* SPI_S25FL_c::Execute(size_t num2read, double timeout_s)
+{
+   if (0 == mCurrWriteBufInx)
+   {
+      throw std::runtime_error("No command specified");
+   }
+
+   if (((mCurrWriteBufInx - 1) + num2read) >= TOTAL_BUFFER_SIZE)
+   {
+      throw std::runtime_error("Attempt to read/write too many bytes");
+   }
+
+   // Make sure flash isn't busy. Only program, erase and status write leave it busy,
+   // so the status register is only polled after one of those
+   if (mFlashBusy)
+   {
+      WaitForFlashNotBusy(timeout_s);
+   }
+
+   // Execute
+   const int status = XSpi_Transfer(&mSPI, mWriteBuf, num2read ? mReadBuf : NULL, mCurrWriteBufInx + num2read);
+   if (status != XST_SUCCESS)
+   {
+      throw std::runtime_error("SPI transaction failed"
+                                 " code " + std::to_string((int)status) 
+                               + " cmd "  + std::to_string((int)mWriteBuf[0])
+                               );
+   }
+   mFlashBusy = LeavesFlashBusy(mWriteBuf[0]);
+   if (mFlashBusy)
+   {
+      mBusyStart = std::chrono::steady_clock::now();
+      mBusyKind = BusyKind(mWriteBuf[0]);
+   }
+
+   // Get the return value before zeroing index
+   const auto rez = num2read ? (mReadBuf + mCurrWriteBufInx) : NULL; 
+   mCurrWriteBufInx = 0;
+
+   // Return a pointer to the first byte read (if any)
+   return rez;
+}
+
+
+//--------------------------------------------------------------------------------
+// LeavesFlashBusy
+// True if the flash is busy for a while after command cmd
+//--------------------------------------------------------------------------------
+bool SPI_S25FL_c::LeavesFlashBusy(uint8_t cmd)
+{
+   return (cmd == CMD_PAGEPROGRAM_WRITE) || (cmd == CMD_SECTOR_ERASE) || (cmd == CMD_STATUSREG_WRITE);
+}
+
+
+//--------------------------------------------------------------------------------
+// WriteEnable
+// Spansion flash requires this to be sent before writing/erasing
+// Sent from its own buffer, so a command already built in the transmit buffer is kept
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::WriteEnable(void)
+{
+   uint8_t cmd = CMD_WRITE_ENABLE;
+
+   if (mFlashBusy)
+   {
+      WaitForFlashNotBusy(FLASH_DEFAULT_CMD_TIMEOUT_S);
+   }
+
+   const int status = XSpi_Transfer(&mSPI, &cmd, NULL, 1);
+   if (status != XST_SUCCESS)
+   {
+      throw std::runtime_error("SPI transaction failed sending write enable code " + std::to_string((int)status));
+   }
+}
+
+
+//--------------------------------------------------------------------------------
+// ProgramPage
+// Programs up to one page from src at flash_addr, skipping pages that are all 0xFF
+// Returns without waiting for the program to finish
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::ProgramPage(uint32_t flash_addr, const uint8_t* src, size_t len)
+{
+   // Optimize- skip whole pages of 0xFF
+   if (!IsBlank(src, len))
+   {
+      SendPageProgram(flash_addr, src, len);
+   }
+}
+
+
+//--------------------------------------------------------------------------------
+// SendPageProgram
+// Programs up to one page from src at flash_addr, without waiting for it to finish
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::SendPageProgram(uint32_t flash_addr, const uint8_t* src, size_t len)
+{
+   StartCommand(CMD_PAGEPROGRAM_WRITE);
+   AddAddr(flash_addr);
+   AddFromBuffer(src, len);
+   WriteEnable();
+   Execute(0);
+}
+
+
+//--------------------------------------------------------------------------------
+// IsBlank
+// True if len bytes at src are all 0xFF, as erased flash is
+//--------------------------------------------------------------------------------
+bool SPI_S25FL_c::IsBlank(const uint8_t* src, size_t len)
+{
+   for (size_t xx = 0; xx < len; xx++)
+   {
+      if (src[xx] != 0xFF)
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+
+//--------------------------------------------------------------------------------
+// BusyKind
+// Which kind of busy time a command that leaves the flash busy has, for WaitForFlashNotBusy
+//--------------------------------------------------------------------------------
+size_t SPI_S25FL_c::BusyKind(uint8_t cmd)
+{
+   if (cmd == CMD_PAGEPROGRAM_WRITE)
+   {
+      return BUSY_PROGRAM;
+   }
+   if (cmd == CMD_SECTOR_ERASE)
+   {
+      return BUSY_ERASE;
+   }
+   return BUSY_OTHER;
+}
+
+
+//--------------------------------------------------------------------------------
+// StartRead/ContinueRead
+// A read is one command, then as many bytes as wanted: the flash carries on across
+// page boundaries. StartRead sends the command; each ContinueRead then receives the
+// next len bytes into dst (which is also sent, as the flash ignores it), with the
+// last one ending the command
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::StartRead(uint32_t flash_addr)
+{
+   uint8_t cmd[FLASH_MAX_CMD_BYTES];
+
+   if (mFlashBusy)
+   {
+      WaitForFlashNotBusy(FLASH_DEFAULT_CMD_TIMEOUT_S);
+   }
+
+   cmd[0] = CMD_RANDOM_READ;
+   cmd[1] = (uint8_t)(flash_addr >> 24);
+   cmd[2] = (uint8_t)(flash_addr >> 16);
+   cmd[3] = (uint8_t)(flash_addr >> 8);
+   cmd[4] = (uint8_t)(flash_addr);
+   const int status = XSpi_TransferPart(&mSPI, cmd, NULL, FLASH_MAX_CMD_BYTES, FALSE);
+   if (status != XST_SUCCESS)
+   {
+      throw std::runtime_error("SPI transaction failed starting flash read code " + std::to_string((int)status));
+   }
+}
+
+void SPI_S25FL_c::ContinueRead(uint8_t* dst, size_t len, bool last)
+{
+   const int status = XSpi_TransferPart(&mSPI, dst, dst, len, last ? TRUE : FALSE);
+   if (status != XST_SUCCESS)
+   {
+      throw std::runtime_error("SPI transaction failed reading flash code " + std::to_string((int)status));
+   }
+}
+
+
+//--------------------------------------------------------------------------------
+// ReadSectorSize
+// Reads the flash ID to find the sector size, which is the erase granularity.
+// S25FL-S parts report their sector architecture: 0 for uniform 256K sectors.
+// Anything else is taken to have 64K sectors
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::ReadSectorSize(void)
+{
+   StartCommand(CMD_READ_ID);
+   const uint8_t* id = Execute(FLASH_ID_BYTES);
+   if ((id[0] == FLASH_SPANSION_ID) && (id[3] == FLASH_S_FAMILY_CFI_LEN) && (id[4] == FLASH_UNIFORM_256K_ARCH))
+   {
+      mSectorBytes = FLASH_LARGE_SECTOR_BYTES;
+   }
+   else
+   {
+      mSectorBytes = FLASH_SECTOR_BYTES;
+   }
+}
+
+
+//--------------------------------------------------------------------------------
+// CheckSectorAligned
+// Throws unless addr is on a sector boundary: erasing doesn't preserve the rest of a sector
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::CheckSectorAligned(uint32_t addr)
+{
+   if (addr & (mSectorBytes - 1))
+   {
+      throw std::runtime_error("Flash address must be on a sector boundary of " + std::to_string(mSectorBytes) + " bytes");
+   }
+}
+
+
+//--------------------------------------------------------------------------------
+// SectorErase
+// Erases the sector that contans address addr
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::SectorErase(u32 addr)
+{
+   StartCommand(CMD_SECTOR_ERASE);
+   AddAddr(addr);
+   Execute(0);
+}
+
+
+//--------------------------------------------------------------------------------
+// SayStatus
+// Report status to any registered callback functions
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::SayStatus(const std::string& msg, double pcnt_cplt)
+{
+   // Build a status structure
+   pgm_status_s stat;
+   stat.msg = msg;
+   stat.pcnt_cmplt = pcnt_cplt;
+
+   // Call all callbacks.
+   for (auto& cb : mCallBacks)
+   {
+      cb(stat);
+   }
+}
+
+
+//--------------------------------------------------------------------------------
+// StartProgress/SayProgress
+// Report progress of a long operation in whole percent steps, rather than for
+// every page or sector
+//--------------------------------------------------------------------------------
+void SPI_S25FL_c::StartProgress(void)
+{
+   mLastPercent = -1;
+}
+
+void SPI_S25FL_c::SayProgress(const char* action, size_t done, size_t total)
+{
+   const int percent = static_cast<int>((100 * done) / total);
+   if (percent != mLastPercent)
+   {
+      mLastPercent = percent;
+      SayStatus(std::string(action) + " " + std::to_string(done) + " bytes", static_cast<double>(done) / static_cast<double>(total));
+   }
+}
@@ -0,0 +1,353 @@
+//-----------------------------------------------------------------------------
+// Name: spi-s25fl.hpp
+// Description: Header file for module to implement spansion S25FL flash routines
+//-----------------------------------------------------------------------------
+#pragma once
+
+#include "xspi.h"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+//-------------------------------------------------------------------------------------//
+// Typedefs- should be common to all flash parts
+//-------------------------------------------------------------------------------------//
+
+struct pgm_status_s
+{
+   std::string msg;
+   double pcnt_cmplt = std::numeric_limits<double>::quiet_NaN();
+};
+
+typedef std::function<void(const pgm_status_s& stat)> status_callback_t;
+
+class SPI_S25FL_c
+{
+
+public:
+
+   ~SPI_S25FL_c();
+
+/**
+ * @brief Initialize this object with hardware-specific settings
+ * 
+ * @param cfg: The configuration structure that describes the hardware 
+ */
+   void Init(const XSpi_Config& cfg);
+
+/**
+ * @brief Register a callback function for flash status updates 
+ * 
+ * @param cb: The callback function to register 
+ */
+   void RegisterStatusCallback(const status_callback_t& cb);
+
+
+/**
+ * @brief Erase a section of the flash. 
+ *  
+ * @note: Flash naturally erases on sector boundaries; this function doesn't attempt to 
+ * preserve data in a sector that isn't fully covered by addr, len 
+ * 
+ * @param addr: The Address to start erasing (will erase the entire sector containing this address) 
+ * @param len: The desired number of bytes to erase. 
+ */
+   void EraseRange(uint32_t addr, size_t len);
+
+/**
+ * @brief Write to flash 
+ * 
+ * @param flash_addr: First address to start writing to 
+ * @param src: Pointer to source data 
+ * @param len: Number of bytes to write 
+ */
+   void Write(uint32_t flash_addr, const uint8_t* src, const size_t len);
+
+/**
+ * @brief Update flash to hold new data, rewriting only the sectors that differ
+ *
+ * @note: Each sector is read back and compared with the new data. A sector that differs is
+ * erased, unless the new data only clears bits, then programmed; a sector that matches is
+ * left alone. As with EraseRange, a rewritten sector is erased in full, even past len
+ *
+ * @param flash_addr: First address to update (must be on a sector boundary)
+ * @param src: Pointer to new data
+ * @param len: Number of bytes to update
+ * @return The number of sectors rewritten
+ */
+   size_t WriteChanged(uint32_t flash_addr, const uint8_t* src, const size_t len);
+
+/**
+ * @brief Erase and write a region of flash in one pass
+ *
+ * @note: Each sector's erase is started, then the pages of it that need programming
+ * (those not all 0xFF) are found while it erases, and programmed as soon as it is done;
+ * then the next sector. As with EraseRange, the last sector is erased in full, even past len
+ *
+ * @param flash_addr: First address to write (must be on a sector boundary)
+ * @param src: Pointer to source data
+ * @param len: Number of bytes to write
+ */
+   void EraseWrite(uint32_t flash_addr, const uint8_t* src, const size_t len);
+
+
+/**
+ * @brief Read data from flash into buffer
+ * 
+ * @param flash_addr: Flash address to read from 
+ * @param dst: Buffer to place data from flash into 
+ * @param len: Number of bytes to read 
+ */
+   void Read(uint32_t flash_addr, uint8_t* dst, const size_t len);
+
+/**
+ * @brief Compare flash with a buffer, without reading the flash into a second buffer
+ *
+ * @param flash_addr: Flash address to compare from
+ * @param src: Data the flash should hold
+ * @param len: Number of bytes to compare
+ * @return true if the flash matches src
+ */
+   bool Verify(uint32_t flash_addr, const uint8_t* src, const size_t len);
+
+
+
+private:
+
+   //-------------------------------------------------------------------------------------//
+   // Private functions
+   //-------------------------------------------------------------------------------------//
+
+
+//--------------------------------------------------------------------------------
+// GetStatusRegister
+// Reads status register and returns it
+//--------------------------------------------------------------------------------
+   uint8_t GetStatusRegister(void);
+
+
+//--------------------------------------------------------------------------------
+// ClearStatusRegister
+// Clears volatile/error bits in the status register
+//--------------------------------------------------------------------------------
+   void ClearStatusRegister(void);
+
+
+
+//--------------------------------------------------------------------------------
+// WaitForFlashNotBusy
+// Waits up to wait_s seconds for flash to indicate it is done with the previous operation
+// Sleeps through most of the time the same kind of command took before, then polls the
+// status register, back to back at first and then with a growing sleep between polls
+//--------------------------------------------------------------------------------
+   void WaitForFlashNotBusy(double wait_s);
+
+
+//--------------------------------------------------------------------------------
+// StartCommand
+// Initialize the system in prep for sending a flash command
+//--------------------------------------------------------------------------------
+   void StartCommand(uint8_t cmd);
+
+   void AddAddr(uint32_t addr);
+
+
+//--------------------------------------------------------------------------------
+// AddFromBuffer
+// Add len bytes from buf into transmit buffer to send to flash
+//--------------------------------------------------------------------------------
+   void AddFromBuffer(const uint8_t* buf, size_t len);
+
+   // Executes the command. Returns a pointer to read data.
+   uint8_t* Execute(size_t num2read, double timeout_s = FLASH_DEFAULT_CMD_TIMEOUT_S);
+
+
+//--------------------------------------------------------------------------------
+// LeavesFlashBusy
+// True if the flash is busy for a while after command cmd
+//--------------------------------------------------------------------------------
+   static bool LeavesFlashBusy(uint8_t cmd);
+
+
+//--------------------------------------------------------------------------------
+// WriteEnable
+// Spansion flash requires this to be sent before writing/erasing
+// Sent from its own buffer, so a command already built in the transmit buffer is kept
+//--------------------------------------------------------------------------------
+   void WriteEnable(void);
+
+
+//--------------------------------------------------------------------------------
+// ProgramPage
+// Programs up to one page from src at flash_addr, skipping pages that are all 0xFF
+// Returns without waiting for the program to finish
+//--------------------------------------------------------------------------------
+   void ProgramPage(uint32_t flash_addr, const uint8_t* src, size_t len);
+
+
+//--------------------------------------------------------------------------------
+// SendPageProgram
+// Programs up to one page from src at flash_addr, without waiting for it to finish
+//--------------------------------------------------------------------------------
+   void SendPageProgram(uint32_t flash_addr, const uint8_t* src, size_t len);
+
+
+//--------------------------------------------------------------------------------
+// IsBlank
+// True if len bytes at src are all 0xFF, as erased flash is
+//--------------------------------------------------------------------------------
+   static bool IsBlank(const uint8_t* src, size_t len);
+
+
+//--------------------------------------------------------------------------------
+// BusyKind
+// Which kind of busy time a command that leaves the flash busy has, for WaitForFlashNotBusy
+//--------------------------------------------------------------------------------
+   static size_t BusyKind(uint8_t cmd);
+
+
+//--------------------------------------------------------------------------------
+// StartRead/ContinueRead
+// A read is one command, then as many bytes as wanted: the flash carries on across
+// page boundaries. StartRead sends the command; each ContinueRead then receives the
+// next len bytes into dst (which is also sent, as the flash ignores it), with the
+// last one ending the command
+//--------------------------------------------------------------------------------
+   void StartRead(uint32_t flash_addr);
+   void ContinueRead(uint8_t* dst, size_t len, bool last);
+
+
+//--------------------------------------------------------------------------------
+// ReadSectorSize
+// Reads the flash ID to find the sector size, which is the erase granularity.
+// S25FL-S parts report their sector architecture: 0 for uniform 256K sectors.
+// Anything else is taken to have 64K sectors
+//--------------------------------------------------------------------------------
+   void ReadSectorSize(void);
+
+
+//--------------------------------------------------------------------------------
+// CheckSectorAligned
+// Throws unless addr is on a sector boundary: erasing doesn't preserve the rest of a sector
+//--------------------------------------------------------------------------------
+   void CheckSectorAligned(uint32_t addr);
+
+
+//--------------------------------------------------------------------------------
+// SectorErase
+// Erases the sector that contans address addr
+//--------------------------------------------------------------------------------
+   void SectorErase(u32 addr);
+
+
+//--------------------------------------------------------------------------------
+// SayStatus
+// Report status to any registered callback functions
+//--------------------------------------------------------------------------------
+   void SayStatus(const std::string& msg, double pcnt_cplt = std::numeric_limits<double>::quiet_NaN());
+
+
+//--------------------------------------------------------------------------------
+// StartProgress/SayProgress
+// Report progress of a long operation in whole percent steps, rather than for
+// every page or sector
+//--------------------------------------------------------------------------------
+   void StartProgress(void);
+   void SayProgress(const char* action, size_t done, size_t total);
+
+   //-------------------------------------------------------------------------------------//
+   // Private data
+   //-------------------------------------------------------------------------------------//
+
+   //-------------------------------------------------------------------------------------//
+   // Details of this flash
+
+   // Settings
+   static constexpr double FLASH_ERASE_TIMEOUT_S = 10.0; 
+   static constexpr double FLASH_DEFAULT_CMD_TIMEOUT_S = 10.0;
+
+   // Busy times of program and erase: first guesses, until WaitForFlashNotBusy has timed them
+   static constexpr double FLASH_PROGRAM_ESTIMATE_S = 0.0003;
+   static constexpr double FLASH_ERASE_ESTIMATE_S = 0.15;
+   static constexpr double FLASH_FIRST_SLEEP_FRACTION = 0.75;   // Of the expected busy time, slept before polling
+   static constexpr double FLASH_MAX_BACKOFF_FRACTION = 0.0625; // Of the expected busy time, the longest sleep between polls
+   static constexpr double FLASH_MIN_POLL_S = 0.00001;          // First interval between polls
+   static constexpr double FLASH_MIN_SLEEP_S = 0.0001;          // Shorter intervals are polled back to back
+   enum { BUSY_PROGRAM, BUSY_ERASE, BUSY_OTHER, BUSY_KINDS };
+
+   // Sizes
+   static constexpr size_t FLASH_PAGE_BYTES = 256;
+   static constexpr size_t FLASH_MAX_CMD_BYTES = 5;
+   static constexpr size_t FLASH_SECTOR_BYTES = 64 * 1024;        // Sector size of most parts
+   static constexpr size_t FLASH_LARGE_SECTOR_BYTES = 256 * 1024; // Sector size of uniform 256K sector S25FL-S parts
+   static constexpr size_t FLASH_ID_BYTES = 6;                    // Manufacturer, device ID, ID-CFI length, sector architecture, family
+   static constexpr size_t FLASH_READ_CHUNK_BYTES = 4096;         // Bytes read between progress reports and verify checks
+
+   // Commands. Note: All commands must use 4 byte addressing
+   static constexpr uint8_t CMD_RANDOM_READ       = 0x13;
+   static constexpr uint8_t CMD_PAGEPROGRAM_WRITE = 0x12;
+   static constexpr uint8_t CMD_WRITE_ENABLE	  = 0x06;
+   static constexpr uint8_t CMD_SECTOR_ERASE	  = 0xDC;
+   static constexpr uint8_t CMD_STATUSREG_READ    = 0x05;
+   static constexpr uint8_t CMD_STATUSREG_WRITE   = 0x01;
+   static constexpr uint8_t CMD_STATUSREG_CLEAR   = 0x30;
+   static constexpr uint8_t CMD_READ_ID           = 0x9F;
+
+   // ID values
+   static constexpr uint8_t FLASH_SPANSION_ID = 0x01;          // Manufacturer
+   static constexpr uint8_t FLASH_S_FAMILY_CFI_LEN = 0x4D;     // ID-CFI length of S25FL-S parts
+   static constexpr uint8_t FLASH_UNIFORM_256K_ARCH = 0x00;    // Sector architecture of uniform 256K sector parts
+
+   // Register defs
+   static constexpr uint8_t SR_IS_READY_MASK = 0x01; // D0 is 1 when busy
+   static constexpr uint8_t SR_E_ERR_MASK = 0x20;       // D5 is 1 if erase error
+   static constexpr uint8_t SR_P_ERR_MASK = 0x40;       // D6 is 1 if program error
+   static constexpr uint8_t SR_ANY_ERR_MASK = (SR_P_ERR_MASK | SR_E_ERR_MASK);  // Any error
+   //-------------------------------------------------------------------------------------//
+
+
+   // Mutex to make the API thread safe. Must be locked by any public functions
+   std::recursive_mutex mMutex;
+
+   // Registered callback functions
+   std::vector<status_callback_t> mCallBacks;
+
+   // Xilinx-like SPI access classes
+   XSpi_Config mCfg;
+   XSpi        mSPI;
+
+   // Buffers for interaction with Xilinx library
+   static constexpr size_t TOTAL_BUFFER_SIZE = FLASH_MAX_CMD_BYTES + FLASH_PAGE_BYTES;
+   uint8_t mWriteBuf[TOTAL_BUFFER_SIZE];
+   uint8_t mReadBuf[TOTAL_BUFFER_SIZE];
+   size_t mCurrWriteBufInx = 0;
+
+   // Buffer for one chunk of flash data being verified
+   uint8_t mVerifyBuf[FLASH_READ_CHUNK_BYTES];
+
+   // True after a command that leaves the flash busy, until the status register shows it is done.
+   // Starts true as no-one knows what the flash was last asked to do
+   bool mFlashBusy = true;
+
+   // Last percentage reported by SayProgress
+   int mLastPercent = -1;
+
+   // Sector size of the part fitted, found by Init
+   size_t mSectorBytes = FLASH_SECTOR_BYTES;
+
+   // When the last command that left the flash busy was sent, its kind, and how long each
+   // kind has taken, so WaitForFlashNotBusy can sleep through most of the wait
+   std::chrono::steady_clock::time_point mBusyStart = std::chrono::steady_clock::now();
+   size_t mBusyKind = BUSY_OTHER;
+   double mBusyEstimate_s[BUSY_KINDS] = {FLASH_PROGRAM_ESTIMATE_S, FLASH_ERASE_ESTIMATE_S, 0.0};
+
+};
+
+
+
+
@@ -0,0 +1,94 @@
+#include "xil_io.h"
+
+#include <unistd.h> // pread/pwrite
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+
+// Defined somewhere else
+extern const char* gAXI_FNAME;
+
+// The BAR is memory mapped on first use, so register accesses (eg each byte written
+// to the SPI transmit FIFO) are single loads and stores rather than syscalls.
+// The BAR size isn't known: the driver refuses a map larger than the BAR, so try
+// from 1MB downwards. Accesses outside the window, or if the map fails, use pread/pwrite.
+#define MAX_AXI_MAP_BYTES 0x100000
+#define MIN_AXI_MAP_BYTES 0x20000
+
+// Static data
+static int sfAXI = -1;
+static int sComplained = 0;
+static volatile u8* sAXIMap = NULL;
+static size_t sAXIMapBytes = 0;
+
+// Static functions
+static int CheckAndOpen(void)
+{
+   if (sfAXI < 0)
+   {
+      sfAXI = open(gAXI_FNAME, O_RDWR);
+      for (size_t map_bytes = MAX_AXI_MAP_BYTES; (sfAXI >= 0) && (map_bytes >= MIN_AXI_MAP_BYTES); map_bytes >>= 1)
+      {
+         void* map = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, sfAXI, 0);
+         if (map != MAP_FAILED)
+         {
+            sAXIMap = (volatile u8*)map;
+            sAXIMapBytes = map_bytes;
+            break;
+         }
+      }
+   }
+
+   if ((sfAXI < 0) && !sComplained)
+   {
+      printf("Error opening device %s:%s", gAXI_FNAME, strerror(errno));
+      sComplained = 1;
+   }
+
+   return (sfAXI >= 0);
+}
+
+//-------------------------------------------------------------------------------------------------
+// Xil_In32
+//-------------------------------------------------------------------------------------------------
+u32 Xil_In32(UINTPTR Addr)
+{
+   u32 rez = 0;
+   if(CheckAndOpen())
+   {
+      if (sAXIMap && ((Addr + sizeof(rez)) <= sAXIMapBytes))
+      {
+         return *(volatile u32*)(sAXIMap + Addr);
+      }
+      ssize_t nread = pread(sfAXI, &rez, sizeof(rez), (off_t) Addr);
+      if (nread != sizeof(rez))
+      {
+         printf("Error writing to device:%s", strerror(errno));
+      }
+   }
+   return rez;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Xil_In32
+//-------------------------------------------------------------------------------------------------
+void Xil_Out32(UINTPTR Addr, u32 Value)
+{
+   if(CheckAndOpen())
+   {
+      if (sAXIMap && ((Addr + sizeof(Value)) <= sAXIMapBytes))
+      {
+         *(volatile u32*)(sAXIMap + Addr) = Value;
+         return;
+      }
+      ssize_t nsent = pwrite(sfAXI, &Value, sizeof(Value), (off_t) Addr);
+      if (nsent != sizeof(Value))
+      {
+         printf("Error writing to device:%s", strerror(errno));
+      }
+   }
+}
+
@@ -0,0 +1,555 @@
+//
+// protocol 2 client load generator: soaks p2app the way Thetis drives it
+// Laurence Barker July 2022
+//
+// ./p2soak [-r <radio address>] [-d <DDCs>] [-s <KHz>] [-t <seconds>] [-c <KHz>] [-n] [-v]
+// sends the general, DDC specific, DUC specific and high priority packets, then
+// DUC I/Q (800/s) and speaker audio (750/s) at their real rates, and receives
+// every DDC, mic and high priority stream the radio sends back. -d DDCs (default 2,
+// max 10) are run at -s KHz (default 192) for -t seconds (default 10).
+// -n sends no DUC I/Q or speaker data (receive only); -v reports every second.
+// -c switches DDC0 to another rate half way through, to check the other DDCs carry
+// on without a glitch and DDC0's sequence numbers carry on (after the switch DDC0
+// is no longer timed).
+// at the end each stream's packets, losses, reordering, jitter and delay are printed.
+// Run with p2app's simulated FPGA (p2app -s -z ...) as a performance regression test:
+// the exit status is 1 if any stream lost or reordered packets.
+//
+// jitter is the RFC3550 interarrival jitter, against each packet's due time: the
+// sample number in a DDC packet's timestamp (enabled in the general packet), or the
+// sequence number for mic audio.
+// the radio and this machine share no clock, so the one way latency itself isn't
+// known: "delay" is each packet's lateness compared with the earliest packet of its
+// stream (queueing and scheduling delay). The start latency, from the run command
+// to the first DDC packet, is a true round trip.
+//
+
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define VNUMDDC 10
+#define VMAXSTREAMS (VNUMDDC + 2)
+#define VSTREAMHP VNUMDDC							// stream table: DDCs 0-9, then these
+#define VSTREAMMIC (VNUMDDC + 1)
+
+#define VPORTCOMMAND 1024							// radio's default ports
+#define VPORTDDCSPECIFIC 1025
+#define VPORTDUCSPECIFIC 1026
+#define VPORTHIGHPRIORITY 1027
+#define VPORTSPEAKER 1028
+#define VPORTDUCIQ 1029
+#define VPORTHPFROMSDR 1025							// source ports of the radio's streams
+#define VPORTMIC 1026
+#define VPORTDDC0 1035
+
+#define VGENERALSIZE 60
+#define VDDCSPECIFICSIZE 1444
+#define VDUCSPECIFICSIZE 60
+#define VHIGHPRIORITYSIZE 1444
+#define VDUCIQSIZE 1444
+#define VSPEAKERSIZE 260
+#define VDUCIQRATE 800								// packets/s: 240 samples at 192KHz
+#define VSPEAKERRATE 750							// packets/s: 64 samples at 48KHz
+#define VMICINTERVAL (64.0 / 48000.0)				// seconds per mic packet
+#define VHPINTERVAL 100								// ms between high priority packets
+#define VSPECIFICINTERVAL 1000						// ms between DDC & DUC specific packets
+#define VTICK 1000000								// send timer, ns
+
+#define VRECVBATCH 64
+#define VMAXPACKET 9000
+
+
+//
+// receive statistics for one stream
+//
+struct StreamStats
+{
+	bool Started;
+	uint32_t NextSequence;
+	uint64_t Packets;
+	uint64_t Bytes;
+	uint64_t Lost;
+	uint64_t Reordered;
+	bool Timed;										// true if packets have a due time
+	uint64_t TimedPackets;							// packets the transit times are from
+	double MinTransit;								// arrival - due time, s
+	double MaxTransit;
+	double SumTransit;
+	double LastTransit;
+	double Jitter;									// RFC3550 interarrival jitter, s
+	uint64_t LastPackets;							// for the per second report
+	uint64_t LastLost;
+};
+
+struct StreamStats Streams[VMAXSTREAMS];
+const char* StreamNames[VMAXSTREAMS] = {"DDC0", "DDC1", "DDC2", "DDC3", "DDC4", "DDC5",
+	"DDC6", "DDC7", "DDC8", "DDC9", "high priority", "mic"};
+
+int Socket;
+struct sockaddr_in RadioAddr;
+uint32_t DDCCount = 2;
+uint32_t DDCRate = 192;								// KHz
+uint32_t SwitchRate = 0;							// KHz DDC0 is switched to half way; 0 = none
+bool Switched = false;
+uint32_t SequenceOut[6];							// per outgoing port 1024-1029
+double RunTime;										// time the run command was sent
+double FirstDDCTime;								// arrival time of the first DDC packet, or 0
+
+static volatile sig_atomic_t StopRequested;
+
+static void StopHandler(int Signal)
+{
+	(void)Signal;
+	StopRequested = 1;
+}
+
+
+static void Usage(void)
+{
+	printf("usage: p2soak [-r <radio address>] [-d <DDCs>] [-s <KHz>] [-t <seconds>] [-c <KHz>] [-n] [-v]\n");
+}
+
+
+static double TimeNow(void)
+{
+	struct timespec Now;
+
+	clock_gettime(CLOCK_REALTIME, &Now);					// same clock as SO_TIMESTAMPNS
+	return Now.tv_sec + Now.tv_nsec * 1.0e-9;
+}
+
+
+//
+// send a packet to a radio port, with that port's sequence number
+//
+static void SendToRadio(uint8_t* Packet, uint32_t Length, uint16_t Port)
+{
+	uint32_t Sequence;
+
+	Sequence = htonl(SequenceOut[Port - VPORTCOMMAND]++);
+	memcpy(Packet, &Sequence, 4);
+	RadioAddr.sin_port = htons(Port);
+	if (sendto(Socket, Packet, Length, 0, (struct sockaddr*)&RadioAddr, sizeof(RadioAddr)) < 0)
+		perror("sendto");
+}
+
+
+//
+// general packet: default ports, no wideband, DDC timestamps on, watchdog enabled
+//
+static void SendGeneralPacket(void)
+{
+	uint8_t Packet[VGENERALSIZE];
+
+	memset(Packet, 0, sizeof(Packet));
+	Packet[37] = 1;									// timestamp DDC packets with their sample number
+	Packet[38] = 1;									// client activity timeout enabled
+	SequenceOut[0] = 0;
+	SendToRadio(Packet, sizeof(Packet), VPORTCOMMAND);
+}
+
+
+//
+// DDC specific: DDCCount DDCs from ADC1 at DDCRate, 24 bit samples;
+// once switched, DDC0 at SwitchRate
+//
+static void SendDDCSpecificPacket(void)
+{
+	uint8_t Packet[VDDCSPECIFICSIZE];
+	uint16_t Enables;
+	uint32_t DDC;
+
+	memset(Packet, 0, sizeof(Packet));
+	Packet[4] = 1;									// ADC count
+	Enables = (uint16_t)((1 << DDCCount) - 1);
+	Packet[7] = Enables & 0xFF;
+	Packet[8] = Enables >> 8;
+	for (DDC = 0; DDC < VNUMDDC; DDC++)
+	{
+		Packet[DDC * 6 + 17] = 0;					// ADC1
+		Packet[DDC * 6 + 18] = ((Switched && (DDC == 0)) ? SwitchRate : DDCRate) >> 8;
+		Packet[DDC * 6 + 19] = ((Switched && (DDC == 0)) ? SwitchRate : DDCRate) & 0xFF;
+		Packet[DDC * 6 + 22] = 24;
+	}
+	SendToRadio(Packet, sizeof(Packet), VPORTDDCSPECIFIC);
+}
+
+
+static void SendDUCSpecificPacket(void)
+{
+	uint8_t Packet[VDUCSPECIFICSIZE];
+
+	memset(Packet, 0, sizeof(Packet));
+	Packet[4] = 1;									// 1 DAC
+	SendToRadio(Packet, sizeof(Packet), VPORTDUCSPECIFIC);
+}
+
+
+//
+// high priority: run bit, no PTT, zero DDC frequencies
+//
+static void SendHighPriorityPacket(bool Run)
+{
+	uint8_t Packet[VHIGHPRIORITYSIZE];
+
+	memset(Packet, 0, sizeof(Packet));
+	Packet[4] = Run ? 1 : 0;
+	SendToRadio(Packet, sizeof(Packet), VPORTHIGHPRIORITY);
+}
+
+
+//
+// note a packet's arrival in its stream's statistics.
+// Due is its due time (s, arbitrary origin) if Timed
+//
+static void CountPacket(struct StreamStats* Stream, uint32_t Sequence, uint32_t Length, bool Timed, double Due, double Arrival)
+{
+	double Transit, Difference;
+
+	Stream->Packets++;
+	Stream->Bytes += Length;
+	if (!Stream->Started)
+	{
+		Stream->Started = true;
+		Stream->NextSequence = Sequence + 1;
+		Stream->Timed = Timed;
+		if (Timed)
+			Stream->MinTransit = Stream->MaxTransit = Stream->LastTransit = Arrival - Due;
+	}
+	else if ((int32_t)(Sequence - Stream->NextSequence) >= 0)
+	{
+		Stream->Lost += Sequence - Stream->NextSequence;
+		Stream->NextSequence = Sequence + 1;
+	}
+	else
+	{
+		Stream->Reordered++;						// counted as lost when its gap was seen
+		if (Stream->Lost != 0)
+			Stream->Lost--;
+	}
+	if (Timed && Stream->Timed)
+	{
+		Transit = Arrival - Due;
+		Stream->TimedPackets++;
+		if (Transit < Stream->MinTransit)
+			Stream->MinTransit = Transit;
+		if (Transit > Stream->MaxTransit)
+			Stream->MaxTransit = Transit;
+		Stream->SumTransit += Transit;
+		Difference = Transit - Stream->LastTransit;
+		if (Difference < 0)
+			Difference = -Difference;
+		Stream->Jitter += (Difference - Stream->Jitter) / 16.0;
+		Stream->LastTransit = Transit;
+	}
+}
+
+
+//
+// classify one packet from the radio by its source port
+//
+static void ReceivePacket(const uint8_t* Packet, uint32_t Length, uint16_t SourcePort, double Arrival)
+{
+	uint32_t Sequence;
+	uint64_t SampleNumber;
+	uint32_t Samples;
+	uint32_t DDC;
+
+	if (Length < 4)
+		return;
+	Sequence = ((uint32_t)Packet[0] << 24) | (Packet[1] << 16) | (Packet[2] << 8) | Packet[3];
+	if ((SourcePort >= VPORTDDC0) && (SourcePort < (VPORTDDC0 + VNUMDDC)) && (Length >= 16))
+	{
+		DDC = SourcePort - VPORTDDC0;
+		SampleNumber = 0;
+		for (int Cntr = 4; Cntr < 12; Cntr++)
+			SampleNumber = (SampleNumber << 8) | Packet[Cntr];
+		Samples = (Packet[14] << 8) | Packet[15];
+		if (SampleNumber == 0)						// no timestamp: assume whole frames, no gaps
+			SampleNumber = (uint64_t)Sequence * Samples;
+		if (FirstDDCTime == 0)
+			FirstDDCTime = Arrival;
+		CountPacket(Streams + DDC, Sequence, Length, !(Switched && (DDC == 0)), SampleNumber / (DDCRate * 1000.0), Arrival);
+	}
+	else if (SourcePort == VPORTMIC)
+		CountPacket(Streams + VSTREAMMIC, Sequence, Length, true, Sequence * VMICINTERVAL, Arrival);
+	else if (SourcePort == VPORTHPFROMSDR)
+		CountPacket(Streams + VSTREAMHP, Sequence, Length, false, 0, Arrival);
+}
+
+
+//
+// take all the waiting packets, with their kernel receive timestamps
+//
+static void ReceivePackets(void)
+{
+	static uint8_t Buffers[VRECVBATCH][VMAXPACKET];
+	static uint8_t Controls[VRECVBATCH][CMSG_SPACE(sizeof(struct timespec))];
+	struct mmsghdr Messages[VRECVBATCH];
+	struct iovec Vectors[VRECVBATCH];
+	struct sockaddr_in From[VRECVBATCH];
+	struct cmsghdr* Cmsg;
+	struct timespec* Stamp;
+	double Arrival;
+	int Count, Msg;
+
+	do
+	{
+		memset(Messages, 0, sizeof(Messages));
+		for (Msg = 0; Msg < VRECVBATCH; Msg++)
+		{
+			Vectors[Msg].iov_base = Buffers[Msg];
+			Vectors[Msg].iov_len = VMAXPACKET;
+			Messages[Msg].msg_hdr.msg_iov = Vectors + Msg;
+			Messages[Msg].msg_hdr.msg_iovlen = 1;
+			Messages[Msg].msg_hdr.msg_name = From + Msg;
+			Messages[Msg].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			Messages[Msg].msg_hdr.msg_control = Controls[Msg];
+			Messages[Msg].msg_hdr.msg_controllen = sizeof(Controls[Msg]);
+		}
+		Count = recvmmsg(Socket, Messages, VRECVBATCH, MSG_DONTWAIT, NULL);
+		for (Msg = 0; Msg < Count; Msg++)
+		{
+			if (From[Msg].sin_addr.s_addr != RadioAddr.sin_addr.s_addr)
+				continue;
+			Arrival = 0;
+			for (Cmsg = CMSG_FIRSTHDR(&Messages[Msg].msg_hdr); Cmsg != NULL; Cmsg = CMSG_NXTHDR(&Messages[Msg].msg_hdr, Cmsg))
+				if ((Cmsg->cmsg_level == SOL_SOCKET) && (Cmsg->cmsg_type == SCM_TIMESTAMPNS))
+				{
+					Stamp = (struct timespec*)CMSG_DATA(Cmsg);
+					Arrival = Stamp->tv_sec + Stamp->tv_nsec * 1.0e-9;
+				}
+			if (Arrival == 0)
+				Arrival = TimeNow();
+			ReceivePacket(Buffers[Msg], Messages[Msg].msg_len, ntohs(From[Msg].sin_port), Arrival);
+		}
+	} while (Count == VRECVBATCH);
+}
+
+
+//
+// one line per stream, for the streams seen
+//
+static void PrintReport(bool Final, double Seconds)
+{
+	struct StreamStats* Stream;
+	uint32_t Cntr;
+
+	for (Cntr = 0; Cntr < VMAXSTREAMS; Cntr++)
+	{
+		Stream = Streams + Cntr;
+		if (!Stream->Started)
+			continue;
+		if (!Final)
+			printf("%-14s %6llu pkt/s, %llu lost", StreamNames[Cntr],
+				(unsigned long long)(Stream->Packets - Stream->LastPackets),
+				(unsigned long long)(Stream->Lost - Stream->LastLost));
+		else
+			printf("%-14s %8llu packets (%.0f/s, %.2f MB/s), %llu lost, %llu reordered", StreamNames[Cntr],
+				(unsigned long long)Stream->Packets, Stream->Packets / Seconds, Stream->Bytes / Seconds / 1.0e6,
+				(unsigned long long)Stream->Lost, (unsigned long long)Stream->Reordered);
+		if (Stream->Timed)
+			printf(", jitter %.1fus, delay mean %.1fus max %.1fus", Stream->Jitter * 1.0e6,
+				(Stream->SumTransit / Stream->TimedPackets - Stream->MinTransit) * 1.0e6,
+				(Stream->MaxTransit - Stream->MinTransit) * 1.0e6);
+		printf("\n");
+		Stream->LastPackets = Stream->Packets;
+		Stream->LastLost = Stream->Lost;
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	uint8_t DUCIQPacket[VDUCIQSIZE];
+	uint8_t SpeakerPacket[VSPEAKERSIZE];
+	struct sockaddr_in LocalAddr;
+	struct itimerspec Timer;
+	struct pollfd PollFds[2];
+	int TimerFd;
+	int Yes = 1;
+	int BufferSize = 8 * 1024 * 1024;
+	bool SendTX = true;
+	bool Verbose = false;
+	int Seconds = 10;
+	double Start, Now, Elapsed;
+	uint64_t DUCSent = 0, SpeakerSent = 0;
+	uint64_t Ticks;
+	uint64_t LastHP = 0, LastSpecific = 0, LastReport = 0;
+	uint64_t Milliseconds;
+	bool Failed = false;
+	uint32_t Cntr;
+	int Opt;
+
+	memset(&RadioAddr, 0, sizeof(RadioAddr));
+	RadioAddr.sin_family = AF_INET;
+	RadioAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	while ((Opt = getopt(argc, argv, "r:d:s:t:c:nvh")) != -1)
+	{
+		switch (Opt)
+		{
+		case 'r':
+			if (inet_aton(optarg, &RadioAddr.sin_addr) == 0)
+			{
+				printf("bad radio address %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			DDCCount = atoi(optarg);
+			break;
+		case 's':
+			DDCRate = atoi(optarg);
+			break;
+		case 't':
+			Seconds = atoi(optarg);
+			break;
+		case 'c':
+			SwitchRate = atoi(optarg);
+			break;
+		case 'n':
+			SendTX = false;
+			break;
+		case 'v':
+			Verbose = true;
+			break;
+		default:
+			Usage();
+			return 0;
+		}
+	}
+	if ((DDCCount == 0) || (DDCCount > VNUMDDC) || (DDCRate < 12) || (DDCRate > 1536) || (Seconds <= 0)
+		|| ((SwitchRate != 0) && ((SwitchRate < 12) || (SwitchRate > 1536))))
+	{
+		Usage();
+		return 1;
+	}
+
+	Socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (Socket < 0)
+	{
+		perror("socket");
+		return 1;
+	}
+	setsockopt(Socket, SOL_SOCKET, SO_RCVBUFFORCE, &BufferSize, sizeof(BufferSize));
+	setsockopt(Socket, SOL_SOCKET, SO_RCVBUF, &BufferSize, sizeof(BufferSize));
+	setsockopt(Socket, SOL_SOCKET, SO_TIMESTAMPNS, &Yes, sizeof(Yes));
+	memset(&LocalAddr, 0, sizeof(LocalAddr));
+	LocalAddr.sin_family = AF_INET;
+	LocalAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(Socket, (struct sockaddr*)&LocalAddr, sizeof(LocalAddr)) < 0)
+	{
+		perror("bind");
+		return 1;
+	}
+	TimerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+	Timer.it_value.tv_sec = 0;
+	Timer.it_value.tv_nsec = VTICK;
+	Timer.it_interval = Timer.it_value;
+	timerfd_settime(TimerFd, 0, &Timer, NULL);
+	PollFds[0].fd = Socket;
+	PollFds[0].events = POLLIN;
+	PollFds[1].fd = TimerFd;
+	PollFds[1].events = POLLIN;
+	signal(SIGINT, StopHandler);
+	signal(SIGTERM, StopHandler);
+	memset(DUCIQPacket, 0, sizeof(DUCIQPacket));
+	memset(SpeakerPacket, 0, sizeof(SpeakerPacket));
+
+	printf("soaking %s: %d DDCs at %dKHz%s for %d seconds\n", inet_ntoa(RadioAddr.sin_addr),
+		DDCCount, DDCRate, SendTX ? ", DUC I/Q and speaker data" : "", Seconds);
+	SendGeneralPacket();
+	SendDDCSpecificPacket();
+	SendDUCSpecificPacket();
+	RunTime = TimeNow();
+	SendHighPriorityPacket(true);
+
+	Start = TimeNow();
+	while (!StopRequested)
+	{
+		if (poll(PollFds, 2, 100) <= 0)
+			continue;
+		if (PollFds[0].revents & POLLIN)
+			ReceivePackets();
+		if (!(PollFds[1].revents & POLLIN))
+			continue;
+		if (read(TimerFd, &Ticks, sizeof(Ticks)) != sizeof(Ticks))
+			continue;
+		Now = TimeNow();
+		Elapsed = Now - Start;
+		if (Elapsed >= Seconds)
+			break;
+		Milliseconds = (uint64_t)(Elapsed * 1000.0);
+		//
+		// streamed data at its real rate: catch up with what is due
+		//
+		while (SendTX && (DUCSent < (uint64_t)(Elapsed * VDUCIQRATE)))
+		{
+			SendToRadio(DUCIQPacket, sizeof(DUCIQPacket), VPORTDUCIQ);
+			DUCSent++;
+		}
+		while (SendTX && (SpeakerSent < (uint64_t)(Elapsed * VSPEAKERRATE)))
+		{
+			SendToRadio(SpeakerPacket, sizeof(SpeakerPacket), VPORTSPEAKER);
+			SpeakerSent++;
+		}
+		if ((Milliseconds - LastHP) >= VHPINTERVAL)
+		{
+			LastHP = Milliseconds;
+			SendHighPriorityPacket(true);
+		}
+		if ((SwitchRate != 0) && !Switched && (Elapsed >= Seconds / 2.0))
+		{
+			Switched = true;
+			printf("switching DDC0 to %dKHz\n", SwitchRate);
+			SendDDCSpecificPacket();
+		}
+		if ((Milliseconds - LastSpecific) >= VSPECIFICINTERVAL)
+		{
+			LastSpecific = Milliseconds;
+			SendDDCSpecificPacket();
+			SendDUCSpecificPacket();
+		}
+		if (Verbose && ((Milliseconds - LastReport) >= 1000))
+		{
+			LastReport = Milliseconds;
+			printf("---- %llus\n", (unsigned long long)(Milliseconds / 1000));
+			PrintReport(false, 1.0);
+		}
+	}
+	SendHighPriorityPacket(false);
+	Elapsed = TimeNow() - Start;
+	usleep(100000);									// take the packets already on their way
+	ReceivePackets();
+
+	printf("---- %.1f seconds; sent %llu DUC I/Q, %llu speaker packets\n", Elapsed,
+		(unsigned long long)DUCSent, (unsigned long long)SpeakerSent);
+	if (FirstDDCTime != 0)
+		printf("start latency (run command to 1st DDC packet) %.2fms\n", (FirstDDCTime - RunTime) * 1000.0);
+	else
+		printf("no DDC packets received\n");
+	PrintReport(true, Elapsed);
+	for (Cntr = 0; Cntr < VMAXSTREAMS; Cntr++)
+		if ((Streams[Cntr].Lost != 0) || (Streams[Cntr].Reordered != 0))
+			Failed = true;
+	if (FirstDDCTime == 0)
+		Failed = true;
+	close(TimerFd);
+	close(Socket);
+	return Failed ? 1 : 0;
+}
@@ -3,6 +3,11 @@
 // Laurence Barker July 2022
 //
 // ./spiadcread
+// reads each channel once
+// ./spiadcread -r <samples/s> [-d decimation] [-t seconds] [-o file]
+// samples all 8 channels continuously, in one block read per sample, and writes
+// the mean, min and max of each channel over every <decimation> samples as CSV
+// (to stdout if no file). Runs for <seconds>, or until ctrl-C if not given.
 //
 
 #define _DEFAULT_SOURCE
@@ -23,6 +28,9 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <signal.h>
+#include "../../sw_projects/common/hwaccess.h"
+#include "../../sw_projects/common/adcsampler.h"
 
 #define AXIBaseAddress 0x10000									// address of StreamRead/Writer IP
 
@@ -38,56 +46,105 @@ char* ChannelNames[] =
 	"Unused            "
 };
 
-//
-// mem read/write variables:
-//
-int register_fd;                             // device identifier
+static volatile sig_atomic_t StopRequested;
 
-//
-// 32 bit register write over the AXILite bus
-//
-void RegisterWrite(uint32_t Address, uint32_t Data)
+static void StopHandler(int Signal)
 {
-	ssize_t nsent = pwrite(register_fd, &Data, sizeof(Data), (off_t)Address);
-	if (nsent != sizeof(Data))
-		printf("ERROR: Write: addr=0x%08X   error=%s\n", Address, strerror(errno));
+	(void)Signal;
+	StopRequested = 1;
 }
 
 
-uint32_t RegisterRead(uint32_t Address)
+//
+// write one decimated reading as a CSV line
+//
+static void WriteReading(const struct AuxADCReading* Reading, void* Context)
 {
-	uint32_t result = 0;
+	FILE* File = (FILE*)Context;
+	uint32_t Cntr;
 
-	ssize_t nread = pread(register_fd, &result, sizeof(result), (off_t)Address);
-	if (nread != sizeof(result))
-		printf("ERROR: register read: addr=0x%08X   error=%s\n", Address, strerror(errno));
-	return result;
+	fprintf(File, "%.6f,%u,%u", Reading->Time * 1.0E-9, Reading->Samples, Reading->Overruns);
+	for (Cntr = 0; Cntr < VMAXAUXADCCHANNELS; Cntr++)
+		fprintf(File, ",%.2f,%u,%u", Reading->Mean[Cntr], Reading->Min[Cntr], Reading->Max[Cntr]);
+	fprintf(File, "\n");
 }
 
 
+//
+// continuous sampling until the time is up or ctrl-C
+//
+static int SampleContinuously(uint32_t Rate, uint32_t Decimation, uint32_t Seconds, FILE* File)
+{
+	struct AuxADCSampler Sampler;
+	uint32_t Cntr;
+	uint32_t Ticks = 0;
+
+	signal(SIGINT, StopHandler);
+	fprintf(File, "time,samples,overruns");
+	for (Cntr = 0; Cntr < VMAXAUXADCCHANNELS; Cntr++)
+		fprintf(File, ",ch%d_mean,ch%d_min,ch%d_max", Cntr, Cntr, Cntr);
+	fprintf(File, "\n");
+	if (StartAuxADCSampler(&Sampler, Rate, Decimation, VMAXAUXADCCHANNELS, WriteReading, File))
+		return 1;
+	while (!StopRequested && ((Seconds == 0) || (Ticks < Seconds * 10)))
+	{
+		usleep(100000);
+		Ticks++;
+	}
+	StopAuxADCSampler(&Sampler);
+	fflush(File);
+	fprintf(stderr, "%d sample times missed\n", Sampler.Overruns);
+	return 0;
+}
+
 
 //
 // main program
 //
-int main(void)
+int main(int argc, char *argv[])
 {
 	uint32_t RegisterValue;
 	uint32_t RegisterAddress;
 	uint32_t Cntr;
+	uint32_t Rate = 0;
+	uint32_t Decimation = 100;
+	uint32_t Seconds = 0;
+	FILE* File = stdout;
+	int Option;
+	int Result = 0;
+
+	while ((Option = getopt(argc, argv, "r:d:t:o:")) != -1)
+	{
+		switch (Option)
+		{
+			case 'r':
+				Rate = atoi(optarg);
+				break;
+			case 'd':
+				Decimation = atoi(optarg);
+				break;
+			case 't':
+				Seconds = atoi(optarg);
+				break;
+			case 'o':
+				File = fopen(optarg, "w");
+				if (File == NULL)
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				printf("usage: spiadcread [-r samples/s [-d decimation] [-t seconds] [-o file]]\n");
+				return 1;
+		}
+	}
 
 	//
 	// try to open memory device
 	//
-	if ((register_fd = open("/dev/xdma0_user", O_RDWR)) == -1)
-	{
-		printf("register R/W address space not available\n");
+	if (OpenXDMADriver() == 0)
 		goto out;
-	}
-	else
-	{
-		printf("register access connected to /dev/xdma0_user\n");
-
-	}
 
 
 	//
@@ -96,6 +153,14 @@ int main(void)
 	RegisterValue = RegisterRead(0x4004);				// read the user access register
 	printf("User register = %08x\n", RegisterValue);
 
+	if (Rate != 0)
+	{
+		Result = SampleContinuously(Rate, Decimation, Seconds, File);
+		if (File != stdout)
+			fclose(File);
+		goto out;
+	}
+
 	//
 	// read registers
 	//
@@ -111,6 +176,7 @@ int main(void)
 	//
 	// close down. Deallocate memory and close files
 	//
-out:	close(register_fd);
+out:	CloseXDMADriver();
+	return Result;
 }
 
@@ -5,9 +5,21 @@
 // Includes
 #include "spi-s25fl.hpp"
 
+#include "sha256.hpp"
+
 #include <getopt.h>
+#include <array>
+#include <condition_variable>
 #include <cstdlib>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 
 // This is ugly, but a side effect of reusing Xilinx code
@@ -16,92 +28,207 @@
 const char* gAXI_FNAME = "/dev/xdma/card0/user";
 
 
+/**
+ * @brief Build the table used to decode hex characters
+ * @return Table of the value of each character, or -1 if not a hex digit
+ */
+static std::array<int8_t, 256> MakeHexTable(void)
+{
+   std::array<int8_t, 256> table;
+   table.fill(-1);
+   for (int i = 0; i < 10; i++)
+   {
+      table['0' + i] = i;
+   }
+   for (int i = 0; i < 6; i++)
+   {
+      table['a' + i] = 10 + i;
+      table['A' + i] = 10 + i;
+   }
+   return table;
+}
+
+static const std::array<int8_t, 256> sHexTable = MakeHexTable();
+
+
 /**
  * @brief Parse 2 character literal as hex byte
  * @return The byte
  */
-static unsigned char readHexByte(char *data)
+static inline unsigned char readHexByte(const char *data)
 {
-   int val = 0;
-   if (data[0] >= '0' && data[0] <= '9'){val = (val + (data[0] - '0')) << 4;}
-   else if (data[0] >= 'a' && data[0] <= 'f'){val = (val + ((data[0] - 'a') + 10)) << 4;}
-   else if (data[0] >= 'A' && data[0] <= 'F'){val = (val + ((data[0] - 'A') + 10)) << 4;}
-   else{throw std::runtime_error("Invalid character in file");}
-
-   if (data[1] >= '0' && data[1] <= '9'){val = val + (data[1] - '0');}
-   else if (data[1] >= 'a' && data[1] <= 'f'){val = val + ((data[1] - 'a') + 10);}
-   else if (data[1] >= 'A' && data[1] <= 'F'){val = val + ((data[1] - 'A') + 10);}
-   else{throw std::runtime_error("Invalid character in file");}
-
-   return val;
+   const int hi = sHexTable[(unsigned char)data[0]];
+   const int lo = sHexTable[(unsigned char)data[1]];
+   if ((hi | lo) < 0)
+   {
+      throw std::runtime_error("Invalid character in file");
+   }
+
+   return (unsigned char)((hi << 4) | lo);
+}
+
+
+/**
+ * @brief A file mapped read only into memory; unmapped when it goes out of scope
+ */
+class MappedFile_c
+{
+public:
+   explicit MappedFile_c(const char* fname)
+   {
+      const int fd = open(fname, O_RDONLY);
+      struct stat st;
+      if ((fd < 0) || (fstat(fd, &st) != 0))
+      {
+         char msg[256];
+         snprintf(msg, sizeof(msg), "Failed to open %s:%s\n", fname, strerror(errno));
+         if (fd >= 0)
+         {
+            close(fd);
+         }
+         throw std::runtime_error(std::string(msg));
+      }
+
+      mSize = st.st_size;
+      if (mSize)
+      {
+         void* map = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (map == MAP_FAILED)
+         {
+            close(fd);
+            throw std::runtime_error(std::string("Failed to map ") + fname + ":" + strerror(errno));
+         }
+         mData = static_cast<const char*>(map);
+         madvise(map, mSize, MADV_SEQUENTIAL);
+      }
+      close(fd);
+   }
+
+   ~MappedFile_c()
+   {
+      if (mData)
+      {
+         munmap(const_cast<char*>(mData), mSize);
+      }
+   }
+
+   MappedFile_c(const MappedFile_c&) = delete;
+   MappedFile_c& operator=(const MappedFile_c&) = delete;
+
+   const char* mData = NULL;
+   size_t mSize = 0;
+};
+
+
+/**
+ * @brief One MCS (Intel hex) record, found by NextMCSRecord
+ */
+struct mcs_record_s
+{
+   int length;
+   int offset;
+   int type;
+   const char* data;       // hex characters of the data bytes
+};
+
+
+/**
+ * @brief Find the next record in MCS text
+ * @param p: Where to start looking; updated to the start of the following line
+ * @param end: End of the text
+ * @param rec: The record found
+ * @return true if a record was found, false at the end of the text
+ */
+static bool NextMCSRecord(const char*& p, const char* end, mcs_record_s& rec)
+{
+   while (p < end)
+   {
+      const char* line = p;
+      const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+      p = eol ? eol + 1 : end;
+
+      if (line[0] == ':')
+      {
+         if ((p - line) < 11)
+         {
+            throw std::runtime_error("Truncated record in file");
+         }
+         rec.length = readHexByte(line + 1);
+         rec.offset = (readHexByte(line + 3) << 8) | readHexByte(line + 5);
+         rec.type = readHexByte(line + 7);
+         rec.data = line + 9;
+         if ((rec.data + rec.length * 2) > p)
+         {
+            throw std::runtime_error("Truncated record in file");
+         }
+         return true;
+      }
+   }
+   return false;
 }
 
 
 /**
  * @brief Load a MCS file into memory for programming
+ * @note: The file is mapped and scanned once to find the highest address, so the result
+ * can be allocated once and filled with 0xFF; then the data records are decoded into it
  * @return Raw data to program
  */
 static std::vector<uint8_t> LoadMCS(const char *fname)
 {
-   std::vector<uint8_t> rez;
-   FILE *inmc = fopen(fname, "rb");
-   char *line;
-   char lineBuf[1024];
-   int curline = 0;
-   int len = 0;
-   int lastReport = 0;
-   int address_high = 0;
-   int lba = 0;
-   while ((line = fgets(lineBuf, 1024, inmc)))
+   MappedFile_c file(fname);
+   const char* const end = file.mData + file.mSize;
+   const char* p;
+   mcs_record_s rec;
+   size_t len = 0;
+   uint32_t lba = 0;
+
+   // Find the length
+   p = file.mData;
+   while (NextMCSRecord(p, end, rec) && (rec.type != 1))
    {
-      if (line[0] == ':')
+      if (rec.type == 4)
+      {
+         lba = ((uint32_t)readHexByte(rec.data) << 24) | (readHexByte(rec.data + 2) << 16);
+      }
+      else if (rec.type == 0)
       {
-         // Valid MCS
-         int length = readHexByte(line + 1);
-         int off_hi = readHexByte(line + 3);
-         int off_lo = readHexByte(line + 5);
-         int recordType = readHexByte(line + 7);
+         len = std::max(len, static_cast<size_t>(lba | rec.offset) + rec.length);
+      }
+   }
 
-         if (recordType == 4)
+   // Decode the data records into place
+   std::vector<uint8_t> rez(len, 0xFF);
+   size_t next = 0;
+   uint32_t address_high = 0;
+   lba = 0;
+   p = file.mData;
+   while (NextMCSRecord(p, end, rec) && (rec.type != 1))
+   {
+      if (rec.type == 4)
+      {
+         // Gap in data - new lba
+         lba = ((uint32_t)readHexByte(rec.data) << 24) | (readHexByte(rec.data + 2) << 16);
+         printf("Was %08x now %08x\n", address_high, lba);
+         address_high = lba;
+      }
+      else if (rec.type == 0)
+      {
+         const size_t addr = lba | rec.offset;
+         if (addr > next)
          {
-            // Gap in data - new lba
-            int lba_hi = readHexByte(line + 9);
-            int lba_lo = readHexByte(line + 11);
-            lba = (lba_hi << 24) | (lba_lo << 16);
-            printf("Was %08x now %08x\n", address_high, lba);
-            address_high = lba;
+            printf("Skipped %zu bytes from %08zx to %08zx\n", addr - next, next, addr);
          }
-         if (recordType == 0)
+         uint8_t* dst = rez.data() + addr;
+         for (int i = 0; i < rec.length; i++)
          {
-            int skip = 0;
-            while ((lba | ((off_hi << 8) | off_lo)) > len)
-            {
-               unsigned char fill = 0xFF;
-               rez.push_back(fill);
-               len++;
-               skip++;
-            }
-            if (skip > 0)
-            {
-               printf("Skipped %i bytes from %08x to %08x\n", skip, len - skip, len);
-            }
-            for (int i = 0; i < length; i++)
-            {
-               unsigned char byte = readHexByte(line + 9 + i * 2);
-               rez.push_back(byte);
-            }
-            len += length;
-            if (len - lastReport > 1024)
-            {
-               lastReport = len;
-            }
+            dst[i] = readHexByte(rec.data + i * 2);
          }
+         next = addr + rec.length;
       }
-      curline++;
    }
-   fclose(inmc);
-   return rez;
 
+   return rez;
 }
 
 /**
@@ -112,51 +239,462 @@ static std::vector<uint8_t> LoadMCS(const char *fname)
  */
 static std::vector<uint8_t> LoadBin(const char* fname, long int aOffset, long int aLen)
 {
-   // Load file data into a vector
-   std::vector<uint8_t> rez(aLen);
-   FILE* fp = fopen(fname, "rb");
-   if (fp)
+   // Map the file
+   MappedFile_c file(fname);
+   const long int fsize = file.mSize;
+
+   // Seek to the desired offset
+   if (aOffset >= fsize)
+   {
+      throw std::runtime_error("File offset index exceeds file size");
+   }
+
+   // Compute the number of bytes to program
+   if ((0 == aLen) || (aLen > (fsize - aOffset)))
    {
-      // obtain file size
-      fseek (fp, 0, SEEK_END);
-      const auto fsize = ftell(fp);
+      // Whole file, or as much as there is
+      aLen = fsize - aOffset;
+   }
+
+   // Copy into rez
+   return std::vector<uint8_t>(file.mData + aOffset, file.mData + aOffset + aLen);
+}
+
+
+//-------------------------------------------------------------------------------------//
+// Network update
+//
+// The service (-n) takes one image at a time over TCP and programs it as it arrives.
+// The client (-s) sends a header then the image:
+//   "SPIU", image length (4 bytes, big endian), digest of the image (32 bytes)
+// The digest is HMAC-SHA256 keyed with the shared key file (-k), or a plain SHA-256
+// if there is no key. The service replies with one line of text, "OK ..." or "ERROR ...".
+//
+// The first UPDATE_HOLD_BYTES of the image are erased at the start, so the old image
+// can no longer boot, but kept in memory and only programmed once the whole image has
+// arrived and its digest matches. An image that is cut short, or not signed with the
+// key, is never left bootable.
+//-------------------------------------------------------------------------------------//
+
+static constexpr uint16_t UPDATE_DEFAULT_PORT = 50120;
+static constexpr size_t UPDATE_HEADER_BYTES = 40;
+static constexpr size_t UPDATE_CHUNK_BYTES = 64 * 1024;         // Received at a time; one flash sector
+static constexpr size_t UPDATE_QUEUED_CHUNKS = 16;              // Received ahead of programming
+static constexpr size_t UPDATE_HOLD_BYTES = 256 * 1024;         // Largest sector size of the parts in use
+static constexpr size_t UPDATE_MAX_BYTES = 32 * 1024 * 1024;    // Size of the largest part in use
+static constexpr int UPDATE_RECEIVE_TIMEOUT_S = 10;
 
-      // Seek to the desired offset
-      if (aOffset >= fsize)
+
+/**
+ * @brief Chunks of an image passed from the receiving thread to the programming one
+ */
+class ChunkQueue_c
+{
+public:
+   // Called by the receiver. Returns false if the programmer has given up
+   bool Push(std::vector<uint8_t>&& chunk)
+   {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mSpace.wait(lock, [this] { return (mChunks.size() < UPDATE_QUEUED_CHUNKS) || mClosed; });
+      if (mClosed)
       {
-         throw std::runtime_error("File offset index exceeds file size");
+         return false;
       }
+      mChunks.push_back(std::move(chunk));
+      mReady.notify_one();
+      return true;
+   }
 
-      // OK seek to desired offset.
-      fseek(fp, aOffset, SEEK_SET);
+   // Called by the receiver when it has no more to send, having finished or failed
+   void Finish(void)
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mFinished = true;
+      mReady.notify_one();
+   }
 
-      // Compute the number of bytes to program
-      if (0 == aLen)
+   // Called by the programmer. Returns false once all chunks have been taken
+   bool Pop(std::vector<uint8_t>& chunk)
+   {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mReady.wait(lock, [this] { return !mChunks.empty() || mFinished; });
+      if (mChunks.empty())
       {
-         // Whole file
-         aLen = fsize - aOffset;
+         return false;
       }
+      chunk = std::move(mChunks.front());
+      mChunks.pop_front();
+      mSpace.notify_one();
+      return true;
+   }
+
+   // Called by the programmer if it gives up, to release the receiver
+   void Close(void)
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mClosed = true;
+      mSpace.notify_one();
+   }
+
+private:
+   std::mutex mMutex;
+   std::condition_variable mReady;
+   std::condition_variable mSpace;
+   std::deque<std::vector<uint8_t>> mChunks;
+   bool mFinished = false;
+   bool mClosed = false;
+};
 
-      // Read into rez
-      rez.resize(aLen);
-      const size_t num_read = fread(rez.data(), 1, aLen, fp);
-      rez.resize(num_read);
 
-      // Done
-      fclose(fp);
+/**
+ * @brief Receive exactly len bytes from a socket
+ */
+static void RecvAll(int fd, uint8_t* dst, size_t len)
+{
+   while (len)
+   {
+      const ssize_t count = recv(fd, dst, len, 0);
+      if (count == 0)
+      {
+         throw std::runtime_error("Connection closed before the image was complete");
+      }
+      if (count < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         throw std::runtime_error(std::string("Receive failed:") + strerror(errno));
+      }
+      dst += count;
+      len -= count;
    }
-   else
+}
+
+
+/**
+ * @brief Send all of len bytes to a socket
+ */
+static void SendAll(int fd, const uint8_t* src, size_t len)
+{
+   while (len)
    {
-      char msg[256];
-      snprintf(msg, sizeof(msg), "Failed to open %s:%s\n", fname, strerror(errno));
-      throw std::runtime_error(std::string(msg));
+      const ssize_t count = send(fd, src, len, MSG_NOSIGNAL);
+      if (count < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         throw std::runtime_error(std::string("Send failed:") + strerror(errno));
+      }
+      src += count;
+      len -= count;
    }
+}
 
-   return rez;
 
+/**
+ * @brief Compare digests, taking the same time wherever they differ
+ */
+static bool DigestsMatch(const sha256_digest_t& a, const sha256_digest_t& b)
+{
+   uint8_t diff = 0;
+   for (size_t i = 0; i < a.size(); i++)
+   {
+      diff |= a[i] ^ b[i];
+   }
+   return diff == 0;
+}
+
+
+/**
+ * @brief Load the key shared by the service and its clients: the whole of the file
+ */
+static std::vector<uint8_t> LoadKey(const char* fname)
+{
+   MappedFile_c file(fname);
+   if (file.mSize == 0)
+   {
+      throw std::runtime_error(std::string("Key file ") + fname + " is empty");
+   }
+   return std::vector<uint8_t>(file.mData, file.mData + file.mSize);
+}
+
+
+/**
+ * @brief Receive one image from a client and program it
+ *
+ * @note: A receiving thread reads the socket and hashes the data while this thread
+ * erases and programs, so the network, erase and program times overlap
+ *
+ * @param fd: Connected socket
+ * @param flash_addr: Where the image goes
+ * @return Text of the reply to the client
+ */
+static std::string ReceiveUpdate(SPI_S25FL_c& fifc, int fd, uint32_t flash_addr, const std::vector<uint8_t>& key, bool verify)
+{
+   // A client that stops sending gives up the service, rather than holding it
+   struct timeval tv = {UPDATE_RECEIVE_TIMEOUT_S, 0};
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   // Header
+   uint8_t header[UPDATE_HEADER_BYTES];
+   RecvAll(fd, header, sizeof(header));
+   if (memcmp(header, "SPIU", 4) != 0)
+   {
+      throw std::runtime_error("Not an update header");
+   }
+   const size_t len = (static_cast<size_t>(header[4]) << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+   sha256_digest_t expected;
+   memcpy(expected.data(), header + 8, expected.size());
+   if ((len == 0) || (len > UPDATE_MAX_BYTES) || ((flash_addr + len) > UPDATE_MAX_BYTES))
+   {
+      throw std::runtime_error("Image of " + std::to_string(len) + " bytes doesn't fit the flash");
+   }
+   printf("\nReceiving %zu bytes for flash[%u]...\n", len, flash_addr);
+
+   // Receive and hash in a thread of its own
+   ChunkQueue_c queue;
+   HMAC_SHA256_c hash(key);
+   std::exception_ptr rx_error;
+   std::thread receiver([&]
+   {
+      try
+      {
+         for (size_t received = 0; received < len;)
+         {
+            std::vector<uint8_t> chunk(std::min(UPDATE_CHUNK_BYTES, len - received));
+            RecvAll(fd, chunk.data(), chunk.size());
+            hash.Update(chunk.data(), chunk.size());
+            received += chunk.size();
+            if (!queue.Push(std::move(chunk)))
+            {
+               break;
+            }
+         }
+      }
+      catch (...)
+      {
+         rx_error = std::current_exception();
+      }
+      queue.Finish();
+   });
+
+   const auto start = std::chrono::steady_clock::now();
+   std::vector<uint8_t> held;
+   try
+   {
+      // Stop the old image booting, then stream the rest behind the held part
+      const size_t hold_len = std::min(UPDATE_HOLD_BYTES, len);
+      fifc.EraseRange(flash_addr, hold_len);
+      fifc.StartStream(flash_addr + UPDATE_HOLD_BYTES, len - hold_len);
+
+      std::vector<uint8_t> chunk;
+      while (queue.Pop(chunk))
+      {
+         size_t used = 0;
+         if (held.size() < hold_len)
+         {
+            used = std::min(hold_len - held.size(), chunk.size());
+            held.insert(held.end(), chunk.begin(), chunk.begin() + used);
+         }
+         if (used < chunk.size())
+         {
+            fifc.StreamWrite(chunk.data() + used, chunk.size() - used);
+         }
+      }
+      fifc.EndStream();
+   }
+   catch (...)
+   {
+      // Release the receiver: out of the queue, and out of the socket
+      queue.Close();
+      shutdown(fd, SHUT_RD);
+      receiver.join();
+      throw;
+   }
+   receiver.join();
+   if (rx_error)
+   {
+      std::rethrow_exception(rx_error);
+   }
+
+   // Only a signed image is made bootable
+   if (!DigestsMatch(hash.Final(), expected))
+   {
+      throw std::runtime_error("Digest doesn't match; image not accepted and its first sector left erased");
+   }
+   fifc.Write(flash_addr, held.data(), held.size());
+   std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+   std::string result = "OK " + std::to_string(len) + " bytes programmed in " + std::to_string(dt.count()) + "s";
+
+   // Verify: hash the flash contents, so nothing more than a chunk is held
+   if (verify)
+   {
+      printf("\nVerifying...\n");
+      std::vector<uint8_t> readback(UPDATE_CHUNK_BYTES);
+      hash.Reset();
+      for (size_t done = 0; done < len;)
+      {
+         const size_t count = std::min(UPDATE_CHUNK_BYTES, len - done);
+         fifc.Read(flash_addr + done, readback.data(), count);
+         hash.Update(readback.data(), count);
+         done += count;
+      }
+      if (!DigestsMatch(hash.Final(), expected))
+      {
+         throw std::runtime_error("Verify failed: flash doesn't match the image");
+      }
+      result += ", verified";
+   }
+   return result;
+}
+
+
+/**
+ * @brief Run the network update service: take updates one at a time, for ever
+ * @note: Doesn't return; throws if the service can't be started
+ */
+static void ServeUpdates(SPI_S25FL_c& fifc, uint16_t port, uint32_t flash_addr, const std::vector<uint8_t>& key, bool verify)
+{
+   const int listener = socket(AF_INET6, SOCK_STREAM, 0);
+   const int on = 1;
+   const int off = 0;
+   struct sockaddr_in6 addr = {};
+   addr.sin6_family = AF_INET6;
+   addr.sin6_addr = in6addr_any;
+   addr.sin6_port = htons(port);
+   if ((listener < 0)
+       || (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0)
+       || (setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) != 0)
+       || (bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+       || (listen(listener, 1) != 0))
+   {
+      throw std::runtime_error("Can't listen on port " + std::to_string(port) + ":" + strerror(errno));
+   }
+   printf("Update service listening on port %u, programming flash[%u]%s\n", port, flash_addr, key.empty() ? "; no key, so images aren't authenticated" : "");
+
+   for (;;)
+   {
+      const int fd = accept(listener, NULL, NULL);
+      if (fd < 0)
+      {
+         continue;
+      }
+
+      std::string reply;
+      try
+      {
+         reply = ReceiveUpdate(fifc, fd, flash_addr, key, verify);
+      }
+      catch (const std::exception& ex)
+      {
+         reply = std::string("ERROR ") + ex.what();
+      }
+      printf("\n%s\n", reply.c_str());
+      reply += "\n";
+      try
+      {
+         SendAll(fd, reinterpret_cast<const uint8_t*>(reply.data()), reply.size());
+      }
+      catch (const std::exception& ex)
+      {
+         printf("Can't reply to the client: %s\n", ex.what());
+      }
+      close(fd);
+   }
 }
 
 
+/**
+ * @brief Send an image to an update service
+ *
+ * @param host: Name or address of the service, with an optional :port
+ * @return true if the service programmed it
+ */
+static bool SendUpdate(const char* host, const std::vector<uint8_t>& data, const std::vector<uint8_t>& key)
+{
+   if (data.size() > UPDATE_MAX_BYTES)
+   {
+      throw std::runtime_error("Image too large to send");
+   }
+
+   // Split host:port
+   std::string name(host);
+   std::string port = std::to_string(UPDATE_DEFAULT_PORT);
+   const size_t colon = name.rfind(':');
+   if ((colon != std::string::npos) && (name.find(':') == colon))
+   {
+      port = name.substr(colon + 1);
+      name.resize(colon);
+   }
+
+   struct addrinfo hints = {};
+   struct addrinfo* found = NULL;
+   hints.ai_socktype = SOCK_STREAM;
+   const int err = getaddrinfo(name.c_str(), port.c_str(), &hints, &found);
+   if (err != 0)
+   {
+      throw std::runtime_error(std::string("Can't find ") + host + ":" + gai_strerror(err));
+   }
+   int fd = -1;
+   for (struct addrinfo* ai = found; ai && (fd < 0); ai = ai->ai_next)
+   {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if ((fd >= 0) && (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0))
+      {
+         close(fd);
+         fd = -1;
+      }
+   }
+   freeaddrinfo(found);
+   if (fd < 0)
+   {
+      throw std::runtime_error(std::string("Can't connect to ") + host + ":" + strerror(errno));
+   }
+
+   // Header, then the image
+   HMAC_SHA256_c hash(key);
+   hash.Update(data.data(), data.size());
+   const sha256_digest_t digest = hash.Final();
+   uint8_t header[UPDATE_HEADER_BYTES];
+   memcpy(header, "SPIU", 4);
+   header[4] = static_cast<uint8_t>(data.size() >> 24);
+   header[5] = static_cast<uint8_t>(data.size() >> 16);
+   header[6] = static_cast<uint8_t>(data.size() >> 8);
+   header[7] = static_cast<uint8_t>(data.size());
+   memcpy(header + 8, digest.data(), digest.size());
+
+   std::string reply;
+   try
+   {
+      SendAll(fd, header, sizeof(header));
+      SendAll(fd, data.data(), data.size());
+
+      // The reply comes once the service has finished programming
+      char buf[256];
+      ssize_t count;
+      while ((count = recv(fd, buf, sizeof(buf), 0)) > 0)
+      {
+         reply.append(buf, count);
+      }
+   }
+   catch (...)
+   {
+      close(fd);
+      throw;
+   }
+   close(fd);
+
+   if (reply.empty())
+   {
+      reply = "ERROR no reply from the service\n";
+   }
+   printf("%s: %s", host, reply.c_str());
+   return reply.compare(0, 2, "OK") == 0;
+}
+
 
 /**
  * @brief Verify the existance of a file 
@@ -181,7 +719,9 @@ static bool FileCheck(const char* fname, int perm = R_OK)
 static void PrintUsage(void)
 {
    printf("\nspi-loader V1.2 copyright 2019 RHS Research LLC"
-	      "\nUsage: spi-loader [-a flashaddr] [-b fileoffset] [-l len] [-d device] [-r deviceoffset] [-f binary file] [-m mcs file]"
+	      "\nUsage: spi-loader [-a flashaddr] [-b fileoffset] [-l len] [-d device] [-r deviceoffset] [-f binary file] [-m mcs file] [-c] [-v]"
+          "\n       spi-loader -n port [-a flashaddr] [-d device] [-r deviceoffset] [-k keyfile] [-v]"
+          "\n       spi-loader -s host[:port] [-b fileoffset] [-l len] [-f binary file] [-m mcs file] [-k keyfile]"
           "\n Loads len bytes from file at fileoffset into flash at address flashaddr\n"
 
           "\n Programming specification options"
@@ -196,10 +736,16 @@ static void PrintUsage(void)
           "\n   -r: Address (offset) of AXI-SPI core in device file"
 
           "\n Other options"
+          "\n   -c: Only erase and program sectors that differ from the file"
           "\n   -v: Verify after programming"
 
+          "\n Network update options"
+          "\n   -n: Run as an update service on this TCP port, programming each image received"
+          "\n   -s: Send the file to the update service at host (default port %u) instead of programming it here"
+          "\n   -k: Key file shared by service and sender; images must be signed with it"
+
           "\n Note: Numeric values default to decimal, unless prefixed with 0x\n"
-          );
+          , UPDATE_DEFAULT_PORT);
 }
 
 /**
@@ -247,10 +793,14 @@ int main(int argc, char* argv[])
       long int srcInx = 0;
       long int dstInx = 0x680000;      // Default to safe area outside of bootloader area
       bool verify = false;
+      bool changed_only = false;
+      long int servePort = 0;
+      char* sendHost = NULL;
+      char* keyFile = NULL;
 
       // Process command line args
       int option;
-      while ((option = getopt(argc, argv, "a:b:l:d:r:f:m:v")) != -1)
+      while ((option = getopt(argc, argv, "a:b:l:d:r:f:m:n:s:k:cv")) != -1)
       {
          switch (option)
          {
@@ -283,18 +833,51 @@ int main(int argc, char* argv[])
             dataFileMCS = optarg;
             break;
 
+         case 'c':
+            changed_only = true;
+            break;
 
          case 'v':
             verify = true;
             break;
 
+         case 'n':
+            servePort = strtol(optarg, NULL, 0);
+            break;
+
+         case 's':
+            sendHost = optarg;
+            break;
+
+         case 'k':
+            keyFile = optarg;
+            break;
+
          default:
             break;
          }
       }
 
+      // Key shared with the update service, if any
+      std::vector<uint8_t> key;
+      if (keyFile)
+      {
+         key = LoadKey(keyFile);
+      }
+
+      if (servePort)
+      {
+         // The service is sent its images, so has no file of its own
+         if (dataFileBIN || dataFileMCS || sendHost || changed_only || (servePort < 1) || (servePort > 65535))
+         {
+            printf("The update service (-n) takes a port number, and no file (-f/-m), -s or -c\n");
+            return 1;
+// << early exit
+         }
+      }
+
       // Make sure the user specified a data file to load into flash
-      if ((!dataFileBIN) && (!dataFileMCS))
+      else if ((!dataFileBIN) && (!dataFileMCS))
       {
          PrintUsage();
          return 1;
@@ -318,6 +901,15 @@ int main(int argc, char* argv[])
       }
 
 
+      // Send the file to an update service, rather than program it here
+      if (sendHost)
+      {
+         std::vector<uint8_t> data_to_send = dataFileMCS ? LoadMCS(dataFileMCS) : LoadBin(dataFileBIN, srcInx, byteLen);
+         printf("Sending %zu bytes from %s to %s\n", data_to_send.size(), dataFileMCS ? dataFileMCS : dataFileBIN, sendHost);
+         return SendUpdate(sendHost, data_to_send, key) ? 0 : 1;
+// << early exit
+      }
+
       // Make sure the device file to access the AXI-SPI block exists
       if (!FileCheck(cfg.dev_fname, R_OK | W_OK))
       {
@@ -326,6 +918,19 @@ int main(int argc, char* argv[])
 // << early exit
       }
 
+      // Run the update service instead of programming a file
+      if (servePort)
+      {
+         gAXI_FNAME = cfg.dev_fname;
+         SPI_S25FL_c fifc;
+         fifc.RegisterStatusCallback(MyStatusCallback);
+         printf("\nInitializing...\n");
+         fifc.Init(cfg);
+         ServeUpdates(fifc, static_cast<uint16_t>(servePort), dstInx, key, verify);
+         return 1;
+// << early exit
+      }
+
       // Load file
       std::vector<uint8_t> data_to_write;
       if (dataFileMCS)
@@ -373,19 +978,24 @@ int main(int argc, char* argv[])
       // Mark erase/program start
       const auto elap_start = std::chrono::steady_clock::now();
 
-      // Erase
-      printf("\nErasing...\n");
       auto start = std::chrono::steady_clock::now();
-      fifc.EraseRange(dstInx, data_to_write.size());
-      std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
-      printf("\nErased in %.3fs...\n", dt.count());
-
-      // Program
-      printf("\nProgramming...\n");
-      start = std::chrono::steady_clock::now();
-      fifc.Write(dstInx, data_to_write.data(), data_to_write.size());
-      dt = std::chrono::steady_clock::now() - start;
-      printf("\nProgrammed in %.3fs...\n", dt.count());
+      std::chrono::duration<double> dt;
+      if (changed_only)
+      {
+         // Compare, then erase and program changed sectors only
+         printf("\nUpdating changed sectors...\n");
+         const size_t num_changed = fifc.WriteChanged(dstInx, data_to_write.data(), data_to_write.size());
+         dt = std::chrono::steady_clock::now() - start;
+         printf("\nUpdated %zu sectors in %.3fs...\n", num_changed, dt.count());
+      }
+      else
+      {
+         // Erase and program, a sector at a time
+         printf("\nErasing and programming...\n");
+         fifc.EraseWrite(dstInx, data_to_write.data(), data_to_write.size());
+         dt = std::chrono::steady_clock::now() - start;
+         printf("\nErased and programmed in %.3fs...\n", dt.count());
+      }
 
       // Report erase/program time
       dt = std::chrono::steady_clock::now() - elap_start;
@@ -397,15 +1007,14 @@ int main(int argc, char* argv[])
          printf("\nVerifying...\n");
          start = std::chrono::steady_clock::now();
 
-         // Read section into vector
-         std::vector<uint8_t> tmp(data_to_write.size());
-         fifc.Read(dstInx, tmp.data(), tmp.size());
+         // Compare flash with the file as it is read
+         const bool verified = fifc.Verify(dstInx, data_to_write.data(), data_to_write.size());
 
          dt = std::chrono::steady_clock::now() - start;
          printf("\nRead in %.3fs...\n", dt.count());
 
          // Check and report
-         if (tmp != data_to_write)
+         if (!verified)
          {
             printf("\nVerify failed\n");
             return 1; 
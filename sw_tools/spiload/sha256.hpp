@@ -0,0 +1,231 @@
+//-----------------------------------------------------------------------------
+// Name: sha256.hpp
+// Description: SHA-256 and HMAC-SHA256, updated a block of data at a time, so
+// an image can be checked as it is received rather than once it is all held
+//-----------------------------------------------------------------------------
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+typedef std::array<uint8_t, 32> sha256_digest_t;
+
+class SHA256_c
+{
+
+public:
+
+   SHA256_c()
+   {
+      Reset();
+   }
+
+/**
+ * @brief Start a new hash
+ */
+   void Reset(void)
+   {
+      static const uint32_t init[8] =
+      {
+         0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+      };
+      memcpy(mState, init, sizeof(mState));
+      mTotal = 0;
+      mFill = 0;
+   }
+
+/**
+ * @brief Add data to the hash
+ *
+ * @param src: Pointer to the data
+ * @param len: Number of bytes
+ */
+   void Update(const uint8_t* src, size_t len)
+   {
+      mTotal += len;
+      if (mFill)
+      {
+         const size_t count = std::min(len, BLOCK_BYTES - mFill);
+         memcpy(mBlock + mFill, src, count);
+         mFill += count;
+         src += count;
+         len -= count;
+         if (mFill < BLOCK_BYTES)
+         {
+            return;
+         }
+         Transform(mBlock);
+         mFill = 0;
+      }
+      for (; len >= BLOCK_BYTES; src += BLOCK_BYTES, len -= BLOCK_BYTES)
+      {
+         Transform(src);
+      }
+      memcpy(mBlock, src, len);
+      mFill = len;
+   }
+
+/**
+ * @brief Finish the hash
+ * @return The digest. The object must be Reset before it is used again
+ */
+   sha256_digest_t Final(void)
+   {
+      const uint64_t bits = mTotal * 8;
+      uint8_t pad[BLOCK_BYTES + 8] = {0x80};
+      const size_t padlen = ((mFill < 56) ? 56 : 120) - mFill;
+      for (int i = 0; i < 8; i++)
+      {
+         pad[padlen + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+      }
+      Update(pad, padlen + 8);
+
+      sha256_digest_t digest;
+      for (int i = 0; i < 32; i++)
+      {
+         digest[i] = static_cast<uint8_t>(mState[i / 4] >> (24 - 8 * (i % 4)));
+      }
+      return digest;
+   }
+
+   static constexpr size_t BLOCK_BYTES = 64;
+
+private:
+
+   static uint32_t Rotr(uint32_t x, int n)
+   {
+      return (x >> n) | (x << (32 - n));
+   }
+
+//--------------------------------------------------------------------------------
+// Transform
+// Hash one 64 byte block into the state
+//--------------------------------------------------------------------------------
+   void Transform(const uint8_t* block)
+   {
+      static const uint32_t k[64] =
+      {
+         0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+         0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+         0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+         0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+         0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+         0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+         0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+         0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+      };
+      uint32_t w[64];
+      for (int i = 0; i < 16; i++)
+      {
+         w[i] = (static_cast<uint32_t>(block[4 * i]) << 24) | (block[4 * i + 1] << 16) | (block[4 * i + 2] << 8) | block[4 * i + 3];
+      }
+      for (int i = 16; i < 64; i++)
+      {
+         const uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+         const uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+         w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+      uint32_t a = mState[0], b = mState[1], c = mState[2], d = mState[3];
+      uint32_t e = mState[4], f = mState[5], g = mState[6], h = mState[7];
+      for (int i = 0; i < 64; i++)
+      {
+         const uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+         const uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+         h = g;
+         g = f;
+         f = e;
+         e = d + t1;
+         d = c;
+         c = b;
+         b = a;
+         a = t1 + t2;
+      }
+      mState[0] += a;
+      mState[1] += b;
+      mState[2] += c;
+      mState[3] += d;
+      mState[4] += e;
+      mState[5] += f;
+      mState[6] += g;
+      mState[7] += h;
+   }
+
+   uint32_t mState[8];
+   uint64_t mTotal;
+   uint8_t mBlock[BLOCK_BYTES];
+   size_t mFill;
+};
+
+
+/**
+ * @brief HMAC-SHA256: a hash keyed with a shared secret, so only a holder of the key
+ * can produce a digest that matches. With an empty key it is a plain SHA-256
+ */
+class HMAC_SHA256_c
+{
+
+public:
+
+   explicit HMAC_SHA256_c(const std::vector<uint8_t>& key) :
+      mKeyed(!key.empty())
+   {
+      uint8_t block[SHA256_c::BLOCK_BYTES] = {};
+      if (key.size() > sizeof(block))
+      {
+         SHA256_c keyhash;
+         keyhash.Update(key.data(), key.size());
+         const sha256_digest_t digest = keyhash.Final();
+         memcpy(block, digest.data(), digest.size());
+      }
+      else if (mKeyed)
+      {
+         memcpy(block, key.data(), key.size());
+      }
+      for (size_t i = 0; i < sizeof(block); i++)
+      {
+         mInnerPad[i] = block[i] ^ 0x36;
+         mOuterPad[i] = block[i] ^ 0x5c;
+      }
+      Reset();
+   }
+
+/**
+ * @brief Start a new digest
+ */
+   void Reset(void)
+   {
+      mInner.Reset();
+      if (mKeyed)
+      {
+         mInner.Update(mInnerPad, sizeof(mInnerPad));
+      }
+   }
+
+   void Update(const uint8_t* src, size_t len)
+   {
+      mInner.Update(src, len);
+   }
+
+   sha256_digest_t Final(void)
+   {
+      sha256_digest_t digest = mInner.Final();
+      if (mKeyed)
+      {
+         SHA256_c outer;
+         outer.Update(mOuterPad, sizeof(mOuterPad));
+         outer.Update(digest.data(), digest.size());
+         digest = outer.Final();
+      }
+      return digest;
+   }
+
+private:
+
+   bool mKeyed;
+   uint8_t mInnerPad[SHA256_c::BLOCK_BYTES];
+   uint8_t mOuterPad[SHA256_c::BLOCK_BYTES];
+   SHA256_c mInner;
+};
@@ -6,10 +6,12 @@
 
 #include "xspi.h"
 
+#include <chrono>
 #include <cstring>
 #include <functional>
 #include <mutex>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 //-------------------------------------------------------------------------------------//
@@ -75,6 +77,9 @@ public:
       // Get up and running, then disable interrupts before calling any other functions
       XSpi_Start(&mSPI);
       XSpi_IntrGlobalDisable(&mSPI);
+
+      // Find the erase granularity of the part fitted
+      ReadSectorSize();
    }
 
 /**
@@ -99,10 +104,7 @@ public:
    void EraseRange(uint32_t addr, size_t len)
    {
       // We don't support erase/write if not on an even sector boundary
-      if (addr & (FLASH_ENFORCED_SECTOR_BYTES - 1))
-      {
-         throw std::runtime_error("Flash address must be on an even page of " + std::to_string(FLASH_ENFORCED_SECTOR_BYTES) + " bytes");
-      }
+      CheckSectorAligned(addr);
 
       std::lock_guard<decltype(mMutex)> lock(mMutex);
 
@@ -112,12 +114,13 @@ public:
       // For now, no range checking. Just erase
       size_t num_sectors_erased = 0;
       size_t erased_bytes = 0;
+      StartProgress();
       while (erased_bytes < len)
       {
          WriteEnable();
          SectorErase(addr + erased_bytes);
-         erased_bytes += FLASH_SECTOR_BYTES;
-         SayStatus("Erased Sector", static_cast<double>(erased_bytes) / static_cast<double>(len));
+         erased_bytes += mSectorBytes;
+         SayProgress("Erased", std::min(erased_bytes, len), len);
          num_sectors_erased++;
       }
 
@@ -152,51 +155,268 @@ public:
 
       // Clear error bits
       ClearStatusRegister();
+      StartProgress();
 
-      // We can write a page at a time
+      // We can write a page at a time. The flash only takes one page per program command,
+      // so the next page's command is built while the previous page is still programming:
+      // the busy wait is left to WriteEnable(), just before the flash is needed again.
       while (numwritten < len)
       {
          // Write up to one page
          const auto flash_page_bytes = FLASH_PAGE_BYTES;  // Needed to compile C++11/C++14. Fixed in C++17. See https://stackoverflow.com/questions/8016780/undefined-reference-to-static-constexpr-char
          const size_t real_count = std::min(flash_page_bytes, len - numwritten);
+         ProgramPage(flash_addr, src + numwritten, real_count);
+
+         flash_addr += real_count;
+         numwritten += real_count;
+
+         // Report status
+         SayProgress("Wrote", numwritten, len);
+      }
+
+      // Check for errors
+      const auto stat = GetStatusRegister();
+      if (stat & SR_ANY_ERR_MASK)
+      {
+         SayStatus("Warning: Flash indicated an error while writing");
+      }
+
+   }
+
+
+/**
+ * @brief Erase and write a region of flash in one pass
+ *
+ * @note: Each sector's erase is started, then the pages of it that need programming
+ * (those not all 0xFF) are found while it erases, and programmed as soon as it is done;
+ * then the next sector. As with EraseRange, the last sector is erased in full, even past len
+ *
+ * @param flash_addr: First address to write (must be on a sector boundary)
+ * @param src: Pointer to source data
+ * @param len: Number of bytes to write
+ */
+   void EraseWrite(uint32_t flash_addr, const uint8_t* src, const size_t len)
+   {
+      CheckSectorAligned(flash_addr);
+
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+      std::vector<size_t> pages;
+      pages.reserve(mSectorBytes / FLASH_PAGE_BYTES);
+      size_t numdone = 0;
 
-         // Optimize- skip whole pages of 0xFF
-         bool skip = true;
-         for (size_t xx = 0; xx < real_count; xx++)
+      // Clear error bits
+      ClearStatusRegister();
+      StartProgress();
+
+      while (numdone < len)
+      {
+         // Start the sector erasing
+         const auto flash_page_bytes = FLASH_PAGE_BYTES;  // Copy needed to compile C++11/C++14, as in Write()
+         const size_t sector_count = std::min(mSectorBytes, len - numdone);
+         const uint32_t sector_addr = flash_addr + numdone;
+         WriteEnable();
+         SectorErase(sector_addr);
+
+         // Plan its pages while it erases
+         pages.clear();
+         for (size_t inx = 0; inx < sector_count; inx += FLASH_PAGE_BYTES)
          {
-            if (src[numwritten + xx] != 0xFF)
+            if (!IsBlank(src + numdone + inx, std::min(flash_page_bytes, sector_count - inx)))
             {
-               skip = false;
-               break;
+               pages.push_back(inx);
             }
          }
 
-         // Only execute the command if its not all FF
-         if (!skip)
+         // Program them. The first waits for the erase, each after for the page before
+         for (const size_t inx : pages)
          {
-            WriteEnable();
-            StartCommand(CMD_PAGEPROGRAM_WRITE);
-            AddAddr(flash_addr);
-            AddFromBuffer(src + numwritten, real_count);
-            Execute(0);
+            SendPageProgram(sector_addr + inx, src + numdone + inx, std::min(flash_page_bytes, sector_count - inx));
          }
+         numdone += sector_count;
 
-         flash_addr += real_count;
-         numwritten += real_count;
+         // Report status
+         SayProgress("Erased and wrote", numdone, len);
+      }
+
+      // Check for errors
+      WaitForFlashNotBusy(FLASH_ERASE_TIMEOUT_S);
+      const auto stat = GetStatusRegister();
+      if (stat & SR_ANY_ERR_MASK)
+      {
+         SayStatus("Warning: Flash indicated an error while writing");
+      }
+   }
+
+
+/**
+ * @brief Update flash to hold new data, rewriting only the sectors that differ
+ *
+ * @note: Each sector is read back and compared with the new data. A sector that differs is
+ * erased, unless the new data only clears bits, then programmed; a sector that matches is
+ * left alone. As with EraseRange, a rewritten sector is erased in full, even past len
+ *
+ * @param flash_addr: First address to update (must be on a sector boundary)
+ * @param src: Pointer to new data
+ * @param len: Number of bytes to update
+ * @return The number of sectors rewritten
+ */
+   size_t WriteChanged(uint32_t flash_addr, const uint8_t* src, const size_t len)
+   {
+      // We don't support erase/write if not on an even sector boundary
+      CheckSectorAligned(flash_addr);
+
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+      std::vector<uint8_t> current(mSectorBytes);
+      size_t numchecked = 0;
+      size_t num_sectors_written = 0;
+
+      // Clear error bits
+      ClearStatusRegister();
+      StartProgress();
+
+      while (numchecked < len)
+      {
+         // Read back up to one sector
+         const auto flash_page_bytes = FLASH_PAGE_BYTES;  // Copy needed to compile C++11/C++14, as in Write()
+         const size_t sector_count = std::min(mSectorBytes, len - numchecked);
+         const uint32_t sector_addr = flash_addr + numchecked;
+         StartRead(sector_addr);
+         ContinueRead(current.data(), sector_count, true);
+
+         // Rewrite it if different. Programming can only clear bits, so erase unless that is all that's needed
+         if (memcmp(current.data(), src + numchecked, sector_count) != 0)
+         {
+            bool need_erase = false;
+            for (size_t xx = 0; xx < sector_count; xx++)
+            {
+               if ((current[xx] & src[numchecked + xx]) != src[numchecked + xx])
+               {
+                  need_erase = true;
+                  break;
+               }
+            }
+            if (need_erase)
+            {
+               WriteEnable();
+               SectorErase(sector_addr);
+            }
+            for (size_t inx = 0; inx < sector_count; inx += FLASH_PAGE_BYTES)
+            {
+               ProgramPage(sector_addr + inx, src + numchecked + inx, std::min(flash_page_bytes, sector_count - inx));
+            }
+            num_sectors_written++;
+         }
+
+         numchecked += sector_count;
 
          // Report status
-         std::stringstream ss;
-         ss << "Wrote " << numwritten << " bytes";
-         SayStatus(ss.str(), static_cast<double>(numwritten) / static_cast<double>(len));
+         SayProgress("Checked", numchecked, len);
+      }
+
+      // Check for errors
+      WaitForFlashNotBusy(FLASH_ERASE_TIMEOUT_S);
+      const auto stat = GetStatusRegister();
+      if (stat & SR_ANY_ERR_MASK)
+      {
+         SayStatus("Warning: Flash indicated an error while writing");
+      }
+
+      return num_sectors_written;
+   }
+
+
+/**
+ * @brief Start programming data that arrives a piece at a time
+ *
+ * @note: Nothing is erased yet. StreamWrite erases each sector when the data first
+ * reaches it, so erasing is spread across the stream instead of done up front,
+ * and the data for the rest of the image can be received while a sector erases
+ *
+ * @param flash_addr: First address to write (must be on a sector boundary)
+ * @param total_len: Number of bytes that will be streamed, for progress reports
+ */
+   void StartStream(uint32_t flash_addr, size_t total_len)
+   {
+      // We don't support erase/write if not on an even sector boundary
+      CheckSectorAligned(flash_addr);
+
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+      mStreamAddr = flash_addr;
+      mStreamErasedTo = flash_addr;
+      mStreamStart = flash_addr;
+      mStreamTotal = total_len;
+      mStreamPageFill = 0;
+
+      // Clear error bits
+      ClearStatusRegister();
+      StartProgress();
+   }
+
+/**
+ * @brief Program the next piece of a stream started by StartStream
+ *
+ * @note: Whole pages are programmed straight from src; a part page is kept until
+ * the next call fills it, or EndStream
+ *
+ * @param src: Pointer to the data
+ * @param len: Number of bytes (any size)
+ */
+   void StreamWrite(const uint8_t* src, size_t len)
+   {
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+      while (len)
+      {
+         if ((mStreamPageFill == 0) && (len >= FLASH_PAGE_BYTES))
+         {
+            StreamPage(src);
+            src += FLASH_PAGE_BYTES;
+            len -= FLASH_PAGE_BYTES;
+         }
+         else
+         {
+            const size_t count = std::min(len, FLASH_PAGE_BYTES - mStreamPageFill);
+            memcpy(mStreamPage + mStreamPageFill, src, count);
+            mStreamPageFill += count;
+            src += count;
+            len -= count;
+            if (mStreamPageFill == FLASH_PAGE_BYTES)
+            {
+               StreamPage(mStreamPage);
+               mStreamPageFill = 0;
+            }
+         }
+      }
+   }
+
+/**
+ * @brief Finish a stream: program any part page left, and wait for the flash
+ * @return The number of bytes programmed
+ */
+   size_t EndStream(void)
+   {
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+      if (mStreamPageFill)
+      {
+         memset(mStreamPage + mStreamPageFill, 0xFF, FLASH_PAGE_BYTES - mStreamPageFill);
+         StreamPage(mStreamPage);
+         mStreamAddr -= FLASH_PAGE_BYTES - mStreamPageFill;
+         mStreamPageFill = 0;
       }
 
       // Check for errors
+      WaitForFlashNotBusy(FLASH_ERASE_TIMEOUT_S);
       const auto stat = GetStatusRegister();
       if (stat & SR_ANY_ERR_MASK)
       {
          SayStatus("Warning: Flash indicated an error while writing");
       }
 
+      return mStreamAddr - mStreamStart;
    }
 
 
@@ -211,27 +431,82 @@ public:
    {
       size_t numread = 0;
 
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+      if (0 == len)
+      {
+         return;
+      }
+
+      // One read command for the whole range; the data is received straight into dst
+      StartProgress();
+      StartRead(flash_addr);
       while (numread < len)
       {
-         // zzqq can read cross page boundary?
-         StartCommand(CMD_RANDOM_READ);
-         AddAddr(flash_addr);
+         // Read up to one chunk
+         const auto flash_read_chunk_bytes = FLASH_READ_CHUNK_BYTES;  // Needed to compile C++11/C++14, as in Write()
+         const size_t real_count = std::min(flash_read_chunk_bytes, len - numread);
+         ContinueRead(dst + numread, real_count, (numread + real_count) == len);
 
-         // Read up to one page
-         const auto flash_page_bytes = FLASH_PAGE_BYTES;  // Needed to compile C++11/C++14. Fixed in C++17. See https://stackoverflow.com/questions/8016780/undefined-reference-to-static-constexpr-char
-         const size_t real_count = std::min(flash_page_bytes, len - numread);
-         const auto* rezbuf = Execute(real_count);
+         numread += real_count;
+
+         // Report status
+         SayProgress("Read", numread, len);
+      }
+   }
 
-         memcpy(dst + numread, rezbuf, real_count);
 
-         flash_addr += real_count;
-         numread += real_count;
+/**
+ * @brief Compare flash with a buffer, without reading the flash into a second buffer
+ *
+ * @param flash_addr: Flash address to compare from
+ * @param src: Data the flash should hold
+ * @param len: Number of bytes to compare
+ * @return true if the flash matches src
+ */
+   bool Verify(uint32_t flash_addr, const uint8_t* src, const size_t len)
+   {
+      size_t numchecked = 0;
+
+      std::lock_guard<decltype(mMutex)> lock(mMutex);
+
+      if (0 == len)
+      {
+         return true;
+      }
+
+      // One read command for the whole range, checked a chunk at a time
+      StartProgress();
+      StartRead(flash_addr);
+      while (numchecked < len)
+      {
+         const auto flash_read_chunk_bytes = FLASH_READ_CHUNK_BYTES;  // Needed to compile C++11/C++14, as in Write()
+         const size_t real_count = std::min(flash_read_chunk_bytes, len - numchecked);
+         const bool last = (numchecked + real_count) == len;
+         ContinueRead(mVerifyBuf, real_count, last);
+
+         if (memcmp(mVerifyBuf, src + numchecked, real_count) != 0)
+         {
+            // Find the first difference, finish the read command, then report it
+            size_t inx = 0;
+            while (mVerifyBuf[inx] == src[numchecked + inx])
+            {
+               inx++;
+            }
+            if (!last)
+            {
+               ContinueRead(mVerifyBuf, 1, true);
+            }
+            SayStatus("Verify failed at address " + std::to_string(flash_addr + numchecked + inx), static_cast<double>(numchecked + inx) / static_cast<double>(len));
+            return false;
+         }
+
+         numchecked += real_count;
 
          // Report status
-         std::stringstream ss;
-         ss << "Read " << numread << " bytes";
-         SayStatus(ss.str(), static_cast<double>(numread) / static_cast<double>(len));
+         SayProgress("Verified", numchecked, len);
       }
+      return true;
    }
 
 
@@ -282,15 +557,32 @@ private:
 //--------------------------------------------------------------------------------
 // WaitForFlashNotBusy
 // Waits up to wait_s seconds for flash to indicate it is done with the previous operation
+// Sleeps through most of the time the same kind of command took before, then polls the
+// status register, back to back at first and then with a growing sleep between polls
 //--------------------------------------------------------------------------------
    void WaitForFlashNotBusy(double wait_s)
    {
       // Get the current time
       const auto start = std::chrono::steady_clock::now();
+      double& estimate = mBusyEstimate_s[mBusyKind];
+      const std::chrono::duration<double> so_far = start - mBusyStart;
+      const double first_sleep = (estimate * FLASH_FIRST_SLEEP_FRACTION) - so_far.count();
+      if (first_sleep >= FLASH_MIN_SLEEP_S)
+      {
+         std::this_thread::sleep_for(std::chrono::duration<double>(first_sleep));
+      }
+
+      double backoff = FLASH_MIN_POLL_S;
+      const double max_backoff = std::max(FLASH_MIN_SLEEP_S, estimate * FLASH_MAX_BACKOFF_FRACTION);
       while (1)
       {
          if ((GetStatusRegister() & SR_IS_READY_MASK) == 0)
          {
+            mFlashBusy = false;
+
+            // Learn how long this kind of command takes
+            const std::chrono::duration<double> busy = std::chrono::steady_clock::now() - mBusyStart;
+            estimate += (busy.count() - estimate) / 4.0;
             break;
          }
 
@@ -300,6 +592,13 @@ private:
          {
             throw std::runtime_error("Timeout waiting for flash ready");
          }
+
+         // Short intervals are polled back to back: a sleep can't be that short
+         if (backoff >= FLASH_MIN_SLEEP_S)
+         {
+            std::this_thread::sleep_for(std::chrono::duration<double>(backoff));
+         }
+         backoff = std::min(backoff * 2.0, max_backoff);
       }
    }
 
@@ -351,8 +650,12 @@ private:
          throw std::runtime_error("Attempt to read/write too many bytes");
       }
 
-      // Make sure flash isn't busy
-      WaitForFlashNotBusy(timeout_s);
+      // Make sure flash isn't busy. Only program, erase and status write leave it busy,
+      // so the status register is only polled after one of those
+      if (mFlashBusy)
+      {
+         WaitForFlashNotBusy(timeout_s);
+      }
 
       // Execute
       const int status = XSpi_Transfer(&mSPI, mWriteBuf, num2read ? mReadBuf : NULL, mCurrWriteBufInx + num2read);
@@ -363,6 +666,12 @@ private:
                                   + " cmd "  + std::to_string((int)mWriteBuf[0])
                                   );
       }
+      mFlashBusy = LeavesFlashBusy(mWriteBuf[0]);
+      if (mFlashBusy)
+      {
+         mBusyStart = std::chrono::steady_clock::now();
+         mBusyKind = BusyKind(mWriteBuf[0]);
+      }
 
       // Get the return value before zeroing index
       const auto rez = num2read ? (mReadBuf + mCurrWriteBufInx) : NULL; 
@@ -373,17 +682,174 @@ private:
    }
 
 
+//--------------------------------------------------------------------------------
+// LeavesFlashBusy
+// True if the flash is busy for a while after command cmd
+//--------------------------------------------------------------------------------
+   static bool LeavesFlashBusy(uint8_t cmd)
+   {
+      return (cmd == CMD_PAGEPROGRAM_WRITE) || (cmd == CMD_SECTOR_ERASE) || (cmd == CMD_STATUSREG_WRITE);
+   }
+
+
 //--------------------------------------------------------------------------------
 // WriteEnable
 // Spansion flash requires this to be sent before writing/erasing
+// Sent from its own buffer, so a command already built in the transmit buffer is kept
 //--------------------------------------------------------------------------------
    void WriteEnable(void)
    {
-      StartCommand(CMD_WRITE_ENABLE);
+      uint8_t cmd = CMD_WRITE_ENABLE;
+
+      if (mFlashBusy)
+      {
+         WaitForFlashNotBusy(FLASH_DEFAULT_CMD_TIMEOUT_S);
+      }
+
+      const int status = XSpi_Transfer(&mSPI, &cmd, NULL, 1);
+      if (status != XST_SUCCESS)
+      {
+         throw std::runtime_error("SPI transaction failed sending write enable code " + std::to_string((int)status));
+      }
+   }
+
+
+//--------------------------------------------------------------------------------
+// ProgramPage
+// Programs up to one page from src at flash_addr, skipping pages that are all 0xFF
+// Returns without waiting for the program to finish
+//--------------------------------------------------------------------------------
+   void ProgramPage(uint32_t flash_addr, const uint8_t* src, size_t len)
+   {
+      // Optimize- skip whole pages of 0xFF
+      if (!IsBlank(src, len))
+      {
+         SendPageProgram(flash_addr, src, len);
+      }
+   }
+
+
+//--------------------------------------------------------------------------------
+// SendPageProgram
+// Programs up to one page from src at flash_addr, without waiting for it to finish
+//--------------------------------------------------------------------------------
+   void SendPageProgram(uint32_t flash_addr, const uint8_t* src, size_t len)
+   {
+      StartCommand(CMD_PAGEPROGRAM_WRITE);
+      AddAddr(flash_addr);
+      AddFromBuffer(src, len);
+      WriteEnable();
       Execute(0);
    }
 
 
+//--------------------------------------------------------------------------------
+// IsBlank
+// True if len bytes at src are all 0xFF, as erased flash is
+//--------------------------------------------------------------------------------
+   static bool IsBlank(const uint8_t* src, size_t len)
+   {
+      for (size_t xx = 0; xx < len; xx++)
+      {
+         if (src[xx] != 0xFF)
+         {
+            return false;
+         }
+      }
+      return true;
+   }
+
+
+//--------------------------------------------------------------------------------
+// BusyKind
+// Which kind of busy time a command that leaves the flash busy has, for WaitForFlashNotBusy
+//--------------------------------------------------------------------------------
+   static size_t BusyKind(uint8_t cmd)
+   {
+      if (cmd == CMD_PAGEPROGRAM_WRITE)
+      {
+         return BUSY_PROGRAM;
+      }
+      if (cmd == CMD_SECTOR_ERASE)
+      {
+         return BUSY_ERASE;
+      }
+      return BUSY_OTHER;
+   }
+
+
+//--------------------------------------------------------------------------------
+// StartRead/ContinueRead
+// A read is one command, then as many bytes as wanted: the flash carries on across
+// page boundaries. StartRead sends the command; each ContinueRead then receives the
+// next len bytes into dst (which is also sent, as the flash ignores it), with the
+// last one ending the command
+//--------------------------------------------------------------------------------
+   void StartRead(uint32_t flash_addr)
+   {
+      uint8_t cmd[FLASH_MAX_CMD_BYTES];
+
+      if (mFlashBusy)
+      {
+         WaitForFlashNotBusy(FLASH_DEFAULT_CMD_TIMEOUT_S);
+      }
+
+      cmd[0] = CMD_RANDOM_READ;
+      cmd[1] = (uint8_t)(flash_addr >> 24);
+      cmd[2] = (uint8_t)(flash_addr >> 16);
+      cmd[3] = (uint8_t)(flash_addr >> 8);
+      cmd[4] = (uint8_t)(flash_addr);
+      const int status = XSpi_TransferPart(&mSPI, cmd, NULL, FLASH_MAX_CMD_BYTES, FALSE);
+      if (status != XST_SUCCESS)
+      {
+         throw std::runtime_error("SPI transaction failed starting flash read code " + std::to_string((int)status));
+      }
+   }
+
+   void ContinueRead(uint8_t* dst, size_t len, bool last)
+   {
+      const int status = XSpi_TransferPart(&mSPI, dst, dst, len, last ? TRUE : FALSE);
+      if (status != XST_SUCCESS)
+      {
+         throw std::runtime_error("SPI transaction failed reading flash code " + std::to_string((int)status));
+      }
+   }
+
+
+//--------------------------------------------------------------------------------
+// ReadSectorSize
+// Reads the flash ID to find the sector size, which is the erase granularity.
+// S25FL-S parts report their sector architecture: 0 for uniform 256K sectors.
+// Anything else is taken to have 64K sectors
+//--------------------------------------------------------------------------------
+   void ReadSectorSize(void)
+   {
+      StartCommand(CMD_READ_ID);
+      const uint8_t* id = Execute(FLASH_ID_BYTES);
+      if ((id[0] == FLASH_SPANSION_ID) && (id[3] == FLASH_S_FAMILY_CFI_LEN) && (id[4] == FLASH_UNIFORM_256K_ARCH))
+      {
+         mSectorBytes = FLASH_LARGE_SECTOR_BYTES;
+      }
+      else
+      {
+         mSectorBytes = FLASH_SECTOR_BYTES;
+      }
+   }
+
+
+//--------------------------------------------------------------------------------
+// CheckSectorAligned
+// Throws unless addr is on a sector boundary: erasing doesn't preserve the rest of a sector
+//--------------------------------------------------------------------------------
+   void CheckSectorAligned(uint32_t addr)
+   {
+      if (addr & (mSectorBytes - 1))
+      {
+         throw std::runtime_error("Flash address must be on a sector boundary of " + std::to_string(mSectorBytes) + " bytes");
+      }
+   }
+
+
 //--------------------------------------------------------------------------------
 // SectorErase
 // Erases the sector that contans address addr
@@ -396,6 +862,30 @@ private:
    }
 
 
+//--------------------------------------------------------------------------------
+// StreamPage
+// Programs one whole page at the stream address, erasing its sector first if
+// the stream hasn't reached that sector before
+//--------------------------------------------------------------------------------
+   void StreamPage(const uint8_t* src)
+   {
+      if (mStreamAddr >= mStreamErasedTo)
+      {
+         WriteEnable();
+         SectorErase(mStreamErasedTo);
+         mStreamErasedTo += mSectorBytes;
+      }
+      ProgramPage(mStreamAddr, src, FLASH_PAGE_BYTES);
+      mStreamAddr += FLASH_PAGE_BYTES;
+
+      // Report status
+      if (mStreamTotal)
+      {
+         SayProgress("Streamed", std::min(static_cast<size_t>(mStreamAddr - mStreamStart), mStreamTotal), mStreamTotal);
+      }
+   }
+
+
 //--------------------------------------------------------------------------------
 // SayStatus
 // Report status to any registered callback functions
@@ -414,6 +904,26 @@ private:
       }
    }
 
+//--------------------------------------------------------------------------------
+// StartProgress/SayProgress
+// Report progress of a long operation in whole percent steps, rather than for
+// every page or sector
+//--------------------------------------------------------------------------------
+   void StartProgress(void)
+   {
+      mLastPercent = -1;
+   }
+
+   void SayProgress(const char* action, size_t done, size_t total)
+   {
+      const int percent = static_cast<int>((100 * done) / total);
+      if (percent != mLastPercent)
+      {
+         mLastPercent = percent;
+         SayStatus(std::string(action) + " " + std::to_string(done) + " bytes", static_cast<double>(done) / static_cast<double>(total));
+      }
+   }
+
    //-------------------------------------------------------------------------------------//
    // Private data
    //-------------------------------------------------------------------------------------//
@@ -424,13 +934,23 @@ private:
    // Settings
    static constexpr double FLASH_ERASE_TIMEOUT_S = 10.0; 
    static constexpr double FLASH_DEFAULT_CMD_TIMEOUT_S = 10.0;
-   static constexpr size_t FLASH_ENFORCED_SECTOR_BYTES = 256 * 1024; // Some parts have 256K pages. 
-                                                                     // Since we don't check the part type, we must enforce the largest size
+
+   // Busy times of program and erase: first guesses, until WaitForFlashNotBusy has timed them
+   static constexpr double FLASH_PROGRAM_ESTIMATE_S = 0.0003;
+   static constexpr double FLASH_ERASE_ESTIMATE_S = 0.15;
+   static constexpr double FLASH_FIRST_SLEEP_FRACTION = 0.75;   // Of the expected busy time, slept before polling
+   static constexpr double FLASH_MAX_BACKOFF_FRACTION = 0.0625; // Of the expected busy time, the longest sleep between polls
+   static constexpr double FLASH_MIN_POLL_S = 0.00001;          // First interval between polls
+   static constexpr double FLASH_MIN_SLEEP_S = 0.0001;          // Shorter intervals are polled back to back
+   enum { BUSY_PROGRAM, BUSY_ERASE, BUSY_OTHER, BUSY_KINDS };
 
    // Sizes
    static constexpr size_t FLASH_PAGE_BYTES = 256;
    static constexpr size_t FLASH_MAX_CMD_BYTES = 5;
-   static constexpr size_t FLASH_SECTOR_BYTES = 64 * 1024;        // Not true for S25FL128xxxxxx1 devices, which have 256K
+   static constexpr size_t FLASH_SECTOR_BYTES = 64 * 1024;        // Sector size of most parts
+   static constexpr size_t FLASH_LARGE_SECTOR_BYTES = 256 * 1024; // Sector size of uniform 256K sector S25FL-S parts
+   static constexpr size_t FLASH_ID_BYTES = 6;                    // Manufacturer, device ID, ID-CFI length, sector architecture, family
+   static constexpr size_t FLASH_READ_CHUNK_BYTES = 4096;         // Bytes read between progress reports and verify checks
 
    // Commands. Note: All commands must use 4 byte addressing
    static constexpr uint8_t CMD_RANDOM_READ       = 0x13;
@@ -440,6 +960,12 @@ private:
    static constexpr uint8_t CMD_STATUSREG_READ    = 0x05;
    static constexpr uint8_t CMD_STATUSREG_WRITE   = 0x01;
    static constexpr uint8_t CMD_STATUSREG_CLEAR   = 0x30;
+   static constexpr uint8_t CMD_READ_ID           = 0x9F;
+
+   // ID values
+   static constexpr uint8_t FLASH_SPANSION_ID = 0x01;          // Manufacturer
+   static constexpr uint8_t FLASH_S_FAMILY_CFI_LEN = 0x4D;     // ID-CFI length of S25FL-S parts
+   static constexpr uint8_t FLASH_UNIFORM_256K_ARCH = 0x00;    // Sector architecture of uniform 256K sector parts
 
    // Register defs
    static constexpr uint8_t SR_IS_READY_MASK = 0x01; // D0 is 1 when busy
@@ -465,6 +991,34 @@ private:
    uint8_t mReadBuf[TOTAL_BUFFER_SIZE];
    size_t mCurrWriteBufInx = 0;
 
+   // Buffer for one chunk of flash data being verified
+   uint8_t mVerifyBuf[FLASH_READ_CHUNK_BYTES];
+
+   // True after a command that leaves the flash busy, until the status register shows it is done.
+   // Starts true as no-one knows what the flash was last asked to do
+   bool mFlashBusy = true;
+
+   // Last percentage reported by SayProgress
+   int mLastPercent = -1;
+
+   // Sector size of the part fitted, found by Init
+   size_t mSectorBytes = FLASH_SECTOR_BYTES;
+
+   // When the last command that left the flash busy was sent, its kind, and how long each
+   // kind has taken, so WaitForFlashNotBusy can sleep through most of the wait
+   std::chrono::steady_clock::time_point mBusyStart = std::chrono::steady_clock::now();
+   size_t mBusyKind = BUSY_OTHER;
+   double mBusyEstimate_s[BUSY_KINDS] = {FLASH_PROGRAM_ESTIMATE_S, FLASH_ERASE_ESTIMATE_S, 0.0};
+
+   // Stream being programmed: next address, end of the sectors erased so far,
+   // and the part page waiting for more data
+   uint32_t mStreamAddr = 0;
+   uint32_t mStreamErasedTo = 0;
+   uint32_t mStreamStart = 0;
+   size_t mStreamTotal = 0;
+   uint8_t mStreamPage[FLASH_PAGE_BYTES];
+   size_t mStreamPageFill = 0;
+
 };
 
 
@@ -2,6 +2,7 @@
 
 #include <unistd.h> // pread/pwrite
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
@@ -10,9 +11,18 @@
 // Defined somewhere else
 extern const char* gAXI_FNAME;
 
+// The BAR is memory mapped on first use, so register accesses (eg each byte written
+// to the SPI transmit FIFO) are single loads and stores rather than syscalls.
+// The BAR size isn't known: the driver refuses a map larger than the BAR, so try
+// from 1MB downwards. Accesses outside the window, or if the map fails, use pread/pwrite.
+#define MAX_AXI_MAP_BYTES 0x100000
+#define MIN_AXI_MAP_BYTES 0x20000
+
 // Static data
 static int sfAXI = -1;
 static int sComplained = 0;
+static volatile u8* sAXIMap = NULL;
+static size_t sAXIMapBytes = 0;
 
 // Static functions
 static int CheckAndOpen(void)
@@ -20,6 +30,16 @@ static int CheckAndOpen(void)
    if (sfAXI < 0)
    {
       sfAXI = open(gAXI_FNAME, O_RDWR);
+      for (size_t map_bytes = MAX_AXI_MAP_BYTES; (sfAXI >= 0) && (map_bytes >= MIN_AXI_MAP_BYTES); map_bytes >>= 1)
+      {
+         void* map = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, sfAXI, 0);
+         if (map != MAP_FAILED)
+         {
+            sAXIMap = (volatile u8*)map;
+            sAXIMapBytes = map_bytes;
+            break;
+         }
+      }
    }
 
    if ((sfAXI < 0) && !sComplained)
@@ -36,9 +56,13 @@ static int CheckAndOpen(void)
 //-------------------------------------------------------------------------------------------------
 u32 Xil_In32(UINTPTR Addr)
 {
-   u32 rez;
+   u32 rez = 0;
    if(CheckAndOpen())
    {
+      if (sAXIMap && ((Addr + sizeof(rez)) <= sAXIMapBytes))
+      {
+         return *(volatile u32*)(sAXIMap + Addr);
+      }
       ssize_t nread = pread(sfAXI, &rez, sizeof(rez), (off_t) Addr);
       if (nread != sizeof(rez))
       {
@@ -55,7 +79,12 @@ void Xil_Out32(UINTPTR Addr, u32 Value)
 {
    if(CheckAndOpen())
    {
-      ssize_t nsent = pwrite(sfAXI, &Value, sizeof(Value), (off_t) Addr); 
+      if (sAXIMap && ((Addr + sizeof(Value)) <= sAXIMapBytes))
+      {
+         *(volatile u32*)(sAXIMap + Addr) = Value;
+         return;
+      }
+      ssize_t nsent = pwrite(sfAXI, &Value, sizeof(Value), (off_t) Addr);
       if (nsent != sizeof(Value))
       {
          printf("Error writing to device:%s", strerror(errno));
@@ -557,6 +557,16 @@ void XSpi_Reset(XSpi* InstancePtr)
 // - master mode
 int XSpi_Transfer(XSpi* InstancePtr, u8* SendBufPtr,
                   u8* RecvBufPtr, unsigned int ByteCount)
+{
+   return XSpi_TransferPart(InstancePtr, SendBufPtr, RecvBufPtr, ByteCount, TRUE);
+}
+
+// Transfers part of a longer transaction, so a flash read can be streamed into
+// the caller's buffers a piece at a time under one command.
+// The slave is selected for each part, but only deselected after a part with
+// Deselect set. Otherwise as XSpi_Transfer
+int XSpi_TransferPart(XSpi* InstancePtr, u8* SendBufPtr,
+                      u8* RecvBufPtr, unsigned int ByteCount, int Deselect)
 {
    u32 ControlReg;
    u32 StatusReg;
@@ -686,7 +696,10 @@ int XSpi_Transfer(XSpi* InstancePtr, u8* SendBufPtr,
     * such as serial EEPROMs work correctly as chip enable
     * may be connected to slave select
     */
-   XSpi_SetSlaveSelectReg(InstancePtr, InstancePtr->SlaveSelectMask);
+   if (Deselect)
+   {
+      XSpi_SetSlaveSelectReg(InstancePtr, InstancePtr->SlaveSelectMask);
+   }
    InstancePtr->IsBusy = FALSE;
 
    return XST_SUCCESS;
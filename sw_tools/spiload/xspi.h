@@ -827,6 +827,8 @@ u32 XSpi_GetSlaveSelect(XSpi *InstancePtr);
 
 int XSpi_Transfer(XSpi *InstancePtr, u8 *SendBufPtr, u8 *RecvBufPtr,
 		  unsigned int ByteCount);
+int XSpi_TransferPart(XSpi *InstancePtr, u8 *SendBufPtr, u8 *RecvBufPtr,
+		      unsigned int ByteCount, int Deselect);
 
 void XSpi_SetStatusHandler(XSpi *InstancePtr, void *CallBackRef,
 			   XSpi_StatusHandler FuncPtr);